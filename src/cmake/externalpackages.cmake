@@ -185,6 +185,13 @@ if (USE_CUDA OR USE_OPTIX)
                  REQUIRED)
     set(CUDA_LIBRARIES ${cuda_lib})
 
+    # testshade's plain CUDA grid renderer links PTX with the driver API
+    find_library(cuda_driver_lib NAMES cuda
+                 PATHS "${CUDA_TOOLKIT_ROOT_DIR}/lib64" "${CUDA_TOOLKIT_ROOT_DIR}/lib64/stubs"
+                       "${CUDA_TOOLKIT_ROOT_DIR}/x64"
+                 REQUIRED)
+    set(CUDA_LIBRARIES ${CUDA_LIBRARIES} ${cuda_driver_lib})
+
     # testrender & testshade need libnvrtc
     if ("${CUDA_VERSION}" VERSION_GREATER_EQUAL "10.0")
         find_library(nvrtc_lib NAMES nvrtc
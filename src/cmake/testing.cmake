@@ -209,44 +209,55 @@ endmacro ()
 macro (osl_add_all_tests)
     # List all the individual testsuite tests here, except those that need
     # special installed tests.
-    TESTSUITE ( aastep allowconnect-err andor-reg and-or-not-synonyms
+    TESTSUITE ( aastep allowconnect-err andor-reg and-or-not-synonyms aot
                 arithmetic area-reg arithmetic-reg
                 array array-reg array-copy-reg array-derivs array-range 
-                array-aassign array-assign-reg array-length-reg
+                array-aassign array-assign-reg array-length-reg async-optimize
+                batch-builder
                 bitwise-and-reg bitwise-or-reg bitwise-shl-reg  bitwise-shr-reg bitwise-xor-reg
                 blackbody blackbody-reg blendmath breakcont breakcont-reg
                 bug-array-heapoffsets bug-locallifetime bug-outputinit
                 bug-param-duplicate bug-peep bug-return
-                calculatenormal-reg
-                cellnoise closure closure-array color color-reg colorspace comparison
-                complement-reg compile-buffer compassign-reg
+                cache-lookups calculatenormal-reg capture-replay
+                cellnoise closure closure-array closure-pool
+                closure-weight-threshold
+                color color-reg colorspace comparison
+                complement-reg compile-buffer compile-buffer-reuse
+                compassign-reg
                 component-range 
-                control-flow-reg connect-components
-                const-array-params const-array-fill
+                control-flow-reg connect-by-index connect-components
+                const-array-params const-array-fill constant-outputs
+                constfold-shadeops
+                cross-layer-cse
                 debugnan debug-uninit
-                derivs derivs-muldiv-clobber
+                deriv-axes derivs derivs-muldiv-clobber
                 draw_string
-                error-dupes error-serialized
+                error-dupes error-serialized execute-many
                 example-deformer
                 example-batched-deformer
                 exit exponential
                 filterwidth-reg
                 for-reg format-reg fprintf
                 function-earlyreturn function-simple function-outputelem
-                function-overloads function-redef
-                geomath getattribute-camera getattribute-shader
+                function-overloads function-redef function-return-fold
+                geomath getattribute-camera getattribute-constant
+                getattribute-handles getattribute-shader
                 getsymbol-nonheap gettextureinfo gettextureinfo-reg
                 globals-needed
-                group-outputs groupstring
+                group-outputs groupdata-layout groupdata-share
+                groupstring
                 hash hashnoise hex hyperb
-                ieee_fp ieee_fp-reg if if-reg incdec initlist initops intbits isconnected
-                isconstant
+                ieee_fp ieee_fp-reg if if-reg incdec initlist initops instance-params intbits
+                isconnected isconstant jit-lazy json
                 layers layers-Ciassign layers-entry layers-lazy layers-lazyerror
-                layers-nonlazycopy layers-repeatedoutputs
-                length-reg linearstep
-                logic loop luminance-reg
+                layers-nonlazycopy layers-repeatedoutputs layers-upfront
+                length-reg linearstep llvm-vectorize
+                logic loop loop-invariants luminance-reg
+                math-precision
                 matrix matrix-reg matrix-arithmetic-reg
-                matrix-compref-reg max-reg message message-no-closure message-reg
+                matrix-compref-reg max-reg message message-many
+                message-no-closure message-slots
+                message-reg
                 mergeinstances-duplicate-entrylayers
                 mergeinstances-nouserdata mergeinstances-vararray
                 metadata-braces min-reg miscmath missing-shader
@@ -254,17 +265,17 @@ macro (osl_add_all_tests)
                 named-components
                 noise noise-cell
                 noise-gabor noise-gabor2d-filter noise-gabor3d-filter
-                noise-gabor-reg
-                noise-generic
+                noise-gabor-reg noise-gabor-fast
+                noise-fbm noise-generic
                 noise-perlin noise-simplex
                 noise-reg
-                normalize-reg
+                normalize-reg object-attributes
                 pnoise pnoise-cell pnoise-gabor 
                 pnoise-generic pnoise-perlin
                 pnoise-reg
                 operator-overloading
-                opt-warnings
-                oslc-comma oslc-D oslc-M
+                opt-pass-limits opt-warnings
+                oslc-comma oslc-D oslc-M oslc-O2
                 oslc-err-arrayindex oslc-err-assignmenttypes
                 oslc-err-closuremul oslc-err-field
                 oslc-err-format oslc-err-funcoverload
@@ -277,23 +288,25 @@ macro (osl_add_all_tests)
                 oslc-err-struct-dup oslc-err-struct-print
                 oslc-err-type-as-variable
                 oslc-err-unknown-ctr
+                oslc-header-cache oslc-multifile
                 oslc-pragma-warnerr
                 oslc-warn-commainit
                 oslc-variadic-macro
                 oslc-version
                 oslinfo-arrayparams oslinfo-colorctrfloat
-                oslinfo-metadata oslinfo-noparams
-                osl-imageio
+                oslinfo-json oslinfo-metadata oslinfo-noparams
+                osl-imageio oso-binary output-variants
                 paramval-floatpromotion
-                pragma-nowarn
+                pragma-nowarn prefetch-textures
                 printf-reg
                 printf-whole-array
-                raytype raytype-reg raytype-specialized regex-reg reparam
+                range-check-elision
+                raytype raytype-reg raytype-specialized raytype-variants regex-reg reparam reparam-reoptimize
                 render-background render-bumptest
                 render-cornell render-furnace-diffuse
-                render-microfacet render-oren-nayar
+                render-microfacet render-oren-nayar render-progressive
                 render-uv render-veachmis render-ward
-                select select-reg shaderglobals shortcircuit
+                select select-reg shader-bundle shaderglobals shortcircuit
                 smoothstep-reg 
                 spline spline-reg splineinverse splineinverse-ident 
                 splineinverse-knots-ascend-reg splineinverse-knots-descend-reg
@@ -306,16 +319,16 @@ macro (osl_add_all_tests)
                 struct-operator-overload struct-return struct-with-array
                 struct-nested struct-nested-assign struct-nested-deep
                 ternary
-                testshade-expr
+                testshade-bench testshade-expr
                 texture-alpha texture-alpha-derivs
-                texture-blur texture-connected-options
+                texture-batched texture-blur texture-coalesce texture-connected-options
                 texture-derivs texture-environment texture-errormsg
                 texture-environment-opts-reg
                 texture-firstchannel texture-interp
                 texture-missingalpha texture-missingcolor texture-opts-reg texture-simple
                 texture-smallderivs texture-swirl texture-udim
                 texture-width texture-withderivs texture-wrap
-                trace-reg
+                trace-deferred trace-reg
                 trailing-commas
                 transcendental-reg
                 transitive-assign
@@ -343,7 +356,12 @@ macro (osl_add_all_tests)
     # because the Python interpreter itself won't be linked with the right asan
     # libraries to run correctly.
     if (USE_PYTHON AND NOT SANITIZE_ON_LINUX)
-        TESTSUITE ( python-oslquery )
+        TESTSUITE ( python-dedupe-groups python-jit-cache
+                    python-jit-concurrent python-jit-evict python-jit-lazy
+                    python-jit-memory python-jit-orc python-jit-pgo
+                    python-jit-tiered python-oslexec python-oslquery
+                    python-reload-shader python-stats
+                    python-userdata-soa )
     endif ()
 
     # Only run openvdb-related tests if the local OIIO has openvdb support.
@@ -355,7 +373,8 @@ macro (osl_add_all_tests)
 
     # Only run pointcloud tests if Partio is found
     if (PARTIO_FOUND)
-        TESTSUITE ( pointcloud pointcloud-fold )
+        TESTSUITE ( pointcloud pointcloud-fold pointcloud-index
+                    pointcloud-paged )
     endif ()
 
     # Only run the OptiX tests if OptiX and CUDA are found
@@ -370,4 +389,32 @@ macro (osl_add_all_tests)
     endif ()
     set_tests_properties (matrix-reg.regress.rsbitcode.opt PROPERTIES TIMEOUT 800)
         
+    # "make osl_perf" runs the performance testsuite in testsuite/perf in
+    # every shading mode we built, comparing against the baselines in
+    # OSL_PERF_BASELINE_DIR.  It isn't part of ctest, since timings are
+    # only meaningful on a quiet machine.  Use OSL_PERF_ARGS to pass more
+    # arguments to runperf.py, such as "--update" to store new baselines.
+    set (OSL_PERF_BASELINE_DIR "${CMAKE_SOURCE_DIR}/testsuite/perf/baselines"
+         CACHE PATH "Directory of baseline results for the osl_perf target")
+    set (OSL_PERF_ARGS "" CACHE STRING "Extra arguments for testsuite/perf/runperf.py")
+    set (_perf_modes scalar)
+    if (BUILD_BATCHED)
+        list (APPEND _perf_modes batched)
+    endif ()
+    if (USE_OPTIX)
+        list (APPEND _perf_modes optix)
+    endif ()
+    separate_arguments (_perf_args UNIX_COMMAND "${OSL_PERF_ARGS}")
+    add_custom_target (osl_perf
+        COMMAND ${Python_EXECUTABLE} "${CMAKE_SOURCE_DIR}/testsuite/perf/runperf.py"
+                --testshade $<TARGET_FILE:testshade>
+                --oslc $<TARGET_FILE:oslc>
+                --workdir "${CMAKE_BINARY_DIR}/testsuite/perf"
+                --baselines "${OSL_PERF_BASELINE_DIR}"
+                --modes ${_perf_modes}
+                ${_perf_args}
+        DEPENDS testshade oslc
+        USES_TERMINAL
+        COMMENT "Running the performance testsuite")
+
 endmacro()
@@ -137,7 +137,7 @@ makeIdentity(Matrix44 &m)
 // affineInverse - fast path that is SIMD friendly
 // nonAffineInverse - slow path to be used outside SIMD loop to
 //                    handle any non-affine matrices
-static OSL_FORCEINLINE bool test_if_affine(const Matrix44 & m) {
+static OSL_FORCEINLINE OSL_HOSTDEVICE bool test_if_affine(const Matrix44 & m) {
 	using ScalarT = typename Matrix44::BaseType;
     return (m.x[0][3] == ScalarT(0)) &
            (m.x[1][3] == ScalarT(0)) &
@@ -363,6 +363,18 @@ Matrix44 OSL_HOSTDEVICE nonAffineInverse(const Matrix44 &source)
 }
 
 
+// General purpose inverse of a Matrix44: take the affine fast path when
+// we can, and Gauss-Jordan elimination otherwise.  Gives the same results
+// as Matrix44::inverse(), but is inlinable and never throws.
+static OSL_FORCEINLINE OSL_HOSTDEVICE Matrix44
+inlinedInverse(const Matrix44 &m)
+{
+    if (OSL_LIKELY(test_if_affine(m)))
+        return affineInverse(m);
+    return nonAffineInverse(m);
+}
+
+
 // In order to have inlinable Matrix44*float
 // Override with a more specific version than
 // template <class T>
@@ -6,7 +6,9 @@
 
 #include <OSL/optautomata.h>
 #include <OSL/oslconfig.h>
+#include <atomic>
 #include <list>
+#include <memory>
 #include <stack>
 
 OSL_NAMESPACE_ENTER
@@ -54,6 +56,70 @@ struct AovOutput {
 
 
 
+/// Tile of accumulated AOV values, keyed by pixel
+///
+/// Instead of flushing every sample through Aov::write, which makes the
+/// renderer lock its framebuffers, an Accumulator can add its outputs
+/// into one of these. A thread that owns the tile uses plain adds, several
+/// threads sharing one use atomic adds. Tiles are finally merged into an
+/// image sized one, and flushed pixel by pixel with Accumulator::flush.
+class OSLEXECPUBLIC AovBuffer {
+public:
+    /// Create a zeroed buffer for pixels [xbegin, xbegin+width) x
+    /// [ybegin, ybegin+height) with noutputs AOV outputs each.
+    AovBuffer(int xbegin, int ybegin, int width, int height, int noutputs);
+
+    int xbegin() const { return m_xbegin; }
+    int ybegin() const { return m_ybegin; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    int noutputs() const { return m_noutputs; }
+    bool contains(int x, int y) const
+    {
+        return x >= m_xbegin && x < m_xbegin + m_width && y >= m_ybegin
+               && y < m_ybegin + m_height;
+    }
+
+    /// Zero all the pixels
+    void reset();
+
+    /// Add the outputs into pixel (x,y). Not thread safe.
+    void add(int x, int y, const std::vector<AovOutput>& outputs);
+    /// Same as add, but safe to call from several threads at once
+    void atomicAdd(int x, int y, const std::vector<AovOutput>& outputs);
+
+    /// Add the pixels of tile that overlap this buffer. Not thread safe.
+    void merge(const AovBuffer& tile) { merge(tile, m_ybegin, m_ybegin + m_height); }
+
+    /// Merge all the tiles into image, splitting the work by rows of
+    /// image over the OIIO thread pool, so no locks or atomics are needed.
+    static void merge(AovBuffer& image, const std::vector<const AovBuffer*>& tiles);
+
+    /// Retrieve the accumulated values of pixel (x,y) into outputs,
+    /// which must have at least noutputs() entries.
+    void get(int x, int y, std::vector<AovOutput>& outputs) const;
+
+private:
+    struct Cell {
+        std::atomic<float> color[3];
+        std::atomic<float> alpha;
+        std::atomic<int> flags;  // 1: has_color, 2: has_alpha
+    };
+
+    Cell* cells(int x, int y) const
+    {
+        return &m_cells[(size_t(y - m_ybegin) * m_width + (x - m_xbegin))
+                        * m_noutputs];
+    }
+    // Add the rows [ybegin, yend) of tile
+    void merge(const AovBuffer& tile, int ybegin, int yend);
+
+    int m_xbegin, m_ybegin, m_width, m_height, m_noutputs;
+    std::unique_ptr<Cell[]> m_cells;
+};
+
+
+
 /// Rule mapping a pattern to an AOV
 ///
 /// This is the entity being linked from the automata. At any state, if
@@ -121,6 +187,20 @@ public:
     /// Once all the desired rules have been added, compile the automata
     void compile();
 
+    /// A key for the rules added so far, along with the custom event and
+    /// scattering types, under which to cache the compiled automata
+    std::string cacheKey() const;
+
+    /// The compiled automata as a binary blob, to be kept under cacheKey()
+    /// and given to compileFromCache() in later runs
+    std::string serialize() const;
+
+    /// Use instead of compile(): load the automata from a blob that
+    /// serialize() made for the same rules, skipping the parsing and the
+    /// NFA and DFA construction. Returns false, leaving the rules to be
+    /// compiled as usual, if the blob doesn't match them or is damaged.
+    bool compileFromCache(const std::string& blob);
+
     /// Performs an accumulation in the given outputs vector if any rule is activated in the given state
     void accum(int state, const Color3& color,
                std::vector<AovOutput>& outputs) const;
@@ -131,6 +211,19 @@ public:
         return m_dfoptautomata.getTransition(state, symbol);
     };
 
+    /// Symbol id for getTransitionById, so a symbol shared by many paths
+    /// is looked up only once
+    int symbolId(ustring symbol) const
+    {
+        return m_dfoptautomata.symbolId(symbol);
+    }
+
+    /// Get an specific transition by symbol id
+    int getTransitionById(int state, int symbolid) const
+    {
+        return m_dfoptautomata.getTransitionById(state, symbolid);
+    }
+
     /// The rule list is for public use in read-only, so Accumulator knows what AOVS are we using
     const std::list<AccumRule>& getRuleList() const { return m_accumrules; };
 
@@ -140,10 +233,18 @@ public:
         return m_dfoptautomata.getRules(state, count);
     };
 
+    /// Number of states of the compiled automata, for statistics
+    int stateCount() const { return m_dfoptautomata.stateCount(); }
+
+    /// Bytes used by the compiled automata, for statistics
+    size_t memoryUsed() const { return m_dfoptautomata.memoryUsed(); }
+
 private:
     // Compiled lpexp's we save while creating the rules with addRule.
     // It gets nuked after you call compile()
     std::list<lpexp::Rule*> m_rules;
+    // The pattern of each rule, in m_accumrules order, for cacheKey()
+    std::vector<std::string> m_patterns;
     // The famous so called DF automata
     DfOptimizedAutomata m_dfoptautomata;
     // List of rules linked as void * from the automata's states
@@ -205,6 +306,14 @@ public:
     /// finishes and flushes the outputs to the sample store
     void end(void* flush_data);
 
+    /// finishes and adds the outputs into pixel (x,y) of a tile buffer,
+    /// with atomic adds if the buffer is shared between threads
+    void end(AovBuffer& buffer, int x, int y, bool atomic = false);
+
+    /// Flush the values accumulated for pixel (x,y) of buffer, typically
+    /// the merged image, through the AOVs set in this accumulator
+    void flush(const AovBuffer& buffer, int x, int y, void* flush_data);
+
 
     /// Send a result to whatever rules might be active in the current state
     void accum(const Color3& color)
@@ -0,0 +1,176 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#if !defined(OSL_USE_BATCHED) || (OSL_USE_BATCHED == 0)
+#    error batched_accum.h should not be included unless OSL_USE_BATCHED is defined to 1
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#include <OSL/accum.h>
+#include <OSL/oslclosure.h>
+#include <OSL/wide.h>
+
+OSL_NAMESPACE_ENTER
+
+/// Batched version of Accumulator, for wide integrators
+///
+/// Follows WidthT paths at once, one per lane, over the same
+/// AccumAutomata. Every operation takes the mask of the lanes it applies
+/// to, so a wavefront renderer can keep the paths of a BatchedExecutor
+/// batch together through the whole light walk:
+///
+///     BatchedAccumulator<16> accum(&automata);
+///     accum.begin(mask);
+///     accum.move(Labels::CAMERA, mask);
+///     ...
+///     accum.move(event, scatt, mask);   // per lane labels
+///     accum.accum(Wide<const Color3, 16>(contrib), mask & ~accum.broken());
+///     accum.end(tile, xs, ys, mask);
+///
+/// Symbols common to all the lanes are interned once per move, so moving
+/// a batch is WidthT loads from the automata's transition table.
+template<int WidthT> class BatchedAccumulator {
+public:
+    BatchedAccumulator(const AccumAutomata* accauto)
+        : m_accum_automata(accauto)
+    {
+        int maxouts = 0;
+        for (const auto& i : m_accum_automata->getRuleList())
+            maxouts = std::max(i.getOutputIndex(), maxouts);
+        for (int lane = 0; lane < WidthT; ++lane) {
+            m_outputs[lane].resize(maxouts + 1);
+            m_state[lane] = 0;  // 0 is our initial state always
+        }
+    }
+
+    /// Set the AOV of an output index for all the lanes
+    void setAov(int outidx, Aov* aov, bool neg_color, bool neg_alpha)
+    {
+        OSL_ASSERT(0 <= outidx && outidx < (int)m_outputs[0].size());
+        for (int lane = 0; lane < WidthT; ++lane) {
+            m_outputs[lane][outidx].aov       = aov;
+            m_outputs[lane][outidx].neg_color = neg_color;
+            m_outputs[lane][outidx].neg_alpha = neg_alpha;
+        }
+    }
+
+    /// Lanes whose automata is broken, no result will be stored for them
+    Mask<WidthT> broken() const
+    {
+        Mask<WidthT> m(false);
+        for (int lane = 0; lane < WidthT; ++lane)
+            if (m_state[lane] < 0)
+                m.set_on(lane);
+        return m;
+    }
+
+    int state(int lane) const { return m_state[lane]; }
+
+    /// Save / restore the state of all the lanes
+    void pushState()
+    {
+        m_stack.emplace_back();
+        for (int lane = 0; lane < WidthT; ++lane)
+            m_stack.back().s[lane] = m_state[lane];
+    }
+    void popState()
+    {
+        OSL_ASSERT(m_stack.size());
+        for (int lane = 0; lane < WidthT; ++lane)
+            m_state[lane] = m_stack.back().s[lane];
+        m_stack.pop_back();
+    }
+
+    /// Move the lanes in mask by the same label
+    void move(ustring symbol, Mask<WidthT> mask)
+    {
+        int id = m_accum_automata->symbolId(symbol);
+        mask.foreach ([&](ActiveLane lane) -> void {
+            if (m_state[lane] >= 0)
+                m_state[lane] = m_accum_automata->getTransitionById(m_state[lane], id);
+        });
+    }
+
+    /// Move the lanes in mask by a label each
+    void move(Wide<const ustring, WidthT> symbols, Mask<WidthT> mask)
+    {
+        mask.foreach ([&](ActiveLane lane) -> void {
+            if (m_state[lane] >= 0)
+                m_state[lane] = m_accum_automata->getTransition(m_state[lane],
+                                                                symbols[lane]);
+        });
+    }
+
+    /// The common event, scattering, STOP sequence of a hit, with per
+    /// lane event and scattering labels
+    void move(Wide<const ustring, WidthT> event,
+              Wide<const ustring, WidthT> scatt, Mask<WidthT> mask)
+    {
+        move(event, mask);
+        move(scatt, mask);
+        move(Labels::STOP, mask);
+    }
+
+    /// Clear the outputs of the lanes in mask to start integrating
+    void begin(Mask<WidthT> mask)
+    {
+        mask.foreach ([&](ActiveLane lane) -> void {
+            for (auto& o : m_outputs[lane])
+                o.reset();
+        });
+    }
+
+    /// Send a result for each lane in mask to the rules active in its state
+    void accum(Wide<const Color3, WidthT> color, Mask<WidthT> mask)
+    {
+        mask.foreach ([&](ActiveLane lane) -> void {
+            if (m_state[lane] >= 0)
+                m_accum_automata->accum(m_state[lane], color[lane],
+                                        m_outputs[lane]);
+        });
+    }
+
+    /// Flush the outputs of the lanes in mask to the AOVs, with a
+    /// flush_data pointer per lane
+    void end(void* const* flush_data, Mask<WidthT> mask)
+    {
+        mask.foreach ([&](ActiveLane lane) -> void {
+            for (auto& o : m_outputs[lane])
+                o.flush(flush_data[lane]);
+        });
+    }
+
+    /// Add the outputs of the lanes in mask into pixel (x[lane],y[lane])
+    /// of a tile buffer, see Accumulator::end
+    void end(AovBuffer& buffer, const int* x, const int* y, Mask<WidthT> mask,
+             bool atomic = false)
+    {
+        mask.foreach ([&](ActiveLane lane) -> void {
+            if (atomic)
+                buffer.atomicAdd(x[lane], y[lane], m_outputs[lane]);
+            else
+                buffer.add(x[lane], y[lane], m_outputs[lane]);
+        });
+    }
+
+    const AovOutput& getOutput(int lane, int idx) const
+    {
+        return m_outputs[lane][idx];
+    }
+
+private:
+    struct States {
+        int s[WidthT];
+    };
+    const AccumAutomata* m_accum_automata;
+    std::vector<AovOutput> m_outputs[WidthT];
+    std::vector<States> m_stack;
+    int m_state[WidthT];
+};
+
+OSL_NAMESPACE_EXIT
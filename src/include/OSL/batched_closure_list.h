@@ -0,0 +1,139 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#if !defined(OSL_USE_BATCHED) || (OSL_USE_BATCHED == 0)
+#    error batched_closure_list.h should not be included unless OSL_USE_BATCHED is defined to 1
+#endif
+
+#include <vector>
+
+#include <OSL/oslclosure.h>
+#include <OSL/wide.h>
+
+OSL_NAMESPACE_ENTER
+
+/// BatchedClosureList is an optional, flattened Structure of Arrays view
+/// of the closures a batch of shading points produced.  After a batched
+/// execute, each lane of Ci holds its own tree of ClosureMul/ClosureAdd
+/// nodes; walking WidthT of those trees, one pointer at a time, keeps the
+/// renderer's BSDF setup from being vectorized.  build() walks every
+/// active lane once and files each primitive component (with its
+/// accumulated weight) under its closure id, so the renderer can then
+/// process all the components of one closure type, across all lanes, in a
+/// single loop:
+///
+///     BatchedClosureList<16> closures;
+///     closures.build(Wide<const ClosureColorPtr, 16>(bsg.varying.Ci), mask);
+///     for (int id : closures.ids()) {
+///         const auto& type = *closures.find(id);
+///         // type.lanes, and per entry i: type.lane[i],
+///         // type.weight_r/g/b[i], type.params[i]
+///     }
+///
+/// The parameter pointers reference the context's closure pool, so the
+/// list is only valid until that context executes again or is released.
+template<int WidthT> class BatchedClosureList {
+public:
+    /// All components of a single closure id, in lane order.
+    struct ClosureType {
+        int id = 0;
+        Mask<WidthT> lanes { false };  ///< Lanes with at least one entry
+        std::vector<int> lane;         ///< Lane each entry came from
+        std::vector<float> weight_r;   ///< Accumulated weight of the entry
+        std::vector<float> weight_g;
+        std::vector<float> weight_b;
+        std::vector<const void*> params;  ///< ClosureComponent::data()
+
+        size_t size() const { return lane.size(); }
+    };
+
+    /// Flatten the closure trees of the lanes of 'wCi' that are on in
+    /// 'mask', replacing any previous contents.  Lanes with a null
+    /// closure simply contribute nothing.
+    void build(Wide<const ClosureColorPtr, WidthT> wCi, Mask<WidthT> mask)
+    {
+        clear();
+        mask.foreach ([&](ActiveLane lane) -> void {
+            add(lane, wCi[lane], Color3(1.0f));
+        });
+    }
+
+    /// Forget all entries, but keep the storage for reuse.
+    void clear()
+    {
+        for (auto& t : m_types) {
+            t.lanes = Mask<WidthT>(false);
+            t.lane.clear();
+            t.weight_r.clear();
+            t.weight_g.clear();
+            t.weight_b.clear();
+            t.params.clear();
+        }
+        m_used.clear();
+    }
+
+    /// The closure ids that have entries, in order of first appearance.
+    const std::vector<int>& ids() const { return m_used; }
+
+    /// Entries for closure 'id', or nullptr if there are none.
+    const ClosureType* find(int id) const
+    {
+        if (id < 0 || id >= int(m_types.size()) || m_types[id].lane.empty())
+            return nullptr;
+        return &m_types[id];
+    }
+
+    /// Total number of components over all lanes and closure ids.
+    size_t size() const
+    {
+        size_t n = 0;
+        for (int id : m_used)
+            n += m_types[id].size();
+        return n;
+    }
+
+private:
+    void add(int lane, const ClosureColor* closure, const Color3& w)
+    {
+        if (!closure)
+            return;
+        switch (closure->id) {
+        case ClosureColor::MUL:
+            add(lane, closure->as_mul()->closure,
+                w * closure->as_mul()->weight);
+            break;
+        case ClosureColor::ADD:
+            add(lane, closure->as_add()->closureA, w);
+            add(lane, closure->as_add()->closureB, w);
+            break;
+        default: {
+            const ClosureComponent* comp = closure->as_comp();
+            if (comp->id >= int(m_types.size()))
+                m_types.resize(comp->id + 1);
+            ClosureType& t = m_types[comp->id];
+            if (t.lane.empty()) {
+                t.id = comp->id;
+                m_used.push_back(comp->id);
+            }
+            Color3 cw = w * comp->w;
+            t.lanes.set_on(lane);
+            t.lane.push_back(lane);
+            t.weight_r.push_back(cw.x);
+            t.weight_g.push_back(cw.y);
+            t.weight_b.push_back(cw.z);
+            t.params.push_back(comp->data());
+            break;
+        }
+        }
+    }
+
+    // Indexed by closure id; ids are small, dense, renderer registered
+    // integers so a direct table beats any map.
+    std::vector<ClosureType> m_types;
+    std::vector<int> m_used;
+};
+
+OSL_NAMESPACE_EXIT
@@ -124,19 +124,17 @@ public:
     /// specified (object == ustring()), then the renderer should search *first*
     /// for the attribute on the currently shaded object, and next, if
     /// unsuccessful, on the currently shaded "scene".
+    /// The default implementation calls get_attribute_uniform() once and
+    /// broadcasts its value to every active lane, so a renderer that only
+    /// supplies uniform attributes need not implement the varying version.
     virtual Mask get_attribute(BatchedShaderGlobals* bsg, ustring object,
-                               ustring name, MaskedData wval)
-    {
-        return Mask(false);
-    }
+                               ustring name, MaskedData wval);
 
     /// Similar to get_attribute();  this method will fetch the 'index'
-    /// element of an attribute array.
+    /// element of an attribute array.  The default implementation
+    /// broadcasts the result of get_array_attribute_uniform().
     virtual Mask get_array_attribute(BatchedShaderGlobals* bsg, ustring object,
-                                     ustring name, int index, MaskedData wval)
-    {
-        return Mask(false);
-    }
+                                     ustring name, int index, MaskedData wval);
 
     virtual bool get_attribute_uniform(BatchedShaderGlobals* bsg,
                                        ustring object, ustring name,
@@ -154,6 +152,31 @@ public:
         return false;
     }
 
+    /// Called as a group is JITed, for each getattribute() whose object
+    /// (ustring() if none) and name are known then: return an opaque
+    /// handle that get_attribute_by_handle and
+    /// get_attribute_uniform_by_handle can find the attribute with,
+    /// skipping the dispatch on its name, or nullptr (the default) to
+    /// have the attribute looked up by name as usual.  The handle must
+    /// stay valid for as long as the code of the group does.
+    virtual void* resolve_attribute(ustring object, ustring name,
+                                    TypeDesc type)
+    {
+        return nullptr;
+    }
+
+    /// Retrieve an attribute that resolve_attribute returned the handle
+    /// for, like get_attribute, or like get_array_attribute for element
+    /// 'index' if index >= 0.  The defaults just call those by name.
+    virtual Mask get_attribute_by_handle(BatchedShaderGlobals* bsg,
+                                         void* handle, ustring object,
+                                         ustring name, int index,
+                                         MaskedData wval);
+    virtual bool get_attribute_uniform_by_handle(BatchedShaderGlobals* bsg,
+                                                 void* handle, ustring object,
+                                                 ustring name, int index,
+                                                 RefData val);
+
     /// Get multiple named user-data from the current object and write them into
     /// 'val'. If derivatives is true, the derivatives should be written into val
     /// as well. It is assumed the results are varying and returns Mask
@@ -0,0 +1,63 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <OSL/batched_shaderglobals.h>
+#include <OSL/device_string.h>
+#include <OSL/oslconfig.h>
+#include <OSL/wide.h>
+
+// Wide counterparts of the free functions in rs_free_function.h, for the
+// batched backend.  A renderer that passes bitcode defining these functions
+// to the "batched_rs_bitcode" ShadingSystem attribute has its matrix
+// lookups linked into, and optimized together with, the JITed SIMD code,
+// instead of going through BatchedRendererServices virtual calls.
+//
+// Each function exists once per batch width, with the width encoded in its
+// name (rs_b16_*, rs_b8_*).  They fill in only the lanes of the result mask
+// and return, as the bits of a Mask, the lanes that succeeded.
+
+// Prefix for OSL shade op declarations.
+// "C" linkage (no C++ name mangling) and local visibility
+#define OSL_BATCHED_RSOP extern "C"
+
+// Keep free functions in sync with virtual function based
+// BatchedRendererServices.
+#define OSL_BATCHED_RS_DECLARE(WidthT)                                        \
+    /* Get the 4x4 matrices that transform by the specified            */     \
+    /* transformations at the given times.                             */     \
+    OSL_BATCHED_RSOP int rs_b##WidthT##_get_matrix_xform_time(                \
+        OSL::BatchedShaderGlobals<WidthT>* bsg,                               \
+        OSL::Masked<OSL::Matrix44, WidthT> wresult,                           \
+        OSL::Wide<const OSL::TransformationPtr, WidthT> wxform,               \
+        OSL::Wide<const float, WidthT> wtime);                                \
+                                                                              \
+    /* Get the inverses of the matrices rs_bW_get_matrix_xform_time    */     \
+    /* returns.  Suggested implementation is to call it and invert.    */     \
+    OSL_BATCHED_RSOP int rs_b##WidthT##_get_inverse_matrix_xform_time(        \
+        OSL::BatchedShaderGlobals<WidthT>* bsg,                               \
+        OSL::Masked<OSL::Matrix44, WidthT> wresult,                           \
+        OSL::Wide<const OSL::TransformationPtr, WidthT> wxform,               \
+        OSL::Wide<const float, WidthT> wtime);                                \
+                                                                              \
+    /* Get the 4x4 matrices that transform points from the named       */     \
+    /* 'from' coordinate system to "common" space at the given times.  */     \
+    /* Lanes fail if the named matrix is not known.                    */     \
+    OSL_BATCHED_RSOP int rs_b##WidthT##_get_matrix_space_time(                \
+        OSL::BatchedShaderGlobals<WidthT>* bsg,                               \
+        OSL::Masked<OSL::Matrix44, WidthT> wresult, OSL::StringParam from,    \
+        OSL::Wide<const float, WidthT> wtime);                                \
+                                                                              \
+    /* Get the 4x4 matrices that transform points from "common" space  */     \
+    /* to the named 'to' coordinate system at the given times.         */     \
+    /* Suggested implementation is to use                              */     \
+    /* rs_bW_get_matrix_space_time and invert it.                      */     \
+    OSL_BATCHED_RSOP int rs_b##WidthT##_get_inverse_matrix_space_time(        \
+        OSL::BatchedShaderGlobals<WidthT>* bsg,                               \
+        OSL::Masked<OSL::Matrix44, WidthT> wresult, OSL::StringParam to,      \
+        OSL::Wide<const float, WidthT> wtime);
+
+OSL_BATCHED_RS_DECLARE(16)
+OSL_BATCHED_RS_DECLARE(8)
@@ -0,0 +1,99 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <OSL/oslclosure.h>
+#include <OSL/oslconfig.h>
+
+#include <vector>
+
+
+OSL_NAMESPACE_ENTER
+
+/// \file
+///
+/// Helpers for renderers to turn the ClosureColor tree an OSL shader
+/// leaves in Ci into the flat list of weighted primitive components it
+/// stands for, without recursion (so a deeply layered material can't
+/// overflow the stack) and in the same order as a depth-first walk.
+
+
+/// One primitive component of a flattened closure, and its weight: the
+/// component's own weight times the weights of all the ClosureMul nodes
+/// above it.
+struct FlatClosureComponent {
+    const ClosureComponent* comp;
+    Color3 weight;
+};
+
+
+/// Call f(comp, weight) for each primitive component of the closure
+/// tree, with weight the product of comp->w, all the ClosureMul weights
+/// above it, and w.
+template<typename F>
+inline void
+foreach_closure_component(const ClosureColor* closure, F f,
+                          Color3 w = Color3(1.0f))
+{
+    // The second operands of the ClosureAdd nodes passed on the way down,
+    // still to be visited.  Trees deeper than the local stack are rare, so
+    // only they pay for a heap allocation.
+    struct Pending {
+        const ClosureColor* closure;
+        Color3 weight;
+    };
+    Pending local[32];
+    std::vector<Pending> spill;
+    int npending = 0;
+    for (;;) {
+        while (closure) {
+            if (closure->id == ClosureColor::MUL) {
+                w *= closure->as_mul()->weight;
+                closure = closure->as_mul()->closure;
+            } else if (closure->id == ClosureColor::ADD) {
+                Pending p = { closure->as_add()->closureB, w };
+                if (npending < 32)
+                    local[npending++] = p;
+                else
+                    spill.push_back(p);
+                closure = closure->as_add()->closureA;
+            } else {
+                const ClosureComponent* comp = closure->as_comp();
+                f(comp, Color3(w * comp->w));
+                closure = nullptr;
+            }
+        }
+        if (!spill.empty()) {
+            closure = spill.back().closure;
+            w       = spill.back().weight;
+            spill.pop_back();
+        } else if (npending) {
+            --npending;
+            closure = local[npending].closure;
+            w       = local[npending].weight;
+        } else {
+            break;
+        }
+    }
+}
+
+
+/// Replace the contents of comps with the weighted primitive components
+/// of the closure tree, and return how many there are.  Reusing comps
+/// from one shading point to the next avoids reallocating it.
+inline size_t
+flatten_closure(const ClosureColor* closure,
+                std::vector<FlatClosureComponent>& comps)
+{
+    comps.clear();
+    foreach_closure_component(closure,
+                              [&](const ClosureComponent* comp,
+                                  const Color3& weight) {
+                                  comps.push_back({ comp, weight });
+                              });
+    return comps.size();
+}
+
+OSL_NAMESPACE_EXIT
@@ -0,0 +1,183 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <OSL/oslconfig.h>
+
+
+OSL_NAMESPACE_ENTER
+
+
+/// A read-only point cloud laid out as one relocatable block of memory,
+/// for renderers that run pointcloud_search and pointcloud_get on a
+/// device. ShadingSystem::pointcloud_device_image() makes the block from
+/// the kd-tree OSL builds when it loads a cloud; the renderer copies it
+/// to device memory once, as it is, and its device implementations of
+/// the pointcloud functions search it with the methods here, which
+/// compile for the host and the device alike.
+///
+/// The block starts with this header. The tree's nodes, the x, y and z
+/// positions and the Partio indices of the points (both in tree order),
+/// the tree order slot of each Partio index, the attribute table, and
+/// each attribute's values (also in tree order) follow it, each found by
+/// its byte offset from the start of the header. Only the cloud's float
+/// and int attributes are included.
+struct DevicePointCloud {
+    /// The same layout as the nodes of OSL's own tree
+    struct Node {
+        float lo[3], hi[3];  ///< Bounds of the points beneath this node
+        float split;         ///< Median along 'axis' (interior nodes only)
+        int axis;            ///< Split axis, or -1 for a leaf
+        int begin, end;      ///< Range of points beneath this node
+        int right;           ///< Right child; the left child is this+1
+    };
+
+    struct Attribute {
+        uint64_t name;       ///< ustring hash of the attribute name
+        int basetype;        ///< TypeDesc::FLOAT or TypeDesc::INT
+        int nvalues;         ///< Values per point (3 for a vector)
+        uint64_t offset;     ///< Of the values, nvalues per point
+    };
+
+    int npoints;
+    int nnodes;
+    int nattributes;
+    int pad_;
+    uint64_t nodes_offset;
+    uint64_t x_offset, y_offset, z_offset;
+    uint64_t index_offset;
+    uint64_t slot_offset;
+    uint64_t attributes_offset;
+
+    template<typename T>
+    OSL_HOSTDEVICE const T* at (uint64_t offset) const {
+        return reinterpret_cast<const T*>(reinterpret_cast<const char*>(this) + offset);
+    }
+    OSL_HOSTDEVICE const Node* nodes () const { return at<Node>(nodes_offset); }
+    OSL_HOSTDEVICE const float* x () const { return at<float>(x_offset); }
+    OSL_HOSTDEVICE const float* y () const { return at<float>(y_offset); }
+    OSL_HOSTDEVICE const float* z () const { return at<float>(z_offset); }
+    /// Partio particle index of each point, in tree order
+    OSL_HOSTDEVICE const int* index () const { return at<int>(index_offset); }
+    /// Tree order slot of each Partio particle index
+    OSL_HOSTDEVICE const int* slot () const { return at<int>(slot_offset); }
+    OSL_HOSTDEVICE const Attribute* attributes () const {
+        return at<Attribute>(attributes_offset);
+    }
+
+    /// The attribute with the given name hash, or nullptr.
+    OSL_HOSTDEVICE const Attribute* find_attribute (uint64_t name) const {
+        const Attribute* attrs = attributes();
+        for (int a = 0; a < nattributes; ++a)
+            if (attrs[a].name == name)
+                return &attrs[a];
+        return nullptr;
+    }
+
+    /// Find up to 'max_points' points closer than 'radius' to 'center',
+    /// storing their tree order slots and squared distances, exactly as
+    /// the host search does: once 'max_points' have been found, only
+    /// closer points replace them, and if 'sort' is true the results
+    /// come out nearest first. Returns the number of points found.
+    OSL_HOSTDEVICE int find_nearest (const float* center, float radius,
+                                     int max_points, bool sort, int* slots,
+                                     float* dist2) const
+    {
+        if (max_points <= 0 || nnodes == 0)
+            return 0;
+        const Node* tree = nodes();
+        const float *px = x(), *py = y(), *pz = z();
+        float bound = radius * radius;
+        int count = 0;
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        while (top) {
+            const int id = stack[--top];
+            const Node& node (tree[id]);
+            float d2 = 0.0f;
+            for (int a = 0; a < 3; ++a) {
+                float d = node.lo[a] - center[a];
+                d = d > center[a] - node.hi[a] ? d : center[a] - node.hi[a];
+                d = d > 0.0f ? d : 0.0f;
+                d2 += d * d;
+            }
+            if (!(d2 < bound))
+                continue;
+            if (node.axis >= 0) {
+                // Visit the near child last so that it is searched first
+                if (center[node.axis] < node.split) {
+                    stack[top++] = node.right;
+                    stack[top++] = id + 1;
+                } else {
+                    stack[top++] = id + 1;
+                    stack[top++] = node.right;
+                }
+                continue;
+            }
+            for (int p = node.begin; p < node.end; ++p) {
+                float dx = center[0] - px[p];
+                float dy = center[1] - py[p];
+                float dz = center[2] - pz[p];
+                float pd2 = dx * dx + dy * dy + dz * dz;
+                if (!(pd2 < bound))
+                    continue;
+                if (count < max_points) {
+                    // Append and sift up the max-heap
+                    int i = count++;
+                    while (i > 0 && dist2[(i - 1) / 2] < pd2) {
+                        dist2[i] = dist2[(i - 1) / 2];
+                        slots[i] = slots[(i - 1) / 2];
+                        i = (i - 1) / 2;
+                    }
+                    dist2[i] = pd2;
+                    slots[i] = p;
+                    if (count == max_points)
+                        bound = dist2[0];
+                } else {
+                    // Replace the farthest point
+                    dist2[0] = pd2;
+                    slots[0] = p;
+                    sift_down (slots, dist2, 0, count);
+                    bound = dist2[0];
+                }
+            }
+        }
+        if (sort) {
+            // Heap sort in place, nearest first
+            for (int n = count - 1; n > 0; --n) {
+                swap (dist2[0], dist2[n]);
+                swap (slots[0], slots[n]);
+                sift_down (slots, dist2, 0, n);
+            }
+        }
+        return count;
+    }
+
+private:
+    template<typename T>
+    OSL_HOSTDEVICE static void swap (T& a, T& b) {
+        T t = a;  a = b;  b = t;
+    }
+
+    OSL_HOSTDEVICE static void sift_down (int* slots, float* dist2, int i, int n)
+    {
+        for (;;) {
+            int c = 2 * i + 1;
+            if (c >= n)
+                break;
+            if (c + 1 < n && dist2[c + 1] > dist2[c])
+                ++c;
+            if (!(dist2[c] > dist2[i]))
+                break;
+            swap (dist2[i], dist2[c]);
+            swap (slots[i], slots[c]);
+            i = c;
+        }
+    }
+};
+
+
+OSL_NAMESPACE_EXIT
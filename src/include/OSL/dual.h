@@ -619,6 +619,45 @@ OSL_HOSTDEVICE OSL_FORCEINLINE OSL_CONSTEXPR14 Dual<T,P> operator/ (const T &ava
 
 
 
+/// Fused multiply-add of duals, a*b + c. Computes the value and each
+/// partial in a single pass rather than through a product temporary, with
+/// the same arithmetic (and so the same results) as the two operators.
+template<class T, int P>
+OSL_HOSTDEVICE OSL_FORCEINLINE OSL_CONSTEXPR14 Dual<T,P>
+madd (const Dual<T,P> &a, const Dual<T,P> &b, const Dual<T,P> &c)
+{
+    Dual<T,P> result;
+    result.val() = a.val() * b.val() + c.val();
+    OSL_INDEX_LOOP(i, P, {
+        result.partial(i) = (a.val()*b.partial(i) + a.partial(i)*b.val()) + c.partial(i);
+    });
+    return result;
+}
+
+
+/// Fused multiply-add of a dual and a non-dual scale, a*b + c.
+///
+template<class T, int P>
+OSL_HOSTDEVICE OSL_FORCEINLINE OSL_CONSTEXPR14 Dual<T,P>
+madd (const Dual<T,P> &a, const T &b, const Dual<T,P> &c)
+{
+    Dual<T,P> result;
+    OSL_INDEX_LOOP(i, P+1, {
+        result.elem(i) = a.elem(i) * b + c.elem(i);
+    });
+    return result;
+}
+
+
+template<class T, int P>
+OSL_HOSTDEVICE OSL_FORCEINLINE OSL_CONSTEXPR14 Dual<T,P>
+madd (const T &a, const Dual<T,P> &b, const Dual<T,P> &c)
+{
+    return madd (b, a, c);
+}
+
+
+
 
 template<class T, int P>
 OSL_HOSTDEVICE OSL_FORCEINLINE constexpr bool operator< (const Dual<T,P> &a, const Dual<T,P> &b) {
@@ -407,17 +407,28 @@ multiplyDirByMatrix (const Imath::Matrix44<S> &M,
     return out;
 }
 
+// The dot, cross, length and normalize of Dual vectors below compute the
+// value and each partial in one pass, rather than composing them from
+// per-component Dual temporaries (which compilers don't reliably remove).
+// They do the same arithmetic, in the same order, as the composed Dual
+// expressions noted in their comments, so the results are identical.
+
+// ax*bx + ay*by + az*bz
 template<int P>
 OSL_HOSTDEVICE inline OSL_CONSTEXPR14 Dual<Vec3::BaseType, P>
 dot (const Dual<Vec3,P> &a, const Dual<Vec3,P> &b)
 {
-    auto ax = comp_x (a);
-    auto ay = comp_y (a);
-    auto az = comp_z (a);
-    auto bx = comp_x (b);
-    auto by = comp_y (b);
-    auto bz = comp_z (b);
-    return ax*bx + ay*by + az*bz;
+    const Vec3 &av (a.val());
+    const Vec3 &bv (b.val());
+    Dual<Vec3::BaseType, P> result;
+    result.val() = av.x*bv.x + av.y*bv.y + av.z*bv.z;
+    OSL_INDEX_LOOP(i, P, {
+        const Vec3 &ap (a.partial(i));
+        const Vec3 &bp (b.partial(i));
+        result.partial(i) = (av.x*bp.x + ap.x*bv.x) + (av.y*bp.y + ap.y*bv.y)
+                          + (av.z*bp.z + ap.z*bv.z);
+    });
+    return result;
 }
 
 
@@ -426,13 +437,12 @@ template<int P>
 OSL_HOSTDEVICE inline OSL_CONSTEXPR14 Dual<Vec3::BaseType,P>
 dot (const Dual<Vec3,P> &a, const Vec3 &b)
 {
-    auto ax = comp_x (a);
-    auto ay = comp_y (a);
-    auto az = comp_z (a);
-    auto bx = comp_x (b);
-    auto by = comp_y (b);
-    auto bz = comp_z (b);
-    return ax*bx + ay*by + az*bz;
+    Dual<Vec3::BaseType, P> result;
+    OSL_INDEX_LOOP(i, P+1, {
+        const Vec3 &ae (a.elem(i));
+        result.elem(i) = ae.x*b.x + ae.y*b.y + ae.z*b.z;
+    });
+    return result;
 }
 
 
@@ -450,11 +460,16 @@ template<int P>
 OSL_HOSTDEVICE inline OSL_CONSTEXPR14 Dual<Vec2::BaseType,P>
 dot (const Dual<Vec2,P> &a, const Dual<Vec2,P> &b)
 {
-    auto ax = comp_x (a);
-    auto ay = comp_y (a);
-    auto bx = comp_x (b);
-    auto by = comp_y (b);
-    return ax*bx + ay*by;
+    const Vec2 &av (a.val());
+    const Vec2 &bv (b.val());
+    Dual<Vec2::BaseType, P> result;
+    result.val() = av.x*bv.x + av.y*bv.y;
+    OSL_INDEX_LOOP(i, P, {
+        const Vec2 &ap (a.partial(i));
+        const Vec2 &bp (b.partial(i));
+        result.partial(i) = (av.x*bp.x + ap.x*bv.x) + (av.y*bp.y + ap.y*bv.y);
+    });
+    return result;
 }
 
 
@@ -463,11 +478,12 @@ template<int P>
 OSL_HOSTDEVICE inline OSL_CONSTEXPR14 Dual<Vec2::BaseType,P>
 dot (const Dual<Vec2,P> &a, const Vec2 &b)
 {
-    auto ax = comp_x (a);
-    auto ay = comp_y (a);
-    auto bx = comp_x (b);
-    auto by = comp_y (b);
-    return ax*bx + ay*by;
+    Dual<Vec2::BaseType, P> result;
+    OSL_INDEX_LOOP(i, P+1, {
+        const Vec2 &ae (a.elem(i));
+        result.elem(i) = ae.x*b.x + ae.y*b.y;
+    });
+    return result;
 }
 
 
@@ -485,50 +501,55 @@ dot (const Vec2 &a, const Dual<Vec2,P> &b)
 
 
 
+// make_Vec3 (ay*bz - az*by, az*bx - ax*bz, ax*by - ay*bx)
 template<int P>
 OSL_HOSTDEVICE inline Dual<Vec3,P>
 cross (const Dual<Vec3,P> &a, const Dual<Vec3,P> &b)
 {
-    auto ax = comp_x (a);
-    auto ay = comp_y (a);
-    auto az = comp_z (a);
-    auto bx = comp_x (b);
-    auto by = comp_y (b);
-    auto bz = comp_z (b);
-    auto nx = ay*bz - az*by;
-    auto ny = az*bx - ax*bz;
-    auto nz = ax*by - ay*bx;
-    return make_Vec3 (nx, ny, nz);
+    const Vec3 &av (a.val());
+    const Vec3 &bv (b.val());
+    Dual<Vec3,P> result;
+    result.val().setValue (av.y*bv.z - av.z*bv.y,
+                           av.z*bv.x - av.x*bv.z,
+                           av.x*bv.y - av.y*bv.x);
+    OSL_INDEX_LOOP(i, P, {
+        const Vec3 &ap (a.partial(i));
+        const Vec3 &bp (b.partial(i));
+        result.partial(i).setValue (
+            (av.y*bp.z + ap.y*bv.z) - (av.z*bp.y + ap.z*bv.y),
+            (av.z*bp.x + ap.z*bv.x) - (av.x*bp.z + ap.x*bv.z),
+            (av.x*bp.y + ap.x*bv.y) - (av.y*bp.x + ap.y*bv.x));
+    });
+    return result;
 }
 
 
 
+// sqrt(ax*ax + ay*ay + az*az)
 template<int P>
 OSL_HOSTDEVICE inline OSL_CONSTEXPR14 Dual<Vec3::BaseType,P>
 length (const Dual<Vec3,P> &a)
 {
-    auto ax = comp_x (a);
-    auto ay = comp_y (a);
-    auto az = comp_z (a);
-    return sqrt(ax*ax + ay*ay + az*az);
+    return sqrt (dot (a, a));
 }
 
 
 
+// make_Vec3 (ax*invlen, ay*invlen, az*invlen), invlen = 1 / length(a)
 template<int P>
 OSL_HOSTDEVICE inline Dual<Vec3,P>
 normalize (const Dual<Vec3,P> &a)
 {
-    auto ax = comp_x (a);
-    auto ay = comp_y (a);
-    auto az = comp_z (a);
-    auto len = sqrt(ax * ax + ay * ay + az * az);
-    if (OSL_LIKELY(len > Vec3::BaseType(0))) {
-        auto invlen = Vec3::BaseType(1) / len;
-        auto nax = ax * invlen;
-        auto nay = ay * invlen;
-        auto naz = az * invlen;
-        return make_Vec3 (nax, nay, naz);
+    auto len = length (a);
+    if (OSL_LIKELY(len.val() > Vec3::BaseType(0))) {
+        Vec3::BaseType invlen = Vec3::BaseType(1) / len.val();
+        Dual<Vec3,P> result;
+        result.val() = a.val() * invlen;
+        OSL_INDEX_LOOP(i, P, {
+            Vec3::BaseType dinvlen = invlen * (-invlen * len.partial(i));
+            result.partial(i) = a.val() * dinvlen + a.partial(i) * invlen;
+        });
+        return result;
     } else {
         return Vec3(0,0,0);
     }
@@ -8,6 +8,9 @@
 #include <OSL/oslversion.h>
 #include <OSL/oslconfig.h>
 
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <unordered_set>
 
@@ -19,6 +22,7 @@ namespace llvm {
   class BasicBlock;
   class Constant;
   class ConstantFolder;
+  class DataLayout;
   class DIBuilder;
   class DICompileUnit;
   class DIFile;
@@ -29,13 +33,14 @@ namespace llvm {
   class ExecutionEngine;
   class Function;
   class FunctionType;
-  class SectionMemoryManager;
   class JITEventListener;
   class Linker;
   class LLVMContext;
   class Module;
   class PointerType;
   class StringRef;
+  class TargetMachine;
+  class TargetOptions;
   class Type;
   class Value;
   class VectorType;
@@ -44,6 +49,10 @@ namespace llvm {
     class FunctionPassManager;
     class PassManager;
   }
+
+  namespace orc {
+    class JITDylib;
+  }
 }
 
 
@@ -64,11 +73,27 @@ enum class TargetISA
     AVX2_noFMA,
     AVX512,
     AVX512_noFMA,
+    NEON,           // AArch64 Advanced SIMD
     HOST,
     COUNT
 };
 
 
+/// Named optimization pipelines, built on LLVM's new pass manager, that
+/// may be chosen instead of the numbered llvm_optimize levels.  LEGACY
+/// means to use the numbered level.
+enum class OptPreset
+{
+    UNKNOWN,
+    LEGACY,
+    NONE,
+    COMPILE_FAST,
+    DEFAULT,
+    AGGRESSIVE,
+    COUNT
+};
+
+
 
 /// Wrapper class around LLVM functionality.  This handles all the
 /// gory details of actually dealing with LLVM.  It should be sufficiently
@@ -100,6 +125,11 @@ public:
         ~ScopedJitMemoryUser();
     };
 
+    // The code and data sections of one JITed module. Whoever holds the
+    // last reference to it decides when it is freed (returned to the
+    // shared JIT memory pool) -- see jit_memory().
+    struct JitMemory;
+
     /// Set debug level
     void debug (int d) { m_debug = d; }
     int debug () const { return m_debug; }
@@ -110,6 +140,22 @@ public:
     void jit_aggressive(bool val) { m_jit_aggressive = val; }
     bool jit_aggressive() const { return m_jit_aggressive; }
 
+    /// Request that make_jit() use the ORC LLJIT backend, which links
+    /// all JITed code into one execution session shared by every thread,
+    /// instead of building a private MCJIT ExecutionEngine per module.
+    /// Ignored (MCJIT is used) if orc_jit_supported() is false.
+    void orc_jit(bool val) { m_orc_jit = val && orc_jit_supported(); }
+    bool orc_jit() const { return m_orc_jit; }
+
+    /// With orc_jit(), defer compiling each function of the module until
+    /// the first time it is called; getPointerToFunction() then returns a
+    /// stub that triggers the compile.
+    void orc_jit_lazy(bool val) { m_orc_jit_lazy = val; }
+    bool orc_jit_lazy() const { return m_orc_jit && m_orc_jit_lazy; }
+
+    /// Was OSL built against an LLVM new enough for the ORC backend?
+    static bool orc_jit_supported();
+
     /// Return a reference to the current context.
     llvm::LLVMContext &context () const { return *m_llvm_context; }
 
@@ -138,6 +184,18 @@ public:
                                        const std::string &name=std::string(),
                                        std::string *err=NULL);
 
+    /// Like module_from_bitcode, but the bitcode is only fully parsed the
+    /// first time it is seen by this thread, and kept as a read-only
+    /// prototype.  The module returned is a clone of the prototype whose
+    /// function bodies are only copied as they are materialized, which is
+    /// much cheaper than parsing again.  The prototype is found by the
+    /// address of the bitcode, so this is only for buffers that will not
+    /// change for the life of the PerThreadInfo (such as the compiled-in
+    /// shadeops libraries).
+    llvm::Module *module_from_bitcode_prototype (const char *bitcode, size_t size,
+                                                 const std::string &name=std::string(),
+                                                 std::string *err=NULL);
+
     bool debug_is_enabled() const;
     void debug_setup_compilation_unit(const char * compile_unit_name);
     void debug_push_function(const std::string & function_name,
@@ -188,11 +246,21 @@ public:
     /// End the current builder
     void end_builder ();
 
+    /// Profilers that can be told about JITed code: the bits of the
+    /// profiling_events passed to make_jit_execengine() and make_jit().
+    enum ProfilingEvents {
+        ProfileIntelJIT = 1,  ///< VTune (if LLVM was built with
+                              ///<   LLVM_USE_INTEL_JITEVENTS)
+        ProfilePerfMap  = 2,  ///< Linux perf, via /tmp/perf-<pid>.map
+        ProfileJitDump  = 4   ///< Linux perf, via a jitdump file (if LLVM
+                              ///<   was built with LLVM_USE_PERF)
+    };
+
     /// Create a new JITing ExecutionEngine and make it the current one.
     /// Return a pointer to the new engine.  If err is not NULL, put any
     /// errors there.
     /// Optionally enable debugging symbols (source file & line number)
-    /// Optionally enable profiling events
+    /// Optionally enable profiling events (a bitfield of ProfilingEvents)
     /// Optionally request a specific ISA for JIT on the host
     ///     ["x64", "SSE4.2", "AVX", "AVX2", "AVX512"]
     ///     (ignored if requested ISA not valid for host)
@@ -201,7 +269,17 @@ public:
     llvm::ExecutionEngine* make_jit_execengine (std::string *err = nullptr,
                          TargetISA requestedISA = TargetISA::NONE,
                          bool debugging_symbols = false,
-                         bool profiling_events = false);
+                         int profiling_events = 0);
+
+    /// Set up JIT compilation of the current module, either with a new
+    /// MCJIT ExecutionEngine (as make_jit_execengine) or, if orc_jit() is
+    /// set, with a private JITDylib in the shared ORC session.  Takes the
+    /// same arguments as make_jit_execengine().  Return true on success;
+    /// on failure, if err is not NULL, put any errors there.
+    bool make_jit (std::string *err = nullptr,
+                   TargetISA requestedISA = TargetISA::NONE,
+                   bool debugging_symbols = false,
+                   int profiling_events = 0);
 
     /// Report the host's TargetISA as chosen by the last call to
     /// make_jit_execengine() or to detect_cpu_features(). Don't call
@@ -228,6 +306,13 @@ public:
     // Name for this TargetISA enum.
     static const char* target_isa_name(TargetISA isa);
 
+    /// Look up an OptPreset by name ("legacy", "none", "compile-fast",
+    /// "default", "aggressive"), returning UNKNOWN if not recognized.
+    static OptPreset lookup_opt_preset_by_name(string_view preset_name);
+
+    /// Return the name of the OptPreset.
+    static const char* opt_preset_name(OptPreset preset);
+
     /// Add a global mapping of a variable to its address
     /// explicitly instead of relying on dlsym.
     static void add_global_mapping (const char *global_var_name, void *global_var_addr);
@@ -289,7 +374,11 @@ public:
 
     /// Setup LLVM optimization passes.
     /// if targetHost is true, passes to target the host will be added
-    void setup_optimization_passes (int optlevel, bool target_host=true);
+    /// If preset is anything but LEGACY, optlevel is ignored and
+    /// do_optimize() runs that new pass manager pipeline instead (with
+    /// LLVM < 13, the nearest numbered optlevel is used).
+    void setup_optimization_passes (int optlevel, bool target_host=true,
+                                    OptPreset preset=OptPreset::LEGACY);
 
     /// Run the optimization passes.
     void do_optimize (std::string *err = NULL);
@@ -299,7 +388,50 @@ public:
     /// you have already called do_optimize() if you want optimization.
     void *getPointerToFunction (llvm::Function *func);
 
-    /// Wrap ExecutionEngine::InstallLazyFunctionCreator.
+    /// Retrieve a callable pointer to the function with the given symbol
+    /// name, which may be in the module or in an add_object() object.
+    void *getPointerToFunction (const std::string &name);
+
+    /// Compile the (optimized) current module into a relocatable object
+    /// file for the JIT's target, or for the given ISA if it is not
+    /// UNKNOWN (it need not be one this CPU supports), stored in object.
+    /// Return true on success; on failure, if err is not NULL, put any
+    /// errors there.
+    bool emit_object (std::string &object, std::string *err = nullptr,
+                      TargetISA isa = TargetISA::UNKNOWN);
+
+    /// Link the relocatable object (such as from emit_object, maybe in
+    /// another process) into the JIT along with the current module, so
+    /// getPointerToFunction() can retrieve its functions. Call after
+    /// make_jit(). Return true on success; on failure, if err is not NULL,
+    /// put any errors there.
+    bool add_object (string_view object, std::string *err = nullptr);
+
+    /// Make code refer to ustring constants by symbol, rather than by
+    /// their address in this process, so that an emit_object() object is
+    /// usable in another process. The i-th string of
+    /// relocatable_strings() is the symbol relocatable_string_symbol(i),
+    /// which must be bound with external_symbol() when it's loaded.
+    void relocatable (bool on) { m_relocatable = on; }
+    bool relocatable () const { return m_relocatable; }
+    const std::vector<ustring>& relocatable_strings () const {
+        return m_relocatable_strings;
+    }
+    static std::string relocatable_string_symbol (int index);
+
+    /// Return, cast to type (void* by default), the address of a global
+    /// symbol declared (once) in the module, and bound to addr in this
+    /// JIT.
+    llvm::Value *external_symbol (const std::string &name, void *addr,
+                                  llvm::PointerType *type = nullptr);
+
+    /// Return, cast to type (void* by default), a pointer to a constant
+    /// copy of data[0..size-1] in the module itself.
+    llvm::Value *constant_data_ptr (const void *data, size_t size,
+                                    llvm::PointerType *type = nullptr);
+
+    /// Wrap ExecutionEngine::InstallLazyFunctionCreator.  (For ORC, the
+    /// function is consulted for any symbol not otherwise resolved.)
     void InstallLazyFunctionCreator (void* (*P)(const std::string &));
 
 
@@ -800,6 +932,12 @@ public:
     void op_branch (llvm::Value *cond, llvm::BasicBlock *trueblock,
                     llvm::BasicBlock *falseblock);
 
+    /// Like op_branch(cond,trueblock,falseblock), but also tell LLVM the
+    /// relative frequencies with which each way is expected to be taken.
+    void op_branch (llvm::Value *cond, llvm::BasicBlock *trueblock,
+                    llvm::BasicBlock *falseblock,
+                    uint32_t true_weight, uint32_t false_weight);
+
     /// Generate code for a memset.
     void op_memset (llvm::Value *ptr, int val, int len, int align=1);
 
@@ -851,6 +989,16 @@ public:
     // Blind pointer version that's deprecated as of LLVM13:
     llvm::Value *GEP (llvm::Value *ptr, llvm::Value *elem);
 
+    /// Like GEP(type,ptr,elem), but promising LLVM that the result stays
+    /// within the object ptr points into (an "inbounds" GEP). For an
+    /// index that is known, or checked, to be in range, this lets LLVM
+    /// see accesses in loops as plain strided addresses, as the loop
+    /// vectorizer needs.
+    llvm::Value *GEP_inbounds (llvm::Type* type, llvm::Value *ptr,
+                               llvm::Value *elem);
+    // Blind pointer version that's deprecated as of LLVM13:
+    llvm::Value *GEP_inbounds (llvm::Value *ptr, llvm::Value *elem);
+
     /// Generate a GEP (get element pointer) with an integer element
     /// offset. `type` is the type of the data we're retrieving.
     llvm::Value *GEP (llvm::Type* type, llvm::Value *ptr, int elem);
@@ -894,6 +1042,8 @@ public:
     llvm::Value *op_zero_if(llvm::Value *cond, llvm::Value *a);
 
     llvm::Value * op_1st_active_lane_of(llvm::Value * mask);
+    /// Return the number of lanes of the mask that are on, as an int.
+    llvm::Value * op_count_active_lanes(llvm::Value * mask);
     llvm::Value * op_lanes_that_match_masked(llvm::Value * scalar_value,
         llvm::Value * wide_value, llvm::Value * mask);
 
@@ -947,28 +1097,78 @@ public:
 
     std::string func_name (llvm::Function *f);
 
+    /// Take over the JIT memory of this module: the code stays valid for
+    /// as long as the returned reference (or a copy) is held, and is freed
+    /// when the last one is dropped, which may be before or after the
+    /// last ScopedJitMemoryUser is gone. If jit_memory() is never called,
+    /// the code is held until the last ScopedJitMemoryUser is gone. Only
+    /// meaningful after make_jit().
+    std::shared_ptr<JitMemory> jit_memory ();
+
+    /// Total bytes of JIT code and data in use by JITed modules.
     static size_t total_jit_memory_held ();
 
+    /// Total bytes of JIT code and data freed by modules but kept pooled
+    /// for reuse.
+    static size_t total_jit_memory_freed ();
+
+    /// Total number of functions that orc_jit_lazy() has compiled so far,
+    /// on first call.
+    static size_t total_lazy_functions_compiled ();
+
+    /// Total bytes of JIT code and data ever allocated by the calling
+    /// thread. The difference across a make_jit() and the
+    /// getPointerToFunction() calls that follow it is the size of the
+    /// module's code (except for ORC lazy JIT, which compiles functions
+    /// on whatever thread first calls them).
+    static size_t thread_jit_memory_allocated ();
+
+    /// Place JIT code sections from now on (for every LLVM_Util in the
+    /// process) in huge-page-backed arenas, packed in the order they are
+    /// made. Such code is left writable as well as executable.
+    static void jit_huge_pages (bool on);
+
 private:
     class MemoryManager;
     class IRBuilder;
+    struct OrcJIT;
 
     void SetupLLVM ();
     IRBuilder& builder();
 
+    bool make_orc_jit (std::string *err, TargetISA requestedISA,
+                       bool debugging_symbols, int profiling_events);
+    void *orc_getPointerToFunction (llvm::Function *func);
+    void *orc_getPointerToFunction (const std::string &name);
+    bool orc_add_lazy_module (llvm::orc::JITDylib &dylib, std::string &err);
+    llvm::TargetMachine *target_machine ();
+    const llvm::DataLayout &data_layout ();
+    void setup_target_options (llvm::TargetOptions &options);
+    void setup_debug_info ();
+    void run_opt_preset ();
+
     int m_debug;
     bool m_dumpasm = false;
     bool m_jit_fma = false;
     bool m_jit_aggressive = false;
+    bool m_orc_jit = false;
+    bool m_orc_jit_lazy = false;
     PerThreadInfo::Impl *m_thread;
     llvm::LLVMContext *m_llvm_context;
     llvm::Module *m_llvm_module;
     IRBuilder *m_builder;
-    llvm::SectionMemoryManager *m_llvm_jitmm;
+    std::shared_ptr<JitMemory> m_jit_memory;
+    bool m_jit_memory_taken = false;
     llvm::Function *m_current_function;
     llvm::legacy::PassManager *m_llvm_module_passes;
     llvm::legacy::FunctionPassManager *m_llvm_func_passes;
     llvm::ExecutionEngine *m_llvm_exec;
+    OrcJIT *m_orc = nullptr;    // ORC session state, if orc_jit()
+    bool m_relocatable = false;
+    std::vector<ustring> m_relocatable_strings;
+    std::unordered_map<const char*, int> m_relocatable_string_index;
+    OptPreset m_opt_preset = OptPreset::LEGACY;
+    bool m_opt_target_host = true;
     TargetISA m_target_isa = TargetISA::UNKNOWN;
 
     std::vector<llvm::BasicBlock *> m_return_block;     // stack for func call
@@ -1023,6 +1223,7 @@ private:
 
     // Profiling Info
     llvm::JITEventListener* mVTuneNotifier;
+    int m_shared_listeners;  // ProfilingEvents registered with m_llvm_exec
 
     // Debug Info
     llvm::DIFile * getOrCreateDebugFileFor(const std::string &file_name);
@@ -1106,6 +1307,7 @@ private:
 
     llvm::Value * op_linearize_16x_indices (llvm::Value *wide_index);
     llvm::Value * op_linearize_8x_indices (llvm::Value *wide_index);
+    llvm::Value * op_linearize_4x_indices (llvm::Value *wide_index);
     std::array<llvm::Value *,2> op_split_16x (llvm::Value * vector_val);
     std::array<llvm::Value *,2> op_split_8x (llvm::Value * vector_val);
     std::array<llvm::Value *,4> op_quarter_16x (llvm::Value * vector_val);
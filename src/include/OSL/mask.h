@@ -4,7 +4,10 @@
 
 #pragma once
 
-#include <immintrin.h>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) \
+    || defined(_M_IX86)
+#    include <immintrin.h>
+#endif
 #include <type_traits>
 
 #include <OSL/oslconfig.h>
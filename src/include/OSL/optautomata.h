@@ -9,6 +9,7 @@
 #include <OSL/export.h>
 #include <OSL/oslversion.h>
 
+#include <string>
 #include <vector>
 
 OSL_NAMESPACE_ENTER
@@ -22,25 +23,58 @@ class DfAutomata;
 /// is a fast compact equivalent of the DfAutomata designed for read
 /// only operations.
 ///
+/// The symbols the automata knows about are interned to small integers
+/// when it is compiled, and the transitions are a dense table indexed by
+/// (state, symbol id), one row of ints per state. A move is then a
+/// search of the (small) alphabet, which doesn't depend on the state,
+/// and a single load.
+///
 class OSLEXECPUBLIC DfOptimizedAutomata {
 public:
     void compileFrom(const DfAutomata& dfautomata);
 
-    int getTransition(int state, OIIO::ustring symbol) const
+    /// Append the automata to blob in a compact binary form that load()
+    /// can read back, in this or another process on the same platform.
+    /// The rules, which are opaque pointers, are written as their index
+    /// in the rules vector, and must all be there.
+    void save(std::string& blob, const std::vector<void*>& rules) const;
+
+    /// Read an automata that save() wrote at blob[pos], leaving pos just
+    /// past it. The rule indices are turned back into pointers with rules.
+    /// Returns false, leaving the automata alone, if the data is
+    /// malformed or names a rule that isn't there.
+    bool load(const std::string& blob, size_t& pos,
+              const std::vector<void*>& rules);
+
+    /// The id of a symbol, or symbolCount() for a symbol that no
+    /// transition mentions (which can only follow a wildcard).
+    int symbolId(OIIO::ustring symbol) const
     {
-        const State& mystate    = m_states[state];
-        const Transition* begin = &m_trans[mystate.begin_trans];
-        const Transition* end   = begin + mystate.ntrans;
+        const char* const* begin = m_symbols.data();
+        const char* const* end   = begin + m_symbols.size();
         while (begin < end) {  // binary search
-            const Transition* middle = begin + ((end - begin) >> 1);
-            if (symbol.data() < middle->symbol.data())
+            const char* const* middle = begin + ((end - begin) >> 1);
+            if (symbol.data() < *middle)
                 end = middle;
-            else if (middle->symbol.data() < symbol.data())
+            else if (*middle < symbol.data())
                 begin = middle + 1;
             else  // match
-                return middle->state;
+                return int(middle - m_symbols.data());
         }
-        return mystate.wildcard_trans;
+        return symbolCount();
+    }
+
+    int symbolCount() const { return int(m_symbols.size()); }
+
+    /// Transition by a symbol id from symbolId()
+    int getTransitionById(int state, int symbolid) const
+    {
+        return m_table[size_t(state) * m_row + symbolid];
+    }
+
+    int getTransition(int state, OIIO::ustring symbol) const
+    {
+        return getTransitionById(state, symbolId(symbol));
     }
 
     void* const* getRules(int state, int& count) const
@@ -49,7 +83,23 @@ public:
         return &m_rules[m_states[state].begin_rules];
     }
 
+    /// Number of states in the compiled automata
+    int stateCount() const { return int(m_states.size()); }
+
+    /// Bytes of storage held by the compiled automata
+    size_t memoryUsed() const
+    {
+        return m_trans.capacity() * sizeof(Transition)
+               + m_rules.capacity() * sizeof(void*)
+               + m_states.capacity() * sizeof(State)
+               + m_symbols.capacity() * sizeof(const char*)
+               + m_table.capacity() * sizeof(int);
+    }
+
 protected:
+    // Build m_symbols and m_table from the sparse transitions
+    void buildTable();
+
     struct State {
         unsigned int begin_trans;
         unsigned int ntrans;
@@ -66,6 +116,12 @@ protected:
     std::vector<Transition> m_trans;
     std::vector<void*> m_rules;
     std::vector<State> m_states;
+    // Interned alphabet, sorted by address like the transitions
+    std::vector<const char*> m_symbols;
+    // Dense transitions: m_row = symbolCount()+1 entries per state, the
+    // last being the wildcard transition
+    std::vector<int> m_table;
+    size_t m_row = 1;
 };
 
 OSL_NAMESPACE_EXIT
@@ -15,6 +15,12 @@ class OSLCompilerImpl;
 
 
 
+/// An OSLCompiler may be kept around and used for any number of compiles,
+/// one at a time, which is cheaper than making a new one for each:
+/// starting with its second compile, it preprocesses stdosl.h once per
+/// set of defines and include paths and reuses the result (as the oslc
+/// --header-cache option does), so each call only has to process the
+/// shader's own source.
 class OSLCOMPPUBLIC OSLCompiler {
 public:
     OSLCompiler(ErrorHandler* errhandler = NULL);
@@ -4,9 +4,12 @@
 
 #pragma once
 
+#include <functional>
+#include <future>
 #include <memory>
 
 #include <OSL/oslconfig.h>
+#include <OSL/rendererservices.h>
 #include <OSL/shaderglobals.h>
 
 #include <OpenImageIO/refcnt.h>
@@ -50,7 +53,7 @@ class ShadingSystemImpl;
 }
 
 #if defined(__CUDA_ARCH__) && OPTIX_VERSION >= 70000
-#  define STRING_PARAMS(x)  UStringHash::Hash(__OSL_STRINGIFY(x))
+#  define STRING_PARAMS(x)  OSL_NAMESPACE::Hashes::x
 #else
 #  define STRING_PARAMS(x)  StringParams::x
 #endif
@@ -103,6 +106,39 @@ public:
     stride_t stride = AutoStride;     ///< Stride in bytes between shade points
     SymArena arena = SymArena::Heap;  ///< Memory arena type for the symbol
     bool derivs = false;              ///< Space allocated for derivs also
+    /// Batched userdata only: rather than a record per shade point, at
+    /// base+offset is the whole batch's data laid out as the symbol is
+    /// held in a batch, so that the JITed code can load it with a vector
+    /// load per component. That is, for the value (then the x and y
+    /// derivs, if 'derivs'), for each array element, for each component,
+    /// one Block of the batch width's values, lane i of the batch in
+    /// slot i; e.g. the Block<Vec3> of a point. Blocks must be aligned as
+    /// Block<> is, and 'stride' is ignored. The renderer fills them in
+    /// for each batch before executing it. Scalar execution ignores such
+    /// records and asks for the userdata as if there were none.
+    bool soa = false;
+};
+
+
+
+/// A connection between two layers of a shader group, for the bulk form
+/// of ShadingSystem::ConnectShaders. Layers are given by their index in
+/// the group, and parameters by their index among their shader's
+/// parameters -- the order in which OSLQuery lists them -- so the names
+/// need only be looked up once per shader rather than once per group. A
+/// non-negative arrayindex or channel connects just that array element or
+/// color/vector component, as "param[i]" does when connecting by name.
+struct ShaderConnection {
+    ShaderConnection () {}
+    ShaderConnection (int srclayer, int srcparam, int dstlayer, int dstparam)
+        : srclayer(srclayer), srcparam(srcparam),
+          dstlayer(dstlayer), dstparam(dstparam)
+    {}
+
+    int srclayer = -1, srcparam = -1;         ///< Upstream layer, parameter
+    int dstlayer = -1, dstparam = -1;         ///< Downstream layer, parameter
+    int srcarrayindex = -1, srcchannel = -1;  ///< Source element/component
+    int dstarrayindex = -1, dstchannel = -1;  ///< Dest element/component
 };
 
 
@@ -129,6 +165,14 @@ public:
     ///                              when NaN/Inf happens (0).
     ///    int debug_uninit       Add extra (expensive) code to pinpoint
     ///                              use of uninitialized variables (0).
+    ///    int debug_sample       If nonzero (N), the debug_nan and
+    ///                              debug_uninit checks are left out of the
+    ///                              code groups normally run, and instead
+    ///                              each context runs one in every N
+    ///                              executions with a separately compiled
+    ///                              copy of the group that has them. Set
+    ///                              it before declaring groups. Batched
+    ///                              execution always has the checks. (0)
     ///    int compile_report     Issue info messages to the renderer for
     ///                              every shader compiled (0).
     ///    int max_warnings_per_thread  Number of warning calls that should be
@@ -136,7 +180,18 @@ public:
     ///    int buffer_printf      Buffer printf output from shaders and
     ///                              output atomically, to prevent threads
     ///                              from interleaving lines. (1)
-    ///    int profile            Perform some rudimentary profiling (0)
+    ///    int profile            Perform some rudimentary profiling (0).
+    ///                              A value of 2 also times each layer
+    ///                              of the groups JITed from then on,
+    ///                              and 3 also counts and times (and
+    ///                              counts the failures of) each texture,
+    ///                              texture3d, environment, getattribute
+    ///                              and pointcloud call site by source
+    ///                              file and line. A value of 4 also
+    ///                              counts how often each line of shader
+    ///                              source runs, listed with the source
+    ///                              in the stats. Code loaded from a JIT
+    ///                              cache or precompiled isn't timed.
     ///    int no_noise           Replace noise with constant value. (0)
     ///    int no_pointcloud      Skip pointcloud lookups. (0)
     ///    int exec_repeat        How many times to run each group (1).
@@ -152,6 +207,20 @@ public:
     ///    string[] renderer_outputs
     ///                           Array of names of renderer outputs (AOVs)
     ///                              that should not be optimized away.
+    ///    string capture         If not empty, the name of a file to which
+    ///                              each scalar execute() appends its
+    ///                              group, the ShaderGlobals it was given,
+    ///                              and the matrices, attributes and
+    ///                              userdata the renderer answered, for
+    ///                              replay() to run again later without
+    ///                              the renderer. Setting it again starts
+    ///                              a new file; "" stops capturing. ("")
+    ///    string[] object_attributes
+    ///                           Names of attributes and userdata whose
+    ///                              values are the same at every point of
+    ///                              an object. Once a context is told the
+    ///                              object with set_object, their lookups
+    ///                              are remembered until it changes.
     ///    int unknown_coordsys_error  Should errors be issued when unknown
     ///                              coord system names are used? (1)
     ///    int connection_error   Should errors be issued when ConnectShaders
@@ -170,6 +239,41 @@ public:
     ///    int lazyerror          Run layers lazily even if they have error
     ///                              ops after optimization (1).
     ///    int lazy_userdata      Retrieve userdata lazily (0).
+    ///    int cache_lookups      Remember the results of named-space matrix
+    ///                              (including "shader" and "object", and
+    ///                              the inverses) and getattribute lookups
+    ///                              for the rest of the point's (or
+    ///                              batch's) execution, so later layers
+    ///                              don't ask the renderer again (0).
+    ///    int deferred_trace     Don't have the renderer trace the rays
+    ///                              of trace() calls as they are made:
+    ///                              record them (trace() returns 0) for
+    ///                              the renderer to trace together and
+    ///                              answer with resume_traces (0).
+    ///                              Scalar shading only.
+    ///    float closure_weight_threshold  Closures whose weight is below
+    ///                              this in every channel are dropped as
+    ///                              they are made, as zero-weighted ones
+    ///                              always are, rather than allocated and
+    ///                              left for the renderer to prune (0).
+    ///    int pointcloud_bake_index  When a cloud made by pointcloud_write
+    ///                              is saved, also save its search index
+    ///                              beside it (as "<file>.oslpci"), which
+    ///                              later renders memory map instead of
+    ///                              rebuilding (0).
+    ///    int pointcloud_bake_pages  When a cloud made by pointcloud_write
+    ///                              is saved, also save a paged copy
+    ///                              beside it (as "<file>.oslpcp"); see
+    ///                              make_paged_pointcloud() (0).
+    ///    int pointcloud_max_memory_MB  Most memory held by the pages of
+    ///                              paged point clouds (1024).
+    ///    int cache_textureinfo  Remember gettextureinfo results (for any
+    ///                              filename, even one computed at run
+    ///                              time) in a cache all threads share,
+    ///                              rather than asking the renderer on
+    ///                              every call.  Turn this off if the
+    ///                              renderer's answers can change during
+    ///                              a render (1).
     ///    int userdata_isconnected  Should lockgeom=0 params (that may
     ///                              receive userdata) return true from
     ///                              isconnected()? (0)
@@ -184,22 +288,144 @@ public:
     ///    string llvm_jit_target  JIT to a specific ISA: "" or "none" means
     ///                              no special ops, "x64", "SSE4.2", "AVX",
     ///                              "AVX2", "AVX2_noFMA", "AVX512",
-    ///                              "AVX512_noFMA", or "host" means to
-    ///                              figure out what the host can do. ("")
+    ///                              "AVX512_noFMA", "NEON" (AArch64), or
+    ///                              "host" means to figure out what the
+    ///                              host can do. ("")
     ///    int llvm_jit_aggressive  Use LLVM "aggressive" JIT mode. (0)
+    ///    int llvm_jit_orc       JIT with one ORC LLJIT session shared by all
+    ///                             threads, rather than an MCJIT engine per
+    ///                             group (needs LLVM >= 13; ignored
+    ///                             otherwise). (0)
+    ///    int llvm_jit_lazy      With llvm_jit_orc, compile each layer only
+    ///                             when it is first run, so layers that
+    ///                             lazylayers never reaches are never
+    ///                             compiled; see
+    ///                             stat:jit_lazy_functions_compiled. (0)
+    ///    int llvm_jit_tiered    JIT each group first with next to no LLVM
+    ///                             optimization so it can shade right
+    ///                             away, then re-JIT it in the background
+    ///                             at the llvm_optimize level. (0)
+    ///    int llvm_pgo_samples   If nonzero, JIT each group with counters
+    ///                             on its conditional branches, and after
+    ///                             the group has been executed this many
+    ///                             times, re-JIT it in the background
+    ///                             laid out for the branches it actually
+    ///                             took. (0)
+    ///    int llvm_aot_output    Also compile each group into relocatable
+    ///                             code (see group attribute
+    ///                             "llvm_aot_object") that other processes
+    ///                             can load instead of JITing it. (0)
+    ///    string llvm_aot_isas   Comma-separated ISAs (llvm_jit_target
+    ///                             names) to compile llvm_aot_output code
+    ///                             for; the loading process uses the best
+    ///                             one its CPU supports. "" means just the
+    ///                             JIT's own ISA. ("")
+    ///    int max_jit_memory_MB  If nonzero, whenever compiling a group
+    ///                             brings the JIT memory in use over this
+    ///                             many MB, release the JITed code and
+    ///                             optimized instances of the groups
+    ///                             executed least recently (none executed
+    ///                             since the last time this happened). An
+    ///                             evicted group is optimized and JITed
+    ///                             again the next time it's executed, or
+    ///                             loaded from its "llvm_aot_object" if it
+    ///                             has one. See stat:groups_evicted. (0)
+    ///    int async_optimize     If nonzero, execute() (but not the batched
+    ///                             or OptiX paths) never waits for a group
+    ///                             to be optimized and JITed: it hands the
+    ///                             group to up to this many background
+    ///                             threads and returns false right away
+    ///                             (or runs the group's "fallback_group",
+    ///                             if it has one) until the group is
+    ///                             ready. See optimize_group_async and the
+    ///                             group attribute "ready". (0)
+    ///    string ptx_cache_dir   For OptiX, a directory in which to keep
+    ///                             the PTX made for each group, keyed by
+    ///                             its LLVM IR, the CUDA target, and the
+    ///                             OSL and LLVM versions, so that a group
+    ///                             compiled by an earlier run skips LLVM
+    ///                             optimization and PTX generation. A
+    ///                             renderer may keep OptiX's own module
+    ///                             cache there too, as testrender and
+    ///                             testshade do. ("")
+    ///    string jit_cache_dir   A directory, possibly shared by many
+    ///                             machines, of precompiled group code
+    ///                             (see "llvm_aot_object") keyed by the
+    ///                             group, its shaders, and the options
+    ///                             its code depends on. A group found
+    ///                             there is loaded instead of JITed; one
+    ///                             that isn't is JITed and its code left
+    ///                             there for the next process. Cache
+    ///                             files are mapped and used in place,
+    ///                             so processes on one machine share
+    ///                             them rather than each keeping a copy.
+    ///                             Groups with non-lockgeom params
+    ///                             aren't cached. See also jit_cache().
+    ///                             ("")
     ///    int vector_width       Vector width to allow for SIMD ops (4).
     ///    int llvm_debugging_symbols  When JITing, generate debug symbols
     ///                             that associate machine code with shader
     ///                             source and lines. (0)
     ///    int llvm_profiling_events  When JITing, generate events to enable
-    ///                             full profiling of shaders. (0)
+    ///                             full profiling of shaders, for each
+    ///                             profiler whose bit is set: 1 = VTune,
+    ///                             2 = Linux perf map (/tmp/perf-<pid>.map),
+    ///                             4 = Linux perf jitdump. Code is named by
+    ///                             group and layer. (0)
     ///    int lockgeom           Default 'lockgeom' value for shader params
     ///                              that don't specify it (1).  Lockgeom
     ///                              means a param CANNOT be overridden by
     ///                              interpolated geometric parameters.
+    ///    int raytype_variants   If nonzero, execute() (but not the
+    ///                              batched or OptiX paths) runs each group
+    ///                              as a copy of itself optimized for the
+    ///                              ray types in sg.raytype that its shaders
+    ///                              query, keeping up to this many such
+    ///                              copies per group; other ray types run
+    ///                              the group itself. Copies are made from
+    ///                              the group as of ShaderGroupEnd, so look
+    ///                              up symbols through the context (e.g.,
+    ///                              get_symbol(ctx,...)), not the group. (0)
+    ///    int output_variants    If nonzero, the execute() that names the
+    ///                              outputs it needs runs a copy of the
+    ///                              group optimized to compute only those,
+    ///                              keeping up to this many such copies
+    ///                              per group; other subsets run the
+    ///                              group itself. As with raytype_variants,
+    ///                              copies are made from the group as of
+    ///                              ShaderGroupEnd. (0)
+    ///    int dedupe_groups      If nonzero, groups that are identical in
+    ///                              their shaders, parameters, connections,
+    ///                              and group attributes share one
+    ///                              optimized and JITed copy of their code
+    ///                              rather than each being compiled on its
+    ///                              own. Groups with lockgeom=0 parameters
+    ///                              (or any, with reparam_reoptimize) are
+    ///                              not shared. A group that shares runs as
+    ///                              the first of its kind, so look up its
+    ///                              symbols through the context. (0)
+    ///    int reparam_reoptimize  Let ReParameter change any parameter of
+    ///                              an optimized group, not just lockgeom=0
+    ///                              ones, by having the group optimized and
+    ///                              JITed again, with the new value, the
+    ///                              next time it's used (0). Combine with
+    ///                              opt_memoize_instances so that layers the
+    ///                              change doesn't reach reuse their prior
+    ///                              optimization.
     ///    int countlayerexecs    Add extra code to count total layers run.
+    ///    int batched_lane_stats Add extra code to batched groups to count
+    ///                              how many lanes are on as each layer
+    ///                              runs and as varying loops go around,
+    ///                              reported per group by getstats(). (0)
+    ///    uint8[] batched_rs_bitcode  LLVM bitcode defining the functions
+    ///                              of <OSL/batched_rs_free_function.h>,
+    ///                              linked into batched groups so their
+    ///                              matrix lookups inline rather than
+    ///                              calling BatchedRendererServices.
     ///    int allow_shader_replacement Allow shader to be specified more than
-    ///                              once, replacing former definition.
+    ///                              once, replacing former definition, and
+    ///                              allow reload_shader().  Groups keep a
+    ///                              copy of their unoptimized state for it.
     ///    string archive_groupname  Name of a group to pickle and archive.
     ///    string archive_filename   Name of file to save the group archive.
     /// 3. Attributes that that are intended for developers debugging
@@ -217,9 +443,132 @@ public:
     ///         opt_merge_instances, opt_merge_instance_with_userdata,
     ///         opt_fold_getattribute, opt_middleman, opt_texture_handle
     ///         opt_seed_bblock_aliases
+    ///    int opt_cross_layer_cse  If nonzero, when a layer computes the
+    ///                             same costly pure op (noise, transform,
+    ///                             etc.) on the same constants and globals
+    ///                             as an earlier layer it's connected to,
+    ///                             have the earlier layer pass its result
+    ///                             down rather than computing it twice. (0)
+    ///    int opt_loop_invariants  If nonzero, move ops that compute the
+    ///                             same value on every trip through a
+    ///                             loop (transforms, getattribute, noise
+    ///                             on loop-invariant inputs, etc.) to run
+    ///                             once before the loop. (0)
+    ///    int opt_transient_strings  If nonzero, strings made by concat,
+    ///                             substr or format that are only ever
+    ///                             printed or built into other such
+    ///                             strings are kept in per-context scratch
+    ///                             memory for the shading point, rather
+    ///                             than added to the global string table
+    ///                             forever. (1)
+    ///    int opt_range_checks  If nonzero, when range_checking is on,
+    ///                             leave out the check on array, component
+    ///                             and matrix indices that are provably in
+    ///                             bounds, such as the induction variable
+    ///                             of a "for (int i = 0; i < N; ++i)" loop
+    ///                             indexing an array of length N. (1)
+    ///    int opt_texture_coalesce  If nonzero, a texture() call that
+    ///                             looks up one float channel is folded
+    ///                             into an earlier call in the same basic
+    ///                             block with the same file, coordinates
+    ///                             and options whose channels end just
+    ///                             before it (e.g. RGB, then "firstchannel"
+    ///                             3), which then fetches it as its
+    ///                             "alpha", so both take one filtered
+    ///                             lookup. (0)
+    ///    int opt_deriv_axes       If nonzero, derivatives that only ever
+    ///                             feed Dx() (or only Dy()) are computed
+    ///                             for that one axis; the other partial
+    ///                             is zeroed once when the layer starts
+    ///                             (NaN under debug_uninit) instead of
+    ///                             being computed. (1)
+    ///    int opt_batched_coherent_branches  For batched execution: if
+    ///                             nonzero, a varying "if" whose sides are
+    ///                             each at most this many ops (and hold no
+    ///                             return, exit, break, continue or
+    ///                             function call) gets a second copy of
+    ///                             each side, built with all lanes known to
+    ///                             be on. When the whole batch is active
+    ///                             and agrees on the condition, that copy
+    ///                             runs instead, with no masking. (0)
     ///    int opt_passes         Number of optimization passes per layer (10)
+    ///    float opt_pass_min_change  A layer stops being optimized before
+    ///                             opt_passes once a pass changes no more
+    ///                             than this fraction of its ops (e.g.
+    ///                             0.001); with 0, only once passes stop
+    ///                             changing anything at all. (0)
+    ///    float opt_time_budget_ms  If nonzero, once the runtime optimizer
+    ///                             has spent this many milliseconds on a
+    ///                             group, each remaining layer gets just
+    ///                             one pass in each direction. compile_report
+    ///                             and the group's compile stats show how
+    ///                             many layers it cut short. (0)
+    ///    int opt_memoize_instances  If nonzero, remember up to this many
+    ///                             runtime-optimized layers, so that a layer
+    ///                             with no incoming connections that is
+    ///                             identical (master, parameter values,
+    ///                             downstream connections) to one already
+    ///                             optimized, in any group, reuses the
+    ///                             result rather than being re-optimized.
+    ///                             Layers whose optimization queries the
+    ///                             renderer aren't memoized. (0)
+    ///    int opt_parallel_layers  If > 1, the number of threads that one
+    ///                             group's optimization may use for its
+    ///                             per-layer cleanup passes (useparam
+    ///                             insertion, temp coalescing, symbol and
+    ///                             op collapsing). The passes that follow
+    ///                             connections between layers stay serial.
+    ///                             Only worth it for groups with many
+    ///                             layers. (0)
+    ///    int opt_groupdata_layout  If nonzero, lay out the per-point group
+    ///                             data with the fields that pass values
+    ///                             between layers first, then the rest of
+    ///                             the params the code uses, and params no
+    ///                             code touches and big arrays last, rather
+    ///                             than in plain layer order. Helps keep
+    ///                             the hot part of the block of big groups
+    ///                             in few cache lines. (0)
+    ///    int opt_groupdata_share  If nonzero, let the input params of
+    ///                             layers that are neither upstream nor
+    ///                             downstream of each other share the same
+    ///                             per-point group data, since they can
+    ///                             never be needed at the same time. Their
+    ///                             values can't be examined after shading
+    ///                             (outputs and renderer outputs always
+    ///                             can). (0)
+    ///    int opt_message_slots  If nonzero, when every setmessage and
+    ///                             getmessage in a group names its message
+    ///                             with a constant string, give each
+    ///                             message a fixed place in the group data
+    ///                             instead of looking it up by name on the
+    ///                             message blackboard as the shader runs.
+    ///                             Errors are reported just the same. (0)
+    ///    int opt_upfront_layers  If nonzero, have the group entry run
+    ///                             first, in order, every lazy layer that
+    ///                             its code (or that of another such
+    ///                             layer) is sure to read from, so that
+    ///                             reading their outputs needs no check of
+    ///                             whether they have run yet. Only the
+    ///                             order of their printfs and the like
+    ///                             can change. (0)
     ///    int llvm_optimize      Which of several LLVM optimize strategies (1)
-    ///    int llvm_debug         Set LLVM extra debug level (0)
+    ///    string llvm_opt_preset  Use one of LLVM's new pass manager
+    ///                              pipelines instead of llvm_optimize:
+    ///                              "none", "compile-fast", "default", or
+    ///                              "aggressive". "" or "legacy" means to
+    ///                              use llvm_optimize. (""). Needs LLVM >=
+    ///                              13; otherwise the closest llvm_optimize
+    ///                              level is used.
+    ///    string math_precision  Accuracy of the transcendental shadeops
+    ///                              (sin, cos, exp, log, pow, ...):
+    ///                              "fast" for the OIIO fast_* polynomial
+    ///                              approximations (a few ULP), "accurate"
+    ///                              for the system math library, or
+    ///                              "default" for the build's choice
+    ///                              (USE_FAST_MATH). ("default")
+    ///    int llvm_debug         Set LLVM extra debug level, which also
+    ///                              prints the loop and SLP vectorizers'
+    ///                              remarks while optimizing. (0)
     ///    int llvm_debug_layers  Extra printfs upon entering and leaving
     ///                              layer functions.
     ///    int llvm_debug_ops     Extra printfs for each OSL op (helpful
@@ -232,6 +581,24 @@ public:
     ///                              "internalize", or "none").
     ///    int max_local_mem_KB   Error if shader group needs more than this
     ///                              much local storage to execute (1024K)
+    ///    int context_pool_KB    Allocate this much closure memory and
+    ///                              this much scratch memory up front in
+    ///                              every shading context, so that
+    ///                              executions needing no more than that
+    ///                              never allocate. The "Most closure/
+    ///                              scratch memory used" stats say how much
+    ///                              is enough. (0)
+    ///    int numa_local         Only reuse a released context on threads
+    ///                              of the NUMA node it was used on, so its
+    ///                              heap and closure pools stay node-local
+    ///                              memory. Make each thread's PerThreadInfo
+    ///                              on that thread. (0)
+    ///    int huge_pages         Put JIT code, packed in the order it's
+    ///                              made, and context heaps of 2 MB or
+    ///                              more in (transparent) 2 MB huge pages,
+    ///                              to cut TLB misses. Applies to all
+    ///                              shading systems in the process, and
+    ///                              leaves JIT code writable. (0)
     ///    string debug_groupname Name of shader group -- debug only this one
     ///    string debug_layername Name of shader layer -- debug only this one
     ///    int optimize_nondebug  If 1, fully optimize shaders that are not
@@ -275,6 +642,43 @@ public:
     ///                                 be elided, but nor will they be
     ///                                 called unconditionally.
     ///    int exec_repeat            How many times to run the group (1).
+    ///    string llvm_opt_preset     Override the ShadingSystem's
+    ///                                 llvm_opt_preset for this group ("").
+    ///    string math_precision      Override the ShadingSystem's
+    ///                                 math_precision for this group ("").
+    ///    int batch_width            The width (4, 8 or 16) the group is to be
+    ///                                 JITed and executed at by a
+    ///                                 BatchedExecutor; a group holds code
+    ///                                 for only one. 0 (the default) leaves
+    ///                                 it to the first width it is JITed
+    ///                                 at. Fails once the group has been
+    ///                                 batch-JITed at another width.
+    ///    ptr llvm_aot_object        Pointer to a std::string holding the
+    ///                                 precompiled code of an identical
+    ///                                 group (see getattribute) to load in
+    ///                                 place of LLVM code generation. If it
+    ///                                 doesn't fit (different group, OSL
+    ///                                 version, or ISA), the group is JITed
+    ///                                 as usual.
+    ///    string[] instance_parameters  Names ("layer.param", or "param"
+    ///                                 for the last layer that has one by
+    ///                                 that name) of parameters that are
+    ///                                 not compiled into the group but read
+    ///                                 by each execute() from a block of
+    ///                                 instance data that its
+    ///                                 userdata_base_ptr points to, so that
+    ///                                 one group may serve many materials
+    ///                                 that differ only in those values.
+    ///                                 The optimizer still specializes on
+    ///                                 all other parameters. Must be set
+    ///                                 before the group is optimized; see
+    ///                                 getattribute for the block's layout.
+    ///    ptr fallback_group         Pointer to a ShaderGroupRef holding a
+    ///                                 group to execute in this one's place
+    ///                                 while it is being optimized in the
+    ///                                 background (see async_optimize);
+    ///                                 an empty ref clears it. Set it
+    ///                                 before the group is first executed.
     ///
     bool attribute (ShaderGroup *group, string_view name,
                     TypeDesc type, const void *val);
@@ -321,6 +725,16 @@ public:
     ///   library build dependencies and their versions (for example,
     ///   "OIIO-2.3.0,LLVM-10.0.0,OpenEXR-2.5.0").
     ///
+    /// - `stat:*` : Each of the statistics that getstats() reports, for
+    ///   example `int stat:groups_compiled` or `float stat:llvm_jit_time`.
+    ///
+    /// - `int stat:num_names`, `string[] stat:names`, `double[]
+    ///   stat:values` : The names of all the `stat:*` attributes above,
+    ///   and all their current values in the same order, as doubles. This
+    ///   is cheap enough to sample periodically while rendering. Per-group
+    ///   statistics are attributes of the group (see the group version
+    ///   of getattribute()).
+    ///
     bool getattribute (string_view name, TypeDesc type, void *val);
 
     /// Shortcut getattribute() for retrieving a single integer.
@@ -370,6 +784,25 @@ public:
     ///   string groupname           The name of the shader group.
     ///   int num_layers             The number of layers in the group.
     ///   string[] layer_names       The names of the layers in the group.
+    ///   string llvm_opt_preset     The LLVM pipeline preset the group will
+    ///                                be optimized with.
+    ///   string math_precision      The math precision the group's
+    ///                                transcendental ops are bound at.
+    ///   int batch_width            The width (4, 8 or 16) to run the group
+    ///                                batched at: the one set, else the
+    ///                                one it was batch-JITed at, else a
+    ///                                guess from its optimized code -- 8
+    ///                                for groups that are mostly texture,
+    ///                                getattribute, string and closure ops
+    ///                                (which go a lane at a time) or that
+    ///                                keep more float values live than
+    ///                                there are vector registers, 16
+    ///                                otherwise. shade_image() uses it.
+    ///   ptr llvm_aot_object        Copies into the std::string pointed to
+    ///                                the group's precompiled code, made
+    ///                                when it was JITed with the
+    ///                                ShadingSystem's llvm_aot_output set,
+    ///                                or registered with attribute().
     ///   int num_textures_needed    The number of texture names that are
     ///                                known to be potentially needed by the
     ///                                group (after optimization).
@@ -379,6 +812,14 @@ public:
     ///   int unknown_textures_needed  Nonzero if additional textures may be
     ///                                needed, whose names can't be known
     ///                                without actually running the shader.
+    ///   int num_pointclouds_needed The number of point cloud files that
+    ///                                pointcloud_search or pointcloud_get
+    ///                                are known to read.
+    ///   ptr pointclouds_needed     Retrieves a pointer to the ustring array
+    ///                                of those point cloud names.
+    ///   int unknown_pointclouds_needed  Nonzero if other clouds may be
+    ///                                read, whose names can't be known
+    ///                                without actually running the shader.
     ///   int num_closures_needed    The number of named closures needed.
     ///   ptr closures_needed        Retrieves a pointer to the ustring array
     ///                                containing all closures known to be
@@ -386,12 +827,43 @@ public:
     ///   int unknown_closures_needed  Nonzero if additional closures may be
     ///                                needed, whose names can't be known
     ///                                without actually running the shader.
+    ///   int closure_pool_size      The most bytes of closures one execution
+    ///                                of the group can allocate (including
+    ///                                alignment), or -1 if that can't be
+    ///                                bounded because closures are made in
+    ///                                a loop or by a non-constant name.
+    ///   int ready                  Nonzero if the group (or, with
+    ///                                dedupe_groups, the group whose code
+    ///                                it shares) is optimized and JITed,
+    ///                                so execute() won't wait for it.
+    ///                                Never blocks or compiles anything.
+    ///   int groupdata_size         The bytes of heap ("groupdata") one
+    ///                                execution of the group needs.  The
+    ///                                group is JITed if it isn't already.
     ///   int globals_read           Bitfield ("or'ed" SGBits values) of
     ///                                which ShaderGlobals may be read by
     ///                                by the shader group.
     ///   int globals_write         Bitfield ("or'ed" SGBits values) of
     ///                                which ShaderGlobals may be written by
     ///                                by the shader group.
+    ///   int closure_output_empty   Nonzero if the optimized group never
+    ///                                sets Ci, so executing it leaves no
+    ///                                closure (e.g., no opacity to shadow
+    ///                                with).
+    ///   <type> output_is_constant:<name>
+    ///                              For an output (or other) parameter
+    ///                                "name" or "layer.name" whose value
+    ///                                the optimized group leaves the same
+    ///                                at every point -- not computed,
+    ///                                connected, or supplied by userdata --
+    ///                                that value, if asked for as the
+    ///                                parameter's own type. Fails for any
+    ///                                other parameter, so a renderer may
+    ///                                skip executing the group for it.
+    ///   int output_is_uniform:<name>  1 if the parameter is constant as
+    ///                                above or, with opt_batched_analysis,
+    ///                                depends on nothing that varies from
+    ///                                point to point in a batch; else 0.
     ///   int num_globals_needed     The number of named globals needed.
     ///   ptr globals_needed         Retrieves a pointer to the ustring array
     ///                                containing all globals needed.
@@ -425,8 +897,45 @@ public:
     ///   int raytype_queries        Bit field of all possible rayquery
     ///   int num_entry_layers       Number of named entry point layers.
     ///   string entry_layers[]      List of entry point layers.
+    ///   int num_instance_parameters  Number of instance_parameters.
+    ///   string instance_parameters[]  Their names, as "layer.param".
+    ///   int instance_data_offsets[]  The byte offset of each within the
+    ///                                 block of instance data.
+    ///   int instance_data_size     The size in bytes of the block, which
+    ///                                 should be aligned for its largest
+    ///                                 member (8 bytes will do).
     ///   string pickle              Retrieves a serialized representation
     ///                                 of the shader group declaration.
+    ///   int stat:layer_execs[]     How many times each layer has run (by
+    ///                                 contexts released so far), with
+    ///                                 ShadingSystem "profile" set to 2.
+    ///                                 May also be retrieved as int64.
+    ///   float stat:layer_times[]   Seconds spent running each layer,
+    ///                                 including the layers it ran lazily.
+    ///   float stat:layer_self_times[]  Seconds spent in each layer, not
+    ///                                 counting the layers it ran lazily.
+    ///   float stat:compile_specialization_time  Seconds the runtime
+    ///                                 optimizer took on the group.
+    ///   int stat:compile_num_opt_passes  Number of parts it was timed in.
+    ///   string stat:compile_opt_pass_names[]  Their names ("forward",
+    ///                                 "backward", "collapse", ...).
+    ///   float stat:compile_opt_pass_times[]  Seconds each one took.
+    ///   int stat:compile_opt_layer_passes  Passes made over the code of
+    ///                                 the layers, in all.
+    ///   int stat:compile_opt_budget_cutoffs  Layer optimizations cut
+    ///                                 short by opt_time_budget_ms.
+    ///   int stat:compile_preopt_ops, stat:compile_postopt_ops,
+    ///     stat:compile_preopt_syms, stat:compile_postopt_syms
+    ///                              Ops and symbols of all the layers,
+    ///                                 before and after optimization.
+    ///   float stat:compile_llvm_setup_time, stat:compile_llvm_irgen_time,
+    ///     stat:compile_llvm_opt_time, stat:compile_llvm_jit_time
+    ///                              Seconds spent in each phase of LLVM
+    ///                                 code generation, over all the
+    ///                                 times the group was JITed.
+    ///   int64 stat:compile_jit_bytes  Bytes of JITed code and data held.
+    /// Together with groupdata_size, num_closures_needed and
+    /// closure_pool_size, these say how expensive a group is to compile.
     /// Note: the attributes referred to as "string" are actually on the app
     /// side as ustring or const char* (they have the same data layout), NOT
     /// std::string!
@@ -466,6 +975,33 @@ public:
     bool LoadMemoryCompiledShader (string_view shadername,
                                    string_view buffer);
 
+    /// With allow_shader_replacement, read a new version of an already
+    /// loaded shader -- from buffer if it's not empty (as with
+    /// LoadMemoryCompiledShader), otherwise from its bundle or .oso file --
+    /// and switch the existing groups using it over to the new version.
+    /// Groups that were already compiled are optimized and JITed again in
+    /// the background (see optimize_group_async); other groups are left
+    /// alone.  The new version must have the same parameters as the old
+    /// one; if not, only groups created from now on use it.  Return true
+    /// if every group using the shader was switched.
+    bool reload_shader (string_view shadername,
+                        string_view buffer = string_view());
+
+    /// Load the masters of all the named shaders from the shader search
+    /// path ahead of their use in Shader() calls, reading up to nthreads
+    /// of them at once (0 means one per hardware thread). Return true if
+    /// all of them loaded. Shaders already loaded are skipped, and it's
+    /// fine for other threads to be loading shaders at the same time.
+    bool preload_shaders (cspan<ustring> shadernames, int nthreads = 0);
+
+    /// Register a shader bundle file (as made by `oslc --bundle`), whose
+    /// shaders will then be found without searching the shader search
+    /// path. Bundles are consulted in the order they were added, all of
+    /// them before the searchpath. The file is mapped into memory and
+    /// kept open for the life of the ShadingSystem. Return false (and
+    /// report an error) if it can't be read or isn't a shader bundle.
+    bool add_shader_bundle (string_view filename);
+
     // The basic sequence for declaring a shader group looks like this:
     // ShadingSystem *ss = ...;
     // ShaderGroupRef group = ss->ShaderGroupBegin (groupname);
@@ -542,6 +1078,17 @@ public:
     bool Shader (ShaderGroup& group, string_view shaderusage,
                  string_view shadername, string_view layername);
 
+    /// Append a new shader instance onto the specified group, with the
+    /// given parameter values (which override any from pending Parameter()
+    /// calls). The values are copied straight into the instance, so the
+    /// ParamValues may merely point to the caller's data (constructed with
+    /// copy=false), saving a copy per parameter when building many groups.
+    /// A ParamValue with non-CONSTANT interpolation is as if Parameter()
+    /// had been passed lockgeom=false.
+    bool Shader (ShaderGroup& group, string_view shaderusage,
+                 string_view shadername, string_view layername,
+                 cspan<ParamValue> params);
+
     /// Connect two shaders within the specified group. The source layer
     /// must be *upstream* of down destination layer (i.e. source must be
     /// declared earlier within the shader group). The named parameters must
@@ -560,13 +1107,26 @@ public:
                          string_view srclayer, string_view srcparam,
                          string_view dstlayer, string_view dstparam);
 
+    /// Make many connections within the group at once, naming layers and
+    /// parameters by index (see ShaderConnection) rather than by name, to
+    /// save the name lookups when building many groups from the same
+    /// shaders. All of the connections are checked, by the same rules as
+    /// above, before any of them is made: if one is invalid, it is
+    /// reported, the group is left unchanged, and false is returned.
+    /// Unlike the named form, out-of-range array elements or components
+    /// are errors rather than being clamped.
+    bool ConnectShaders (ShaderGroup &group,
+                         cspan<ShaderConnection> connections);
+
     /// Replace a parameter value in a previously-declared shader group.
     /// This is meant to called after the ShaderGroupBegin/End, but will
     /// fail if the shader has already been irrevocably optimized/compiled,
     /// unless the particular parameter is marked as lockgeom=0 (which
     /// indicates that it's a parameter that may be overridden by the
     /// geometric primitive).  This call gives you a way of changing the
-    /// instance value, even if it's not a geometric override.
+    /// instance value, even if it's not a geometric override. With the
+    /// "reparam_reoptimize" attribute set, any parameter of an optimized
+    /// group may be changed, and the group is re-optimized on next use.
     bool ReParameter (ShaderGroup &group,
                       string_view layername, string_view paramname,
                       TypeDesc type, const void *val);
@@ -631,6 +1191,17 @@ public:
     ///
     void release_context (ShadingContext *ctx);
 
+    /// Make `count` ShadingContexts ahead of time, each with `heapsize`
+    /// bytes of per-point group data already allocated, so that threads
+    /// that need a context find one ready rather than constructing it
+    /// while shading. Contexts of a PerThreadInfo passed to
+    /// destroy_thread_info() are kept the same way, so the worker threads
+    /// of a task pool that make a PerThreadInfo for each task still reuse
+    /// warm contexts. Getting a context from, and releasing it to, its
+    /// own thread's pool takes no locks; only taking a spare one (or
+    /// handing them over in destroy_thread_info) takes a brief spin lock.
+    void reserve_contexts (int count, size_t heapsize = 0);
+
     /// Execute the shader group in this context on shading point
     /// `shadeindex`. If ctx is nullptr, then execute will request one
     /// (based on the running thread) on its own and then return it when
@@ -642,6 +1213,35 @@ public:
                  ShaderGlobals& globals, void* userdata_base_ptr,
                  void* output_base_ptr, bool run = true);
 
+    /// Execute the shader group in this context on each of the shading
+    /// points described by `globals`, with shade index `shadeindices[i]`
+    /// for `globals[i]` (or just `i` if `shadeindices` is empty). This
+    /// gives the same results as calling execute() for each point, but
+    /// binds the group and sets up the context only once, so it saves the
+    /// per-call overhead for renderers that shade many points at once on
+    /// the scalar path. Each point's Ci stays valid until the context is
+    /// next used; other outputs should be retrieved through symlocs and
+    /// `output_base_ptr` (see add_symlocs), since only the last point's
+    /// values can be found with get_symbol(). Return true if the shader
+    /// executed on every point.
+    bool execute_many (ShadingContext &ctx, ShaderGroup &group,
+                       span<ShaderGlobals> globals, cspan<int> shadeindices,
+                       void* userdata_base_ptr, void* output_base_ptr);
+
+    /// Execute the shader group, as execute() does, but computing only
+    /// the named outputs: renderer outputs ("param" or "layer.param")
+    /// and globals (such as "Ci" or "P"), which may be other than the
+    /// group's renderer_outputs. With the "output_variants" option, this
+    /// runs a copy of the group compiled and kept just for that subset,
+    /// without the ops and layers that only the other outputs need;
+    /// globals the subset leaves out (Ci included) may not be set.
+    /// Without it, or once a group has all the copies it may keep, the
+    /// whole group runs.
+    bool execute(ShadingContext &ctx, ShaderGroup &group,
+                 cspan<ustring> outputs, int shadeindex,
+                 ShaderGlobals& globals, void* userdata_base_ptr,
+                 void* output_base_ptr, bool run = true);
+
     // DEPRECATED(2.0): no shadeindex or base pointers
     bool execute (ShadingContext &ctx, ShaderGroup &group,
                   ShaderGlobals &globals, bool run=true) {
@@ -708,6 +1308,42 @@ public:
     /// execute_layer.
     bool execute_cleanup (ShadingContext &ctx);
 
+    /// With the "deferred_trace" option on, return the trace() calls that
+    /// the last execution on ctx recorded instead of making, in the order
+    /// they were made.  They stay valid until ctx next executes.
+    cspan<RendererServices::TraceRequest>
+    trace_requests (const ShadingContext &ctx) const;
+
+    /// Supply the results of the last execution's trace_requests on ctx,
+    /// in the same order, to the next execution on ctx, which should
+    /// shade the same point with the same group.  There the n-th trace()
+    /// call returns results[n].hit without tracing, and getmessage("trace",
+    /// name) after it finds the matching entry of results[n].values (with
+    /// zero derivatives).  trace() calls past the end of results are
+    /// recorded again, for another round.
+    void resume_traces (ShadingContext &ctx,
+                        cspan<RendererServices::TraceResult> results);
+
+    /// Execute again, `iterations` times over and in their original order,
+    /// the points recorded by the "capture" option in the named file, on
+    /// a context of the calling thread. The groups are rebuilt from the
+    /// file, and their renderer lookups get the recorded answers instead
+    /// of going to the renderer. Textures, traces and the like are still
+    /// done for real, so the same files must be at hand. Only a file
+    /// written by the same build can be replayed. Return the number of
+    /// points executed, or -1 (with an error) if the file couldn't be
+    /// read.
+    int replay (string_view filename, int iterations = 1,
+                PerThreadInfo *threadinfo = nullptr);
+
+    /// Tell ctx that the executions that follow shade points of the
+    /// object with the given renderer-assigned id (-1, the initial value,
+    /// for unknown).  While the id stays the same, getattribute and
+    /// userdata lookups of the "object_attributes" are answered from
+    /// what was found for the first point of the object instead of
+    /// asking the renderer again.  A different id starts over.
+    void set_object (ShadingContext &ctx, long long objectid);
+
     /// Find the named layer within a group and return its index, or -1
     /// if no such named layer exists.
     int find_layer (const ShaderGroup &group, ustring layername) const;
@@ -734,9 +1370,12 @@ public:
 
     /// Search for an output symbol by name (and optionally, layer) within
     /// the optimized shader group. If the symbol is found, return an opaque
-    /// identifying pointer to it, otherwise return NULL. This is somewhat
-    /// expensive because of the name-based search, but once done, you can
-    /// reuse the pointer to the symbol for the lifetime of the group.
+    /// identifying pointer to it, otherwise return NULL. The optimized
+    /// group keeps a hashed index of its symbols, so this is a lookup
+    /// rather than a search, but it is still best done once: you can
+    /// reuse the pointer to the symbol for the lifetime of the group, and
+    /// symbol_address() turns it into the value's address for each
+    /// execution.
     ///
     /// If you give just a symbol name, it will search for the symbol in all
     /// layers, last-to-first. If a specific layer is named, it will search
@@ -761,6 +1400,36 @@ public:
     const void* symbol_address (const ShadingContext &ctx,
                                 const ShaderSymbol *sym) const;
 
+    /// Given an opaque ShaderSymbol*, return the byte offset of its value
+    /// within the group's heap ("groupdata", see groupdata_size), which is
+    /// the same for every execution, or -1 if the value doesn't live on
+    /// the heap. This is how a renderer that runs the group's PTX itself
+    /// finds the outputs in the groupdata it handed the group. Only valid
+    /// once the group is JITed.
+    int symbol_offset (const ShaderSymbol *sym) const;
+
+    /// A way for optimize_all_groups and jit_all_groups to run on the
+    /// renderer's own task system (TBB, an OIIO::thread_pool, ...): call
+    /// task(i) for each i in [0,ntasks), as many at once as it likes,
+    /// and return when they have all finished.
+    using ParallelFor = std::function<void (int ntasks,
+                                            const std::function<void (int)> &task)>;
+
+    /// A store of precompiled group code shared between processes, like
+    /// a compile service that the nodes of a render farm ask over the
+    /// network, in place of the "jit_cache_dir" directory. The key is a
+    /// string describing the group and everything its code depends on.
+    /// fetch returns true, having filled in object, if it has code for
+    /// the key; store is offered the code of each group this process had
+    /// to JIT itself. Either may be called from many threads at once.
+    /// Set them before any group is optimized; empty functions go back
+    /// to using jit_cache_dir.
+    using JitCacheFetch = std::function<bool (string_view key,
+                                              std::string &object)>;
+    using JitCacheStore = std::function<void (string_view key,
+                                              string_view object)>;
+    void jit_cache (const JitCacheFetch &fetch, const JitCacheStore &store);
+
 #if OSL_USE_BATCHED
     /// Based on currently set attributes for llvm_jit_target and
     /// llvm_jit_fma, test if current machine is capable of supporting
@@ -787,6 +1456,10 @@ public:
         /// specified number of threads (0 means use all available HW cores).
         void jit_all_groups (int nthreads=0);
 
+        /// Like jit_all_groups, but running on the renderer's
+        /// parallel_for rather than threads of our own.
+        void jit_all_groups (const ParallelFor &parallel_for);
+
         bool execute (ShadingContext &ctx, ShaderGroup &group, int batch_size,
                       Wide<const int, WidthT> wide_shadeindex,
                       BatchedShaderGlobals<WidthT> &globals_batch,
@@ -820,6 +1493,65 @@ public:
     OSL_FORCEINLINE BatchedExecutor<WidthT> batched() {
         return BatchedExecutor<WidthT>(*this);
     }
+
+    /// Gathers points that are handed over one at a time, for instance
+    /// hits coming out of a path tracer, into full batches for the batched
+    /// JIT code. There's a queue for each shader group; when a queue has
+    /// WidthT points, it is executed and the results are passed to a
+    /// callback. Points are only batched together if they share the ray
+    /// type and the renderstate, tracedata and objdata pointers, since
+    /// batched execution takes those as uniform; a renderer that keeps
+    /// per-point state should find it by shadeindex instead.
+    ///
+    /// A BatchBuilder is used by one thread, with that thread's context.
+    template<int WidthT>
+    class OSLEXECPUBLIC BatchBuilder {
+    public:
+        /// Called after each batch has executed, while its results can
+        /// still be read (with symbol_address() and Wide, or from
+        /// globals.varying.Ci) and handed back to its points, which may be
+        /// told apart by their shadeindex. The first batch_size lanes are
+        /// in use. BatchedClosureList (<OSL/batched_closure_list.h>) can
+        /// flatten globals.varying.Ci into per closure type arrays here.
+        using ResultsFunc = std::function<void (ShadingContext &ctx,
+                                                ShaderGroup &group,
+                                                int batch_size,
+                                                Wide<const int, WidthT> wide_shadeindex,
+                                                BatchedShaderGlobals<WidthT> &globals)>;
+
+        BatchBuilder (ShadingSystem &ss, ShadingContext &ctx,
+                      ResultsFunc results, void* userdata_base_ptr = nullptr,
+                      void* output_base_ptr = nullptr);
+        BatchBuilder (const BatchBuilder&) = delete;
+        /// Executes whatever points are still queued.
+        ~BatchBuilder ();
+
+        /// Queue the point described by sg to be shaded by the group, and
+        /// execute the queue if that fills it. Return false if that
+        /// execution failed.
+        bool add (ShaderGroup &group, const ShaderGlobals &sg, int shadeindex);
+
+        /// Execute the points queued for the group, full batch or not.
+        bool flush (ShaderGroup &group);
+
+        /// Execute all the points queued.
+        bool flush ();
+
+        /// The number of points queued and not yet executed.
+        int queued () const;
+
+    private:
+        struct Batch;
+        bool execute (Batch &batch);
+
+        ShadingSystem &m_shading_system;
+        ShadingContext &m_context;
+        ResultsFunc m_results;
+        void* m_userdata_base_ptr;
+        void* m_output_base_ptr;
+        std::vector<Batch *> m_batches;   ///< Queues, made as needed
+        size_t m_last = 0;                ///< Index of the last used queue
+    };
 #endif
 
 
@@ -862,6 +1594,22 @@ public:
     void clear_symlocs(ShaderGroup* group);
 
     /// Add symbol location mappings.
+    ///
+    /// A UserData mapping named for a global that SGBits names (such as
+    /// "P", "N" or "u"), but not "Ci", tells the scalar JIT to read that
+    /// global from the userdata record rather than from ShaderGlobals.  A
+    /// renderer can then keep the globals a group reads (its globals_read
+    /// attribute) in a small record of its own layout and fill in only
+    /// those.  Globals the group writes, and globals needing derivs when
+    /// the mapping has none, are still read from ShaderGlobals.  Renderer
+    /// callbacks and library calls always see the ShaderGlobals copy.
+    ///
+    /// For batched execution, a UserData mapping of a userdata parameter
+    /// with 'soa' set lets the renderer place a whole batch's values at
+    /// once, in wide layout, before each execute; the JITed code then
+    /// loads them rather than gathering them per point or calling
+    /// BatchedRendererServices::get_userdata. Parameters without a
+    /// mapping are still fetched lazily through get_userdata.
     void add_symlocs(cspan<SymLocationDesc> symlocs);
     void add_symlocs(ShaderGroup* group, cspan<SymLocationDesc> symlocs);
 
@@ -878,8 +1626,15 @@ public:
     /// If option "greedyjit" was set, this call will trigger all
     /// shader groups that have not yet been compiled to do so with the
     /// specified number of threads (0 means use all available HW cores).
+    /// The threads take the groups one at a time as they are free,
+    /// biggest first, so that a few huge groups don't hold up the end.
     void optimize_all_groups (int nthreads=0, bool do_jit = true);
 
+    /// Like optimize_all_groups, but running on the renderer's
+    /// parallel_for rather than threads of our own.
+    void optimize_all_groups (const ParallelFor &parallel_for,
+                              bool do_jit = true);
+
     /// Return a pointer to the TextureSystem being used.
     TextureSystem * texturesys () const;
 
@@ -893,6 +1648,77 @@ public:
     // DEPRECATED(2.0)
     bool archive_shadergroup (ShaderGroup *group, string_view filename);
 
+    /// Merge the points that shaders have written with pointcloud_write
+    /// to the named cloud so far and save it to disk, returning
+    /// immediately and doing the work on a background thread unless
+    /// `wait` is true.  Shaders may keep writing to the cloud meanwhile;
+    /// later points are saved by the next flush or at shutdown.  Returns
+    /// false if no cloud of that name is being written.
+    bool flush_pointcloud (string_view filename, bool wait = false);
+
+    /// Write a paged copy of the named point cloud beside it, as
+    /// "<file>.oslpcp", unless a current one is there already.  A paged
+    /// cloud is split spatially into pages of nearby points, and searches
+    /// read in only the pages within their radius, through a cache shared
+    /// by all paged clouds and bounded by the "pointcloud_max_memory_MB"
+    /// attribute, so clouds too large to load can still be searched.
+    /// Clouds loaded after this (or named by the paged file itself) are
+    /// read this way; the indices their searches return are only good for
+    /// pointcloud_get.  Returns false if the cloud can't be read or has no
+    /// "position" attribute, if the copy can't be written, or if OSL was
+    /// built without Partio.
+    bool make_paged_pointcloud (string_view filename);
+
+    /// Lay out the named read-only point cloud -- OSL's kd-tree over it,
+    /// and its float and int attributes -- as the single relocatable
+    /// block described in OSL/device_pointcloud.h, for a renderer to copy
+    /// to device memory and search there. Returns false if the cloud
+    /// can't be read or has no "position" attribute, or if OSL was built
+    /// without Partio.
+    bool pointcloud_device_image (string_view filename,
+                                  std::vector<char>& image);
+
+    /// Open the textures that `group` is known to need (its
+    /// "textures_needed" attribute) and read their headers and coarsest
+    /// MIP level into the TextureSystem, so that the first shading
+    /// doesn't stall on cold file opens.  The work is done by up to
+    /// `nthreads` background threads (0 means one per hardware thread)
+    /// while this call returns right away, unless `wait` is true, in
+    /// which case it returns once every prefetch requested so far is
+    /// done.  The group is optimized first if it isn't yet.  Each file
+    /// is only prefetched once.  Returns false if `group` is null.
+    bool prefetch_textures (ShaderGroup *group, int nthreads = 0,
+                            bool wait = false);
+
+    /// Optimize and JIT `group` on a background thread, returning right
+    /// away with a future that becomes true once the group is ready to
+    /// execute (or false if it couldn't be compiled or was freed first).
+    /// Calls made while the group is still queued or compiling share the
+    /// same future, and one made when the group is already compiled
+    /// returns a future that is ready and true.  With dedupe_groups, the
+    /// group whose code this one shares is the one compiled.  The number
+    /// of background threads is the "async_optimize" attribute (at least
+    /// one).  Returns an invalid future if `group` is null.
+    std::shared_future<bool> optimize_group_async (ShaderGroup *group);
+
+    /// Declare that the renderer attribute `name` of `object` has the
+    /// given value everywhere, e.g. for the whole frame, so that groups
+    /// optimized from now on fold getattribute() calls for it (with
+    /// constant object and attribute names, and a destination of the same
+    /// type, or of its element type for an indexed lookup) into that
+    /// value, and drop the code it makes dead.  An empty object matches
+    /// getattribute() calls that name none, which the renderer otherwise
+    /// can't answer before shading.  A null `val` removes the attribute.
+    /// Strings are given as ustring or const char*.  Only the optimizer
+    /// consults these, so the renderer's get_attribute should give the
+    /// same answers for groups that aren't optimized; and a group already
+    /// optimized keeps the values it was optimized with, so changing one
+    /// between frames calls for reoptimizing the groups that use it.
+    void constant_attribute (string_view object, string_view name,
+                             TypeDesc type, const void *val);
+    /// Remove all constant_attribute values.
+    void clear_constant_attributes ();
+
     /// Construct and return an OSLQuery initialized with an existing
     /// ShaderGroup. For a shader group already loaded by the ShadingSystem,
     /// this is much less expensive than constructing an OSLQuery by reading
@@ -965,6 +1791,13 @@ enum ShadeImageLocations {
 /// themselves will either be at "pixel centers" (position (i+0.5)/res), or
 /// as if it were a grid that is shaded at exact endpoints (position
 /// i/(res+1)). In either case, derivatives will be set appropriately.
+///
+/// The pixels are shaded a 64x64 tile at a time, each thread (up to
+/// popt.maxthreads of them) taking the next tile as soon as it is done
+/// with the last. If the renderer provides BatchedRendererServices at a
+/// width that configure_batch_execution_at() accepts (16, else 8, else 4),
+/// runs of that many pixels along each row are shaded together with the
+/// batched JIT; otherwise each pixel is shaded by itself.
 OSLEXECPUBLIC
 bool
 shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
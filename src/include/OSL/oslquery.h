@@ -144,6 +144,15 @@ public:
     /// the named shader with optional searchpath.  Return true for success,
     /// false if the shader could not be found or opened properly.
 
+    static std::vector<OSLQuery>
+    open_many(cspan<std::string> shadernames,
+              string_view searchpath = string_view(), int nthreads = 0);
+    ///< Query many shaders at once, reading up to `nthreads` of them at a
+    /// time (0 means one per hardware thread). Return one `OSLQuery` per
+    /// name, in the same order; check each with `geterror()`. Binary oso
+    /// is read fully in parallel, while text oso still takes turns in the
+    /// parser.
+
     bool open_bytecode(string_view buffer);
     ///< Get info on the shader from it's compiled bytecode (i.e., like the
     /// contents of an `.oso` file, but in a string).  Return `true` for
@@ -9,6 +9,8 @@
 
 #include <OSL/oslconfig.h>
 
+#include <OpenImageIO/paramlist.h>
+
 
 OSL_NAMESPACE_ENTER
 
@@ -46,6 +48,8 @@ class OSLEXECPUBLIC RendererServices {
 public:
     typedef TextureSystem::TextureHandle TextureHandle;
     typedef TextureSystem::Perthread TexturePerthread;
+    /// Opaque handle to an attribute, as returned by resolve_attribute().
+    typedef void AttributeHandle;
 
 
     RendererServices(TextureSystem* texsys = NULL);
@@ -177,6 +181,26 @@ public:
                                       ustring object, TypeDesc type,
                                       ustring name, int index, void *val) { return false; }
 
+    /// Called as a group is JITed, for each getattribute() whose object
+    /// (ustring() if none is given) and name are known then, but whose
+    /// value isn't: return an opaque handle that get_attribute_by_handle
+    /// can find the attribute with, skipping the dispatch on its name,
+    /// or nullptr (the default) to have get_attribute/get_array_attribute
+    /// called by name as usual. The handle must stay valid for as long as
+    /// the code of the group does.
+    virtual AttributeHandle* resolve_attribute (ustring object, ustring name,
+                                                TypeDesc type) { return nullptr; }
+
+    /// Retrieve an attribute that resolve_attribute returned the handle
+    /// for, like get_attribute, or like get_array_attribute for element
+    /// 'index' if index >= 0. The object, type, and name are the ones it
+    /// was resolved with. The default just calls those by name.
+    virtual bool get_attribute_by_handle (ShaderGlobals *sg,
+                                          AttributeHandle *handle,
+                                          bool derivatives, ustring object,
+                                          TypeDesc type, ustring name,
+                                          int index, void *val);
+
     /// Get the named user-data from the current object and write it into
     /// 'val'. If derivatives is true, the derivatives should be written into val
     /// as well. Return false if no user-data with the given name and type was
@@ -385,6 +409,23 @@ public:
         };
     };
 
+    /// A trace() call that a shader recorded instead of making, when the
+    /// ShadingSystem's "deferred_trace" option is on, for the renderer to
+    /// trace along with others (see ShadingSystem::trace_requests).
+    struct TraceRequest {
+        TraceOpt options;
+        OSL::Vec3 P, dPdx, dPdy;
+        OSL::Vec3 R, dRdx, dRdy;
+    };
+
+    /// The renderer's answer to a TraceRequest: whether the ray hit, and
+    /// the values that getmessage("trace", name) should find afterwards
+    /// (see ShadingSystem::resume_traces).
+    struct TraceResult {
+        bool hit = false;
+        OIIO::ParamValueList values;
+    };
+
     /// Immediately trace a ray from P in the direction R.  Return true
     /// if anything hit, otherwise false.
     virtual bool trace (TraceOpt &options, ShaderGlobals *sg,
@@ -445,6 +486,7 @@ public:
     /// Unless overridden, a nullptr is returned.
     virtual BatchedRendererServices<16> * batched(WidthOf<16>);
     virtual BatchedRendererServices<8> * batched(WidthOf<8>);
+    virtual BatchedRendererServices<4> * batched(WidthOf<4>);
 
 protected:
     TextureSystem *m_texturesys;   // A place to hold a TextureSystem
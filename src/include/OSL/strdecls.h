@@ -106,11 +106,17 @@ STRDECL("simplex", simplex)
 STRDECL("usimplex", usimplex)
 STRDECL("simplexnoise", simplexnoise)
 STRDECL("usimplexnoise", usimplexnoise)
+STRDECL("fbm", fbm)
+STRDECL("fbmnoise", fbmnoise)
 STRDECL("anisotropic", anisotropic)
 STRDECL("direction", direction)
 STRDECL("do_filter", do_filter)
 STRDECL("bandwidth", bandwidth)
 STRDECL("impulses", impulses)
+STRDECL("fast", fast)
+STRDECL("octaves", octaves)
+STRDECL("lacunarity", lacunarity)
+STRDECL("gain", gain)
 STRDECL("dowhile", op_dowhile)
 STRDECL("for", op_for)
 STRDECL("while", op_while)
@@ -154,6 +154,37 @@ template<typename DataT, int WidthT>
 OSL_FORCEINLINE void
 assign_all(Block<DataT, WidthT>&, const DataT&);
 
+// Utilities to transpose a renderer's Array of Structures records into
+// (and back out of) the Structure of Arrays layout of a Block, typically
+// to populate BatchedShaderGlobals from a batch of hit records.
+// 'src'/'dst' point at the DataT of the first record, records are
+// 'stride' bytes apart, and only the first 'count' lanes are touched.
+// Works for any Block specialization (float, Vec3, Color3, Matrix44, ...).
+template<typename DataT, int WidthT>
+OSL_FORCEINLINE void
+transpose_from_aos(Block<DataT, WidthT>& wide_data, const DataT* src,
+                   size_t stride = sizeof(DataT), int count = WidthT);
+template<typename DataT, int WidthT>
+OSL_FORCEINLINE void
+transpose_to_aos(const Block<DataT, WidthT>& wide_data, DataT* dst,
+                 size_t stride = sizeof(DataT), int count = WidthT);
+
+// Split AoS Dual2 records into the separate value, Dx and Dy Blocks
+// BatchedShaderGlobals uses (e.g. P, dPdx, dPdy).
+template<typename DataT, int WidthT>
+OSL_FORCEINLINE void
+transpose_from_aos(Block<DataT, WidthT>& wide_val, Block<DataT, WidthT>& wide_dx,
+                   Block<DataT, WidthT>& wide_dy, const Dual2<DataT>* src,
+                   size_t stride = sizeof(Dual2<DataT>), int count = WidthT);
+
+// Gather the active lanes of 'wdest' from AoS records indexed per lane by
+// 'windex', e.g. reading back a batch's outputs placed through a
+// SymLocationDesc with base+offset, stride and the batch's shade indices.
+template<typename DataT, int WidthT>
+OSL_FORCEINLINE void
+gather_from_aos(Masked<DataT, WidthT> wdest, const void* base, size_t stride,
+                Wide<const int, WidthT> windex);
+
 // Scalar execution of Functor for each unique value in the Wide data out
 // of the data_mask, the functor must be of the form
 //     (const DataT &, Mask<WidthT>)->void
@@ -2717,6 +2748,82 @@ assign_all(Masked<DataT[], WidthT> wide_data, const DataT* value_array)
 }
 
 
+template<typename DataT, int WidthT>
+OSL_FORCEINLINE void
+transpose_from_aos(Block<DataT, WidthT>& wide_data, const DataT* src,
+                   size_t stride, int count)
+{
+    OSL_DASSERT(count <= WidthT);
+    const char* src_bytes = reinterpret_cast<const char*>(src);
+    OSL_FORCEINLINE_BLOCK
+    {
+        OSL_OMP_PRAGMA(omp simd simdlen(WidthT))
+        for (int lane = 0; lane < count; ++lane) {
+            wide_data.set(lane, *reinterpret_cast<const DataT*>(
+                                    src_bytes + lane * stride));
+        }
+    }
+}
+
+template<typename DataT, int WidthT>
+OSL_FORCEINLINE void
+transpose_to_aos(const Block<DataT, WidthT>& wide_data, DataT* dst,
+                 size_t stride, int count)
+{
+    OSL_DASSERT(count <= WidthT);
+    char* dst_bytes = reinterpret_cast<char*>(dst);
+    OSL_FORCEINLINE_BLOCK
+    {
+        OSL_OMP_PRAGMA(omp simd simdlen(WidthT))
+        for (int lane = 0; lane < count; ++lane) {
+            *reinterpret_cast<DataT*>(dst_bytes + lane * stride)
+                = wide_data.get(lane);
+        }
+    }
+}
+
+template<typename DataT, int WidthT>
+OSL_FORCEINLINE void
+transpose_from_aos(Block<DataT, WidthT>& wide_val, Block<DataT, WidthT>& wide_dx,
+                   Block<DataT, WidthT>& wide_dy, const Dual2<DataT>* src,
+                   size_t stride, int count)
+{
+    OSL_DASSERT(count <= WidthT);
+    const char* src_bytes = reinterpret_cast<const char*>(src);
+    OSL_FORCEINLINE_BLOCK
+    {
+        OSL_OMP_PRAGMA(omp simd simdlen(WidthT))
+        for (int lane = 0; lane < count; ++lane) {
+            const Dual2<DataT>& d = *reinterpret_cast<const Dual2<DataT>*>(
+                src_bytes + lane * stride);
+            wide_val.set(lane, d.val());
+            wide_dx.set(lane, d.dx());
+            wide_dy.set(lane, d.dy());
+        }
+    }
+}
+
+template<typename DataT, int WidthT>
+OSL_FORCEINLINE void
+gather_from_aos(Masked<DataT, WidthT> wdest, const void* base, size_t stride,
+                Wide<const int, WidthT> windex)
+{
+    const char* base_bytes = reinterpret_cast<const char*>(base);
+    OSL_FORCEINLINE_BLOCK
+    {
+        OSL_OMP_PRAGMA(omp simd simdlen(WidthT))
+        for (int lane = 0; lane < WidthT; ++lane) {
+            // Masked off lanes may hold garbage indices, don't load them
+            if (wdest.mask()[lane]) {
+                int index = windex[lane];
+                wdest[ActiveLane(lane)] = *reinterpret_cast<const DataT*>(
+                    base_bytes + index * stride);
+            }
+        }
+    }
+}
+
+
 template<typename DataT, int WidthT, typename FunctorT>
 OSL_FORCEINLINE void
 foreach_unique(Wide<DataT, WidthT> wdata, Mask<WidthT> data_mask, FunctorT f)
@@ -474,6 +474,7 @@ public:
                      : (int)datatype.simpletype().size())
         , m_symtype(symtype)
         , m_has_derivs(false)
+        , m_deriv_axes(DerivBothAxes)
         , m_const_initializer(false)
         , m_connected_down(false)
         , m_initialized(false)
@@ -483,6 +484,7 @@ public:
         , m_readonly(false)
         , m_is_uniform(true)
         , m_forced_llvm_bool(false)
+        , m_transient(false)
         , m_arena(static_cast<unsigned int>(SymArena::Unknown))
         , m_free_data(false)
         , m_valuesource(static_cast<unsigned int>(DefaultVal))
@@ -646,6 +648,18 @@ public:
 
     bool has_derivs() const { return m_has_derivs; }
     void has_derivs(bool new_derivs) { m_has_derivs = new_derivs; }
+
+    /// Which partials of a symbol with derivs anything ever reads: a
+    /// mask of DerivXAxis and DerivYAxis. The storage is the same Dual2
+    /// either way; codegen just doesn't bother computing the other one.
+    enum DerivAxes { DerivXAxis = 1, DerivYAxis = 2, DerivBothAxes = 3 };
+    int deriv_axes() const { return m_deriv_axes; }
+    void deriv_axes(int axes) { m_deriv_axes = axes; }
+    /// Does anything need partial deriv (1 = x, 2 = y) of this symbol?
+    bool needs_deriv(int deriv) const
+    {
+        return m_has_derivs && (m_deriv_axes & (1 << (deriv - 1)));
+    }
     int size() const { return m_size; }
     void size(size_t newsize) { m_size = (int)newsize; }
 
@@ -795,6 +809,13 @@ public:
     bool forced_llvm_bool() const { return m_forced_llvm_bool; }
     void forced_llvm_bool(bool v) { m_forced_llvm_bool = v; }
 
+    // A transient string never leaves the shading point and is only ever
+    // read as characters (never hashed, compared, or looked up by name),
+    // so its value may live in the context's scratch arena instead of
+    // being interned as a ustring.
+    bool transient() const { return m_transient; }
+    void transient(bool v) { m_transient = v; }
+
     bool readonly() const { return m_readonly; }
     void readonly(bool v) { m_readonly = v; }
 
@@ -868,6 +889,7 @@ protected:
     int m_size;                 ///< Size of data (in bytes, without derivs)
     unsigned m_symtype : 4;     ///< Kind of symbol (param, local, etc.)
     unsigned m_has_derivs : 1;  ///< Step to derivs (0 == has no derivs)
+    unsigned m_deriv_axes : 2;  ///< DerivAxes whose partials are used
     unsigned m_const_initializer : 1;  ///< initializer is a constant expression
     unsigned m_connected_down : 1;   ///< Connected to a later/downstream layer
     unsigned m_initialized : 1;      ///< If a param, has it been initialized?
@@ -877,6 +899,7 @@ protected:
     unsigned m_readonly : 1;         ///< read-only symbol
     unsigned m_is_uniform : 1;  ///< symbol is uniform under batched execution
     unsigned m_forced_llvm_bool : 1;  ///< Is this sym forced to be llvm bool?
+    unsigned m_transient : 1;         ///< String value is shading-point only
     unsigned m_arena : 3;             ///< Storage arena
     unsigned m_free_data : 1;         ///< Free m_data upon destruction?
     unsigned m_valuesource : 2;       ///< Where did the value come from?
@@ -923,6 +946,7 @@ public:
         m_argtakesderivs = 0;   // Default - doesn't take derivs
         m_requires_masking = 0;  // Default - doesn't require masking
         m_analysis_flag    = 0;  // Default - optional analysis flag is not set
+        m_index_in_range   = 0;  // Default - indices need range checks
     }
 
     ustring opname() const { return m_op; }
@@ -1096,6 +1120,12 @@ public:
     bool analysis_flag() const { return m_analysis_flag; }
     void analysis_flag(bool v) { m_analysis_flag = v; }
 
+    /// The runtime optimizer proved that every index this op takes (array
+    /// element, component, or matrix row and column) is always in range,
+    /// so code generation may leave out the range checks.
+    bool index_in_range() const { return m_index_in_range; }
+    void index_in_range(bool v) { m_index_in_range = v; }
+
 private:
     ustring m_op;                   ///< Name of opcode
     int m_firstarg;                 ///< Index of first argument
@@ -1117,6 +1147,8 @@ private:
     unsigned m_requires_masking : 1;
     ///< Op specific analysis flag, meaning depends on type of op
     unsigned m_analysis_flag : 1;
+    ///< Optimizer proved all index args are within bounds
+    unsigned m_index_in_range : 1;
 };
 
 
@@ -0,0 +1,389 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <climits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "oslcomp_pvt.h"
+
+
+OSL_NAMESPACE_ENTER
+
+namespace pvt {  // OSL::pvt
+
+
+// The simplifications done here only look at the code of one shader, never
+// at parameter values or connections, so they are valid for every instance
+// of it.  That lets us do them once, when the .oso is written, rather than
+// leaving all of it to the runtime optimizer, which would otherwise redo
+// the same work for every instance of every group.
+
+
+static ustring op_add("add");
+static ustring op_assign("assign");
+static ustring op_div("div");
+static ustring op_eq("eq");
+static ustring op_ge("ge");
+static ustring op_gt("gt");
+static ustring op_le("le");
+static ustring op_lt("lt");
+static ustring op_mul("mul");
+static ustring op_neg("neg");
+static ustring op_neq("neq");
+static ustring op_sub("sub");
+
+
+
+// Ops that compute their first argument from the rest and have no other
+// effect, so they may be dropped if that result is never read, or made to
+// write directly to the variable that their result is copied into.
+static bool
+is_pure_op(ustring opname)
+{
+    static const std::unordered_set<ustring, OIIO::ustringHash> pure_ops {
+        op_add, op_assign, op_div, op_eq, op_ge, op_gt, op_le, op_lt, op_mul,
+        op_neg, op_neq, op_sub,
+        // clang-format off
+        ustring("mod"), ustring("abs"), ustring("fabs"), ustring("floor"),
+        ustring("ceil"), ustring("round"), ustring("trunc"), ustring("sign"),
+        ustring("sqrt"), ustring("inversesqrt"), ustring("cbrt"),
+        ustring("exp"), ustring("exp2"), ustring("expm1"), ustring("log"),
+        ustring("log2"), ustring("log10"), ustring("logb"), ustring("pow"),
+        ustring("sin"), ustring("cos"), ustring("tan"), ustring("asin"),
+        ustring("acos"), ustring("atan"), ustring("atan2"), ustring("sinh"),
+        ustring("cosh"), ustring("tanh"), ustring("erf"), ustring("erfc"),
+        ustring("radians"), ustring("degrees"), ustring("hypot"),
+        ustring("min"), ustring("max"), ustring("clamp"), ustring("mix"),
+        ustring("step"), ustring("smoothstep"), ustring("dot"),
+        ustring("cross"), ustring("length"), ustring("distance"),
+        ustring("normalize"), ustring("luminance"), ustring("bitand"),
+        ustring("bitor"), ustring("xor"), ustring("compl"), ustring("shl"),
+        ustring("shr"), ustring("and"), ustring("or"), ustring("color"),
+        ustring("point"), ustring("vector"), ustring("normal"),
+        ustring("Dx"), ustring("Dy"), ustring("Dz"),
+        // clang-format on
+    };
+    return pure_ops.find(opname) != pure_ops.end();
+}
+
+
+
+// Ops whose arguments steer control flow; we leave those alone.
+static bool
+is_control_op(ustring opname)
+{
+    static ustring op_if("if"), op_for("for"), op_while("while"),
+        op_dowhile("dowhile"), op_functioncall("functioncall"),
+        op_functioncall_nr("functioncall_nr");
+    return opname == op_if || opname == op_for || opname == op_while
+           || opname == op_dowhile || opname == op_functioncall
+           || opname == op_functioncall_nr;
+}
+
+
+
+// Is the symbol a plain temporary we're free to rewrite around?
+static bool
+simple_temp(const Symbol* s)
+{
+    return s->symtype() == SymTypeTemp && !s->typespec().is_structure_based()
+           && s->fieldid() < 0;
+}
+
+
+
+template<typename T>
+static bool
+compare_values(ustring opname, T a, T b, int& result)
+{
+    if (opname == op_eq)
+        result = (a == b);
+    else if (opname == op_neq)
+        result = (a != b);
+    else if (opname == op_lt)
+        result = (a < b);
+    else if (opname == op_le)
+        result = (a <= b);
+    else if (opname == op_gt)
+        result = (a > b);
+    else if (opname == op_ge)
+        result = (a >= b);
+    else
+        return false;
+    return true;
+}
+
+
+
+bool
+OSLCompilerImpl::fold_constant_op(Opcode& op)
+{
+    ustring opname = op.opname();
+    bool unary     = (opname == op_neg);
+    bool compare   = (opname == op_eq || opname == op_neq || opname == op_lt
+                    || opname == op_le || opname == op_gt || opname == op_ge);
+    bool binary    = compare
+                  || (opname == op_add || opname == op_sub || opname == op_mul
+                      || opname == op_div);
+    if (!(unary || binary) || op.nargs() != (unary ? 2 : 3))
+        return false;
+
+    Symbol* R = m_opargs[op.firstarg()];
+    Symbol* A = m_opargs[op.firstarg() + 1];
+    Symbol* B = unary ? A : m_opargs[op.firstarg() + 2];
+    auto scalar_const = [](const Symbol* s) {
+        return s->is_constant()
+               && (s->typespec().is_int() || s->typespec().is_float());
+    };
+    const TypeSpec& rtype(R->typespec());
+    if (!scalar_const(A) || !scalar_const(B)
+        || !(rtype.is_int() || rtype.is_float()))
+        return false;
+    bool ints = A->typespec().is_int() && B->typespec().is_int();
+
+    Symbol* K = nullptr;
+    if (compare) {
+        int r = 0;
+        if (!rtype.is_int())
+            return false;
+        if (ints)
+            compare_values(opname, A->get_int(), B->get_int(), r);
+        else
+            compare_values(opname, A->coerce_float(), B->coerce_float(), r);
+        K = make_constant(r);
+    } else if (rtype.is_int()) {
+        if (!ints)
+            return false;
+        // Wrap like the generated code does, without signed overflow UB
+        unsigned int a = (unsigned int)A->get_int();
+        unsigned int b = (unsigned int)B->get_int();
+        unsigned int r;
+        if (opname == op_neg)
+            r = 0u - a;
+        else if (opname == op_add)
+            r = a + b;
+        else if (opname == op_sub)
+            r = a - b;
+        else if (opname == op_mul)
+            r = a * b;
+        else {
+            // Leave division by zero (and the one overflowing quotient) to
+            // the runtime's own rules.
+            int ia = A->get_int(), ib = B->get_int();
+            if (ib == 0 || (ia == INT_MIN && ib == -1))
+                return false;
+            r = (unsigned int)(ia / ib);
+        }
+        K = make_constant((int)r);
+    } else {
+        float a = A->coerce_float();
+        float b = B->coerce_float();
+        float r;
+        if (opname == op_neg)
+            r = -a;
+        else if (opname == op_add)
+            r = a + b;
+        else if (opname == op_sub)
+            r = a - b;
+        else if (opname == op_mul)
+            r = a * b;
+        else {
+            if (b == 0.0f)
+                return false;
+            r = a / b;
+        }
+        K = make_constant(r);
+    }
+
+    // Turn the op into "assign R K", reusing its argument slots.
+    op.reset(op_assign, 2);
+    m_opargs[op.firstarg() + 1] = K;
+    return true;
+}
+
+
+
+bool
+OSLCompilerImpl::propagate_through_temps(std::vector<bool>& dead)
+{
+    // How each symbol is used by the code as it stands now.
+    struct SymUse {
+        int nreads    = 0;
+        int nwrites   = 0;
+        int firstread = INT_MAX;
+        bool rewrite  = false;  // read in a non-rewritable spot
+    };
+    std::unordered_map<const Symbol*, SymUse> uses;
+    int nops = (int)m_ircode.size();
+    std::vector<bool> jumped_to(nops + 1, false);
+    for (int opnum = 0; opnum < nops; ++opnum) {
+        const Opcode& op(m_ircode[opnum]);
+        bool control = is_control_op(op.opname());
+        for (int a = 0; a < op.nargs(); ++a) {
+            SymUse& u(uses[m_opargs[op.firstarg() + a]]);
+            if (op.argread(a)) {
+                ++u.nreads;
+                u.firstread = std::min(u.firstread, opnum);
+                if (op.argwrite(a) || control)
+                    u.rewrite = true;
+            }
+            if (op.argwrite(a))
+                ++u.nwrites;
+        }
+        for (int j = 0; j < (int)Opcode::max_jumps && op.jump(j) >= 0; ++j)
+            jumped_to[op.jump(j)] = true;
+    }
+
+    bool changed = false;
+    for (int opnum = 0; opnum < nops; ++opnum) {
+        if (dead[opnum])
+            continue;
+        Opcode& op(m_ircode[opnum]);
+        if (!is_pure_op(op.opname()) || op.argwrite_bits() != 1
+            || op.argread(0) || op.nargs() < 2 || op.jump(0) >= 0)
+            continue;
+        Symbol* T = m_opargs[op.firstarg()];
+        if (!simple_temp(T))
+            continue;
+        const SymUse& tuse(uses[T]);
+        if (tuse.nwrites != 1)
+            continue;
+
+        // "assign T K" for a constant K: read K wherever T is read.
+        Symbol* K = m_opargs[op.firstarg() + 1];
+        if (op.opname() == op_assign && K->is_constant()
+            && K->typespec() == T->typespec() && !tuse.rewrite
+            && tuse.firstread > opnum) {
+            bool samemethod = true;
+            for (int j = opnum + 1; j < nops && samemethod; ++j)
+                if (op_uses_sym(m_ircode[j], T, true, false))
+                    samemethod = (m_ircode[j].method() == op.method());
+            if (samemethod) {
+                for (int j = opnum + 1; j < nops; ++j) {
+                    const Opcode& user(m_ircode[j]);
+                    for (int a = 0; a < user.nargs(); ++a)
+                        if (m_opargs[user.firstarg() + a] == T)
+                            m_opargs[user.firstarg() + a] = K;
+                }
+                changed = true;
+                continue;  // the assign is now dead
+            }
+        }
+
+        // "op T ...; assign X T": have the op write X itself.
+        if (tuse.nreads != 1 || opnum + 1 >= nops || jumped_to[opnum + 1]
+            || dead[opnum + 1])
+            continue;
+        Opcode& next(m_ircode[opnum + 1]);
+        if (next.opname() != op_assign || next.nargs() != 2
+            || next.method() != op.method()
+            || m_opargs[next.firstarg() + 1] != T)
+            continue;
+        Symbol* X = m_opargs[next.firstarg()];
+        if (X->typespec() != T->typespec() || X->typespec().is_array()
+            || X->typespec().is_structure_based() || X->is_constant()
+            || op_uses_sym(op, X))
+            continue;
+        m_opargs[op.firstarg()] = X;
+        dead[opnum + 1]         = true;
+        changed                 = true;
+        // X's use counts still hold: it's written once, just one op
+        // sooner than before.
+    }
+    return changed;
+}
+
+
+
+bool
+OSLCompilerImpl::find_dead_ops(std::vector<bool>& dead)
+{
+    std::unordered_set<const Symbol*> read;
+    for (auto&& op : m_ircode)
+        for (int a = 0; a < op.nargs(); ++a)
+            if (op.argread(a))
+                read.insert(m_opargs[op.firstarg() + a]);
+
+    bool changed = false;
+    for (size_t opnum = 0; opnum < m_ircode.size(); ++opnum) {
+        const Opcode& op(m_ircode[opnum]);
+        if (dead[opnum] || !is_pure_op(op.opname()) || op.nargs() < 1
+            || op.argwrite_bits() != 1 || op.argread(0) || op.jump(0) >= 0)
+            continue;
+        // Locals that are never read are as dead as temporaries.
+        const Symbol* R = m_opargs[op.firstarg()];
+        if ((R->symtype() == SymTypeTemp || R->symtype() == SymTypeLocal)
+            && !R->typespec().is_structure_based() && R->fieldid() < 0
+            && read.find(R) == read.end()) {
+            dead[opnum] = true;
+            changed     = true;
+        }
+    }
+    return changed;
+}
+
+
+
+void
+OSLCompilerImpl::remove_ops(const std::vector<bool>& dead)
+{
+    // newnum[i] is where op i lands, or where the first surviving op after
+    // it does, so that jumps to a removed op go where it would have led.
+    int nops = (int)m_ircode.size();
+    std::vector<int> newnum(nops + 1);
+    int n = 0;
+    for (int opnum = 0; opnum < nops; ++opnum) {
+        newnum[opnum] = n;
+        if (!dead[opnum])
+            m_ircode[n++] = m_ircode[opnum];
+    }
+    newnum[nops] = n;
+    if (n == nops)
+        return;
+    m_ircode.resize(n);
+
+    for (auto& op : m_ircode)
+        for (int j = 0; j < (int)Opcode::max_jumps && op.jump(j) >= 0; ++j)
+            op.jump(j) = newnum[op.jump(j)];
+    for (auto&& s : symtab()) {
+        if (s->symtype() == SymTypeParam || s->symtype() == SymTypeOutputParam) {
+            s->initbegin(newnum[s->initbegin()]);
+            s->initend(newnum[s->initend()]);
+        }
+    }
+    if (m_main_method_start >= 0)
+        m_main_method_start = newnum[m_main_method_start];
+}
+
+
+
+void
+OSLCompilerImpl::optimize()
+{
+    // Each simplification can expose more for the others, so keep going
+    // until nothing changes.
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto& op : m_ircode)
+            changed |= fold_constant_op(op);
+        std::vector<bool> dead(m_ircode.size(), false);
+        changed |= propagate_through_temps(dead);
+        changed |= find_dead_ops(dead);
+        remove_ops(dead);
+    }
+
+    track_variable_lifetimes();
+    coalesce_temporaries();
+    // A merged temporary needs derivatives if any of its parts did.
+    for (auto&& s : symtab())
+        if (s->dealias() != s && s->has_derivs())
+            s->dealias()->has_derivs(true);
+}
+
+
+};  // namespace pvt
+
+OSL_NAMESPACE_EXIT
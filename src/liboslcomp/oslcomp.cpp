@@ -3,14 +3,21 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <cctype>
 #include <cerrno>
 #include <cstdio>
+#include <cstdlib>
 #include <fstream>
+#include <mutex>
+#include <set>
+#include <sstream>
 #include <streambuf>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "oslcomp_pvt.h"
+#include "osoreader.h"
 
 #include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/platform.h>
@@ -26,6 +33,7 @@
 #include <clang/Frontend/TextDiagnosticPrinter.h>
 #include <clang/Frontend/Utils.h>
 #include <clang/Lex/PreprocessorOptions.h>
+#include <llvm/Config/llvm-config.h>
 #include <llvm/Support/Host.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/ToolOutputFile.h>
@@ -35,8 +43,19 @@
 OSL_NAMESPACE_ENTER
 
 
+namespace pvt {
+// Held by a compiler from the parse until it's done writing its oso, and
+// while it's being built or destroyed. Struct types live in one table
+// shared by all compilers (TypeSpec::struct_list), so compilers on
+// different threads must take turns at everything past preprocessing.
+static std::mutex frontend_mutex;
+}  // namespace pvt
+
+
+
 OSLCompiler::OSLCompiler(ErrorHandler* errhandler)
 {
+    std::lock_guard<std::mutex> lock(pvt::frontend_mutex);
     m_impl = new pvt::OSLCompilerImpl(errhandler);
 }
 
@@ -44,16 +63,36 @@ OSLCompiler::OSLCompiler(ErrorHandler* errhandler)
 
 OSLCompiler::~OSLCompiler()
 {
+    std::lock_guard<std::mutex> lock(pvt::frontend_mutex);
     delete m_impl;
 }
 
 
 
+// Everything a compile builds -- symbols, AST, ops -- lives in the
+// OSLCompilerImpl, so a compiler that has been used is swapped for a
+// fresh one before it's used again. A reused compiler is likely to be
+// reused many more times, so the new one keeps stdosl.h preprocessed.
+static void
+prepare_for_compile(pvt::OSLCompilerImpl*& impl)
+{
+    if (impl->used()) {
+        std::lock_guard<std::mutex> lock(pvt::frontend_mutex);
+        ErrorHandler* errhandler = &impl->errhandler();
+        delete impl;
+        impl = new pvt::OSLCompilerImpl(errhandler);
+        impl->header_cache(true);
+    }
+}
+
+
+
 bool
 OSLCompiler::compile(string_view filename,
                      const std::vector<std::string>& options,
                      string_view stdoslpath)
 {
+    prepare_for_compile(m_impl);
     return m_impl->compile(filename, options, stdoslpath);
 }
 
@@ -64,6 +103,7 @@ OSLCompiler::compile_buffer(string_view sourcecode, std::string& osobuffer,
                             const std::vector<std::string>& options,
                             string_view stdoslpath, string_view filename)
 {
+    prepare_for_compile(m_impl);
     return m_impl->compile_buffer(sourcecode, osobuffer, options, stdoslpath,
                                   filename);
 }
@@ -141,35 +181,22 @@ OSLCompilerImpl::preprocess_file(const std::string& filename,
 
 
 bool
-OSLCompilerImpl::preprocess_buffer(const std::string& buffer,
-                                   const std::string& filename,
-                                   const std::string& stdoslpath,
-                                   const std::vector<std::string>& defines,
-                                   const std::vector<std::string>& includepaths,
-                                   std::string& result)
+OSLCompilerImpl::run_preprocessor(const std::string& buffer,
+                                  const std::string& filename,
+                                  const std::string& directory,
+                                  const std::vector<std::string>& defines,
+                                  const std::vector<std::string>& includepaths,
+                                  bool macros_only, std::string& result,
+                                  std::string& errors)
 {
     using OIIO::Strutil::fmt::format;
-    std::string instring;
-    if (!stdoslpath.empty()) {
-        instring = format("#include \"{}\"\n",
-                          OIIO::Strutil::escape_chars(stdoslpath));
-        // Note: because we're turning this from a regular string into a
-        // double-quoted string injected into the OSL parse stream, we need
-        // to fully escape any backslashes used in Windows file paths. We
-        // don't want "c:\path\to\new\osl" to be interpreted as
-        // "c:\path<tab>o<newline>ew\osl" !
-    } else {
-        instring = "\n";
-    }
-    instring += buffer;
     std::unique_ptr<llvm::MemoryBuffer> mbuf(
-        llvm::MemoryBuffer::getMemBuffer(instring, filename));
+        llvm::MemoryBuffer::getMemBuffer(buffer, filename));
 
     clang::CompilerInstance inst;
 
     // Set up error capture for the preprocessor
-    std::string preproc_errors;
-    llvm::raw_string_ostream errstream(preproc_errors);
+    llvm::raw_string_ostream errstream(errors);
     clang::DiagnosticOptions* diagOptions = new clang::DiagnosticOptions();
     clang::TextDiagnosticPrinter* diagPrinter
         = new clang::TextDiagnosticPrinter(errstream, diagOptions);
@@ -193,8 +220,10 @@ OSLCompilerImpl::preprocess_buffer(const std::string& buffer,
     clang::SourceManager& sm = inst.getSourceManager();
     sm.setMainFileID(sm.createFileID(std::move(mbuf), clang::SrcMgr::C_User));
 
-    inst.getPreprocessorOutputOpts().ShowCPP               = 1;
-    inst.getPreprocessorOutputOpts().ShowMacros            = 0;
+    // With ShowCPP off and ShowMacros on, the output is just the final
+    // set of macro definitions (like "cpp -dM").
+    inst.getPreprocessorOutputOpts().ShowCPP               = !macros_only;
+    inst.getPreprocessorOutputOpts().ShowMacros            = macros_only;
     inst.getPreprocessorOutputOpts().ShowComments          = 0;
     inst.getPreprocessorOutputOpts().ShowLineMarkers       = 1;
     inst.getPreprocessorOutputOpts().ShowMacroComments     = 0;
@@ -205,9 +234,6 @@ OSLCompilerImpl::preprocess_buffer(const std::string& buffer,
     headerOpts.UseStandardSystemIncludes   = 0;
     headerOpts.UseStandardCXXIncludes      = 0;
     // headerOpts.Verbose = 1;
-    std::string directory = OIIO::Filesystem::parent_path(filename);
-    if (directory.empty())
-        directory = OIIO::Filesystem::current_path();
     headerOpts.AddPath(directory, clang::frontend::Angled, false, true);
     for (auto&& inc : includepaths) {
         headerOpts.AddPath(inc, clang::frontend::Angled,
@@ -239,8 +265,264 @@ OSLCompilerImpl::preprocess_buffer(const std::string& buffer,
     clang::DoPrintPreprocessedInput(inst.getPreprocessor(), &ostream,
                                     inst.getPreprocessorOutputOpts());
     diagPrinter->EndSourceFile();
+    ostream.flush();
+    errstream.flush();
+    return errors.empty();
+}
+
+
+
+// The files named by the line markers ("# 12 "file.h" 1") in preprocessed
+// output, other than pseudo files like "<built-in>".
+static std::set<std::string>
+line_marker_files(string_view text)
+{
+    std::set<std::string> files;
+    while (text.size()) {
+        size_t eol       = text.find('\n');
+        string_view line = text.substr(0, eol);
+        text.remove_prefix(eol == string_view::npos ? text.size() : eol + 1);
+        if (line.size() < 4 || line[0] != '#' || line[1] != ' '
+            || !isdigit(line[2]))
+            continue;
+        size_t q0 = line.find('\"');
+        size_t q1 = line.rfind('\"');
+        if (q0 == string_view::npos || q1 <= q0 + 1 || line[q0 + 1] == '<')
+            continue;
+        files.emplace(line.substr(q0 + 1, q1 - q0 - 1));
+    }
+    return files;
+}
+
+
+
+// A file name made relative to the working directory, as the lexer does
+// for the file names it reports.
+std::string
+OSLCompilerImpl::cwd_relative(string_view filename) const
+{
+    std::string f(filename);
+    if (f.find(m_cwd) == 0) {
+        f.erase(0, m_cwd.size());
+        if (f.size() && (f[0] == '/' || f[0] == '\\'))
+            f.erase(0, 1);
+    }
+    return f;
+}
+
+
+
+static bool
+header_deps_current(const PreprocessedHeader& hdr)
+{
+    for (auto&& dep : hdr.deps) {
+        std::string contents;
+        if (!OIIO::Filesystem::read_text_file(dep.first, contents)
+            || OIIO::Strutil::strhash(contents) != dep.second)
+            return false;
+    }
+    return true;
+}
+
+
+
+// On-disk form of a PreprocessedHeader:
+//     OSL preprocessed header 1
+//     <number of deps>
+//     <hash> <path>          (one line per dep)
+//     <size of macros>
+//     <macros>
+//     <size of text>
+//     <text>
+static const char* header_cache_magic = "OSL preprocessed header 1";
+
+static std::shared_ptr<PreprocessedHeader>
+read_header_cache_file(const std::string& path)
+{
+    std::string contents;
+    if (!OIIO::Filesystem::read_text_file(path, contents))
+        return nullptr;
+    string_view in(contents);
+    auto getline = [&]() {
+        size_t eol       = in.find('\n');
+        string_view line = in.substr(0, eol);
+        in.remove_prefix(eol == string_view::npos ? in.size() : eol + 1);
+        return line;
+    };
+    auto getblock = [&](std::string& block) {
+        string_view sizeline = getline();
+        if (sizeline.empty())
+            return false;
+        size_t size = strtoull(std::string(sizeline).c_str(), nullptr, 10);
+        if (size > in.size())
+            return false;
+        block = in.substr(0, size);
+        in.remove_prefix(size);
+        return true;
+    };
+    if (getline() != header_cache_magic)
+        return nullptr;
+    auto hdr          = std::make_shared<PreprocessedHeader>();
+    string_view nline = getline();
+    int ndeps         = 0;
+    if (!OIIO::Strutil::parse_int(nline, ndeps))
+        return nullptr;
+    for (int i = 0; i < ndeps; ++i) {
+        string_view line = getline();
+        size_t space     = line.find(' ');
+        if (space == string_view::npos)
+            return nullptr;
+        std::string hash(line.substr(0, space));
+        hdr->deps.emplace_back(std::string(line.substr(space + 1)),
+                               size_t(strtoull(hash.c_str(), nullptr, 10)));
+    }
+    if (!getblock(hdr->macros) || !getblock(hdr->text))
+        return nullptr;
+    return hdr;
+}
+
+
+
+static void
+write_header_cache_file(const std::string& path, const PreprocessedHeader& hdr)
+{
+    using OIIO::Strutil::fmt::format;
+    std::string out = format("{}\n{}\n", header_cache_magic, hdr.deps.size());
+    for (auto&& dep : hdr.deps)
+        out += format("{} {}\n", dep.second, dep.first);
+    out += format("{}\n{}{}\n{}", hdr.macros.size(), hdr.macros,
+                  hdr.text.size(), hdr.text);
+    // Write to a unique temporary and rename it into place, so that
+    // several oslc processes filling the cache at once never see a
+    // partial file.
+    std::string err;
+    std::string dir = OIIO::Filesystem::parent_path(path);
+    if (!OIIO::Filesystem::is_directory(dir))
+        OIIO::Filesystem::create_directory(dir, err);
+    std::string tmp = format("{}.{}.tmp", path,
+                             OIIO::Filesystem::unique_path("%%%%%%%%"));
+    OIIO::ofstream file;
+    OIIO::Filesystem::open(file, tmp, std::ios::out | std::ios::binary);
+    if (!file)
+        return;
+    file << out;
+    file.close();
+    if (!file.good()
+        || !OIIO::Filesystem::rename(tmp, path, err))
+        OIIO::Filesystem::remove(tmp, err);
+}
+
+
+
+std::shared_ptr<const PreprocessedHeader>
+OSLCompilerImpl::preprocessed_stdosl(
+    const std::string& stdoslpath, const std::vector<std::string>& defines,
+    const std::vector<std::string>& includepaths)
+{
+    using OIIO::Strutil::fmt::format;
+    // Everything that changes how stdosl.h preprocesses, other than the
+    // contents of the files it reads, which are checked separately.
+    std::string key = format("{}\n{}\n{}\n{}\n{}\n", OSL_LIBRARY_VERSION_CODE,
+                             LLVM_VERSION_STRING, stdoslpath,
+                             OIIO::Strutil::join(defines, "\n"),
+                             OIIO::Strutil::join(includepaths, "\n"));
+
+    static OIIO::spin_mutex cache_mutex;
+    static std::unordered_map<std::string,
+                              std::shared_ptr<const PreprocessedHeader>>
+        cache;
+    {
+        OIIO::spin_lock lock(cache_mutex);
+        auto found = cache.find(key);
+        if (found != cache.end() && header_deps_current(*found->second))
+            return found->second;
+    }
 
-    if (preproc_errors.size()) {
+    std::string cachefile;
+    std::shared_ptr<PreprocessedHeader> hdr;
+    if (m_header_cache_dir.size()) {
+        cachefile = format("{}/oslc-{:016x}.pph", m_header_cache_dir,
+                           OIIO::Strutil::strhash(key));
+        hdr = read_header_cache_file(cachefile);
+        if (hdr && !header_deps_current(*hdr))
+            hdr.reset();
+    }
+
+    if (!hdr) {
+        // Preprocess it twice, once for the text and once for the macros
+        // it leaves defined. It's named as a pseudo file so that the text
+        // doesn't mention the shader that happened to fill the cache.
+        std::string buffer = format("#include \"{}\"\n",
+                                    OIIO::Strutil::escape_chars(stdoslpath));
+        std::string directory = OIIO::Filesystem::parent_path(stdoslpath);
+        if (directory.empty())
+            directory = OIIO::Filesystem::current_path();
+        hdr = std::make_shared<PreprocessedHeader>();
+        std::string errors;
+        if (!run_preprocessor(buffer, "<stdosl>", directory, defines,
+                              includepaths, false, hdr->text, errors)
+            || !run_preprocessor(buffer, "<stdosl>", directory, defines,
+                                 includepaths, true, hdr->macros, errors))
+            return nullptr;
+        for (auto&& f : line_marker_files(hdr->text)) {
+            std::string contents;
+            if (!OIIO::Filesystem::read_text_file(f, contents))
+                return nullptr;
+            hdr->deps.emplace_back(f, OIIO::Strutil::strhash(contents));
+        }
+        if (cachefile.size())
+            write_header_cache_file(cachefile, *hdr);
+    }
+
+    OIIO::spin_lock lock(cache_mutex);
+    cache[key] = hdr;
+    return hdr;
+}
+
+
+
+bool
+OSLCompilerImpl::preprocess_buffer(const std::string& buffer,
+                                   const std::string& filename,
+                                   const std::string& stdoslpath,
+                                   const std::vector<std::string>& defines,
+                                   const std::vector<std::string>& includepaths,
+                                   std::string& result)
+{
+    using OIIO::Strutil::fmt::format;
+    std::string directory = OIIO::Filesystem::parent_path(filename);
+    if (directory.empty())
+        directory = OIIO::Filesystem::current_path();
+
+    std::string instring;
+    std::shared_ptr<const PreprocessedHeader> header;
+    if (m_header_cache && !stdoslpath.empty())
+        header = preprocessed_stdosl(stdoslpath, defines, includepaths);
+    if (header) {
+        // Start from the cached stdosl.h: replay the macros it defined,
+        // then number the shader's lines just as if it had followed an
+        // #include of stdosl.h on line 1.
+        instring = header->macros;
+        instring += format("#line 2 \"{}\"\n",
+                           OIIO::Strutil::escape_chars(filename));
+    } else if (!stdoslpath.empty()) {
+        instring = format("#include \"{}\"\n",
+                          OIIO::Strutil::escape_chars(stdoslpath));
+        // Note: because we're turning this from a regular string into a
+        // double-quoted string injected into the OSL parse stream, we need
+        // to fully escape any backslashes used in Windows file paths. We
+        // don't want "c:\path\to\new\osl" to be interpreted as
+        // "c:\path<tab>o<newline>ew\osl" !
+    } else {
+        instring = "\n";
+    }
+    instring += buffer;
+
+    std::string preproc_errors;
+    if (header)
+        result = header->text;
+    if (!run_preprocessor(instring, filename, directory, defines, includepaths,
+                          false, result, preproc_errors)) {
         while (preproc_errors.size()
                && preproc_errors[preproc_errors.size() - 1] == '\n')
             preproc_errors.erase(preproc_errors.size() - 1);
@@ -285,6 +567,8 @@ OSLCompilerImpl::read_compile_options(const std::vector<std::string>& options,
         } else if (options[i] == "-embed-source"
                    || options[i] == "--embed-source") {
             m_embed_source = true;
+        } else if (options[i] == "--binary-oso") {
+            m_binary_oso = true;
         } else if (options[i] == "-MD"
                    || options[i] == "--write-dependencies") {
             // write depfile w/ user and system headers
@@ -307,6 +591,15 @@ OSLCompilerImpl::read_compile_options(const std::vector<std::string>& options,
             m_preprocess_only = true;
             if (m_deps_filename.empty())
                 m_deps_filename = "stdout";
+        } else if (options[i] == "--header-cache") {
+            m_header_cache = true;
+        } else if (options[i] == "--header-cache-dir"
+                   && i < options.size() - 1) {
+            m_header_cache     = true;
+            m_header_cache_dir = options[++i];
+        } else if (options[i] == "-MP") {
+            // add a phony target for each header, as gcc does
+            m_deps_phony = true;
         } else if (options[i] == "-MF") {
             m_deps_filename = options[++i];
         } else if (OIIO::Strutil::starts_with(options[i], "-MF")) {
@@ -410,6 +703,9 @@ OSLCompilerImpl::compile(string_view filename,
         return false;
     }
 
+    m_used = true;
+    m_phase_times.clear();
+    m_phase_timer.lap();
     std::vector<std::string> defines;
     std::vector<std::string> includepaths;
     m_cwd           = OIIO::Filesystem::current_path();
@@ -435,16 +731,32 @@ OSLCompilerImpl::compile(string_view filename,
                          preprocess_result)) {
         return false;
     }
+    phase_done("preprocess");
 
-    if (m_preprocess_only && !m_generate_deps) {
-        std::cout << preprocess_result;
+    std::lock_guard<std::mutex> lock(frontend_mutex);
+    phase_done("wait for frontend lock");
+
+    if (m_generate_deps) {
+        // The preprocessor's line markers name every file it read, so the
+        // dependencies are known without parsing the shader at all.
+        for (auto&& f : line_marker_files(preprocess_result))
+            m_file_dependencies.emplace(cwd_relative(f));
+        write_dependency_file(filename, stdoslpath);
+    }
+
+    if (m_preprocess_only) {
+        // -E prints the preprocessed text; -M and -MM are done already
+        if (!m_generate_deps)
+            std::cout << preprocess_result;
     } else {
         bool parseerr = osl_parse_buffer(preprocess_result);
+        phase_done("parse");
         if (!parseerr) {
             if (shader())
                 shader()->typecheck();
             else
                 errorfmt(ustring(), 0, "No shader function defined");
+            phase_done("typecheck");
         }
 
         // Print the parse tree if there were no errors
@@ -454,16 +766,17 @@ OSLCompilerImpl::compile(string_view filename,
                 shader()->print(std::cout);
         }
 
-        if (m_generate_deps)
-            write_dependency_file(filename);
-
         if (!error_encountered()) {
             shader()->codegen();
+            phase_done("codegen");
             track_variable_dependencies();
             track_variable_lifetimes();
             check_for_illegal_writes();
-            //            if (m_optimizelevel >= 1)
-            //                coalesce_temporaries ();
+            phase_done("analysis");
+            if (m_optimizelevel >= 2 && !error_encountered()) {
+                optimize();
+                phase_done("optimize");
+            }
         }
 
         if (!error_encountered()) {
@@ -471,18 +784,31 @@ OSLCompilerImpl::compile(string_view filename,
                 m_output_filename = default_output_filename();
 
             OIIO::ofstream oso_output;
-            OIIO::Filesystem::open(oso_output, m_output_filename);
+            OIIO::Filesystem::open(oso_output, m_output_filename,
+                                   m_binary_oso
+                                       ? std::ios::out | std::ios::binary
+                                       : std::ios::out);
             if (!oso_output.good()) {
                 errorfmt(ustring(), 0, "Could not open \"{}\"",
                          m_output_filename);
                 return false;
             }
+            // Binary oso is made from the text, so write that to memory
+            // first when we need it.
+            std::ostringstream oso_text;
+            oso_text.imbue(std::locale::classic());  // force C locale
             OSL_DASSERT(m_osofile == nullptr);
-            m_osofile = &oso_output;
+            m_osofile = m_binary_oso ? (std::ostream*)&oso_text : &oso_output;
 
             write_oso_file(OIIO::Strutil::join(options, " "),
                            preprocess_result);
             OSL_DASSERT(m_osofile == nullptr);
+            if (m_binary_oso) {
+                std::string binary;
+                if (!binary_oso(oso_text.str(), binary))
+                    return false;
+                oso_output.write(binary.data(), binary.size());
+            }
 
             oso_output.close();
             if (!oso_output.good()) {
@@ -490,9 +816,11 @@ OSLCompilerImpl::compile(string_view filename,
                          m_output_filename);
                 return false;
             }
+            phase_done("write oso");
         }
     }
 
+    report_phase_times(filename);
     return !error_encountered();
 }
 
@@ -505,6 +833,9 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
 {
     if (filename.empty())
         filename = string_view("<buffer>");
+    m_used = true;
+    m_phase_times.clear();
+    m_phase_timer.lap();
 
     std::vector<std::string> defines;
     std::vector<std::string> includepaths;
@@ -527,16 +858,22 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
                            includepaths, preprocess_result)) {
         return false;
     }
+    phase_done("preprocess");
+
+    std::lock_guard<std::mutex> lock(frontend_mutex);
+    phase_done("wait for frontend lock");
 
     if (m_preprocess_only) {
         std::cout << preprocess_result;
     } else {
         bool parseerr = osl_parse_buffer(preprocess_result);
+        phase_done("parse");
         if (!parseerr) {
             if (shader())
                 shader()->typecheck();
             else
                 errorfmt(ustring(), 0, "No shader function defined");
+            phase_done("typecheck");
         }
 
         // Print the parse tree if there were no errors
@@ -548,11 +885,15 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
 
         if (!error_encountered()) {
             shader()->codegen();
+            phase_done("codegen");
             track_variable_dependencies();
             track_variable_lifetimes();
             check_for_illegal_writes();
-            //            if (m_optimizelevel >= 1)
-            //                coalesce_temporaries ();
+            phase_done("analysis");
+            if (m_optimizelevel >= 2 && !error_encountered()) {
+                optimize();
+                phase_done("optimize");
+            }
         }
 
         if (!error_encountered()) {
@@ -568,16 +909,75 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
                            preprocess_result);
             osobuffer = oso_output.str();
             OSL_DASSERT(m_osofile == nullptr);
+            if (m_binary_oso) {
+                std::string binary;
+                if (!binary_oso(osobuffer, binary))
+                    return false;
+                osobuffer = std::move(binary);
+            }
+            phase_done("write oso");
         }
     }
 
+    report_phase_times(filename);
     return !error_encountered();
 }
 
 
 
 void
-OSLCompilerImpl::write_dependency_file(string_view filename)
+OSLCompilerImpl::report_phase_times(string_view filename) const
+{
+    using OIIO::Strutil::fmt::format;
+    if (!m_verbose || m_phase_times.empty())
+        return;
+    double total    = 0.0;
+    std::string msg = format("Compile times for {}:", filename);
+    for (auto&& p : m_phase_times) {
+        msg += format("\n    {:<24} {:8.3f}s", p.first, p.second);
+        total += p.second;
+    }
+    msg += format("\n    {:<24} {:8.3f}s", "total", total);
+    infofmt(ustring(), 0, "{}", msg);
+}
+
+
+
+bool
+OSLCompilerImpl::binary_oso(const std::string& text, std::string& binary)
+{
+    OSOBinaryWriter writer(&errhandler());
+    if (!writer.parse_memory(text)) {
+        errorfmt(ustring(), 0, "Could not convert \"{}\" to binary oso",
+                 m_output_filename);
+        return false;
+    }
+    binary = writer.binary();
+    return true;
+}
+
+
+
+// Escape a file name for a make rule.
+static std::string
+make_escape(string_view name)
+{
+    std::string s;
+    for (char c : name) {
+        if (c == ' ' || c == '#')
+            s += '\\';
+        else if (c == '$')
+            s += '$';
+        s += c;
+    }
+    return s;
+}
+
+
+
+void
+OSLCompilerImpl::write_dependency_file(string_view filename,
+                                       string_view stdoslpath)
 {
     if (m_deps_filename.empty())
         m_deps_filename = OIIO::Filesystem::replace_extension(filename, ".d");
@@ -586,22 +986,39 @@ OSLCompilerImpl::write_dependency_file(string_view filename)
         target = m_output_filename.size()
                      ? m_output_filename
                      : OIIO::Filesystem::replace_extension(filename, ".oso");
+    // stdosl.h and anything else in its directory are the system headers
+    std::string sysdir = stdoslpath.size()
+                             ? OIIO::Filesystem::parent_path(
+                                 cwd_relative(stdoslpath))
+                             : std::string();
+    std::vector<std::string> deps;
+    for (const auto& dep : m_file_dependencies) {
+        if (!m_generate_system_deps
+            && (OIIO::Strutil::ends_with(dep, "stdosl.h")
+                || (sysdir.size()
+                    && OIIO::Filesystem::parent_path(dep.string())
+                           == sysdir)))
+            continue;  // skip system headers if so instructed
+        if (OIIO::Strutil::starts_with(dep, "<"))
+            continue;  // skip pseudo files
+        if (dep == filename)
+            continue;  // skip this file, since we already put it first
+        deps.emplace_back(make_escape(dep));
+    }
     FILE* depfile = (m_deps_filename == "stdout"
                          ? stdout
                          : OIIO::Filesystem::fopen(m_deps_filename, "w"));
     if (depfile) {
-        OIIO::Strutil::fprintf(depfile, "%s: %s", target, filename);
-        for (const auto& dep : m_file_dependencies) {
-            if (OIIO::Strutil::ends_with(dep, "stdosl.h")
-                && !m_generate_system_deps)
-                continue;  // skip system headers if so instructed
-            if (OIIO::Strutil::starts_with(dep, "<"))
-                continue;  // skip pseudo files
-            if (dep == filename)
-                continue;  // skip this file, since we already put it first
+        OIIO::Strutil::fprintf(depfile, "%s: %s", make_escape(target),
+                               make_escape(filename));
+        for (const auto& dep : deps)
             OIIO::Strutil::fprintf(depfile, " \\\n  %s", dep);
-        }
         OIIO::Strutil::fprintf(depfile, "\n");
+        // With -MP, a rule for each header, so that deleting one doesn't
+        // break the build until the shader is recompiled.
+        if (m_deps_phony)
+            for (const auto& dep : deps)
+                OIIO::Strutil::fprintf(depfile, "\n%s:\n", dep);
         if (depfile != stdout)
             fclose(depfile);
     } else {
@@ -5,13 +5,16 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <set>
 #include <stack>
+#include <unordered_map>
 #include <vector>
 
 #include <OSL/genclosure.h>
 #include <OSL/oslcomp.h>
 #include <OSL/oslconfig.h>
+#include <OpenImageIO/timer.h>
 #include "ast.h"
 #include "symtab.h"
 
@@ -32,6 +35,17 @@ typedef std::set<const Symbol*> SymPtrSet;
 typedef std::map<const Symbol*, SymPtrSet> SymDependencyMap;
 
 
+/// stdosl.h run through the preprocessor once, so that every shader
+/// compiled with the same defines and include paths can start from it
+/// rather than preprocessing it again (see the --header-cache option).
+struct PreprocessedHeader {
+    std::string text;    ///< Preprocessed output, with line markers
+    std::string macros;  ///< The #defines in effect at its end
+    /// Every file it read, with a hash of the contents it had then.
+    std::vector<std::pair<std::string, size_t>> deps;
+};
+
+
 
 class OSLCompilerImpl {
 public:
@@ -58,7 +72,6 @@ public:
     void filename(ustring f)
     {
         m_filename = f;
-        m_file_dependencies.emplace(f);
     }
 
     /// The line we're currently parsing
@@ -75,6 +88,12 @@ public:
 
     ErrorHandler& errhandler() const { return *m_errhandler; }
 
+    /// Has compile() or compile_buffer() been called?
+    bool used() const { return m_used; }
+
+    /// Turn on reuse of the preprocessed stdosl.h (--header-cache).
+    void header_cache(bool on) { m_header_cache = on; }
+
     /// Error reporting
     template<typename... Args>
     void errorfmt(ustring filename, int line, const char* format,
@@ -165,6 +184,27 @@ public:
                            const std::vector<std::string>& includepaths,
                            std::string& result);
 
+    /// Run the clang preprocessor over buffer (named filename), putting
+    /// its output in result and any diagnostics in errors. With
+    /// macros_only, the output is the set of #defines in effect at the
+    /// end of the buffer rather than the preprocessed text.
+    bool run_preprocessor(const std::string& buffer,
+                          const std::string& filename,
+                          const std::string& directory,
+                          const std::vector<std::string>& defines,
+                          const std::vector<std::string>& includepaths,
+                          bool macros_only, std::string& result,
+                          std::string& errors);
+
+    /// Return stdosl.h preprocessed with these defines and include paths,
+    /// from the header cache if it's there and still up to date, otherwise
+    /// preprocessing it and adding it to the cache. Returns nullptr if the
+    /// header doesn't preprocess cleanly.
+    std::shared_ptr<const PreprocessedHeader>
+    preprocessed_stdosl(const std::string& stdoslpath,
+                        const std::vector<std::string>& defines,
+                        const std::vector<std::string>& includepaths);
+
     /// Has a shader already been defined?
     bool shader_is_defined() const { return (bool)m_shader; }
 
@@ -204,6 +244,23 @@ public:
     /// to the type.
     std::string code_from_type(TypeSpec type) const;
 
+    /// Function calls already resolved to one overload, keyed by the
+    /// head of the overload list and the argument types, so that the many
+    /// identical calls in generated code don't each score every overload.
+    typedef std::unordered_map<std::string,
+                               std::pair<FunctionSymbol*, TypeSpec>>
+        OverloadIndex;
+    OverloadIndex& overload_index() { return m_overload_index; }
+
+    /// Note that a compile phase has ended, for the -v phase times.
+    void phase_done(const char* phase)
+    {
+        m_phase_times.emplace_back(phase, m_phase_timer.lap());
+    }
+
+    /// In verbose mode, report how long each phase took.
+    void report_phase_times(string_view filename) const;
+
     /// Take a type code string (possibly containing many types)
     /// and turn it into a human-readable string.
     std::string typelist_from_code(const char* code) const;
@@ -388,7 +445,10 @@ private:
     void write_oso_const_value(const ConstantSymbol* sym) const;
     void write_oso_symbol(const Symbol* sym);
     void write_oso_metadata(const ASTNode* metanode) const;
-    void write_dependency_file(string_view filename);
+    /// Convert the text OSO to binary OSO (--binary-oso).
+    bool binary_oso(const std::string& text, std::string& binary);
+    void write_dependency_file(string_view filename, string_view stdoslpath);
+    std::string cwd_relative(string_view filename) const;
 
     // Output text to the osofile, using std::format formatting conventions.
     template<typename... Args>
@@ -405,6 +465,23 @@ private:
     void track_variable_dependencies();
     void coalesce_temporaries() { coalesce_temporaries(m_symtab.allsyms()); }
 
+    /// Simplify the generated code in ways that don't depend on parameter
+    /// values (-O2): fold constant arithmetic, propagate constants and
+    /// copies through temporaries, drop ops whose results are never used,
+    /// and coalesce temporaries. Must be called AFTER
+    /// track_variable_dependencies and check_for_illegal_writes.
+    void optimize();
+
+    /// Helpers for optimize(): fold one op if all its inputs are
+    /// constants; forward values through single-use temporaries; flag
+    /// unneeded ops in dead[]; and remove the flagged ops, fixing up
+    /// jumps and init ranges. The first three return true if they
+    /// changed anything.
+    bool fold_constant_op(Opcode& op);
+    bool propagate_through_temps(std::vector<bool>& dead);
+    bool find_dead_ops(std::vector<bool>& dead);
+    void remove_ops(const std::vector<bool>& dead);
+
     /// Scan through all the ops and make sure none of them write to
     /// things that are illegal (consts, non-output params, etc.).
     /// Must be called AFTER track_variable_lifetimes.
@@ -473,6 +550,10 @@ private:
     bool m_generate_deps = false;  ///< Generate dependencies? -MD or -MMD?
     bool m_generate_system_deps = false;  ///< Generate system header deps? -MD
     bool m_embed_source         = false;  ///< Embed preprocessed source in oso?
+    bool m_binary_oso           = false;  ///< Write binary oso?
+    bool m_used         = false;  ///< Has it compiled anything?
+    bool m_header_cache = false;  ///< Reuse preprocessed stdosl.h?
+    std::string m_header_cache_dir;  ///< Where to keep it between runs
     bool m_err_on_warning;                ///< Treat warnings as errors?
     int m_optimizelevel;                  ///< Optimization level
     OpcodeVec m_ircode;                   ///< Generated IR code
@@ -497,9 +578,13 @@ private:
     int m_last_sourceline;
     size_t m_last_sourceline_offset;
     std::string m_deps_filename;            ///< Where to write deps? -MF
-    std::string m_deps_target;              ///< Custom target: -MF
+    std::string m_deps_target;              ///< Custom target: -MT
+    bool m_deps_phony = false;              ///< Phony header targets? -MP
     std::set<ustring> m_file_dependencies;  ///< All include file dependencies
     std::stack<TypeSpec> m_typespec_stack;  ///< Just for function_declaration
+    OverloadIndex m_overload_index;         ///< Resolved function calls
+    OIIO::Timer m_phase_timer;              ///< Times the compile phases
+    std::vector<std::pair<const char*, double>> m_phase_times;  ///< For -v
 };
 
 
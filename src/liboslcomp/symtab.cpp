@@ -168,25 +168,20 @@ Symbol::print(std::ostream& out, int maxvals) const
 Symbol*
 SymbolTable::find(ustring name, Symbol* last) const
 {
-    ScopeTableStack::const_reverse_iterator scopelevel;
-    scopelevel = m_scopetables.rbegin();
+    NameTable::const_iterator found = m_visible.find(name);
+    if (found == m_visible.end())
+        return NULL;  // not found
+    const SymbolPtrVec& syms(found->second);
+    size_t n = syms.size();
     if (last) {
         // We only want to match OUTSIDE the scope of 'last'.  So first
         // search for last.  Then advance to the next outer scope.
-        for (; scopelevel != m_scopetables.rend(); ++scopelevel) {
-            ScopeTable::const_iterator s = scopelevel->find(name);
-            if (s != scopelevel->end() && s->second == last) {
-                ++scopelevel;
-                break;
-            }
-        }
+        while (n && syms[n - 1] != last)
+            --n;
+        if (n)
+            --n;
     }
-    for (; scopelevel != m_scopetables.rend(); ++scopelevel) {
-        ScopeTable::const_iterator s = scopelevel->find(name);
-        if (s != scopelevel->end())
-            return s->second;
-    }
-    return NULL;  // not found
+    return n ? syms[n - 1] : NULL;
 }
 
 
@@ -214,7 +209,13 @@ SymbolTable::insert(Symbol* sym)
 {
     OSL_DASSERT(sym != NULL);
     sym->scope(scopeid());
-    m_scopetables.back()[sym->name()] = sym;
+    SymbolPtrVec& syms(m_visible[sym->name()]);
+    if (syms.size() && syms.back()->scope() == scopeid()) {
+        syms.back() = sym;  // replaces the same name in this scope
+    } else {
+        syms.push_back(sym);
+        m_scopenames.push_back(sym->name());
+    }
     m_allsyms.push_back(sym);
     m_allmangled[ustring(sym->mangled())] = sym;
 }
@@ -254,7 +255,7 @@ SymbolTable::push()
 {
     m_scopestack.push(m_scopeid);  // push old scope id on the scope stack
     m_scopeid = m_nextscopeid++;   // set to new scope id
-    m_scopetables.resize(m_scopetables.size() + 1);  // push scope table
+    m_scopebegin.push_back(m_scopenames.size());
 }
 
 
@@ -262,7 +263,12 @@ SymbolTable::push()
 void
 SymbolTable::pop()
 {
-    m_scopetables.resize(m_scopetables.size() - 1);
+    // Unhide whatever the names of this scope were hiding.
+    OSL_DASSERT(!m_scopebegin.empty());
+    for (size_t i = m_scopebegin.back(); i < m_scopenames.size(); ++i)
+        m_visible[m_scopenames[i]].pop_back();
+    m_scopenames.resize(m_scopebegin.back());
+    m_scopebegin.pop_back();
     OSL_DASSERT(!m_scopestack.empty());
     m_scopeid = m_scopestack.top();
     m_scopestack.pop();
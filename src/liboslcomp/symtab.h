@@ -187,15 +187,16 @@ private:
 class SymbolTable {
 public:
     typedef std::unordered_map<ustring, Symbol*, ustringHash> ScopeTable;
-    typedef std::vector<ScopeTable> ScopeTableStack;
+    /// For each name, the symbols of that name in the active scopes,
+    /// innermost last.  One hash lookup finds a name at any depth.
+    typedef std::unordered_map<ustring, SymbolPtrVec, ustringHash> NameTable;
     typedef SymbolPtrVec::iterator iterator;
     typedef SymbolPtrVec::const_iterator const_iterator;
 
     SymbolTable(OSLCompilerImpl& comp)
         : m_comp(comp), m_scopeid(-1), m_nextscopeid(0)
     {
-        m_scopetables.reserve(20);  // So unlikely to ever copy tables
-        push();                     // Create scope 0 -- global scope
+        push();  // Create scope 0 -- global scope
         //        m_structs.resize (1);        // Create dummy struct
     }
     ~SymbolTable() { delete_syms(); }
@@ -259,13 +260,15 @@ public:
     SymbolPtrVec& allsyms() { return m_allsyms; }
 
 private:
-    OSLCompilerImpl& m_comp;        ///< Back-reference to compiler
-    SymbolPtrVec m_allsyms;         ///< Master list of all symbols
-    ScopeTableStack m_scopetables;  ///< Stack of symbol scopes
-    std::stack<int> m_scopestack;   ///< Stack of current scope IDs
-    ScopeTable m_allmangled;        ///< All syms, mangled, in a hash table
-    int m_scopeid;                  ///< Current scope ID
-    int m_nextscopeid;              ///< Next unique scope ID
+    OSLCompilerImpl& m_comp;            ///< Back-reference to compiler
+    SymbolPtrVec m_allsyms;             ///< Master list of all symbols
+    NameTable m_visible;                ///< Symbols of the active scopes
+    std::vector<ustring> m_scopenames;  ///< Names entered in active scopes
+    std::vector<size_t> m_scopebegin;   ///< Where each scope's names start
+    std::stack<int> m_scopestack;       ///< Stack of current scope IDs
+    ScopeTable m_allmangled;            ///< All syms, mangled, in a hash table
+    int m_scopeid;                      ///< Current scope ID
+    int m_nextscopeid;                  ///< Next unique scope ID
 };
 
 
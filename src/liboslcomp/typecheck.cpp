@@ -1860,6 +1860,9 @@ public:
 
     bool empty() const { return m_candidates.empty(); }
 
+    // Did exactly one overload match, so that there was nothing to report?
+    bool unique() const { return m_candidates.size() == 1; }
+
     // Remove when LegacyOverload checking is removed.
     bool hadinitlist() const { return m_had_initlist; }
 };
@@ -1986,37 +1989,60 @@ ASTfunction_call::typecheck(TypeSpec expected)
     // Save the currently choosen symbol for error reporting later
     FunctionSymbol* poly = func();
 
-    CandidateFunctions candidates(m_compiler, expected, args(), poly);
-    std::tie(m_sym, m_typespec) = candidates.best(this, m_name);
-
-    // Check resolution against prior versions of OSL.
-    // Skip the check if any arguments used initializer list syntax.
+    // A call that matched just one overload is remembered by its argument
+    // types, and later calls to the same overload list with the same
+    // types skip the scoring. (Only the argument types decide the matches;
+    // the expected type just breaks ties, which aren't remembered.)
     static const char* OSL_LEGACY = ::getenv("OSL_LEGACY_FUNCTION_RESOLUTION");
-    if (!candidates.hadinitlist() && OSL_LEGACY && strcmp(OSL_LEGACY, "0")) {
-        auto* legacy = LegacyOverload(m_compiler, this, poly,
-                                      &ASTfunction_call::check_arglist)(
-            expected);
-        if (m_sym != legacy) {
-            bool as_warning = true;
-            if (Strutil::iequals(OSL_LEGACY, "err"))
-                as_warning = false;  // full error
-            std::string errmsg = "  Current overload is\n";
-            if (m_sym)
-                errmsg += candidates.reportFunction(
-                    static_cast<FunctionSymbol*>(m_sym));
-            else
-                errmsg += "<none>";
-            errmsg += "\n  Prior overload was ";
-            if (legacy)
-                errmsg += candidates.reportFunction(legacy);
-            else
-                errmsg += "<none>";
-            if (Strutil::iequals(OSL_LEGACY, "use"))
-                m_sym = legacy;
-            if (as_warning)
-                warningfmt("overload chosen differs from OSL 1.9\n{}", errmsg);
-            else
-                errorfmt("overload chosen differs from OSL 1.9\n{}", errmsg);
+    bool legacy_check = OSL_LEGACY && strcmp(OSL_LEGACY, "0");
+    std::string overload_key;
+    if (poly && !any_args_are_compound_initializers && !legacy_check) {
+        overload_key.assign((const char*)&poly, sizeof(poly));
+        for (ref arg = args(); arg; arg = arg->next()) {
+            overload_key += m_compiler->code_from_type(arg->typespec());
+            overload_key += ',';
+        }
+    }
+    auto& index = m_compiler->overload_index();
+    auto found  = overload_key.size() ? index.find(overload_key) : index.end();
+    if (found != index.end()) {
+        std::tie(m_sym, m_typespec) = found->second;
+    } else {
+        CandidateFunctions candidates(m_compiler, expected, args(), poly);
+        std::tie(m_sym, m_typespec) = candidates.best(this, m_name);
+        if (overload_key.size() && candidates.unique())
+            index.emplace(overload_key, std::make_pair(func(), m_typespec));
+
+        // Check resolution against prior versions of OSL.
+        // Skip the check if any arguments used initializer list syntax.
+        if (!candidates.hadinitlist() && legacy_check) {
+            auto* legacy = LegacyOverload(m_compiler, this, poly,
+                                          &ASTfunction_call::check_arglist)(
+                expected);
+            if (m_sym != legacy) {
+                bool as_warning = true;
+                if (Strutil::iequals(OSL_LEGACY, "err"))
+                    as_warning = false;  // full error
+                std::string errmsg = "  Current overload is\n";
+                if (m_sym)
+                    errmsg += candidates.reportFunction(
+                        static_cast<FunctionSymbol*>(m_sym));
+                else
+                    errmsg += "<none>";
+                errmsg += "\n  Prior overload was ";
+                if (legacy)
+                    errmsg += candidates.reportFunction(legacy);
+                else
+                    errmsg += "<none>";
+                if (Strutil::iequals(OSL_LEGACY, "use"))
+                    m_sym = legacy;
+                if (as_warning)
+                    warningfmt("overload chosen differs from OSL 1.9\n{}",
+                               errmsg);
+                else
+                    errorfmt("overload chosen differs from OSL 1.9\n{}",
+                             errmsg);
+            }
         }
     }
 
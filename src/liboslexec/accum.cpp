@@ -6,6 +6,11 @@
 #include <OSL/oslclosure.h>
 #include "lpeparse.h"
 
+#include <algorithm>
+#include <cstring>
+
+#include <OpenImageIO/parallel.h>
+
 
 OSL_NAMESPACE_ENTER
 
@@ -30,6 +35,161 @@ AovOutput::flush(void *flush_data)
 
 
 
+static inline void
+atomic_add(std::atomic<float> &a, float f)
+{
+    float old = a.load(std::memory_order_relaxed);
+    while (!a.compare_exchange_weak(old, old + f, std::memory_order_relaxed))
+        ;
+}
+
+
+
+static inline void
+plain_add(std::atomic<float> &a, float f)
+{
+    // The owner thread is the only one touching it, relaxed
+    // accesses compile to ordinary loads and stores
+    a.store(a.load(std::memory_order_relaxed) + f, std::memory_order_relaxed);
+}
+
+
+
+AovBuffer::AovBuffer(int xbegin, int ybegin, int width, int height, int noutputs)
+    : m_xbegin(xbegin), m_ybegin(ybegin), m_width(width), m_height(height),
+      m_noutputs(noutputs),
+      m_cells(new Cell[size_t(width) * height * noutputs])
+{
+    reset();
+}
+
+
+
+void
+AovBuffer::reset()
+{
+    size_t n = size_t(m_width) * m_height * m_noutputs;
+    for (size_t i = 0; i < n; ++i) {
+        Cell &c = m_cells[i];
+        c.color[0].store(0.0f, std::memory_order_relaxed);
+        c.color[1].store(0.0f, std::memory_order_relaxed);
+        c.color[2].store(0.0f, std::memory_order_relaxed);
+        c.alpha.store(0.0f, std::memory_order_relaxed);
+        c.flags.store(0, std::memory_order_relaxed);
+    }
+}
+
+
+
+void
+AovBuffer::add(int x, int y, const std::vector<AovOutput> &outputs)
+{
+    OSL_DASSERT (contains(x, y));
+    Cell *c = cells(x, y);
+    int n = std::min(m_noutputs, int(outputs.size()));
+    for (int i = 0; i < n; ++i) {
+        const AovOutput &o = outputs[i];
+        if (o.has_color) {
+            plain_add(c[i].color[0], o.color.x);
+            plain_add(c[i].color[1], o.color.y);
+            plain_add(c[i].color[2], o.color.z);
+        }
+        if (o.has_alpha)
+            plain_add(c[i].alpha, o.alpha);
+        int flags = (o.has_color ? 1 : 0) | (o.has_alpha ? 2 : 0);
+        if (flags)
+            c[i].flags.store(c[i].flags.load(std::memory_order_relaxed) | flags,
+                             std::memory_order_relaxed);
+    }
+}
+
+
+
+void
+AovBuffer::atomicAdd(int x, int y, const std::vector<AovOutput> &outputs)
+{
+    OSL_DASSERT (contains(x, y));
+    Cell *c = cells(x, y);
+    int n = std::min(m_noutputs, int(outputs.size()));
+    for (int i = 0; i < n; ++i) {
+        const AovOutput &o = outputs[i];
+        if (o.has_color) {
+            atomic_add(c[i].color[0], o.color.x);
+            atomic_add(c[i].color[1], o.color.y);
+            atomic_add(c[i].color[2], o.color.z);
+        }
+        if (o.has_alpha)
+            atomic_add(c[i].alpha, o.alpha);
+        int flags = (o.has_color ? 1 : 0) | (o.has_alpha ? 2 : 0);
+        if (flags)
+            c[i].flags.fetch_or(flags, std::memory_order_relaxed);
+    }
+}
+
+
+
+void
+AovBuffer::merge(const AovBuffer &tile, int ybegin, int yend)
+{
+    int x0 = std::max(m_xbegin, tile.m_xbegin);
+    int x1 = std::min(m_xbegin + m_width, tile.m_xbegin + tile.m_width);
+    int y0 = std::max(ybegin, tile.m_ybegin);
+    int y1 = std::min(yend, tile.m_ybegin + tile.m_height);
+    int n = std::min(m_noutputs, tile.m_noutputs);
+    for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+            Cell *dst = cells(x, y);
+            const Cell *src = tile.cells(x, y);
+            for (int i = 0; i < n; ++i) {
+                int flags = src[i].flags.load(std::memory_order_relaxed);
+                if (!flags)
+                    continue;
+                for (int c = 0; c < 3; ++c)
+                    plain_add(dst[i].color[c], src[i].color[c].load(std::memory_order_relaxed));
+                plain_add(dst[i].alpha, src[i].alpha.load(std::memory_order_relaxed));
+                dst[i].flags.store(dst[i].flags.load(std::memory_order_relaxed) | flags,
+                                   std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+
+
+void
+AovBuffer::merge(AovBuffer &image, const std::vector<const AovBuffer*> &tiles)
+{
+    // Each task owns a band of rows of the image, so tiles overlapping
+    // each other (filter footprints) still never race
+    OIIO::parallel_for_chunked (image.m_ybegin, image.m_ybegin + image.m_height, 0,
+        [&](int64_t ybegin, int64_t yend) {
+            for (const AovBuffer *tile : tiles)
+                image.merge(*tile, int(ybegin), int(yend));
+        });
+}
+
+
+
+void
+AovBuffer::get(int x, int y, std::vector<AovOutput> &outputs) const
+{
+    OSL_DASSERT (contains(x, y));
+    const Cell *c = cells(x, y);
+    int n = std::min(m_noutputs, int(outputs.size()));
+    for (int i = 0; i < n; ++i) {
+        AovOutput &o = outputs[i];
+        int flags = c[i].flags.load(std::memory_order_relaxed);
+        o.color.setValue(c[i].color[0].load(std::memory_order_relaxed),
+                         c[i].color[1].load(std::memory_order_relaxed),
+                         c[i].color[2].load(std::memory_order_relaxed));
+        o.alpha = c[i].alpha.load(std::memory_order_relaxed);
+        o.has_color = (flags & 1) != 0;
+        o.has_alpha = (flags & 2) != 0;
+    }
+}
+
+
+
 void
 AccumRule::accum(const Color3 &color, std::vector<AovOutput> &outputs)const
 {
@@ -65,6 +225,7 @@ AccumAutomata::addRule(const char *pattern, int outidx, bool toalpha)
         return NULL;
     }
     m_accumrules.emplace_back(outidx, toalpha);
+    m_patterns.emplace_back(pattern);
     // it is a list, so as long as we don't remove it from there, the pointer is valid
     void *rule = (void *)&(m_accumrules.back());
     m_rules.push_back (new lpexp::Rule (e, rule));
@@ -90,6 +251,76 @@ AccumAutomata::compile()
 
 
 
+// Identifies (and versions) the binary form of a compiled AccumAutomata
+static const char automata_blob_magic[] = "OSLLPE1";
+
+
+
+std::string
+AccumAutomata::cacheKey() const
+{
+    // Everything that goes into the compiled automata, written so that
+    // no two different rule sets can come out the same
+    std::string key;
+    for (ustring e : m_user_events)
+        key += fmtformat("E{}:{}", e.size(), e);
+    for (ustring s : m_user_scatterings)
+        key += fmtformat("S{}:{}", s.size(), s);
+    auto pattern = m_patterns.begin();
+    for (const AccumRule &r : m_accumrules)
+        key += fmtformat("R{},{},{}:{}", r.getOutputIndex(),
+                         int(r.toAlpha()), pattern->size(), *pattern++);
+    return key;
+}
+
+
+
+std::string
+AccumAutomata::serialize() const
+{
+    std::string blob(automata_blob_magic, sizeof(automata_blob_magic));
+    std::string key = cacheKey();
+    size_t keylen = key.size();
+    blob.append((const char *)&keylen, sizeof(keylen));
+    blob += key;
+    std::vector<void*> rules;
+    for (const AccumRule &r : m_accumrules)
+        rules.push_back((void *)&r);
+    m_dfoptautomata.save(blob, rules);
+    return blob;
+}
+
+
+
+bool
+AccumAutomata::compileFromCache(const std::string &blob)
+{
+    // It has to be for exactly these rules, since the automata links to
+    // them by their order
+    std::string key = cacheKey();
+    size_t pos = sizeof(automata_blob_magic), keylen = 0;
+    if (blob.size() < pos + sizeof(keylen)
+        || blob.compare(0, pos, automata_blob_magic, pos) != 0)
+        return false;
+    memcpy(&keylen, blob.data() + pos, sizeof(keylen));
+    pos += sizeof(keylen);
+    if (keylen != key.size() || blob.compare(pos, keylen, key) != 0)
+        return false;
+    pos += keylen;
+    std::vector<void*> rules;
+    for (AccumRule &r : m_accumrules)
+        rules.push_back((void *)&r);
+    if (!m_dfoptautomata.load(blob, pos, rules) || pos != blob.size())
+        return false;
+    // Same as compile(), the parsed expressions aren't needed anymore
+    for (auto& r : m_rules)
+        delete r;
+    m_rules.clear();
+    return true;
+}
+
+
+
 void
 AccumAutomata::accum(int state, const Color3 &color, std::vector<AovOutput> &outputs)const
 {
@@ -199,4 +430,24 @@ Accumulator::end(void *flush_data)
         m_outputs[i].flush(flush_data);
 }
 
+
+
+void
+Accumulator::end(AovBuffer &buffer, int x, int y, bool atomic)
+{
+    if (atomic)
+        buffer.atomicAdd(x, y, m_outputs);
+    else
+        buffer.add(x, y, m_outputs);
+}
+
+
+
+void
+Accumulator::flush(const AovBuffer &buffer, int x, int y, void *flush_data)
+{
+    buffer.get(x, y, m_outputs);
+    end(flush_data);
+}
+
 OSL_NAMESPACE_EXIT
@@ -6,6 +6,11 @@
 #include <OSL/oslclosure.h>
 #include <OpenImageIO/unittest.h>
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
 using namespace OSL;
 
 #define END_AOV 65535
@@ -63,8 +68,8 @@ class MyAov final : public Aov
         std::vector<bool> m_received;
 };
 
-// Simulate the tracing of a path with the accumulator
-void simulate(Accumulator &accum, const char **events, size_t testno)
+// Simulate the tracing of a path with the accumulator, without flushing
+void walk(Accumulator &accum, const char **events)
 {
     accum.begin();
     accum.pushState();
@@ -84,13 +89,30 @@ void simulate(Accumulator &accum, const char **events, size_t testno)
     }
     // Here is were we have reached a light, accumulate color
     accum.accum(Color3(1, 1, 1));
-    // Restore state and flush
+    // Restore state
     accum.popState();
+}
+
+// Simulate the tracing of a path and flush it to the AOVs
+void simulate(Accumulator &accum, const char **events, size_t testno)
+{
+    walk(accum, events);
     accum.end(reinterpret_cast<void*>(testno));
 }
 
-int main()
+// Usage: accum_test [--save-cache file | --load-cache file]
+// With --save-cache the compiled automata is written to the file, and with
+// --load-cache all the checks below run on one loaded from it instead of
+// compiled, the way a renderer would reuse it in a later run.
+int main(int argc, char* argv[])
 {
+    const char* save_cache = nullptr;
+    const char* load_cache = nullptr;
+    if (argc == 3 && !strcmp(argv[1], "--save-cache"))
+        save_cache = argv[2];
+    else if (argc == 3 && !strcmp(argv[1], "--load-cache"))
+        load_cache = argv[2];
+
     // Some constants to avoid refering to AOV's by number
     const int beauty       = 0;
     const int diffuse2_3   = 1;
@@ -128,23 +150,40 @@ int main()
         aovs.emplace_back(test, i);
 
     // Create the automata and add the rules
-    AccumAutomata automata;
-
-    automata.addEventType(ustring("U"));
-    automata.addScatteringType(ustring("Y"));
+    auto add_rules = [&](AccumAutomata& automata) {
+        automata.addEventType(ustring("U"));
+        automata.addScatteringType(ustring("Y"));
 
-    OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D*L",        beauty));
-    OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D{2,3}L",    diffuse2_3));
-    OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D*<L.'3'>",  light3));
-    OIIO_CHECK_ASSERT(automata.addRule("C[SG]*<.D'1'>D*L", object_1));
-    OIIO_CHECK_ASSERT(automata.addRule("C<.[SG]>+D*L",     specular));
-    OIIO_CHECK_ASSERT(automata.addRule("CD+L",             diffuse));
-    OIIO_CHECK_ASSERT(automata.addRule("CD+<Ts>L",         transpshadow));
-    OIIO_CHECK_ASSERT(automata.addRule("C<R[^D]>+D*L",     reflections));
-    OIIO_CHECK_ASSERT(automata.addRule("C([SG]*D){1,2}L",  nocaustic));
-    OIIO_CHECK_ASSERT(automata.addRule("CDY+U",            custom));
+        OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D*L",        beauty));
+        OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D{2,3}L",    diffuse2_3));
+        OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D*<L.'3'>",  light3));
+        OIIO_CHECK_ASSERT(automata.addRule("C[SG]*<.D'1'>D*L", object_1));
+        OIIO_CHECK_ASSERT(automata.addRule("C<.[SG]>+D*L",     specular));
+        OIIO_CHECK_ASSERT(automata.addRule("CD+L",             diffuse));
+        OIIO_CHECK_ASSERT(automata.addRule("CD+<Ts>L",         transpshadow));
+        OIIO_CHECK_ASSERT(automata.addRule("C<R[^D]>+D*L",     reflections));
+        OIIO_CHECK_ASSERT(automata.addRule("C([SG]*D){1,2}L",  nocaustic));
+        OIIO_CHECK_ASSERT(automata.addRule("CDY+U",            custom));
+    };
+    AccumAutomata automata;
+    add_rules(automata);
 
-    automata.compile();
+    if (load_cache) {
+        std::ifstream in(load_cache, std::ios::binary);
+        std::stringstream blob;
+        blob << in.rdbuf();
+        OIIO_CHECK_ASSERT(in.good());
+        OIIO_CHECK_ASSERT(automata.compileFromCache(blob.str()));
+    } else {
+        automata.compile();
+    }
+    if (save_cache) {
+        std::ofstream out(save_cache, std::ios::binary);
+        out << automata.serialize();
+        OIIO_CHECK_ASSERT(out.good());
+    }
+    OIIO_CHECK_ASSERT(automata.stateCount() > 0);
+    OIIO_CHECK_ASSERT(automata.memoryUsed() > 0);
 
     // now create the accumulator
     Accumulator accum (&automata);
@@ -169,6 +208,51 @@ int main()
     OIIO_CHECK_ASSERT(aovs[reflections ].check());
     OIIO_CHECK_ASSERT(aovs[nocaustic   ].check());
 
+    // Same again, but accumulating each test case into pixel x=testno of
+    // one of two tiles, one with plain adds and the other with atomics,
+    // then merging the tiles and flushing the merged image
+    int ntests = 0;
+    while (test[ntests].path[0])
+        ++ntests;
+    AovBuffer tile0(0, 0, ntests, 1, naovs), tile1(0, 0, ntests, 1, naovs);
+    for (int i = 0; i < ntests; ++i) {
+        walk(accum, test[i].path);
+        accum.end(i & 1 ? tile1 : tile0, i, 0, i & 1);
+    }
+    AovBuffer image(0, 0, ntests, 1, naovs);
+    AovBuffer::merge(image, { &tile0, &tile1 });
+    for (int i = 0; i < ntests; ++i)
+        accum.flush(image, i, 0, reinterpret_cast<void*>(size_t(i)));
+    for (int i = 0; i < naovs; ++i)
+        OIIO_CHECK_ASSERT(aovs[i].check());
+
+    // An automata loaded from the serialized one has to move and accept
+    // exactly the same way, and one with other rules must reject it
+    std::string blob = automata.serialize();
+    AccumAutomata cached;
+    add_rules(cached);
+    OIIO_CHECK_EQUAL(cached.cacheKey(), automata.cacheKey());
+    OIIO_CHECK_ASSERT(cached.compileFromCache(blob));
+    OIIO_CHECK_EQUAL(cached.stateCount(), automata.stateCount());
+    const char* symbols[] = { "C", "D", "S", "G", "R", "T", "L", "O", "U",
+                              "Y", "x", "1", "3", "__stop__", "unknown" };
+    for (int state = 0; state < automata.stateCount(); ++state) {
+        for (const char* sym : symbols)
+            OIIO_CHECK_EQUAL(cached.getTransition(state, ustring(sym)),
+                             automata.getTransition(state, ustring(sym)));
+        int n0 = 0, n1 = 0;
+        void* const* r0 = automata.getRulesInState(state, n0);
+        void* const* r1 = cached.getRulesInState(state, n1);
+        OIIO_CHECK_EQUAL(n0, n1);
+        for (int r = 0; r < std::min(n0, n1); ++r)
+            OIIO_CHECK_EQUAL(((AccumRule*)r0[r])->getOutputIndex(),
+                             ((AccumRule*)r1[r])->getOutputIndex());
+    }
+    AccumAutomata other;
+    OIIO_CHECK_ASSERT(other.addRule("CD+L", diffuse));
+    OIIO_CHECK_ASSERT(!other.compileFromCache(blob));
+    OIIO_CHECK_ASSERT(!cached.compileFromCache(blob.substr(0, blob.size() / 2)));
+
     std::cout << "Light expressions check OK" << std::endl;
     return unit_test_failures;
 }
@@ -6,6 +6,7 @@
 #include <OSL/optautomata.h>
 #include <algorithm>
 #include <cstdio>
+#include <cstring>
 
 
 OSL_NAMESPACE_ENTER
@@ -256,11 +257,8 @@ NdfAutomata::~NdfAutomata()
 
 void keyFromStateSet(const IntSet &states, StateSetKey &out_key)
 {
-    out_key.clear(); // just in case
-    for (IntSet::const_iterator i = states.begin(); i != states.end(); ++i)
-        out_key.push_back(*i);
-    // Sort the ids so we make sure the vector is unique for each set
-    sort(out_key.begin(), out_key.end());
+    // IntSet is ordered, so the vector is already unique for each set
+    out_key.assign(states.begin(), states.end());
 }
 
 
@@ -394,86 +392,72 @@ DfAutomata::tostr()const
 
 
 
-bool
-DfAutomata::equivalent(const State *dfstateA, const State *dfstateB)
-{
-    // early exit if the size of the tables is different
-    if (dfstateA->m_symbol_trans.size() != dfstateB->m_symbol_trans.size())
-        return false;
-    // The pointed state by both transitions have to be the same or any of dfstateA and dfstateB
-    int destA = (dfstateA->m_wildcard_trans == dfstateA->getId() || dfstateA->m_wildcard_trans == dfstateB->getId()) ? -2 : dfstateA->m_wildcard_trans;
-    int destB = (dfstateB->m_wildcard_trans == dfstateA->getId() || dfstateB->m_wildcard_trans == dfstateB->getId()) ? -2 : dfstateB->m_wildcard_trans;
-    if (destA != destB)
-        return false;
-    // Rules have to be the same
-    if (dfstateA->m_rules != dfstateB->m_rules)
-        return false;
-    for (SymbolToInt::const_iterator i = dfstateA->m_symbol_trans.begin(); i != dfstateA->m_symbol_trans.end(); ++i) {
-        SymbolToInt::const_iterator other = dfstateB->m_symbol_trans.find(i->first);
-        if (other == dfstateB->m_symbol_trans.end())
-            return false;
-        // The pointed state by both transitions have to be the same or any of dfstateA and dfstateB
-        int destA = (i->second == dfstateA->getId() || i->second == dfstateB->getId()) ? -2 : i->second;
-        int destB = (other->second == dfstateA->getId() || other->second == dfstateB->getId()) ? -2 : other->second;
-        // when they are -1 is because they are in the wildcard black list, anyway they have to match so ...
-        if (destA != destB)
-            return false;
-    }
-    // if everything passed, they are equivalent, congratulations.
-    return true;
-}
-
-
-
 void
 DfAutomata::removeEquivalentStates()
 {
-    std::vector<State *> newstatelist;
-    HashIntInt newfromold;
-
-    // First go through all states and delete all those
-    // that are equivalent with a previous one
-    for (size_t i = 0; i < m_states.size(); ++i) {
-        if (!m_states[i]) // it has already been removed
-            continue;
-        // create a new state id from newstatelist.size()
-        // move the pointer there and register the translation
-        int newstate = newfromold[i] = newstatelist.size();
-        newstatelist.push_back(m_states[i]);
-        for (size_t j = i + 1; j < m_states.size(); ++j)
-            if (m_states[j] && equivalent(m_states[i], m_states[j])) {
-                // put in the record that this state will be known as
-                // the one in newstate from now on
-                newfromold[j] = newstate;
-                delete m_states[j];
-                m_states[j] = NULL;
+    const size_t nstates = m_states.size();
+    // Partition refinement (Moore's algorithm). Block ids are always
+    // handed out in order of first appearance, so state 0 stays in
+    // block 0 and becomes the initial state of the minimized automata.
+    std::vector<int> block(nstates), newblock(nstates);
+    size_t nblocks;
+    {
+        // States with different rules can never be merged
+        std::map<RuleSet, int> ids;
+        for (size_t i = 0; i < nstates; ++i)
+            block[i] = ids.emplace(m_states[i]->m_rules, int(ids.size())).first->second;
+        nblocks = ids.size();
+    }
+    // A state's signature is its current block plus the blocks its
+    // transitions go to. Symbol transitions that lead to the same block
+    // as the wildcard are left out, they make no difference.
+    typedef std::vector<std::pair<const char *, int> > Moves;
+    typedef std::pair<std::pair<int, int>, Moves> Signature;
+    while (true) {
+        std::map<Signature, int> ids;
+        for (size_t i = 0; i < nstates; ++i) {
+            const State *state = m_states[i];
+            int wild = state->m_wildcard_trans < 0 ? -1 : block[state->m_wildcard_trans];
+            Signature sig;
+            sig.first = std::make_pair(block[i], wild);
+            for (SymbolToInt::const_iterator j = state->m_symbol_trans.begin(); j != state->m_symbol_trans.end(); ++j) {
+                int dest = j->second < 0 ? -1 : block[j->second];
+                if (dest != wild)
+                    sig.second.emplace_back(j->first.data(), dest);
             }
+            std::sort(sig.second.begin(), sig.second.end());
+            newblock[i] = ids.emplace(std::move(sig), int(ids.size())).first->second;
+        }
+        // Refining never merges blocks, so the same count means no change
+        bool stable = ids.size() == nblocks;
+        nblocks = ids.size();
+        block.swap(newblock);
+        if (stable)
+            break;
     }
-    // Everything has been moved now, but we still have to fix the
-    // transitions so they point to the right states!
+    if (nblocks == nstates)
+        return;
+    // Keep the first state of every block and delete the rest
+    std::vector<State *> newstatelist;
+    newstatelist.reserve(nblocks);
+    for (size_t i = 0; i < nstates; ++i) {
+        if (block[i] == int(newstatelist.size())) {
+            m_states[i]->m_id = block[i];
+            newstatelist.push_back(m_states[i]);
+        } else
+            delete m_states[i];
+    }
+    // Now fix the transitions so they point to the right states
     for (size_t i = 0; i < newstatelist.size(); ++i) {
         State *state = newstatelist[i];
-        for (SymbolToInt::iterator j = state->m_symbol_trans.begin(); j != state->m_symbol_trans.end(); ++j) {
-            if (j->second != -1) { // if it is -1 it is just in the wildcards black list
-                // Get the new state that maps to the oldstate pointed by the transition
-                HashIntInt::const_iterator trans = newfromold.find(j->second);
-                if (trans != newfromold.end())
-                    j->second = trans->second;
-                else
-                    std::cerr << "[pathexp] broken translation list between states" << std::endl;
-            }
-        }
-        // Do the same with the wildcard
-        if (state->m_wildcard_trans >=0) {
-            HashIntInt::const_iterator trans = newfromold.find(state->m_wildcard_trans);
-            if (trans != newfromold.end())
-                state->m_wildcard_trans = trans->second;
-            else
-                std::cerr << "[pathexp] broken translation list between states" << std::endl;
-        }
+        for (SymbolToInt::iterator j = state->m_symbol_trans.begin(); j != state->m_symbol_trans.end(); ++j)
+            if (j->second != -1) // if it is -1 it is just in the wildcards black list
+                j->second = block[j->second];
+        if (state->m_wildcard_trans >= 0)
+            state->m_wildcard_trans = block[state->m_wildcard_trans];
     }
-    // switch to the new hopefully reduced state vector
-    m_states = newstatelist;
+    // switch to the new reduced state vector
+    m_states.swap(newstatelist);
 }
 
 
@@ -518,7 +502,7 @@ StateSetRecord::ensureState(const IntSet &newstates, std::list<StateSetRecord::D
         // if not in our records create a new DF state
         DfAutomata::State *tstate = m_dfautomata.newState();
         getRulesFromSet(tstate, m_ndfautomata, newstates);
-        m_key_to_dfstate[newkey] = tstate;
+        m_key_to_dfstate.emplace(std::move(newkey), tstate);
         // Add the discovery to the list so it will be explored
         discovered.emplace_back(tstate, newstates);
         return tstate;
@@ -631,6 +615,147 @@ DfOptimizedAutomata::compileFrom(const DfAutomata &dfautomata)
                      DfOptimizedAutomata::Transition::trans_comp);
         m_states[s].wildcard_trans = dfautomata.m_states[s]->m_wildcard_trans;
     }
+
+    buildTable();
+}
+
+
+
+void
+DfOptimizedAutomata::buildTable()
+{
+    // Intern the alphabet and expand the sparse transitions into the
+    // dense (state, symbol id) table that getTransition reads.
+    m_symbols.clear();
+    for (const Transition &t : m_trans)
+        m_symbols.push_back (t.symbol.data());
+    std::sort (m_symbols.begin(), m_symbols.end());
+    m_symbols.erase (std::unique (m_symbols.begin(), m_symbols.end()),
+                     m_symbols.end());
+    m_row = m_symbols.size() + 1;
+    m_table.resize (m_states.size() * m_row);
+    for (size_t s = 0; s < m_states.size(); ++s) {
+        int *row = &m_table[s * m_row];
+        std::fill (row, row + m_row, m_states[s].wildcard_trans);
+        for (unsigned int t = 0; t < m_states[s].ntrans; ++t) {
+            const Transition &trans (m_trans[m_states[s].begin_trans + t]);
+            row[symbolId (trans.symbol)] = trans.state;
+        }
+    }
+}
+
+
+
+
+// Plain little helpers for the binary form of DfOptimizedAutomata. The
+// numbers are stored as native 32 bit ints, so a blob is only good on
+// the same kind of platform.
+static void
+put_int(std::string &blob, int v)
+{
+    blob.append((const char *)&v, sizeof(v));
+}
+
+static bool
+get_int(const std::string &blob, size_t &pos, int &v)
+{
+    if (pos + sizeof(v) > blob.size())
+        return false;
+    memcpy(&v, blob.data() + pos, sizeof(v));
+    pos += sizeof(v);
+    return true;
+}
+
+
+
+void
+DfOptimizedAutomata::save(std::string &blob, const std::vector<void*> &rules) const
+{
+    // The symbol addresses mean nothing to another process, so the
+    // transitions refer to a table of symbol names instead, and the dense
+    // table is rebuilt on loading.
+    put_int(blob, (int)m_symbols.size());
+    for (const char *sym : m_symbols) {
+        int len = (int)strlen(sym);
+        put_int(blob, len);
+        blob.append(sym, len);
+    }
+    put_int(blob, (int)m_states.size());
+    for (const State &s : m_states) {
+        put_int(blob, (int)s.ntrans);
+        put_int(blob, (int)s.nrules);
+        put_int(blob, s.wildcard_trans);
+        for (unsigned int t = 0; t < s.ntrans; ++t) {
+            const Transition &trans (m_trans[s.begin_trans + t]);
+            put_int(blob, symbolId(trans.symbol));
+            put_int(blob, trans.state);
+        }
+        for (unsigned int r = 0; r < s.nrules; ++r) {
+            auto found = std::find(rules.begin(), rules.end(),
+                                   m_rules[s.begin_rules + r]);
+            OSL_DASSERT(found != rules.end());
+            put_int(blob, int(found - rules.begin()));
+        }
+    }
+}
+
+
+
+bool
+DfOptimizedAutomata::load(const std::string &blob, size_t &pos,
+                          const std::vector<void*> &rules)
+{
+    size_t p = pos;
+    int nsymbols = 0, nstates = 0;
+    if (!get_int(blob, p, nsymbols) || nsymbols < 0)
+        return false;
+    std::vector<ustring> symbols(nsymbols);
+    for (auto &sym : symbols) {
+        int len = 0;
+        if (!get_int(blob, p, len) || len < 0 || p + len > blob.size())
+            return false;
+        sym = ustring(blob.data() + p, len);
+        p += len;
+    }
+    if (!get_int(blob, p, nstates) || nstates < 0)
+        return false;
+    std::vector<State> states(nstates);
+    std::vector<Transition> trans;
+    std::vector<void*> staterules;
+    for (State &s : states) {
+        int ntrans = 0, nrules = 0;
+        if (!get_int(blob, p, ntrans) || !get_int(blob, p, nrules)
+            || !get_int(blob, p, s.wildcard_trans) || ntrans < 0 || nrules < 0
+            || s.wildcard_trans < -1 || s.wildcard_trans >= nstates)
+            return false;
+        s.begin_trans = (unsigned int)trans.size();
+        s.ntrans = ntrans;
+        s.begin_rules = (unsigned int)staterules.size();
+        s.nrules = nrules;
+        for (int t = 0; t < ntrans; ++t) {
+            int sym = 0, next = 0;
+            if (!get_int(blob, p, sym) || !get_int(blob, p, next)
+                || sym < 0 || sym >= nsymbols || next < 0 || next >= nstates)
+                return false;
+            trans.push_back({ symbols[sym], next });
+        }
+        for (int r = 0; r < nrules; ++r) {
+            int rule = 0;
+            if (!get_int(blob, p, rule) || rule < 0 || rule >= (int)rules.size())
+                return false;
+            staterules.push_back(rules[rule]);
+        }
+        // Transitions are kept sorted by symbol address, which is
+        // different in this process
+        std::sort(trans.begin() + s.begin_trans, trans.end(),
+                  DfOptimizedAutomata::Transition::trans_comp);
+    }
+    m_states.swap(states);
+    m_trans.swap(trans);
+    m_rules.swap(staterules);
+    buildTable();
+    pos = p;
+    return true;
 }
 
 
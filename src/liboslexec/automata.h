@@ -179,6 +179,18 @@ typedef std::vector<int> StateSetKey;
 // Compute the unique key for the given set of states
 void keyFromStateSet(const IntSet &states, StateSetKey &out_key);
 
+// Hash for StateSetKey, so the subset construction can look the sets up
+// in a hash table instead of doing a lexicographic tree search
+struct StateSetKeyHash {
+    size_t operator()(const StateSetKey &key)const
+    {
+        size_t h = key.size();
+        for (int i : key)
+            h ^= size_t(i) + 0x9e3779b9 + (h << 6) + (h >> 2);
+        return h;
+    }
+};
+
 
 
 /// Deterministic Finite Automata
@@ -248,6 +260,10 @@ class DfAutomata {
         void clear();
 
         /// Colapse all the equivalent states into single ones
+        ///
+        /// This is a full minimization by partition refinement: states
+        /// start grouped by their rule sets and groups are split until
+        /// all the states in one go to the same groups for every symbol.
         void removeEquivalentStates();
         /// Go through all the states and perform removeUselessTransitions
         /// method call on them
@@ -258,12 +274,6 @@ class DfAutomata {
 
     protected:
 
-        /// Return true if two states are equivalent
-        ///
-        /// Two states are equivalent if their transition tables lead
-        /// to the same states for the same symbols
-        bool equivalent(const State *dfstateA, const State *dfstateB);
-
         // State vector with the automata
         std::vector<State *> m_states;
 };
@@ -283,7 +293,7 @@ class StateSetRecord {
         // for it and the state(int) set in the original automata
         typedef std::pair<DfAutomata::State *, IntSet> Discovery;
         // The type that will index our new created states indexed by the set key
-        typedef std::map<StateSetKey, DfAutomata::State *> StateSetMap;
+        typedef std::unordered_map<StateSetKey, DfAutomata::State *, StateSetKeyHash> StateSetMap;
 
         /// Take a state set and build a new df state (or return existing one)
         /// Also, if it was newly created, append it to the discovered list so we
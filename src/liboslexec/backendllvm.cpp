@@ -79,9 +79,14 @@ BackendLLVM::BackendLLVM (ShadingSystemImpl &shadingsys,
 #endif
     m_use_optix = shadingsys.renderer()->supports ("OptiX");
     m_use_rs_bitcode = !shadingsys.m_rs_bitcode.empty();
+    m_llvm_optimize = shadingsys.llvm_optimize();
+    m_llvm_opt_preset = shadingsys.llvm_opt_preset(group);
     ll.dumpasm(shadingsys.m_llvm_dumpasm);
     ll.jit_fma(shadingsys.m_llvm_jit_fma);
     ll.jit_aggressive(shadingsys.m_llvm_jit_aggressive);
+    ll.orc_jit(shadingsys.m_llvm_jit_orc);
+    ll.orc_jit_lazy(shadingsys.m_llvm_jit_lazy);
+    m_llvm_aot_output = shadingsys.m_llvm_aot_output && !m_use_optix;
 }
 
 
@@ -202,6 +207,22 @@ BackendLLVM::llvm_zero_derivs (const Symbol &sym, llvm::Value *count)
     }
 }
 
+void
+BackendLLVM::llvm_init_unused_derivs (const Symbol &sym)
+{
+    if (! sym.has_derivs() || sym.deriv_axes() == Symbol::DerivBothAxes ||
+          sym.typespec().is_closure_based() ||
+          ! sym.typespec().elementtype().is_float_based())
+        return;
+    // llvm_store_value skips the unneeded partial, so this is its only
+    // write. All-ones bytes are a quiet NaN.
+    int val = shadingsys().debug_uninit(group()) ? 0xff : 0;
+    size_t align = sym.typespec().simpletype().basesize();
+    for (int d = 1;  d <= 2;  ++d)
+        if (! sym.needs_deriv (d))
+            ll.op_memset (llvm_void_ptr(sym,d), val, sym.size(), (int)align);
+}
+
 namespace
 {
     // N.B. The order of names in this table MUST exactly match the
@@ -245,13 +266,38 @@ BackendLLVM::llvm_global_symbol_ptr (ustring name)
 
 
 
+const SymLocationDesc*
+BackendLLVM::global_symloc (const Symbol &sym)
+{
+    // The renderer may keep the globals a group reads in its own compact
+    // per-point record, given by UserData symlocs, instead of filling in
+    // ShaderGlobals.  Globals the group writes stay in ShaderGlobals,
+    // where the renderer looks for the results, and so do those whose
+    // derivs the record lacks.
+    if (use_optix())
+        return nullptr;
+    SGBits bit = ShadingSystem::globals_bit (sym.name());
+    if (bit == SGBits::None || bit == SGBits::Ci
+          || (group().m_globals_write & int(bit)))
+        return nullptr;
+    auto symloc = group().find_symloc (sym.name(), SymArena::UserData);
+    if (! symloc || symloc->soa || ! equivalent (sym.typespec(), symloc->type)
+          || (sym.has_derivs() && ! symloc->derivs))
+        return nullptr;
+    return symloc;
+}
+
+
+
 llvm::Value *
 BackendLLVM::getLLVMSymbolBase (const Symbol &sym)
 {
     Symbol* dealiased = sym.dealias();
 
     if (sym.symtype() == SymTypeGlobal) {
-        llvm::Value *result = llvm_global_symbol_ptr (sym.name());
+        const SymLocationDesc* symloc = global_symloc (sym);
+        llvm::Value *result = symloc ? symloc_ptr (symloc, userdata_base_ptr())
+                                     : llvm_global_symbol_ptr (sym.name());
         OSL_ASSERT (result);
         result = ll.ptr_to_cast (result, llvm_type(sym.typespec().elementtype()));
         return result;
@@ -260,6 +306,12 @@ BackendLLVM::getLLVMSymbolBase (const Symbol &sym)
     if (sym.symtype() == SymTypeParam || sym.symtype() == SymTypeOutputParam) {
         // Special case for params -- they live in the group data
         int fieldnum = m_param_order_map[&sym];
+        if (fieldnum < 0) {  // in the shared layer private area
+            llvm::Value *result = ll.GEP (ll.type_int8(),
+                                          ll.void_ptr (groupdata_ptr()),
+                                          sym.dataoffset());
+            return ll.ptr_to_cast (result, llvm_type(sym.typespec().elementtype()));
+        }
         return groupdata_field_ptr (fieldnum, sym.typespec().elementtype().simpletype());
     }
 
@@ -567,15 +619,22 @@ BackendLLVM::llvm_get_pointer (const Symbol& sym, int deriv,
         return NULL;  // Error
 
     // If it's an array or we're dealing with derivatives, step to the
-    // right element.
+    // right element. Stepping to the derivative and then to the element
+    // with inbounds GEPs, rather than adding up an index that LLVM can't
+    // assume doesn't wrap, lets it see an array indexed by a loop counter
+    // as a simple strided access, which the loop vectorizer needs. (An
+    // index out of range was already undefined behavior, and range
+    // checking clamps it.)
     TypeDesc t = sym.typespec().simpletype();
     if (t.arraylen || has_derivs) {
         int d = deriv * std::max(1,t.arraylen);
-        if (arrayindex)
-            arrayindex = ll.op_add (arrayindex, ll.constant(d));
+        if (! arrayindex)
+            result = ll.GEP (result, d);
+        else if (d)
+            result = ll.GEP_inbounds (ll.GEP_inbounds (result, ll.constant(d)),
+                                      arrayindex);
         else
-            arrayindex = ll.constant(d);
-        result = ll.GEP (result, arrayindex);
+            result = ll.GEP_inbounds (result, arrayindex);
     }
 
     return result;
@@ -822,9 +881,10 @@ BackendLLVM::llvm_store_value (llvm::Value* new_val, const Symbol& sym,
                                     int deriv, llvm::Value* arrayindex,
                                     int component)
 {
-    bool has_derivs = sym.has_derivs();
-    if (!has_derivs && deriv != 0) {
-        // Attempt to store deriv in symbol that doesn't have it is just a nop
+    if (deriv != 0 && !sym.needs_deriv(deriv)) {
+        // Attempt to store deriv in symbol that doesn't have it is just a
+        // nop, as is storing a partial that nothing will ever read (which
+        // lets LLVM drop the math that computed it).
         return true;
     }
 
@@ -871,9 +931,9 @@ BackendLLVM::llvm_store_component_value (llvm::Value* new_val,
                                               const Symbol& sym, int deriv,
                                               llvm::Value* component)
 {
-    bool has_derivs = sym.has_derivs();
-    if (!has_derivs && deriv != 0) {
-        // Attempt to store deriv in symbol that doesn't have it is just a nop
+    if (deriv != 0 && !sym.needs_deriv(deriv)) {
+        // Attempt to store deriv in symbol that doesn't have it (or an
+        // unneeded partial) is just a nop
         return true;
     }
 
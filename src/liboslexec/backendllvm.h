@@ -41,10 +41,61 @@ public:
     /// and store the llvm::Function* handle to it with the ShaderGroup.
     virtual void run ();
 
+    /// Instead of generating code for the group, load the precompiled
+    /// code that was registered for it (group().m_llvm_aot_object).
+    /// Return false, having told why, if it doesn't fit the group.
+    bool run_precompiled ();
+
+    /// For ptx_cache_dir: the cache file for the group's PTX, and the
+    /// key that must be at the head of it, both from the group's
+    /// unoptimized IR (ll.module()).
+    void ptx_cache_key (std::string &filename, std::string &key);
+
+    /// Set the group's PTX from the cache file if it holds it for key.
+    bool ptx_cache_load (const std::string &filename, const std::string &key);
+
+    /// Save the group's PTX in the cache file.
+    void ptx_cache_save (const std::string &filename, const std::string &key);
+
 
     /// What LLVM debug level are we at?
     int llvm_debug() const;
 
+    /// The llvm_optimize level to use for this group, by default
+    /// the ShadingSystem's.
+    int llvm_optimize() const { return m_llvm_optimize; }
+    void llvm_optimize (int level) { m_llvm_optimize = level; }
+    OptPreset llvm_opt_preset() const { return m_llvm_opt_preset; }
+    void llvm_opt_preset (OptPreset preset) { m_llvm_opt_preset = preset; }
+
+    /// Profile-guided JIT (llvm_pgo_samples): instrument the group's
+    /// conditional branches to count which way they go, or use the counts
+    /// collected by an earlier, instrumented JIT of the group.
+    void llvm_pgo_instrument (bool on) { m_llvm_pgo_instrument = on; }
+    void llvm_pgo_use (bool on) { m_llvm_pgo_use = on; }
+
+    /// Did a re-JIT of an already JITed group find that it would lay out
+    /// the group data differently? If so, run() left the group's code
+    /// as it was.
+    bool groupdata_layout_changed () const { return m_groupdata_layout_changed; }
+
+    /// Branch on cond, just like ll.op_branch(cond,trueblock,falseblock),
+    /// but counting or applying the branch profile (see llvm_pgo_*).
+    void llvm_profiled_branch (llvm::Value *cond, llvm::BasicBlock *trueblock,
+                               llvm::BasicBlock *falseblock);
+
+    /// With llvm_aot_output, the group is also compiled into the
+    /// relocatable object that gets stored in group().m_llvm_aot_object,
+    /// which may be loaded by other processes instead of JITing it.
+    bool llvm_aot_output() const { return m_llvm_aot_output; }
+    void llvm_aot_output (bool on) { m_llvm_aot_output = on && !m_use_optix; }
+
+    /// Return a pointer to an object in this process, like
+    /// ll.constant_ptr(p,type), except that with llvm_aot_output it is
+    /// looked up by name (see resolve_process_ptr) when loaded.
+    llvm::Value *llvm_process_ptr (void *p, string_view name,
+                                   llvm::PointerType *type = nullptr);
+
     /// Set up a bunch of static things we'll need for the whole group.
     ///
     void initialize_llvm_group ();
@@ -227,6 +278,10 @@ public:
     /// Retrieve the named global ("P", "N", etc.).
     llvm::Value *llvm_global_symbol_ptr (ustring name);
 
+    /// If the global lives in the renderer's userdata record rather than
+    /// in ShaderGlobals, return its symloc there, otherwise nullptr.
+    const SymLocationDesc* global_symloc (const Symbol &sym);
+
     /// Test whether val is nonzero, return the llvm::Value* that's the
     /// result of a CreateICmpNE or CreateFCmpUNE (depending on the
     /// type).  If test_derivs is true, it it also tests whether the
@@ -276,6 +331,10 @@ public:
     /// data that holds all the shader params.
     llvm::Type *llvm_type_groupdata ();
 
+    /// Give sym the offset within the group data that llvm_type_groupdata
+    /// lays it out at.
+    void place_groupdata (Symbol &sym, size_t offset);
+
     /// Return the LLVM type handle for a pointer to the common group
     /// data that holds all the shader params.
     llvm::Type *llvm_type_groupdata_ptr ();
@@ -343,6 +402,12 @@ public:
     ///
     void llvm_zero_derivs (const Symbol &sym, llvm::Value *count);
 
+    /// Generate LLVM code to fill, once, any partial of sym that the
+    /// derivative analysis found nothing reads (see opt_deriv_axes), so
+    /// it never holds garbage. It is zeroed, or set to NaN in debug_uninit
+    /// mode so that a stray read shows up in the results.
+    void llvm_init_unused_derivs (const Symbol &sym);
+
     /// Generate a debugging printf at shader execution time.
     void llvm_gen_debug_printf (string_view message);
 
@@ -434,6 +499,37 @@ public:
 
     llvm::Function *layer_func () const { return ll.current_function(); }
 
+    /// With profile >= 3, count and time the texture, getattribute or
+    /// pointcloud call that an op makes: llvm_call_site_begin() goes just
+    /// before it, and llvm_call_site_end() just after, given the int it
+    /// returned (zero meaning it failed). Code that may be loaded into
+    /// another process (precompiled, or for the JIT cache) is left alone,
+    /// as the call site ids are only good in this one.
+    bool profile_call_sites () const {
+        return shadingsys().profile() >= 3 && ! use_optix()
+               && ! llvm_aot_output() && ! shadingsys().jit_cache_enabled();
+    }
+    void llvm_call_site_begin () {
+        if (profile_call_sites())
+            ll.call_function ("osl_call_site_begin", sg_void_ptr());
+    }
+    void llvm_call_site_end (const Opcode &op, llvm::Value *result) {
+        if (profile_call_sites())
+            ll.call_function ("osl_call_site_end", sg_void_ptr(),
+                              ll.constant (shadingsys().call_site (op)),
+                              result);
+    }
+
+    /// With profile >= 4, count the executions of each basic block of a
+    /// layer's main code, for the source listing in the stats. The same
+    /// code is left alone as for profile_call_sites().
+    bool profile_blocks () const {
+        return shadingsys().profile() >= 4 && profile_call_sites();
+    }
+    /// Generate code to count an execution of the basic block that starts
+    /// at opnum.
+    void llvm_profile_block (int opnum);
+
     /// Call this when JITing a texture-like call, to track how many.
     void generated_texture_call (bool handle) {
         shadingsys().m_stat_tex_calls_codegened += 1;
@@ -447,6 +543,17 @@ public:
     /// Return whether or not we are compiling for an OptiX-based renderer.
     bool use_optix() { return m_use_optix; }
 
+    /// Set m_num_used_layers and m_layer_remap for the group.
+    void find_used_layers ();
+
+    /// For opt_upfront_layers: set m_layer_run_upfront to the layers that
+    /// the group entry can call first thing, without flag checks, because
+    /// they are sure to be needed (or aren't lazy at all).
+    void find_layers_run_upfront ();
+
+    /// The object that llvm_process_ptr(p,name) stood for.
+    void *resolve_process_ptr (string_view name);
+
     /// Return if we should compile against free function versions of Renderer Service.
     bool use_rs_bitcode() {return m_use_rs_bitcode; }
 
@@ -455,11 +562,20 @@ public:
     /// entry in the groupdata struct.
     int find_userdata_index (const Symbol& sym);
 
+    /// For opt_message_slots: return the groupdata field of the
+    /// MessageSlot that stands in for the named message, or -1 if the
+    /// message goes on the blackboard.
+    int message_slot_field (ustring name) const {
+        auto found = m_message_slots.find (name);
+        return found != m_message_slots.end() ? found->second : -1;
+    }
+
     LLVM_Util ll;
 
 private:
     std::vector<int> m_layer_remap;     ///< Remapping of layer ordering
     std::set<int> m_layers_already_run; ///< List of layers run
+    std::vector<bool> m_layer_run_upfront; ///< Run first by the group entry?
     int m_num_used_layers;              ///< Number of layers actually used
 
     double m_stat_total_llvm_time;        ///<   total time spent on LLVM
@@ -471,6 +587,7 @@ private:
     // LLVM stuff
     AllocationMap m_named_values;
     std::map<const Symbol*,int> m_param_order_map;
+    std::map<ustring,int> m_message_slots;  ///< Message name -> field
     llvm::Value *m_llvm_shaderglobals_ptr;
     llvm::Value *m_llvm_groupdata_ptr;
     llvm::Value *m_llvm_userdata_base_ptr;
@@ -496,6 +613,16 @@ private:
 
     bool m_use_rs_bitcode;              /// To use free function versions of Renderer Service functions.
 
+    int m_llvm_optimize;                ///< llvm_optimize level for this group
+    OptPreset m_llvm_opt_preset;        ///< llvm_opt_preset for this group
+    bool m_llvm_pgo_instrument = false; ///< Count branches for PGO
+    bool m_llvm_pgo_use = false;        ///< Use branch counts from PGO
+    int m_llvm_pgo_branch = 0;          ///< Next branch's profile index
+    bool m_groupdata_layout_changed = false; ///< Re-JIT layout mismatch
+    bool m_llvm_aot_output = false;     ///< Also make a precompiled object
+    bool m_counting_blocks = false;     ///< Instrumenting basic blocks now
+    std::vector<std::string> m_llvm_process_ptrs;  ///< Named for AOT
+
     friend class ShadingSystemImpl;
 };
 
@@ -4,6 +4,7 @@
 
 //#define OSL_DEV
 
+#include <algorithm>
 #include <boost/container/flat_set.hpp>
 #include <iterator>
 #include <type_traits>
@@ -1197,10 +1198,26 @@ struct Analyzer {
     // Once built, we use this to push "varying" downstream from
     // shader globals through all operations that take their symbols as inputs
     // and feed them forward to those operations outputs (then repeat
-    // recursively for those outputs)
-    std::unordered_multimap<Symbol* /* parent */, Symbol* /* dependent */,
-                            std::hash<Symbol*>, std::equal_to<Symbol*>>
-        m_symbols_dependent_upon;
+    // for those outputs).
+    // The (parent, dependent) edges are just appended while discovering,
+    // then build_dependency_graph() sorts them by parent and drops the
+    // duplicates, so that the dependents of a symbol are one contiguous
+    // range and the propagation is linear in the number of edges.
+    typedef std::pair<Symbol* /* parent */, Symbol* /* dependent */>
+        DependencyEdge;
+    std::vector<DependencyEdge> m_symbols_dependent_upon;
+
+    // For each symbol, the last read position checked against its write
+    // chronology and how many of its writes that covered. Another read at
+    // the same position, which is common, then only checks newer writes.
+    struct ReadCheck {
+        DependencyTreeTracker::Position pos;
+        size_t writes_checked;
+    };
+    std::unordered_map<const Symbol*, ReadCheck> m_last_read_check;
+
+    // Scratch for recursively_mark_varying
+    std::vector<Symbol*> m_varying_worklist;
 
     std::unordered_set<Symbol*> m_symbols_written_to_by_implicitly_varying_ops;
 
@@ -1252,10 +1269,20 @@ struct Analyzer {
         if (lookup != m_write_chronology_by_symbol.end()) {
             auto& write_chronology = lookup->second;
             if (!write_chronology.empty()) {
+                // Checking the same read position against the same writes
+                // again would change nothing, so skip the writes an earlier
+                // read from here already covered.
+                size_t first_write = 0;
+                auto checked = m_last_read_check.find(symbol_to_check);
+                if (checked != m_last_read_check.end()
+                    && checked->second.pos == read_pos)
+                    first_write = checked->second.writes_checked;
+                m_last_read_check[symbol_to_check]
+                    = ReadCheck { read_pos, write_chronology.size() };
                 auto write_end = write_chronology.end();
                 // Find common ancestor (ca) between the read position and the write pos
                 // if generation of ca is older than current oldest ca for write instruction, record it
-                for (auto write_iter = write_chronology.begin();
+                for (auto write_iter = write_chronology.begin() + first_write;
                      write_iter != write_end; ++write_iter) {
                     auto common_ancestor
                         = m_conditional_symbol_stack.common_ancestor_between(
@@ -1497,8 +1524,8 @@ struct Analyzer {
                                    << " needs to depend on conditional "
                                    << conditionContinueDependsOn->unmangled().c_str()
                                    << std::endl);
-            m_symbols_dependent_upon.insert(
-                std::make_pair(conditionContinueDependsOn, loop_condition));
+            m_symbols_dependent_upon.emplace_back(conditionContinueDependsOn,
+                                                  loop_condition);
         }
     }
 
@@ -1559,8 +1586,8 @@ struct Analyzer {
                             = symbols_written_by_op[write_index];
                         // Skip self dependencies
                         if (symbolWrittenTo != read_sym) {
-                            m_symbols_dependent_upon.insert(
-                                std::make_pair(read_sym, symbolWrittenTo));
+                            m_symbols_dependent_upon.emplace_back(
+                                read_sym, symbolWrittenTo);
                         }
                     }
                 }
@@ -1568,8 +1595,7 @@ struct Analyzer {
                     // Some operations have only side effects and no return value
                     // We still want to track them so they can trigger transition
                     // from uniform to varying if they are a shader global that is varying
-                    m_symbols_dependent_upon.insert(
-                        std::make_pair(read_sym, nullptr));
+                    m_symbols_dependent_upon.emplace_back(read_sym, nullptr);
                 }
 
                 ensure_writes_with_more_conditions_are_masked(
@@ -1650,10 +1676,16 @@ struct Analyzer {
                     // specific BatchedRendererServices.
                     // Right here we don't know which width will be used,
                     // so we will just require all widths provide the same answer
+                    auto rs4  = m_ba.renderer()->batched(WidthOf<4>());
                     auto rs8  = m_ba.renderer()->batched(WidthOf<8>());
                     auto rs16 = m_ba.renderer()->batched(WidthOf<16>());
-                    if (rs8 || rs16) {
+                    if (rs4 || rs8 || rs16) {
                         get_attr_is_uniform = true;
+                        if (rs4) {
+                            get_attr_is_uniform
+                                &= rs4->is_attribute_uniform(obj_name,
+                                                             attr_name);
+                        }
                         if (rs8) {
                             get_attr_is_uniform
                                 &= rs8->is_attribute_uniform(obj_name,
@@ -1694,8 +1726,8 @@ struct Analyzer {
                          ++write_index) {
                         auto symbolWrittenTo
                             = symbols_written_by_op[write_index];
-                        m_symbols_dependent_upon.insert(
-                            std::make_pair(psg_symbol, symbolWrittenTo));
+                        m_symbols_dependent_upon.emplace_back(
+                            psg_symbol, symbolWrittenTo);
                     }
                 }
             }
@@ -1945,23 +1977,48 @@ struct Analyzer {
         }
     };
 
+    void build_dependency_graph()
+    {
+        // Must be called after the last dependency is added (by
+        // establish_dependencies_for_masked_ops) and before any varying
+        // is pushed through them.
+        std::sort(m_symbols_dependent_upon.begin(),
+                  m_symbols_dependent_upon.end());
+        m_symbols_dependent_upon.erase(
+            std::unique(m_symbols_dependent_upon.begin(),
+                        m_symbols_dependent_upon.end()),
+            m_symbols_dependent_upon.end());
+    }
+
     void recursively_mark_varying(Symbol* symbol_to_be_varying,
                                   bool force = false)
     {
-        bool previously_was_uniform = symbol_to_be_varying->is_uniform();
-        if (previously_was_uniform | force) {
-            symbol_to_be_varying->make_varying();
-            auto range = m_symbols_dependent_upon.equal_range(
-                symbol_to_be_varying);
-            auto iter = range.first;
-            for (; iter != range.second; ++iter) {
+        // Despite the name, this uses a worklist rather than recursion, so
+        // that long chains of dependencies can't overflow the stack. Each
+        // symbol is pushed at most once, when it turns varying.
+        if (!symbol_to_be_varying->is_uniform() && !force)
+            return;
+        symbol_to_be_varying->make_varying();
+        std::vector<Symbol*>& worklist(m_varying_worklist);
+        worklist.push_back(symbol_to_be_varying);
+        while (!worklist.empty()) {
+            Symbol* parent = worklist.back();
+            worklist.pop_back();
+            auto iter = std::lower_bound(m_symbols_dependent_upon.begin(),
+                                         m_symbols_dependent_upon.end(),
+                                         DependencyEdge(parent, nullptr));
+            for (; iter != m_symbols_dependent_upon.end()
+                   && iter->first == parent;
+                 ++iter) {
                 auto dependent_symbol = iter->second;
                 // Some symbols read for operations with only side effects and
                 // who do not write to another symbol, eg. printf(...)
-                if (dependent_symbol != nullptr) {
-                    recursively_mark_varying(dependent_symbol);
+                if (dependent_symbol != nullptr
+                    && dependent_symbol->is_uniform()) {
+                    dependent_symbol->make_varying();
+                    worklist.push_back(dependent_symbol);
                 }
-            };
+            }
         }
     };
 
@@ -2122,9 +2179,8 @@ struct Analyzer {
                                         << "Mapping "
                                         << sym_mask_depends_on->unmangled().c_str()
                                         << std::endl);
-                                    m_symbols_dependent_upon.insert(
-                                        std::make_pair(sym_mask_depends_on,
-                                                       sym_written_to));
+                                    m_symbols_dependent_upon.emplace_back(
+                                        sym_mask_depends_on, sym_written_to);
                                 }
                             }
                         }
@@ -2170,9 +2226,8 @@ struct Analyzer {
                                         << "Mapping "
                                         << sym_mask_depends_on->unmangled().c_str()
                                         << std::endl);
-                                    m_symbols_dependent_upon.insert(
-                                        std::make_pair(sym_mask_depends_on,
-                                                       sym_written_to));
+                                    m_symbols_dependent_upon.emplace_back(
+                                        sym_mask_depends_on, sym_written_to);
                                 }
                             }
                         }
@@ -2325,6 +2380,7 @@ BatchedAnalysis::analyze_layer(ShaderInstance* inst)
 
     analyzer.simulate_reading_output_params();
     analyzer.establish_dependencies_for_masked_ops();
+    analyzer.build_dependency_graph();
 
     OSL_DEV_ONLY(std::cout << "About to find which symbols need to be varying()"
                            << std::endl);
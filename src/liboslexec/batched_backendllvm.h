@@ -461,6 +461,14 @@ public:
     /// Generate a debugging printf at shader execution time.
     void llvm_gen_debug_printf(string_view message);
 
+    /// For opt_batched_coherent_branches: may ops [begin,end) be built a
+    /// second time, with all lanes on, as one side of a varying if?
+    bool coherent_copy_ok(int begin, int end) const;
+
+    /// For batched_lane_stats: generate code to add 1 to the group's
+    /// lane count number 'index', and 'lanes' (an int) to the one after.
+    void llvm_count_lanes(int index, llvm::Value* lanes);
+
     /// Generate a warning message at shader execution time.
     void llvm_gen_warning(string_view message);
 
@@ -749,6 +757,9 @@ private:
         virtual ~TargetLibraryHelper() {}
         virtual const char* library_selector() const                        = 0;
         virtual void init_function_map(ShadingSystemImpl& shadingsys) const = 0;
+        /// Bitcode of the target's ops that call the batched free function
+        /// renderer services, for "batched_rs_bitcode" (empty if not built).
+        virtual string_view rs_dependant_ops() const                        = 0;
 
         static std::unique_ptr<TargetLibraryHelper> build(ShadingContext* context,
                                                           int vector_width,
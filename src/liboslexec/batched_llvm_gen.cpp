@@ -29,6 +29,9 @@ static ustring op_and("and");
 static ustring op_bitand("bitand");
 static ustring op_bitor("bitor");
 static ustring op_break("break");
+static ustring op_functioncall("functioncall");
+static ustring op_functioncall_nr("functioncall_nr");
+static ustring op_return("return");
 static ustring op_ceil("ceil");
 static ustring op_compl("compl");
 static ustring op_continue("continue");
@@ -85,6 +88,44 @@ BatchedBackendLLVM::llvm_gen_debug_printf(string_view message)
 
 
 
+bool
+BatchedBackendLLVM::coherent_copy_ok(int begin, int end) const
+{
+    int limit = shadingsys().m_opt_batched_coherent_branches;
+    if (limit <= 0 || end - begin > limit)
+        return false;
+    // Anything that changes the masks of enclosing code can't be built
+    // as if it were uniform.
+    for (int i = begin; i < end; ++i) {
+        ustring opname = inst()->op(i).opname();
+        if (opname == op_return || opname == Strings::op_exit
+            || opname == op_break || opname == op_continue
+            || opname == op_functioncall || opname == op_functioncall_nr)
+            return false;
+    }
+    return true;
+}
+
+
+
+void
+BatchedBackendLLVM::llvm_count_lanes(int index, llvm::Value* lanes)
+{
+    // Plain (not atomic) increments: a few counts lost to races between
+    // threads won't change the averages.
+    uint64_t* counts = &group().m_batched_lane_counts[index];
+    llvm::Value* runs = ll.constant_ptr(counts, ll.type_longlong_ptr());
+    llvm::Value* total = ll.constant_ptr(counts + 1, ll.type_longlong_ptr());
+    ll.op_store(ll.op_add(ll.op_load(ll.type_longlong(), runs),
+                          ll.constant64(1)),
+                runs);
+    ll.op_store(ll.op_add(ll.op_load(ll.type_longlong(), total),
+                          ll.op_int_to_longlong(lanes)),
+                total);
+}
+
+
+
 void
 BatchedBackendLLVM::llvm_call_layer(int layer, bool unconditional)
 {
@@ -760,7 +801,11 @@ LLVMGEN (llvm_gen_generic)
             op.opname() == op_sign)
             any_deriv_args = false;
 
-    FuncSpec func_spec(op.opname().c_str());
+    // Transcendentals may be bound to their "fast_" or "accurate_"
+    // variants, depending on the group's math_precision.
+    std::string opname = std::string(rop.shadingsys().math_precision_prefix (rop.group(), op.opname()))
+                       + op.opname().string();
+    FuncSpec func_spec(opname.c_str());
     if (uniformFormOfFunction) {
         func_spec.unbatch();
     }
@@ -1040,6 +1085,45 @@ LLVMGEN (llvm_gen_if)
 #ifdef __OSL_TRACE_MASKS
         rop.llvm_print_mask("if(cond)",mask);
 #endif
+
+        // Conditions that vary in principle are often the same for a whole
+        // batch in practice. When every lane is on and they all agree, run
+        // a copy of the side they take that was built with all lanes known
+        // to be on, so its stores need no blending and nothing else runs.
+        llvm::BasicBlock* coherent_join_block = nullptr;
+        if (rop.coherent_copy_ok(opnum+1, op.jump(0))
+            && (!elseBlockRequired || rop.coherent_copy_ok(op.jump(0), op.jump(1)))) {
+            llvm::Value* all_on = rop.ll.constant(rop.true_mask_value());
+            llvm::Value* batch_on = rop.ll.op_eq(rop.ll.mask_as_int(rop.ll.current_mask()), all_on);
+            llvm::Value* cond_bits = rop.ll.mask_as_int(mask);
+            llvm::BasicBlock* coherent_block = rop.ll.new_basic_block (rop.llvm_debug() ? std::string("coherent test (varying)") + cond_name : std::string());
+            llvm::BasicBlock* coherent_else_test_block = elseBlockRequired ? rop.ll.new_basic_block (rop.llvm_debug() ? std::string("coherent else test (varying)") + cond_name : std::string()) : nullptr;
+            llvm::BasicBlock* coherent_then_block = rop.ll.new_basic_block (rop.llvm_debug() ? std::string("then (coherent)") + cond_name : std::string());
+            llvm::BasicBlock* coherent_else_block = elseBlockRequired ? rop.ll.new_basic_block (rop.llvm_debug() ? std::string("else (coherent)") + cond_name : std::string()) : nullptr;
+            llvm::BasicBlock* masked_block = rop.ll.new_basic_block (rop.llvm_debug() ? std::string("masked if (varying)") + cond_name : std::string());
+            coherent_join_block = rop.ll.new_basic_block (rop.llvm_debug() ? std::string("after_if (coherent)") + cond_name : std::string());
+
+            rop.ll.op_branch (batch_on, coherent_block, masked_block);
+            rop.ll.op_branch (rop.ll.op_eq(cond_bits, all_on), coherent_then_block,
+                              elseBlockRequired ? coherent_else_test_block : masked_block);
+            if (elseBlockRequired) {
+                rop.ll.set_insert_point (coherent_else_test_block);
+                rop.ll.op_branch (rop.ll.op_eq(cond_bits, rop.ll.constant(0)),
+                                  coherent_else_block, masked_block);
+            }
+
+            rop.ll.push_mask(rop.ll.wide_constant_bool(true), false /* negate */, true /* absolute */);
+            rop.build_llvm_code (opnum+1, op.jump(0), coherent_then_block);
+            rop.ll.op_branch (coherent_join_block);
+            if (elseBlockRequired) {
+                rop.build_llvm_code (op.jump(0), op.jump(1), coherent_else_block);
+                rop.ll.op_branch (coherent_join_block);
+            }
+            rop.ll.pop_mask();
+
+            rop.ll.set_insert_point (masked_block);
+        }
+
         rop.ll.push_mask(mask);
 #ifdef __OSL_TRACE_MASKS
         rop.llvm_print_mask("if STACK");
@@ -1101,6 +1185,8 @@ LLVMGEN (llvm_gen_if)
             rop.ll.pop_mask();
             rop.ll.op_branch (after_block);
         }
+        if (coherent_join_block)
+            rop.ll.op_branch (coherent_join_block);  // insert point is now coherent_join_block
     }
 
     bool requiresTestForActiveLanes = false;
@@ -3667,6 +3753,10 @@ LLVMGEN (llvm_gen_loop_op)
 
             llvm::Value* pre_condition_mask = rop.ll.op_load_mask(loc_of_control_mask);
             OSL_ASSERT(pre_condition_mask->getType() == rop.ll.type_wide_bool());
+            if (rop.shadingsys().batched_lane_stats())
+                rop.llvm_count_lanes(2 * rop.group().nlayers(),
+                                     rop.ll.op_sub(rop.ll.op_count_active_lanes(initial_mask),
+                                                   rop.ll.op_count_active_lanes(pre_condition_mask)));
 
             rop.ll.push_mask(pre_condition_mask, false /* negate */, true /* absolute */);
 #ifdef __OSL_TRACE_MASKS
@@ -3775,6 +3865,10 @@ LLVMGEN (llvm_gen_loop_op)
 
             // Body of loop
             rop.ll.push_mask(post_condition_mask, false /* negate */, true /* absolute */);
+            if (rop.shadingsys().batched_lane_stats())
+                rop.llvm_count_lanes(2 * rop.group().nlayers(),
+                                     rop.ll.op_sub(rop.ll.op_count_active_lanes(initial_mask),
+                                                   rop.ll.op_count_active_lanes(post_condition_mask)));
             // We need to zero out the continue mask at the top loop body, as the previous
             // iteration could have set continue, alternatively we could zero at the end
             // of the loop body so its ready for the next iteration, perhaps as part
@@ -5248,6 +5342,10 @@ llvm_batched_noise_options (BatchedBackendLLVM &rop, int opnum,
     bool is_bandwidth_uniform = true;
     bool is_impulses_uniform = true;
     bool is_do_filter_uniform = true;
+    bool is_fast_uniform = true;
+    bool is_octaves_uniform = true;
+    bool is_lacunarity_uniform = true;
+    bool is_gain_uniform = true;
 
     OSL_DASSERT(loc_wide_direction == nullptr);
 
@@ -5317,6 +5415,40 @@ llvm_batched_noise_options (BatchedBackendLLVM &rop, int opnum,
             rop.ll.call_function ("osl_noiseparams_set_impulses", opt,
                                     rop.llvm_load_value (Val, 0, NULL, 0,
                                                          TypeDesc::TypeFloat));
+        } else if (name == Strings::fast && Val.typespec().is_int()) {
+            if (!Val.is_uniform()) {
+                is_fast_uniform = false;
+                continue; // We are only setting uniform options here
+            }
+            rop.ll.call_function ("osl_noiseparams_set_fast", opt,
+                                    rop.llvm_load_value (Val));
+        } else if (name == Strings::octaves &&
+                   (Val.typespec().is_float() || Val.typespec().is_int())) {
+            if (!Val.is_uniform()) {
+                is_octaves_uniform = false;
+                continue; // We are only setting uniform options here
+            }
+            rop.ll.call_function ("osl_noiseparams_set_octaves", opt,
+                                    rop.llvm_load_value (Val, 0, NULL, 0,
+                                                         TypeDesc::TypeInt));
+        } else if (name == Strings::lacunarity &&
+                   (Val.typespec().is_float() || Val.typespec().is_int())) {
+            if (!Val.is_uniform()) {
+                is_lacunarity_uniform = false;
+                continue; // We are only setting uniform options here
+            }
+            rop.ll.call_function ("osl_noiseparams_set_lacunarity", opt,
+                                    rop.llvm_load_value (Val, 0, NULL, 0,
+                                                         TypeDesc::TypeFloat));
+        } else if (name == Strings::gain &&
+                   (Val.typespec().is_float() || Val.typespec().is_int())) {
+            if (!Val.is_uniform()) {
+                is_gain_uniform = false;
+                continue; // We are only setting uniform options here
+            }
+            rop.ll.call_function ("osl_noiseparams_set_gain", opt,
+                                    rop.llvm_load_value (Val, 0, NULL, 0,
+                                                         TypeDesc::TypeFloat));
         } else {
             rop.shadingcontext()->errorfmt(
                 "Unknown {} optional argument: \"{}\", <{}> ({}:{})",
@@ -5328,7 +5460,11 @@ llvm_batched_noise_options (BatchedBackendLLVM &rop, int opnum,
     all_options_are_uniform &= is_anisotropic_uniform &&
                                is_bandwidth_uniform &&
                                is_impulses_uniform &&
-                               is_do_filter_uniform;
+                               is_do_filter_uniform &&
+                               is_fast_uniform &&
+                               is_octaves_uniform &&
+                               is_lacunarity_uniform &&
+                               is_gain_uniform;
 
     return opt;
 }
@@ -5401,6 +5537,41 @@ llvm_batched_noise_varying_options (
             remainingMask = rop.ll.op_lanes_that_match_masked(scalar_impulses, wide_impulses, remainingMask);
             rop.ll.call_function ("osl_noiseparams_set_impulses", opt,
                                   scalar_impulses);
+        } else if (name == Strings::fast && Val.typespec().is_int()) {
+            OSL_DEV_ONLY(std::cout << "Varying fast" << std::endl);
+            llvm::Value *wide_fast = rop.llvm_load_value (Val,
+                    /*deriv=*/0, /*component=*/0, /*cast=*/TypeDesc::UNKNOWN, /*op_is_uniform=*/false);
+            llvm::Value *scalar_fast = rop.ll.op_extract(wide_fast, leadLane);
+            remainingMask = rop.ll.op_lanes_that_match_masked(scalar_fast, wide_fast, remainingMask);
+            rop.ll.call_function ("osl_noiseparams_set_fast", opt,
+                                  scalar_fast);
+        } else if (name == Strings::octaves &&
+                   (Val.typespec().is_float() || Val.typespec().is_int())) {
+            OSL_DEV_ONLY(std::cout << "Varying octaves" << std::endl);
+            llvm::Value *wide_octaves = rop.llvm_load_value (Val,
+                    /*deriv=*/0, /*component=*/0, /*cast=*/TypeDesc::TypeInt, /*op_is_uniform=*/false);
+            llvm::Value *scalar_octaves = rop.ll.op_extract(wide_octaves, leadLane);
+            remainingMask = rop.ll.op_lanes_that_match_masked(scalar_octaves, wide_octaves, remainingMask);
+            rop.ll.call_function ("osl_noiseparams_set_octaves", opt,
+                                  scalar_octaves);
+        } else if (name == Strings::lacunarity &&
+                   (Val.typespec().is_float() || Val.typespec().is_int())) {
+            OSL_DEV_ONLY(std::cout << "Varying lacunarity" << std::endl);
+            llvm::Value *wide_lacunarity = rop.llvm_load_value (Val,
+                    /*deriv=*/0, /*component=*/0, /*cast=*/TypeDesc::TypeFloat, /*op_is_uniform=*/false);
+            llvm::Value *scalar_lacunarity = rop.ll.op_extract(wide_lacunarity, leadLane);
+            remainingMask = rop.ll.op_lanes_that_match_masked(scalar_lacunarity, wide_lacunarity, remainingMask);
+            rop.ll.call_function ("osl_noiseparams_set_lacunarity", opt,
+                                  scalar_lacunarity);
+        } else if (name == Strings::gain &&
+                   (Val.typespec().is_float() || Val.typespec().is_int())) {
+            OSL_DEV_ONLY(std::cout << "Varying gain" << std::endl);
+            llvm::Value *wide_gain = rop.llvm_load_value (Val,
+                    /*deriv=*/0, /*component=*/0, /*cast=*/TypeDesc::TypeFloat, /*op_is_uniform=*/false);
+            llvm::Value *scalar_gain = rop.ll.op_extract(wide_gain, leadLane);
+            remainingMask = rop.ll.op_lanes_that_match_masked(scalar_gain, wide_gain, remainingMask);
+            rop.ll.call_function ("osl_noiseparams_set_gain", opt,
+                                  scalar_gain);
         } else if (name == Strings::direction && Val.typespec().is_triple()) {
                     OSL_DEV_ONLY(std::cout << "Varying direction" << std::endl);
                     // As we passed the pointer to the varying direction along
@@ -5520,6 +5691,12 @@ LLVMGEN (llvm_gen_noise)
         pass_options = true;
         derivs = true;
         name = periodic ? Strings::gaborpnoise : Strings::gabornoise;
+    } else if (name == Strings::fbm && !periodic) {
+        pass_name = true;
+        pass_sg = true;
+        pass_options = true;
+        derivs = true;
+        name = Strings::fbmnoise;
     } else {
         rop.shadingcontext()->errorfmt(
             "{}noise type \"{}\" is unknown, called from ({}:{})",
@@ -5771,10 +5948,32 @@ LLVMGEN (llvm_gen_getattribute)
     // necessary conversions from its internal format to OSL's.
     const TypeDesc* dest_type = &Destination.typespec().simpletype();
 
+    // When the names are known now, let the renderer resolve them to a
+    // handle, so it needn't dispatch on them each time the op runs.
+    void* attr_handle = nullptr;
+    if (Attribute.is_constant() && (!object_lookup || ObjectName.is_constant())) {
+        ustring obj_name = object_lookup ? ObjectName.get_string() : ustring();
+        if (rop.vector_width() == 16)
+            attr_handle = rop.renderer()->batched(WidthOf<16>())
+                              ->resolve_attribute(obj_name,
+                                                  Attribute.get_string(),
+                                                  *dest_type);
+        else if (rop.vector_width() == 8)
+            attr_handle = rop.renderer()->batched(WidthOf<8>())
+                              ->resolve_attribute(obj_name,
+                                                  Attribute.get_string(),
+                                                  *dest_type);
+        else
+            attr_handle = rop.renderer()->batched(WidthOf<4>())
+                              ->resolve_attribute(obj_name,
+                                                  Attribute.get_string(),
+                                                  *dest_type);
+    }
+
     if (false == op_is_uniform) {
         OSL_ASSERT((!result_is_uniform) && (!destination_is_uniform));
 
-        llvm::Value * args[] = {
+        std::vector<llvm::Value*> args = {
             rop.sg_void_ptr(),
             rop.ll.constant ((int)Destination.has_derivs()),
             object_lookup ? rop.llvm_load_value (ObjectName) :
@@ -5785,6 +5984,9 @@ LLVMGEN (llvm_gen_getattribute)
             rop.ll.constant_ptr ((void *) dest_type),
             rop.llvm_void_ptr (Destination),
             rop.ll.mask_as_int(rop.ll.current_mask())};
+        // Only a uniform name can have been resolved
+        if (attribute_is_uniform)
+            args.push_back(rop.ll.constant_ptr(attr_handle));
 
         FuncSpec func_spec("get_attribute");
         func_spec.arg(Attribute,attribute_is_uniform);
@@ -5817,7 +6019,8 @@ LLVMGEN (llvm_gen_getattribute)
             rop.ll.constant ((int)array_lookup),
             array_lookup ? rop.llvm_load_value (Index) : rop.ll.constant((int)0), // Never load a symbol that is invalid
             rop.ll.constant_ptr ((void *) dest_type),
-            uniformDestination};
+            uniformDestination,
+            rop.ll.constant_ptr (attr_handle)};
 
         llvm::Value *r = rop.ll.call_function (rop.build_name(FuncSpec("get_attribute_uniform"))
                 , args);
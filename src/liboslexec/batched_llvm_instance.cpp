@@ -103,6 +103,44 @@ Schematically, we want to create code that resembles the following:
 extern int osl_llvm_compiled_ops_size;
 extern unsigned char osl_llvm_compiled_ops_block[];
 
+#ifndef OSL_LLVM_NO_BITCODE
+// Each batched target's matrix ops, built to call the free function
+// renderer services of batched_rs_free_function.h, for use with the
+// "batched_rs_bitcode" attribute.
+#    define DECLARE_WIDE_RS_DEPENDANT_OPS(target)                            \
+        extern int osl_llvm_compiled_wide_rs_dependant_ops_##target##_size; \
+        extern unsigned char                                                \
+            osl_llvm_compiled_wide_rs_dependant_ops_##target##_block[];
+#    ifdef __OSL_SUPPORTS_b16_AVX512
+DECLARE_WIDE_RS_DEPENDANT_OPS(b16_AVX512)
+#    endif
+#    ifdef __OSL_SUPPORTS_b16_AVX512_noFMA
+DECLARE_WIDE_RS_DEPENDANT_OPS(b16_AVX512_noFMA)
+#    endif
+#    ifdef __OSL_SUPPORTS_b8_AVX512
+DECLARE_WIDE_RS_DEPENDANT_OPS(b8_AVX512)
+#    endif
+#    ifdef __OSL_SUPPORTS_b8_AVX512_noFMA
+DECLARE_WIDE_RS_DEPENDANT_OPS(b8_AVX512_noFMA)
+#    endif
+#    ifdef __OSL_SUPPORTS_b8_AVX2
+DECLARE_WIDE_RS_DEPENDANT_OPS(b8_AVX2)
+#    endif
+#    ifdef __OSL_SUPPORTS_b8_AVX2_noFMA
+DECLARE_WIDE_RS_DEPENDANT_OPS(b8_AVX2_noFMA)
+#    endif
+#    ifdef __OSL_SUPPORTS_b8_AVX
+DECLARE_WIDE_RS_DEPENDANT_OPS(b8_AVX)
+#    endif
+#    ifdef __OSL_SUPPORTS_b4_SSE4_2
+DECLARE_WIDE_RS_DEPENDANT_OPS(b4_SSE4_2)
+#    endif
+#    ifdef __OSL_SUPPORTS_b4_NEON
+DECLARE_WIDE_RS_DEPENDANT_OPS(b4_NEON)
+#    endif
+#    undef DECLARE_WIDE_RS_DEPENDANT_OPS
+#endif
+
 using namespace OSL::pvt;
 
 OSL_NAMESPACE_ENTER
@@ -300,6 +338,10 @@ public:
     // Specialize instances for each supported Width and IsaT combo
     static const NameAndSignature library_functions[];
     static const char* library_selector_string;
+#ifndef OSL_LLVM_NO_BITCODE
+    static const unsigned char* const rs_dependant_ops_block;
+    static const int& rs_dependant_ops_size;
+#endif
 
     void init_function_map(ShadingSystemImpl& shadingsys) const final
     {
@@ -310,6 +352,17 @@ public:
     {
         return library_selector_string;
     }
+
+    string_view rs_dependant_ops() const final
+    {
+#ifdef OSL_LLVM_NO_BITCODE
+        return string_view();
+#else
+        return string_view(reinterpret_cast<const char*>(
+                               rs_dependant_ops_block),
+                           rs_dependant_ops_size);
+#endif
+    }
 };
 
 // Specialize ConcreteTargetLibraryHelper<>::library_functions and
@@ -347,6 +400,15 @@ template<>
 const char*
     ConcreteTargetLibraryHelper<16, TargetISA::AVX512>::library_selector_string
     = "b16_AVX512_";
+#    ifndef OSL_LLVM_NO_BITCODE
+template<>
+const unsigned char* const
+    ConcreteTargetLibraryHelper<16, TargetISA::AVX512>::rs_dependant_ops_block
+    = osl_llvm_compiled_wide_rs_dependant_ops_b16_AVX512_block;
+template<>
+const int& ConcreteTargetLibraryHelper<16, TargetISA::AVX512>::rs_dependant_ops_size
+    = osl_llvm_compiled_wide_rs_dependant_ops_b16_AVX512_size;
+#    endif
 #endif
 
 #ifdef __OSL_SUPPORTS_b16_AVX512_noFMA
@@ -374,6 +436,15 @@ template<>
 const char* ConcreteTargetLibraryHelper<
     16, TargetISA::AVX512_noFMA>::library_selector_string
     = "b16_AVX512_noFMA_";
+#    ifndef OSL_LLVM_NO_BITCODE
+template<>
+const unsigned char* const
+    ConcreteTargetLibraryHelper<16, TargetISA::AVX512_noFMA>::rs_dependant_ops_block
+    = osl_llvm_compiled_wide_rs_dependant_ops_b16_AVX512_noFMA_block;
+template<>
+const int& ConcreteTargetLibraryHelper<16, TargetISA::AVX512_noFMA>::rs_dependant_ops_size
+    = osl_llvm_compiled_wide_rs_dependant_ops_b16_AVX512_noFMA_size;
+#    endif
 #endif
 
 #ifdef __OSL_SUPPORTS_b8_AVX512
@@ -401,6 +472,15 @@ template<>
 const char*
     ConcreteTargetLibraryHelper<8, TargetISA::AVX512>::library_selector_string
     = "b8_AVX512_";
+#    ifndef OSL_LLVM_NO_BITCODE
+template<>
+const unsigned char* const
+    ConcreteTargetLibraryHelper<8, TargetISA::AVX512>::rs_dependant_ops_block
+    = osl_llvm_compiled_wide_rs_dependant_ops_b8_AVX512_block;
+template<>
+const int& ConcreteTargetLibraryHelper<8, TargetISA::AVX512>::rs_dependant_ops_size
+    = osl_llvm_compiled_wide_rs_dependant_ops_b8_AVX512_size;
+#    endif
 #endif
 
 #ifdef __OSL_SUPPORTS_b8_AVX512_noFMA
@@ -428,6 +508,15 @@ template<>
 const char* ConcreteTargetLibraryHelper<
     8, TargetISA::AVX512_noFMA>::library_selector_string
     = "b8_AVX512_noFMA_";
+#    ifndef OSL_LLVM_NO_BITCODE
+template<>
+const unsigned char* const
+    ConcreteTargetLibraryHelper<8, TargetISA::AVX512_noFMA>::rs_dependant_ops_block
+    = osl_llvm_compiled_wide_rs_dependant_ops_b8_AVX512_noFMA_block;
+template<>
+const int& ConcreteTargetLibraryHelper<8, TargetISA::AVX512_noFMA>::rs_dependant_ops_size
+    = osl_llvm_compiled_wide_rs_dependant_ops_b8_AVX512_noFMA_size;
+#    endif
 #endif
 
 #ifdef __OSL_SUPPORTS_b8_AVX2
@@ -455,6 +544,15 @@ template<>
 const char*
     ConcreteTargetLibraryHelper<8, TargetISA::AVX2>::library_selector_string
     = "b8_AVX2_";
+#    ifndef OSL_LLVM_NO_BITCODE
+template<>
+const unsigned char* const
+    ConcreteTargetLibraryHelper<8, TargetISA::AVX2>::rs_dependant_ops_block
+    = osl_llvm_compiled_wide_rs_dependant_ops_b8_AVX2_block;
+template<>
+const int& ConcreteTargetLibraryHelper<8, TargetISA::AVX2>::rs_dependant_ops_size
+    = osl_llvm_compiled_wide_rs_dependant_ops_b8_AVX2_size;
+#    endif
 #endif
 
 #ifdef __OSL_SUPPORTS_b8_AVX2_noFMA
@@ -482,6 +580,15 @@ template<>
 const char*
     ConcreteTargetLibraryHelper<8, TargetISA::AVX2_noFMA>::library_selector_string
     = "b8_AVX2_noFMA_";
+#    ifndef OSL_LLVM_NO_BITCODE
+template<>
+const unsigned char* const
+    ConcreteTargetLibraryHelper<8, TargetISA::AVX2_noFMA>::rs_dependant_ops_block
+    = osl_llvm_compiled_wide_rs_dependant_ops_b8_AVX2_noFMA_block;
+template<>
+const int& ConcreteTargetLibraryHelper<8, TargetISA::AVX2_noFMA>::rs_dependant_ops_size
+    = osl_llvm_compiled_wide_rs_dependant_ops_b8_AVX2_noFMA_size;
+#    endif
 #endif
 
 #ifdef __OSL_SUPPORTS_b8_AVX
@@ -509,6 +616,87 @@ template<>
 const char*
     ConcreteTargetLibraryHelper<8, TargetISA::AVX>::library_selector_string
     = "b8_AVX_";
+#    ifndef OSL_LLVM_NO_BITCODE
+template<>
+const unsigned char* const
+    ConcreteTargetLibraryHelper<8, TargetISA::AVX>::rs_dependant_ops_block
+    = osl_llvm_compiled_wide_rs_dependant_ops_b8_AVX_block;
+template<>
+const int& ConcreteTargetLibraryHelper<8, TargetISA::AVX>::rs_dependant_ops_size
+    = osl_llvm_compiled_wide_rs_dependant_ops_b8_AVX_size;
+#    endif
+#endif
+
+#ifdef __OSL_SUPPORTS_b4_SSE4_2
+template<>
+const NameAndSignature
+    ConcreteTargetLibraryHelper<4, TargetISA::SSE4_2>::library_functions[]
+    = {
+#    define DECL_INDIRECT(name, signature) \
+        NameAndSignature { #name, signature },
+#    define DECL(name, signature) DECL_INDIRECT(name, signature)
+#    define __OSL_WIDTH           4
+#    define __OSL_TARGET_ISA      SSE4_2
+// Don't allow order of xmacro includes be rearranged
+// clang-format off
+#    include "wide/define_opname_macros.h"
+#    include "builtindecl_wide_xmacro.h"
+#    include "wide/undef_opname_macros.h"
+// clang-format on
+#    undef __OSL_TARGET_ISA
+#    undef __OSL_WIDTH
+#    undef DECL
+#    undef DECL_INDIRECT
+      };
+template<>
+const char*
+    ConcreteTargetLibraryHelper<4, TargetISA::SSE4_2>::library_selector_string
+    = "b4_SSE4_2_";
+#    ifndef OSL_LLVM_NO_BITCODE
+template<>
+const unsigned char* const
+    ConcreteTargetLibraryHelper<4, TargetISA::SSE4_2>::rs_dependant_ops_block
+    = osl_llvm_compiled_wide_rs_dependant_ops_b4_SSE4_2_block;
+template<>
+const int& ConcreteTargetLibraryHelper<4, TargetISA::SSE4_2>::rs_dependant_ops_size
+    = osl_llvm_compiled_wide_rs_dependant_ops_b4_SSE4_2_size;
+#    endif
+#endif
+
+#ifdef __OSL_SUPPORTS_b4_NEON
+template<>
+const NameAndSignature
+    ConcreteTargetLibraryHelper<4, TargetISA::NEON>::library_functions[]
+    = {
+#    define DECL_INDIRECT(name, signature) \
+        NameAndSignature { #name, signature },
+#    define DECL(name, signature) DECL_INDIRECT(name, signature)
+#    define __OSL_WIDTH           4
+#    define __OSL_TARGET_ISA      NEON
+// Don't allow order of xmacro includes be rearranged
+// clang-format off
+#    include "wide/define_opname_macros.h"
+#    include "builtindecl_wide_xmacro.h"
+#    include "wide/undef_opname_macros.h"
+// clang-format on
+#    undef __OSL_TARGET_ISA
+#    undef __OSL_WIDTH
+#    undef DECL
+#    undef DECL_INDIRECT
+      };
+template<>
+const char*
+    ConcreteTargetLibraryHelper<4, TargetISA::NEON>::library_selector_string
+    = "b4_NEON_";
+#    ifndef OSL_LLVM_NO_BITCODE
+template<>
+const unsigned char* const
+    ConcreteTargetLibraryHelper<4, TargetISA::NEON>::rs_dependant_ops_block
+    = osl_llvm_compiled_wide_rs_dependant_ops_b4_NEON_block;
+template<>
+const int& ConcreteTargetLibraryHelper<4, TargetISA::NEON>::rs_dependant_ops_size
+    = osl_llvm_compiled_wide_rs_dependant_ops_b4_NEON_size;
+#    endif
 #endif
 
 std::unique_ptr<BatchedBackendLLVM::TargetLibraryHelper>
@@ -561,6 +749,22 @@ BatchedBackendLLVM::TargetLibraryHelper::build(ShadingContext* context,
         case TargetISA::AVX:
             return RetType(
                 new ConcreteTargetLibraryHelper<8, TargetISA::AVX>());
+#endif
+        default:
+            break;
+        }
+        break;
+    case 4:
+        switch (target_isa) {
+#ifdef __OSL_SUPPORTS_b4_SSE4_2
+        case TargetISA::SSE4_2:
+            return RetType(
+                new ConcreteTargetLibraryHelper<4, TargetISA::SSE4_2>());
+#endif
+#ifdef __OSL_SUPPORTS_b4_NEON
+        case TargetISA::NEON:
+            return RetType(
+                new ConcreteTargetLibraryHelper<4, TargetISA::NEON>());
 #endif
         default:
             break;
@@ -715,6 +919,9 @@ BatchedBackendLLVM::llvm_type_batched_texture_options()
         case 16:
             build_offsets_of_BatchedTextureOptions<16>(offset_by_index);
             break;
+        case 4:
+            build_offsets_of_BatchedTextureOptions<4>(offset_by_index);
+            break;
         default:
             OSL_ASSERT(
                 0
@@ -1069,42 +1276,68 @@ BatchedBackendLLVM::llvm_assign_initial_value(
 
             llvm::Value* sym_offset = ll.constanti64(symloc->offset);
             llvm::Value* userdata_sym_base_ptr = ll.ptr_cast(ll.offset_ptr(m_llvm_userdata_base_ptr, sym_offset), type.scalartype());
-            bool isBase32bit = (symloc->type != TypeDesc::STRING);
-            int bytesPerElem = isBase32bit ? 4 : 8;
-            // TODO:  could move assert inside SymLocation
-            OSL_ASSERT((symloc->stride % bytesPerElem) == 0);
-
-            llvm::Value* wide_shadeindex = ll.op_load(ll.type_wide_int(), m_llvm_wide_shadeindex_ptr);
-            const int elem_stride = static_cast<int>(symloc->stride/bytesPerElem);
-            llvm::Value* wide_index_for_userdata = nullptr;
-            if (elem_stride == 1) {
-                wide_index_for_userdata = wide_shadeindex;
-            } else {
-                llvm::Value* element_stride = ll.wide_constant(elem_stride);
-                wide_index_for_userdata = ll.op_mul(element_stride, wide_shadeindex);
-            }
-
             const int elem_count   = static_cast<int>(type.numelements());
             const int comp_count   = type.aggregate;
 
-            int c = 0;
-            for (int d = 0; d < deriv_count; ++d) {
-                for (int a = 0; a < elem_count; ++a) {
-                    llvm::Value* arrind = isarray ? ll.constant(a)
-                                                            : nullptr;
-                    for (int i = 0; i < comp_count; ++i, ++c) {
-                        llvm::Value* wide_index = wide_index_for_userdata;
-                        if (c != 0) {
-                            wide_index = ll.op_add(wide_index_for_userdata, ll.wide_constant(c));
+            if (symloc->soa) {
+                // The renderer placed the whole batch as Blocks, in the
+                // order the symbol's own wide storage has them, so each
+                // component is a single vector load.
+                llvm::Type* scalar_type = ll.llvm_type(type.scalartype());
+                llvm::Type* wide_type = ll.llvm_vector_type(type.scalartype());
+                int c = 0;
+                for (int d = 0; d < deriv_count; ++d) {
+                    for (int a = 0; a < elem_count; ++a) {
+                        llvm::Value* arrind = isarray ? ll.constant(a)
+                                                      : nullptr;
+                        for (int i = 0; i < comp_count; ++i, ++c) {
+                            llvm::Value* block_ptr = ll.wide_ptr_cast(
+                                ll.GEP(scalar_type, userdata_sym_base_ptr,
+                                       c * m_width),
+                                type.scalartype());
+                            llvm::Value* wide_val = ll.op_load(wide_type,
+                                                               block_ptr);
+                            llvm_store_value(wide_val, sym, d, arrind,
+                                             /*component*/i,
+                                             /*index_is_uniform*/true);
+                        }
+                    }
+                }
+            } else {
+                bool isBase32bit = (symloc->type != TypeDesc::STRING);
+                int bytesPerElem = isBase32bit ? 4 : 8;
+                // TODO:  could move assert inside SymLocation
+                OSL_ASSERT((symloc->stride % bytesPerElem) == 0);
+
+                llvm::Value* wide_shadeindex = ll.op_load(ll.type_wide_int(), m_llvm_wide_shadeindex_ptr);
+                const int elem_stride = static_cast<int>(symloc->stride/bytesPerElem);
+                llvm::Value* wide_index_for_userdata = nullptr;
+                if (elem_stride == 1) {
+                    wide_index_for_userdata = wide_shadeindex;
+                } else {
+                    llvm::Value* element_stride = ll.wide_constant(elem_stride);
+                    wide_index_for_userdata = ll.op_mul(element_stride, wide_shadeindex);
+                }
+
+                int c = 0;
+                for (int d = 0; d < deriv_count; ++d) {
+                    for (int a = 0; a < elem_count; ++a) {
+                        llvm::Value* arrind = isarray ? ll.constant(a)
+                                                                : nullptr;
+                        for (int i = 0; i < comp_count; ++i, ++c) {
+                            llvm::Value* wide_index = wide_index_for_userdata;
+                            if (c != 0) {
+                                wide_index = ll.op_add(wide_index_for_userdata, ll.wide_constant(c));
+                            }
+                            // For ISA without a native mask (AVX & AVX2), this gather op will
+                            // clamp the indices of masked off lanes to 0.
+                            // This means the user data base pointer + sym_offset
+                            // must be dereferencable with a shadeindex of 0.
+                            llvm::Value *wide_val = ll.op_gather(userdata_sym_base_ptr, wide_index);
+
+                            llvm_store_value(wide_val, sym, d, arrind,
+                                         /*component*/i, /*index_is_uniform*/true);
                         }
-                        // For ISA without a native mask (AVX & AVX2), this gather op will
-                        // clamp the indices of masked off lanes to 0.
-                        // This means the user data base pointer + sym_offset
-                        // must be dereferencable with a shadeindex of 0.
-                        llvm::Value *wide_val = ll.op_gather(userdata_sym_base_ptr, wide_index);
-
-                        llvm_store_value(wide_val, sym, d, arrind,
-                                     /*component*/i, /*index_is_uniform*/true);
                     }
                 }
             }
@@ -1945,6 +2178,9 @@ BatchedBackendLLVM::build_llvm_instance(bool groupentry)
         if (shadingsys().countlayerexecs())
             ll.call_function("osl_incr_layers_executed", sg_void_ptr());
     }
+    if (shadingsys().batched_lane_stats())
+        llvm_count_lanes(2 * layer(),
+                         ll.op_count_active_lanes(initial_shader_mask));
 
     // Setup the symbols
     m_named_values.clear();
@@ -2279,7 +2515,8 @@ BatchedBackendLLVM::initialize_llvm_group()
     }
 
     ll.setup_optimization_passes(shadingsys().llvm_optimize(),
-                                 true /*targetHost*/);
+                                 true /*targetHost*/,
+                                 shadingsys().llvm_opt_preset(group()));
 
     // Clear the shaderglobals and groupdata types -- they will be
     // created on demand.
@@ -2307,6 +2544,9 @@ BatchedBackendLLVM::initialize_llvm_group()
         }
         const std::string& funcname(i->first);
         //std::cout << "OSL Library Function Fwd:" << funcname << std::endl;
+        llvm::Function* defined = ll.module()->getFunction(funcname);
+        if (defined && !defined->isDeclaration())
+            continue;  // Linked in from batched_rs_bitcode, don't remap it
         bool varargs      = false;
         const char* types = i->second.argtypes;
         int advance;
@@ -2524,16 +2764,33 @@ BatchedBackendLLVM::run()
 #ifdef OSL_LLVM_NO_BITCODE
         ll.module(ll.new_module("llvm_ops"));
 #else
-        ll.module(ll.module_from_bitcode((char*)osl_llvm_compiled_ops_block,
-                                         osl_llvm_compiled_ops_size, "llvm_ops",
-                                         &err));
+        ll.module(ll.module_from_bitcode_prototype((char*)osl_llvm_compiled_ops_block,
+                                                   osl_llvm_compiled_ops_size, "llvm_ops",
+                                                   &err));
         if (err.length())
             shadingcontext()->errorfmt("ParseBitcodeFile returned '{}'\n", err);
         OSL_ASSERT(ll.module());
 #endif
+        // Batches of 4 are only generated for SSE4.2 and NEON: the AVX
+        // family's mask and gather code covers 8 and 16 lanes. So don't
+        // let the host's widest ISA be picked for them.
+        TargetISA isa = ll.lookup_isa_by_name(shadingsys().m_llvm_jit_target);
+        if (vector_width() == 4 && isa != TargetISA::SSE4_2
+            && isa != TargetISA::NEON) {
+            if (isa != TargetISA::UNKNOWN && isa != TargetISA::HOST) {
+                shadingcontext()->errorfmt(
+                    "Batches of 4 need llvm_jit_target SSE4.2 or NEON, not {}\n",
+                    shadingsys().m_llvm_jit_target);
+                OSL_ASSERT(0);
+                return;
+            }
+            isa = LLVM_Util::supports_isa(TargetISA::NEON) ? TargetISA::NEON
+                                                           : TargetISA::SSE4_2;
+        }
+
         // Create the ExecutionEngine
-        if (!ll.make_jit_execengine(
-                &err, ll.lookup_isa_by_name(shadingsys().m_llvm_jit_target),
+        if (!ll.make_jit(
+                &err, isa,
                 shadingsys().llvm_debugging_symbols(),
                 shadingsys().llvm_profiling_events())) {
             shadingcontext()->errorfmt("Failed to create engine: {}\n", err);
@@ -2551,6 +2808,39 @@ BatchedBackendLLVM::run()
     OSL_ASSERT(m_library_selector == nullptr);
     m_library_selector = m_target_lib_helper->library_selector();
 
+    const std::vector<char>& rs_bitcode = shadingsys().m_batched_rs_bitcode;
+    if (!rs_bitcode.empty()) {
+        // Link in this target's matrix ops built against the free function
+        // renderer services, then the renderer's definitions of those, so
+        // the lookups inline into the shader instead of calling through
+        // the library and BatchedRendererServices virtuals.
+        string_view ops = m_target_lib_helper->rs_dependant_ops();
+        if (ops.empty()) {
+            shadingcontext()->errorfmt(
+                "batched_rs_bitcode is not supported by this build for {}",
+                m_library_selector);
+        } else {
+            std::unique_ptr<llvm::Module> ops_module(
+                ll.module_from_bitcode(ops.data(), ops.size(),
+                                       "llvm_wide_rs_dependant_ops", &err));
+            if (err.length())
+                shadingcontext()->errorfmt(
+                    "llvm::parseBitcodeFile returned '{}' for llvm_wide_rs_dependant_ops\n",
+                    err);
+            std::unique_ptr<llvm::Module> rs_module(
+                ll.module_from_bitcode(rs_bitcode.data(), rs_bitcode.size(),
+                                       "batched_rs_free_functions", &err));
+            if (err.length())
+                shadingcontext()->errorfmt(
+                    "llvm::parseBitcodeFile returned '{}' for batched_rs_free_functions\n",
+                    err);
+            if (!ll.absorb_module(std::move(ops_module))
+                || !ll.absorb_module(std::move(rs_module)))
+                shadingcontext()->errorfmt(
+                    "LLVM_Util::absorb_module failed'\n");
+        }
+    }
+
     m_stat_llvm_setup_time += timer.lap();
 
     // Set up m_num_used_layers to be the number of layers that are
@@ -2577,6 +2867,31 @@ BatchedBackendLLVM::run()
     }
     shadingsys().m_stat_empty_instances += nlayers - m_num_used_layers;
 
+    if (shadingsys().batched_lane_stats()) {
+        // Counters for each layer, and one pair for the varying loops
+        if (!group().m_batched_lane_counts)
+            group().m_batched_lane_counts.reset(
+                new uint64_t[2 * nlayers + 2]());
+        // An op is only done once for the whole batch if none of its
+        // arguments vary from lane to lane.
+        group().m_batched_uniform_ops = 0;
+        group().m_batched_varying_ops = 0;
+        for (int layer = 0; layer < nlayers; ++layer) {
+            if (m_layer_remap[layer] == -1)
+                continue;
+            const ShaderInstance& li(*group()[layer]);
+            for (const Opcode& op : li.ops()) {
+                if (op.opname() == op_nop || op.opname() == op_end)
+                    continue;
+                bool varying = false;
+                for (int a = 0; a < op.nargs() && !varying; ++a)
+                    varying = li.argsymbol(op.firstarg() + a)->is_varying();
+                ++(varying ? group().m_batched_varying_ops
+                           : group().m_batched_uniform_ops);
+            }
+        }
+    }
+
     initialize_llvm_group();
 
     // Generate the LLVM IR for each layer.  Skip unused layers.
@@ -2600,10 +2915,13 @@ BatchedBackendLLVM::run()
         case 16:
             build_offsets_of_BatchedShaderGlobals<16>(offset_by_index);
             break;
+        case 4:
+            build_offsets_of_BatchedShaderGlobals<4>(offset_by_index);
+            break;
         default:
             OSL_ASSERT(
                 0
-                && "Unsupported width of batch.  Only widths 8 and 16 are allowed");
+                && "Unsupported width of batch.  Only widths 4, 8, and 16 are allowed");
             break;
         };
         ll.validate_struct_data_layout(m_llvm_type_sg, offset_by_index);
@@ -2747,6 +3065,13 @@ BatchedBackendLLVM::run()
         group().llvm_compiled_wide_version(
             group().llvm_compiled_wide_layer(nlayers - 1));
 
+    // The group owns the code from now on, so it is freed when the group is.
+    // A scalar JIT of the group may be adding its own at the same time.
+    if (auto jit_memory = ll.jit_memory()) {
+        lock_guard state_lock(group().m_jit_state_mutex);
+        group().m_llvm_jit_memory.push_back(std::move(jit_memory));
+    }
+
     // We are destroying the entire module below, no reason to bother
     // destroying individual functions
 
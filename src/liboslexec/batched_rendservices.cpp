@@ -88,6 +88,61 @@ BatchedRendererServices<WidthT>::get_inverse_matrix(BatchedShaderGlobals* bsg,
     return Mask(false);
 }
 
+template<int WidthT>
+Mask<WidthT>
+BatchedRendererServices<WidthT>::get_attribute(BatchedShaderGlobals* bsg,
+                                               ustring object, ustring name,
+                                               MaskedData wval)
+{
+    // Look the attribute up once for the whole batch into a scalar
+    // (value, Dx, Dy) and broadcast it to the active lanes.
+    char* scratch = OIIO_ALLOCA(char, wval.type().size()
+                                          * (wval.has_derivs() ? 3 : 1));
+    RefData val(wval.type(), wval.has_derivs(), scratch);
+    if (!get_attribute_uniform(bsg, object, name, val))
+        return Mask(false);
+    wval.assign_all_from_scalar(scratch);
+    return wval.mask();
+}
+
+template<int WidthT>
+Mask<WidthT>
+BatchedRendererServices<WidthT>::get_array_attribute(BatchedShaderGlobals* bsg,
+                                                     ustring object,
+                                                     ustring name, int index,
+                                                     MaskedData wval)
+{
+    char* scratch = OIIO_ALLOCA(char, wval.type().size()
+                                          * (wval.has_derivs() ? 3 : 1));
+    RefData val(wval.type(), wval.has_derivs(), scratch);
+    if (!get_array_attribute_uniform(bsg, object, name, index, val))
+        return Mask(false);
+    wval.assign_all_from_scalar(scratch);
+    return wval.mask();
+}
+
+template<int WidthT>
+Mask<WidthT>
+BatchedRendererServices<WidthT>::get_attribute_by_handle(
+    BatchedShaderGlobals* bsg, void* handle, ustring object, ustring name,
+    int index, MaskedData wval)
+{
+    if (index >= 0)
+        return get_array_attribute(bsg, object, name, index, wval);
+    return get_attribute(bsg, object, name, wval);
+}
+
+template<int WidthT>
+bool
+BatchedRendererServices<WidthT>::get_attribute_uniform_by_handle(
+    BatchedShaderGlobals* bsg, void* handle, ustring object, ustring name,
+    int index, RefData val)
+{
+    if (index >= 0)
+        return get_array_attribute_uniform(bsg, object, name, index, val);
+    return get_attribute_uniform(bsg, object, name, val);
+}
+
 template<int WidthT>
 TextureSystem*
 BatchedRendererServices<WidthT>::texturesys() const
@@ -112,8 +167,8 @@ BatchedRendererServices<WidthT>::resolve_udim_uniform(
         // Newer versions of the TextureSystem interface are able to determine the
         // specific UDIM tile we're using.
         TextureSystem::TextureHandle* udim_handle
-            = texturesys()->resolve_udim(texture_handle, texture_thread_info, S,
-                                         T);
+            = bsg->uniform.context->resolve_udim(texturesys(), texture_handle,
+                                                 texture_thread_info, S, T);
         // NOTE:  udim_handle may be nullptr if no corresponding texture exists
         if (udim_handle == nullptr) {
             // Optimization to just reuse the <udim> texture handle vs.
@@ -143,18 +198,35 @@ BatchedRendererServices<WidthT>::resolve_udim(
     if (texturesys()->is_udim(texture_handle)) {
         // Newer versions of the TextureSystem interface are able to determine the
         // specific UDIM tile we're using.
-        wresult.mask().foreach ([&](ActiveLane l) -> void {
+        // Lanes usually share a handful of tiles: resolve each distinct
+        // tile once and hand it to every lane that lands on it.
+        int utile[WidthT], vtile[WidthT];
+        OSL_OMP_PRAGMA(omp simd simdlen(WidthT))
+        for (int l = 0; l < WidthT; ++l) {
+            utile[l] = OIIO::ifloor(wS[l]);
+            vtile[l] = OIIO::ifloor(wT[l]);
+        }
+        Mask<WidthT> pending = wresult.mask();
+        while (pending.any_on()) {
+            int first = pending.first_on();
             TextureSystem::TextureHandle* udim_handle
-                = texturesys()->resolve_udim(texture_handle,
-                                             texture_thread_info, wS[l], wT[l]);
+                = bsg->uniform.context->resolve_udim(texturesys(),
+                                                     texture_handle,
+                                                     texture_thread_info,
+                                                     wS[first], wT[first]);
             // NOTE:  udim_handle may be nullptr if no corresponding texture exists
             if (udim_handle == nullptr) {
                 // Optimization to just reuse the <udim> texture handle vs.
                 // forcing get_texture_info_uniform to redo the lookup we have already done.
                 udim_handle = texture_handle;
             }
-            wresult[l] = udim_handle;
-        });
+            pending.foreach ([&](ActiveLane l) -> void {
+                if (utile[l] == utile[first] && vtile[l] == vtile[first]) {
+                    wresult[l] = udim_handle;
+                    pending.set_off(l);
+                }
+            });
+        }
     } else
 #endif
         assign_all(wresult, texture_handle);
@@ -299,5 +371,6 @@ BatchedRendererServices<WidthT>::getmessage(BatchedShaderGlobals* bsg,
 // Explicitly instantiate BatchedRendererServices template
 template class OSLEXECPUBLIC BatchedRendererServices<16>;
 template class OSLEXECPUBLIC BatchedRendererServices<8>;
+template class OSLEXECPUBLIC BatchedRendererServices<4>;
 
 OSL_NAMESPACE_EXIT
@@ -0,0 +1,58 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <OSL/batched_rs_free_function.h>
+
+#include <OSL/batched_rendererservices.h>
+#include <OSL/rendererservices.h>
+
+// Host only fallback implementation of the batched free function renderer
+// services that simply forward the calls to the existing virtual
+// BatchedRendererServices methods
+
+#define OSL_BATCHED_RS_FALLBACK(WidthT)                                       \
+    OSL_BATCHED_RSOP int rs_b##WidthT##_get_matrix_xform_time(                \
+        OSL::BatchedShaderGlobals<WidthT>* bsg,                               \
+        OSL::Masked<OSL::Matrix44, WidthT> wresult,                           \
+        OSL::Wide<const OSL::TransformationPtr, WidthT> wxform,               \
+        OSL::Wide<const float, WidthT> wtime)                                 \
+    {                                                                         \
+        return bsg->uniform.renderer->batched(OSL::WidthOf<WidthT>())         \
+            ->get_matrix(bsg, wresult, wxform, wtime)                         \
+            .value();                                                         \
+    }                                                                         \
+                                                                              \
+    OSL_BATCHED_RSOP int rs_b##WidthT##_get_inverse_matrix_xform_time(        \
+        OSL::BatchedShaderGlobals<WidthT>* bsg,                               \
+        OSL::Masked<OSL::Matrix44, WidthT> wresult,                           \
+        OSL::Wide<const OSL::TransformationPtr, WidthT> wxform,               \
+        OSL::Wide<const float, WidthT> wtime)                                 \
+    {                                                                         \
+        return bsg->uniform.renderer->batched(OSL::WidthOf<WidthT>())         \
+            ->get_inverse_matrix(bsg, wresult, wxform, wtime)                 \
+            .value();                                                         \
+    }                                                                         \
+                                                                              \
+    OSL_BATCHED_RSOP int rs_b##WidthT##_get_matrix_space_time(                \
+        OSL::BatchedShaderGlobals<WidthT>* bsg,                               \
+        OSL::Masked<OSL::Matrix44, WidthT> wresult, OSL::StringParam from,    \
+        OSL::Wide<const float, WidthT> wtime)                                 \
+    {                                                                         \
+        return bsg->uniform.renderer->batched(OSL::WidthOf<WidthT>())         \
+            ->get_matrix(bsg, wresult, from, wtime)                           \
+            .value();                                                         \
+    }                                                                         \
+                                                                              \
+    OSL_BATCHED_RSOP int rs_b##WidthT##_get_inverse_matrix_space_time(        \
+        OSL::BatchedShaderGlobals<WidthT>* bsg,                               \
+        OSL::Masked<OSL::Matrix44, WidthT> wresult, OSL::StringParam to,      \
+        OSL::Wide<const float, WidthT> wtime)                                 \
+    {                                                                         \
+        return bsg->uniform.renderer->batched(OSL::WidthOf<WidthT>())         \
+            ->get_inverse_matrix(bsg, wresult, to, wtime)                     \
+            .value();                                                         \
+    }
+
+OSL_BATCHED_RS_FALLBACK(16)
+OSL_BATCHED_RS_FALLBACK(8)
@@ -122,8 +122,19 @@ DECL (osl_printf, "xXs*")
 DECL (osl_fprintf, "xXss*")
 DECL (osl_error, "xXs*")
 DECL (osl_warning, "xXs*")
+DECL (osl_format_spec, "sXX")
+DECL (osl_format_spec_transient, "sXXX")
+DECL (osl_printf_spec, "xXXX")
+DECL (osl_fprintf_spec, "xXsXX")
+DECL (osl_error_spec, "xXXX")
+DECL (osl_warning_spec, "xXXX")
 DECL (osl_split, "isXsii")
 DECL (osl_incr_layers_executed, "xX")
+DECL (osl_layer_profile_begin, "xXi")
+DECL (osl_layer_profile_end, "xX")
+DECL (osl_call_site_begin, "xX")
+DECL (osl_call_site_end, "xXii")
+DECL (osl_profile_block, "xXi")
 
 NOISE_IMPL(cellnoise)
 //NOISE_DERIV_IMPL(cellnoise)
@@ -138,6 +149,7 @@ NOISE_IMPL(usimplexnoise)
 NOISE_DERIV_IMPL(usimplexnoise)
 GENERIC_NOISE_DERIV_IMPL(gabornoise)
 GENERIC_NOISE_DERIV_IMPL(genericnoise)
+GENERIC_NOISE_DERIV_IMPL(fbmnoise)
 NOISE_IMPL(nullnoise)
 NOISE_DERIV_IMPL(nullnoise)
 NOISE_IMPL(unullnoise)
@@ -156,6 +168,10 @@ DECL (osl_noiseparams_set_do_filter, "xXi")
 DECL (osl_noiseparams_set_direction, "xXv")
 DECL (osl_noiseparams_set_bandwidth, "xXf")
 DECL (osl_noiseparams_set_impulses, "xXf")
+DECL (osl_noiseparams_set_fast, "xXi")
+DECL (osl_noiseparams_set_octaves, "xXi")
+DECL (osl_noiseparams_set_lacunarity, "xXf")
+DECL (osl_noiseparams_set_gain, "xXf")
 DECL (osl_count_noise, "xX")
 DECL (osl_hash_ii,  "ii")
 DECL (osl_hash_if,  "if")
@@ -177,6 +193,8 @@ DECL (osl_splineinverse_dfdff, "xXXXXii")
 DECL (osl_splineinverse_dffdf, "xXXXXii")
 DECL (osl_setmessage, "xXsLXisi")
 DECL (osl_getmessage, "iXssLXiisi")
+DECL (osl_setmessage_slot, "xXXsLXisi")
+DECL (osl_getmessage_slot, "iXXsLXiisi")
 DECL (osl_pointcloud_search, "iXsXfiiXXii*")
 DECL (osl_pointcloud_get, "iXsXisLX")
 DECL (osl_pointcloud_write, "iXsXiXXX")
@@ -210,9 +228,10 @@ DECL (osl_range_check, "iiiXXXiXiXX")
 DECL (osl_range_check_err, "iiiXXXiXiXX")
 DECL (osl_naninf_check, "xiXiXXiXiiX")
 DECL (osl_uninit_check, "xLXXXiXiXXiXiXii")
-DECL (osl_get_attribute, "iXiXXiiLX")
+DECL (osl_get_attribute, "iXiXXiiLXX")
 DECL (osl_bind_interpolated_param, "iXXLiXiXiXi")
 DECL (osl_get_texture_options, "XX");
+DECL (osl_get_texture_options_from, "XXX");
 DECL (osl_get_noise_options, "XX");
 DECL (osl_get_trace_options, "XX");
 
@@ -230,6 +249,26 @@ BINARY_OP_IMPL(atan2)
 UNARY_OP_IMPL(sinh)
 UNARY_OP_IMPL(cosh)
 UNARY_OP_IMPL(tanh)
+UNARY_OP_IMPL(fast_sin)
+UNARY_OP_IMPL(fast_cos)
+UNARY_OP_IMPL(fast_tan)
+UNARY_OP_IMPL(fast_asin)
+UNARY_OP_IMPL(fast_acos)
+UNARY_OP_IMPL(fast_atan)
+BINARY_OP_IMPL(fast_atan2)
+UNARY_OP_IMPL(fast_sinh)
+UNARY_OP_IMPL(fast_cosh)
+UNARY_OP_IMPL(fast_tanh)
+UNARY_OP_IMPL(accurate_sin)
+UNARY_OP_IMPL(accurate_cos)
+UNARY_OP_IMPL(accurate_tan)
+UNARY_OP_IMPL(accurate_asin)
+UNARY_OP_IMPL(accurate_acos)
+UNARY_OP_IMPL(accurate_atan)
+BINARY_OP_IMPL(accurate_atan2)
+UNARY_OP_IMPL(accurate_sinh)
+UNARY_OP_IMPL(accurate_cosh)
+UNARY_OP_IMPL(accurate_tanh)
 
 DECL (osl_safe_div_iii, "iii")
 DECL (osl_safe_div_fff, "fff")
@@ -258,6 +297,36 @@ DECL (osl_pow_dvdvdf, "xXXX")
 DECL (osl_pow_dvvdf, "xXXX")
 DECL (osl_pow_dvdvf, "xXXf")
 
+UNARY_OP_IMPL(fast_log)
+UNARY_OP_IMPL(fast_log2)
+UNARY_OP_IMPL(fast_log10)
+UNARY_OP_IMPL(fast_exp)
+UNARY_OP_IMPL(fast_exp2)
+UNARY_OP_IMPL(fast_expm1)
+BINARY_OP_IMPL(fast_pow)
+UNARY_OP_IMPL(fast_erf)
+UNARY_OP_IMPL(fast_erfc)
+UNARY_OP_IMPL(fast_cbrt)
+DECL (osl_fast_pow_vvf, "xXXf")
+DECL (osl_fast_pow_dvdvdf, "xXXX")
+DECL (osl_fast_pow_dvvdf, "xXXX")
+DECL (osl_fast_pow_dvdvf, "xXXf")
+
+UNARY_OP_IMPL(accurate_log)
+UNARY_OP_IMPL(accurate_log2)
+UNARY_OP_IMPL(accurate_log10)
+UNARY_OP_IMPL(accurate_exp)
+UNARY_OP_IMPL(accurate_exp2)
+UNARY_OP_IMPL(accurate_expm1)
+BINARY_OP_IMPL(accurate_pow)
+UNARY_OP_IMPL(accurate_erf)
+UNARY_OP_IMPL(accurate_erfc)
+UNARY_OP_IMPL(accurate_cbrt)
+DECL (osl_accurate_pow_vvf, "xXXf")
+DECL (osl_accurate_pow_dvdvdf, "xXXX")
+DECL (osl_accurate_pow_dvvdf, "xXXX")
+DECL (osl_accurate_pow_dvdvf, "xXXf")
+
 UNARY_OP_IMPL(sqrt)
 UNARY_OP_IMPL(inversesqrt)
 UNARY_OP_IMPL(cbrt)
@@ -336,6 +405,8 @@ DECL (osl_endswith_iss, "iss")
 DECL (osl_stoi_is, "is")
 DECL (osl_stof_fs, "fs")
 DECL (osl_substr_ssii, "ssii")
+DECL (osl_concat_transient, "sXss")
+DECL (osl_substr_transient, "sXsii")
 DECL (osl_regex_impl, "iXsXisi")
 
 // Used by wide code generator, but are uniform calls
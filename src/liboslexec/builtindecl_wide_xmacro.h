@@ -225,6 +225,7 @@ WIDE_GENERIC_NOISE_DERIV_IMPL(gabornoise)
 WIDE_GENERIC_PNOISE_DERIV_IMPL(gaborpnoise)
 
 WIDE_GENERIC_NOISE_DERIV_IMPL(genericnoise)
+WIDE_GENERIC_NOISE_DERIV_IMPL(fbmnoise)
 WIDE_GENERIC_PNOISE_DERIV_IMPL(genericpnoise)
 
 WIDE_NOISE_IMPL(nullnoise)
@@ -238,6 +239,10 @@ WIDE_NOISE_DERIV_IMPL(unullnoise)
 //DECL (osl_noiseparams_set_direction, "xXv") // share non-wide impl
 //DECL (osl_noiseparams_set_bandwidth, "xXf") // share non-wide impl
 //DECL (osl_noiseparams_set_impulses, "xXf")  // share non-wide impl
+//DECL (osl_noiseparams_set_fast, "xXi")  // share non-wide impl
+//DECL (osl_noiseparams_set_octaves, "xXi")  // share non-wide impl
+//DECL (osl_noiseparams_set_lacunarity, "xXf")  // share non-wide impl
+//DECL (osl_noiseparams_set_gain, "xXf")  // share non-wide impl
 
 DECL(__OSL_MASKED_OP(count_noise), "xXi")
 
@@ -374,9 +379,9 @@ DECL(__OSL_MASKED_OP2(uninit_check_values_offset, X, Wi), "xiLXXXiXiXXiXiXXi")
 DECL(__OSL_MASKED_OP2(uninit_check_values_offset, WX, i), "xiLXXXiXiXXiXiXii")
 DECL(__OSL_MASKED_OP2(uninit_check_values_offset, WX, Wi), "xiLXXXiXiXXiXiXXi")
 
-DECL(__OSL_OP1(get_attribute, s), "iXiXXiiXXi")
+DECL(__OSL_OP1(get_attribute, s), "iXiXXiiXXiX")
 DECL(__OSL_MASKED_OP1(get_attribute, Ws), "iXiXXiiXXi")
-DECL(__OSL_OP(get_attribute_uniform), "iXiXXiiXX")
+DECL(__OSL_OP(get_attribute_uniform), "iXiXXiiXXX")
 
 // TODO:  shouldn't bind_interpolated_param be MASKED?  change name to reflect
 DECL(__OSL_OP(bind_interpolated_param), "iXXLiXiXiXii")
@@ -404,6 +409,27 @@ WIDE_BINARY_OP_IMPL(atan2)
 WIDE_UNARY_OP_IMPL(sinh)
 WIDE_UNARY_OP_IMPL(cosh)
 WIDE_UNARY_OP_IMPL(tanh)
+// Variants for the "math_precision" option
+WIDE_UNARY_OP_IMPL(fast_sin)
+WIDE_UNARY_OP_IMPL(fast_cos)
+WIDE_UNARY_OP_IMPL(fast_tan)
+WIDE_UNARY_OP_IMPL(fast_asin)
+WIDE_UNARY_OP_IMPL(fast_acos)
+WIDE_UNARY_OP_IMPL(fast_atan)
+WIDE_BINARY_OP_IMPL(fast_atan2)
+WIDE_UNARY_OP_IMPL(fast_sinh)
+WIDE_UNARY_OP_IMPL(fast_cosh)
+WIDE_UNARY_OP_IMPL(fast_tanh)
+WIDE_UNARY_OP_IMPL(accurate_sin)
+WIDE_UNARY_OP_IMPL(accurate_cos)
+WIDE_UNARY_OP_IMPL(accurate_tan)
+WIDE_UNARY_OP_IMPL(accurate_asin)
+WIDE_UNARY_OP_IMPL(accurate_acos)
+WIDE_UNARY_OP_IMPL(accurate_atan)
+WIDE_BINARY_OP_IMPL(accurate_atan2)
+WIDE_UNARY_OP_IMPL(accurate_sinh)
+WIDE_UNARY_OP_IMPL(accurate_cosh)
+WIDE_UNARY_OP_IMPL(accurate_tanh)
 
 // DECL (osl_safe_div_iii, "iii") // impl by code generator
 // DECL (osl_safe_div_fff, "fff") // impl by code generator
@@ -443,6 +469,30 @@ WIDE_UNARY_F_OP_IMPL(erfc)
 // pow is only masked implementation for performance reasons
 WIDE_BINARY_VF_OP_MASKED_IMPL(pow)
 
+// Variants for the "math_precision" option
+WIDE_UNARY_OP_IMPL(fast_log)
+WIDE_UNARY_OP_IMPL(fast_log2)
+WIDE_UNARY_OP_IMPL(fast_log10)
+WIDE_UNARY_OP_IMPL(fast_exp)
+WIDE_UNARY_OP_IMPL(fast_exp2)
+WIDE_UNARY_OP_IMPL(fast_expm1)
+WIDE_BINARY_OP_MASKED_IMPL(fast_pow)
+WIDE_BINARY_VF_OP_MASKED_IMPL(fast_pow)
+WIDE_UNARY_F_OP_IMPL(fast_erf)
+WIDE_UNARY_F_OP_IMPL(fast_erfc)
+WIDE_UNARY_OP_IMPL(fast_cbrt)
+WIDE_UNARY_OP_IMPL(accurate_log)
+WIDE_UNARY_OP_IMPL(accurate_log2)
+WIDE_UNARY_OP_IMPL(accurate_log10)
+WIDE_UNARY_OP_IMPL(accurate_exp)
+WIDE_UNARY_OP_IMPL(accurate_exp2)
+WIDE_UNARY_OP_IMPL(accurate_expm1)
+WIDE_BINARY_OP_MASKED_IMPL(accurate_pow)
+WIDE_BINARY_VF_OP_MASKED_IMPL(accurate_pow)
+WIDE_UNARY_F_OP_IMPL(accurate_erf)
+WIDE_UNARY_F_OP_IMPL(accurate_erfc)
+WIDE_UNARY_OP_IMPL(accurate_cbrt)
+
 WIDE_UNARY_OP_IMPL(sqrt)
 WIDE_UNARY_OP_IMPL(inversesqrt)
 WIDE_UNARY_OP_IMPL(cbrt)
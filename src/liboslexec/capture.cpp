@@ -0,0 +1,326 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <OpenImageIO/filesystem.h>
+
+#include "oslexec_pvt.h"
+
+
+OSL_NAMESPACE_ENTER
+
+namespace pvt {
+
+// A capture stream is the magic, the size of ShaderGlobals (which is
+// stored raw, so a stream only replays on the build that wrote it), and
+// then records, each starting with a tag:
+//
+//   'G' id name usage spec noutputs outputs...   a group, before its points
+//   'P' groupid shadeindex globals nlookups lookups...   an executed point
+//
+// Ints are native, and strings are a 32-bit length and the bytes.
+
+static const char capture_magic[8] = { 'O', 'S', 'L', 'c', 'a', 'p', 't', '1' };
+
+namespace {
+
+template<typename T>
+void
+put (std::string &out, const T &val)
+{
+    out.append ((const char *)&val, sizeof(T));
+}
+
+void
+put_string (std::string &out, string_view s)
+{
+    put (out, uint32_t(s.size()));
+    out.append (s.data(), s.size());
+}
+
+void
+put_type (std::string &out, TypeDesc type)
+{
+    put (out, uint8_t(type.basetype));
+    put (out, uint8_t(type.aggregate));
+    put (out, uint8_t(type.vecsemantics));
+    put (out, int32_t(type.arraylen));
+}
+
+
+// Reads a stream back, turning ok off (and returning zeroes) instead of
+// reading past its end.
+struct CaptureReader {
+    const std::string &blob;
+    size_t pos = 0;
+    bool ok = true;
+
+    CaptureReader (const std::string &blob) : blob(blob) {}
+    bool more () const { return ok && pos < blob.size(); }
+
+    template<typename T> T get () {
+        T val {};
+        if (! ok || pos + sizeof(T) > blob.size()) {
+            ok = false;
+            return val;
+        }
+        memcpy ((void *)&val, blob.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return val;
+    }
+    std::string get_string () {
+        uint32_t len = get<uint32_t>();
+        if (! ok || pos + len > blob.size()) {
+            ok = false;
+            return std::string();
+        }
+        std::string s (blob, pos, len);
+        pos += len;
+        return s;
+    }
+    TypeDesc get_type () {
+        TypeDesc type;
+        type.basetype = get<uint8_t>();
+        type.aggregate = get<uint8_t>();
+        type.vecsemantics = get<uint8_t>();
+        type.arraylen = get<int32_t>();
+        return type;
+    }
+};
+
+
+const ShadingContext::CapturedLookup *
+find_captured (cspan<ShadingContext::CapturedLookup> lookups,
+               ShadingContext::LookupKind kind, ustring object, ustring name,
+               TypeDesc type, int index, bool derivs)
+{
+    for (auto& c : lookups)
+        if (c.name == name && c.kind == kind && c.object == object
+            && c.type == type && c.index == index && c.derivs == derivs)
+            return &c;
+    return nullptr;
+}
+
+}  // anon namespace
+
+
+
+void
+ShadingContext::capture_lookup (LookupKind kind, ustring object, ustring name,
+                                TypeDesc type, int index, bool derivs,
+                                bool ok, const void *data, size_t size)
+{
+    if (find_captured (m_captured, kind, object, name, type, index, derivs))
+        return;   // a later layer asking again gets the same answer
+    CapturedLookup c { kind, object, name, type, index, derivs, ok,
+                       ok ? std::string ((const char *)data, size)
+                          : std::string() };
+    m_captured.push_back (std::move(c));
+}
+
+
+
+const ShadingContext::CapturedLookup *
+ShadingContext::replay_lookup (LookupKind kind, ustring object, ustring name,
+                               TypeDesc type, int index, bool derivs) const
+{
+    return find_captured (m_replay, kind, object, name, type, index, derivs);
+}
+
+
+
+bool
+ShadingSystemImpl::open_capture (ustring filename)
+{
+    lock_guard lock (m_capture_mutex);
+    m_capturing = false;
+    if (m_capture_out.is_open())
+        m_capture_out.close ();
+    m_captured_groups.clear ();
+    m_capture = filename;
+    if (filename.empty())
+        return true;
+    OIIO::Filesystem::open (m_capture_out, filename.string(),
+                            std::ios::out | std::ios::binary);
+    if (! m_capture_out) {
+        errorfmt ("Could not open capture file \"{}\"", filename);
+        m_capture = ustring();
+        return false;
+    }
+    std::string header (capture_magic, sizeof(capture_magic));
+    put (header, int32_t(sizeof(ShaderGlobals)));
+    m_capture_out.write (header.data(), header.size());
+    m_capturing = true;
+    return true;
+}
+
+
+
+void
+ShadingSystemImpl::capture_point (ShadingContext &ctx, ShaderGroup &group,
+                                  int shadeindex, const ShaderGlobals &sg)
+{
+    // Put the record together before taking the lock
+    const auto& lookups (ctx.end_capture ());
+    std::string rec;
+    put (rec, 'P');
+    put (rec, int32_t(group.id()));
+    put (rec, int32_t(shadeindex));
+    put (rec, sg);
+    put (rec, uint32_t(lookups.size()));
+    for (auto&& c : lookups) {
+        put (rec, uint8_t(c.kind));
+        put_string (rec, c.object);
+        put_string (rec, c.name);
+        put_type (rec, c.type);
+        put (rec, int32_t(c.index));
+        put (rec, uint8_t(c.derivs));
+        put (rec, uint8_t(c.ok));
+        put_string (rec, c.data);
+    }
+
+    lock_guard lock (m_capture_mutex);
+    if (! m_capture_out.is_open())
+        return;   // capture was turned off while we ran
+    if (m_captured_groups.insert (group.id()).second) {
+        std::string g;
+        put (g, 'G');
+        put (g, int32_t(group.id()));
+        put_string (g, group.name());
+        put_string (g, group.m_group_use);
+        put_string (g, group.serialize());
+        put (g, uint32_t(group.m_renderer_outputs.size()));
+        for (auto&& o : group.m_renderer_outputs)
+            put_string (g, o);
+        m_capture_out.write (g.data(), g.size());
+    }
+    m_capture_out.write (rec.data(), rec.size());
+}
+
+
+
+int
+ShadingSystemImpl::replay (string_view filename, int iterations,
+                           PerThreadInfo *threadinfo)
+{
+    OIIO::ifstream in;
+    OIIO::Filesystem::open (in, filename, std::ios::in | std::ios::binary);
+    if (! in) {
+        errorfmt ("Could not read capture file \"{}\"", filename);
+        return -1;
+    }
+    std::string blob ((std::istreambuf_iterator<char>(in)),
+                      std::istreambuf_iterator<char>());
+    CaptureReader r (blob);
+    if (blob.size() < sizeof(capture_magic)
+          || memcmp (blob.data(), capture_magic, sizeof(capture_magic))) {
+        errorfmt ("\"{}\" is not a shading capture", filename);
+        return -1;
+    }
+    r.pos = sizeof(capture_magic);
+    if (r.get<int32_t>() != int32_t(sizeof(ShaderGlobals))) {
+        errorfmt ("Capture \"{}\" was written by an incompatible build",
+                  filename);
+        return -1;
+    }
+
+    // Read it all up front, so that the timed part is only shading
+    struct Point {
+        ShaderGroup *group;
+        int shadeindex;
+        ShaderGlobals sg;
+        std::vector<ShadingContext::CapturedLookup> lookups;
+    };
+    std::unordered_map<int, ShaderGroupRef> groups;
+    std::vector<Point> points;
+    while (r.more()) {
+        char tag = r.get<char>();
+        if (tag == 'G') {
+            int id = r.get<int32_t>();
+            std::string name = r.get_string();
+            std::string usage = r.get_string();
+            std::string spec = r.get_string();
+            std::vector<ustring> outputs (r.get<uint32_t>());
+            for (size_t i = 0;  r.ok && i < outputs.size();  ++i)
+                outputs[i] = ustring (r.get_string());
+            if (! r.ok)
+                break;
+            ShaderGroupRef saved_curgroup = m_curgroup;
+            ShaderGroupRef group = ShaderGroupBegin (name, usage, spec);
+            m_curgroup = saved_curgroup;
+            if (! group) {
+                errorfmt ("Could not rebuild group \"{}\" from \"{}\"",
+                          name, filename);
+                return -1;
+            }
+            group->m_renderer_outputs = outputs;
+            ShaderGroupEnd (*group);
+            groups[id] = group;
+        } else if (tag == 'P') {
+            Point p;
+            auto found = groups.find (r.get<int32_t>());
+            p.shadeindex = r.get<int32_t>();
+            p.sg = r.get<ShaderGlobals>();
+            uint32_t n = r.get<uint32_t>();
+            if (! r.ok || found == groups.end()) {
+                r.ok = false;
+                break;
+            }
+            p.group = found->second.get();
+            for (uint32_t i = 0;  r.ok && i < n;  ++i) {
+                ShadingContext::CapturedLookup c;
+                uint8_t kind = r.get<uint8_t>();
+                c.kind = ShadingContext::LookupKind (kind);
+                c.object = ustring (r.get_string());
+                c.name = ustring (r.get_string());
+                c.type = r.get_type();
+                c.index = r.get<int32_t>();
+                c.derivs = r.get<uint8_t>();
+                c.ok = r.get<uint8_t>();
+                c.data = r.get_string();
+                if (kind > ShadingContext::LookupUserdata
+                      || (c.ok && c.data.size() != c.type.size() * (c.derivs ? 3 : 1)))
+                    r.ok = false;
+                p.lookups.push_back (std::move(c));
+            }
+            // The pointers meant something only to the renderer that
+            // captured the point.
+            p.sg.renderstate = nullptr;
+            p.sg.tracedata = nullptr;
+            p.sg.objdata = nullptr;
+            p.sg.object2common = nullptr;
+            p.sg.shader2common = nullptr;
+            points.push_back (std::move(p));
+        } else {
+            r.ok = false;
+        }
+    }
+    if (! r.ok) {
+        errorfmt ("Capture \"{}\" is malformed", filename);
+        return -1;
+    }
+
+    ShadingContext *ctx = get_context (threadinfo);
+    int executed = 0;
+    for (int iter = 0;  iter < iterations;  ++iter) {
+        for (auto&& p : points) {
+            ShaderGlobals sg = p.sg;
+            ctx->begin_replay (p.lookups);
+            execute (*ctx, *p.group, p.shadeindex, sg, nullptr, nullptr);
+            ++executed;
+        }
+    }
+    ctx->end_replay ();
+    release_context (ctx);
+    return executed;
+}
+
+}  // namespace pvt
+
+OSL_NAMESPACE_EXIT
@@ -4,10 +4,9 @@
 
 #pragma once
 
-#include <vector>
-#include <list>
-
-#include <OpenImageIO/thread.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
 
 using namespace OSL;
 using namespace OSL::pvt;
@@ -21,51 +20,68 @@ namespace pvt {
 /// A ConstantPool<T> is a way to allocate room for a small number of
 /// T's at a time, such that the memory allocated will NEVER change its
 /// address or be deallocated until the entire ConstantPool is
-/// destroyed.  Allocating from the pool is completely thread-safe.
+/// destroyed.  Allocating from the pool is completely thread-safe, and
+/// lock-free.
 ///
 /// It is implemented as a linked list of memory blocks.  A request for
-/// a new allocation tries to fit it in one of the allocated blocks, but
-/// if it won't fit anywhere, it makes a new block and adds it to the
-/// head of the list.
+/// a new allocation bumps an atomic offset within the newest block; if
+/// it won't fit there, it makes a new block and swaps it in as the head
+/// of the list.  (The unused tail of a full block is simply abandoned.)
 template<class T>
 class ConstantPool {
 public:
     /// Allocate a new pool of T's.  The quanta, if supplied, is the
     /// number of T's to malloc at a time.
-    ConstantPool (size_t quanta = 1000000) : m_quanta(quanta), m_total(0) { }
+    ConstantPool (size_t quanta = 1000000) : m_quanta(quanta) { }
 
-    ~ConstantPool () { }
+    ~ConstantPool () {
+        for (Block *b = m_head.load();  b; ) {
+            Block *next = b->next;
+            delete b;
+            b = next;
+        }
+    }
+
+    ConstantPool (const ConstantPool &) = delete;
+    ConstantPool & operator= (const ConstantPool &) = delete;
 
     /// Allocate space enough for n T's, and return a pointer to the
     /// start of that space.
     T * alloc (size_t n) {
-        OIIO::lock_guard lock (m_mutex);
-        // Check each block in the block list to see if it has enough space
-        for (auto&& block : m_block_list) {
-            size_t s = block.size();
-            if ((s+n) <= block.capacity()) {
-                // Enough space in this block.  Use it.
-                block.resize (s+n);
-                return &block[s];
+        Block *head = m_head.load (std::memory_order_acquire);
+        while (true) {
+            if (head) {
+                size_t s = head->used.fetch_add (n, std::memory_order_relaxed);
+                if (s + n <= head->capacity)
+                    return &head->data[s];   // Enough space in this block
+            }
+            // No room in the newest block. Make a new one, already
+            // holding our allocation, and try to make it the head.
+            Block *block = new Block (std::max (m_quanta, n), n);
+            block->next = head;
+            if (m_head.compare_exchange_strong (head, block,
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_acquire)) {
+                m_total += block->capacity * sizeof(T);
+                return &block->data[0];
             }
+            // Another thread added a block first; try that one instead.
+            delete block;
         }
-        // If we got here, there were no mini-blocks in the list with enough
-        // space.  Make a new one.
-        m_block_list.push_front (block_t());
-        block_t &block (m_block_list.front());
-        size_t s = std::max (m_quanta, n);
-        block.reserve (s);
-        m_total += s * sizeof(T);
-        block.resize (n);
-        return &block[0];
     }
 
 private:
-    typedef std::vector<T> block_t;   ///< Type of block
-    std::list<block_t> m_block_list;  ///< List of memory blocks
+    struct Block {
+        Block (size_t cap, size_t n)
+            : used(n), capacity(cap), data(new T[cap]()) { }
+        std::atomic<size_t> used;     ///< T's handed out (may overshoot)
+        size_t capacity;              ///< T's in the block
+        Block *next = nullptr;        ///< Next older block
+        std::unique_ptr<T[]> data;    ///< The memory itself
+    };
+    std::atomic<Block *> m_head { nullptr };  ///< Newest block
     size_t m_quanta;   ///< How big each memory block is (in T's, not bytes)
-    size_t m_total;    ///< Total memory allocated (bytes!)
-    OIIO::mutex m_mutex;  ///< Thread-safe lock
+    std::atomic<size_t> m_total { 0 };  ///< Total memory allocated (bytes!)
 };
 
 
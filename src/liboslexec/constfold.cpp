@@ -13,7 +13,10 @@
 #include "opcolor.h"
 #include "runtimeoptimize.h"
 #include <OSL/dual.h>
+#include <OSL/dual_vec.h>
+#include <OSL/device_string.h>
 #include <OSL/oslnoise.h>
+#include "splineimpl.h"
 using namespace OSL;
 using namespace OSL::pvt;
 
@@ -31,8 +34,13 @@ static ustring u_nop    ("nop"),
                u_inversesqrt ("inversesqrt"),
                u_cbrt   ("cbrt"),
                u_if     ("if"),
+               u_for    ("for"),
+               u_while  ("while"),
+               u_dowhile("dowhile"),
                u_eq     ("eq"),
                u_return ("return"),
+               u_functioncall ("functioncall"),
+               u_functioncall_nr ("functioncall_nr"),
                u_error  ("error"),
                u_fmterror("%s"),
                u_fmt_range_check("Index [%d] out of range %s[0..%d]: %s:%d (group %s, layer %d %s, shader %s)");
@@ -1395,21 +1403,32 @@ DECLFOLDER(constfold_substr)
 
 
 
-DECLFOLDER(constfold_regex_search)
+static int
+constfold_regex (RuntimeOptimizer &rop, int opnum, bool fullmatch)
 {
     // Try to turn R=regex_search(subj,reg) into R=C
     Opcode &op (rop.inst()->ops()[opnum]);
     Symbol &Subj (*rop.inst()->argsymbol(op.firstarg()+1));
-    Symbol &Reg (*rop.inst()->argsymbol(op.firstarg()+2));
+    Symbol &Reg (*rop.inst()->argsymbol(op.firstarg() + (op.nargs() == 3 ? 2 : 3)));
+    if (! Reg.is_constant())
+        return 0;
+    OSL_DASSERT(Subj.typespec().is_string() && Reg.typespec().is_string());
+    // A constant pattern is compiled now, into the cache the shading
+    // system's contexts share, so no shader execution ever compiles it.
+    // An invalid pattern is left to fail at run time, as it always has.
+    const CompiledRegex *regex = nullptr;
+    try {
+        regex = &rop.shadingsys().find_regex (Reg.get_string());
+    } catch (const std::regex_error &) {
+        return 0;
+    }
     if (op.nargs() == 3 // only the 2-arg version without search results
-          && Subj.is_constant() && Reg.is_constant()) {
-        OSL_DASSERT(Subj.typespec().is_string() && Reg.typespec().is_string());
-        ustring s (Subj.get_string());
-        ustring r (Reg.get_string());
-        std::regex reg(r.string());
-        int result = std::regex_search(s.string(), reg);
+          && Subj.is_constant()) {
+        int result = regex->match (Subj.get_string().string(), nullptr, 0,
+                                   fullmatch);
         int cind = rop.add_constant (result);
-        rop.turn_into_assign (op, cind, "const fold regex_search");
+        rop.turn_into_assign (op, cind, fullmatch ? "const fold regex_match"
+                                                  : "const fold regex_search");
         return 1;
     }
     return 0;
@@ -1417,6 +1436,20 @@ DECLFOLDER(constfold_regex_search)
 
 
 
+DECLFOLDER(constfold_regex_search)
+{
+    return constfold_regex (rop, opnum, false);
+}
+
+
+
+DECLFOLDER(constfold_regex_match)
+{
+    return constfold_regex (rop, opnum, true);
+}
+
+
+
 inline float clamp (float x, float minv, float maxv)
 {
     if (x < minv) return minv;
@@ -1926,6 +1959,44 @@ DECLFOLDER(constfold_triple)
 
 
 
+// Is the matrix that transforms from space 'from' to space 'to' already
+// known before execution? It is for an identity transform, and for spaces
+// whose matrices the renderer says are not time-varying (which shader and
+// object space never are, since they change with every execution).
+static bool
+known_space_matrix (RuntimeOptimizer &rop, ustring from, ustring to,
+                    Matrix44 &M)
+{
+    ustring commonsyn = rop.shadingsys().commonspace_synonym();
+    if (from == commonsyn)
+        from = Strings::common;
+    if (to == commonsyn)
+        to = Strings::common;
+    if (from == to) {
+        M.makeIdentity ();
+        return true;
+    }
+    if (from == Strings::shader || from == Strings::object ||
+        to == Strings::shader || to == Strings::object)
+        return false;
+    RendererServices *rs = rop.shadingsys().renderer();
+    Matrix44 Mfrom, Mto;
+    bool ok = true;
+    if (from == Strings::common)
+        Mfrom.makeIdentity ();
+    else
+        ok &= rs->get_matrix (rop.shaderglobals(), Mfrom, from);
+    if (to == Strings::common)
+        Mto.makeIdentity ();
+    else
+        ok &= rs->get_inverse_matrix (rop.shaderglobals(), Mto, to);
+    if (ok)
+        M = Mfrom * Mto;
+    return ok;
+}
+
+
+
 DECLFOLDER(constfold_matrix)
 {
     Opcode &op (rop.inst()->ops()[opnum]);
@@ -1958,29 +2029,11 @@ DECLFOLDER(constfold_matrix)
         // varying matrices.
         if (! (From.is_constant() && To.is_constant()))
             return 0;
-        // Shader and object spaces will vary from execution to execution,
-        // so we can't optimize those away.
-        if (from == Strings::shader || from == Strings::object ||
-            to == Strings::shader || to == Strings::object)
-            return 0;
-        // But whatever spaces are left *may* be optimizable if they are
-        // not time-varying.
-        RendererServices *rs = rop.shadingsys().renderer();
-        Matrix44 Mfrom, Mto;
-        bool ok = true;
-        if (from == Strings::common || from == commonsyn)
-            Mfrom.makeIdentity ();
-        else
-            ok &= rs->get_matrix (rop.shaderglobals(), Mfrom, from);
-        if (to == Strings::common || to == commonsyn)
-            Mto.makeIdentity ();
-        else
-            ok &= rs->get_inverse_matrix (rop.shaderglobals(), Mto, to);
-        if (ok) {
+        Matrix44 Mresult;
+        if (known_space_matrix (rop, from, to, Mresult)) {
             // The from-to matrix is known and not time-varying, so just
             // turn it into a constant rather than calling getmatrix at
             // execution time.
-            Matrix44 Mresult = Mfrom * Mto;
             int cind = rop.add_constant (TypeDesc::TypeMatrix, &Mresult);
             rop.turn_into_assign (op, cind, "const fold matrix");
             return 1;
@@ -2045,30 +2098,8 @@ DECLFOLDER(constfold_getmatrix)
     if (! (From.is_constant() && To.is_constant()))
         return 0;
     // OK, From and To are constant strings.
-    ustring from = From.get_string();
-    ustring to = To.get_string();
-    ustring commonsyn = rop.inst()->shadingsys().commonspace_synonym();
-
-    // Shader and object spaces will vary from execution to execution,
-    // so we can't optimize those away.
-    if (from == Strings::shader || from == Strings::object ||
-        to == Strings::shader || to == Strings::object)
-        return 0;
-
-    // But whatever spaces are left *may* be optimizable if they are
-    // not time-varying.
-    RendererServices *rs = rop.shadingsys().renderer();
-    Matrix44 Mfrom, Mto;
-    bool ok = true;
-    if (from == Strings::common || from == commonsyn || from == to)
-        Mfrom.makeIdentity ();
-    else
-        ok &= rs->get_matrix (rop.shaderglobals(), Mfrom, from);
-    if (to == Strings::common || to == commonsyn || from == to)
-        Mto.makeIdentity ();
-    else
-        ok &= rs->get_inverse_matrix (rop.shaderglobals(), Mto, to);
-    if (ok) {
+    Matrix44 Mresult;
+    if (known_space_matrix (rop, From.get_string(), To.get_string(), Mresult)) {
         // The from-to matrix is known and not time-varying, so just
         // turn it into a constant rather than calling getmatrix at
         // execution time.
@@ -2077,7 +2108,6 @@ DECLFOLDER(constfold_getmatrix)
         // Make data the first argument
         rop.inst()->args()[op.firstarg()+0] = dataarg;
         // Now turn it into an assignment
-        Matrix44 Mresult = Mfrom * Mto;
         int cind = rop.add_constant (TypeDesc::TypeMatrix, &Mresult);
         rop.turn_into_assign (op, cind, "getmatrix of known matrix");
 
@@ -2105,25 +2135,64 @@ DECLFOLDER(constfold_transform)
                               "transform by identity");
         return 1;
     }
-    if (op.nargs() == 4) {
-        Symbol &T (*rop.inst()->argsymbol(op.firstarg()+2));
-        if (M.is_constant() && T.is_constant()) {
-            OSL_DASSERT(M.typespec().is_string() && T.typespec().is_string());
-            ustring from = M.get_string();
-            ustring to = T.get_string();
-            ustring syn = rop.shadingsys().commonspace_synonym();
-            if (from == syn)
-                from = Strings::common;
-            if (to == syn)
-                to = Strings::common;
-            if (from == to) {
-                rop.turn_into_assign (op, rop.inst()->arg(op.firstarg()+3),
-                                      "transform by identity");
-                return 1;
-            }
+    int changed = 0;
+    bool named = ! M.typespec().is_matrix();
+    Symbol &T (*rop.inst()->argsymbol(op.firstarg() + (op.nargs() == 4 ? 2 : 1)));
+    if (named && (op.nargs() == 3 || M.is_constant()) && T.is_constant()) {
+        OSL_DASSERT(M.typespec().is_string() && T.typespec().is_string());
+        ustring from = op.nargs() == 4 ? M.get_string() : Strings::common;
+        ustring to = T.get_string();
+        ustring syn = rop.shadingsys().commonspace_synonym();
+        if (from == syn)
+            from = Strings::common;
+        if (to == syn)
+            to = Strings::common;
+        if (from == to) {
+            rop.turn_into_assign (op, rop.inst()->arg(op.firstarg()+op.nargs()-1),
+                                  "transform by identity");
+            return 1;
+        }
+        // If the renderer won't do anything nonlinear between these spaces
+        // and their matrix is already known, switch to the matrix form, so
+        // finding the matrix isn't left for every execution.
+        TypeDesc::VECSEMANTICS vectype = TypeDesc::POINT;
+        if (op.opname() == "transformv")
+            vectype = TypeDesc::VECTOR;
+        else if (op.opname() == "transformn")
+            vectype = TypeDesc::NORMAL;
+        Matrix44 Mknown;
+        RendererServices *rs = rop.shadingsys().renderer();
+        if (! rs->transform_points (NULL, from, to, 0.0f, NULL, NULL, 0, vectype)
+              && known_space_matrix (rop, from, to, Mknown)) {
+            int *args = &rop.inst()->args()[op.firstarg()];
+            args[1] = rop.add_constant (Mknown);
+            args[2] = args[op.nargs()-1];
+            op.set_args (op.firstarg(), 3);
+            if (rop.debug())
+                rop.debug_opt_ops (opnum, opnum+1,
+                                   "transform by known space matrix");
+            named = false;
+            ++changed;
         }
     }
-    return 0;
+    // A constant point/vector/normal through a constant matrix is itself
+    // just a constant.
+    Symbol &Mc (*rop.opargsym (op, 1));
+    Symbol &P (*rop.opargsym (op, 2));
+    if (! named && op.nargs() == 3 && Mc.is_constant() && P.is_constant()) {
+        const Matrix44 &Mx (*(const Matrix44 *)Mc.data());
+        Vec3 v (P.get_vec3()), result;
+        if (op.opname() == "transformv")
+            multDirMatrix (Mx, v, result);
+        else if (op.opname() == "transformn")
+            multDirMatrix (inlinedTransposed (Mx.inverse()), v, result);
+        else
+            robust_multVecMatrix (Mx, v, result);
+        rop.turn_into_assign (op, rop.add_constantv (result, rop.opargsym(op,0)->typespec()),
+                              "const fold transform");
+        return 1;
+    }
+    return changed;
 }
 
 
@@ -2161,6 +2230,73 @@ DECLFOLDER(constfold_transformc)
 
 
 
+// color blackbody (float temperatureK)
+// color wavelength_color (float wavelength_nm)
+DECLFOLDER(constfold_blackbody)
+{
+    Opcode &op (rop.inst()->ops()[opnum]);
+    Symbol &X = *rop.opargsym (op, 1);
+    if (X.is_constant()) {
+        const ColorSystem &cs (rop.shadingsys().colorsystem());
+        Color3 result = (op.opname() == "blackbody")
+                      ? cs.blackbody_color (X.get_float())
+                      : cs.wavelength_color (X.get_float());
+        rop.turn_into_assign (op, rop.add_constantc(result),
+                              "const fold color of constant");
+        return 1;
+    }
+    return 0;
+}
+
+
+
+// spline (result, basis, x, [knot_count,] knots)
+// splineinverse (result, basis, y, [knot_count,] knots)
+DECLFOLDER(constfold_spline)
+{
+    Opcode &op (rop.inst()->ops()[opnum]);
+    bool has_knot_count = (op.nargs() == 5);
+    Symbol &Result = *rop.opargsym (op, 0);
+    Symbol &Basis = *rop.opargsym (op, 1);
+    Symbol &X = *rop.opargsym (op, 2);
+    Symbol &Knot_count = *rop.opargsym (op, 3);  // might alias Knots
+    Symbol &Knots = *rop.opargsym (op, has_knot_count ? 4 : 3);
+    if (! (Basis.is_constant() && X.is_constant() && Knots.is_constant()
+           && (! has_knot_count || Knot_count.is_constant())))
+        return 0;
+    int arraylen = Knots.typespec().arraylength();
+    int count = has_knot_count ? Knot_count.get_int() : arraylen;
+    if (count < 4 || count > arraylen)
+        return 0;   // Leave the bad knot count to the run time
+    auto spline = Spline::SplineInterp::create (Basis.get_string());
+    float x = X.get_float();
+    if (Result.typespec().is_float() && Knots.typespec().elementtype().is_float()) {
+        const float *knots = (const float *) Knots.data();
+        float result;
+        if (op.opname() == "splineinverse")
+            spline.inverse<float> (result, x, knots, count, arraylen);
+        else
+            spline.evaluate<float, float, float, float, false>
+                (result, x, knots, count, arraylen);
+        rop.turn_into_assign (op, rop.add_constant (result),
+                              "const fold spline");
+        return 1;
+    }
+    if (Result.typespec().is_triple() && Knots.typespec().elementtype().is_triple()
+          && op.opname() == "spline") {
+        const Vec3 *knots = (const Vec3 *) Knots.data();
+        Vec3 result;
+        spline.evaluate<Vec3, float, Vec3, Vec3, false>
+            (result, x, knots, count, arraylen);
+        rop.turn_into_assign (op, rop.add_constantv (result, Result.typespec()),
+                              "const fold spline");
+        return 1;
+    }
+    return 0;
+}
+
+
+
 DECLFOLDER(constfold_setmessage)
 {
     Opcode &op (rop.inst()->ops()[opnum]);
@@ -2268,14 +2404,20 @@ DECLFOLDER(constfold_getattribute)
         found = true;
     }
 
+    ustring obj_name;
+    if (object_lookup)
+        obj_name = ObjectName.get_string();
+    if (!found) {
+        // Then attributes the renderer declared constant
+        found = rop.shadingsys().find_constant_attribute (obj_name, attr_name,
+                    attr_type, array_lookup ? Index.get_int() : -1, buf);
+    }
+
     if (!found) {
         // If the object name is not supplied, it implies that we are
         // supposed to search the shaded object first, then if that fails,
         // the scene-wide namespace.  We can't do that yet, have to wait
         // until shade time.
-        ustring obj_name;
-        if (object_lookup)
-            obj_name = ObjectName.get_string();
         if (obj_name.empty())
             return 0;
 
@@ -2321,22 +2463,28 @@ DECLFOLDER(constfold_gettextureinfo)
 {
     Opcode &op (rop.inst()->ops()[opnum]);
 
-    // FIXME: For now, punt on constant folding the variety of gettextureinfo
-    // that is passed texture coordinates. Eventually, if we can determine that
-    // the filename is constant and is known to not be UDIM, we can fall back
-    // to the other case.
+    // The variety of gettextureinfo that is passed texture coordinates
+    // only depends on them for UDIM textures; any other constant filename
+    // is folded just like the plain variety.
     bool use_coords = (op.nargs() == 6);
-    if (use_coords)
-        return 0;
+    int dataargnum = use_coords ? 5 : 3;
 
     OSL_MAYBE_UNUSED Symbol& Result(*rop.inst()->argsymbol(op.firstarg() + 0));
     Symbol &Filename (*rop.inst()->argsymbol(op.firstarg()+1));
     Symbol &Dataname (*rop.inst()->argsymbol(op.firstarg() + (use_coords ? 4 : 2)));
-    Symbol &Data (*rop.inst()->argsymbol(op.firstarg() + (use_coords ? 5 : 3)));
+    Symbol &Data (*rop.inst()->argsymbol(op.firstarg() + dataargnum));
     OSL_DASSERT (Result.typespec().is_int() &&
                  Filename.typespec().is_string() &&
                  Dataname.typespec().is_string());
 
+    if (use_coords && Filename.is_constant()) {
+        RendererServices::TextureHandle *handle
+            = rop.renderer()->get_texture_handle (Filename.get_string(),
+                                                  rop.shadingcontext());
+        if (! handle || rop.renderer()->is_udim (handle))
+            return 0;
+    }
+
     if (Filename.is_constant() && Dataname.is_constant()) {
         ustring filename = Filename.get_string();
         ustring dataname = Dataname.get_string();
@@ -2360,7 +2508,7 @@ DECLFOLDER(constfold_gettextureinfo)
         //       assign result 0
         if (result) {
             int oldresultarg = rop.inst()->args()[op.firstarg()+0];
-            int dataarg = rop.inst()->args()[op.firstarg()+3];
+            int dataarg = rop.inst()->args()[op.firstarg()+dataargnum];
             // Make data the first argument
             rop.inst()->args()[op.firstarg()+0] = dataarg;
             // Now turn it into an assignment
@@ -2402,6 +2550,84 @@ DECLFOLDER(constfold_gettextureinfo)
 
 
 
+// Dictionary lookups of constant documents and queries are resolved now,
+// against the store that the shading system's contexts share, so that at
+// run time a dict_find/dict_next/dict_value chain over constants is just
+// the final node IDs and values.
+DECLFOLDER(constfold_dict_find)
+{
+    // dict_find (string dict, string query)
+    // dict_find (int nodeID, string query)
+    Opcode &op (rop.inst()->ops()[opnum]);
+    Symbol &Source (*rop.opargsym (op, 1));
+    Symbol &Query (*rop.opargsym (op, 2));
+    if (! Source.is_constant() || ! Query.is_constant())
+        return 0;
+    int result = 0;
+    bool ok = Source.typespec().is_int()
+        ? rop.shadingsys().fold_dict_find (Source.get_int(), Query.get_string(), result)
+        : rop.shadingsys().fold_dict_find (Source.get_string(), Query.get_string(), result);
+    if (! ok)
+        return 0;   // Leave it to report its error at run time
+    rop.turn_into_assign (op, rop.add_constant (result), "const fold dict_find");
+    return 1;
+}
+
+
+
+DECLFOLDER(constfold_dict_next)
+{
+    // dict_next (int nodeID)
+    Opcode &op (rop.inst()->ops()[opnum]);
+    Symbol &NodeID (*rop.opargsym (op, 1));
+    if (! NodeID.is_constant())
+        return 0;
+    int result = rop.shadingsys().fold_dict_next (NodeID.get_int());
+    rop.turn_into_assign (op, rop.add_constant (result), "const fold dict_next");
+    return 1;
+}
+
+
+
+DECLFOLDER(constfold_dict_value)
+{
+    // int dict_value (int nodeID, string attribname, output TYPE value)
+    Opcode &op (rop.inst()->ops()[opnum]);
+    Symbol &NodeID (*rop.opargsym (op, 1));
+    Symbol &Name (*rop.opargsym (op, 2));
+    Symbol &Value (*rop.opargsym (op, 3));
+    if (! NodeID.is_constant() || ! Name.is_constant())
+        return 0;
+    TypeDesc t = Value.typespec().simpletype();
+    void *mydata = OIIO_ALLOCA(char, t.size());
+    int result = rop.shadingsys().fold_dict_value (NodeID.get_int(),
+                                                   Name.get_string(), t,
+                                                   mydata);
+    if (result) {
+        // Like gettextureinfo, turn it into
+        //       assign value [retrieved value]
+        //       assign result 1
+        int oldresultarg = rop.inst()->args()[op.firstarg()+0];
+        int valuearg = rop.inst()->args()[op.firstarg()+3];
+        rop.inst()->args()[op.firstarg()+0] = valuearg;
+        int cind = rop.add_constant (Value.typespec(), mydata);
+        rop.turn_into_assign (op, cind, "const fold dict_value");
+        const int args_to_add[] = {
+            oldresultarg,
+            rop.add_constant (result)
+        };
+        rop.insert_code (opnum, u_assign, args_to_add,
+                         RuntimeOptimizer::RecomputeRWRanges,
+                         RuntimeOptimizer::GroupWithNext);
+    } else {
+        // Not found: the value is left untouched
+        rop.turn_into_assign_zero (op, "const fold dict_value");
+    }
+    return 1;
+}
+
+
+
 // texture -- we can eliminate a lot of superfluous setting of optional
 // parameters to their default values.
 DECLFOLDER(constfold_texture)
@@ -2848,9 +3074,62 @@ DECLFOLDER(constfold_noise)
 
 
 
+// Would control pass from just after op r to the end of its function's
+// body (at op end) without executing anything? That's what returning does,
+// making such a 'return' (like "if (c) return a; else return b;" at the
+// end of a function) unnecessary.
+static bool
+return_falls_through (RuntimeOptimizer &rop, int body, int r, int end)
+{
+    const OpcodeVec &code (rop.inst()->ops());
+    // Inside a loop, what follows the body is another iteration, not the
+    // end of the function.
+    for (int i = body;  i < r;  ++i) {
+        ustring opname = code[i].opname();
+        if ((opname == u_for || opname == u_while || opname == u_dowhile)
+              && r < code[i].jump(3))
+            return false;
+    }
+    int next = r + 1;
+    while (next < end) {
+        if (code[next].opname() == u_nop) {
+            ++next;
+            continue;
+        }
+        // Reaching the 'else' of an 'if' around us means skipping it
+        int skip_to = -1;
+        for (int i = body;  i < r;  ++i)
+            if (code[i].opname() == u_if && code[i].jump(0) == next
+                  && code[i].jump(0) != code[i].jump(1))
+                skip_to = code[i].jump(1);
+        if (skip_to < 0)
+            return false;
+        next = skip_to;
+    }
+    return true;
+}
+
+
+
 DECLFOLDER(constfold_functioncall)
 {
     Opcode &op (rop.inst()->ops()[opnum]);
+    int changed = 0;
+    // Returns that just go where the code would have gone anyway only
+    // stand in the way of treating the body as straight-line code, which
+    // is what lets constants and aliases flow through it (or what's left
+    // of it once 'if's on newly constant arguments have folded).
+    for (int i = opnum+1, e = op.jump(0);  i < e;  ++i) {
+        Opcode &bodyop (rop.inst()->ops()[i]);
+        if (bodyop.opname() == u_functioncall
+              || bodyop.opname() == u_functioncall_nr) {
+            i = bodyop.jump(0) - 1;   // nested function returns are its own
+        } else if (bodyop.opname() == u_return
+                   && return_falls_through (rop, opnum+1, i, e)) {
+            rop.turn_into_nop (bodyop, "return just falls through");
+            ++changed;
+        }
+    }
     // Make a "functioncall" block disappear if the only non-nop statements
     // inside it is 'return'.
     bool has_return = false;
@@ -2862,7 +3141,6 @@ DECLFOLDER(constfold_functioncall)
         else if (op.opname() != u_nop)
             has_anything_else = true;
     }
-    int changed = 0;
     if (! has_anything_else) {
         // Possibly due to optimizations, there's nothing in the
         // function body but the return.  So just eliminate the whole
@@ -2,11 +2,17 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <cstdio>
 #include <cstdint>
 
+#ifdef __linux__
+#include <sys/mman.h>  /* for madvise */
+#endif
+
+#include <OpenImageIO/strutil.h>
 #include <OpenImageIO/sysutil.h>
 #include <OpenImageIO/timer.h>
 #include <OpenImageIO/thread.h>
@@ -24,7 +30,6 @@
 
 OSL_NAMESPACE_ENTER
 
-static mutex buffered_errors_mutex;
 #if OSL_USE_BATCHED
 static mutex buffered_file_output_mutex;
 #endif
@@ -50,6 +55,33 @@ ShadingContext::ShadingContext (ShadingSystemImpl &shadingsys,
     m_shadingsys.m_stat_contexts += 1;
     m_threadinfo = threadinfo ? threadinfo : shadingsys.get_perthread_info ();
     m_texture_thread_info = NULL;
+    if (size_t reserve = size_t(shadingsys.context_pool_KB()) * 1024) {
+        m_closure_pool.reserve (reserve);
+        m_scratch_pool.reserve (reserve);
+    }
+}
+
+
+
+void
+ShadingContext::reserve_heap (size_t size)
+{
+    if (size <= m_heapsize)
+        return;
+    // With huge_pages, a heap of at least a huge page is aligned to one and
+    // advised to be backed by them, so a big group's data takes a few TLB
+    // entries instead of hundreds.
+    const size_t huge_page_size = 2 << 20;
+    bool huge = shadingsys().huge_pages() && size >= huge_page_size;
+    if (huge)
+        size = (size + huge_page_size - 1) / huge_page_size * huge_page_size;
+    m_heap.reset ((char *)OIIO::aligned_malloc (size, huge ? huge_page_size
+                                                           : OIIO_CACHE_LINE_SIZE));
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (huge && m_heap)
+        madvise (m_heap.get(), size, MADV_HUGEPAGE);
+#endif
+    m_heapsize = size;
 }
 
 
@@ -60,26 +92,93 @@ ShadingContext::~ShadingContext ()
 #if OSL_USE_BATCHED
     process_file_output();
 #endif
+    // A context that was never released may outlive the group it last
+    // profiled, so what has not been merged is lost rather than risk it.
+    m_layer_profile_group = nullptr;
+    release_group ();
+    merge_stats ();
     m_shadingsys.m_stat_contexts -= 1;
     free_dict_resources ();
 }
 
 
 
+void
+ShadingContext::note_executed (ShaderGroup& group)
+{
+    if (shadingsys().m_max_jit_memory_MB <= 0)
+        return;
+    // Only store when it changes, so threads running the group don't
+    // contend for it.
+    int epoch = shadingsys().m_jit_epoch.load (std::memory_order_relaxed);
+    if (group.m_last_executed.load (std::memory_order_relaxed) != epoch)
+        group.m_last_executed.store (epoch, std::memory_order_relaxed);
+}
+
+
+
+void
+ShadingContext::hold_group (ShaderGroup& group)
+{
+    if (m_held_group == &group)
+        return;
+    release_group ();
+    group.m_in_flight.fetch_add (1);
+    while (group.m_evicting.load ()) {
+        // It's being evicted right now. Stand aside until that's done
+        // (the eviction holds the group's lock throughout); then it is
+        // simply compiled again.
+        group.m_in_flight.fetch_sub (1);
+        group.lock ();
+        group.unlock ();
+        group.m_in_flight.fetch_add (1);
+    }
+    m_held_group = &group;
+}
+
+
+
+void
+ShadingContext::release_group ()
+{
+    if (m_held_group) {
+        m_held_group->m_in_flight.fetch_sub (1, std::memory_order_release);
+        m_held_group = nullptr;
+    }
+}
+
+
+
 bool
-ShadingContext::execute_init(ShaderGroup& sgroup, int shadeindex,
-                             ShaderGlobals& ssg, void* userdata_base_ptr,
-                             void* output_base_ptr, bool run)
+ShadingContext::bind_group (ShaderGroup& group, int raytype,
+                            bool allow_async, bool debug)
 {
-    if (m_group)
-        execute_cleanup ();
-    batch_size_executed = 0;
+    // With dedupe_groups, run the identical group whose code this one
+    // shares, and with raytype_variants, its copy for this ray type
+    ShaderGroup& vgroup (shadingsys().raytype_variant (
+        shadingsys().dedupe_group (group), raytype));
+    m_unsampled_group = &vgroup;
+    ShaderGroup& sgroup (debug ? shadingsys().debug_variant (vgroup) : vgroup);
     m_group = &sgroup;
-    m_ticks = 0;
+    note_executed (sgroup);
 
     // Optimize if we haven't already
     if (sgroup.nlayers()) {
+        hold_group (sgroup);
         sgroup.start_running ();
+        if (! sgroup.jitted() && allow_async
+              && shadingsys().m_async_optimize > 0) {
+            // Don't wait for it; run the fallback (compiled here if need
+            // be) until the background threads have it ready.
+            if (! sgroup.m_async_opt_pending.load (std::memory_order_acquire))
+                shadingsys().optimize_group_async (sgroup);
+            if (group.m_fallback_group)
+                return bind_group (*group.m_fallback_group, raytype, false);
+            // Nothing will run, so execute_cleanup won't come to let
+            // the group's code go.
+            release_group ();
+            return false;
+        }
         if (! sgroup.jitted()) {
             auto ctx = shadingsys().get_context(thread_info());
             shadingsys().optimize_group (sgroup, ctx, true /*do_jit*/);
@@ -89,12 +188,38 @@ ShadingContext::execute_init(ShaderGroup& sgroup, int shadeindex,
             }
             shadingsys().release_context(ctx);
         }
-        if (sgroup.does_nothing())
+        if (sgroup.does_nothing()) {
+            release_group ();
             return false;
+        }
+        m_entry_points = sgroup.llvm_entry_points();
+        // Once an instrumented group has been sampled enough, hand it to
+        // the background re-JIT (exactly one thread sees the count hit 0).
+        if (sgroup.m_pgo_samples_left.load (std::memory_order_relaxed) > 0
+            && sgroup.m_pgo_samples_left.fetch_sub (1) == 1)
+            shadingsys().tiered_rejit_enqueue (sgroup);
     } else {
        // empty shader - nothing to do!
        return false;
     }
+    return true;
+}
+
+
+
+bool
+ShadingContext::execute_init(ShaderGroup& group, int shadeindex,
+                             ShaderGlobals& ssg, void* userdata_base_ptr,
+                             void* output_base_ptr, bool run)
+{
+    if (m_group)
+        execute_cleanup ();
+    batch_size_executed = 0;
+    m_ticks = 0;
+    m_entry_points = nullptr;
+    if (! bind_group (group, ssg.raytype, true, debug_sample_next ()))
+        return false;
+    ShaderGroup& sgroup (*m_group);
 
     int profile = shadingsys().m_profile;
     OIIO::Timer timer (profile ? OIIO::Timer::StartNow : OIIO::Timer::DontStartNow);
@@ -111,6 +236,14 @@ ShadingContext::execute_init(ShaderGroup& sgroup, int shadeindex,
 
     // Clear the message blackboard
     m_messages.clear ();
+    clear_lookups ();
+
+    // Results given to resume_traces are for this execution only
+    m_trace_results.swap (m_next_trace_results);
+    m_next_trace_results.clear ();
+    m_trace_requests.clear ();
+    m_trace_calls = 0;
+    m_current_trace = nullptr;
 
     // Clear miscellaneous scratch space
     m_scratch_pool.clear ();
@@ -119,7 +252,8 @@ ShadingContext::execute_init(ShaderGroup& sgroup, int shadeindex,
     clear_runtime_stats ();
 
     if (run) {
-        RunLLVMGroupFunc run_func = sgroup.llvm_compiled_init();
+        RunLLVMGroupFunc run_func = m_entry_points ? m_entry_points->init
+                                                   : nullptr;
         if (!run_func)
             return false;
         ssg.context = this;
@@ -136,6 +270,37 @@ ShadingContext::execute_init(ShaderGroup& sgroup, int shadeindex,
 
 
 
+void
+ShadingContext::execute_next_point (int shadeindex, ShaderGlobals& ssg,
+                                    void* userdata_base_ptr,
+                                    void* output_base_ptr)
+{
+    int profile = shadingsys().m_profile;
+    OIIO::Timer timer (profile ? OIIO::Timer::StartNow : OIIO::Timer::DontStartNow);
+
+    // The group data and messages belong to one point, but the closure and
+    // scratch pools are kept so that earlier points' Ci stays valid.
+    if (shadingsys().m_clearmemory)
+        memset (m_heap.get(), 0, group()->llvm_groupdata_size());
+    m_messages.clear ();
+    clear_lookups ();
+    m_trace_results.clear ();
+    m_trace_requests.clear ();
+    m_trace_calls = 0;
+    m_current_trace = nullptr;
+
+    ssg.context = this;
+    ssg.renderer = renderer();
+    ssg.Ci = NULL;
+    m_entry_points->init (&ssg, m_heap.get(), userdata_base_ptr,
+                          output_base_ptr, shadeindex);
+
+    if (profile)
+        m_ticks += timer.ticks();
+}
+
+
+
 bool
 ShadingContext::execute_layer(int shadeindex, ShaderGlobals& ssg,
                               void* userdata_base_ptr, void* output_base_ptr,
@@ -148,7 +313,8 @@ ShadingContext::execute_layer(int shadeindex, ShaderGlobals& ssg,
     int profile = shadingsys().m_profile;
     OIIO::Timer timer (profile ? OIIO::Timer::StartNow : OIIO::Timer::DontStartNow);
 
-    RunLLVMGroupFunc run_func = group()->llvm_compiled_layer (layernumber);
+    RunLLVMGroupFunc run_func = m_entry_points ? m_entry_points->layer (layernumber)
+                                               : nullptr;
     if (! run_func)
         return false;
 
@@ -177,17 +343,160 @@ ShadingContext::execute_cleanup ()
     process_file_output();
 #endif
 
-    if (shadingsys().m_profile) {
-        record_runtime_stats ();   // Transfer runtime stats to the shadingsys
-        shadingsys().m_stat_total_shading_time_ticks += m_ticks;
-        group()->m_stat_total_shading_time_ticks += m_ticks;
-    }
+    record_pool_peaks ();
+    if (shadingsys().m_profile)
+        record_runtime_stats ();   // Save up runtime stats for merge_stats
+
+    // From here on, the group's code may be evicted
+    release_group ();
 
     return true;
 }
 
 
 
+int
+ShadingContext::trace (ShaderGlobals *sg, RendererServices::TraceOpt &opt,
+                       const Vec3 &P, const Vec3 &dPdx, const Vec3 &dPdy,
+                       const Vec3 &R, const Vec3 &dRdx, const Vec3 &dRdy)
+{
+    // A re-execution makes the same trace() calls in the same order, so
+    // the n-th call is answered by the n-th supplied result.
+    int call = m_trace_calls++;
+    if (call < int(m_trace_results.size())) {
+        m_current_trace = &m_trace_results[call];
+        return m_current_trace->hit;
+    }
+    m_current_trace = nullptr;
+    if (! shadingsys().m_deferred_trace)
+        return renderer()->trace (opt, sg, P, dPdx, dPdy, R, dRdx, dRdy);
+    m_trace_requests.push_back ({ opt, P, dPdx, dPdy, R, dRdx, dRdy });
+    return 0;
+}
+
+
+
+bool
+ShadingContext::execute_many (ShaderGroup &sgroup, span<ShaderGlobals> globals,
+                              cspan<int> shadeindices,
+                              void* userdata_base_ptr, void* output_base_ptr)
+{
+    OSL_DASSERT (shadeindices.empty() || shadeindices.size() == globals.size());
+    bool result = true;
+    if (sgroup.m_exec_repeat > 1) {
+        // Repeats are for timing single executions; do it the long way.
+        for (size_t i = 0, n = globals.size(); i < n; ++i)
+            result &= execute (sgroup, shadeindices.size() ? shadeindices[i] : int(i),
+                               globals[i], userdata_base_ptr, output_base_ptr,
+                               true);
+        return result;
+    }
+
+    bool runnable = false;
+    for (size_t i = 0, n = globals.size(); i < n; ++i) {
+        ShaderGlobals &ssg (globals[i]);
+        int shadeindex = shadeindices.size() ? shadeindices[i] : int(i);
+        if (i == 0) {
+            runnable = execute_init (sgroup, shadeindex, ssg,
+                                     userdata_base_ptr, output_base_ptr, true);
+        } else {
+            // Points of a different ray type may need another variant,
+            // and with debug_sample, the sampled points the debug one
+            // (and the points after them the regular one again).
+            ShaderGroup& dgroup (shadingsys().dedupe_group (sgroup));
+            bool debug = debug_sample_next ();
+            if (&shadingsys().raytype_variant (dgroup, ssg.raytype) != m_unsampled_group
+                  || debug || m_group != m_unsampled_group) {
+                m_entry_points = nullptr;
+                runnable = bind_group (sgroup, ssg.raytype, true, debug)
+                           && m_entry_points && m_entry_points->init;
+                if (runnable)
+                    reserve_heap (group()->llvm_groupdata_size());
+            }
+            if (runnable)
+                execute_next_point (shadeindex, ssg, userdata_base_ptr,
+                                    output_base_ptr);
+        }
+        if (runnable)
+            execute_layer (shadeindex, ssg, userdata_base_ptr, output_base_ptr,
+                           group()->nlayers() - 1);
+        else
+            result = false;
+    }
+    if (group())
+        result &= execute_cleanup ();
+    return result;
+}
+
+
+
+void
+ShadingContext::merge_stats ()
+{
+    ShadingSystemImpl &ss (shadingsys());
+    if (m_merge_get_userdata_calls) {
+        ss.m_stat_get_userdata_calls += m_merge_get_userdata_calls;
+        m_merge_get_userdata_calls = 0;
+    }
+    if (m_merge_layers_executed) {
+        ss.m_stat_layers_executed += m_merge_layers_executed;
+        m_merge_layers_executed = 0;
+    }
+    if (m_merge_noise_calls) {
+        ss.m_stat_noise_calls += m_merge_noise_calls;
+        m_merge_noise_calls = 0;
+    }
+    if (m_merge_shading_ticks) {
+        ss.m_stat_total_shading_time_ticks += m_merge_shading_ticks;
+        m_merge_shading_ticks = 0;
+        // Keep the entries (zeroed) so that m_merge_group_ticks stays
+        // valid and later executions don't allocate.
+        spin_lock lock (ss.m_stat_mutex);
+        for (auto& g : m_merge_group_times) {
+            if (g.second) {
+                ss.m_group_profile_times[g.first] += g.second;
+                g.second = 0;
+            }
+        }
+    }
+    merge_layer_profile ();
+    if (m_call_site_profile.size()) {
+        spin_lock lock (ss.m_stat_mutex);
+        for (size_t i = 0, n = std::min (m_call_site_profile.size(),
+                                         ss.m_call_sites.size());  i < n;  ++i)
+            ss.m_call_sites[i].profile += m_call_site_profile[i];
+        // Keep the entries (zeroed) so that later executions don't allocate
+        std::fill (m_call_site_profile.begin(), m_call_site_profile.end(),
+                   CallSiteProfile());
+    }
+    if (m_profile_block_execs.size()) {
+        spin_lock lock (ss.m_stat_mutex);
+        for (size_t i = 0, n = std::min (m_profile_block_execs.size(),
+                                         ss.m_profile_blocks.size());  i < n;  ++i)
+            ss.m_profile_blocks[i].execs += m_profile_block_execs[i];
+        std::fill (m_profile_block_execs.begin(), m_profile_block_execs.end(), 0);
+    }
+}
+
+
+
+void
+ShadingContext::merge_layer_profile ()
+{
+    if (m_layer_profile_group) {
+        spin_lock lock (shadingsys().m_stat_mutex);
+        auto &prof (m_layer_profile_group->m_layer_profile);
+        if (prof.size() < m_layer_profile.size())
+            prof.resize (m_layer_profile.size());
+        for (size_t i = 0, n = m_layer_profile.size();  i < n;  ++i)
+            prof[i] += m_layer_profile[i];
+        m_layer_profile_group = nullptr;
+    }
+    m_layer_profile.clear ();
+}
+
+
+
 bool
 ShadingContext::execute (ShaderGroup &sgroup, int shadeindex,
                          ShaderGlobals &ssg, void* userdata_base_ptr,
@@ -232,7 +541,7 @@ ShadingContext::execute (ShaderGroup &sgroup, int shadeindex,
 
 template<int WidthT>
 bool
-ShadingContext::Batched<WidthT>::execute_init( ShaderGroup &sgroup,
+ShadingContext::Batched<WidthT>::execute_init( ShaderGroup &group,
                                                int batch_size,
                                                Wide<const int, WidthT> wide_shadeindex,
                                                BatchedShaderGlobals<WidthT> &bsg,
@@ -242,12 +551,16 @@ ShadingContext::Batched<WidthT>::execute_init( ShaderGroup &sgroup,
     if (context().m_group)
         context().execute_cleanup ();
 
+    // With dedupe_groups, run the identical group whose code this one shares
+    ShaderGroup& sgroup (shadingsys().dedupe_group (group));
+    context().note_executed (sgroup);
     context().batch_size_executed = batch_size;
     context().m_group = &sgroup;
     context().m_ticks = 0;
 
     // Optimize if we haven't already
     if (sgroup.nlayers()) {
+        context().hold_group (sgroup);
         sgroup.start_running ();
         if (! sgroup.batch_jitted()) {
             // Matching ShadingContext::execute_init behavior
@@ -263,6 +576,13 @@ ShadingContext::Batched<WidthT>::execute_init( ShaderGroup &sgroup,
             }
             shadingsys().release_context(ctx);
         }
+        if (sgroup.batch_jitted() != WidthT) {
+            // Its wide code was made at another width (or not at all)
+            context().errorfmt("Shader group \"{}\" was not JITed {} wide",
+                               sgroup.name(), WidthT);
+            context().release_group ();
+            return false;
+        }
         // To handle layers that were not used but still possibly had
         // render outputs, we always generate a run function even for
         // do nothing groups, so that a GroupData on the heap gets built
@@ -293,6 +613,7 @@ ShadingContext::Batched<WidthT>::execute_init( ShaderGroup &sgroup,
     // Clear the message blackboard
     context().m_messages.clear ();
     context().batched_messages_buffer().clear ();
+    context().clear_lookups ();
 
     // Clear miscellaneous scratch space
     context().m_scratch_pool.clear ();
@@ -407,9 +728,11 @@ ShadingContext::Batched<WidthT>::execute(ShaderGroup &sgroup, int batch_size,
 
 void
 ShadingContext::record_error (ErrorHandler::ErrCode code,
-                              const std::string &text, Mask<MaxSupportedSimdLaneCount> mask) const
+                              string_view text, Mask<MaxSupportedSimdLaneCount> mask) const
 {
-    m_buffered_errors.emplace_back (code,text, mask);
+    m_buffered_errors.push_back ({ code, uint32_t(m_buffered_text.size()),
+                                   uint32_t(text.size()), false, mask });
+    m_buffered_text.append (text.data(), text.size());
     // If we aren't buffering, just process immediately
     if (! shadingsys().m_buffer_printf)
         process_errors ();
@@ -417,18 +740,24 @@ ShadingContext::record_error (ErrorHandler::ErrCode code,
 
 void
 ShadingContext::record_to_file (ustring filename,
-                              const std::string &text, Mask<MaxSupportedSimdLaneCount> mask) const
+                              string_view text, Mask<MaxSupportedSimdLaneCount> mask) const
 {
-    m_buffered_file_output.emplace_back (filename,text, mask);
+    m_buffered_file_output.push_back ({ filename,
+                                        uint32_t(m_buffered_file_text.size()),
+                                        uint32_t(text.size()), mask });
+    m_buffered_file_text.append (text.data(), text.size());
 }
 
 #endif
 
 void
 ShadingContext::record_error (ErrorHandler::ErrCode code,
-                              const std::string &text) const
+                              string_view text) const
 {
-    m_buffered_errors.emplace_back(code,text);
+    m_buffered_errors.push_back ({ code, uint32_t(m_buffered_text.size()),
+                                   uint32_t(text.size()), false,
+                                   Mask<MaxSupportedSimdLaneCount>(true) });
+    m_buffered_text.append (text.data(), text.size());
     // If we aren't buffering, just process immediately
     if (! shadingsys().m_buffer_printf)
         process_errors ();
@@ -438,7 +767,7 @@ ShadingContext::record_error (ErrorHandler::ErrCode code,
 // separate declaration from definition of template function
 // to ensure noinline is respected
 template<typename ErrorsT, typename TestFunctorT>
-static OSL_NOINLINE void process_errors_helper (ShadingSystemImpl &shading_sys, const ErrorsT &errors, int startAtError, int endBeforeError, const TestFunctorT & test_func);
+static OSL_NOINLINE void process_errors_helper (ShadingSystemImpl &shading_sys, const ErrorsT &errors, const std::string &text, std::string &msg, int startAtError, int endBeforeError, const TestFunctorT & test_func);
 
 // Given array of ErrorItems emit errors within the range startAtError to
 // endBeforeError if and only if the test_func passed each ErrorItem's mask
@@ -446,33 +775,57 @@ static OSL_NOINLINE void process_errors_helper (ShadingSystemImpl &shading_sys,
 // each data lane separately effectively serializing emission of errors,
 // warnings, info, and messages
 template<typename ErrorsT, typename TestFunctorT>
-void process_errors_helper (ShadingSystemImpl &shading_sys, const ErrorsT &errors, int startAtError, int endBeforeError, const TestFunctorT & test_func)
+void process_errors_helper (ShadingSystemImpl &shading_sys, const ErrorsT &errors, const std::string &text, std::string &msg, int startAtError, int endBeforeError, const TestFunctorT & test_func)
 {
     for (int i = startAtError;  i < endBeforeError;  ++i) {
         const auto & error_item = errors[i];
-        if (test_func(error_item.mask)) {
-            switch (errors[i].err_code) {
-            case ErrorHandler::EH_MESSAGE :
-            case ErrorHandler::EH_DEBUG :
-                shading_sys.message (error_item.msgString);
-                break;
-            case ErrorHandler::EH_INFO :
-                shading_sys.info (error_item.msgString);
-                break;
-            case ErrorHandler::EH_WARNING :
-                shading_sys.warning (error_item.msgString);
-                break;
-            case ErrorHandler::EH_ERROR :
-            case ErrorHandler::EH_SEVERE :
-                shading_sys.error (error_item.msgString);
-                break;
-            default:
-                break;
-            }
+        if (! error_item.repeat && test_func(error_item.mask)) {
+            // Reuses msg's storage rather than making a new string
+            msg.assign (text, error_item.begin, error_item.size);
+            shading_sys.report_locked (error_item.err_code, msg);
+        }
+    }
+}
+
+
+
+// Unless error_repeats is set, the shading system would only drop an error
+// or warning identical to one it has recently seen, after taking its lock
+// and comparing against each. A shader that fails at every point repeats
+// the same few messages many times over, so weed those out here first:
+// sort by hash, and mark any that match an earlier one of its kind.
+void
+ShadingContext::mark_repeated_errors () const
+{
+    m_buffered_hashes.clear ();
+    for (int i = 0, e = int(m_buffered_errors.size()); i < e; ++i) {
+        const ErrorItem &item (m_buffered_errors[i]);
+        if (item.err_code == ErrorHandler::EH_WARNING
+            || item.err_code == ErrorHandler::EH_ERROR
+            || item.err_code == ErrorHandler::EH_SEVERE) {
+            size_t h = Strutil::strhash (buffered_text (item.begin, item.size));
+            m_buffered_hashes.emplace_back (h * 31 + size_t(item.err_code), i);
+        }
+    }
+    if (m_buffered_hashes.size() < 2)
+        return;
+    std::sort (m_buffered_hashes.begin(), m_buffered_hashes.end());
+    size_t first = 0;
+    for (size_t i = 1, e = m_buffered_hashes.size(); i < e; ++i) {
+        if (m_buffered_hashes[i].first != m_buffered_hashes[first].first) {
+            first = i;
+            continue;
         }
+        const ErrorItem &a (m_buffered_errors[m_buffered_hashes[first].second]);
+        ErrorItem &b (m_buffered_errors[m_buffered_hashes[i].second]);
+        if (a.err_code == b.err_code
+            && buffered_text (a.begin, a.size) == buffered_text (b.begin, b.size))
+            b.repeat = true;
     }
 }
 
+
+
 void
 ShadingContext::process_errors () const
 {
@@ -480,10 +833,13 @@ ShadingContext::process_errors () const
     if (! nerrors)
         return;
 
-    // Use a mutex to make sure output from different threads stays
-    // together, at least for one shader invocation, rather than being
-    // interleaved with other threads.
-    lock_guard lock (buffered_errors_mutex);
+    if (! shadingsys().m_error_repeats)
+        mark_repeated_errors ();
+
+    // Hold the error lock for the whole batch to make sure output from
+    // different threads stays together, at least for one shader
+    // invocation, rather than being interleaved with other threads.
+    lock_guard lock (shadingsys().m_errmutex);
 
 #if OSL_USE_BATCHED
     if (execution_is_batched()) {
@@ -491,7 +847,8 @@ ShadingContext::process_errors () const
         // Process each data lane separately and in the correct order
         for(int lane=0; lane < batch_size_executed; ++lane) {
             OSL_INTEL_PRAGMA(noinline)
-            process_errors_helper(shadingsys(), m_buffered_errors, 0, nerrors,
+            process_errors_helper(shadingsys(), m_buffered_errors,
+                                  m_buffered_text, m_buffered_msg, 0, nerrors,
                 // Test Function returns true to process the ErrorItem
                 [=](Mask<MaxSupportedSimdLaneCount> mask)->bool
                 {
@@ -503,7 +860,8 @@ ShadingContext::process_errors () const
     {
         // Non-batch errors: ignore the mask, just print them out once
         OSL_INTEL_PRAGMA(noinline)
-        process_errors_helper(shadingsys(), m_buffered_errors, 0, nerrors,
+        process_errors_helper(shadingsys(), m_buffered_errors,
+                              m_buffered_text, m_buffered_msg, 0, nerrors,
             // Test Function returns true to process the ErrorItem
             [=](Mask<MaxSupportedSimdLaneCount> /*mask*/)->bool
             {
@@ -511,6 +869,7 @@ ShadingContext::process_errors () const
             });
     }
     m_buffered_errors.clear();
+    m_buffered_text.clear();
 }
 
 #if OSL_USE_BATCHED
@@ -536,12 +895,14 @@ ShadingContext::process_file_output () const
                 // TODO: if performance critical, one could keep a cache of
                 // open files instead of closing and reopening
                 FILE *file = fopen (item.filename.c_str(), "a");
-                fputs (item.msgString.c_str(), file);
+                fwrite (m_buffered_file_text.data() + item.begin, 1,
+                        item.size, file);
                 fclose (file);
             }
         }
     }
     m_buffered_file_output.clear();
+    m_buffered_file_text.clear();
 }
 #endif
 
@@ -592,17 +953,146 @@ ShadingContext::symbol_data (const Symbol &sym) const
 
 
 
-const std::regex&
+const ShadingContext::TextureHandleEntry &
+ShadingContext::texture_handle (ustring filename)
+{
+    // Just a handful of entries, so a linear search with move-to-front
+    // beats any hashing.
+    for (int i = 0;  i < m_ntexture_handles;  ++i) {
+        if (m_texture_handles[i].filename == filename) {
+            if (i)
+                std::rotate (m_texture_handles, m_texture_handles + i,
+                             m_texture_handles + i + 1);
+            return m_texture_handles[0];
+        }
+    }
+    // Miss: take an unused slot, or else the least recently used one,
+    // and move it to the front.
+    int slot = std::min (m_ntexture_handles, TextureHandleCacheSize - 1);
+    m_ntexture_handles = std::min (m_ntexture_handles + 1, TextureHandleCacheSize);
+    std::rotate (m_texture_handles, m_texture_handles + slot,
+                 m_texture_handles + slot + 1);
+    TextureHandleEntry &e (m_texture_handles[0]);
+    e.filename = filename;
+    e.handle = renderer()->get_texture_handle (filename, this);
+    e.good = e.handle && renderer()->good (e.handle);
+    e.udim = e.handle && renderer()->is_udim (e.handle);
+    return e;
+}
+
+
+
+TextureSystem::TextureHandle *
+ShadingContext::resolve_udim (TextureSystem *ts,
+                              TextureSystem::TextureHandle *udim,
+                              TextureSystem::Perthread *perthread,
+                              float s, float t)
+{
+#if OIIO_VERSION >= 20307
+    // Which tile a UDIM lookup lands on depends only on the integer parts
+    // of s and t, so those (and the set) are the whole key.
+    int utile = OIIO::ifloor (s);
+    int vtile = OIIO::ifloor (t);
+    for (int i = 0;  i < m_nudim_tiles;  ++i) {
+        const UdimTileEntry &e (m_udim_tiles[i]);
+        if (e.udim == udim && e.utile == utile && e.vtile == vtile) {
+            if (i)
+                std::rotate (m_udim_tiles, m_udim_tiles + i,
+                             m_udim_tiles + i + 1);
+            return m_udim_tiles[0].tile;
+        }
+    }
+    int slot = std::min (m_nudim_tiles, UdimTileCacheSize - 1);
+    m_nudim_tiles = std::min (m_nudim_tiles + 1, UdimTileCacheSize);
+    std::rotate (m_udim_tiles, m_udim_tiles + slot, m_udim_tiles + slot + 1);
+    m_udim_tiles[0] = { udim, utile, vtile,
+                        ts->resolve_udim (udim, perthread, s, t) };
+    return m_udim_tiles[0].tile;
+#else
+    return nullptr;
+#endif
+}
+
+
+
+const CompiledRegex&
 ShadingContext::find_regex (ustring r)
 {
     RegexMap::const_iterator found = m_regex_map.find (r);
     if (found != m_regex_map.end())
         return *found->second;
-    // otherwise, it wasn't found, add it
-    m_regex_map[r].reset(new std::regex(r.c_str()));
-    m_shadingsys.m_stat_regexes += 1;
-    // std::cerr << "Made new regex for " << r << "\n";
-    return *m_regex_map[r];
+    // otherwise, it wasn't found, get it from the shading system
+    const CompiledRegex &regex (m_shadingsys.find_regex (r));
+    m_regex_map[r] = &regex;
+    return regex;
+}
+
+
+
+const CompiledRegex&
+ShadingSystemImpl::find_regex (ustring pattern)
+{
+    spin_lock lock (m_regexes_mutex);
+    std::unique_ptr<CompiledRegex> &regex (m_regexes[pattern]);
+    if (! regex) {
+        try {
+            regex.reset (new CompiledRegex (pattern));
+        } catch (...) {
+            m_regexes.erase (pattern);
+            throw;
+        }
+        m_stat_regexes += 1;
+    }
+    return *regex;
+}
+
+
+
+CompiledRegex::CompiledRegex (ustring pattern_)
+    : pattern(pattern_), regex(pattern_.c_str()),
+      literal(pattern_.size() &&
+              pattern_.find_first_of ("^$\\.|?*+()[]{}") == ustring::npos)
+{
+}
+
+
+
+int
+CompiledRegex::match (const std::string &subject, int *results,
+                      int nresults, bool fullmatch) const
+{
+    if (literal) {
+        // Plain text: the whole match is the only group there is.
+        size_t pos = fullmatch ? (subject == pattern.string() ? 0 : std::string::npos)
+                               : subject.find (pattern.string());
+        bool res = (pos != std::string::npos);
+        for (int r = 0;  r < nresults;  ++r) {
+            if (res && r < 2)
+                results[r] = int(r == 0 ? pos : pos + pattern.length());
+            else
+                results[r] = int(pattern.length());
+        }
+        return res;
+    }
+    if (nresults > 0) {
+        std::match_results<std::string::const_iterator> mresults;
+        std::string::const_iterator start = subject.begin();
+        int res = fullmatch ? std::regex_match(subject, mresults, regex)
+                            : std::regex_search(subject, mresults, regex);
+        for (int r = 0;  r < nresults;  ++r) {
+            if (r/2 < (int)mresults.size()) {
+                if ((r & 1) == 0)
+                    results[r] = mresults[r/2].first - start;
+                else
+                    results[r] = mresults[r/2].second - start;
+            } else {
+                results[r] = pattern.length();
+            }
+        }
+        return res;
+    }
+    return fullmatch ? std::regex_match(subject, regex)
+                     : std::regex_search(subject, regex);
 }
 
 
@@ -612,7 +1102,8 @@ ShadingContext::osl_get_attribute (ShaderGlobals *sg, void *objdata,
                                    int dest_derivs,
                                    ustring obj_name, ustring attr_name,
                                    int array_lookup, int index,
-                                   TypeDesc attr_type, void *attr_dest)
+                                   TypeDesc attr_type, void *attr_dest,
+                                   void *attr_handle)
 {
 #if 0
     // Change the #if's below if you want to
@@ -620,7 +1111,36 @@ ShadingContext::osl_get_attribute (ShaderGlobals *sg, void *objdata,
 #endif
     bool ok;
 
-    if (array_lookup)
+    int cache_index = array_lookup ? index : -1;
+    size_t size = attr_type.size() * (dest_derivs ? 3 : 1);
+    bool per_object = object_lookup (attr_name);
+    bool cache = per_object || shadingsys().cache_lookups();
+    if (cache) {
+        if (auto e = find_lookup (LookupAttribute, 1, obj_name, attr_name,
+                                  attr_type, cache_index, dest_derivs,
+                                  per_object)) {
+            if (e->ok)
+                memcpy (attr_dest, lookup_data(*e), size);
+            if (capturing())
+                capture_lookup (LookupAttribute, obj_name, attr_name,
+                                attr_type, cache_index, dest_derivs, e->ok,
+                                attr_dest, size);
+            return e->ok;
+        }
+    }
+
+    if (replaying()) {
+        auto c = replay_lookup (LookupAttribute, obj_name, attr_name,
+                                attr_type, cache_index, dest_derivs);
+        ok = c && c->ok;
+        if (ok)
+            memcpy (attr_dest, c->data.data(), size);
+    } else if (attr_handle)
+        ok = renderer()->get_attribute_by_handle (sg, attr_handle, dest_derivs,
+                                                  obj_name, attr_type,
+                                                  attr_name, cache_index,
+                                                  attr_dest);
+    else if (array_lookup)
         ok = renderer()->get_array_attribute (sg, dest_derivs,
                                               obj_name, attr_type,
                                               attr_name, index, attr_dest);
@@ -628,6 +1148,19 @@ ShadingContext::osl_get_attribute (ShaderGlobals *sg, void *objdata,
         ok = renderer()->get_attribute (sg, dest_derivs,
                                         obj_name, attr_type,
                                         attr_name, attr_dest);
+    if (capturing())
+        capture_lookup (LookupAttribute, obj_name, attr_name, attr_type,
+                        cache_index, dest_derivs, ok, attr_dest, size);
+
+    if (cache) {
+        auto& e = add_lookup (LookupAttribute, 1, obj_name, attr_name,
+                              attr_type, cache_index, dest_derivs,
+                              ok ? size : 0, per_object);
+        e.fetched = 1;
+        e.ok = ok;
+        if (ok)
+            memcpy (lookup_data(e), attr_dest, size);
+    }
 
 #if 0
     double time = timer();
@@ -642,6 +1175,39 @@ ShadingContext::osl_get_attribute (ShaderGlobals *sg, void *objdata,
 
 
 
+ShadingContext::LookupCacheEntry *
+ShadingContext::find_lookup (LookupKind kind, int width, ustring object,
+                             ustring name, TypeDesc type, int index,
+                             bool derivs, bool per_object)
+{
+    // Only a handful of distinct lookups happen per point, so a linear
+    // search is cheaper than hashing.
+    for (auto& e : per_object ? m_object_lookups : m_lookups)
+        if (e.name == name && e.kind == kind && e.width == width
+            && e.object == object && e.type == type && e.index == index
+            && e.derivs == derivs)
+            return &e;
+    return nullptr;
+}
+
+
+
+ShadingContext::LookupCacheEntry &
+ShadingContext::add_lookup (LookupKind kind, int width, ustring object,
+                            ustring name, TypeDesc type, int index,
+                            bool derivs, size_t size, bool per_object)
+{
+    auto& lookups (per_object ? m_object_lookups : m_lookups);
+    auto& data (per_object ? m_object_lookup_data : m_lookup_data);
+    LookupCacheEntry e { kind, width, object, name, type, index, derivs,
+                         0, 0, data.size(), per_object };
+    data.resize (data.size() + size);
+    lookups.push_back (e);
+    return lookups.back();
+}
+
+
+
 OSL_SHADEOP void
 osl_incr_layers_executed (ShaderGlobals *sg)
 {
@@ -649,10 +1215,56 @@ osl_incr_layers_executed (ShaderGlobals *sg)
     ctx->incr_layers_executed ();
 }
 
+
+
+OSL_SHADEOP void
+osl_layer_profile_begin (ShaderGlobals *sg, int layer)
+{
+    ShadingContext *ctx = (ShadingContext *)sg->context;
+    ctx->layer_profile_begin (layer);
+}
+
+
+
+OSL_SHADEOP void
+osl_layer_profile_end (ShaderGlobals *sg)
+{
+    ShadingContext *ctx = (ShadingContext *)sg->context;
+    ctx->layer_profile_end ();
+}
+
+
+
+OSL_SHADEOP void
+osl_call_site_begin (ShaderGlobals *sg)
+{
+    ShadingContext *ctx = (ShadingContext *)sg->context;
+    ctx->call_site_begin ();
+}
+
+
+
+OSL_SHADEOP void
+osl_call_site_end (ShaderGlobals *sg, int site, int result)
+{
+    ShadingContext *ctx = (ShadingContext *)sg->context;
+    ctx->call_site_end (site, result != 0);
+}
+
+
+
+OSL_SHADEOP void
+osl_profile_block (ShaderGlobals *sg, int block)
+{
+    ShadingContext *ctx = (ShadingContext *)sg->context;
+    ctx->profile_block (block);
+}
+
 #if OSL_USE_BATCHED
 // Explicit template instantiation for supported batch sizes
 template class ShadingContext::Batched<16>;
 template class ShadingContext::Batched<8>;
+template class ShadingContext::Batched<4>;
 #endif
 
 
@@ -7,8 +7,12 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cctype>
+#include <cstring>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 
+#include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/strutil.h>
 
 #include <pugixml.hpp>
@@ -25,6 +29,84 @@ OSL_NAMESPACE_ENTER
 namespace pvt {   // OSL::pvt
 
 
+// A JSON dictionary, parsed once into a flat table of nodes.  The
+// children of each array or object are contiguous in m_children, so an
+// array subscript is a direct index, and every object member is also
+// entered in a hash table keyed by (object, member name), so each step
+// of a key path costs one hash probe rather than an XPath evaluation.
+//
+// Queries are key paths: member names separated by '.', each optionally
+// followed by array subscripts, e.g. "assets.hero.cameras[1].name".  A
+// '*' in place of a name or a subscript matches every member or element.
+// A leading '$' (JSONPath style) names the starting node and is ignored.
+class JsonDocument {
+public:
+    enum Kind { Null, Bool, Number, String, Array, Object };
+    struct Node {
+        Kind kind = Null;
+        int first = 0, count = 0;  // children are m_children[first..+count)
+        ustring text;              // scalars: the value (strings unescaped)
+    };
+
+    // Parse the document, whose root becomes node 0.  On failure, set
+    // 'err' and the 'offset' in the text at which parsing stopped.
+    bool parse (string_view text, std::string &err, size_t &offset);
+
+    // Append to 'matches' the nodes that 'query' reaches from node
+    // 'root', in document order.  Return false if the query is malformed.
+    bool find (int root, string_view query, std::vector<int> &matches,
+               std::string &err) const;
+
+    // The member of object 'node' with the given name, or -1.
+    int member (int node, ustring name) const {
+        auto found = m_members.find (MemberKey { node, name });
+        return found == m_members.end() ? -1 : found->second;
+    }
+
+    // The value of 'node' as text for dict_value to decode: a scalar as
+    // written (bools as 1 or 0 if 'numeric'), or the elements of an array
+    // of scalars separated by commas.  Objects and nulls have no value.
+    bool value (int node, bool numeric, std::string &text) const;
+
+private:
+    struct MemberKey {
+        int object;
+        ustring name;
+        bool operator== (const MemberKey &k) const {
+            return object == k.object && name == k.name;
+        }
+    };
+    struct MemberHash {
+        size_t operator() (const MemberKey &key) const {
+            return key.name.hash() + 17*key.object;
+        }
+    };
+
+    std::vector<Node> m_nodes;
+    std::vector<int> m_children;
+    std::unordered_map<MemberKey, int, MemberHash> m_members;
+
+    // Parser state, only used during parse()
+    const char *m_begin = nullptr, *m_p = nullptr, *m_end = nullptr;
+    std::string m_error;
+
+    void skip_space ();
+    int parse_value (int depth);
+    bool parse_string (std::string &s);
+    void add_children (int node, std::vector<int> &list) const {
+        const Node &n (m_nodes[node]);
+        list.insert (list.end(), m_children.begin() + n.first,
+                     m_children.begin() + n.first + n.count);
+    }
+    static string_view scalar (const Node &n, bool numeric) {
+        if (n.kind == Bool && numeric)
+            return n.text == "true" ? "1" : "0";
+        return n.text;
+    }
+};
+
+
+
 // Helper class to manage the dictionaries.
 //
 // Shaders are written as if they parse arbitrary things from whole
@@ -37,28 +119,39 @@ namespace pvt {   // OSL::pvt
 // We have parsed xml (as pugi::xml_document *'s) cached in a hash table,
 // looked up by the xml and/or dictionary name.  Either will do, if it
 // looks like a filename, it will read the XML from the file, otherwise it
-// will interpret it as xml directly.
+// will interpret it as xml directly.  A name ending in ".json", or text
+// starting with '{' or '[', is a JSON document instead, which is held
+// as a JsonDocument and queried by key path rather than by XPath.
 //
 // Also, individual queries are cached in a hash table.  The key is a
 // tuple of (nodeID, query_string, type_requested), so that asking for a
 // particular query to return a string is a totally different cache
 // entry than asking for it to be converted to a matrix, say.
 //
+// One Dictionary is shared by all the contexts of a ShadingSystem, so
+// each document is parsed and held only once, and node IDs mean the same
+// thing on every thread.  Its methods are serialized by a mutex; each
+// context puts a DictionaryCache in front of it so that repeated queries
+// don't take the lock at all.  The ctx passed to each call is only used
+// to report errors.
+//
 class Dictionary {
 public:
-    Dictionary (ShadingContext *ctx) : m_context(ctx)
+    Dictionary ()
     {
         // Create placeholder element 0 == 'not found'
         m_nodes.emplace_back(0, pugi::xml_node());
     }
-    ~Dictionary () {
-        // Free all the documents.
-        for (auto& doc : m_documents)
-            delete doc;
-    }
 
-    int dict_find (ustring dictionaryname, ustring query);
-    int dict_find (int nodeID, ustring query);
+    // The dict_find variants set 'cacheable' to false for results that
+    // came with an error, which should not be remembered by a front cache
+    // lest the error only be reported once per thread.  A NULL ctx asks
+    // for no errors to be reported at all, and for a document that fails
+    // to parse not to be remembered either.
+    int dict_find (ShadingContext *ctx, ustring dictionaryname,
+                   ustring query, bool &cacheable);
+    int dict_find (ShadingContext *ctx, int nodeID, ustring query,
+                   bool &cacheable);
     int dict_next (int nodeID);
     int dict_value (int nodeID, ustring attribname, TypeDesc type, void *data);
 
@@ -103,18 +196,25 @@ private:
     struct Node {
         int document;         // which document the node belongs to
         pugi::xml_node node;  // which node within the dictionary
+        int json;             // or which node of a JSON document, else -1
         int next;             // next node for the same query
-        Node (int d, const pugi::xml_node &n)
-            : document(d), node(n), next(0) { }
+        Node (int d, const pugi::xml_node &n, int j = -1)
+            : document(d), node(n), json(j), next(0) { }
+    };
+
+    // A document is either XML or JSON.
+    struct Document {
+        std::unique_ptr<pugi::xml_document> xml;
+        std::unique_ptr<JsonDocument> json;
     };
 
     typedef std::unordered_map <Query, QueryResult, QueryHash> QueryMap;
     typedef std::unordered_map<ustring, int, ustringHash> DocMap;
 
-    ShadingContext *m_context;  // back-pointer to shading context
+    std::mutex m_mutex;
 
-    // List of XML documents we've read in.
-    std::vector<pugi::xml_document *> m_documents;
+    // List of documents we've read in.
+    std::vector<Document> m_documents;
 
     // Map xml strings and/or filename to indices in m_documents.
     DocMap m_document_map;
@@ -132,33 +232,485 @@ private:
     std::vector<ustring> m_stringdata;
 
     // Helper function: return the document index given dictionary name.
-    int get_document_index (ustring dictionaryname);
+    int get_document_index (ShadingContext *ctx, ustring dictionaryname);
+
+    // Helper function: resolve query q from node 'root' of the JSON
+    // document q.document, and record and cache its matches.
+    int find_json (ShadingContext *ctx, const Query &q, int root,
+                   bool &cacheable);
 };
 
 
 
+// Per-context front cache of Dictionary results.  Everything the shared
+// Dictionary hands out is immutable -- documents are never modified and
+// node IDs are never reused -- so a context may remember any answer and
+// give it again without consulting the shared store.
+class DictionaryCache {
+public:
+    DictionaryCache (Dictionary &store) : m_store(store) { }
+
+    int dict_find (ShadingContext *ctx, ustring dictionaryname, ustring query);
+    int dict_find (ShadingContext *ctx, int nodeID, ustring query);
+    int dict_next (int nodeID);
+    int dict_value (int nodeID, ustring attribname, TypeDesc type, void *data);
+
+private:
+    enum Kind { FindRoot, FindNode, Next, Value };
+    struct Key {
+        Kind kind;
+        int node;
+        ustring dictionary;  // FindRoot only
+        ustring name;        // query, or attribute name
+        TypeDesc type;       // Value only
+        bool operator== (const Key &k) const {
+            return kind == k.kind && node == k.node && name == k.name &&
+                   dictionary == k.dictionary && type == k.type;
+        }
+    };
+    struct KeyHash {
+        size_t operator() (const Key &key) const {
+            return key.name.hash() + 31*key.dictionary.hash() +
+                   17*key.node + 7*int(key.kind);
+        }
+    };
+    // For Value entries, 'result' is dict_value's return and 'offset'
+    // locates the copy of the value in m_values.
+    struct Entry {
+        int result;
+        size_t offset;
+    };
+
+    Dictionary &m_store;
+    std::unordered_map<Key, Entry, KeyHash> m_cache;
+    std::vector<char> m_values;
+};
+
+
+
+void
+JsonDocument::skip_space ()
+{
+    while (m_p < m_end && (*m_p == ' ' || *m_p == '\t' ||
+                           *m_p == '\n' || *m_p == '\r'))
+        ++m_p;
+}
+
+
+
+bool
+JsonDocument::parse (string_view text, std::string &err, size_t &offset)
+{
+    m_begin = m_p = text.data();
+    m_end = m_begin + text.size();
+    skip_space ();
+    bool ok = parse_value (0) == 0;
+    if (ok) {
+        skip_space ();
+        if (m_p != m_end) {
+            m_error = "unexpected text after the document";
+            ok = false;
+        }
+    }
+    if (! ok) {
+        err = m_error;
+        offset = size_t(m_p - m_begin);
+    }
+    m_begin = m_p = m_end = nullptr;
+    return ok;
+}
+
+
+
+static bool
+parse_hex4 (const char *&p, const char *end, unsigned int &code)
+{
+    if (end - p < 4)
+        return false;
+    code = 0;
+    for (int i = 0;  i < 4;  ++i, ++p) {
+        char c = *p;
+        code <<= 4;
+        if (c >= '0' && c <= '9')
+            code |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            code |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            code |= c - 'A' + 10;
+        else
+            return false;
+    }
+    return true;
+}
+
+
+
+static void
+append_utf8 (std::string &s, unsigned int code)
+{
+    if (code < 0x80) {
+        s += char(code);
+    } else if (code < 0x800) {
+        s += char(0xC0 | (code >> 6));
+        s += char(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        s += char(0xE0 | (code >> 12));
+        s += char(0x80 | ((code >> 6) & 0x3F));
+        s += char(0x80 | (code & 0x3F));
+    } else {
+        s += char(0xF0 | (code >> 18));
+        s += char(0x80 | ((code >> 12) & 0x3F));
+        s += char(0x80 | ((code >> 6) & 0x3F));
+        s += char(0x80 | (code & 0x3F));
+    }
+}
+
+
+
+bool
+JsonDocument::parse_string (std::string &s)
+{
+    ++m_p;   // opening quote
+    while (m_p < m_end) {
+        char c = *m_p++;
+        if (c == '"')
+            return true;
+        if ((unsigned char)c < 0x20) {
+            --m_p;
+            m_error = "control character in string";
+            return false;
+        }
+        if (c != '\\') {
+            s += c;
+            continue;
+        }
+        if (m_p == m_end)
+            break;
+        switch (c = *m_p++) {
+        case '"': case '\\': case '/': s += c;  break;
+        case 'b': s += '\b';  break;
+        case 'f': s += '\f';  break;
+        case 'n': s += '\n';  break;
+        case 'r': s += '\r';  break;
+        case 't': s += '\t';  break;
+        case 'u': {
+            unsigned int code, low;
+            if (! parse_hex4 (m_p, m_end, code)) {
+                m_error = "invalid \\u escape";
+                return false;
+            }
+            if (code >= 0xD800 && code < 0xDC00) {
+                // UTF-16 surrogate pair
+                if (m_end - m_p < 2 || m_p[0] != '\\' || m_p[1] != 'u') {
+                    m_error = "unpaired surrogate in \\u escape";
+                    return false;
+                }
+                m_p += 2;
+                if (! parse_hex4 (m_p, m_end, low) ||
+                      low < 0xDC00 || low > 0xDFFF) {
+                    m_error = "unpaired surrogate in \\u escape";
+                    return false;
+                }
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            }
+            append_utf8 (s, code);
+            break;
+        }
+        default:
+            m_p -= 2;
+            m_error = "invalid escape in string";
+            return false;
+        }
+    }
+    m_error = "unterminated string";
+    return false;
+}
+
+
+
+// Parse the value at m_p into a new node, and return its index, or -1
+// (with m_error set and m_p left where things went wrong).
+int
+JsonDocument::parse_value (int depth)
+{
+    if (depth > 512) {
+        m_error = "nesting is too deep";
+        return -1;
+    }
+    if (m_p == m_end) {
+        m_error = "unexpected end of document";
+        return -1;
+    }
+    int id = (int) m_nodes.size();
+    m_nodes.emplace_back ();
+    char c = *m_p;
+
+    if (c == '{' || c == '[') {
+        bool object = (c == '{');
+        char close = object ? '}' : ']';
+        m_nodes[id].kind = object ? Object : Array;
+        ++m_p;
+        skip_space ();
+        // The children are parsed (and their own children appended to
+        // m_children) before this node's list is appended in one piece.
+        std::vector<int> children;
+        if (m_p < m_end && *m_p == close) {
+            ++m_p;
+        } else {
+            for (;;) {
+                ustring name;
+                if (object) {
+                    std::string s;
+                    if (m_p == m_end || *m_p != '"') {
+                        m_error = "expected a member name";
+                        return -1;
+                    }
+                    if (! parse_string (s))
+                        return -1;
+                    skip_space ();
+                    if (m_p == m_end || *m_p != ':') {
+                        m_error = "expected ':'";
+                        return -1;
+                    }
+                    ++m_p;
+                    skip_space ();
+                    name = ustring (s);
+                }
+                int child = parse_value (depth + 1);
+                if (child < 0)
+                    return -1;
+                children.push_back (child);
+                if (object)
+                    m_members[MemberKey { id, name }] = child;
+                skip_space ();
+                if (m_p < m_end && *m_p == ',') {
+                    ++m_p;
+                    skip_space ();
+                    continue;
+                }
+                if (m_p < m_end && *m_p == close) {
+                    ++m_p;
+                    break;
+                }
+                m_error = object ? "expected ',' or '}'" : "expected ',' or ']'";
+                return -1;
+            }
+        }
+        m_nodes[id].first = (int) m_children.size();
+        m_nodes[id].count = (int) children.size();
+        m_children.insert (m_children.end(), children.begin(), children.end());
+        return id;
+    }
+
+    if (c == '"') {
+        std::string s;
+        if (! parse_string (s))
+            return -1;
+        m_nodes[id].kind = String;
+        m_nodes[id].text = ustring (s);
+        return id;
+    }
+
+    static const struct { string_view word; Kind kind; } literals[] = {
+        { "true", Bool }, { "false", Bool }, { "null", Null }
+    };
+    for (auto&& lit : literals) {
+        if (Strutil::starts_with (string_view (m_p, m_end - m_p), lit.word)) {
+            m_nodes[id].kind = lit.kind;
+            m_nodes[id].text = ustring (lit.word);
+            m_p += lit.word.size();
+            return id;
+        }
+    }
+
+    // Anything else must be a number, which is kept as written
+    const char *start = m_p;
+    auto digits = [&]() {
+        const char *d = m_p;
+        while (m_p < m_end && isdigit((unsigned char)*m_p))
+            ++m_p;
+        return m_p > d;
+    };
+    if (*m_p == '-')
+        ++m_p;
+    bool ok = digits ();
+    if (ok && m_p < m_end && *m_p == '.') {
+        ++m_p;
+        ok = digits ();
+    }
+    if (ok && m_p < m_end && (*m_p == 'e' || *m_p == 'E')) {
+        ++m_p;
+        if (m_p < m_end && (*m_p == '+' || *m_p == '-'))
+            ++m_p;
+        ok = digits ();
+    }
+    if (! ok) {
+        m_p = start;
+        m_error = "invalid value";
+        return -1;
+    }
+    m_nodes[id].kind = Number;
+    m_nodes[id].text = ustring (start, m_p - start);
+    return id;
+}
+
+
+
+bool
+JsonDocument::find (int root, string_view query, std::vector<int> &matches,
+                    std::string &err) const
+{
+    // Step along the path with the set of nodes reached so far, which
+    // never holds more than one node unless the path has a wildcard.
+    std::vector<int> current (1, root), next;
+    string_view path = query;
+    if (Strutil::starts_with (path, "$"))
+        path.remove_prefix (1);
+    while (! path.empty() && ! current.empty()) {
+        next.clear ();
+        if (path[0] == '[') {
+            size_t close = path.find (']');
+            if (close == string_view::npos) {
+                err = "missing ']'";
+                return false;
+            }
+            string_view sub = path.substr (1, close - 1);
+            path.remove_prefix (close + 1);
+            if (sub == "*") {
+                for (int n : current)
+                    add_children (n, next);
+            } else {
+                int index = -1;
+                if (! Strutil::parse_int (sub, index) || ! sub.empty() ||
+                      index < 0) {
+                    err = "invalid subscript";
+                    return false;
+                }
+                for (int n : current) {
+                    const Node &node (m_nodes[n]);
+                    if (node.kind == Array && index < node.count)
+                        next.push_back (m_children[node.first + index]);
+                }
+            }
+        } else {
+            if (path[0] == '.')
+                path.remove_prefix (1);
+            string_view name = path.substr (0, path.find_first_of (".["));
+            path.remove_prefix (name.size());
+            if (name.empty()) {
+                err = "empty member name";
+                return false;
+            }
+            if (name == "*") {
+                for (int n : current)
+                    if (m_nodes[n].kind == Object)
+                        add_children (n, next);
+            } else {
+                ustring uname (name);
+                for (int n : current) {
+                    int m = member (n, uname);
+                    if (m >= 0)
+                        next.push_back (m);
+                }
+            }
+        }
+        current.swap (next);
+    }
+    matches.insert (matches.end(), current.begin(), current.end());
+    return true;
+}
+
+
+
+bool
+JsonDocument::value (int node, bool numeric, std::string &text) const
+{
+    const Node &n (m_nodes[node]);
+    if (n.kind == Object || n.kind == Null)
+        return false;
+    if (n.kind != Array) {
+        string_view v = scalar (n, numeric);
+        text.assign (v.data(), v.size());
+        return true;
+    }
+    text.clear ();
+    for (int i = 0;  i < n.count;  ++i) {
+        const Node &e (m_nodes[m_children[n.first + i]]);
+        if (e.kind == Object || e.kind == Array || e.kind == Null)
+            return false;
+        if (i)
+            text += ',';
+        string_view v = scalar (e, numeric);
+        text.append (v.data(), v.size());
+    }
+    return true;
+}
+
+
+
+static bool
+is_json (ustring dictionaryname)
+{
+    if (Strutil::ends_with (dictionaryname, ".json"))
+        return true;
+    string_view text = dictionaryname;
+    Strutil::skip_whitespace (text);
+    return Strutil::starts_with (text, "{") || Strutil::starts_with (text, "[");
+}
+
+
+
 int
-Dictionary::get_document_index (ustring dictionaryname)
+Dictionary::get_document_index (ShadingContext *ctx, ustring dictionaryname)
 {
     DocMap::iterator dm = m_document_map.find(dictionaryname);
     int dindex;
     if (dm == m_document_map.end()) {
         dindex = m_documents.size();
         m_document_map[dictionaryname] = dindex;
-        pugi::xml_document *doc = new pugi::xml_document;
-        m_documents.push_back (doc);
-        pugi::xml_parse_result parse_result;
-        if (Strutil::ends_with(dictionaryname, ".xml")) {
-            // xml file -- read it
-            parse_result = doc->load_file (dictionaryname.c_str());
+        m_documents.emplace_back ();
+        Document &doc (m_documents.back());
+        const char *format = "XML";
+        std::string error;
+        size_t offset = 0;
+        if (is_json (dictionaryname)) {
+            format = "JSON";
+            doc.json.reset (new JsonDocument);
+            std::string file;
+            string_view text = dictionaryname;
+            if (Strutil::ends_with (dictionaryname, ".json")) {
+                // json file -- read it
+                if (! OIIO::Filesystem::read_text_file (dictionaryname, file))
+                    error = "File was not found";
+                text = file;
+            }
+            if (error.empty())
+                doc.json->parse (text, error, offset);
         } else {
-            // load xml directly from the string
-            parse_result = doc->load_string(dictionaryname.c_str());
+            doc.xml.reset (new pugi::xml_document);
+            pugi::xml_parse_result parse_result;
+            if (Strutil::ends_with(dictionaryname, ".xml")) {
+                // xml file -- read it
+                parse_result = doc.xml->load_file (dictionaryname.c_str());
+            } else {
+                // load xml directly from the string
+                parse_result = doc.xml->load_string(dictionaryname.c_str());
+            }
+            if (! parse_result) {
+                error = parse_result.description();
+                offset = parse_result.offset;
+            }
         }
-        if (! parse_result) {
-            m_context->errorfmt("XML parsed with errors: {}, at offset {}",
-                                parse_result.description(),
-                                parse_result.offset);
+        if (! error.empty()) {
+            if (! ctx) {
+                // Quietly forget the failure, so that it is reported
+                // when a shader actually asks for this document.
+                m_documents.pop_back ();
+                m_document_map.erase (dictionaryname);
+                return -1;
+            }
+            ctx->errorfmt("{} parsed with errors: {}, at offset {}",
+                          format, error, offset);
             m_document_map[dictionaryname] = -1;
             return -1;
         }
@@ -173,11 +725,46 @@ Dictionary::get_document_index (ustring dictionaryname)
 
 
 int
-Dictionary::dict_find (ustring dictionaryname, ustring query)
+Dictionary::find_json (ShadingContext *ctx, const Query &q, int root,
+                       bool &cacheable)
 {
-    int dindex = get_document_index (dictionaryname);
-    if (dindex < 0)
+    std::vector<int> matches;
+    std::string err;
+    if (! m_documents[q.document].json->find (root, q.name, matches, err)) {
+        if (ctx)
+            ctx->errorfmt("Invalid dict_find query '{}': {}", q.name, err);
+        cacheable = false;
+        return 0;
+    }
+
+    if (matches.empty()) {
+        m_cache[q] = QueryResult (false);  // mark invalid
+        return 0;   // Not found
+    }
+    int firstmatch = (int) m_nodes.size();
+    for (int m : matches) {
+        int nodeid = (int) m_nodes.size();
+        m_nodes.emplace_back (q.document, pugi::xml_node(), m);
+        if (nodeid > firstmatch)
+            m_nodes[nodeid-1].next = nodeid;
+    }
+    m_cache[q] = QueryResult (true /* it's a node */, firstmatch);
+    return firstmatch;
+}
+
+
+
+int
+Dictionary::dict_find (ShadingContext *ctx, ustring dictionaryname,
+                       ustring query, bool &cacheable)
+{
+    std::lock_guard<std::mutex> lock (m_mutex);
+    cacheable = true;
+    int dindex = get_document_index (ctx, dictionaryname);
+    if (dindex < 0) {
+        cacheable = (ctx != nullptr);
         return dindex;
+    }
 
     Query q (dindex, 0, query);
     QueryMap::iterator qfound = m_cache.find (q);
@@ -185,7 +772,9 @@ Dictionary::dict_find (ustring dictionaryname, ustring query)
         return qfound->second.valueoffset;
     }
 
-    pugi::xml_document *doc = m_documents[dindex];
+    if (m_documents[dindex].json)
+        return find_json (ctx, q, 0, cacheable);
+    pugi::xml_document *doc = m_documents[dindex].xml.get();
 
     // Query was not found.  Do the expensive lookup and cache it
     pugi::xpath_node_set matches;
@@ -194,8 +783,10 @@ Dictionary::dict_find (ustring dictionaryname, ustring query)
         matches = doc->select_nodes (query.c_str());
     }
     catch (const pugi::xpath_exception& e) {
-        m_context->errorfmt("Invalid dict_find query '{}': {}", query,
-                            e.what());
+        if (ctx)
+            ctx->errorfmt("Invalid dict_find query '{}': {}", query,
+                          e.what());
+        cacheable = false;
         return 0;
     }
 
@@ -223,8 +814,11 @@ Dictionary::dict_find (ustring dictionaryname, ustring query)
 
 
 int
-Dictionary::dict_find (int nodeID, ustring query)
+Dictionary::dict_find (ShadingContext *ctx, int nodeID, ustring query,
+                       bool &cacheable)
 {
+    std::lock_guard<std::mutex> lock (m_mutex);
+    cacheable = true;
     if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
         return 0;     // invalid node ID
 
@@ -235,14 +829,19 @@ Dictionary::dict_find (int nodeID, ustring query)
         return qfound->second.valueoffset;
     }
 
+    if (m_nodes[nodeID].json >= 0)
+        return find_json (ctx, q, m_nodes[nodeID].json, cacheable);
+
     // Query was not found.  Do the expensive lookup and cache it
     pugi::xpath_node_set matches;
     try {
         matches = m_nodes[nodeID].node.select_nodes (query.c_str());
     }
     catch (const pugi::xpath_exception& e) {
-        m_context->errorfmt("Invalid dict_find query '{}': {}", query,
-                            e.what());
+        if (ctx)
+            ctx->errorfmt("Invalid dict_find query '{}': {}", query,
+                          e.what());
+        cacheable = false;
         return 0;
     }
 
@@ -272,6 +871,7 @@ Dictionary::dict_find (int nodeID, ustring query)
 int
 Dictionary::dict_next (int nodeID)
 {
+    std::lock_guard<std::mutex> lock (m_mutex);
     if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
         return 0;     // invalid node ID
     return m_nodes[nodeID].next;
@@ -283,6 +883,7 @@ int
 Dictionary::dict_value (int nodeID, ustring attribname,
                         TypeDesc type, void *data)
 {
+    std::lock_guard<std::mutex> lock (m_mutex);
     if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
         return 0;     // invalid node ID
 
@@ -314,7 +915,15 @@ Dictionary::dict_value (int nodeID, ustring attribname,
     // OK, the entry wasn't in the cache, we need to decode it and cache it.
 
     const char *val = NULL;
-    if (attribname.empty()) {
+    std::string jsonval;
+    if (node.json >= 0) {
+        // A JSON node's attributes are the members of an object
+        const JsonDocument &doc (*m_documents[node.document].json);
+        int j = attribname.empty() ? node.json
+                                   : doc.member (node.json, attribname);
+        if (j >= 0 && doc.value (j, type.basetype != TypeDesc::STRING, jsonval))
+            val = jsonval.c_str();
+    } else if (attribname.empty()) {
         val = node.node.value();
     } else {
         for (pugi::xml_attribute_iterator ait = node.node.attributes_begin();
@@ -370,6 +979,135 @@ Dictionary::dict_value (int nodeID, ustring attribname,
 }
 
 
+
+
+int
+DictionaryCache::dict_find (ShadingContext *ctx, ustring dictionaryname,
+                            ustring query)
+{
+    Key key { FindRoot, 0, dictionaryname, query, TypeDesc() };
+    auto found = m_cache.find (key);
+    if (found != m_cache.end())
+        return found->second.result;
+    bool cacheable;
+    int result = m_store.dict_find (ctx, dictionaryname, query, cacheable);
+    if (cacheable)
+        m_cache[key] = Entry { result, 0 };
+    return result;
+}
+
+
+
+int
+DictionaryCache::dict_find (ShadingContext *ctx, int nodeID, ustring query)
+{
+    Key key { FindNode, nodeID, ustring(), query, TypeDesc() };
+    auto found = m_cache.find (key);
+    if (found != m_cache.end())
+        return found->second.result;
+    bool cacheable;
+    int result = m_store.dict_find (ctx, nodeID, query, cacheable);
+    if (cacheable)
+        m_cache[key] = Entry { result, 0 };
+    return result;
+}
+
+
+
+int
+DictionaryCache::dict_next (int nodeID)
+{
+    Key key { Next, nodeID, ustring(), ustring(), TypeDesc() };
+    auto found = m_cache.find (key);
+    if (found != m_cache.end())
+        return found->second.result;
+    int result = m_store.dict_next (nodeID);
+    m_cache[key] = Entry { result, 0 };
+    return result;
+}
+
+
+
+int
+DictionaryCache::dict_value (int nodeID, ustring attribname,
+                             TypeDesc type, void *data)
+{
+    Key key { Value, nodeID, ustring(), attribname, type };
+    auto found = m_cache.find (key);
+    if (found != m_cache.end()) {
+        if (found->second.result)
+            memcpy (data, &m_values[found->second.offset], type.size());
+        return found->second.result;
+    }
+    int result = m_store.dict_value (nodeID, attribname, type, data);
+    size_t offset = m_values.size();
+    if (result) {
+        m_values.resize (offset + type.size());
+        memcpy (&m_values[offset], data, type.size());
+    }
+    m_cache[key] = Entry { result, offset };
+    return result;
+}
+
+
+
+Dictionary &
+ShadingSystemImpl::dictionary ()
+{
+    spin_lock lock (m_dictionary_mutex);
+    if (! m_dictionary)
+        m_dictionary = new Dictionary;
+    return *m_dictionary;
+}
+
+
+
+bool
+ShadingSystemImpl::fold_dict_find (ustring dictionaryname, ustring query,
+                                   int &result)
+{
+    bool ok;
+    result = dictionary().dict_find (nullptr, dictionaryname, query, ok);
+    return ok;
+}
+
+
+
+bool
+ShadingSystemImpl::fold_dict_find (int nodeID, ustring query, int &result)
+{
+    bool ok;
+    result = dictionary().dict_find (nullptr, nodeID, query, ok);
+    return ok;
+}
+
+
+
+int
+ShadingSystemImpl::fold_dict_next (int nodeID)
+{
+    return dictionary().dict_next (nodeID);
+}
+
+
+
+int
+ShadingSystemImpl::fold_dict_value (int nodeID, ustring attribname,
+                                    TypeDesc type, void *data)
+{
+    return dictionary().dict_value (nodeID, attribname, type, data);
+}
+
+
+
+void
+ShadingSystemImpl::free_dict_resources ()
+{
+    delete m_dictionary;
+    m_dictionary = nullptr;
+}
+
+
 }; // namespace pvt
 
 
@@ -378,9 +1116,9 @@ int
 ShadingContext::dict_find (ustring dictionaryname, ustring query)
 {
     if (! m_dictionary) {
-        m_dictionary = new Dictionary (this);
+        m_dictionary = new DictionaryCache (shadingsys().dictionary());
     }
-    return m_dictionary->dict_find (dictionaryname, query);
+    return m_dictionary->dict_find (this, dictionaryname, query);
 }
 
 
@@ -389,9 +1127,9 @@ int
 ShadingContext::dict_find (int nodeID, ustring query)
 {
     if (! m_dictionary) {
-        m_dictionary = new Dictionary (this);
+        m_dictionary = new DictionaryCache (shadingsys().dictionary());
     }
-    return m_dictionary->dict_find (nodeID, query);
+    return m_dictionary->dict_find (this, nodeID, query);
 }
 
 
@@ -110,11 +110,79 @@ test_metaprogramming ()
 
 
 
+// The composed per-component Dual expressions that the fused dot, cross,
+// and normalize in dual_vec.h replace.
+template<int P>
+Dual<float,P> composed_dot (const Dual<Vec3,P>& a, const Dual<Vec3,P>& b)
+{
+    return comp_x(a)*comp_x(b) + comp_y(a)*comp_y(b) + comp_z(a)*comp_z(b);
+}
+
+template<int P>
+Dual<Vec3,P> composed_cross (const Dual<Vec3,P>& a, const Dual<Vec3,P>& b)
+{
+    auto ax = comp_x (a), ay = comp_y (a), az = comp_z (a);
+    auto bx = comp_x (b), by = comp_y (b), bz = comp_z (b);
+    return make_Vec3 (ay*bz - az*by, az*bx - ax*bz, ax*by - ay*bx);
+}
+
+template<int P>
+Dual<Vec3,P> composed_normalize (const Dual<Vec3,P>& a)
+{
+    auto ax = comp_x (a), ay = comp_y (a), az = comp_z (a);
+    auto len = sqrt (ax*ax + ay*ay + az*az);
+    if (len.val() > 0.0f) {
+        auto invlen = 1.0f / len;
+        return make_Vec3 (ax*invlen, ay*invlen, az*invlen);
+    }
+    return Vec3(0,0,0);
+}
+
+
+
+// The fused ops must give exactly what the composed expressions do.
+void
+test_fused ()
+{
+    Dual2f a (0.7f, 0.3f, -1.1f), b (-1.3f, 0.25f, 2.0f), c (0.1f, -0.6f, 0.9f);
+    Dual2f m = madd (a, b, c), e = a * b + c;
+    OIIO_CHECK_EQUAL (m.val(), e.val());
+    OIIO_CHECK_EQUAL (m.dx(), e.dx());
+    OIIO_CHECK_EQUAL (m.dy(), e.dy());
+    m = madd (a, 3.5f, c);
+    e = a * 3.5f + c;
+    OIIO_CHECK_EQUAL (m.val(), e.val());
+    OIIO_CHECK_EQUAL (m.dx(), e.dx());
+    OIIO_CHECK_EQUAL (m.dy(), e.dy());
+
+    Dual2<Vec3> u (Vec3(0.3f, -1.2f, 2.5f), Vec3(0.1f, 0.7f, -0.2f),
+                   Vec3(-0.4f, 0.05f, 1.3f));
+    Dual2<Vec3> v (Vec3(1.7f, 0.6f, -0.8f), Vec3(-0.9f, 0.2f, 0.35f),
+                   Vec3(0.5f, -1.5f, 0.01f));
+    Dual2f d = dot (u, v), dc = composed_dot (u, v);
+    OIIO_CHECK_EQUAL (d.val(), dc.val());
+    OIIO_CHECK_EQUAL (d.dx(), dc.dx());
+    OIIO_CHECK_EQUAL (d.dy(), dc.dy());
+    Dual2<Vec3> x = cross (u, v), xc = composed_cross (u, v);
+    OIIO_CHECK_EQUAL (x.val(), xc.val());
+    OIIO_CHECK_EQUAL (x.dx(), xc.dx());
+    OIIO_CHECK_EQUAL (x.dy(), xc.dy());
+    Dual2<Vec3> n = normalize (u), nc = composed_normalize (u);
+    OIIO_CHECK_EQUAL (n.val(), nc.val());
+    OIIO_CHECK_EQUAL (n.dx(), nc.dx());
+    OIIO_CHECK_EQUAL (n.dy(), nc.dy());
+    n = normalize (Dual2<Vec3>(Vec3(0.0f)));
+    OIIO_CHECK_EQUAL (n.val(), Vec3(0.0f));
+}
+
+
+
 int main(int /*argc*/, char * /*argv*/[])
 {
     test_metaprogramming ();
     test_derivs1 ();
     test_derivs2 ();
+    test_fused ();
 
     // Some benchmarking
     std::cout << "\nBenchmarks:\n";
@@ -125,6 +193,19 @@ int main(int /*argc*/, char * /*argv*/[])
     bench("-Dual2f", [&](const Dual2f& v) { return DoNotOptimize(-v); }, v);
     bench("fast_neg(Dual2f)", [&](const Dual2f& v) { return DoNotOptimize(fast_neg(v)); }, v);
     bench("log2(Dual2f)", [&](const Dual2f& v) { return DoNotOptimize(fast_log2(v)); }, v);
+    Dual2f w(-0.5f, 0.02f, 0.03f);
+    clobber(w);
+    bench("Dual2f*Dual2f+Dual2f", [&](const Dual2f& v) { return DoNotOptimize(v * w + w); }, v);
+    bench("madd(Dual2f)", [&](const Dual2f& v) { return DoNotOptimize(madd(v, w, w)); }, v);
+    Dual2<Vec3> p(Vec3(0.3f, -1.2f, 2.5f), Vec3(0.1f, 0.7f, -0.2f), Vec3(-0.4f, 0.05f, 1.3f));
+    Dual2<Vec3> q(Vec3(1.7f, 0.6f, -0.8f), Vec3(-0.9f, 0.2f, 0.35f), Vec3(0.5f, -1.5f, 0.01f));
+    clobber(q);
+    bench("composed dot(Dual2<Vec3>)", [&](const Dual2<Vec3>& p) { return DoNotOptimize(composed_dot(p, q)); }, p);
+    bench("dot(Dual2<Vec3>)", [&](const Dual2<Vec3>& p) { return DoNotOptimize(dot(p, q)); }, p);
+    bench("composed cross(Dual2<Vec3>)", [&](const Dual2<Vec3>& p) { return DoNotOptimize(composed_cross(p, q)); }, p);
+    bench("cross(Dual2<Vec3>)", [&](const Dual2<Vec3>& p) { return DoNotOptimize(cross(p, q)); }, p);
+    bench("composed normalize(Dual2<Vec3>)", [&](const Dual2<Vec3>& p) { return DoNotOptimize(composed_normalize(p)); }, p);
+    bench("normalize(Dual2<Vec3>)", [&](const Dual2<Vec3>& p) { return DoNotOptimize(normalize(p)); }, p);
 
     // FIXME: Some day, expand to more exhaustive tests of Dual
 
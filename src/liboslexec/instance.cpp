@@ -6,6 +6,7 @@
 #include <string>
 #include <cstdio>
 #include <algorithm>
+#include <functional>
 
 #include <OpenImageIO/strutil.h>
 
@@ -68,7 +69,8 @@ ShaderInstance::~ShaderInstance ()
 {
     shadingsys().m_stat_instances -= 1;
 
-    OSL_DASSERT (m_instops.size() == 0 && m_instargs.size() == 0);
+    OSL_DASSERT (shared_or_empty(m_instops).empty() &&
+                 shared_or_empty(m_instargs).empty());
     ShadingSystemImpl &ss (shadingsys());
     off_t symmem = vectorbytes (m_instsymbols) + vectorbytes(m_instoverrides);
     off_t parammem = vectorbytes (m_iparams)
@@ -176,7 +178,7 @@ inline bool compatible_param (const TypeDesc& a, const TypeDesc& b)
 
 
 void
-ShaderInstance::parameters (const ParamValueList &params)
+ShaderInstance::parameters (cspan<ParamValue> params)
 {
     // Seed the params with the master's defaults
     m_iparams = m_master->m_idefaults;
@@ -450,15 +452,139 @@ ShaderInstance::evaluate_writes_globals_and_userdata_params ()
 
 
 
+// Everything about an instance that changes when it's optimized
+struct ShaderInstance::Unoptimized {
+    SymOverrideInfoVec instoverrides;
+    std::vector<int> iparams;
+    std::vector<float> fparams;
+    std::vector<ustring> sparams;
+    ConnectionVec connections;
+    bool writes_globals, userdata_params, outgoing_connections;
+    bool renderer_outputs, has_error_op, merged_unused;
+    bool last_layer, entry_layer;
+    int firstparam, lastparam, maincodebegin, maincodeend, Psym, Nsym;
+};
+
+
+
+void
+ShaderInstance::save_unoptimized ()
+{
+    OSL_ASSERT (m_instsymbols.empty() && "already optimized");
+    if (! m_unoptimized)
+        m_unoptimized.reset (new Unoptimized);
+    Unoptimized &u (*m_unoptimized);
+    u.instoverrides = m_instoverrides;
+    u.iparams = m_iparams;
+    u.fparams = m_fparams;
+    u.sparams = m_sparams;
+    u.connections = m_connections;
+    u.writes_globals = m_writes_globals;
+    u.userdata_params = m_userdata_params;
+    u.outgoing_connections = m_outgoing_connections;
+    u.renderer_outputs = m_renderer_outputs;
+    u.has_error_op = m_has_error_op;
+    u.merged_unused = m_merged_unused;
+    u.last_layer = m_last_layer;
+    u.entry_layer = m_entry_layer;
+    u.firstparam = m_firstparam;
+    u.lastparam = m_lastparam;
+    u.maincodebegin = m_maincodebegin;
+    u.maincodeend = m_maincodeend;
+    u.Psym = m_Psym;
+    u.Nsym = m_Nsym;
+}
+
+
+
+void
+ShaderInstance::unoptimize ()
+{
+    OSL_ASSERT (m_unoptimized);
+    const Unoptimized &u (*m_unoptimized);
+    SymbolVec nosyms;
+    m_instsymbols.swap (nosyms);
+    clear_code ();
+    m_instoverrides = u.instoverrides;
+    m_iparams = u.iparams;
+    m_fparams = u.fparams;
+    m_sparams = u.sparams;
+    m_connections = u.connections;
+    m_writes_globals = u.writes_globals;
+    m_userdata_params = u.userdata_params;
+    m_outgoing_connections = u.outgoing_connections;
+    m_renderer_outputs = u.renderer_outputs;
+    m_has_error_op = u.has_error_op;
+    m_merged_unused = u.merged_unused;
+    m_last_layer = u.last_layer;
+    m_entry_layer = u.entry_layer;
+    m_firstparam = u.firstparam;
+    m_lastparam = u.lastparam;
+    m_maincodebegin = u.maincodebegin;
+    m_maincodeend = u.maincodeend;
+    m_Psym = u.Psym;
+    m_Nsym = u.Nsym;
+}
+
+
+
+void
+ShaderInstance::replace_master (ShaderMaster::ref master)
+{
+    OSL_ASSERT (m_instsymbols.empty() && "must be unoptimized");
+    OSL_DASSERT (m_master->same_params (*master));
+    const ShaderMaster &m (*master);
+    // Parameter storage is laid out the same in both masters, so the
+    // defaults copy straight across, leaving the instance values alone.
+    auto refresh = [&](const SymOverrideInfoVec &overrides,
+                       std::vector<int> &iparams, std::vector<float> &fparams,
+                       std::vector<ustring> &sparams) {
+        for (int i = m.m_firstparam;  i < m.m_lastparam;  ++i) {
+            const Symbol &sym (m.m_symbols[i]);
+            const TypeSpec &ts (sym.typespec());
+            if (i >= (int)overrides.size() || ts.is_closure_based()
+                  || ts.is_structure() || ts.is_unsized_array()
+                  || sym.dataoffset() < 0
+                  || overrides[i].valuesource() != Symbol::DefaultVal
+                  || overrides[i].dataoffset() != sym.dataoffset())
+                continue;
+            TypeDesc t = ts.simpletype();
+            size_t n = t.numelements() * t.aggregate;
+            size_t off = sym.dataoffset();
+            if (t.basetype == TypeDesc::INT)
+                std::copy_n (&m.m_idefaults[off], n, &iparams[off]);
+            else if (t.basetype == TypeDesc::FLOAT)
+                std::copy_n (&m.m_fdefaults[off], n, &fparams[off]);
+            else if (t.basetype == TypeDesc::STRING)
+                std::copy_n (&m.m_sdefaults[off], n, &sparams[off]);
+        }
+    };
+    refresh (m_instoverrides, m_iparams, m_fparams, m_sparams);
+    m_master = master;
+    m_maincodebegin = m.m_maincodebegin;
+    m_maincodeend = m.m_maincodeend;
+    m_Psym = findsymbol (Strings::P);
+    m_Nsym = findsymbol (Strings::N);
+    if (m_unoptimized) {
+        Unoptimized &u (*m_unoptimized);
+        refresh (u.instoverrides, u.iparams, u.fparams, u.sparams);
+        u.maincodebegin = m_maincodebegin;
+        u.maincodeend = m_maincodeend;
+        u.Psym = m_Psym;
+        u.Nsym = m_Nsym;
+    }
+}
+
+
+
 void
 ShaderInstance::copy_code_from_master (ShaderGroup &group)
 {
-    OSL_ASSERT (m_instops.empty() && m_instargs.empty());
-    // reserve with enough room for a few insertions
-    m_instops.reserve (master()->m_ops.size()+10);
-    m_instargs.reserve (master()->m_args.size()+10);
-    m_instops = master()->m_ops;
-    m_instargs = master()->m_args;
+    OSL_ASSERT (shared_or_empty(m_instops).empty() &&
+                shared_or_empty(m_instargs).empty());
+    // Share the master's code; the first modification by the optimizer
+    // makes a private copy (see ShaderInstance::ops()).
+    m_master->shared_code (m_instops, m_instargs);
 
     // Copy the symbols from the master
     OSL_ASSERT (m_instsymbols.size() == 0 &&
@@ -572,6 +698,7 @@ equivalent (const Symbol &a, const Symbol &b)
         return false;
 
     return a.has_derivs() == b.has_derivs() &&
+        a.deriv_axes() == b.deriv_axes() &&
         a.lockgeom() == b.lockgeom() &&
         a.valuesource() == b.valuesource() &&
         a.fieldid() == b.fieldid() &&
@@ -582,6 +709,51 @@ equivalent (const Symbol &a, const Symbol &b)
 
 
 
+size_t
+ShaderInstance::merge_signature () const
+{
+    // Anything hashed here must be compared, and required to be equal, by
+    // mergeable() -- otherwise mergeable instances could land in different
+    // buckets of merge_instances() and never be compared.
+    size_t h = std::hash<const void*>()(master());
+    auto combine = [&](size_t v) {
+        h ^= v + 0x9e3779b9 + (h << 6) + (h >> 2);
+    };
+    combine (run_lazily());
+    combine (m_connections.size());
+    for (auto&& con : m_connections) {
+        combine (size_t(con.srclayer));
+        combine (size_t(con.src.param));
+        combine (size_t(con.src.arrayindex * 32 + con.src.channel));
+        combine (size_t(con.dst.param));
+        combine (size_t(con.dst.arrayindex * 32 + con.dst.channel));
+    }
+
+    bool optimized = (m_instsymbols.size() != 0 || ops().size() != 0);
+    if (optimized) {
+        // Optimized instances must have the same code, and the parameter
+        // values that matter have mostly been folded into it.
+        combine (ops().size());
+        combine (OIIO::Strutil::strhash (string_view ((const char *)args().data(),
+                                         args().size() * sizeof(int))));
+    } else {
+        // Before optimization, the master's symbols decide which parameter
+        // values mergeable() compares, and those are the same for every
+        // instance of the master.
+        for (int i = firstparam();  i < lastparam();  ++i) {
+            const Symbol *sym = mastersymbol(i);
+            if (! sym->everused_in_group() || sym->typespec().is_closure())
+                continue;
+            if (sym->valuesource() == Symbol::InstanceVal || sym->valuesource() == Symbol::DefaultVal)
+                combine (OIIO::Strutil::strhash (string_view ((const char *)param_storage(i),
+                                                 sym->typespec().simpletype().size())));
+        }
+    }
+    return h;
+}
+
+
+
 bool
 ShaderInstance::mergeable (const ShaderInstance &b, const ShaderGroup& /*g*/) const
 {
@@ -600,7 +772,7 @@ ShaderInstance::mergeable (const ShaderInstance &b, const ShaderGroup& /*g*/) co
     // their unoptimized master), but they may have an "instance
     // override" vector that describes which parameters have
     // instance-specific values or connections.
-    bool optimized = (m_instsymbols.size() != 0 || m_instops.size() != 0);
+    bool optimized = (m_instsymbols.size() != 0 || ops().size() != 0);
 
     // Same instance overrides
     if (m_instoverrides.size() || b.m_instoverrides.size()) {
@@ -686,11 +858,11 @@ ShaderInstance::mergeable (const ShaderInstance &b, const ShaderGroup& /*g*/) co
     }
 
     // Same opcodes to run
-    if (! equivalent (m_instops, b.m_instops)) {
+    if (! equivalent (ops(), b.ops())) {
         return false;
     }
     // Same arguments to the ops
-    if (m_instargs != b.m_instargs) {
+    if (args() != b.args()) {
         return false;
     }
 
@@ -766,6 +938,12 @@ ShaderGroup::find_layer (ustring layername) const
 const Symbol *
 ShaderGroup::find_symbol (ustring layername, ustring symbolname) const
 {
+    if (optimized() && ! m_symbol_index.empty()) {
+        auto found = m_symbol_index.find (std::make_pair (layername, symbolname));
+        if (found == m_symbol_index.end())
+            return NULL;
+        return m_layers[found->second.first]->symbol (found->second.second);
+    }
     for (int layer = nlayers()-1;  layer >= 0;  --layer) {
         const ShaderInstance *inst (m_layers[layer].get());
         if (layername.size() && layername != inst->layername())
@@ -779,6 +957,24 @@ ShaderGroup::find_symbol (ustring layername, ustring symbolname) const
 
 
 
+void
+ShaderGroup::build_symbol_index ()
+{
+    m_symbol_index.clear ();
+    // Later layers overwrite earlier ones, and within a layer the lowest
+    // index is written last, to match what the scan in find_symbol finds.
+    for (int layer = 0;  layer < nlayers();  ++layer) {
+        const ShaderInstance *inst (m_layers[layer].get());
+        for (int i = int(inst->symbols().size()) - 1;  i >= 0;  --i) {
+            ustring name = inst->symbols()[i].name();
+            m_symbol_index[std::make_pair (inst->layername(), name)] = std::make_pair (layer, i);
+            m_symbol_index[std::make_pair (ustring(), name)] = std::make_pair (layer, i);
+        }
+    }
+}
+
+
+
 void
 ShaderGroup::clear_entry_layers ()
 {
@@ -175,6 +175,11 @@ BackendLLVM::llvm_run_connected_layers (Symbol &sym, int symindex,
                     already_run->insert (con.srclayer);  // mark it
             }
 
+            // Layers run upfront by the group entry have been run before
+            // any code that could get here.
+            if (m_layer_run_upfront[con.srclayer])
+                continue;
+
             if (inmain) {
                 // There is an instance-wide m_layers_already_run that tries
                 // to remember which earlier layers have unconditionally
@@ -408,9 +413,51 @@ LLVMGEN (llvm_gen_printf)
     }
 
     // Now go back and put the new format string in its place
-    if (! rop.use_optix()) {
+    std::string funcsuffix;
+    if (! rop.use_optix() && rop.llvm_aot_output()) {
+        // Precompiled code can't embed the address of a FormatSpec
         call_args[new_format_slot] = rop.ll.constant (s.c_str());
     }
+    else if (! rop.use_optix()) {
+        // Split the format once, now, rather than every time the op runs,
+        // and pass the arguments packed in 8-byte slots instead of as C
+        // varargs:
+        //     char args[8*nargs];   // int, double, or char* per slot
+        //     osl_printf_spec(sg, spec, args);
+        size_t nargs = call_args.size() - (new_format_slot+1);
+        llvm::Value *slots = rop.ll.op_alloca (rop.ll.type_char(),
+                                               std::max(nargs, size_t(1)) * sizeof(uint64_t),
+                                               std::string(), 8);
+        std::string types;
+        for (size_t i = 0; i < nargs; ++i) {
+            llvm::Value* arg = call_args[new_format_slot+1+i];
+            llvm::Value* memptr = rop.ll.offset_ptr (slots, int(i * sizeof(uint64_t)));
+            if (arg->getType()->isIntegerTy()) {
+                llvm::Value* iptr = rop.ll.ptr_cast(memptr, rop.ll.type_int_ptr());
+                rop.ll.op_store (arg, iptr);
+                types += FormatSpec::Int;
+            } else if (arg->getType()->isFloatingPointTy()) {
+                llvm::Value* fptr = rop.ll.ptr_cast(memptr, rop.ll.type_double_ptr());
+                rop.ll.op_store (arg, fptr);
+                types += FormatSpec::Double;
+            } else {
+                llvm::Value* vptr = rop.ll.ptr_to_cast(memptr, rop.ll.type_void_ptr());
+                rop.ll.op_store (arg, vptr);
+                types += FormatSpec::String;
+            }
+        }
+        const FormatSpec *spec = rop.shadingsys().format_spec (s, types);
+        call_args.resize (new_format_slot+2);
+        call_args[new_format_slot] = rop.ll.constant_ptr ((void *)spec);
+        call_args[new_format_slot+1] = rop.ll.void_ptr (slots);
+        funcsuffix = "_spec";
+        if (op.opname() == op_format && rop.opargsym (op, 0)->transient()) {
+            // The result never leaves the shading point, so it goes in
+            // the context's scratch arena rather than the ustring table.
+            call_args.insert (call_args.begin(), rop.sg_void_ptr());
+            funcsuffix = "_spec_transient";
+        }
+    }
     else {
         // In OptiX 6 we do this:
         // void* args = { arg0, arg1, arg2 };
@@ -485,7 +532,7 @@ LLVMGEN (llvm_gen_printf)
     }
 
     // Construct the function name and call it.
-    std::string opname = std::string("osl_") + op.opname().string();
+    std::string opname = std::string("osl_") + op.opname().string() + funcsuffix;
     llvm::Value *ret = rop.ll.call_function (opname.c_str(), call_args);
 
     // The format op returns a string value, put in in the right spot
@@ -1177,7 +1224,7 @@ LLVMGEN (llvm_gen_compref)
     Symbol& Index = *rop.opargsym (op, 2);
 
     llvm::Value *c = rop.llvm_load_value(Index);
-    if (rop.inst()->master()->range_checking()) {
+    if (rop.inst()->master()->range_checking() && ! op.index_in_range()) {
         if (! (Index.is_constant() &&  Index.get_int() >= 0 &&
                Index.get_int() < 3)) {
             llvm::Value *args[] = { c, rop.ll.constant(3),
@@ -1220,7 +1267,7 @@ LLVMGEN (llvm_gen_compassign)
     Symbol& Val = *rop.opargsym (op, 2);
 
     llvm::Value *c = rop.llvm_load_value(Index);
-    if (rop.inst()->master()->range_checking()) {
+    if (rop.inst()->master()->range_checking() && ! op.index_in_range()) {
         if (! (Index.is_constant() &&  Index.get_int() >= 0 &&
                Index.get_int() < 3)) {
             llvm::Value *args[] = { c, rop.ll.constant(3),
@@ -1264,7 +1311,7 @@ LLVMGEN (llvm_gen_mxcompref)
 
     llvm::Value *row = rop.llvm_load_value (Row);
     llvm::Value *col = rop.llvm_load_value (Col);
-    if (rop.inst()->master()->range_checking()) {
+    if (rop.inst()->master()->range_checking() && ! op.index_in_range()) {
         if (! (Row.is_constant() && Col.is_constant() &&
                Row.get_int() >= 0 && Row.get_int() < 4 &&
                Col.get_int() >= 0 && Col.get_int() < 4)) {
@@ -1319,7 +1366,7 @@ LLVMGEN (llvm_gen_mxcompassign)
 
     llvm::Value *row = rop.llvm_load_value (Row);
     llvm::Value *col = rop.llvm_load_value (Col);
-    if (rop.inst()->master()->range_checking()) {
+    if (rop.inst()->master()->range_checking() && ! op.index_in_range()) {
         if (! (Row.is_constant() && Col.is_constant() &&
                Row.get_int() >= 0 && Row.get_int() < 4 &&
                Col.get_int() >= 0 && Col.get_int() < 4)) {
@@ -1389,7 +1436,7 @@ LLVMGEN (llvm_gen_aref)
     llvm::Value *index = rop.loadLLVMValue (Index);
     if (! index)
         return false;
-    if (rop.inst()->master()->range_checking()) {
+    if (rop.inst()->master()->range_checking() && ! op.index_in_range()) {
         if (! (Index.is_constant() &&  Index.get_int() >= 0 &&
                Index.get_int() < Src.typespec().arraylength())) {
             llvm::Value *args[] = { index,
@@ -1433,7 +1480,7 @@ LLVMGEN (llvm_gen_aassign)
     llvm::Value *index = rop.loadLLVMValue (Index);
     if (! index)
         return false;
-    if (rop.inst()->master()->range_checking()) {
+    if (rop.inst()->master()->range_checking() && ! op.index_in_range()) {
         if (! (Index.is_constant() &&  Index.get_int() >= 0 &&
                Index.get_int() < Result.typespec().arraylength())) {
             llvm::Value *args[] = { index,
@@ -2036,7 +2083,11 @@ LLVMGEN (llvm_gen_generic)
             op.opname() == op_sign)
             any_deriv_args = false;
 
-    std::string name = std::string("osl_") + op.opname().string() + "_";
+    // Transcendentals may be bound to their "fast_" or "accurate_"
+    // variants, depending on the group's math_precision.
+    std::string name = std::string("osl_")
+                     + rop.shadingsys().math_precision_prefix (rop.group(), op.opname())
+                     + op.opname().string() + "_";
     for (int i = 0;  i < op.nargs();  ++i) {
         Symbol *s (rop.opargsym (op, i));
         if (any_deriv_args && Result.has_derivs() && s->has_derivs() && !s->typespec().is_matrix())
@@ -2054,6 +2105,20 @@ LLVMGEN (llvm_gen_generic)
         else OSL_ASSERT (0);
     }
 
+    if (Result.transient() && ! rop.use_optix()) {
+        // concat or substr whose string never leaves the shading point:
+        // build it in the context's scratch arena, not the ustring table.
+        llvm::Value *valargs[4] = { rop.sg_void_ptr() };
+        OSL_DASSERT (op.nargs() <= 4);
+        for (int i = 1;  i < op.nargs();  ++i)
+            valargs[i] = rop.llvm_load_value (*args[i]);
+        std::string tname = "osl_" + op.opname().string() + "_transient";
+        llvm::Value *r = rop.ll.call_function (tname.c_str(),
+                                               cspan<llvm::Value*>(valargs, op.nargs()));
+        rop.llvm_store_value (r, Result);
+        return true;
+    }
+
     if (! Result.has_derivs() || ! any_deriv_args) {
         // Don't compute derivs -- either not needed or not provided in args
         if (Result.typespec().aggregate() == TypeDesc::SCALAR) {
@@ -2167,7 +2232,7 @@ LLVMGEN (llvm_gen_if)
     llvm::BasicBlock* then_block = rop.ll.new_basic_block ("then");
     llvm::BasicBlock* else_block = rop.ll.new_basic_block ("else");
     llvm::BasicBlock* after_block = rop.ll.new_basic_block ("");
-    rop.ll.op_branch (cond_val, then_block, else_block);
+    rop.llvm_profiled_branch (cond_val, then_block, else_block);
 
     // Then block
     rop.build_llvm_code (opnum+1, op.jump(0), then_block);
@@ -2208,7 +2273,7 @@ LLVMGEN (llvm_gen_loop_op)
     llvm::Value* cond_val = rop.llvm_test_nonzero (cond);
 
     // Jump to either LoopBody or AfterLoop
-    rop.ll.op_branch (cond_val, body_block, after_block);
+    rop.llvm_profiled_branch (cond_val, body_block, after_block);
 
     // Body of loop
     rop.build_llvm_code (op.jump(1), op.jump(2), body_block);
@@ -2249,8 +2314,19 @@ llvm_gen_texture_options (BackendLLVM &rop, int opnum,
                           llvm::Value* &alpha, llvm::Value* &dalphadx,
                           llvm::Value* &dalphady, llvm::Value* &errormessage)
 {
-    llvm::Value* opt = rop.ll.call_function ("osl_get_texture_options",
-                                             rop.sg_void_ptr());
+    // Options whose values are constant go into a template TextureOpt,
+    // filled in right here and kept by the group; at run time the
+    // context's TextureOpt is copied from it, and only the options with
+    // varying values still need an osl_texture_set_* call.  (Precompiled
+    // code can't point at the template, so it sets every option.)
+    TextureOpt *tmpl = rop.llvm_aot_output() ? nullptr
+                                             : rop.group().new_texture_opt();
+    llvm::Value* opt = tmpl
+        ? rop.ll.call_function ("osl_get_texture_options_from",
+                                rop.sg_void_ptr(),
+                                rop.ll.constant_ptr (tmpl))
+        : rop.ll.call_function ("osl_get_texture_options",
+                                rop.sg_void_ptr());
     llvm::Value* missingcolor = NULL;
     TextureOpt optdefaults;  // So we can check the defaults
     bool swidth_set = false, twidth_set = false, rwidth_set = false;
@@ -2258,6 +2334,14 @@ llvm_gen_texture_options (BackendLLVM &rop, int opnum,
     bool swrap_set = false, twrap_set = false, rwrap_set = false;
     bool firstchannel_set = false, fill_set = false, interp_set = false;
     bool time_set = false, subimage_set = false;
+    // Once an option has been set by a call, any later constant for it
+    // must be a call too, so that it still overrides.
+    bool swidth_varying = false, twidth_varying = false, rwidth_varying = false;
+    bool sblur_varying = false, tblur_varying = false, rblur_varying = false;
+    bool swrap_varying = false, twrap_varying = false, rwrap_varying = false;
+    bool firstchannel_varying = false, fill_varying = false;
+    bool interp_varying = false, time_varying = false;
+    bool subimage_varying = false, subimagename_varying = false;
 
     Opcode &op (rop.inst()->ops()[opnum]);
     for (int a = first_optional_arg;  a < op.nargs();  ++a) {
@@ -2281,8 +2365,13 @@ llvm_gen_texture_options (BackendLLVM &rop, int opnum,
             if (! paramname##_set &&                                    \
                 ival && *ival == optdefaults.paramname)                 \
                 continue;     /* default constant */                    \
-            llvm::Value *val = rop.llvm_load_value (Val);               \
-            rop.ll.call_function ("osl_texture_set_" #paramname, opt, val); \
+            if (tmpl && ival && ! paramname##_varying) {                \
+                tmpl->paramname = *ival;                                \
+            } else {                                                    \
+                llvm::Value *val = rop.llvm_load_value (Val);           \
+                rop.ll.call_function ("osl_texture_set_" #paramname, opt, val); \
+                paramname##_varying = true;                             \
+            }                                                           \
             paramname##_set = true;                                     \
             continue;                                                   \
         }
@@ -2294,10 +2383,15 @@ llvm_gen_texture_options (BackendLLVM &rop, int opnum,
                 ((ival && *ival == optdefaults.paramname) ||            \
                  (fval && *fval == optdefaults.paramname)))             \
                 continue;     /* default constant */                    \
-            llvm::Value *val = rop.llvm_load_value (Val);               \
-            if (valtype == TypeDesc::INT)                               \
-                val = rop.ll.op_int_to_float (val);                     \
-            rop.ll.call_function ("osl_texture_set_" #paramname, opt, val); \
+            if (tmpl && (ival || fval) && ! paramname##_varying) {      \
+                tmpl->paramname = fval ? *fval : float(*ival);          \
+            } else {                                                    \
+                llvm::Value *val = rop.llvm_load_value (Val);           \
+                if (valtype == TypeDesc::INT)                           \
+                    val = rop.ll.op_int_to_float (val);                 \
+                rop.ll.call_function ("osl_texture_set_" #paramname, opt, val); \
+                paramname##_varying = true;                             \
+            }                                                           \
             paramname##_set = true;                                     \
             continue;                                                   \
         }
@@ -2310,12 +2404,25 @@ llvm_gen_texture_options (BackendLLVM &rop, int opnum,
                 ((ival && *ival == optdefaults.s##paramname) ||         \
                  (fval && *fval == optdefaults.s##paramname)))          \
                 continue;     /* default constant */                    \
-            llvm::Value *val = rop.llvm_load_value (Val);               \
-            if (valtype == TypeDesc::INT)                               \
-                val = rop.ll.op_int_to_float (val);                     \
-            rop.ll.call_function ("osl_texture_set_st" #paramname, opt, val); \
-            if (tex3d)                                                  \
-                rop.ll.call_function ("osl_texture_set_r" #paramname, opt, val); \
+            if (tmpl && (ival || fval) && ! s##paramname##_varying &&   \
+                ! t##paramname##_varying &&                             \
+                ! (tex3d && r##paramname##_varying)) {                  \
+                float v = fval ? *fval : float(*ival);                  \
+                tmpl->s##paramname = v;                                 \
+                tmpl->t##paramname = v;                                 \
+                if (tex3d)                                              \
+                    tmpl->r##paramname = v;                             \
+            } else {                                                    \
+                llvm::Value *val = rop.llvm_load_value (Val);           \
+                if (valtype == TypeDesc::INT)                           \
+                    val = rop.ll.op_int_to_float (val);                 \
+                rop.ll.call_function ("osl_texture_set_st" #paramname, opt, val); \
+                if (tex3d)                                              \
+                    rop.ll.call_function ("osl_texture_set_r" #paramname, opt, val); \
+                s##paramname##_varying = true;                          \
+                t##paramname##_varying = true;                          \
+                r##paramname##_varying = true;                          \
+            }                                                           \
             s##paramname##_set = true;                                  \
             t##paramname##_set = true;                                  \
             r##paramname##_set = true;                                  \
@@ -2328,13 +2435,16 @@ llvm_gen_texture_options (BackendLLVM &rop, int opnum,
                 int code = decoder (Val.get_string());                  \
                 if (! paramname##_set && code == optdefaults.fieldname) \
                     continue;                                           \
-                if (code >= 0) {                                        \
+                if (code >= 0 && tmpl && ! paramname##_varying) {       \
+                    tmpl->fieldname = decltype(tmpl->fieldname)(code);  \
+                } else if (code >= 0) {                                 \
                     llvm::Value *val = rop.ll.constant (code);          \
                     rop.ll.call_function ("osl_texture_set_" #paramname "_code", opt, val); \
                 }                                                       \
             } else {                                                    \
                 llvm::Value *val = rop.llvm_load_value (Val);           \
                 rop.ll.call_function ("osl_texture_set_" #paramname, opt, val); \
+                paramname##_varying = true;                             \
             }                                                           \
             paramname##_set = true;                                     \
             continue;                                                   \
@@ -2350,7 +2460,13 @@ llvm_gen_texture_options (BackendLLVM &rop, int opnum,
         PARAM_FLOAT (rblur)
 
         if (name == Strings::wrap && valtype == TypeDesc::STRING) {
-            if (Val.is_constant()) {
+            if (Val.is_constant() && tmpl && ! swrap_varying &&
+                ! twrap_varying && ! (tex3d && rwrap_varying)) {
+                auto mode = TextureOpt::Wrap (TextureOpt::decode_wrapmode (Val.get_string()));
+                tmpl->swrap = tmpl->twrap = mode;
+                if (tex3d)
+                    tmpl->rwrap = mode;
+            } else if (Val.is_constant()) {
                 int mode = TextureOpt::decode_wrapmode (Val.get_string());
                 llvm::Value *val = rop.ll.constant (mode);
                 rop.ll.call_function ("osl_texture_set_stwrap_code", opt, val);
@@ -2361,6 +2477,7 @@ llvm_gen_texture_options (BackendLLVM &rop, int opnum,
                 rop.ll.call_function ("osl_texture_set_stwrap", opt, val);
                 if (tex3d)
                     rop.ll.call_function ("osl_texture_set_rwrap", opt, val);
+                swrap_varying = twrap_varying = rwrap_varying = true;
             }
             swrap_set = twrap_set = rwrap_set = true;
             continue;
@@ -2381,8 +2498,13 @@ llvm_gen_texture_options (BackendLLVM &rop, int opnum,
                     continue;     // Ignore nulls unless they are overrides
                 }
             }
-            llvm::Value *val = rop.llvm_load_value (Val);
-            rop.ll.call_function ("osl_texture_set_subimagename", opt, val);
+            if (Val.is_constant() && tmpl && ! subimagename_varying) {
+                tmpl->subimagename = Val.get_string();
+            } else {
+                llvm::Value *val = rop.llvm_load_value (Val);
+                rop.ll.call_function ("osl_texture_set_subimagename", opt, val);
+                subimagename_varying = true;
+            }
             subimage_set = true;
             continue;
         }
@@ -2482,7 +2604,8 @@ LLVMGEN (llvm_gen_texture)
                                     alpha, dalphadx, dalphady, errormessage);
 
     RendererServices::TextureHandle *texture_handle = NULL;
-    if (Filename.is_constant() && rop.shadingsys().opt_texture_handle()) {
+    if (Filename.is_constant() && rop.shadingsys().opt_texture_handle()
+          && ! rop.llvm_aot_output()) {
         texture_handle = rop.renderer()->get_texture_handle (Filename.get_string(), rop.shadingcontext());
     }
 
@@ -2508,7 +2631,9 @@ LLVMGEN (llvm_gen_texture)
         rop.ll.void_ptr (dalphady ? dalphady : rop.ll.void_ptr_null()),
         rop.ll.void_ptr (errormessage ? errormessage : rop.ll.void_ptr_null()),
     };
-    rop.ll.call_function ("osl_texture", args);
+    rop.llvm_call_site_begin ();
+    llvm::Value *ok = rop.ll.call_function ("osl_texture", args);
+    rop.llvm_call_site_end (op, ok);
     rop.generated_texture_call (texture_handle != NULL);
     return true;
 }
@@ -2541,7 +2666,8 @@ LLVMGEN (llvm_gen_texture3d)
                                     alpha, dalphadx, dalphady, errormessage);
 
     RendererServices::TextureHandle *texture_handle = NULL;
-    if (Filename.is_constant() && rop.shadingsys().opt_texture_handle()) {
+    if (Filename.is_constant() && rop.shadingsys().opt_texture_handle()
+          && ! rop.llvm_aot_output()) {
         texture_handle = rop.renderer()->get_texture_handle(Filename.get_string(), rop.shadingcontext());
     }
 
@@ -2568,7 +2694,9 @@ LLVMGEN (llvm_gen_texture3d)
         rop.ll.void_ptr (errormessage ? errormessage : rop.ll.void_ptr_null()),
     };
 
-    rop.ll.call_function ("osl_texture3d", args);
+    rop.llvm_call_site_begin ();
+    llvm::Value *ok = rop.ll.call_function ("osl_texture3d", args);
+    rop.llvm_call_site_end (op, ok);
     rop.generated_texture_call (texture_handle != NULL);
     return true;
 }
@@ -2599,7 +2727,8 @@ LLVMGEN (llvm_gen_environment)
                                     alpha, dalphadx, dalphady, errormessage);
 
     RendererServices::TextureHandle *texture_handle = NULL;
-    if (Filename.is_constant() && rop.shadingsys().opt_texture_handle()) {
+    if (Filename.is_constant() && rop.shadingsys().opt_texture_handle()
+          && ! rop.llvm_aot_output()) {
         texture_handle = rop.renderer()->get_texture_handle(Filename.get_string(), rop.shadingcontext());
     }
 
@@ -2622,7 +2751,9 @@ LLVMGEN (llvm_gen_environment)
         dalphady ? rop.ll.void_ptr (dalphady) : rop.ll.void_ptr_null(),
         rop.ll.void_ptr (errormessage ? errormessage : rop.ll.void_ptr_null()),
     };
-    rop.ll.call_function ("osl_environment", args);
+    rop.llvm_call_site_begin ();
+    llvm::Value *ok = rop.ll.call_function ("osl_environment", args);
+    rop.llvm_call_site_end (op, ok);
     rop.generated_texture_call (texture_handle != NULL);
     return true;
 }
@@ -2763,6 +2894,24 @@ llvm_gen_noise_options (BackendLLVM &rop, int opnum,
             rop.ll.call_function ("osl_noiseparams_set_impulses", opt,
                                     rop.llvm_load_value (Val, 0, NULL, 0,
                                                          TypeDesc::TypeFloat));
+        } else if (name == Strings::fast && Val.typespec().is_int()) {
+            rop.ll.call_function ("osl_noiseparams_set_fast", opt,
+                                    rop.llvm_load_value (Val));
+        } else if (name == Strings::octaves &&
+                   (Val.typespec().is_float() || Val.typespec().is_int())) {
+            rop.ll.call_function ("osl_noiseparams_set_octaves", opt,
+                                    rop.llvm_load_value (Val, 0, NULL, 0,
+                                                         TypeDesc::TypeInt));
+        } else if (name == Strings::lacunarity &&
+                   (Val.typespec().is_float() || Val.typespec().is_int())) {
+            rop.ll.call_function ("osl_noiseparams_set_lacunarity", opt,
+                                    rop.llvm_load_value (Val, 0, NULL, 0,
+                                                         TypeDesc::TypeFloat));
+        } else if (name == Strings::gain &&
+                   (Val.typespec().is_float() || Val.typespec().is_int())) {
+            rop.ll.call_function ("osl_noiseparams_set_gain", opt,
+                                    rop.llvm_load_value (Val, 0, NULL, 0,
+                                                         TypeDesc::TypeFloat));
         } else {
             rop.shadingcontext()->errorfmt(
                 "Unknown {} optional argument: \"{}\", <{}> ({}:{})",
@@ -2863,6 +3012,14 @@ LLVMGEN (llvm_gen_noise)
         pass_options = true;
         derivs = true;
         name = periodic ? Strings::gaborpnoise : Strings::gabornoise;
+    } else if (name == Strings::fbm && !periodic) {
+        // Sums its octaves in one call; an "octaves" given as a constant
+        // folds the octave dispatch once the shadeop is inlined.
+        pass_name = true;
+        pass_sg = true;
+        pass_options = true;
+        derivs = true;
+        name = Strings::fbmnoise;
     } else {
         rop.shadingcontext()->errorfmt(
             "{}noise type \"{}\" is unknown, called from ({}:{})",
@@ -3016,6 +3173,15 @@ LLVMGEN (llvm_gen_getattribute)
         attr_name_arg = rop.llvm_load_value (Attribute);
     }
 
+    // When the names are known now, let the renderer resolve them to a
+    // handle, so it needn't dispatch on them each time the op runs.
+    void *attr_handle = nullptr;
+    if (! rop.use_optix() && Attribute.is_constant()
+          && (! object_lookup || ObjectName.is_constant()))
+        attr_handle = rop.renderer()->resolve_attribute (
+            object_lookup ? ObjectName.get_string() : ustring(),
+            Attribute.get_string(), dest_type);
+
     llvm::Value * args[] = {
             rop.sg_void_ptr(),
             rop.ll.constant ((int)Destination.has_derivs()),
@@ -3025,8 +3191,11 @@ LLVMGEN (llvm_gen_getattribute)
             rop.llvm_load_value (Index),
             rop.ll.constant (dest_type),
             rop.llvm_void_ptr (Destination),
+            rop.ll.constant_ptr (attr_handle),
     };
+    rop.llvm_call_site_begin ();
     llvm::Value *r = rop.ll.call_function ("osl_get_attribute", args);
+    rop.llvm_call_site_end (op, r);
     rop.llvm_store_value (r, Result);
 
     return true;
@@ -3056,7 +3225,8 @@ LLVMGEN (llvm_gen_gettextureinfo)
              Result.typespec().is_int());
 
     RendererServices::TextureHandle *texture_handle = NULL;
-    if (Filename.is_constant() && rop.shadingsys().opt_texture_handle()) {
+    if (Filename.is_constant() && rop.shadingsys().opt_texture_handle()
+          && ! rop.llvm_aot_output()) {
         texture_handle = rop.renderer()->get_texture_handle(Filename.get_string(), rop.shadingcontext());
     }
 
@@ -3131,6 +3301,17 @@ LLVMGEN (llvm_gen_getmessage)
     args[7] = rop.ll.constant(op.sourcefile());
     args[8] = rop.ll.constant(op.sourceline());
 
+    // A message with a slot in the group data (see opt_message_slots)
+    // is found there, with the slot taking the place of the source. (Only
+    // constant sources are given slots; "trace" still asks the renderer.)
+    int slot = Name.is_constant() ? rop.message_slot_field (Name.get_string()) : -1;
+    if (slot >= 0 && (! has_source || Source.get_string() != "trace")) {
+        args[1] = rop.groupdata_field_ptr (slot);
+        llvm::Value *r = rop.ll.call_function ("osl_getmessage_slot", args);
+        rop.llvm_store_value (r, Result);
+        return true;
+    }
+
     llvm::Value *r = rop.ll.call_function ("osl_getmessage", args);
     rop.llvm_store_value (r, Result);
     return true;
@@ -3165,6 +3346,16 @@ LLVMGEN (llvm_gen_setmessage)
     args[5] = rop.ll.constant(op.sourcefile());
     args[6] = rop.ll.constant(op.sourceline());
 
+    int slot = Name.is_constant() ? rop.message_slot_field (Name.get_string()) : -1;
+    if (slot >= 0) {
+        // The message has a slot in the group data (see opt_message_slots)
+        llvm::Value *slot_args[8] = { args[0], rop.groupdata_field_ptr (slot),
+                                      args[1], args[2], args[3], args[4],
+                                      args[5], args[6] };
+        rop.ll.call_function ("osl_setmessage_slot", slot_args);
+        return true;
+    }
+
     rop.ll.call_function ("osl_setmessage", args);
     return true;
 }
@@ -3378,7 +3569,7 @@ LLVMGEN (llvm_gen_closure)
 
     // Call osl_allocate_closure_component(closure, id, size).  It returns
     // the memory for the closure parameter data.
-    llvm::Value *render_ptr = rop.ll.constant_ptr(rop.shadingsys().renderer(), rop.ll.type_void_ptr());
+    llvm::Value *render_ptr = rop.llvm_process_ptr(rop.shadingsys().renderer(), "renderer");
     llvm::Value *sg_ptr = rop.sg_void_ptr();
     llvm::Value *id_int = rop.ll.constant(clentry->id);
     llvm::Value *size_int = rop.ll.constant(clentry->struct_size);
@@ -3390,9 +3581,10 @@ LLVMGEN (llvm_gen_closure)
     // For the weighted closures, we need a surrounding "if" so that it's safe
     // for osl_allocate_weighted_closure_component to return NULL (unless we
     // know for sure that it's constant weighted and that the weight is
-    // not zero).
+    // not zero, and no threshold could prune it either).
     llvm::BasicBlock *next_block = NULL;
-    if (weighted && ! (weight->is_constant() && !rop.is_zero(*weight))) {
+    if (weighted && ! (weight->is_constant() && !rop.is_zero(*weight)
+                       && rop.shadingsys().closure_weight_threshold() == 0.0f)) {
         llvm::BasicBlock *notnull_block = rop.ll.new_basic_block ("non_null_closure");
         next_block = rop.ll.new_basic_block ("");
         llvm::Value *cond = rop.ll.op_ne (return_ptr, rop.ll.void_ptr_null());
@@ -3410,7 +3602,9 @@ LLVMGEN (llvm_gen_closure)
     // zero out the closure parameter memory.
     if (clentry->prepare) {
         // Call clentry->prepare(renderservices *, int id, void *mem)
-        llvm::Value *funct_ptr = rop.ll.constant_ptr((void *)clentry->prepare, rop.llvm_type_prepare_closure_func());
+        llvm::Value *funct_ptr = rop.llvm_process_ptr((void *)clentry->prepare,
+                                                      fmtformat("closure_prepare_{}", clentry->id),
+                                                      rop.llvm_type_prepare_closure_func());
         llvm::Value *args[] = {render_ptr, id_int, mem_void_ptr};
         rop.ll.call_function (funct_ptr, args);
     } else {
@@ -3448,7 +3642,9 @@ LLVMGEN (llvm_gen_closure)
     // setup(render_services, id, mem_ptr).
     if (clentry->setup) {
         // Call clentry->setup(renderservices *, int id, void *mem)
-        llvm::Value *funct_ptr = rop.ll.constant_ptr((void *)clentry->setup, rop.llvm_type_setup_closure_func());
+        llvm::Value *funct_ptr = rop.llvm_process_ptr((void *)clentry->setup,
+                                                      fmtformat("closure_setup_{}", clentry->id),
+                                                      rop.llvm_type_setup_closure_func());
         llvm::Value *args[] = {render_ptr, id_int, mem_void_ptr};
         rop.ll.call_function (funct_ptr, args);
     }
@@ -3491,9 +3687,17 @@ LLVMGEN (llvm_gen_pointcloud_search)
     }
     int nattrs = (op.nargs() - attr_arg_offset) / 2;
 
+    // On the GPU the names are passed as device strings (hashes), which
+    // the renderer's device pointcloud functions look the clouds and
+    // attributes up by.
+    auto load_name = [&](const Symbol& sym) {
+        return rop.use_optix() ? rop.llvm_load_device_string (sym, /*follow*/ true)
+                               : rop.llvm_load_value (sym);
+    };
+
     std::vector<llvm::Value *> args;
     args.push_back (rop.sg_void_ptr());                // 0 sg
-    args.push_back (rop.llvm_load_value (Filename));   // 1 filename
+    args.push_back (load_name (Filename));             // 1 filename
     args.push_back (rop.llvm_void_ptr   (Center));     // 2 center
     args.push_back (rop.llvm_load_value (Radius));     // 3 radius
 
@@ -3535,7 +3739,7 @@ LLVMGEN (llvm_gen_pointcloud_search)
             }
         } else {
             // It is a regular attribute, push it to the arg list
-            args.push_back (rop.llvm_load_value (Name));
+            args.push_back (load_name (Name));
             args.push_back (rop.ll.constant (simpletype));
             args.push_back (rop.llvm_void_ptr (Value));
             if (Value.has_derivs())
@@ -3568,7 +3772,9 @@ LLVMGEN (llvm_gen_pointcloud_search)
         args[maxPointsArgumentIndex] = clampedMaxPoints;
     }
 
+    rop.llvm_call_site_begin ();
     llvm::Value *count = rop.ll.call_function ("osl_pointcloud_search", args);
+    rop.llvm_call_site_end (op, count);
     // Clear derivs if necessary
     for (size_t i = 0; i < clear_derivs_of.size(); ++i)
         rop.llvm_zero_derivs (*clear_derivs_of[i], count);
@@ -3605,14 +3811,18 @@ LLVMGEN (llvm_gen_pointcloud_get)
     // Convert 32bit indices to 64bit
     llvm::Value * args[] = {
         rop.sg_void_ptr(),
-        rop.llvm_load_value (Filename),
+        rop.use_optix() ? rop.llvm_load_device_string (Filename, /*follow*/ true)
+                        : rop.llvm_load_value (Filename),
         rop.llvm_void_ptr (Indices),
         clampedCount,
-        rop.llvm_load_value (Attr_name),
+        rop.use_optix() ? rop.llvm_load_device_string (Attr_name, /*follow*/ true)
+                        : rop.llvm_load_value (Attr_name),
         rop.ll.constant (Data.typespec().simpletype()),
         rop.llvm_void_ptr (Data),
     };
+    rop.llvm_call_site_begin ();
     llvm::Value *found = rop.ll.call_function ("osl_pointcloud_get", args);
+    rop.llvm_call_site_end (op, found);
     rop.llvm_store_value (found, Result);
     if (Data.has_derivs()) {
         rop.llvm_zero_derivs (Data, clampedCount);
@@ -3668,7 +3878,9 @@ LLVMGEN (llvm_gen_pointcloud_write)
         rop.ll.void_ptr (types),   // attribute types array
         rop.ll.void_ptr (values)   // attribute values array
     };
+    rop.llvm_call_site_begin ();
     llvm::Value *ret = rop.ll.call_function ("osl_pointcloud_write", args);
+    rop.llvm_call_site_end (op, ret);
     rop.llvm_store_value (ret, Result);
 
     return true;
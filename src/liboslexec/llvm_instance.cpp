@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <unordered_map>
@@ -132,6 +133,17 @@ static ustring op_aref("aref");
 static ustring op_compref("compref");
 static ustring op_mxcompref("mxcompref");
 static ustring op_useparam("useparam");
+static ustring op_if("if");
+static ustring op_for("for");
+static ustring op_while("while");
+static ustring op_dowhile("dowhile");
+static ustring op_setmessage("setmessage");
+static ustring op_getmessage("getmessage");
+static ustring u_trace("trace");
+static ustring op_exit("exit");
+static ustring op_return("return");
+static ustring op_functioncall("functioncall");
+static ustring op_functioncall_nr("functioncall_nr");
 static ustring unknown_shader_group_name("<Unknown Shader Group Name>");
 
 
@@ -234,6 +246,87 @@ BackendLLVM::llvm_type_sg_ptr ()
 
 
 
+// How likely is the groupdata field of param sym to be touched by every
+// shading point? 0 = it carries a value between layers, 1 = the code or
+// the renderer uses it, 2 = nothing touches it, or it's a big array that
+// would push the others apart.
+static int
+groupdata_field_heat (const Symbol &sym)
+{
+    const int derivSize = (sym.has_derivs() ? 3 : 1);
+    if (sym.typespec().is_array() && derivSize * sym.size() > 256)
+        return 2;
+    if (sym.connected() || sym.connected_down())
+        return 0;
+    if (sym.everused() || sym.renderer_output())
+        return 1;
+    return 2;
+}
+
+
+
+// Is the groupdata field of param sym never looked at by anything but
+// its own layer's code -- not by a downstream layer, not by the renderer?
+static bool
+groupdata_field_is_layer_private (const Symbol &sym)
+{
+    return sym.symtype() == SymTypeParam && ! sym.connected_down()
+        && ! sym.renderer_output();
+}
+
+
+
+// The messages that can live in MessageSlots: those whose name is a
+// constant in every setmessage and getmessage of the group that uses it,
+// which all agree on the type. A name that isn't known until run time
+// could be any message, so then there are none.
+static std::vector<std::pair<ustring,TypeDesc>>
+find_message_slots (ShaderGroup &group)
+{
+    std::vector<std::pair<ustring,TypeDesc>> slots;
+    std::set<ustring> ineligible;
+    for (int layer = 0;  layer < group.nlayers();  ++layer) {
+        ShaderInstance *inst = group[layer];
+        if (inst->unused())
+            continue;
+        for (auto&& op : inst->ops()) {
+            bool get = (op.opname() == op_getmessage);
+            if (! get && op.opname() != op_setmessage)
+                continue;
+            int has_source = (get && op.nargs() == 4);
+            Symbol &Name (*inst->argsymbol (op.firstarg() + (get ? 1+has_source : 0)));
+            Symbol &Data (*inst->argsymbol (op.firstarg() + (get ? 2+has_source : 1)));
+            if (! Name.is_constant())
+                return {};
+            if (has_source) {
+                Symbol &Source (*inst->argsymbol (op.firstarg() + 1));
+                if (! Source.is_constant())
+                    ineligible.insert (Name.get_string());
+                if (! Source.is_constant() || Source.get_string() == u_trace)
+                    continue;   // asks the renderer, not the blackboard
+            }
+            TypeDesc type = Data.typespec().is_closure_based()
+                          ? TypeDesc (TypeDesc::PTR, Data.typespec().arraylength())
+                          : Data.typespec().simpletype();
+            auto found = std::find_if (slots.begin(), slots.end(),
+                             [&](const std::pair<ustring,TypeDesc> &s) {
+                                 return s.first == Name.get_string();
+                             });
+            if (found == slots.end())
+                slots.emplace_back (Name.get_string(), type);
+            else if (found->second != type)
+                ineligible.insert (Name.get_string());  // leave mismatch errors to the blackboard
+        }
+    }
+    slots.erase (std::remove_if (slots.begin(), slots.end(),
+                     [&](const std::pair<ustring,TypeDesc> &s) {
+                         return ineligible.count (s.first) != 0;
+                     }), slots.end());
+    return slots;
+}
+
+
+
 llvm::Type *
 BackendLLVM::llvm_type_groupdata ()
 {
@@ -295,51 +388,159 @@ BackendLLVM::llvm_type_groupdata ()
         }
     }
 
+    // Next, a MessageSlot for each message that can have one.
+    m_message_slots.clear ();
+    if (shadingsys().opt_message_slots() && ! use_optix()) {
+        for (auto&& slot : find_message_slots (group())) {
+            int size = (int) MessageSlot::size_for (slot.second);
+            offset = OIIO::round_to_multiple_of_pow2 (offset, 8);
+            if (llvm_debug() >= 2)
+                std::cout << "  message slot \"" << slot.first << "\" "
+                          << slot.second << ", field " << order
+                          << ", offset " << offset << "\n";
+            fields.push_back (ll.type_array (ll.type_longlong(), size / 8));
+            m_message_slots[slot.first] = order;
+            offset += size;
+            ++order;
+        }
+    }
+
     // For each layer in the group, add entries for all params that are
     // connected or interpolated, and output params.  Also mark those
     // symbols with their offset within the group struct.
-    m_param_order_map.clear ();
+    // With opt_groupdata_share, the params that only their own layer
+    // ever looks at are set aside to be overlapped further down.
+    struct GroupdataField { int layer; Symbol *sym; int heat; };
+    std::vector<GroupdataField> params;
+    const bool share = shadingsys().opt_groupdata_share();
+    std::vector<std::vector<Symbol *>> layer_private (group().nlayers());
     for (int layer = 0;  layer < group().nlayers();  ++layer) {
         ShaderInstance *inst = group()[layer];
         if (inst->unused())
             continue;
         FOREACH_PARAM (Symbol &sym, inst) {
-            TypeSpec ts = sym.typespec();
-            if (ts.is_structure())  // skip the struct symbol itself
+            if (sym.typespec().is_structure())  // skip the struct symbol itself
                 continue;
-            const int arraylen = std::max (1, sym.typespec().arraylength());
-            const int derivSize = (sym.has_derivs() ? 3 : 1);
-            ts.make_array (arraylen * derivSize);
-            fields.push_back (llvm_type (ts));
-
-            // FIXME(arena) -- temporary debugging
-            if (debug() && sym.symtype() == SymTypeOutputParam
-                && !sym.connected_down()) {
-                auto found = group().find_symloc(sym.name());
-                if (found)
-                    OIIO::Strutil::print("layer {} \"{}\" : OUTPUT {}\n",
-                                         layer, inst->layername(), found->name);
-            }
+            if (share && groupdata_field_is_layer_private (sym))
+                layer_private[layer].push_back (&sym);
+            else
+                params.push_back ({ layer, &sym, groupdata_field_heat (sym) });
+        }
+    }
+    // Optionally put the fields most likely to be touched on every point
+    // together at the front, keeping layer order within each class.
+    if (shadingsys().opt_groupdata_layout())
+        std::stable_sort (params.begin(), params.end(),
+                          [](const GroupdataField &a, const GroupdataField &b) {
+                              return a.heat < b.heat;
+                          });
+    m_param_order_map.clear ();
+    for (auto&& p : params) {
+        int layer = p.layer;
+        ShaderInstance *inst = group()[layer];
+        Symbol &sym (*p.sym);
+        TypeSpec ts = sym.typespec();
+        const int arraylen = std::max (1, sym.typespec().arraylength());
+        const int derivSize = (sym.has_derivs() ? 3 : 1);
+        ts.make_array (arraylen * derivSize);
+        fields.push_back (llvm_type (ts));
+
+        // FIXME(arena) -- temporary debugging
+        if (debug() && sym.symtype() == SymTypeOutputParam
+            && !sym.connected_down()) {
+            auto found = group().find_symloc(sym.name());
+            if (found)
+                OIIO::Strutil::print("layer {} \"{}\" : OUTPUT {}\n",
+                                     layer, inst->layername(), found->name);
+        }
 
-            // Alignment
-            size_t align = sym.typespec().is_closure_based() ? sizeof(void*) :
-                    sym.typespec().simpletype().basesize();
-            if (offset & (align-1))
-                offset += align - (offset & (align-1));
+        // Alignment
+        size_t align = sym.typespec().is_closure_based() ? sizeof(void*) :
+                sym.typespec().simpletype().basesize();
+        if (offset & (align-1))
+            offset += align - (offset & (align-1));
+        if (llvm_debug() >= 2)
+            std::cout << "  " << inst->layername() 
+                      << " (" << inst->id() << ") " << sym.mangled()
+                      << " " << ts.c_str() << ", field " << order 
+                      << ", size " << derivSize * int(sym.size())
+                      << ", offset " << offset << std::endl;
+        place_groupdata (sym, offset);
+        // TODO(arenas): sym.set_dataoffset(SymArena::Heap, offset);
+        offset += derivSize * sym.size();
+        m_param_order_map[&sym] = order;
+        ++order;
+    }
+
+    // A layer's private params are only live while that layer runs, and
+    // two layers can only be running at the same time if one of them is
+    // (maybe indirectly) upstream of the other, having been run lazily
+    // from within it. So the private params of layers with no connection
+    // path between them can share the same bytes. They go in one trailing
+    // byte array and are addressed by their offset rather than by field.
+    int nlayers = group().nlayers();
+    std::vector<std::vector<bool>> upstream (share ? nlayers : 0,
+                                             std::vector<bool>(nlayers));
+    if (share) {
+        for (int layer = 0;  layer < nlayers;  ++layer) {
+            ShaderInstance *inst = group()[layer];
+            for (int c = 0, e = inst->nconnections();  c < e;  ++c) {
+                int src = inst->connection(c).srclayer;
+                upstream[layer][src] = true;
+                for (int i = 0;  i < src;  ++i)
+                    if (upstream[src][i])
+                        upstream[layer][i] = true;
+            }
+        }
+    }
+    size_t private_begin = offset, private_end = offset;
+    size_t unshared_size = 0;
+    std::vector<size_t> layer_end (nlayers, 0);
+    for (int layer = 0;  layer < nlayers;  ++layer) {
+        if (layer_private[layer].empty())
+            continue;
+        ShaderInstance *inst = group()[layer];
+        size_t start = private_begin;
+        for (int i = 0;  i < layer;  ++i)
+            if ((upstream[layer][i] || upstream[i][layer]) && layer_end[i])
+                start = std::max (start, layer_end[i]);
+        size_t end = start;
+        for (Symbol *sym : layer_private[layer]) {
+            const int derivSize = (sym->has_derivs() ? 3 : 1);
+            size_t align = sym->typespec().is_closure_based() ? sizeof(void*) :
+                    sym->typespec().simpletype().basesize();
+            end = OIIO::round_to_multiple_of_pow2 (end, align);
             if (llvm_debug() >= 2)
-                std::cout << "  " << inst->layername() 
-                          << " (" << inst->id() << ") " << sym.mangled()
-                          << " " << ts.c_str() << ", field " << order 
-                          << ", size " << derivSize * int(sym.size())
-                          << ", offset " << offset << std::endl;
-            sym.dataoffset ((int)offset);
-            // TODO(arenas): sym.set_dataoffset(SymArena::Heap, offset);
-            offset += derivSize * sym.size();
-            m_param_order_map[&sym] = order;
-            ++order;
+                std::cout << "  " << inst->layername()
+                          << " (" << inst->id() << ") " << sym->mangled()
+                          << " " << sym->typespec().c_str() << ", private"
+                          << ", size " << derivSize * int(sym->size())
+                          << ", offset " << end << std::endl;
+            place_groupdata (*sym, end);
+            end += derivSize * sym->size();
+            unshared_size += derivSize * sym->size();
+            m_param_order_map[sym] = -1;
         }
+        layer_end[layer] = end;
+        private_end = std::max (private_end, end);
     }
-    group().llvm_groupdata_size (offset);
+    if (private_end > private_begin) {
+        fields.push_back (ll.type_array (ll.type_int8(),
+                                         int(private_end - private_begin)));
+        ++order;
+        if (llvm_debug() >= 2)
+            std::cout << "  layer private params: " << unshared_size
+                      << " bytes in " << (private_end - private_begin)
+                      << " at offset " << private_begin << "\n";
+        shadingsys().m_stat_groupdata_bytes_shared
+            += int(unshared_size - (private_end - private_begin));
+        offset = private_end;
+    }
+    if (group().jitted()) {
+        if (offset != group().llvm_groupdata_size())
+            m_groupdata_layout_changed = true;
+    } else
+        group().llvm_groupdata_size (offset);
     if (llvm_debug() >= 2)
         std::cout << " Group struct had " << order << " fields, total size "
                   << offset << "\n\n";
@@ -353,6 +554,21 @@ BackendLLVM::llvm_type_groupdata ()
 
 
 
+void
+BackendLLVM::place_groupdata (Symbol &sym, size_t offset)
+{
+    // A tiered re-JIT lays the group out exactly as the JIT before it,
+    // whose code other threads may be running and reading the offsets
+    // with right now, so it leaves them alone.
+    if (group().jitted()) {
+        if (sym.dataoffset() != (int)offset)
+            m_groupdata_layout_changed = true;
+    } else
+        sym.dataoffset ((int)offset);
+}
+
+
+
 llvm::Type *
 BackendLLVM::llvm_type_groupdata_ptr ()
 {
@@ -385,6 +601,19 @@ BackendLLVM::llvm_type_closure_component_ptr ()
 
 
 
+// Must the group init function give this closure param its (null)
+// storage, or can its own layer do that as it starts? Only the group init
+// runs early enough for a param that an earlier layer writes through a
+// connection, or that the renderer may read even if its layer never runs.
+static bool
+closure_param_needs_group_init (const Symbol& sym)
+{
+    return sym.connected() || sym.valuesource() == Symbol::ConnectedVal
+           || sym.renderer_output();
+}
+
+
+
 void
 BackendLLVM::llvm_assign_initial_value (const Symbol& sym, bool force)
 {
@@ -400,16 +629,24 @@ BackendLLVM::llvm_assign_initial_value (const Symbol& sym, bool force)
     int arraylen = std::max (1, sym.typespec().arraylength());
 
     // Closures need to get their storage before anything can be
-    // assigned to them.  Unless they are params, in which case we took
-    // care of it in the group entry point.
+    // assigned to them.  Unless they are params that the group entry point
+    // took care of.
     if (sym.typespec().is_closure_based() &&
         sym.symtype() != SymTypeParam && sym.symtype() != SymTypeOutputParam) {
         llvm_assign_zero (sym);
         return;
     }
+    if (sym.typespec().is_closure_based() && ! force
+        && ! closure_param_needs_group_init (sym)) {
+        llvm::Value *null = ll.constant_ptr (NULL, ll.type_void_ptr());
+        for (int a = 0; a < arraylen;  ++a) {
+            llvm::Value *arrind = sym.typespec().is_array() ? ll.constant(a) : NULL;
+            llvm_store_value (null, sym, 0, arrind, 0);
+        }
+    }
 
     if ((sym.symtype() == SymTypeLocal || sym.symtype() == SymTypeTemp)
-          && shadingsys().debug_uninit()) {
+          && shadingsys().debug_uninit(group())) {
         // Handle the "debug uninitialized values" case
         bool isarray = sym.typespec().is_array();
         int alen = isarray ? sym.typespec().arraylength() : 1;
@@ -469,6 +706,8 @@ BackendLLVM::llvm_assign_initial_value (const Symbol& sym, bool force)
         symloc = group().find_symloc(layersym, SymArena::UserData);
         if (! symloc)
             symloc = group().find_symloc(sym.name(), SymArena::UserData);
+        if (symloc && symloc->soa)
+            symloc = nullptr;   // placed for batched execution only
         if (symloc) {
             // We had a userdata pre-placement record for this variable.
             // Just copy from the correct offset location!
@@ -514,7 +753,7 @@ BackendLLVM::llvm_assign_initial_value (const Symbol& sym, bool force)
             };
             got_userdata = ll.call_function ("osl_bind_interpolated_param", args);
         }
-        if (shadingsys().debug_nan() && type.basetype == TypeDesc::FLOAT) {
+        if (shadingsys().debug_nan(group()) && type.basetype == TypeDesc::FLOAT) {
             // check for NaN/Inf for float-based types
             int ncomps = type.numelements() * type.aggregate;
             llvm::Value *args[] = { ll.constant(ncomps), llvm_void_ptr(sym),
@@ -571,7 +810,10 @@ BackendLLVM::llvm_assign_initial_value (const Symbol& sym, bool force)
         } else if (! sym.lockgeom() && ! sym.typespec().is_closure()) {
             // geometrically-varying param; memcpy its default value
             TypeDesc t = sym.typespec().simpletype();
-            ll.op_memcpy (llvm_void_ptr (sym), ll.constant_ptr (sym.data()),
+            llvm::Value *init_val = llvm_aot_output()
+                                  ? ll.constant_data_ptr (sym.data(), t.size())
+                                  : ll.constant_ptr (sym.data());
+            ll.op_memcpy (llvm_void_ptr (sym), init_val,
                           t.size(), t.basesize() /*align*/);
             if (sym.has_derivs())
                 llvm_zero_derivs (sym);
@@ -816,9 +1058,12 @@ BackendLLVM::build_llvm_code (int beginop, int endop, llvm::BasicBlock *bb)
 
     for (int opnum = beginop;  opnum < endop;  ++opnum) {
         const Opcode& op = inst()->ops()[opnum];
+        if (m_counting_blocks
+            && (opnum == beginop || bblockid(opnum) != bblockid(opnum-1)))
+            llvm_profile_block (opnum);
         const OpDescriptor *opd = shadingsys().op_descriptor (op.opname());
         if (opd && opd->llvmgen) {
-            if (shadingsys().debug_uninit() /* debug uninitialized vals */)
+            if (shadingsys().debug_uninit(group()) /* debug uninitialized vals */)
                 llvm_generate_debug_uninit (op);
             if (shadingsys().llvm_debug_ops())
                 llvm_generate_debug_op_printf (op);
@@ -827,7 +1072,7 @@ BackendLLVM::build_llvm_code (int beginop, int endop, llvm::BasicBlock *bb)
             bool ok = (*opd->llvmgen) (*this, opnum);
             if (! ok)
                 return false;
-            if (shadingsys().debug_nan() /* debug NaN/Inf */
+            if (shadingsys().debug_nan(group()) /* debug NaN/Inf */
                 && op.farthest_jump() < 0 /* Jumping ops don't need it */) {
                 llvm_generate_debugnan (op);
             }
@@ -852,6 +1097,28 @@ BackendLLVM::build_llvm_code (int beginop, int endop, llvm::BasicBlock *bb)
 
 
 
+void
+BackendLLVM::llvm_profile_block (int opnum)
+{
+    // The block runs until the op whose block id differs. Note every line
+    // it has code on, so the listing can show a count for each of them.
+    const OpcodeVec &ops (inst()->ops());
+    std::vector<int> lines;
+    for (int n = opnum, e = (int)ops.size();
+         n < e && bblockid(n) == bblockid(opnum);  ++n) {
+        if (ops[n].sourceline() > 0 && ops[n].sourcefile() == ops[opnum].sourcefile())
+            lines.push_back (ops[n].sourceline());
+    }
+    std::sort (lines.begin(), lines.end());
+    lines.erase (std::unique (lines.begin(), lines.end()), lines.end());
+    if (lines.empty())
+        return;
+    int block = shadingsys().profile_block (ops[opnum].sourcefile(), lines);
+    ll.call_function ("osl_profile_block", sg_void_ptr(), ll.constant (block));
+}
+
+
+
 llvm::Function*
 BackendLLVM::build_llvm_init ()
 {
@@ -900,15 +1167,23 @@ BackendLLVM::build_llvm_init ()
         int sz = (num_userdata + 3) & (~3);  // round up to 32 bits
         ll.op_memset (ll.void_ptr(userdata_initialized_ref(0)), 0, sz, 4 /*align*/);
     }
-
-    // Group init also needs to allot space for ALL layers' params
-    // that are closures (to avoid weird order of layer eval problems).
+    // ... and empties the message slots, like the blackboard is emptied
+    for (auto&& slot : m_message_slots)
+        ll.op_store (ll.constant (int(MessageSlot::Empty)),
+                     groupdata_field_ptr (slot.second, TypeDesc::TypeInt));
+
+    // Group init also needs to allot space for the closure params that
+    // may be written or read before their own layer runs (to avoid weird
+    // order of layer eval problems). The rest, usually most of them, are
+    // left to their layer's start, so layers that lazy evaluation never
+    // runs cost nothing here.
     for (int i = 0;  i < group().nlayers();  ++i) {
         ShaderInstance *gi = group()[i];
         if (gi->unused() || gi->empty_instance())
             continue;
         FOREACH_PARAM (Symbol &sym, gi) {
-           if (sym.typespec().is_closure_based()) {
+           if (sym.typespec().is_closure_based()
+                 && closure_param_needs_group_init (sym)) {
                 int arraylen = std::max (1, sym.typespec().arraylength());
                 llvm::Value *val = ll.constant_ptr(NULL, ll.type_void_ptr());
                 for (int a = 0; a < arraylen;  ++a) {
@@ -1002,12 +1277,17 @@ BackendLLVM::build_llvm_instance (bool groupentry)
     if (shadingsys().llvm_debug_layers())
         llvm_gen_debug_printf (Strutil::sprintf("enter layer %d %s %s",
                                this->layer(), inst()->layername(), inst()->shadername()));
-    // Mark this layer as executed
+    // Mark this layer as executed (unless it's run upfront, in which case
+    // nobody checks)
     if (! group().is_last_layer(layer())) {
-        ll.op_store (ll.constant_bool(true), layerfield);
+        if (! m_layer_run_upfront[layer()])
+            ll.op_store (ll.constant_bool(true), layerfield);
         if (shadingsys().countlayerexecs())
             ll.call_function ("osl_incr_layers_executed", sg_void_ptr());
     }
+    if (shadingsys().profile() >= 2)
+        ll.call_function ("osl_layer_profile_begin", sg_void_ptr(),
+                          ll.constant(layer()));
 
     // Setup the symbols
     m_named_values.clear ();
@@ -1025,6 +1305,8 @@ BackendLLVM::build_llvm_instance (bool groupentry)
         if (s.symtype() == SymTypeLocal || s.symtype() == SymTypeTemp ||
                 s.symtype() == SymTypeConst)
             getOrAllocateLLVMSymbol (s);
+        if (s.symtype() == SymTypeLocal || s.symtype() == SymTypeTemp)
+            llvm_init_unused_derivs (s);
         // Set initial value for constants, closures, and strings that are
         // not parameters.
         if (s.symtype() != SymTypeParam && s.symtype() != SymTypeOutputParam &&
@@ -1032,10 +1314,10 @@ BackendLLVM::build_llvm_instance (bool groupentry)
             (s.is_constant() || s.typespec().is_closure_based() ||
              s.typespec().is_string_based() || 
              ((s.symtype() == SymTypeLocal || s.symtype() == SymTypeTemp)
-              && shadingsys().debug_uninit())))
+              && shadingsys().debug_uninit(group()))))
             llvm_assign_initial_value (s);
         // If debugnan is turned on, globals check that their values are ok
-        if (s.symtype() == SymTypeGlobal && shadingsys().debug_nan()) {
+        if (s.symtype() == SymTypeGlobal && shadingsys().debug_nan(group())) {
             TypeDesc t = s.typespec().simpletype();
             if (t.basetype == TypeDesc::FLOAT) { // just check float-based types
                 int ncomps = t.numelements() * t.aggregate;
@@ -1067,6 +1349,7 @@ BackendLLVM::build_llvm_instance (bool groupentry)
                 && ! s.connected() && ! s.connected_down()
                 && shadingsys().lazy_userdata())
             continue;
+        llvm_init_unused_derivs (s);
         // Set initial value for params (may contain init ops)
         llvm_assign_initial_value (s);
     }
@@ -1079,7 +1362,8 @@ BackendLLVM::build_llvm_instance (bool groupentry)
         // parameter initialization for this layer.
         for (int i = 0;  i < group().nlayers()-1;  ++i) {
             ShaderInstance *gi = group()[i];
-            if (!gi->unused() && !gi->empty_instance() && !gi->run_lazily())
+            if ((!gi->unused() && !gi->empty_instance() && !gi->run_lazily())
+                || m_layer_run_upfront[i])
                 llvm_call_layer (i, true /* unconditionally run */);
         }
     }
@@ -1089,7 +1373,9 @@ BackendLLVM::build_llvm_instance (bool groupentry)
     find_basic_blocks ();
     find_conditionals ();
 
+    m_counting_blocks = profile_blocks();
     build_llvm_code (inst()->maincodebegin(), inst()->maincodeend());
+    m_counting_blocks = false;
 
     if (llvm_has_exit_instance_block())
         ll.op_branch (m_exit_instance_block); // also sets insert point
@@ -1214,6 +1500,8 @@ BackendLLVM::build_llvm_instance (bool groupentry)
     if (shadingsys().llvm_debug_layers())
         llvm_gen_debug_printf (Strutil::sprintf("exit layer %d %s %s",
                                this->layer(), inst()->layername(), inst()->shadername()));
+    if (shadingsys().profile() >= 2)
+        ll.call_function ("osl_layer_profile_end", sg_void_ptr());
     ll.op_return();
 
     if (llvm_debug())
@@ -1232,6 +1520,462 @@ BackendLLVM::build_llvm_instance (bool groupentry)
 
 
 
+void
+BackendLLVM::find_used_layers ()
+{
+    // Set up m_num_used_layers to be the number of layers that are
+    // actually used, and m_layer_remap[] to map original layer numbers
+    // to the shorter list of actually-called layers. We also note that
+    // if m_layer_remap[i] is < 0, it's not a layer that's used.
+    int nlayers = group().nlayers();
+    m_layer_remap.assign (nlayers, -1);
+    m_num_used_layers = 0;
+    if (debug() >= 1)
+        std::cout << "\nLayers used: (group " << group().name() << ")\n";
+    for (int layer = 0;  layer < nlayers;  ++layer) {
+        // Skip unused or empty layers, unless they are callable entry
+        // points.
+        ShaderInstance *inst = group()[layer];
+        bool is_single_entry = (layer == (nlayers-1) && group().num_entry_layers() == 0);
+        if (inst->entry_layer() || is_single_entry ||
+            (! inst->unused() && !inst->empty_instance())) {
+            if (debug() >= 1)
+                std::cout << "  " << layer << ' ' << inst->layername() << "\n";
+            m_layer_remap[layer] = m_num_used_layers++;
+        }
+    }
+}
+
+
+
+namespace {
+
+enum class ScanEnd { Fallthrough, Returned, Exited };
+
+// Add to 'layers' the upstream layers whose connected params are read by
+// ops in [begin,end) of inst that run whenever that range runs. Skip over
+// the bodies of ifs and loops, and stop at the first return or exit that
+// (perhaps) cuts the rest of the range short. Function bodies run in
+// full, up to a return.
+ScanEnd
+find_unconditional_reads (const ShaderInstance &inst, int begin, int end,
+                          std::vector<int> &layers)
+{
+    for (int opnum = begin;  opnum < end;  ) {
+        const Opcode &op (inst.op(opnum));
+        for (int a = 0;  a < op.nargs();  ++a) {
+            int symindex = inst.arg (op.firstarg() + a);
+            if (! op.argread(a)
+                || inst.symbol(symindex)->valuesource() != Symbol::ConnectedVal)
+                continue;
+            for (int c = 0;  c < inst.nconnections();  ++c)
+                if (inst.connection(c).dst.param == symindex)
+                    layers.push_back (inst.connection(c).srclayer);
+        }
+        if (op.opname() == op_exit)
+            return ScanEnd::Exited;
+        if (op.opname() == op_return)
+            return ScanEnd::Returned;
+        if (op.opname() == op_functioncall || op.opname() == op_functioncall_nr) {
+            if (find_unconditional_reads (inst, opnum+1, op.jump(0), layers)
+                    == ScanEnd::Exited)
+                return ScanEnd::Exited;
+            opnum = op.jump(0);
+            continue;
+        }
+        if (op.jump(0) >= 0) {
+            // A conditional body: any return or exit in it means nothing
+            // after it is sure to run.
+            int far = op.farthest_jump();
+            for (int i = opnum+1;  i < far;  ++i) {
+                if (inst.op(i).opname() == op_exit)
+                    return ScanEnd::Exited;
+                if (inst.op(i).opname() == op_return)
+                    return ScanEnd::Returned;
+            }
+            opnum = far;
+            continue;
+        }
+        ++opnum;
+    }
+    return ScanEnd::Fallthrough;
+}
+
+}  // anon namespace
+
+
+
+void
+BackendLLVM::find_layers_run_upfront ()
+{
+    int nlayers = group().nlayers();
+    m_layer_run_upfront.assign (nlayers, false);
+    if (! shadingsys().opt_upfront_layers() || group().num_entry_layers()
+        || ! shadingsys().m_lazylayers)
+        return;
+
+    // Layers run upfront have to be done before anything else calls them.
+    // That holds once the entry layer's params are set up, unless their
+    // init ops read connections, and so may run layers early.
+    const ShaderInstance &entry (*group()[nlayers-1]);
+    for (int p = entry.firstparam();  p < entry.lastparam();  ++p) {
+        const Symbol &sym (*entry.symbol(p));
+        for (int opnum = sym.initbegin();  opnum < sym.initend();  ++opnum) {
+            const Opcode &op (entry.op(opnum));
+            for (int a = 0;  a < op.nargs();  ++a)
+                if (op.argread(a) && entry.argsymbol(op.firstarg()+a)->valuesource()
+                                         == Symbol::ConnectedVal)
+                    return;
+        }
+    }
+
+    // Layers that aren't lazy already run upfront. Then any layer that
+    // the entry's main code, or that of a layer run upfront, is sure to
+    // read from joins them, working back from the entry.
+    for (int i = 0;  i < nlayers-1;  ++i) {
+        const ShaderInstance *gi = group()[i];
+        if (!gi->unused() && !gi->empty_instance() && !gi->run_lazily())
+            m_layer_run_upfront[i] = true;
+    }
+    std::vector<int> layers;
+    for (int i = nlayers-1;  i >= 0;  --i) {
+        const ShaderInstance &gi (*group()[i]);
+        if (i != nlayers-1 && ! m_layer_run_upfront[i])
+            continue;
+        layers.clear ();
+        find_unconditional_reads (gi, gi.maincodebegin(), gi.maincodeend(),
+                                  layers);
+        for (int up : layers)
+            if (! group()[up]->unused() && ! group()[up]->empty_instance())
+                m_layer_run_upfront[up] = true;
+    }
+
+    if (debug() >= 1) {
+        std::cout << "Layers run upfront: (group " << group().name() << ")\n";
+        for (int i = 0;  i < nlayers-1;  ++i)
+            if (m_layer_run_upfront[i])
+                std::cout << "  " << i << ' ' << group()[i]->layername() << "\n";
+    }
+}
+
+
+
+llvm::Value *
+BackendLLVM::llvm_process_ptr (void *p, string_view name,
+                               llvm::PointerType *type)
+{
+    if (! llvm_aot_output())
+        return ll.constant_ptr (p, type);
+    std::string symbol = fmtformat ("osl_aot_{}", name);
+    if (std::find (m_llvm_process_ptrs.begin(), m_llvm_process_ptrs.end(),
+                   std::string(name)) == m_llvm_process_ptrs.end())
+        m_llvm_process_ptrs.emplace_back (name);
+    return ll.external_symbol (symbol, p, type);
+}
+
+
+
+void *
+BackendLLVM::resolve_process_ptr (string_view name)
+{
+    if (name == "renderer")
+        return shadingsys().renderer();
+    bool prepare = Strutil::parse_prefix (name, "closure_prepare_");
+    if (prepare || Strutil::parse_prefix (name, "closure_setup_")) {
+        int id = -1;
+        const ClosureRegistry::ClosureEntry *clentry = nullptr;
+        if (Strutil::parse_int (name, id) && name.empty())
+            clentry = shadingsys().find_closure (id);
+        if (clentry)
+            return prepare ? (void *)clentry->prepare : (void *)clentry->setup;
+    }
+    return nullptr;
+}
+
+
+
+// A precompiled group (llvm_aot_output) is a short text header, which
+// describes what the code expects of the group and of the process, and
+// then the relocatable object for each ISA (llvm_aot_isas) it was made for:
+//     OSL precompiled group <OSL_LIBRARY_VERSION_CODE>
+//     layers <nlayers> <used layers>
+//     groupdata <size>
+//     init <symbol>
+//     layer <index> <symbol>                (each entry layer)
+//     string <length> <chars>               (relocatable_strings(), in order)
+//     pointer <name>                        (each llvm_process_ptr name)
+//     object <TargetISA name> <size> <size bytes of object file>
+//                                           (each ISA)
+namespace {
+
+struct PrecompiledGroup {
+    int nlayers = 0, used_layers = 0;
+    int groupdata_size = 0;
+    std::string init;
+    std::vector<std::pair<int, std::string>> layers;
+    std::vector<std::string> strings;
+    std::vector<std::string> pointers;
+    std::vector<std::pair<TargetISA, string_view>> objects;
+};
+
+
+
+// The next whitespace-delimited token
+string_view
+next_token (string_view &text)
+{
+    Strutil::skip_whitespace (text);
+    return Strutil::parse_until (text, " \t\r\n");
+}
+
+
+
+// The rest of the line, after the single space that ends the keyword
+string_view
+rest_of_line (string_view &text)
+{
+    if (Strutil::parse_char (text, ' ', false)) {
+        string_view line = Strutil::parse_until (text, "\n");
+        Strutil::parse_char (text, '\n');
+        return line;
+    }
+    return string_view();
+}
+
+
+
+bool
+parse_precompiled (string_view text, PrecompiledGroup &pre, std::string &err)
+{
+    if (! Strutil::parse_prefix (text, "OSL precompiled group ")) {
+        err = "not a precompiled OSL group";
+        return false;
+    }
+    int version = 0;
+    if (! Strutil::parse_int (text, version) || version != OSL_LIBRARY_VERSION_CODE) {
+        err = fmtformat ("made by OSL version code {}, not {}", version,
+                         OSL_LIBRARY_VERSION_CODE);
+        return false;
+    }
+    while (! text.empty()) {
+        string_view key = next_token (text);
+        bool ok = true;
+        TargetISA isa = TargetISA::UNKNOWN;
+        if (key == "object")
+            isa = LLVM_Util::lookup_isa_by_name (next_token (text));
+        if (key == "layers") {
+            ok = Strutil::parse_int (text, pre.nlayers)
+                 && Strutil::parse_int (text, pre.used_layers);
+        } else if (key == "groupdata") {
+            ok = Strutil::parse_int (text, pre.groupdata_size);
+        } else if (key == "init") {
+            pre.init = rest_of_line (text);
+        } else if (key == "layer") {
+            int layer = -1;
+            ok = Strutil::parse_int (text, layer);
+            pre.layers.emplace_back (layer, rest_of_line (text));
+        } else if (key == "string" || key == "object") {
+            // Length-prefixed, after exactly one space
+            int len = -1;
+            ok = Strutil::parse_int (text, len) && len >= 0
+                 && text.size() >= size_t(len) + 1;
+            if (ok) {
+                string_view data = text.substr (1, len);
+                if (key == "object")
+                    pre.objects.emplace_back (isa, data);
+                else
+                    pre.strings.emplace_back (data);
+                text.remove_prefix (1 + len);
+                Strutil::parse_char (text, '\n', false);
+            }
+        } else if (key == "pointer") {
+            pre.pointers.emplace_back (next_token (text));
+        } else {
+            ok = false;
+        }
+        if (! ok) {
+            err = fmtformat ("malformed \"{}\" entry", key);
+            return false;
+        }
+    }
+    if (pre.objects.empty()) {
+        err = "no object code";
+        return false;
+    }
+    return true;
+}
+
+
+
+// Rank of an ISA's code, by how much of the CPU it gets to use
+int
+isa_rank (TargetISA isa)
+{
+    switch (isa) {
+    case TargetISA::x64:          return 1;
+    case TargetISA::SSE4_2:       return 2;
+    case TargetISA::AVX:          return 3;
+    case TargetISA::AVX2_noFMA:   return 4;
+    case TargetISA::AVX2:         return 5;
+    case TargetISA::AVX512_noFMA: return 6;
+    case TargetISA::AVX512:       return 7;
+    case TargetISA::NEON:         return 1;   // the only AArch64 choice
+    default:                      return 0;
+    }
+}
+
+}  // namespace
+
+
+
+bool
+BackendLLVM::run_precompiled ()
+{
+    OIIO::Timer timer;
+    std::string err;
+    PrecompiledGroup pre;
+    if (! parse_precompiled (group().llvm_aot_object(), pre, err)) {
+        shadingsys().warningfmt ("Precompiled code for group \"{}\" is unusable, JITing it instead: {}",
+                                 group().name(), err);
+        return false;
+    }
+
+    // The group data layout is the one contract between the precompiled
+    // code and the group, so it had better be the same.
+    find_used_layers ();
+    m_llvm_type_groupdata = nullptr;
+    llvm_type_groupdata ();
+    if (pre.nlayers != group().nlayers() || pre.used_layers != m_num_used_layers
+          || pre.groupdata_size != group().llvm_groupdata_size()) {
+        shadingsys().warningfmt ("Precompiled code for group \"{}\" was made from a different group, JITing it instead",
+                                 group().name());
+        return false;
+    }
+
+    // Use the code for the llvm_jit_target ISA if there is one, otherwise
+    // the best code this CPU can run.
+    TargetISA requested = ll.lookup_isa_by_name (shadingsys().m_llvm_jit_target);
+    const std::pair<TargetISA, string_view> *object = nullptr;
+    for (auto&& obj : pre.objects) {
+        if (isa_rank (obj.first) == 0 || ! LLVM_Util::supports_isa (obj.first))
+            continue;
+        if (obj.first == requested) {
+            object = &obj;
+            break;
+        }
+        if (! object || isa_rank (obj.first) > isa_rank (object->first))
+            object = &obj;
+    }
+    if (! object) {
+        shadingsys().warningfmt ("Precompiled code for group \"{}\" is for no ISA this CPU supports, JITing it instead",
+                                 group().name());
+        return false;
+    }
+
+    ll.module (ll.new_module ("osl_precompiled"));
+    if (! ll.make_jit (&err, object->first,
+                       shadingsys().llvm_debugging_symbols(),
+                       shadingsys().llvm_profiling_events())) {
+        shadingcontext()->errorfmt("Failed to create engine: {}\n", err);
+        return false;
+    }
+    m_stat_llvm_setup_time += timer.lap();
+
+    // Bind everything the code refers to by name, then link it.
+    initialize_llvm_group ();
+    for (size_t i = 0, e = pre.strings.size(); i < e; ++i)
+        ll.external_symbol (LLVM_Util::relocatable_string_symbol (int(i)),
+                            (void *)ustring (pre.strings[i]).c_str());
+    for (auto&& name : pre.pointers) {
+        void *p = resolve_process_ptr (name);
+        if (! p) {
+            shadingsys().warningfmt ("Precompiled code for group \"{}\" needs \"{}\", which this renderer lacks, JITing it instead",
+                                     group().name(), name);
+            return false;
+        }
+        ll.external_symbol (fmtformat ("osl_aot_{}", name), p);
+    }
+    if (! ll.add_object (object->second, &err)) {
+        shadingsys().warningfmt ("Precompiled code for group \"{}\" could not be loaded, JITing it instead: {}",
+                                 group().name(), err);
+        return false;
+    }
+
+    RunLLVMGroupFunc init_func = (RunLLVMGroupFunc) ll.getPointerToFunction (pre.init);
+    if (! init_func) {
+        shadingsys().warningfmt ("Precompiled code for group \"{}\" lacks {}, JITing it instead",
+                                 group().name(), pre.init);
+        return false;
+    }
+    int nlayers = group().nlayers();
+    std::unique_ptr<ShaderGroup::LLVMEntryPoints> entry (new ShaderGroup::LLVMEntryPoints);
+    entry->init = init_func;
+    entry->layers.resize (nlayers, nullptr);
+    for (auto&& layer : pre.layers)
+        if (layer.first >= 0 && layer.first < nlayers && group().is_entry_layer (layer.first))
+            entry->layers[layer.first]
+                = (RunLLVMGroupFunc) ll.getPointerToFunction (layer.second);
+    if (! group().num_entry_layers())
+        entry->version = entry->layers[nlayers-1];
+    if (auto jit_memory = ll.jit_memory()) {
+        lock_guard state_lock (group().m_jit_state_mutex);
+        group().m_llvm_jit_memory.push_back (std::move(jit_memory));
+    }
+    group().llvm_entry_points (std::move(entry));
+
+    if (! group().jitted())
+        shadingsys().m_stat_empty_instances += nlayers - m_num_used_layers;
+    shadingsys().m_stat_groups_precompiled += 1;
+    m_stat_llvm_jit_time += timer.lap();
+    m_stat_total_llvm_time = m_stat_llvm_setup_time + m_stat_llvm_jit_time;
+    return true;
+}
+
+
+
+void
+BackendLLVM::llvm_profiled_branch (llvm::Value *cond,
+                                   llvm::BasicBlock *trueblock,
+                                   llvm::BasicBlock *falseblock)
+{
+    int b = m_llvm_pgo_branch++;
+    if ((! m_llvm_pgo_instrument && ! m_llvm_pgo_use)
+          || b >= group().m_pgo_nbranches) {
+        ll.op_branch (cond, trueblock, falseblock);
+        return;
+    }
+    uint64_t *counts = &group().m_pgo_counts[2*b];
+    if (m_llvm_pgo_instrument) {
+        // Plain (not atomic) increments: a few counts lost to races
+        // between threads won't change the picture.
+        llvm::Value *reached = ll.constant_ptr (counts, ll.type_longlong_ptr());
+        llvm::Value *taken = ll.constant_ptr (counts+1, ll.type_longlong_ptr());
+        ll.op_store (ll.op_add (ll.op_load (ll.type_longlong(), reached),
+                                ll.constant64 (1)), reached);
+        ll.op_store (ll.op_add (ll.op_load (ll.type_longlong(), taken),
+                                ll.op_int_to_longlong (ll.op_bool_to_int (cond))),
+                     taken);
+        ll.op_branch (cond, trueblock, falseblock);
+        return;
+    }
+    uint64_t reached = counts[0];
+    uint64_t taken = std::min (counts[1], reached);
+    if (! reached) {
+        // Never got here while profiling, so no basis for a guess.
+        ll.op_branch (cond, trueblock, falseblock);
+        return;
+    }
+    // Branch weights are only 32 bits, and only their ratio matters.
+    while (reached > 0xffffffffULL) {
+        reached >>= 1;
+        taken >>= 1;
+    }
+    ll.op_branch (cond, trueblock, falseblock,
+                  uint32_t(taken), uint32_t(reached - taken));
+}
+
+
+
 void
 BackendLLVM::initialize_llvm_group ()
 {
@@ -1242,8 +1986,9 @@ BackendLLVM::initialize_llvm_group ()
 
     // Set up optimization passes. Don't target the host if we're building
     // for OptiX.
-    ll.setup_optimization_passes (shadingsys().llvm_optimize(),
-                                  shadingsys().llvm_target_host() && !use_optix());
+    ll.setup_optimization_passes (llvm_optimize(),
+                                  shadingsys().llvm_target_host() && !use_optix(),
+                                  llvm_opt_preset());
 
     // Clear the shaderglobals and groupdata types -- they will be
     // created on demand.
@@ -1305,17 +2050,73 @@ static void empty_group_func (void*, void*)
 
 
 
+void
+BackendLLVM::ptx_cache_key (std::string &filename, std::string &key)
+{
+    // The IR names the group's functions, and the PTX made from it
+    // depends on nothing else but how it's optimized and for what.
+    std::string ir = ll.module_string();
+    key = fmtformat ("OSL PTX cache {} llvm {} {} O{} preset {} ir {} {:x}\n",
+                     OSL_LIBRARY_VERSION_CODE, OSL_LLVM_VERSION,
+                     CUDA_TARGET_ARCH, llvm_optimize(),
+                     int(llvm_opt_preset()), ir.size(),
+                     std::hash<std::string>()(ir));
+    filename = fmtformat ("{}/{:016x}.ptx", shadingsys().m_ptx_cache_dir,
+                          uint64_t(Strutil::strhash (ir)));
+}
+
+
+
+bool
+BackendLLVM::ptx_cache_load (const std::string &filename,
+                             const std::string &key)
+{
+    std::string contents;
+    if (! OIIO::Filesystem::read_text_file (filename, contents)
+          || ! Strutil::starts_with (contents, key)
+          || contents.size() == key.size())
+        return false;
+    group().m_llvm_ptx_compiled_version = contents.substr (key.size());
+    return true;
+}
+
+
+
+void
+BackendLLVM::ptx_cache_save (const std::string &filename,
+                             const std::string &key)
+{
+    // Write to a temporary and rename, so that another process never
+    // reads a half-written file.
+    std::string tmpname = OIIO::Filesystem::unique_path (filename + ".%%%%%%.tmp");
+    std::string err;
+    if (! OIIO::Filesystem::write_text_file (tmpname,
+                key + group().m_llvm_ptx_compiled_version)
+          || ! OIIO::Filesystem::rename (tmpname, filename, err)) {
+        OIIO::Filesystem::remove (tmpname, err);
+        shadingsys().warningfmt ("Could not write PTX cache file \"{}\"",
+                                 filename);
+    }
+}
+
+
+
 void
 BackendLLVM::run ()
 {
     if (group().does_nothing()) {
-        group().llvm_compiled_init ((RunLLVMGroupFunc)empty_group_func);
-        group().llvm_compiled_version ((RunLLVMGroupFunc)empty_group_func);
+        std::unique_ptr<ShaderGroup::LLVMEntryPoints> entry (new ShaderGroup::LLVMEntryPoints);
+        entry->init = (RunLLVMGroupFunc)empty_group_func;
+        entry->version = (RunLLVMGroupFunc)empty_group_func;
+        group().llvm_entry_points (std::move(entry));
         return;
     }
 
     // At this point, we already hold the lock for this group, by virtue
     // of ShadingSystemImpl::optimize_group.
+    if (! group().llvm_aot_object().empty() && ! use_optix() && run_precompiled ())
+        return;
+
     OIIO::Timer timer;
     std::string err;
 
@@ -1335,9 +2136,9 @@ BackendLLVM::run ()
 #else
     if (! use_optix()) {
         if(use_rs_bitcode()){
-            ll.module (ll.module_from_bitcode ((char*)osl_llvm_compiled_rs_dependant_ops_block,
-                                               osl_llvm_compiled_rs_dependant_ops_size,
-                                               "llvm_rs_dependant_ops", &err));
+            ll.module (ll.module_from_bitcode_prototype ((char*)osl_llvm_compiled_rs_dependant_ops_block,
+                                                         osl_llvm_compiled_rs_dependant_ops_size,
+                                                         "llvm_rs_dependant_ops", &err));
             if (err.length())
                 shadingcontext()->errorfmt(
                     "llvm::parseBitcodeFile returned '{}' for llvm_rs_dependant_ops\n",
@@ -1358,9 +2159,9 @@ BackendLLVM::run ()
             if (!success)
                 shadingcontext()->errorfmt("LLVM_Util::absorb_module failed'\n");
         } else {
-            ll.module (ll.module_from_bitcode ((char*)osl_llvm_compiled_ops_block,
-                                               osl_llvm_compiled_ops_size,
-                                               "llvm_ops", &err));
+            ll.module (ll.module_from_bitcode_prototype ((char*)osl_llvm_compiled_ops_block,
+                                                         osl_llvm_compiled_ops_size,
+                                                         "llvm_ops", &err));
             if (err.length())
                 shadingcontext()->errorfmt(
                     "llvm::parseBitcodeFile returned '{}' for llvm_ops\n", err);
@@ -1380,10 +2181,10 @@ BackendLLVM::run ()
     OSL_ASSERT (ll.module());
 #endif
 
-    // Create the ExecutionEngine. We don't create an ExecutionEngine in the
+    // Create the ExecutionEngine (or ORC JIT). We don't create one in the
     // OptiX case, because we are using the NVPTX backend and not MCJIT
     if (! use_optix() &&
-        ! ll.make_jit_execengine (&err, ll.lookup_isa_by_name(shadingsys().m_llvm_jit_target),
+        ! ll.make_jit (&err, ll.lookup_isa_by_name(shadingsys().m_llvm_jit_target),
                                   shadingsys().llvm_debugging_symbols(),
                                   shadingsys().llvm_profiling_events())) {
         shadingcontext()->errorfmt("Failed to create engine: {}\n", err);
@@ -1396,30 +2197,29 @@ BackendLLVM::run ()
 
     m_stat_llvm_setup_time += timer.lap();
 
-    // Set up m_num_used_layers to be the number of layers that are
-    // actually used, and m_layer_remap[] to map original layer numbers
-    // to the shorter list of actually-called layers. We also note that
-    // if m_layer_remap[i] is < 0, it's not a layer that's used.
     int nlayers = group().nlayers();
-    m_layer_remap.resize (nlayers, -1);
-    m_num_used_layers = 0;
-    if (debug() >= 1)
-        std::cout << "\nLayers used: (group " << group().name() << ")\n";
-    for (int layer = 0;  layer < nlayers;  ++layer) {
-        // Skip unused or empty layers, unless they are callable entry
-        // points.
-        ShaderInstance *inst = group()[layer];
-        bool is_single_entry = (layer == (nlayers-1) && group().num_entry_layers() == 0);
-        if (inst->entry_layer() || is_single_entry ||
-            (! inst->unused() && !inst->empty_instance())) {
-            if (debug() >= 1)
-                std::cout << "  " << layer << ' ' << inst->layername() << "\n";
-            m_layer_remap[layer] = m_num_used_layers++;
-        }
-    }
-    shadingsys().m_stat_empty_instances += nlayers - m_num_used_layers;
+    find_used_layers ();
+    find_layers_run_upfront ();
+    if (! group().jitted())   // don't count them again for a tiered re-JIT
+        shadingsys().m_stat_empty_instances += nlayers - m_num_used_layers;
 
     initialize_llvm_group ();
+    ll.relocatable (llvm_aot_output());
+
+    // Every if and loop gets a pair of branch counters (times reached,
+    // times true), numbered in the order the code is generated, which is
+    // the same for every JIT of the group.
+    m_llvm_pgo_branch = 0;
+    if (m_llvm_pgo_instrument && ! group().m_pgo_counts) {
+        int nbranches = 0;
+        for (int layer = 0; layer < nlayers; ++layer)
+            for (auto&& op : group()[layer]->ops())
+                if (op.opname() == op_if || op.opname() == op_for ||
+                    op.opname() == op_while || op.opname() == op_dowhile)
+                    ++nbranches;
+        group().m_pgo_nbranches = nbranches;
+        group().m_pgo_counts.reset (new uint64_t[2*nbranches] ());
+    }
 
     // Generate the LLVM IR for each layer.  Skip unused layers.
     m_llvm_local_mem = 0;
@@ -1437,6 +2237,16 @@ BackendLLVM::run ()
     // llvm::Function* entry_func = group().num_entry_layers() ? NULL : funcs[m_num_used_layers-1];
     m_stat_llvm_irgen_time += timer.lap();
 
+    // Code for a different layout would misread the group data of the
+    // contexts still running the current code, so keep that instead.
+    if (m_groupdata_layout_changed) {
+        shadingcontext()->errorfmt("Re-JIT of group \"{}\" would change its group data layout; keeping its current code",
+                                   group().name());
+        ll.execengine (NULL);
+        ll.module (NULL);
+        return;
+    }
+
     if (shadingsys().m_max_local_mem_KB &&
         m_llvm_local_mem/1024 > shadingsys().m_max_local_mem_KB) {
         shadingcontext()->errorfmt(
@@ -1525,8 +2335,21 @@ BackendLLVM::run ()
         }
     }
 
+    // With ptx_cache_dir, an earlier compile of the same IR may have left
+    // us its PTX, making the rest of the work unnecessary.
+    std::string ptx_cache_file, ptx_cache_key;
+    bool ptx_cached = false;
+    if (use_optix() && ! shadingsys().m_ptx_cache_dir.empty()) {
+        this->ptx_cache_key (ptx_cache_file, ptx_cache_key);
+        ptx_cached = ptx_cache_load (ptx_cache_file, ptx_cache_key);
+        if (ptx_cached)
+            shadingsys().m_stat_ptx_cache_hits += 1;
+        else
+            shadingsys().m_stat_ptx_cache_misses += 1;
+    }
+
     // Optimize the LLVM IR unless it's a do-nothing group.
-    if (! group().does_nothing())
+    if (! group().does_nothing() && ! ptx_cached)
         ll.do_optimize();
 
     m_stat_llvm_opt_time += timer.lap();
@@ -1561,7 +2384,7 @@ BackendLLVM::run ()
                                   safegroup.substr(safegroup.size() - 235),
                                   group().id());
         std::string name = fmtformat("{}_O{}.ll", safegroup,
-                                     shadingsys().llvm_optimize());
+                                     llvm_optimize());
         OIIO::ofstream out;
         OIIO::Filesystem::open(out, name);
         if (out) {
@@ -1572,7 +2395,7 @@ BackendLLVM::run ()
         }
     }
 
-    if (use_optix()) {
+    if (use_optix() && ! ptx_cached) {
         std::string name = fmtformat("{}_{}", group().name(), group().id());
 
 #if (OPTIX_VERSION < 70000)
@@ -1593,20 +2416,77 @@ BackendLLVM::run ()
         if (group().m_llvm_ptx_compiled_version.empty()) {
              OSL_ASSERT (0 && "Unable to generate PTX");
         }
+        if (ptx_cache_file.size())
+            ptx_cache_save (ptx_cache_file, ptx_cache_key);
     }
-    else {
+    else if (! use_optix()) {
+        if (llvm_aot_output()) {
+            std::vector<TargetISA> isas;
+            for (auto&& name : Strutil::splits (shadingsys().m_llvm_aot_isas.string(), ",")) {
+                TargetISA isa = LLVM_Util::lookup_isa_by_name (Strutil::strip (name));
+                if (isa_rank (isa))
+                    isas.push_back (isa);
+                else
+                    shadingsys().warningfmt ("llvm_aot_isas: unknown ISA \"{}\"", name);
+            }
+            if (isas.empty())
+                isas.push_back (ll.target_isa());
+            std::string objects, object;
+            for (TargetISA isa : isas) {
+                if (! ll.emit_object (object, &err, isa))
+                    break;
+                objects += fmtformat ("object {} {} ",
+                                      LLVM_Util::target_isa_name (isa),
+                                      object.size());
+                objects += object;
+                objects += '\n';
+            }
+            if (! object.empty()) {
+                std::string &pre (group().m_llvm_aot_object);
+                pre = fmtformat ("OSL precompiled group {}\nlayers {} {}\ngroupdata {}\ninit {}\n",
+                                 OSL_LIBRARY_VERSION_CODE,
+                                 nlayers, m_num_used_layers,
+                                 group().llvm_groupdata_size(),
+                                 ll.func_name (init_func));
+                for (int layer = 0; layer < nlayers; ++layer)
+                    if (funcs[layer] && group().is_entry_layer (layer))
+                        pre += fmtformat ("layer {} {}\n", layer,
+                                          ll.func_name (funcs[layer]));
+                for (ustring s : ll.relocatable_strings())
+                    pre += fmtformat ("string {} {}\n", s.length(), s.string());
+                for (auto&& name : m_llvm_process_ptrs)
+                    pre += fmtformat ("pointer {}\n", name);
+                pre += objects;
+            } else {
+                shadingcontext()->errorfmt ("Could not compile group \"{}\" to an object: {}",
+                                            group().name(), err);
+            }
+        }
+
         // Force the JIT to happen now and retrieve the JITed function pointers
         // for the initialization and all public entry points.
-        group().llvm_compiled_init ((RunLLVMGroupFunc) ll.getPointerToFunction(init_func));
+        std::unique_ptr<ShaderGroup::LLVMEntryPoints> entry (new ShaderGroup::LLVMEntryPoints);
+        entry->init = (RunLLVMGroupFunc) ll.getPointerToFunction(init_func);
+        entry->layers.resize (nlayers, nullptr);
         for (int layer = 0; layer < nlayers; ++layer) {
             llvm::Function* f = funcs[layer];
             if (f && group().is_entry_layer (layer))
-                group().llvm_compiled_layer (layer, (RunLLVMGroupFunc) ll.getPointerToFunction(f));
+                entry->layers[layer] = (RunLLVMGroupFunc) ll.getPointerToFunction(f);
         }
-        if (group().num_entry_layers())
-            group().llvm_compiled_version (NULL);
-        else
-            group().llvm_compiled_version (group().llvm_compiled_layer(nlayers-1));
+        if (! group().num_entry_layers())
+            entry->version = entry->layers[nlayers-1];
+
+        // The group owns the code from now on (along with that of any
+        // earlier JIT of it), so it is freed when the group is.
+        // A batched JIT of the group may be adding its own at the same time.
+        if (auto jit_memory = ll.jit_memory()) {
+            lock_guard state_lock (group().m_jit_state_mutex);
+            group().m_llvm_jit_memory.push_back (std::move(jit_memory));
+        }
+        // Only now, with everything it points to in place, can threads
+        // shading the group (with an earlier JIT, if this is a re-JIT)
+        // switch over to it.
+        group().llvm_entry_points (std::move(entry));
     }
 
     // We are destroying the entire module below,
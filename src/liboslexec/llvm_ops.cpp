@@ -285,6 +285,30 @@ MAKE_UNARY_PERCOMPONENT_OP (cosh , coshf     , cosh )
 MAKE_UNARY_PERCOMPONENT_OP (tanh , tanhf     , tanh )
 #endif
 
+// Explicit "fast_" and "accurate_" variants of the above, bound instead of
+// the build default by the "math_precision" option.
+MAKE_UNARY_PERCOMPONENT_OP (fast_sin  , OIIO::fast_sin  , fast_sin )
+MAKE_UNARY_PERCOMPONENT_OP (fast_cos  , OIIO::fast_cos  , fast_cos )
+MAKE_UNARY_PERCOMPONENT_OP (fast_tan  , OIIO::fast_tan  , fast_tan )
+MAKE_UNARY_PERCOMPONENT_OP (fast_asin , OIIO::fast_asin , fast_asin)
+MAKE_UNARY_PERCOMPONENT_OP (fast_acos , OIIO::fast_acos , fast_acos)
+MAKE_UNARY_PERCOMPONENT_OP (fast_atan , OIIO::fast_atan , fast_atan)
+MAKE_BINARY_PERCOMPONENT_OP(fast_atan2, OIIO::fast_atan2, fast_atan2)
+MAKE_UNARY_PERCOMPONENT_OP (fast_sinh , OIIO::fast_sinh , fast_sinh)
+MAKE_UNARY_PERCOMPONENT_OP (fast_cosh , OIIO::fast_cosh , fast_cosh)
+MAKE_UNARY_PERCOMPONENT_OP (fast_tanh , OIIO::fast_tanh , fast_tanh)
+
+MAKE_UNARY_PERCOMPONENT_OP (accurate_sin  , sinf      , sin  )
+MAKE_UNARY_PERCOMPONENT_OP (accurate_cos  , cosf      , cos  )
+MAKE_UNARY_PERCOMPONENT_OP (accurate_tan  , tanf      , tan  )
+MAKE_UNARY_PERCOMPONENT_OP (accurate_asin , safe_asin , safe_asin )
+MAKE_UNARY_PERCOMPONENT_OP (accurate_acos , safe_acos , safe_acos )
+MAKE_UNARY_PERCOMPONENT_OP (accurate_atan , atanf     , atan )
+MAKE_BINARY_PERCOMPONENT_OP(accurate_atan2, atan2f    , atan2)
+MAKE_UNARY_PERCOMPONENT_OP (accurate_sinh , sinhf     , sinh )
+MAKE_UNARY_PERCOMPONENT_OP (accurate_cosh , coshf     , cosh )
+MAKE_UNARY_PERCOMPONENT_OP (accurate_tanh , tanhf     , tanh )
+
 OSL_SHADEOP void osl_sincos_fff(float x, void *s_, void *c_)
 {
 #if OSL_FAST_MATH
@@ -496,6 +520,31 @@ MAKE_UNARY_PERCOMPONENT_OP     (erfc       , erfcf                , erfc)
 MAKE_UNARY_PERCOMPONENT_OP     (cbrt       , cbrtf                , cbrt)
 #endif
 
+// "fast_" and "accurate_" variants for the "math_precision" option.
+MAKE_UNARY_PERCOMPONENT_OP     (fast_log   , OIIO::fast_log       , fast_log)
+MAKE_UNARY_PERCOMPONENT_OP     (fast_log2  , OIIO::fast_log2      , fast_log2)
+MAKE_UNARY_PERCOMPONENT_OP     (fast_log10 , OIIO::fast_log10     , fast_log10)
+MAKE_UNARY_PERCOMPONENT_OP     (fast_exp   , OIIO::fast_exp       , fast_exp)
+MAKE_UNARY_PERCOMPONENT_OP     (fast_exp2  , OIIO::fast_exp2      , fast_exp2)
+MAKE_UNARY_PERCOMPONENT_OP     (fast_expm1 , OIIO::fast_expm1     , fast_expm1)
+MAKE_BINARY_PERCOMPONENT_OP    (fast_pow   , OIIO::fast_safe_pow  , fast_safe_pow)
+MAKE_BINARY_PERCOMPONENT_VF_OP (fast_pow   , OIIO::fast_safe_pow  , fast_safe_pow)
+MAKE_UNARY_PERCOMPONENT_OP     (fast_erf   , OIIO::fast_erf       , fast_erf)
+MAKE_UNARY_PERCOMPONENT_OP     (fast_erfc  , OIIO::fast_erfc      , fast_erfc)
+MAKE_UNARY_PERCOMPONENT_OP     (fast_cbrt  , OIIO::fast_cbrt      , fast_cbrt)
+
+MAKE_UNARY_PERCOMPONENT_OP     (accurate_log   , OIIO::safe_log   , safe_log)
+MAKE_UNARY_PERCOMPONENT_OP     (accurate_log2  , OIIO::safe_log2  , safe_log2)
+MAKE_UNARY_PERCOMPONENT_OP     (accurate_log10 , OIIO::safe_log10 , safe_log10)
+MAKE_UNARY_PERCOMPONENT_OP     (accurate_exp   , expf             , exp)
+MAKE_UNARY_PERCOMPONENT_OP     (accurate_exp2  , exp2f            , exp2)
+MAKE_UNARY_PERCOMPONENT_OP     (accurate_expm1 , expm1f           , expm1)
+MAKE_BINARY_PERCOMPONENT_OP    (accurate_pow   , OIIO::safe_pow   , safe_pow)
+MAKE_BINARY_PERCOMPONENT_VF_OP (accurate_pow   , OIIO::safe_pow   , safe_pow)
+MAKE_UNARY_PERCOMPONENT_OP     (accurate_erf   , erff             , erf)
+MAKE_UNARY_PERCOMPONENT_OP     (accurate_erfc  , erfcf            , erfc)
+MAKE_UNARY_PERCOMPONENT_OP     (accurate_cbrt  , cbrtf            , cbrt)
+
 MAKE_UNARY_PERCOMPONENT_OP     (sqrt       , OIIO::safe_sqrt      , sqrt)
 MAKE_UNARY_PERCOMPONENT_OP     (inversesqrt, OIIO::safe_inversesqrt, inversesqrt)
 
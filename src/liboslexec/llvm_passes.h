@@ -327,6 +327,9 @@ char PreventBitMasksFromBeingLiveinsToBasicBlocks<8>::ID = 0;
 template<>
 char PreventBitMasksFromBeingLiveinsToBasicBlocks<16>::ID = 0;
 
+template<>
+char PreventBitMasksFromBeingLiveinsToBasicBlocks<4>::ID = 0;
+
 }  // end of anonymous namespace
 
 }  // namespace pvt
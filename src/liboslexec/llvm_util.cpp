@@ -5,6 +5,9 @@
 
 #include <memory>
 #include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <unordered_map>
 #include <OpenImageIO/fmath.h>
 #include <OpenImageIO/thread.h>
 #include <boost/thread/tss.hpp>   /* for thread_specific_ptr */
@@ -13,6 +16,11 @@
 #include <OSL/llvm_util.h>
 #include <OSL/wide.h>
 
+#ifdef __linux__
+#include <sys/mman.h> /* for madvise */
+#include <unistd.h>   /* for getpid */
+#endif
+
 #if OSL_LLVM_VERSION < 90
 #error "LLVM minimum version required for OSL is 9.0"
 #endif
@@ -27,6 +35,9 @@
 #include <llvm/IR/DebugInfoMetadata.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/GVMaterializer.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Intrinsics.h>
 #if OSL_LLVM_VERSION >= 100
@@ -34,10 +45,13 @@
 #endif
 #include <llvm/IR/Module.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/TypeFinder.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/IR/ValueSymbolTable.h>
 #include <llvm/Linker/Linker.h>
+#include <llvm/MC/SubtargetFeature.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/Host.h>
 #include <llvm/Support/CommandLine.h>
@@ -55,9 +69,23 @@
 #include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/Support/ManagedStatic.h>
 #include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Process.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/ExecutionEngine/JITEventListener.h>
 #include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Object/SymbolSize.h>
+#if OSL_LLVM_VERSION >= 130
+#include <llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/IndirectionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LazyReexports.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/Passes/PassBuilder.h>
+#endif
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Support/PrettyStackTrace.h>
@@ -126,35 +154,314 @@ typedef llvm::Error LLVMErr;
 
 namespace {
 
-// NOTE: This is a COPY of something internal to LLVM, but since we destroy
-// our LLVMMemoryManager via global variables we can't rely on the LLVM copy
-// sticking around. Because of this, the variable must be declared _before_
-// jitmm_hold so that the object stays valid until after we have destroyed
-// all our memory managers.
-struct DefaultMMapper final : public llvm::SectionMemoryManager::MemoryMapper {
+// All JIT code and data sections, for every memory manager (MCJIT or
+// ORC), are mapped through this one pool. Pages that a memory manager
+// releases (because the group that owned the code was destroyed) are kept
+// for reuse by later allocations rather than unmapped right away, up to
+// max_pooled bytes, which saves a lot of mmap/munmap churn when groups
+// come and go constantly.
+//
+// With huge_pages on, code sections instead come out of 2 MB arenas, each
+// mapped once as read/write/execute and advised to be backed by a
+// transparent huge page. Sections are handed out from the arena in order,
+// so the code of groups JITed one after another (typically related ones)
+// sits together, and a few TLB entries cover all of it. Changing the
+// protection of part of an arena would split its huge page, so arena
+// blocks stay RWX: protecting them is a no-op, and released ones are only
+// kept for reuse by later code sections, never unmapped.
+//
+// NOTE: Since we destroy our LLVMMemoryManager via global variables, the
+// variable must be declared _before_ jitmm_hold so that the object stays
+// valid until after we have destroyed all our memory managers.
+class PooledMMapper final : public llvm::SectionMemoryManager::MemoryMapper {
+public:
+    ~PooledMMapper() {
+        for (auto& b : m_free)
+            llvm::sys::Memory::releaseMappedMemory(b.second);
+        for (auto& a : m_arenas)
+            llvm::sys::Memory::releaseMappedMemory(a.second);
+    }
+
     llvm::sys::MemoryBlock
-    allocateMappedMemory(llvm::SectionMemoryManager::AllocationPurpose /*Purpose*/,
+    allocateMappedMemory(llvm::SectionMemoryManager::AllocationPurpose Purpose,
                          size_t NumBytes, const llvm::sys::MemoryBlock *const NearBlock,
                          unsigned Flags, std::error_code &EC) override {
-        return llvm::sys::Memory::allocateMappedMemory(NumBytes, NearBlock, Flags, EC);
+        size_t pagesize = llvm::sys::Process::getPageSizeEstimate();
+        NumBytes = (NumBytes + pagesize - 1) / pagesize * pagesize;
+        llvm::sys::MemoryBlock block;
+        if (Purpose == llvm::SectionMemoryManager::AllocationPurpose::Code
+              && m_huge_pages.load (std::memory_order_relaxed)) {
+            block = allocate_from_arena (NumBytes);
+            if (block.base()) {
+                thread_allocated += block.allocatedSize();
+                EC = std::error_code();
+                return block;
+            }
+            // No arena to be had -- fall back to ordinary pages.
+        }
+        {
+            OIIO::spin_lock lock (m_mutex);
+            // Reuse the smallest pooled block that fits, as long as it
+            // wouldn't waste more than it uses.
+            auto found = m_free.lower_bound (NumBytes);
+            if (found != m_free.end() && found->first <= 2*NumBytes) {
+                block = found->second;
+                m_free.erase (found);
+                m_pooled -= block.allocatedSize();
+                m_live += block.allocatedSize();
+            }
+        }
+        if (block.base())
+            thread_allocated += block.allocatedSize();
+        if (block.base()) {
+            EC = llvm::sys::Memory::protectMappedMemory (block, Flags);
+            if (! EC)
+                return block;
+            // Couldn't reprotect it? Just give up on that block.
+            thread_allocated -= block.allocatedSize();
+            llvm::sys::Memory::releaseMappedMemory (block);
+            OIIO::spin_lock lock (m_mutex);
+            m_live -= block.allocatedSize();
+        }
+        block =
+            llvm::sys::Memory::allocateMappedMemory(NumBytes, NearBlock, Flags, EC);
+        if (! EC) {
+            OIIO::spin_lock lock (m_mutex);
+            m_live += block.allocatedSize();
+            thread_allocated += block.allocatedSize();
+        }
+        return block;
     }
 
     std::error_code protectMappedMemory(const llvm::sys::MemoryBlock &Block,
                                         unsigned Flags) override {
+        if (in_arena (Block))
+            return std::error_code();
         return llvm::sys::Memory::protectMappedMemory(Block, Flags);
     }
 
     std::error_code releaseMappedMemory(llvm::sys::MemoryBlock &M) override {
+        size_t size = M.allocatedSize();
+        if (in_arena (M)) {
+            OIIO::spin_lock lock (m_mutex);
+            m_live -= size;
+            m_pooled += size;
+            m_arena_free.emplace (size, M);
+            M = llvm::sys::MemoryBlock();
+            return std::error_code();
+        }
+        // Nothing may execute it any more, whether or not it is pooled.
+        std::error_code EC = llvm::sys::Memory::protectMappedMemory (M,
+            llvm::sys::Memory::MF_READ | llvm::sys::Memory::MF_WRITE);
+        {
+            OIIO::spin_lock lock (m_mutex);
+            m_live -= size;
+            if (! EC && m_pooled + size <= max_pooled) {
+                m_pooled += size;
+                m_free.emplace (size, M);
+                M = llvm::sys::MemoryBlock();
+                return EC;
+            }
+        }
         return llvm::sys::Memory::releaseMappedMemory(M);
     }
+
+    size_t live () const { OIIO::spin_lock lock (m_mutex); return m_live; }
+    size_t pooled () const { OIIO::spin_lock lock (m_mutex); return m_pooled; }
+
+    void huge_pages (bool on) { m_huge_pages = on; }
+
+    // Bytes ever handed out to memory managers on this thread. A module is
+    // linked on the thread that JITs it, so the growth of this across a
+    // JIT is the size of what it made.
+    static thread_local size_t thread_allocated;
+
+private:
+    static const size_t max_pooled = 64 << 20;
+    static const size_t huge_page_size = 2 << 20;
+
+    bool in_arena (const llvm::sys::MemoryBlock &block) const {
+        if (! m_has_arenas.load (std::memory_order_acquire))
+            return false;
+        const char *p = static_cast<const char *>(block.base());
+        OIIO::spin_lock lock (m_mutex);
+        auto a = m_arenas.upper_bound (p);
+        if (a == m_arenas.begin())
+            return false;
+        --a;
+        return p < a->first + a->second.allocatedSize();
+    }
+
+    // Take NumBytes (a multiple of the page size) of RWX memory from an
+    // arena, or return an empty block if no arena can be mapped.
+    llvm::sys::MemoryBlock allocate_from_arena (size_t NumBytes) {
+        OIIO::spin_lock lock (m_mutex);
+        llvm::sys::MemoryBlock block;
+        auto found = m_arena_free.lower_bound (NumBytes);
+        if (found != m_arena_free.end() && found->first <= 2*NumBytes) {
+            block = found->second;
+            m_arena_free.erase (found);
+            m_pooled -= block.allocatedSize();
+        } else {
+            if (m_arena_next + NumBytes > m_arena_end) {
+                // Map a new arena with room to align it to a huge page.
+                size_t size = (NumBytes + huge_page_size - 1)
+                              / huge_page_size * huge_page_size;
+                std::error_code EC;
+                llvm::sys::MemoryBlock arena =
+                    llvm::sys::Memory::allocateMappedMemory (
+                        size + huge_page_size, nullptr,
+                        llvm::sys::Memory::MF_RWE_MASK, EC);
+                if (EC)
+                    return block;
+                char *base = static_cast<char *>(arena.base());
+                char *start = reinterpret_cast<char *>(
+                    (reinterpret_cast<uintptr_t>(base) + huge_page_size - 1)
+                    & ~uintptr_t(huge_page_size - 1));
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+                madvise (start, size, MADV_HUGEPAGE);
+#endif
+                m_arenas.emplace (base, arena);
+                m_has_arenas = true;
+                m_arena_next = start;
+                m_arena_end = start + size;
+            }
+            block = llvm::sys::MemoryBlock (m_arena_next, NumBytes);
+            m_arena_next += NumBytes;
+        }
+        m_live += block.allocatedSize();
+        return block;
+    }
+
+    mutable OIIO::spin_mutex m_mutex;
+    std::multimap<size_t, llvm::sys::MemoryBlock> m_free;
+    size_t m_live = 0;    // bytes handed out to memory managers
+    size_t m_pooled = 0;  // bytes released and waiting in m_free or m_arena_free
+    std::atomic<bool> m_huge_pages { false };
+    std::atomic<bool> m_has_arenas { false };
+    std::map<const char *, llvm::sys::MemoryBlock> m_arenas;  // by base
+    std::multimap<size_t, llvm::sys::MemoryBlock> m_arena_free;
+    char *m_arena_next = nullptr;  // unused part of the newest arena
+    char *m_arena_end = nullptr;
 };
-static DefaultMMapper llvm_default_mapper;
+static PooledMMapper llvm_jit_mapper;
+thread_local size_t PooledMMapper::thread_allocated = 0;
 
 static OIIO::spin_mutex llvm_global_mutex;
 static bool setup_done = false;
-static std::unique_ptr<std::vector<std::shared_ptr<LLVMMemoryManager> >> jitmm_hold;
+static std::unique_ptr<std::vector<std::shared_ptr<LLVM_Util::JitMemory> >> jitmm_hold;
 static int jit_mem_hold_users = 0;
 
+#if OSL_LLVM_VERSION >= 130
+// One ORC LLJIT session is shared by every LLVM_Util (on any thread) that
+// asks for it. Like jitmm_hold, it owns the memory for all the code it has
+// linked, so it is kept alive until the last ScopedJitMemoryUser is gone.
+// All of these are guarded by llvm_global_mutex.
+static std::unique_ptr<llvm::orc::LLJIT> orc_session;
+static llvm::orc::RTDyldObjectLinkingLayer* orc_object_layer = nullptr;
+static bool orc_gdb_listener = false;
+static llvm::JITEventListener* orc_vtune_listener = nullptr;
+static int orc_shared_listeners = 0;   // ProfilingEvents already registered
+static int orc_dylib_serial = 0;
+static int orc_session_serial = 0;
+
+// For lazy compilation (LLVM_Util::orc_jit_lazy), each module gets its own
+// pair of compile layers, which must outlive the session's use of them,
+// and all of them share one lazy call-through manager.
+struct OrcLazyLayers {
+    std::unique_ptr<llvm::orc::IRCompileLayer> compile_layer;
+    std::unique_ptr<llvm::orc::CompileOnDemandLayer> cod_layer;
+};
+static std::vector<std::unique_ptr<OrcLazyLayers>> orc_lazy_layers;
+static std::unique_ptr<llvm::orc::LazyCallThroughManager> orc_lazy_callthrough;
+static std::atomic<size_t> orc_lazy_compiled { 0 };  // functions, ever
+#endif
+
+
+#ifdef __linux__
+// Tells Linux perf the names of JITed functions, by appending a line for
+// each to /tmp/perf-<pid>.map, which perf reads to name the addresses it
+// can't find in any binary.  The functions are named as in the module:
+// "<group>_<layer>_<id>" for a layer and "__direct_callable__group_
+// <group>_<id>_init" for a group's init function.  There is one map file
+// per process, so this one listener is registered with every MCJIT
+// engine or ORC object layer that wants perf map events.
+class PerfMapListener final : public llvm::JITEventListener {
+public:
+    void notifyObjectLoaded (ObjectKey, const llvm::object::ObjectFile &obj,
+                             const llvm::RuntimeDyld::LoadedObjectInfo &info) override
+    {
+        // The debugger's copy of the object has its sections at the
+        // addresses they were loaded at.
+        llvm::object::OwningBinary<llvm::object::ObjectFile> debugobj
+            = info.getObjectForDebug (obj);
+        if (! debugobj.getBinary())
+            return;
+        std::string lines;
+        for (auto&& sym_size : llvm::object::computeSymbolSizes (*debugobj.getBinary())) {
+            const llvm::object::SymbolRef &sym = sym_size.first;
+            auto type = sym.getType();
+            if (! type) {
+                llvm::consumeError (type.takeError());
+                continue;
+            }
+            if (*type != llvm::object::SymbolRef::ST_Function || ! sym_size.second)
+                continue;
+            auto name = sym.getName();
+            if (! name) {
+                llvm::consumeError (name.takeError());
+                continue;
+            }
+            auto addr = sym.getAddress();
+            if (! addr) {
+                llvm::consumeError (addr.takeError());
+                continue;
+            }
+            char buf[64];
+            snprintf (buf, sizeof(buf), "%" PRIx64 " %" PRIx64 " ",
+                      uint64_t(*addr), uint64_t(sym_size.second));
+            lines += buf;
+            lines += name->str();
+            lines += '\n';
+        }
+        if (lines.empty())
+            return;
+        OIIO::lock_guard lock (m_mutex);
+        if (! m_file) {
+            std::string filename = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+            m_file = fopen (filename.c_str(), "a");
+            if (! m_file)
+                return;
+        }
+        fputs (lines.c_str(), m_file);
+        fflush (m_file);
+    }
+
+private:
+    OIIO::mutex m_mutex;
+    FILE *m_file = nullptr;
+};
+static PerfMapListener perf_map_listener;
+#endif
+
+// The listener for each kind of profiling_events other than Intel's (whose
+// listeners aren't shared), or nullptr if it isn't available here. The
+// jitdump one is nullptr unless LLVM was built with -DLLVM_USE_PERF=ON.
+static llvm::JITEventListener *
+shared_profiling_listener (int event)
+{
+#ifdef __linux__
+    if (event == LLVM_Util::ProfilePerfMap)
+        return &perf_map_listener;
+#endif
+    if (event == LLVM_Util::ProfileJitDump)
+        return llvm::JITEventListener::createPerfJITEventListener();
+    return nullptr;
+}
+
+static const int shared_profiling_events[] = { LLVM_Util::ProfilePerfMap,
+                                               LLVM_Util::ProfileJitDump };
+
 
 #if OSL_LLVM_VERSION >= 120
 llvm::raw_os_ostream raw_cout(std::cout);
@@ -172,7 +479,7 @@ LLVM_Util::ScopedJitMemoryUser::ScopedJitMemoryUser()
     OIIO::spin_lock lock (llvm_global_mutex);
     if (jit_mem_hold_users == 0) {
         OSL_ASSERT(!jitmm_hold);
-        jitmm_hold.reset(new std::vector<std::shared_ptr<LLVMMemoryManager> >());
+        jitmm_hold.reset(new std::vector<std::shared_ptr<LLVM_Util::JitMemory> >());
     }
     ++jit_mem_hold_users;
 }
@@ -180,28 +487,44 @@ LLVM_Util::ScopedJitMemoryUser::ScopedJitMemoryUser()
 
 LLVM_Util::ScopedJitMemoryUser::~ScopedJitMemoryUser()
 {
+    // Freeing JitMemory takes the lock, so let that happen after we're done.
+    std::unique_ptr<std::vector<std::shared_ptr<LLVM_Util::JitMemory> >> hold;
     OIIO::spin_lock lock (llvm_global_mutex);
     OSL_ASSERT(jit_mem_hold_users > 0);
     --jit_mem_hold_users;
     if (jit_mem_hold_users == 0) {
-        jitmm_hold.reset();
+        hold = std::move(jitmm_hold);
+#if OSL_LLVM_VERSION >= 130
+        // The lazy layers and call-through manager refer to the session,
+        // so they must go before it does.
+        orc_lazy_layers.clear();
+        orc_lazy_callthrough.reset();
+        orc_session.reset();
+        orc_object_layer = nullptr;
+        orc_gdb_listener = false;
+        delete orc_vtune_listener;
+        orc_vtune_listener = nullptr;
+        orc_shared_listeners = 0;
+#endif
     }
 }
 
 
 
-// We hold certain things (LLVM context and custom JIT memory manager)
-// per thread and retained across LLVM_Util invocations.
+// We hold certain things (LLVM context and parsed bitcode) per thread and
+// retained across LLVM_Util invocations.
 struct LLVM_Util::PerThreadInfo::Impl {
     Impl() {}
     ~Impl() {
+        // The prototypes live in llvm_context, so must go first.
+        bitcode_prototypes.clear();
         delete llvm_context;
-        // N.B. Do NOT delete the jitmm -- another thread may need the
-        // code! Don't worry, we stashed a pointer in jitmm_hold.
     }
 
     llvm::LLVMContext* llvm_context = nullptr;
-    LLVMMemoryManager* llvm_jitmm = nullptr;
+    // Fully parsed, read-only library modules, keyed by the address of
+    // the bitcode they came from (see module_from_bitcode_prototype).
+    std::unordered_map<const char*, std::unique_ptr<llvm::Module>> bitcode_prototypes;
 };
 
 
@@ -228,11 +551,43 @@ LLVM_Util::PerThreadInfo::get() const
 size_t
 LLVM_Util::total_jit_memory_held ()
 {
-    // FIXME: This can't possibly be correct. It will always return 0,
-    // since jitmem is a local variable.
-    size_t jitmem = 0;
-    OIIO::spin_lock lock (llvm_global_mutex);
-    return jitmem;
+    return llvm_jit_mapper.live();
+}
+
+
+
+size_t
+LLVM_Util::total_jit_memory_freed ()
+{
+    return llvm_jit_mapper.pooled();
+}
+
+
+
+size_t
+LLVM_Util::total_lazy_functions_compiled ()
+{
+#if OSL_LLVM_VERSION >= 130
+    return orc_lazy_compiled;
+#else
+    return 0;
+#endif
+}
+
+
+
+size_t
+LLVM_Util::thread_jit_memory_allocated ()
+{
+    return PooledMMapper::thread_allocated;
+}
+
+
+
+void
+LLVM_Util::jit_huge_pages (bool on)
+{
+    llvm_jit_mapper.huge_pages (on);
 }
 
 
@@ -316,6 +671,122 @@ public:
 
 
 
+#if OSL_LLVM_VERSION >= 130
+/// Per-LLVM_Util state for the ORC backend. The module is compiled to an
+/// object by our own TargetMachine (on the calling thread), and only the
+/// resulting object is handed to the shared session to be linked into a
+/// JITDylib private to this module, so that identically named symbols of
+/// different groups never collide.
+struct LLVM_Util::OrcJIT {
+    llvm::orc::LLJIT* session = nullptr;
+    llvm::orc::JITDylib* dylib = nullptr;
+    std::unique_ptr<llvm::TargetMachine> target_machine;
+    std::unique_ptr<llvm::orc::JITTargetMachineBuilder> tm_builder;
+    std::unique_ptr<llvm::Module> module;  // we own it, as MCJIT would
+    llvm::orc::SymbolMap function_mappings;
+    void* (*lazy_function_creator)(const std::string&) = nullptr;
+    std::vector<std::unique_ptr<llvm::MemoryBuffer>> objects;  // add_object
+};
+
+
+namespace {
+
+// Resolve any symbols not found elsewhere by asking the function installed
+// with LLVM_Util::InstallLazyFunctionCreator, just as MCJIT would.
+class LazyFunctionGenerator final : public llvm::orc::DefinitionGenerator {
+public:
+    LazyFunctionGenerator(void* (*creator)(const std::string&), char prefix)
+        : m_creator(creator), m_prefix(prefix) {}
+
+    llvm::Error tryToGenerate(llvm::orc::LookupState& /*LS*/,
+                              llvm::orc::LookupKind /*K*/,
+                              llvm::orc::JITDylib& JD,
+                              llvm::orc::JITDylibLookupFlags /*JDLookupFlags*/,
+                              const llvm::orc::SymbolLookupSet& symbols) override
+    {
+        llvm::orc::SymbolMap found;
+        for (auto& sym : symbols) {
+            llvm::StringRef name = *sym.first;
+            if (m_prefix && name.startswith(llvm::StringRef(&m_prefix, 1)))
+                name = name.drop_front();
+            if (void* addr = m_creator(name.str()))
+                found[sym.first] = llvm::JITEvaluatedSymbol(
+                    llvm::pointerToJITTargetAddress(addr),
+                    llvm::JITSymbolFlags::Exported);
+        }
+        if (found.empty())
+            return llvm::Error::success();
+        return JD.define(llvm::orc::absoluteSymbols(std::move(found)));
+    }
+
+private:
+    void* (*m_creator)(const std::string&);
+    char m_prefix;
+};
+
+
+
+// Where a lazy call-through lands if compiling the callee failed.
+void
+orc_lazy_compile_failed()
+{
+    OSL_ASSERT(0 && "ORC JIT: lazy compilation of a function failed");
+}
+
+}  // namespace
+
+#else
+struct LLVM_Util::OrcJIT {};
+#endif
+
+
+
+struct LLVM_Util::JitMemory {
+    // MCJIT: the memory manager that all the sections came from.
+    std::unique_ptr<LLVMMemoryManager> mm;
+#if OSL_LLVM_VERSION >= 130
+    // ORC: all the module's code is in its own JITDylib (as well as in
+    // the ".impl" one that a CompileOnDemandLayer makes for it).
+    llvm::orc::JITDylib* dylib = nullptr;
+    OrcLazyLayers* lazy_layers = nullptr;
+    int session_serial = 0;
+#endif
+
+    ~JitMemory() {
+#if OSL_LLVM_VERSION >= 130
+        if (! dylib)
+            return;
+        OIIO::spin_lock lock (llvm_global_mutex);
+        // If the session it was linked into is gone, so is the code.
+        if (! orc_session || session_serial != orc_session_serial)
+            return;
+        auto& es (orc_session->getExecutionSession());
+        llvm::orc::JITDylib* impl = es.getJITDylibByName (dylib->getName() + ".impl");
+        for (llvm::orc::JITDylib* jd : { dylib, impl }) {
+            if (! jd)
+                continue;
+#  if OSL_LLVM_VERSION >= 140
+            llvm::Error err = es.removeJITDylib (*jd);
+#  else
+            llvm::Error err = jd->clear ();
+#  endif
+            if (err)
+                es.reportError (std::move(err));
+        }
+        if (lazy_layers) {
+            for (auto l = orc_lazy_layers.begin(); l != orc_lazy_layers.end(); ++l) {
+                if (l->get() == lazy_layers) {
+                    orc_lazy_layers.erase (l);
+                    break;
+                }
+            }
+        }
+#endif
+    }
+};
+
+
+
 class LLVM_Util::IRBuilder final : public llvm::IRBuilder<llvm::ConstantFolder,
                                                llvm::IRBuilderDefaultInserter> {
     typedef llvm::IRBuilder<llvm::ConstantFolder,
@@ -344,13 +815,14 @@ LLVM_Util::LLVM_Util (const PerThreadInfo &per_thread_info,
                       int debuglevel, int vector_width)
     : m_debug(debuglevel), m_thread(NULL),
       m_llvm_context(NULL), m_llvm_module(NULL),
-      m_builder(NULL), m_llvm_jitmm(NULL),
+      m_builder(NULL),
       m_current_function(NULL),
       m_llvm_module_passes(NULL), m_llvm_func_passes(NULL),
       m_llvm_exec(NULL),
       m_vector_width(vector_width),
       m_llvm_type_native_mask(nullptr),
       mVTuneNotifier(nullptr),
+      m_shared_listeners(0),
       m_llvm_debug_builder(nullptr),
       mDebugCU(nullptr),
       mSubTypeForInlinedFunction(nullptr),
@@ -372,15 +844,8 @@ LLVM_Util::LLVM_Util (const PerThreadInfo &per_thread_info,
             //static SetCommandLineOptionsForLLVM sSetCommandLineOptionsForLLVM;
         }
 
-        if (! m_thread->llvm_jitmm) {
-            m_thread->llvm_jitmm = new LLVMMemoryManager(&llvm_default_mapper);
-            OSL_DASSERT (m_thread->llvm_jitmm);
-            OSL_ASSERT (jitmm_hold &&
-                "An instance of OSL::pvt::LLVM_Util::ScopedJitMemoryUser must exist with a longer lifetime than this LLVM_Util object");
-            jitmm_hold->emplace_back (m_thread->llvm_jitmm);
-        }
-        // Hold the REAL manager and use it as an argument later
-        m_llvm_jitmm = m_thread->llvm_jitmm;
+        OSL_ASSERT (jitmm_hold &&
+            "An instance of OSL::pvt::LLVM_Util::ScopedJitMemoryUser must exist with a longer lifetime than this LLVM_Util object");
     }
 
     OSL_ASSERT(m_thread->llvm_context);
@@ -454,8 +919,24 @@ LLVM_Util::~LLVM_Util ()
     delete m_llvm_func_passes;
     delete m_builder;
     delete m_llvm_debug_builder;
+    delete m_orc;
     module (NULL);
-    // DO NOT delete m_llvm_jitmm;  // just the dummy wrapper around the real MM
+    // Unless someone took charge of the JITed code, it lives as long as
+    // the ScopedJitMemoryUsers do.
+    if (m_jit_memory && ! m_jit_memory_taken) {
+        OIIO::spin_lock lock (llvm_global_mutex);
+        if (jitmm_hold)
+            jitmm_hold->emplace_back (std::move(m_jit_memory));
+    }
+}
+
+
+
+std::shared_ptr<LLVM_Util::JitMemory>
+LLVM_Util::jit_memory ()
+{
+    m_jit_memory_taken = true;
+    return m_jit_memory;
 }
 
 
@@ -493,6 +974,9 @@ LLVM_Util::SetupLLVM ()
     static llvm::RegisterPass<PreventBitMasksFromBeingLiveinsToBasicBlocks<16>> sRegCustomPass1("PreventBitMasksFromBeingLiveinsToBasicBlocks<16>", "Prevent Bit Masks <16xi1> From Being Liveins To Basic Blocks Pass",
                                  false /* Only looks at CFG */,
                                  false /* Analysis Pass */);
+    static llvm::RegisterPass<PreventBitMasksFromBeingLiveinsToBasicBlocks<4>> sRegCustomPass2("PreventBitMasksFromBeingLiveinsToBasicBlocks<4>", "Prevent Bit Masks <4xi1> From Being Liveins To Basic Blocks Pass",
+                                 false /* Only looks at CFG */,
+                                 false /* Analysis Pass */);
 
     if (debug()) {
         for (auto t : llvm::TargetRegistry::targets())
@@ -856,6 +1340,135 @@ LLVM_Util::module_from_bitcode (const char *bitcode, size_t size,
 }
 
 
+#ifndef OSL_FORCE_BITCODE_PARSE
+namespace { // anonymous
+
+// Materializer for a module that was cloned from a fully parsed prototype
+// with all function bodies left out. It plays the same role as the lazy
+// bitcode reader: each function body is copied from the prototype only
+// when something asks for it to be materialized, so the usual pruning
+// of unused library functions never has to touch the rest.
+class PrototypeMaterializer final : public llvm::GVMaterializer {
+public:
+    PrototypeMaterializer (const llvm::Module &proto, llvm::Module &module,
+                           std::unique_ptr<llvm::ValueToValueMapTy> vmap)
+        : m_proto(proto), m_module(module), m_vmap(std::move(vmap))
+    {
+        for (const llvm::Function &pfunc : m_proto) {
+            if (pfunc.isDeclaration())
+                continue;
+            llvm::Function *func = llvm::cast<llvm::Function>((*m_vmap)[&pfunc]);
+            // CloneModule made it an external declaration, restore the
+            // real linkage and comdat up front so the module looks just
+            // like one lazily read from bitcode.
+            func->setLinkage(pfunc.getLinkage());
+            if (const llvm::Comdat *pcomdat = pfunc.getComdat()) {
+                llvm::Comdat *comdat = m_module.getOrInsertComdat(pcomdat->getName());
+                comdat->setSelectionKind(pcomdat->getSelectionKind());
+                func->setComdat(comdat);
+            }
+            func->setIsMaterializable(true);
+            m_origin[func] = &pfunc;
+        }
+    }
+
+    llvm::Error materialize (llvm::GlobalValue *gv) override {
+        llvm::Function *func = llvm::dyn_cast<llvm::Function>(gv);
+        if (!func || !func->isMaterializable())
+            return llvm::Error::success();
+        const llvm::Function *pfunc = m_origin.lookup(func);
+        OSL_ASSERT (pfunc);
+        auto arg = func->arg_begin();
+        for (const llvm::Argument &parg : pfunc->args()) {
+            arg->setName(parg.getName());
+            (*m_vmap)[&parg] = &*arg++;
+        }
+        func->setIsMaterializable(false);
+        llvm::SmallVector<llvm::ReturnInst*, 8> returns;
+#if OSL_LLVM_VERSION >= 130
+        llvm::CloneFunctionInto(func, pfunc, *m_vmap,
+                                llvm::CloneFunctionChangeType::ClonedModule,
+                                returns);
+#else
+        llvm::CloneFunctionInto(func, pfunc, *m_vmap,
+                                /*ModuleLevelChanges=*/true, returns);
+#endif
+        return llvm::Error::success();
+    }
+
+    llvm::Error materializeModule () override {
+        for (llvm::Function &func : m_module)
+            if (llvm::Error err = materialize(&func))
+                return err;
+        return llvm::Error::success();
+    }
+
+    llvm::Error materializeMetadata () override {
+        // CloneModule already copied all module level metadata.
+        return llvm::Error::success();
+    }
+
+    void setStripDebugInfo () override { }
+
+    std::vector<llvm::StructType *> getIdentifiedStructTypes () const override {
+        // Both modules share the context, and thus the struct types.
+        llvm::TypeFinder types;
+        types.run (m_proto, true);
+        return std::vector<llvm::StructType *>(types.begin(), types.end());
+    }
+
+private:
+    const llvm::Module &m_proto;
+    llvm::Module &m_module;
+    std::unique_ptr<llvm::ValueToValueMapTy> m_vmap;
+    llvm::DenseMap<const llvm::Function*, const llvm::Function*> m_origin;
+};
+
+} // anonymous namespace
+#endif
+
+
+
+llvm::Module *
+LLVM_Util::module_from_bitcode_prototype (const char *bitcode, size_t size,
+                                          const std::string &name,
+                                          std::string *err)
+{
+#ifdef OSL_FORCE_BITCODE_PARSE
+    // Nothing lazy allowed, the full parse is all we can do.
+    return module_from_bitcode (bitcode, size, name, err);
+#else
+    if (err)
+        err->clear();
+
+    std::unique_ptr<llvm::Module> &proto = m_thread->bitcode_prototypes[bitcode];
+    if (! proto) {
+        llvm::MemoryBufferRef buf =
+            llvm::MemoryBufferRef(llvm::StringRef(bitcode, size), name);
+        llvm::Expected<std::unique_ptr<llvm::Module> > ModuleOrErr =
+            llvm::parseBitcodeFile (buf, context());
+        if (! ModuleOrErr) {
+            std::string parse_err;
+            error_string(ModuleOrErr.takeError(), err ? err : &parse_err);
+            m_thread->bitcode_prototypes.erase(bitcode);
+            return nullptr;
+        }
+        proto = std::move(*ModuleOrErr);
+    }
+
+    // Copy everything but the function bodies, which are left for the
+    // materializer to copy as they are needed.
+    std::unique_ptr<llvm::ValueToValueMapTy> vmap (new llvm::ValueToValueMapTy);
+    std::unique_ptr<llvm::Module> m = llvm::CloneModule (*proto, *vmap,
+        [](const llvm::GlobalValue *gv) { return ! llvm::isa<llvm::Function>(gv); });
+    m->setModuleIdentifier(name);
+    m->setMaterializer(new PrototypeMaterializer(*proto, *m, std::move(vmap)));
+    return m.release();
+#endif
+}
+
+
+
 void
 LLVM_Util::push_function_mask(llvm::Value * startMaskValue)
 {
@@ -1024,7 +1637,7 @@ static bool initCpuFeatures()
 // for any of the wide libraries, please update here to match
 static const char * target_isa_names[] = {
     "UNKNOWN", "none", "x64", "SSE4.2", "AVX", "AVX2", "AVX2_noFMA",
-    "AVX512", "AVX512_noFMA", "host"
+    "AVX512", "AVX512_noFMA", "NEON", "host"
 };
 
 
@@ -1137,6 +1750,13 @@ static const char * required_cpu_features_by_AVX512_noFMA[] = {
 };
 
 
+// clang: -march=armv8-a
+// Advanced SIMD is part of the base AArch64 ISA, but check anyway
+static const char * required_cpu_features_by_NEON[] = {
+    "fp-armv8", "neon"
+};
+
+
 static cspan<const char*>
 get_required_cpu_features_for(TargetISA target)
 {
@@ -1149,6 +1769,7 @@ get_required_cpu_features_for(TargetISA target)
     case TargetISA::AVX2_noFMA:   return required_cpu_features_by_AVX2_noFMA;
     case TargetISA::AVX512:       return required_cpu_features_by_AVX512;
     case TargetISA::AVX512_noFMA: return required_cpu_features_by_AVX512_noFMA;
+    case TargetISA::NEON:         return required_cpu_features_by_NEON;
     default:
         OSL_ASSERT(0 && "incomplete required cpu features for target are not specified");
         return {};
@@ -1185,6 +1806,32 @@ LLVM_Util::target_isa_name(TargetISA isa)
 
 
 
+static const char * opt_preset_names[] = {
+    "UNKNOWN", "legacy", "none", "compile-fast", "default", "aggressive"
+};
+
+
+
+/*static*/ OptPreset
+LLVM_Util::lookup_opt_preset_by_name(string_view preset_name)
+{
+    for (int i = static_cast<int>(OptPreset::LEGACY); i < static_cast<int>(OptPreset::COUNT); ++i) {
+        if (OIIO::Strutil::iequals(preset_name, opt_preset_names[i]))
+            return static_cast<OptPreset>(i);
+    }
+    return OptPreset::UNKNOWN;
+}
+
+
+
+const char*
+LLVM_Util::opt_preset_name(OptPreset preset)
+{
+    return opt_preset_names[static_cast<int>(preset)];
+}
+
+
+
 bool
 LLVM_Util::detect_cpu_features(TargetISA requestedISA, bool no_fma)
 {
@@ -1205,6 +1852,11 @@ LLVM_Util::detect_cpu_features(TargetISA requestedISA, bool no_fma)
     case TargetISA::UNKNOWN:
         OSL_FALLTHROUGH;
     case TargetISA::HOST:
+        // An AArch64 host has none of the x86 ISAs below
+        if (supports_isa(TargetISA::NEON)) {
+            m_target_isa = TargetISA::NEON;
+            break;
+        }
         OSL_FALLTHROUGH;
     case TargetISA::AVX512:
         if (!no_fma) {
@@ -1269,6 +1921,10 @@ LLVM_Util::detect_cpu_features(TargetISA requestedISA, bool no_fma)
             break;
         }
         break;
+    case TargetISA::NEON:
+        if (supports_isa(TargetISA::NEON))
+            m_target_isa = TargetISA::NEON;
+        break;
     case TargetISA::NONE:
         m_target_isa = TargetISA::NONE;
         break;
@@ -1326,34 +1982,9 @@ LLVM_Util::supports_isa(TargetISA target)
 
 
 
-// N.B. This method is never called for PTX generation, so don't be alarmed
-// if it's doing x86 specific things.
-llvm::ExecutionEngine *
-LLVM_Util::make_jit_execengine (std::string *err,
-                                TargetISA requestedISA,
-                                bool debugging_symbols,
-                                bool profiling_events)
+void
+LLVM_Util::setup_target_options (llvm::TargetOptions &options)
 {
-    execengine (NULL);   // delete and clear any existing engine
-    if (err)
-        err->clear ();
-    llvm::EngineBuilder engine_builder ((std::unique_ptr<llvm::Module>(module())));
-
-    engine_builder.setEngineKind (llvm::EngineKind::JIT);
-    engine_builder.setErrorStr (err);
-    //engine_builder.setRelocationModel(llvm::Reloc::PIC_);
-    //engine_builder.setCodeModel(llvm::CodeModel::Default);
-    engine_builder.setVerifyModules(true);
-
-    // We are actually holding a LLVMMemoryManager
-    engine_builder.setMCJITMemoryManager (std::unique_ptr<llvm::RTDyldMemoryManager>
-        (new MemoryManager(m_llvm_jitmm)));
-
-    engine_builder.setOptLevel (jit_aggressive()
-                                ? llvm::CodeGenOpt::Aggressive
-                                : llvm::CodeGenOpt::Default);
-
-    llvm::TargetOptions options;
     // Enables FMA's in IR generation.
     // However cpu feature set may or may not support FMA's independently
     options.AllowFPOpFusion = jit_fma() ? llvm::FPOpFusion::Fast :
@@ -1392,7 +2023,96 @@ LLVM_Util::make_jit_execengine (std::string *err,
     // It is instead accomplished with a MachineFunctionPrinterPass.
     options.PrintMachineCode = dumpasm();
 #endif
+}
+
+
+
+void
+LLVM_Util::setup_debug_info ()
+{
+    OSL_ASSERT(m_llvm_module != nullptr);
+    OSL_DEV_ONLY(std::cout << "debugging symbols"<< std::endl);
+
+    module()->addModuleFlag(llvm::Module::Error, "Debug Info Version",
+            llvm::DEBUG_METADATA_VERSION);
+
+    OSL_MAYBE_UNUSED unsigned int modulesDebugInfoVersion = 0;
+    if (auto *Val = llvm::mdconst::dyn_extract_or_null < llvm::ConstantInt
+            > (module()->getModuleFlag("Debug Info Version"))) {
+        modulesDebugInfoVersion = Val->getZExtValue();
+    }
+
+    OSL_ASSERT(m_llvm_debug_builder == nullptr && "Only handle creating the debug builder once");
+    m_llvm_debug_builder = new llvm::DIBuilder(*m_llvm_module);
+
+    llvm::SmallVector<llvm::Metadata *, 8> EltTys;
+    mSubTypeForInlinedFunction = m_llvm_debug_builder->createSubroutineType(
+                    m_llvm_debug_builder->getOrCreateTypeArray(EltTys));
+
+    //  OSL_DEV_ONLY(std::cout)
+    //  OSL_DEV_ONLY(       << "------------------>enable_debug_info<-----------------------------module flag['Debug Info Version']= ")
+    //  OSL_DEV_ONLY(       << modulesDebugInfoVersion << std::endl);
+}
+
+
+
+bool
+LLVM_Util::orc_jit_supported ()
+{
+#if OSL_LLVM_VERSION >= 130
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+
+bool
+LLVM_Util::make_jit (std::string *err, TargetISA requestedISA,
+                     bool debugging_symbols, int profiling_events)
+{
+    if (orc_jit())
+        return make_orc_jit (err, requestedISA, debugging_symbols,
+                             profiling_events);
+    return make_jit_execengine (err, requestedISA, debugging_symbols,
+                                profiling_events) != nullptr;
+}
+
+
+
+// N.B. This method is never called for PTX generation, so don't be alarmed
+// if it's doing x86 specific things.
+llvm::ExecutionEngine *
+LLVM_Util::make_jit_execengine (std::string *err,
+                                TargetISA requestedISA,
+                                bool debugging_symbols,
+                                int profiling_events)
+{
+    execengine (NULL);   // delete and clear any existing engine
+    if (err)
+        err->clear ();
+    llvm::EngineBuilder engine_builder ((std::unique_ptr<llvm::Module>(module())));
+
+    engine_builder.setEngineKind (llvm::EngineKind::JIT);
+    engine_builder.setErrorStr (err);
+    //engine_builder.setRelocationModel(llvm::Reloc::PIC_);
+    //engine_builder.setCodeModel(llvm::CodeModel::Default);
+    engine_builder.setVerifyModules(true);
 
+    // The engine gets a shell around the real memory manager, which is
+    // ours, so that the code outlives the engine.
+    m_jit_memory.reset (new JitMemory);
+    m_jit_memory->mm.reset (new LLVMMemoryManager(&llvm_jit_mapper));
+    engine_builder.setMCJITMemoryManager (std::unique_ptr<llvm::RTDyldMemoryManager>
+        (new MemoryManager(m_jit_memory->mm.get())));
+
+    engine_builder.setOptLevel (jit_aggressive()
+                                ? llvm::CodeGenOpt::Aggressive
+                                : llvm::CodeGenOpt::Default);
+
+    llvm::TargetOptions options;
+    setup_target_options(options);
     engine_builder.setTargetOptions(options);
 
     detect_cpu_features(requestedISA, !jit_fma());
@@ -1428,57 +2148,227 @@ LLVM_Util::make_jit_execengine (std::string *err,
     // The underlying GDBRegistrationListener is static, so we are leaking it
     m_llvm_exec->UnregisterJITEventListener(llvm::JITEventListener::createGDBRegistrationListener());
 
-    if (debugging_symbols) {
-        OSL_ASSERT(m_llvm_module != nullptr);
-        OSL_DEV_ONLY(std::cout << "debugging symbols"<< std::endl);
+    if (debugging_symbols) {
+        setup_debug_info();
+
+        // The underlying GDBRegistrationListener is static, so we are leaking it
+        m_llvm_exec->RegisterJITEventListener(llvm::JITEventListener::createGDBRegistrationListener());
+    }
+
+    if (profiling_events & ProfileIntelJIT) {
+        // These magic lines will make it so that enough symbol information
+        // is injected so that running vtune will kinda tell you which shaders
+        // you're in, and sometimes which function (only for functions that don't
+        // get inlined. There doesn't seem to be any perf hit from this, either
+        // in code quality or JIT time. It is only enabled, however, if your copy
+        // of LLVM was build with -DLLVM_USE_INTEL_JITEVENTS=ON, otherwise
+        // createIntelJITEventListener() is a stub that just returns nullptr.
+
+        // TODO:  Create better VTune listener that can handle inline fuctions
+        //        https://software.intel.com/en-us/node/544211
+        mVTuneNotifier = llvm::JITEventListener::createIntelJITEventListener();
+        if (mVTuneNotifier != NULL) {
+            m_llvm_exec->RegisterJITEventListener(mVTuneNotifier);
+        }
+    }
+    m_shared_listeners = 0;
+    for (int event : shared_profiling_events) {
+        llvm::JITEventListener *listener = shared_profiling_listener(event);
+        if ((profiling_events & event) && listener) {
+            m_llvm_exec->RegisterJITEventListener(listener);
+            m_shared_listeners |= event;
+        }
+    }
+
+    // Force it to JIT as soon as we ask it for the code pointer,
+    // don't take any chances that it might JIT lazily, since we
+    // will be stealing the JIT code memory from under its nose and
+    // destroying the Module & ExecutionEngine.
+    m_llvm_exec->DisableLazyCompilation ();
+    return m_llvm_exec;
+}
+
+
+
+// N.B. Like make_jit_execengine, this is never called for PTX generation.
+bool
+LLVM_Util::make_orc_jit (std::string *err, TargetISA requestedISA,
+                         bool debugging_symbols, int profiling_events)
+{
+    execengine (NULL);   // no MCJIT engine alongside ORC
+    delete m_orc;
+    m_orc = nullptr;
+    if (err)
+        err->clear ();
+    std::string errmsg;
+#if OSL_LLVM_VERSION >= 130
+    m_orc = new OrcJIT;
+
+    llvm::TargetOptions options;
+    setup_target_options(options);
+
+    detect_cpu_features(requestedISA, !jit_fma());
+
+    // Build the same TargetMachine that MCJIT's EngineBuilder would.
+    std::string triple = module()->getTargetTriple();
+    if (triple.empty())
+        triple = llvm::sys::getProcessTriple();
+    llvm::orc::JITTargetMachineBuilder tm_builder ((llvm::Triple(triple)));
+    tm_builder.setOptions (options);
+    tm_builder.setCodeGenOptLevel (jit_aggressive()
+                                   ? llvm::CodeGenOpt::Aggressive
+                                   : llvm::CodeGenOpt::Default);
+    if (initCpuFeatures()) {
+        OSL_DEV_ONLY(std::cout << "Building LLVM ORC JIT for target:" << target_isa_name(m_target_isa) << std::endl);
+        std::vector<std::string> attrvec;
+        auto features = get_required_cpu_features_for(m_target_isa);
+        for (auto f : features) {
+            OSL_DEV_ONLY(std::cout << ">>>Requesting Feature:" << f << std::endl);
+            attrvec.push_back(f);
+        }
+        tm_builder.addFeatures(attrvec);
+    }
+
+    m_llvm_type_native_mask = m_supports_avx512f ? m_llvm_type_wide_bool
+                : llvm_vector_type(m_llvm_type_int, m_vector_width);
+
+    auto target_machine = tm_builder.createTargetMachine();
+    if (! target_machine) {
+        error_string (target_machine.takeError(), &errmsg);
+        if (err)
+            *err = errmsg;
+        return false;
+    }
+    m_orc->target_machine = std::move(*target_machine);
+    m_orc->tm_builder.reset (new llvm::orc::JITTargetMachineBuilder(tm_builder));
+    module()->setDataLayout (m_orc->target_machine->createDataLayout());
+    m_orc->module.reset (module());
+
+    {
+        OIIO::spin_lock lock (llvm_global_mutex);
+        OSL_ASSERT (jit_mem_hold_users > 0 &&
+            "An instance of OSL::pvt::LLVM_Util::ScopedJitMemoryUser must exist with a longer lifetime than this LLVM_Util object");
+        if (! orc_session) {
+            // Code and data sections come from a fresh memory manager
+            // per object, and are released when the session is.
+            auto session = llvm::orc::LLJITBuilder()
+                .setObjectLinkingLayerCreator(
+                    [](llvm::orc::ExecutionSession &ES, const llvm::Triple &)
+                        -> llvm::Expected<std::unique_ptr<llvm::orc::ObjectLayer>> {
+                        auto layer = std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(ES,
+                            []() { return std::make_unique<LLVMMemoryManager>(&llvm_jit_mapper); });
+                        orc_object_layer = layer.get();
+                        return std::unique_ptr<llvm::orc::ObjectLayer>(std::move(layer));
+                    })
+                .create();
+            if (! session) {
+                error_string (session.takeError(), &errmsg);
+                if (err)
+                    *err = errmsg;
+                return false;
+            }
+            orc_session = std::move(*session);
+            ++orc_session_serial;
+        }
+        m_orc->session = orc_session.get();
+
+        if (orc_jit_lazy() && ! orc_lazy_callthrough) {
+            auto callthrough = llvm::orc::createLocalLazyCallThroughManager(
+                m_orc->tm_builder->getTargetTriple(),
+                orc_session->getExecutionSession(),
+                llvm::pointerToJITTargetAddress(&orc_lazy_compile_failed));
+            if (! callthrough) {
+                error_string (callthrough.takeError(), &errmsg);
+                if (err)
+                    *err = errmsg;
+                return false;
+            }
+            orc_lazy_callthrough = std::move(*callthrough);
+        }
 
-        module()->addModuleFlag(llvm::Module::Error, "Debug Info Version",
-                llvm::DEBUG_METADATA_VERSION);
+        // Listeners are registered with the shared object layer, once,
+        // the first time any module asks for them. The underlying
+        // GDBRegistrationListener is static, so we are leaking it.
+        if (debugging_symbols && ! orc_gdb_listener) {
+            orc_object_layer->registerJITEventListener(
+                *llvm::JITEventListener::createGDBRegistrationListener());
+            orc_gdb_listener = true;
+        }
+        if ((profiling_events & ProfileIntelJIT) && ! orc_vtune_listener) {
+            // See make_jit_execengine: this is nullptr unless LLVM was
+            // built with -DLLVM_USE_INTEL_JITEVENTS=ON.
+            orc_vtune_listener = llvm::JITEventListener::createIntelJITEventListener();
+            if (orc_vtune_listener)
+                orc_object_layer->registerJITEventListener(*orc_vtune_listener);
+        }
+        for (int event : shared_profiling_events) {
+            if (! (profiling_events & event) || (orc_shared_listeners & event))
+                continue;
+            if (llvm::JITEventListener *listener = shared_profiling_listener(event))
+                orc_object_layer->registerJITEventListener(*listener);
+            orc_shared_listeners |= event;
+        }
 
-        OSL_MAYBE_UNUSED unsigned int modulesDebugInfoVersion = 0;
-        if (auto *Val = llvm::mdconst::dyn_extract_or_null < llvm::ConstantInt
-                > (module()->getModuleFlag("Debug Info Version"))) {
-            modulesDebugInfoVersion = Val->getZExtValue();
+        std::string dylib_name = module()->getModuleIdentifier() + "_"
+                               + std::to_string(++orc_dylib_serial);
+        auto dylib = orc_session->createJITDylib (dylib_name);
+        if (! dylib) {
+            error_string (dylib.takeError(), &errmsg);
+            if (err)
+                *err = errmsg;
+            return false;
         }
+        m_orc->dylib = &dylib.get();
+        m_jit_memory.reset (new JitMemory);
+        m_jit_memory->dylib = m_orc->dylib;
+        m_jit_memory->session_serial = orc_session_serial;
+    }
 
-        OSL_ASSERT(m_llvm_debug_builder == nullptr && "Only handle creating the debug builder once");
-        m_llvm_debug_builder = new llvm::DIBuilder(*m_llvm_module);
+    // Anything not defined by the module or mapped explicitly with
+    // add_function_mapping is looked up in the running process
+    // (including names registered with add_global_mapping).
+    auto process_symbols = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+                               m_orc->session->getDataLayout().getGlobalPrefix());
+    if (! process_symbols) {
+        error_string (process_symbols.takeError(), &errmsg);
+        if (err)
+            *err = errmsg;
+        return false;
+    }
+    m_orc->dylib->addGenerator (std::move(*process_symbols));
 
-        llvm::SmallVector<llvm::Metadata *, 8> EltTys;
-        mSubTypeForInlinedFunction = m_llvm_debug_builder->createSubroutineType(
-                        m_llvm_debug_builder->getOrCreateTypeArray(EltTys));
+    if (debugging_symbols)
+        setup_debug_info ();
+    return true;
+#else
+    if (err)
+        *err = "ORC JIT requires LLVM 13 or newer";
+    return false;
+#endif
+}
 
-        //  OSL_DEV_ONLY(std::cout)
-        //  OSL_DEV_ONLY(       << "------------------>enable_debug_info<-----------------------------module flag['Debug Info Version']= ")
-        //  OSL_DEV_ONLY(       << modulesDebugInfoVersion << std::endl);
 
-        // The underlying GDBRegistrationListener is static, so we are leaking it
-        m_llvm_exec->RegisterJITEventListener(llvm::JITEventListener::createGDBRegistrationListener());
-    }
 
-    if (profiling_events) {
-        // These magic lines will make it so that enough symbol information
-        // is injected so that running vtune will kinda tell you which shaders
-        // you're in, and sometimes which function (only for functions that don't
-        // get inlined. There doesn't seem to be any perf hit from this, either
-        // in code quality or JIT time. It is only enabled, however, if your copy
-        // of LLVM was build with -DLLVM_USE_INTEL_JITEVENTS=ON, otherwise
-        // createIntelJITEventListener() is a stub that just returns nullptr.
+llvm::TargetMachine *
+LLVM_Util::target_machine ()
+{
+#if OSL_LLVM_VERSION >= 130
+    if (m_orc)
+        return m_orc->target_machine.get();
+#endif
+    return execengine()->getTargetMachine();
+}
 
-        // TODO:  Create better VTune listener that can handle inline fuctions
-        //        https://software.intel.com/en-us/node/544211
-        mVTuneNotifier = llvm::JITEventListener::createIntelJITEventListener();
-        if (mVTuneNotifier != NULL) {
-            m_llvm_exec->RegisterJITEventListener(mVTuneNotifier);
-        }
-    }
 
-    // Force it to JIT as soon as we ask it for the code pointer,
-    // don't take any chances that it might JIT lazily, since we
-    // will be stealing the JIT code memory from under its nose and
-    // destroying the Module & ExecutionEngine.
-    m_llvm_exec->DisableLazyCompilation ();
-    return m_llvm_exec;
+
+const llvm::DataLayout &
+LLVM_Util::data_layout ()
+{
+#if OSL_LLVM_VERSION >= 130
+    if (m_orc)
+        return m_orc->module->getDataLayout();
+#endif
+    return execengine()->getDataLayout();
 }
 
 
@@ -1506,7 +2396,7 @@ LLVM_Util::dump_struct_data_layout(llvm::Type *Ty)
     OSL_ASSERT(Ty->isStructTy());
 
     llvm::StructType *structTy = static_cast<llvm::StructType *>(Ty);
-    const llvm::DataLayout & data_layout = m_llvm_exec->getDataLayout();
+    const llvm::DataLayout & data_layout = this->data_layout();
 
     int number_of_elements = structTy->getNumElements();
     const llvm::StructLayout * layout = data_layout.getStructLayout (structTy);
@@ -1535,7 +2425,7 @@ LLVM_Util::validate_struct_data_layout(llvm::Type *Ty, const std::vector<unsigne
     OSL_ASSERT(Ty->isStructTy());
 
     llvm::StructType *structTy = static_cast<llvm::StructType *>(Ty);
-    const llvm::DataLayout & data_layout = m_llvm_exec->getDataLayout();
+    const llvm::DataLayout & data_layout = this->data_layout();
 
     int number_of_elements = structTy->getNumElements();
 
@@ -1580,6 +2470,12 @@ LLVM_Util::execengine (llvm::ExecutionEngine *exec)
             delete mVTuneNotifier;
             mVTuneNotifier = nullptr;
         }
+        // Likewise for the perf listeners, which are shared, so are only
+        // unregistered from this engine.
+        for (int event : shared_profiling_events)
+            if (m_shared_listeners & event)
+                m_llvm_exec->UnregisterJITEventListener(shared_profiling_listener(event));
+        m_shared_listeners = 0;
 
         if (debug_is_enabled()) {
             // We explicitly remove the GDB listener, so it can't be notified of the object's release.
@@ -1607,6 +2503,9 @@ LLVM_Util::getPointerToFunction (llvm::Function *func)
         m_llvm_debug_builder->finalize();
     }
 
+    if (m_orc)
+        return orc_getPointerToFunction (func);
+
     llvm::ExecutionEngine *exec = execengine();
     OSL_ASSERT(!exec->isCompilingLazily());
     if (!m_ModuleIsFinalized) {
@@ -1622,6 +2521,297 @@ LLVM_Util::getPointerToFunction (llvm::Function *func)
 }
 
 
+
+void *
+LLVM_Util::getPointerToFunction (const std::string &name)
+{
+    if (debug_is_enabled())
+        m_llvm_debug_builder->finalize();
+
+    if (m_orc)
+        return orc_getPointerToFunction (name);
+
+    llvm::ExecutionEngine *exec = execengine();
+    if (!m_ModuleIsFinalized) {
+        exec->finalizeObject ();
+        m_ModuleIsFinalized = true;
+    }
+    return (void *)exec->getFunctionAddress (name);
+}
+
+
+
+bool
+LLVM_Util::emit_object (std::string &object, std::string *err,
+                        TargetISA isa)
+{
+    object.clear ();
+    std::string errmsg;
+    // Code generation rewrites the IR it's given, and the JIT will still
+    // compile this module, so compile a copy.
+    if (error_string (module()->materializeAll(), &errmsg)) {
+        if (err)
+            *err = errmsg;
+        return false;
+    }
+    std::unique_ptr<llvm::Module> copy = llvm::CloneModule (*module());
+
+    // Another ISA gets a TargetMachine just like the JIT's, except for
+    // the CPU features it may assume.
+    llvm::TargetMachine *tm = target_machine();
+    std::unique_ptr<llvm::TargetMachine> isa_tm;
+    if (isa != TargetISA::UNKNOWN && isa != m_target_isa) {
+        // Only the CPU features differ, so it must be the same architecture
+        bool aarch64 = tm->getTargetTriple().getArch() == llvm::Triple::aarch64;
+        if ((isa == TargetISA::NEON) != aarch64) {
+            if (err)
+                *err = fmtformat ("can't target {} from {}", target_isa_name(isa),
+                                  tm->getTargetTriple().getArchName().str());
+            return false;
+        }
+        llvm::SubtargetFeatures features;
+        for (auto f : get_required_cpu_features_for(isa))
+            features.AddFeature (f);
+        isa_tm.reset (tm->getTarget().createTargetMachine (
+                          tm->getTargetTriple().str(), tm->getTargetCPU(),
+                          features.getString(), tm->Options,
+                          tm->getRelocationModel(), tm->getCodeModel(),
+                          tm->getOptLevel()));
+        if (! isa_tm) {
+            if (err)
+                *err = fmtformat ("can't target {}", target_isa_name(isa));
+            return false;
+        }
+        tm = isa_tm.get();
+    }
+
+    llvm::SmallVector<char, 0> buffer;
+    llvm::raw_svector_ostream out (buffer);
+    llvm::legacy::PassManager passes;
+#if OSL_LLVM_VERSION >= 100
+    bool failed = tm->addPassesToEmitFile (passes, out, nullptr,
+                                          llvm::CGFT_ObjectFile);
+#else
+    bool failed = tm->addPassesToEmitFile (passes, out, nullptr,
+                                          llvm::TargetMachine::CGFT_ObjectFile);
+#endif
+    if (failed) {
+        if (err)
+            *err = "the JIT target can't emit object files";
+        return false;
+    }
+    passes.run (*copy);
+    object.assign (buffer.begin(), buffer.end());
+    return true;
+}
+
+
+
+bool
+LLVM_Util::add_object (string_view object, std::string *err)
+{
+    auto buffer = llvm::MemoryBuffer::getMemBufferCopy (
+                      llvm::StringRef (object.data(), object.size()),
+                      "osl_precompiled");
+#if OSL_LLVM_VERSION >= 130
+    if (m_orc) {
+        // Linked in with the module, on the first getPointerToFunction.
+        m_orc->objects.push_back (std::move(buffer));
+        return true;
+    }
+#endif
+    auto objfile = llvm::object::ObjectFile::createObjectFile (buffer->getMemBufferRef());
+    if (! objfile)
+        return ! error_string (objfile.takeError(), err);
+    execengine()->addObjectFile (llvm::object::OwningBinary<llvm::object::ObjectFile>
+                                     (std::move(*objfile), std::move(buffer)));
+    return true;
+}
+
+
+
+llvm::Value *
+LLVM_Util::external_symbol (const std::string &name, void *addr,
+                            llvm::PointerType *type)
+{
+    llvm::GlobalVariable *gv = module()->getGlobalVariable (name);
+    if (! gv) {
+        gv = new llvm::GlobalVariable (*module(), type_char(), true /*const*/,
+                                       llvm::GlobalValue::ExternalLinkage,
+                                       nullptr, name);
+#if OSL_LLVM_VERSION >= 130
+        if (m_orc)
+            m_orc->function_mappings[m_orc->session->mangleAndIntern(name)]
+                = llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(addr),
+                                           llvm::JITSymbolFlags::Exported);
+        else
+#endif
+            execengine()->addGlobalMapping (gv, addr);
+    }
+    return llvm::ConstantExpr::getBitCast (gv, type ? type : type_void_ptr());
+}
+
+
+
+llvm::Value *
+LLVM_Util::constant_data_ptr (const void *data, size_t size,
+                              llvm::PointerType *type)
+{
+    llvm::Constant *init = llvm::ConstantDataArray::get (context(),
+        llvm::ArrayRef<uint8_t> ((const uint8_t *)data, size));
+    llvm::GlobalVariable *gv = new llvm::GlobalVariable (*module(),
+        init->getType(), true /*const*/, llvm::GlobalValue::PrivateLinkage,
+        init, "constant data");
+#if OSL_LLVM_VERSION >= 100
+    gv->setAlignment (llvm::MaybeAlign (16));
+#else
+    gv->setAlignment (16);
+#endif
+    return llvm::ConstantExpr::getBitCast (gv, type ? type : type_void_ptr());
+}
+
+
+
+std::string
+LLVM_Util::relocatable_string_symbol (int index)
+{
+    return fmtformat ("osl_aot_str_{}", index);
+}
+
+
+
+bool
+LLVM_Util::orc_add_lazy_module (llvm::orc::JITDylib &dylib, std::string &err)
+{
+#if OSL_LLVM_VERSION >= 130
+    // The module may now be compiled at any later time, on whichever
+    // thread first calls one of its functions, long after this LLVM_Util
+    // (and maybe its thread's LLVMContext) is gone. So it has to be moved
+    // into a context of its own, which we do with a bitcode round trip.
+    llvm::SmallVector<char, 0> bitcode;
+    {
+        llvm::raw_svector_ostream out (bitcode);
+        llvm::WriteBitcodeToFile (*m_orc->module, out);
+    }
+    llvm::orc::ThreadSafeContext context (std::make_unique<llvm::LLVMContext>());
+    auto lazy_module = llvm::parseBitcodeFile (
+        llvm::MemoryBufferRef (llvm::StringRef (bitcode.data(), bitcode.size()),
+                               m_orc->module->getModuleIdentifier()),
+        *context.getContext());
+    if (! lazy_module)
+        return error_string (lazy_module.takeError(), &err);
+
+    // Each function is compiled, by a TargetMachine built just like ours,
+    // only when it is first called. Until then callers go through a stub.
+    // The session makes sure concurrent first calls compile it only once.
+    OrcLazyLayers *layers = nullptr;
+    {
+        OIIO::spin_lock lock (llvm_global_mutex);
+        auto &es (orc_session->getExecutionSession());
+        orc_lazy_layers.emplace_back (new OrcLazyLayers);
+        layers = orc_lazy_layers.back().get();
+        m_jit_memory->lazy_layers = layers;
+        layers->compile_layer.reset (new llvm::orc::IRCompileLayer (es, *orc_object_layer,
+            std::make_unique<llvm::orc::ConcurrentIRCompiler>(*m_orc->tm_builder)));
+        layers->compile_layer->setNotifyCompiled (
+            [](llvm::orc::MaterializationResponsibility &,
+               llvm::orc::ThreadSafeModule tsm) {
+                tsm.withModuleDo ([](llvm::Module &m) {
+                    for (auto &f : m)
+                        if (! f.isDeclaration())
+                            ++orc_lazy_compiled;
+                });
+            });
+        layers->cod_layer.reset (new llvm::orc::CompileOnDemandLayer (es,
+            *layers->compile_layer, *orc_lazy_callthrough,
+            llvm::orc::createLocalIndirectStubsManagerBuilder (
+                m_orc->tm_builder->getTargetTriple())));
+        layers->cod_layer->setPartitionFunction (
+            llvm::orc::CompileOnDemandLayer::compileRequested);
+    }
+    return error_string (layers->cod_layer->add (dylib,
+                             llvm::orc::ThreadSafeModule (std::move(*lazy_module),
+                                                          std::move(context))),
+                         &err);
+#else
+    err = "ORC JIT requires LLVM 13 or newer";
+    return true;
+#endif
+}
+
+
+
+void *
+LLVM_Util::orc_getPointerToFunction (llvm::Function *func)
+{
+#if OSL_LLVM_VERSION >= 130
+    return orc_getPointerToFunction (func->getName().str());
+#else
+    OSL_ASSERT (0 && "ORC JIT requires LLVM 13 or newer");
+    return nullptr;
+#endif
+}
+
+
+
+void *
+LLVM_Util::orc_getPointerToFunction (const std::string &name)
+{
+#if OSL_LLVM_VERSION >= 130
+    OSL_ASSERT (m_orc->dylib && "make_jit() has not set up the ORC JIT");
+    std::string errmsg;
+    if (!m_ModuleIsFinalized) {
+        // The first request compiles the whole module, right here on
+        // this thread, using our own TargetMachine. Only the object is
+        // handed to the shared session, so any number of threads may be
+        // compiling at once, and only the (brief) linking is serialized.
+        llvm::orc::JITDylib &dylib (*m_orc->dylib);
+        if (! m_orc->function_mappings.empty()) {
+            bool failed = error_string (dylib.define (llvm::orc::absoluteSymbols(
+                                            std::move(m_orc->function_mappings))),
+                                        &errmsg);
+            OSL_ASSERT_MSG (!failed, "ORC JIT: %s", errmsg.c_str());
+            m_orc->function_mappings.clear();
+        }
+        if (m_orc->lazy_function_creator)
+            dylib.addGenerator (std::make_unique<LazyFunctionGenerator>(
+                m_orc->lazy_function_creator,
+                m_orc->session->getDataLayout().getGlobalPrefix()));
+
+        bool failed = false;
+        if (orc_jit_lazy()) {
+            failed = orc_add_lazy_module (dylib, errmsg);
+        } else {
+            llvm::orc::SimpleCompiler compiler (*m_orc->target_machine);
+            auto object = compiler (*m_orc->module);
+            failed = !object && error_string (object.takeError(), &errmsg);
+            if (! failed)
+                failed = error_string (m_orc->session->addObjectFile (dylib,
+                                           std::move(*object)), &errmsg);
+        }
+        for (auto& object : m_orc->objects)
+            if (! failed)
+                failed = error_string (m_orc->session->addObjectFile (dylib,
+                                           std::move(object)), &errmsg);
+        m_orc->objects.clear ();
+        OSL_ASSERT_MSG (!failed, "ORC JIT: %s", errmsg.c_str());
+        m_ModuleIsFinalized = true;
+    }
+
+    auto symbol = m_orc->session->lookup (*m_orc->dylib, name);
+    if (! symbol) {
+        error_string (symbol.takeError(), &errmsg);
+        OSL_ASSERT_MSG (0, "could not getPointerToFunction: %s", errmsg.c_str());
+        return nullptr;
+    }
+    return (void *)symbol->getAddress();
+#else
+    OSL_ASSERT (0 && "ORC JIT requires LLVM 13 or newer");
+    return nullptr;
+#endif
+}
+
+
 void
 LLVM_Util::add_global_mapping (const char *global_var_name, void *global_var_addr)
 {
@@ -1631,6 +2821,12 @@ LLVM_Util::add_global_mapping (const char *global_var_name, void *global_var_add
 void
 LLVM_Util::InstallLazyFunctionCreator (void* (*P)(const std::string &))
 {
+#if OSL_LLVM_VERSION >= 130
+    if (m_orc) {
+        m_orc->lazy_function_creator = P;
+        return;
+    }
+#endif
     llvm::ExecutionEngine *exec = execengine();
     exec->InstallLazyFunctionCreator (P);
 }
@@ -1638,11 +2834,37 @@ LLVM_Util::InstallLazyFunctionCreator (void* (*P)(const std::string &))
 
 
 void
-LLVM_Util::setup_optimization_passes (int optlevel, bool target_host)
+LLVM_Util::setup_optimization_passes (int optlevel, bool target_host,
+                                      OptPreset preset)
 {
     OSL_DEV_ONLY(std::cout << "setup_optimization_passes " << optlevel);
     OSL_DASSERT (m_llvm_module_passes == NULL && m_llvm_func_passes == NULL);
 
+    if (preset == OptPreset::UNKNOWN)
+        preset = OptPreset::LEGACY;
+    // Only the aggressive preset runs the loop and SLP vectorizers, even
+    // where it has to fall back to a numbered level.
+    bool vectorize = (preset == OptPreset::AGGRESSIVE);
+#if OSL_LLVM_VERSION >= 130
+    // The preset's pipeline is built and run by do_optimize. Only the
+    // target info and extra passes at the end go in the legacy managers.
+    if (preset != OptPreset::LEGACY)
+        optlevel = 10;
+#else
+    // The new pass manager is too immature here; settle for the closest
+    // of the numbered levels.
+    switch (preset) {
+    case OptPreset::NONE:         optlevel = 10; break;
+    case OptPreset::COMPILE_FAST: optlevel = 1;  break;
+    case OptPreset::DEFAULT:      optlevel = 2;  break;
+    case OptPreset::AGGRESSIVE:   optlevel = 3;  break;
+    default: break;
+    }
+    preset = OptPreset::LEGACY;
+#endif
+    m_opt_preset = preset;
+    m_opt_target_host = target_host;
+
     // Construct the per-function passes and module-wide (interprocedural
     // optimization) passes.
 
@@ -1654,7 +2876,7 @@ LLVM_Util::setup_optimization_passes (int optlevel, bool target_host)
 
     llvm::TargetMachine* target_machine = nullptr;
     if (target_host) {
-        target_machine = execengine()->getTargetMachine();
+        target_machine = this->target_machine();
         llvm::Triple ModuleTriple(module()->getTargetTriple());
         // Add an appropriate TargetLibraryInfo pass for the module's triple.
         llvm::TargetLibraryInfoImpl TLII(ModuleTriple);
@@ -1686,8 +2908,8 @@ LLVM_Util::setup_optimization_passes (int optlevel, bool target_host)
         // Time spent in JIT is considerably higher if there is no inliner specified
         builder.Inliner = llvm::createFunctionInliningPass();
         builder.DisableUnrollLoops = false;
-        builder.SLPVectorize = false;
-        builder.LoopVectorize = false;
+        builder.SLPVectorize = vectorize;
+        builder.LoopVectorize = vectorize;
         if (target_machine)
             target_machine->adjustPassManager(builder);
 
@@ -1926,7 +3148,8 @@ LLVM_Util::setup_optimization_passes (int optlevel, bool target_host)
                 mpm.add(new PreventBitMasksFromBeingLiveinsToBasicBlocks<8>());
                 break;
             case 4:
-                // We don't use masking or SIMD shading for 4-wide
+                // MUST BE THE FINAL PASS!
+                mpm.add(new PreventBitMasksFromBeingLiveinsToBasicBlocks<4>());
                 break;
             default:
                 std::cout << "m_vector_width = " << m_vector_width << "\n";
@@ -1937,6 +3160,46 @@ LLVM_Util::setup_optimization_passes (int optlevel, bool target_host)
 }
 
 
+namespace {
+
+// Installed while optimizing with llvm_debug on, to print what the loop
+// and SLP vectorizers did, or why they couldn't, for each loop or
+// stretch of code they considered.
+class VectorizerRemarks : public llvm::DiagnosticHandler {
+public:
+    static bool wanted (llvm::StringRef pass) {
+        return pass == "loop-vectorize" || pass == "slp-vectorizer";
+    }
+    bool isAnalysisRemarkEnabled (llvm::StringRef pass) const override {
+        return wanted (pass);
+    }
+    bool isMissedOptRemarkEnabled (llvm::StringRef pass) const override {
+        return wanted (pass);
+    }
+    bool isPassedOptRemarkEnabled (llvm::StringRef pass) const override {
+        return wanted (pass);
+    }
+    bool handleDiagnostics (const llvm::DiagnosticInfo &info) override {
+        auto remark = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&info);
+        if (! remark)
+            return false;   // Leave the rest to LLVM, as usual
+        if (wanted (remark->getPassName())) {
+            const char *kind = llvm::isa<llvm::OptimizationRemark>(info) ? "done"
+                : llvm::isa<llvm::OptimizationRemarkMissed>(info) ? "missed"
+                : "analysis";
+            std::cout << "LLVM remark [" << remark->getPassName().str()
+                      << ", " << kind << "] in "
+                      << remark->getFunction().getName().str() << ": "
+                      << remark->getMsg() << "\n";
+        }
+        return true;
+    }
+};
+
+}  // namespace
+
+
+
 void
 LLVM_Util::do_optimize (std::string *out_err)
 {
@@ -1948,12 +3211,74 @@ LLVM_Util::do_optimize (std::string *out_err)
         return;
 #endif
 
+    std::unique_ptr<llvm::DiagnosticHandler> saved_handler;
+    if (debug()) {
+        saved_handler = context().getDiagnosticHandler();
+        context().setDiagnosticHandler (std::unique_ptr<llvm::DiagnosticHandler>(
+                                            new VectorizerRemarks));
+    }
+
+    if (m_opt_preset != OptPreset::LEGACY)
+        run_opt_preset ();
+
     m_llvm_func_passes->doInitialization();
     for (auto&& I : m_llvm_module->functions())
         if (!I.isDeclaration())
             m_llvm_func_passes->run(I);
     m_llvm_func_passes->doFinalization();
     m_llvm_module_passes->run (*m_llvm_module);
+
+    if (saved_handler)
+        context().setDiagnosticHandler (std::move(saved_handler));
+}
+
+
+
+void
+LLVM_Util::run_opt_preset ()
+{
+#if OSL_LLVM_VERSION >= 130
+#  if OSL_LLVM_VERSION >= 140
+    typedef llvm::OptimizationLevel OptimizationLevel;
+#  else
+    typedef llvm::PassBuilder::OptimizationLevel OptimizationLevel;
+#  endif
+    if (m_opt_preset == OptPreset::NONE)
+        return;
+
+    // Like the legacy llvm_optimize levels, leave loops and straight-line
+    // code unvectorized (the batched code is already SIMD) unless asked
+    // to be aggressive; and don't spend time unrolling when compiling fast.
+    llvm::PipelineTuningOptions tuning;
+    tuning.LoopVectorization = (m_opt_preset == OptPreset::AGGRESSIVE);
+    tuning.SLPVectorization = (m_opt_preset == OptPreset::AGGRESSIVE);
+    tuning.LoopUnrolling = (m_opt_preset != OptPreset::COMPILE_FAST);
+
+    llvm::PassBuilder builder (m_opt_target_host ? target_machine() : nullptr,
+                               tuning);
+    llvm::LoopAnalysisManager lam;
+    llvm::FunctionAnalysisManager fam;
+    llvm::CGSCCAnalysisManager cgam;
+    llvm::ModuleAnalysisManager mam;
+    if (m_opt_target_host) {
+        llvm::TargetLibraryInfoImpl TLII (llvm::Triple(module()->getTargetTriple()));
+        fam.registerPass([&]{ return llvm::TargetLibraryAnalysis(TLII); });
+    }
+    builder.registerModuleAnalyses (mam);
+    builder.registerCGSCCAnalyses (cgam);
+    builder.registerFunctionAnalyses (fam);
+    builder.registerLoopAnalyses (lam);
+    builder.crossRegisterProxies (lam, fam, cgam, mam);
+
+    OptimizationLevel level = OptimizationLevel::O2;
+    switch (m_opt_preset) {
+    case OptPreset::COMPILE_FAST: level = OptimizationLevel::O1; break;
+    case OptPreset::AGGRESSIVE:   level = OptimizationLevel::O3; break;
+    default: break;
+    }
+    llvm::ModulePassManager mpm = builder.buildPerModuleDefaultPipeline (level);
+    mpm.run (*m_llvm_module, mam);
+#endif
 }
 
 
@@ -2366,6 +3691,14 @@ LLVM_Util::make_function (const std::string &name, bool fastcall,
 void
 LLVM_Util::add_function_mapping (llvm::Function *func, void *addr)
 {
+#if OSL_LLVM_VERSION >= 130
+    if (m_orc) {
+        m_orc->function_mappings[m_orc->session->mangleAndIntern(func->getName())]
+            = llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(addr),
+                                       llvm::JITSymbolFlags::Exported);
+        return;
+    }
+#endif
     execengine()->addGlobalMapping (func, addr);
 }
 
@@ -2730,6 +4063,19 @@ LLVM_Util::constant_ptr (void *p, llvm::PointerType *type)
 llvm::Value *
 LLVM_Util::constant (ustring s)
 {
+    if (m_relocatable && s.c_str()) {
+        // Refer to the string by a symbol that is bound to this process's
+        // copy of it when the code is linked.
+        auto found = m_relocatable_string_index.find (s.c_str());
+        int index = found != m_relocatable_string_index.end() ? found->second
+                                                            : int(m_relocatable_strings.size());
+        if (index == int(m_relocatable_strings.size())) {
+            m_relocatable_strings.push_back (s);
+            m_relocatable_string_index[s.c_str()] = index;
+        }
+        return external_symbol (relocatable_string_symbol (index),
+                                (void *)s.c_str(), (llvm::PointerType *)type_string());
+    }
     // Create a const size_t with the ustring contents
     size_t bits = sizeof(size_t)*8;
     llvm::Value *str = llvm::ConstantInt::get (context(),
@@ -2786,6 +4132,14 @@ LLVM_Util::mask_as_int(llvm::Value *mask)
 {
     OSL_ASSERT(mask->getType() == type_wide_bool());
 
+    if (m_target_isa == TargetISA::NEON) {
+        // There is no movmsk on AArch64, so leave it to LLVM to lower a
+        // bit cast of the <N x i1> mask to an N bit integer.
+        llvm::Value* result = builder().CreateBitCast (mask,
+            llvm::Type::getIntNTy (context(), m_vector_width));
+        return builder().CreateZExt(result, type_int());
+    }
+
     if (m_supports_avx512f) {
 
         llvm::Type * intMaskType = nullptr;
@@ -3159,23 +4513,11 @@ LLVM_Util::op_1st_active_lane_of(llvm::Value * mask)
             // and all types are happy
             intMaskType = type_int8();
             break;
-#if 0 // WIP
         case 4:
-        {
-            // We can just reinterpret cast a 8 bit mask to a 8 bit integer
-            // and all types are happy
-            intMaskType = type_int8();
-
-//            extended_int_vector_type = (llvm::Type *) llvm::VectorType::get(llvm::Type::getInt32Ty (*m_llvm_context), m_vector_width);
-//            llvm::Value * wide_int_mask = builder().CreateSExt(mask, extended_int_vector_type);
-//
-//            int_reinterpret_cast_vector_type = (llvm::Type *) llvm::Type::getInt128Ty (*m_llvm_context);
-//            zeroConstant = constant128(0);
-//
-//            llvm::Value * mask_as_int =  builder().CreateBitCast (wide_int_mask, int_reinterpret_cast_vector_type);
+            // A 4 bit mask reinterpret casts to a 4 bit integer, which
+            // LLVM widens as it needs to
+            intMaskType = llvm::Type::getIntNTy (context(), 4);
             break;
-        }
-#endif
         default:
             OSL_ASSERT(0 && "unsupported native bit mask width");
     };
@@ -3200,6 +4542,24 @@ LLVM_Util::op_1st_active_lane_of(llvm::Value * mask)
 
 
 
+llvm::Value *
+LLVM_Util::op_count_active_lanes(llvm::Value * mask)
+{
+    llvm::Type* types[] = {
+            type_int()
+    };
+    llvm::Function* func_ctpop = llvm::Intrinsic::getDeclaration (module(),
+        llvm::Intrinsic::ctpop,
+        makeArrayRef(types));
+
+    llvm::Value *args[1] = {
+            mask_as_int(mask)
+    };
+    return builder().CreateCall (func_ctpop, makeArrayRef(args));
+}
+
+
+
 llvm::Value *
 LLVM_Util::op_lanes_that_match_masked(llvm::Value* scalar_value,
                                       llvm::Value* wide_value,
@@ -3401,7 +4761,7 @@ LLVM_Util::offset_ptr (llvm::Value* ptr, int offset, llvm::Type* ptrtype)
 void
 LLVM_Util::assume_ptr_is_aligned(llvm::Value* ptr, unsigned alignment)
 {
-    const llvm::DataLayout& data_layout = m_llvm_exec->getDataLayout();
+    const llvm::DataLayout& data_layout = this->data_layout();
     builder().CreateAlignmentAssumption(data_layout, ptr, alignment);
 }
 
@@ -3522,6 +4882,19 @@ LLVM_Util::op_branch (llvm::Value *cond, llvm::BasicBlock *trueblock,
 
 
 
+void
+LLVM_Util::op_branch (llvm::Value *cond, llvm::BasicBlock *trueblock,
+                      llvm::BasicBlock *falseblock,
+                      uint32_t true_weight, uint32_t false_weight)
+{
+    llvm::MDBuilder mdbuilder (context());
+    builder().CreateCondBr (cond, trueblock, falseblock,
+                            mdbuilder.createBranchWeights (true_weight, false_weight));
+    set_insert_point (trueblock);
+}
+
+
+
 void
 LLVM_Util::set_insert_point (llvm::BasicBlock *block)
 {
@@ -3654,6 +5027,22 @@ LLVM_Util::op_linearize_8x_indices(llvm::Value *wide_index)
 }
 
 
+llvm::Value *
+LLVM_Util::op_linearize_4x_indices(llvm::Value *wide_index)
+{
+    llvm::Value* strided_indices = op_mul(wide_index, wide_constant(4, 4));
+    llvm::Constant* offsets_to_lane[4] = {
+        constant(0),
+        constant(1),
+        constant(2),
+        constant(3)
+    };
+    llvm::Value *const_vec_offsets = llvm::ConstantVector::get(llvm::ArrayRef< llvm::Constant *>(&offsets_to_lane[0], 4));
+
+    return op_add (strided_indices, const_vec_offsets);
+}
+
+
 std::array<llvm::Value *,2>
 LLVM_Util::op_split_16x (llvm::Value * vector_val)
 {
@@ -4271,6 +5660,9 @@ LLVM_Util::op_scatter(llvm::Value *wide_val, llvm::Value *ptr, llvm::Value *wide
             case 8:
                 linear_indices = op_linearize_8x_indices(wide_index);
                 break;
+            case 4:
+                linear_indices = op_linearize_4x_indices(wide_index);
+                break;
             default:
                 OSL_ASSERT(0 && "unsupported vector width for scatter");
             };
@@ -5090,6 +6482,23 @@ LLVM_Util::GEP (llvm::Value *ptr, llvm::Value *elem)
 
 
 
+llvm::Value *
+LLVM_Util::GEP_inbounds (llvm::Type* type, llvm::Value* ptr, llvm::Value* elem)
+{
+    return builder().CreateInBoundsGEP(type, ptr, elem);
+}
+
+
+
+llvm::Value *
+LLVM_Util::GEP_inbounds (llvm::Value *ptr, llvm::Value *elem)
+{
+    return GEP_inbounds(ptr->getType()->getScalarType()->getPointerElementType(),
+                        ptr, elem);
+}
+
+
+
 llvm::Value *
 LLVM_Util::GEP (llvm::Type* type, llvm::Value* ptr, int elem)
 {
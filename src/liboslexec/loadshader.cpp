@@ -2,18 +2,22 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <atomic>
 #include <vector>
 #include <string>
 #include <cstdio>
+#include <thread>
 #include <cmath> // FIXME: used by timer.h - should be included there
 
 #include "oslexec_pvt.h"
 #include "osoreader.h"
+#include "shaderbundle.h"
 
 #include <OpenImageIO/strutil.h>
 #include <OpenImageIO/timer.h>
 #include <OpenImageIO/thread.h>
 #include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/sysutil.h>
 #include <OpenImageIO/hash.h>
 
 
@@ -36,6 +40,7 @@ public:
     virtual ~OSOReaderToMaster () { }
     virtual bool parse_file (const std::string &filename);
     virtual bool parse_memory (const std::string &oso);
+    bool parse_bundled (string_view oso, const std::string &where);
     virtual void version (const char *specid, int major, int minor);
     virtual void shader (const char *shadertype, const char *name);
     virtual void symbol (SymType symtype, TypeSpec typespec, const char *name);
@@ -70,8 +75,14 @@ private:
     int m_oso_major, m_oso_minor;     ///< oso file format version
     int m_sym_default_index;          ///< Next sym default value to fill in
     bool m_errors;                    ///< Did we hit any errors?
-    typedef std::unordered_map<ustring,int,ustringHash> UstringIntMap;
-    UstringIntMap m_symmap;           ///< map sym name to index
+    struct StrviewHash {
+        size_t operator() (string_view s) const { return Strutil::strhash (s); }
+    };
+    // Keyed by the symbol's ustring characters, so that op arguments can
+    // be looked up without making ustrings of them.
+    typedef std::unordered_map<string_view,int,StrviewHash> SymIndexMap;
+    SymIndexMap m_symmap;             ///< map sym name to index
+    UstringCache m_strings;           ///< opcodes, source files, etc.
 };
 
 
@@ -102,6 +113,23 @@ OSOReaderToMaster::parse_memory (const std::string &oso)
 
 
 
+bool
+OSOReaderToMaster::parse_bundled (string_view oso, const std::string &where)
+{
+    m_master->m_osofilename = where;
+    m_master->m_maincodebegin = 0;
+    m_master->m_maincodeend = 0;
+    m_codesection.clear ();
+    m_codesym = -1;
+    // Binary OSO is read in place, straight out of the mapped bundle.
+    bool ok = is_binary (oso.data(), oso.size())
+                  ? parse_binary (oso.data(), oso.size())
+                  : OSOReader::parse_memory (std::string (oso));
+    return ok && ! m_errors;
+}
+
+
+
 
 void
 OSOReaderToMaster::version (const char* /*specid*/, int major, int minor)
@@ -173,7 +201,7 @@ OSOReaderToMaster::symbol (SymType symtype, TypeSpec typespec, const char *name_
 #endif
     sym.lockgeom (m_shadingsys.lockgeom_default());
     m_master->m_symbols.push_back (sym);
-    m_symmap[name] = int(m_master->m_symbols.size()) - 1;
+    m_symmap[string_view (name.c_str(), name.length())] = int(m_master->m_symbols.size()) - 1;
     // Start the index at which we add specified defaults
     m_sym_default_index = 0;
 }
@@ -206,9 +234,9 @@ void
 OSOReaderToMaster::add_param_default (const char *def, size_t offset, const Symbol& sym)
 {
   if (sym.typespec().is_unsized_array() && offset >= m_master->m_sdefaults.size())
-      m_master->m_sdefaults.emplace_back(def);
+      m_master->m_sdefaults.push_back(m_strings(def));
   else
-      m_master->m_sdefaults[offset] = ustring(def);
+      m_master->m_sdefaults[offset] = m_strings(def);
 }
 
 
@@ -286,7 +314,7 @@ OSOReaderToMaster::symdefault (const char *def)
         }
     } else if (sym.symtype() == SymTypeConst) {
         if (sym.typespec().simpletype().basetype == TypeDesc::STRING)
-            m_master->m_sconsts[offset] = ustring(def);
+            m_master->m_sconsts[offset] = m_strings(def);
         else {
             OSL_DASSERT_MSG (0, "unexpected type: %s (%s)",
                              sym.typespec().c_str(), sym.name().c_str());
@@ -315,7 +343,7 @@ OSOReaderToMaster::hint (string_view hintstring)
     string_view h (hintstring);
 
     if (Strutil::parse_prefix (h, "%filename{\"")) {
-        m_sourcefile = Strutil::parse_until (h, "\"");
+        m_sourcefile = m_strings (Strutil::parse_until (h, "\""));
         return;
     }
     if (Strutil::parse_prefix (h, "%line{")) {
@@ -434,7 +462,7 @@ OSOReaderToMaster::codemarker (const char *name)
 
     codeend ();   // Mark the end spot, if we were parsing ops before
 
-    m_codesection = ustring (name);
+    m_codesection = m_strings (name);
     m_codesym = m_master->findsymbol (m_codesection);
     if (m_codesym >= 0)
         m_master->symbol(m_codesym)->initbegin (nextop);
@@ -476,7 +504,7 @@ OSOReaderToMaster::codeend ()
 void
 OSOReaderToMaster::instruction (int /*label*/, const char *opcode)
 {
-    ustring uopcode (opcode);
+    ustring uopcode = m_strings (opcode);
     Opcode op (uopcode, m_codesection);
     m_master->m_ops.push_back (op);
     m_firstarg = m_master->m_args.size();
@@ -498,8 +526,7 @@ OSOReaderToMaster::instruction (int /*label*/, const char *opcode)
 void
 OSOReaderToMaster::instruction_arg (const char *name)
 {
-    ustring argname (name);
-    UstringIntMap::const_iterator found = m_symmap.find (argname);
+    SymIndexMap::const_iterator found = m_symmap.find (string_view (name));
     if (found != m_symmap.end()) {
         m_master->m_args.push_back (found->second);
         ++m_nargs;
@@ -541,54 +568,144 @@ ShadingSystemImpl::loadshader (string_view cname)
     }
     ++m_stat_shaders_requested;
     ustring name (cname);
-    lock_guard guard (m_mutex);  // Thread safety
-    ShaderNameMap::const_iterator found = m_shader_masters.find (name);
-    if (found != m_shader_masters.end()) {
-        // if (debug())
-        //     infofmt("Found {} in shader_masters", name);
-        // Already loaded this shader, return its reference
-        return (*found).second;
+
+    // Only the lookups hold m_mutex, not the reading of the file, so
+    // different masters may load at the same time. A request for a master
+    // that another thread is already reading waits for that load instead
+    // of starting its own.
+    std::promise<ShaderMaster::ref> loaded;
+    std::vector<std::string> searchpath_dirs;
+    std::vector<std::shared_ptr<ShaderBundle>> bundles;
+    {
+        std::shared_future<ShaderMaster::ref> inflight;
+        {
+            lock_guard guard (m_mutex);  // Thread safety
+            ShaderNameMap::const_iterator found = m_shader_masters.find (name);
+            if (found != m_shader_masters.end()) {
+                // Already loaded this shader, return its reference
+                return (*found).second;
+            }
+            ShaderLoadMap::const_iterator loading = m_shader_loads.find (name);
+            if (loading != m_shader_loads.end())
+                inflight = loading->second;
+            else
+                m_shader_loads[name] = loaded.get_future().share();
+            searchpath_dirs = m_searchpath_dirs;
+            bundles = m_shader_bundles;
+        }
+        if (inflight.valid())
+            return inflight.get();
     }
 
-    // Not found in the map
-    OSOReaderToMaster oso (*this);
-    bool testcwd = m_searchpath_dirs.empty();  // test "." if there's no searchpath
-    std::string filename = OIIO::Filesystem::searchpath_find (name.string() + ".oso",
-                                                        m_searchpath_dirs,
-                                                        testcwd);
-    if (filename.empty ()) {
-        errorfmt("No .oso file could be found for shader \"{}\"", name);
-        return NULL;
+    // Not found in the map, and we're the thread to read it
+    // Registered bundles are checked first, since that needs no file
+    // system access at all.
+    ShaderMaster::ref r;
+    std::string filename;
+    string_view bundled;
+    for (auto& bundle : bundles) {
+        bundled = bundle->find (name);
+        if (bundled.size()) {
+            filename = fmtformat("{}({})", bundle->filename(), name);
+            break;
+        }
     }
-    OIIO::Timer timer;
-    bool ok = oso.parse_file (filename);
-    ShaderMaster::ref r = ok ? oso.master() : nullptr;
-    m_shader_masters[name] = r;
-    double loadtime = timer();
-    {
-        spin_lock lock (m_stat_mutex);
-        m_stat_master_load_time += loadtime;
+    if (filename.empty()) {
+        bool testcwd = searchpath_dirs.empty();  // test "." if there's no searchpath
+        filename = OIIO::Filesystem::searchpath_find (name.string() + ".oso",
+                                                      searchpath_dirs,
+                                                      testcwd);
     }
-    if (ok) {
-        ++m_stat_shaders_loaded;
-        infofmt("Loaded \"{}\" (took {})", filename,
-                Strutil::timeintervalformat(loadtime, 2));
-        OSL_DASSERT (r);
-        r->resolve_syms ();
-        // if (debug()) {
-        //     std::string s = r->print ();
-        //     if (s.length())
-        //         infofmt("{}", s);
-        // }
+    if (filename.empty ()) {
+        errorfmt("No .oso file could be found for shader \"{}\"", name);
     } else {
-        errorfmt("Unable to read \"{}\"", filename);
+        OSOReaderToMaster oso (*this);
+        OIIO::Timer timer;
+        bool ok = bundled.size() ? oso.parse_bundled (bundled, filename)
+                                 : oso.parse_file (filename);
+        r = ok ? oso.master() : nullptr;
+        double loadtime = timer();
+        {
+            spin_lock lock (m_stat_mutex);
+            m_stat_master_load_time += loadtime;
+        }
+        if (ok) {
+            ++m_stat_shaders_loaded;
+            infofmt("Loaded \"{}\" (took {})", filename,
+                    Strutil::timeintervalformat(loadtime, 2));
+            OSL_DASSERT (r);
+            r->resolve_syms ();
+            // if (debug()) {
+            //     std::string s = r->print ();
+            //     if (s.length())
+            //         infofmt("{}", s);
+            // }
+        } else {
+            errorfmt("Unable to read \"{}\"", filename);
+        }
     }
 
+    {
+        lock_guard guard (m_mutex);
+        // A missing file isn't remembered, so that it may still show up
+        // later. If LoadMemoryCompiledShader supplied this name while we
+        // were reading, that master wins.
+        if (! filename.empty())
+            r = m_shader_masters.emplace (name, r).first->second;
+        m_shader_loads.erase (name);
+    }
+    loaded.set_value (r);
     return r;
 }
 
 
 
+bool
+ShadingSystemImpl::preload_shaders (cspan<ustring> shadernames, int nthreads)
+{
+    if (nthreads <= 0)
+        nthreads = (int) OIIO::Sysutil::hardware_concurrency();
+    nthreads = std::max (1, std::min (nthreads, (int)shadernames.size()));
+
+    std::atomic<size_t> next (0);
+    std::atomic<bool> ok (true);
+    auto load = [&]() {
+        for (size_t i = next++;  i < shadernames.size();  i = next++)
+            if (! loadshader (shadernames[i]))
+                ok = false;
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1;  t < nthreads;  ++t)
+        threads.emplace_back (load);
+    load ();
+    for (auto& t : threads)
+        t.join ();
+    return ok;
+}
+
+
+
+bool
+ShadingSystemImpl::add_shader_bundle (string_view filename)
+{
+    std::string err;
+    std::shared_ptr<ShaderBundle> bundle (ShaderBundle::open (filename, err));
+    if (! bundle) {
+        errorfmt("Could not add shader bundle: {}", err);
+        return false;
+    }
+    infofmt("Added shader bundle \"{}\" ({} shaders)", filename,
+            bundle->size());
+    lock_guard guard (m_mutex);
+    for (auto& b : m_shader_bundles)
+        if (b->filename() == bundle->filename())
+            return true;   // Already have it
+    m_shader_bundles.push_back (bundle);
+    return true;
+}
+
+
+
 bool
 ShadingSystemImpl::LoadMemoryCompiledShader (string_view shadername,
                                              string_view buffer)
@@ -603,20 +720,27 @@ ShadingSystemImpl::LoadMemoryCompiledShader (string_view shadername,
     }
 
     ustring name (shadername);
-    lock_guard guard (m_mutex);  // Thread safety
-    ShaderNameMap::const_iterator found = m_shader_masters.find (name);
-    if (found != m_shader_masters.end() && ! allow_shader_replacement()) {
-        if (debug())
-            infofmt("Preload shader {} already exists in shader_masters", name);
+    auto exists = [&]() {
+        if (m_shader_masters.find (name) != m_shader_masters.end()
+              && ! allow_shader_replacement()) {
+            if (debug())
+                infofmt("Preload shader {} already exists in shader_masters", name);
+            return true;
+        }
         return false;
+    };
+    {
+        lock_guard guard (m_mutex);  // Thread safety
+        if (exists ())
+            return false;
     }
 
-    // Not found in the map
+    // Not found in the map. Parse without holding the lock, so that
+    // other masters may load meanwhile.
     OSOReaderToMaster reader (*this);
     OIIO::Timer timer;
     bool ok = reader.parse_memory (buffer);
     ShaderMaster::ref r = ok ? reader.master() : nullptr;
-    m_shader_masters[name] = r;
     double loadtime = timer();
     {
         spin_lock lock (m_stat_mutex);
@@ -637,6 +761,10 @@ ShadingSystemImpl::LoadMemoryCompiledShader (string_view shadername,
         errorfmt("Unable to parse preloaded shader \"{}\"", shadername);
     }
 
+    lock_guard guard (m_mutex);
+    if (exists ())   // Someone else got there first
+        return false;
+    m_shader_masters[name] = r;
     return ok;
 }
 
@@ -61,6 +61,26 @@ ShaderMaster::findsymbol (ustring name) const
 
 
 
+bool
+ShaderMaster::same_params (const ShaderMaster &other) const
+{
+    if (m_firstparam != other.m_firstparam || m_lastparam != other.m_lastparam
+          || m_idefaults.size() != other.m_idefaults.size()
+          || m_fdefaults.size() != other.m_fdefaults.size()
+          || m_sdefaults.size() != other.m_sdefaults.size())
+        return false;
+    for (int i = 0;  i < m_lastparam;  ++i) {
+        const Symbol &a (m_symbols[i]), &b (other.m_symbols[i]);
+        if (a.name() != b.name() || a.symtype() != b.symtype()
+              || a.typespec() != b.typespec()
+              || a.dataoffset() != b.dataoffset())
+            return false;
+    }
+    return true;
+}
+
+
+
 void *
 ShaderMaster::param_default_storage (int index)
 {
@@ -197,6 +217,39 @@ ShaderMaster::resolve_syms ()
 
 
 
+size_t
+ShaderMaster::code_hash () const
+{
+    size_t h = OIIO::Strutil::strhash (string_view ((const char *)m_args.data(),
+                                                    m_args.size() * sizeof(int)));
+    for (auto&& op : m_ops)
+        h = h * 31 + op.opname().hash();
+    for (auto&& s : m_symbols)
+        h = h * 31 + s.name().hash();
+    return h;
+}
+
+
+
+void
+ShaderMaster::shared_code (std::shared_ptr<OpcodeVec> &ops,
+                           std::shared_ptr<std::vector<int>> &args)
+{
+    OIIO::spin_lock lock (m_shared_code_mutex);
+    ops = m_shared_ops.lock ();
+    if (! ops) {
+        ops = std::make_shared<OpcodeVec> (m_ops);
+        m_shared_ops = ops;
+    }
+    args = m_shared_args.lock ();
+    if (! args) {
+        args = std::make_shared<std::vector<int>> (m_args);
+        m_shared_args = args;
+    }
+}
+
+
+
 std::string
 ShaderMaster::print ()
 {
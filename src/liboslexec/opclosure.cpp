@@ -28,9 +28,7 @@ OSL_SHADEOP const ClosureColor *
 osl_mul_closure_color (ShaderGlobals *sg, ClosureColor *a, const Color3 *w)
 {
     if (a == NULL) return NULL;
-    if (w->x == 0.0f &&
-        w->y == 0.0f &&
-        w->z == 0.0f) return NULL;
+    if (sg->context->negligible_closure_weight (*w)) return NULL;
     if (w->x == 1.0f &&
         w->y == 1.0f &&
         w->z == 1.0f) return a;
@@ -42,7 +40,7 @@ OSL_SHADEOP const ClosureColor *
 osl_mul_closure_float (ShaderGlobals *sg, ClosureColor *a, float w)
 {
     if (a == NULL) return NULL;
-    if (w == 0.0f) return NULL;
+    if (sg->context->negligible_closure_weight (Color3(w))) return NULL;
     if (w == 1.0f) return a;
     return sg->context->closure_mul_allot (w, a);
 }
@@ -59,7 +57,7 @@ osl_allocate_closure_component (ShaderGlobals *sg, int id, int size)
 OSL_SHADEOP ClosureColor *
 osl_allocate_weighted_closure_component (ShaderGlobals *sg, int id, int size, const Color3 *w)
 {
-    if (w->x == 0.0f && w->y == 0.0f && w->z == 0.0f)
+    if (sg->context->negligible_closure_weight (*w))
         return NULL;
     return sg->context->closure_component_allot(id, size, *w);
 }
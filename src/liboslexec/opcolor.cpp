@@ -128,6 +128,29 @@ norm_rgb (Color3 &rgb)
 }
 #endif
 
+
+#ifndef __CUDACC__
+// XYZ of the blackbody spectrum at each table temperature. Only their
+// conversion to RGB depends on the color space, so the (comparatively
+// slow) spectral integration is done once per process, on first use,
+// and shared by every ColorSystem that is set up afterwards.
+const std::vector<Color3>&
+blackbody_XYZ_table ()
+{
+    static const std::vector<Color3> table = []() {
+        std::vector<Color3> xyz;
+        float lastT = 0;
+        for (int i = 0;  lastT <= BB_MAX_TABLE_RANGE; ++i) {
+            float T = BB_TABLE_MAP(float(i));
+            lastT = T;
+            xyz.push_back (spectrum_to_XYZ (bb_spectrum (T)));
+        }
+        return xyz;
+    }();
+    return table;
+}
+#endif
+
 };  // End anonymous namespace
 
 
@@ -185,6 +208,16 @@ ColorSystem::set_colorspace (StringParam colorspace)
     assert( std::ceil(BB_TABLE_UNMAP(BB_MAX_TABLE_RANGE)) <
             std::extent<decltype(m_blackbody_table)>::value);
 
+#ifndef __CUDACC__
+    const std::vector<Color3>& bbXYZ (blackbody_XYZ_table());
+    for (size_t i = 0;  i < bbXYZ.size(); ++i) {
+        Color3 rgb = XYZ_to_RGB (bbXYZ[i]);
+        clamp_zero (rgb);
+        rgb = colpow (rgb, 1.0f/BB_TABLE_YPOWER);
+        m_blackbody_table[i] = rgb;
+        //std::cout << "Table[" << i << "] = " << rgb << "\n";
+    }
+#else
     float lastT = 0;
     for (int i = 0;  lastT <= BB_MAX_TABLE_RANGE; ++i) {
         float T = BB_TABLE_MAP(float(i));
@@ -194,10 +227,8 @@ ColorSystem::set_colorspace (StringParam colorspace)
         clamp_zero (rgb);
         rgb = colpow (rgb, 1.0f/BB_TABLE_YPOWER);
         m_blackbody_table[i] = rgb;
-#if !defined(__CUDACC__)
-        //std::cout << "Table[" << i << "; T=" << T << "] = " << rgb << "\n";
-#endif
     }
+#endif
 
 #if 0 && !defined(__CUDACC__)
     std::cout << "Made " << m_blackbody_table.size() << " table entries for blackbody\n";
@@ -417,6 +448,27 @@ ColorSystem::transformc (StringParam fromspace, StringParam tospace,
     return transformc<Color3>(fromspace, tospace, color, ctx);
 }
 
+
+
+OSL_HOSTDEVICE Color3
+ColorSystem::blackbody_color (float T) const
+{
+    return blackbody_rgb (T);
+}
+
+
+
+OSL_HOSTDEVICE Color3
+ColorSystem::wavelength_color (float lambda) const
+{
+    Color3 rgb = XYZ_to_RGB (wavelength_color_XYZ (lambda));
+//    constrain_rgb (rgb);
+    rgb *= 1.0/2.52;    // Empirical scale from lg to make all comps <= 1
+//    norm_rgb (rgb);
+    clamp_zero (rgb);
+    return rgb;
+}
+
 } // namespace pvt
 
 
@@ -424,7 +476,7 @@ ColorSystem::transformc (StringParam fromspace, StringParam tospace,
 OSL_SHADEOP OSL_HOSTDEVICE void osl_blackbody_vf (void *sg, void *out, float temp)
 {
     const ColorSystem &cs = op_color_colorsystem(sg);
-    *(Color3 *)out = cs.blackbody_rgb (temp);
+    *(Color3 *)out = cs.blackbody_color (temp);
 }
 
 
@@ -432,12 +484,7 @@ OSL_SHADEOP OSL_HOSTDEVICE void osl_blackbody_vf (void *sg, void *out, float tem
 OSL_SHADEOP OSL_HOSTDEVICE void osl_wavelength_color_vf (void *sg, void *out, float lambda)
 {
     const ColorSystem &cs = op_color_colorsystem(sg);
-    Color3 rgb = cs.XYZ_to_RGB (wavelength_color_XYZ (lambda));
-//    constrain_rgb (rgb);
-    rgb *= 1.0/2.52;    // Empirical scale from lg to make all comps <= 1
-//    norm_rgb (rgb);
-    clamp_zero (rgb);
-    *(Color3 *)out = rgb;
+    *(Color3 *)out = cs.wavelength_color (lambda);
 }
 
 
@@ -79,6 +79,11 @@ public:
     OSL_HOSTDEVICE inline Color3
     compute_blackbody_rgb (float T /*Kelvin*/) const;
 
+    /// The results of the blackbody() and wavelength_color() shadeops, for
+    /// callers outside of them (like constant folding).
+    OSL_HOSTDEVICE Color3 blackbody_color (float T /*Kelvin*/) const;
+    OSL_HOSTDEVICE Color3 wavelength_color (float lambda_nm) const;
+
 
     /// Set the current color space.
     OSL_HOSTDEVICE bool
@@ -29,12 +29,113 @@ namespace pvt {
 
 
 
+#ifndef __CUDA_ARCH__
+// On the host the scalar matrix ops handle one matrix at a time, so do
+// the work a row at a time in 4-wide SIMD registers rather than with
+// Imath's scalar loops.  Each lane does the same multiplies and adds, in
+// the same order, as the scalar code, so the results don't change.  The
+// batched ops keep the scalar forms, which vectorize across lanes instead.
+
+// a * b
+static OSL_FORCEINLINE Matrix44
+simd_mul (const Matrix44 &a, const Matrix44 &b)
+{
+    using OIIO::simd::vfloat4;
+    const vfloat4 b0 (b.x[0]), b1 (b.x[1]), b2 (b.x[2]), b3 (b.x[3]);
+    Matrix44 r;
+    for (int i = 0; i < 4; ++i) {
+        vfloat4 row = vfloat4(a.x[i][0]) * b0 + vfloat4(a.x[i][1]) * b1
+                    + vfloat4(a.x[i][2]) * b2 + vfloat4(a.x[i][3]) * b3;
+        row.store (r.x[i]);
+    }
+    return r;
+}
+
+// Lanes hold the transformed x, y, z and w of a point (or direction).
+static OSL_FORCEINLINE OIIO::simd::vfloat4
+simd_mult_dir (const Matrix44 &M, const Vec3 &v)
+{
+    using OIIO::simd::vfloat4;
+    return vfloat4(v.x) * vfloat4(M.x[0]) + vfloat4(v.y) * vfloat4(M.x[1])
+         + vfloat4(v.z) * vfloat4(M.x[2]);
+}
+
+// Same as robust_multVecMatrix
+static OSL_FORCEINLINE void
+simd_transform_point (const Matrix44 &M, const Vec3 &v, Vec3 &result)
+{
+    using OIIO::simd::vfloat4;
+    vfloat4 p = simd_mult_dir (M, v) + vfloat4(M.x[3]);
+    float w = OIIO::simd::extract<3>(p);
+    if (OSL_LIKELY(w != 0.0f))
+        p = p / vfloat4(w);
+    else
+        p = vfloat4::Zero();
+    p.store (&result.x, 3);
+}
+
+// Same as robust_multVecMatrix on a Dual2<Vec3>: the partials skip the
+// translation and then take the quotient rule through the divide by w.
+static OSL_FORCEINLINE void
+simd_transform_point (const Matrix44 &M, const Dual2<Vec3> &v,
+                      Dual2<Vec3> &result)
+{
+    using OIIO::simd::vfloat4;
+    vfloat4 p  = simd_mult_dir (M, v.val()) + vfloat4(M.x[3]);
+    vfloat4 dx = simd_mult_dir (M, v.dx());
+    vfloat4 dy = simd_mult_dir (M, v.dy());
+    float w = OIIO::simd::extract<3>(p);
+    if (OSL_LIKELY(w != 0.0f)) {
+        vfloat4 winv (1.0f / w);
+        p  = p / vfloat4(w);
+        dx = winv * (dx - p * vfloat4(OIIO::simd::extract<3>(dx)));
+        dy = winv * (dy - p * vfloat4(OIIO::simd::extract<3>(dy)));
+    } else {
+        p = dx = dy = vfloat4::Zero();
+    }
+    p.store (&result.val().x, 3);
+    dx.store (&result.dx().x, 3);
+    dy.store (&result.dy().x, 3);
+}
+
+static OSL_FORCEINLINE void
+simd_transform_dir (const Matrix44 &M, const Vec3 &v, Vec3 &result)
+{
+    simd_mult_dir (M, v).store (&result.x, 3);
+}
+
+static OSL_FORCEINLINE void
+simd_transform_dir (const Matrix44 &M, const Dual2<Vec3> &v,
+                    Dual2<Vec3> &result)
+{
+    auto p  = simd_mult_dir (M, v.val());
+    auto dx = simd_mult_dir (M, v.dx());
+    auto dy = simd_mult_dir (M, v.dy());
+    p.store (&result.val().x, 3);
+    dx.store (&result.dx().x, 3);
+    dy.store (&result.dy().x, 3);
+}
+#endif
+
+// a * b, with the SIMD kernel wherever we have it
+static OSL_FORCEINLINE OSL_HOSTDEVICE Matrix44
+mul_matrix (const Matrix44 &a, const Matrix44 &b)
+{
+#ifndef __CUDA_ARCH__
+    return simd_mul (a, b);
+#else
+    return multiplyMatrixByMatrix (a, b);
+#endif
+}
+
+
+
 // Matrix ops
 
 OSL_SHADEOP OSL_HOSTDEVICE void
 osl_mul_mmm (void *r, void *a, void *b)
 {
-    MAT(r) = MAT(a) * MAT(b);
+    MAT(r) = mul_matrix (MAT(a), MAT(b));
 }
 
 OSL_SHADEOP OSL_HOSTDEVICE void
@@ -47,7 +148,7 @@ osl_mul_mmf (void *r, void *a, float b)
 OSL_SHADEOP OSL_HOSTDEVICE void
 osl_div_mmm (void *r, void *a, void *b)
 {
-    MAT(r) = MAT(a) * MAT(b).inverse();
+    MAT(r) = mul_matrix (MAT(a), inlinedInverse(MAT(b)));
 }
 
 OSL_SHADEOP OSL_HOSTDEVICE void
@@ -59,7 +160,7 @@ osl_div_mmf (void *r, void *a, float b)
 OSL_SHADEOP OSL_HOSTDEVICE void
 osl_div_mfm (void *r, float a, void *b)
 {
-    MAT(r) = a * MAT(b).inverse();
+    MAT(r) = a * inlinedInverse(MAT(b));
 }
 
 OSL_SHADEOP OSL_HOSTDEVICE void
@@ -84,14 +185,22 @@ OSL_SHADEOP OSL_HOSTDEVICE void osl_transform_vmv(void *result, void* M_, void*
 {
    const Vec3 &v = VEC(v_);
    const Matrix44 &M = MAT(M_);
+#ifndef __CUDA_ARCH__
+   simd_transform_point (M, v, VEC(result));
+#else
    robust_multVecMatrix (M, v, VEC(result));
+#endif
 }
 
 OSL_SHADEOP OSL_HOSTDEVICE void osl_transform_dvmdv(void *result, void* M_, void* v_)
 {
    const Dual2<Vec3> &v = DVEC(v_);
    const Matrix44    &M = MAT(M_);
+#ifndef __CUDA_ARCH__
+   simd_transform_point (M, v, DVEC(result));
+#else
    robust_multVecMatrix (M, v, DVEC(result));
+#endif
 }
 
 // vector = M * vector
@@ -99,15 +208,23 @@ OSL_SHADEOP OSL_HOSTDEVICE void osl_transformv_vmv(void *result, void* M_, void*
 {
    const Vec3 &v = VEC(v_);
    const Matrix44 &M = MAT(M_);
+#ifndef __CUDA_ARCH__
+   simd_transform_dir (M, v, VEC(result));
+#else
    //M.multDirMatrix (v, VEC(result));
    multDirMatrix (M, v, VEC(result));
+#endif
 }
 
 OSL_SHADEOP OSL_HOSTDEVICE void osl_transformv_dvmdv(void *result, void* M_, void* v_)
 {
    const Dual2<Vec3> &v = DVEC(v_);
    const Matrix44    &M = MAT(M_);
+#ifndef __CUDA_ARCH__
+   simd_transform_dir (M, v, DVEC(result));
+#else
    multDirMatrix (M, v, DVEC(result));
+#endif
 }
 
 
@@ -117,7 +234,11 @@ OSL_SHADEOP OSL_HOSTDEVICE void osl_transformn_vmv(void *result, void* M_, void*
    const Vec3 &v = VEC(v_);
    const Matrix44 &M = MAT(M_);
    //M.inverse().transposed().multDirMatrix (v, VEC(result));
-   multDirMatrix(inlinedTransposed(M.inverse()), v, VEC(result));
+#ifndef __CUDA_ARCH__
+   simd_transform_dir (inlinedTransposed(inlinedInverse(M)), v, VEC(result));
+#else
+   multDirMatrix(inlinedTransposed(inlinedInverse(M)), v, VEC(result));
+#endif
 }
 
 OSL_SHADEOP OSL_HOSTDEVICE void osl_transformn_dvmdv(void *result, void* M_, void* v_)
@@ -125,10 +246,74 @@ OSL_SHADEOP OSL_HOSTDEVICE void osl_transformn_dvmdv(void *result, void* M_, voi
    const Dual2<Vec3> &v = DVEC(v_);
    const Matrix44    &M = MAT(M_);
    //multDirMatrix (M.inverse().transposed(), v, DVEC(result));
-   multDirMatrix (inlinedTransposed(M.inverse()), v, DVEC(result));
+#ifndef __CUDA_ARCH__
+   simd_transform_dir (inlinedTransposed(inlinedInverse(M)), v, DVEC(result));
+#else
+   multDirMatrix (inlinedTransposed(inlinedInverse(M)), v, DVEC(result));
+#endif
 }
 
+
+
 #ifndef __CUDACC__
+// Look up a named space's matrix (or its inverse) from the renderer,
+// going through the context's lookup cache when "cache_lookups" is on.
+// That includes "shader" and "object", whose transformations are only
+// good for the point being shaded, but so is the cache; so a point
+// inverts each at most once, however many layers transform with it.
+// The renderer's answer is also what a "capture" records and a replay
+// gives back.
+static int
+get_named_matrix (ShaderGlobals *sg, ShadingContext *ctx, Matrix44 &M,
+                  ustring name, bool inverse)
+{
+    auto kind = inverse ? ShadingContext::LookupInverseMatrix
+                        : ShadingContext::LookupMatrix;
+    bool cache = ctx->shadingsys().cache_lookups();
+    if (cache) {
+        if (auto e = ctx->find_lookup (kind, 1, ustring(), name,
+                                       TypeDesc::TypeMatrix, -1, false)) {
+            memcpy (&M, ctx->lookup_data(*e), sizeof(Matrix44));
+            return e->ok;
+        }
+    }
+    int ok;
+    if (ctx->replaying()) {
+        auto c = ctx->replay_lookup (kind, ustring(), name,
+                                     TypeDesc::TypeMatrix, -1, false);
+        ok = c && c->ok;
+        if (ok)
+            memcpy (&M, c->data.data(), sizeof(Matrix44));
+        else
+            M.makeIdentity ();
+    } else if (name == Strings::shader || name == Strings::object) {
+        TransformationPtr xform = name == Strings::shader ? sg->shader2common
+                                                          : sg->object2common;
+        if (inverse)
+            rs_get_inverse_matrix_xform_time (sg, M, xform, sg->time);
+        else
+            rs_get_matrix_xform_time (sg, M, xform, sg->time);
+        ok = true;   // As ever, whatever the renderer says
+    } else {
+        ok = inverse ? rs_get_inverse_matrix_space_time (sg, M, name, sg->time)
+                     : rs_get_matrix_space_time (sg, M, name, sg->time);
+    }
+    if (ctx->capturing())
+        ctx->capture_lookup (kind, ustring(), name, TypeDesc::TypeMatrix, -1,
+                             false, ok, &M, sizeof(Matrix44));
+    if (cache) {
+        auto& e = ctx->add_lookup (kind, 1, ustring(), name,
+                                   TypeDesc::TypeMatrix, -1, false,
+                                   sizeof(Matrix44));
+        e.fetched = 1;
+        e.ok = ok;
+        memcpy (ctx->lookup_data(e), &M, sizeof(Matrix44));
+    }
+    return ok;
+}
+
+
+
 OSL_SHADEOP int
 osl_get_matrix (void *sg_, void *r, const char *from)
 {
@@ -139,15 +324,7 @@ osl_get_matrix (void *sg_, void *r, const char *from)
         MAT(r).makeIdentity ();
         return true;
     }
-    if (HDSTR(from) == STRING_PARAMS(shader)) {
-        rs_get_matrix_xform_time(sg, MAT(r), sg->shader2common, sg->time);
-        return true;
-    }
-    if (HDSTR(from) == STRING_PARAMS(object)) {
-        rs_get_matrix_xform_time(sg, MAT(r), sg->object2common, sg->time);
-        return true;
-    }
-    int ok = rs_get_matrix_space_time(sg, MAT(r), HDSTR(from), sg->time);
+    int ok = get_named_matrix (sg, ctx, MAT(r), HDSTR(from), false);
     if (! ok) {
         MAT(r).makeIdentity();
         ShadingContext *ctx = (ShadingContext *)((ShaderGlobals *)sg)->context;
@@ -169,15 +346,7 @@ osl_get_inverse_matrix (void *sg_, void *r, const char *to)
         MAT(r).makeIdentity ();
         return true;
     }
-    if (HDSTR(to) == STRING_PARAMS(shader)) {
-        rs_get_inverse_matrix_xform_time(sg, MAT(r), sg->shader2common, sg->time);
-        return true;
-    }
-    if (HDSTR(to) == STRING_PARAMS(object)) {
-        rs_get_inverse_matrix_xform_time(sg, MAT(r), sg->object2common, sg->time);
-        return true;
-    }
-    int ok = rs_get_inverse_matrix_space_time(sg, MAT(r), HDSTR(to), sg->time);
+    int ok = get_named_matrix (sg, ctx, MAT(r), HDSTR(to), true);
     if (! ok) {
         MAT(r).makeIdentity ();
         ShadingContext *ctx = (ShadingContext *)((ShaderGlobals *)sg)->context;
@@ -202,7 +371,7 @@ osl_prepend_matrix_from (void *sg, void *r, const char *from)
     Matrix44 m;
     bool ok = osl_get_matrix ((ShaderGlobals *)sg, &m, from);
     if (ok)
-        MAT(r) = m * MAT(r);
+        MAT(r) = mul_matrix (m, MAT(r));
 #ifndef __CUDACC__
     // TODO: How do we manage this in OptiX?
     else {
@@ -222,7 +391,7 @@ osl_get_from_to_matrix (void *sg, void *r, const char *from, const char *to)
     Matrix44 Mfrom, Mto;
     int ok = osl_get_matrix ((ShaderGlobals *)sg, &Mfrom, from);
     ok &= osl_get_inverse_matrix ((ShaderGlobals *)sg, &Mto, to);
-    MAT(r) = Mfrom * Mto;
+    MAT(r) = mul_matrix (Mfrom, Mto);
     return ok;
 }
 
@@ -78,7 +78,20 @@ osl_getmessage (ShaderGlobals *sg, const char *source_, const char *name_,
 
     static ustring ktrace ("trace");
     if (source == ktrace) {
-        // Source types where we need to ask the renderer
+        // A trace answered from supplied results only knows those values;
+        // otherwise the renderer knows about its own trace.
+        if (const auto *result = sg->context->current_trace()) {
+            for (const auto& v : result->values) {
+                if (v.name() == name && v.type() == type) {
+                    size_t size = type.size();
+                    memcpy (val, v.data(), size);
+                    if (derivs)
+                        memset ((char *)val + size, 0, 2 * size);
+                    return 1;
+                }
+            }
+            return 0;
+        }
         return sg->renderer->getmessage (sg, source, name, type, val, derivs);
     }
 
@@ -129,5 +142,88 @@ osl_getmessage (ShaderGlobals *sg, const char *source_, const char *name_,
 }
 
 
+
+// setmessage and getmessage for messages that have a MessageSlot in the
+// group data (opt_message_slots). They mirror osl_setmessage and
+// osl_getmessage; no type mismatch is possible, since a message only
+// gets a slot if all its uses agree on the type.
+
+OSL_SHADEOP void
+osl_setmessage_slot (ShaderGlobals *sg, void *slot_, const char *name_,
+                     long long type_, void *val, int layeridx,
+                     const char* sourcefile_, int sourceline)
+{
+    MessageSlot &slot (*(MessageSlot *)slot_);
+    const ustring &name (USTR(name_));
+    const ustring &sourcefile (USTR(sourcefile_));
+    TypeDesc type = TYPEDESC(type_);
+    if (type.basetype == TypeDesc::UNKNOWN)  // secret code for closure
+        type.basetype = TypeDesc::PTR;
+
+    if (slot.state == MessageSlot::Set) {
+        sg->context->errorfmt(
+            "message \"{}\" already exists (created here: {}:{})"
+            " cannot set again from {}:{}",
+            name, slot.sourcefile, slot.sourceline, sourcefile, sourceline);
+        return;
+    }
+    if (slot.state == MessageSlot::Queried) {
+        sg->context->errorfmt(
+            "message \"{}\" was queried before being set (queried here: {}:{})"
+            " setting it now ({}:{}) would lead to inconsistent results",
+            name, slot.sourcefile, slot.sourceline, sourcefile, sourceline);
+        return;
+    }
+    slot.state = MessageSlot::Set;
+    slot.layeridx = layeridx;
+    slot.sourcefile = sourcefile;
+    slot.sourceline = sourceline;
+    memcpy (slot.data(), val, type.size());
+}
+
+
+
+OSL_SHADEOP int
+osl_getmessage_slot (ShaderGlobals *sg, void *slot_, const char *name_,
+                     long long type_, void *val, int derivs,
+                     int layeridx, const char* sourcefile_, int sourceline)
+{
+    MessageSlot &slot (*(MessageSlot *)slot_);
+    const ustring &name (USTR(name_));
+    const ustring &sourcefile (USTR(sourcefile_));
+    TypeDesc type = TYPEDESC(type_);
+    if (type.basetype == TypeDesc::UNKNOWN)  // secret code for closure
+        type.basetype = TypeDesc::PTR;
+
+    if (slot.state == MessageSlot::Empty) {
+        // Record the miss in case a later layer tries to set it
+        if (sg->context->shadingsys().strict_messages()) {
+            slot.state = MessageSlot::Queried;
+            slot.layeridx = layeridx;
+            slot.sourcefile = sourcefile;
+            slot.sourceline = sourceline;
+        }
+        return 0;
+    }
+    if (slot.state == MessageSlot::Queried)
+        return 0;
+    if (slot.layeridx > layeridx) {
+        sg->context->errorfmt(
+            "message \"{}\" was set by layer #{} ({}:{})"
+            " but is being queried by layer #{} ({}:{})"
+            " - messages may only be transfered from nodes "
+            "that appear earlier in the shading network",
+            name, slot.layeridx, slot.sourcefile, slot.sourceline, layeridx,
+            sourcefile, sourceline);
+        return 0;
+    }
+    size_t size = type.size();
+    memcpy (val, slot.data(), size);
+    if (derivs)
+        memset (((char *)val)+size, 0, 2*size);
+    return 1;
+}
+
+
 } // namespace pvt
 OSL_NAMESPACE_EXIT
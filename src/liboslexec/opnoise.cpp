@@ -602,6 +602,34 @@ NOISE_IMPL_DERIV_OPT (gabornoise, GaborNoise)
 PNOISE_IMPL_DERIV_OPT (gaborpnoise, GaborPNoise)
 
 
+
+struct FBmNoise {
+    OSL_HOSTDEVICE FBmNoise () { }
+
+    // Like Gabor, fbm is only called with derivs. Template on R, S, and T
+    // to be either float or Vec3.
+
+    template<class R, class S> OSL_HOSTDEVICE
+    inline void operator() (StringParam /*noisename*/, Dual2<R> &result,
+                            const Dual2<S> &s,
+                            ShaderGlobals* /*sg*/, const NoiseParams *opt) const {
+        FBm fbm;
+        fbm (result, opt->octaves, opt->lacunarity, opt->gain, s);
+    }
+
+    template<class R, class S, class T> OSL_HOSTDEVICE
+    inline void operator() (StringParam /*noisename*/, Dual2<R> &result,
+                            const Dual2<S> &s, const Dual2<T> &t,
+                            ShaderGlobals* /*sg*/, const NoiseParams *opt) const {
+        FBm fbm;
+        fbm (result, opt->octaves, opt->lacunarity, opt->gain, s, t);
+    }
+};
+
+
+NOISE_IMPL_DERIV_OPT (fbmnoise, FBmNoise)
+
+
 // Turn off warnings about unused params, since the NullNoise methods are stubs.
 OSL_PRAGMA_WARNING_PUSH
 OSL_GCC_PRAGMA(GCC diagnostic ignored "-Wunused-parameter")
@@ -695,6 +723,9 @@ struct GenericNoise {
         } else if (name == STRING_PARAMS(gabor)) {
             GaborNoise gnoise;
             gnoise (name, result, s, sg, opt);
+        } else if (name == STRING_PARAMS(fbm)) {
+            FBmNoise fnoise;
+            fnoise (name, result, s, sg, opt);
         } else if (name == STRING_PARAMS(null)) {
             NullNoise noise; noise(result, s);
         } else if (name == STRING_PARAMS(unull)) {
@@ -737,6 +768,9 @@ struct GenericNoise {
         } else if (name == STRING_PARAMS(gabor)) {
             GaborNoise gnoise;
             gnoise (name, result, s, t, sg, opt);
+        } else if (name == STRING_PARAMS(fbm)) {
+            FBmNoise fnoise;
+            fnoise (name, result, s, t, sg, opt);
         } else if (name == STRING_PARAMS(null)) {
             NullNoise noise; noise(result, s, t);
         } else if (name == STRING_PARAMS(unull)) {
@@ -888,11 +922,43 @@ osl_noiseparams_set_impulses (void *opt, float i)
 
 
 
+OSL_SHADEOP OSL_HOSTDEVICE void
+osl_noiseparams_set_fast (void *opt, int f)
+{
+    ((RendererServices::NoiseOpt *)opt)->fast = f;
+}
+
+
+
+OSL_SHADEOP OSL_HOSTDEVICE void
+osl_noiseparams_set_octaves (void *opt, int o)
+{
+    ((RendererServices::NoiseOpt *)opt)->octaves = o;
+}
+
+
+
+OSL_SHADEOP OSL_HOSTDEVICE void
+osl_noiseparams_set_lacunarity (void *opt, float l)
+{
+    ((RendererServices::NoiseOpt *)opt)->lacunarity = l;
+}
+
+
+
+OSL_SHADEOP OSL_HOSTDEVICE void
+osl_noiseparams_set_gain (void *opt, float g)
+{
+    ((RendererServices::NoiseOpt *)opt)->gain = g;
+}
+
+
+
 OSL_SHADEOP void
 osl_count_noise (void *sg_)
 {
     ShaderGlobals *sg = (ShaderGlobals *)sg_;
-    sg->context->shadingsys().count_noise ();
+    sg->context->count_noise ();
 }
 
 
@@ -118,6 +118,65 @@ osl_substr_ssii (const char *s_, int start, int length)
 }
 
 
+
+// The *_transient variants make strings that the optimizer found never
+// leave the shading point (RuntimeOptimizer::mark_transient_strings).
+// They are plain NUL-terminated copies in the context's scratch arena,
+// which is reset for each shade, so nothing may hash them, compare them
+// by address, or ask ustring for their length -- and since their inputs
+// may be transient as well, lengths here come from strlen. As with
+// ustring, the empty string is a null pointer.
+
+static inline size_t
+transient_length (const char *s)
+{
+    return s ? strlen (s) : 0;
+}
+
+
+static const char *
+transient_string (ShaderGlobals *sg, string_view s)
+{
+    if (s.empty())
+        return nullptr;
+    char *buf = (char *) sg->context->alloc_scratch (s.size() + 1);
+    memcpy (buf, s.data(), s.size());
+    buf[s.size()] = 0;
+    return buf;
+}
+
+
+OSL_SHADEOP const char *
+osl_concat_transient (void *sg_, const char *s, const char *t)
+{
+    ShaderGlobals *sg = (ShaderGlobals *)sg_;
+    size_t sl = transient_length (s);
+    size_t tl = transient_length (t);
+    if (sl + tl == 0)
+        return nullptr;
+    char *buf = (char *) sg->context->alloc_scratch (sl + tl + 1);
+    memcpy (buf     , s, sl);
+    memcpy (buf + sl, t, tl);
+    buf[sl + tl] = 0;
+    return buf;
+}
+
+
+OSL_SHADEOP const char *
+osl_substr_transient (void *sg_, const char *s, int start, int length)
+{
+    int slen = int (transient_length (s));
+    if (slen == 0)
+        return nullptr;  // No substring of empty string
+    int b = start;
+    if (b < 0)
+        b += slen;
+    b = Imath::clamp (b, 0, slen);
+    string_view sub (s + b, std::min (Imath::clamp (length, 0, slen), slen - b));
+    return transient_string ((ShaderGlobals *)sg_, sub);
+}
+
+
 OSL_SHADEOP int
 osl_regex_impl (void *sg_, const char *subject_, void *results, int nresults,
                 const char *pattern, int fullmatch)
@@ -125,31 +184,112 @@ osl_regex_impl (void *sg_, const char *subject_, void *results, int nresults,
     ShaderGlobals *sg = (ShaderGlobals *)sg_;
     ShadingContext *ctx = sg->context;
     const std::string &subject (ustring::from_unique(subject_).string());
-    std::match_results<std::string::const_iterator> mresults;
-    const std::regex &regex (ctx->find_regex (USTR(pattern)));
-    if (nresults > 0) {
-        std::string::const_iterator start = subject.begin();
-        int res = fullmatch ? std::regex_match(subject, mresults, regex)
-                            : std::regex_search(subject, mresults, regex);
-        int *m = (int *)results;
-        for (int r = 0;  r < nresults;  ++r) {
-            if (r/2 < (int)mresults.size()) {
-                if ((r & 1) == 0)
-                    m[r] = mresults[r/2].first - start;
-                else
-                    m[r] = mresults[r/2].second - start;
-            } else {
-                m[r] = USTR(pattern).length();
-            }
+    const CompiledRegex &regex (ctx->find_regex (USTR(pattern)));
+    return regex.match (subject, (int *)results, nresults, fullmatch);
+}
+
+
+FormatSpec::FormatSpec (string_view format, string_view types)
+{
+    Piece piece;
+    size_t arg = 0;
+    for (size_t i = 0;  i < format.size();  ) {
+        if (format[i] != '%') {
+            piece.literal += format[i++];
+        } else if (i+1 < format.size() && format[i+1] == '%') {
+            piece.literal += '%';
+            i += 2;
+        } else {
+            // Same conversion characters llvm_gen_printf recognizes
+            size_t end = format.find_first_of ("cdefgimnopsuvxX", i+1);
+            end = (end == string_view::npos) ? format.size() : end+1;
+            piece.conversion = format.substr (i, end-i);
+            OSL_DASSERT (arg < types.size());
+            piece.type = ArgType (types[arg++]);
+            pieces.push_back (std::move(piece));
+            piece = Piece();
+            i = end;
         }
-        return res;
+    }
+    if (piece.literal.size() || pieces.empty())
+        pieces.push_back (std::move(piece));
+}
+
+
+
+// snprintf a single conversion, growing past the stack buffer if needed.
+template<typename T>
+static void
+append_conversion (std::string &out, const std::string &conversion, T value)
+{
+    char buf[128];
+    int len = snprintf (buf, sizeof(buf), conversion.c_str(), value);
+    if (len < 0)
+        return;
+    if (size_t(len) < sizeof(buf)) {
+        out.append (buf, len);
     } else {
-        return fullmatch ? std::regex_match(subject, regex)
-                         : std::regex_search(subject, regex);
+        size_t start = out.size();
+        out.resize (start + len + 1);
+        snprintf (&out[start], len + 1, conversion.c_str(), value);
+        out.resize (start + len);
+    }
+}
+
+
+
+std::string
+FormatSpec::format (const void *args) const
+{
+    std::string out;
+    const char *slot = (const char *)args;
+    for (const Piece &p : pieces) {
+        out += p.literal;
+        if (p.conversion.empty())
+            continue;
+        switch (p.type) {
+        case Int: {
+            int v = *(const int *)slot;
+            if (p.conversion == "%d")
+                out += Strutil::to_string (v);
+            else
+                append_conversion (out, p.conversion, v);
+            break;
+        }
+        case Double:
+            append_conversion (out, p.conversion, *(const double *)slot);
+            break;
+        case String: {
+            const char *v = *(const char * const *)slot;
+            if (p.conversion == "%s")
+                out += v ? v : "";
+            else
+                append_conversion (out, p.conversion, v ? v : "");
+            break;
+        }
+        }
+        slot += sizeof(uint64_t);
     }
+    return out;
+}
+
+
+
+const FormatSpec *
+ShadingSystemImpl::format_spec (string_view format, string_view types)
+{
+    std::string key (format);
+    key += '\0';
+    key += types;
+    spin_lock lock (m_format_specs_mutex);
+    std::unique_ptr<FormatSpec> &spec (m_format_specs[key]);
+    if (! spec)
+        spec.reset (new FormatSpec (format, types));
+    return spec.get();
 }
 
 
+
 OSL_SHADEOP const char *
 osl_format (const char* format_str, ...)
 {
@@ -202,6 +342,17 @@ osl_warning (ShaderGlobals *sg, const char* format_str, ...)
 
 
 
+static void
+fprintf_append (const char *filename, const std::string &s)
+{
+    static OIIO::mutex fprintf_mutex;
+    OIIO::lock_guard lock (fprintf_mutex);
+    FILE *file = OIIO::Filesystem::fopen (filename, "a");
+    fputs (s.c_str(), file);
+    fclose (file);
+}
+
+
 OSL_SHADEOP void
 osl_fprintf (ShaderGlobals* /*sg*/, const char *filename,
              const char* format_str, ...)
@@ -211,11 +362,59 @@ osl_fprintf (ShaderGlobals* /*sg*/, const char *filename,
     std::string s = Strutil::vsprintf (format_str, args);
     va_end (args);
 
-    static OIIO::mutex fprintf_mutex;
-    OIIO::lock_guard lock (fprintf_mutex);
-    FILE *file = OIIO::Filesystem::fopen (filename, "a");
-    fputs (s.c_str(), file);
-    fclose (file);
+    fprintf_append (filename, s);
+}
+
+
+
+// The *_spec variants below are what the JIT calls for these ops: the
+// format was split once into a FormatSpec and the arguments are packed in
+// 8-byte slots, so there is no format parsing or varargs at run time.
+
+OSL_SHADEOP const char *
+osl_format_spec (void *spec, void *args)
+{
+    return ustring(((const FormatSpec *)spec)->format (args)).c_str();
+}
+
+
+OSL_SHADEOP const char *
+osl_format_spec_transient (void *sg, void *spec, void *args)
+{
+    return transient_string ((ShaderGlobals *)sg,
+                             ((const FormatSpec *)spec)->format (args));
+}
+
+
+OSL_SHADEOP void
+osl_printf_spec (ShaderGlobals *sg, void *spec, void *args)
+{
+    sg->context->messagefmt("{}", ((const FormatSpec *)spec)->format (args));
+}
+
+
+OSL_SHADEOP void
+osl_error_spec (ShaderGlobals *sg, void *spec, void *args)
+{
+    sg->context->errorfmt("{}", ((const FormatSpec *)spec)->format (args));
+}
+
+
+OSL_SHADEOP void
+osl_warning_spec (ShaderGlobals *sg, void *spec, void *args)
+{
+    if (sg->context->allow_warnings())
+        sg->context->warningfmt("{}", ((const FormatSpec *)spec)->format (args));
+}
+
+
+OSL_SHADEOP void
+osl_fprintf_spec (ShaderGlobals* /*sg*/, const char *filename,
+                  void *spec, void *args)
+{
+    std::string s = ((const FormatSpec *)spec)->format (args);
+
+    fprintf_append (filename, s);
 }
 
 
@@ -24,6 +24,20 @@ OSL_NAMESPACE_ENTER
 namespace pvt {
 
 
+// Utility: the handle to use for a texture lookup.  Ops whose filename
+// is constant were given their handle when the group was JITed; for the
+// rest, ask the context's small cache of runtime filenames rather than
+// having the renderer find the file by name on every call.
+static inline void *
+texture_handle (ShaderGlobals *sg, const char *name, void *handle)
+{
+    if (handle)
+        return handle;
+    return sg->context->texture_handle (USTR(name)).handle;
+}
+
+
+
 // Utility: retrieve a pointer to the ShadingContext's texture options
 // struct, also re-initialize its contents.
 OSL_SHADEOP void *
@@ -36,6 +50,19 @@ osl_get_texture_options (void *sg_)
 }
 
 
+// Utility: like osl_get_texture_options, but initialize the options as a
+// copy of a template TextureOpt that the JIT filled in with the options
+// whose values are constant.
+OSL_SHADEOP void *
+osl_get_texture_options_from (void *sg_, const void *tmpl)
+{
+    ShaderGlobals *sg = (ShaderGlobals *)sg_;
+    TextureOpt *opt = sg->context->texture_options_ptr ();
+    new (opt) TextureOpt (*(const TextureOpt *)tmpl);
+    return opt;
+}
+
+
 OSL_SHADEOP void
 osl_texture_set_firstchannel (void *opt, int x)
 {
@@ -228,7 +255,7 @@ osl_texture (void *sg_, const char *name, void *handle,
     // and ensure that they're being put in aligned memory.
     OIIO::simd::float4 result_simd, dresultds_simd, dresultdt_simd;
     bool ok = sg->renderer->texture (USTR(name),
-                                     (TextureSystem::TextureHandle *)handle, sg->context->texture_thread_info(),
+                                     (TextureSystem::TextureHandle *)texture_handle (sg, name, handle), sg->context->texture_thread_info(),
                                      *opt, sg, s, t, dsdx, dtdx, dsdy, dtdy, 4,
                                      (float *)&result_simd,
                                      derivs ? (float *)&dresultds_simd : NULL,
@@ -287,7 +314,7 @@ osl_texture3d (void *sg_, const char *name, void *handle,
     // and ensure that they're being put in aligned memory.
     OIIO::simd::float4 result_simd, dresultds_simd, dresultdt_simd, dresultdr_simd;
     bool ok = sg->renderer->texture3d (USTR(name),
-                                       (TextureSystem::TextureHandle *)handle, sg->context->texture_thread_info(),
+                                       (TextureSystem::TextureHandle *)texture_handle (sg, name, handle), sg->context->texture_thread_info(),
                                        *opt, sg, P, dPdx, dPdy, dPdz,
                                        4, (float *)&result_simd,
                                        derivs ? (float *)&dresultds_simd : nullptr,
@@ -340,7 +367,7 @@ osl_environment (void *sg_, const char *name, void *handle,
     // and ensure that they're being put in aligned memory.
     OIIO::simd::float4 local_result;
     bool ok = sg->renderer->environment (USTR(name),
-                                         (TextureSystem::TextureHandle *)handle,
+                                         (TextureSystem::TextureHandle *)texture_handle (sg, name, handle),
                                          sg->context->texture_thread_info(), *opt, sg, R, dRdx, dRdy, 4,
                                          (float *)&local_result, NULL, NULL,
                                          errormessage);
@@ -377,6 +404,33 @@ osl_environment (void *sg_, const char *name, void *handle,
 
 
 
+bool
+ShadingSystemImpl::find_textureinfo (ustring filename, int subimage,
+                                     ustring dataname, TypeDesc type,
+                                     void *data)
+{
+    OIIO::spin_rw_read_lock lock (m_textureinfo_mutex);
+    auto found = m_textureinfo.find ({ filename, dataname, type, subimage });
+    if (found == m_textureinfo.end())
+        return false;
+    memcpy (data, found->second.data(), found->second.size());
+    return true;
+}
+
+
+
+void
+ShadingSystemImpl::add_textureinfo (ustring filename, int subimage,
+                                    ustring dataname, TypeDesc type,
+                                    const void *data)
+{
+    const char *bytes = (const char *)data;
+    OIIO::spin_rw_write_lock lock (m_textureinfo_mutex);
+    m_textureinfo[{ filename, dataname, type, subimage }].assign (bytes, bytes + type.size());
+}
+
+
+
 OSL_SHADEOP int
 osl_get_textureinfo (void *sg_, const char *name, void *handle,
                      void *dataname,  int type,
@@ -391,13 +445,26 @@ osl_get_textureinfo (void *sg_, const char *name, void *handle,
 
     ShaderGlobals *sg   = (ShaderGlobals *)sg_;
 
-    return sg->renderer->get_texture_info (USTR(name),
-                                           (RendererServices::TextureHandle *)handle,
-                                           sg->context->texture_thread_info(),
-                                           sg->context,
-                                           0 /*FIXME-ptex*/,
-                                           USTR(dataname), typedesc, data,
-                                           errormessage);
+    // Texture metadata doesn't change during a render, so (unless the
+    // renderer says otherwise) successful answers are kept in a cache
+    // that all threads share.  Failures aren't, so that their errors are
+    // still reported each time.
+    ShadingSystemImpl &shadingsys (sg->context->shadingsys());
+    bool cache = shadingsys.cache_textureinfo();
+    if (cache && shadingsys.find_textureinfo (USTR(name), 0, USTR(dataname),
+                                              typedesc, data))
+        return 1;
+
+    bool ok = sg->renderer->get_texture_info (USTR(name),
+                                              (RendererServices::TextureHandle *)texture_handle (sg, name, handle),
+                                              sg->context->texture_thread_info(),
+                                              sg->context,
+                                              0 /*FIXME-ptex*/,
+                                              USTR(dataname), typedesc, data,
+                                              errormessage);
+    if (ok && cache)
+        shadingsys.add_textureinfo (USTR(name), 0, USTR(dataname), typedesc, data);
+    return ok;
 }
 
 
@@ -416,7 +483,8 @@ osl_get_textureinfo_st(void* sg_, const char* name, void* handle, float s,
     ShaderGlobals* sg = (ShaderGlobals*)sg_;
 
     return sg->renderer->get_texture_info(
-        USTR(name), (RendererServices::TextureHandle*)handle, s, t,
+        USTR(name),
+        (RendererServices::TextureHandle*)texture_handle(sg, name, handle), s, t,
         sg->context->texture_thread_info(), sg->context, 0 /*FIXME-ptex*/,
         USTR(dataname), typedesc, data, errormessage);
 }
@@ -475,8 +543,8 @@ osl_trace (void *sg_, void *opt_, void *Pos_, void *dPosdx_, void *dPosdy_,
     const Vec3 *Dir = (Vec3 *)Dir_;
     const Vec3 *dDirdx = dDirdx_ ? (Vec3 *)dDirdx_ : &Zero;
     const Vec3 *dDirdy = dDirdy_ ? (Vec3 *)dDirdy_ : &Zero;
-    return sg->renderer->trace (*opt, sg, *Pos, *dPosdx, *dPosdy,
-                                *Dir, *dDirdx, *dDirdy);
+    return sg->context->trace (sg, *opt, *Pos, *dPosdx, *dPosdy,
+                               *Dir, *dDirdx, *dDirdy);
 }
 
 
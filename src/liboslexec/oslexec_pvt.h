@@ -4,14 +4,22 @@
 
 #pragma once
 
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <stack>
 #include <map>
+#include <tuple>
 #include <memory>
+#include <mutex>
 #include <list>
+#include <deque>
+#include <condition_variable>
+#include <future>
+#include <thread>
 #include <regex>
 #include <set>
+#include <atomic>
 #include <unordered_map>
 
 #include <boost/thread/tss.hpp>   /* for thread_specific_ptr */
@@ -28,10 +36,12 @@
 #endif
 #endif
 
+#include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/ustring.h>
 #include <OpenImageIO/thread.h>
 #include <OpenImageIO/paramlist.h>
 #include <OpenImageIO/refcnt.h>
+#include <OpenImageIO/timer.h>
 #include <OpenImageIO/color.h>
 
 #include <OSL/genclosure.h>
@@ -73,8 +83,9 @@ struct PerThreadInfo
     ~PerThreadInfo ();
     ShadingContext *pop_context ();  ///< Get the pool top and then pop
 
-    std::stack<ShadingContext *> context_pool;
+    std::vector<ShadingContext *> context_pool;
     LLVM_Util::PerThreadInfo llvm_thread_info;
+    int numa_node = 0;    ///< Node the thread ran on when made (numa_local)
 };
 
 
@@ -85,17 +96,86 @@ namespace pvt {
 // forward definitions
 class ShadingSystemImpl;
 class ShaderInstance;
+struct OptimizedInstance;
 typedef std::shared_ptr<ShaderInstance> ShaderInstanceRef;
 class Dictionary;
+class DictionaryCache;
 class RuntimeOptimizer;
 class BackendLLVM;
+class ShaderBundle;
+class MappedFile;
 #if OSL_USE_BATCHED
 class BatchedBackendLLVM;
 #endif
 struct ConnectedParam;
 
+/// A compiled regular expression, shared by all of a shading system's
+/// contexts (std::regex may be matched from many threads at once).
+/// Patterns with no special characters at all are also marked 'literal'
+/// and matched as plain text, which is far cheaper than running the regex
+/// engine.
+struct CompiledRegex {
+    CompiledRegex (ustring pattern);
+
+    /// The regex_search (or with fullmatch, regex_match) of subject,
+    /// filling in 'nresults' match start/end offsets if nresults > 0.
+    int match (const std::string &subject, int *results, int nresults,
+               bool fullmatch) const;
+
+    ustring pattern;
+    std::regex regex;
+    bool literal;
+};
+
+/// A printf-style format string split, when the shader is JITed, into its
+/// literal text and one conversion per argument (see llvm_gen_printf).
+/// Formatting with it never rescans the literal text and needs no C
+/// varargs: the arguments arrive packed in consecutive 8-byte slots, each
+/// holding an int, a double, or a C string.
+struct FormatSpec {
+    enum ArgType : char { Int = 'i', Double = 'd', String = 's' };
+    struct Piece {
+        std::string literal;     ///< Text before the conversion, '%%' collapsed
+        std::string conversion;  ///< e.g. "%g"; empty for the trailing text
+        ArgType type;
+    };
+
+    /// Split 'format' (already rewritten so its conversions match the
+    /// argument types) given the type of each argument, in order.
+    FormatSpec (string_view format, string_view types);
+
+    /// Format the packed argument slots.
+    std::string format (const void *args) const;
+
+    std::vector<Piece> pieces;
+};
+
 OSL_DLL_EXPORT void print_closure (std::ostream &out, const ClosureColor *closure, ShadingSystemImpl *ss);
 
+/// Merge the pending points of the named cloud being written and save it,
+/// in the background unless 'wait' is true. Returns false if no such
+/// cloud is being written.
+bool pointcloud_flush (ustring filename, bool wait);
+
+/// Lay out the named read-only cloud as a DevicePointCloud block. Returns
+/// false if it can't be read or has no positions to search.
+bool pointcloud_device_image (ustring filename, std::vector<char> &image);
+
+/// Write a paged copy of the named cloud beside it, unless a current one
+/// is there already. Returns false if it can't be read, has no positions,
+/// or the copy can't be written.
+bool pointcloud_make_paged (ustring filename);
+
+/// Counts kept by the page cache that all paged point clouds share.
+struct PointCloudPageStats {
+    long long hits = 0;
+    long long misses = 0;
+    long long evictions = 0;
+    long long bytes_read = 0;
+    long long peak_bytes = 0;
+};
+PointCloudPageStats pointcloud_page_stats ();
+
 /// Signature of the function that LLVM generates to run the shader
 /// group.
 typedef void (*RunLLVMGroupFunc)(void* shaderglobals,
@@ -317,6 +397,31 @@ private:
 
 
 
+/// A local front for the global ustring table: strings seen before are
+/// found here without touching the global table (and its locks) again.
+/// Meant for the stack of a single thread doing something that creates
+/// many repeated strings, like reading an oso file or a group spec.
+class UstringCache {
+public:
+    ustring operator() (string_view s) {
+        auto found = m_map.find (s);
+        if (found != m_map.end())
+            return found->second;
+        ustring u (s);
+        // Key by the ustring's own characters, which never go away.
+        m_map.emplace (string_view (u.c_str(), u.length()), u);
+        return u;
+    }
+
+private:
+    struct Hash {
+        size_t operator() (string_view s) const { return OIIO::Strutil::strhash (s); }
+    };
+    std::unordered_map<string_view,ustring,Hash> m_map;
+};
+
+
+
 /// Template to count a vector's allocated size, in bytes.
 ///
 template<class T>
@@ -379,6 +484,25 @@ public:
 
     int num_params () const { return m_lastparam - m_firstparam; }
 
+    /// Does the other master have the very same parameters (names, types,
+    /// order and default value storage), so that an instance of this one
+    /// could use it instead (see ShaderInstance::replace_master)?
+    bool same_params (const ShaderMaster &other) const;
+
+    /// Number of instructions in the shader's code.
+    int num_ops () const { return (int)m_ops.size(); }
+
+    /// A hash of the shader's code, to tell apart different builds of a
+    /// shader with the same name.
+    size_t code_hash () const;
+
+    /// Retrieve a shared, read-only snapshot of the master's ops and
+    /// args, which instances start from instead of each taking their
+    /// own copy.  The master only holds it weakly, so it goes away once
+    /// the last instance has modified or discarded its code.
+    void shared_code (std::shared_ptr<OpcodeVec> &ops,
+                      std::shared_ptr<std::vector<int>> &args);
+
     int raytype_queries () const { return m_raytype_queries; }
 
     bool range_checking() const { return m_range_checking; }
@@ -403,6 +527,9 @@ private:
     int m_maincodebegin, m_maincodeend; ///< Main shader code range
     int m_raytype_queries;              ///< Bitmask of raytypes queried
     bool m_range_checking;              ///< Is range checking enabled for this shader?
+    std::weak_ptr<OpcodeVec> m_shared_ops;          ///< See shared_code()
+    std::weak_ptr<std::vector<int>> m_shared_args;  ///< See shared_code()
+    OIIO::spin_mutex m_shared_code_mutex;           ///< Guards the above
 
     friend class OSOReaderToMaster;
     friend class ShaderInstance;
@@ -428,6 +555,12 @@ public:
         std::vector<ClosureParam> params;
         // the needed size for the structure
         int                       struct_size;
+        // the alignment of a component holding the structure (never less
+        // than alignof(ClosureComponent)), and the bytes it takes (header
+        // and structure, padded to that alignment), which is the stride
+        // of a batch of them
+        int                       alignment;
+        int                       component_size;
         // Creation callbacks
         PrepareClosureFunc        prepare;
         SetupClosureFunc          setup;
@@ -454,6 +587,17 @@ private:
 
 
 
+/// Accuracy the transcendental shadeops (sin, exp, pow, ...) are bound at,
+/// set by the "math_precision" ShadingSystem or group attribute.
+enum class MathPrecision {
+    UNKNOWN = -1,      ///< Group only: use the ShadingSystem's
+    DEFAULT = 0,       ///< Whatever the build chose (USE_FAST_MATH)
+    FAST,              ///< OIIO fast_* approximations
+    ACCURATE           ///< System math library
+};
+
+
+
 class ShadingSystemImpl
 {
 public:
@@ -481,12 +625,16 @@ public:
                        TypeDesc type, void *val);
     bool LoadMemoryCompiledShader (string_view shadername,
                                    string_view buffer);
+    bool reload_shader (string_view shadername, string_view buffer);
     bool Parameter (ShaderGroup& group, string_view name, TypeDesc t,
                     const void *val, bool lockgeom);
     bool Parameter (string_view name, TypeDesc t, const void *val,
                     bool lockgeom);
     bool Shader (ShaderGroup& group, string_view shaderusage,
                  string_view shadername, string_view layername);
+    bool Shader (ShaderGroup& group, string_view shaderusage,
+                 string_view shadername, string_view layername,
+                 cspan<ParamValue> params);
     bool Shader (string_view shaderusage, string_view shadername,
                  string_view layername);
     ShaderGroupRef ShaderGroupBegin (string_view groupname = string_view());
@@ -497,6 +645,8 @@ public:
                          string_view dstlayer, string_view dstparam);
     bool ConnectShaders (string_view srclayer, string_view srcparam,
                          string_view dstlayer, string_view dstparam);
+    bool ConnectShaders (ShaderGroup& group,
+                         cspan<ShaderConnection> connections);
     ShaderGroupRef ShaderGroupBegin (string_view groupname,
                                      string_view usage,
                                      string_view groupspec);
@@ -530,12 +680,22 @@ public:
     }
     void message (const std::string &message) const;
 
+    /// Report a message of any kind, as error(), warning(), etc. would,
+    /// but with the caller already holding m_errmutex (so that a context
+    /// can pass on a whole batch of buffered messages under one lock).
+    void report_locked (ErrorHandler::ErrCode code,
+                        const std::string &message) const;
+
     std::string getstats (int level=1) const;
 
     ErrorHandler &errhandler () const { return *m_err; }
 
     ShaderMaster::ref loadshader (string_view name);
 
+    bool preload_shaders (cspan<ustring> shadernames, int nthreads);
+
+    bool add_shader_bundle (string_view filename);
+
     PerThreadInfo * create_thread_info();
 
     void destroy_thread_info (PerThreadInfo *threadinfo);
@@ -545,10 +705,21 @@ public:
 
     void release_context (ShadingContext *ctx);
 
+    void reserve_contexts (int count, size_t heapsize);
+
     bool execute (ShadingContext &ctx, ShaderGroup &group, int shadeindex,
                   ShaderGlobals &ssg, void* userdata_base_ptr,
                   void* output_base_ptr, bool run=true);
 
+    bool execute_many (ShadingContext &ctx, ShaderGroup &group,
+                       span<ShaderGlobals> globals, cspan<int> shadeindices,
+                       void* userdata_base_ptr, void* output_base_ptr);
+
+    /// Re-execute the points of a "capture" stream; see
+    /// ShadingSystem::replay.
+    int replay (string_view filename, int iterations,
+                PerThreadInfo *threadinfo);
+
     const void* get_symbol (ShadingContext &ctx, ustring layername,
                             ustring symbolname, TypeDesc &type);
 
@@ -562,12 +733,20 @@ public:
     ///
     RendererServices *renderer () const { return m_renderer; }
 
-    /// Return a pointer to the texture system.
-    ///
-    TextureSystem *texturesys () const { return m_texturesys; }
+    /// Return a pointer to the texture system.  It's found (or made)
+    /// the first time it's asked for, so that a ShadingSystem that never
+    /// needs one doesn't pay for it.
+    TextureSystem *texturesys () const {
+        std::call_once (m_texturesys_once, [this]{ init_texturesys (); });
+        return m_texturesys;
+    }
 
     bool debug_nan () const { return m_debugnan; }
     bool debug_uninit () const { return m_debug_uninit; }
+    /// debug_nan and debug_uninit as they apply to the scalar code of the
+    /// group: with debug_sample, only its debug variant has the checks.
+    bool debug_nan (const ShaderGroup &group) const;
+    bool debug_uninit (const ShaderGroup &group) const;
     bool lockgeom_default () const { return m_lockgeom_default; }
     bool strict_messages() const { return m_strict_messages; }
     bool range_checking() const { return m_range_checking; }
@@ -576,6 +755,20 @@ public:
     bool relaxed_param_typecheck() const { return m_relaxed_param_typecheck; }
     int optimize () const { return m_optimize; }
     int llvm_optimize () const { return m_llvm_optimize; }
+    /// The LLVM pipeline preset to use for the group: its own, if it set
+    /// one, otherwise the ShadingSystem's.
+    OptPreset llvm_opt_preset (const ShaderGroup &group) const;
+    /// The math precision to use for the group: its own, if it set one,
+    /// otherwise the ShadingSystem's.
+    MathPrecision math_precision (const ShaderGroup &group) const;
+    /// Prefix ("", "fast_" or "accurate_") to insert before the name of
+    /// the shadeop implementing 'opname' for the group's math precision.
+    const char *math_precision_prefix (const ShaderGroup &group,
+                                       ustring opname) const;
+    /// The width (8 or 16) to run the group batched at: its own, if it
+    /// set one, else the one it was already JITed at, else an estimate
+    /// from its optimized code.
+    int batch_width (const ShaderGroup &group) const;
     int llvm_debug () const { return m_llvm_debug; }
     int llvm_debug_layers () const { return m_llvm_debug_layers; }
     int llvm_debug_ops () const { return m_llvm_debug_ops; }
@@ -587,9 +780,32 @@ public:
     bool fold_getattribute () const { return m_opt_fold_getattribute; }
     bool opt_texture_handle () const { return m_opt_texture_handle; }
     int opt_passes() const { return m_opt_passes; }
+    float opt_pass_min_change () const { return m_opt_pass_min_change; }
+    float opt_time_budget_ms () const { return m_opt_time_budget_ms; }
+    bool opt_groupdata_layout () const { return m_opt_groupdata_layout; }
+    bool opt_groupdata_share () const { return m_opt_groupdata_share; }
+    bool opt_message_slots () const { return m_opt_message_slots; }
+    bool opt_upfront_layers () const { return m_opt_upfront_layers; }
     int max_warnings_per_thread() const { return m_max_warnings_per_thread; }
+    int context_pool_KB() const { return m_context_pool_KB; }
+    bool huge_pages() const { return m_huge_pages; }
     bool countlayerexecs() const { return m_countlayerexecs; }
+    bool batched_lane_stats() const { return m_batched_lane_stats; }
     bool lazy_userdata () const { return m_lazy_userdata; }
+    bool cache_lookups () const { return m_cache_lookups; }
+    /// Is name one of the "object_attributes", constant over an object?
+    bool is_object_attribute (ustring name) const {
+        return std::find (m_object_attributes.begin(),
+                          m_object_attributes.end(), name)
+               != m_object_attributes.end();
+    }
+    float closure_weight_threshold () const { return m_closure_weight_threshold; }
+    bool pointcloud_bake_index () const { return m_pointcloud_bake_index; }
+    bool pointcloud_bake_pages () const { return m_pointcloud_bake_pages; }
+    size_t pointcloud_cache_bytes () const {
+        return size_t(std::max (m_pointcloud_max_memory_MB, 0)) << 20;
+    }
+    bool cache_textureinfo () const { return m_cache_textureinfo; }
     bool userdata_isconnected () const { return m_userdata_isconnected; }
     int profile() const { return m_profile; }
     bool no_noise() const { return m_no_noise; }
@@ -622,6 +838,48 @@ public:
     /// symbol tables down to just parameters.
     void group_post_jit_cleanup (ShaderGroup &group);
 
+    /// Return an optimized group whose instances can_unoptimize() to its
+    /// state before optimization, so that the next use of it optimizes
+    /// and JITs it again.
+    void unoptimize_group (ShaderGroup &group);
+
+    /// Make the named parameters of the group instance_parameters, read
+    /// at execution from the userdata arena rather than compiled in.
+    bool set_instance_parameters (ShaderGroup &group,
+                                  cspan<const char *> names);
+
+    /// For raytype_variants: return the copy of the group specialized for
+    /// the ray types in raytype that its shaders query, making it if
+    /// we've room for another, or else the group itself.
+    ShaderGroup& raytype_variant (ShaderGroup &group, int raytype);
+
+    /// For output_variants: return the copy of the group specialized to
+    /// compute only the named outputs, making it if we've room for
+    /// another, or else the group itself.
+    ShaderGroup& output_variant (ShaderGroup &group, cspan<ustring> outputs);
+
+    /// For debug_sample: return the copy of the group compiled with the
+    /// debug_nan/debug_uninit checks, making it the first time, or the
+    /// group itself if it has none.
+    ShaderGroup& debug_variant (ShaderGroup &group);
+
+    /// For dedupe_groups: return the first group seen that is identical
+    /// to this one, whose compiled code it runs, or else the group itself.
+    ShaderGroup& dedupe_group (ShaderGroup &group);
+
+    /// The per-layer profile (profile >= 2) that released contexts have
+    /// merged for the group, including that of its raytype variants.
+    std::vector<LayerProfile> layer_profile (const ShaderGroup &group) const;
+
+    /// For profile >= 3: the id under which the runtime profile of the
+    /// call op makes is kept, the same for every op of that name at the
+    /// same source file and line.
+    int call_site (const Opcode &op);
+
+    /// For profile >= 4: the id under which the execution count of a basic
+    /// block is kept, given the source file and the lines its ops are on.
+    int profile_block (ustring sourcefile, const std::vector<int> &lines);
+
     int *alloc_int_constants (size_t n) { return m_int_pool.alloc (n); }
     float *alloc_float_constants (size_t n) { return m_float_pool.alloc (n); }
     ustring *alloc_string_constants (size_t n) { return m_string_pool.alloc (n); }
@@ -642,13 +900,44 @@ public:
 
     int raytype_bit (ustring name);
 
-    void optimize_all_groups (int nthreads=0, int mythread=0, int totalthreads=1, bool do_jit=true);
+    typedef ShadingSystem::ParallelFor ParallelFor;
+    typedef ShadingSystem::JitCacheFetch JitCacheFetch;
+    typedef ShadingSystem::JitCacheStore JitCacheStore;
+
+    void jit_cache (const JitCacheFetch &fetch, const JitCacheStore &store) {
+        m_jit_cache_fetch = fetch;
+        m_jit_cache_store = store;
+    }
+    bool jit_cache_enabled () const {
+        return m_jit_cache_fetch || ! m_jit_cache_dir.empty();
+    }
+    /// The key under which the group's code is kept in the JIT cache.
+    std::string jit_cache_key (const ShaderGroup &group, const std::string &spec);
+    /// Look up the group's code in the JIT cache, setting its
+    /// precompiled code if found.
+    bool jit_cache_fetch (ShaderGroup &group);
+    /// Map the group's jit_cache_dir file, if there is one.
+    bool jit_cache_map (ShaderGroup &group);
+    void jit_cache_store (const std::string &key, const std::string &object);
+
+    void optimize_all_groups (int nthreads=0, bool do_jit=true,
+                              const ParallelFor &parallel_for = {});
+
+    /// For optimize_all_groups and jit_all_groups: compile() each complete
+    /// group that needs_compile(), given a context of the thread doing
+    /// it, on nthreads threads of our own (or the renderer's
+    /// parallel_for), each of which takes the next group as it is free.
+    /// The biggest groups, by their instructions, go first.
+    void compile_all_groups (int nthreads, const ParallelFor &parallel_for,
+                             const std::function<bool (const ShaderGroup&)> &needs_compile,
+                             const std::function<void (ShaderGroup&, ShadingContext*)> &compile);
 
     typedef std::unordered_map<ustring,OpDescriptor,ustringHash> OpDescriptorMap;
 
     /// Look up OpDescriptor for the named op, return NULL for unknown op.
     ///
     const OpDescriptor *op_descriptor (ustring opname) {
+        std::call_once (m_op_descriptors_once, [this]{ setup_op_descriptors (); });
         OpDescriptorMap::const_iterator i = m_op_descriptor.find (opname);
         if (i != m_op_descriptor.end())
             return &(i->second);
@@ -658,6 +947,42 @@ public:
 
     void pointcloud_stats (int search, int get, int results, int writes=0);
 
+    /// The dictionaries (parsed XML and resolved queries) shared by all
+    /// of this shading system's contexts, created on first use.
+    Dictionary &dictionary ();
+
+    /// Return the compiled regex for a pattern, compiling it the first
+    /// time any context (or the optimizer) asks for it.  Throws
+    /// std::regex_error for an invalid pattern.
+    const CompiledRegex &find_regex (ustring pattern);
+
+    /// Return the split form of a JIT-rewritten printf format string with
+    /// the given argument types (one FormatSpec::ArgType char each).  The
+    /// result lives as long as the shading system, so generated code may
+    /// embed its address.
+    const FormatSpec *format_spec (string_view format, string_view types);
+
+    /// The shared cache of gettextureinfo results for "cache_textureinfo":
+    /// copy a remembered result into 'data' and return true, or return
+    /// false if there is none yet.
+    bool find_textureinfo (ustring filename, int subimage, ustring dataname,
+                           TypeDesc type, void *data);
+    /// Remember a successful gettextureinfo result.
+    void add_textureinfo (ustring filename, int subimage, ustring dataname,
+                          TypeDesc type, const void *data);
+
+    /// Resolve dictionary lookups with constant arguments while
+    /// optimizing.  Node IDs are shared by all contexts, so results found
+    /// now stay valid at run time.  The fold_dict_find calls return false
+    /// -- reporting no error and remembering no failed document -- when
+    /// the lookup would have produced an error, so that it is left to run
+    /// time to report.
+    bool fold_dict_find (ustring dictionaryname, ustring query, int &result);
+    bool fold_dict_find (int nodeID, ustring query, int &result);
+    int fold_dict_next (int nodeID);
+    int fold_dict_value (int nodeID, ustring attribname, TypeDesc type,
+                         void *data);
+
     /// Is the named symbol among the renderer outputs?
     bool is_renderer_output (ustring layername, ustring paramname,
                              ShaderGroup *group) const;
@@ -666,12 +991,30 @@ public:
     /// archive.
     bool archive_shadergroup (ShaderGroup& group, string_view filename);
 
-    void count_noise (int number=1) { m_stat_noise_calls += number; }
+    bool prefetch_textures (ShaderGroup &group, int nthreads, bool wait);
+
+    /// Queue the group to be optimized and JITed by the async_optimize
+    /// threads, unless it's queued already or done, returning the future
+    /// that says when it's ready.
+    std::shared_future<bool> optimize_group_async (ShaderGroup &group);
+
+    void constant_attribute (ustring object, ustring name, TypeDesc type,
+                             const void *val);
+    void clear_constant_attributes ();
+    /// Retrieve a constant_attribute value of the given type (or, if index
+    /// >= 0, that element of it) into val, returning whether there is one.
+    bool find_constant_attribute (ustring object, ustring name,
+                                  TypeDesc type, int index, void *val) const;
 
     ColorSystem& colorsystem() { return m_colorsystem; }
 
     std::shared_ptr<OIIO::ColorConfig> colorconfig();
 
+    /// The OCIO processor for a (from, to) color space pair, created the
+    /// first time any context asks for it and shared ever after.
+    OIIO::ColorProcessorHandle ocio_processor (ustring fromspace,
+                                               ustring tospace);
+
 #if OSL_USE_BATCHED
     // Group all batched methods behind a templated interface
     // so we can support multiple widths
@@ -687,7 +1030,8 @@ public:
         /// Ensure that the group has been JITed.
         void jit_group (ShaderGroup &group, ShadingContext *ctx);
 
-        void jit_all_groups (int nthreads=0, int mythread=0, int totalthreads=1);
+        void jit_all_groups (int nthreads=0,
+                             const ParallelFor &parallel_for = {});
     };
 
     template<int WidthT>
@@ -719,6 +1063,17 @@ private:
     ConnectedParam decode_connected_param (string_view connectionname,
                                string_view layername, ShaderInstance *inst);
 
+    /// The same for a parameter given by its index among the parameters
+    /// of layer 'layer' (which must exist), plus an optional array
+    /// element and component, for the bulk form of ConnectShaders.
+    ConnectedParam decode_connected_param (ShaderGroup& group, int layer,
+                               int param, int arrayindex, int channel);
+
+    /// Record a connection whose ends have been checked by ConnectShaders.
+    void connect_layers (ShaderGroup& group,
+                         int srclayer, const ConnectedParam &srccon,
+                         int dstlayer, const ConnectedParam &dstcon);
+
     /// Get the per-thread info, create it if necessary.
     // N.B. This will be DEPRECATED (as will the m_perthread_info itself)
     // in OSL 2.1 when we fully require the app to allocate the per-thread
@@ -737,9 +1092,11 @@ private:
     void SetupLLVM ();
 
     void setup_op_descriptors ();
+    void init_texturesys () const;
 
     RendererServices *m_renderer;         ///< Renderer services
-    TextureSystem *m_texturesys;          ///< Texture system
+    mutable TextureSystem *m_texturesys;  ///< Texture system (see texturesys())
+    mutable std::once_flag m_texturesys_once;
 
     ErrorHandler *m_err;                  ///< Error handler
     mutable std::list<std::string> m_errseen, m_warnseen;
@@ -748,17 +1105,22 @@ private:
 
     typedef std::map<ustring,ShaderMaster::ref> ShaderNameMap;
     ShaderNameMap m_shader_masters;       ///< name -> shader masters map
+    typedef std::map<ustring,std::shared_future<ShaderMaster::ref>> ShaderLoadMap;
+    ShaderLoadMap m_shader_loads;         ///< masters being read right now
+    std::vector<std::shared_ptr<ShaderBundle>> m_shader_bundles; ///< Searched before the searchpath
 
     ConstantPool<int> m_int_pool;
     ConstantPool<Float> m_float_pool;
     ConstantPool<ustring> m_string_pool;
 
     OpDescriptorMap m_op_descriptor;
+    std::once_flag m_op_descriptors_once;  ///< Set up on first lookup
 
     // Pre-compiled support library
     std::vector<char> m_lib_bitcode;      ///> Container for the pre-compiled library bitcode
 
     std::vector<char> m_rs_bitcode;       ///> Container for the pre-compiled renderer services free function bitcode
+    std::vector<char> m_batched_rs_bitcode;  ///> Pre-compiled batched renderer services free function bitcode
 
     // Options
     int m_statslevel;                     ///< Statistics level
@@ -767,11 +1129,23 @@ private:
     bool m_lazyunconnected;               ///< Run lazily even if not connected?
     bool m_lazyerror;                     ///< Run lazily even if it has error op
     bool m_lazy_userdata;                 ///< Retrieve userdata lazily?
+    bool m_cache_lookups;                 ///< Cache named matrix/attribute lookups per execute?
+    bool m_deferred_trace;                ///< Record trace() calls for the renderer to batch?
+    float m_closure_weight_threshold;     ///< Drop closures weighted less than this
+    bool m_pointcloud_bake_index;         ///< Write search index files with baked clouds?
+    bool m_pointcloud_bake_pages;         ///< Write paged copies of baked clouds?
+    int m_pointcloud_max_memory_MB;       ///< Page cache size for paged clouds
+    bool m_cache_textureinfo;             ///< Share gettextureinfo results across contexts?
     bool m_userdata_isconnected;          ///< Userdata params isconnected()?
     bool m_clearmemory;                   ///< Zero mem before running shader?
     bool m_debugnan;                      ///< Root out NaN's?
     bool m_debug_uninit;                  ///< Find use of uninitialized vars?
+    int m_debug_sample;                   ///< Run debug checks 1 in N times
     bool m_lockgeom_default;              ///< Default value of lockgeom
+    bool m_reparam_reoptimize;            ///< ReParameter may re-optimize
+    int m_raytype_variants;               ///< Max raytype variants per group
+    int m_output_variants;                ///< Max output variants per group
+    bool m_dedupe_groups;                 ///< Share code of identical groups?
     bool m_strict_messages;               ///< Strict checking of message passing usage?
     bool m_error_repeats;                 ///< Allow repeats of identical err/warn?
     bool m_range_checking;                ///< Range check arrays & components?
@@ -779,6 +1153,7 @@ private:
     bool m_connection_error;              ///< Error for ConnectShaders to fail?
     bool m_greedyjit;                     ///< JIT as much as we can?
     bool m_countlayerexecs;               ///< Count number of layer execs?
+    bool m_batched_lane_stats;            ///< Count active batch lanes?
     bool m_relaxed_param_typecheck;       ///< Allow parameters to be set from isomorphic types (same data layout)
     int m_max_warnings_per_thread;        ///< How many warnings to display per thread before giving up?
     int m_profile;                        ///< Level of profiling of shader execution
@@ -796,23 +1171,52 @@ private:
     bool m_opt_merge_instances_with_userdata; ///< Merge identical instances if they have userdata?
     bool m_opt_fold_getattribute;         ///< Constant-fold getattribute()?
     bool m_opt_middleman;                 ///< Middle-man optimization?
+    bool m_opt_cross_layer_cse;           ///< Share ops across layers?
     bool m_opt_texture_handle;            ///< Use texture handles?
     bool m_opt_seed_bblock_aliases;       ///< Turn on basic block alias seeds
     bool m_opt_batched_analysis;          ///< Perform extra analysis required for batched execution?
+    int m_opt_batched_coherent_branches;  ///< Max ops to copy for coherent ifs
+    bool m_opt_loop_invariants;           ///< Hoist loop-invariant ops?
+    bool m_opt_transient_strings;         ///< Scratch-arena temp strings?
+    bool m_opt_range_checks;              ///< Skip provably-safe range checks?
+    bool m_opt_texture_coalesce;          ///< Merge adjacent-channel lookups?
+    bool m_opt_deriv_axes;                ///< Track x and y derivs apart?
+    int m_opt_memoize_instances;          ///< Max optimized layers to reuse
+    int m_opt_parallel_layers;            ///< Threads for per-layer opt passes
+    bool m_opt_groupdata_layout;          ///< Hot groupdata fields first?
+    bool m_opt_groupdata_share;           ///< Overlap layer-private params?
+    bool m_opt_message_slots;             ///< Group data slots for messages?
+    bool m_opt_upfront_layers;            ///< Run sure-needed layers first?
     bool m_llvm_jit_fma;                  ///< Allow fused multiply/add in JIT
     bool m_llvm_jit_aggressive;           ///< Turn on llvm "aggressive" JIT
+    bool m_llvm_jit_orc;                  ///< Use the shared ORC LLJIT
+    bool m_llvm_jit_lazy;                 ///< ORC: compile funcs on first call
+    bool m_llvm_jit_tiered;               ///< Quick JIT first, re-JIT later
+    int m_llvm_pgo_samples;               ///< Profile this many, then re-JIT
+    bool m_llvm_aot_output;               ///< Keep precompiled group code
+    int m_max_jit_memory_MB;              ///< Evict groups beyond this JIT mem
+    int m_async_optimize;                 ///< Background optimize threads
+    ustring m_llvm_aot_isas;              ///< ISAs of precompiled code
+    ustring m_ptx_cache_dir;              ///< Where to cache group PTX
+    ustring m_jit_cache_dir;              ///< Where to share group code
+    JitCacheFetch m_jit_cache_fetch;      ///< Renderer's shared code store
+    JitCacheStore m_jit_cache_store;
     bool m_optimize_nondebug;             ///< Fully optimize non-debug!
     ustring m_llvm_jit_target;            ///< ISA target for JIT
     int m_vector_width;                   ///< SIMD width maximum (8)
     int m_opt_passes;                     ///< Opt passes per layer
+    float m_opt_pass_min_change;          ///< Pass change (of ops) to go on
+    float m_opt_time_budget_ms;           ///< Optimizer time per group
     int m_llvm_optimize;                  ///< OSL optimization strategy
+    OptPreset m_llvm_opt_preset;          ///< New pass manager pipeline
+    MathPrecision m_math_precision;       ///< Transcendental op accuracy
     int m_debug;                          ///< Debugging output
     int m_llvm_debug;                     ///< More LLVM debugging output
     int m_llvm_debug_layers;              ///< Add layer enter/exit printfs
     int m_llvm_debug_ops;                 ///< Add printfs to every op
     int m_llvm_target_host;               ///< Target specific host architecture
     int m_llvm_debugging_symbols;         ///< Generate GDB compatible debug info during JIT
-    int m_llvm_profiling_events;          ///< Emit Intel profiling events during JIT
+    int m_llvm_profiling_events;          ///< Emit profiling events during JIT (LLVM_Util::ProfilingEvents)
     int m_llvm_output_bitcode;            ///< Output bitcode for each group
     int m_llvm_dumpasm;                   ///< Output CPU asm of the JIT
     ustring m_llvm_prune_ir_strategy;     ///< LLVM IR pruning strategy
@@ -829,8 +1233,12 @@ private:
     ustring m_commonspace_synonym;        ///< Synonym for "common" space
     std::vector<ustring> m_raytypes;      ///< Names of ray types
     std::vector<ustring> m_renderer_outputs; ///< Names of renderer outputs
+    std::vector<ustring> m_object_attributes; ///< Constant over an object
     std::vector<SymLocationDesc> m_symlocs;
     int m_max_local_mem_KB;               ///< Local storage can a shader use
+    int m_context_pool_KB;                ///< Preallocated pool per context
+    bool m_numa_local;                    ///< Keep contexts on their NUMA node?
+    bool m_huge_pages;                    ///< Huge pages for JIT code & heaps?
     bool m_compile_report;                ///< Print compilation report?
     bool m_buffer_printf;                 ///< Buffer/batch printf output?
     bool m_no_noise;                      ///< Substitute trivial noise calls
@@ -845,6 +1253,10 @@ private:
     ustring m_colorspace;                 ///< What RGB colors mean
     ColorSystem m_colorsystem;            ///< Data for current colorspace
     std::shared_ptr<OIIO::ColorConfig> m_colorconfig;  ///< OIIO/OCIO color configuration
+    using OCIOProcessorMap = std::map<std::pair<ustring, ustring>,
+                                      OIIO::ColorProcessorHandle>;
+    OCIOProcessorMap m_ocio_processors;   ///< By (from, to), for all contexts
+    spin_mutex m_ocio_processors_mutex;   ///< Guards m_ocio_processors
 
     // Thread safety
     mutable mutex m_mutex;
@@ -859,9 +1271,23 @@ private:
     atomic_int m_stat_groupinstances;     ///< Stat: total inst in all groups
     atomic_int m_stat_instances_compiled; ///< Stat: instances compiled
     atomic_int m_stat_groups_compiled;    ///< Stat: groups compiled
+    atomic_int m_stat_groups_rejitted;    ///< Stat: tiered groups re-JITed
+    atomic_int m_stat_groups_pgo_rejitted;///< Stat: groups re-JITed with PGO
+    atomic_int m_stat_groups_precompiled; ///< Stat: groups loaded, not JITed
     atomic_int m_stat_empty_instances;    ///< Stat: shaders empty after opt
     atomic_int m_stat_merged_inst;        ///< Stat: number of merged instances
     atomic_int m_stat_merged_inst_opt;    ///< Stat: merged insts after opt
+    atomic_int m_stat_memoized_opt_steps; ///< Stat: layer opts memoized
+    atomic_int m_stat_raytype_variants;   ///< Stat: raytype variants made
+    atomic_int m_stat_output_variants;    ///< Stat: output variants made
+    atomic_int m_stat_groups_dedupe_checked; ///< Stat: groups checked for dups
+    atomic_int m_stat_groups_deduped;     ///< Stat: groups sharing code
+    atomic_int m_stat_groups_evicted;     ///< Stat: groups evicted (JIT mem)
+    atomic_int m_stat_ptx_cache_hits;     ///< Stat: group PTX from the cache
+    atomic_int m_stat_ptx_cache_misses;   ///< Stat: group PTX not in cache
+    atomic_int m_stat_jit_cache_hits;     ///< Stat: group code from the cache
+    atomic_int m_stat_jit_cache_misses;   ///< Stat: group code not in cache
+    atomic_ll m_stat_jit_memory_evicted;  ///< Stat: JIT bytes evicted
     atomic_int m_stat_empty_groups;       ///< Stat: groups empty after opt
     atomic_int m_stat_regexes;            ///< Stat: how many regex's compiled
     atomic_int m_stat_preopt_syms;        ///< Stat: pre-optimization symbols
@@ -870,6 +1296,10 @@ private:
     atomic_int m_stat_preopt_ops;         ///< Stat: pre-optimization ops
     atomic_int m_stat_postopt_ops;        ///< Stat: post-optimization ops
     atomic_int m_stat_middlemen_eliminated; ///< Stat: middlemen eliminated
+    atomic_int m_stat_cross_layer_cse;    ///< Stat: ops shared across layers
+    atomic_int m_stat_groupdata_bytes_shared; ///< Stat: groupdata overlapped
+    atomic_int m_stat_peak_closure_bytes; ///< Stat: most closure pool used
+    atomic_int m_stat_peak_scratch_bytes; ///< Stat: most scratch pool used
     atomic_int m_stat_const_connections;  ///< Stat: const connections elim'd
     atomic_int m_stat_global_connections; ///< Stat: global connections elim'd
     atomic_int m_stat_tex_calls_codegened;///< Stat: total texture calls
@@ -883,6 +1313,7 @@ private:
     double m_stat_llvm_irgen_time;        ///<     llvm IR generation time
     double m_stat_llvm_opt_time;          ///<     llvm IR optimization time
     double m_stat_llvm_jit_time;          ///<     llvm JIT time
+    double m_stat_llvm_opt_preset_time[int(OptPreset::COUNT)]; ///< opt time by preset
     double m_stat_inst_merge_time;        ///< Stat: time merging instances
     double m_stat_getattribute_time;      ///< Stat: time spent in getattribute
     double m_stat_getattribute_fail_time; ///< Stat: time spent in getattribute
@@ -913,10 +1344,45 @@ private:
     PeakCounter<off_t> m_stat_mem_inst_connections;
 
     mutable spin_mutex m_stat_mutex;     ///< Mutex for non-atomic stats
+    // Call sites (profile >= 3) by id, and the ids by source file, line
+    // and op name. Guarded by m_stat_mutex.
+    struct CallSite {
+        ustring opname, sourcefile;
+        int sourceline;
+        CallSiteProfile profile;
+    };
+    std::vector<CallSite> m_call_sites;
+    std::map<std::tuple<ustring,int,ustring>, int> m_call_site_ids;
+    // Basic blocks (profile >= 4) by id, and the ids by source file and
+    // lines. Also guarded by m_stat_mutex.
+    struct ProfileBlock {
+        ustring sourcefile;
+        std::vector<int> lines;
+        long long execs;
+    };
+    std::vector<ProfileBlock> m_profile_blocks;
+    std::map<std::pair<ustring,std::vector<int>>, int> m_profile_block_ids;
+    // Annotated source listing of the block execution counts
+    std::string profile_block_listing (int level) const;
     ClosureRegistry m_closure_registry;
     std::vector<std::weak_ptr<ShaderGroup> > m_all_shader_groups;
     mutable spin_mutex m_all_shader_groups_mutex;
 
+    // Runtime-optimized layers by memo key, for opt_memoize_instances.
+    std::unordered_map<std::string, std::shared_ptr<const OptimizedInstance>> m_optimized_instances;
+    mutable spin_mutex m_optimized_instances_mutex;
+
+    // Renderer attributes declared constant (constant_attribute), by
+    // object and name: their type and value.
+    std::map<std::pair<ustring,ustring>,
+             std::pair<TypeDesc, std::vector<char>>> m_constant_attributes;
+    mutable spin_mutex m_constant_attributes_mutex;
+
+    // Groups that may be shared by identical ones (dedupe_groups), by the
+    // hash of their specification.
+    std::unordered_multimap<size_t, std::weak_ptr<ShaderGroup>> m_dedupe_table;
+    mutex m_dedupe_mutex;
+
     // State for entering shader groups -- this is only for the
     // non-threadsafe calls to Parameter/etc that don't take a group
     // reference.
@@ -929,6 +1395,110 @@ private:
 
     LLVM_Util::ScopedJitMemoryUser m_llvm_jit_memory_user;
 
+    // Eviction of the least recently executed groups under
+    // max_jit_memory_MB. Groups note the epoch they last executed in, and
+    // each eviction pass starts a new one. Only groups no context has
+    // bound are evicted (see ShaderGroup::m_in_flight), so their code is
+    // freed at once.
+    void evict_jit_memory (ShaderGroup &keep);
+    std::atomic<int> m_jit_epoch {1};
+    mutex m_eviction_mutex;
+
+    // A weak reference to the group, or an empty one if it isn't among
+    // m_all_shader_groups (any more).
+    std::weak_ptr<ShaderGroup> weak_group_ref (ShaderGroup &group);
+
+    // Background re-JIT of groups that were first JITed with minimal
+    // optimization (llvm_jit_tiered), or instrumented (llvm_pgo_samples).
+    void tiered_rejit_enqueue (ShaderGroup &group);
+    void tiered_rejit_worker ();
+    std::mutex m_tiered_rejit_mutex;
+    std::condition_variable m_tiered_rejit_cond;
+    std::deque<std::weak_ptr<ShaderGroup>> m_tiered_rejit_queue;
+    std::thread m_tiered_rejit_thread;
+    bool m_tiered_rejit_exit = false;
+
+    // Background optimization of groups (async_optimize), by a pool of
+    // worker threads that only ever grows.
+    struct AsyncOptRequest {
+        std::weak_ptr<ShaderGroup> group;
+        std::shared_ptr<std::promise<bool>> promise;
+    };
+    void async_optimize_worker ();
+    std::mutex m_async_opt_mutex;
+    std::condition_variable m_async_opt_cond;
+    std::deque<AsyncOptRequest> m_async_opt_queue;
+    std::vector<std::thread> m_async_opt_threads;
+    bool m_async_opt_exit = false;
+
+    // Capture of executed points (the "capture" option) for replay: the
+    // stream, guarded by the mutex, and the groups already written to it.
+    bool open_capture (ustring filename);
+    void capture_point (ShadingContext &ctx, ShaderGroup &group,
+                        int shadeindex, const ShaderGlobals &sg);
+    ustring m_capture;                    ///< Capture file name
+    std::mutex m_capture_mutex;
+    OIIO::ofstream m_capture_out;
+    std::set<int> m_captured_groups;      ///< Ids of groups in the stream
+    std::atomic<bool> m_capturing {false};
+
+    // Background texture prefetch (prefetch_textures): a queue of files
+    // drained by a pool of worker threads that only ever grows.
+    void prefetch_worker ();
+    std::mutex m_prefetch_mutex;
+    std::condition_variable m_prefetch_cond;
+    std::deque<ustring> m_prefetch_queue;
+    std::set<ustring> m_prefetched;       ///< Already queued, ever
+    std::vector<std::thread> m_prefetch_threads;
+    int m_prefetch_busy = 0;              ///< Files being read right now
+    bool m_prefetch_exit = false;
+
+    // Contexts that belong to no thread: made ahead of time by
+    // reserve_contexts, or left behind by destroyed PerThreadInfos. Each
+    // list is a stack, pushed and popped at the back under its own spin
+    // lock, so taking a context is O(1) however many are spare.
+    // Only list 0 is used unless numa_local is set; then each NUMA node
+    // (modulo max_numa_nodes) has its own, so a context whose memory a
+    // thread on one node has touched isn't handed to a thread on another,
+    // and the last list holds the untouched ones from reserve_contexts.
+    static constexpr int max_numa_nodes = 8;
+    struct SpareContexts {
+        spin_mutex mutex;
+        std::vector<ShadingContext *> contexts;
+    };
+    SpareContexts m_spare_contexts[max_numa_nodes + 1];
+    int spare_list (int numa_node) const;
+    void push_spare_contexts (int list, cspan<ShadingContext *> contexts);
+    ShadingContext *pop_spare_context (int list);
+
+    Dictionary *m_dictionary = nullptr;   ///< Shared by all contexts
+    std::unordered_map<ustring, std::unique_ptr<CompiledRegex>, ustringHash> m_regexes;
+    spin_mutex m_regexes_mutex;           ///< Guards m_regexes
+    std::unordered_map<std::string, std::unique_ptr<FormatSpec>> m_format_specs;
+    spin_mutex m_format_specs_mutex;      ///< Guards m_format_specs
+    struct TextureInfoKey {
+        ustring filename, dataname;
+        TypeDesc type;
+        int subimage;
+        bool operator== (const TextureInfoKey &k) const {
+            return filename == k.filename && dataname == k.dataname
+                && type == k.type && subimage == k.subimage;
+        }
+    };
+    struct TextureInfoKeyHash {
+        size_t operator() (const TextureInfoKey &k) const {
+            size_t type = size_t(k.type.basetype)
+                        | size_t(k.type.aggregate) << 8
+                        | size_t(k.type.arraylen) << 16;
+            return k.filename.hash() ^ (k.dataname.hash() * 31)
+                 ^ (type * 131) ^ size_t(k.subimage);
+        }
+    };
+    std::unordered_map<TextureInfoKey, std::vector<char>, TextureInfoKeyHash> m_textureinfo;
+    OIIO::spin_rw_mutex m_textureinfo_mutex; ///< Guards m_textureinfo
+    spin_mutex m_dictionary_mutex;        ///< Guards creating it
+    void free_dict_resources ();
+
     friend class OSL::ShadingContext;
     friend class ShaderMaster;
     friend class ShaderInstance;
@@ -1047,7 +1617,7 @@ public:
 
     /// Apply pending parameters
     ///
-    void parameters (const ParamValueList &params);
+    void parameters (cspan<ParamValue> params);
 
     /// Find the named symbol, return its index in the symbol array, or
     /// -1 if not found.
@@ -1227,13 +1797,19 @@ public:
     int Psym () const { return m_Psym; }
     int Nsym () const { return m_Nsym; }
 
-    const std::vector<int> & args () const { return m_instargs; }
-    std::vector<int> & args () { return m_instargs; }
+    // The ops and args may be shared with the master or with memoized
+    // optimizer results.  Const access reads them in place; non-const
+    // access first makes a private copy if anybody else holds them.
+    const std::vector<int> & args () const { return shared_or_empty (m_instargs); }
+    std::vector<int> & args () { return copy_on_write (m_instargs); }
     int arg (int argnum) const { return args()[argnum]; }
     const Symbol *argsymbol (int argnum) const { return symbol(arg(argnum)); }
     Symbol *argsymbol (int argnum) { return symbol(arg(argnum)); }
-    const OpcodeVec & ops () const { return m_instops; }
-    OpcodeVec & ops () { return m_instops; }
+    const OpcodeVec & ops () const { return shared_or_empty (m_instops); }
+    OpcodeVec & ops () { return copy_on_write (m_instops); }
+
+    /// Release this instance's hold on its ops and args.
+    void clear_code () { m_instops.reset ();  m_instargs.reset (); }
     const Opcode & op (int opnum) const { return ops()[opnum]; }
     Opcode & op (int opnum) { return ops()[opnum]; }
     SymbolVec &symbols () { return m_instsymbols; }
@@ -1278,6 +1854,22 @@ public:
     /// Make our own version of the code and args from the master.
     void copy_code_from_master (ShaderGroup &group);
 
+    /// Remember the instance as it is before optimization, so that
+    /// unoptimize() can return to it (reparam_reoptimize).
+    void save_unoptimized ();
+
+    /// Is there a save_unoptimized() state to return to?
+    bool can_unoptimize () const { return m_unoptimized != nullptr; }
+
+    /// Discard the optimized code and return to the state saved by
+    /// save_unoptimized(), ready to be optimized again.
+    void unoptimize ();
+
+    /// Switch the unoptimized instance to a reloaded version of its
+    /// master, which must have the same_params().  Parameters left at
+    /// their defaults take the new master's defaults.
+    void replace_master (ShaderMaster::ref master);
+
     /// Check the params to re-assess writes_globals and userdata_params.
     /// Sorry, can't think of a short name that isn't too cryptic.
     void evaluate_writes_globals_and_userdata_params ();
@@ -1321,12 +1913,31 @@ public:
     /// equivalent, in that they may be merged into a single instance?
     bool mergeable (const ShaderInstance &b, const ShaderGroup &g) const;
 
+    /// A hash of what mergeable() requires to match -- the master, the
+    /// parameter values, and the connections -- so instances with
+    /// different signatures are never mergeable.
+    size_t merge_signature () const;
+
 private:
+    template<typename T>
+    static const T & shared_or_empty (const std::shared_ptr<T> &v) {
+        static const T empty;
+        return v ? *v : empty;
+    }
+    template<typename T>
+    static T & copy_on_write (std::shared_ptr<T> &v) {
+        if (! v)
+            v = std::make_shared<T> ();
+        else if (v.use_count() > 1)
+            v = std::make_shared<T> (*v);
+        return *v;
+    }
+
     ShaderMaster::ref m_master;         ///< Reference to the master
     SymOverrideInfoVec m_instoverrides; ///< Instance parameter info
     SymbolVec m_instsymbols;            ///< Symbols used by the instance
-    OpcodeVec m_instops;                ///< Actual code instructions
-    std::vector<int> m_instargs;        ///< Arguments for all the ops
+    std::shared_ptr<OpcodeVec> m_instops;        ///< Actual code instructions
+    std::shared_ptr<std::vector<int>> m_instargs; ///< Arguments for all the ops
     ustring m_layername;                ///< Name of this layer
     std::vector<int> m_iparams;         ///< int param values
     std::vector<float> m_fparams;       ///< float param values
@@ -1344,6 +1955,8 @@ private:
     int m_firstparam, m_lastparam;      ///< Subset of symbols that are params
     int m_maincodebegin, m_maincodeend; ///< Main shader code range
     int m_Psym, m_Nsym;                 ///< Quick lookups of common syms
+    struct Unoptimized;
+    std::unique_ptr<Unoptimized> m_unoptimized; ///< For unoptimize()
 
     friend class ShadingSystemImpl;
     friend class RuntimeOptimizer;
@@ -1400,6 +2013,23 @@ public:
         m_block_offset = 0;
     }
 
+    /// Make sure at least 'size' bytes of blocks are already allocated, so
+    /// that executions needing no more than that never call malloc.
+    void reserve (size_t size) {
+        while (m_blocks.size() * BlockSize < size)
+            m_blocks.emplace_back(new char[BlockSize]);
+    }
+
+    /// Bytes handed out since the last clear(), counting the unused tails
+    /// of any blocks already left behind.
+    size_t used () const {
+        return m_current_block * BlockSize
+               + std::min(m_block_offset, size_t(BlockSize));
+    }
+
+    /// Bytes of blocks allocated in total.
+    size_t capacity () const { return m_blocks.size() * BlockSize; }
+
 private:
     static inline size_t alignment_offset_calc(void* ptr, size_t alignment) {
         uintptr_t ptrbits = reinterpret_cast<uintptr_t>(ptr);
@@ -1413,6 +2043,106 @@ private:
     size_t  m_block_offset;     ///< Offset from the start of the current block
 };
 
+/// Open-addressed hash table from message name to message, used by
+/// MessageList and BatchedMessageBuffer so that finding a message doesn't
+/// mean walking all of them. Its slots are carved from the same SimplePool
+/// as the messages themselves, in chunks small enough for a pool block, so
+/// clearing the pool frees them too. Past MaxSlots it stops indexing and
+/// says so with complete(), and the owner goes back to walking its list.
+class MessageIndex {
+public:
+    MessageIndex () { }
+    MessageIndex (const MessageIndex &) = delete;
+    MessageIndex & operator= (const MessageIndex &) = delete;
+
+    void clear () {
+        m_nslots = 0;
+        m_count = 0;
+        m_complete = true;
+    }
+
+    /// Is every message the owner has added in the index?
+    bool complete () const { return m_complete; }
+
+    /// Return the message added under this name, or nullptr.
+    void *find (ustring name) const {
+        if (! m_nslots)
+            return nullptr;
+        size_t mask = m_nslots - 1;
+        for (size_t i = name.hash() & mask;  ;  i = (i + 1) & mask) {
+            const Slot &s (slot(i));
+            if (s.name == name)
+                return s.msg;
+            if (! s.msg)
+                return nullptr;
+        }
+    }
+
+    /// Add a message, the only one with this name.
+    template<class Pool>
+    void insert (ustring name, void *msg, Pool &pool) {
+        if (! m_complete)
+            return;
+        if ((m_count + 1) * 4 > m_nslots * 3) {  // keep load under 3/4
+            if (m_nslots == MaxSlots) {
+                m_complete = false;
+                return;
+            }
+            grow (pool);
+        }
+        place (name, msg);
+        ++m_count;
+    }
+
+private:
+    struct Slot {
+        ustring name;
+        void *msg = nullptr;
+    };
+    static constexpr size_t ChunkSlots = 32;   // 512 bytes of slots
+    static constexpr size_t MaxChunks = 16;
+    static constexpr size_t MaxSlots = ChunkSlots * MaxChunks;
+
+    Slot & slot (size_t i) const { return m_chunks[i / ChunkSlots][i % ChunkSlots]; }
+
+    void place (ustring name, void *msg) {
+        size_t mask = m_nslots - 1;
+        size_t i = name.hash() & mask;
+        while (slot(i).msg)
+            i = (i + 1) & mask;
+        slot(i).name = name;
+        slot(i).msg = msg;
+    }
+
+    template<class Pool>
+    void grow (Pool &pool) {
+        // The old slots stay in the pool until it's cleared
+        Slot *old[MaxChunks];
+        size_t oldslots = m_nslots;
+        std::copy (m_chunks, m_chunks + MaxChunks, old);
+        m_nslots = oldslots ? oldslots * 2 : 16;
+        size_t chunkslots = std::min (m_nslots, ChunkSlots);
+        for (size_t c = 0;  c * chunkslots < m_nslots;  ++c) {
+            char *mem = pool.alloc (chunkslots * sizeof(Slot), alignof(Slot));
+            m_chunks[c] = reinterpret_cast<Slot *>(mem);
+            for (size_t i = 0;  i < chunkslots;  ++i)
+                new (m_chunks[c] + i) Slot;
+        }
+        for (size_t i = 0;  i < oldslots;  ++i) {
+            const Slot &s (old[i / ChunkSlots][i % ChunkSlots]);
+            if (s.msg)
+                place (s.name, s.msg);
+        }
+    }
+
+    Slot *m_chunks[MaxChunks] = {};
+    size_t m_nslots = 0;            ///< Power of 2, or 0 before the first
+    size_t m_count = 0;
+    bool m_complete = true;
+};
+
+
+
 /// Represents a single message for use by getmessage and setmessage opcodes
 ///
 struct Message {
@@ -1433,6 +2163,25 @@ struct Message {
     Message* next;          ///< linked list of messages (managed by MessageList below)
 };
 
+/// With opt_message_slots, a message whose name every setmessage and
+/// getmessage of the group knows at compile time lives in one of these in
+/// the group data rather than on the MessageList. The message's data
+/// follows the header, and group init resets state.
+struct MessageSlot {
+    enum State { Empty = 0, Set = 1, Queried = 2 /* before being set */ };
+    int state;
+    int layeridx;           ///< layer that set (or queried) it
+    ustring sourcefile;     ///< where it was set (or queried)
+    int sourceline;
+
+    char *data () { return (char *)this + sizeof(MessageSlot); }
+    static size_t size_for (TypeDesc type) {
+        return (sizeof(MessageSlot) + type.size() + 7) & ~size_t(7);
+    }
+};
+
+
+
 /// Represents the list of messages set by a given shader using setmessage and getmessage
 ///
 struct MessageList {
@@ -1441,9 +2190,12 @@ struct MessageList {
      void clear() {
          list_head = NULL;
          message_data.clear();
+         index.clear();
      }
 
     const Message* find(ustring name) const {
+        if (index.complete())
+            return (const Message*) index.find(name);
         for (const Message* m = list_head; m != NULL; m = m->next)
             if (m->name == name)
                 return m; // name matches
@@ -1456,11 +2208,13 @@ struct MessageList {
             list_head->data = message_data.alloc(type.size());
             memcpy(list_head->data, data, type.size());
         }
+        index.insert(name, list_head, message_data);
     }
 
 private:
     Message*         list_head;
     SimplePool<1024> message_data;
+    MessageIndex     index;         ///< Finds messages by name
 };
 
 
@@ -1474,22 +2228,76 @@ struct BatchedMessageBuffer {
     void clear() {
         list_head = NULL;
         message_data.clear();
+        index.clear();
     }
 
     void * list_head;
     SimplePool<16*1024> message_data;
+    MessageIndex index;             ///< Finds messages by name
 };
 
 
 #endif
 
+
+/// Execution profile of one layer of a group (profile >= 2). The times
+/// are in OIIO::Timer ticks: 'ticks' includes the time in the layers it
+/// ran lazily, 'self_ticks' leaves them out.
+struct LayerProfile {
+    long long execs = 0;
+    long long ticks = 0;
+    long long self_ticks = 0;
+
+    LayerProfile& operator+= (const LayerProfile &p) {
+        execs += p.execs;
+        ticks += p.ticks;
+        self_ticks += p.self_ticks;
+        return *this;
+    }
+};
+
+/// Execution profile of one texture, getattribute or pointcloud call site
+/// (profile >= 3). The time is in OIIO::Timer ticks.
+struct CallSiteProfile {
+    long long calls = 0;
+    long long failures = 0;
+    long long ticks = 0;
+
+    CallSiteProfile& operator+= (const CallSiteProfile &p) {
+        calls += p.calls;
+        failures += p.failures;
+        ticks += p.ticks;
+        return *this;
+    }
+};
+
+/// What compiling a group has cost, for its stat:compile_* attributes.
+/// Times are in seconds. The optimizer's numbers are from its last run on
+/// the group; the LLVM times add up every JIT of it (scalar, batched and
+/// re-JITs).
+struct GroupCompileStats {
+    double specialization_time = 0;     ///< All of the runtime optimizer
+    std::vector<std::pair<const char*,double>> opt_pass_times; ///< Its parts
+    int opt_layer_runs = 0;             ///< Layers optimized (each direction)
+    int opt_layer_passes = 0;           ///< Passes over their code, in all
+    int opt_converged = 0;              ///< Runs that stopped changing
+    int opt_capped = 0;                 ///< Runs that hit opt_passes
+    int opt_budget_cutoffs = 0;         ///< Runs cut short by the budget
+    int preopt_ops = 0, postopt_ops = 0;
+    int preopt_syms = 0, postopt_syms = 0;
+    double llvm_setup_time = 0;
+    double llvm_irgen_time = 0;
+    double llvm_opt_time = 0;
+    double llvm_jit_time = 0;
+};
+
 }; // namespace pvt
 
 
 
 /// A ShaderGroup consists of one or more layers (each of which is a
 /// ShaderInstance), and the connections among them.
-class ShaderGroup {
+class ShaderGroup : public std::enable_shared_from_this<ShaderGroup> {
 public:
     ShaderGroup (string_view name);
     ShaderGroup (const ShaderGroup &g, string_view name);
@@ -1530,26 +2338,45 @@ public:
     size_t llvm_groupdata_wide_size () const { return m_llvm_groupdata_wide_size; }
     void llvm_groupdata_wide_size (size_t size) { m_llvm_groupdata_wide_size = size; }
 
-    RunLLVMGroupFunc llvm_compiled_version() const {
-        return m_llvm_compiled_version;
+    // The scalar entry points of one JIT of the group. A tiered re-JIT
+    // (see the llvm_jit_tiered attribute) builds a complete new set off to
+    // the side while other threads shade with the current one, and
+    // publishes it with a single atomic pointer store; a context loads the
+    // pointer once per execution, so it never mixes two JITs' functions.
+    // Replaced sets are kept, like the code they point into, until the
+    // group is freed or no context is running it (see m_in_flight).
+    struct LLVMEntryPoints {
+        RunLLVMGroupFunc init = nullptr;
+        RunLLVMGroupFunc version = nullptr;
+        std::vector<RunLLVMGroupFunc> layers;
+
+        RunLLVMGroupFunc layer (int layer) const {
+            return layer < (int)layers.size() ? layers[layer] : nullptr;
+        }
+    };
+    const LLVMEntryPoints *llvm_entry_points () const {
+        return m_llvm_entry_points.load (std::memory_order_acquire);
     }
-    void llvm_compiled_version (RunLLVMGroupFunc func) {
-        m_llvm_compiled_version = func;
+    void llvm_entry_points (std::unique_ptr<LLVMEntryPoints> entry) {
+        const LLVMEntryPoints *e = entry.get();
+        {
+            lock_guard state_lock (m_jit_state_mutex);
+            if (e)
+                m_llvm_entry_point_sets.push_back (std::move(entry));
+        }
+        m_llvm_entry_points.store (e, std::memory_order_release);
     }
-    RunLLVMGroupFunc llvm_compiled_init() const {
-        return m_llvm_compiled_init;
+    RunLLVMGroupFunc llvm_compiled_version() const {
+        const LLVMEntryPoints *e = llvm_entry_points();
+        return e ? e->version : nullptr;
     }
-    void llvm_compiled_init (RunLLVMGroupFunc func) {
-        m_llvm_compiled_init = func;
+    RunLLVMGroupFunc llvm_compiled_init() const {
+        const LLVMEntryPoints *e = llvm_entry_points();
+        return e ? e->init : nullptr;
     }
     RunLLVMGroupFunc llvm_compiled_layer (int layer) const {
-        return layer < (int)m_llvm_compiled_layers.size()
-                            ? m_llvm_compiled_layers[layer] : NULL;
-    }
-    void llvm_compiled_layer (int layer, RunLLVMGroupFunc func) {
-        m_llvm_compiled_layers.resize ((size_t)nlayers(), NULL);
-        if (layer < nlayers())
-            m_llvm_compiled_layers[layer] = func;
+        const LLVMEntryPoints *e = llvm_entry_points();
+        return e ? e->layer (layer) : nullptr;
     }
 
 #if OSL_USE_BATCHED
@@ -1608,6 +2435,17 @@ public:
     // empty, go back-to-front.
     const Symbol* find_symbol (ustring layername, ustring symbolname) const;
 
+    /// The group's precompiled code, wherever it is kept (empty if none).
+    string_view llvm_aot_object () const {
+        return m_llvm_aot_file ? m_llvm_aot_mapped
+                               : string_view (m_llvm_aot_object);
+    }
+
+    // Index every layer's symbols by name, so that find_symbol on the
+    // optimized group is a hash lookup rather than a scan of the layers
+    // and their symbols.  Done by optimize_group.
+    void build_symbol_index ();
+
     /// Return a unique ID of this group.
     ///
     int id () const { return m_id; }
@@ -1639,6 +2477,20 @@ public:
 
     int raytype_queries () const { return m_raytype_queries; }
 
+    /// For a copy made by output_variant, the outputs it computes (the
+    /// globals among them being the only ones its last layer sets);
+    /// empty for any other group.
+    const std::vector<ustring>& output_subset () const {
+        return m_output_subset;
+    }
+
+    /// The identical group whose compiled code this one runs (see the
+    /// dedupe_groups attribute), or nullptr if it runs its own.
+    ShaderGroup* dedupe_leader () const {
+        return m_dedupe_resolved.load (std::memory_order_acquire)
+                   ? m_dedupe_leader.get() : nullptr;
+    }
+
     /// Optionally set which ray types are known to be on or off (0 means
     /// not known at optimize time).
     void set_raytypes (int raytypes_on, int raytypes_off) {
@@ -1680,6 +2532,19 @@ public:
             return nullptr;
     }
 
+    /// The layout of the instance data block (see the instance_parameters
+    /// group attribute): where each instance parameter lives in it.
+    cspan<SymLocationDesc> instance_data () const { return m_instance_data; }
+    size_t instance_data_size () const { return m_instance_data_size; }
+
+    /// A new default TextureOpt that generated code may point to (as the
+    /// template for a texture call's options); it lives as long as the
+    /// group does.
+    TextureOpt *new_texture_opt () {
+        m_texture_opts.emplace_back ();
+        return &m_texture_opts.back();
+    }
+
 private:
     // Put all the things that are read-only (after optimization) and
     // needed on every shade execution at the front of the struct, as much
@@ -1687,30 +2552,57 @@ private:
     volatile int m_optimized = 0;    ///< Is it already optimized?
     volatile int m_jitted = 0;       ///< Is it already jitted?
     bool m_does_nothing = false;     ///< Is the shading group just func() { return; }
-    volatile int m_batch_jitted = 0; ///< Is it already jitted for batch execution?
+    volatile int m_batch_jitted = 0; ///< Width it was jitted at for batch execution, or 0
     size_t m_llvm_groupdata_size = 0;///< Heap size needed for its groupdata
     size_t m_llvm_groupdata_wide_size = 0;    ///< Heap size needed for its wide groupdata
     int m_id;                        ///< Unique ID for the group
     int m_num_entry_layers = 0;      ///< Number of marked entry layers
-    RunLLVMGroupFunc m_llvm_compiled_version = nullptr;
-    RunLLVMGroupFunc m_llvm_compiled_init = nullptr;
-    std::vector<RunLLVMGroupFunc> m_llvm_compiled_layers;
+    std::atomic<const LLVMEntryPoints *> m_llvm_entry_points {nullptr};
 #if OSL_USE_BATCHED
     RunLLVMGroupFuncWide m_llvm_compiled_wide_version = nullptr;
     RunLLVMGroupFuncWide m_llvm_compiled_wide_init = nullptr;
     std::vector<RunLLVMGroupFuncWide> m_llvm_compiled_wide_layers;
 #endif
+    // JITed code and data of the group (one for each time it was JITed:
+    // scalar, batched, re-JITs), and the entry points into the scalar
+    // ones, freed along with the group or when it's evicted. With
+    // llvm_jit_orc, freeing it removes the group's JITDylibs from the
+    // shared session.
+    std::vector<std::shared_ptr<LLVM_Util::JitMemory>> m_llvm_jit_memory;
+    std::vector<std::unique_ptr<LLVMEntryPoints>> m_llvm_entry_point_sets;
+    size_t m_llvm_jit_bytes = 0;     ///< Size of all of m_llvm_jit_memory
+    pvt::GroupCompileStats m_compile_stats; ///< What compiling it cost
+    std::atomic<int> m_last_executed {0};  ///< Epoch (max_jit_memory_MB)
+    // Contexts that have the group bound, from execute_init until
+    // execute_cleanup. Eviction (max_jit_memory_MB) only tears down a
+    // group with none, which it checks under m_mutex after setting
+    // m_evicting; a context binding it meanwhile sees the flag and waits
+    // for the eviction to finish.
+    std::atomic<int> m_in_flight {0};
+    std::atomic<bool> m_evicting {false};
     std::vector<ShaderInstanceRef> m_layers;
     ustring m_name;
     int m_exec_repeat = 1;           ///< How many times to execute group
+    int m_batch_width = 0;           ///< Width to batch-JIT at (0 = choose)
+    OptPreset m_llvm_opt_preset = OptPreset::UNKNOWN; ///< UNKNOWN: use shadingsys's
+    MathPrecision m_math_precision = MathPrecision::UNKNOWN; ///< UNKNOWN: use shadingsys's
     int m_raytype_queries = -1;      ///< Bitmask of raytypes queried
     int m_raytypes_on = 0;           ///< Bitmask of raytypes we assume to be on
     int m_raytypes_off = 0;          ///< Bitmask of raytypes we assume to be off
+    // Locking, always taken in this order: m_mutex for optimizing the
+    // group (and changing it), m_jit_mutex for its scalar code generation
+    // and m_batch_jit_mutex for its batched one, which can go on at the
+    // same time once it is optimized, and m_jit_state_mutex for what
+    // both of those update when done.
     mutable mutex m_mutex;           ///< Thread-safe optimization
+    mutex m_jit_mutex;               ///< Scalar JIT (and re-JITs)
+    mutex m_batch_jit_mutex;         ///< Batched JIT
+    mutex m_jit_state_mutex;         ///< JIT memory, stats, cleanup
     int m_globals_read = 0;
     int m_globals_write = 0;
     std::vector<ustring> m_textures_needed;
     std::vector<ustring> m_closures_needed;
+    std::vector<ustring> m_pointclouds_needed;
     std::vector<ustring> m_globals_needed;  // semi-deprecated
     std::vector<ustring> m_userdata_names;
     std::vector<TypeDesc> m_userdata_types;
@@ -1722,11 +2614,15 @@ private:
     std::vector<ustring> m_attribute_scopes;
     std::vector<ustring> m_renderer_outputs; ///< Names of renderer outputs
     std::vector<SymLocationDesc> m_symlocs; ///< SORTED!!
+    std::vector<SymLocationDesc> m_instance_data; ///< instance_parameters
+    size_t m_instance_data_size = 0;       ///< Bytes of instance data
+    std::deque<TextureOpt> m_texture_opts; ///< Templates JITed code uses
     bool m_unknown_textures_needed;
     bool m_unknown_closures_needed;
+    bool m_unknown_pointclouds_needed = false;
     bool m_unknown_attributes_needed;
+    int m_closure_pool_size = 0;      ///< Closure bytes per run, -1 unbounded
     atomic_ll m_executions {0};       ///< Number of times the group executed
-    atomic_ll m_stat_total_shading_time_ticks {0}; ///< Total shading time (ticks)
 
     // PTX assembly for compiled ShaderGroup
     std::string m_llvm_ptx_compiled_version;
@@ -1734,6 +2630,79 @@ private:
     ParamValueList m_pending_params;      ///< Pending Parameter() values
     ustring m_group_use;                  ///< "Usage" of group
     bool m_complete = false;              ///< Successfully ShaderGroupEnd?
+    bool m_tiered_rejit_pending = false;  ///< Awaiting fully optimized JIT?
+    // For async_optimize: the group to run while this one is compiled
+    // in the background, and the future of that compile, guarded by the
+    // shading system's m_async_opt_mutex. The flag is set while it's
+    // queued or compiling, so execute() needn't take the mutex.
+    ShaderGroupRef m_fallback_group;
+    std::shared_future<bool> m_async_opt_future;
+    std::atomic<bool> m_async_opt_pending {false};
+    // Branch profile of an llvm_pgo_samples instrumented JIT: for each
+    // branch, the times it was reached and the times it was true.
+    std::unique_ptr<uint64_t[]> m_pgo_counts;
+    int m_pgo_nbranches = 0;
+    // Precompiled code for the group (llvm_aot_output or registered).
+    std::string m_llvm_aot_object;
+    // Or precompiled code read in place from a mapped jit_cache_dir file,
+    // whose pages all the processes on the machine share: the file, and
+    // the code within it.
+    std::shared_ptr<MappedFile> m_llvm_aot_file;
+    string_view m_llvm_aot_mapped;
+    std::atomic<int> m_pgo_samples_left {0};  ///< Until the PGO re-JIT
+    // Per-layer profile (profile >= 2), added to by contexts as they're
+    // released. Protected by the shading system's m_stat_mutex.
+    std::vector<LayerProfile> m_layer_profile;
+    // Lane occupancy of batched execution (batched_lane_stats): the runs
+    // of each layer and the lanes that were on in them, then for all the
+    // group's varying loops together, the iterations and the lanes that
+    // entered the loop but sat them out. Also how many of the ops the
+    // batched analysis found to be uniform or varying.
+    std::unique_ptr<uint64_t[]> m_batched_lane_counts;
+    int m_batched_uniform_ops = 0;
+    int m_batched_varying_ops = 0;
+    // Copies specialized by ray type (raytype_variants): the group as it
+    // was specified, and the variants made from it so far, keyed by the
+    // queried ray types that are on. Entries below the count are final.
+    std::string m_raytype_variant_spec;
+    std::unique_ptr<std::pair<int,ShaderGroupRef>[]> m_raytype_variants;
+    int m_max_raytype_variants = 0;       ///< -1 for a variant itself
+    std::atomic<int> m_num_raytype_variants {0};
+    // Likewise the copies specialized to a subset of the outputs
+    // (output_variants), keyed by that subset, and for such a copy the
+    // subset it computes.
+    std::string m_output_variant_spec;
+    std::unique_ptr<std::pair<std::vector<ustring>,ShaderGroupRef>[]> m_output_variants;
+    int m_max_output_variants = 0;        ///< -1 for a variant itself
+    std::atomic<int> m_num_output_variants {0};
+    std::vector<ustring> m_output_subset;
+    // With debug_sample, the group as it was specified, and the copy of it
+    // made from that with the debug checks (state 1 once it's made, -1 if
+    // it couldn't be). m_is_debug_variant marks such a copy.
+    std::string m_debug_variant_spec;
+    ShaderGroupRef m_debug_variant;
+    std::atomic<int> m_debug_variant_state {0};
+    bool m_is_debug_variant = false;
+    // Sharing with identical groups (dedupe_groups): the group as it was
+    // specified and a hash of that, as of ShaderGroupEnd, and once it has
+    // been looked for among the groups already seen, the one it shares.
+    std::string m_dedupe_spec;
+    size_t m_dedupe_hash = 0;
+    ShaderGroupRef m_dedupe_leader;
+    std::atomic<bool> m_dedupe_resolved {false};
+    // Key of the group's code in the JIT cache (jit_cache_dir or
+    // ShadingSystem::jit_cache), or empty if it isn't cached.
+    std::string m_jit_cache_key;
+    // Optimized symbols by (layer name, symbol name), and by (empty,
+    // symbol name) for unqualified lookups, as the layer and the symbol
+    // index within it (see build_symbol_index).
+    struct SymbolKeyHash {
+        size_t operator() (const std::pair<ustring,ustring> &k) const {
+            return k.first.hash() * 31 + k.second.hash();
+        }
+    };
+    std::unordered_map<std::pair<ustring,ustring>, std::pair<int,int>,
+                       SymbolKeyHash> m_symbol_index;
 
     friend class OSL::pvt::ShadingSystemImpl;
     friend class OSL::pvt::BackendLLVM;
@@ -1781,6 +2750,13 @@ public:
     bool execute(ShaderGroup& group, int shadeindex, ShaderGlobals& globals,
                  void* userdata_base_ptr, void* output_base_ptr, bool run);
 
+    /// Execute the shader group on each of many shading points, setting up
+    /// for the group only once. (See similarly named method of
+    /// ShadingSystem.)
+    bool execute_many(ShaderGroup& group, span<ShaderGlobals> globals,
+                      cspan<int> shadeindices, void* userdata_base_ptr,
+                      void* output_base_ptr);
+
 #if OSL_USE_BATCHED
     // Group all batched methods behind a templated interface
     // so we can support multiple widths
@@ -1825,12 +2801,11 @@ public:
                       void* userdata_base_ptr, void* output_base_ptr,
                       bool run=true);
 
-        ClosureComponent *closure_component_allot(size_t prim_size) {
-            // Allocate the component and the mul back to back
-            constexpr int alignment = alignof(ClosureComponent);
-            size_t stride = (int)((sizeof(ClosureComponent) + prim_size + alignment-1)/alignment)*alignment;
-            size_t needed = WidthT * stride;
-            ClosureComponent *comp_mem = (ClosureComponent *)m_sc.m_closure_pool.alloc(needed, alignment);
+        ClosureComponent *closure_component_allot(const ClosureRegistry::ClosureEntry &clentry) {
+            // Allocate the components of all lanes back to back, each
+            // clentry.component_size bytes after the last
+            size_t needed = WidthT * size_t(clentry.component_size);
+            ClosureComponent *comp_mem = (ClosureComponent *)m_sc.m_closure_pool.alloc(needed, clentry.alignment);
             return comp_mem;
         }
 
@@ -1890,10 +2865,20 @@ public:
     }
 #endif
 
+    /// Is a closure weight small enough that the closure it scales can be
+    /// dropped rather than built?  Exactly zero always is, and so is any
+    /// weight whose components are all below the "closure_weight_threshold"
+    /// option in magnitude.
+    bool negligible_closure_weight (const Color3 &w) const {
+        float m = std::max (fabsf(w.x), std::max (fabsf(w.y), fabsf(w.z)));
+        return m == 0.0f || m < shadingsys().closure_weight_threshold();
+    }
+
     ClosureComponent * closure_component_allot(int id, size_t prim_size, const Color3 &w) {
-        // Allocate the component and the mul back to back
+        // Allocate the component and its parameters back to back
+        const ClosureRegistry::ClosureEntry *clentry = shadingsys().find_closure(id);
         size_t needed = sizeof(ClosureComponent) + prim_size;
-        ClosureComponent *comp = (ClosureComponent *) m_closure_pool.alloc(needed, alignof(ClosureComponent));
+        ClosureComponent *comp = (ClosureComponent *) m_closure_pool.alloc(needed, clentry->alignment);
         comp->id = id;
         comp->w = w;
         return comp;
@@ -1939,8 +2924,10 @@ public:
 
     /// Return a reference to a compiled regular expression for the
     /// given string, being careful to cache already-created ones so we
-    /// aren't constantly compiling new ones.
-    const std::regex& find_regex (ustring r);
+    /// aren't constantly compiling new ones.  The compiled patterns live
+    /// in the shading system; this context only remembers which it has
+    /// already looked up.
+    const CompiledRegex& find_regex (ustring r);
 
     /// Return a pointer to the shading group for this context.
     ///
@@ -1951,6 +2938,30 @@ public:
     /// Return a reference to the MessageList containing messages.
     ///
     MessageList & messages () { return m_messages; }
+
+    /// Handle a trace() call made by the shader: answer it from the
+    /// results given to resume_traces, record it if the "deferred_trace"
+    /// option is on, or else have the renderer trace it now.
+    int trace (ShaderGlobals *sg, RendererServices::TraceOpt &opt,
+               const Vec3 &P, const Vec3 &dPdx, const Vec3 &dPdy,
+               const Vec3 &R, const Vec3 &dRdx, const Vec3 &dRdy);
+
+    /// The supplied result of the most recent trace() call, or NULL if it
+    /// was not answered from resume_traces results.
+    const RendererServices::TraceResult *current_trace () const {
+        return m_current_trace;
+    }
+
+    /// The trace() calls that the last execution recorded.
+    const std::vector<RendererServices::TraceRequest>& trace_requests () const {
+        return m_trace_requests;
+    }
+
+    /// Answer the trace requests of the last execution, in order, for
+    /// the next one.
+    void resume_traces (cspan<RendererServices::TraceResult> results) {
+        m_next_trace_results.assign (results.begin(), results.end());
+    }
 #if OSL_USE_BATCHED
     BatchedMessageBuffer & batched_messages_buffer() { return m_batched_messages_buffer; }
 #endif
@@ -1969,12 +2980,115 @@ public:
     /// attribname is "", return the value of the node itself.
     int dict_value (int nodeID, ustring attribname, TypeDesc type, void *data);
 
+    /// Run getattribute, through the renderer's handle for the attribute
+    /// (from resolve_attribute at JIT time) if it gave one.
     bool osl_get_attribute (ShaderGlobals *sg, void *objdata, int dest_derivs,
                             ustring obj_name, ustring attr_name,
                             int array_lookup, int index,
-                            TypeDesc attr_type, void *attr_dest);
+                            TypeDesc attr_type, void *attr_dest,
+                            void *attr_handle = nullptr);
+
+    /// Results of renderer lookups (matrices by space name, attributes)
+    /// remembered until the next point or batch starts executing, when
+    /// the "cache_lookups" option is on. A batched entry holds a whole
+    /// Block of results and the lanes fetched into it so far. Lookups of
+    /// the "object_attributes" go in a separate store, kept for as long
+    /// as the context shades the same object.
+    enum LookupKind { LookupMatrix, LookupInverseMatrix, LookupAttribute,
+                      LookupUserdata };
+    struct LookupCacheEntry {
+        LookupKind kind;
+        int width;                      ///< 1 for scalar, else batch width
+        ustring object, name;
+        TypeDesc type;
+        int index;                      ///< Array element, or -1
+        bool derivs;
+        unsigned int fetched;           ///< Lanes looked up (bit 0 if scalar)
+        unsigned int ok;                ///< Lanes that were found
+        size_t offset;                  ///< Of its data in m_lookup_data
+        bool per_object;                ///< In the per-object store?
+    };
+    LookupCacheEntry *find_lookup (LookupKind kind, int width, ustring object,
+                                   ustring name, TypeDesc type, int index,
+                                   bool derivs, bool per_object = false);
+    /// Add an entry with 'size' bytes of data; the reference and any
+    /// lookup_data() pointers are invalidated by the next add_lookup().
+    LookupCacheEntry &add_lookup (LookupKind kind, int width, ustring object,
+                                  ustring name, TypeDesc type, int index,
+                                  bool derivs, size_t size,
+                                  bool per_object = false);
+    void *lookup_data (const LookupCacheEntry &e) {
+        return (e.per_object ? m_object_lookup_data : m_lookup_data).data()
+               + e.offset;
+    }
+    void clear_lookups () {
+        m_lookups.clear ();
+        m_lookup_data.clear ();
+    }
+
+    /// The renderer's id of the object being shaded, or -1 if unknown.
+    long long object () const { return m_object_id; }
+    /// Start shading another object, forgetting the per-object lookups
+    /// if the id changes.
+    void object (long long id) {
+        if (id != m_object_id) {
+            m_object_lookups.clear ();
+            m_object_lookup_data.clear ();
+            m_object_id = id;
+        }
+    }
+    /// Should lookups of attribute or userdata 'name' go in the
+    /// per-object store?
+    bool object_lookup (ustring name) const {
+        return m_object_id >= 0 && shadingsys().is_object_attribute (name);
+    }
+
+    /// A renderer lookup (matrix, attribute or userdata) made while the
+    /// point was captured with the "capture" option, or its recorded
+    /// answer while replaying a capture.
+    struct CapturedLookup {
+        LookupKind kind;
+        ustring object, name;
+        TypeDesc type;
+        int index;                      ///< Array element, or -1
+        bool derivs;
+        bool ok;
+        std::string data;
+    };
+    /// Record the renderer lookups of the execution that follows.
+    void begin_capture () {
+        m_captured.clear ();
+        m_capturing = true;
+    }
+    /// Stop recording, and return what the execution looked up.
+    const std::vector<CapturedLookup>& end_capture () {
+        m_capturing = false;
+        return m_captured;
+    }
+    bool capturing () const { return m_capturing; }
+    /// Record a lookup and its result, if it isn't recorded already.
+    void capture_lookup (LookupKind kind, ustring object, ustring name,
+                         TypeDesc type, int index, bool derivs, bool ok,
+                         const void *data, size_t size);
+    /// Answer the renderer lookups of the executions that follow from
+    /// 'lookups' alone, until end_replay().
+    void begin_replay (cspan<CapturedLookup> lookups) {
+        m_replay = lookups;
+        m_replaying = true;
+    }
+    void end_replay () {
+        m_replay = cspan<CapturedLookup>();
+        m_replaying = false;
+    }
+    bool replaying () const { return m_replaying; }
+    /// The recorded answer to a lookup, or NULL if the captured point
+    /// never made it.
+    const CapturedLookup *replay_lookup (LookupKind kind, ustring object,
+                                         ustring name, TypeDesc type,
+                                         int index, bool derivs) const;
 
     PerThreadInfo *thread_info () const { return m_threadinfo; }
+    void thread_info (PerThreadInfo *t) { m_threadinfo = t; }
 
     TextureSystem::Perthread *texture_thread_info () const {
         if (! m_texture_thread_info)
@@ -1986,6 +3100,28 @@ public:
         m_texture_thread_info = t;
     }
 
+    /// A texture handle, and what the renderer reported about it, for a
+    /// texture filename that was only known at run time.
+    struct TextureHandleEntry {
+        ustring filename;
+        RendererServices::TextureHandle *handle = nullptr;
+        bool good = false;
+        bool udim = false;
+    };
+
+    /// Return the handle for a runtime-computed texture filename from a
+    /// small most-recently-used cache, asking the renderer only on a
+    /// miss. (Constant filenames get their handle when the group is JITed.)
+    const TextureHandleEntry &texture_handle (ustring filename);
+
+    /// Return the tile of UDIM texture 'udim' that (s,t) falls in, or
+    /// nullptr if there is no such tile.  The most recently used tiles are
+    /// remembered, so lookups that stay on a few tiles rarely ask the
+    /// TextureSystem.
+    TextureSystem::TextureHandle *resolve_udim (TextureSystem *ts,
+                    TextureSystem::TextureHandle *udim,
+                    TextureSystem::Perthread *perthread, float s, float t);
+
     const LLVM_Util::PerThreadInfo &llvm_thread_info () const {
         return thread_info()->llvm_thread_info;
     }
@@ -2004,21 +3140,103 @@ public:
     ocio_transform (StringParam fromspace, StringParam tospace,
                     const Color& C, Color& Cout);
 
+    /// Transform 'n' packed colors in place with a single OCIO call,
+    /// returning false (and leaving them alone) if there is no such
+    /// transform.
+    bool ocio_transform (StringParam fromspace, StringParam tospace,
+                         Color3 *colors, int n);
+
     void incr_layers_executed () { ++m_stat_layers_executed; }
 
+    // Bracket the execution of a layer function (profile >= 2). Layers may
+    // nest, when one runs another lazily, and the time spent in the inner
+    // one is taken out of the outer one's self time.
+    void layer_profile_begin (int layer) {
+        if (m_layer_profile_group != group()) {
+            merge_layer_profile ();
+            m_layer_profile_group = group();
+            m_layer_profile.resize (group()->nlayers());
+        }
+        m_layer_timers.push_back ({ layer, m_layer_clock.ticks(), 0 });
+    }
+    void layer_profile_end () {
+        OSL_DASSERT (! m_layer_timers.empty());
+        LayerTimer t = m_layer_timers.back();
+        m_layer_timers.pop_back ();
+        long long ticks = m_layer_clock.ticks() - t.start;
+        LayerProfile &p (m_layer_profile[t.layer]);
+        p.execs += 1;
+        p.ticks += ticks;
+        p.self_ticks += ticks - t.child_ticks;
+        if (! m_layer_timers.empty())
+            m_layer_timers.back().child_ticks += ticks;
+    }
+
+    // Add the layer profile saved up for m_layer_profile_group to that
+    // group's, and start over.
+    void merge_layer_profile ();
+
+    // Bracket a texture, getattribute or pointcloud call (profile >= 3)
+    // made at a call site, and note whether it succeeded.
+    void call_site_begin () { m_call_site_start = m_layer_clock.ticks(); }
+    void call_site_end (int site, bool ok) {
+        if (site >= (int)m_call_site_profile.size())
+            m_call_site_profile.resize (site + 1);
+        CallSiteProfile &p (m_call_site_profile[site]);
+        p.calls += 1;
+        p.failures += ! ok;
+        p.ticks += m_layer_clock.ticks() - m_call_site_start;
+    }
+
+    // Count an execution of a basic block (profile >= 4).
+    void profile_block (int block) {
+        if (block >= (int)m_profile_block_execs.size())
+            m_profile_block_execs.resize (block + 1, 0);
+        ++m_profile_block_execs[block];
+    }
+
     void incr_get_userdata_calls () { ++m_stat_get_userdata_calls; }
 
+    void count_noise (int number=1) { m_merge_noise_calls += number; }
+
     // Clear the stats we record per-execution in this context (unlocked)
     void clear_runtime_stats () {
         m_stat_get_userdata_calls = 0;
         m_stat_layers_executed = 0;
     }
 
-    // Transfer the per-execution stats from this context to the shading
-    // system.
+    // Add the per-execution stats to the ones this context is saving up
+    // for merge_stats(), without touching anything shared with other
+    // threads.
     void record_runtime_stats () {
-        shadingsys().m_stat_get_userdata_calls += m_stat_get_userdata_calls;
-        shadingsys().m_stat_layers_executed += m_stat_layers_executed;
+        m_merge_get_userdata_calls += m_stat_get_userdata_calls;
+        m_merge_layers_executed += m_stat_layers_executed;
+        m_merge_shading_ticks += m_ticks;
+        if (! m_merge_group_ticks || group()->name() != m_merge_group_name) {
+            m_merge_group_name = group()->name();
+            m_merge_group_ticks = &m_merge_group_times[m_merge_group_name];
+        }
+        *m_merge_group_ticks += m_ticks;
+    }
+
+    // Add the stats saved up since the last merge to the shading system's.
+    // Done when the context is released or destroyed, so the shared
+    // counters are touched once per get/release rather than once per point.
+    void merge_stats ();
+
+    // Pass on to the shading system any closure or scratch pool high water
+    // mark this context hasn't reported yet.
+    void record_pool_peaks () {
+        size_t closure = m_closure_pool.used();
+        if (closure > m_closure_pool_peak) {
+            m_closure_pool_peak = closure;
+            atomic_max (shadingsys().m_stat_peak_closure_bytes, closure);
+        }
+        size_t scratch = m_scratch_pool.used();
+        if (scratch > m_scratch_pool_peak) {
+            m_scratch_pool_peak = scratch;
+            atomic_max (shadingsys().m_stat_peak_scratch_bytes, scratch);
+        }
     }
 
     bool allow_warnings() {
@@ -2033,10 +3251,10 @@ public:
     }
 
     // Record an error (or warning, printf, etc.)
-    void record_error (ErrorHandler::ErrCode code, const std::string &text) const;
+    void record_error (ErrorHandler::ErrCode code, string_view text) const;
 #if OSL_USE_BATCHED
-    void record_error (ErrorHandler::ErrCode code, const std::string &text, Mask<MaxSupportedSimdLaneCount> mask) const;
-    void record_to_file(ustring filename, const std::string &text, Mask<MaxSupportedSimdLaneCount> mask) const;
+    void record_error (ErrorHandler::ErrCode code, string_view text, Mask<MaxSupportedSimdLaneCount> mask) const;
+    void record_to_file(ustring filename, string_view text, Mask<MaxSupportedSimdLaneCount> mask) const;
     // Process all the recorded fprintf messages
     void process_file_output () const;
 #endif
@@ -2063,28 +3281,95 @@ public:
         record_error(ErrorHandler::EH_MESSAGE, fmtformat(fmt, args...));
     }
 
-    void reserve_heap(size_t size) {
-        if (size > m_heapsize) {
-            m_heap.reset((char *)OIIO::aligned_malloc(size, OIIO_CACHE_LINE_SIZE));
-            m_heapsize = size;
-        }
-    }
+    void reserve_heap(size_t size);
+
+    // Count this context among those running the group (releasing the one
+    // it held before, if another), so that it can't be evicted under it,
+    // until release_group() or the next hold_group().
+    void hold_group (ShaderGroup &group);
+    void release_group ();
 
 private:
 
     void free_dict_resources ();
 
+    // Bind the ray type variant of the group to this context, optimizing
+    // and JITing it if that hasn't been done. Return false if it has
+    // nothing to run. With async_optimize (and allow_async), a group that
+    // isn't compiled yet is queued rather than waited for, and its
+    // fallback group is bound instead, or false returned if it has none.
+    // With debug_sample (and debug), bind its debug variant instead.
+    bool bind_group (ShaderGroup &group, int raytype,
+                     bool allow_async = true, bool debug = false);
+
+    // For debug_sample: count an execution, and return true for each
+    // one that should run with the debug checks.
+    bool debug_sample_next () {
+        int n = shadingsys().m_debug_sample;
+        if (n <= 0 || ++m_debug_sample_count < n)
+            return false;
+        m_debug_sample_count = 0;
+        return true;
+    }
+
+    // For max_jit_memory_MB, note that the group is executing in the
+    // current epoch, which keeps it from being evicted until the next.
+    void note_executed (ShaderGroup &group);
+
+    // Reset just what must be fresh for each point, and run the group's
+    // init function. For the second and later points of execute_many.
+    void execute_next_point (int shadeindex, ShaderGlobals &ssg,
+                             void* userdata_base_ptr, void* output_base_ptr);
+
+    static void atomic_max (atomic_int &stat, size_t val) {
+        int old = stat.load();
+        while (old < int(val) && ! stat.compare_exchange_weak (old, int(val)))
+            ;
+    }
+
     ShadingSystemImpl &m_shadingsys;    ///< Backpointer to shadingsys
     RendererServices *m_renderer;       ///< Ptr to renderer services
     PerThreadInfo *m_threadinfo;        ///< Ptr to our thread's info
     mutable TextureSystem::Perthread *m_texture_thread_info; ///< Ptr to texture thread info
     ShaderGroup *m_group;               ///< Ptr to shader group
+    ShaderGroup *m_unsampled_group = nullptr; ///< m_group but for debug_sample
+    /// The scalar entry points of m_group this execution runs, loaded once
+    /// when it was bound, so a tiered re-JIT swapping in new ones can't
+    /// leave it running the init of one JIT and the layers of another.
+    const ShaderGroup::LLVMEntryPoints *m_entry_points = nullptr;
+    ShaderGroup *m_held_group = nullptr;  ///< See hold_group()
+    int m_debug_sample_count = 0;       ///< Executions since the last sample
     // Heap memory
     std::unique_ptr<char, decltype(&OIIO::aligned_free)> m_heap { nullptr, &OIIO::aligned_free };
     size_t m_heapsize = 0;
-    using RegexMap = std::unordered_map<ustring, std::unique_ptr<std::regex>, ustringHash>;
-    RegexMap m_regex_map;               ///< Compiled regex's
+    using RegexMap = std::unordered_map<ustring, const CompiledRegex*, ustringHash>;
+    RegexMap m_regex_map;               ///< Regex's already looked up
+    static constexpr int TextureHandleCacheSize = 8;
+    TextureHandleEntry m_texture_handles[TextureHandleCacheSize]; ///< Most recent first
+    int m_ntexture_handles = 0;         ///< Entries of it in use
+    struct UdimTileEntry {
+        TextureSystem::TextureHandle *udim;  ///< The UDIM set
+        int utile, vtile;                    ///< floor(s), floor(t)
+        TextureSystem::TextureHandle *tile;  ///< What it resolved to
+    };
+    static constexpr int UdimTileCacheSize = 16;
+    UdimTileEntry m_udim_tiles[UdimTileCacheSize]; ///< Most recent first
+    int m_nudim_tiles = 0;              ///< Entries of it in use
     MessageList m_messages;             ///< Message blackboard
+    std::vector<LookupCacheEntry> m_lookups; ///< Cached renderer lookups
+    std::vector<char> m_lookup_data;    ///< Their results
+    long long m_object_id = -1;         ///< Object being shaded, if known
+    std::vector<LookupCacheEntry> m_object_lookups; ///< Kept for the object
+    std::vector<char> m_object_lookup_data; ///< Their results
+    std::vector<CapturedLookup> m_captured; ///< Lookups of the captured point
+    cspan<CapturedLookup> m_replay;     ///< Answers for the replayed point
+    bool m_capturing = false;           ///< Recording lookups?
+    bool m_replaying = false;           ///< Answering lookups from m_replay?
+    std::vector<RendererServices::TraceRequest> m_trace_requests; ///< Deferred trace() calls
+    std::vector<RendererServices::TraceResult> m_trace_results;  ///< Their answers, this execution
+    std::vector<RendererServices::TraceResult> m_next_trace_results; ///< ... and for the next
+    int m_trace_calls = 0;              ///< trace() calls this execution
+    const RendererServices::TraceResult *m_current_trace = nullptr; ///< Answer to the last one
 #if OSL_USE_BATCHED
     BatchedMessageBuffer m_batched_messages_buffer;    ///< Buffer for Batched Message blackboard
 #endif
@@ -2092,6 +3377,30 @@ private:
     int m_stat_get_userdata_calls;      ///< Number of calls to get_userdata
     int m_stat_layers_executed;         ///< Number of layers executed
     long long m_ticks;                  ///< Time executing the shader
+    // Stats saved up across executions until merge_stats()
+    long long m_merge_get_userdata_calls = 0;
+    long long m_merge_layers_executed = 0;
+    long long m_merge_noise_calls = 0;
+    long long m_merge_shading_ticks = 0;
+    std::unordered_map<ustring, long long, ustringHash> m_merge_group_times;
+    ustring m_merge_group_name;         ///< Group of m_merge_group_ticks
+    long long *m_merge_group_ticks = nullptr; ///< Its m_merge_group_times
+    // Per-layer profile (profile >= 2) saved up until merge_stats(), or
+    // until a different group runs.
+    struct LayerTimer {
+        int layer;
+        long long start;
+        long long child_ticks;
+    };
+    OIIO::Timer m_layer_clock;          ///< Started with the context
+    std::vector<LayerTimer> m_layer_timers;  ///< Layers running now
+    std::vector<LayerProfile> m_layer_profile;
+    ShaderGroup *m_layer_profile_group = nullptr; ///< Its group
+    // Per-call-site profile (profile >= 3), by call site id, saved up
+    // until merge_stats().
+    std::vector<CallSiteProfile> m_call_site_profile;
+    long long m_call_site_start = 0;    ///< When the current call began
+    std::vector<long long> m_profile_block_execs; ///< By block (profile >= 4)
 
     TextureOpt m_textureopt;            ///< texture call options
     RendererServices::NoiseOpt m_noiseopt; ///< noise call options
@@ -2099,49 +3408,44 @@ private:
 
     SimplePool<20 * 1024> m_closure_pool;
     SimplePool<64 * 1024> m_scratch_pool;
+    size_t m_closure_pool_peak = 0;     ///< Closure pool high water mark
+    size_t m_scratch_pool_peak = 0;     ///< Scratch pool high water mark
 
-    Dictionary *m_dictionary;
+    DictionaryCache *m_dictionary;   ///< Front cache of shared dictionary
 
     OCIOColorSystem m_ocio_system;
 
-    // Buffering of error messages and printfs
+    // Buffering of error messages and printfs. The text of all the items
+    // is kept back to back in one string, and the items just say where
+    // theirs is, so once the buffers have grown to what a shader needs,
+    // recording a message doesn't allocate.
     struct ErrorItem
     {
-        ErrorItem() = default;
-        ErrorItem(ErrorHandler::ErrCode err_code_,
-                  std::string msgString_,
-                  Mask<MaxSupportedSimdLaneCount> mask_ =
-                      Mask<MaxSupportedSimdLaneCount>(true))
-        : err_code(err_code_)
-        , msgString(msgString_)
-        , mask(mask_)
-        {}
-
         ErrorHandler::ErrCode err_code;
-        std::string msgString;
+        uint32_t begin, size;           ///< Range of m_buffered_text
+        bool repeat;                    ///< Same as an earlier one; skip
         Mask<MaxSupportedSimdLaneCount> mask;
     };
     mutable std::vector<ErrorItem> m_buffered_errors;
+    mutable std::string m_buffered_text;
+    mutable std::string m_buffered_msg;     ///< Passes on one item's text
+    mutable std::vector<std::pair<size_t,int>> m_buffered_hashes;
+    string_view buffered_text (uint32_t begin, uint32_t size) const {
+        return string_view (m_buffered_text.data() + begin, size);
+    }
+    void mark_repeated_errors () const;
 
 #if OSL_USE_BATCHED
     // Buffering of fprintf's so they can be output
     // to the file one data lane at a time
     struct FileItem
     {
-        FileItem() = default;
-        FileItem(ustring filename_,
-                  std::string msgString_,
-                  Mask<MaxSupportedSimdLaneCount> mask_)
-        : filename(filename_)
-        , msgString(msgString_)
-        , mask(mask_)
-        {}
-
         ustring filename;
-        std::string msgString;
+        uint32_t begin, size;           ///< Range of m_buffered_file_text
         Mask<MaxSupportedSimdLaneCount> mask;
     };
     mutable std::vector<FileItem> m_buffered_file_output;
+    mutable std::string m_buffered_file_text;
 
 #endif
     // When interpreting symbol addresses we need to know if the
@@ -2177,10 +3481,16 @@ struct NoiseParams {
     Vec3 direction;
     float bandwidth;
     float impulses;
+    int fast;                 // gabor: use precomputed impulse patterns
+    // fbm
+    int octaves;
+    float lacunarity;
+    float gain;
 
     NoiseParams ()
         : anisotropic(0), do_filter(true), direction(1.0f,0.0f,0.0f),
-          bandwidth(1.0f), impulses(16.0f)
+          bandwidth(1.0f), impulses(16.0f), fast(0),
+          octaves(4), lacunarity(2.0f), gain(0.5f)
     {
     }
 };
@@ -0,0 +1,421 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "osoreader.h"
+
+
+// Binary OSO holds exactly what the callbacks of an OSOReader are given
+// while reading text OSO, so it loads through the same readers
+// (OSOReaderToMaster, OSLQuery) but without lexing, parsing, or the global
+// lock the flex/bison reader needs.  All values are in native (little
+// endian) byte order:
+//
+//     char[8]    magic "OSObin\0" followed by the format version, 1
+//     uint32     0x01020304, to recognize a foreign byte order
+//     uint32     size of the string table in bytes (a multiple of 4)
+//     uint32     number of records
+//     uint32     reserved, 0
+//     char[]     string table: NUL-terminated strings, each referred to by
+//                its byte offset in the table, each distinct string once
+//     record[]   16-byte OSOBinaryRecord entries, one per callback:
+//
+//     tag              operands
+//     Version          x=major y=minor z=specid
+//     Shader           x=shadertype y=name
+//     Symbol           a=SymType b=TypeKind x=name y=arraylen
+//                      z=TypeDesc (basetype, aggregate, vecsemantics
+//                        in bytes 0-2) or the struct name
+//     DefaultInt       x=value
+//     DefaultFloat     x=bits of the float value
+//     DefaultString    x=value
+//     ParameterDone
+//     Hint             x=hint text
+//     CodeMarker       x=name
+//     Instruction      x=label y=opcode
+//     InstructionArg   x=symbol name
+//     InstructionJump  x=target
+//     InstructionEnd
+//     CodeEnd
+
+
+OSL_NAMESPACE_ENTER
+
+namespace pvt {  // OSL::pvt
+
+
+static const char binary_magic[8] = { 'O', 'S', 'O', 'b', 'i', 'n', '\0', 1 };
+static const uint32_t binary_byteorder = 0x01020304;
+static const size_t binary_header_size = 24;
+
+enum BinaryTag {
+    TagVersion = 1,
+    TagShader,
+    TagSymbol,
+    TagDefaultInt,
+    TagDefaultFloat,
+    TagDefaultString,
+    TagParameterDone,
+    TagHint,
+    TagCodeMarker,
+    TagInstruction,
+    TagInstructionArg,
+    TagInstructionJump,
+    TagInstructionEnd,
+    TagCodeEnd
+};
+
+enum TypeKind { KindSimple = 0, KindClosure = 1, KindStruct = 2 };
+
+static_assert(sizeof(OSOBinaryRecord) == 16, "OSOBinaryRecord must be packed");
+
+
+
+bool
+OSOReader::is_binary(const char* data, size_t size)
+{
+    return size >= sizeof(binary_magic)
+           && !memcmp(data, binary_magic, sizeof(binary_magic));
+}
+
+
+
+bool
+OSOReader::parse_binary_header(const char* header, size_t filesize,
+                               size_t& nstringbytes, size_t& nrecords)
+{
+    if (filesize < binary_header_size || !is_binary(header, filesize)) {
+        m_err.errorfmt("Not a binary OSO file");
+        return false;
+    }
+    uint32_t fields[4];
+    memcpy(fields, header + sizeof(binary_magic), sizeof(fields));
+    if (fields[0] != binary_byteorder) {
+        m_err.errorfmt("Binary OSO was written with a different byte order");
+        return false;
+    }
+    nstringbytes = fields[1];
+    nrecords     = fields[2];
+    if (nstringbytes % 4
+        || filesize != binary_header_size + nstringbytes
+                           + nrecords * sizeof(OSOBinaryRecord)) {
+        m_err.errorfmt("Corrupt binary OSO");
+        return false;
+    }
+    return true;
+}
+
+
+
+bool
+OSOReader::parse_binary_records(const char* strings, size_t nstringbytes,
+                                const char* records, size_t nrecords,
+                                bool& done)
+{
+    bool ok = !nstringbytes || !strings[nstringbytes - 1];
+    auto str = [&](int32_t offset) -> const char* {
+        if (offset < 0 || size_t(offset) >= nstringbytes) {
+            ok = false;
+            return "";
+        }
+        return strings + offset;
+    };
+
+    for (size_t i = 0; i < nrecords && ok; ++i) {
+        OSOBinaryRecord r;
+        memcpy(&r, records + i * sizeof(r), sizeof(r));
+        switch (r.tag) {
+        case TagVersion: version(str(r.z), r.x, r.y); break;
+        case TagShader: shader(str(r.x), str(r.y)); break;
+        case TagSymbol: {
+            if ((SymType)r.a == SymTypeTemp
+                && stop_parsing_at_temp_symbols()) {
+                done = true;
+                return true;
+            }
+            TypeSpec typespec;
+            if (r.b == KindStruct)
+                typespec = TypeSpec(str(r.z), 0);
+            else if (r.b == KindClosure)
+                typespec = TypeSpec(TypeDesc::TypeColor, true);
+            else
+                typespec = TypeDesc(TypeDesc::BASETYPE(r.z & 0xff),
+                                    TypeDesc::AGGREGATE((r.z >> 8) & 0xff),
+                                    TypeDesc::VECSEMANTICS((r.z >> 16) & 0xff));
+            if (r.y)
+                typespec.make_array(r.y);
+            symbol((SymType)r.a, typespec, str(r.x));
+            break;
+        }
+        case TagDefaultInt: symdefault(int(r.x)); break;
+        case TagDefaultFloat: {
+            float f;
+            memcpy(&f, &r.x, sizeof(f));
+            symdefault(f);
+            break;
+        }
+        case TagDefaultString: symdefault(str(r.x)); break;
+        case TagParameterDone: parameter_done(); break;
+        case TagHint: hint(str(r.x)); break;
+        case TagCodeMarker:
+            if (!parse_code_section()) {
+                done = true;
+                return true;
+            }
+            codemarker(str(r.x));
+            break;
+        case TagInstruction: instruction(r.x, str(r.y)); break;
+        case TagInstructionArg: instruction_arg(str(r.x)); break;
+        case TagInstructionJump: instruction_jump(r.x); break;
+        case TagInstructionEnd: instruction_end(); break;
+        case TagCodeEnd: codeend(); break;
+        default: ok = false;
+        }
+    }
+    if (!ok)
+        m_err.errorfmt("Corrupt binary OSO");
+    return ok;
+}
+
+
+
+bool
+OSOReader::parse_binary(const char* data, size_t size)
+{
+    size_t nstringbytes, nrecords;
+    if (!parse_binary_header(data, size, nstringbytes, nrecords))
+        return false;
+    const char* strings = data + binary_header_size;
+    bool done           = false;
+    return parse_binary_records(strings, nstringbytes, strings + nstringbytes,
+                                nrecords, done);
+}
+
+
+
+bool
+OSOReader::parse_binary_file(FILE* file, const std::string& filename)
+{
+    char header[binary_header_size];
+    long filesize = -1;
+    if (!fseek(file, 0, SEEK_END))
+        filesize = ftell(file);
+    if (filesize < 0 || fseek(file, 0, SEEK_SET)
+        || fread(header, 1, sizeof(header), file) != sizeof(header)) {
+        m_err.errorfmt("Could not read {}", filename);
+        return false;
+    }
+    size_t nstringbytes, nrecords;
+    if (!parse_binary_header(header, size_t(filesize), nstringbytes, nrecords))
+        return false;
+    std::string strings(nstringbytes, '\0');
+    if (fread(&strings[0], 1, nstringbytes, file) != nstringbytes) {
+        m_err.errorfmt("Could not read {}", filename);
+        return false;
+    }
+
+    // The symbols come first, so a reader that wants only the parameters
+    // is done after the first block or so.
+    std::vector<OSOBinaryRecord> block(std::min(nrecords, size_t(1024)));
+    bool done = false;
+    for (size_t i = 0; i < nrecords && !done; i += block.size()) {
+        size_t n = std::min(block.size(), nrecords - i);
+        if (fread(block.data(), sizeof(OSOBinaryRecord), n, file) != n) {
+            m_err.errorfmt("Could not read {}", filename);
+            return false;
+        }
+        if (!parse_binary_records(strings.data(), nstringbytes,
+                                  (const char*)block.data(), n, done))
+            return false;
+    }
+    return true;
+}
+
+
+
+int32_t
+OSOBinaryWriter::string_offset(string_view s)
+{
+    ustring u(s);
+    auto found = m_string_offsets.find(u);
+    if (found != m_string_offsets.end())
+        return found->second;
+    int32_t offset = int32_t(m_strings.size());
+    m_strings.append(u.c_str(), u.length() + 1);
+    m_string_offsets[u] = offset;
+    return offset;
+}
+
+
+
+void
+OSOBinaryWriter::record(int tag, int32_t x, int32_t y, int32_t z, uint8_t a,
+                        uint8_t b)
+{
+    OSOBinaryRecord r;
+    r.tag = uint8_t(tag);
+    r.a   = a;
+    r.b   = b;
+    r.c   = 0;
+    r.x   = x;
+    r.y   = y;
+    r.z   = z;
+    m_records.push_back(r);
+}
+
+
+
+void
+OSOBinaryWriter::version(const char* specid, int major, int minor)
+{
+    record(TagVersion, major, minor, string_offset(specid));
+}
+
+
+
+void
+OSOBinaryWriter::shader(const char* shadertype, const char* name)
+{
+    record(TagShader, string_offset(shadertype), string_offset(name));
+}
+
+
+
+void
+OSOBinaryWriter::symbol(SymType symtype, TypeSpec typespec, const char* name)
+{
+    TypeDesc simple = typespec.simpletype();
+    int arraylen    = simple.arraylen;
+    uint8_t kind    = KindSimple;
+    int32_t type    = 0;
+    if (typespec.is_structure_based()) {
+        kind = KindStruct;
+        type = string_offset(typespec.structspec()->name());
+    } else if (typespec.is_closure_based()) {
+        kind = KindClosure;
+    } else {
+        type = int32_t(simple.basetype) | (int32_t(simple.aggregate) << 8)
+               | (int32_t(simple.vecsemantics) << 16);
+    }
+    record(TagSymbol, string_offset(name), arraylen, type, uint8_t(symtype),
+           kind);
+}
+
+
+
+void
+OSOBinaryWriter::symdefault(int def)
+{
+    record(TagDefaultInt, def);
+}
+
+
+
+void
+OSOBinaryWriter::symdefault(float def)
+{
+    int32_t bits;
+    memcpy(&bits, &def, sizeof(bits));
+    record(TagDefaultFloat, bits);
+}
+
+
+
+void
+OSOBinaryWriter::symdefault(const char* def)
+{
+    record(TagDefaultString, string_offset(def));
+}
+
+
+
+void
+OSOBinaryWriter::parameter_done()
+{
+    record(TagParameterDone);
+}
+
+
+
+void
+OSOBinaryWriter::hint(string_view hintstring)
+{
+    record(TagHint, string_offset(hintstring));
+}
+
+
+
+void
+OSOBinaryWriter::codemarker(const char* name)
+{
+    record(TagCodeMarker, string_offset(name));
+}
+
+
+
+void
+OSOBinaryWriter::codeend()
+{
+    record(TagCodeEnd);
+}
+
+
+
+void
+OSOBinaryWriter::instruction(int label, const char* opcode)
+{
+    record(TagInstruction, label, string_offset(opcode));
+}
+
+
+
+void
+OSOBinaryWriter::instruction_arg(const char* name)
+{
+    record(TagInstructionArg, string_offset(name));
+}
+
+
+
+void
+OSOBinaryWriter::instruction_jump(int target)
+{
+    record(TagInstructionJump, target);
+}
+
+
+
+void
+OSOBinaryWriter::instruction_end()
+{
+    record(TagInstructionEnd);
+}
+
+
+
+std::string
+OSOBinaryWriter::binary() const
+{
+    size_t nstringbytes = (m_strings.size() + 3) & ~size_t(3);
+    uint32_t header[4]  = { binary_byteorder, uint32_t(nstringbytes),
+                           uint32_t(m_records.size()), 0 };
+    std::string out;
+    out.reserve(binary_header_size + nstringbytes
+                + m_records.size() * sizeof(OSOBinaryRecord));
+    out.append(binary_magic, sizeof(binary_magic));
+    out.append((const char*)header, sizeof(header));
+    out.append(m_strings);
+    out.append(nstringbytes - m_strings.size(), '\0');
+    out.append((const char*)m_records.data(),
+               m_records.size() * sizeof(OSOBinaryRecord));
+    return out;
+}
+
+
+};  // namespace pvt
+
+OSL_NAMESPACE_EXIT
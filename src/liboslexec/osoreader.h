@@ -10,6 +10,12 @@
 #include <OpenImageIO/thread.h>
 #include <OpenImageIO/string_view.h>
 
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 
 
 OSL_NAMESPACE_ENTER
@@ -42,6 +48,22 @@ public:
     /// an unrecoverable error reading.
     virtual bool parse_memory (const std::string &buffer);
 
+    /// Call the callbacks for binary OSO (as made by OSOBinaryWriter) held
+    /// in memory.  The strings passed to the callbacks point straight into
+    /// the buffer rather than being interned first.  There is no need to
+    /// call this directly: parse_file and parse_memory recognize binary
+    /// OSO and come here on their own.
+    bool parse_binary (const char *data, size_t size);
+
+    /// Does the buffer hold binary (rather than text) OSO?
+    static bool is_binary (const char *data, size_t size);
+
+    /// Like parse_binary, but reading binary OSO from an open file a
+    /// block of records at a time, so that a reader that stops early (see
+    /// stop_parsing_at_temp_symbols and parse_code_section) reads only the
+    /// front of the file.  parse_file comes here for binary OSO.
+    bool parse_binary_file (FILE *file, const std::string &filename);
+
     /// Declare the shader version.
     ///
     virtual void version (const char *specid, int major, int minor) { }
@@ -126,11 +148,68 @@ public:
 
 private:
     class Scope;
+    bool parse_binary_header (const char *header, size_t filesize,
+                              size_t &nstringbytes, size_t &nrecords);
+    bool parse_binary_records (const char *strings, size_t nstringbytes,
+                               const char *records, size_t nrecords,
+                               bool &done);
     ErrorHandler &m_err;
     int m_lineno;
     TypeSpec m_current_typespec;
 };
 
+
+
+
+/// One fixed-size entry of binary OSO, standing for one reader callback.
+/// The layout of the whole file is described in osobinary.cpp.
+struct OSOBinaryRecord {
+    uint8_t tag;           ///< Which callback
+    uint8_t a, b, c;       ///< Small operands (symbol type, type kind)
+    int32_t x, y, z;       ///< Operands: values or string table offsets
+};
+
+
+
+/// OSOReader whose callbacks record what they are given as binary OSO: a
+/// table of the distinct strings followed by fixed-size records, which
+/// parse_binary replays without the lexer, the parser, or interning every
+/// token.  Feed it text OSO with parse_file() or parse_memory(), then
+/// collect the result with binary().
+class OSOBinaryWriter final : public OSOReader {
+public:
+    OSOBinaryWriter (ErrorHandler *errhandler = NULL)
+        : OSOReader (errhandler) { }
+    virtual ~OSOBinaryWriter () { }
+
+    virtual void version (const char *specid, int major, int minor);
+    virtual void shader (const char *shadertype, const char *name);
+    virtual void symbol (SymType symtype, TypeSpec typespec, const char *name);
+    virtual void symdefault (int def);
+    virtual void symdefault (float def);
+    virtual void symdefault (const char *def);
+    virtual void parameter_done ();
+    virtual void hint (string_view hintstring);
+    virtual void codemarker (const char *name);
+    virtual void codeend ();
+    virtual void instruction (int label, const char *opcode);
+    virtual void instruction_arg (const char *name);
+    virtual void instruction_jump (int target);
+    virtual void instruction_end ();
+
+    /// Return the binary OSO for everything recorded so far.
+    std::string binary () const;
+
+private:
+    int32_t string_offset (string_view s);
+    void record (int tag, int32_t x = 0, int32_t y = 0, int32_t z = 0,
+                 uint8_t a = 0, uint8_t b = 0);
+
+    std::string m_strings;          ///< String table
+    std::unordered_map<ustring,int32_t,OIIO::ustringHash> m_string_offsets;
+    std::vector<OSOBinaryRecord> m_records;
+};
+
 OSL_PRAGMA_WARNING_POP
 
 
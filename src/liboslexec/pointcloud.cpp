@@ -2,7 +2,25 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <list>
+#include <thread>
+
+#ifndef _WIN32
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#include <OpenImageIO/filesystem.h>
+
+#include <OSL/device_pointcloud.h>
 
 #include "pointcloud.h"
 
@@ -12,12 +30,101 @@ OSL_NAMESPACE_ENTER
 namespace pvt {
 
 #ifdef USE_PARTIO
+namespace {
+// The pages of every paged cloud that are in memory, kept within budget by
+// dropping the least recently used.  A dropped page that a search is still
+// reading lives on until the search lets go of it.
+class PointCloudPageCache {
+public:
+    typedef std::shared_ptr<const PagedPointCloud::Page> PageRef;
+
+    PageRef find (const PagedPointCloud *cloud, int page) {
+        spin_lock lock (m_mutex);
+        auto found = m_map.find (Key (cloud, page));
+        if (found == m_map.end()) {
+            ++m_stats.misses;
+            return nullptr;
+        }
+        ++m_stats.hits;
+        m_lru.splice (m_lru.begin(), m_lru, found->second);
+        return found->second->page;
+    }
+
+    /// Add a page just read, unless another thread got there first, and
+    /// return the cached copy.
+    PageRef insert (const PagedPointCloud *cloud, int page, PageRef data,
+                    size_t capacity) {
+        spin_lock lock (m_mutex);
+        m_stats.bytes_read += data->size;
+        Key key (cloud, page);
+        auto found = m_map.find (key);
+        if (found != m_map.end())
+            return found->second->page;
+        m_lru.push_front (Entry { key, data });
+        m_map[key] = m_lru.begin();
+        m_bytes += data->size;
+        m_stats.peak_bytes = std::max (m_stats.peak_bytes, (long long)m_bytes);
+        while (m_bytes > capacity && m_lru.size() > 1) {
+            const Entry &victim (m_lru.back());
+            m_bytes -= victim.page->size;
+            m_map.erase (victim.key);
+            m_lru.pop_back ();
+            ++m_stats.evictions;
+        }
+        return data;
+    }
+
+    /// Forget every page of a cloud that is going away.
+    void purge (const PagedPointCloud *cloud) {
+        spin_lock lock (m_mutex);
+        for (auto e = m_lru.begin();  e != m_lru.end(); ) {
+            if (e->key.first == cloud) {
+                m_bytes -= e->page->size;
+                m_map.erase (e->key);
+                e = m_lru.erase (e);
+            } else {
+                ++e;
+            }
+        }
+    }
+
+    PointCloudPageStats stats () {
+        spin_lock lock (m_mutex);
+        return m_stats;
+    }
+
+private:
+    typedef std::pair<const PagedPointCloud *, int> Key;
+    struct KeyHash {
+        size_t operator() (const Key &k) const {
+            return std::hash<const void *>()(k.first) ^ (size_t(k.second) * 0x9e3779b9u);
+        }
+    };
+    struct Entry {
+        Key key;
+        PageRef page;
+    };
+    std::list<Entry> m_lru;   // Most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_map;
+    size_t m_bytes = 0;
+    PointCloudPageStats m_stats;
+    OIIO::spin_mutex m_mutex;
+};
+
+// Constructed before, and so destroyed after, the clouds whose pages it
+// holds.
+static PointCloudPageCache page_cache;
+}  // anon namespace
+
+
+
 typedef std::unordered_map<ustring, std::unique_ptr<PointCloud>, ustringHash> PointCloudMap;
 static PointCloudMap pointclouds;
 static OIIO::spin_mutex pointcloudmap_mutex;
 
 PointCloud *
-PointCloud::get (ustring filename, bool write)
+PointCloud::get (ustring filename, bool write, bool write_index,
+                 bool write_pages)
 {
     if (filename.empty())
         return NULL;
@@ -28,6 +135,18 @@ PointCloud::get (ustring filename, bool write)
     // Not found. Create a new one.
     Partio::ParticlesDataMutable *partio_cloud = NULL;
     if (!write) {
+        // Read a paged cloud, whether named directly or a current copy of
+        // the named one, a page at a time instead of loading it.
+        std::unique_ptr<PagedPointCloud> paged
+            = PagedPointCloud::open (filename.string());
+        if (! paged)
+            paged = PagedPointCloud::open (PagedPointCloud::paged_filename (filename),
+                                           filename.string());
+        if (paged) {
+            PointCloud *pc = new PointCloud (filename, std::move(paged));
+            pointclouds[filename].reset (pc);
+            return pc;
+        }
         partio_cloud = Partio::read(filename.c_str(), false);
         if (! partio_cloud)
             return NULL;
@@ -35,6 +154,8 @@ PointCloud::get (ustring filename, bool write)
         partio_cloud = Partio::create();
     }
     PointCloud *pc = new PointCloud (filename, partio_cloud, write);
+    pc->m_write_index = write && write_index;
+    pc->m_write_pages = write && write_pages;
     pointclouds[filename].reset (pc);
     return pc;
 }
@@ -48,9 +169,6 @@ PointCloud::PointCloud (ustring filename,
         return;   // empty cloud
 
     if (!m_write) {
-        // partio requires this for accelerated lookups
-        m_partio_cloud->sort();
-
         // Create & stash a ParticleAttribute record for each attribute.
         // These will be automatically freed by ~PointCloud when the map
         // destructs.
@@ -59,20 +177,926 @@ PointCloud::PointCloud (ustring filename,
             m_partio_cloud->attributeInfo (i, *a);
             m_attributes[ustring(a->name)].reset (a);
         }
+
+        // Use our own index for accelerated lookups, mapping the one
+        // saved when the cloud was baked if it is still current.  Only a
+        // cloud without positions falls back to Partio's, which requires
+        // this.
+        auto found = m_attributes.find (u_position);
+        if (found != m_attributes.end() &&
+              found->second->type == Partio::VECTOR) {
+            m_tree.reset (new PointCloudTree);
+            if (! m_tree->map (PointCloudTree::index_filename (m_filename),
+                               m_partio_cloud->numParticles(),
+                               OIIO::Filesystem::file_size (m_filename),
+                               OIIO::Filesystem::last_write_time (m_filename)))
+                m_tree->build (m_partio_cloud, *found->second);
+        } else {
+            m_partio_cloud->sort();
+        }
+    }
+}
+
+
+
+PointCloud::PointCloud (ustring filename,
+                        std::unique_ptr<PagedPointCloud> paged)
+    : m_filename(filename), m_partio_cloud(nullptr), m_write(false),
+      m_paged(std::move(paged))
+{
+    // The same attribute records as a loaded cloud's, so that lookups and
+    // type checks needn't care; their index is into the paged cloud's
+    // attributes, or -1 for the positions.
+    const auto &attrs (m_paged->attributes());
+    for (int i = 0, e = int(attrs.size());  i < e;  ++i) {
+        Partio::ParticleAttribute *a = new Partio::ParticleAttribute();
+        a->type = attrs[i].type;
+        a->count = attrs[i].count;
+        a->name = attrs[i].name;
+        a->attributeIndex = i;
+        m_attributes[ustring(a->name)].reset (a);
     }
+    Partio::ParticleAttribute *pos = new Partio::ParticleAttribute();
+    pos->type = Partio::VECTOR;
+    pos->count = 3;
+    pos->name = u_position.string();
+    pos->attributeIndex = -1;
+    m_attributes[u_position].reset (pos);
 }
 
 
 
 PointCloud::~PointCloud ()
 {
+    if (m_flush_thread.joinable())
+        m_flush_thread.join ();
     // Save the file if we wrote to it
-    if (m_write && !m_filename.empty())
-        Partio::write (m_filename.c_str(), *m_partio_cloud);
+    if (m_write && m_partio_cloud) {
+        spin_lock lock (m_mutex);
+        merge_write_buffers ();
+        save ();
+    }
     if (m_partio_cloud)
         m_partio_cloud->release ();
 }
+
+
+
+PointCloudWriteBuffer &
+PointCloud::write_buffer ()
+{
+    // Each thread finds its own buffer without any locking; only its first
+    // write to a cloud registers a new buffer with it.
+    static thread_local std::unordered_map<const PointCloud*,
+                                           PointCloudWriteBuffer*> buffers;
+    PointCloudWriteBuffer *&buf (buffers[this]);
+    if (! buf) {
+        spin_lock lock (m_write_buffers_mutex);
+        m_write_buffers.emplace_back (new PointCloudWriteBuffer);
+        buf = m_write_buffers.back().get();
+    }
+    return *buf;
+}
+
+
+
+void
+PointCloud::flush (bool wait)
+{
+    std::lock_guard<std::mutex> guard (m_flush_mutex);
+    if (m_flush_thread.joinable())
+        m_flush_thread.join ();
+    auto work = [this]() {
+        spin_lock lock (m_mutex);
+        merge_write_buffers ();
+        save ();
+    };
+    if (wait)
+        work ();
+    else
+        m_flush_thread = std::thread (work);
+}
+
+
+
+void
+PointCloud::merge_write_buffers ()
+{
+    // Take every thread's pending points, holding each buffer's lock only
+    // long enough to swap its contents out.
+    std::vector<std::vector<Vec3>> positions;
+    std::vector<std::vector<PointCloudWriteBuffer::Value>> values;
+    {
+        spin_lock lock (m_write_buffers_mutex);
+        positions.resize (m_write_buffers.size());
+        values.resize (m_write_buffers.size());
+        for (size_t b = 0, e = m_write_buffers.size();  b < e;  ++b) {
+            spin_lock buflock (m_write_buffers[b]->mutex);
+            positions[b].swap (m_write_buffers[b]->positions);
+            values[b].swap (m_write_buffers[b]->values);
+        }
+    }
+    size_t total = 0;
+    std::vector<int> base (positions.size());
+    for (size_t b = 0;  b < positions.size();  ++b) {
+        base[b] = m_partio_cloud->numParticles() + int(total);
+        total += positions[b].size();
+    }
+    if (! total)
+        return;
+
+    Partio::ParticlesDataMutable *cloud = m_partio_cloud;
+    if (! cloud->attributeInfo ("position", m_position_attribute))
+        m_position_attribute = cloud->addAttribute ("position", Partio::VECTOR, 3);
+
+    // Add any attributes seen for the first time, and resolve the string
+    // values, which Partio can only register one at a time.
+    for (size_t b = 0;  b < values.size();  ++b) {
+        for (auto &v : values[b]) {
+            Partio::ParticleAttribute *a = m_attributes[v.name].get();
+            if (! a) {
+                a = new Partio::ParticleAttribute ();
+                *a = cloud->addAttribute (v.name.c_str(), v.type,
+                                          v.type==Partio::VECTOR ? 3 : 1 /*count*/);
+                m_attributes[v.name].reset (a);
+            }
+            if (v.type == Partio::INDEXEDSTR && a->type == v.type) {
+                int index = cloud->lookupIndexedStr (*a, v.s.c_str());
+                if (index == -1)
+                    index = cloud->registerIndexedStr (*a, v.s.c_str());
+                v.i = index;
+            }
+        }
+    }
+    cloud->addParticles (int(total));
+
+    // With the particles allocated, each buffer fills its own range, so
+    // large merges copy the buffers in parallel.
+    auto fill = [&](size_t b) {
+        for (size_t i = 0, e = positions[b].size();  i < e;  ++i)
+            *(Vec3 *)cloud->dataWrite<float>(m_position_attribute, base[b] + int(i)) = positions[b][i];
+        for (const auto &v : values[b]) {
+            auto found = m_attributes.find (v.name);
+            const Partio::ParticleAttribute *a = found->second.get();
+            if (a->type != v.type)
+                continue;
+            Partio::ParticleIndex p = base[b] + v.point;
+            switch (a->type) {
+            case Partio::FLOAT :
+                *(float *)cloud->dataWrite<float>(*a, p) = v.f[0];
+                break;
+            case Partio::VECTOR :
+                *(Vec3 *)cloud->dataWrite<float>(*a, p) = Vec3 (v.f[0], v.f[1], v.f[2]);
+                break;
+            case Partio::INT :
+            case Partio::INDEXEDSTR :
+                *(int *)cloud->dataWrite<int>(*a, p) = v.i;
+                break;
+            case Partio::NONE :
+                break;
+            }
+        }
+    };
+    if (positions.size() > 1 && total > (1 << 16)) {
+        std::vector<std::thread> threads;
+        for (size_t b = 1;  b < positions.size();  ++b)
+            threads.emplace_back (fill, b);
+        fill (0);
+        for (auto &t : threads)
+            t.join ();
+    } else {
+        for (size_t b = 0;  b < positions.size();  ++b)
+            fill (b);
+    }
+}
+
+
+
+void
+PointCloud::save ()
+{
+    if (m_filename.empty())
+        return;
+    Partio::write (m_filename.c_str(), *m_partio_cloud);
+    // Paying for the index now means no render has to build it.
+    if ((m_write_index || m_write_pages) && m_partio_cloud->numParticles()) {
+        PointCloudTree tree;
+        tree.build (m_partio_cloud, m_position_attribute);
+        uint64_t size = OIIO::Filesystem::file_size (m_filename);
+        int64_t mtime = OIIO::Filesystem::last_write_time (m_filename);
+        if (m_write_index)
+            tree.save (PointCloudTree::index_filename (m_filename), size, mtime);
+        if (m_write_pages)
+            PagedPointCloud::write (PagedPointCloud::paged_filename (m_filename),
+                                    m_partio_cloud, tree, size, mtime);
+    }
+}
+
+
+
+void
+PointCloudTree::build (const Partio::ParticlesData *cloud,
+                       const Partio::ParticleAttribute &pos, int nthreads)
+{
+    int n = cloud->numParticles();
+    std::vector<float> p[3];
+    for (auto &v : p)
+        v.resize (n);
+    for (int i = 0;  i < n;  ++i) {
+        const float *P = cloud->data<float> (pos, i);
+        p[0][i] = P[0];
+        p[1][i] = P[1];
+        p[2][i] = P[2];
+    }
+    std::vector<int> perm (n);
+    for (int i = 0;  i < n;  ++i)
+        perm[i] = i;
+
+    // Every subtree's size is fixed by the median splits, so each node's
+    // slot is known up front and disjoint subtrees can be built by
+    // separate threads.
+    if (nthreads <= 0)
+        nthreads = std::max (1, (int)std::thread::hardware_concurrency());
+    int maxdepth = 0;
+    while ((1 << maxdepth) < nthreads)
+        ++maxdepth;
+    m_nodes.clear ();
+    if (n) {
+        m_nodes.resize (count_nodes (n));
+        build_node (0, 0, n, 0, maxdepth, perm, p);
+    }
+
+    // Gather the positions into tree order.
+    m_x.resize (n);
+    m_y.resize (n);
+    m_z.resize (n);
+    m_index.swap (perm);
+    for (int i = 0;  i < n;  ++i) {
+        m_x[i] = p[0][m_index[i]];
+        m_y[i] = p[1][m_index[i]];
+        m_z[i] = p[2][m_index[i]];
+    }
+    nodes = m_nodes.data();
+    x = m_x.data();
+    y = m_y.data();
+    z = m_z.data();
+    index = m_index.data();
+    nnodes = int(m_nodes.size());
+    npoints = n;
+}
+
+
+
+void
+PointCloudTree::build_node (int id, int begin, int end, int depth,
+                            int maxdepth, std::vector<int> &perm,
+                            const std::vector<float> *pos)
+{
+    Node &node (m_nodes[id]);
+    for (int a = 0;  a < 3;  ++a) {
+        node.lo[a] = std::numeric_limits<float>::max();
+        node.hi[a] = -std::numeric_limits<float>::max();
+    }
+    for (int i = begin;  i < end;  ++i) {
+        for (int a = 0;  a < 3;  ++a) {
+            float v = pos[a][perm[i]];
+            node.lo[a] = std::min (node.lo[a], v);
+            node.hi[a] = std::max (node.hi[a], v);
+        }
+    }
+    node.split = 0.0f;
+    node.axis = -1;
+    node.begin = begin;
+    node.end = end;
+    node.right = -1;
+    if (end - begin <= LeafSize)
+        return;
+
+    // Split at the median of the widest axis.
+    int axis = 0;
+    for (int a = 1;  a < 3;  ++a)
+        if (node.hi[a] - node.lo[a] > node.hi[axis] - node.lo[axis])
+            axis = a;
+    const std::vector<float> &key (pos[axis]);
+    int mid = begin + (end - begin) / 2;
+    std::nth_element (perm.begin() + begin, perm.begin() + mid,
+                      perm.begin() + end,
+                      [&](int a, int b) { return key[a] < key[b]; });
+    node.split = key[perm[mid]];
+    node.axis = axis;
+    node.right = id + 1 + count_nodes (mid - begin);
+    int right = node.right;
+
+    // Hand the left half to another thread while the clouds are big
+    // enough to be worth it.
+    if (depth < maxdepth && end - begin > (1 << 16)) {
+        std::thread left (&PointCloudTree::build_node, this, id + 1, begin,
+                          mid, depth + 1, maxdepth, std::ref(perm), pos);
+        build_node (right, mid, end, depth + 1, maxdepth, perm, pos);
+        left.join ();
+    } else {
+        build_node (id + 1, begin, mid, depth + 1, maxdepth, perm, pos);
+        build_node (right, mid, end, depth + 1, maxdepth, perm, pos);
+    }
+}
+
+
+
+namespace {
+// Layout of a saved index: this header, then the nodes, then the x, y
+// and z positions and the particle indices, each as a packed array.
+struct IndexFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t leafsize;
+    int64_t npoints;
+    int64_t nnodes;
+    uint64_t source_size;
+    int64_t source_mtime;
+};
+static const char index_file_magic[8] = { 'O', 'S', 'L', 'P', 'C', 'I', 0, 0 };
+static const uint32_t index_file_version = 1;
+
+inline size_t
+index_file_size (int64_t npoints, int64_t nnodes)
+{
+    return sizeof(IndexFileHeader) + nnodes * sizeof(PointCloudTree::Node)
+           + npoints * (3 * sizeof(float) + sizeof(int));
+}
+}  // anon namespace
+
+
+
+PointCloudTree::~PointCloudTree ()
+{
+#ifndef _WIN32
+    if (m_map)
+        munmap (m_map, m_mapsize);
 #endif
+}
+
+
+
+bool
+PointCloudTree::save (const std::string &filename, uint64_t source_size,
+                      int64_t source_mtime) const
+{
+    IndexFileHeader header;
+    memcpy (header.magic, index_file_magic, sizeof(header.magic));
+    header.version = index_file_version;
+    header.leafsize = LeafSize;
+    header.npoints = npoints;
+    header.nnodes = nnodes;
+    header.source_size = source_size;
+    header.source_mtime = source_mtime;
+
+    // Write to a temporary and rename it into place, so that a render
+    // starting meanwhile never maps a partial file.
+    std::string tmpname = filename + ".tmp";
+    FILE *file = OIIO::Filesystem::fopen (tmpname, "wb");
+    if (! file)
+        return false;
+    bool ok = fwrite (&header, sizeof(header), 1, file) == 1;
+    ok &= fwrite (nodes, sizeof(Node), nnodes, file) == size_t(nnodes);
+    ok &= fwrite (x, sizeof(float), npoints, file) == size_t(npoints);
+    ok &= fwrite (y, sizeof(float), npoints, file) == size_t(npoints);
+    ok &= fwrite (z, sizeof(float), npoints, file) == size_t(npoints);
+    ok &= fwrite (index, sizeof(int), npoints, file) == size_t(npoints);
+    ok &= (fclose (file) == 0);
+    std::string err;
+    if (ok)
+        ok = OIIO::Filesystem::rename (tmpname, filename, err);
+    if (! ok)
+        OIIO::Filesystem::remove (tmpname, err);
+    return ok;
+}
+
+
+
+bool
+PointCloudTree::map (const std::string &filename, int npoints_,
+                     uint64_t source_size, int64_t source_mtime)
+{
+#ifndef _WIN32
+    int fd = open (filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat (fd, &st) != 0 || size_t(st.st_size) < sizeof(IndexFileHeader)) {
+        close (fd);
+        return false;
+    }
+    size_t size = size_t(st.st_size);
+    void *base = mmap (nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (base == MAP_FAILED)
+        return false;
+
+    const IndexFileHeader *header = (const IndexFileHeader *)base;
+    if (memcmp (header->magic, index_file_magic, sizeof(header->magic))
+          || header->version != index_file_version
+          || header->leafsize != LeafSize
+          || header->npoints != npoints_ || header->nnodes < 1
+          || header->source_size != source_size
+          || header->source_mtime != source_mtime
+          || size != index_file_size (header->npoints, header->nnodes)) {
+        munmap (base, size);
+        return false;
+    }
+
+    const char *data = (const char *)(header + 1);
+    nodes = (const Node *)data;
+    data += header->nnodes * sizeof(Node);
+    x = (const float *)data;
+    y = x + npoints_;
+    z = y + npoints_;
+    index = (const int *)(z + npoints_);
+    nnodes = int(header->nnodes);
+    npoints = npoints_;
+    m_map = base;
+    m_mapsize = size;
+    return true;
+#else
+    // FIXME: no Windows file mapping yet, so always rebuild.
+    return false;
+#endif
+}
+
+
+
+namespace {
+// Layout of a paged cloud file: this header, the top of the tree, the
+// page table, the attribute records, and then the pages.  Each attribute
+// record is followed by its name and, for INDEXEDSTR attributes, by each
+// of its strings after its length.  A page holds its nodes, its x, y and
+// z positions, and the values of each attribute in turn.
+struct PagedFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t leafsize;
+    uint32_t pagesize;
+    uint32_t nattributes;
+    int64_t npoints;
+    int64_t ntop;
+    int64_t npages;
+    uint64_t source_size;
+    int64_t source_mtime;
+};
+struct PagedAttributeRecord {
+    int32_t type;
+    int32_t count;
+    uint32_t namelen;
+    uint32_t nstrings;
+};
+static const char paged_file_magic[8] = { 'O', 'S', 'L', 'P', 'C', 'P', 0, 0 };
+static const uint32_t paged_file_version = 1;
+}  // anon namespace
+
+
+
+PagedPointCloud::~PagedPointCloud ()
+{
+    page_cache.purge (this);
+    if (m_file)
+        fclose (m_file);
+}
+
+
+
+int
+PagedPointCloud::add_top_node (const PointCloudTree &tree, int id)
+{
+    // Copy the tree down to the first nodes with few enough points to be
+    // pages, whose subtrees (being contiguous in the tree) become pages.
+    const Node &node (tree.nodes[id]);
+    int t = int(m_top.size());
+    m_top.push_back (node);
+    int n = node.end - node.begin;
+    if (node.leaf() || n <= PageSize) {
+        PageEntry entry {};
+        entry.begin = node.begin;
+        entry.end = node.end;
+        entry.nnodes = PointCloudTree::count_nodes (n);
+        entry.first_node = id;
+        m_top[t].axis = -1;
+        m_top[t].right = int(m_pages.size());
+        m_pages.push_back (entry);
+    } else {
+        add_top_node (tree, id + 1);
+        int right = add_top_node (tree, node.right);
+        m_top[t].right = right;
+    }
+    return t;
+}
+
+
+
+bool
+PagedPointCloud::write (const std::string &filename,
+                        const Partio::ParticlesData *cloud,
+                        const PointCloudTree &tree, uint64_t source_size,
+                        int64_t source_mtime)
+{
+    if (! tree.nnodes)
+        return false;
+    PagedPointCloud layout;
+    layout.add_top_node (tree, 0);
+
+    // Every attribute but the positions, which the pages hold already
+    std::vector<Partio::ParticleAttribute> attrs;
+    std::vector<char> records;
+    auto append = [&](const void *data, size_t size) {
+        records.insert (records.end(), (const char *)data,
+                        (const char *)data + size);
+    };
+    size_t stride = 0;   // Bytes of attribute values per point
+    for (int i = 0, e = cloud->numAttributes();  i < e;  ++i) {
+        Partio::ParticleAttribute a;
+        cloud->attributeInfo (i, a);
+        if (a.name == u_position.string()
+              || (a.type != Partio::FLOAT && a.type != Partio::VECTOR
+                  && a.type != Partio::INT && a.type != Partio::INDEXEDSTR))
+            continue;
+        const std::vector<std::string> *strings
+            = a.type == Partio::INDEXEDSTR ? &cloud->indexedStrs (a) : nullptr;
+        PagedAttributeRecord rec;
+        rec.type = a.type;
+        rec.count = a.count;
+        rec.namelen = uint32_t(a.name.size());
+        rec.nstrings = strings ? uint32_t(strings->size()) : 0;
+        append (&rec, sizeof(rec));
+        append (a.name.data(), a.name.size());
+        if (strings) {
+            for (const auto &str : *strings) {
+                uint32_t len = uint32_t(str.size());
+                append (&len, sizeof(len));
+                append (str.data(), len);
+            }
+        }
+        // Ints and floats are both 4 bytes
+        stride += a.count * 4;
+        attrs.push_back (a);
+    }
+
+    uint64_t offset = sizeof(PagedFileHeader)
+                      + layout.m_top.size() * sizeof(Node)
+                      + layout.m_pages.size() * sizeof(PageEntry)
+                      + records.size();
+    for (auto &entry : layout.m_pages) {
+        entry.offset = offset;
+        entry.size = entry.nnodes * sizeof(Node)
+                     + size_t(entry.end - entry.begin) * (3 * sizeof(float) + stride);
+        offset += entry.size;
+    }
+
+    PagedFileHeader header;
+    memcpy (header.magic, paged_file_magic, sizeof(header.magic));
+    header.version = paged_file_version;
+    header.leafsize = PointCloudTree::LeafSize;
+    header.pagesize = PageSize;
+    header.nattributes = uint32_t(attrs.size());
+    header.npoints = tree.npoints;
+    header.ntop = int64_t(layout.m_top.size());
+    header.npages = int64_t(layout.m_pages.size());
+    header.source_size = source_size;
+    header.source_mtime = source_mtime;
+
+    // As with the index, write to a temporary and rename it into place.
+    std::string tmpname = filename + ".tmp";
+    FILE *file = OIIO::Filesystem::fopen (tmpname, "wb");
+    if (! file)
+        return false;
+    bool ok = fwrite (&header, sizeof(header), 1, file) == 1;
+    ok &= fwrite (layout.m_top.data(), sizeof(Node), layout.m_top.size(), file)
+          == layout.m_top.size();
+    ok &= fwrite (layout.m_pages.data(), sizeof(PageEntry), layout.m_pages.size(), file)
+          == layout.m_pages.size();
+    ok &= fwrite (records.data(), 1, records.size(), file) == records.size();
+    std::vector<char> buf;
+    for (const auto &entry : layout.m_pages) {
+        if (! ok)
+            break;
+        buf.resize (entry.size);
+        char *dst = buf.data();
+        // The page's nodes, with their points and children made page
+        // relative
+        Node *nodes = (Node *)dst;
+        memcpy (nodes, tree.nodes + entry.first_node, entry.nnodes * sizeof(Node));
+        for (int i = 0;  i < entry.nnodes;  ++i) {
+            nodes[i].begin -= entry.begin;
+            nodes[i].end -= entry.begin;
+            if (! nodes[i].leaf())
+                nodes[i].right -= entry.first_node;
+        }
+        dst += entry.nnodes * sizeof(Node);
+        const size_t n = size_t(entry.end - entry.begin);
+        for (const float *pos : { tree.x, tree.y, tree.z }) {
+            memcpy (dst, pos + entry.begin, n * sizeof(float));
+            dst += n * sizeof(float);
+        }
+        for (const auto &a : attrs) {
+            const size_t bytes = a.count * 4;
+            for (int p = entry.begin;  p < entry.end;  ++p, dst += bytes)
+                memcpy (dst, cloud->data<float> (a, tree.index[p]), bytes);
+        }
+        ok &= fwrite (buf.data(), 1, entry.size, file) == entry.size;
+    }
+    ok &= (fclose (file) == 0);
+    std::string err;
+    if (ok)
+        ok = OIIO::Filesystem::rename (tmpname, filename, err);
+    if (! ok)
+        OIIO::Filesystem::remove (tmpname, err);
+    return ok;
+}
+
+
+
+std::unique_ptr<PagedPointCloud>
+PagedPointCloud::open (const std::string &filename, const std::string &source)
+{
+    FILE *file = OIIO::Filesystem::fopen (filename, "rb");
+    if (! file)
+        return nullptr;
+    // From here the file is closed with the cloud, whatever happens.
+    std::unique_ptr<PagedPointCloud> pc (new PagedPointCloud);
+    pc->m_file = file;
+    PagedFileHeader header;
+    if (fread (&header, sizeof(header), 1, file) != 1
+          || memcmp (header.magic, paged_file_magic, sizeof(header.magic))
+          || header.version != paged_file_version
+          || header.leafsize != PointCloudTree::LeafSize
+          || header.ntop < 1 || header.npages < 1)
+        return nullptr;
+    if (source.size()
+          && (header.source_size != OIIO::Filesystem::file_size (source)
+              || header.source_mtime != int64_t(OIIO::Filesystem::last_write_time (source))))
+        return nullptr;
+
+    pc->m_npoints = int(header.npoints);
+    pc->m_top.resize (size_t(header.ntop));
+    pc->m_pages.resize (size_t(header.npages));
+    if (fread (pc->m_top.data(), sizeof(Node), pc->m_top.size(), file) != pc->m_top.size()
+          || fread (pc->m_pages.data(), sizeof(PageEntry), pc->m_pages.size(), file) != pc->m_pages.size())
+        return nullptr;
+    for (uint32_t a = 0;  a < header.nattributes;  ++a) {
+        PagedAttributeRecord rec;
+        if (fread (&rec, sizeof(rec), 1, file) != 1)
+            return nullptr;
+        Attribute attr;
+        attr.type = Partio::ParticleAttributeType (rec.type);
+        attr.count = rec.count;
+        attr.name.resize (rec.namelen);
+        if (rec.namelen && fread (&attr.name[0], 1, rec.namelen, file) != rec.namelen)
+            return nullptr;
+        attr.strings.resize (rec.nstrings);
+        for (auto &str : attr.strings) {
+            uint32_t len;
+            if (fread (&len, sizeof(len), 1, file) != 1)
+                return nullptr;
+            str.resize (len);
+            if (len && fread (&str[0], 1, len, file) != len)
+                return nullptr;
+        }
+        pc->m_attributes.push_back (std::move(attr));
+    }
+    return pc;
+}
+
+
+
+std::shared_ptr<const PagedPointCloud::Page>
+PagedPointCloud::read_page (int p) const
+{
+    const PageEntry &entry (m_pages[p]);
+    std::shared_ptr<Page> page (new Page);
+    page->data.reset (new char[entry.size]);
+    page->size = entry.size;
+    {
+        std::lock_guard<std::mutex> lock (m_file_mutex);
+#ifdef _WIN32
+        bool ok = _fseeki64 (m_file, int64_t(entry.offset), SEEK_SET) == 0;
+#else
+        bool ok = fseeko (m_file, off_t(entry.offset), SEEK_SET) == 0;
+#endif
+        if (! ok || fread (page->data.get(), 1, entry.size, m_file) != entry.size)
+            return nullptr;
+    }
+    const size_t n = size_t(entry.end - entry.begin);
+    const char *data = page->data.get();
+    page->nodes = (const Node *)data;
+    page->x = (const float *)(data + entry.nnodes * sizeof(Node));
+    page->y = page->x + n;
+    page->z = page->y + n;
+    const char *values = (const char *)(page->z + n);
+    for (const auto &a : m_attributes) {
+        page->values.push_back (values);
+        values += n * a.count * 4;
+    }
+    return page;
+}
+
+
+
+std::shared_ptr<const PagedPointCloud::Page>
+PagedPointCloud::page (int p, size_t cache_bytes) const
+{
+    if (auto found = page_cache.find (this, p))
+        return found;
+    std::shared_ptr<const Page> page = read_page (p);
+    if (! page)
+        return nullptr;
+    return page_cache.insert (this, p, std::move(page), cache_bytes);
+}
+
+
+
+void
+PagedPointCloud::get (const size_t *slots, int count, int attr, void *out,
+                      size_t cache_bytes) const
+{
+    const size_t bytes = attr < 0 ? 3 * sizeof(float)
+                                  : size_t(m_attributes[attr].count) * 4;
+    char *dst = (char *)out;
+    std::shared_ptr<const Page> pg;
+    int p = -1;
+    for (int i = 0;  i < count;  ++i, dst += bytes) {
+        const size_t slot = slots[i];
+        if (slot >= size_t(m_npoints)) {
+            memset (dst, 0, bytes);
+            continue;
+        }
+        // The results of a search mostly share a few pages, so only look
+        // for another when the slot leaves the current one.
+        if (p < 0 || slot < size_t(m_pages[p].begin) || slot >= size_t(m_pages[p].end)) {
+            auto found = std::upper_bound (m_pages.begin(), m_pages.end(), slot,
+                                           [](size_t s, const PageEntry &e) {
+                                               return s < size_t(e.begin);
+                                           });
+            p = int(found - m_pages.begin()) - 1;
+            pg = page (p, cache_bytes);
+        }
+        if (! pg) {
+            memset (dst, 0, bytes);
+            continue;
+        }
+        const size_t local = slot - size_t(m_pages[p].begin);
+        if (attr < 0) {
+            float *P = (float *)dst;
+            P[0] = pg->x[local];
+            P[1] = pg->y[local];
+            P[2] = pg->z[local];
+        } else {
+            memcpy (dst, pg->values[attr] + local * bytes, bytes);
+        }
+    }
+}
+#endif
+
+
+
+bool
+pointcloud_flush (ustring filename, bool wait)
+{
+#ifdef USE_PARTIO
+    PointCloud *pc = NULL;
+    {
+        spin_lock lock (pointcloudmap_mutex);
+        PointCloudMap::const_iterator found = pointclouds.find(filename);
+        if (found != pointclouds.end())
+            pc = found->second.get();
+    }
+    if (! pc || ! pc->m_write)
+        return false;
+    pc->flush (wait);
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+
+bool
+pointcloud_make_paged (ustring filename)
+{
+#ifdef USE_PARTIO
+    std::string paged = PagedPointCloud::paged_filename (filename);
+    if (PagedPointCloud::open (paged, filename.string()))
+        return true;   // Already current
+    // Read the cloud straight from Partio, so that it isn't kept loaded
+    Partio::ParticlesDataMutable *cloud = Partio::read (filename.c_str(), false);
+    if (! cloud)
+        return false;
+    Partio::ParticleAttribute pos;
+    bool ok = cloud->attributeInfo ("position", pos)
+              && pos.type == Partio::VECTOR && cloud->numParticles();
+    if (ok) {
+        PointCloudTree tree;
+        tree.build (cloud, pos);
+        ok = PagedPointCloud::write (paged, cloud, tree,
+                                     OIIO::Filesystem::file_size (filename),
+                                     OIIO::Filesystem::last_write_time (filename));
+    }
+    cloud->release ();
+    return ok;
+#else
+    return false;
+#endif
+}
+
+
+
+PointCloudPageStats
+pointcloud_page_stats ()
+{
+#ifdef USE_PARTIO
+    return page_cache.stats ();
+#else
+    return PointCloudPageStats();
+#endif
+}
+
+
+
+bool
+pointcloud_device_image (ustring filename, std::vector<char> &image)
+{
+#ifdef USE_PARTIO
+    static_assert (sizeof(DevicePointCloud::Node) == sizeof(PointCloudTree::Node),
+                   "DevicePointCloud::Node must match PointCloudTree::Node");
+    PointCloud *pc = PointCloud::get (filename);
+    if (! pc || pc->m_write || ! pc->tree())
+        return false;
+    const PointCloudTree &tree (*pc->tree());
+    const Partio::ParticlesData *cloud = pc->read_access();
+
+    // The float and int attributes, whose values we gather into tree order
+    std::vector<const Partio::ParticleAttribute*> attrs;
+    for (auto &&a : pc->m_attributes) {
+        const Partio::ParticleAttribute *attr = a.second.get();
+        if (attr->type == Partio::FLOAT || attr->type == Partio::VECTOR
+              || attr->type == Partio::INT)
+            attrs.push_back (attr);
+    }
+
+    const size_t npoints = size_t(tree.npoints);
+    auto align = [](size_t offset) { return (offset + 15) & ~size_t(15); };
+    DevicePointCloud header {};
+    header.npoints = tree.npoints;
+    header.nnodes = tree.nnodes;
+    header.nattributes = int(attrs.size());
+    size_t size = align (sizeof(DevicePointCloud));
+    header.nodes_offset = size;
+    size = align (size + tree.nnodes * sizeof(DevicePointCloud::Node));
+    header.x_offset = size;
+    size = align (size + npoints * sizeof(float));
+    header.y_offset = size;
+    size = align (size + npoints * sizeof(float));
+    header.z_offset = size;
+    size = align (size + npoints * sizeof(float));
+    header.index_offset = size;
+    size = align (size + npoints * sizeof(int));
+    header.slot_offset = size;
+    size = align (size + npoints * sizeof(int));
+    header.attributes_offset = size;
+    size = align (size + attrs.size() * sizeof(DevicePointCloud::Attribute));
+    std::vector<DevicePointCloud::Attribute> table (attrs.size());
+    for (size_t a = 0; a < attrs.size(); ++a) {
+        table[a].name = ustring(attrs[a]->name).hash();
+        table[a].basetype = attrs[a]->type == Partio::INT ? TypeDesc::INT
+                                                          : TypeDesc::FLOAT;
+        table[a].nvalues = attrs[a]->count;
+        table[a].offset = size;
+        size = align (size + npoints * attrs[a]->count * 4);
+    }
+
+    image.assign (size, 0);
+    char *base = image.data();
+    memcpy (base, &header, sizeof(header));
+    memcpy (base + header.nodes_offset, tree.nodes,
+            tree.nnodes * sizeof(DevicePointCloud::Node));
+    memcpy (base + header.x_offset, tree.x, npoints * sizeof(float));
+    memcpy (base + header.y_offset, tree.y, npoints * sizeof(float));
+    memcpy (base + header.z_offset, tree.z, npoints * sizeof(float));
+    memcpy (base + header.index_offset, tree.index, npoints * sizeof(int));
+    int *slot = reinterpret_cast<int*>(base + header.slot_offset);
+    for (size_t p = 0; p < npoints; ++p)
+        slot[tree.index[p]] = int(p);
+    memcpy (base + header.attributes_offset, table.data(),
+            table.size() * sizeof(DevicePointCloud::Attribute));
+    for (size_t a = 0; a < attrs.size(); ++a) {
+        // Ints and floats are both 4 bytes, so the copy needn't care which
+        const size_t bytes = attrs[a]->count * 4;
+        char *dst = base + table[a].offset;
+        for (size_t p = 0; p < npoints; ++p, dst += bytes)
+            memcpy (dst, cloud->data<float> (*attrs[a], tree.index[p]), bytes);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
 
 } // namespace pvt
 
@@ -93,19 +1117,22 @@ RendererServices::pointcloud_search (ShaderGlobals *sg,
     }
 
     const Partio::ParticlesData *cloud = pc->read_access();
-    if (cloud == NULL) { // The file failed to load
+    const PagedPointCloud *paged = pc->paged();
+    if (cloud == NULL && paged == NULL) { // The file failed to load
         sg->context->errorfmt("pointcloud_search: could not open \"{}\"", filename);
         return 0;
     }
 
     // Early exit if the pointcloud contains no particles.
-    if (cloud->numParticles() == 0)
+    if ((paged ? paged->npoints() : cloud->numParticles()) == 0)
        return 0;
 
+    const PointCloudTree *tree = pc->tree();
+
     // If we need derivs of the distances, we'll need access to the 
     // found point's positions.
     Partio::ParticleAttribute *pos_attr = NULL;
-    if (derivs_offset) {
+    if (derivs_offset && !tree && !paged) {
         pos_attr = pc->m_attributes[u_position].get();
         if (! pos_attr)
             return 0;   // No "position" attribute -- fail
@@ -122,13 +1149,56 @@ RendererServices::pointcloud_search (ShaderGlobals *sg,
     if (! dist2)  // If not supplied, allocate our own
         dist2 = (float *)sg->context->alloc_scratch (max_points*sizeof(float), sizeof(float));
 
-    float finalRadius;
-    int count = cloud->findNPoints (&center[0], max_points, radius,
+    int count;
+    if (tree) {
+        // The tree search leaves its results already sorted if asked to,
+        // with tree order slots that we convert to particle indices in
+        // place, after picking up the positions for the derivatives.
+        count = tree->find_nearest (&center[0], radius, max_points, sort,
+                                    out_indices, dist2);
+        if (out_distances) {
+            for (int i = 0; i < count; ++i)
+                out_distances[i] = sqrtf(dist2[i]);
+            if (derivs_offset) {
+                const Vec3 &dCdx = (&center)[1];
+                const Vec3 &dCdy = (&center)[2];
+                float *d_distance_dx = out_distances + derivs_offset;
+                float *d_distance_dy = out_distances + derivs_offset * 2;
+                for (int i = 0; i < count; ++i) {
+                    size_t p = out_indices[i];
+                    Vec3 delta (center.x - tree->x[p], center.y - tree->y[p],
+                                center.z - tree->z[p]);
+                    if (out_distances[i] > 0) {
+                        d_distance_dx[i] = 1.0f / out_distances[i] * delta.dot(dCdx);
+                        d_distance_dy[i] = 1.0f / out_distances[i] * delta.dot(dCdy);
+                    } else {
+                        // distance is 0, derivs would be infinite which could cause trouble downstream
+                        d_distance_dx[i] = 0;
+                        d_distance_dy[i] = 0;
+                    }
+                }
+            }
+        }
+        for (int i = 0; i < count; ++i)
+            out_indices[i] = size_t(tree->index[out_indices[i]]);
+        return count;
+    }
+
+    const size_t cache_bytes = sg->context->shadingsys().pointcloud_cache_bytes();
+    if (paged) {
+        // A paged cloud's points are known by their slots, so the results
+        // need no converting, and come out sorted if asked to.
+        count = paged->find_nearest (&center[0], radius, max_points, sort,
+                                     out_indices, dist2, cache_bytes);
+    } else {
+        float finalRadius;
+        count = cloud->findNPoints (&center[0], max_points, radius,
                                     indices, dist2, &finalRadius);
+    }
 
     // If sorting, allocate some temp space and sort the distances and
     // indices at the same time.
-    if (sort && count > 1) {
+    if (sort && count > 1 && !paged) {
         SortedPointRecord *sorted = (SortedPointRecord *) sg->context->alloc_scratch (count * sizeof(SortedPointRecord), sizeof(SortedPointRecord));
         for (int i = 0;  i < count;  ++i)
             sorted[i] = SortedPointRecord (dist2[i], indices[i]);
@@ -148,8 +1218,11 @@ RendererServices::pointcloud_search (ShaderGlobals *sg,
             // We are going to need the positions if we need to compute
             // distance derivs
             Vec3 *positions = (Vec3 *) sg->context->alloc_scratch (sizeof(Vec3) * count, sizeof(float));
-            // FIXME(Partio): this function really should be marked as const because it is just a wrapper of a private const method
-            const_cast<Partio::ParticlesData*>(cloud)->data (*pos_attr, count, indices, true, (void *)positions);
+            if (paged)
+                paged->get (out_indices, count, -1, positions, cache_bytes);
+            else
+                // FIXME(Partio): this function really should be marked as const because it is just a wrapper of a private const method
+                const_cast<Partio::ParticlesData*>(cloud)->data (*pos_attr, count, indices, true, (void *)positions);
             const Vec3 &dCdx = (&center)[1];
             const Vec3 &dCdy = (&center)[2];
             float *d_distance_dx = out_distances + derivs_offset;
@@ -198,7 +1271,8 @@ RendererServices::pointcloud_get (ShaderGlobals *sg,
     }
 
     const Partio::ParticlesData *cloud = pc->read_access();
-    if (cloud == NULL) { // The file failed to load
+    const PagedPointCloud *paged = pc->paged();
+    if (cloud == NULL && paged == NULL) { // The file failed to load
         sg->context->errorfmt("pointcloud_get: could not open \"{}\"",
                               filename);
         return 0;
@@ -242,12 +1316,17 @@ RendererServices::pointcloud_get (ShaderGlobals *sg,
     // then copy them back to the caller's indices.
 
     // Actual data query
+    const size_t cache_bytes = sg->context->shadingsys().pointcloud_cache_bytes();
     if (partio_type == TypeString) {
         // strings are special cases because they are stored as int index
         int* strindices = OIIO_ALLOCA(int, count);
-        const_cast<Partio::ParticlesData*>(cloud)->data (*attr, count,
+        if (paged)
+            paged->get (indices, count, attr->attributeIndex, strindices, cache_bytes);
+        else
+            const_cast<Partio::ParticlesData*>(cloud)->data (*attr, count,
                     (const Partio::ParticleIndex *)indices, /*sorted=*/false, (void*)strindices);
-        const auto& strings = cloud->indexedStrs(*attr);
+        const auto& strings = paged ? paged->attributes()[attr->attributeIndex].strings
+                                    : cloud->indexedStrs(*attr);
         int sicount = int(strings.size());
         for (int i = 0; i < count; ++i) {
             int ind = strindices[i];
@@ -256,6 +1335,8 @@ RendererServices::pointcloud_get (ShaderGlobals *sg,
             else
                 ((ustring *)out_data)[i] = ustring();
         }
+    } else if (paged) {
+        paged->get (indices, count, attr->attributeIndex, out_data, cache_bytes);
     } else {
         // All cases aside from strings are simple.
         const_cast<Partio::ParticlesData*>(cloud)->data (*attr, count,
@@ -274,7 +1355,7 @@ RendererServices::pointcloud_get (ShaderGlobals *sg,
 
 
 bool
-RendererServices::pointcloud_write (ShaderGlobals* /*sg*/,
+RendererServices::pointcloud_write (ShaderGlobals* sg,
                                     ustring filename, const Vec3 &pos,
                                     int nattribs, const ustring *names,
                                     const TypeDesc *types,
@@ -283,67 +1364,42 @@ RendererServices::pointcloud_write (ShaderGlobals* /*sg*/,
 #ifdef USE_PARTIO
     if (filename.empty())
         return false;
-    PointCloud *pc = PointCloud::get(filename, true /* create file to write */);
-    spin_lock lock (pc->m_mutex);
-    Partio::ParticlesDataMutable *cloud = pc->write_access();
-    if (cloud == NULL) // The file failed to load
+    PointCloud *pc = PointCloud::get(filename, true /* create file to write */,
+                        sg->context->shadingsys().pointcloud_bake_index(),
+                        sg->context->shadingsys().pointcloud_bake_pages());
+    if (pc->write_access() == NULL) // The file failed to load
         return false;
 
-    // Mark the pointcloud as written, so we will save it later
-    pc->m_write = true;
-
-    // first time only -- add "position" attribute
-    if (cloud->numParticles() == 0)
-        pc->m_position_attribute = cloud->addAttribute ("position", Partio::VECTOR, 3);
-
-    // Make sure all the attributes mentioned have been added properly
+    // Stage the point in this thread's buffer; it joins the cloud itself
+    // when the cloud is flushed or saved.
+    PointCloudWriteBuffer &buf (pc->write_buffer());
+    spin_lock lock (buf.mutex);
+    int point = int(buf.positions.size());
+    buf.positions.push_back (pos);
     bool ok = true;
-    std::vector<Partio::ParticleAttribute *> partattrs;
-    partattrs.reserve (nattribs);
     for (int i = 0;  i < nattribs;  ++i) {
-        Partio::ParticleAttribute *a = pc->m_attributes[names[i]].get();
-        if (!a) {  // attribute needs to be added
-            Partio::ParticleAttributeType pt = PartioType (types[i]);
-            if (pt == Partio::NONE) {
-                ok = false;
-            } else {
-                a = new Partio::ParticleAttribute ();
-                *a = cloud->addAttribute (names[i].c_str(), pt,
-                                          pt==Partio::VECTOR ? 3 : 1 /*count*/);
-                pc->m_attributes[names[i]].reset(a);
-            }
-        }
-        partattrs.push_back (a);
-    }
-
-    // Make a new particle
-    Partio::ParticleIndex p = cloud->addParticle();
-    *(Vec3 *)cloud->dataWrite<float>(pc->m_position_attribute, p) = pos;
-    for (int i = 0;  i < nattribs;  ++i) {
-        Partio::ParticleAttribute *a = partattrs[i];
-        if (a  &&  PartioType(types[i]) == a->type) {
-            switch (a->type) {
-            case Partio::FLOAT :
-                *(float *)cloud->dataWrite<float>(*a, p) = *(float *)(data[i]);
-                break;
-            case Partio::VECTOR :
-                *(Vec3 *)cloud->dataWrite<float>(*a, p) = *(Vec3 *)(data[i]);
-                break;
-            case Partio::INT :
-                *(int *)cloud->dataWrite<int>(*a, p) = *(int *)(data[i]);
-                break;
-            case Partio::INDEXEDSTR : {
-                const char* s = *(const char**)(data[i]);
-                int index = cloud->lookupIndexedStr(*a, s);
-                if (index == -1)
-                    index = cloud->registerIndexedStr(*a, s);
-                *(int *)cloud->dataWrite<int>(*a, p) = index;
-                }
-                break;
-            case Partio::NONE :
-                break;
-            }
+        PointCloudWriteBuffer::Value v;
+        v.point = point;
+        v.name = names[i];
+        v.type = PartioType (types[i]);
+        switch (v.type) {
+        case Partio::FLOAT :
+            v.f[0] = *(const float *)(data[i]);
+            break;
+        case Partio::VECTOR :
+            memcpy (v.f, data[i], 3 * sizeof(float));
+            break;
+        case Partio::INT :
+            v.i = *(const int *)(data[i]);
+            break;
+        case Partio::INDEXEDSTR :
+            v.s = ustring::from_unique (*(const char **)(data[i]));
+            break;
+        case Partio::NONE :
+            ok = false;
+            continue;
         }
+        buf.values.push_back (v);
     }
 
     return ok;
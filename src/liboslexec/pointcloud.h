@@ -3,8 +3,15 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 #ifdef USE_PARTIO
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 #include <Partio.h>
 #endif
 
@@ -15,17 +22,417 @@ namespace pvt {
 
 #ifdef USE_PARTIO
 
+/// Flat kd-tree over the positions of a read-only point cloud, built by
+/// OSL when the cloud is loaded and used by both the scalar and batched
+/// pointcloud_search in place of Partio's own kd-tree.  Points are stored
+/// Structure of Arrays in tree order, so a leaf is a short contiguous run
+/// that can be distance tested against all lanes of a batch at once, and
+/// every node keeps its bounding box so that it can be culled with a single
+/// test.  The arrays are either owned, or a read-only memory map of an
+/// index file saved when the cloud was baked, shared by every process
+/// that renders with it.
+struct PointCloudTree {
+    enum { LeafSize = 16 };
+
+    PointCloudTree () = default;
+    PointCloudTree (const PointCloudTree&) = delete;
+    PointCloudTree& operator= (const PointCloudTree&) = delete;
+    ~PointCloudTree ();
+
+    struct Node {
+        float lo[3], hi[3];  ///< Bounds of the points beneath this node
+        float split;         ///< Median along 'axis' (interior nodes only)
+        int axis;            ///< Split axis, or -1 for a leaf
+        int begin, end;      ///< Range of points beneath this node
+        int right;           ///< Right child; the left child is this+1
+        bool leaf() const { return axis < 0; }
+    };
+
+    /// Build from the "position" attribute of 'cloud'.  Large clouds are
+    /// split across up to 'nthreads' threads (0 means one per core).
+    void build (const Partio::ParticlesData *cloud,
+                const Partio::ParticleAttribute &pos, int nthreads = 0);
+
+    /// Save to 'filename', tagged with the size and modification time of
+    /// the cloud file it indexes.  Returns true on success.
+    bool save (const std::string &filename, uint64_t source_size,
+               int64_t source_mtime) const;
+
+    /// Memory map an index previously written by save(), if it describes
+    /// 'npoints' points of a cloud file with the given size and
+    /// modification time.  Returns false (leaving the tree empty) if the
+    /// file is missing, stale or mapping is unsupported.
+    bool map (const std::string &filename, int npoints,
+              uint64_t source_size, int64_t source_mtime);
+
+    /// Name of the index file that accompanies a cloud file.
+    static std::string index_filename (ustring cloud_filename) {
+        return cloud_filename.string() + ".oslpci";
+    }
+
+    /// Find up to 'max_points' points closer than 'radius' to 'center',
+    /// storing their tree order slots and squared distances.  Once
+    /// 'max_points' have been found, only closer points replace them, as
+    /// with Partio's findNPoints.  If 'sort' is true the results come out
+    /// nearest first.  Returns the number of points found.
+    template<typename IndexT>
+    int find_nearest (const float *center, float radius, int max_points,
+                      bool sort, IndexT *slots, float *dist2) const;
+
+    /// The search that find_nearest runs, over the subtree rooted at
+    /// nodes[0] with its own position arrays, adding 'base' to the slots
+    /// it stores.  'count' and 'bound' (the squared search radius) carry
+    /// the bounded max-heap in slots/dist2 from one call to the next, so
+    /// several subtrees can be searched as though they were one tree.
+    template<typename IndexT>
+    static void search (const Node *nodes, const float *x, const float *y,
+                        const float *z, int base, const float *center,
+                        int max_points, IndexT *slots, float *dist2,
+                        int &count, float &bound);
+
+    /// Sort the heap left by search, nearest first.
+    template<typename IndexT>
+    static void sort_results (IndexT *slots, float *dist2, int count);
+
+    /// Number of nodes in the tree (or subtree) over n points.
+    static int count_nodes (int n) {
+        return n <= LeafSize ? 1 : 1 + count_nodes (n / 2) + count_nodes (n - n / 2);
+    }
+
+    const Node *nodes = nullptr;
+    const float *x = nullptr;    ///< Positions, in tree order
+    const float *y = nullptr;
+    const float *z = nullptr;
+    const int *index = nullptr;  ///< Partio particle index, in tree order
+    int nnodes = 0;
+    int npoints = 0;
+
+private:
+    std::vector<Node> m_nodes;
+    std::vector<float> m_x, m_y, m_z;
+    std::vector<int> m_index;
+    void *m_map = nullptr;       ///< Base of a mapped index file
+    size_t m_mapsize = 0;
+
+    void build_node (int id, int begin, int end, int depth, int maxdepth,
+                     std::vector<int> &perm, const std::vector<float> *pos);
+    template<typename IndexT>
+    static void sift_down (IndexT *slots, float *dist2, int i, int n);
+};
+
+
+
+template<typename IndexT>
+inline void
+PointCloudTree::sift_down (IndexT *slots, float *dist2, int i, int n)
+{
+    // Max-heap on dist2, with the slots moved alongside.
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= n)
+            break;
+        if (c + 1 < n && dist2[c + 1] > dist2[c])
+            ++c;
+        if (!(dist2[c] > dist2[i]))
+            break;
+        std::swap (dist2[i], dist2[c]);
+        std::swap (slots[i], slots[c]);
+        i = c;
+    }
+}
+
+
+
+template<typename IndexT>
+inline void
+PointCloudTree::search (const Node *nodes, const float *x, const float *y,
+                        const float *z, int base, const float *center,
+                        int max_points, IndexT *slots, float *dist2,
+                        int &count, float &bound)
+{
+    // The output arrays themselves hold the bounded max-heap, so nothing
+    // needs to be copied once the search is done.
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top) {
+        const int id = stack[--top];
+        const Node &node (nodes[id]);
+        float d2 = 0.0f;
+        for (int a = 0;  a < 3;  ++a) {
+            float d = std::max (std::max (node.lo[a] - center[a],
+                                          center[a] - node.hi[a]), 0.0f);
+            d2 += d * d;
+        }
+        if (!(d2 < bound))
+            continue;
+        if (! node.leaf()) {
+            // Visit the near child last so that it is searched first
+            if (center[node.axis] < node.split) {
+                stack[top++] = node.right;
+                stack[top++] = id + 1;
+            } else {
+                stack[top++] = id + 1;
+                stack[top++] = node.right;
+            }
+            continue;
+        }
+        for (int p = node.begin;  p < node.end;  ++p) {
+            float dx = center[0] - x[p];
+            float dy = center[1] - y[p];
+            float dz = center[2] - z[p];
+            float pd2 = dx * dx + dy * dy + dz * dz;
+            if (!(pd2 < bound))
+                continue;
+            if (count < max_points) {
+                // Append and sift up
+                int i = count++;
+                while (i > 0 && dist2[(i - 1) / 2] < pd2) {
+                    dist2[i] = dist2[(i - 1) / 2];
+                    slots[i] = slots[(i - 1) / 2];
+                    i = (i - 1) / 2;
+                }
+                dist2[i] = pd2;
+                slots[i] = IndexT(base + p);
+                if (count == max_points)
+                    bound = dist2[0];
+            } else {
+                // Replace the farthest point
+                dist2[0] = pd2;
+                slots[0] = IndexT(base + p);
+                sift_down (slots, dist2, 0, count);
+                bound = dist2[0];
+            }
+        }
+    }
+}
+
+
+
+template<typename IndexT>
+inline void
+PointCloudTree::sort_results (IndexT *slots, float *dist2, int count)
+{
+    // Heap sort in place, nearest first
+    for (int n = count - 1;  n > 0;  --n) {
+        std::swap (dist2[0], dist2[n]);
+        std::swap (slots[0], slots[n]);
+        sift_down (slots, dist2, 0, n);
+    }
+}
+
+
+
+template<typename IndexT>
+inline int
+PointCloudTree::find_nearest (const float *center, float radius,
+                              int max_points, bool sort, IndexT *slots,
+                              float *dist2) const
+{
+    if (max_points <= 0 || nnodes == 0)
+        return 0;
+    float bound = radius * radius;
+    int count = 0;
+    search (nodes, x, y, z, 0, center, max_points, slots, dist2, count, bound);
+    if (sort)
+        sort_results (slots, dist2, count);
+    return count;
+}
+
+
+
+/// A read-only point cloud stored split into pages, each a subtree of its
+/// kd-tree holding at most PageSize points with their positions and
+/// attribute values, so that clouds far larger than memory can be
+/// searched.  Only the top of the tree, above the pages, and the page
+/// table stay in memory; a search reads in just the pages whose bounds
+/// come within its radius, and they are kept in a cache, shared by every
+/// paged cloud, whose size is bounded by the "pointcloud_max_memory_MB"
+/// attribute.  Its points are known by their tree order slots, which a
+/// search returns in place of Partio particle indices.
+class PagedPointCloud {
+public:
+    enum { PageSize = 4096 };
+    typedef PointCloudTree::Node Node;
+
+    ~PagedPointCloud ();
+
+    /// One page as read from the file.
+    struct Page {
+        std::unique_ptr<char[]> data;
+        size_t size = 0;
+        const Node *nodes = nullptr;  ///< Point ranges are page relative
+        const float *x = nullptr, *y = nullptr, *z = nullptr;
+        std::vector<const char *> values;  ///< Of each attribute
+    };
+
+    struct Attribute {
+        std::string name;
+        Partio::ParticleAttributeType type;
+        int count;                          ///< Values per point
+        std::vector<std::string> strings;   ///< INDEXEDSTR values
+    };
+
+    /// Write 'cloud', whose kd-tree is 'tree', as a paged cloud file
+    /// tagged with the size and modification time of the cloud file it
+    /// copies.  Returns true on success.
+    static bool write (const std::string &filename,
+                       const Partio::ParticlesData *cloud,
+                       const PointCloudTree &tree, uint64_t source_size,
+                       int64_t source_mtime);
+
+    /// Open a paged cloud file for reading.  If 'source' is not empty, the
+    /// file must be a current copy of that cloud file.  Returns NULL if
+    /// the file isn't a paged cloud, or is stale.
+    static std::unique_ptr<PagedPointCloud> open (const std::string &filename,
+                                                  const std::string &source = std::string());
+
+    /// Name of the paged copy that accompanies a cloud file.
+    static std::string paged_filename (ustring cloud_filename) {
+        return cloud_filename.string() + ".oslpcp";
+    }
+
+    /// As PointCloudTree::find_nearest, reading pages through a cache of
+    /// at most 'cache_bytes'.
+    template<typename IndexT>
+    int find_nearest (const float *center, float radius, int max_points,
+                      bool sort, IndexT *slots, float *dist2,
+                      size_t cache_bytes) const;
+
+    /// Copy the values of attribute 'attr' (or the positions, if it is -1)
+    /// for the points at 'count' slots to 'out', as Partio would.  The
+    /// values of an INDEXEDSTR attribute are indices into its strings.
+    void get (const size_t *slots, int count, int attr, void *out,
+              size_t cache_bytes) const;
+
+    int npoints () const { return m_npoints; }
+    const std::vector<Attribute> &attributes () const { return m_attributes; }
+
+private:
+    struct PageEntry {
+        uint64_t offset;       ///< Of the page's data in the file
+        uint64_t size;
+        int begin, end;        ///< Slots of the page's points
+        int nnodes;
+        int first_node;        ///< Of the page in the whole tree
+    };
+
+    PagedPointCloud () = default;
+    int add_top_node (const PointCloudTree &tree, int id);
+    std::shared_ptr<const Page> page (int p, size_t cache_bytes) const;
+    std::shared_ptr<const Page> read_page (int p) const;
+
+    int m_npoints = 0;
+    std::vector<Node> m_top;          ///< Leaves are pages: 'right' is the page
+    std::vector<PageEntry> m_pages;
+    std::vector<Attribute> m_attributes;
+    FILE *m_file = nullptr;
+    mutable std::mutex m_file_mutex;
+};
+
+
+
+template<typename IndexT>
+inline int
+PagedPointCloud::find_nearest (const float *center, float radius,
+                               int max_points, bool sort, IndexT *slots,
+                               float *dist2, size_t cache_bytes) const
+{
+    if (max_points <= 0 || m_top.empty())
+        return 0;
+    float bound = radius * radius;
+    int count = 0;
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top) {
+        const int id = stack[--top];
+        const Node &node (m_top[id]);
+        float d2 = 0.0f;
+        for (int a = 0;  a < 3;  ++a) {
+            float d = std::max (std::max (node.lo[a] - center[a],
+                                          center[a] - node.hi[a]), 0.0f);
+            d2 += d * d;
+        }
+        if (!(d2 < bound))
+            continue;
+        if (! node.leaf()) {
+            if (center[node.axis] < node.split) {
+                stack[top++] = node.right;
+                stack[top++] = id + 1;
+            } else {
+                stack[top++] = id + 1;
+                stack[top++] = node.right;
+            }
+            continue;
+        }
+        // Only now that its bounds are within reach is the page read in
+        std::shared_ptr<const Page> pg = page (node.right, cache_bytes);
+        if (pg)
+            PointCloudTree::search (pg->nodes, pg->x, pg->y, pg->z,
+                                    m_pages[node.right].begin, center,
+                                    max_points, slots, dist2, count, bound);
+    }
+    if (sort)
+        PointCloudTree::sort_results (slots, dist2, count);
+    return count;
+}
+
+
+
+/// One thread's pending pointcloud_write points for a cloud.  Writers
+/// append here without touching the cloud itself, and PointCloud::flush
+/// merges every thread's buffer into it.
+struct PointCloudWriteBuffer {
+    struct Value {
+        int point;                      ///< Index into 'positions'
+        ustring name;
+        Partio::ParticleAttributeType type;
+        float f[3];                     ///< FLOAT and VECTOR values
+        int i;                          ///< INT values
+        ustring s;                      ///< INDEXEDSTR values
+    };
+    OIIO::spin_mutex mutex;             ///< Only contended while flushing
+    std::vector<Vec3> positions;
+    std::vector<Value> values;
+};
+
+
+
 class PointCloud {
 public:
     PointCloud (ustring filename, Partio::ParticlesDataMutable *partio_cloud, bool write);
+    PointCloud (ustring filename, std::unique_ptr<PagedPointCloud> paged);
     ~PointCloud ();
-    static PointCloud *get (ustring filename, bool write = false);
+    /// Find or load the named cloud.  A cloud created for writing with
+    /// 'write_index' also saves its search index when it is saved, and
+    /// with 'write_pages' a paged copy of itself.  A cloud read from a
+    /// paged file, or that has a current paged copy, is read a page at a
+    /// time rather than loaded.
+    static PointCloud *get (ustring filename, bool write = false,
+                            bool write_index = false, bool write_pages = false);
 
     typedef std::unordered_map<ustring, std::unique_ptr<Partio::ParticleAttribute>, ustringHash> AttributeMap;
 
     const Partio::ParticlesData* read_access() const { OSL_DASSERT(!m_write); return m_partio_cloud; }
     Partio::ParticlesDataMutable* write_access() const { OSL_DASSERT(m_write); return m_partio_cloud; }
 
+    /// The kd-tree built when the cloud was loaded, or NULL for clouds
+    /// being written or that lack a "position" attribute.
+    const PointCloudTree* tree () const { return m_tree.get(); }
+
+    /// The paged cloud, for clouds read a page at a time (which have no
+    /// Partio data), or NULL.
+    const PagedPointCloud* paged () const { return m_paged.get(); }
+
+    /// The calling thread's buffer for points written to this cloud.
+    PointCloudWriteBuffer& write_buffer ();
+
+    /// Merge every thread's pending points into the cloud and save it.  If
+    /// 'wait' is false this happens on a background thread, and writers
+    /// may keep appending meanwhile.
+    void flush (bool wait = true);
+
     ustring m_filename;
 private:
     // hide just this field, because we want to control how it is accessed
@@ -34,8 +441,21 @@ public:
 
     AttributeMap m_attributes;
     bool m_write;
+    bool m_write_index = false;
+    bool m_write_pages = false;
     Partio::ParticleAttribute m_position_attribute;
     OIIO::spin_mutex m_mutex;
+
+private:
+    void merge_write_buffers ();  // Caller must hold m_mutex
+    void save ();                 // Caller must hold m_mutex
+
+    std::unique_ptr<PointCloudTree> m_tree;
+    std::unique_ptr<PagedPointCloud> m_paged;
+    std::vector<std::unique_ptr<PointCloudWriteBuffer>> m_write_buffers;
+    OIIO::spin_mutex m_write_buffers_mutex;
+    std::mutex m_flush_mutex;
+    std::thread m_flush_thread;
 };
 
 namespace { // anon
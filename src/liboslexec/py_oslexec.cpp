@@ -0,0 +1,809 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+// Python bindings for building shader groups and shading NumPy arrays of
+// points with them.
+
+// Python.h uses the 'register' keyword, don't warn about it being
+// deprecated in C++17.
+#if (__cplusplus >= 201703L && defined(__GNUC__))
+#    pragma GCC diagnostic ignored "-Wregister"
+#endif
+
+// clang-format off
+// Must include Python.h first to avoid certain warnings
+#ifdef _POSIX_C_SOURCE
+#  error "You must include Python.h BEFORE anything that defines _POSIX_C_SOURCE"
+#endif
+#include <Python.h>
+// clang-format on
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Avoid a compiler warning from a duplication in tiffconf.h/pyconfig.h
+#undef SIZEOF_LONG
+
+#include <OpenImageIO/parallel.h>
+
+#include <OSL/oslexec.h>
+#include <OSL/rendererservices.h>
+#if OSL_USE_BATCHED
+#    include <OSL/batched_rendererservices.h>
+#    include <OSL/batched_shaderglobals.h>
+#endif
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+namespace py = pybind11;
+
+
+namespace PyOSL {
+
+using namespace OSL;
+
+
+
+// The renderer behind a Python ShadingSystem: transformations are plain
+// 4x4 matrices, and there are no named spaces, attributes, or userdata.
+class PyRendererServices final : public RendererServices {
+public:
+    PyRendererServices() {}
+
+    virtual int supports(string_view /*feature*/) const { return false; }
+
+    virtual bool get_matrix(ShaderGlobals* /*sg*/, Matrix44& result,
+                            TransformationPtr xform, float /*time*/)
+    {
+        result = *reinterpret_cast<const Matrix44*>(xform);
+        return true;
+    }
+    virtual bool get_matrix(ShaderGlobals* /*sg*/, Matrix44& result,
+                            TransformationPtr xform)
+    {
+        result = *reinterpret_cast<const Matrix44*>(xform);
+        return true;
+    }
+    virtual bool get_matrix(ShaderGlobals* /*sg*/, Matrix44& /*result*/,
+                            ustring /*from*/, float /*time*/)
+    {
+        return false;
+    }
+    virtual bool get_matrix(ShaderGlobals* /*sg*/, Matrix44& /*result*/,
+                            ustring /*from*/)
+    {
+        return false;
+    }
+
+#if OSL_USE_BATCHED
+    template<int WidthT>
+    class Batched final : public BatchedRendererServices<WidthT> {
+    public:
+        explicit Batched(TextureSystem* texsys)
+            : BatchedRendererServices<WidthT>(texsys)
+        {
+        }
+
+        OSL_USING_DATA_WIDTH(WidthT);
+
+        Mask get_matrix(BatchedShaderGlobals* /*bsg*/, Masked<Matrix44> result,
+                        Wide<const TransformationPtr> xform,
+                        Wide<const float> /*time*/) override
+        {
+            result.mask().foreach([&](ActiveLane lane) -> void {
+                result[lane] = *reinterpret_cast<const Matrix44*>(xform[lane]);
+            });
+            return result.mask();
+        }
+        bool is_overridden_get_inverse_matrix_WmWxWf() const override
+        {
+            return false;
+        }
+        bool is_overridden_get_matrix_WmWsWf() const override { return false; }
+        bool is_overridden_get_inverse_matrix_WmsWf() const override
+        {
+            return false;
+        }
+        bool is_overridden_get_inverse_matrix_WmWsWf() const override
+        {
+            return false;
+        }
+        bool is_overridden_texture() const override { return false; }
+        bool is_overridden_texture3d() const override { return false; }
+        bool is_overridden_environment() const override { return false; }
+        bool is_overridden_pointcloud_search() const override { return false; }
+        bool is_overridden_pointcloud_get() const override { return false; }
+        bool is_overridden_pointcloud_write() const override { return false; }
+    };
+
+    virtual BatchedRendererServices<16>* batched(WidthOf<16>)
+    {
+        return &m_batched16;
+    }
+    virtual BatchedRendererServices<8>* batched(WidthOf<8>)
+    {
+        return &m_batched8;
+    }
+    virtual BatchedRendererServices<4>* batched(WidthOf<4>)
+    {
+        return &m_batched4;
+    }
+
+private:
+    Batched<16> m_batched16 { texturesys() };
+    Batched<8> m_batched8 { texturesys() };
+    Batched<4> m_batched4 { texturesys() };
+#endif
+};
+
+
+
+// A shader group, and how it's been prepared for execution.
+struct PyShaderGroup {
+    ShaderGroupRef group;
+    std::vector<std::string> outputs;
+    bool jitted     = false;
+    int batch_width = 0;  // 0 means it's shaded one point at a time
+    // Outputs the group writes straight to the output arena (see
+    // place_outputs), by their offset in the record kept for each point.
+    std::map<std::string, size_t> placed;
+    size_t placed_stride = 0;  // bytes per point in the output arena
+    // Userdata that batched execution loads from blocks filled in for
+    // each batch (see place_userdata), by its type and its offset in the
+    // userdata arena of a batch.
+    std::map<std::string, std::pair<TypeDesc, size_t>> placed_userdata;
+    size_t userdata_size = 0;  // bytes of userdata arena per batch
+};
+
+
+
+// A float or int array shared with Python: checked to be C contiguous and
+// of the expected element type and size, then accessed in place.
+struct ArrayView {
+    char* data = nullptr;
+    size_t size = 0;  // in elements
+};
+
+static ArrayView
+array_view(const std::string& what, py::buffer buf, TypeDesc basetype,
+           bool writable)
+{
+    py::buffer_info info = buf.request(writable);
+    bool type_ok = (basetype == TypeDesc::FLOAT)
+                       ? info.format == py::format_descriptor<float>::format()
+                       : (info.itemsize == 4
+                          && (info.format == "i" || info.format == "l"));
+    if (!type_ok)
+        throw py::type_error(what + " must be an array of "
+                             + (basetype == TypeDesc::FLOAT ? "float32"
+                                                            : "int32"));
+    // Shading reads and writes the caller's memory directly, so it must
+    // be laid out as one dense run of values.
+    ssize_t stride = info.itemsize;
+    for (ssize_t d = info.ndim - 1; d >= 0; --d) {
+        if (info.shape[d] > 1 && info.strides[d] != stride)
+            throw py::value_error(what + " must be C contiguous");
+        stride *= info.shape[d];
+    }
+    ArrayView view;
+    view.data = (char*)info.ptr;
+    view.size = size_t(info.size);
+    return view;
+}
+
+
+
+// Everything a shading thread needs, gathered while holding the GIL.
+struct ShadeJob {
+    ShadingSystem* shadingsys;
+    ShaderGroup* group;
+    size_t npoints;
+    const float *P, *N, *u, *v;  // any may be null
+    std::vector<const ShaderSymbol*> output_sym;
+    std::vector<TypeDesc> output_type;
+    std::vector<int> output_nchans;
+    std::vector<char*> output_data;
+    std::vector<size_t> output_placed;  // arena offset, or npos if not placed
+    char* arena = nullptr;              // output arena, if any are placed
+    size_t arena_stride = 0;
+    // Userdata placed as blocks: the caller's array, channels per point,
+    // and offset in the userdata arena of each batch.
+    std::vector<const char*> userdata_data;
+    std::vector<int> userdata_nchans;
+    std::vector<size_t> userdata_offset;
+    size_t userdata_size = 0;
+    ShaderGlobals sg;  // the fields that are the same for every point
+    Matrix44 Mshad, Mobj;
+
+    // Copy the outputs of point i, component c of output o being at
+    // data[o][c * stride], or for a placed one, in its arena record.
+    void save_outputs(size_t i, const void* const* data, int stride) const
+    {
+        for (size_t o = 0; o < output_sym.size(); ++o) {
+            int n           = output_nchans[o];
+            const void* src = data[o];
+            int s           = stride;
+            if (output_placed[o] != std::string::npos) {
+                src = arena + i * arena_stride + output_placed[o];
+                s   = 1;
+            }
+            if (output_type[o].basetype == TypeDesc::FLOAT) {
+                float* dst = (float*)output_data[o] + i * n;
+                for (int c = 0; c < n; ++c)
+                    dst[c] = ((const float*)src)[c * s];
+            } else {
+                int* dst = (int*)output_data[o] + i * n;
+                for (int c = 0; c < n; ++c)
+                    dst[c] = ((const int*)src)[c * s];
+            }
+        }
+    }
+};
+
+
+
+static void
+shade_points(const ShadeJob& job, ShadingContext& ctx, size_t begin,
+             size_t end)
+{
+    size_t noutputs   = job.output_sym.size();
+    const void** data = OIIO_ALLOCA(const void*, noutputs);
+    ShaderGlobals sg  = job.sg;
+    for (size_t i = begin; i < end; ++i) {
+        if (job.P)
+            sg.P = Vec3(job.P[3 * i], job.P[3 * i + 1], job.P[3 * i + 2]);
+        if (job.N) {
+            sg.N  = Vec3(job.N[3 * i], job.N[3 * i + 1], job.N[3 * i + 2]);
+            sg.Ng = sg.N;
+        }
+        if (job.u)
+            sg.u = job.u[i];
+        if (job.v)
+            sg.v = job.v[i];
+        job.shadingsys->execute(ctx, *job.group, int(i), sg, nullptr,
+                                job.arena);
+        for (size_t o = 0; o < noutputs; ++o)
+            data[o] = job.shadingsys->symbol_address(ctx, job.output_sym[o]);
+        job.save_outputs(i, data, 1);
+    }
+}
+
+
+
+#if OSL_USE_BATCHED
+template<int WidthT>
+static void
+batched_shade_points(const ShadeJob& job, ShadingContext& ctx, size_t begin,
+                     size_t end)
+{
+    const ShaderGlobals& sg = job.sg;
+    BatchedShaderGlobals<WidthT> bsg;
+    memset((char*)&bsg.uniform, 0, sizeof(UniformShaderGlobals));
+    auto& vsg = bsg.varying;
+    using OSL::assign_all;
+    assign_all(vsg.P, sg.P);
+    assign_all(vsg.dPdx, sg.dPdx);
+    assign_all(vsg.dPdy, sg.dPdy);
+    assign_all(vsg.dPdz, sg.dPdz);
+    assign_all(vsg.I, sg.I);
+    assign_all(vsg.dIdx, sg.dIdx);
+    assign_all(vsg.dIdy, sg.dIdy);
+    assign_all(vsg.N, sg.N);
+    assign_all(vsg.Ng, sg.Ng);
+    assign_all(vsg.u, sg.u);
+    assign_all(vsg.v, sg.v);
+    assign_all(vsg.dudx, sg.dudx);
+    assign_all(vsg.dudy, sg.dudy);
+    assign_all(vsg.dvdx, sg.dvdx);
+    assign_all(vsg.dvdy, sg.dvdy);
+    assign_all(vsg.dPdu, sg.dPdu);
+    assign_all(vsg.dPdv, sg.dPdv);
+    assign_all(vsg.time, sg.time);
+    assign_all(vsg.dtime, sg.dtime);
+    assign_all(vsg.dPdtime, sg.dPdtime);
+    assign_all(vsg.Ps, sg.Ps);
+    assign_all(vsg.dPsdx, sg.dPsdx);
+    assign_all(vsg.dPsdy, sg.dPsdy);
+    assign_all(vsg.object2common, sg.object2common);
+    assign_all(vsg.shader2common, sg.shader2common);
+    assign_all(vsg.Ci, (ClosureColor*)nullptr);
+    assign_all(vsg.surfacearea, sg.surfacearea);
+    assign_all(vsg.flipHandedness, sg.flipHandedness);
+    assign_all(vsg.backfacing, sg.backfacing);
+
+    size_t noutputs       = job.output_sym.size();
+    const void** data     = OIIO_ALLOCA(const void*, noutputs);
+    const void** lanedata = OIIO_ALLOCA(const void*, noutputs);
+    OSL::Block<int, WidthT> wide_shadeindex;
+    // Each channel of a placed userdata is a Block of the batch's values
+    char* userdata_base = nullptr;
+    if (job.userdata_size)
+        userdata_base = (char*)OIIO::aligned_malloc(
+            job.userdata_size, alignof(OSL::Block<float, WidthT>));
+    for (size_t i0 = begin; i0 < end; i0 += WidthT) {
+        int batch_size = int(std::min(size_t(WidthT), end - i0));
+        for (size_t d = 0; d < job.userdata_data.size(); ++d) {
+            int n        = job.userdata_nchans[d];
+            int32_t* dst = (int32_t*)(userdata_base + job.userdata_offset[d]);
+            const int32_t* src = (const int32_t*)job.userdata_data[d];
+            for (int lane = 0; lane < batch_size; ++lane)
+                for (int c = 0; c < n; ++c)
+                    dst[c * WidthT + lane] = src[(i0 + lane) * n + c];
+        }
+        for (int lane = 0; lane < batch_size; ++lane) {
+            size_t i = i0 + lane;
+            if (job.P)
+                vsg.P[lane] = Vec3(job.P[3 * i], job.P[3 * i + 1],
+                                   job.P[3 * i + 2]);
+            if (job.N) {
+                Vec3 N       = Vec3(job.N[3 * i], job.N[3 * i + 1],
+                                    job.N[3 * i + 2]);
+                vsg.N[lane]  = N;
+                vsg.Ng[lane] = N;
+            }
+            if (job.u)
+                vsg.u[lane] = job.u[i];
+            if (job.v)
+                vsg.v[lane] = job.v[i];
+            wide_shadeindex[lane] = int(i);
+        }
+
+        job.shadingsys->batched<WidthT>().execute(ctx, *job.group,
+                                                  batch_size, wide_shadeindex,
+                                                  bsg, userdata_base,
+                                                  job.arena);
+
+        for (size_t o = 0; o < noutputs; ++o)
+            data[o] = job.shadingsys->symbol_address(ctx, job.output_sym[o]);
+        for (int lane = 0; lane < batch_size; ++lane) {
+            for (size_t o = 0; o < noutputs; ++o)
+                lanedata[o] = (const char*)data[o]
+                              + lane * job.output_type[o].basesize();
+            job.save_outputs(i0 + lane, lanedata, WidthT);
+        }
+    }
+    OIIO::aligned_free(userdata_base);
+}
+#endif
+
+
+
+class PyShadingSystem {
+public:
+    PyShadingSystem()
+        : m_shadingsys(new ShadingSystem(&m_renderer, nullptr, nullptr))
+    {
+    }
+
+    ShadingSystem& shadingsys() { return *m_shadingsys; }
+
+    // Build a group from a serialized group spec, marking the named
+    // outputs as renderer outputs so the optimizer keeps them.
+    PyShaderGroup shader_group(const std::string& groupspec,
+                               const std::vector<std::string>& outputs,
+                               const std::string& usage,
+                               const std::string& name)
+    {
+        PyShaderGroup g;
+        g.group = m_shadingsys->ShaderGroupBegin(name, usage, groupspec);
+        if (!g.group)
+            throw std::runtime_error("Could not build shader group");
+        std::vector<ustring> uoutputs(outputs.begin(), outputs.end());
+        if (uoutputs.size())
+            m_shadingsys->attribute(g.group.get(), "renderer_outputs",
+                                    TypeDesc(TypeDesc::STRING,
+                                             int(uoutputs.size())),
+                                    uoutputs.data());
+        g.outputs = outputs;
+        return g;
+    }
+
+    // Optimize and JIT the group, for batches of the widest width the
+    // machine supports (unless batched is false), and return that width,
+    // or 0 if it will be shaded one point at a time.
+    int jit(PyShaderGroup& g, bool batched)
+    {
+        if (g.jitted)
+            return g.batch_width;
+        py::gil_scoped_release gil;
+        g.batch_width = 0;
+#if OSL_USE_BATCHED
+        if (batched && m_shadingsys->configure_batch_execution_at(16))
+            g.batch_width = 16;
+        else if (batched && m_shadingsys->configure_batch_execution_at(8))
+            g.batch_width = 8;
+        else if (batched && m_shadingsys->configure_batch_execution_at(4))
+            g.batch_width = 4;
+#endif
+        PerThreadInfo* thread_info = m_shadingsys->create_thread_info();
+        ShadingContext* ctx        = m_shadingsys->get_context(thread_info);
+#if OSL_USE_BATCHED
+        if (g.batch_width == 16)
+            m_shadingsys->batched<16>().jit_group(g.group.get(), ctx);
+        else if (g.batch_width == 8)
+            m_shadingsys->batched<8>().jit_group(g.group.get(), ctx);
+        else if (g.batch_width == 4)
+            m_shadingsys->batched<4>().jit_group(g.group.get(), ctx);
+        else
+#endif
+            m_shadingsys->optimize_group(g.group.get(), ctx);
+        m_shadingsys->release_context(ctx);
+        m_shadingsys->destroy_thread_info(thread_info);
+        g.jitted = true;
+        return g.batch_width;
+    }
+
+    // Before it's JITed, have the group write the given outputs (a dict
+    // of name -> type) straight to an output arena, as renderers that use
+    // output placement do, rather than have shade read them back from the
+    // context after each point.
+    void place_outputs(PyShaderGroup& g, py::dict outputs)
+    {
+        if (g.jitted)
+            throw std::runtime_error(
+                "Outputs must be placed before the group is JITed");
+        std::vector<SymLocationDesc> symlocs;
+        for (auto item : outputs) {
+            std::string name = item.first.cast<std::string>();
+            TypeDesc type(item.second.cast<std::string>());
+            if (type.basetype != TypeDesc::FLOAT
+                && type.basetype != TypeDesc::INT)
+                throw py::type_error("Output \"" + name
+                                     + "\" is not float or int based");
+            g.placed[name] = g.placed_stride;
+            g.placed_stride += type.size();
+            symlocs.emplace_back(name, type, /*derivs*/ false,
+                                 SymArena::Outputs, 0);
+        }
+        // One record per point, holding all of the placed outputs.
+        for (auto& s : symlocs) {
+            s.offset = g.placed[s.name.string()];
+            s.stride = g.placed_stride;
+        }
+        m_shadingsys->add_symlocs(g.group.get(), symlocs);
+    }
+
+    // Before it's JITed, have the group's batched code load the given
+    // userdata (a dict of name -> type) from blocks that shade fills in
+    // for each batch from the arrays it's given, as renderers that place
+    // userdata do, rather than ask the renderer for it. Shading one point
+    // at a time ignores this and finds no such userdata.
+    void place_userdata(PyShaderGroup& g, py::dict userdata)
+    {
+        if (g.jitted)
+            throw std::runtime_error(
+                "Userdata must be placed before the group is JITed");
+        std::vector<SymLocationDesc> symlocs;
+        for (auto item : userdata) {
+            std::string name = item.first.cast<std::string>();
+            TypeDesc type(item.second.cast<std::string>());
+            if (type.basetype != TypeDesc::FLOAT
+                && type.basetype != TypeDesc::INT)
+                throw py::type_error("Userdata \"" + name
+                                     + "\" is not float or int based");
+            // Room for a Block of the widest batch (16) per channel, so the
+            // layout doesn't depend on the width the group is JITed for.
+            g.placed_userdata[name] = { type, g.userdata_size };
+            symlocs.emplace_back(name, type, /*derivs*/ false,
+                                 SymArena::UserData, g.userdata_size);
+            symlocs.back().soa = true;
+            g.userdata_size += type.numelements() * type.aggregate * 16
+                               * sizeof(float);
+        }
+        m_shadingsys->add_symlocs(g.group.get(), symlocs);
+    }
+
+    // Shade one point per element of the inputs, writing the outputs
+    // straight into the caller's arrays.
+    void shade(PyShaderGroup& g, py::dict outputs, py::object P,
+               py::object N, py::object u, py::object v, py::dict userdata,
+               int nthreads)
+    {
+        jit(g, true);
+
+        ShadeJob job;
+        job.shadingsys = m_shadingsys.get();
+        job.group      = g.group.get();
+        job.npoints    = 0;
+        bool sized     = false;
+        auto set_npoints = [&](const std::string& what, size_t n) {
+            if (sized && n != job.npoints)
+                throw py::value_error(what
+                                      + " doesn't have one entry per point");
+            job.npoints = n;
+            sized       = true;
+        };
+        auto input = [&](const char* what, py::object obj,
+                         int nchans) -> const float* {
+            if (obj.is_none())
+                return nullptr;
+            ArrayView view = array_view(what, obj.cast<py::buffer>(),
+                                        TypeDesc::FLOAT, false);
+            if (view.size % nchans)
+                throw py::value_error(std::string(what)
+                                      + " must hold " + std::to_string(nchans)
+                                      + " floats per point");
+            set_npoints(what, view.size / nchans);
+            return (const float*)view.data;
+        };
+        job.P = input("P", P, 3);
+        job.N = input("N", N, 3);
+        job.u = input("u", u, 1);
+        job.v = input("v", v, 1);
+
+        for (auto item : outputs) {
+            std::string name = item.first.cast<std::string>();
+            const ShaderSymbol* sym
+                = m_shadingsys->find_symbol(*job.group, ustring(name));
+            if (!sym)
+                throw py::key_error("No output named \"" + name
+                                    + "\" in the shader group");
+            TypeDesc type = m_shadingsys->symbol_typedesc(sym);
+            if (type.basetype != TypeDesc::FLOAT
+                && type.basetype != TypeDesc::INT)
+                throw py::type_error("Output \"" + name
+                                     + "\" is not float or int based");
+            int nchans     = int(type.numelements() * type.aggregate);
+            ArrayView view = array_view("output \"" + name + "\"",
+                                        item.second.cast<py::buffer>(),
+                                        TypeDesc::BASETYPE(type.basetype),
+                                        true);
+            if (view.size % nchans)
+                throw py::value_error("output \"" + name + "\" must hold "
+                                      + std::to_string(nchans)
+                                      + " values per point");
+            set_npoints("output \"" + name + "\"", view.size / nchans);
+            job.output_sym.push_back(sym);
+            job.output_type.push_back(type);
+            job.output_nchans.push_back(nchans);
+            job.output_data.push_back(view.data);
+            auto placed = g.placed.find(name);
+            job.output_placed.push_back(placed != g.placed.end()
+                                            ? placed->second
+                                            : std::string::npos);
+        }
+        for (auto& placed : g.placed_userdata) {
+            const std::string& name = placed.first;
+            TypeDesc type           = placed.second.first;
+            if (!userdata.contains(name))
+                throw py::key_error("No values for the placed userdata \""
+                                    + name + "\"");
+            int nchans     = int(type.numelements() * type.aggregate);
+            ArrayView view = array_view("userdata \"" + name + "\"",
+                                        userdata[name.c_str()]
+                                            .cast<py::buffer>(),
+                                        TypeDesc::BASETYPE(type.basetype),
+                                        false);
+            if (view.size % nchans)
+                throw py::value_error("userdata \"" + name + "\" must hold "
+                                      + std::to_string(nchans)
+                                      + " values per point");
+            set_npoints("userdata \"" + name + "\"", view.size / nchans);
+            job.userdata_data.push_back(view.data);
+            job.userdata_nchans.push_back(nchans);
+            job.userdata_offset.push_back(placed.second.second);
+        }
+        if (py::len(userdata) != g.placed_userdata.size())
+            throw py::key_error("Userdata given that wasn't placed");
+        job.userdata_size = g.userdata_size;
+
+        std::vector<char> arena(g.placed_stride * job.npoints);
+        job.arena        = arena.data();
+        job.arena_stride = g.placed_stride;
+
+        // Defaults for anything the caller didn't supply: a unit patch
+        // facing +z, with transformations to common space of identity.
+        memset((char*)&job.sg, 0, sizeof(ShaderGlobals));
+        job.sg.shader2common = OSL::TransformationPtr(&job.Mshad);
+        job.sg.object2common = OSL::TransformationPtr(&job.Mobj);
+        job.sg.surfacearea   = 1;
+        job.sg.dPdu          = Vec3(1.0f, 0.0f, 0.0f);
+        job.sg.dPdv          = Vec3(0.0f, 1.0f, 0.0f);
+        job.sg.N             = Vec3(0.0f, 0.0f, 1.0f);
+        job.sg.Ng            = Vec3(0.0f, 0.0f, 1.0f);
+
+        // Everything from here on only touches memory we've already
+        // checked, so let other Python threads run while we shade.
+        py::gil_scoped_release gil;
+        const size_t chunk = 4096;
+        size_t nchunks     = (job.npoints + chunk - 1) / chunk;
+        std::atomic<size_t> next { 0 };
+        auto worker = [&]() {
+            PerThreadInfo* thread_info = m_shadingsys->create_thread_info();
+            ShadingContext* ctx = m_shadingsys->get_context(thread_info);
+            for (size_t c; (c = next++) < nchunks;) {
+                size_t begin = c * chunk;
+                size_t end   = std::min(begin + chunk, job.npoints);
+#if OSL_USE_BATCHED
+                if (g.batch_width == 16)
+                    batched_shade_points<16>(job, *ctx, begin, end);
+                else if (g.batch_width == 8)
+                    batched_shade_points<8>(job, *ctx, begin, end);
+                else if (g.batch_width == 4)
+                    batched_shade_points<4>(job, *ctx, begin, end);
+                else
+#endif
+                    shade_points(job, *ctx, begin, end);
+            }
+            m_shadingsys->release_context(ctx);
+            m_shadingsys->destroy_thread_info(thread_info);
+        };
+        OIIO::parallel_options popt;
+        popt.maxthreads = nthreads;
+        popt.minitems   = 1;
+        popt.resolve();
+        int nworkers = int(std::min(size_t(std::max(popt.maxthreads, 1)),
+                                    std::max(nchunks, size_t(1))));
+        OIIO::parallel_for_chunked(
+            0, nworkers, 1,
+            [&](int64_t /*b*/, int64_t /*e*/) { worker(); }, popt);
+    }
+
+private:
+    PyRendererServices m_renderer;
+    std::unique_ptr<ShadingSystem> m_shadingsys;
+};
+
+
+
+void
+declare_oslexec(py::module& m)
+{
+    using namespace pybind11::literals;
+
+    py::class_<PyShaderGroup>(m, "ShaderGroup")
+        .def_readonly("outputs", &PyShaderGroup::outputs)
+        .def_readonly("jitted", &PyShaderGroup::jitted)
+        .def_readonly("batch_width", &PyShaderGroup::batch_width)
+        .def(
+            "copy",
+            [](const PyShaderGroup& g) {
+                // Another handle on the same group, not yet JITed, so the
+                // group can also be JITed (and shaded) at another width.
+                PyShaderGroup c;
+                c.group           = g.group;
+                c.outputs         = g.outputs;
+                c.placed          = g.placed;
+                c.placed_stride   = g.placed_stride;
+                c.placed_userdata = g.placed_userdata;
+                c.userdata_size   = g.userdata_size;
+                return c;
+            });
+
+    py::class_<PyShadingSystem>(m, "ShadingSystem")
+        .def(py::init<>())
+        .def(
+            "attribute",
+            [](PyShadingSystem& ss, const std::string& name, py::object val) {
+                if (py::isinstance<py::int_>(val))
+                    return ss.shadingsys().attribute(name, val.cast<int>());
+                if (py::isinstance<py::float_>(val))
+                    return ss.shadingsys().attribute(name, val.cast<float>());
+                return ss.shadingsys().attribute(name,
+                                                 val.cast<std::string>());
+            },
+            "name"_a, "value"_a)
+        .def(
+            "attribute",
+            [](PyShadingSystem& ss, PyShaderGroup& g, const std::string& name,
+               py::object val) {
+                // Group attributes: a single int, float or string, or a
+                // list of strings (such as "entry_layers").
+                ShaderGroup* group = g.group.get();
+                if (py::isinstance<py::int_>(val))
+                    return ss.shadingsys().attribute(group, name,
+                                                     val.cast<int>());
+                if (py::isinstance<py::float_>(val))
+                    return ss.shadingsys().attribute(group, name,
+                                                     val.cast<float>());
+                if (py::isinstance<py::str>(val))
+                    return ss.shadingsys().attribute(group, name,
+                                                     val.cast<std::string>());
+                std::vector<std::string> strs
+                    = val.cast<std::vector<std::string>>();
+                std::vector<ustring> ustrs(strs.begin(), strs.end());
+                return ss.shadingsys().attribute(
+                    group, name, TypeDesc(TypeDesc::STRING, int(ustrs.size())),
+                    ustrs.data());
+            },
+            "group"_a, "name"_a, "value"_a)
+        .def(
+            "getattribute",
+            [](PyShadingSystem& ss, const std::string& name,
+               const std::string& type) -> py::object {
+                // Only single values; None if there's no such attribute
+                // of that type.
+                TypeDesc t(type);
+                if (t == TypeDesc::INT) {
+                    int v;
+                    if (ss.shadingsys().getattribute(name, t, &v))
+                        return py::int_(v);
+                } else if (t == TypeDesc::INT64) {
+                    long long v;
+                    if (ss.shadingsys().getattribute(name, t, &v))
+                        return py::int_(v);
+                } else if (t == TypeDesc::FLOAT) {
+                    float v;
+                    if (ss.shadingsys().getattribute(name, t, &v))
+                        return py::float_(v);
+                } else if (t == TypeDesc::STRING) {
+                    ustring v;
+                    if (ss.shadingsys().getattribute(name, t, &v))
+                        return py::str(v.string());
+                }
+                return py::none();
+            },
+            "name"_a, "type"_a = "int")
+        .def(
+            "stats",
+            [](PyShadingSystem& ss) {
+                // All the stat:* attributes in one call, as a dict of
+                // name -> value (as a float).
+                int n = 0;
+                ss.shadingsys().getattribute("stat:num_names", n);
+                std::vector<ustring> names(n);
+                std::vector<double> values(n);
+                ss.shadingsys().getattribute("stat:names",
+                                             TypeDesc(TypeDesc::STRING, n),
+                                             names.data());
+                ss.shadingsys().getattribute("stat:values",
+                                             TypeDesc(TypeDesc::DOUBLE, n),
+                                             values.data());
+                py::dict d;
+                for (int i = 0; i < n; ++i)
+                    d[py::str(names[i].string())] = values[i];
+                return d;
+            })
+        .def(
+            "load_memory_compiled_shader",
+            [](PyShadingSystem& ss, const std::string& shadername,
+               const std::string& buffer) {
+                return ss.shadingsys().LoadMemoryCompiledShader(shadername,
+                                                                buffer);
+            },
+            "shadername"_a, "buffer"_a)
+        .def(
+            "reload_shader",
+            [](PyShadingSystem& ss, const std::string& shadername,
+               const std::string& buffer) {
+                return ss.shadingsys().reload_shader(shadername, buffer);
+            },
+            "shadername"_a, "buffer"_a = "")
+        .def("shader_group", &PyShadingSystem::shader_group, "groupspec"_a,
+             "outputs"_a = std::vector<std::string>(), "usage"_a = "surface",
+             "name"_a = "")
+        .def("jit", &PyShadingSystem::jit, "group"_a, "batched"_a = true)
+        .def("place_outputs", &PyShadingSystem::place_outputs, "group"_a,
+             "outputs"_a)
+        .def("place_userdata", &PyShadingSystem::place_userdata, "group"_a,
+             "userdata"_a)
+        .def("shade", &PyShadingSystem::shade, "group"_a, "outputs"_a,
+             "P"_a = py::none(), "N"_a = py::none(), "u"_a = py::none(),
+             "v"_a = py::none(), "userdata"_a = py::dict(),
+             "nthreads"_a = 0);
+}
+
+}  // namespace PyOSL
+
+
+
+// This OSL_DECLARE_PYMODULE mojo is necessary if we want to pass in the
+// MODULE name as a #define. Google for Argument-Prescan for additional
+// info on why this is necessary
+
+#define OSL_DECLARE_PYMODULE(x) PYBIND11_MODULE(x, m)
+
+OSL_DECLARE_PYMODULE(PYMODULE_NAME)
+{
+    using namespace PyOSL;
+
+    // Basic helper classes
+    declare_oslexec(m);
+}
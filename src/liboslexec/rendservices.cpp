@@ -53,7 +53,7 @@ RendererServices::get_inverse_matrix (ShaderGlobals *sg, Matrix44 &result,
 {
     bool ok = get_matrix (sg, result, xform, time);
     if (ok)
-        result.invert ();
+        result = inlinedInverse (result);
     return ok;
 }
 
@@ -65,7 +65,7 @@ RendererServices::get_inverse_matrix (ShaderGlobals *sg, Matrix44 &result,
 {
     bool ok = get_matrix (sg, result, xform);
     if (ok)
-        result.invert ();
+        result = inlinedInverse (result);
     return ok;
 }
 
@@ -77,7 +77,7 @@ RendererServices::get_inverse_matrix (ShaderGlobals *sg, Matrix44 &result,
 {
     bool ok = get_matrix (sg, result, to, time);
     if (ok)
-        result.invert ();
+        result = inlinedInverse (result);
     return ok;
 }
 
@@ -89,13 +89,28 @@ RendererServices::get_inverse_matrix (ShaderGlobals *sg, Matrix44 &result,
 {
     bool ok = get_matrix (sg, result, to);
     if (ok)
-        result.invert ();
+        result = inlinedInverse (result);
     return ok;
 }
 
 
 
 
+bool
+RendererServices::get_attribute_by_handle (ShaderGlobals *sg,
+                                           AttributeHandle *handle,
+                                           bool derivatives, ustring object,
+                                           TypeDesc type, ustring name,
+                                           int index, void *val)
+{
+    if (index >= 0)
+        return get_array_attribute (sg, derivatives, object, type, name,
+                                    index, val);
+    return get_attribute (sg, derivatives, object, type, name, val);
+}
+
+
+
 RendererServices::TextureHandle *
 RendererServices::get_texture_handle (ustring filename, ShadingContext *context)
 {
@@ -278,8 +293,9 @@ RendererServices::get_texture_info(ustring filename,
         texture_handle = texturesys()->get_texture_handle(filename,
                                                           texture_thread_info);
     if (texturesys()->is_udim(texture_handle)) {
-        TextureSystem::TextureHandle* udim_handle = texturesys()->resolve_udim(texture_handle,
-                                                    texture_thread_info, s, t);
+        TextureSystem::TextureHandle* udim_handle
+            = shading_context->resolve_udim(texturesys(), texture_handle,
+                                            texture_thread_info, s, t);
         // NOTE:  udim_handle may be nullptr if no corresponding texture exists
         // Optimization to just reuse the <udim> texture handle vs.
         // forcing get_texture_info_uniform to redo the lookup we have already done.
@@ -308,4 +324,11 @@ RendererServices::batched(WidthOf<8>)
     return nullptr;
 }
 
+BatchedRendererServices<4> *
+RendererServices::batched(WidthOf<4>)
+{
+    // No default implementation for batched services
+    return nullptr;
+}
+
 OSL_NAMESPACE_EXIT
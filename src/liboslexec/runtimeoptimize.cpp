@@ -2,6 +2,8 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
+#include <limits>
 #include <vector>
 #include <cstdio>
 #include <cmath>
@@ -41,7 +43,35 @@ static ustring u_nop    ("nop"),
                u_setmessage ("setmessage"),
                u_getmessage ("getmessage"),
                u_getattribute ("getattribute"),
+               u_matrix ("matrix"),
+               u_getmatrix ("getmatrix"),
+               u_gettextureinfo ("gettextureinfo"),
+               u_texture ("texture"),
+               u_Dx ("Dx"), u_Dy ("Dy"),
+               u_pointcloud_search ("pointcloud_search"),
+               u_pointcloud_get ("pointcloud_get"),
                u_backfacing ("backfacing"),
+               u_concat ("concat"),
+               u_substr ("substr"),
+               u_format ("format"),
+               u_printf ("printf"),
+               u_fprintf ("fprintf"),
+               u_error ("error"),
+               u_warning ("warning"),
+               u_mod ("mod"),
+               u_min ("min"),
+               u_max ("max"),
+               u_clamp ("clamp"),
+               u_lt ("lt"),
+               u_le ("le"),
+               u_gt ("gt"),
+               u_ge ("ge"),
+               u_aref ("aref"),
+               u_aassign ("aassign"),
+               u_compref ("compref"),
+               u_compassign ("compassign"),
+               u_mxcompref ("mxcompref"),
+               u_mxcompassign ("mxcompassign"),
                u_N ("N"),
                u_I ("I");
 
@@ -102,6 +132,11 @@ RuntimeOptimizer::RuntimeOptimizer (ShadingSystemImpl &shadingsys,
       m_opt_mix(shadingsys.m_opt_mix),
       m_opt_middleman(shadingsys.m_opt_middleman),
       m_opt_batched_analysis(shadingsys.m_opt_batched_analysis),
+      m_opt_loop_invariants(shadingsys.m_opt_loop_invariants),
+      m_opt_transient_strings(shadingsys.m_opt_transient_strings),
+      m_opt_range_checks(shadingsys.m_opt_range_checks),
+      m_opt_texture_coalesce(shadingsys.m_opt_texture_coalesce),
+      m_opt_deriv_axes(shadingsys.m_opt_deriv_axes),
       m_keep_no_return_function_calls(shadingsys.m_llvm_debugging_symbols),
       m_pass(0),
       m_next_newconst(0), m_next_newtemp(0),
@@ -1230,9 +1265,15 @@ RuntimeOptimizer::unread_after (const Symbol *A, int opnum)
     // Try to figure out if this symbol is completely unused after this
     // op (and thus, any values written to it now will never be needed).
 
-    // Globals may be read by later layers
-    if (A->symtype() == SymTypeGlobal)
-        return false;
+    // Globals may be read by later layers, and are outputs of the group,
+    // except in the last layer of an output variant that doesn't
+    // compute them.
+    if (A->symtype() == SymTypeGlobal) {
+        const std::vector<ustring> &subset (group().output_subset());
+        if (subset.empty() || layer() != group().nlayers() - 1
+              || std::find (subset.begin(), subset.end(), A->name()) != subset.end())
+            return false;
+    }
 
     // Params may be read afterwards if connected to a downstream
     // layer or if "elide_unconnected_outputs" is turned off.
@@ -1951,6 +1992,230 @@ RuntimeOptimizer::eliminate_middleman ()
 }
 
 
+int
+RuntimeOptimizer::insert_params (const SymbolVec &params)
+{
+    ShaderInstance *in = inst();
+    int pos = std::max (in->m_lastparam, 0);
+    int n = (int) params.size();
+    in->m_instsymbols.insert (in->m_instsymbols.begin()+pos,
+                              params.begin(), params.end());
+    auto renumber = [=](int &index) {
+        if (index >= pos)
+            index += n;
+    };
+    for (auto&& arg : in->args())
+        renumber (arg);
+    for (auto&& c : in->m_connections)
+        renumber (c.dst.param);
+    for (int lay = layer()+1;  lay < group().nlayers();  ++lay) {
+        for (auto&& c : group()[lay]->m_connections)
+            if (c.srclayer == layer())
+                renumber (c.src.param);
+    }
+    if (in->m_Psym >= 0)
+        renumber (in->m_Psym);
+    if (in->m_Nsym >= 0)
+        renumber (in->m_Nsym);
+    if (in->m_firstparam < 0)
+        in->m_firstparam = pos;
+    in->m_lastparam = pos + n;
+    return pos;
+}
+
+
+
+int
+RuntimeOptimizer::share_common_subexpressions ()
+{
+    // Ops worth handing down a connection rather than recomputing.
+    static ustring costly_ops[] = {
+        ustring("noise"), ustring("snoise"), ustring("pnoise"),
+        ustring("psnoise"), ustring("cellnoise"), ustring("hashnoise"),
+        ustring("transform"), ustring("transformv"), ustring("transformn"),
+        ustring("transformc"), ustring("matrix"), ustring("spline"),
+        ustring("splineinverse"), ustring("blackbody"),
+        ustring("wavelength_color"), ustring("calculatenormal"),
+        ustring("pow"), ustring("exp"), ustring("log"), ustring("sin"),
+        ustring("cos"), ustring("tan"), ustring("asin"), ustring("acos"),
+        ustring("atan"), ustring("atan2"), ustring("smoothstep")
+    };
+    int nlayers = (int) group().nlayers ();
+
+    // Globals written by any layer can't be assumed to hold the same
+    // value from one layer to the next.
+    std::set<ustring> written_globals;
+    for (int lay = 0;  lay < nlayers;  ++lay) {
+        ShaderInstance *in = group()[lay];
+        for (auto&& op : in->ops())
+            for (int a = 0;  a < op.nargs();  ++a) {
+                const Symbol *s = in->argsymbol (op.firstarg()+a);
+                if (op.argwrite(a) && s->symtype() == SymTypeGlobal)
+                    written_globals.insert (s->name());
+            }
+    }
+
+    // Value-number the ops of each layer, in layer order. A value's key
+    // spells out the op and its type, all the way down to the constants
+    // and globals it's computed from.
+    struct Borrow { int opnum, sym, srclayer, srcsym; };
+    std::map<std::string, std::vector<std::pair<int,int>>> available;
+    std::vector<std::set<int>> exports (nlayers);
+    std::vector<std::vector<Borrow>> borrows (nlayers);
+    for (int lay = 0;  lay < nlayers;  ++lay) {
+        set_inst (lay);
+        if (inst()->unused())
+            continue;
+        find_conditionals ();
+        std::vector<int> nwrites (inst()->symbols().size(), 0);
+        for (auto&& op : inst()->ops())
+            for (int a = 0;  a < op.nargs();  ++a)
+                if (op.argwrite(a))
+                    ++nwrites[oparg(op,a)];
+        std::set<int> upstream;
+        for (auto&& c : inst()->m_connections)
+            upstream.insert (c.srclayer);
+        std::map<int,std::string> keys;
+        for (int opnum = inst()->maincodebegin();
+               opnum < inst()->maincodeend();  ++opnum) {
+            Opcode &op (inst()->ops()[opnum]);
+            const OpDescriptor *opd = shadingsys().op_descriptor (op.opname());
+            if (! opd || ! opd->simple_assign || opd->flags
+                  || op.opname() == u_assign || op.opname() == u_nop
+                  || op.opname() == u_closure || op.nargs() < 2
+                  || op.argread(0) || ! op_is_unconditionally_executed (opnum))
+                continue;
+            int r = oparg (op, 0);
+            const Symbol *R = inst()->symbol (r);
+            if ((R->symtype() != SymTypeTemp && R->symtype() != SymTypeLocal)
+                  || nwrites[r] != 1 || R->typespec().is_closure_based()
+                  || R->typespec().is_structure_based()
+                  || R->typespec().is_array())
+                continue;
+            std::string key = op.opname().string();
+            key += ' ';
+            key += R->typespec().string();
+            bool ok = true;
+            for (int a = 1;  a < op.nargs() && ok;  ++a) {
+                int s = oparg (op, a);
+                const Symbol *S = inst()->symbol (s);
+                key += a == 1 ? '(' : ',';
+                if (op.argwrite(a)) {
+                    ok = false;
+                } else if (S->is_constant()) {
+                    key += "c ";
+                    key += S->typespec().string();
+                    key.append ((const char *)S->data(),
+                                S->typespec().simpletype().size());
+                } else if (S->symtype() == SymTypeGlobal) {
+                    if (written_globals.count (S->name()))
+                        ok = false;
+                    key += "g ";
+                    key += S->name().string();
+                } else {
+                    auto found = keys.find (s);
+                    if (found != keys.end())
+                        key += found->second;
+                    else
+                        ok = false;
+                }
+            }
+            if (! ok)
+                continue;
+            key += ')';
+            keys[r] = key;
+            if (std::find (std::begin(costly_ops), std::end(costly_ops),
+                           op.opname()) == std::end(costly_ops))
+                continue;
+            // Only borrow from a layer that this one already pulls from,
+            // so sharing never makes a layer run that wouldn't have.
+            auto& candidates (available[key]);
+            auto source = std::find_if (candidates.begin(), candidates.end(),
+                            [&](const std::pair<int,int> &c) {
+                                return upstream.count (c.first) != 0; });
+            if (source != candidates.end()) {
+                exports[source->first].insert (source->second);
+                borrows[lay].push_back (Borrow { opnum, r, source->first,
+                                                 source->second });
+            } else {
+                candidates.emplace_back (lay, r);
+            }
+        }
+    }
+
+    // Now give each exporting layer an output param holding the shared
+    // value, and each borrowing layer a param connected to it.
+    auto make_param = [&](const Symbol &like, SymType symtype) {
+        Symbol p (ustring::fmtformat ("$cse{}", m_next_newtemp++),
+                  like.typespec(), symtype);
+        TypeDesc t (like.typespec().simpletype());
+        size_t n = t.aggregate * t.numelements();
+        void *data = nullptr;
+        if (t.basetype == TypeDesc::INT) {
+            data = shadingsys().alloc_int_constants (n);
+            std::fill_n ((int *)data, n, 0);
+        } else if (t.basetype == TypeDesc::FLOAT) {
+            data = shadingsys().alloc_float_constants (n);
+            std::fill_n ((float *)data, n, 0.0f);
+        } else if (t.basetype == TypeDesc::STRING) {
+            data = shadingsys().alloc_string_constants (n);
+            std::fill_n ((ustring *)data, n, ustring());
+        }
+        p.set_dataptr (SymArena::Absolute, data);
+        p.lockgeom (true);
+        p.valuesource (symtype == SymTypeParam ? Symbol::ConnectedVal
+                                               : Symbol::DefaultVal);
+        p.connected_down (symtype == SymTypeOutputParam);
+        return p;
+    };
+    std::map<std::pair<int,int>,int> exported;  // (layer,sym) -> new param
+    int shared = 0;
+    for (int lay = 0;  lay < nlayers;  ++lay) {
+        if (exports[lay].empty() && borrows[lay].empty())
+            continue;
+        set_inst (lay);
+        SymbolVec params;
+        for (int s : exports[lay])
+            params.push_back (make_param (*inst()->symbol(s), SymTypeOutputParam));
+        for (auto&& b : borrows[lay])
+            params.push_back (make_param (*inst()->symbol(b.sym), SymTypeParam));
+        int pos = insert_params (params);
+        int n = (int) params.size();
+        int p = pos;
+        for (int s : exports[lay]) {
+            // The exported value is now computed right into the param
+            int news = s >= pos ? s + n : s;
+            for (auto&& arg : inst()->args())
+                if (arg == news)
+                    arg = p;
+            exported[std::make_pair(lay, s)] = p++;
+        }
+        for (auto&& b : borrows[lay]) {
+            Opcode &op (inst()->ops()[b.opnum]);
+            turn_into_assign (op, p, "shared with an earlier layer");
+            ConnectedParam src, dst;
+            src.param = exported[std::make_pair(b.srclayer, b.srcsym)];
+            src.type = inst()->symbol(p)->typespec();
+            dst.param = p++;
+            dst.type = src.type;
+            inst()->m_connections.emplace_back (b.srclayer, src, dst);
+            ++shared;
+        }
+        // The layer no longer matches the state its memo key describes
+        m_memo_keys[lay].clear ();
+    }
+    for (int lay = 0;  lay < nlayers;  ++lay) {
+        if (! exports[lay].empty() || ! borrows[lay].empty()) {
+            set_inst (lay);
+            mark_outgoing_connections ();
+            track_variable_lifetimes ();
+        }
+    }
+    shadingsys().m_stat_cross_layer_cse += shared;
+    return shared;
+}
+
+
 
 int
 RuntimeOptimizer::optimize_assignment (Opcode &op, int opnum)
@@ -2287,9 +2552,14 @@ RuntimeOptimizer::optimize_instance ()
     // the point that not much is improving.  It rarely goes beyond 3-4
     // passes, but we have a hard cutoff just to be sure we don't
     // ever get into an infinite loop from an unforseen cycle where we
-    // end up inadvertently transforming A => B => A => etc.
+    // end up inadvertently transforming A => B => A => etc.  Passes that
+    // change only a sliver of a big layer, or that would overrun the
+    // group's time budget, aren't worth making either.
+    GroupCompileStats &stats (group().m_compile_stats);
     int reallydone = 0;   // Force a few passes after we think we're done
     int npasses = shadingsys().opt_passes();
+    float budget_ms = shadingsys().opt_time_budget_ms();
+    bool converged = false, cut_short = false;
     for (m_pass = 0;  m_pass < npasses;  ++m_pass) {
 
         // Once we've made one pass (and therefore called
@@ -2301,6 +2571,13 @@ RuntimeOptimizer::optimize_instance ()
         if (m_stop_optimizing)
             break;
 
+        // Every layer gets its first pass, whatever the time.
+        if (m_pass != 0 && budget_ms > 0.0f
+              && m_opt_timer() * 1000.0 > budget_ms) {
+            cut_short = true;
+            break;
+        }
+
         if (debug() > 1)
             debug_optfmt("layer {} \"{}\", pass {}:\n", layer(),
                          inst()->layername(), m_pass);
@@ -2320,7 +2597,9 @@ RuntimeOptimizer::optimize_instance ()
 
         // Here is the meat of the optimization, where we pass over the
         // code for this instance and make various transformations.
-        int changed = optimize_ops (0, (int)inst()->ops().size());
+        int nops = (int)inst()->ops().size();
+        int changed = optimize_ops (0, nops);
+        ++stats.opt_layer_passes;
 
         // Now that we've rewritten the code, we need to re-track the
         // variable lifetimes.
@@ -2349,12 +2628,25 @@ RuntimeOptimizer::optimize_instance ()
         // that after re-tracking variable lifetimes, we can notice new
         // optimizations!  So force another pass, then we're really done.
         if (changed < 1) {
-            if (++reallydone > 3)
+            if (++reallydone > 3) {
+                converged = true;
                 break;
+            }
+        } else if (changed <= shadingsys().opt_pass_min_change() * nops) {
+            // Still changing, but too little to pay for another pass
+            converged = true;
+            break;
         } else {
             reallydone = 0;
         }
     }
+    ++stats.opt_layer_runs;
+    if (converged)
+        ++stats.opt_converged;
+    else if (cut_short)
+        ++stats.opt_budget_cutoffs;
+    else if (m_pass == npasses)
+        ++stats.opt_capped;
 
     // A layer that was allowed to run lazily originally, if it no
     // longer (post-optimized) has any outgoing connections, is no
@@ -2368,9 +2660,16 @@ RuntimeOptimizer::optimize_instance ()
             s.clear_rw ();
     }
 
-    // Now that we've optimized this layer, walk through the ops and
-    // note which messages may have been sent, so subsequent layers will
-    // know.
+    // Now that we've optimized this layer, note which messages may have
+    // been sent, so subsequent layers will know.
+    note_messages_sent ();
+}
+
+
+
+void
+RuntimeOptimizer::note_messages_sent ()
+{
     for (auto& op : inst()->ops()) {
         if (op.opname() == u_setmessage) {
             Symbol &Name (*inst()->argsymbol(op.firstarg()+0));
@@ -2384,6 +2683,170 @@ RuntimeOptimizer::optimize_instance ()
 
 
 
+namespace {
+
+// Append the bytes of a value to a memo key
+template<typename T>
+inline void
+append_key (std::string &key, const T &v)
+{
+    key.append ((const char *)&v, sizeof(T));
+}
+
+template<typename T>
+inline void
+append_key (std::string &key, const std::vector<T> &v)
+{
+    append_key (key, v.size());
+    key.append ((const char *)v.data(), v.size() * sizeof(T));
+}
+
+}  // namespace
+
+
+
+bool
+RuntimeOptimizer::recall_optimized (char step)
+{
+    std::string &key (m_memo_keys[layer()]);
+    if (step == 'f') {
+        // The first step starts from the master's code, so the master
+        // and the instance values determine it -- unless the layer has
+        // upstream connections, or the renderer has a say (which it may
+        // answer differently from one group to the next).
+        key.clear ();
+        if (! shadingsys().m_opt_memoize_instances || debug()
+              || ! shadingsys().m_opt_layername.empty()
+              || inst()->nconnections() || inst()->merged_unused())
+            return false;
+        for (auto&& op : inst()->ops()) {
+            ustring opname = op.opname();
+            if (opname == u_matrix || opname == u_getmatrix
+                  || opname == u_getattribute || opname == u_gettextureinfo
+                  || opname == u_pointcloud_search || opname == u_pointcloud_get)
+                return false;
+        }
+        append_key (key, inst()->master());
+        append_key (key, m_raytypes_on);
+        append_key (key, m_raytypes_off);
+        append_key (key, inst()->m_iparams);
+        append_key (key, inst()->m_fparams);
+        append_key (key, inst()->m_sparams);
+    } else if (key.empty()) {
+        return false;   // Not memoizable since the first step
+    } else if (step == 'p' && m_opt_batched_analysis) {
+        key.clear ();   // BatchedAnalysis looks at the whole group
+        return false;
+    }
+    // Later steps start from the previous step's result, which the key
+    // so far determines, plus whatever may have changed since.
+    key += step;
+    append_key (key, inst()->last_layer());
+    append_key (key, inst()->entry_layer());
+    append_key (key, inst()->merged_unused());
+    append_key (key, inst()->outgoing_connections());
+    append_key (key, inst()->renderer_outputs());
+    if (inst()->last_layer())   // which globals it sets (see unread_after)
+        append_key (key, group().output_subset());
+    append_key (key, inst()->writes_globals());
+    append_key (key, inst()->userdata_params());
+    append_key (key, inst()->has_error_op());
+    append_key (key, m_unknown_message_sent);
+    append_key (key, m_messages_sent);
+    for (auto&& s : inst()->symbols()) {
+        int bits = int(s.valuesource()) | (s.lockgeom() << 4)
+                 | (s.connected_down() << 5) | (s.renderer_output() << 6)
+                 | (s.has_derivs() << 7) | (s.deriv_axes() << 8);
+        append_key (key, bits);
+        append_key (key, s.typespec().simpletype());
+    }
+    for (int lay = layer()+1;  lay < group().nlayers();  ++lay) {
+        for (auto&& c : group()[lay]->m_connections) {
+            if (c.srclayer == layer()) {
+                int src[3] = { c.src.param, c.src.arrayindex, c.src.channel };
+                append_key (key, src);
+                append_key (key, c.src.type.simpletype());
+            }
+        }
+    }
+
+    std::shared_ptr<const OptimizedInstance> found;
+    {
+        ShadingSystemImpl &ss (shadingsys());
+        spin_lock lock (ss.m_optimized_instances_mutex);
+        auto f = ss.m_optimized_instances.find (key);
+        if (f != ss.m_optimized_instances.end())
+            found = f->second;
+    }
+    if (! found)
+        return false;
+
+    ShaderInstance &inst (*this->inst());
+    inst.m_instsymbols = found->symbols;
+    inst.m_instops = found->ops;
+    inst.m_instargs = found->args;
+    inst.m_iparams = found->iparams;
+    inst.m_fparams = found->fparams;
+    inst.m_sparams = found->sparams;
+    inst.m_connections = found->connections;
+    inst.m_writes_globals = found->writes_globals;
+    inst.m_userdata_params = found->userdata_params;
+    inst.m_outgoing_connections = found->outgoing_connections;
+    inst.m_renderer_outputs = found->renderer_outputs;
+    inst.m_has_error_op = found->has_error_op;
+    inst.m_firstparam = found->firstparam;
+    inst.m_lastparam = found->lastparam;
+    inst.m_maincodebegin = found->maincodebegin;
+    inst.m_maincodeend = found->maincodeend;
+    inst.m_Psym = found->Psym;
+    inst.m_Nsym = found->Nsym;
+    m_params_holding_globals[layer()] = found->params_holding_globals;
+    shadingsys().m_stat_memoized_opt_steps += 1;
+    return true;
+}
+
+
+
+void
+RuntimeOptimizer::remember_optimized ()
+{
+    const std::string &key (m_memo_keys[layer()]);
+    if (key.empty())
+        return;
+    const ShaderInstance &inst (*this->inst());
+    auto entry = std::make_shared<OptimizedInstance>();
+    entry->master = inst.m_master;
+    entry->symbols = inst.m_instsymbols;
+    entry->ops = inst.m_instops;
+    entry->args = inst.m_instargs;
+    entry->iparams = inst.m_iparams;
+    entry->fparams = inst.m_fparams;
+    entry->sparams = inst.m_sparams;
+    entry->connections = inst.m_connections;
+    entry->params_holding_globals = m_params_holding_globals[layer()];
+    entry->writes_globals = inst.m_writes_globals;
+    entry->userdata_params = inst.m_userdata_params;
+    entry->outgoing_connections = inst.m_outgoing_connections;
+    entry->renderer_outputs = inst.m_renderer_outputs;
+    entry->has_error_op = inst.m_has_error_op;
+    entry->firstparam = inst.m_firstparam;
+    entry->lastparam = inst.m_lastparam;
+    entry->maincodebegin = inst.m_maincodebegin;
+    entry->maincodeend = inst.m_maincodeend;
+    entry->Psym = inst.m_Psym;
+    entry->Nsym = inst.m_Nsym;
+
+    ShadingSystemImpl &ss (shadingsys());
+    spin_lock lock (ss.m_optimized_instances_mutex);
+    // When full, just start over; the layers that recur will soon be
+    // back.
+    if (int(ss.m_optimized_instances.size()) >= ss.m_opt_memoize_instances)
+        ss.m_optimized_instances.clear ();
+    ss.m_optimized_instances.emplace (key, std::move(entry));
+}
+
+
+
 void
 RuntimeOptimizer::resolve_isconnected ()
 {
@@ -2445,7 +2908,6 @@ RuntimeOptimizer::track_variable_lifetimes ()
 }
 
 
-// This has O(n^2) memory usage, so only for debugging
 //#define DEBUG_SYMBOL_DEPENDENCIES
 
 // Add to the dependency map that "symbol A depends on symbol B".
@@ -2453,14 +2915,28 @@ void
 RuntimeOptimizer::add_dependency (SymDependency &dmap, int A, int B)
 {
     OSL_DASSERT (A < (int)inst()->symbols().size());
-    OSL_DASSERT (B < (int)inst()->symbols().size());
-    dmap[A].insert (B);
+    OSL_DASSERT (B >= 0 && B < (int)inst()->symbols().size());
+    dmap.edges.emplace_back (A, B);
+}
 
-#ifdef DEBUG_SYMBOL_DEPENDENCIES
-    // Unification -- make all of B's dependencies be dependencies of A.
-    for (auto&& r : dmap[B])
-        dmap[A].insert (r);
-#endif
+
+
+void
+RuntimeOptimizer::SymDependency::finalize (int nsyms)
+{
+    // A counting sort of the edges by A, with A < 0 (the pseudo-symbols
+    // -1, -2, -3) as the last rows. Repeated edges are harmless to the
+    // walks.
+    rowstart.assign (nsyms + 5, 0);
+    for (auto&& e : edges)
+        ++rowstart[(e.first < 0 ? nsyms - 1 - e.first : e.first) + 2];
+    for (int i = 2;  i < nsyms + 5;  ++i)
+        rowstart[i] += rowstart[i-1];
+    deps.resize (edges.size());
+    for (auto&& e : edges)
+        deps[rowstart[(e.first < 0 ? nsyms - 1 - e.first : e.first) + 1]++] = e.second;
+    edges.clear ();
+    edges.shrink_to_fit ();
 }
 
 
@@ -2483,24 +2959,49 @@ RuntimeOptimizer::syms_used_in_op (Opcode &op, std::vector<int> &rsyms,
 
 
 
-// Fake symbol index for "derivatives" entry in dependency map.
+// Fake symbol indices for the "derivatives" entries in the dependency
+// map: of both partials, or of just the x or y one (what Dx and Dy read).
 static const int DerivSym = -1;
+static const int DerivSymX = -2;
+static const int DerivSymY = -3;
 
 
-// Recursively mark symbols that have derivatives from dependency map
+// Mark the symbols that the derivatives pseudo-symbols depend on,
+// directly or not, as having derivatives, and which of the partials are
+// needed. A worklist walk in which a symbol is revisited only when it
+// gains an axis, so each symbol and edge is visited at most twice however
+// deep the chains of dependencies go.
 void
-RuntimeOptimizer::mark_symbol_derivatives (SymDependency &symdeps, SymIntSet &visited, int d)
+RuntimeOptimizer::mark_symbol_derivatives (const SymDependency &symdeps)
 {
-    for (auto&& r : symdeps[d]) {
-        if (visited.find(r) == visited.end()) {
-            visited.insert(r);
-            
-            Symbol *s = inst()->symbol(r);
-
-            if (s->typespec().elementtype().is_float_based())
-                s->has_derivs (true);
-
-            mark_symbol_derivatives(symdeps, visited, r);
+    int nsyms = (int)inst()->symbols().size();
+    std::vector<unsigned char> axes (nsyms, 0);
+    std::vector<int> worklist;
+    auto reach = [&](int r, int a) {
+        if ((axes[r] | a) != axes[r]) {
+            axes[r] |= a;
+            worklist.push_back (r);
+        }
+    };
+    const int seeds[3] = { Symbol::DerivBothAxes, Symbol::DerivXAxis,
+                           Symbol::DerivYAxis };
+    for (int p = 0;  p < 3;  ++p)
+        for (int i = symdeps.rowstart[nsyms+p], e = symdeps.rowstart[nsyms+p+1];
+             i < e;  ++i)
+            reach (symdeps.deps[i], seeds[p]);
+    while (! worklist.empty()) {
+        int d = worklist.back();
+        worklist.pop_back ();
+        for (int i = symdeps.rowstart[d], e = symdeps.rowstart[d+1];  i < e;  ++i)
+            reach (symdeps.deps[i], axes[d]);
+    }
+    for (int r = 0;  r < nsyms;  ++r) {
+        Symbol *s = inst()->symbol(r);
+        if (axes[r] && s->typespec().elementtype().is_float_based()) {
+            s->has_derivs (true);
+            // The renderer may read back either partial of its outputs
+            s->deriv_axes (s->renderer_output() ? int(Symbol::DerivBothAxes)
+                                                : int(axes[r]));
         }
     }
 }
@@ -2515,6 +3016,7 @@ void
 RuntimeOptimizer::track_variable_dependencies ()
 {
     SymDependency symdeps;
+    int nsyms = (int)inst()->symbols().size();
 
     // It's important to note that this is simplistically conservative
     // in that it overestimates dependencies.  To see why this is the
@@ -2544,8 +3046,6 @@ RuntimeOptimizer::track_variable_dependencies ()
     // cause them to be reassigned in exactly the way that confuses this
     // analysis).
 
-    symdeps.clear ();
-
     std::vector<int> read, written;
     bool forcederivs = shadingsys().force_derivs();
     // Loop over all ops...
@@ -2567,7 +3067,16 @@ RuntimeOptimizer::track_variable_dependencies ()
                 if (inst()->symbol(r)->symtype() != SymTypeConst)
                     add_dependency (symdeps, w, r);
             // If the op takes derivs, make the pseudo-symbol DerivSym
-            // depend on those arguments.
+            // depend on those arguments. Dx and Dy read only one partial,
+            // which is all they need of their argument when we're keeping
+            // track of the axes apart.
+            int derivsym = DerivSym;
+            if (m_opt_deriv_axes && ! forcederivs) {
+                if (op.opname() == u_Dx)
+                    derivsym = DerivSymX;
+                else if (op.opname() == u_Dy)
+                    derivsym = DerivSymY;
+            }
             if (op.argtakesderivs_all() || forcederivs) {
                 for (int a = 0;  a < op.nargs();  ++a)
                     if (op.argtakesderivs(a) || forcederivs) {
@@ -2587,7 +3096,7 @@ RuntimeOptimizer::track_variable_dependencies ()
                                s.mangled() == Strings::v ||
                                s.mangled() == Strings::Ps))
                             continue;
-                        add_dependency (symdeps, DerivSym,
+                        add_dependency (symdeps, derivsym,
                                         inst()->arg(a+op.firstarg()));
                     }
             }
@@ -2607,13 +3116,16 @@ RuntimeOptimizer::track_variable_dependencies ()
               !s.typespec().is_closure_based() && s.mangled() != Strings::N)
             s.has_derivs(true);
         if (s.has_derivs())
-            add_dependency (symdeps, DerivSym, snum);
+            add_dependency (symdeps,
+                            s.deriv_axes() == Symbol::DerivXAxis ? DerivSymX
+                            : s.deriv_axes() == Symbol::DerivYAxis ? DerivSymY
+                            : DerivSym, snum);
         ++snum;
     }
 
     // Mark all symbols needing derivatives as such
-    SymIntSet visited;
-    mark_symbol_derivatives (symdeps, visited, DerivSym);
+    symdeps.finalize (nsyms);
+    mark_symbol_derivatives (symdeps);
 
     // Only some globals are allowed to have derivatives
     for (auto&& s : inst()->symbols()) {
@@ -2628,42 +3140,18 @@ RuntimeOptimizer::track_variable_dependencies ()
 
 #ifdef DEBUG_SYMBOL_DEPENDENCIES
     // Helpful for debugging
-
     std::cerr << "track_variable_dependencies\n";
     std::cerr << "\nDependencies:\n";
-    for (auto&& m : symdeps) {
-        if (m.first == DerivSym)
-            std::cerr << "$derivs depends on ";
+    for (int a = 0;  a <= nsyms+2;  ++a) {
+        if (symdeps.rowstart[a] == symdeps.rowstart[a+1])
+            continue;
+        if (a >= nsyms)
+            std::cerr << (a == nsyms ? "$derivs" : a == nsyms+1 ? "$dx" : "$dy")
+                      << " depends on ";
         else
-            std::cerr << inst->symbol(m.first)->mangled() << " depends on ";
-        for (auto&& d : m.second) {
-            if (d == DerivSym)
-                std::cerr << "$derivs ";
-            else
-                std::cerr << inst->symbol(d)->mangled() << ' ';
-        }
-        std::cerr << "\n";
-    }
-    std::cerr << "\n\n";
-
-    // Invert the dependency
-    SymDependency influences;
-    for (auto&& m : symdeps)
-        for (auto&& d : m.second)
-            influences[d].insert (m.first);
-
-    std::cerr << "\nReverse dependencies:\n";
-    for (auto&& m : influences) {
-        if (m.first == DerivSym)
-            std::cerr << "$derivs contrbutes to ";
-        else
-            std::cerr << inst->symbol(m.first)->mangled() << " contributes to ";
-        for (auto&& d : m.second) {
-            if (d == DerivSym)
-                std::cerr << "$derivs ";
-            else
-                std::cerr << inst->symbol(d)->mangled() << ' ';
-        }
+            std::cerr << inst()->symbol(a)->mangled() << " depends on ";
+        for (int i = symdeps.rowstart[a];  i < symdeps.rowstart[a+1];  ++i)
+            std::cerr << inst()->symbol(symdeps.deps[i])->mangled() << ' ';
         std::cerr << "\n";
     }
     std::cerr << "\n\n";
@@ -2688,6 +3176,233 @@ coalescable (const Symbol &s)
 /// Coalesce temporaries.  During code generation, we make a new
 /// temporary EVERY time we need one.  Now we examine them all and merge
 /// ones of identical type and non-overlapping lifetimes.
+int
+RuntimeOptimizer::hoist_loop_invariants ()
+{
+    OpcodeVec &code (inst()->ops());
+    int nsyms = (int) inst()->symbols().size();
+    int hoisted = 0;
+    // Go backwards, so inner loops go first and whatever they hoist can
+    // be considered again for the loops around them.
+    for (int loop = inst()->maincodeend()-1;
+           loop >= inst()->maincodebegin();  --loop) {
+        ustring loopname = code[loop].opname();
+        if (loopname != u_for && loopname != u_while && loopname != u_dowhile)
+            continue;
+        // Keep hoisting from this loop until nothing else qualifies, since
+        // each op we move out may make the ops that use it invariant too.
+        for (bool moved = true;  moved;  ) {
+            moved = false;
+            int begin = code[loop].jump(0), end = code[loop].jump(3);
+            std::vector<int> loopwrites (nsyms, 0);
+            std::vector<int> firstread (nsyms, end);
+            std::vector<char> used_outside (nsyms, false);
+            for (int i = 0, e = (int)code.size();  i < e;  ++i) {
+                const Opcode &op (code[i]);
+                bool inloop = (i >= begin && i < end);
+                for (int a = 0;  a < op.nargs();  ++a) {
+                    int s = oparg (op, a);
+                    if (! inloop)
+                        used_outside[s] = true;
+                    else if (op.argwrite(a))
+                        ++loopwrites[s];
+                    if (inloop && op.argread(a))
+                        firstread[s] = std::min (firstread[s], i);
+                }
+            }
+            for (int k = begin;  k < end && ! moved;  ++k) {
+                const Opcode &op (code[k]);
+                const OpDescriptor *opd = shadingsys().op_descriptor (op.opname());
+                if (! opd || (opd->flags & (OpDescriptor::SideEffects | OpDescriptor::Tex))
+                      || op.opname() == u_nop || op.opname() == u_useparam
+                      || op.opname() == u_closure
+                      || ! (opd->simple_assign || op.opname() == u_getattribute
+                            || op.opname() == u_getmatrix))
+                    continue;
+                // It must run on every trip through the loop, not just
+                // when some nested conditional says so.
+                bool nested = false;
+                for (int m = begin;  m < k && ! nested;  ++m)
+                    nested = (code[m].jump(0) >= 0 && code[m].farthest_jump() > k);
+                if (nested)
+                    continue;
+                // What it reads mustn't change in the loop, and what it
+                // writes must be private to the loop, written only here,
+                // and not read before here (where it would have seen the
+                // value from before the loop on the first trip).
+                bool ok = true;
+                for (int a = 0;  a < op.nargs() && ok;  ++a) {
+                    int s = oparg (op, a);
+                    const Symbol *S = inst()->symbol (s);
+                    if (op.argwrite(a))
+                        ok = (S->symtype() == SymTypeTemp || S->symtype() == SymTypeLocal)
+                             && ! S->typespec().is_array() && ! op.argread(a)
+                             && loopwrites[s] == 1 && ! used_outside[s]
+                             && firstread[s] > k;
+                    else
+                        ok = S->is_constant() || loopwrites[s] == 0;
+                }
+                if (! ok)
+                    continue;
+
+                // Move it to the end of the loop's init code. Ops that
+                // jump to where the condition starts keep jumping there
+                // (now to the hoisted op), except the loop itself.
+                Opcode orig = op;
+                std::vector<int> args (&inst()->args()[orig.firstarg()],
+                                       &inst()->args()[orig.firstarg()+orig.nargs()]);
+                insert_code (begin, orig.opname(), args, RecomputeRWRanges);
+                Opcode &newop (code[begin]);
+                newop.set_argbits (orig.argread_bits(), orig.argwrite_bits(),
+                                   orig.argtakesderivs_all());
+                newop.method (orig.method());
+                newop.source (orig.sourcefile(), orig.sourceline());
+                for (int j = 0;  j < (int)Opcode::max_jumps;  ++j)
+                    if (code[loop].jump(j) == begin)
+                        code[loop].jump(j) = begin+1;
+                turn_into_nop (code[k+1], "hoisted out of loop");
+                ++hoisted;
+                moved = true;
+            }
+        }
+    }
+    if (hoisted)
+        track_variable_lifetimes ();
+    return hoisted;
+}
+
+
+
+int
+RuntimeOptimizer::coalesce_texture_lookups ()
+{
+    // The parts of a texture op that matter for merging: how many
+    // positional args it has (result, filename, s, t and any explicit
+    // derivatives), its constant firstchannel, and its other options.
+    struct TexLookup {
+        int npos = 4;
+        int firstchannel = 0;
+        std::vector<std::pair<ustring,int>> opts;
+    };
+    auto parse = [&](const Opcode &op, TexLookup &tex) -> bool {
+        if (op.nargs() > 4 && opargsym(op,4)->typespec().is_float())
+            tex.npos = 8;
+        for (int a = tex.npos;  a+1 < op.nargs();  a += 2) {
+            const Symbol *Name = opargsym (op, a);
+            if (! Name->is_constant() || ! Name->typespec().is_string())
+                return false;
+            ustring name = Name->get_string();
+            const Symbol *Val = opargsym (op, a+1);
+            if (name == Strings::firstchannel) {
+                if (! Val->is_constant() || ! Val->typespec().is_int())
+                    return false;
+                tex.firstchannel = Val->get_int();
+            } else if (name == Strings::alpha || name == Strings::errormessage
+                       || name == Strings::missingcolor
+                       || name == Strings::missingalpha) {
+                // Outputs of their own, or a different fallback for the
+                // alpha channel than for the result.
+                return false;
+            } else if (! name.empty()) {
+                tex.opts.emplace_back (name, oparg (op, a+1));
+            }
+        }
+        return true;
+    };
+    // Options match if they name the same symbols or equal constants.
+    auto same_opts = [&](const TexLookup &a, const TexLookup &b) -> bool {
+        if (a.opts.size() != b.opts.size())
+            return false;
+        for (size_t i = 0;  i < a.opts.size();  ++i) {
+            if (a.opts[i].first != b.opts[i].first)
+                return false;
+            const Symbol *A = inst()->symbol (a.opts[i].second);
+            const Symbol *B = inst()->symbol (b.opts[i].second);
+            if (A != B && ! (A->is_constant() && B->is_constant()
+                             && A->typespec() == B->typespec()
+                             && ! memcmp (A->data(), B->data(),
+                                          A->typespec().simpletype().size())))
+                return false;
+        }
+        return true;
+    };
+
+    OpcodeVec &code (inst()->ops());
+    find_basic_blocks ();
+    int merged = 0;
+    for (int opnum = 0, e = (int)code.size();  opnum < e;  ++opnum) {
+        Opcode &op (code[opnum]);
+        TexLookup tex;
+        if (op.opname() != u_texture || ! parse (op, tex)
+              || op.nargs() + 2 > 32)
+            continue;
+        const Symbol *R = opargsym (op, 0);
+        int nchans = R->typespec().aggregate();
+        if (R->typespec().is_closure_based() || R->typespec().is_array())
+            continue;
+
+        // Look ahead in the basic block for a float lookup of the channel
+        // just past ours, with the same file, coordinates and options,
+        // none of whose inputs change in between. That one can ride along
+        // as our "alpha".
+        std::vector<int> written;
+        for (int a = 0;  a < op.nargs();  ++a)
+            if (op.argwrite(a))
+                written.push_back (oparg (op, a));
+        for (int next = opnum+1;  next < e && m_bblockids[next] == m_bblockids[opnum];  ++next) {
+            Opcode &op2 (code[next]);
+            TexLookup tex2;
+            const Symbol *R2 = op2.nargs() ? opargsym (op2, 0) : nullptr;
+            bool match = op2.opname() == u_texture && parse (op2, tex2)
+                         && tex2.npos == tex.npos && same_opts (tex, tex2)
+                         && tex2.firstchannel == tex.firstchannel + nchans
+                         && R2->typespec().is_float() && R2 != R;
+            for (int a = 1;  match && a < tex.npos;  ++a)
+                match = (oparg (op2, a) == oparg (op, a));
+            // Its result must not be touched between the two ops, since
+            // it will now be written at the first one.
+            bool touched = false;
+            if (match) {
+                int r2 = oparg (op2, 0);
+                for (int i = opnum;  i < next && ! touched;  ++i)
+                    for (int a = 0;  a < code[i].nargs() && ! touched;  ++a)
+                        touched = (oparg (code[i], a) == r2);
+            }
+            // ... and what it reads must not have changed since ours.
+            for (int a = 1;  match && ! touched && a < op2.nargs();  ++a)
+                touched = std::find (written.begin(), written.end(),
+                                     oparg (op2, a)) != written.end();
+            if (match && ! touched) {
+                std::vector<int> &opargs (inst()->args());
+                int firstarg = (int) opargs.size();
+                for (int a = 0;  a < op.nargs();  ++a)
+                    opargs.push_back (oparg (op, a));
+                opargs.push_back (add_constant (Strings::alpha));
+                opargs.push_back (oparg (op2, 0));
+                int nargs = op.nargs() + 2;
+                op.set_args (firstarg, nargs);
+                op.argreadonly (nargs-2);
+                op.argwriteonly (nargs-1);
+                turn_into_nop (op2, "coalesced into an earlier texture lookup");
+                ++merged;
+                break;
+            }
+            // Keep track of what changes on the way to the next candidate.
+            for (int a = 0;  a < op2.nargs();  ++a)
+                if (op2.argwrite(a))
+                    written.push_back (oparg (op2, a));
+            if (op2.opname() == u_texture && match)
+                break;  // its result was in the way; give up on this one
+        }
+    }
+    m_bblockids.clear ();   // Keep insert_code from getting confused
+    if (merged)
+        track_variable_lifetimes ();
+    return merged;
+}
+
+
+
 void
 RuntimeOptimizer::coalesce_temporaries ()
 {
@@ -2722,6 +3437,7 @@ RuntimeOptimizer::coalesce_temporaries ()
                 if (coalescable (*t) &&
                       equivalent (s->typespec(), t->typespec()) &&
                       s->has_derivs() == t->has_derivs() &&
+                      s->deriv_axes() == t->deriv_axes() &&
                       (slast < t->firstuse() || sfirst > t->lastuse()) &&
                       (s->is_uniform() == t->is_uniform()) &&
                       (s->forced_llvm_bool() == t->forced_llvm_bool())) {
@@ -2752,6 +3468,325 @@ RuntimeOptimizer::coalesce_temporaries ()
 
 
 
+int
+RuntimeOptimizer::mark_transient_strings ()
+{
+    // Only these ops make strings we know how to build in the scratch
+    // arena, and only the result (arg 0) of each is such a string.
+    auto creates = [](const Opcode &op) {
+        return op.opname() == u_concat || op.opname() == u_substr ||
+               op.opname() == u_format;
+    };
+
+    // Start with every string temp that nothing but those ops write.
+    // Coalescing may have merged several temps into one symbol, so every
+    // write must qualify, not just the first.
+    const OpcodeVec &ops (static_cast<const ShaderInstance &>(*inst()).ops());
+    int nsyms = (int) inst()->symbols().size();
+    std::vector<char> transient (nsyms, 0);
+    for (int s = 0;  s < nsyms;  ++s) {
+        Symbol &sym (*inst()->symbol(s));
+        sym.transient (false);
+        transient[s] = (sym.symtype() == SymTypeTemp &&
+                        sym.typespec().is_string() &&
+                        ! sym.typespec().is_array() && sym.everwritten());
+    }
+    for (auto&& op : ops) {
+        for (int a = 0;  a < op.nargs();  ++a)
+            if (op.argwrite(a) && ! (a == 0 && creates(op)))
+                transient[oparg(op, a)] = 0;
+    }
+
+    // A read is harmless only where the characters are all that's used:
+    // the printed arguments of printf & co (not a format string or an
+    // fprintf filename), and the inputs of a concat or substr whose own
+    // result stays transient. Anything else -- assignment, comparison,
+    // hashing, a name passed to the renderer, a connection -- lets the
+    // pointer escape. Dropping one symbol can drop the strings built from
+    // it, so iterate until nothing changes.
+    auto harmless = [&](const Opcode &op, int a) {
+        ustring opname = op.opname();
+        if (opname == u_concat || opname == u_substr)
+            return a >= 1 && transient[oparg(op, 0)];
+        if (opname == u_format || opname == u_fprintf)
+            return a >= 2;
+        if (opname == u_printf || opname == u_error || opname == u_warning)
+            return a >= 1;
+        return false;
+    };
+    for (bool changed = true;  changed;  ) {
+        changed = false;
+        for (auto&& op : ops) {
+            for (int a = 0;  a < op.nargs();  ++a) {
+                int s = oparg(op, a);
+                if (transient[s] && op.argread(a) && ! harmless(op, a)) {
+                    transient[s] = 0;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    int nmarked = 0;
+    for (int s = 0;  s < nsyms;  ++s) {
+        if (transient[s]) {
+            inst()->symbol(s)->transient (true);
+            ++nmarked;
+        }
+    }
+    return nmarked;
+}
+
+
+
+// Integer value ranges, just enough to prove indices in bounds. An int
+// symbol's range is known when it is a constant, the induction variable
+// of a "for" loop whose body holds the op asking, or a temp whose only
+// writer is an earlier op in the same basic block computing assign, add,
+// sub, mul, mod, min, max or clamp of int ranges that are known in turn.
+class IndexRangeFinder
+{
+public:
+    IndexRangeFinder (RuntimeOptimizer &rop)
+        : m_rop(rop), m_code(rop.inst()->ops())
+    {
+        // Which op writes each symbol, if exactly one does
+        m_writer.resize (rop.inst()->symbols().size(), -1);
+        for (int i = 0, e = (int)m_code.size();  i < e;  ++i) {
+            const Opcode &op (m_code[i]);
+            for (int a = 0;  a < op.nargs();  ++a) {
+                if (! op.argwrite(a))
+                    continue;
+                int &w (m_writer[rop.oparg(op, a)]);
+                w = (w == -1 || w == i) ? i : -2;
+            }
+        }
+        for (int i = 0, e = (int)m_code.size();  i < e;  ++i) {
+            if (m_code[i].opname() == Strings::op_for) {
+                Loop loop;
+                loop.var = induction_var (i, loop.lo, loop.hi);
+                loop.bodybegin = m_code[i].jump(1);
+                loop.bodyend = m_code[i].jump(2);
+                if (loop.var >= 0)
+                    m_loops.push_back (loop);
+            }
+        }
+    }
+
+    /// Is argument a of op opnum an int always in [0,len)?
+    bool in_range (int opnum, int a, int len) {
+        int64_t lo, hi;
+        return range (m_rop.oparg (m_code[opnum], a), opnum, lo, hi, 0)
+               && lo >= 0 && hi < len;
+    }
+
+private:
+    struct Loop {
+        int var, bodybegin, bodyend;
+        int64_t lo, hi;
+    };
+
+    const Symbol *constant_int (const Opcode &op, int a) {
+        const Symbol *s = m_rop.opargsym (op, a);
+        return (s->is_constant() && s->typespec().is_int()) ? s : nullptr;
+    }
+
+    bool straight_line (int begin, int end) {
+        for (int i = begin;  i < end;  ++i)
+            if (m_code[i].jump(0) >= 0)
+                return false;
+        return true;
+    }
+
+    // If the "for" loop at opnum has the shape
+    //     for (I = c0;  I < C;  I += k)       (or <=, or C > I, C >= I)
+    // with constant c0, C and k > 0, and I written nowhere else inside the
+    // loop, return I and the values it can take in the body, else -1.
+    int induction_var (int opnum, int64_t &lo, int64_t &hi) {
+        const Opcode &loop (m_code[opnum]);
+        int condbegin = loop.jump(0), bodybegin = loop.jump(1);
+        int stepbegin = loop.jump(2), end = loop.jump(3);
+        if (! straight_line (opnum+1, bodybegin) || ! straight_line (stepbegin, end))
+            return -1;
+
+        // The condition is the last thing the cond section writes to it
+        int cond = m_rop.oparg (loop, 0), cmp = -1;
+        for (int i = condbegin;  i < bodybegin;  ++i)
+            for (int a = 0;  a < m_code[i].nargs();  ++a)
+                if (m_code[i].argwrite(a) && m_rop.oparg (m_code[i], a) == cond)
+                    cmp = i;
+        if (cmp < 0 || m_code[cmp].nargs() != 3)
+            return -1;
+        const Opcode &c (m_code[cmp]);
+        const Symbol *bound;
+        int var;
+        if ((c.opname() == u_lt || c.opname() == u_le) && (bound = constant_int (c, 2))) {
+            var = m_rop.oparg (c, 1);
+            hi = int64_t(bound->get_int()) - (c.opname() == u_lt);
+        } else if ((c.opname() == u_gt || c.opname() == u_ge) && (bound = constant_int (c, 1))) {
+            var = m_rop.oparg (c, 2);
+            hi = int64_t(bound->get_int()) - (c.opname() == u_gt);
+        } else {
+            return -1;
+        }
+        const Symbol &I (*m_rop.inst()->symbol (var));
+        if (I.symtype() != SymTypeLocal || ! I.typespec().is_int())
+            return -1;
+
+        // Inside the loop, I is set once in the init and once in the step
+        int init = -1, step = -1;
+        for (int i = opnum+1;  i < end;  ++i) {
+            for (int a = 0;  a < m_code[i].nargs();  ++a) {
+                if (! m_code[i].argwrite(a) || m_rop.oparg (m_code[i], a) != var)
+                    continue;
+                if (i < condbegin && init < 0)
+                    init = i;
+                else if (i >= stepbegin && step < 0)
+                    step = i;
+                else
+                    return -1;
+            }
+        }
+        if (init < 0 || step < 0)
+            return -1;
+        const Symbol *start = constant_int (m_code[init], 1);
+        if (m_code[init].opname() != u_assign || ! start)
+            return -1;
+        lo = start->get_int();
+
+        // The step is "add I I k", or "add T I k" then "assign I T"
+        const Opcode *incr = &m_code[step];
+        if (incr->opname() == u_assign) {
+            int t = m_rop.oparg (*incr, 1);
+            incr = nullptr;
+            for (int i = stepbegin;  i < step;  ++i)
+                if (m_code[i].argwrite(0) && m_rop.oparg (m_code[i], 0) == t)
+                    incr = &m_code[i];
+            if (! incr)
+                return -1;
+        }
+        if (incr->opname() != u_add || incr->nargs() != 3)
+            return -1;
+        const Symbol *k = nullptr;
+        if (m_rop.oparg (*incr, 1) == var)
+            k = constant_int (*incr, 2);
+        else if (m_rop.oparg (*incr, 2) == var)
+            k = constant_int (*incr, 1);
+        // Stepping out of the loop must not wrap I around to negative
+        if (! k || k->get_int() <= 0 || lo > hi ||
+            hi + k->get_int() > std::numeric_limits<int>::max())
+            return -1;
+        return var;
+    }
+
+    bool range (int symindex, int opnum, int64_t &lo, int64_t &hi, int depth) {
+        const Symbol &s (*m_rop.inst()->symbol (symindex));
+        if (! s.typespec().is_int())
+            return false;
+        if (s.is_constant()) {
+            lo = hi = s.get_int();
+            return true;
+        }
+        for (auto&& loop : m_loops) {
+            if (loop.var == symindex && opnum >= loop.bodybegin &&
+                    opnum < loop.bodyend) {
+                lo = loop.lo;
+                hi = loop.hi;
+                return true;
+            }
+        }
+        int w = m_writer[symindex];
+        if (s.symtype() != SymTypeTemp || depth > 8 || w < 0 || w >= opnum ||
+                m_rop.bblockid (w) != m_rop.bblockid (opnum))
+            return false;
+
+        const Opcode &op (m_code[w]);
+        int64_t alo, ahi, blo, bhi, clo, chi;
+        auto arg = [&](int a, int64_t &l, int64_t &h) {
+            return a < op.nargs() && range (m_rop.oparg (op, a), w, l, h, depth+1);
+        };
+        ustring opname = op.opname();
+        if (opname == u_assign && op.nargs() == 2) {
+            if (! arg (1, lo, hi))
+                return false;
+        } else if (op.nargs() == 4 && opname == u_clamp) {
+            if (! arg (1, alo, ahi) || ! arg (2, blo, bhi) || ! arg (3, clo, chi))
+                return false;
+            lo = std::min (std::max (alo, blo), clo);
+            hi = std::min (std::max (ahi, bhi), chi);
+        } else if (op.nargs() == 3 && arg (1, alo, ahi) && arg (2, blo, bhi)) {
+            if (opname == u_add) {
+                lo = alo + blo;
+                hi = ahi + bhi;
+            } else if (opname == u_sub) {
+                lo = alo - bhi;
+                hi = ahi - blo;
+            } else if (opname == u_mul) {
+                int64_t p[4] = { alo*blo, alo*bhi, ahi*blo, ahi*bhi };
+                lo = *std::min_element (p, p+4);
+                hi = *std::max_element (p, p+4);
+            } else if (opname == u_mod && alo >= 0 && blo == bhi && blo > 0) {
+                lo = 0;
+                hi = std::min (ahi, blo - 1);
+            } else if (opname == u_min) {
+                lo = std::min (alo, blo);
+                hi = std::min (ahi, bhi);
+            } else if (opname == u_max) {
+                lo = std::max (alo, blo);
+                hi = std::max (ahi, bhi);
+            } else {
+                return false;
+            }
+        } else {
+            return false;
+        }
+        // Anything that might have overflowed an int is unknown
+        return lo >= std::numeric_limits<int>::min() &&
+               hi <= std::numeric_limits<int>::max();
+    }
+
+    RuntimeOptimizer &m_rop;
+    OpcodeVec &m_code;
+    std::vector<int> m_writer;   ///< Sole writing op of each sym, or <0
+    std::vector<Loop> m_loops;   ///< "for" loops with known induction vars
+};
+
+
+
+int
+RuntimeOptimizer::elide_range_checks ()
+{
+    find_basic_blocks ();
+    IndexRangeFinder ranges (*this);
+    int nelided = 0;
+    OpcodeVec &code (inst()->ops());
+    for (int opnum = 0, e = (int)code.size();  opnum < e;  ++opnum) {
+        Opcode &op (code[opnum]);
+        ustring opname = op.opname();
+        bool safe = false;
+        if (opname == u_aref)
+            safe = ranges.in_range (opnum, 2, opargsym(op, 1)->typespec().arraylength());
+        else if (opname == u_aassign)
+            safe = ranges.in_range (opnum, 1, opargsym(op, 0)->typespec().arraylength());
+        else if (opname == u_compref)
+            safe = ranges.in_range (opnum, 2, 3);
+        else if (opname == u_compassign)
+            safe = ranges.in_range (opnum, 1, 3);
+        else if (opname == u_mxcompref)
+            safe = ranges.in_range (opnum, 2, 4) && ranges.in_range (opnum, 3, 4);
+        else if (opname == u_mxcompassign)
+            safe = ranges.in_range (opnum, 1, 4) && ranges.in_range (opnum, 2, 4);
+        else
+            continue;
+        op.index_in_range (safe);
+        nelided += safe;
+    }
+    m_bblockids.clear ();   // Keep insert_code from getting confused
+    return nelided;
+}
+
+
+
 void
 RuntimeOptimizer::post_optimize_instance ()
 {
@@ -2760,6 +3795,15 @@ RuntimeOptimizer::post_optimize_instance ()
     if (inst()->unused())
         return;    // skip the expensive stuff if we're not used anyway
 
+    // Hoist before add_useparam, so that any useparam a hoisted op needs
+    // is placed in front of it where it lands.
+    if (optimize() >= 2 && m_opt_loop_invariants)
+        hoist_loop_invariants ();
+
+    // Merge texture lookups of adjacent channels into one call
+    if (optimize() >= 1 && m_opt_texture_coalesce)
+        coalesce_texture_lookups ();
+
     SymbolPtrVec allsymptrs;
     allsymptrs.reserve (inst()->symbols().size());
     for (auto&& s : inst()->symbols())
@@ -2781,8 +3825,16 @@ RuntimeOptimizer::post_optimize_instance ()
     }
 #endif
 
+    // Before coalescing, while each temp still has its own single writer
+    if (optimize() >= 1 && m_opt_range_checks &&
+            inst()->master()->range_checking())
+        elide_range_checks ();
+
     if (optimize() >= 1 && m_opt_coalesce_temps)
         coalesce_temporaries ();
+
+    if (optimize() >= 1 && m_opt_transient_strings)
+        mark_transient_strings ();
 }
 
 
@@ -2818,7 +3870,7 @@ RuntimeOptimizer::collapse_syms ()
     }
 
     // Remap all the function arguments to the new indices
-    for (auto&& arg : inst()->m_instargs)
+    for (auto&& arg : inst()->args())
         arg = symbol_remap[arg];
 
     // Fix our connections from upstream shaders
@@ -2919,7 +3971,7 @@ RuntimeOptimizer::collapse_ops ()
     }
 
     // Swap the new code for the old.
-    std::swap (inst()->m_instops, new_ops);
+    inst()->m_instops = std::make_shared<OpcodeVec> (std::move (new_ops));
 
     // These are no longer valid
     m_bblockids.clear ();
@@ -3023,10 +4075,106 @@ RuntimeOptimizer::printinst (std::ostream &out) const
 
 
 
+void
+RuntimeOptimizer::parallel_layers (bool allow_threads,
+                        const std::function<void(RuntimeOptimizer&)> &func)
+{
+    int nlayers = (int) group().nlayers ();
+    int nthreads = allow_threads && ! debug() ? shadingsys().m_opt_parallel_layers : 0;
+    nthreads = std::min (nthreads, nlayers);
+    if (nthreads < 2) {
+        for (int layer = 0;  layer < nlayers;  ++layer) {
+            set_inst (layer);
+            func (*this);
+        }
+        return;
+    }
+
+    // Each thread gets its own optimizer (and context, for any errors
+    // it reports), seeded with the group-wide state gathered so far, and
+    // takes every nthreads-th layer.
+    auto worker = [&](int mythread) {
+        PerThreadInfo *threadinfo = shadingsys().create_thread_info();
+        ShadingContext *ctx = shadingsys().get_context (threadinfo);
+        {
+            RuntimeOptimizer rop (shadingsys(), group(), ctx);
+            rop.m_params_holding_globals = m_params_holding_globals;
+            rop.m_memo_keys = m_memo_keys;
+            rop.m_unknown_message_sent = m_unknown_message_sent;
+            rop.m_messages_sent = m_messages_sent;
+            for (int layer = mythread;  layer < nlayers;  layer += nthreads) {
+                rop.set_inst (layer);
+                func (rop);
+            }
+        }
+        shadingsys().release_context (ctx);
+        shadingsys().destroy_thread_info (threadinfo);
+    };
+    OIIO::thread_group threads;
+    for (int t = 0;  t < nthreads;  ++t)
+        threads.add_thread (new std::thread (worker, t));
+    threads.join_all ();
+}
+
+
+
+void
+RuntimeOptimizer::add_closure_pool_size (const Opcode &op, bool in_loop)
+{
+    // Tally, as the renderer's allocator lays them out, the most closure
+    // memory one execution of the group can ask for: each closure, mul,
+    // or add of closures makes at most one node.  A node made in a loop
+    // or for a closure whose name isn't known leaves it unbounded.
+    if (m_closure_pool_size < 0 || ! op.nargs())
+        return;
+    size_t size = 0, align = 1;
+    if (op.opname() == u_closure) {
+        // It's either 'closure result weight name' or 'closure result name'
+        Symbol *sym = opargsym (op, 1);
+        if (sym && !sym->typespec().is_string())
+            sym = opargsym (op, 2);
+        const ClosureRegistry::ClosureEntry *clentry = nullptr;
+        if (sym->is_constant())
+            clentry = shadingsys().find_closure (sym->get_string());
+        if (! clentry) {
+            m_closure_pool_size = -1;
+            return;
+        }
+        size = sizeof(ClosureComponent) + std::max (4, clentry->struct_size);
+        align = clentry->alignment;
+    } else if (op.opname() == u_mul
+               && opargsym (op, 0)->typespec().is_closure_based()) {
+        size = sizeof(ClosureMul);
+        align = alignof(ClosureMul);
+    } else if (op.opname() == u_add
+               && opargsym (op, 0)->typespec().is_closure_based()) {
+        size = sizeof(ClosureAdd);
+        align = alignof(ClosureAdd);
+    } else {
+        return;
+    }
+    if (in_loop) {
+        m_closure_pool_size = -1;
+        return;
+    }
+    // Round up, and allow for realigning the node's start.
+    m_closure_pool_size += int(((size + align - 1) & ~(align - 1)) + align - 1);
+}
+
+
+
 void
 RuntimeOptimizer::run ()
 {
     Timer rop_timer;
+    // Time each part of the optimization, for the group's compile stats
+    Timer pass_timer;
+    GroupCompileStats &stats (group().m_compile_stats);
+    stats.opt_pass_times.clear ();
+    stats.opt_layer_runs = stats.opt_layer_passes = 0;
+    stats.opt_converged = stats.opt_capped = stats.opt_budget_cutoffs = 0;
+    m_opt_timer.reset ();
+    m_opt_timer.start ();
     int nlayers = (int) group().nlayers ();
     if (debug())
         shadingcontext()->infofmt(
@@ -3067,10 +4215,12 @@ RuntimeOptimizer::run ()
         shadingsys().merge_instances (group());
 
     m_params_holding_globals.resize (nlayers);
+    m_memo_keys.assign (nlayers, std::string());
 
     // Inventory for error calls so that if lazyerror=0 we don't incorrectly
     // assume the layer is unused.
     check_for_error_calls(false);
+    stats.opt_pass_times.emplace_back ("setup", pass_timer.lap());
 
     // Optimize each layer, from first to last
     for (int layer = 0;  layer < nlayers;  ++layer) {
@@ -3081,19 +4231,40 @@ RuntimeOptimizer::run ()
         // is otherwise optimized, or else isconnected() may not reflect
         // the original connectivity after substitutions are made.
         resolve_isconnected ();
-        optimize_instance ();
+        if (recall_optimized ('f')) {
+            note_messages_sent ();
+        } else {
+            optimize_instance ();
+            remember_optimized ();
+        }
     }
     check_for_error_calls(false);  // re-check
+    stats.opt_pass_times.emplace_back ("forward", pass_timer.lap());
+
+    // Let layers hand down values that later layers would recompute; the
+    // backward pass below then cleans up what the borrowers no longer need.
+    if (shadingsys().m_opt_cross_layer_cse && optimize() >= 2) {
+        share_common_subexpressions ();
+        stats.opt_pass_times.emplace_back ("cross_layer_cse", pass_timer.lap());
+    }
 
     // Optimize each layer again, from last to first (because some
     // optimizations are only apparent when the subsequent shaders have
     // been simplified).
     for (int layer = nlayers-1;  layer >= 0;  --layer) {
         set_inst (layer);
-        if (! inst()->unused())
+        if (inst()->unused())
+            continue;
+        if (recall_optimized ('b')) {
+            note_messages_sent ();
+        } else {
             optimize_instance ();
+            remember_optimized ();
+        }
     }
 
+    stats.opt_pass_times.emplace_back ("backward", pass_timer.lap());
+
     // Try merging instances again, now that we've optimized
     shadingsys().merge_instances (group(), true);
 
@@ -3107,36 +4278,55 @@ RuntimeOptimizer::run ()
         // For our parameters that require derivatives, mark their
         // upstream connections as also needing derivatives.
         for (auto&& c : inst()->m_connections) {
-            if (inst()->symbol(c.dst.param)->has_derivs()) {
+            Symbol *dst = inst()->symbol(c.dst.param);
+            if (dst->has_derivs()) {
                 Symbol *source = group()[c.srclayer]->symbol(c.src.param);
-                if (source->typespec().elementtype().is_float_based())
+                if (source->typespec().elementtype().is_float_based()) {
+                    source->deriv_axes (source->has_derivs()
+                                        ? source->deriv_axes() | dst->deriv_axes()
+                                        : dst->deriv_axes());
                     source->has_derivs (true);
+                }
             }
         }
     }
 
-    // Post-opt cleanup: add useparam, coalesce temporaries, etc.
-    for (int layer = 0;  layer < nlayers;  ++layer) {
-        set_inst (layer);
-        post_optimize_instance ();
-    }
+    stats.opt_pass_times.emplace_back ("dependencies", pass_timer.lap());
+
+    // Post-opt cleanup: add useparam, coalesce temporaries, etc. Each
+    // layer is on its own here, except that batched analysis needs its
+    // upstream layers already analyzed.
+    parallel_layers (! m_opt_batched_analysis, [](RuntimeOptimizer &rop) {
+        if (! rop.recall_optimized ('p')) {
+            rop.post_optimize_instance ();
+            rop.remember_optimized ();
+        }
+    });
 
     // Last chance to eliminate duplicate instances
     shadingsys().merge_instances (group(), true);
 
     // Last inventory of error() calls, issue warnings if needed.
     check_for_error_calls(true);
-
-    // Get rid of nop instructions and unused symbols.
+    stats.opt_pass_times.emplace_back ("post_optimize", pass_timer.lap());
+
+    // Get rid of nop instructions and unused symbols. A layer only
+    // renumbers its own symbols and the source end of the connections
+    // it feeds, so layers can do this independently.
+    if (optimize() >= 1) {
+        parallel_layers (true, [](RuntimeOptimizer &rop) {
+            if (! rop.inst()->unused()) {
+                rop.collapse_syms ();
+                rop.collapse_ops ();
+            }
+        });
+        stats.opt_pass_times.emplace_back ("collapse", pass_timer.lap());
+    }
     size_t new_nsyms = 0, new_nops = 0, new_deriv_syms = 0;
     for (int layer = 0;  layer < nlayers;  ++layer) {
         set_inst (layer);
         if (inst()->unused())
             continue;  // no need to print or gather stats for unused layers
-        if (optimize() >= 1) {
-            collapse_syms ();
-            collapse_ops ();
-        }
         if (debug() && !inst()->unused()) {
             track_variable_lifetimes ();
             std::cout << "After optimizing layer " << layer << " \"" 
@@ -3150,9 +4340,12 @@ RuntimeOptimizer::run ()
 
     m_unknown_textures_needed = false;
     m_unknown_closures_needed = false;
+    m_unknown_pointclouds_needed = false;
     m_unknown_attributes_needed = false;
+    m_closure_pool_size = 0;
     m_textures_needed.clear();
     m_closures_needed.clear();
+    m_pointclouds_needed.clear();
     m_globals_read = 0;
     m_globals_write = 0;
     m_globals_needed.clear();
@@ -3192,10 +4385,16 @@ RuntimeOptimizer::run ()
             if (s.has_derivs())
                 ++new_deriv_syms;
         }
-        for (auto&& op : inst()->ops()) {
+        int loop_end = 0;  // ops before this are inside a loop body
+        for (int opnum = 0, nops = (int)inst()->ops().size();  opnum < nops;  ++opnum) {
+            Opcode &op (inst()->ops()[opnum]);
             const OpDescriptor *opd = shadingsys().op_descriptor (op.opname());
             if (! opd)
                 continue;
+            if (op.opname() == u_for || op.opname() == u_while
+                  || op.opname() == u_dowhile)
+                loop_end = std::max (loop_end, op.jump(3));
+            add_closure_pool_size (op, opnum < loop_end);
             // a non-unused layer with a nontrivial op does something
             if (op.opname() != Strings::end && op.opname() != Strings::useparam)
                 does_nothing = false;
@@ -3217,6 +4416,16 @@ RuntimeOptimizer::run ()
                     m_unknown_textures_needed = true;
                 }
             }
+            if (op.opname() == u_pointcloud_search
+                  || op.opname() == u_pointcloud_get) {
+                // arg 1 is the cloud's file name
+                Symbol *sym = opargsym (op, 1);
+                OSL_DASSERT (sym && sym->typespec().is_string());
+                if (sym->is_constant())
+                    m_pointclouds_needed.insert(sym->get_string());
+                else
+                    m_unknown_pointclouds_needed = true;
+            }
             if (op.opname() == u_closure) {
                 // It's either 'closure result weight name' or 'closure result name'
                 Symbol *sym = opargsym (op, 1); // arg 1 is the closure name
@@ -3265,6 +4474,12 @@ RuntimeOptimizer::run ()
     group().does_nothing (does_nothing);
 
     m_stat_specialization_time = rop_timer();
+    stats.opt_pass_times.emplace_back ("inventory", pass_timer.lap());
+    stats.specialization_time = m_stat_specialization_time;
+    stats.preopt_ops = (int) old_nops;
+    stats.postopt_ops = (int) new_nops;
+    stats.preopt_syms = (int) old_nsyms;
+    stats.postopt_syms = (int) new_nsyms;
     {
         // adjust memory stats
         ShadingSystemImpl &ss (shadingsys());
@@ -3284,6 +4499,19 @@ RuntimeOptimizer::run ()
               100.0*double((long long)new_nsyms-(long long)old_nsyms)/double(old_nsyms),
               new_nops, old_nops,
               100.0*double((long long)new_nops-(long long)old_nops)/double(old_nops));
+        std::string passes;
+        for (auto&& p : stats.opt_pass_times)
+            passes += fmtformat (" {} {:1.3f}s", p.first, p.second);
+        shadingcontext()->infofmt(" passes:{}", passes);
+        shadingcontext()->infofmt(" {} optimizer passes over {} layer runs: {} converged, {} hit opt_passes={}",
+              stats.opt_layer_passes, stats.opt_layer_runs,
+              stats.opt_converged, stats.opt_capped,
+              shadingsys().opt_passes());
+        if (shadingsys().opt_time_budget_ms() > 0.0f)
+            shadingcontext()->infofmt(" time budget {}ms, used {:1.1f}ms, {} layer runs cut short",
+                  shadingsys().opt_time_budget_ms(),
+                  m_stat_specialization_time * 1000.0,
+                  stats.opt_budget_cutoffs);
         if (does_nothing)
             shadingcontext()->infofmt("Group does nothing");
         if (m_textures_needed.size()) {
@@ -7,6 +7,7 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <functional>
 
 #include <boost/container/flat_map.hpp>
 #include <boost/container/flat_set.hpp>
@@ -296,15 +297,51 @@ public:
 
     void coalesce_temporaries ();
 
+    /// Move ops out of for/while/do loops when they compute the same
+    /// thing on every trip: pure ops (including renderer queries such as
+    /// getattribute and getmatrix) whose inputs the loop doesn't change,
+    /// writing temps that nothing outside the loop sees. Return the
+    /// number of ops hoisted.
+    int hoist_loop_invariants ();
+
+    /// Merge a texture() lookup of a float channel into an earlier one of
+    /// the same file, coordinates and options in the same basic block
+    /// whose channels end just before it, by making it the earlier one's
+    /// "alpha" output. Return the number of lookups merged away.
+    int coalesce_texture_lookups ();
+
+    /// Mark the string temps whose values never escape the shading point:
+    /// made only by concat, substr or format, and read only to be printed
+    /// or to build other such strings. Codegen builds those in the
+    /// context's scratch arena instead of interning them. Return the
+    /// number of symbols marked.
+    int mark_transient_strings ();
+
+    /// Flag the aref, aassign, compref, compassign, mxcompref and
+    /// mxcompassign ops whose indices provably stay in bounds -- loop
+    /// induction variables and simple integer arithmetic on them and on
+    /// constants -- so that codegen can skip their range checks. Return
+    /// the number of ops flagged.
+    int elide_range_checks ();
+
     /// Track variable lifetimes for all the symbols of the instance.
     ///
     void track_variable_lifetimes ();
     void track_variable_lifetimes (const SymbolPtrVec &allsymptrs);
 
-    /// For each symbol, have a list of the symbols it depends on (or that
-    /// depends on it).
-    typedef std::set<int> SymIntSet;
-    typedef std::map<int, SymIntSet> SymDependency;
+    /// For each symbol, the list of the symbols it depends on. The
+    /// "A depends on B" edges are collected as they're found, then
+    /// gathered by A into one flat array (a row per symbol, plus last
+    /// ones for the "derivatives" pseudo-symbols), so that propagating
+    /// along them is a linear walk rather than a chase through nested
+    /// std::map and std::set nodes.
+    struct SymDependency {
+        std::vector<std::pair<int,int>> edges;  ///< (A, B) as added
+        std::vector<int> rowstart;  ///< A's deps: [rowstart[A],rowstart[A+1])
+        std::vector<int> deps;
+        // Sort the edges into rows, for nsyms symbols and the pseudo-ones.
+        void finalize (int nsyms);
+    };
 
     void syms_used_in_op (Opcode &op,
                           std::vector<int> &rsyms, std::vector<int> &wsyms);
@@ -313,7 +350,7 @@ public:
 
     void add_dependency (SymDependency &dmap, int A, int B);
 
-    void mark_symbol_derivatives (SymDependency &symdeps, SymIntSet &visited, int d);
+    void mark_symbol_derivatives (const SymDependency &symdeps);
 
     void mark_outgoing_connections ();
 
@@ -324,6 +361,17 @@ public:
 
     int eliminate_middleman ();
 
+    /// Find pure ops, computed unconditionally on the same constants and
+    /// unwritten globals, that a layer repeats from an earlier layer it's
+    /// already connected to, and have that earlier layer pass its result
+    /// down through a new connection instead. Return the number shared.
+    int share_common_subexpressions ();
+
+    /// Add new parameters to the end of the current layer's parameter
+    /// range, renumbering all references to the symbols after them.
+    /// Return the index of the first new parameter.
+    int insert_params (const SymbolVec &params);
+
     /// Squeeze out unused symbols from an instance that has been
     /// optimized.
     void collapse_syms ();
@@ -407,9 +455,29 @@ public:
     // optimization is finished, warn if any error messages are left.
     bool check_for_error_calls (bool warn = false);
 
+    /// For opt_memoize_instances: extend the current layer's memo key
+    /// with its state as it enters the given optimization step, and if
+    /// an identical layer already went through that step (in any group),
+    /// replace the layer with the result and return true.
+    bool recall_optimized (char step);
+
+    /// Remember the current layer's state after the step that the last
+    /// recall_optimized() call for it wasn't able to skip.
+    void remember_optimized ();
+
+    /// For opt_parallel_layers: call func on an optimizer set to each
+    /// layer, spreading the layers over that many threads (each with its
+    /// own optimizer and context) or just looping over them if it's off.
+    /// func may only touch its own layer of the group.
+    void parallel_layers (bool allow_threads,
+                          const std::function<void(RuntimeOptimizer&)> &func);
+
     /// After optimization, check for things that should not be left
     /// unoptimized.
     bool police_failed_optimizations ();
+
+    /// Add to m_closure_pool_size the closure memory that op may allocate.
+    void add_closure_pool_size (const Opcode &op, bool in_loop);
     enum {  // bit field
         police_opt_warn           = 1,
         police_gpu_err_only       = 2,
@@ -445,6 +513,11 @@ private:
     bool m_opt_mix;                       ///< Do mix optimizations?
     bool m_opt_middleman;                 ///< Do middleman optimizations?
     bool m_opt_batched_analysis;          ///< Perform extra analysis required for batched execution?
+    bool m_opt_loop_invariants;           ///< Hoist loop-invariant ops?
+    bool m_opt_transient_strings;         ///< Scratch-arena temp strings?
+    bool m_opt_range_checks;              ///< Skip provably-safe range checks?
+    bool m_opt_texture_coalesce;          ///< Merge adjacent-channel lookups?
+    bool m_opt_deriv_axes;                ///< Track x and y derivs apart?
     bool m_keep_no_return_function_calls; ///< To generate debug info, keep no return function calls
     ShaderGlobals m_shaderglobals;        ///< Dummy ShaderGlobals
 
@@ -455,6 +528,7 @@ private:
 
     // All below is just for the one inst we're optimizing at the moment:
     int m_pass;                       ///< Optimization pass we're on now
+    Timer m_opt_timer;                ///< Time spent on the group so far
     std::vector<int> m_all_consts;    ///< All const symbol indices for inst
     int m_next_newconst;              ///< Unique ID for next new const we add
     int m_next_newtemp;               ///< Unique ID for next new temp we add
@@ -467,13 +541,16 @@ private:
     std::vector<ustring> m_local_messages_sent; ///< Messages set in this inst
     std::set<ustring> m_textures_needed;
     std::set<ustring> m_closures_needed;
+    std::set<ustring> m_pointclouds_needed;
     std::set<ustring> m_globals_needed;
     int m_globals_read = 0;
     int m_globals_write = 0;
     std::set<AttributeNeeded> m_attributes_needed;
     bool m_unknown_textures_needed;
     bool m_unknown_closures_needed;
+    bool m_unknown_pointclouds_needed = false;
     bool m_unknown_attributes_needed;
+    int m_closure_pool_size;          ///< Closure bytes per run, -1 unbounded
     std::set<UserDataNeeded> m_userdata_needed;
     double m_stat_opt_locking_time;       ///<   locking time
     double m_stat_specialization_time;    ///<   specialization time
@@ -484,12 +561,36 @@ private:
     // Persistant data shared between layers
     bool m_unknown_message_sent;      ///< Somebody did a non-const setmessage
     std::vector<ustring> m_messages_sent;  ///< Names of messages set
+    std::vector<std::string> m_memo_keys;  ///< Each layer's memo key so far
+
+    // Add the names of messages the current layer may set to
+    // m_messages_sent.
+    void note_messages_sent ();
 
     friend class ShadingSystemImpl;
 };
 
 
 
+/// A layer as one step of the runtime optimizer left it, for reuse by
+/// identical layers (opt_memoize_instances).
+struct OptimizedInstance {
+    ShaderMaster::ref master;         ///< Keeps the master's data around
+    SymbolVec symbols;
+    std::shared_ptr<OpcodeVec> ops;         ///< Shared with the instances
+    std::shared_ptr<std::vector<int>> args;
+    std::vector<int> iparams;
+    std::vector<float> fparams;
+    std::vector<ustring> sparams;
+    ConnectionVec connections;
+    std::unordered_map<ustring,ustring,ustringHash> params_holding_globals;
+    bool writes_globals, userdata_params, outgoing_connections;
+    bool renderer_outputs, has_error_op;
+    int firstparam, lastparam, maincodebegin, maincodeend, Psym, Nsym;
+};
+
+
+
 /// Macro that defines the arguments to constant-folding routines
 ///
 #define FOLDARGSDECL     RuntimeOptimizer &rop, int opnum
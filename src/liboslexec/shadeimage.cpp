@@ -2,13 +2,21 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
+#include <atomic>
+
 #include <OSL/oslconfig.h>
 
 #include <OpenImageIO/thread.h>
 #include <OpenImageIO/imagebuf.h>
 #include <OpenImageIO/imagebufalgo_util.h>
+#include <OpenImageIO/parallel.h>
 
 #include <OSL/oslexec.h>
+#include <OSL/rendererservices.h>
+#if OSL_USE_BATCHED
+#   include <OSL/batched_shaderglobals.h>
+#endif
 
 using namespace OSL;
 using namespace OSL::pvt;
@@ -21,6 +29,308 @@ using namespace OSL::pvt;
 OSL_NAMESPACE_ENTER
 
 
+namespace {  // anonymous
+
+// Pixels are handed out to the shading threads a tile at a time.  Tiles
+// are small enough that an image whose cost is concentrated in a few
+// places still gives every thread its share of the work, and big enough
+// that taking one costs nothing next to shading it.
+static const int shade_tile_size = 64;
+
+
+// What shade_image needs to know about the image and the outputs, gathered
+// once rather than for each tile or pixel.
+struct ShadeImageJob {
+    ShadingSystem& shadingsys;
+    ShaderGroup& group;
+    OIIO::ImageBuf& buf;
+    ShadeImageLocations shadelocations;
+    OIIO::ROI roi_full;
+    int xres, yres, zres;
+    std::vector<const ShaderSymbol*> output_sym;
+    std::vector<TypeDesc> output_type;
+    std::vector<int> output_nchans;
+    ShaderGlobals sg;   // the fields that are the same for every pixel
+    Matrix44 Mshad, Mobj;  // just let these be identity for now
+
+    ShadeImageJob(ShadingSystem& shadingsys, ShaderGroup& group,
+                  const ShaderGlobals* defaultsg, OIIO::ImageBuf& buf,
+                  cspan<ustring> outputs, ShadeImageLocations shadelocations);
+
+    float u(int x) const
+    {
+        if (shadelocations == ShadePixelCenters)
+            return float(x - roi_full.xbegin + 0.5f) / xres;
+        return (xres == 1) ? 0.5f : float(x - roi_full.xbegin) / (xres - 1);
+    }
+
+    float v(int y) const
+    {
+        if (shadelocations == ShadePixelCenters)
+            return float(y - roi_full.ybegin + 0.5f) / yres;
+        return (yres == 1) ? 0.5f : float(y - roi_full.ybegin) / (yres - 1);
+    }
+
+    // Copy the designated outputs of the point just shaded into pixel p.
+    // The value of component c of output i is at data[i][c * stride].
+    void save_outputs(OIIO::ImageBuf::Iterator<float>& p,
+                      const void* const* data, int stride) const
+    {
+        int chan = 0;
+        for (int i = 0; i < int(output_sym.size()); ++i) {
+            if (!data[i])
+                continue;  // Skip if symbol isn't found
+            TypeDesc t = output_type[i];
+            int tvals  = output_nchans[i];
+            if (chan + tvals > buf.nchannels())
+                break;
+            if (t.basetype == TypeDesc::FLOAT) {
+                for (int c = 0; c < tvals; ++c)
+                    p[chan++] = ((const float*)data[i])[c * stride];
+            } else if (t.basetype == TypeDesc::INT) {
+                for (int c = 0; c < tvals; ++c)
+                    p[chan++] = ((const int*)data[i])[c * stride];
+            }
+            // N.B. Drop any outputs that aren't float- or int-based
+        }
+    }
+};
+
+
+
+ShadeImageJob::ShadeImageJob(ShadingSystem& shadingsys, ShaderGroup& group,
+                             const ShaderGlobals* defaultsg,
+                             OIIO::ImageBuf& buf, cspan<ustring> outputs,
+                             ShadeImageLocations shadelocations)
+    : shadingsys(shadingsys)
+    , group(group)
+    , buf(buf)
+    , shadelocations(shadelocations)
+    , roi_full(buf.roi_full())
+    , xres(roi_full.width())
+    , yres(roi_full.height())
+    , zres(roi_full.depth())
+{
+    for (ustring name : outputs) {
+        const ShaderSymbol* sym = shadingsys.find_symbol(group, name);
+        TypeDesc type           = shadingsys.symbol_typedesc(sym);
+        output_sym.push_back(sym);
+        output_type.push_back(type);
+        output_nchans.push_back(type.numelements() * type.aggregate);
+    }
+
+    // Set up the shader globals.  Note that some of the fields can be set
+    // up once and used for all of the shades. Others need to be changed
+    // for every point shaded.
+    //
+    // Note that because we are shading a single object that is a flat image
+    // plane, a lot of this is simplified. In a real 3D render, most of
+    // these fields would need to be reset for every shade.
+    if (defaultsg) {
+        // If the caller passed a default SG template, use it to initialize
+        // the sg and in particular to set all the constant fields.
+        memcpy((char*)&sg, (const char*)defaultsg, sizeof(ShaderGlobals));
+        return;
+    }
+    // No SG template was passed, so set up reasonable defaults.
+    memset((char*)&sg, 0, sizeof(ShaderGlobals));
+    // Set "shader" space to be Mshad.  In a real renderer, this may be
+    // different for each shader group.
+    sg.shader2common = OSL::TransformationPtr(&Mshad);
+    // Set "object" space to be Mobj.  In a real renderer, this may be
+    // different for each object.
+    sg.object2common = OSL::TransformationPtr(&Mobj);
+    // Just make it look like all shades are the result of 'raytype' rays.
+    sg.raytype = 0;  // default ray type
+    // Set the surface area of the patch to 1 (which it is).  This is
+    // only used for light shaders that call the surfacearea() function.
+    sg.surfacearea = 1;
+    // Derivs are constant across the image
+    if (shadelocations == ShadePixelCenters) {
+        sg.dudx = 1.0f / xres;  // sg.dudy is already 0
+        sg.dvdy = 1.0f / yres;  // sg.dvdx is already 0
+    } else {
+        sg.dudx = 1.0f / std::max(1, (xres - 1));
+        sg.dvdy = 1.0f / std::max(1, (yres - 1));
+    }
+    // Derivatives with respect to x,y
+    sg.dPdx = Vec3(1.0f, 0.0f, 0.0f);
+    sg.dPdy = Vec3(0.0f, 1.0f, 0.0f);
+    sg.dPdz = Vec3(0.0f, 0.0f, 1.0f);
+    // Tangents of P with respect to surface u,v
+    sg.dPdu = Vec3(xres, 0.0f, 0.0f);
+    sg.dPdv = Vec3(0.0f, yres, 0.0f);
+    sg.dPdz = Vec3(0.0f, 0.0f, zres);
+    // That also implies that our normal points to (0,0,1)
+    sg.N  = Vec3(0, 0, 1);
+    sg.Ng = Vec3(0, 0, 1);
+    // In our SimpleRenderer, the "renderstate" itself just a pointer to
+    // the ShaderGlobals.
+    // sg.renderstate = &sg;
+}
+
+
+
+// Shade the pixels of one tile, one at a time.
+void
+shade_tile(const ShadeImageJob& job, ShadingContext& ctx, ShaderGlobals& sg,
+           OIIO::ROI tile)
+{
+    size_t noutputs   = job.output_sym.size();
+    const void** data = OIIO_ALLOCA(const void*, noutputs);
+    for (OIIO::ImageBuf::Iterator<float> p(job.buf, tile); !p.done(); ++p) {
+        // Set the shader globals that vary from point to pixel to pixel
+        sg.P = Vec3(p.x(), p.y(), p.z());
+        sg.u = job.u(p.x());
+        sg.v = job.v(p.y());
+
+        // Actually run the shader for this point
+        job.shadingsys.execute(ctx, job.group, sg);
+
+        // Save all the designated outputs.
+        for (size_t i = 0; i < noutputs; ++i)
+            data[i] = job.output_sym[i]
+                          ? job.shadingsys.symbol_address(ctx,
+                                                          job.output_sym[i])
+                          : nullptr;
+        job.save_outputs(p, data, 1);
+    }
+}
+
+
+
+#if OSL_USE_BATCHED
+// Fill in the parts of the batch's shader globals that are the same for
+// every pixel, from the scalar template.
+template<int WidthT>
+void
+setup_batch_globals(const ShaderGlobals& sg, BatchedShaderGlobals<WidthT>& bsg)
+{
+    memset((char*)&bsg.uniform, 0, sizeof(UniformShaderGlobals));
+    bsg.uniform.renderstate = sg.renderstate;
+    bsg.uniform.tracedata   = sg.tracedata;
+    bsg.uniform.objdata     = sg.objdata;
+    bsg.uniform.raytype     = sg.raytype;
+
+    auto& vsg = bsg.varying;
+    using OSL::assign_all;
+    assign_all(vsg.dPdx, sg.dPdx);
+    assign_all(vsg.dPdy, sg.dPdy);
+    assign_all(vsg.dPdz, sg.dPdz);
+    assign_all(vsg.I, sg.I);
+    assign_all(vsg.dIdx, sg.dIdx);
+    assign_all(vsg.dIdy, sg.dIdy);
+    assign_all(vsg.N, sg.N);
+    assign_all(vsg.Ng, sg.Ng);
+    assign_all(vsg.dudx, sg.dudx);
+    assign_all(vsg.dudy, sg.dudy);
+    assign_all(vsg.dvdx, sg.dvdx);
+    assign_all(vsg.dvdy, sg.dvdy);
+    assign_all(vsg.dPdu, sg.dPdu);
+    assign_all(vsg.dPdv, sg.dPdv);
+    assign_all(vsg.time, sg.time);
+    assign_all(vsg.dtime, sg.dtime);
+    assign_all(vsg.dPdtime, sg.dPdtime);
+    assign_all(vsg.Ps, sg.Ps);
+    assign_all(vsg.dPsdx, sg.dPsdx);
+    assign_all(vsg.dPsdy, sg.dPsdy);
+    assign_all(vsg.object2common, sg.object2common);
+    assign_all(vsg.shader2common, sg.shader2common);
+    assign_all(vsg.Ci, (ClosureColor*)nullptr);
+    assign_all(vsg.surfacearea, sg.surfacearea);
+    assign_all(vsg.flipHandedness, sg.flipHandedness);
+    assign_all(vsg.backfacing, sg.backfacing);
+}
+
+
+
+// Shade the pixels of one tile in runs of up to WidthT along each row.
+template<int WidthT>
+void
+batched_shade_tile(const ShadeImageJob& job, ShadingContext& ctx,
+                   BatchedShaderGlobals<WidthT>& bsg, OIIO::ROI tile)
+{
+    size_t noutputs       = job.output_sym.size();
+    const void** data     = OIIO_ALLOCA(const void*, noutputs);
+    const void** lanedata = OIIO_ALLOCA(const void*, noutputs);
+    auto& vsg             = bsg.varying;
+    OSL::Block<int, WidthT> wide_shadeindex;
+    for (int z = tile.zbegin; z < tile.zend; ++z) {
+        for (int y = tile.ybegin; y < tile.yend; ++y) {
+            float v = job.v(y);
+            for (int x0 = tile.xbegin; x0 < tile.xend; x0 += WidthT) {
+                int batch_size = std::min(WidthT, tile.xend - x0);
+                // Lanes past the end of a short run shade the pixels that
+                // would follow, which are never used but keep this simple.
+                for (int lane = 0; lane < WidthT; ++lane) {
+                    int x                 = x0 + lane;
+                    vsg.P[lane]           = Vec3(x, y, z);
+                    vsg.u[lane]           = job.u(x);
+                    vsg.v[lane]           = v;
+                    wide_shadeindex[lane] = lane;
+                }
+
+                job.shadingsys.batched<WidthT>().execute(ctx, job.group,
+                                                         batch_size,
+                                                         wide_shadeindex, bsg,
+                                                         nullptr, nullptr);
+
+                for (size_t i = 0; i < noutputs; ++i)
+                    data[i] = job.output_sym[i]
+                                  ? job.shadingsys.symbol_address(
+                                      ctx, job.output_sym[i])
+                                  : nullptr;
+                OIIO::ROI run(x0, x0 + batch_size, y, y + 1, z, z + 1);
+                int lane = 0;
+                for (OIIO::ImageBuf::Iterator<float> p(job.buf, run);
+                     !p.done(); ++p, ++lane) {
+                    for (size_t i = 0; i < noutputs; ++i)
+                        lanedata[i] = data[i]
+                                          ? (const char*)data[i]
+                                                + lane
+                                                      * job.output_type[i]
+                                                            .basesize()
+                                          : nullptr;
+                    job.save_outputs(p, lanedata, WidthT);
+                }
+            }
+        }
+    }
+}
+
+
+
+// The batch width to shade with: the group's own "batch_width" if the
+// renderer provides BatchedRendererServices at it and this machine can
+// run it, else the widest that can, or 0 to shade one point at a time.
+int
+shade_image_batch_width(ShadingSystem& shadingsys, ShaderGroup& group)
+{
+    RendererServices* rs = shadingsys.renderer();
+    if (!rs)
+        return 0;
+    int preferred = 0;
+    shadingsys.getattribute(&group, "batch_width", preferred);
+    if (preferred == 8 && rs->batched(WidthOf<8>())
+        && shadingsys.configure_batch_execution_at(8))
+        return 8;
+    if (preferred == 4 && rs->batched(WidthOf<4>())
+        && shadingsys.configure_batch_execution_at(4))
+        return 4;
+    if (rs->batched(WidthOf<16>())
+        && shadingsys.configure_batch_execution_at(16))
+        return 16;
+    if (rs->batched(WidthOf<8>()) && shadingsys.configure_batch_execution_at(8))
+        return 8;
+    if (rs->batched(WidthOf<4>()) && shadingsys.configure_batch_execution_at(4))
+        return 4;
+    return 0;
+}
+#endif
+
+}  // namespace
+
+
 
 bool
 shade_image (ShadingSystem &shadingsys, ShaderGroup &group,
@@ -44,134 +354,107 @@ shade_image (ShadingSystem &shadingsys, ShaderGroup &group,
         return false;
     }
 
-    parallel_image (roi, popt, [&](OIIO::ROI roi){
+    OSL_MAYBE_UNUSED int batch_width = 0;
+#if OSL_USE_BATCHED
+    batch_width = shade_image_batch_width(shadingsys, group);
+#endif
 
-    // Request an OSL::PerThreadInfo for this thread.
-    OSL::PerThreadInfo *thread_info = shadingsys.create_thread_info();
+    // Ensure the group has already been optimized (and JITed for batches
+    // of the width we'll use), both so that the outputs can be found and
+    // so that the shading threads don't all wait on one of them doing it.
+    {
+        OSL::PerThreadInfo* thread_info = shadingsys.create_thread_info();
+        ShadingContext* ctx             = shadingsys.get_context(thread_info);
+#if OSL_USE_BATCHED
+        if (batch_width == 16)
+            shadingsys.batched<16>().jit_group(&group, ctx);
+        else if (batch_width == 8)
+            shadingsys.batched<8>().jit_group(&group, ctx);
+        else if (batch_width == 4)
+            shadingsys.batched<4>().jit_group(&group, ctx);
+        else
+#endif
+            shadingsys.optimize_group(&group, ctx);
+        shadingsys.release_context(ctx);
+        shadingsys.destroy_thread_info(thread_info);
+    }
 
-    // Request a shading context so that we can execute the shader.
-    // We could get_context/release_context for each shading point,
-    // but to save overhead, it's more efficient to reuse a context
-    // within a thread.
-    ShadingContext *ctx = shadingsys.get_context (thread_info);
+    ShadeImageJob job(shadingsys, group, defaultsg, buf, outputs,
+                      shadelocations);
 
-    // Ensure the group has already been optimized
-    shadingsys.optimize_group (&group, ctx);
+    // Cut the roi into tiles, in scanline order.
+    int xtiles = (roi.width() + shade_tile_size - 1) / shade_tile_size;
+    int ytiles = (roi.height() + shade_tile_size - 1) / shade_tile_size;
+    int ntiles = xtiles * ytiles * roi.depth();
+    auto tile_roi = [&](int t) {
+        int tx = t % xtiles, ty = (t / xtiles) % ytiles;
+        int z  = roi.zbegin + t / (xtiles * ytiles);
+        int x  = roi.xbegin + tx * shade_tile_size;
+        int y  = roi.ybegin + ty * shade_tile_size;
+        return ROI(x, std::min(x + shade_tile_size, roi.xend), y,
+                   std::min(y + shade_tile_size, roi.yend), z, z + 1,
+                   roi.chbegin, roi.chend);
+    };
 
-    Matrix44 Mshad, Mobj;  // just let these be identity for now
-    OIIO::ROI roi_full = buf.roi_full();
-    int xres = roi_full.width();
-    int yres = roi_full.height();
-    int zres = roi_full.depth();
-
-    // Gather some information about the outputs once, rather than for
-    // each pixel.
-    const ShaderSymbol **output_sym  = OIIO_ALLOCA(const ShaderSymbol*, outputs.size());
-    TypeDesc *output_type = OIIO_ALLOCA(TypeDesc, outputs.size());
-    int *output_nchans = OIIO_ALLOCA(int, outputs.size());
-    for (int i = 0;  i < int(outputs.size());  ++i) {
-        output_sym[i] = shadingsys.find_symbol (group, outputs[i]);
-        output_type[i] = shadingsys.symbol_typedesc (output_sym[i]);
-        output_nchans[i] = output_type[i].numelements() * output_type[i].aggregate;
-    }
+    // Each worker takes the next tile as soon as it's free, so a thread
+    // that lands on cheap tiles goes on to take more of them instead of
+    // waiting while another works through a fixed share of expensive ones.
+    std::atomic<int> next { 0 };
+    auto worker = [&]() {
+        // Request an OSL::PerThreadInfo for this thread.
+        OSL::PerThreadInfo* thread_info = shadingsys.create_thread_info();
 
-    // Set up shader globals and a little test grid of points to shade.
-    // Note that some of the fields can be set up once and used for all of
-    // the shades. Others need to be changed for every point shaded.
-    //
-    // Note that because we are shading a single object that is a flat image
-    // plane, a lot of this is simplified. In a real 3D render, most of
-    // these fields would need to be reset for every shade.
-    ShaderGlobals sg;
-    if (defaultsg) {
-        // If the caller passed a default SG template, use it to initialize
-        // the sg and in particular to set all the constant fields.
-        memcpy ((char *)&sg, (const char*)defaultsg, sizeof(ShaderGlobals));
-    } else {
-        // No SG template was passed, so set up reasonable defaults.
-        memset ((char *)&sg, 0, sizeof(ShaderGlobals));
-        // Set "shader" space to be Mshad.  In a real renderer, this may be
-        // different for each shader group.
-        sg.shader2common = OSL::TransformationPtr (&Mshad);
-        // Set "object" space to be Mobj.  In a real renderer, this may be
-        // different for each object.
-        sg.object2common = OSL::TransformationPtr (&Mobj);
-        // Just make it look like all shades are the result of 'raytype' rays.
-        sg.raytype = 0;  // default ray type
-        // Set the surface area of the patch to 1 (which it is).  This is
-        // only used for light shaders that call the surfacearea() function.
-        sg.surfacearea = 1;
-        // Derivs are constant across the image
-        if (shadelocations == ShadePixelCenters) {
-            sg.dudx  = 1.0f / xres;    // sg.dudy is already 0
-            sg.dvdy  = 1.0f / yres;    // sg.dvdx is already 0
-        } else {
-            sg.dudx  = 1.0f / std::max(1,(xres-1));
-            sg.dvdy  = 1.0f / std::max(1,(yres-1));
-        }
-        // Derivatives with respect to x,y
-        sg.dPdx = Vec3 (1.0f, 0.0f, 0.0f);
-        sg.dPdy = Vec3 (0.0f, 1.0f, 0.0f);
-        sg.dPdz = Vec3 (0.0f, 0.0f, 1.0f);
-        // Tangents of P with respect to surface u,v
-        sg.dPdu = Vec3 (xres, 0.0f, 0.0f);
-        sg.dPdv = Vec3 (0.0f, yres, 0.0f);
-        sg.dPdz = Vec3 (0.0f, 0.0f, zres);
-        // That also implies that our normal points to (0,0,1)
-        sg.N    = Vec3 (0, 0, 1);
-        sg.Ng   = Vec3 (0, 0, 1);
-        // In our SimpleRenderer, the "renderstate" itself just a pointer to
-        // the ShaderGlobals.
-        // sg.renderstate = &sg;
-    }
+        // Request a shading context so that we can execute the shader.
+        // We could get_context/release_context for each shading point,
+        // but to save overhead, it's more efficient to reuse a context
+        // within a thread.
+        ShadingContext* ctx = shadingsys.get_context(thread_info);
 
-    // Loop over all pixels in the image (in x and y)...
-    for (OIIO::ImageBuf::Iterator<float> p (buf, roi);  ! p.done();  ++p) {
-        // Set the shader globals that vary from point to pixel to pixel
-        sg.P = Vec3 (p.x(), p.y(), p.z());
-        if (shadelocations == ShadePixelCenters) {
-            sg.u    = float(p.x()-roi_full.xbegin+0.5f) / xres;
-            sg.v    = float(p.y()-roi_full.ybegin+0.5f) / yres;
-            // float w = float(p.z()-roi_full.zbegin+0.5f) / zres;
-        } else {
-            sg.u    = (xres == 1) ? 0.5f : float(p.x()-roi_full.xbegin) / (xres - 1);
-            sg.v    = (yres == 1) ? 0.5f : float(p.y()-roi_full.ybegin) / (yres - 1);
-            // float w = (zres == 1) ? 0.5f : float(p.z()-roi_full.zbegin) / (zres - 1);
+#if OSL_USE_BATCHED
+        if (batch_width == 16) {
+            BatchedShaderGlobals<16> bsg;
+            setup_batch_globals(job.sg, bsg);
+            for (int t; (t = next++) < ntiles;)
+                batched_shade_tile(job, *ctx, bsg, tile_roi(t));
+        } else if (batch_width == 8) {
+            BatchedShaderGlobals<8> bsg;
+            setup_batch_globals(job.sg, bsg);
+            for (int t; (t = next++) < ntiles;)
+                batched_shade_tile(job, *ctx, bsg, tile_roi(t));
+        } else if (batch_width == 4) {
+            BatchedShaderGlobals<4> bsg;
+            setup_batch_globals(job.sg, bsg);
+            for (int t; (t = next++) < ntiles;)
+                batched_shade_tile(job, *ctx, bsg, tile_roi(t));
+        } else
+#endif
+        {
+            ShaderGlobals sg = job.sg;
+            for (int t; (t = next++) < ntiles;)
+                shade_tile(job, *ctx, sg, tile_roi(t));
         }
 
-        // Actually run the shader for this point
-        shadingsys.execute (*ctx, group, sg);
+        // We're done shading with this context.
+        shadingsys.release_context(ctx);
+        shadingsys.destroy_thread_info(thread_info);
+    };
 
-        // Save all the designated outputs.
-        int chan = 0;
-        for (int i = 0;  i < int(outputs.size());  ++i) {
-            const void *data = shadingsys.symbol_address (*ctx, output_sym[i]);
-            if (!data)
-                continue;  // Skip if symbol isn't found
-            TypeDesc t = output_type[i];
-            int tvals = output_nchans[i];
-            if (chan+tvals > buf.nchannels())
-                break;
-            if (t.basetype == TypeDesc::FLOAT) {
-                for (int c = 0; c < tvals; ++c)
-                    p[chan++] = ((const float *)data)[c];
-            } else if (t.basetype == TypeDesc::INT) {
-                for (int c = 0; c < int(t.numelements())*t.aggregate; ++c)
-                    p[chan++] = ((const int *)data)[c];
-            }
-            // N.B. Drop any outputs that aren't float- or int-based
-        }
+    popt.resolve();
+    int nworkers = std::max(1, std::min(popt.maxthreads, ntiles));
+    if (nworkers == 1) {
+        worker();
+    } else {
+        popt.minitems = 1;
+        parallel_for_chunked(0, nworkers, 1,
+                             [&](int64_t begin, int64_t end) {
+                                 for (int64_t w = begin; w < end; ++w)
+                                     worker();
+                             },
+                             popt);
     }
-
-    // We're done shading with this context.
-    shadingsys.release_context (ctx);
-    shadingsys.destroy_thread_info (thread_info);
-
-    });   // end of parallel_image
     return true;
 }
 
 
 
 OSL_NAMESPACE_EXIT
-
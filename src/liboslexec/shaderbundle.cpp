@@ -0,0 +1,254 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#include <OpenImageIO/filesystem.h>
+
+#include "shaderbundle.h"
+
+
+// A bundle file is laid out as follows, all values in native (little
+// endian) byte order:
+//
+//     char[8]    magic "OSLbndl" followed by the format version, 1
+//     uint32     0x01020304, to recognize a foreign byte order
+//     uint32     number of shaders
+//     entry[]    one 24-byte BundleEntry per shader, sorted by name
+//     char[]     the shader names, back to back without terminators
+//     char[]     the OSO of each shader, each starting on an 8-byte boundary
+//
+// All offsets are from the start of the file, so that a lookup is a binary
+// search of the mapped index and no part of the file needs to be read
+// until it is asked for.
+
+
+OSL_NAMESPACE_ENTER
+
+namespace pvt {  // OSL::pvt
+
+
+static const char bundle_magic[8] = { 'O', 'S', 'L', 'b', 'n', 'd', 'l', 1 };
+static const uint32_t bundle_byteorder = 0x01020304;
+static const size_t bundle_header_size = 16;
+
+struct BundleEntry {
+    uint64_t oso_offset;
+    uint64_t oso_size;
+    uint32_t name_offset;
+    uint32_t name_size;
+};
+
+static_assert(sizeof(BundleEntry) == 24, "BundleEntry must be packed");
+
+
+
+static BundleEntry
+bundle_entry(const char* data, size_t n)
+{
+    BundleEntry e;
+    memcpy(&e, data + bundle_header_size + n * sizeof(BundleEntry), sizeof(e));
+    return e;
+}
+
+
+
+std::shared_ptr<MappedFile>
+MappedFile::open(const std::string& filename, std::string& err)
+{
+    std::shared_ptr<MappedFile> file(new MappedFile);
+#ifndef _WIN32
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        err = fmtformat("Could not open \"{}\"", filename);
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* base = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED,
+                          fd, 0);
+        if (base != MAP_FAILED) {
+            file->m_data   = (const char*)base;
+            file->m_size   = size_t(st.st_size);
+            file->m_mapped = true;
+        }
+    }
+    close(fd);
+#endif
+    if (!file->m_mapped) {
+        // No file mapping (Windows), so read it all at once instead.
+        FILE* f = OIIO::Filesystem::fopen(filename, "rb");
+        bool ok = f && !fseek(f, 0, SEEK_END);
+        if (ok) {
+            file->m_contents.resize(size_t(ftell(f)));
+            fseek(f, 0, SEEK_SET);
+            ok = fread(&file->m_contents[0], 1, file->m_contents.size(), f)
+                 == file->m_contents.size();
+        }
+        if (f)
+            fclose(f);
+        if (!ok) {
+            err = fmtformat("Could not read \"{}\"", filename);
+            return nullptr;
+        }
+        file->m_data = file->m_contents.data();
+        file->m_size = file->m_contents.size();
+    }
+    return file;
+}
+
+
+
+MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+    if (m_mapped)
+        munmap((void*)m_data, m_size);
+#endif
+}
+
+
+
+std::unique_ptr<ShaderBundle>
+ShaderBundle::open(const std::string& filename, std::string& err)
+{
+    std::unique_ptr<ShaderBundle> bundle(new ShaderBundle);
+    bundle->m_filename = filename;
+    bundle->m_file     = MappedFile::open(filename, err);
+    if (!bundle->m_file)
+        return nullptr;
+    bundle->m_data = bundle->m_file->data();
+
+    const char* data = bundle->m_data;
+    size_t size      = bundle->m_file->size();
+    uint32_t header[2];
+    if (size < bundle_header_size
+        || memcmp(data, bundle_magic, sizeof(bundle_magic))) {
+        err = fmtformat("\"{}\" is not a shader bundle", filename);
+        return nullptr;
+    }
+    memcpy(header, data + sizeof(bundle_magic), sizeof(header));
+    if (header[0] != bundle_byteorder) {
+        err = fmtformat(
+            "Shader bundle \"{}\" was written with a different byte order",
+            filename);
+        return nullptr;
+    }
+    bundle->m_count = header[1];
+    bool ok = bundle->m_count
+              <= (size - bundle_header_size) / sizeof(BundleEntry);
+    for (size_t i = 0; ok && i < bundle->m_count; ++i) {
+        BundleEntry e = bundle_entry(data, i);
+        ok = e.name_offset <= size && e.name_size <= size - e.name_offset
+             && e.oso_offset <= size && e.oso_size <= size - e.oso_offset;
+    }
+    if (!ok) {
+        err = fmtformat("Corrupt shader bundle \"{}\"", filename);
+        return nullptr;
+    }
+    return bundle;
+}
+
+
+
+string_view
+ShaderBundle::name(size_t n) const
+{
+    BundleEntry e = bundle_entry(m_data, n);
+    return string_view(m_data + e.name_offset, e.name_size);
+}
+
+
+
+string_view
+ShaderBundle::find(string_view shadername) const
+{
+    size_t lo = 0, hi = m_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (name(mid) < shadername)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == m_count || name(lo) != shadername)
+        return string_view();
+    BundleEntry e = bundle_entry(m_data, lo);
+    return string_view(m_data + e.oso_offset, e.oso_size);
+}
+
+
+
+bool
+ShaderBundle::write(const std::string& filename,
+                    std::vector<std::pair<std::string, std::string>> shaders,
+                    std::string& err)
+{
+    std::sort(shaders.begin(), shaders.end());
+    for (size_t i = 1; i < shaders.size(); ++i) {
+        if (shaders[i].first == shaders[i - 1].first) {
+            err = fmtformat("Shader \"{}\" appears more than once",
+                            shaders[i].first);
+            return false;
+        }
+    }
+
+    std::vector<BundleEntry> entries(shaders.size());
+    std::string names;
+    size_t offset = bundle_header_size + entries.size() * sizeof(BundleEntry);
+    for (size_t i = 0; i < shaders.size(); ++i) {
+        entries[i].name_offset = uint32_t(offset + names.size());
+        entries[i].name_size   = uint32_t(shaders[i].first.size());
+        names += shaders[i].first;
+    }
+    offset += names.size();
+    std::string contents;
+    for (size_t i = 0; i < shaders.size(); ++i) {
+        contents.append(((offset + contents.size() + 7) & ~size_t(7))
+                            - (offset + contents.size()),
+                        '\0');
+        entries[i].oso_offset = offset + contents.size();
+        entries[i].oso_size   = shaders[i].second.size();
+        contents += shaders[i].second;
+    }
+    uint32_t header[2] = { bundle_byteorder, uint32_t(shaders.size()) };
+
+    // Write to a temporary and rename, so that a reader never maps a
+    // half-written bundle.
+    std::string tmpname = filename + ".tmp";
+    FILE* file          = OIIO::Filesystem::fopen(tmpname, "wb");
+    if (!file) {
+        err = fmtformat("Could not open \"{}\"", tmpname);
+        return false;
+    }
+    bool ok = fwrite(bundle_magic, sizeof(bundle_magic), 1, file) == 1;
+    ok &= fwrite(header, sizeof(header), 1, file) == 1;
+    ok &= fwrite(entries.data(), sizeof(BundleEntry), entries.size(), file)
+          == entries.size();
+    ok &= fwrite(names.data(), 1, names.size(), file) == names.size();
+    ok &= fwrite(contents.data(), 1, contents.size(), file) == contents.size();
+    ok &= (fclose(file) == 0);
+    std::string fserr;
+    if (ok)
+        ok = OIIO::Filesystem::rename(tmpname, filename, fserr);
+    if (!ok) {
+        OIIO::Filesystem::remove(tmpname, fserr);
+        err = fmtformat("Could not write \"{}\"", filename);
+    }
+    return ok;
+}
+
+
+}  // namespace pvt
+
+OSL_NAMESPACE_EXIT
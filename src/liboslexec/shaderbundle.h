@@ -0,0 +1,95 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <OSL/oslconfig.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+
+OSL_NAMESPACE_ENTER
+
+namespace pvt {
+
+
+/// A whole file, read-only, mapped into memory where the platform allows
+/// it, so that every process mapping the same file shares its pages.
+/// Where it can't be mapped, the file is simply read into memory.
+class MappedFile {
+public:
+    ~MappedFile();
+
+    /// Open and map the file.  Return nullptr (and set err to the
+    /// reason) if it can't be read.
+    static std::shared_ptr<MappedFile> open(const std::string& filename,
+                                            std::string& err);
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    string_view contents() const { return string_view(m_data, m_size); }
+
+private:
+    MappedFile() {}
+
+    const char* m_data = nullptr;  ///< Start of the file's contents
+    size_t m_size      = 0;        ///< Size of the file
+    bool m_mapped      = false;    ///< m_data is mmapped (not m_contents)
+    std::string m_contents;        ///< The file, where it couldn't be mapped
+};
+
+
+
+/// A shader bundle is a single file holding the compiled OSO (text or
+/// binary) of many shaders along with a sorted index of their names, so
+/// that a renderer can find all its masters with one open() rather than
+/// a searchpath walk per shader.  Bundles are made by `oslc --bundle`.
+///
+/// An open bundle is mapped into memory and is read-only, so it may be
+/// shared freely among threads.
+class ShaderBundle {
+public:
+    /// Open and map the bundle file.  Return nullptr (and set err to the
+    /// reason) if it can't be read or isn't a valid bundle.
+    static std::unique_ptr<ShaderBundle> open(const std::string& filename,
+                                              std::string& err);
+
+    /// Return the OSO of the named shader, or an empty string_view if the
+    /// bundle doesn't hold it.  The view stays valid for the life of the
+    /// bundle.
+    string_view find(string_view shadername) const;
+
+    /// Return the name of the nth shader (in sorted order).
+    string_view name(size_t n) const;
+
+    /// The number of shaders in the bundle.
+    size_t size() const { return m_count; }
+
+    const std::string& filename() const { return m_filename; }
+
+    /// Write a bundle file holding the given (name, oso) pairs.  Return
+    /// false (and set err) if the names aren't unique or the file can't be
+    /// written.
+    static bool write(const std::string& filename,
+                      std::vector<std::pair<std::string, std::string>> shaders,
+                      std::string& err);
+
+private:
+    ShaderBundle() {}
+
+    std::string m_filename;
+    std::shared_ptr<MappedFile> m_file;  ///< The bundle file
+    const char* m_data = nullptr;        ///< Start of the mapped file
+    size_t m_count     = 0;              ///< Number of shaders
+};
+
+
+}  // namespace pvt
+
+OSL_NAMESPACE_EXIT
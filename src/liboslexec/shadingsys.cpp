@@ -8,6 +8,8 @@
 #include <fstream>
 #include <cstdlib>
 #include <mutex>
+#include <algorithm>
+#include <unordered_map>
 
 #include "oslexec_pvt.h"
 #include <OSL/genclosure.h>
@@ -27,12 +29,18 @@
 #include <OpenImageIO/timer.h>
 
 #include "opcolor.h"
+#include "shaderbundle.h"
 
 using namespace OSL;
 using namespace OSL::pvt;
 
 #include <OpenEXR/ImfChannelList.h>  // Just for OPENEXR_VERSION_STRING
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>   /* for syscall */
+#endif
+
 // avoid naming conflicts with MSVC macros
 #ifdef _MSC_VER
  #undef RGB
@@ -118,6 +126,30 @@ ShadingSystem::LoadMemoryCompiledShader (string_view shadername,
 
 
 
+bool
+ShadingSystem::reload_shader (string_view shadername, string_view buffer)
+{
+    return m_impl->reload_shader (shadername, buffer);
+}
+
+
+
+bool
+ShadingSystem::preload_shaders (cspan<ustring> shadernames, int nthreads)
+{
+    return m_impl->preload_shaders (shadernames, nthreads);
+}
+
+
+
+bool
+ShadingSystem::add_shader_bundle (string_view filename)
+{
+    return m_impl->add_shader_bundle (filename);
+}
+
+
+
 ShaderGroupRef
 ShadingSystem::ShaderGroupBegin (string_view groupname)
 {
@@ -177,6 +209,16 @@ ShadingSystem::Shader (ShaderGroup& group, string_view shaderusage,
 
 
 
+bool
+ShadingSystem::Shader (ShaderGroup& group, string_view shaderusage,
+                       string_view shadername, string_view layername,
+                       cspan<ParamValue> params)
+{
+    return m_impl->Shader (group, shaderusage, shadername, layername, params);
+}
+
+
+
 bool
 ShadingSystem::Shader (string_view shaderusage, string_view shadername,
                        string_view layername)
@@ -197,6 +239,15 @@ ShadingSystem::ConnectShaders (ShaderGroup& group,
 
 
 
+bool
+ShadingSystem::ConnectShaders (ShaderGroup& group,
+                               cspan<ShaderConnection> connections)
+{
+    return m_impl->ConnectShaders (group, connections);
+}
+
+
+
 bool
 ShadingSystem::ConnectShaders (string_view srclayer, string_view srcparam,
                                string_view dstlayer, string_view dstparam)
@@ -249,6 +300,14 @@ ShadingSystem::release_context (ShadingContext *ctx)
 
 
 
+void
+ShadingSystem::reserve_contexts (int count, size_t heapsize)
+{
+    m_impl->reserve_contexts (count, heapsize);
+}
+
+
+
 bool
 ShadingSystem::execute(ShadingContext& ctx, ShaderGroup& group, int index,
                        ShaderGlobals& globals, void* userdata_base_ptr,
@@ -260,6 +319,31 @@ ShadingSystem::execute(ShadingContext& ctx, ShaderGroup& group, int index,
 
 
 
+bool
+ShadingSystem::execute(ShadingContext& ctx, ShaderGroup& group,
+                       cspan<ustring> outputs, int index,
+                       ShaderGlobals& globals, void* userdata_base_ptr,
+                       void* output_base_ptr, bool run)
+{
+    return m_impl->execute (ctx, m_impl->output_variant (group, outputs),
+                            index, globals, userdata_base_ptr,
+                            output_base_ptr, run);
+}
+
+
+
+bool
+ShadingSystem::execute_many (ShadingContext &ctx, ShaderGroup &group,
+                             span<ShaderGlobals> globals,
+                             cspan<int> shadeindices,
+                             void* userdata_base_ptr, void* output_base_ptr)
+{
+    return m_impl->execute_many (ctx, group, globals, shadeindices,
+                                 userdata_base_ptr, output_base_ptr);
+}
+
+
+
 bool
 ShadingSystem::execute_init(ShadingContext& ctx, ShaderGroup& group,
                             int index, ShaderGlobals& globals,
@@ -412,6 +496,40 @@ ShadingSystem::execute_cleanup (ShadingContext &ctx)
 
 
 
+cspan<RendererServices::TraceRequest>
+ShadingSystem::trace_requests (const ShadingContext &ctx) const
+{
+    return ctx.trace_requests ();
+}
+
+
+
+void
+ShadingSystem::resume_traces (ShadingContext &ctx,
+                              cspan<RendererServices::TraceResult> results)
+{
+    ctx.resume_traces (results);
+}
+
+
+
+int
+ShadingSystem::replay (string_view filename, int iterations,
+                       PerThreadInfo *threadinfo)
+{
+    return m_impl->replay (filename, iterations, threadinfo);
+}
+
+
+
+void
+ShadingSystem::set_object (ShadingContext &ctx, long long objectid)
+{
+    ctx.object (objectid);
+}
+
+
+
 int
 ShadingSystem::find_layer (const ShaderGroup &group, ustring layername) const
 {
@@ -455,9 +573,13 @@ const ShaderSymbol*
 ShadingSystem::find_symbol (const ShaderGroup &group, ustring layername,
                             ustring symbolname) const
 {
-    if (! group.optimized())
+    // A group sharing the code of an identical one has only that one's
+    // optimized symbols.
+    const ShaderGroup &sgroup (group.dedupe_leader() ? *group.dedupe_leader()
+                                                     : group);
+    if (! sgroup.optimized())
         return NULL;   // has to be post-optimized
-    return (const ShaderSymbol *) group.find_symbol (layername, symbolname);
+    return (const ShaderSymbol *) sgroup.find_symbol (layername, symbolname);
 }
 
 
@@ -493,6 +615,16 @@ ShadingSystem::symbol_address (const ShadingContext &ctx,
     return ctx.symbol_data (*(const Symbol *)sym);
 }
 
+
+
+int
+ShadingSystem::symbol_offset (const ShaderSymbol *sym) const
+{
+    OSL_DASSERT(sym != nullptr);
+    int offset = ((const Symbol *)sym)->dataoffset();
+    return offset >= 0 ? offset : -1;
+}
+
 #if OSL_USE_BATCHED
 bool
 ShadingSystem::configure_batch_execution_at(int width)
@@ -600,6 +732,37 @@ ShadingSystem::configure_batch_execution_at(int width)
                     m_impl->attribute ("llvm_jit_fma", 0);
                     return true;
                 }
+#endif
+                if (target_requested) { break; }
+                // fallthrough
+            default:
+                return false;
+        };
+        return false;
+    case 4:
+        switch(requestedISA)
+        {
+            case TargetISA::UNKNOWN:
+                // fallthrough
+            case TargetISA::NEON:
+#ifdef __OSL_SUPPORTS_b4_NEON
+                if (LLVM_Util::supports_isa(TargetISA::NEON)) {
+                    if (!target_requested)
+                        m_impl->attribute("llvm_jit_target", LLVM_Util::target_isa_name(TargetISA::NEON));
+                    return true;
+                }
+#endif
+                if (target_requested) { break; }
+                // fallthrough
+            case TargetISA::SSE4_2:
+#ifdef __OSL_SUPPORTS_b4_SSE4_2
+                if (LLVM_Util::supports_isa(TargetISA::SSE4_2)) {
+                    if (!target_requested)
+                        m_impl->attribute("llvm_jit_target", LLVM_Util::target_isa_name(TargetISA::SSE4_2));
+                    // SSE4.2 doesn't support FMA
+                    m_impl->attribute ("llvm_jit_fma", 0);
+                    return true;
+                }
 #endif
                 if (target_requested) { break; }
                 // fallthrough
@@ -696,10 +859,28 @@ ShadingSystem::raytype_bit (ustring name)
 
 
 
+void
+ShadingSystem::jit_cache (const JitCacheFetch &fetch,
+                          const JitCacheStore &store)
+{
+    m_impl->jit_cache (fetch, store);
+}
+
+
+
 void
 ShadingSystem::optimize_all_groups (int nthreads, bool do_jit)
 {
-    return m_impl->optimize_all_groups (nthreads, 0 /*mythread*/, 1 /*totalthreads*/, do_jit);
+    return m_impl->optimize_all_groups (nthreads, do_jit);
+}
+
+
+
+void
+ShadingSystem::optimize_all_groups (const ParallelFor &parallel_for,
+                                    bool do_jit)
+{
+    return m_impl->optimize_all_groups (0, do_jit, parallel_for);
 }
 
 
@@ -738,6 +919,72 @@ ShadingSystem::archive_shadergroup (ShaderGroup& group, string_view filename)
 }
 
 
+
+bool
+ShadingSystem::flush_pointcloud (string_view filename, bool wait)
+{
+    return pvt::pointcloud_flush (ustring(filename), wait);
+}
+
+
+
+bool
+ShadingSystem::make_paged_pointcloud (string_view filename)
+{
+    return pvt::pointcloud_make_paged (ustring(filename));
+}
+
+
+
+bool
+ShadingSystem::pointcloud_device_image (string_view filename,
+                                        std::vector<char>& image)
+{
+    return pvt::pointcloud_device_image (ustring(filename), image);
+}
+
+
+
+bool
+ShadingSystem::prefetch_textures (ShaderGroup *group, int nthreads, bool wait)
+{
+    if (!group) {
+        m_impl->error ("prefetch_textures: passed nullptr as group");
+        return false;
+    }
+    return m_impl->prefetch_textures (*group, nthreads, wait);
+}
+
+
+std::shared_future<bool>
+ShadingSystem::optimize_group_async (ShaderGroup *group)
+{
+    if (!group) {
+        m_impl->error ("optimize_group_async: passed nullptr as group");
+        return std::shared_future<bool>();
+    }
+    return m_impl->optimize_group_async (m_impl->dedupe_group (*group));
+}
+
+
+
+void
+ShadingSystem::constant_attribute (string_view object, string_view name,
+                                   TypeDesc type, const void *val)
+{
+    m_impl->constant_attribute (ustring(object), ustring(name), type, val);
+}
+
+
+
+void
+ShadingSystem::clear_constant_attributes ()
+{
+    m_impl->clear_constant_attributes ();
+}
+
+
+
 void
 ShadingSystem::set_raytypes (ShaderGroup *group, int raytypes_on, int raytypes_off)
 {
@@ -817,12 +1064,197 @@ template<int WidthT>
 void
 ShadingSystem::BatchedExecutor<WidthT>::jit_all_groups (int nthreads)
 {
-    OSL_ASSERT(0 && "To Be Implemented");
+    m_shading_system.m_impl->batched<WidthT>().jit_all_groups(nthreads);
+}
+
+template<int WidthT>
+void
+ShadingSystem::BatchedExecutor<WidthT>::jit_all_groups (const ParallelFor &parallel_for)
+{
+    m_shading_system.m_impl->batched<WidthT>().jit_all_groups(0, parallel_for);
 }
 
 // Explicitly instantiate
 template class ShadingSystem::BatchedExecutor<16>;
 template class ShadingSystem::BatchedExecutor<8>;
+template class ShadingSystem::BatchedExecutor<4>;
+
+
+
+// One queue of a BatchBuilder: the points gathered so far for a group.
+template<int WidthT>
+struct ShadingSystem::BatchBuilder<WidthT>::Batch {
+    BatchedShaderGlobals<WidthT> globals;
+    Block<int, WidthT> shadeindex;
+    ShaderGroup *group = nullptr;
+    int size = 0;
+
+    bool matches (const ShaderGroup &g, const ShaderGlobals &sg) const {
+        return group == &g && globals.uniform.raytype == sg.raytype
+            && globals.uniform.renderstate == sg.renderstate
+            && globals.uniform.tracedata == sg.tracedata
+            && globals.uniform.objdata == sg.objdata;
+    }
+};
+
+
+
+template<int WidthT>
+ShadingSystem::BatchBuilder<WidthT>::BatchBuilder (ShadingSystem &ss,
+                                                   ShadingContext &ctx,
+                                                   ResultsFunc results,
+                                                   void* userdata_base_ptr,
+                                                   void* output_base_ptr)
+    : m_shading_system(ss), m_context(ctx), m_results(std::move(results)),
+      m_userdata_base_ptr(userdata_base_ptr), m_output_base_ptr(output_base_ptr)
+{
+}
+
+
+
+template<int WidthT>
+ShadingSystem::BatchBuilder<WidthT>::~BatchBuilder ()
+{
+    flush ();
+    for (Batch *b : m_batches) {
+        b->~Batch();
+        OIIO::aligned_free (b);
+    }
+}
+
+
+
+template<int WidthT>
+bool
+ShadingSystem::BatchBuilder<WidthT>::add (ShaderGroup &group,
+                                          const ShaderGlobals &sg,
+                                          int shadeindex)
+{
+    // Successive points mostly go to the same queue, so try the last one
+    // before searching.
+    if (m_last >= m_batches.size() || ! m_batches[m_last]->matches (group, sg)) {
+        m_last = 0;
+        while (m_last < m_batches.size() && ! m_batches[m_last]->matches (group, sg))
+            ++m_last;
+        if (m_last == m_batches.size()) {
+            // A queue that's empty can be taken over, otherwise make one
+            // (the globals are too big, and too aligned, for the stack).
+            m_last = 0;
+            while (m_last < m_batches.size() && m_batches[m_last]->size)
+                ++m_last;
+            if (m_last == m_batches.size()) {
+                void *mem = OIIO::aligned_malloc (sizeof(Batch), alignof(Batch));
+                m_batches.push_back (new (mem) Batch);
+            }
+            Batch &b (*m_batches[m_last]);
+            b.group = &group;
+            UniformShaderGlobals &usg (b.globals.uniform);
+            memset ((void *)&usg, 0, sizeof(UniformShaderGlobals));
+            usg.renderstate = sg.renderstate;
+            usg.tracedata = sg.tracedata;
+            usg.objdata = sg.objdata;
+            usg.raytype = sg.raytype;
+        }
+    }
+
+    Batch &b (*m_batches[m_last]);
+    int lane = b.size;
+    auto &vsg (b.globals.varying);
+    vsg.P[lane] = sg.P;
+    vsg.dPdx[lane] = sg.dPdx;
+    vsg.dPdy[lane] = sg.dPdy;
+    vsg.dPdz[lane] = sg.dPdz;
+    vsg.I[lane] = sg.I;
+    vsg.dIdx[lane] = sg.dIdx;
+    vsg.dIdy[lane] = sg.dIdy;
+    vsg.N[lane] = sg.N;
+    vsg.Ng[lane] = sg.Ng;
+    vsg.u[lane] = sg.u;
+    vsg.dudx[lane] = sg.dudx;
+    vsg.dudy[lane] = sg.dudy;
+    vsg.v[lane] = sg.v;
+    vsg.dvdx[lane] = sg.dvdx;
+    vsg.dvdy[lane] = sg.dvdy;
+    vsg.dPdu[lane] = sg.dPdu;
+    vsg.dPdv[lane] = sg.dPdv;
+    vsg.time[lane] = sg.time;
+    vsg.dtime[lane] = sg.dtime;
+    vsg.dPdtime[lane] = sg.dPdtime;
+    vsg.Ps[lane] = sg.Ps;
+    vsg.dPsdx[lane] = sg.dPsdx;
+    vsg.dPsdy[lane] = sg.dPsdy;
+    vsg.object2common[lane] = sg.object2common;
+    vsg.shader2common[lane] = sg.shader2common;
+    vsg.surfacearea[lane] = sg.surfacearea;
+    vsg.flipHandedness[lane] = sg.flipHandedness;
+    vsg.backfacing[lane] = sg.backfacing;
+    b.shadeindex[lane] = shadeindex;
+    if (++b.size < WidthT)
+        return true;
+    return execute (b);
+}
+
+
+
+template<int WidthT>
+bool
+ShadingSystem::BatchBuilder<WidthT>::execute (Batch &batch)
+{
+    bool ok = m_shading_system.batched<WidthT>().execute (m_context,
+                                                          *batch.group,
+                                                          batch.size,
+                                                          batch.shadeindex,
+                                                          batch.globals,
+                                                          m_userdata_base_ptr,
+                                                          m_output_base_ptr);
+    if (ok && m_results)
+        m_results (m_context, *batch.group, batch.size, batch.shadeindex,
+                   batch.globals);
+    batch.size = 0;
+    return ok;
+}
+
+
+
+template<int WidthT>
+bool
+ShadingSystem::BatchBuilder<WidthT>::flush (ShaderGroup &group)
+{
+    bool ok = true;
+    for (Batch *b : m_batches)
+        if (b->size && b->group == &group)
+            ok &= execute (*b);
+    return ok;
+}
+
+
+
+template<int WidthT>
+bool
+ShadingSystem::BatchBuilder<WidthT>::flush ()
+{
+    bool ok = true;
+    for (Batch *b : m_batches)
+        if (b->size)
+            ok &= execute (*b);
+    return ok;
+}
+
+
+
+template<int WidthT>
+int
+ShadingSystem::BatchBuilder<WidthT>::queued () const
+{
+    int n = 0;
+    for (const Batch *b : m_batches)
+        n += b->size;
+    return n;
+}
+
+template class ShadingSystem::BatchBuilder<16>;
+template class ShadingSystem::BatchBuilder<8>;
+template class ShadingSystem::BatchBuilder<4>;
 #endif
 
 
@@ -953,8 +1385,8 @@ PerThreadInfo::~PerThreadInfo ()
 ShadingContext *
 PerThreadInfo::pop_context ()
 {
-    ShadingContext *sc = context_pool.top ();
-    context_pool.pop ();
+    ShadingContext *sc = context_pool.back ();
+    context_pool.pop_back ();
     return sc;
 }
 
@@ -979,13 +1411,21 @@ ShadingSystemImpl::ShadingSystemImpl (RendererServices *renderer,
     : m_renderer(renderer), m_texturesys(texturesystem), m_err(err),
       m_statslevel (0), m_lazylayers (true),
       m_lazyglobals (true), m_lazyunconnected(true), m_lazyerror(true),
-      m_lazy_userdata(false), m_userdata_isconnected(false),
+      m_lazy_userdata(false), m_cache_lookups(false), m_deferred_trace(false),
+      m_closure_weight_threshold(0.0f),
+      m_pointcloud_bake_index(false), m_pointcloud_bake_pages(false),
+      m_pointcloud_max_memory_MB(1024), m_cache_textureinfo(true),
+      m_userdata_isconnected(false),
       m_clearmemory (false), m_debugnan (false), m_debug_uninit(false),
-      m_lockgeom_default (true), m_strict_messages(true),
+      m_debug_sample(0),
+      m_lockgeom_default (true), m_reparam_reoptimize(false),
+      m_raytype_variants(0), m_output_variants(0), m_dedupe_groups(false),
+      m_strict_messages(true),
       m_error_repeats(false),
       m_range_checking(true),
       m_unknown_coordsys_error(true), m_connection_error(true),
       m_greedyjit(false), m_countlayerexecs(false),
+      m_batched_lane_stats(false),
       m_relaxed_param_typecheck(false),
       m_max_warnings_per_thread(100),
       m_profile(0),
@@ -997,20 +1437,42 @@ ShadingSystemImpl::ShadingSystemImpl (RendererServices *renderer,
       m_opt_assign(true), m_opt_mix(true),
       m_opt_merge_instances(1), m_opt_merge_instances_with_userdata(true),
       m_opt_fold_getattribute(true),
-      m_opt_middleman(true), m_opt_texture_handle(true),
+      m_opt_middleman(true), m_opt_cross_layer_cse(false),
+      m_opt_texture_handle(true),
       m_opt_seed_bblock_aliases(true),
 #if OSL_USE_BATCHED
       m_opt_batched_analysis((renderer->batched(WidthOf<16>()) != nullptr) ||
-                             (renderer->batched(WidthOf<8>()) != nullptr)),
+                             (renderer->batched(WidthOf<8>()) != nullptr) ||
+                             (renderer->batched(WidthOf<4>()) != nullptr)),
 #else
       m_opt_batched_analysis(false),
 #endif
+      m_opt_batched_coherent_branches(0),
+      m_opt_loop_invariants(false),
+      m_opt_transient_strings(true),
+      m_opt_range_checks(true),
+      m_opt_texture_coalesce(false),
+      m_opt_deriv_axes(true),
+      m_opt_memoize_instances(0),
+      m_opt_parallel_layers(0),
+      m_opt_groupdata_layout(false),
+      m_opt_groupdata_share(false),
+      m_opt_message_slots(false),
+      m_opt_upfront_layers(false),
       m_llvm_jit_fma(false),
       m_llvm_jit_aggressive(false),
+      m_llvm_jit_orc(false),
+      m_llvm_jit_lazy(false),
+      m_llvm_jit_tiered(false),
+      m_llvm_pgo_samples(0),
+      m_llvm_aot_output(false), m_max_jit_memory_MB(0), m_async_optimize(0),
       m_optimize_nondebug(false),
       m_vector_width(4),
       m_opt_passes(10),
+      m_opt_pass_min_change(0.0f), m_opt_time_budget_ms(0.0f),
       m_llvm_optimize(1),
+      m_llvm_opt_preset(OptPreset::LEGACY),
+      m_math_precision(MathPrecision::DEFAULT),
       m_debug(0), m_llvm_debug(0),
       m_llvm_debug_layers(0), m_llvm_debug_ops(0),
       m_llvm_target_host(1),
@@ -1020,6 +1482,7 @@ ShadingSystemImpl::ShadingSystemImpl (RendererServices *renderer,
       m_llvm_dumpasm(0),
       m_commonspace_synonym("world"),
       m_max_local_mem_KB(2048),
+      m_context_pool_KB(0), m_numa_local(false), m_huge_pages(false),
       m_compile_report(false),
       m_buffer_printf(true),
       m_no_noise(false),
@@ -1034,6 +1497,7 @@ ShadingSystemImpl::ShadingSystemImpl (RendererServices *renderer,
       m_stat_total_llvm_time(0),
       m_stat_llvm_setup_time(0), m_stat_llvm_irgen_time(0),
       m_stat_llvm_opt_time(0), m_stat_llvm_jit_time(0),
+      m_stat_llvm_opt_preset_time(),
       m_stat_inst_merge_time(0),
       m_stat_max_llvm_local_mem(0)
 {
@@ -1043,9 +1507,23 @@ ShadingSystemImpl::ShadingSystemImpl (RendererServices *renderer,
     m_stat_groupinstances = 0;
     m_stat_instances_compiled = 0;
     m_stat_groups_compiled = 0;
+    m_stat_groups_rejitted = 0;
+    m_stat_groups_pgo_rejitted = 0;
+    m_stat_groups_precompiled = 0;
     m_stat_empty_instances = 0;
     m_stat_merged_inst = 0;
     m_stat_merged_inst_opt = 0;
+    m_stat_memoized_opt_steps = 0;
+    m_stat_raytype_variants = 0;
+    m_stat_output_variants = 0;
+    m_stat_groups_dedupe_checked = 0;
+    m_stat_groups_deduped = 0;
+    m_stat_groups_evicted = 0;
+    m_stat_ptx_cache_hits = 0;
+    m_stat_ptx_cache_misses = 0;
+    m_stat_jit_cache_hits = 0;
+    m_stat_jit_cache_misses = 0;
+    m_stat_jit_memory_evicted = 0;
     m_stat_empty_groups = 0;
     m_stat_regexes = 0;
     m_stat_preopt_syms = 0;
@@ -1054,6 +1532,10 @@ ShadingSystemImpl::ShadingSystemImpl (RendererServices *renderer,
     m_stat_preopt_ops = 0;
     m_stat_postopt_ops = 0;
     m_stat_middlemen_eliminated = 0;
+    m_stat_cross_layer_cse = 0;
+    m_stat_groupdata_bytes_shared = 0;
+    m_stat_peak_closure_bytes = 0;
+    m_stat_peak_scratch_bytes = 0;
     m_stat_const_connections = 0;
     m_stat_global_connections = 0;
     m_stat_tex_calls_codegened = 0;
@@ -1083,27 +1565,6 @@ ShadingSystemImpl::ShadingSystemImpl (RendererServices *renderer,
         m_err = & ErrorHandler::default_handler ();
     }
 
-    // If client didn't supply a texture system, use the one already held
-    // by the renderer (if it returns one).
-    if (! m_texturesys)
-        m_texturesys = renderer->texturesys();
-
-    // If we still don't have a texture system, create a new one
-    if (! m_texturesys) {
-#if OSL_NO_DEFAULT_TEXTURESYSTEM
-        // This build option instructs OSL to never create a TextureSystem
-        // itself. (Most likely reason: this build of OSL is for a renderer
-        // that replaces OIIO's TextureSystem with its own, and therefore
-        // wouldn't want to accidentally make an OIIO one here.
-        OSL_ASSERT (0 && "ShadingSystem was not passed a working TextureSystem*");
-#else
-        m_texturesys = TextureSystem::create (true /* shared */);
-        // Make some good guesses about default options
-        m_texturesys->attribute ("automip",  1);
-        m_texturesys->attribute ("autotile", 64);
-#endif
-    }
-
     // Alternate way of turning on LLVM debug mode (temporary/experimental)
     const char *llvm_debug_env = getenv ("OSL_LLVM_DEBUG");
     if (llvm_debug_env && *llvm_debug_env)
@@ -1125,15 +1586,45 @@ ShadingSystemImpl::ShadingSystemImpl (RendererServices *renderer,
     if (options)
         attribute ("options", TypeDesc::STRING, &options);
 
-    setup_op_descriptors ();
+    // The texture system and the op descriptors are set up the first
+    // time they're needed (see texturesys() and op_descriptor()), and
+    // LLVM not until the first group is JITed, so that a ShadingSystem
+    // made just to load and query shaders is quick to make.
 
     colorsystem().set_colorspace(m_colorspace);
 }
 
 
 
-static void
-shading_system_setup_op_descriptors (ShadingSystemImpl::OpDescriptorMap& op_descriptor)
+void
+ShadingSystemImpl::init_texturesys () const
+{
+    // If client didn't supply a texture system, use the one already held
+    // by the renderer (if it returns one).
+    if (! m_texturesys)
+        m_texturesys = m_renderer->texturesys();
+
+    // If we still don't have a texture system, create a new one
+    if (! m_texturesys) {
+#if OSL_NO_DEFAULT_TEXTURESYSTEM
+        // This build option instructs OSL to never create a TextureSystem
+        // itself. (Most likely reason: this build of OSL is for a renderer
+        // that replaces OIIO's TextureSystem with its own, and therefore
+        // wouldn't want to accidentally make an OIIO one here.
+        OSL_ASSERT (0 && "ShadingSystem was not passed a working TextureSystem*");
+#else
+        m_texturesys = TextureSystem::create (true /* shared */);
+        // Make some good guesses about default options
+        m_texturesys->attribute ("automip",  1);
+        m_texturesys->attribute ("autotile", 64);
+#endif
+    }
+}
+
+
+
+static void
+shading_system_setup_op_descriptors (ShadingSystemImpl::OpDescriptorMap& op_descriptor)
 {
 #if OSL_USE_BATCHED
 #define OP2(alias,name,ll,fold,simp,flag)                                \
@@ -1174,7 +1665,7 @@ shading_system_setup_op_descriptors (ShadingSystemImpl::OpDescriptorMap& op_desc
     OP (backfacing,  get_simple_SG_field, none,          true,      0);
     OP (bitand,      bitwise_binary_op,   bitand,        true,      0);
     OP (bitor,       bitwise_binary_op,   bitor,         true,      0);
-    OP (blackbody,   blackbody,           none,          true,      0);
+    OP (blackbody,   blackbody,           blackbody,     true,      0);
     OP (break,       loopmod_op,          none,          false,     0);
     OP (calculatenormal, calculatenormal, none,          true,      0);
     OP (cbrt,        generic,             cbrt,          true,      0);
@@ -1193,9 +1684,9 @@ shading_system_setup_op_descriptors (ShadingSystemImpl::OpDescriptorMap& op_desc
     OP (cross,       generic,             none,          true,      0);
     OP (degrees,     generic,             degrees,       true,      0);
     OP (determinant, generic,             none,          true,      0);
-    OP (dict_find,   dict_find,           none,          false,     0);
-    OP (dict_next,   dict_next,           none,          false,     0);
-    OP (dict_value,  dict_value,          none,          false,     0);
+    OP (dict_find,   dict_find,           dict_find,     false,     0);
+    OP (dict_next,   dict_next,           dict_next,     false,     0);
+    OP (dict_value,  dict_value,          dict_value,    false,     0);
     OP (distance,    generic,             none,          true,      0);
     OP (div,         div,                 div,           true,      0);
     OP (dot,         generic,             dot,           true,      0);
@@ -1273,7 +1764,7 @@ shading_system_setup_op_descriptors (ShadingSystemImpl::OpDescriptorMap& op_desc
     OP (psnoise,     noise,               noise,         true,      0);
     OP (radians,     generic,             radians,       true,      0);
     OP (raytype,     raytype,             raytype,       true,      0);
-    OP (regex_match, regex,               none,          false,     STRCHARS);
+    OP (regex_match, regex,               regex_match,   false,     STRCHARS);
     OP (regex_search, regex,              regex_search,  false,     STRCHARS);
     OP (return,      return,              none,          false,     0);
     OP (round,       generic,             none,          true,      0);
@@ -1287,8 +1778,8 @@ shading_system_setup_op_descriptors (ShadingSystemImpl::OpDescriptorMap& op_desc
     OP (sinh,        generic,             none,          true,      0);
     OP (smoothstep,  generic,             none,          true,      0);
     OP (snoise,      noise,               noise,         true,      0);
-    OP (spline,      spline,              none,          true,      0);
-    OP (splineinverse, spline,            none,          true,      0);
+    OP (spline,      spline,              spline,        true,      0);
+    OP (splineinverse, spline,            spline,        true,      0);
     OP (split,       split,               split,         false,     0);
     OP (sqrt,        generic,             sqrt,          true,      0);
     OP (startswith,  generic,             none,          true,      STRCHARS);
@@ -1315,7 +1806,7 @@ shading_system_setup_op_descriptors (ShadingSystemImpl::OpDescriptorMap& op_desc
     OP (useparam,    useparam,            useparam,      false,     0);
     OP (vector,      construct_triple,    triple,        true,      0);
     OP (warning,     printf,              warning,       false,     SIDE);
-    OP (wavelength_color, blackbody,      none,          true,      0);
+    OP (wavelength_color, blackbody,      blackbody,     true,      0);
     OP (while,       loop_op,             none,          false,     0);
     OP (xor,         bitwise_binary_op,   xor,           true,      0);
 #undef OP
@@ -1382,6 +1873,34 @@ ShadingSystemImpl::query_closure(const char **name, int *id,
 
 ShadingSystemImpl::~ShadingSystemImpl ()
 {
+    // Stop any background optimization or re-JIT before tearing anything
+    // down. Whoever still waits on a group that was never compiled hears
+    // that it wasn't.
+    {
+        std::lock_guard<std::mutex> lock (m_async_opt_mutex);
+        m_async_opt_exit = true;
+    }
+    m_async_opt_cond.notify_all ();
+    for (auto &thread : m_async_opt_threads)
+        thread.join ();
+    for (auto &request : m_async_opt_queue)
+        request.promise->set_value (false);
+    m_async_opt_queue.clear ();
+    {
+        std::lock_guard<std::mutex> lock (m_tiered_rejit_mutex);
+        m_tiered_rejit_exit = true;
+    }
+    m_tiered_rejit_cond.notify_all ();
+    if (m_tiered_rejit_thread.joinable())
+        m_tiered_rejit_thread.join ();
+    {
+        std::lock_guard<std::mutex> lock (m_prefetch_mutex);
+        m_prefetch_exit = true;
+    }
+    m_prefetch_cond.notify_all ();
+    for (auto &thread : m_prefetch_threads)
+        thread.join ();
+
     size_t ngroups = m_all_shader_groups.size();
     for (size_t i = 0;  i < ngroups;  ++i) {
         if (ShaderGroupRef g = m_all_shader_groups[i].lock()) {
@@ -1394,6 +1913,15 @@ ShadingSystemImpl::~ShadingSystemImpl ()
         }
     }
 
+    // Contexts no thread ever claimed, or whose thread info was destroyed
+    for (auto &spares : m_spare_contexts) {
+        for (ShadingContext *ctx : spares.contexts)
+            delete ctx;
+        spares.contexts.clear ();
+    }
+
+    free_dict_resources ();
+
     printstats ();
     // N.B. just let m_texsys go -- if we asked for one to be created,
     // we asked for a shared one.
@@ -1441,6 +1969,27 @@ osl_simd_caps()
 
 
 
+static const char *math_precision_names[] = { "default", "fast", "accurate" };
+
+// Name to MathPrecision; UNKNOWN for anything unrecognized (including "").
+static MathPrecision
+lookup_math_precision (string_view name)
+{
+    for (int i = 0;  i < 3;  ++i)
+        if (Strutil::iequals (name, math_precision_names[i]))
+            return MathPrecision(i);
+    return MathPrecision::UNKNOWN;
+}
+
+static const char *
+math_precision_name (MathPrecision precision)
+{
+    return precision == MathPrecision::UNKNOWN ? ""
+                        : math_precision_names[int(precision)];
+}
+
+
+
 bool
 ShadingSystemImpl::attribute (string_view name, TypeDesc type,
                               const void *val)
@@ -1461,6 +2010,12 @@ ShadingSystemImpl::attribute (string_view name, TypeDesc type,
     }
 
     lock_guard guard (m_mutex);  // Thread safety
+    {
+        // Any option may change how a layer optimizes, so forget the
+        // memoized ones.
+        spin_lock lock (m_optimized_instances_mutex);
+        m_optimized_instances.clear ();
+    }
     ATTR_SET ("statistics:level", int, m_statslevel);
     ATTR_SET ("debug", int, m_debug);
     ATTR_SET ("lazylayers", int, m_lazylayers);
@@ -1468,12 +2023,24 @@ ShadingSystemImpl::attribute (string_view name, TypeDesc type,
     ATTR_SET ("lazyunconnected", int, m_lazyunconnected);
     ATTR_SET ("lazyerror", int, m_lazyerror);
     ATTR_SET ("lazy_userdata", int, m_lazy_userdata);
+    ATTR_SET ("cache_lookups", int, m_cache_lookups);
+    ATTR_SET ("deferred_trace", int, m_deferred_trace);
+    ATTR_SET ("closure_weight_threshold", float, m_closure_weight_threshold);
+    ATTR_SET ("pointcloud_bake_index", int, m_pointcloud_bake_index);
+    ATTR_SET ("pointcloud_bake_pages", int, m_pointcloud_bake_pages);
+    ATTR_SET ("pointcloud_max_memory_MB", int, m_pointcloud_max_memory_MB);
+    ATTR_SET ("cache_textureinfo", int, m_cache_textureinfo);
     ATTR_SET ("userdata_isconnected", int, m_userdata_isconnected);
     ATTR_SET ("clearmemory", int, m_clearmemory);
     ATTR_SET ("debug_nan", int, m_debugnan);
     ATTR_SET ("debugnan", int, m_debugnan);  // back-compatible alias
     ATTR_SET ("debug_uninit", int, m_debug_uninit);
+    ATTR_SET ("debug_sample", int, m_debug_sample);
     ATTR_SET ("lockgeom", int, m_lockgeom_default);
+    ATTR_SET ("reparam_reoptimize", int, m_reparam_reoptimize);
+    ATTR_SET ("raytype_variants", int, m_raytype_variants);
+    ATTR_SET ("output_variants", int, m_output_variants);
+    ATTR_SET ("dedupe_groups", int, m_dedupe_groups);
     ATTR_SET ("profile", int, m_profile);
     ATTR_SET ("optimize", int, m_optimize);
     ATTR_SET ("opt_simplify_param", int, m_opt_simplify_param);
@@ -1489,16 +2056,59 @@ ShadingSystemImpl::attribute (string_view name, TypeDesc type,
     ATTR_SET ("opt_merge_instances_with_userdata", int, m_opt_merge_instances_with_userdata);
     ATTR_SET ("opt_fold_getattribute", int, m_opt_fold_getattribute);
     ATTR_SET ("opt_middleman", int, m_opt_middleman);
+    ATTR_SET ("opt_cross_layer_cse", int, m_opt_cross_layer_cse);
     ATTR_SET ("opt_texture_handle", int, m_opt_texture_handle);
     ATTR_SET ("opt_seed_bblock_aliases", int, m_opt_seed_bblock_aliases);
     ATTR_SET ("opt_batched_analysis", int, m_opt_batched_analysis);
+    ATTR_SET ("opt_batched_coherent_branches", int, m_opt_batched_coherent_branches);
+    ATTR_SET ("opt_loop_invariants", int, m_opt_loop_invariants);
+    ATTR_SET ("opt_transient_strings", int, m_opt_transient_strings);
+    ATTR_SET ("opt_range_checks", int, m_opt_range_checks);
+    ATTR_SET ("opt_texture_coalesce", int, m_opt_texture_coalesce);
+    ATTR_SET ("opt_deriv_axes", int, m_opt_deriv_axes);
+    ATTR_SET ("opt_memoize_instances", int, m_opt_memoize_instances);
+    ATTR_SET ("opt_parallel_layers", int, m_opt_parallel_layers);
+    ATTR_SET ("opt_groupdata_layout", int, m_opt_groupdata_layout);
+    ATTR_SET ("opt_groupdata_share", int, m_opt_groupdata_share);
+    ATTR_SET ("opt_message_slots", int, m_opt_message_slots);
+    ATTR_SET ("opt_upfront_layers", int, m_opt_upfront_layers);
     ATTR_SET ("llvm_jit_fma", int, m_llvm_jit_fma);
     ATTR_SET ("llvm_jit_aggressive", int, m_llvm_jit_aggressive);
+    ATTR_SET ("llvm_jit_orc", int, m_llvm_jit_orc);
+    ATTR_SET ("llvm_jit_lazy", int, m_llvm_jit_lazy);
+    ATTR_SET ("llvm_jit_tiered", int, m_llvm_jit_tiered);
+    ATTR_SET ("llvm_pgo_samples", int, m_llvm_pgo_samples);
+    ATTR_SET ("llvm_aot_output", int, m_llvm_aot_output);
+    ATTR_SET ("max_jit_memory_MB", int, m_max_jit_memory_MB);
+    ATTR_SET ("async_optimize", int, m_async_optimize);
+    ATTR_SET_STRING ("llvm_aot_isas", m_llvm_aot_isas);
+    ATTR_SET_STRING ("ptx_cache_dir", m_ptx_cache_dir);
+    ATTR_SET_STRING ("jit_cache_dir", m_jit_cache_dir);
     ATTR_SET_STRING ("llvm_jit_target", m_llvm_jit_target);
     ATTR_SET ("vector_width", int, m_vector_width);
     ATTR_SET ("opt_passes", int, m_opt_passes);
+    ATTR_SET ("opt_pass_min_change", float, m_opt_pass_min_change);
+    ATTR_SET ("opt_time_budget_ms", float, m_opt_time_budget_ms);
     ATTR_SET ("optimize_nondebug", int, m_optimize_nondebug);
     ATTR_SET ("llvm_optimize", int, m_llvm_optimize);
+    if (name == "llvm_opt_preset" && type == TypeDesc::STRING) {
+        string_view preset_name (*(const char **)val);
+        OptPreset preset = LLVM_Util::lookup_opt_preset_by_name (preset_name);
+        if (preset == OptPreset::UNKNOWN) {
+            if (! preset_name.empty())
+                return false;
+            preset = OptPreset::LEGACY;
+        }
+        m_llvm_opt_preset = preset;
+        return true;
+    }
+    if (name == "math_precision" && type == TypeDesc::STRING) {
+        MathPrecision precision = lookup_math_precision (*(const char **)val);
+        if (precision == MathPrecision::UNKNOWN)
+            return false;
+        m_math_precision = precision;
+        return true;
+    }
     ATTR_SET ("llvm_debug", int, m_llvm_debug);
     ATTR_SET ("llvm_debug_layers", int, m_llvm_debug_layers);
     ATTR_SET ("llvm_debug_ops", int, m_llvm_debug_ops);
@@ -1515,8 +2125,16 @@ ShadingSystemImpl::attribute (string_view name, TypeDesc type,
     ATTR_SET ("greedyjit", int, m_greedyjit);
     ATTR_SET ("relaxed_param_typecheck", int, m_relaxed_param_typecheck);
     ATTR_SET ("countlayerexecs", int, m_countlayerexecs);
+    ATTR_SET ("batched_lane_stats", int, m_batched_lane_stats);
     ATTR_SET ("max_warnings_per_thread", int, m_max_warnings_per_thread);
     ATTR_SET ("max_local_mem_KB", int, m_max_local_mem_KB);
+    ATTR_SET ("context_pool_KB", int, m_context_pool_KB);
+    ATTR_SET ("numa_local", int, m_numa_local);
+    if (name == "huge_pages" && type == TypeDesc::INT) {
+        m_huge_pages = *(const int *)val;
+        LLVM_Util::jit_huge_pages (m_huge_pages);
+        return true;
+    }
     ATTR_SET ("compile_report", int, m_compile_report);
     ATTR_SET ("buffer_printf", int, m_buffer_printf);
     ATTR_SET ("no_noise", int, m_no_noise);
@@ -1567,6 +2185,15 @@ ShadingSystemImpl::attribute (string_view name, TypeDesc type,
             m_renderer_outputs.emplace_back(((const char **)val)[i]);
         return true;
     }
+    if (name == "capture" && type == TypeDesc::STRING) {
+        return open_capture (ustring (*(const char **)val));
+    }
+    if (name == "object_attributes" && type.basetype == TypeDesc::STRING) {
+        m_object_attributes.clear ();
+        for (size_t i = 0;  i < type.numelements();  ++i)
+            m_object_attributes.emplace_back(((const char **)val)[i]);
+        return true;
+    }
     if (name == "lib_bitcode" && type.basetype == TypeDesc::UINT8) {
         if (type.arraylen < 0) {
             errorfmt("Invalid bitcode size: {}", type.arraylen);
@@ -1593,6 +2220,19 @@ ShadingSystemImpl::attribute (string_view name, TypeDesc type,
         }
         return true;
     }
+    if (name == "batched_rs_bitcode" && type.basetype == TypeDesc::UINT8) {
+        if (type.arraylen < 0) {
+            errorfmt("Invalid bitcode size: {}", type.arraylen);
+            return false;
+        }
+        m_batched_rs_bitcode.clear();
+        if (type.arraylen) {
+            const char* bytes = static_cast<const char*>(val);
+            std::copy(bytes, bytes + type.arraylen,
+                      back_inserter(m_batched_rs_bitcode));
+        }
+        return true;
+    }
 
     if (name == "error_repeats") {
         // Special case: setting error_repeats also clears the "previously
@@ -1609,6 +2249,109 @@ ShadingSystemImpl::attribute (string_view name, TypeDesc type,
 
 
 
+// All the ShadingSystem statistics that getattribute() can retrieve,
+// as STAT (name, C type, expression).
+#define OSL_SHADINGSYS_STATS(STAT) \
+    STAT ("stat:masters", int, m_stat_shaders_loaded) \
+    STAT ("stat:shaders_requested", int, m_stat_shaders_requested) \
+    STAT ("stat:groups", int, m_stat_groups) \
+    STAT ("stat:instances_compiled", int, m_stat_instances_compiled) \
+    STAT ("stat:groups_compiled", int, m_stat_groups_compiled) \
+    STAT ("stat:groups_rejitted", int, m_stat_groups_rejitted) \
+    STAT ("stat:groups_pgo_rejitted", int, m_stat_groups_pgo_rejitted) \
+    STAT ("stat:groups_precompiled", int, m_stat_groups_precompiled) \
+    STAT ("stat:empty_instances", int, m_stat_empty_instances) \
+    STAT ("stat:merged_inst", int, m_stat_merged_inst) \
+    STAT ("stat:merged_inst_opt", int, m_stat_merged_inst_opt) \
+    STAT ("stat:memoized_opt_steps", int, m_stat_memoized_opt_steps) \
+    STAT ("stat:raytype_variants", int, m_stat_raytype_variants) \
+    STAT ("stat:output_variants", int, m_stat_output_variants) \
+    STAT ("stat:groups_dedupe_checked", int, m_stat_groups_dedupe_checked) \
+    STAT ("stat:groups_deduped", int, m_stat_groups_deduped) \
+    STAT ("stat:groups_evicted", int, m_stat_groups_evicted) \
+    STAT ("stat:ptx_cache_hits", int, m_stat_ptx_cache_hits) \
+    STAT ("stat:ptx_cache_misses", int, m_stat_ptx_cache_misses) \
+    STAT ("stat:jit_cache_hits", int, m_stat_jit_cache_hits) \
+    STAT ("stat:jit_cache_misses", int, m_stat_jit_cache_misses) \
+    STAT ("stat:jit_memory_evicted", long long, m_stat_jit_memory_evicted) \
+    STAT ("stat:empty_groups", int, m_stat_empty_groups) \
+    STAT ("stat:instances", int, m_stat_groupinstances) \
+    STAT ("stat:regexes", int, m_stat_regexes) \
+    STAT ("stat:preopt_syms", int, m_stat_preopt_syms) \
+    STAT ("stat:postopt_syms", int, m_stat_postopt_syms) \
+    STAT ("stat:syms_with_derivs", int, m_stat_syms_with_derivs) \
+    STAT ("stat:preopt_ops", int, m_stat_preopt_ops) \
+    STAT ("stat:postopt_ops", int, m_stat_postopt_ops) \
+    STAT ("stat:middlemen_eliminated", int, m_stat_middlemen_eliminated) \
+    STAT ("stat:cross_layer_cse", int, m_stat_cross_layer_cse) \
+    STAT ("stat:groupdata_bytes_shared", int, m_stat_groupdata_bytes_shared) \
+    STAT ("stat:peak_closure_bytes", int, m_stat_peak_closure_bytes) \
+    STAT ("stat:peak_scratch_bytes", int, m_stat_peak_scratch_bytes) \
+    STAT ("stat:const_connections", int, m_stat_const_connections) \
+    STAT ("stat:global_connections", int, m_stat_global_connections) \
+    STAT ("stat:tex_calls_codegened", int, m_stat_tex_calls_codegened) \
+    STAT ("stat:tex_calls_as_handles", int, m_stat_tex_calls_as_handles) \
+    STAT ("stat:master_load_time", float, m_stat_master_load_time) \
+    STAT ("stat:optimization_time", float, m_stat_optimization_time) \
+    STAT ("stat:opt_locking_time", float, m_stat_opt_locking_time) \
+    STAT ("stat:specialization_time", float, m_stat_specialization_time) \
+    STAT ("stat:total_llvm_time", float, m_stat_total_llvm_time) \
+    STAT ("stat:llvm_setup_time", float, m_stat_llvm_setup_time) \
+    STAT ("stat:llvm_irgen_time", float, m_stat_llvm_irgen_time) \
+    STAT ("stat:llvm_opt_time", float, m_stat_llvm_opt_time) \
+    STAT ("stat:llvm_jit_time", float, m_stat_llvm_jit_time) \
+    STAT ("stat:inst_merge_time", float, m_stat_inst_merge_time) \
+    STAT ("stat:getattribute_calls", long long, m_stat_getattribute_calls) \
+    STAT ("stat:get_userdata_calls", long long, m_stat_get_userdata_calls) \
+    STAT ("stat:noise_calls", long long, m_stat_noise_calls) \
+    STAT ("stat:pointcloud_searches", long long, m_stat_pointcloud_searches) \
+    STAT ("stat:pointcloud_gets", long long, m_stat_pointcloud_gets) \
+    STAT ("stat:pointcloud_writes", long long, m_stat_pointcloud_writes) \
+    STAT ("stat:pointcloud_searches_total_results", long long, m_stat_pointcloud_searches_total_results) \
+    STAT ("stat:pointcloud_max_results", int, m_stat_pointcloud_max_results) \
+    STAT ("stat:pointcloud_failures", int, m_stat_pointcloud_failures) \
+    STAT ("stat:pointcloud_page_hits", long long, pointcloud_page_stats().hits) \
+    STAT ("stat:pointcloud_page_misses", long long, pointcloud_page_stats().misses) \
+    STAT ("stat:pointcloud_page_evictions", long long, pointcloud_page_stats().evictions) \
+    STAT ("stat:pointcloud_page_bytes_read", long long, pointcloud_page_stats().bytes_read) \
+    STAT ("stat:pointcloud_page_peak_bytes", long long, pointcloud_page_stats().peak_bytes) \
+    STAT ("stat:memory_current", long long, m_stat_memory.current()) \
+    STAT ("stat:memory_peak", long long, m_stat_memory.peak()) \
+    STAT ("stat:jit_memory_live", long long, LLVM_Util::total_jit_memory_held()) \
+    STAT ("stat:jit_memory_freed", long long, LLVM_Util::total_jit_memory_freed()) \
+    STAT ("stat:jit_lazy_functions_compiled", long long, LLVM_Util::total_lazy_functions_compiled()) \
+    STAT ("stat:mem_master_current", long long, m_stat_mem_master.current()) \
+    STAT ("stat:mem_master_peak", long long, m_stat_mem_master.peak()) \
+    STAT ("stat:mem_master_ops_current", long long, m_stat_mem_master_ops.current()) \
+    STAT ("stat:mem_master_ops_peak", long long, m_stat_mem_master_ops.peak()) \
+    STAT ("stat:mem_master_args_current", long long, m_stat_mem_master_args.current()) \
+    STAT ("stat:mem_master_args_peak", long long, m_stat_mem_master_args.peak()) \
+    STAT ("stat:mem_master_syms_current", long long, m_stat_mem_master_syms.current()) \
+    STAT ("stat:mem_master_syms_peak", long long, m_stat_mem_master_syms.peak()) \
+    STAT ("stat:mem_master_defaults_current", long long, m_stat_mem_master_defaults.current()) \
+    STAT ("stat:mem_master_defaults_peak", long long, m_stat_mem_master_defaults.peak()) \
+    STAT ("stat:mem_master_consts_current", long long, m_stat_mem_master_consts.current()) \
+    STAT ("stat:mem_master_consts_peak", long long, m_stat_mem_master_consts.peak()) \
+    STAT ("stat:mem_inst_current", long long, m_stat_mem_inst.current()) \
+    STAT ("stat:mem_inst_peak", long long, m_stat_mem_inst.peak()) \
+    STAT ("stat:mem_inst_syms_current", long long, m_stat_mem_inst_syms.current()) \
+    STAT ("stat:mem_inst_syms_peak", long long, m_stat_mem_inst_syms.peak()) \
+    STAT ("stat:mem_inst_paramvals_current", long long, m_stat_mem_inst_paramvals.current()) \
+    STAT ("stat:mem_inst_paramvals_peak", long long, m_stat_mem_inst_paramvals.peak()) \
+    STAT ("stat:mem_inst_connections_current", long long, m_stat_mem_inst_connections.current()) \
+    STAT ("stat:mem_inst_connections_peak", long long, m_stat_mem_inst_connections.peak()) \
+    STAT ("stat:instances_current", int, m_stat_instances.current()) \
+    STAT ("stat:instances_peak", int, m_stat_instances.peak()) \
+    STAT ("stat:contexts_current", int, m_stat_contexts.current()) \
+    STAT ("stat:contexts_peak", int, m_stat_contexts.peak()) \
+    STAT ("stat:layers_executed", long long, m_stat_layers_executed) \
+    STAT ("stat:total_shading_time", float, OIIO::Timer::seconds (m_stat_total_shading_time_ticks)) \
+    STAT ("stat:getattribute_time", float, m_stat_getattribute_time) \
+    STAT ("stat:getattribute_fail_time", float, m_stat_getattribute_fail_time) \
+    STAT ("stat:max_llvm_local_mem", int, m_stat_max_llvm_local_mem)
+
+
+
 bool
 ShadingSystemImpl::getattribute (string_view name, TypeDesc type,
                                  void *val)
@@ -1633,12 +2376,24 @@ ShadingSystemImpl::getattribute (string_view name, TypeDesc type,
     ATTR_DECODE ("lazyglobals", int, m_lazyglobals);
     ATTR_DECODE ("lazyunconnected", int, m_lazyunconnected);
     ATTR_DECODE ("lazy_userdata", int, m_lazy_userdata);
+    ATTR_DECODE ("cache_lookups", int, m_cache_lookups);
+    ATTR_DECODE ("deferred_trace", int, m_deferred_trace);
+    ATTR_DECODE ("closure_weight_threshold", float, m_closure_weight_threshold);
+    ATTR_DECODE ("pointcloud_bake_index", int, m_pointcloud_bake_index);
+    ATTR_DECODE ("pointcloud_bake_pages", int, m_pointcloud_bake_pages);
+    ATTR_DECODE ("pointcloud_max_memory_MB", int, m_pointcloud_max_memory_MB);
+    ATTR_DECODE ("cache_textureinfo", int, m_cache_textureinfo);
     ATTR_DECODE ("userdata_isconnected", int, m_userdata_isconnected);
     ATTR_DECODE ("clearmemory", int, m_clearmemory);
     ATTR_DECODE ("debug_nan", int, m_debugnan);
     ATTR_DECODE ("debugnan", int, m_debugnan);  // back-compatible alias
     ATTR_DECODE ("debug_uninit", int, m_debug_uninit);
+    ATTR_DECODE ("debug_sample", int, m_debug_sample);
     ATTR_DECODE ("lockgeom", int, m_lockgeom_default);
+    ATTR_DECODE ("reparam_reoptimize", int, m_reparam_reoptimize);
+    ATTR_DECODE ("raytype_variants", int, m_raytype_variants);
+    ATTR_DECODE ("output_variants", int, m_output_variants);
+    ATTR_DECODE ("dedupe_groups", int, m_dedupe_groups);
     ATTR_DECODE ("profile", int, m_profile);
     ATTR_DECODE ("optimize", int, m_optimize);
     ATTR_DECODE ("opt_simplify_param", int, m_opt_simplify_param);
@@ -1654,15 +2409,48 @@ ShadingSystemImpl::getattribute (string_view name, TypeDesc type,
     ATTR_DECODE ("opt_merge_instances_with_userdata", int, m_opt_merge_instances_with_userdata);
     ATTR_DECODE ("opt_fold_getattribute", int, m_opt_fold_getattribute);
     ATTR_DECODE ("opt_middleman", int, m_opt_middleman);
+    ATTR_DECODE ("opt_cross_layer_cse", int, m_opt_cross_layer_cse);
     ATTR_DECODE ("opt_texture_handle", int, m_opt_texture_handle);
     ATTR_DECODE ("opt_seed_bblock_aliases", int, m_opt_seed_bblock_aliases);
+    ATTR_DECODE ("opt_loop_invariants", int, m_opt_loop_invariants);
+    ATTR_DECODE ("opt_transient_strings", int, m_opt_transient_strings);
+    ATTR_DECODE ("opt_range_checks", int, m_opt_range_checks);
+    ATTR_DECODE ("opt_texture_coalesce", int, m_opt_texture_coalesce);
+    ATTR_DECODE ("opt_deriv_axes", int, m_opt_deriv_axes);
+    ATTR_DECODE ("opt_batched_coherent_branches", int, m_opt_batched_coherent_branches);
+    ATTR_DECODE ("opt_memoize_instances", int, m_opt_memoize_instances);
+    ATTR_DECODE ("opt_parallel_layers", int, m_opt_parallel_layers);
+    ATTR_DECODE ("opt_groupdata_layout", int, m_opt_groupdata_layout);
+    ATTR_DECODE ("opt_groupdata_share", int, m_opt_groupdata_share);
+    ATTR_DECODE ("opt_message_slots", int, m_opt_message_slots);
+    ATTR_DECODE ("opt_upfront_layers", int, m_opt_upfront_layers);
     ATTR_DECODE ("llvm_jit_fma", int, m_llvm_jit_fma);
     ATTR_DECODE ("llvm_jit_aggressive", int, m_llvm_jit_aggressive);
+    ATTR_DECODE ("llvm_jit_orc", int, m_llvm_jit_orc);
+    ATTR_DECODE ("llvm_jit_lazy", int, m_llvm_jit_lazy);
+    ATTR_DECODE ("llvm_jit_tiered", int, m_llvm_jit_tiered);
+    ATTR_DECODE ("llvm_pgo_samples", int, m_llvm_pgo_samples);
+    ATTR_DECODE ("llvm_aot_output", int, m_llvm_aot_output);
+    ATTR_DECODE ("max_jit_memory_MB", int, m_max_jit_memory_MB);
+    ATTR_DECODE ("async_optimize", int, m_async_optimize);
+    ATTR_DECODE_STRING ("llvm_aot_isas", m_llvm_aot_isas);
+    ATTR_DECODE_STRING ("ptx_cache_dir", m_ptx_cache_dir);
+    ATTR_DECODE_STRING ("jit_cache_dir", m_jit_cache_dir);
     ATTR_DECODE_STRING ("llvm_jit_target", m_llvm_jit_target);
     ATTR_DECODE ("vector_width", int, m_vector_width);
     ATTR_DECODE ("opt_passes", int, m_opt_passes);
+    ATTR_DECODE ("opt_pass_min_change", float, m_opt_pass_min_change);
+    ATTR_DECODE ("opt_time_budget_ms", float, m_opt_time_budget_ms);
     ATTR_DECODE ("optimize_nondebug", int, m_optimize_nondebug);
     ATTR_DECODE ("llvm_optimize", int, m_llvm_optimize);
+    if (name == "llvm_opt_preset" && type == TypeDesc::STRING) {
+        *(const char **)val = LLVM_Util::opt_preset_name (m_llvm_opt_preset);
+        return true;
+    }
+    if (name == "math_precision" && type == TypeDesc::STRING) {
+        *(const char **)val = math_precision_name (m_math_precision);
+        return true;
+    }
     ATTR_DECODE ("debug", int, m_debug);
     ATTR_DECODE ("llvm_debug", int, m_llvm_debug);
     ATTR_DECODE ("llvm_debug_layers", int, m_llvm_debug_layers);
@@ -1679,10 +2467,12 @@ ShadingSystemImpl::getattribute (string_view name, TypeDesc type,
     ATTR_DECODE ("connection_error", int, m_connection_error);
     ATTR_DECODE ("greedyjit", int, m_greedyjit);
     ATTR_DECODE ("countlayerexecs", int, m_countlayerexecs);
+    ATTR_DECODE ("batched_lane_stats", int, m_batched_lane_stats);
     ATTR_DECODE ("relaxed_param_typecheck", int, m_relaxed_param_typecheck);
     ATTR_DECODE ("max_warnings_per_thread", int, m_max_warnings_per_thread);
     ATTR_DECODE_STRING ("commonspace", m_commonspace_synonym);
     ATTR_DECODE_STRING ("colorspace", m_colorspace);
+    ATTR_DECODE_STRING ("capture", m_capture);
     ATTR_DECODE_STRING ("debug_groupname", m_debug_groupname);
     ATTR_DECODE_STRING ("debug_layername", m_debug_layername);
     ATTR_DECODE_STRING ("opt_layername", m_opt_layername);
@@ -1690,6 +2480,9 @@ ShadingSystemImpl::getattribute (string_view name, TypeDesc type,
     ATTR_DECODE_STRING ("archive_groupname", m_archive_groupname);
     ATTR_DECODE_STRING ("archive_filename", m_archive_filename);
     ATTR_DECODE ("max_local_mem_KB", int, m_max_local_mem_KB);
+    ATTR_DECODE ("context_pool_KB", int, m_context_pool_KB);
+    ATTR_DECODE ("numa_local", int, m_numa_local);
+    ATTR_DECODE ("huge_pages", int, m_huge_pages);
     ATTR_DECODE ("compile_report", int, m_compile_report);
     ATTR_DECODE ("buffer_printf", int, m_buffer_printf);
     ATTR_DECODE ("no_noise", int, m_no_noise);
@@ -1700,67 +2493,40 @@ ShadingSystemImpl::getattribute (string_view name, TypeDesc type,
     ATTR_DECODE ("opt_warnings", int, m_opt_warnings);
     ATTR_DECODE ("gpu_opt_error", int, m_gpu_opt_error);
 
-    ATTR_DECODE ("stat:masters", int, m_stat_shaders_loaded);
-    ATTR_DECODE ("stat:groups", int, m_stat_groups);
-    ATTR_DECODE ("stat:instances_compiled", int, m_stat_instances_compiled);
-    ATTR_DECODE ("stat:groups_compiled", int, m_stat_groups_compiled);
-    ATTR_DECODE ("stat:empty_instances", int, m_stat_empty_instances);
-    ATTR_DECODE ("stat:merged_inst", int, m_stat_merged_inst);
-    ATTR_DECODE ("stat:merged_inst_opt", int, m_stat_merged_inst_opt);
-    ATTR_DECODE ("stat:empty_groups", int, m_stat_empty_groups);
-    ATTR_DECODE ("stat:instances", int, m_stat_groupinstances);
-    ATTR_DECODE ("stat:regexes", int, m_stat_regexes);
-    ATTR_DECODE ("stat:preopt_syms", int, m_stat_preopt_syms);
-    ATTR_DECODE ("stat:postopt_syms", int, m_stat_postopt_syms);
-    ATTR_DECODE ("stat:syms_with_derivs", int, m_stat_syms_with_derivs);
-    ATTR_DECODE ("stat:preopt_ops", int, m_stat_preopt_ops);
-    ATTR_DECODE ("stat:postopt_ops", int, m_stat_postopt_ops);
-    ATTR_DECODE ("stat:middlemen_eliminated", int, m_stat_middlemen_eliminated);
-    ATTR_DECODE ("stat:const_connections", int, m_stat_const_connections);
-    ATTR_DECODE ("stat:global_connections", int, m_stat_global_connections);
-    ATTR_DECODE ("stat:tex_calls_codegened", int, m_stat_tex_calls_codegened);
-    ATTR_DECODE ("stat:tex_calls_as_handles", int, m_stat_tex_calls_as_handles);
-    ATTR_DECODE ("stat:master_load_time", float, m_stat_master_load_time);
-    ATTR_DECODE ("stat:optimization_time", float, m_stat_optimization_time);
-    ATTR_DECODE ("stat:opt_locking_time", float, m_stat_opt_locking_time);
-    ATTR_DECODE ("stat:specialization_time", float, m_stat_specialization_time);
-    ATTR_DECODE ("stat:total_llvm_time", float, m_stat_total_llvm_time);
-    ATTR_DECODE ("stat:llvm_setup_time", float, m_stat_llvm_setup_time);
-    ATTR_DECODE ("stat:llvm_irgen_time", float, m_stat_llvm_irgen_time);
-    ATTR_DECODE ("stat:llvm_opt_time", float, m_stat_llvm_opt_time);
-    ATTR_DECODE ("stat:llvm_jit_time", float, m_stat_llvm_jit_time);
-    ATTR_DECODE ("stat:inst_merge_time", float, m_stat_inst_merge_time);
-    ATTR_DECODE ("stat:getattribute_calls", long long, m_stat_getattribute_calls);
-    ATTR_DECODE ("stat:get_userdata_calls", long long, m_stat_get_userdata_calls);
-    ATTR_DECODE ("stat:noise_calls", long long, m_stat_noise_calls);
-    ATTR_DECODE ("stat:pointcloud_searches", long long, m_stat_pointcloud_searches);
-    ATTR_DECODE ("stat:pointcloud_gets", long long, m_stat_pointcloud_gets);
-    ATTR_DECODE ("stat:pointcloud_writes", long long, m_stat_pointcloud_writes);
-    ATTR_DECODE ("stat:pointcloud_searches_total_results", long long, m_stat_pointcloud_searches_total_results);
-    ATTR_DECODE ("stat:pointcloud_max_results", int, m_stat_pointcloud_max_results);
-    ATTR_DECODE ("stat:pointcloud_failures", int, m_stat_pointcloud_failures);
-    ATTR_DECODE ("stat:memory_current", long long, m_stat_memory.current());
-    ATTR_DECODE ("stat:memory_peak", long long, m_stat_memory.peak());
-    ATTR_DECODE ("stat:mem_master_current", long long, m_stat_mem_master.current());
-    ATTR_DECODE ("stat:mem_master_peak", long long, m_stat_mem_master.peak());
-    ATTR_DECODE ("stat:mem_master_ops_current", long long, m_stat_mem_master_ops.current());
-    ATTR_DECODE ("stat:mem_master_ops_peak", long long, m_stat_mem_master_ops.peak());
-    ATTR_DECODE ("stat:mem_master_args_current", long long, m_stat_mem_master_args.current());
-    ATTR_DECODE ("stat:mem_master_args_peak", long long, m_stat_mem_master_args.peak());
-    ATTR_DECODE ("stat:mem_master_syms_current", long long, m_stat_mem_master_syms.current());
-    ATTR_DECODE ("stat:mem_master_syms_peak", long long, m_stat_mem_master_syms.peak());
-    ATTR_DECODE ("stat:mem_master_defaults_current", long long, m_stat_mem_master_defaults.current());
-    ATTR_DECODE ("stat:mem_master_defaults_peak", long long, m_stat_mem_master_defaults.peak());
-    ATTR_DECODE ("stat:mem_master_consts_current", long long, m_stat_mem_master_consts.current());
-    ATTR_DECODE ("stat:mem_master_consts_peak", long long, m_stat_mem_master_consts.peak());
-    ATTR_DECODE ("stat:mem_inst_current", long long, m_stat_mem_inst.current());
-    ATTR_DECODE ("stat:mem_inst_peak", long long, m_stat_mem_inst.peak());
-    ATTR_DECODE ("stat:mem_inst_syms_current", long long, m_stat_mem_inst_syms.current());
-    ATTR_DECODE ("stat:mem_inst_syms_peak", long long, m_stat_mem_inst_syms.peak());
-    ATTR_DECODE ("stat:mem_inst_paramvals_current", long long, m_stat_mem_inst_paramvals.current());
-    ATTR_DECODE ("stat:mem_inst_paramvals_peak", long long, m_stat_mem_inst_paramvals.peak());
-    ATTR_DECODE ("stat:mem_inst_connections_current", long long, m_stat_mem_inst_connections.current());
-    ATTR_DECODE ("stat:mem_inst_connections_peak", long long, m_stat_mem_inst_connections.peak());
+    OSL_SHADINGSYS_STATS (ATTR_DECODE)
+    // All the stats at once, so that they can be sampled during a render
+    // without formatting getstats() text: "stat:names" lists them, and
+    // "stat:values" gives their current values, in the same order.
+#define STAT_NAME(_name,_ctype,_src) _name,
+    static const char *stat_names[] = { OSL_SHADINGSYS_STATS (STAT_NAME) };
+#undef STAT_NAME
+    const int nstats = int (sizeof(stat_names) / sizeof(stat_names[0]));
+    if (name == "stat:num_names" && type == TypeDesc::TypeInt) {
+        *(int *)val = nstats;
+        return true;
+    }
+    if (name == "stat:names" && type.basetype == TypeDesc::STRING) {
+        int n = std::min (nstats, (int)type.numelements());
+        for (int i = 0;  i < n;  ++i)
+            ((ustring *)val)[i] = ustring (stat_names[i]);
+        return true;
+    }
+    if (name == "stat:values" && type.basetype == TypeDesc::DOUBLE) {
+        double *v = (double *)val;
+        int i = 0, n = std::min (nstats, (int)type.numelements());
+#define STAT_VALUE(_name,_ctype,_src) \
+        if (i < n) v[i++] = (double)(_ctype)(_src);
+        OSL_SHADINGSYS_STATS (STAT_VALUE)
+#undef STAT_VALUE
+        return true;
+    }
+    if (Strutil::starts_with (name, "stat:llvm_opt_time:") && type == TypeDesc::FLOAT) {
+        OptPreset preset = LLVM_Util::lookup_opt_preset_by_name (name.substr(19));
+        if (preset == OptPreset::UNKNOWN)
+            return false;
+        *(float *)val = (float) m_stat_llvm_opt_preset_time[int(preset)];
+        return true;
+    }
 
     if (name == "colorsystem" && type.basetype == TypeDesc::PTR) {
         *(void**)val = &colorsystem();
@@ -1816,6 +2582,8 @@ ShadingSystemImpl::getattribute (string_view name, TypeDesc type,
 #undef ATTR_DECODE_STRING
 }
 
+#undef OSL_SHADINGSYS_STATS
+
 
 
 bool
@@ -1846,11 +2614,124 @@ ShadingSystemImpl::attribute (ShaderGroup *group, string_view name,
         group->name (ustring(((const char **)val)[0]));
         return true;
     }
+    if (name == "llvm_opt_preset" && type == TypeDesc::TypeString) {
+        // "" reverts to the ShadingSystem's llvm_opt_preset
+        string_view preset_name (*(const char **)val);
+        OptPreset preset = LLVM_Util::lookup_opt_preset_by_name (preset_name);
+        if (preset == OptPreset::UNKNOWN && ! preset_name.empty())
+            return false;
+        group->m_llvm_opt_preset = preset;
+        return true;
+    }
+    if (name == "math_precision" && type == TypeDesc::TypeString) {
+        // "" reverts to the ShadingSystem's math_precision
+        string_view precision_name (*(const char **)val);
+        MathPrecision precision = lookup_math_precision (precision_name);
+        if (precision == MathPrecision::UNKNOWN && ! precision_name.empty())
+            return false;
+        group->m_math_precision = precision;
+        return true;
+    }
+    if (name == "llvm_aot_object" && type.basetype == TypeDesc::PTR) {
+        // Code from a "llvm_aot_output" run, to use instead of JITing
+        group->m_llvm_aot_object = *(const std::string *)val;
+        group->m_llvm_aot_file.reset ();
+        group->m_llvm_aot_mapped = string_view();
+        return true;
+    }
+    if (name == "batch_width" && type == TypeDesc::TypeInt) {
+        // 0 lets batch_width() choose; otherwise only the widths that
+        // BatchedExecutor is instantiated for
+        int width = *(const int *)val;
+        if (width != 0 && width != 4 && width != 8 && width != 16)
+            return false;
+        if (group->batch_jitted() && width && width != group->batch_jitted())
+            return false;   // too late, its wide code is already made
+        group->m_batch_width = width;
+        return true;
+    }
+    if (name == "fallback_group" && type.basetype == TypeDesc::PTR) {
+        group->m_fallback_group = *(const ShaderGroupRef *)val;
+        return true;
+    }
+    if (name == "instance_parameters" && type.basetype == TypeDesc::STRING) {
+        return set_instance_parameters (*group,
+            cspan<const char *> ((const char **)val, type.numelements()));
+    }
     return false;
 }
 
 
 
+bool
+ShadingSystemImpl::set_instance_parameters (ShaderGroup &group,
+                                            cspan<const char *> names)
+{
+    if (group.optimized()) {
+        errorfmt ("Can't set instance_parameters of group \"{}\" after it "
+                  "has been optimized", group.name());
+        return false;
+    }
+
+    // Each one becomes a lockgeom=0 parameter, so that the optimizer
+    // leaves it alone, with a stride-0 userdata placement, so that the
+    // generated code copies it from the same place of the userdata arena
+    // for every point that is shaded.
+    std::vector<SymLocationDesc> layout;
+    std::vector<std::pair<ShaderInstance*, int>> params;
+    size_t size = 0;
+    for (string_view fullname : names) {
+        string_view layername, paramname (fullname);
+        size_t dot = fullname.find ('.');
+        if (dot != string_view::npos) {
+            layername = fullname.substr (0, dot);
+            paramname = fullname.substr (dot+1);
+        }
+        ShaderInstance *inst = nullptr;
+        int p = -1;
+        for (int layer = group.nlayers()-1;  layer >= 0 && p < 0;  --layer) {
+            inst = group[layer];
+            if (layername.empty() || inst->layername() == layername)
+                p = inst->findparam (ustring(paramname));
+        }
+        const Symbol *sym = p >= 0 ? inst->mastersymbol (p) : nullptr;
+        if (! sym) {
+            errorfmt ("instance_parameters: group \"{}\" has no parameter "
+                      "\"{}\"", group.name(), fullname);
+            return false;
+        }
+        TypeDesc type = sym->typespec().simpletype();
+        if (sym->typespec().is_closure_based() || type.is_unsized_array()) {
+            errorfmt ("instance_parameters: parameter \"{}\" of group \"{}\" "
+                      "can't be instance data", fullname, group.name());
+            return false;
+        }
+        size = OIIO::round_to_multiple (size, type.basesize());
+        layout.emplace_back (fmtformat ("{}.{}", inst->layername(),
+                                        sym->name()),
+                             type, /*derivs*/ false, SymArena::UserData,
+                             size, /*stride*/ 0);
+        params.emplace_back (inst, p);
+        size += type.size();
+    }
+
+    // Forget the placements of any earlier instance parameters
+    for (auto&& old : group.m_instance_data) {
+        auto f = std::lower_bound (group.m_symlocs.begin(),
+                                   group.m_symlocs.end(), old.name);
+        if (f != group.m_symlocs.end() && f->name == old.name)
+            group.m_symlocs.erase (f);
+    }
+    for (auto&& p : params)
+        p.first->instoverride(p.second)->lockgeom (false);
+    group.add_symlocs (layout);
+    group.m_instance_data = std::move (layout);
+    group.m_instance_data_size = size;
+    return true;
+}
+
+
+
 bool
 ShadingSystemImpl::getattribute (ShaderGroup *group, string_view name,
                                  TypeDesc type, void *val)
@@ -1862,10 +2743,22 @@ ShadingSystemImpl::getattribute (ShaderGroup *group, string_view name,
         *(ustring *)val = group->name();
         return true;
     }
+    if (name == "llvm_opt_preset" && type == TypeDesc::TypeString) {
+        *(ustring *)val = ustring (LLVM_Util::opt_preset_name (llvm_opt_preset (*group)));
+        return true;
+    }
+    if (name == "math_precision" && type == TypeDesc::TypeString) {
+        *(ustring *)val = ustring (math_precision_name (math_precision (*group)));
+        return true;
+    }
     if (name == "num_layers" && type == TypeDesc::TypeInt) {
         *(int *)val = group->nlayers();
         return true;
     }
+    if (name == "ready" && type == TypeDesc::TypeInt) {
+        *(int *)val = dedupe_group (*group).jitted();
+        return true;
+    }
     if (name == "layer_names" && type.basetype == TypeDesc::STRING) {
         size_t n = std::min (type.numelements(), (size_t)group->nlayers());
         for (size_t i = 0;  i < n;  ++i)
@@ -1904,6 +2797,26 @@ ShadingSystemImpl::getattribute (ShaderGroup *group, string_view name,
             ((ustring *)val)[i] = ustring();
         return true;
     }
+    if (name == "num_instance_parameters" && type.basetype == TypeDesc::INT) {
+        *(int *)val = (int)group->instance_data().size();
+        return true;
+    }
+    if (name == "instance_parameters" && type.basetype == TypeDesc::STRING) {
+        auto layout = group->instance_data();
+        for (size_t i = 0;  i < type.numelements();  ++i)
+            ((ustring *)val)[i] = i < layout.size() ? layout[i].name : ustring();
+        return true;
+    }
+    if (name == "instance_data_offsets" && type.basetype == TypeDesc::INT) {
+        auto layout = group->instance_data();
+        for (size_t i = 0;  i < type.numelements();  ++i)
+            ((int *)val)[i] = i < layout.size() ? (int)layout[i].offset : -1;
+        return true;
+    }
+    if (name == "instance_data_size" && type.basetype == TypeDesc::INT) {
+        *(int *)val = (int)group->instance_data_size();
+        return true;
+    }
     if (name == "group_init_name" && type.basetype == TypeDesc::STRING) {
         *(ustring*)val
             = ustring::fmtformat("__direct_callable__group_{}_{}_init",
@@ -1933,14 +2846,104 @@ ShadingSystemImpl::getattribute (ShaderGroup *group, string_view name,
         *(int *)val = group->m_exec_repeat;
         return true;
     }
+    if (name == "llvm_aot_object" && type.basetype == TypeDesc::PTR) {
+        *(std::string *)val = std::string (group->llvm_aot_object());
+        return true;
+    }
     if (name == "ptx_compiled_version" && type.basetype == TypeDesc::PTR) {
         bool exists = !group->m_llvm_ptx_compiled_version.empty();
         *(std::string *)val = exists ? group->m_llvm_ptx_compiled_version : "";
         return true;
     }
+    // What compiling the group cost
+    const GroupCompileStats &cs (group->m_compile_stats);
+    if (name == "stat:compile_specialization_time" && type == TypeDesc::TypeFloat) {
+        *(float *)val = (float) cs.specialization_time;
+        return true;
+    }
+    if (name == "stat:compile_num_opt_passes" && type == TypeDesc::TypeInt) {
+        *(int *)val = (int) cs.opt_pass_times.size();
+        return true;
+    }
+    if (name == "stat:compile_opt_pass_names" && type.basetype == TypeDesc::STRING) {
+        size_t n = std::min (type.numelements(), cs.opt_pass_times.size());
+        for (size_t i = 0;  i < n;  ++i)
+            ((ustring *)val)[i] = ustring (cs.opt_pass_times[i].first);
+        return true;
+    }
+    if (name == "stat:compile_opt_pass_times" && type.basetype == TypeDesc::FLOAT) {
+        size_t n = std::min (type.numelements(), cs.opt_pass_times.size());
+        for (size_t i = 0;  i < n;  ++i)
+            ((float *)val)[i] = (float) cs.opt_pass_times[i].second;
+        return true;
+    }
+    if (name == "stat:compile_opt_layer_passes" && type == TypeDesc::TypeInt) {
+        *(int *)val = cs.opt_layer_passes;
+        return true;
+    }
+    if (name == "stat:compile_opt_budget_cutoffs" && type == TypeDesc::TypeInt) {
+        *(int *)val = cs.opt_budget_cutoffs;
+        return true;
+    }
+    if (name == "stat:compile_llvm_setup_time" && type == TypeDesc::TypeFloat) {
+        *(float *)val = (float) cs.llvm_setup_time;
+        return true;
+    }
+    if (name == "stat:compile_llvm_irgen_time" && type == TypeDesc::TypeFloat) {
+        *(float *)val = (float) cs.llvm_irgen_time;
+        return true;
+    }
+    if (name == "stat:compile_llvm_opt_time" && type == TypeDesc::TypeFloat) {
+        *(float *)val = (float) cs.llvm_opt_time;
+        return true;
+    }
+    if (name == "stat:compile_llvm_jit_time" && type == TypeDesc::TypeFloat) {
+        *(float *)val = (float) cs.llvm_jit_time;
+        return true;
+    }
+    if (name == "stat:compile_preopt_ops" && type == TypeDesc::TypeInt) {
+        *(int *)val = cs.preopt_ops;
+        return true;
+    }
+    if (name == "stat:compile_postopt_ops" && type == TypeDesc::TypeInt) {
+        *(int *)val = cs.postopt_ops;
+        return true;
+    }
+    if (name == "stat:compile_preopt_syms" && type == TypeDesc::TypeInt) {
+        *(int *)val = cs.preopt_syms;
+        return true;
+    }
+    if (name == "stat:compile_postopt_syms" && type == TypeDesc::TypeInt) {
+        *(int *)val = cs.postopt_syms;
+        return true;
+    }
+    if (name == "stat:compile_jit_bytes" && type.basetype == TypeDesc::INT64) {
+        *(long long *)val = (long long) group->m_llvm_jit_bytes;
+        return true;
+    }
+    if ((name == "stat:layer_execs" && (type.basetype == TypeDesc::INT
+                                        || type.basetype == TypeDesc::INT64))
+        || ((name == "stat:layer_times" || name == "stat:layer_self_times")
+            && type.basetype == TypeDesc::FLOAT)) {
+        std::vector<LayerProfile> prof = layer_profile (*group);
+        size_t n = std::min (type.numelements(), (size_t)group->nlayers());
+        for (size_t i = 0;  i < n;  ++i) {
+            LayerProfile p = i < prof.size() ? prof[i] : LayerProfile();
+            if (type.basetype == TypeDesc::INT)
+                ((int *)val)[i] = (int) p.execs;
+            else if (type.basetype == TypeDesc::INT64)
+                ((long long *)val)[i] = p.execs;
+            else
+                ((float *)val)[i] = (float) OIIO::Timer::seconds (
+                    name == "stat:layer_times" ? p.ticks : p.self_ticks);
+        }
+        return true;
+    }
 
     // All the remaining attributes require the group to already be
-    // optimized.
+    // optimized. A group that shares the code of an identical one
+    // answers with that one's.
+    group = &dedupe_group (*group);
     if (! group->optimized()) {
         auto threadinfo = create_thread_info();
         auto ctx = get_context(threadinfo);
@@ -1949,6 +2952,11 @@ ShadingSystemImpl::getattribute (ShaderGroup *group, string_view name,
         destroy_thread_info (threadinfo);
     }
 
+    if (name == "batch_width" && type == TypeDesc::TypeInt) {
+        *(int *)val = batch_width (*group);
+        return true;
+    }
+
     if (name == "num_textures_needed" && type == TypeDesc::TypeInt) {
         *(int *)val = (int)group->m_textures_needed.size();
         return true;
@@ -1963,6 +2971,20 @@ ShadingSystemImpl::getattribute (ShaderGroup *group, string_view name,
         return true;
     }
 
+    if (name == "num_pointclouds_needed" && type == TypeDesc::TypeInt) {
+        *(int *)val = (int)group->m_pointclouds_needed.size();
+        return true;
+    }
+    if (name == "pointclouds_needed" && type.basetype == TypeDesc::PTR) {
+        size_t n = group->m_pointclouds_needed.size();
+        *(ustring **)val = n ? &group->m_pointclouds_needed[0] : NULL;
+        return true;
+    }
+    if (name == "unknown_pointclouds_needed" && type == TypeDesc::TypeInt) {
+        *(int *)val = (int)group->m_unknown_pointclouds_needed;
+        return true;
+    }
+
     if (name == "num_closures_needed" && type == TypeDesc::TypeInt) {
         *(int *)val = (int)group->m_closures_needed.size();
         return true;
@@ -1976,6 +2998,22 @@ ShadingSystemImpl::getattribute (ShaderGroup *group, string_view name,
         *(int *)val = (int)group->m_unknown_closures_needed;
         return true;
     }
+    if (name == "closure_pool_size" && type == TypeDesc::TypeInt) {
+        *(int *)val = group->m_closure_pool_size;
+        return true;
+    }
+    if (name == "groupdata_size" && type == TypeDesc::TypeInt) {
+        // Only known once the group has been JITed.
+        if (! group->jitted()) {
+            auto threadinfo = create_thread_info();
+            auto ctx = get_context(threadinfo);
+            optimize_group (*group, ctx, true /*jit*/);
+            release_context(ctx);
+            destroy_thread_info (threadinfo);
+        }
+        *(int *)val = (int)group->llvm_groupdata_size();
+        return true;
+    }
 
     if (name == "num_globals_needed" && type == TypeDesc::TypeInt) {
         *(int *)val = (int)group->m_globals_needed.size();
@@ -1994,6 +3032,41 @@ ShadingSystemImpl::getattribute (ShaderGroup *group, string_view name,
         *(int *)val = group->m_globals_write;
         return true;
     }
+    if (name == "closure_output_empty" && type == TypeDesc::TypeInt) {
+        *(int *)val = ! (group->m_globals_write & int(SGBits::Ci));
+        return true;
+    }
+    if (Strutil::starts_with (name, "output_is_constant:")
+          || Strutil::starts_with (name, "output_is_uniform:")) {
+        string_view symname = name.substr (name.find (':') + 1);
+        ustring layername, symbolname (symname);
+        size_t dot = symname.find ('.');
+        if (dot != string_view::npos) {
+            layername = ustring (symname.substr (0, dot));
+            symbolname = ustring (symname.substr (dot + 1));
+        }
+        const Symbol *sym = group->find_symbol (layername, symbolname);
+        if (! sym || (sym->symtype() != SymTypeParam
+                      && sym->symtype() != SymTypeOutputParam))
+            return false;
+        // Nothing in the optimized code sets it, and neither a connection
+        // nor userdata (lockgeom=0, including instance_parameters) can.
+        bool constant = sym->lockgeom() && ! sym->connected()
+                        && ! sym->has_init_ops() && ! sym->everwritten()
+                        && ! sym->typespec().is_closure_based()
+                        && sym->data();
+        if (Strutil::starts_with (name, "output_is_uniform:")) {
+            if (type != TypeDesc::TypeInt)
+                return false;
+            *(int *)val = constant
+                          || (m_opt_batched_analysis && sym->is_uniform());
+            return true;
+        }
+        if (! constant || type != sym->typespec().simpletype())
+            return false;
+        memcpy (val, sym->data(), type.size());
+        return true;
+    }
 
     if (name == "num_userdata" && type == TypeDesc::TypeInt) {
         *(int *)val = (int)group->m_userdata_names.size();
@@ -2059,20 +3132,58 @@ ShadingSystemImpl::getattribute (ShaderGroup *group, string_view name,
 
 
 
-void
-ShadingSystemImpl::error (const std::string &msg) const
+// Have we recently reported this message? If not, remember that we have.
+static bool
+seen_recently (std::list<std::string> &seen, int maxseen,
+               const std::string &msg, bool repeats)
 {
-    lock_guard guard (m_errmutex);
     int n = 0;
-    for (auto&& s : m_errseen) {
-        if (s == msg && !m_error_repeats)
-            return;
+    for (auto&& s : seen) {
+        if (s == msg && !repeats)
+            return true;
         ++n;
     }
-    if (n >= m_errseenmax)
-        m_errseen.pop_front ();
-    m_errseen.push_back (msg);
-    m_err->error (msg);
+    if (n >= maxseen)
+        seen.pop_front ();
+    seen.push_back (msg);
+    return false;
+}
+
+
+
+void
+ShadingSystemImpl::report_locked (ErrorHandler::ErrCode code,
+                                  const std::string &msg) const
+{
+    switch (code) {
+    case ErrorHandler::EH_MESSAGE :
+    case ErrorHandler::EH_DEBUG :
+        m_err->message (msg);
+        break;
+    case ErrorHandler::EH_INFO :
+        m_err->info (msg);
+        break;
+    case ErrorHandler::EH_WARNING :
+        if (! seen_recently (m_warnseen, m_errseenmax, msg, m_error_repeats))
+            m_err->warning (msg);
+        break;
+    case ErrorHandler::EH_ERROR :
+    case ErrorHandler::EH_SEVERE :
+        if (! seen_recently (m_errseen, m_errseenmax, msg, m_error_repeats))
+            m_err->error (msg);
+        break;
+    default:
+        break;
+    }
+}
+
+
+
+void
+ShadingSystemImpl::error (const std::string &msg) const
+{
+    lock_guard guard (m_errmutex);
+    report_locked (ErrorHandler::EH_ERROR, msg);
 }
 
 
@@ -2081,16 +3192,7 @@ void
 ShadingSystemImpl::warning (const std::string &msg) const
 {
     lock_guard guard (m_errmutex);
-    int n = 0;
-    for (auto&& s : m_warnseen) {
-        if (s == msg && !m_error_repeats)
-            return;
-        ++n;
-    }
-    if (n >= m_errseenmax)
-        m_warnseen.pop_front ();
-    m_warnseen.push_back (msg);
-    m_err->warning (msg);
+    report_locked (ErrorHandler::EH_WARNING, msg);
 }
 
 
@@ -2177,16 +3279,32 @@ ShadingSystemImpl::getstats (int level) const
     BOOLOPT (lazyunconnected);
     BOOLOPT (lazyerror);
     BOOLOPT (lazy_userdata);
+    BOOLOPT (cache_lookups);
+    BOOLOPT (numa_local);
+    BOOLOPT (huge_pages);
+    BOOLOPT (deferred_trace);
+    if (m_closure_weight_threshold > 0.0f)
+        opt += Strutil::sprintf("closure_weight_threshold=%g ", m_closure_weight_threshold);
+    BOOLOPT (pointcloud_bake_index);
+    BOOLOPT (pointcloud_bake_pages);
+    INTOPT (pointcloud_max_memory_MB);
+    BOOLOPT (cache_textureinfo);
     BOOLOPT (userdata_isconnected);
     BOOLOPT (clearmemory);
     BOOLOPT (debugnan);
     BOOLOPT (debug_uninit);
+    INTOPT (debug_sample);
     BOOLOPT (lockgeom_default);
+    BOOLOPT (reparam_reoptimize);
+    INTOPT (raytype_variants);
+    INTOPT (output_variants);
+    BOOLOPT (dedupe_groups);
     BOOLOPT (strict_messages);
     BOOLOPT (error_repeats);
     BOOLOPT (range_checking);
     BOOLOPT (greedyjit);
     BOOLOPT (countlayerexecs);
+    BOOLOPT (batched_lane_stats);
     BOOLOPT (opt_simplify_param);
     BOOLOPT (opt_constant_fold);
     BOOLOPT (opt_stale_assign);
@@ -2200,14 +3318,41 @@ ShadingSystemImpl::getstats (int level) const
     BOOLOPT (opt_merge_instances_with_userdata);
     BOOLOPT (opt_fold_getattribute);
     BOOLOPT (opt_middleman);
+    BOOLOPT (opt_cross_layer_cse);
     BOOLOPT (opt_texture_handle);
     BOOLOPT (opt_seed_bblock_aliases);
     BOOLOPT (opt_batched_analysis);
+    INTOPT (opt_batched_coherent_branches);
+    BOOLOPT (opt_loop_invariants);
+    BOOLOPT (opt_transient_strings);
+    BOOLOPT (opt_range_checks);
+    BOOLOPT (opt_texture_coalesce);
+    BOOLOPT (opt_deriv_axes);
+    INTOPT (opt_memoize_instances);
+    INTOPT (opt_parallel_layers);
+    BOOLOPT (opt_groupdata_layout);
+    BOOLOPT (opt_groupdata_share);
+    BOOLOPT (opt_message_slots);
+    BOOLOPT (opt_upfront_layers);
     BOOLOPT (llvm_jit_fma);
     BOOLOPT (llvm_jit_aggressive);
+    BOOLOPT (llvm_jit_orc);
+    BOOLOPT (llvm_jit_lazy);
+    BOOLOPT (llvm_jit_tiered);
+    INTOPT (llvm_pgo_samples);
+    INTOPT (max_jit_memory_MB);
+    INTOPT (async_optimize);
+    BOOLOPT (llvm_aot_output);
+    STROPT (llvm_aot_isas);
+    STROPT (ptx_cache_dir);
+    STROPT (jit_cache_dir);
     INTOPT (vector_width);
     STROPT (llvm_jit_target);
     INTOPT  (opt_passes);
+    if (m_opt_pass_min_change > 0.0f)
+        opt += Strutil::sprintf("opt_pass_min_change=%g ", m_opt_pass_min_change);
+    if (m_opt_time_budget_ms > 0.0f)
+        opt += Strutil::sprintf("opt_time_budget_ms=%g ", m_opt_time_budget_ms);
     INTOPT (no_noise);
     INTOPT (no_pointcloud);
     INTOPT (force_derivs);
@@ -2264,6 +3409,40 @@ ShadingSystemImpl::getstats (int level) const
     if (m_countlayerexecs)
         out << "  Total layers executed: " << m_stat_layers_executed << "\n";
 
+    if (m_batched_lane_stats) {
+        std::vector<ShaderGroupRef> groups;
+        {
+            spin_lock lock (m_all_shader_groups_mutex);
+            for (auto&& w : m_all_shader_groups)
+                if (ShaderGroupRef g = w.lock())
+                    if (g->m_batched_lane_counts)
+                        groups.push_back (g);
+        }
+        if (groups.size())
+            out << "  Batched lane occupancy (average lanes on per run):\n";
+        for (auto&& g : groups) {
+            const uint64_t *counts = g->m_batched_lane_counts.get();
+            int nlayers = g->nlayers();
+            int nops = g->m_batched_uniform_ops + g->m_batched_varying_ops;
+            out << "    " << (g->name().size() ? g->name().c_str() : "<unnamed group>")
+                << ": " << g->m_batched_uniform_ops << " of " << nops
+                << " ops uniform";
+            if (nops)
+                out << Strutil::sprintf (" (%.1f%%)", 100.0 * g->m_batched_uniform_ops / nops);
+            out << "\n";
+            for (int i = 0;  i < nlayers;  ++i)
+                if (counts[2*i])
+                    out << Strutil::sprintf ("      %.2f in %llu runs of layer %s\n",
+                                             double(counts[2*i+1]) / counts[2*i],
+                                             (unsigned long long)counts[2*i],
+                                             (*g)[i]->layername().c_str());
+            if (counts[2*nlayers])
+                out << Strutil::sprintf ("      %.2f lanes off in %llu varying loop iterations\n",
+                                         double(counts[2*nlayers+1]) / counts[2*nlayers],
+                                         (unsigned long long)counts[2*nlayers]);
+        }
+    }
+
 #if 0
     long long totalexec = m_layers_executed_uncond + m_layers_executed_lazy +
                           m_layers_executed_never;
@@ -2283,10 +3462,45 @@ ShadingSystemImpl::getstats (int level) const
 
     out << "  Compiled " << m_stat_groups_compiled << " groups, "
         << m_stat_instances_compiled << " instances\n";
+    if (m_stat_groups_rejitted)
+        out << "  Re-JITed " << m_stat_groups_rejitted
+            << " groups at full optimization (tiered)\n";
+    if (m_stat_groups_pgo_rejitted)
+        out << "  Re-JITed " << m_stat_groups_pgo_rejitted
+            << " groups with their branch profiles (pgo)\n";
+    if (m_stat_groups_precompiled)
+        out << "  Loaded " << m_stat_groups_precompiled
+            << " groups from precompiled code\n";
     out << "  Merged " << (m_stat_merged_inst+m_stat_merged_inst_opt)
         << " instances (" << m_stat_merged_inst << " initial, "
         << m_stat_merged_inst_opt << " after opt) in "
         << Strutil::timeintervalformat (m_stat_inst_merge_time, 2) << "\n";
+    if (m_stat_memoized_opt_steps)
+        out << "  Reused " << m_stat_memoized_opt_steps
+            << " memoized layer optimization steps\n";
+    if (m_stat_raytype_variants)
+        out << "  Specialized " << m_stat_raytype_variants
+            << " ray type variants of groups\n";
+    if (m_stat_output_variants)
+        out << "  Specialized " << m_stat_output_variants
+            << " output subset variants of groups\n";
+    if (m_stat_groups_deduped)
+        out << "  Shared the code of identical groups for "
+            << m_stat_groups_deduped << " of " << m_stat_groups_dedupe_checked
+            << " groups ("
+            << (int)(100.0f*m_stat_groups_deduped/m_stat_groups_dedupe_checked)
+            << "%)\n";
+    if (m_stat_groups_evicted)
+        out << "  Evicted " << m_stat_groups_evicted
+            << " least recently executed groups ("
+            << Strutil::memformat (m_stat_jit_memory_evicted)
+            << " of JIT memory) to stay under max_jit_memory_MB\n";
+    if (m_stat_ptx_cache_hits || m_stat_ptx_cache_misses)
+        out << "  PTX cache: " << m_stat_ptx_cache_hits << " hits, "
+            << m_stat_ptx_cache_misses << " misses\n";
+    if (m_stat_jit_cache_hits || m_stat_jit_cache_misses)
+        out << "  JIT cache: " << m_stat_jit_cache_hits << " hits, "
+            << m_stat_jit_cache_misses << " misses\n";
     if (m_stat_instances_compiled > 0)
         out << "  After optimization, " << m_stat_empty_instances
             << " empty instances ("
@@ -2310,6 +3524,9 @@ ShadingSystemImpl::getstats (int level) const
                             (int)m_stat_global_connections);
     out << Strutil::sprintf ("  Middlemen eliminated: %d\n",
                             (int)m_stat_middlemen_eliminated);
+    if (m_opt_cross_layer_cse)
+        out << Strutil::sprintf ("  Ops shared across layers: %d\n",
+                                (int)m_stat_cross_layer_cse);
     out << Strutil::sprintf ("  Derivatives needed on %d / %d symbols (%.1f%%)\n",
                             (int)m_stat_syms_with_derivs, (int)m_stat_postopt_syms,
                             (100.0*(int)m_stat_syms_with_derivs)/std::max((int)m_stat_postopt_syms,1));
@@ -2326,6 +3543,15 @@ ShadingSystemImpl::getstats (int level) const
             << Strutil::timeintervalformat (m_stat_llvm_irgen_time, 2) << "\n";
         out << "    LLVM optimize:             "
             << Strutil::timeintervalformat (m_stat_llvm_opt_time, 2) << "\n";
+        // Only break it down if any group used a preset pipeline
+        if (m_stat_llvm_opt_preset_time[int(OptPreset::LEGACY)] < m_stat_llvm_opt_time) {
+            for (int i = int(OptPreset::LEGACY);  i < int(OptPreset::COUNT);  ++i) {
+                if (m_stat_llvm_opt_preset_time[i] > 0.0)
+                    out << Strutil::sprintf ("      %-25s",
+                                             std::string(LLVM_Util::opt_preset_name(OptPreset(i))) + ":")
+                        << Strutil::timeintervalformat (m_stat_llvm_opt_preset_time[i], 2) << "\n";
+            }
+        }
         out << "    LLVM JIT:                  "
             << Strutil::timeintervalformat (m_stat_llvm_jit_time, 2) << "\n";
     }
@@ -2336,6 +3562,15 @@ ShadingSystemImpl::getstats (int level) const
     out << "  Regex's compiled: " << m_stat_regexes << "\n";
     out << "  Largest generated function local memory size: "
         << m_stat_max_llvm_local_mem/1024 << " KB\n";
+    if (m_stat_groupdata_bytes_shared)
+        out << "  Group data bytes saved by sharing between layers: "
+            << m_stat_groupdata_bytes_shared << "\n";
+    if (m_stat_peak_closure_bytes)
+        out << "  Most closure memory used by one execution: "
+            << Strutil::memformat (m_stat_peak_closure_bytes) << "\n";
+    if (m_stat_peak_scratch_bytes)
+        out << "  Most scratch memory used by one execution: "
+            << Strutil::memformat (m_stat_peak_scratch_bytes) << "\n";
     if (m_stat_getattribute_calls) {
         out << "  getattribute calls: " << m_stat_getattribute_calls << " ("
             << Strutil::timeintervalformat (m_stat_getattribute_time, 2) << ")\n";
@@ -2355,6 +3590,15 @@ ShadingSystemImpl::getstats (int level) const
         out << "      failures: " << m_stat_pointcloud_failures << "\n";
         out << "    pointcloud_get calls: " << m_stat_pointcloud_gets << "\n";
         out << "    pointcloud_write calls: " << m_stat_pointcloud_writes << "\n";
+        PointCloudPageStats pages = pointcloud_page_stats ();
+        if (pages.hits || pages.misses) {
+            out << "    paged cloud page lookups: " << pages.hits + pages.misses << "\n";
+            out << "      hit rate: " << Strutil::sprintf ("%.1f%%",
+                       100.0 * pages.hits / double(pages.hits + pages.misses)) << "\n";
+            out << "      evictions: " << pages.evictions << "\n";
+            out << "      read: " << Strutil::memformat (pages.bytes_read)
+                << ", peak in memory: " << Strutil::memformat (pages.peak_bytes) << "\n";
+        }
     }
     out << "  Memory total: " << m_stat_memory.memstat() << '\n';
     out << "    Master memory: " << m_stat_mem_master.memstat() << '\n';
@@ -2369,24 +3613,15 @@ ShadingSystemImpl::getstats (int level) const
     out << "        Instance connections:  " << m_stat_mem_inst_connections.memstat() << '\n';
 
     size_t jitmem = LLVM_Util::total_jit_memory_held();
-    out << "    LLVM JIT memory: " << Strutil::memformat(jitmem) << '\n';
+    size_t jitmem_freed = LLVM_Util::total_jit_memory_freed();
+    out << "    LLVM JIT memory: " << Strutil::memformat(jitmem) << " live, "
+        << Strutil::memformat(jitmem_freed) << " freed and pooled for reuse\n";
 
     if (m_profile) {
         out << "  Execution profile:\n";
         out << "    Total shader execution time: "
             << Strutil::timeintervalformat(OIIO::Timer::seconds(m_stat_total_shading_time_ticks), 2)
             << " (sum of all threads)\n";
-        // Account for times of any groups that haven't yet been destroyed
-        {
-            spin_lock lock (m_all_shader_groups_mutex);
-            for (auto&& grp : m_all_shader_groups) {
-                if (ShaderGroupRef g = grp.lock()) {
-                    long long ticks = g->m_stat_total_shading_time_ticks;
-                    m_group_profile_times[g->name()] += ticks;
-                    g->m_stat_total_shading_time_ticks -= ticks;
-                }
-            }
-        }
         {
             spin_lock lock (m_stat_mutex);
             std::vector<GroupTimeVal> grouptimes;
@@ -2406,6 +3641,80 @@ ShadingSystemImpl::getstats (int level) const
             }
         }
 
+        if (m_profile >= 2) {
+            // Per-layer profile of the groups that ran, most expensive
+            // first, and within each group the layers by their self time.
+            std::vector<std::pair<long long,ShaderGroupRef>> groups;
+            {
+                spin_lock lock (m_all_shader_groups_mutex);
+                for (auto&& w : m_all_shader_groups)
+                    if (ShaderGroupRef g = w.lock())
+                        groups.emplace_back (0, g);
+            }
+            {
+                spin_lock lock (m_stat_mutex);
+                for (auto&& g : groups)
+                    for (auto&& p : g.second->m_layer_profile)
+                        g.first += p.self_ticks;
+            }
+            groups.erase (std::remove_if (groups.begin(), groups.end(),
+                              [](const std::pair<long long,ShaderGroupRef> &g) {
+                                  return g.first == 0; }),
+                          groups.end());
+            std::stable_sort (groups.begin(), groups.end(),
+                              [](const std::pair<long long,ShaderGroupRef> &a,
+                                 const std::pair<long long,ShaderGroupRef> &b) {
+                                  return a.first > b.first; });
+            if (level < 2 && groups.size() > 5)
+                groups.resize (5);
+            for (auto&& g : groups) {
+                const ShaderGroup &group (*g.second);
+                std::vector<LayerProfile> prof;
+                {
+                    spin_lock lock (m_stat_mutex);
+                    prof = group.m_layer_profile;
+                }
+                std::vector<int> order;
+                for (int i = 0, e = std::min ((int)prof.size(), group.nlayers());  i < e;  ++i)
+                    if (prof[i].execs)
+                        order.push_back (i);
+                std::stable_sort (order.begin(), order.end(), [&](int a, int b) {
+                    return prof[a].self_ticks > prof[b].self_ticks; });
+                out << "    Layers of group "
+                    << (group.name().size() ? group.name().c_str() : "<unnamed group>")
+                    << " (self time, total time, runs):\n";
+                for (int i : order)
+                    out << "      " << Strutil::timeintervalformat(OIIO::Timer::seconds(prof[i].self_ticks), 2)
+                        << ", " << Strutil::timeintervalformat(OIIO::Timer::seconds(prof[i].ticks), 2)
+                        << ", " << prof[i].execs << ' ' << group[i]->layername() << "\n";
+            }
+        }
+
+        if (m_profile >= 3) {
+            // The call sites that took the most time, or all of them at
+            // stats level 5 and up.
+            std::vector<CallSite> sites;
+            {
+                spin_lock lock (m_stat_mutex);
+                for (auto&& s : m_call_sites)
+                    if (s.profile.calls)
+                        sites.push_back (s);
+            }
+            std::stable_sort (sites.begin(), sites.end(),
+                              [](const CallSite &a, const CallSite &b) {
+                                  return a.profile.ticks > b.profile.ticks; });
+            if (level < 5 && sites.size() > 20)
+                sites.resize (20);
+            if (sites.size())
+                out << "    Call sites (time, calls, failures):\n";
+            for (auto&& s : sites)
+                out << "      " << Strutil::timeintervalformat(OIIO::Timer::seconds(s.profile.ticks), 2)
+                    << ", " << s.profile.calls << ", " << s.profile.failures
+                    << ' ' << s.opname << " at " << s.sourcefile << ':'
+                    << s.sourceline << "\n";
+        }
+        if (m_profile >= 4)
+            out << profile_block_listing (level);
     }
 
     return out.str();
@@ -2517,6 +3826,62 @@ ShadingSystemImpl::ShaderGroupEnd (ShaderGroup& group)
     // std::cout << "Group " << group.name() << " ray query bits "
     //         << group.m_raytype_queries << "\n";
 
+    // Remember the group as specified, to make ray type variants from
+    if (m_raytype_variants > 0 && group.m_raytype_queries
+          && group.m_max_raytype_variants == 0) {
+        group.m_raytype_variant_spec = group.serialize ();
+        group.m_max_raytype_variants = m_raytype_variants;
+        group.m_raytype_variants.reset (
+            new std::pair<int,ShaderGroupRef> [m_raytype_variants]);
+    }
+    // ... and output variants
+    if (m_output_variants > 0 && group.m_max_output_variants == 0) {
+        group.m_output_variant_spec = group.serialize ();
+        group.m_max_output_variants = m_output_variants;
+        group.m_output_variants.reset (
+            new std::pair<std::vector<ustring>,ShaderGroupRef> [m_output_variants]);
+    }
+
+    // With debug_sample, remember the group as specified, to make the
+    // copy with the debug checks from
+    if (m_debug_sample > 0 && (m_debugnan || m_debug_uninit)
+          && ! group.m_is_debug_variant && group.m_debug_variant_spec.empty())
+        group.m_debug_variant_spec = group.serialize ();
+
+    // A group whose parameters ReParameter may yet change can't share
+    // its code, with other groups or other processes.
+    auto interactive = [&]() {
+        for (int layer = 0, n = group.nlayers(); layer < n; ++layer) {
+            const ShaderInstance *inst = group[layer];
+            for (int p = 0;  p < inst->lastparam();  ++p) {
+                const Symbol *s = inst->mastersymbol(p);
+                if ((s->symtype() == SymTypeParam
+                     || s->symtype() == SymTypeOutputParam)
+                      && ! inst->instoverride(p)->lockgeom())
+                    return true;
+            }
+        }
+        return false;
+    };
+
+    // With dedupe_groups, remember the group as specified, so that it can
+    // be matched against the others (see dedupe_group).
+    if (m_dedupe_groups && ! m_reparam_reoptimize
+          && group.m_max_raytype_variants >= 0 && ! group.m_dedupe_resolved
+          && ! interactive()) {
+        group.m_dedupe_spec = group.serialize ();
+        group.m_dedupe_hash = Strutil::strhash (group.m_dedupe_spec);
+    }
+
+    // With a JIT cache, the group's code may be waiting for it there.
+    if (jit_cache_enabled() && ! m_reparam_reoptimize
+          && group.m_max_raytype_variants >= 0 && group.m_jit_cache_key.empty()
+          && ! renderer()->supports ("OptiX") && ! interactive()) {
+        group.m_jit_cache_key = jit_cache_key (group,
+                                   group.m_dedupe_spec.size() ? group.m_dedupe_spec
+                                                              : group.serialize ());
+    }
+
     ustring groupname = group.name();
     if (groupname.size() && groupname == m_archive_groupname) {
         std::string filename = m_archive_filename.string();
@@ -2556,6 +3921,17 @@ ShadingSystemImpl::Shader (string_view shaderusage,
 bool
 ShadingSystemImpl::Shader (ShaderGroup& group, string_view shaderusage,
                            string_view shadername, string_view layername)
+{
+    return Shader (group, shaderusage, shadername, layername,
+                   cspan<ParamValue>());
+}
+
+
+
+bool
+ShadingSystemImpl::Shader (ShaderGroup& group, string_view shaderusage,
+                           string_view shadername, string_view layername,
+                           cspan<ParamValue> params)
 {
     ShaderMaster::ref master = loadshader (shadername);
     if (! master) {
@@ -2581,9 +3957,17 @@ ShadingSystemImpl::Shader (ShaderGroup& group, string_view shaderusage,
     }
 
     ShaderInstanceRef instance (new ShaderInstance (master, layername));
-    instance->parameters (group.m_pending_params);
-    group.m_pending_params.clear ();
-    group.m_pending_params.shrink_to_fit ();
+    if (group.m_pending_params.empty()) {
+        instance->parameters (params);
+    } else {
+        // The params given here come last, so they win.
+        for (auto&& p : params)
+            group.m_pending_params.push_back (p);
+        instance->parameters (cspan<ParamValue> (group.m_pending_params.data(),
+                                                 group.m_pending_params.size()));
+        group.m_pending_params.clear ();
+        group.m_pending_params.shrink_to_fit ();
+    }
 
     if (group.m_group_use.empty()) {
         // First in a group
@@ -2714,10 +4098,7 @@ ShadingSystemImpl::ConnectShaders (ShaderGroup& group,
         return false;
     }
 
-    dstinst->add_connection (srcinstindex, srccon, dstcon);
-    dstinst->instoverride(dstcon.param)->valuesource (Symbol::ConnectedVal);
-    srcinst->instoverride(srccon.param)->connected_down (true);
-    srcinst->outgoing_connections (true);
+    connect_layers (group, srcinstindex, srccon, dstinstindex, dstcon);
 
     // if (debug())
     //     message ("ConnectShaders %s %s -> %s %s\n",
@@ -2728,6 +4109,151 @@ ShadingSystemImpl::ConnectShaders (ShaderGroup& group,
 
 
 
+bool
+ShadingSystemImpl::ConnectShaders (ShaderGroup& group,
+                                   cspan<ShaderConnection> connections)
+{
+    // Check every connection before making any of them, so that a bad
+    // one leaves the group as it was.
+    struct Checked {
+        ConnectedParam src, dst;
+        bool structure;
+    };
+    std::vector<Checked> checked;
+    checked.reserve (connections.size());
+    int nlayers = group.m_group_use.empty() ? 0 : group.nlayers();
+    for (const ShaderConnection &c : connections) {
+        if (c.srclayer < 0 || c.srclayer >= nlayers ||
+              c.dstlayer < 0 || c.dstlayer >= nlayers) {
+            errorfmt("ConnectShaders: no such layer (tried to connect layer {} -> {} of {})\n"
+                     "        group: {}", c.srclayer, c.dstlayer, nlayers,
+                     group.name());
+            return false;
+        }
+        if (c.dstlayer <= c.srclayer) {
+            errorfmt("ConnectShaders: destination layer must follow source layer (tried to connect layer {} -> {})\n"
+                     "        group: {}", c.srclayer, c.dstlayer, group.name());
+            return false;
+        }
+        ConnectedParam srccon = decode_connected_param (group, c.srclayer,
+                                    c.srcparam, c.srcarrayindex, c.srcchannel);
+        ConnectedParam dstcon = decode_connected_param (group, c.dstlayer,
+                                    c.dstparam, c.dstarrayindex, c.dstchannel);
+        if (! (srccon.valid() && dstcon.valid()))
+            return false;
+
+        const ShaderInstance *srcinst = group[c.srclayer];
+        const ShaderInstance *dstinst = group[c.dstlayer];
+        const Symbol *srcsym = srcinst->mastersymbol (srccon.param);
+        const Symbol *dstsym = dstinst->mastersymbol (dstcon.param);
+        bool structure = srccon.type.is_structure() &&
+                         dstcon.type.is_structure() &&
+                         equivalent (srccon.type, dstcon.type);
+        if (! structure && ! assignable (dstcon.type, srccon.type)) {
+            if (connection_error())
+                errorfmt("ConnectShaders: cannot connect a {} ({}.{}) to a {} ({}.{})\n"
+                         "        group: {}",
+                         srccon.type, srcinst->layername(), srcsym->name(),
+                         dstcon.type, dstinst->layername(), dstsym->name(),
+                         group.name());
+            else
+                warningfmt("ConnectShaders: cannot connect a {} ({}.{}) to a {} ({}.{})\n"
+                           "        group: {}",
+                           srccon.type, srcinst->layername(), srcsym->name(),
+                           dstcon.type, dstinst->layername(), dstsym->name(),
+                           group.name());
+            return false;
+        }
+        if (! dstsym->allowconnect()) {
+            errorfmt("ConnectShaders: cannot connect to {}.{} because it has metadata allowconnect=0\n"
+                     "        group: {}", dstinst->layername(), dstsym->name(),
+                     group.name());
+            return false;
+        }
+        checked.push_back (Checked { srccon, dstcon, structure });
+    }
+
+    for (size_t i = 0;  i < checked.size();  ++i) {
+        const ShaderConnection &c (connections[i]);
+        const Checked &k (checked[i]);
+        if (k.structure) {
+            // Whole structs are rare; let the named form break them
+            // into their fields.
+            ShaderInstance *srcinst = group[c.srclayer];
+            ShaderInstance *dstinst = group[c.dstlayer];
+            ConnectShaders (group, srcinst->layername(),
+                            srcinst->mastersymbol(k.src.param)->name(),
+                            dstinst->layername(),
+                            dstinst->mastersymbol(k.dst.param)->name());
+            continue;
+        }
+        connect_layers (group, c.srclayer, k.src, c.dstlayer, k.dst);
+    }
+    return true;
+}
+
+
+
+void
+ShadingSystemImpl::connect_layers (ShaderGroup& group,
+                                   int srclayer, const ConnectedParam &srccon,
+                                   int dstlayer, const ConnectedParam &dstcon)
+{
+    ShaderInstance *srcinst = group[srclayer];
+    ShaderInstance *dstinst = group[dstlayer];
+    dstinst->add_connection (srclayer, srccon, dstcon);
+    dstinst->instoverride(dstcon.param)->valuesource (Symbol::ConnectedVal);
+    srcinst->instoverride(srccon.param)->connected_down (true);
+    srcinst->outgoing_connections (true);
+}
+
+
+
+namespace {
+
+// A parameter of a group specification awaiting its "shader" statement.
+// Its values stay in the parser's arrays until then, and are handed to
+// the new instance by pointer rather than copied into the group's pending
+// ParamValueList first.
+struct GroupSpecParam {
+    ustring name;
+    TypeDesc type;
+    bool lockgeom;
+    size_t offset;    // into the values of the type's basetype
+};
+
+
+// Parse a parameter name, which may be dotted (struct members), returning
+// a view of the spec itself, except in the unusual case of whitespace
+// around the dots, when the pieces are joined in scratch.
+string_view
+parse_param_name (string_view &p, std::string &scratch)
+{
+    Strutil::skip_whitespace (p);
+    const char *begin = p.data();
+    Strutil::parse_identifier (p);
+    for (;;) {
+        string_view q = p;
+        Strutil::skip_whitespace (q);
+        if (! Strutil::parse_char (q, '.'))
+            break;
+        p = q;
+        Strutil::parse_identifier (p);
+    }
+    string_view name (begin, size_t(p.data() - begin));
+    if (name.find_first_of (" \t\r\n") == string_view::npos)
+        return name;
+    scratch.clear ();
+    for (char c : name)
+        if (! isspace ((unsigned char)c))
+            scratch += c;
+    return scratch;
+}
+
+}  // anon namespace
+
+
+
 ShaderGroupRef
 ShadingSystemImpl::ShaderGroupBegin (string_view groupname,
                                      string_view usage,
@@ -2737,9 +4263,35 @@ ShadingSystemImpl::ShaderGroupBegin (string_view groupname,
     bool err = false;
     std::string errdesc;
     string_view errstatement;
+    // Values of all the params for the next shader, back to back
     std::vector<int> intvals;
     std::vector<float> floatvals;
     std::vector<ustring> stringvals;
+    std::vector<GroupSpecParam> specparams;
+    ParamValueList paramvals;
+    std::string scratch;
+    // Param names and string values repeat a lot within a group (think
+    // many layers of the same shader), so intern them through a local
+    // table rather than going to the global ustring table for each.
+    UstringCache strings;
+    // Point ParamValues at the values of the params seen since the last
+    // shader (the value arrays won't move again until they're cleared).
+    auto bind_params = [&]() {
+        paramvals.clear ();
+        paramvals.reserve (specparams.size());
+        for (auto&& sp : specparams) {
+            const void *data = sp.type.basetype == TypeDesc::INT
+                                   ? (const void *)&intvals[sp.offset]
+                             : sp.type.basetype == TypeDesc::FLOAT
+                                   ? (const void *)&floatvals[sp.offset]
+                                   : (const void *)&stringvals[sp.offset];
+            paramvals.emplace_back (sp.name, sp.type, 1,
+                                    sp.lockgeom ? ParamValue::INTERP_CONSTANT
+                                                : ParamValue::INTERP_VERTEX,
+                                    data, /*copy=*/false);
+        }
+        specparams.clear ();
+    };
     string_view p = groupspec;   // parse view
     // std::cout << "!!!!!\n---\n" << groupspec << "\n---\n\n";
     while (p.size()) {
@@ -2755,7 +4307,13 @@ ShadingSystemImpl::ShaderGroupBegin (string_view groupname,
             string_view shadername = Strutil::parse_identifier (p);
             Strutil::skip_whitespace (p);
             string_view layername = Strutil::parse_until (p, " \t\r\n,;");
-            bool ok = Shader (*g, usage, shadername, layername);
+            bind_params ();
+            bool ok = Shader (*g, usage, shadername, layername,
+                              cspan<ParamValue> (paramvals.data(),
+                                                 paramvals.size()));
+            intvals.clear ();
+            floatvals.clear ();
+            stringvals.clear ();
             if (!ok) {
                 errstatement = pstart;
                 err = true;
@@ -2829,29 +4387,17 @@ ShadingSystemImpl::ShaderGroupBegin (string_view groupname,
             Strutil::parse_char (p, ']');
             type.arraylen = arraylen;
         }
-        std::string paramname_string;
-        while (1) {
-            paramname_string += Strutil::parse_identifier (p);
-            Strutil::skip_whitespace (p);
-            if (Strutil::parse_char (p, '.')) {
-                paramname_string += ".";
-            } else {
-                break;
-            }
-        }
-        string_view paramname (paramname_string);
+        string_view paramname = parse_param_name (p, scratch);
         int lockgeom = m_lockgeom_default;
-        // For speed, reserve space. Note that for "unsized" arrays, we only
-        // preallocate 1 slot and let it grow as needed. That's ok. For
-        // everything else, we will reserve the right amount up front.
-        int vals_to_preallocate = type.is_unsized_array()
-                                ? 1 : type.numelements() * type.aggregate;
         // Stop parsing values when we hit the limit based on the
-        // declaration.
-        int max_vals = type.is_unsized_array() ? 1<<28 : vals_to_preallocate;
+        // declaration. Values are appended to those of the earlier params
+        // of this shader.
+        int max_vals = type.is_unsized_array() ? 1<<28
+                                               : type.numelements() * type.aggregate;
+        size_t offset = 0;
         if (type.basetype == TypeDesc::INT) {
-            intvals.clear ();
-            intvals.reserve (vals_to_preallocate);
+            offset = intvals.size();
+            intvals.reserve (offset + std::min (max_vals, 16));
             int i;
             for (i = 0; i < max_vals; ++i) {
                 int val = 0;
@@ -2866,11 +4412,10 @@ ShadingSystemImpl::ShaderGroupBegin (string_view groupname,
                 type.arraylen = std::max (1, i/type.aggregate);
             }
             // Zero-pad if we parsed fewer values than we needed
-            intvals.resize (type.numelements()*type.aggregate, 0);
-            OSL_DASSERT (int(type.numelements())*type.aggregate == int(intvals.size()));
+            intvals.resize (offset + type.numelements()*type.aggregate, 0);
         } else if (type.basetype == TypeDesc::FLOAT) {
-            floatvals.clear ();
-            floatvals.reserve (vals_to_preallocate);
+            offset = floatvals.size();
+            floatvals.reserve (offset + std::min (max_vals, 16));
             int i;
             for (i = 0; i < max_vals; ++i) {
                 float val = 0;
@@ -2885,28 +4430,28 @@ ShadingSystemImpl::ShaderGroupBegin (string_view groupname,
                 type.arraylen = std::max (1, i/type.aggregate);
             }
             // Zero-pad if we parsed fewer values than we needed
-            floatvals.resize (type.numelements()*type.aggregate, 0);
-            OSL_DASSERT (int(type.numelements())*type.aggregate == int(floatvals.size()));
+            floatvals.resize (offset + type.numelements()*type.aggregate, 0);
         } else if (type.basetype == TypeDesc::STRING) {
-            stringvals.clear ();
-            stringvals.reserve (vals_to_preallocate);
+            offset = stringvals.size();
             int i;
             for (i = 0; i < max_vals; ++i) {
-                std::string unescaped;
                 string_view s;
                 Strutil::skip_whitespace (p);
                 if (p.size() && p[0] == '\"') {
                     if (! Strutil::parse_string (p, s))
                         break;
-                    unescaped = Strutil::unescape_chars (s);
-                    s = unescaped;
+                    // Only strings with escapes need a copy to unescape
+                    if (s.find ('\\') != string_view::npos)
+                        stringvals.emplace_back (Strutil::unescape_chars (s));
+                    else
+                        stringvals.push_back (strings (s));
                 }
                 else {
                     s = Strutil::parse_until (p, " \t\r\n;");
                     if (s.size() == 0)
                         break;
+                    stringvals.push_back (strings (s));
                 }
-                stringvals.emplace_back(s);
             }
             if (type.is_unsized_array()) {
                 // For unsized arrays, now set the size based on how many
@@ -2914,8 +4459,8 @@ ShadingSystemImpl::ShaderGroupBegin (string_view groupname,
                 type.arraylen = std::max (1, i/type.aggregate);
             }
             // Zero-pad if we parsed fewer values than we needed
-            stringvals.resize (type.numelements()*type.aggregate, ustring());
-            OSL_DASSERT (int(type.numelements())*type.aggregate == int(stringvals.size()));
+            stringvals.resize (offset + type.numelements()*type.aggregate,
+                               ustring());
         }
 
         if (Strutil::parse_prefix (p, "[[")) {  // hints
@@ -2956,19 +4501,8 @@ ShadingSystemImpl::ShaderGroupBegin (string_view groupname,
             }
         }
 
-        bool ok = true;
-        if (type.basetype == TypeDesc::INT) {
-            ok = Parameter (*g, paramname, type, &intvals[0], lockgeom);
-        } else if (type.basetype == TypeDesc::FLOAT) {
-            ok = Parameter (*g, paramname, type, &floatvals[0], lockgeom);
-        } else if (type.basetype == TypeDesc::STRING) {
-            ok = Parameter (*g, paramname, type, &stringvals[0], lockgeom);
-        }
-        if (!ok) {
-            errstatement = pstart;
-            err = true;
-            break;
-        }
+        specparams.push_back ({ strings (paramname), type, lockgeom != 0,
+                                offset });
 
         Strutil::skip_whitespace (p);
         if (! p.size())
@@ -2984,6 +4518,15 @@ ShadingSystemImpl::ShaderGroupBegin (string_view groupname,
         }
     }
 
+    // Params after the last shader are left pending for the next one, as
+    // if Parameter() had been called.
+    if (! err && specparams.size()) {
+        bind_params ();
+        for (auto&& pv : paramvals)
+            Parameter (*g, pv.name(), pv.type(), pv.data(),
+                       pv.interp() == ParamValue::INTERP_CONSTANT);
+    }
+
     if (err) {
         std::string msg = Strutil::sprintf(
                 "ShaderGroupBegin: error parsing group description: %s\n"
@@ -3032,7 +4575,43 @@ ShadingSystemImpl::ReParameter (ShaderGroup &group, string_view layername_,
     if (paramindex < 0)
         return false;   // could not find the named parameter
 
+    // With reparam_reoptimize, a parameter that the optimizer may have
+    // specialized on (or folded away altogether) can still be changed, by
+    // going back to the group as it was before it was optimized.
     Symbol *sym = layer->symbol (paramindex);
+    if (group.optimized() && layer->can_unoptimize()
+          && (!sym || sym->name() != paramname || sym->lockgeom())) {
+        const ShaderMaster *master = layer->master();
+        paramindex = master->findsymbol (ustring(paramname));
+        const Symbol *msym = master->symbol (paramindex);
+        if (! msym || (msym->symtype() != SymTypeParam &&
+                       msym->symtype() != SymTypeOutputParam)
+              || msym->typespec().is_closure_based()
+              || !equivalent(msym->typespec(), type))
+            return false;
+        // Neither JIT may be reading the group while it's undone
+        lock_guard lock (group.m_mutex);
+        lock_guard jit_lock (group.m_jit_mutex);
+        lock_guard batch_jit_lock (group.m_batch_jit_mutex);
+        if (group.optimized())
+            unoptimize_group (group);
+        // Now set it the way Parameter() would have.
+        ShaderInstance::SymOverrideInfo &so (layer->m_instoverrides[paramindex]);
+        so.valuesource (Symbol::InstanceVal);
+        if (type.basetype == TypeDesc::STRING) {
+            ustring *dst = (ustring *) layer->param_storage (paramindex);
+            for (int i = 0, n = int(type.numelements() * type.aggregate); i < n; ++i)
+                dst[i] = ustring (((const char **)val)[i]);
+        } else {
+            memcpy (layer->param_storage (paramindex), val, type.size());
+        }
+        if (so.lockgeom() && ! so.arraylen()
+              && ! memcmp (master->param_default_storage (paramindex),
+                           layer->param_storage (paramindex), type.size()))
+            so.valuesource (Symbol::DefaultVal);
+        return true;
+    }
+
     if (!sym) {
         // Can have a paramindex >= 0, but no symbol when it's a master-symbol
         OSL_DASSERT(layer->mastersymbol(paramindex) && "No symbol for paramindex");
@@ -3055,10 +4634,36 @@ ShadingSystemImpl::ReParameter (ShaderGroup &group, string_view layername_,
 
 
 
+// The NUMA node of the CPU the calling thread is running on, or 0 if that
+// can't be told.
+static int
+current_numa_node ()
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned int cpu = 0, node = 0;
+    if (syscall (SYS_getcpu, &cpu, &node, nullptr) == 0)
+        return int(node);
+#endif
+    return 0;
+}
+
+
+
+int
+ShadingSystemImpl::spare_list (int numa_node) const
+{
+    return m_numa_local ? numa_node % max_numa_nodes : 0;
+}
+
+
+
 PerThreadInfo *
 ShadingSystemImpl::create_thread_info()
 {
-    return new PerThreadInfo;
+    PerThreadInfo *threadinfo = new PerThreadInfo;
+    if (m_numa_local)
+        threadinfo->numa_node = current_numa_node ();
+    return threadinfo;
 }
 
 
@@ -3066,11 +4671,68 @@ ShadingSystemImpl::create_thread_info()
 void
 ShadingSystemImpl::destroy_thread_info (PerThreadInfo *threadinfo)
 {
+    if (! threadinfo)
+        return;
+    // Hand its contexts over to the spare list, rather than deleting them,
+    // so the next thread to need one (maybe one that lives only for a
+    // single task) finds it already made and warmed up. With numa_local,
+    // that's the list of the thread's node, whose memory they're in.
+    auto &pool (threadinfo->context_pool);
+    if (! pool.empty()) {
+        for (ShadingContext *ctx : pool)
+            ctx->thread_info (nullptr);
+        push_spare_contexts (spare_list (threadinfo->numa_node), pool);
+        pool.clear ();
+    }
     delete threadinfo;
 }
 
 
 
+void
+ShadingSystemImpl::push_spare_contexts (int list,
+                                        cspan<ShadingContext *> contexts)
+{
+    auto &spares (m_spare_contexts[list]);
+    spin_lock lock (spares.mutex);
+    spares.contexts.insert (spares.contexts.end(), contexts.begin(),
+                            contexts.end());
+}
+
+
+
+ShadingContext *
+ShadingSystemImpl::pop_spare_context (int list)
+{
+    auto &spares (m_spare_contexts[list]);
+    spin_lock lock (spares.mutex);
+    if (spares.contexts.empty())
+        return nullptr;
+    ShadingContext *ctx = spares.contexts.back();
+    spares.contexts.pop_back ();
+    return ctx;
+}
+
+
+
+void
+ShadingSystemImpl::reserve_contexts (int count, size_t heapsize)
+{
+    std::vector<ShadingContext *> contexts;
+    contexts.reserve (std::max (count, 0));
+    for (int i = 0; i < count; ++i) {
+        ShadingContext *ctx = new ShadingContext (*this, nullptr);
+        ctx->thread_info (nullptr);
+        ctx->reserve_heap (heapsize);
+        contexts.push_back (ctx);
+    }
+    // With numa_local these go on a list of their own: nothing has touched
+    // their heaps yet, so they're local to whichever thread claims them.
+    push_spare_contexts (m_numa_local ? max_numa_nodes : 0, contexts);
+}
+
+
+
 ShadingContext *
 ShadingSystemImpl::get_context (PerThreadInfo *threadinfo,
                                 TextureSystem::Perthread *texture_threadinfo)
@@ -3084,9 +4746,14 @@ ShadingSystemImpl::get_context (PerThreadInfo *threadinfo,
         return nullptr;
 #endif
     }
-    ShadingContext *ctx = threadinfo->context_pool.empty()
-                          ? new ShadingContext (*this, threadinfo)
-                          : threadinfo->pop_context ();
+    ShadingContext *ctx = nullptr;
+    if (! threadinfo->context_pool.empty())
+        ctx = threadinfo->pop_context ();
+    else if ((ctx = pop_spare_context (spare_list (threadinfo->numa_node)))
+             || (m_numa_local && (ctx = pop_spare_context (max_numa_nodes))))
+        ctx->thread_info (threadinfo);
+    else
+        ctx = new ShadingContext (*this, threadinfo);
     ctx->texture_thread_info (texture_threadinfo);
     return ctx;
 }
@@ -3099,7 +4766,11 @@ ShadingSystemImpl::release_context (ShadingContext *ctx)
     if (! ctx)
         return;
     ctx->process_errors ();
-    ctx->thread_info()->context_pool.push (ctx);
+    ctx->merge_stats ();
+    // A pooled context must not keep its last group's code from being
+    // evicted (or point at it after it's freed).
+    ctx->release_group ();
+    ctx->thread_info()->context_pool.push_back (ctx);
 }
 
 
@@ -3110,12 +4781,34 @@ ShadingSystemImpl::execute(ShadingContext& ctx, ShaderGroup& group,
                            void* userdata_base_ptr, void* output_base_ptr,
                            bool run)
 {
+    if (m_capturing && run && ! ctx.replaying()) {
+        // Record the globals as they came in, before the shaders have a
+        // chance to change them.
+        ShaderGlobals sg = ssg;
+        ctx.begin_capture ();
+        bool ok = ctx.execute (group, index, ssg, userdata_base_ptr,
+                               output_base_ptr, run);
+        capture_point (ctx, group, index, sg);
+        return ok;
+    }
     return ctx.execute(group, index, ssg, userdata_base_ptr, output_base_ptr,
                        run);
 }
 
 
 
+bool
+ShadingSystemImpl::execute_many (ShadingContext &ctx, ShaderGroup &group,
+                                 span<ShaderGlobals> globals,
+                                 cspan<int> shadeindices,
+                                 void* userdata_base_ptr, void* output_base_ptr)
+{
+    return ctx.execute_many (group, globals, shadeindices, userdata_base_ptr,
+                             output_base_ptr);
+}
+
+
+
 const void *
 ShadingSystemImpl::get_symbol (ShadingContext &ctx, ustring layername,
                                ustring symbolname, TypeDesc &type)
@@ -3245,6 +4938,56 @@ ShadingSystemImpl::decode_connected_param (string_view connectionname,
 
 
 
+ConnectedParam
+ShadingSystemImpl::decode_connected_param (ShaderGroup& group, int layer,
+                                           int param, int arrayindex,
+                                           int channel)
+{
+    ConnectedParam c;  // initializes to "invalid"
+    ShaderInstance *inst = group[layer];
+
+    // Parameter indices count from the first parameter, as OSLQuery
+    // lists them.
+    int sym = inst->firstparam() + param;
+    if (param < 0 || sym >= inst->lastparam()) {
+        errorfmt("ConnectShaders: layer \"{}\" (shader \"{}\") has no parameter {}\n"
+                 "        group: {}",
+                 inst->layername(), inst->shadername(), param, group.name());
+        return c;
+    }
+    c.type = inst->mastersymbol(sym)->typespec();
+
+    if (arrayindex >= 0) {
+        if (! c.type.is_array() || arrayindex >= c.type.arraylength()) {
+            errorfmt("ConnectShaders: cannot request array element {} from a {} ({}.{})\n"
+                     "        group: {}", arrayindex, c.type, inst->layername(),
+                     inst->mastersymbol(sym)->name(), group.name());
+            return c;
+        }
+        c.arrayindex = arrayindex;
+        c.type.make_array (0);              // chop to the element type
+    }
+
+    if (channel >= 0) {
+        if (c.type.is_closure() || c.type.is_structure() || c.type.is_array() ||
+              c.type.aggregate() == TypeDesc::SCALAR ||
+              channel >= (int)c.type.aggregate()) {
+            errorfmt("ConnectShaders: cannot request component {} from a {} ({}.{})\n"
+                     "        group: {}", channel, c.type, inst->layername(),
+                     inst->mastersymbol(sym)->name(), group.name());
+            return c;
+        }
+        c.channel = channel;
+        // chop to just the scalar part
+        c.type = TypeSpec ((TypeDesc::BASETYPE)c.type.simpletype().basetype);
+    }
+
+    c.param = sym;
+    return c;
+}
+
+
+
 int
 ShadingSystemImpl::raytype_bit (ustring name)
 {
@@ -3256,11 +4999,126 @@ ShadingSystemImpl::raytype_bit (ustring name)
 
 
 
+OptPreset
+ShadingSystemImpl::llvm_opt_preset (const ShaderGroup &group) const
+{
+    if (group.m_llvm_opt_preset != OptPreset::UNKNOWN)
+        return group.m_llvm_opt_preset;
+    return m_llvm_opt_preset;
+}
+
+
+
+MathPrecision
+ShadingSystemImpl::math_precision (const ShaderGroup &group) const
+{
+    if (group.m_math_precision != MathPrecision::UNKNOWN)
+        return group.m_math_precision;
+    return m_math_precision;
+}
+
+
+
+const char *
+ShadingSystemImpl::math_precision_prefix (const ShaderGroup &group,
+                                          ustring opname) const
+{
+    // The ops with "fast_" and "accurate_" variants in llvm_ops.cpp and
+    // wide_optrigonometric.cpp / wide_optranscendental.cpp.
+    static const ustring precision_ops[] = {
+        ustring("sin"), ustring("cos"), ustring("tan"), ustring("asin"),
+        ustring("acos"), ustring("atan"), ustring("atan2"), ustring("sinh"),
+        ustring("cosh"), ustring("tanh"), ustring("log"), ustring("log2"),
+        ustring("log10"), ustring("exp"), ustring("exp2"), ustring("expm1"),
+        ustring("pow"), ustring("erf"), ustring("erfc"), ustring("cbrt")
+    };
+    MathPrecision precision = math_precision (group);
+    if (precision == MathPrecision::DEFAULT
+        || std::find (std::begin(precision_ops), std::end(precision_ops),
+                      opname) == std::end(precision_ops))
+        return "";
+    return precision == MathPrecision::FAST ? "fast_" : "accurate_";
+}
+
+
+
+int
+ShadingSystemImpl::batch_width (const ShaderGroup &group) const
+{
+    if (group.m_batch_width)
+        return group.m_batch_width;
+    if (group.batch_jitted())
+        return group.batch_jitted();
+
+    // Ops whose wide implementations go a lane at a time -- calls out to
+    // the renderer, string handling, closures -- gain nothing from more
+    // lanes, and only make the masked-off ones cost more.
+    static const ustring serial_ops[] = {
+        ustring("texture"), ustring("texture3d"), ustring("environment"),
+        ustring("gettextureinfo"), ustring("getattribute"),
+        ustring("getmessage"), ustring("setmessage"), ustring("trace"),
+        ustring("pointcloud_search"), ustring("pointcloud_get"),
+        ustring("pointcloud_write"), ustring("closure"), ustring("concat"),
+        ustring("format"), ustring("printf"), ustring("error"),
+        ustring("warning"), ustring("regex_search"), ustring("regex_match"),
+        ustring("dict_find"), ustring("dict_value")
+    };
+    static const ustring op_nop ("nop"), op_end ("end");
+    size_t nops = 0, nserial = 0;
+    int peak_live = 0;
+    for (int layer = 0;  layer < group.nlayers();  ++layer) {
+        const ShaderInstance *inst = group[layer];
+        if (inst->unused())
+            continue;
+        const OpcodeVec &ops (inst->ops());
+        for (const Opcode &op : ops) {
+            if (op.opname() == op_nop || op.opname() == op_end)
+                continue;
+            ++nops;
+            if (std::find (std::begin(serial_ops), std::end(serial_ops),
+                           op.opname()) != std::end(serial_ops))
+                ++nserial;
+        }
+        // The most float values the layer holds at once, each of which
+        // is a whole vector register per component when run wide.
+        std::vector<int> live (ops.size() + 1, 0);
+        for (const Symbol &s : inst->symbols()) {
+            if ((s.symtype() != SymTypeLocal && s.symtype() != SymTypeTemp)
+                  || ! s.everused()
+                  || s.typespec().simpletype().basetype != TypeDesc::FLOAT)
+                continue;
+            const TypeDesc t = s.typespec().simpletype();
+            int n = int(t.aggregate * std::max (t.arraylen, 1))
+                    * (s.has_derivs() ? 3 : 1);
+            live[std::max (s.firstuse(), 0)] += n;
+            live[std::min (s.lastuse() + 1, (int)ops.size())] -= n;
+        }
+        int count = 0;
+        for (int n : live)
+            peak_live = std::max (peak_live, count += n);
+    }
+
+    // Mostly lane-at-a-time work, or more live values than the 32 vector
+    // registers of AVX-512 (at 16 wide they are whole zmm registers, and
+    // two apiece on narrower targets), run better 8 wide.
+    if (nserial * 4 >= nops || peak_live > 32)
+        return 8;
+    return 16;
+}
+
+
+
 bool
 ShadingSystemImpl::is_renderer_output (ustring layername, ustring paramname,
                                        ShaderGroup *group) const
 {
     ustring name2 = ustring::fmtformat("{}.{}", layername, paramname);
+    if (group && ! group->m_output_subset.empty()) {
+        // An output variant makes just the outputs it was asked for
+        const std::vector<ustring> &subset (group->m_output_subset);
+        return std::find(subset.begin(), subset.end(), paramname) != subset.end()
+            || std::find(subset.begin(), subset.end(), name2) != subset.end();
+    }
     if (group) {
         for (auto&& sl : group->m_symlocs) {
             if (sl.arena == SymArena::Outputs &&
@@ -3289,6 +5147,87 @@ ShadingSystemImpl::is_renderer_output (ustring layername, ustring paramname,
 
 
 
+std::string
+ShadingSystemImpl::jit_cache_key (const ShaderGroup &group,
+                                  const std::string &spec)
+{
+    // Besides the group itself: the builds of its shaders, and whatever
+    // else decides what code it gets and for which ISAs.
+    std::string key = fmtformat ("OSL JIT cache {} llvm {} isas {} target {} O{} opt {} preset {} debug {}{}\n",
+                                 OSL_LIBRARY_VERSION_CODE, OSL_LLVM_VERSION,
+                                 m_llvm_aot_isas, m_llvm_jit_target,
+                                 m_llvm_optimize, m_optimize,
+                                 int(llvm_opt_preset (group)),
+                                 int(debug_nan (group)), int(debug_uninit (group)));
+    for (int layer = 0;  layer < group.nlayers();  ++layer)
+        key += fmtformat ("shader {} {:x}\n", group[layer]->master()->shadername(),
+                          group[layer]->master()->code_hash());
+    for (auto&& name : m_renderer_outputs)
+        key += fmtformat ("output {}\n", name);
+    key += spec;
+    return key;
+}
+
+
+
+bool
+ShadingSystemImpl::jit_cache_fetch (ShaderGroup &group)
+{
+    if (m_jit_cache_fetch) {
+        if (m_jit_cache_fetch (group.m_jit_cache_key, group.m_llvm_aot_object))
+            return true;
+        group.m_llvm_aot_object.clear ();
+        return false;
+    }
+    return jit_cache_map (group);
+}
+
+
+
+bool
+ShadingSystemImpl::jit_cache_map (ShaderGroup &group)
+{
+    // A cache file is the key, for checking, followed by the object. It's
+    // used in place, so every process using it shares the same pages.
+    const std::string &key (group.m_jit_cache_key);
+    std::string filename = fmtformat ("{}/{:016x}.oslobj", m_jit_cache_dir,
+                                      uint64_t(Strutil::strhash (key)));
+    std::string err;
+    std::shared_ptr<MappedFile> file = MappedFile::open (filename, err);
+    if (! file || ! Strutil::starts_with (file->contents(), key)
+          || file->size() == key.size())
+        return false;
+    group.m_llvm_aot_file = file;
+    group.m_llvm_aot_mapped = file->contents().substr (key.size());
+    return true;
+}
+
+
+
+void
+ShadingSystemImpl::jit_cache_store (const std::string &key,
+                                    const std::string &object)
+{
+    if (m_jit_cache_fetch) {
+        if (m_jit_cache_store)
+            m_jit_cache_store (key, object);
+        return;
+    }
+    std::string filename = fmtformat ("{}/{:016x}.oslobj", m_jit_cache_dir,
+                                      uint64_t(Strutil::strhash (key)));
+    // Write to a temporary and rename, so that another process never
+    // reads a half-written file.
+    std::string tmpname = OIIO::Filesystem::unique_path (filename + ".%%%%%%.tmp");
+    std::string err;
+    if (! OIIO::Filesystem::write_text_file (tmpname, key + object)
+          || ! OIIO::Filesystem::rename (tmpname, filename, err)) {
+        OIIO::Filesystem::remove (tmpname, err);
+        warningfmt ("Could not write JIT cache file \"{}\"", filename);
+    }
+}
+
+
+
 void
 ShadingSystemImpl::group_post_jit_cleanup (ShaderGroup &group)
 {
@@ -3298,12 +5237,9 @@ ShadingSystemImpl::group_post_jit_cleanup (ShaderGroup &group)
     size_t connectionmem = 0;
     for (int layer = 0;  layer < group.nlayers();  ++layer) {
         ShaderInstance *inst = group[layer];
-        // We no longer needs ops and args -- create empty vectors and
-        // swap with the ones in the instance.
-        OpcodeVec emptyops;
-        inst->ops().swap (emptyops);
-        std::vector<int> emptyargs;
-        inst->args().swap (emptyargs);
+        // We no longer needs ops and args -- drop our hold on them (they
+        // may still be shared with the master or the optimizer's memo).
+        inst->clear_code ();
         if (inst->unused()) {
             // If we'll never use the layer, we don't need the syms at all
             SymbolVec nosyms;
@@ -3337,8 +5273,15 @@ ShadingSystemImpl::optimize_group (ShaderGroup &group, ShadingContext *ctx, bool
     if (group.optimized() && (!do_jit || group.jitted()))
         return;    // already optimized and optionally jitted
 
+    // A group identical to one already seen gets that one's code
+    ShaderGroup &leader (dedupe_group (group));
+    if (&leader != &group) {
+        optimize_group (leader, ctx, do_jit);
+        return;
+    }
+
     OIIO::Timer timer;
-    lock_guard lock (group.m_mutex);
+    std::unique_lock<mutex> lock (group.m_mutex);
     bool need_jit = do_jit && !group.jitted();
     if (group.optimized() && !need_jit) {
         // The group was somehow optimized by another thread between the
@@ -3376,17 +5319,46 @@ ShadingSystemImpl::optimize_group (ShaderGroup &group, ShadingContext *ctx, bool
         ctx_allocated = true;
     }
     if (!group.optimized()) {
+        // Keep what's needed to optimize it again after ReParameter,
+        // after it's evicted to stay under max_jit_memory_MB, or after
+        // reload_shader.
+        if (m_reparam_reoptimize || m_max_jit_memory_MB > 0
+              || m_allow_shader_replacement)
+            for (int layer = 0;  layer < group.nlayers();  ++layer)
+                group[layer]->save_unoptimized ();
         RuntimeOptimizer rop (*this, group, ctx);
         rop.run ();
         rop.police_failed_optimizations();
 
+        // No more symbols will be added, so give back the spare room that
+        // make_symbol_room left for the optimizer. This must happen before
+        // the group is marked optimized, since find_symbol hands out
+        // pointers into these vectors that must stay valid.
+        off_t symslack = 0;
+        for (int layer = 0;  layer < group.nlayers();  ++layer) {
+            SymbolVec &syms (group[layer]->symbols());
+            off_t before = vectorbytes (syms);
+            syms.shrink_to_fit ();
+            symslack += before - vectorbytes (syms);
+        }
+        {
+            spin_lock stat_lock (m_stat_mutex);
+            m_stat_mem_inst_syms -= symslack;
+            m_stat_mem_inst -= symslack;
+            m_stat_memory -= symslack;
+        }
+
         // Copy some info recorded by the RuntimeOptimizer into the group
         group.m_unknown_textures_needed = rop.m_unknown_textures_needed;
         for (auto&& f : rop.m_textures_needed)
             group.m_textures_needed.push_back (f);
         group.m_unknown_closures_needed = rop.m_unknown_closures_needed;
+        group.m_closure_pool_size = rop.m_closure_pool_size;
         for (auto&& f : rop.m_closures_needed)
             group.m_closures_needed.push_back (f);
+        group.m_unknown_pointclouds_needed = rop.m_unknown_pointclouds_needed;
+        for (auto&& f : rop.m_pointclouds_needed)
+            group.m_pointclouds_needed.push_back (f);
         for (auto&& f : rop.m_globals_needed)
             group.m_globals_needed.push_back (f);
         group.m_globals_read = rop.m_globals_read;
@@ -3410,6 +5382,7 @@ ShadingSystemImpl::optimize_group (ShaderGroup &group, ShadingContext *ctx, bool
             group.m_attributes_needed.push_back (f.name);
             group.m_attribute_scopes.push_back (f.scope);
         }
+        group.build_symbol_index ();
         group.m_optimized = true;
 
         spin_lock stat_lock (m_stat_mutex);
@@ -3422,24 +5395,111 @@ ShadingSystemImpl::optimize_group (ShaderGroup &group, ShadingContext *ctx, bool
         m_stat_specialization_time += rop.m_stat_specialization_time;
     }
 
+    // Trade the optimizer's lock for the scalar JIT's, so that a batched
+    // JIT of the group may go on alongside this one.
+    std::unique_lock<mutex> jit_lock (group.m_jit_mutex, std::defer_lock);
+    if (need_jit) {
+        OIIO::Timer jit_lock_timer;
+        jit_lock.lock ();
+        if (group.jitted()) {
+            // Another thread JITed the group while we waited for the
+            // lock, which means it was already optimized before we came.
+            jit_lock.unlock ();
+            lock.unlock ();
+            if (ctx_allocated) {
+                release_context(ctx);
+                destroy_thread_info(thread_info);
+            }
+            spin_lock stat_lock (m_stat_mutex);
+            double t = timer();
+            m_stat_optimization_time += t;
+            m_stat_opt_locking_time += t;
+            return;
+        }
+        locking_time += jit_lock_timer();
+    }
+    lock.unlock ();
+
+    // In tiered mode, get the group shading as soon as possible by
+    // JITing it with next to no LLVM optimization, and then re-JIT it at
+    // the requested llvm_optimize level in the background.
+    OptPreset preset = llvm_opt_preset (group);
+    // With a JIT cache, another process may have compiled the group
+    // already. If not, compile it to an object too, to leave it there.
+    bool jit_cache_miss = false;
+    if (need_jit && ! group.m_jit_cache_key.empty()
+          && group.llvm_aot_object().empty() && ! group.does_nothing()) {
+        if (jit_cache_fetch (group)) {
+            m_stat_jit_cache_hits += 1;
+        } else {
+            jit_cache_miss = true;
+            m_stat_jit_cache_misses += 1;
+        }
+    }
+    // Precompiled code, or code for llvm_aot_output, is made just once.
+    bool aot = m_llvm_aot_output || jit_cache_miss
+               || ! group.llvm_aot_object().empty();
+    bool tiered = need_jit && m_llvm_jit_tiered && !group.does_nothing() && !aot
+                  && (preset == OptPreset::LEGACY
+                      ? (m_llvm_optimize != 0 && m_llvm_optimize != 10)
+                      : preset != OptPreset::NONE)
+                  && !renderer()->supports ("OptiX");
+    // With llvm_pgo_samples, the first JIT also counts which way each
+    // branch goes, and after that many executions of the group it is
+    // re-JITed in the background using those counts. A group that never
+    // gets that far isn't hot enough to be worth it.
+    bool pgo = need_jit && m_llvm_pgo_samples > 0 && !group.does_nothing() && !aot
+               && !renderer()->supports ("OptiX");
     if (need_jit) {
         BackendLLVM lljitter (*this, group, ctx);
+        if (tiered) {
+            lljitter.llvm_optimize (10);
+            lljitter.llvm_opt_preset (OptPreset::LEGACY);
+            group.m_tiered_rejit_pending = true;
+        }
+        if (pgo) {
+            lljitter.llvm_pgo_instrument (true);
+            group.m_tiered_rejit_pending = true;
+            group.m_pgo_samples_left = m_llvm_pgo_samples;
+        }
+        if (jit_cache_miss)
+            lljitter.llvm_aot_output (true);
+        size_t jit_bytes = LLVM_Util::thread_jit_memory_allocated();
         lljitter.run ();
-
-        // NOTE: it is now possible to optimize and not JIT
-        // which would leave the cleanup to happen
-        // when the ShadingSystem is destroyed
-
-        // Only cleanup when are not batching or if
-        // the batch jit has already happened,
-        // as it requires the ops so we can't delete them yet!
-        if (((renderer()->batched(WidthOf<16>()) == nullptr) &&
-             (renderer()->batched(WidthOf<8>()) == nullptr))
-            || group.batch_jitted()) {
-            group_post_jit_cleanup (group);
+        jit_bytes = LLVM_Util::thread_jit_memory_allocated() - jit_bytes;
+        if (jit_cache_miss && ! group.m_llvm_aot_object.empty()) {
+            jit_cache_store (group.m_jit_cache_key, group.m_llvm_aot_object);
+            // Where the cache is a file, keep the mapping of it that other
+            // processes on the machine share rather than our own copy.
+            if (! m_llvm_aot_output && ! m_jit_cache_fetch && jit_cache_map (group))
+                std::string().swap (group.m_llvm_aot_object);
         }
 
-        group.m_jitted = true;
+        {
+            lock_guard state_lock (group.m_jit_state_mutex);
+            group.m_llvm_jit_bytes += jit_bytes;
+
+            // NOTE: it is now possible to optimize and not JIT
+            // which would leave the cleanup to happen
+            // when the ShadingSystem is destroyed
+
+            // Only cleanup when are not batching or if
+            // the batch jit has already happened,
+            // as it requires the ops so we can't delete them yet!
+            // The ops are also still needed for a pending tiered re-JIT.
+            if ((((renderer()->batched(WidthOf<16>()) == nullptr) &&
+                  (renderer()->batched(WidthOf<8>()) == nullptr) &&
+                  (renderer()->batched(WidthOf<4>()) == nullptr))
+                 || group.batch_jitted()) && !group.m_tiered_rejit_pending) {
+                group_post_jit_cleanup (group);
+            }
+
+            group.m_jitted = true;
+            group.m_compile_stats.llvm_setup_time += lljitter.m_stat_llvm_setup_time;
+            group.m_compile_stats.llvm_irgen_time += lljitter.m_stat_llvm_irgen_time;
+            group.m_compile_stats.llvm_opt_time += lljitter.m_stat_llvm_opt_time;
+            group.m_compile_stats.llvm_jit_time += lljitter.m_stat_llvm_jit_time;
+        }
         spin_lock stat_lock (m_stat_mutex);
         m_stat_opt_locking_time += locking_time;
         m_stat_optimization_time += timer();
@@ -3447,6 +5507,7 @@ ShadingSystemImpl::optimize_group (ShaderGroup &group, ShadingContext *ctx, bool
         m_stat_llvm_setup_time += lljitter.m_stat_llvm_setup_time;
         m_stat_llvm_irgen_time += lljitter.m_stat_llvm_irgen_time;
         m_stat_llvm_opt_time += lljitter.m_stat_llvm_opt_time;
+        m_stat_llvm_opt_preset_time[int(lljitter.llvm_opt_preset())] += lljitter.m_stat_llvm_opt_time;
         m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
         m_stat_max_llvm_local_mem = std::max (m_stat_max_llvm_local_mem,
                                               lljitter.m_llvm_local_mem);
@@ -3460,32 +5521,932 @@ ShadingSystemImpl::optimize_group (ShaderGroup &group, ShadingContext *ctx, bool
     m_stat_groups_compiled += 1;
     m_stat_instances_compiled += group.nlayers();
     m_groups_to_compile_count -= 1;
+
+    if (tiered && !pgo)
+        tiered_rejit_enqueue (group);
+    if (need_jit && m_max_jit_memory_MB > 0)
+        evict_jit_memory (group);
 }
 
-#if OSL_USE_BATCHED
-template <int WidthT>
+
+
 void
-ShadingSystemImpl::Batched<WidthT>::jit_group (ShaderGroup &group, ShadingContext *ctx)
+ShadingSystemImpl::unoptimize_group (ShaderGroup &group)
 {
-    if (group.batch_jitted())
-        return;    // already optimized
-
-    bool ctx_allocated = false;
-    PerThreadInfo *thread_info = nullptr;
-    if (! ctx) {
-        thread_info = m_ssi.create_thread_info();
-        ctx = m_ssi.get_context(thread_info);
-        ctx_allocated = true;
-    }
+    // Any thread still running the old code simply finishes with it; its
+    // memory stays with the group until the group is freed.
+    for (int layer = 0;  layer < group.nlayers();  ++layer)
+        group[layer]->unoptimize ();
 
-    if (!group.optimized())
+    group.llvm_entry_points (nullptr);
+#if OSL_USE_BATCHED
+    group.m_llvm_compiled_wide_version = nullptr;
+    group.m_llvm_compiled_wide_init = nullptr;
+    group.m_llvm_compiled_wide_layers.clear ();
+#endif
+    group.m_llvm_ptx_compiled_version.clear ();
+    group.m_llvm_aot_object.clear ();
+    group.m_llvm_aot_file.reset ();
+    group.m_llvm_aot_mapped = string_view();
+    group.m_llvm_groupdata_size = 0;
+    group.m_llvm_groupdata_wide_size = 0;
+    group.m_tiered_rejit_pending = false;
+    group.m_symbol_index.clear ();
+    group.m_pgo_counts.reset ();
+    group.m_pgo_nbranches = 0;
+    group.m_pgo_samples_left = 0;
+
+    // What the optimizer found out about the group
+    group.m_textures_needed.clear ();
+    group.m_closures_needed.clear ();
+    group.m_pointclouds_needed.clear ();
+    group.m_globals_needed.clear ();
+    group.m_userdata_names.clear ();
+    group.m_userdata_types.clear ();
+    group.m_userdata_offsets.clear ();
+    group.m_userdata_derivs.clear ();
+    group.m_userdata_layers.clear ();
+    group.m_userdata_init_vals.clear ();
+    group.m_attributes_needed.clear ();
+    group.m_attribute_scopes.clear ();
+    group.m_unknown_textures_needed = false;
+    group.m_unknown_closures_needed = false;
+    group.m_unknown_pointclouds_needed = false;
+    group.m_closure_pool_size = 0;
+    group.m_unknown_attributes_needed = false;
+    group.m_globals_read = 0;
+    group.m_globals_write = 0;
+    group.does_nothing (false);
+
+    group.m_optimized = 0;
+    group.m_jitted = 0;
+    group.m_batch_jitted = 0;
+    ++m_groups_to_compile_count;
+}
+
+
+
+void
+ShadingSystemImpl::evict_jit_memory (ShaderGroup &keep)
+{
+    // The group just compiled counts as executed now, so that it's the
+    // last to go rather than the first.
+    keep.m_last_executed.store (m_jit_epoch.load (std::memory_order_relaxed),
+                                std::memory_order_relaxed);
+    size_t budget = size_t(m_max_jit_memory_MB) << 20;
+    if (LLVM_Util::total_jit_memory_held() <= budget)
+        return;
+    // One pass at a time; another thread that wants one leaves it be.
+    std::unique_lock<mutex> lock (m_eviction_mutex, std::try_to_lock);
+    if (! lock.owns_lock())
+        return;
+    int epoch = m_jit_epoch.fetch_add (1);
+    size_t held = LLVM_Util::total_jit_memory_held();
+    if (held <= budget)
+        return;
+
+    // Least recently executed groups first. Take their refs (and drop the
+    // ones we don't want) outside the lock on the list of groups.
+    std::vector<std::pair<int,ShaderGroupRef>> lru;
+    {
+        spin_lock glock (m_all_shader_groups_mutex);
+        lru.reserve (m_all_shader_groups.size());
+        for (auto&& w : m_all_shader_groups)
+            if (ShaderGroupRef g = w.lock()) {
+                int last = g->m_last_executed.load (std::memory_order_relaxed);
+                lru.emplace_back (last, std::move(g));
+            }
+    }
+    std::stable_sort (lru.begin(), lru.end(),
+                      [](const std::pair<int,ShaderGroupRef> &a,
+                         const std::pair<int,ShaderGroupRef> &b) {
+                          return a.first < b.first;
+                      });
+
+    for (auto&& e : lru) {
+        // Nothing executed since the last pass is evicted
+        if (held <= budget || e.first >= epoch)
+            break;
+        ShaderGroup &group (*e.second);
+        if (&group == &keep)
+            continue;
+        // A group that's being compiled right now isn't one to evict.
+        std::unique_lock<mutex> glock (group.m_mutex, std::try_to_lock);
+        if (! glock.owns_lock())
+            continue;
+        std::unique_lock<mutex> jit_lock (group.m_jit_mutex, std::try_to_lock);
+        if (! jit_lock.owns_lock())
+            continue;
+        std::unique_lock<mutex> batch_jit_lock (group.m_batch_jit_mutex,
+                                                std::try_to_lock);
+        if (! batch_jit_lock.owns_lock() || ! group.m_llvm_jit_bytes)
+            continue;
+        bool can_unoptimize = group.optimized();
+        for (int layer = 0;  layer < group.nlayers() && can_unoptimize;  ++layer)
+            can_unoptimize = group[layer]->can_unoptimize();
+        if (! can_unoptimize)
+            continue;   // optimized before max_jit_memory_MB was set
+        // Only a group that no context has bound can go. A context that
+        // binds it from now on sees m_evicting and waits for glock.
+        group.m_evicting.store (true);
+        if (group.m_in_flight.load () != 0) {
+            group.m_evicting.store (false);
+            continue;
+        }
+        // Precompiled code (llvm_aot_output or registered) is kept, since
+        // loading it again is far quicker than JITing the group again.
+        std::string aot_object;
+        aot_object.swap (group.m_llvm_aot_object);
+        auto aot_file = group.m_llvm_aot_file;
+        string_view aot_mapped = group.m_llvm_aot_mapped;
+        unoptimize_group (group);
+        group.m_llvm_aot_object.swap (aot_object);
+        group.m_llvm_aot_file = aot_file;
+        group.m_llvm_aot_mapped = aot_mapped;
+        // Nothing can be running the code, so it goes right away.
+        group.m_llvm_jit_memory.clear ();
+        group.m_llvm_entry_point_sets.clear ();
+        held -= std::min (held, group.m_llvm_jit_bytes);
+        m_stat_jit_memory_evicted += group.m_llvm_jit_bytes;
+        m_stat_groups_evicted += 1;
+        group.m_llvm_jit_bytes = 0;
+        group.m_evicting.store (false);
+    }
+}
+
+
+
+ShaderGroup&
+ShadingSystemImpl::raytype_variant (ShaderGroup &group, int raytype)
+{
+    if (group.m_max_raytype_variants <= 0)
+        return group;
+    // Only the ray types that the shaders ask about make a difference
+    int raytypes = raytype & group.raytype_queries();
+    int n = group.m_num_raytype_variants.load (std::memory_order_acquire);
+    for (int i = 0;  i < n;  ++i)
+        if (group.m_raytype_variants[i].first == raytypes)
+            return *group.m_raytype_variants[i].second;
+    if (n >= group.m_max_raytype_variants)
+        return group;   // no room for more, run the general version
+
+    lock_guard lock (group.m_mutex);
+    n = group.m_num_raytype_variants.load (std::memory_order_acquire);
+    for (int i = 0;  i < n;  ++i)   // Did another thread just make it?
+        if (group.m_raytype_variants[i].first == raytypes)
+            return *group.m_raytype_variants[i].second;
+    if (n >= group.m_max_raytype_variants)
+        return group;
+
+    // Build it from the group's original specification. This goes
+    // through the same calls a renderer would make, so don't let it
+    // disturb any group the renderer has open.
+    ShaderGroupRef saved_curgroup = m_curgroup;
+    ShaderGroupRef variant = ShaderGroupBegin (
+        ustring::fmtformat ("{}_raytype{}", group.name(), raytypes),
+        group.m_group_use, group.m_raytype_variant_spec);
+    m_curgroup = saved_curgroup;
+    if (! variant) {
+        group.m_max_raytype_variants = n;   // don't keep trying
+        return group;
+    }
+    for (int layer = 0, e = group.nlayers();  layer < e;  ++layer)
+        if (group.layer(layer)->entry_layer())
+            variant->mark_entry_layer (layer);
+    variant->m_renderer_outputs = group.m_renderer_outputs;
+    variant->m_exec_repeat = group.m_exec_repeat;
+    variant->m_llvm_opt_preset = group.m_llvm_opt_preset;
+    variant->m_symlocs = group.m_symlocs;
+    variant->set_raytypes (group.raytypes_on() | raytypes,
+                           group.raytypes_off()
+                               | (group.raytype_queries() & ~raytypes));
+    variant->m_max_raytype_variants = -1;
+    if (! ShaderGroupEnd (*variant)) {
+        group.m_max_raytype_variants = n;
+        return group;
+    }
+    group.m_raytype_variants[n] = std::make_pair (raytypes, variant);
+    group.m_num_raytype_variants.store (n+1, std::memory_order_release);
+    m_stat_raytype_variants += 1;
+    return *variant;
+}
+
+
+
+ShaderGroup&
+ShadingSystemImpl::output_variant (ShaderGroup &group_, cspan<ustring> outputs)
+{
+    ShaderGroup &group (dedupe_group (group_));
+    if (group.m_max_output_variants <= 0 || outputs.empty())
+        return group;
+    // The same outputs in any order are the same variant
+    auto same = [&](const std::vector<ustring> &subset) {
+        if (subset.size() != outputs.size())
+            return false;
+        for (auto&& o : outputs)
+            if (std::find (subset.begin(), subset.end(), o) == subset.end())
+                return false;
+        return true;
+    };
+    int n = group.m_num_output_variants.load (std::memory_order_acquire);
+    for (int i = 0;  i < n;  ++i)
+        if (same (group.m_output_variants[i].first))
+            return *group.m_output_variants[i].second;
+    if (n >= group.m_max_output_variants)
+        return group;   // no room for more, run the general version
+
+    lock_guard lock (group.m_mutex);
+    n = group.m_num_output_variants.load (std::memory_order_acquire);
+    for (int i = 0;  i < n;  ++i)   // Did another thread just make it?
+        if (same (group.m_output_variants[i].first))
+            return *group.m_output_variants[i].second;
+    if (n >= group.m_max_output_variants)
+        return group;
+
+    // As with raytype_variant, build it from the group's specification
+    // without disturbing any group the renderer has open. Its renderer
+    // outputs are just the ones asked for, and the optimizer drops the
+    // writes of its last layer to any global not among them, and with
+    // them whatever (layers included) only fed those.
+    std::vector<ustring> subset (outputs.begin(), outputs.end());
+    std::string name = fmtformat ("{}_outputs", group.name());
+    for (auto&& o : subset)
+        name += fmtformat ("_{}", o);
+    ShaderGroupRef saved_curgroup = m_curgroup;
+    ShaderGroupRef variant = ShaderGroupBegin (ustring(name),
+        group.m_group_use, group.m_output_variant_spec);
+    m_curgroup = saved_curgroup;
+    if (! variant) {
+        group.m_max_output_variants = n;   // don't keep trying
+        return group;
+    }
+    for (int layer = 0, e = group.nlayers();  layer < e;  ++layer)
+        if (group.layer(layer)->entry_layer())
+            variant->mark_entry_layer (layer);
+    variant->m_renderer_outputs = subset;
+    variant->m_output_subset = subset;
+    variant->m_exec_repeat = group.m_exec_repeat;
+    variant->m_llvm_opt_preset = group.m_llvm_opt_preset;
+    variant->m_symlocs = group.m_symlocs;
+    variant->set_raytypes (group.raytypes_on(), group.raytypes_off());
+    variant->m_max_raytype_variants = -1;
+    variant->m_max_output_variants = -1;
+    if (! ShaderGroupEnd (*variant)) {
+        group.m_max_output_variants = n;
+        return group;
+    }
+    group.m_output_variants[n] = std::make_pair (std::move(subset), variant);
+    group.m_num_output_variants.store (n+1, std::memory_order_release);
+    m_stat_output_variants += 1;
+    return *variant;
+}
+
+
+
+int
+ShadingSystemImpl::call_site (const Opcode &op)
+{
+    auto key = std::make_tuple (op.sourcefile(), op.sourceline(), op.opname());
+    spin_lock lock (m_stat_mutex);
+    auto found = m_call_site_ids.find (key);
+    if (found != m_call_site_ids.end())
+        return found->second;
+    int id = (int) m_call_sites.size();
+    m_call_sites.push_back ({ op.opname(), op.sourcefile(), op.sourceline(),
+                             CallSiteProfile() });
+    m_call_site_ids[key] = id;
+    return id;
+}
+
+
+
+int
+ShadingSystemImpl::profile_block (ustring sourcefile,
+                                  const std::vector<int> &lines)
+{
+    auto key = std::make_pair (sourcefile, lines);
+    spin_lock lock (m_stat_mutex);
+    auto found = m_profile_block_ids.find (key);
+    if (found != m_profile_block_ids.end())
+        return found->second;
+    int id = (int) m_profile_blocks.size();
+    m_profile_blocks.push_back ({ sourcefile, lines, 0 });
+    m_profile_block_ids[key] = id;
+    return id;
+}
+
+
+
+std::string
+ShadingSystemImpl::profile_block_listing (int level) const
+{
+    // How many times the code on each line ran, by source file and line.
+    std::map<ustring, std::map<int, long long>> execs;
+    {
+        spin_lock lock (m_stat_mutex);
+        for (auto&& b : m_profile_blocks)
+            if (b.execs)
+                for (int line : b.lines)
+                    execs[b.sourcefile][line] += b.execs;
+    }
+    std::ostringstream out;
+    out.imbue (std::locale::classic());  // force C locale
+    if (execs.size())
+        out << "    Executions by source line:\n";
+    for (auto&& file : execs) {
+        // Show the line's text too, if the source can still be found. At
+        // stats level 5 and up, list the whole source with the counts in
+        // the margin, otherwise just the lines that ran.
+        std::string text;
+        std::vector<std::string> source;
+        if (OIIO::Filesystem::read_text_file (file.first.string(), text))
+            Strutil::split (text, source, "\n");
+        out << "      " << file.first << "\n";
+        int nlines = (level >= 5 && source.size()) ? (int)source.size()
+                                                   : file.second.rbegin()->first;
+        for (int line = 1;  line <= nlines;  ++line) {
+            auto found = file.second.find (line);
+            if (found == file.second.end() && ! (level >= 5 && source.size()))
+                continue;
+            out << fmtformat ("      {:>12} {:5}: {}\n",
+                              found != file.second.end()
+                                  ? Strutil::to_string (found->second) : "",
+                              line, line <= (int)source.size()
+                                  ? source[line-1] : std::string());
+        }
+    }
+    return out.str();
+}
+
+
+
+bool
+ShadingSystemImpl::debug_nan (const ShaderGroup &group) const
+{
+    return m_debugnan && (m_debug_sample <= 0 || group.m_is_debug_variant);
+}
+
+
+
+bool
+ShadingSystemImpl::debug_uninit (const ShaderGroup &group) const
+{
+    return m_debug_uninit && (m_debug_sample <= 0 || group.m_is_debug_variant);
+}
+
+
+
+ShaderGroup&
+ShadingSystemImpl::debug_variant (ShaderGroup &group)
+{
+    int state = group.m_debug_variant_state.load (std::memory_order_acquire);
+    if (state > 0)
+        return *group.m_debug_variant;
+    if (state < 0 || group.m_debug_variant_spec.empty())
+        return group;
+
+    lock_guard lock (group.m_mutex);
+    state = group.m_debug_variant_state.load (std::memory_order_acquire);
+    if (state > 0)   // Did another thread just make it?
+        return *group.m_debug_variant;
+    if (state < 0)
+        return group;
+
+    // As with raytype_variant, build it from the group's specification
+    // without disturbing any group the renderer has open.
+    ShaderGroupRef saved_curgroup = m_curgroup;
+    ShaderGroupRef variant = ShaderGroupBegin (
+        ustring::fmtformat ("{}_debug", group.name()),
+        group.m_group_use, group.m_debug_variant_spec);
+    m_curgroup = saved_curgroup;
+    if (variant) {
+        for (int layer = 0, e = group.nlayers();  layer < e;  ++layer)
+            if (group.layer(layer)->entry_layer())
+                variant->mark_entry_layer (layer);
+        variant->m_renderer_outputs = group.m_renderer_outputs;
+        variant->m_exec_repeat = group.m_exec_repeat;
+        variant->m_llvm_opt_preset = group.m_llvm_opt_preset;
+        variant->m_symlocs = group.m_symlocs;
+        variant->set_raytypes (group.raytypes_on(), group.raytypes_off());
+        variant->m_max_raytype_variants = -1;
+        variant->m_is_debug_variant = true;
+    }
+    if (! variant || ! ShaderGroupEnd (*variant)) {
+        group.m_debug_variant_state.store (-1, std::memory_order_release);
+        return group;
+    }
+    group.m_debug_variant = variant;
+    group.m_debug_variant_state.store (1, std::memory_order_release);
+    return *variant;
+}
+
+
+
+ShaderGroup&
+ShadingSystemImpl::dedupe_group (ShaderGroup &group)
+{
+    if (group.m_dedupe_resolved.load (std::memory_order_acquire))
+        return group.m_dedupe_leader ? *group.m_dedupe_leader : group;
+
+    lock_guard lock (m_dedupe_mutex);
+    if (group.m_dedupe_resolved.load (std::memory_order_acquire))
+        return group.m_dedupe_leader ? *group.m_dedupe_leader : group;
+    // Groups with their own precompiled code, or whose code is saved or
+    // looked up by group, are left alone.
+    if (! group.m_dedupe_spec.empty() && group.llvm_aot_object().empty()
+          && ! m_llvm_aot_output && ! renderer()->supports ("OptiX")) {
+        // Besides what the group serializes, the attributes it may have
+        // been given since ShaderGroupEnd change the code it compiles to.
+        group.m_dedupe_spec += fmtformat (
+            "use {} repeat {} preset {} precision {} raytypes {} {}\n",
+            group.m_group_use, group.m_exec_repeat,
+            int(group.m_llvm_opt_preset), int(group.m_math_precision),
+            group.m_raytypes_on, group.m_raytypes_off);
+        for (int layer = 0, n = group.nlayers();  layer < n;  ++layer)
+            if (group.is_entry_layer (layer))
+                group.m_dedupe_spec += fmtformat ("entry {}\n", layer);
+        for (auto&& name : group.m_renderer_outputs)
+            group.m_dedupe_spec += fmtformat ("output {}\n", name);
+        for (auto&& s : group.m_symlocs)
+            group.m_dedupe_spec += fmtformat (
+                "symloc {} {} {} {} {} {}\n", s.name, s.type.c_str(),
+                s.offset, s.stride, int(s.arena), s.derivs);
+
+        ShaderGroupRef leader;
+        auto range = m_dedupe_table.equal_range (group.m_dedupe_hash);
+        for (auto i = range.first;  i != range.second && ! leader; ) {
+            leader = i->second.lock();
+            if (! leader) {   // released since, so forget it
+                i = m_dedupe_table.erase (i);
+                continue;
+            }
+            if (leader->m_dedupe_spec != group.m_dedupe_spec)
+                leader.reset ();
+            ++i;
+        }
+        if (leader) {
+            // Hold on to it, so its code lives as long as either group
+            group.m_dedupe_leader = leader;
+            std::string().swap (group.m_dedupe_spec);
+            m_stat_groups_deduped += 1;
+            m_groups_to_compile_count -= 1;
+        } else {
+            m_dedupe_table.emplace (group.m_dedupe_hash,
+                                    group.shared_from_this());
+        }
+        m_stat_groups_dedupe_checked += 1;
+    }
+    group.m_dedupe_resolved.store (true, std::memory_order_release);
+    return group.m_dedupe_leader ? *group.m_dedupe_leader : group;
+}
+
+
+
+std::vector<LayerProfile>
+ShadingSystemImpl::layer_profile (const ShaderGroup &group) const
+{
+    spin_lock lock (m_stat_mutex);
+    std::vector<LayerProfile> prof = group.m_layer_profile;
+    int n = group.m_max_raytype_variants > 0
+          ? group.m_num_raytype_variants.load (std::memory_order_acquire) : 0;
+    for (int v = 0;  v < n;  ++v) {
+        const auto &vprof (group.m_raytype_variants[v].second->m_layer_profile);
+        if (prof.size() < vprof.size())
+            prof.resize (vprof.size());
+        for (size_t i = 0;  i < vprof.size();  ++i)
+            prof[i] += vprof[i];
+    }
+    return prof;
+}
+
+
+
+bool
+ShadingSystemImpl::prefetch_textures (ShaderGroup &group, int nthreads,
+                                      bool wait)
+{
+    // Only an optimized group knows which textures it needs.
+    if (! group.optimized()) {
+        auto threadinfo = create_thread_info();
+        auto ctx = get_context(threadinfo);
+        optimize_group (group, ctx, false /*jit*/);
+        release_context(ctx);
+        destroy_thread_info (threadinfo);
+    }
+    if (nthreads < 1)
+        nthreads = std::max (1, (int)std::thread::hardware_concurrency());
+
+    std::unique_lock<std::mutex> lock (m_prefetch_mutex);
+    for (ustring filename : group.m_textures_needed)
+        if (m_prefetched.insert (filename).second)
+            m_prefetch_queue.push_back (filename);
+    while (m_prefetch_threads.size() < size_t(nthreads)
+           && m_prefetch_threads.size() < m_prefetch_queue.size())
+        m_prefetch_threads.emplace_back (&ShadingSystemImpl::prefetch_worker, this);
+    m_prefetch_cond.notify_all ();
+    if (wait)
+        m_prefetch_cond.wait (lock, [&]{
+            return m_prefetch_queue.empty() && ! m_prefetch_busy;
+        });
+    return true;
+}
+
+
+
+void
+ShadingSystemImpl::prefetch_worker ()
+{
+    TextureSystem *ts = texturesys();
+    TextureSystem::Perthread *perthread = ts->create_thread_info ();
+    std::unique_lock<std::mutex> lock (m_prefetch_mutex);
+    for (;;) {
+        m_prefetch_cond.wait (lock, [&]{
+            return m_prefetch_exit || ! m_prefetch_queue.empty();
+        });
+        if (m_prefetch_exit)
+            break;
+        ustring filename = m_prefetch_queue.front();
+        m_prefetch_queue.pop_front ();
+        ++m_prefetch_busy;
+        lock.unlock ();
+
+        // Getting the handle opens the file and reads its header. A
+        // lookup whose footprint covers the whole image then reads the
+        // coarsest MIP level. UDIM sets have no single file to warm.
+        TextureSystem::TextureHandle *handle
+            = ts->get_texture_handle (filename, perthread);
+        if (handle && ts->good (handle) && ! ts->is_udim (handle)) {
+            TextureOpt opt;
+            float result[1];
+            ts->texture (handle, perthread, opt, 0.5f, 0.5f,
+                         1.0f, 0.0f, 0.0f, 1.0f, 1, result);
+        }
+
+        lock.lock ();
+        --m_prefetch_busy;
+        if (m_prefetch_queue.empty() && ! m_prefetch_busy)
+            m_prefetch_cond.notify_all ();
+    }
+    lock.unlock ();
+    ts->destroy_thread_info (perthread);
+}
+
+
+
+bool
+ShadingSystemImpl::reload_shader (string_view shadername, string_view buffer)
+{
+    if (Strutil::ends_with (shadername, ".oso"))
+        shadername.remove_suffix (4);
+    ustring name (shadername);
+    if (! allow_shader_replacement()) {
+        errorfmt("Can't reload shader \"{}\" without allow_shader_replacement",
+                 name);
+        return false;
+    }
+    ShaderMaster::ref old;
+    {
+        lock_guard guard (m_mutex);
+        auto found = m_shader_masters.find (name);
+        if (found == m_shader_masters.end() || ! found->second) {
+            errorfmt("Can't reload shader \"{}\", which was never loaded", name);
+            return false;
+        }
+        old = found->second;
+        if (buffer.empty())
+            m_shader_masters.erase (found);   // so loadshader reads it anew
+    }
+
+    ShaderMaster::ref master;
+    if (buffer.size()) {
+        if (LoadMemoryCompiledShader (name, buffer)) {
+            lock_guard guard (m_mutex);
+            master = m_shader_masters[name];
+        }
+    } else {
+        master = loadshader (name);
+    }
+    if (! master) {
+        // Keep using the old version
+        lock_guard guard (m_mutex);
+        m_shader_masters[name] = old;
+        return false;
+    }
+    if (! old->same_params (*master)) {
+        errorfmt("Reloaded shader \"{}\" has different parameters; groups "
+                 "already using it must be rebuilt to use the new version",
+                 name);
+        return false;
+    }
+
+    std::vector<ShaderGroupRef> groups;
+    {
+        spin_lock lock (m_all_shader_groups_mutex);
+        for (auto&& g : m_all_shader_groups)
+            if (ShaderGroupRef group = g.lock())
+                groups.push_back (group);
+    }
+    bool ok = true;
+    std::vector<ShaderGroupRef> reoptimize;
+    for (auto&& g : groups) {
+        ShaderGroup &group (*g);
+        lock_guard lock (group.m_mutex);
+        lock_guard jit_lock (group.m_jit_mutex);
+        lock_guard batch_jit_lock (group.m_batch_jit_mutex);
+        bool uses = false, saved = true;
+        for (int layer = 0;  layer < group.nlayers();  ++layer) {
+            uses |= (group[layer]->master() == old.get());
+            saved &= group[layer]->can_unoptimize();
+        }
+        if (! uses)
+            continue;
+        bool was_optimized = group.optimized();
+        if (was_optimized) {
+            if (! saved) {
+                // Optimized before allow_shader_replacement was set
+                errorfmt("Group \"{}\" can't switch to reloaded shader \"{}\"",
+                         group.name(), name);
+                ok = false;
+                continue;
+            }
+            // Threads still running the old code finish with it, as
+            // with reparam_reoptimize.
+            unoptimize_group (group);
+        }
+        for (int layer = 0;  layer < group.nlayers();  ++layer)
+            if (group[layer]->master() == old.get())
+                group[layer]->replace_master (master);
+        if (was_optimized)
+            reoptimize.push_back (g);
+    }
+
+    // Only the groups that use the shader, and were already compiled,
+    // are compiled again -- in the background.  Until each is done,
+    // executing it compiles it (or runs its fallback_group, with
+    // async_optimize).
+    for (auto&& g : reoptimize)
+        optimize_group_async (*g);
+    return ok;
+}
+
+
+
+std::weak_ptr<ShaderGroup>
+ShadingSystemImpl::weak_group_ref (ShaderGroup &group)
+{
+    // The group was most likely created recently, so search from the back.
+    spin_lock lock (m_all_shader_groups_mutex);
+    for (size_t i = m_all_shader_groups.size();  i-- > 0; ) {
+        if (m_all_shader_groups[i].lock().get() == &group)
+            return m_all_shader_groups[i];
+    }
+    return std::weak_ptr<ShaderGroup>();
+}
+
+
+
+void
+ShadingSystemImpl::tiered_rejit_enqueue (ShaderGroup &group)
+{
+    // Hold only a weak reference, so a group released by the app before
+    // we get to it is simply skipped.
+    std::weak_ptr<ShaderGroup> ref = weak_group_ref (group);
+    std::lock_guard<std::mutex> lock (m_tiered_rejit_mutex);
+    m_tiered_rejit_queue.push_back (ref);
+    if (! m_tiered_rejit_thread.joinable())
+        m_tiered_rejit_thread = std::thread (&ShadingSystemImpl::tiered_rejit_worker, this);
+    m_tiered_rejit_cond.notify_one ();
+}
+
+
+
+void
+ShadingSystemImpl::tiered_rejit_worker ()
+{
+    PerThreadInfo* threadinfo = create_thread_info();
+    ShadingContext* ctx = get_context(threadinfo);
+    for (;;) {
+        ShaderGroupRef group;
+        {
+            std::unique_lock<std::mutex> lock (m_tiered_rejit_mutex);
+            m_tiered_rejit_cond.wait (lock, [this]{
+                return m_tiered_rejit_exit || !m_tiered_rejit_queue.empty();
+            });
+            if (m_tiered_rejit_exit)
+                break;
+            group = m_tiered_rejit_queue.front().lock();
+            m_tiered_rejit_queue.pop_front();
+        }
+        if (! group)
+            continue;
+
+        OIIO::Timer timer;
+        lock_guard lock (group->m_jit_mutex);
+        if (! group->m_tiered_rejit_pending)
+            continue;   // Unoptimized since (reparam_reoptimize)
+        // The instances are untouched since the first JIT, so this lays
+        // out the group data identically; only the code differs, and run()
+        // leaves the layout alone. It builds the new entry points off to
+        // the side and publishes them with one atomic store; any thread
+        // still running the old ones (whose memory is retained) simply
+        // finishes with them.
+        BackendLLVM lljitter (*this, *group, ctx);
+        bool pgo = group->m_pgo_counts != nullptr;
+        lljitter.llvm_pgo_use (pgo);
+        lljitter.run ();
+        {
+            lock_guard state_lock (group->m_jit_state_mutex);
+            group->m_tiered_rejit_pending = false;
+            if (((renderer()->batched(WidthOf<16>()) == nullptr) &&
+                 (renderer()->batched(WidthOf<8>()) == nullptr) &&
+                 (renderer()->batched(WidthOf<4>()) == nullptr))
+                || group->batch_jitted()) {
+                group_post_jit_cleanup (*group);
+            }
+            // If the layout would have changed, run() reported it and
+            // kept the code that's running; there's no re-JIT to count.
+            if (lljitter.groupdata_layout_changed())
+                continue;
+            group->m_compile_stats.llvm_setup_time += lljitter.m_stat_llvm_setup_time;
+            group->m_compile_stats.llvm_irgen_time += lljitter.m_stat_llvm_irgen_time;
+            group->m_compile_stats.llvm_opt_time += lljitter.m_stat_llvm_opt_time;
+            group->m_compile_stats.llvm_jit_time += lljitter.m_stat_llvm_jit_time;
+        }
+
+        if (pgo)
+            m_stat_groups_pgo_rejitted += 1;
+        else
+            m_stat_groups_rejitted += 1;
+        spin_lock stat_lock (m_stat_mutex);
+        m_stat_optimization_time += timer();
+        m_stat_total_llvm_time += lljitter.m_stat_total_llvm_time;
+        m_stat_llvm_setup_time += lljitter.m_stat_llvm_setup_time;
+        m_stat_llvm_irgen_time += lljitter.m_stat_llvm_irgen_time;
+        m_stat_llvm_opt_time += lljitter.m_stat_llvm_opt_time;
+        m_stat_llvm_opt_preset_time[int(lljitter.llvm_opt_preset())] += lljitter.m_stat_llvm_opt_time;
+        m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
+    }
+    release_context(ctx);
+    destroy_thread_info(threadinfo);
+}
+
+
+
+void
+ShadingSystemImpl::constant_attribute (ustring object, ustring name,
+                                       TypeDesc type, const void *val)
+{
+    spin_lock lock (m_constant_attributes_mutex);
+    auto key = std::make_pair (object, name);
+    if (! val) {
+        m_constant_attributes.erase (key);
+        return;
+    }
+    std::vector<char> data ((const char *)val,
+                            (const char *)val + type.size());
+    if (type.basetype == TypeDesc::STRING) {
+        // Accept const char* as well as ustring, and keep ustrings.
+        ustring *s = (ustring *)data.data();
+        for (size_t i = 0, n = type.numelements() * type.aggregate;  i < n;  ++i)
+            s[i] = ustring (((const char **)val)[i]);
+    }
+    m_constant_attributes[key] = std::make_pair (type, std::move(data));
+}
+
+
+
+void
+ShadingSystemImpl::clear_constant_attributes ()
+{
+    spin_lock lock (m_constant_attributes_mutex);
+    m_constant_attributes.clear ();
+}
+
+
+
+bool
+ShadingSystemImpl::find_constant_attribute (ustring object, ustring name,
+                                            TypeDesc type, int index,
+                                            void *val) const
+{
+    spin_lock lock (m_constant_attributes_mutex);
+    auto found = m_constant_attributes.find (std::make_pair (object, name));
+    if (found == m_constant_attributes.end())
+        return false;
+    TypeDesc ctype = found->second.first;
+    const char *data = found->second.second.data();
+    if (index >= 0) {
+        if (! ctype.is_array() || index >= ctype.arraylen
+              || ctype.elementtype() != type)
+            return false;
+        memcpy (val, data + index * type.size(), type.size());
+        return true;
+    }
+    if (ctype != type)
+        return false;
+    memcpy (val, data, type.size());
+    return true;
+}
+
+
+
+std::shared_future<bool>
+ShadingSystemImpl::optimize_group_async (ShaderGroup &group)
+{
+    std::lock_guard<std::mutex> lock (m_async_opt_mutex);
+    // Share the compile already under way, or its result if the group is
+    // still compiled (it may have been evicted or unoptimized since).
+    if (group.m_async_opt_future.valid()
+        && (group.m_async_opt_pending.load() || group.jitted()))
+        return group.m_async_opt_future;
+
+    auto promise = std::make_shared<std::promise<bool>>();
+    group.m_async_opt_future = promise->get_future().share();
+    if (group.jitted() || m_async_opt_exit) {
+        promise->set_value (group.jitted());
+        return group.m_async_opt_future;
+    }
+    group.m_async_opt_pending = true;
+    m_async_opt_queue.push_back ({ weak_group_ref (group), promise });
+    size_t nthreads = size_t (std::max (1, m_async_optimize));
+    if (m_async_opt_threads.size() < nthreads
+        && m_async_opt_threads.size() < m_async_opt_queue.size())
+        m_async_opt_threads.emplace_back (&ShadingSystemImpl::async_optimize_worker, this);
+    m_async_opt_cond.notify_one ();
+    return group.m_async_opt_future;
+}
+
+
+
+void
+ShadingSystemImpl::async_optimize_worker ()
+{
+    PerThreadInfo* threadinfo = create_thread_info();
+    ShadingContext* ctx = get_context(threadinfo);
+    for (;;) {
+        AsyncOptRequest request;
+        {
+            std::unique_lock<std::mutex> lock (m_async_opt_mutex);
+            m_async_opt_cond.wait (lock, [this]{
+                return m_async_opt_exit || !m_async_opt_queue.empty();
+            });
+            if (m_async_opt_exit)
+                break;
+            request = std::move (m_async_opt_queue.front());
+            m_async_opt_queue.pop_front();
+        }
+        // A group released by the app before we got to it is skipped.
+        bool ready = false;
+        if (ShaderGroupRef group = request.group.lock()) {
+            if (! group->jitted())
+                optimize_group (*group, ctx, true /*do_jit*/);
+            ready = group->jitted();
+            group->m_async_opt_pending = false;
+        }
+        request.promise->set_value (ready);
+    }
+    release_context(ctx);
+    destroy_thread_info(threadinfo);
+}
+
+#if OSL_USE_BATCHED
+template <int WidthT>
+void
+ShadingSystemImpl::Batched<WidthT>::jit_group (ShaderGroup &group, ShadingContext *ctx)
+{
+    if (group.batch_jitted())
+        return;    // already optimized
+
+    // A group holds code for just one width
+    if (group.m_batch_width && group.m_batch_width != WidthT) {
+        m_ssi.errorfmt ("Shader group \"{}\" has batch_width {}, can't JIT it {} wide",
+                        group.name(), group.m_batch_width, WidthT);
+        return;
+    }
+
+    // A group identical to one already seen gets that one's code
+    ShaderGroup &leader (m_ssi.dedupe_group (group));
+    if (&leader != &group) {
+        jit_group (leader, ctx);
+        return;
+    }
+
+    bool ctx_allocated = false;
+    PerThreadInfo *thread_info = nullptr;
+    if (! ctx) {
+        thread_info = m_ssi.create_thread_info();
+        ctx = m_ssi.get_context(thread_info);
+        ctx_allocated = true;
+    }
+
+    if (!group.optimized())
         m_ssi.optimize_group (group,
                 ctx, false /*do_jit*/);
 
     OIIO::Timer timer;
-    // TODO: we could have separate mutexes for jit vs. batched_jit
-    // choose to keep it simple to start with
-    lock_guard lock (group.m_mutex);
+    // The group is optimized, so this needs only the batched JIT's own
+    // lock, and may run alongside a scalar JIT of the group.
+    lock_guard lock (group.m_batch_jit_mutex);
     if (group.batch_jitted()) {
         if (ctx_allocated) {
             // TODO: scope object to manage temporary context&threadinfo
@@ -3506,20 +6467,33 @@ ShadingSystemImpl::Batched<WidthT>::jit_group (ShaderGroup &group, ShadingContex
 
     // TODO:  Add BatchedBackendLLVM in subsequent pull request
     BatchedBackendLLVM lljitter (m_ssi, group, ctx, WidthT);
+    size_t jit_bytes = LLVM_Util::thread_jit_memory_allocated();
     lljitter.run ();
+    jit_bytes = LLVM_Util::thread_jit_memory_allocated() - jit_bytes;
 
-    // Keep OSL instructions around in case someone
-    // wants the scalar version jitted
-    if (group.jitted()) {
-        m_ssi.group_post_jit_cleanup (group);
+    {
+        lock_guard state_lock (group.m_jit_state_mutex);
+        group.m_llvm_jit_bytes += jit_bytes;
+
+        // Keep OSL instructions around in case someone
+        // wants the scalar version jitted (or re-JITed, if tiered)
+        if (group.jitted() && !group.m_tiered_rejit_pending) {
+            m_ssi.group_post_jit_cleanup (group);
+        }
+
+        group.m_batch_jitted = WidthT;
+        group.m_compile_stats.llvm_setup_time += lljitter.m_stat_llvm_setup_time;
+        group.m_compile_stats.llvm_irgen_time += lljitter.m_stat_llvm_irgen_time;
+        group.m_compile_stats.llvm_opt_time += lljitter.m_stat_llvm_opt_time;
+        group.m_compile_stats.llvm_jit_time += lljitter.m_stat_llvm_jit_time;
     }
 
     if (ctx_allocated) {
         m_ssi.release_context(ctx);
         m_ssi.destroy_thread_info(thread_info);
     }
-
-    group.m_batch_jitted = true;
+    if (m_ssi.m_max_jit_memory_MB > 0)
+        m_ssi.evict_jit_memory (group);
     spin_lock stat_lock (m_ssi.m_stat_mutex);
     m_ssi.m_stat_opt_locking_time += locking_time;
     m_ssi.m_stat_optimization_time += timer();
@@ -3527,6 +6501,7 @@ ShadingSystemImpl::Batched<WidthT>::jit_group (ShaderGroup &group, ShadingContex
     m_ssi.m_stat_llvm_setup_time += lljitter.m_stat_llvm_setup_time;
     m_ssi.m_stat_llvm_irgen_time += lljitter.m_stat_llvm_irgen_time;
     m_ssi.m_stat_llvm_opt_time += lljitter.m_stat_llvm_opt_time;
+    m_ssi.m_stat_llvm_opt_preset_time[int(m_ssi.llvm_opt_preset(group))] += lljitter.m_stat_llvm_opt_time;
     m_ssi.m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
     m_ssi.m_stat_max_llvm_local_mem = std::max (m_ssi.m_stat_max_llvm_local_mem,
                                           lljitter.m_llvm_local_mem);
@@ -3538,114 +6513,105 @@ ShadingSystemImpl::Batched<WidthT>::jit_group (ShaderGroup &group, ShadingContex
 }
 #endif
 
-static void optimize_all_groups_wrapper (ShadingSystemImpl *ss, int mythread, int totalthreads, bool do_jit)
-{
-    ss->optimize_all_groups (1, mythread, totalthreads, do_jit);
-}
-
-
-#if OSL_USE_BATCHED
-template<int WidthT>
-static void batched_jit_all_groups_wrapper (ShadingSystemImpl *ss, int mythread, int totalthreads)
-{
-    ss->batched<WidthT>().jit_all_groups(1, mythread, totalthreads);
-}
-#endif
-
 void
-ShadingSystemImpl::optimize_all_groups (int nthreads, int mythread, int totalthreads, bool do_jit)
-{
-    // Spawn a bunch of threads to do this in parallel -- just call this
-    // routine again (with threads=1) for each thread.
+ShadingSystemImpl::compile_all_groups (int nthreads,
+        const ParallelFor &parallel_for,
+        const std::function<bool (const ShaderGroup&)> &needs_compile,
+        const std::function<void (ShaderGroup&, ShadingContext*)> &compile)
+{
+    // Take the groups to do up front, biggest first: handing them out in
+    // order (or round robin) leaves every thread but one idle at the end
+    // when a few groups are far bigger than the rest.
+    std::vector<std::pair<int,ShaderGroupRef>> groups;
+    {
+        spin_lock lock (m_all_shader_groups_mutex);
+        for (auto&& w : m_all_shader_groups)
+            if (ShaderGroupRef g = w.lock())
+                groups.emplace_back (0, std::move(g));
+    }
+    groups.erase (std::remove_if (groups.begin(), groups.end(),
+                      [&](const std::pair<int,ShaderGroupRef> &g) {
+                          return ! g.second->m_complete
+                                 || ! needs_compile (*g.second);
+                      }), groups.end());
+    if (groups.empty())
+        return;
+    for (auto&& g : groups)
+        for (int layer = 0;  layer < g.second->nlayers();  ++layer)
+            g.first += (*g.second)[layer]->master()->num_ops();
+    std::stable_sort (groups.begin(), groups.end(),
+                      [](const std::pair<int,ShaderGroupRef> &a,
+                         const std::pair<int,ShaderGroupRef> &b) {
+                          return a.first > b.first;
+                      });
+
+    // Each worker takes the next group as soon as it's free.
+    std::atomic<size_t> next {0};
+    auto worker = [&](int /*task*/) {
+        PerThreadInfo* threadinfo = create_thread_info();
+        ShadingContext* ctx = get_context(threadinfo);
+        for (size_t i;  (i = next++) < groups.size();  )
+            compile (*groups[i].second, ctx);
+        release_context(ctx);
+        destroy_thread_info(threadinfo);
+    };
+
     if (nthreads < 1)  // threads <= 0 means use all hardware available
-        nthreads = std::min ((int)std::thread::hardware_concurrency(),
-                             (int)m_groups_to_compile_count);
-    if (nthreads > 1) {
-        if (m_threads_currently_compiling)
-            return;   // never mind, somebody else spawned the JIT threads
+        nthreads = (int)std::thread::hardware_concurrency();
+    nthreads = std::max (1, std::min (nthreads, (int)groups.size()));
+    if (nthreads == 1 && ! parallel_for) {
+        worker (0);
+        return;
+    }
+    if (m_threads_currently_compiling)
+        return;   // never mind, somebody else spawned the JIT threads
+    m_threads_currently_compiling += nthreads;
+    if (parallel_for) {
+        parallel_for (nthreads, worker);
+    } else {
         OIIO::thread_group threads;
-        m_threads_currently_compiling += nthreads;
         for (int t = 0;  t < nthreads;  ++t)
-            threads.add_thread (new std::thread (optimize_all_groups_wrapper, this, t, nthreads, do_jit));
+            threads.add_thread (new std::thread (worker, t));
         threads.join_all ();
-        m_threads_currently_compiling -= nthreads;
-        return;
     }
+    m_threads_currently_compiling -= nthreads;
+}
 
-    // And here's the single thread case
-    size_t ngroups = 0;
-    {
-        spin_lock lock (m_all_shader_groups_mutex);
-        ngroups = m_all_shader_groups.size();
-    }
-    PerThreadInfo* threadinfo = create_thread_info();
-    ShadingContext* ctx = get_context(threadinfo);
-    for (size_t i = 0;  i < ngroups;  ++i) {
-        // Assign to threads based on mod of totalthreads
-        if ((i % totalthreads) == (unsigned)mythread) {
-            ShaderGroupRef group;
-            {
-                spin_lock lock (m_all_shader_groups_mutex);
-                group = m_all_shader_groups[i].lock();
-            }
-            if (group && group->m_complete)
-                optimize_group (*group, ctx, do_jit);
-        }
-    }
-    release_context(ctx);
-    destroy_thread_info(threadinfo);
+
+
+void
+ShadingSystemImpl::optimize_all_groups (int nthreads, bool do_jit,
+                                        const ParallelFor &parallel_for)
+{
+    compile_all_groups (nthreads, parallel_for,
+        [=](const ShaderGroup &group) {
+            return ! group.optimized() || (do_jit && ! group.jitted());
+        },
+        [=](ShaderGroup &group, ShadingContext *ctx) {
+            optimize_group (group, ctx, do_jit);
+        });
 }
 
 #if OSL_USE_BATCHED
 template<int WidthT>
 void
-ShadingSystemImpl::Batched<WidthT>::jit_all_groups (int nthreads, int mythread, int totalthreads)
+ShadingSystemImpl::Batched<WidthT>::jit_all_groups (int nthreads,
+                                                    const ParallelFor &parallel_for)
 {
-    // Spawn a bunch of threads to do this in parallel -- just call this
-    // routine again (with threads=1) for each thread.
-    if (nthreads < 1)  // threads <= 0 means use all hardware available
-        nthreads = std::min ((int)std::thread::hardware_concurrency(),
-                             (int)m_ssi.m_groups_to_compile_count);
-    if (nthreads > 1) {
-        if (m_ssi.m_threads_currently_compiling)
-            return;   // never mind, somebody else spawned the JIT threads
-        OIIO::thread_group threads;
-        m_ssi.m_threads_currently_compiling += nthreads;
-        for (int t = 0;  t < nthreads;  ++t)
-            threads.add_thread (new std::thread (batched_jit_all_groups_wrapper<WidthT>, &m_ssi, t, nthreads));
-        threads.join_all ();
-        m_ssi.m_threads_currently_compiling -= nthreads;
-        return;
-    }
-
-    // And here's the single thread case
-    size_t ngroups = 0;
-    {
-        spin_lock lock (m_ssi.m_all_shader_groups_mutex);
-        ngroups = m_ssi.m_all_shader_groups.size();
-    }
-    PerThreadInfo* threadinfo = m_ssi.create_thread_info();
-    ShadingContext* ctx = m_ssi.get_context(threadinfo);
-    for (size_t i = 0;  i < ngroups;  ++i) {
-        // Assign to threads based on mod of totalthreads
-        if ((i % totalthreads) == (unsigned)mythread) {
-            ShaderGroupRef group;
-            {
-                spin_lock lock (m_ssi.m_all_shader_groups_mutex);
-                group = m_ssi.m_all_shader_groups[i].lock();
-            }
-            if (group)
-                jit_group (*group, ctx);
-        }
-    }
-    m_ssi.release_context(ctx);
-    m_ssi.destroy_thread_info(threadinfo);
+    m_ssi.compile_all_groups (nthreads, parallel_for,
+        [](const ShaderGroup &group) {
+            return ! group.batch_jitted();
+        },
+        [this](ShaderGroup &group, ShadingContext *ctx) {
+            jit_group (group, ctx);
+        });
 }
 
 // Explicitly instantiate, although might need to specialize on target
 // machine as well, start with just the batch size
 template class pvt::ShadingSystemImpl::Batched<16>;
 template class pvt::ShadingSystemImpl::Batched<8>;
+template class pvt::ShadingSystemImpl::Batched<4>;
 #endif
 
 int
@@ -3670,13 +6636,11 @@ ShadingSystemImpl::merge_instances (ShaderGroup &group, bool post_opt)
     // general shading and lookdev approach of the studio.  But it was
     // very helpful for us in many cases.
     //
-    // The basic loop below looks very inefficient, O(n^2) in number of
-    // instances in the group. But it's really not -- a few seconds (sum
-    // of all threads) for even our very complex scenes. This is because
-    // most potential pairs have a very fast rejection case if they are
-    // not using the same master.  Since there's no appreciable cost to
-    // the brute force approach, it seems silly to have a complex scheme
-    // to try to reduce the number of pairings.
+    // Comparing every pair of layers is O(n^2) in the number of layers,
+    // which is noticeable for generated networks of a thousand or more.
+    // Instead, layers are bucketed by ShaderInstance::merge_signature(),
+    // which mergeable instances always share, and each layer is only
+    // compared with the earlier layers kept in its bucket.
 
     if (! m_opt_merge_instances || optimize() < 1)
         return 0;
@@ -3692,64 +6656,76 @@ ShadingSystemImpl::merge_instances (ShaderGroup &group, bool post_opt)
         if (! group[layer]->unused())
             group[layer]->evaluate_writes_globals_and_userdata_params ();
 
-    // Loop over all layers...
-    for (int a = 0;  a < nlayers-1;  ++a) {
-        if (group[a]->unused() || group[a]->entry_layer()) // Don't merge a layer that's not used
-            continue;                                      // or if it's an entry layer
-        // Check all later layers...
-        for (int b = a+1;  b < nlayers;  ++b) {
-            if (group[b]->unused())    // Don't merge a layer that's not used
-                continue;
-            if (b == nlayers-1)   // Don't merge the last layer -- causes
-                continue;         // many tears because it's the group entry
+    // Visit the layers in order.  Merging a layer rewires the connections
+    // of all the later layers before they are visited, so by the time a
+    // layer's signature is taken, its upstream layers have already been
+    // merged, and a single pass finds all the merges there are.
+    std::unordered_map<size_t, std::vector<int>> buckets;
+    for (int b = 0;  b < nlayers;  ++b) {
+        ShaderInstance *B = group[b];
+        if (B->unused() || B->renderer_outputs())  // Don't merge a layer that's
+            continue;                              // not used or is an output
+        std::vector<int> &bucket (buckets[B->merge_signature()]);
+
+        // See if B is mergeable with (identical to) an earlier layer.  All
+        // the heavy lifting is done by ShaderInstance::mergeable().
+        int a = -1;
+        if (b != nlayers-1) {   // Don't merge the last layer -- causes
+                                // many tears because it's the group entry
+            for (int candidate : bucket) {
+                if (group[candidate]->mergeable (*B, group)) {
+                    a = candidate;
+                    break;
+                }
+            }
+        }
+        if (a < 0) {
+            // Keep B, and offer it to later layers -- unless it's an entry
+            // layer, which is never kept in place of another.
+            if (! B->entry_layer())
+                bucket.push_back (b);
+            continue;
+        }
 
-            // Now we have two used layers, a and b, to examine.
-            // See if they are mergeable (identical).  All the heavy
-            // lifting is done by ShaderInstance::mergeable().
-            if (! group[a]->mergeable (*group[b], group))
-                continue;
+        // The two nodes a and b are mergeable, so merge them.
+        ShaderInstance *A = group[a];
+        ++merges;
 
-            // The two nodes a and b are mergeable, so merge them.
-            ShaderInstance *A = group[a];
-            ShaderInstance *B = group[b];
-            ++merges;
-
-            // We'll keep A, get rid of B.  For all layers later than B,
-            // check its incoming connections and replace all references
-            // to B with references to A.
-            for (int j = b+1;  j < nlayers;  ++j) {
-                ShaderInstance *inst = group[j];
-                if (inst->unused())  // don't bother if it's unused
-                    continue;
-                for (int c = 0, ce = inst->nconnections();  c < ce;  ++c) {
-                    Connection &con = inst->connection(c);
-                    if (con.srclayer == b) {
-                        con.srclayer = a;
-                        A->outgoing_connections (true);
-                        if (A->symbols().size() && B->symbols().size()) {
-                            OSL_DASSERT (A->symbol(con.src.param)->name() ==
-                                         B->symbol(con.src.param)->name());
-                        }
+        // We'll keep A, get rid of B.  For all layers later than B,
+        // check its incoming connections and replace all references
+        // to B with references to A.
+        for (int j = b+1;  j < nlayers;  ++j) {
+            ShaderInstance *inst = group[j];
+            if (inst->unused())  // don't bother if it's unused
+                continue;
+            for (int c = 0, ce = inst->nconnections();  c < ce;  ++c) {
+                Connection &con = inst->connection(c);
+                if (con.srclayer == b) {
+                    con.srclayer = a;
+                    A->outgoing_connections (true);
+                    if (A->symbols().size() && B->symbols().size()) {
+                        OSL_DASSERT (A->symbol(con.src.param)->name() ==
+                                     B->symbol(con.src.param)->name());
                     }
                 }
             }
+        }
 
-            // Mark parameters of B as no longer connected
-            for (int p = B->firstparam();  p < B->lastparam();  ++p) {
-                if (B->symbols().size())
-                    B->symbol(p)->connected_down(false);
-                if (B->m_instoverrides.size())
-                    B->instoverride(p)->connected_down(false);
-            }
-            // B won't be used, so mark it as having no outgoing
-            // connections and clear its incoming connections (which are
-            // no longer used).
-            OSL_DASSERT (B->merged_unused() == false);
-            B->outgoing_connections (false);
-            connectionmem += B->clear_connections ();
-            B->m_merged_unused = true;
-            OSL_DASSERT (B->unused());
+        // Mark parameters of B as no longer connected
+        for (int p = B->firstparam();  p < B->lastparam();  ++p) {
+            if (B->symbols().size())
+                B->symbol(p)->connected_down(false);
+            if (B->m_instoverrides.size())
+                B->instoverride(p)->connected_down(false);
         }
+        // B won't be used, so mark it as having no outgoing
+        // connections and clear its incoming connections (which are
+        // no longer used).
+        OSL_DASSERT (B->merged_unused() == false);
+        B->outgoing_connections (false);
+        connectionmem += B->clear_connections ();
+        B->m_merged_unused = true;
+        OSL_DASSERT (B->unused());
     }
 
     {
@@ -3778,7 +6754,8 @@ OCIOColorSystem::load_transform (StringParam fromspace, StringParam tospace,
 {
     if (fromspace != m_last_colorproc_fromspace ||
         tospace != m_last_colorproc_tospace) {
-        m_last_colorproc = colorconfig(ss).createColorProcessor(fromspace, tospace);
+        m_last_colorproc = ss ? ss->ocio_processor(fromspace, tospace)
+                              : colorconfig(ss).createColorProcessor(fromspace, tospace);
         m_last_colorproc_fromspace = fromspace;
         m_last_colorproc_tospace = tospace;
     }
@@ -3814,6 +6791,26 @@ ShadingSystemImpl::colorconfig()
 
 
 
+OIIO::ColorProcessorHandle
+ShadingSystemImpl::ocio_processor (ustring fromspace, ustring tospace)
+{
+    auto key = std::make_pair (fromspace, tospace);
+    {
+        spin_lock lock (m_ocio_processors_mutex);
+        auto found = m_ocio_processors.find (key);
+        if (found != m_ocio_processors.end())
+            return found->second;
+    }
+    // Building a processor can be slow, so do it without holding the
+    // lock; if another thread raced us to it, keep the first one.
+    OIIO::ColorProcessorHandle processor
+        = colorconfig()->createColorProcessor (fromspace, tospace);
+    spin_lock lock (m_ocio_processors_mutex);
+    return m_ocio_processors.emplace (key, processor).first->second;
+}
+
+
+
 bool
 ShadingSystemImpl::archive_shadergroup (ShaderGroup& group, string_view filename)
 {
@@ -3926,6 +6923,7 @@ ClosureRegistry::register_closure (string_view name, int id,
     entry.nformal = 0;
     entry.nkeyword = 0;
     entry.struct_size = 0; /* params could be NULL */
+    entry.alignment = int(alignof(ClosureComponent));
     for (int i = 0; params; ++i) {
         /* always push so the end marker is there */
         entry.params.push_back(params[i]);
@@ -3938,6 +6936,10 @@ ClosureRegistry::register_closure (string_view name, int id,
                 "Closure %s wants alignment of %d which is larger than that of ClosureComponent",
                 std::string(name).c_str(),
                 params[i].field_size);
+            /* A component is never aligned less than ClosureComponent
+             * itself, whose type promises that alignment to the renderer. */
+            entry.alignment = std::max(params[i].field_size,
+                                       int(alignof(ClosureComponent)));
             break;
         }
         if (params[i].key == nullptr)
@@ -3945,6 +6947,8 @@ ClosureRegistry::register_closure (string_view name, int id,
         else
             entry.nkeyword ++;
     }
+    entry.component_size = (int(sizeof(ClosureComponent)) + entry.struct_size
+                             + entry.alignment - 1) & ~(entry.alignment - 1);
     entry.prepare = prepare;
     entry.setup = setup;
     m_closure_name_to_id[ustring(name)] = id;
@@ -4005,6 +7009,22 @@ ShadingContext::ocio_transform (StringParam fromspace, StringParam tospace,
 
 
 
+bool
+ShadingContext::ocio_transform (StringParam fromspace, StringParam tospace,
+                                Color3 *colors, int n) {
+#ifndef __CUDA_ARCH__
+    if (auto cp = m_ocio_system.load_transform(fromspace, tospace, &shadingsys())) {
+        // The colors are one n x 1 RGB image as far as OCIO is concerned
+        if (n > 0)
+            cp->apply ((float *)colors, n, 1, 3, sizeof(float), sizeof(Color3), 0);
+        return true;
+    }
+#endif
+    return false;
+}
+
+
+
 OSL_NAMESPACE_EXIT
 
 
@@ -4266,7 +7286,8 @@ OSL_SHADEOP int osl_get_attribute(void *sg_,
                              int   array_lookup,
                              int   index,
                              long long attr_type,
-                             void *attr_dest)
+                             void *attr_dest,
+                             void *attr_handle)
 {
     ShaderGlobals *sg   = (ShaderGlobals *)sg_;
     const ustring &obj_name  = USTR(obj_name_);
@@ -4276,7 +7297,7 @@ OSL_SHADEOP int osl_get_attribute(void *sg_,
                                            dest_derivs, obj_name, attr_name,
                                            array_lookup, index,
                                            TYPEDESC(attr_type),
-                                           attr_dest);
+                                           attr_dest, attr_handle);
 }
 
 
@@ -4292,13 +7313,53 @@ osl_bind_interpolated_param (void *sg_, const void *name, long long type,
     if (status == 0) {
         // First time retrieving this userdata
         ShaderGlobals *sg = (ShaderGlobals *)sg_;
-        bool ok = sg->renderer->get_userdata (userdata_has_derivs, USTR(name),
-                                              TYPEDESC(type),
-                                              sg, userdata_data);
+        ShadingContext *ctx = sg->context;
+        TypeDesc t = TYPEDESC(type);
+        size_t size = t.size() * (userdata_has_derivs ? 3 : 1);
+        bool per_object = ctx->object_lookup (USTR(name));
+        bool ok;
+        if (auto e = per_object
+                     ? ctx->find_lookup (ShadingContext::LookupUserdata, 1,
+                                         ustring(), USTR(name), t, -1,
+                                         userdata_has_derivs, true)
+                     : nullptr) {
+            // Constant over the object, and an earlier point of it
+            // already asked the renderer.
+            ok = e->ok;
+            if (ok)
+                memcpy (userdata_data, ctx->lookup_data(*e), size);
+        } else {
+            if (ctx->replaying()) {
+                auto c = ctx->replay_lookup (ShadingContext::LookupUserdata,
+                                             ustring(), USTR(name), t, -1,
+                                             userdata_has_derivs);
+                ok = c && c->ok;
+                if (ok)
+                    memcpy (userdata_data, c->data.data(), size);
+            } else {
+                ok = sg->renderer->get_userdata (userdata_has_derivs,
+                                                 USTR(name), t, sg,
+                                                 userdata_data);
+            }
+            ctx->incr_get_userdata_calls ();
+            if (per_object) {
+                auto& e = ctx->add_lookup (ShadingContext::LookupUserdata, 1,
+                                           ustring(), USTR(name), t, -1,
+                                           userdata_has_derivs,
+                                           ok ? size : 0, true);
+                e.fetched = 1;
+                e.ok = ok;
+                if (ok)
+                    memcpy (ctx->lookup_data(e), userdata_data, size);
+            }
+        }
+        if (ctx->capturing())
+            ctx->capture_lookup (ShadingContext::LookupUserdata, ustring(),
+                                 USTR(name), t, -1, userdata_has_derivs, ok,
+                                 userdata_data, size);
         // printf ("Binding %s %s : index %d, ok = %d\n", name,
         //         TYPEDESC(type).c_str(),userdata_index, ok);
         *userdata_initialized = status = 1 + ok;  // 1 = not found, 2 = found
-        sg->context->incr_get_userdata_calls ();
     }
     if (status == 2) {
         // If userdata was present, copy it to the shader variable
@@ -99,6 +99,58 @@ OSL_HOSTDEVICE static int basis_type_of(StringParam basis_name)
     return kLinear;
 }
 
+// Solve ((tk[0]*t + tk[1])*t + tk[2])*t + tk[3] == y for t in [0,1], the
+// cubic of one spline segment, given that its values v0 at t=0 and v1 at
+// t=1 bracket y.  Newton's method starting from the regula falsi guess,
+// falling back to bisection whenever a step would leave the bracket.
+// Stops when the value is within veps of y or the bracket is narrower
+// than teps.  'slope' receives the derivative of the cubic at the result.
+template<int maxiters = 32>
+OSL_HOSTDEVICE inline float
+solve_segment (const float tk[4], float y, float v0, float v1,
+               float veps, float teps, float &slope)
+{
+    float t = 0.0f;
+    if (fabsf(v1 - v0) >= veps) {   // else already close enough
+        bool increasing = v0 < v1;
+        float t0 = 0.0f, t1 = 1.0f;
+        t = (y - v0) / (v1 - v0);
+        for (int iters = 0;  iters < maxiters;  ++iters) {
+            float v = ((tk[0]*t + tk[1])*t + tk[2])*t + tk[3];
+            if (fabsf(v - y) < veps)
+                break;
+            if ((v < y) == increasing)
+                t0 = t;
+            else
+                t1 = t;
+            if (t1 - t0 < teps)
+                break;
+            // A flat spot gives an inf or nan step, which fails the
+            // bracket test and bisects.
+            float d = (3.0f*tk[0]*t + 2.0f*tk[1])*t + tk[2];
+            float tn = t - (v - y) / d;
+            t = (tn > t0 && tn < t1) ? tn : 0.5f * (t0 + t1);
+        }
+    }
+    slope = (3.0f*tk[0]*t + 2.0f*tk[1])*t + tk[2];
+    return t;
+}
+
+// Store an inverse result, with derivatives (when wanted) taken from y's
+// through the implicit function theorem: dx = dy / (dS/dx).
+OSL_HOSTDEVICE inline void
+assign_inverse (float &x, float xval, const float & /*y*/, float /*dxdy*/)
+{
+    x = xval;
+}
+
+OSL_HOSTDEVICE inline void
+assign_inverse (Dual2<float> &x, float xval, const Dual2<float> &y, float dxdy)
+{
+    x = Dual2<float> (xval, dxdy * y.dx(), dxdy * y.dy());
+}
+
+
 struct SplineInterp {
     const SplineBasis& spline;
     const bool         constant;
@@ -253,21 +305,69 @@ struct SplineInterp {
         }
 
 
-        SplineFunctor<YTYPE,YTYPE> S (*this, knots, knot_count, knot_arraylen);
+        int nsegs = (knot_count - 4) / spline.basis_step + 1;
+        float nseginv = 1.0f / nsegs;
+
+        if (constant) {
+            // A step function, so no cubic to solve.  Search each
+            // interval with the general inverter.
+            SplineFunctor<YTYPE,YTYPE> S (*this, knots, knot_count, knot_arraylen);
+            YTYPE r0 = 0.0;
+            x = 0;
+            for (int s = 0;  s < nsegs;  ++s) {  // Search each interval
+                YTYPE r1 = nseginv * (s+1);
+                bool brack;
+                x = OIIO::invert (S, y, r0, r1, 32, YTYPE(1.0e-6), &brack);
+                if (brack)
+                    return;
+                r0 = r1;  // Start of next interval is end of this one
+            }
+            return;
+        }
+
         // Because of the nature of spline interpolation, monotonic knots
         // can still lead to a non-monotonic curve.  To deal with this,
         // search separately on each spline segment and hope for the best.
-        int nsegs = (knot_count - 4) / spline.basis_step + 1;
-        float nseginv = 1.0f / nsegs;
-        YTYPE r0 = 0.0;
-        x = 0;
+        // Each segment's cubic is built once, both to test whether it
+        // brackets y and to solve on it, rather than evaluating the
+        // whole spline at every step.
+        float yval = removeDerivatives (y);
         for (int s = 0;  s < nsegs;  ++s) {  // Search each interval
-            YTYPE r1 = nseginv * (s+1);
-            bool brack;
-            x = OIIO::invert (S, y, r0, r1, 32, YTYPE(1.0e-6), &brack);
-            if (brack)
+            float tk[4];
+            segment_coefficients (tk, knots, s);
+            float v0 = tk[3];
+            float v1 = ((tk[0] + tk[1]) + tk[2]) + tk[3];
+            bool seg_increasing = v0 < v1;
+            float vmin = seg_increasing ? v0 : v1;
+            float vmax = seg_increasing ? v1 : v0;
+            if (yval >= vmin && yval <= vmax) {
+                float slope;
+                float t = solve_segment (tk, yval, v0, v1, 1.0e-6f,
+                                         1.0e-6f * nsegs, slope);
+                float dxdy = (slope != 0.0f) ? nseginv / slope : 0.0f;
+                assign_inverse (x, (float(s) + t) * nseginv, y, dxdy);
                 return;
-            r0 = r1;  // Start of next interval is end of this one
+            }
+            if (s == nsegs-1) {
+                // Nothing bracketed y, return the appropriate "edge" of
+                // the last interval
+                bool low = ((yval < vmin) == seg_increasing);
+                x = YTYPE(low ? float(s) * nseginv : 1.0f);
+            }
+        }
+    }
+
+    // Coefficients of segment 'segnum''s cubic in its local t, the same
+    // ones evaluate() builds: ((tk[0]*t + tk[1])*t + tk[2])*t + tk[3]
+    OSL_HOSTDEVICE void
+    segment_coefficients (float tk[4], const float *knots, int segnum) const
+    {
+        const float *P = knots + segnum * spline.basis_step;
+        for (int k = 0; k < 4; k++) {
+            tk[k] = spline.basis[k][0] * P[0] +
+                    spline.basis[k][1] * P[1] +
+                    spline.basis[k][2] * P[2] +
+                    spline.basis[k][3] * P[3];
         }
     }
 };
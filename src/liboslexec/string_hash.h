@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <OSL/oslconfig.h>
 #include <OpenImageIO/oiioversion.h>
 #include <OpenImageIO/detail/farmhash.h>
 
@@ -30,3 +31,16 @@ OIIO_CONSTEXPR14 inline size_t Hash(const char* s)
 }
 }
 
+
+OSL_NAMESPACE_ENTER
+// The hash of each of the 'standard' strings declared in <OSL/strdecls.h>,
+// computed at compile time.  On OptiX 7 a string is just its hash, so
+// device code compares against these constants and none of the standard
+// strings need to be registered with the renderer at runtime.
+namespace Hashes {
+#define STRDECL(str,var_name) \
+    static constexpr size_t var_name = UStringHash::Hash(str);
+#include <OSL/strdecls.h>
+#undef STRDECL
+}
+OSL_NAMESPACE_EXIT
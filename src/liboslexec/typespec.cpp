@@ -6,6 +6,7 @@
 #include <string>
 #include <cstdio>
 #include <memory>
+#include <mutex>
 
 #include <OpenImageIO/strutil.h>
 #include <OpenImageIO/thread.h>
@@ -29,6 +30,12 @@ TypeSpec::struct_list ()
 
 
 
+// Masters may be loaded by several threads at once, and each may find
+// struct types it needs to add to the table.
+static std::recursive_mutex struct_list_mutex;
+
+
+
 TypeSpec::TypeSpec (const char *name, int structid, int arraylen)
     : m_simple(TypeDesc::UNKNOWN, arraylen), m_structure((short)structid),
       m_closure(false)
@@ -80,6 +87,7 @@ TypeSpec::c_str () const
 int
 TypeSpec::structure_id (const char *name, bool add)
 {
+    std::lock_guard<std::recursive_mutex> lock (struct_list_mutex);
     std::vector<std::shared_ptr<StructSpec> > & m_structs (struct_list());
     ustring n (name);
     for (int i = (int)m_structs.size()-1;  i > 0;  --i) {
@@ -102,6 +110,7 @@ TypeSpec::structure_id (const char *name, bool add)
 int
 TypeSpec::new_struct (StructSpec *n)
 {
+    std::lock_guard<std::recursive_mutex> lock (struct_list_mutex);
     std::vector<std::shared_ptr<StructSpec> > & m_structs (struct_list());
     if (m_structs.size() == 0)
         m_structs.resize (1);   // Allocate an empty one
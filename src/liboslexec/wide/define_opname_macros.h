@@ -7,7 +7,7 @@
 #endif
 
 #ifndef __OSL_TARGET_ISA
-#    error must define __OSL_TARGET_ISA to AVX512, AVX2, AVX, SSE4_2, or x64 before including this header
+#    error must define __OSL_TARGET_ISA to AVX512, AVX2, AVX, SSE4_2, NEON, or x64 before including this header
 #endif
 
 #include <OSL/export.h>
@@ -20,6 +20,23 @@ namespace __OSL_WIDE_PVT {
 OSL_USING_DATA_WIDTH(__OSL_WIDTH)
 
 
+// The active lanes that have a closure and a weight worth keeping.
+template<typename WeightT>
+static Mask
+keep_weighted_lanes (const ShadingContext &ctx, Mask mask,
+                     Wide<const ClosureColorPtr> wide_closure,
+                     Wide<const WeightT> wide_weight)
+{
+    Mask keep(false);
+    for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+        if (mask[lane] && wide_closure[lane]
+            && ! ctx.negligible_closure_weight (Color3(wide_weight[lane])))
+            keep.set_on (lane);
+    }
+    return keep;
+}
+
+
 OSL_BATCHOP void
 __OSL_MASKED_OP(add_closure_closure) (void *bsg_, void *wide_out_, 
         void *wide_closure_a_, void* wide_closure_b_, unsigned int mask_value)
@@ -61,21 +78,26 @@ __OSL_MASKED_OP(mul_closure_color) (void *bsg_, void *wide_out_,
         void *wide_closure_a_,  void *wide_weight_, unsigned int mask_value)
 {
     auto *bsg = reinterpret_cast<BatchedShaderGlobals *>(bsg_);
-    // TODO avoid allot if weight = 0 or closure = null?
     Mask mask(mask_value);
     Masked<ClosureColorPtr> wide_out (wide_out_, mask);
     Wide<const Color3> wide_weight (wide_weight_);
     Wide<const ClosureColorPtr> wide_closure_a (wide_closure_a_);
-    
-    ClosureMul *mul = bsg->uniform.context->batched<__OSL_WIDTH>().closure_mul_allot();
+
+    // Like the scalar op, lanes with no closure or a negligible weight
+    // get a null result rather than a mul node.
+    Mask keep = keep_weighted_lanes (*bsg->uniform.context, mask,
+                                     wide_closure_a, wide_weight);
+    ClosureMul *mul = keep.any_on()
+                    ? bsg->uniform.context->batched<__OSL_WIDTH>().closure_mul_allot()
+                    : nullptr;
 
     // Currently this is done as AOS, future work may improve this by converting to SOA
     OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
     for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
-        ClosureMul *m = &mul[lane];
         const Color3 w = wide_weight[lane];
         const ClosureColor* ca = wide_closure_a[lane]; 
-        if (mask[lane]) {
+        if (keep[lane]) {
+            ClosureMul *m = &mul[lane];
             m->id = ClosureColor::MUL;
             m->weight = w;
             m->closure = ca;
@@ -87,7 +109,7 @@ __OSL_MASKED_OP(mul_closure_color) (void *bsg_, void *wide_out_,
     // new result
     OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
     for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
-        ClosureColorPtr m = (ClosureColorPtr)&mul[lane];
+        ClosureColorPtr m = keep[lane] ? (ClosureColorPtr)&mul[lane] : nullptr;
         wide_out[lane] = m;
     }
 }
@@ -98,22 +120,25 @@ __OSL_MASKED_OP(mul_closure_float) (void *bsg_, void *wide_out_,
         void *wide_closure_a_, void * wide_weight_, unsigned int mask_value)
 {
     auto *bsg = reinterpret_cast<BatchedShaderGlobals *>(bsg_);
-    // TODO avoid allot if weight = 0 or closure = null?
     Mask mask(mask_value);
     Masked<ClosureColorPtr> wide_out (wide_out_, mask);
     Wide<const float> wide_weight (wide_weight_);
     Wide<const ClosureColorPtr> wide_closure_a (wide_closure_a_);
 
-    ClosureMul *mul = bsg->uniform.context->batched<__OSL_WIDTH>().closure_mul_allot ();
+    Mask keep = keep_weighted_lanes (*bsg->uniform.context, mask,
+                                     wide_closure_a, wide_weight);
+    ClosureMul *mul = keep.any_on()
+                    ? bsg->uniform.context->batched<__OSL_WIDTH>().closure_mul_allot ()
+                    : nullptr;
 
     // Currently this is done as AOS, future work may improve this by converting to SOA
     OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
     for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
-        ClosureMul *m = &mul[lane];
         const float w = wide_weight[lane];
         const Color3 weight(w, w, w);
         const ClosureColor* ca = wide_closure_a[lane]; 
-        if (mask[lane]) {
+        if (keep[lane]) {
+            ClosureMul *m = &mul[lane];
             m->id = ClosureColor::MUL;
             m->weight = weight;
             m->closure = ca;
@@ -125,17 +150,14 @@ __OSL_MASKED_OP(mul_closure_float) (void *bsg_, void *wide_out_,
     // new result
     OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
     for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
-        ClosureColorPtr m = (ClosureColorPtr)&mul[lane];
+        ClosureColorPtr m = keep[lane] ? (ClosureColorPtr)&mul[lane] : nullptr;
         wide_out[lane] = m;
     }
 }
 
 
-void init_closure_component(Masked<ClosureComponentPtr> &wComp, int id, int size, Wide<const Color3> wWeight, ClosureComponent* comp_mem)
+void init_closure_component(Masked<ClosureComponentPtr> &wComp, int id, size_t stride, Wide<const Color3> wWeight, ClosureComponent* comp_mem)
 {
-
-    constexpr int alignment = alignof(ClosureComponent);
-    size_t stride = (int)((sizeof(ClosureComponent) + size + alignment-1)/alignment)*alignment;
     // Currently this is done as AOS, future work may improve this by converting to SOA
     OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
     for(int lane = 0; lane < __OSL_WIDTH; ++lane) {
@@ -158,8 +180,10 @@ __OSL_MASKED_OP(allocate_closure_component) (void *bsg_, void *wide_out_, int id
     Block<Color3> one_block;
     assign_all(one_block, Color3(1.0f));
     Wide<const Color3> wWeight (&one_block);
-    ClosureComponent *comp_mem = bsg->uniform.context->batched<__OSL_WIDTH>().closure_component_allot (size);
-    init_closure_component (wComp, id, size, wWeight, comp_mem);
+    // size is the parameter struct's, already part of component_size
+    const auto *clentry = bsg->uniform.context->shadingsys().find_closure(id);
+    ClosureComponent *comp_mem = bsg->uniform.context->batched<__OSL_WIDTH>().closure_component_allot (*clentry);
+    init_closure_component (wComp, id, clentry->component_size, wWeight, comp_mem);
 }
 
 OSL_BATCHOP void
@@ -170,8 +194,10 @@ __OSL_MASKED_OP(allocate_weighted_closure_component) (void *bsg_, void *wide_out
     auto *bsg = reinterpret_cast<BatchedShaderGlobals *>(bsg_);
     Masked<ClosureComponentPtr> wComp (wide_out_, Mask(mask_value));
     Wide<const Color3> wWeight (wide_weight_);
-    ClosureComponent *comp_mem = bsg->uniform.context->batched<__OSL_WIDTH>().closure_component_allot (size);
-    init_closure_component (wComp, id, size, wWeight, comp_mem);
+    // size is the parameter struct's, already part of component_size
+    const auto *clentry = bsg->uniform.context->shadingsys().find_closure(id);
+    ClosureComponent *comp_mem = bsg->uniform.context->batched<__OSL_WIDTH>().closure_component_allot (*clentry);
+    init_closure_component (wComp, id, clentry->component_size, wWeight, comp_mem);
 }
 
 // This currently duplicates the scalar version of the op, but
@@ -171,6 +171,63 @@ __OSL_OP(prepend_color_from_vs)
 
 namespace {
 
+// Apply an OCIO transform to the active lanes as one packed block, with
+// a single call to the processor rather than one per lane.  Like the
+// scalar ColorSystem::ocio_transform, a missing transform is an error
+// and leaves the colors unchanged.
+void
+wide_ocio_transform(ShadingContext *ctx, const ColorSystem &cs,
+    StringParam fromspace, StringParam tospace,
+    Masked<Color3> wOutput, Wide<const Color3> wInput)
+{
+    Color3 colors[__OSL_WIDTH];
+    int lanes[__OSL_WIDTH];
+    int n = 0;
+    wOutput.mask().foreach([&](ActiveLane lane)->void {
+        lanes[n] = lane;
+        colors[n++] = wInput[lane];
+    });
+    if (! ctx->ocio_transform(fromspace, tospace, colors, n))
+        cs.error(fromspace, tospace, ctx);
+    for (int i = 0; i < n; ++i)
+        wOutput[ActiveLane(lanes[i])] = colors[i];
+}
+
+void
+wide_ocio_transform(ShadingContext *ctx, const ColorSystem &cs,
+    StringParam fromspace, StringParam tospace,
+    Masked<Dual2<Color3>> wOutput, Wide<const Dual2<Color3>> wInput)
+{
+    // Derivatives by finite differencing, as the scalar version does:
+    // three colors per lane go through the processor.
+    const float eps = 0.001f;
+    Color3 colors[3*__OSL_WIDTH];
+    int lanes[__OSL_WIDTH];
+    int n = 0;
+    wOutput.mask().foreach([&](ActiveLane lane)->void {
+        Dual2<Color3> C = wInput[lane];
+        lanes[n] = lane;
+        colors[3*n+0] = C.val();
+        colors[3*n+1] = C.val() + eps*C.dx();
+        colors[3*n+2] = C.val() + eps*C.dy();
+        ++n;
+    });
+    if (! ctx->ocio_transform(fromspace, tospace, colors, 3*n)) {
+        cs.error(fromspace, tospace, ctx);
+        wOutput.mask().foreach([&](ActiveLane lane)->void {
+            Dual2<Color3> C = wInput[lane];
+            wOutput[lane] = C;
+        });
+        return;
+    }
+    for (int i = 0; i < n; ++i) {
+        const Color3 *CC = colors + 3*i;
+        wOutput[ActiveLane(lanes[i])] = Dual2<Color3>(CC[0],
+            (CC[1] - CC[0]) * (1.0f / eps),
+            (CC[2] - CC[0]) * (1.0f / eps));
+    }
+}
+
 // NOTE: keep implementation as mirror of ColorSystem::to_rgb
 void
 wide_prepend_color_from(ShadingContext *ctx, const ColorSystem &cs, Masked<Color3> wR,
@@ -244,12 +301,8 @@ wide_prepend_color_from(ShadingContext *ctx, const ColorSystem &cs, Masked<Color
         return;
     }
 
-    // Serialize calls to ocio
-    wR.mask().foreach([=,&cs](ActiveLane lane)->void {
-        Color3 C = wR[lane];
-        Color3 R = cs.ocio_transform (fromspace, STRING_PARAMS(RGB), C, ctx);
-        wR[lane] = R;
-    });
+    wide_ocio_transform(ctx, cs, fromspace, STRING_PARAMS(RGB), wR,
+                        Wide<const Color3>(&wR.data()));
 }
 
 } // namespace
@@ -448,12 +501,7 @@ wide_transformc (const ColorSystem cs, StringParam fromspace, StringParam tospac
     }
 
     if (use_colorconfig) {
-        // Serialize calls to ocio
-        wOutput.mask().foreach([=,&cs](ActiveLane lane)->void {
-            COLOR C = wInput[lane];
-            COLOR Cto = cs.ocio_transform (fromspace, tospace, C, context);
-            wOutput[lane] = Cto;
-        });
+        wide_ocio_transform(context, cs, fromspace, tospace, wOutput, wInput);
     }
 }
 
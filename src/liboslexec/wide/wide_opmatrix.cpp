@@ -13,6 +13,9 @@
 #include <OSL/batched_rendererservices.h>
 #include <OSL/batched_shaderglobals.h>
 #include <OSL/wide.h>
+#ifdef __OSL_BATCHED_RS_BITCODE
+#    include <OSL/batched_rs_free_function.h>
+#endif
 
 #include <OpenImageIO/fmath.h>
 
@@ -23,12 +26,93 @@ namespace __OSL_WIDE_PVT {
 
 OSL_USING_DATA_WIDTH(__OSL_WIDTH)
 
-using BatchedRendererServices = OSL::BatchedRendererServices<__OSL_WIDTH>;
-
 #include "define_opname_macros.h"
 
 namespace {
 
+#ifdef __OSL_BATCHED_RS_BITCODE
+// When this file is compiled to bitcode for "batched_rs_bitcode", matrix
+// lookups go to the renderer's rs_bW_* free functions instead of the
+// BatchedRendererServices virtuals, so they can be inlined into the
+// shader.  This stand-in has the subset of the BatchedRendererServices
+// interface used below; the lookups it doesn't have a free function for
+// report themselves as not overridden, so the defaults here build them
+// from the ones it does.
+#    define __OSL_RS_FUNC3(WIDTH, NAME) rs_b##WIDTH##_##NAME
+#    define __OSL_RS_FUNC2(WIDTH, NAME) __OSL_RS_FUNC3(WIDTH, NAME)
+#    define __OSL_RS_FUNC(NAME)         __OSL_RS_FUNC2(__OSL_WIDTH, NAME)
+
+struct FreeFunctionRendererServices {
+    Mask get_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> wresult,
+                    Wide<const TransformationPtr> wxform,
+                    Wide<const float> wtime)
+    {
+        return Mask(__OSL_RS_FUNC(get_matrix_xform_time)(bsg, wresult, wxform,
+                                                         wtime));
+    }
+    Mask get_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> wresult,
+                    ustring from, Wide<const float> wtime)
+    {
+        return Mask(
+            __OSL_RS_FUNC(get_matrix_space_time)(bsg, wresult, from, wtime));
+    }
+    Mask get_matrix(BatchedShaderGlobals*, Masked<Matrix44>,
+                    Wide<const ustring>, Wide<const float>)
+    {
+        OSL_ASSERT(0 && "not overridden, use default_get_matrix");
+        return Mask(false);
+    }
+    bool is_overridden_get_matrix_WmWsWf() const { return false; }
+
+    Mask get_inverse_matrix(BatchedShaderGlobals* bsg,
+                            Masked<Matrix44> wresult,
+                            Wide<const TransformationPtr> wxform,
+                            Wide<const float> wtime)
+    {
+        return Mask(__OSL_RS_FUNC(get_inverse_matrix_xform_time)(bsg, wresult,
+                                                                 wxform,
+                                                                 wtime));
+    }
+    bool is_overridden_get_inverse_matrix_WmWxWf() const { return true; }
+    Mask get_inverse_matrix(BatchedShaderGlobals* bsg,
+                            Masked<Matrix44> wresult, ustring to,
+                            Wide<const float> wtime)
+    {
+        return Mask(__OSL_RS_FUNC(get_inverse_matrix_space_time)(bsg, wresult,
+                                                                 to, wtime));
+    }
+    bool is_overridden_get_inverse_matrix_WmsWf() const { return true; }
+    Mask get_inverse_matrix(BatchedShaderGlobals*, Masked<Matrix44>,
+                            Wide<const ustring>, Wide<const float>)
+    {
+        OSL_ASSERT(0 && "not overridden, use default_get_inverse_matrix");
+        return Mask(false);
+    }
+    bool is_overridden_get_inverse_matrix_WmWsWf() const { return false; }
+};
+
+#    undef __OSL_RS_FUNC
+#    undef __OSL_RS_FUNC2
+#    undef __OSL_RS_FUNC3
+
+using BatchedRendererServices = FreeFunctionRendererServices;
+
+OSL_FORCEINLINE BatchedRendererServices*
+renderer_services(ShadingContext*)
+{
+    static BatchedRendererServices free_function_rs;
+    return &free_function_rs;
+}
+#else
+using BatchedRendererServices = OSL::BatchedRendererServices<__OSL_WIDTH>;
+
+OSL_FORCEINLINE BatchedRendererServices*
+renderer_services(ShadingContext* ctx)
+{
+    return ctx->batched<__OSL_WIDTH>().renderer();
+}
+#endif
+
 // invoke is helper to ensure a functor is compiled inside a
 // actual function call vs. inlining.
 // Useful for keeping the slow path from fusing
@@ -203,7 +287,10 @@ default_get_inverse_matrix(BatchedRendererServices* bsr,
         OSL_FORCEINLINE_BLOCK
         {
             Block<Matrix44> wmatrix;
-            Mask succeeded = dispatch_get_matrix(bsr, bsg, wresult, wto, wtime);
+            Mask succeeded
+                = dispatch_get_matrix(bsr, bsg,
+                                      Masked<Matrix44>(wmatrix, wresult.mask()),
+                                      wto, wtime);
             invert_wide_matrix(wresult & succeeded, wmatrix);
             return succeeded;
         }
@@ -501,6 +588,74 @@ makeIdentity(Masked<Matrix44> wrm)
     }
 }
 
+// Look up a named space's matrix (or its inverse) for the lanes of
+// wresult.  When "cache_lookups" is on, lanes an earlier call fetched
+// during this batch are copied from the context's lookup cache and only
+// the others go to the renderer.  That includes "shader" and "object",
+// so each is inverted at most once per batch.
+Mask
+get_named_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> wresult,
+                 ustring name, bool inverse)
+{
+    ShadingContext* ctx = bsg->uniform.context;
+    auto* bsr           = renderer_services(ctx);
+    auto lookup         = [&](Masked<Matrix44> wdest) -> Mask {
+        if (name == Strings::shader || name == Strings::object) {
+            const auto& xform = name == Strings::shader
+                                    ? bsg->varying.shader2common
+                                    : bsg->varying.object2common;
+            if (inverse)
+                dispatch_get_inverse_matrix(bsr, bsg, wdest, xform,
+                                            bsg->varying.time);
+            else
+                bsr->get_matrix(bsg, wdest, xform, bsg->varying.time);
+            // NOTE: matching scalar version of code which ignores the renderservices return value
+            return wdest.mask();
+        }
+        if (inverse)
+            return dispatch_get_inverse_matrix(bsr, bsg, wdest, name,
+                                               bsg->varying.time);
+        return bsr->get_matrix(bsg, wdest, name, bsg->varying.time);
+    };
+    if (!ctx->shadingsys().cache_lookups())
+        return lookup(wresult);
+
+    auto kind = inverse ? ShadingContext::LookupInverseMatrix
+                        : ShadingContext::LookupMatrix;
+    Block<Matrix44> wcached;
+    Mask fetched(false);
+    Mask ok(false);
+    auto* e = ctx->find_lookup(kind, __OSL_WIDTH, ustring(), name,
+                               TypeDesc::TypeMatrix, -1, false);
+    if (e) {
+        fetched = Mask(e->fetched);
+        ok      = Mask(e->ok);
+        memcpy(&wcached, ctx->lookup_data(*e), sizeof(wcached));
+    }
+    Mask missing = wresult.mask() & ~fetched;
+    if (missing.any_on()) {
+        ok |= lookup(Masked<Matrix44>(wcached, missing)) & missing;
+        fetched |= missing;
+        if (!e)
+            e = &ctx->add_lookup(kind, __OSL_WIDTH, ustring(), name,
+                                 TypeDesc::TypeMatrix, -1, false,
+                                 sizeof(wcached));
+        e->fetched = fetched.value();
+        e->ok      = ok.value();
+        memcpy(ctx->lookup_data(*e), &wcached, sizeof(wcached));
+    }
+
+    Wide<const Matrix44> wsrc(wcached);
+    OSL_FORCEINLINE_BLOCK
+    {
+        OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
+        for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+            wresult[lane] = wsrc[lane];
+        }
+    }
+    return ok & wresult.mask();
+}
+
 OSL_FORCEINLINE Mask
 impl_get_uniform_from_matrix_masked(void* bsg_, Masked<Matrix44> wrm,
                                     const char* from)
@@ -515,21 +670,7 @@ impl_get_uniform_from_matrix_masked(void* bsg_, Masked<Matrix44> wrm,
         return wrm.mask();
     }
 
-    if (USTR(from) == Strings::shader) {
-        ctx->batched<__OSL_WIDTH>().renderer()->get_matrix(
-            bsg, wrm, bsg->varying.shader2common, bsg->varying.time);
-        // NOTE: matching scalar version of code which ignores the renderservices return value
-        return wrm.mask();
-    }
-    if (USTR(from) == Strings::object) {
-        ctx->batched<__OSL_WIDTH>().renderer()->get_matrix(
-            bsg, wrm, bsg->varying.object2common, bsg->varying.time);
-        // NOTE: matching scalar version of code which ignores the renderservices return value
-        return wrm.mask();
-    }
-
-    Mask succeeded = ctx->batched<__OSL_WIDTH>().renderer()->get_matrix(
-        bsg, wrm, USTR(from), bsg->varying.time);
+    Mask succeeded = get_named_matrix(bsg, wrm, USTR(from), false);
     auto failedResults = wrm & succeeded.invert();
     if (failedResults.mask().any_on()) {
         makeIdentity(failedResults);
@@ -553,27 +694,10 @@ impl_get_uniform_to_inverse_matrix_masked(void* bsg_, Masked<Matrix44> wrm,
         makeIdentity(wrm);
         return wrm.mask();
     }
-    if (USTR(to) == Strings::shader) {
-        dispatch_get_inverse_matrix(ctx->batched<__OSL_WIDTH>().renderer(), bsg,
-                                    wrm, bsg->varying.shader2common,
-                                    bsg->varying.time);
-        // NOTE: matching scalar version of code which ignores the renderservices return value
-        return wrm.mask();
-    }
-    if (USTR(to) == Strings::object) {
-        dispatch_get_inverse_matrix(ctx->batched<__OSL_WIDTH>().renderer(), bsg,
-                                    wrm, bsg->varying.object2common,
-                                    bsg->varying.time);
-        // NOTE: matching scalar version of code which ignores the renderservices return value
-        return wrm.mask();
-    }
-
     // Based on the 1 function that calls this function
     // the results of the failed data lanes will get overwritten
     // so no need to make sure that the values are valid (assuming FP exceptions are disabled)
-    Mask succeeded
-        = dispatch_get_inverse_matrix(ctx->batched<__OSL_WIDTH>().renderer(),
-                                      bsg, wrm, USTR(to), bsg->varying.time);
+    Mask succeeded = get_named_matrix(bsg, wrm, USTR(to), true);
 
     auto failedResults = wrm & succeeded.invert();
     if (failedResults.mask().any_on()) {
@@ -645,16 +769,14 @@ impl_get_varying_from_matrix_batched(BatchedShaderGlobals* bsg,
     const auto& sgbv = bsg->varying;
     if (shaderSpaceMask.any_on()) {
         Masked<Matrix44> mfrom(wMfrom.data(), shaderSpaceMask);
-        ctx->batched<__OSL_WIDTH>().renderer()->get_matrix(bsg, mfrom,
-                                                           sgbv.shader2common,
-                                                           sgbv.time);
+        renderer_services(ctx)->get_matrix(bsg, mfrom, sgbv.shader2common,
+                                           sgbv.time);
         // NOTE: matching scalar version of code which ignores the renderservices return value
     }
     if (objectSpaceMask.any_on()) {
         Masked<Matrix44> mfrom(wMfrom.data(), objectSpaceMask);
-        ctx->batched<__OSL_WIDTH>().renderer()->get_matrix(bsg, mfrom,
-                                                           sgbv.object2common,
-                                                           sgbv.time);
+        renderer_services(ctx)->get_matrix(bsg, mfrom, sgbv.object2common,
+                                           sgbv.time);
         // NOTE: matching scalar version of code which ignores the renderservices return value
     }
     // Only named lookups can fail, so we can just subtract those lanes
@@ -662,8 +784,8 @@ impl_get_varying_from_matrix_batched(BatchedShaderGlobals* bsg,
     if (namedSpaceMask.any_on()) {
         Masked<Matrix44> mfrom(wMfrom.data(), namedSpaceMask);
 
-        Mask success = ctx->batched<__OSL_WIDTH>().renderer()->get_matrix(
-            bsg, mfrom, wFrom, sgbv.time);
+        Mask success = dispatch_get_matrix(renderer_services(ctx), bsg, mfrom,
+                                           wFrom, sgbv.time);
 
         Mask failedLanes = success.invert() & namedSpaceMask;
         if (failedLanes.any_on()) {
@@ -764,14 +886,14 @@ impl_get_varying_to_matrix_masked(BatchedShaderGlobals* bsg,
     const auto& sgbv = bsg->varying;
     if (shaderSpaceMask.any_on()) {
         Masked<Matrix44> mto(wMto.data(), shaderSpaceMask);
-        dispatch_get_inverse_matrix(ctx->batched<__OSL_WIDTH>().renderer(), bsg,
-                                    mto, sgbv.shader2common, sgbv.time);
+        dispatch_get_inverse_matrix(renderer_services(ctx), bsg, mto,
+                                    sgbv.shader2common, sgbv.time);
         // NOTE: matching scalar version of code which ignores the renderservices return value
     }
     if (objectSpaceMask.any_on()) {
         Masked<Matrix44> mto(wMto.data(), objectSpaceMask);
-        dispatch_get_inverse_matrix(ctx->batched<__OSL_WIDTH>().renderer(), bsg,
-                                    mto, sgbv.object2common, sgbv.time);
+        dispatch_get_inverse_matrix(renderer_services(ctx), bsg, mto,
+                                    sgbv.object2common, sgbv.time);
         // NOTE: matching scalar version of code which ignores the renderservices return value
     }
     // Only named lookups can fail, so we can just subtract those lanes
@@ -779,8 +901,8 @@ impl_get_varying_to_matrix_masked(BatchedShaderGlobals* bsg,
     if (namedSpaceMask.any_on()) {
         Masked<Matrix44> mto(wMto.data(), namedSpaceMask);
 
-        Mask success = dispatch_get_inverse_matrix(
-            ctx->batched<__OSL_WIDTH>().renderer(), bsg, mto, wTo, sgbv.time);
+        Mask success = dispatch_get_inverse_matrix(renderer_services(ctx), bsg,
+                                                   mto, wTo, sgbv.time);
 
         Mask failedLanes = success.invert() & namedSpaceMask;
         if (failedLanes.any_on()) {
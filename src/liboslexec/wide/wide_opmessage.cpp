@@ -106,6 +106,8 @@ public:
 
     MessageBlock* find(ustring name) const
     {
+        if (m_buffer.index.complete())
+            return reinterpret_cast<MessageBlock*>(m_buffer.index.find(name));
         for (MessageBlock* m = list_head(); m != nullptr; m = m->next)
             if (m->name == name)
                 return m;  // name matches
@@ -126,6 +128,7 @@ public:
                                           alignment);
         list_head()->import_data(wsrcval, lanes_to_populate, layeridx,
                                  sourcefile, sourceline);
+        m_buffer.index.insert(name, list_head(), m_buffer.message_data);
     }
 };
 
@@ -33,7 +33,7 @@ OSL_BATCHOP void __OSL_MASKED_OP(count_noise)(void* bsg_,
 {
     auto* bsg = reinterpret_cast<BatchedShaderGlobals*>(bsg_);
     Mask mask(mask_value);
-    bsg->uniform.context->shadingsys().count_noise(mask.count());
+    bsg->uniform.context->count_noise(mask.count());
 }
 
 
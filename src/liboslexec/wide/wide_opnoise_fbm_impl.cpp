@@ -0,0 +1,175 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <limits>
+
+#include <OSL/oslconfig.h>
+
+#include "oslexec_pvt.h"
+
+#include <OSL/Imathx/Imathx.h>
+#include <OSL/dual_vec.h>
+#include <OSL/oslnoise.h>
+
+#include <OpenImageIO/fmath.h>
+
+using namespace OSL;
+
+OSL_NAMESPACE_ENTER
+namespace __OSL_WIDE_PVT {
+
+OSL_USING_DATA_WIDTH(__OSL_WIDTH)
+
+#include "define_opname_macros.h"
+#define __OSL_NOISE_OP2(A, B)    __OSL_MASKED_OP2(fbmnoise, A, B)
+#define __OSL_NOISE_OP3(A, B, C) __OSL_MASKED_OP3(fbmnoise, A, B, C)
+
+namespace  // anonymous
+{
+
+// The noise options are uniform for the lanes of a call (varying ones
+// are binned by the code generator), so the octave count is resolved
+// once per batch and each lane runs the same unrolled sum inside the
+// SIMD loop. OctavesT == 0 takes the count from the options.
+template<int OctavesT, typename ResultT, typename... ArgsT>
+void
+wide_fbm(const NoiseParams* opt, Masked<ResultT> wresult,
+         Wide<const ArgsT>... wargs)
+{
+    const int octaves      = opt->octaves;
+    const float lacunarity = opt->lacunarity;
+    const float gain       = opt->gain;
+    OSL_FORCEINLINE_BLOCK
+    {
+        OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
+        for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+            if (wresult.mask()[lane]) {
+                ResultT result;
+                if (OctavesT > 0)
+                    FBmScalar::sum<OctavesT>(result, lacunarity, gain,
+                                             ArgsT(wargs[lane])...);
+                else
+                    FBmScalar::sum_loop(result, octaves, lacunarity, gain,
+                                        ArgsT(wargs[lane])...);
+                wresult[ActiveLane(lane)] = result;
+            }
+        }
+    }
+}
+
+template<typename ResultT, typename... ArgsT>
+void
+dispatch(const NoiseParams* opt, Masked<ResultT> wresult,
+         Wide<const ArgsT>... wargs)
+{
+    switch (opt->octaves) {
+    case 1: wide_fbm<1>(opt, wresult, wargs...); break;
+    case 2: wide_fbm<2>(opt, wresult, wargs...); break;
+    case 3: wide_fbm<3>(opt, wresult, wargs...); break;
+    case 4: wide_fbm<4>(opt, wresult, wargs...); break;
+    case 5: wide_fbm<5>(opt, wresult, wargs...); break;
+    case 6: wide_fbm<6>(opt, wresult, wargs...); break;
+    case 7: wide_fbm<7>(opt, wresult, wargs...); break;
+    case 8: wide_fbm<8>(opt, wresult, wargs...); break;
+    default: wide_fbm<0>(opt, wresult, wargs...);
+    }
+}
+
+}  // namespace
+
+OSL_BATCHOP void __OSL_NOISE_OP2(Wdf, Wdf)(char* name, char* r_ptr, char* x_ptr,
+                                           char* bsg, char* opt,
+                                           char* varying_direction_ptr,
+                                           unsigned int mask_value)
+{
+    dispatch(reinterpret_cast<const NoiseParams*>(opt),
+             Masked<Dual2<float>>(r_ptr, Mask(mask_value)),
+             Wide<const Dual2<float>>(x_ptr));
+}
+
+OSL_BATCHOP void __OSL_NOISE_OP3(Wdf, Wdf, Wdf)(char* name, char* r_ptr,
+                                                char* x_ptr, char* y_ptr,
+                                                char* bsg, char* opt,
+                                                char* varying_direction_ptr,
+                                                unsigned int mask_value)
+{
+    dispatch(reinterpret_cast<const NoiseParams*>(opt),
+             Masked<Dual2<float>>(r_ptr, Mask(mask_value)),
+             Wide<const Dual2<float>>(x_ptr), Wide<const Dual2<float>>(y_ptr));
+}
+
+OSL_BATCHOP void __OSL_NOISE_OP2(Wdf, Wdv)(char* name, char* r_ptr, char* p_ptr,
+                                           char* bsg, char* opt,
+                                           char* varying_direction_ptr,
+                                           unsigned int mask_value)
+{
+    dispatch(reinterpret_cast<const NoiseParams*>(opt),
+             Masked<Dual2<float>>(r_ptr, Mask(mask_value)),
+             Wide<const Dual2<Vec3>>(p_ptr));
+}
+
+OSL_BATCHOP void __OSL_NOISE_OP3(Wdf, Wdv, Wdf)(char* name, char* r_ptr,
+                                                char* p_ptr, char* t_ptr,
+                                                char* bsg, char* opt,
+                                                char* varying_direction_ptr,
+                                                unsigned int mask_value)
+{
+    dispatch(reinterpret_cast<const NoiseParams*>(opt),
+             Masked<Dual2<float>>(r_ptr, Mask(mask_value)),
+             Wide<const Dual2<Vec3>>(p_ptr), Wide<const Dual2<float>>(t_ptr));
+}
+
+
+
+OSL_BATCHOP void __OSL_NOISE_OP2(Wdv, Wdf)(char* name, char* r_ptr, char* x_ptr,
+                                           char* bsg, char* opt,
+                                           char* varying_direction_ptr,
+                                           unsigned int mask_value)
+{
+    dispatch(reinterpret_cast<const NoiseParams*>(opt),
+             Masked<Dual2<Vec3>>(r_ptr, Mask(mask_value)),
+             Wide<const Dual2<float>>(x_ptr));
+}
+
+OSL_BATCHOP void __OSL_NOISE_OP3(Wdv, Wdf, Wdf)(char* name, char* r_ptr,
+                                                char* x_ptr, char* y_ptr,
+                                                char* bsg, char* opt,
+                                                char* varying_direction_ptr,
+                                                unsigned int mask_value)
+{
+    dispatch(reinterpret_cast<const NoiseParams*>(opt),
+             Masked<Dual2<Vec3>>(r_ptr, Mask(mask_value)),
+             Wide<const Dual2<float>>(x_ptr), Wide<const Dual2<float>>(y_ptr));
+}
+
+OSL_BATCHOP void __OSL_NOISE_OP2(Wdv, Wdv)(char* name, char* r_ptr, char* p_ptr,
+                                           char* bsg, char* opt,
+                                           char* varying_direction_ptr,
+                                           unsigned int mask_value)
+{
+    dispatch(reinterpret_cast<const NoiseParams*>(opt),
+             Masked<Dual2<Vec3>>(r_ptr, Mask(mask_value)),
+             Wide<const Dual2<Vec3>>(p_ptr));
+}
+
+OSL_BATCHOP void __OSL_NOISE_OP3(Wdv, Wdv, Wdf)(char* name, char* r_ptr,
+                                                char* p_ptr, char* t_ptr,
+                                                char* bsg, char* opt,
+                                                char* varying_direction_ptr,
+                                                unsigned int mask_value)
+{
+    dispatch(reinterpret_cast<const NoiseParams*>(opt),
+             Masked<Dual2<Vec3>>(r_ptr, Mask(mask_value)),
+             Wide<const Dual2<Vec3>>(p_ptr), Wide<const Dual2<float>>(t_ptr));
+}
+
+
+
+}  // namespace __OSL_WIDE_PVT
+OSL_NAMESPACE_EXIT
+
+#undef __OSL_NOISE_OP2
+#undef __OSL_NOISE_OP3
+
+#include "undef_opname_macros.h"
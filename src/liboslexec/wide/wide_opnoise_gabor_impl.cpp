@@ -56,11 +56,49 @@ namespace  // anonymous
 LOOKUP_WIDE_GABOR_IMPL_BY_OPT(lookup_wide_float_impl, wide_gabor)
 LOOKUP_WIDE_GABOR_IMPL_BY_OPT(lookup_wide_Vec3_impl, wide_gabor3)
 
+template<typename... ArgsT>
+OSL_FORCEINLINE Dual2<float>
+scalar_fast_impl(const Dual2<float>&, ArgsT... args)
+{
+    return OSL::pvt::gabor(args...);
+}
+
+template<typename... ArgsT>
+OSL_FORCEINLINE Dual2<Vec3>
+scalar_fast_impl(const Dual2<Vec3>&, ArgsT... args)
+{
+    return OSL::pvt::gabor3(args...);
+}
+
+// The "fast" variant has no SIMD implementation; evaluate it one lane at
+// a time with the scalar version, which shares its precomputed impulse
+// tables.
+template<typename ResultT, typename... WideArgsT>
+void
+dispatch_fast_result(const NoiseParams* opt,
+                     Block<Vec3>* opt_varying_direction,
+                     Masked<ResultT> wresult, WideArgsT... wargs)
+{
+    NoiseParams lane_opt = *opt;
+    for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+        if (!wresult.mask()[lane])
+            continue;
+        if (opt_varying_direction)
+            lane_opt.direction = opt_varying_direction->get(lane);
+        ResultT r = scalar_fast_impl(ResultT(), wargs[lane]..., &lane_opt);
+        wresult[lane] = r;
+    }
+}
+
 template<typename... ArgsT>
 void
 dispatch_float_result(const NoiseParams* opt,
                       Block<Vec3>* opt_varying_direction, ArgsT... args)
 {
+    if (opt->fast) {
+        dispatch_fast_result(opt, opt_varying_direction, args...);
+        return;
+    }
     typedef void (*FuncPtr)(ArgsT..., const NoiseParams* opt, Block<Vec3>*);
 
     lookup_wide_float_impl<FuncPtr>(opt)(args..., opt, opt_varying_direction);
@@ -71,6 +109,10 @@ void
 dispatch_Vec3_result(const NoiseParams* opt, Block<Vec3>* opt_varying_direction,
                      ArgsT... args)
 {
+    if (opt->fast) {
+        dispatch_fast_result(opt, opt_varying_direction, args...);
+        return;
+    }
     typedef void (*FuncPtr)(ArgsT..., const NoiseParams* opt, Block<Vec3>*);
 
     lookup_wide_Vec3_impl<FuncPtr>(opt)(args..., opt, opt_varying_direction);
@@ -9,6 +9,7 @@
 ///
 /////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
 #include <cstdarg>
 
 #include "pointcloud.h"
@@ -34,6 +35,193 @@ using PointCloudSearchResults = BatchedRendererServices::PointCloudSearchResults
 
 namespace {
 
+#ifdef USE_PARTIO
+// Search a PointCloudTree for every lane of the batch in a single
+// traversal.  Each lane keeps a bounded max-heap of its nearest points, and
+// once that heap is full its search radius shrinks to the heap's farthest
+// entry, matching the results of Partio's findNPoints.  Node culling and
+// leaf distance tests are done for all lanes at once; only the heap
+// updates are per lane.
+void
+tree_pointcloud_search(ShadingContext* ctx, const PointCloudTree& tree,
+                       const void* wcenter_, Wide<const float> wradius,
+                       int max_points, bool sort,
+                       PointCloudSearchResults& results)
+{
+    const Mask mask = results.mask();
+    if (max_points <= 0) {
+        assign_all(results.wnum_points(), 0);
+        return;
+    }
+
+    Wide<const OSL::Vec3> wcenter(wcenter_);
+
+    // Inactive lanes get a negative bound so that no distance passes.
+    float qx[__OSL_WIDTH], qy[__OSL_WIDTH], qz[__OSL_WIDTH];
+    float bound[__OSL_WIDTH];
+    int count[__OSL_WIDTH];
+    OSL_FORCEINLINE_BLOCK
+    {
+        OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
+        for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+            const OSL::Vec3 center = wcenter[lane];
+            const float radius     = wradius[lane];
+            qx[lane]               = center.x;
+            qy[lane]               = center.y;
+            qz[lane]               = center.z;
+            bound[lane] = mask.is_on(lane) ? radius * radius : -1.0f;
+            count[lane] = 0;
+        }
+    }
+
+    SortedPointRecord* heaps = (SortedPointRecord*)ctx->alloc_scratch(
+        sizeof(SortedPointRecord) * max_points * __OSL_WIDTH,
+        alignof(SortedPointRecord));
+    SortedPointCompare compare;
+
+    // A median split tree over an int range is at most 32 levels deep,
+    // and each level leaves at most one sibling pending.
+    int stack[64];
+    int top      = 0;
+    stack[top++] = 0;
+    float dist2[__OSL_WIDTH];
+    while (top) {
+        const int index                  = stack[--top];
+        const PointCloudTree::Node& node = tree.nodes[index];
+
+        int hit = 0;
+        OSL_FORCEINLINE_BLOCK
+        {
+            OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH) reduction(|:hit))
+            for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+                const float dx = std::max(std::max(node.lo[0] - qx[lane],
+                                                   qx[lane] - node.hi[0]),
+                                          0.0f);
+                const float dy = std::max(std::max(node.lo[1] - qy[lane],
+                                                   qy[lane] - node.hi[1]),
+                                          0.0f);
+                const float dz = std::max(std::max(node.lo[2] - qz[lane],
+                                                   qz[lane] - node.hi[2]),
+                                          0.0f);
+                hit |= int(dx * dx + dy * dy + dz * dz < bound[lane]);
+            }
+        }
+        if (!hit)
+            continue;
+
+        if (!node.leaf()) {
+            // Descend first into the child most lanes are nearest to.
+            const float* q = node.axis == 0 ? qx : (node.axis == 1 ? qy : qz);
+            int votes      = 0;
+            OSL_FORCEINLINE_BLOCK
+            {
+                OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH) reduction(+:votes))
+                for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+                    if (bound[lane] >= 0.0f)
+                        votes += (q[lane] < node.split) ? 1 : -1;
+                }
+            }
+            if (votes > 0) {
+                stack[top++] = node.right;
+                stack[top++] = index + 1;
+            } else {
+                stack[top++] = index + 1;
+                stack[top++] = node.right;
+            }
+            continue;
+        }
+
+        for (int p = node.begin; p < node.end; ++p) {
+            const float px = tree.x[p];
+            const float py = tree.y[p];
+            const float pz = tree.z[p];
+            int any        = 0;
+            OSL_FORCEINLINE_BLOCK
+            {
+                OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH) reduction(|:any))
+                for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+                    const float dx = qx[lane] - px;
+                    const float dy = qy[lane] - py;
+                    const float dz = qz[lane] - pz;
+                    dist2[lane]    = dx * dx + dy * dy + dz * dz;
+                    any |= int(dist2[lane] < bound[lane]);
+                }
+            }
+            if (!any)
+                continue;
+            for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+                if (!(dist2[lane] < bound[lane]))
+                    continue;
+                SortedPointRecord* heap = heaps + lane * max_points;
+                if (count[lane] < max_points) {
+                    heap[count[lane]++] = SortedPointRecord(dist2[lane], p);
+                    std::push_heap(heap, heap + count[lane], compare);
+                    if (count[lane] == max_points)
+                        bound[lane] = heap[0].first;
+                } else {
+                    std::pop_heap(heap, heap + max_points, compare);
+                    heap[max_points - 1] = SortedPointRecord(dist2[lane], p);
+                    std::push_heap(heap, heap + max_points, compare);
+                    bound[lane] = heap[0].first;
+                }
+            }
+        }
+    }
+
+    // Copy each lane's heap straight out to the wide results; the heap
+    // entries hold tree order slots, so positions for the distance
+    // derivatives come from the tree rather than from Partio.
+    auto windices    = results.windices();
+    auto wnum_points = results.wnum_points();
+    mask.foreach([&](ActiveLane lane) -> void {
+        SortedPointRecord* heap = heaps + lane * max_points;
+        const int n             = count[lane];
+        if (sort && n > 1)
+            std::sort_heap(heap, heap + n, compare);
+
+        auto out_indices = windices[lane];
+        for (int i = 0; i < n; ++i)
+            out_indices[i] = tree.index[heap[i].second];
+
+        if (results.has_distances()) {
+            auto wdistances    = results.wdistances();
+            auto out_distances = wdistances[lane];
+            for (int i = 0; i < n; ++i)
+                out_distances[i] = sqrtf(heap[i].first);
+
+            if (results.distances_have_derivs()) {
+                Wide<const Dual2<OSL::Vec3>> wdcenter(wcenter_);
+                const Dual2<OSL::Vec3> dcenter = wdcenter[lane];
+
+                const OSL::Vec3& dCval = dcenter.val();
+                const OSL::Vec3& dCdx  = dcenter.dx();
+                const OSL::Vec3& dCdy  = dcenter.dy();
+                auto wdistances_dx     = results.wdistancesDx();
+                auto wdistances_dy     = results.wdistancesDy();
+                auto d_distance_dx     = wdistances_dx[lane];
+                auto d_distance_dy     = wdistances_dy[lane];
+                for (int i = 0; i < n; ++i) {
+                    const int p    = heap[i].second;
+                    const float d  = out_distances[i];
+                    const OSL::Vec3 delta(dCval.x - tree.x[p],
+                                          dCval.y - tree.y[p],
+                                          dCval.z - tree.z[p]);
+                    if (d > 0.0f) {
+                        d_distance_dx[i] = 1.0f / d * delta.dot(dCdx);
+                        d_distance_dy[i] = 1.0f / d * delta.dot(dCdy);
+                    } else {
+                        // distance is 0, derivs would be infinite
+                        d_distance_dx[i] = 0.0f;
+                        d_distance_dy[i] = 0.0f;
+                    }
+                }
+            }
+        }
+        wnum_points[lane] = n;
+    });
+}
+#endif
+
 OSL_FORCEINLINE void
 default_pointcloud_search(BatchedShaderGlobals* bsg,
     ustring filename, const void * wcenter_,
@@ -57,7 +245,8 @@ default_pointcloud_search(BatchedShaderGlobals* bsg,
     }
 
     const Partio::ParticlesData *cloud = pc->read_access();
-    if (cloud == NULL) { // The file failed to load
+    const PagedPointCloud *paged = pc->paged();
+    if (cloud == NULL && paged == NULL) { // The file failed to load
         ctx->batched<__OSL_WIDTH>().errorfmt(
             results.mask(), "pointcloud_search: could not open \"{}\"",
             filename);
@@ -66,15 +255,24 @@ default_pointcloud_search(BatchedShaderGlobals* bsg,
     }
 
     // Early exit if the pointcloud contains no particles.
-    if (cloud->numParticles() == 0) {
+    if ((paged ? paged->npoints() : cloud->numParticles()) == 0) {
         assign_all(results.wnum_points(), 0);
         return;
     }
 
+    // Answer the whole batch with one traversal of the cloud's flat
+    // kd-tree; fall back to per lane Partio (or paged) queries if it has
+    // none.
+    if (const PointCloudTree* tree = pc->tree()) {
+        tree_pointcloud_search(ctx, *tree, wcenter_, wradius, max_points,
+                               sort, results);
+        return;
+    }
+
     // If we need derivs of the distances, we'll need access to the
     // found point's positions.
     Partio::ParticleAttribute *pos_attr = NULL;
-    if (results.distances_have_derivs()) {
+    if (results.distances_have_derivs() && !paged) {
         pos_attr = pc->m_attributes[u_position].get();
         if (! pos_attr) {
             // No "position" attribute -- fail
@@ -105,17 +303,26 @@ default_pointcloud_search(BatchedShaderGlobals* bsg,
      SortedPointRecord *sorted = OIIO_ALLOCA(SortedPointRecord, max_points);
      auto windices = results.windices();
      auto wnum_points = results.wnum_points();
+     const size_t cache_bytes = ctx->shadingsys().pointcloud_cache_bytes();
      results.mask().foreach([=](ActiveLane lane)->void {
          const OSL::Vec3 center = wcenter[lane];
 
          const float radius = wradius[lane];
-         float finalRadius;
-         int count = cloud->findNPoints (&center[0], max_points, radius,
+         int count;
+         if (paged) {
+             // Slots, which need no converting, already sorted if asked
+             count = paged->find_nearest (&center[0], radius, max_points,
+                                          sort, (size_t *)indices, dist2,
+                                          cache_bytes);
+         } else {
+             float finalRadius;
+             count = cloud->findNPoints (&center[0], max_points, radius,
                                          indices, dist2, &finalRadius);
+         }
 
          // If sorting, allocate some temp space and sort the distances and
          // indices at the same time.
-         if (sort && count > 1) {
+         if (sort && count > 1 && !paged) {
              //SortedPointRecord *sorted = (SortedPointRecord *) sg->context->alloc_scratch (count * sizeof(SortedPointRecord), sizeof(SortedPointRecord));
              //SortedPointRecord *sorted = OIIO_ALLOCA(SortedPointRecord, count);
              for (int i = 0;  i < count;  ++i)
@@ -154,8 +361,12 @@ default_pointcloud_search(BatchedShaderGlobals* bsg,
                  // distance derivs
                  //OSL::Vec3 *positions = (OSL::Vec3 *) sg->context->alloc_scratch (sizeof(OSL::Vec3) * count, sizeof(float));
                  OSL::Vec3 *positions = OIIO_ALLOCA(OSL::Vec3, count);
-                 // FIXME(Partio): this function really should be marked as const because it is just a wrapper of a private const method
-                 const_cast<Partio::ParticlesData*>(cloud)->data (*pos_attr, count, indices, true, (void *)positions);
+                 if (paged)
+                     paged->get ((const size_t *)indices, count, -1,
+                                 positions, cache_bytes);
+                 else
+                     // FIXME(Partio): this function really should be marked as const because it is just a wrapper of a private const method
+                     const_cast<Partio::ParticlesData*>(cloud)->data (*pos_attr, count, indices, true, (void *)positions);
 
                  Wide<const Dual2<OSL::Vec3>> wdcenter(wcenter_);
                  const Dual2<OSL::Vec3> dcenter = wdcenter[lane];
@@ -222,13 +433,16 @@ default_pointcloud_get(BatchedShaderGlobals* bsg,
     // defer reporting errors as only lanes with non zero num_points
     // should report errors
     const Partio::ParticlesData *cloud = nullptr;
+    const PagedPointCloud *paged = nullptr;
     if (pc != nullptr) {
         cloud = pc->read_access();
+        paged = pc->paged();
     }
     Partio::ParticleAttribute *attr = nullptr;
-    if (cloud != nullptr) {
+    if (cloud != nullptr || paged != nullptr) {
         attr = pc->m_attributes[attr_name].get();
     }
+    const size_t cache_bytes = ctx->shadingsys().pointcloud_cache_bytes();
 
     TypeDesc attr_type = wout_data.type();
     // Type the OSL shader has provided in destination array:
@@ -270,7 +484,7 @@ default_pointcloud_get(BatchedShaderGlobals* bsg,
             return;
         }
 
-        if (cloud == nullptr) { // The file failed to load
+        if (cloud == nullptr && paged == nullptr) { // The file failed to load
             ctx->batched<__OSL_WIDTH>().errorfmt(
                 Mask { lane }, "pointcloud_get: could not open \"{}\"",
                 filename);
@@ -319,9 +533,14 @@ default_pointcloud_get(BatchedShaderGlobals* bsg,
         // Actual data query
         if (partio_type == OIIO::TypeString) {
             // strings are special cases because they are stored as int index
-            const_cast<Partio::ParticlesData*>(cloud)->data (*attr, count,
+            if (paged)
+                paged->get ((const size_t *)indices, count,
+                            attr->attributeIndex, strindices, cache_bytes);
+            else
+                const_cast<Partio::ParticlesData*>(cloud)->data (*attr, count,
                     (const Partio::ParticleIndex *)indices, /*sorted*/ /*true*/false, (void*)strindices);
-            const auto& strings = cloud->indexedStrs(*attr);
+            const auto& strings = paged ? paged->attributes()[attr->attributeIndex].strings
+                                        : cloud->indexedStrs(*attr);
             int sicount = int(strings.size());
             OSL_DASSERT(Masked<ustring[]>::is(wout_data));
             Masked<ustring[]> wout_strings(wout_data);
@@ -333,6 +552,10 @@ default_pointcloud_get(BatchedShaderGlobals* bsg,
                 else
                     out_strings[i] = ustring();
             }
+        } else if (paged) {
+            paged->get ((const size_t *)indices, count, attr->attributeIndex,
+                        aos_buffer, cache_bytes);
+            wout_data.assign_val_lane_from_scalar(lane, aos_buffer);
         } else {
             // All cases aside from strings are simple.
             const_cast<Partio::ParticlesData*>(cloud)->data (*attr, count,
@@ -376,79 +599,61 @@ Mask default_pointcloud_write(BatchedShaderGlobals* bsg,
     if (filename.empty())
         return Mask{false};
 
-    PointCloud *pc = PointCloud::get(filename, true /* create file to write */);
-    spin_lock lock (pc->m_mutex);
-    Partio::ParticlesDataMutable *cloud = pc->write_access();
-    if (cloud == NULL) // The file failed to load
+    PointCloud *pc = PointCloud::get(
+        filename, true /* create file to write */,
+        bsg->uniform.context->shadingsys().pointcloud_bake_index(),
+        bsg->uniform.context->shadingsys().pointcloud_bake_pages());
+    if (pc->write_access() == NULL) // The file failed to load
         return Mask{false};
 
-    // Mark the pointcloud as written, so we will save it later
-    pc->m_write = true;
-
-    // first time only -- add "position" attribute
-    if (cloud->numParticles() == 0)
-        pc->m_position_attribute = cloud->addAttribute ("position", Partio::VECTOR, 3);
-
-    // Make sure all the attributes mentioned have been added properly
+    // Stage the points in this thread's buffer; they join the cloud
+    // itself when the cloud is flushed or saved.
+    PointCloudWriteBuffer &buf (pc->write_buffer());
+    spin_lock lock (buf.mutex);
     bool ok = true;
-    std::vector<Partio::ParticleAttribute *> partattrs;
-    partattrs.reserve (nattribs);
     for (int i = 0;  i < nattribs;  ++i) {
-        const ustring attr_name = attr_names[i];
-        Partio::ParticleAttribute *a = pc->m_attributes[attr_name].get();
-        if (!a) {  // attribute needs to be added
-            Partio::ParticleAttributeType pt = PartioType (attr_types[i]);
-            if (pt == Partio::NONE) {
-                ok = false;
-            } else {
-                a = new Partio::ParticleAttribute ();
-                *a = cloud->addAttribute (attr_name.c_str(), pt,
-                                          pt==Partio::VECTOR ? 3 : 1 /*count*/);
-                pc->m_attributes[attr_name].reset(a);
-            }
-        }
-        partattrs.push_back (a);
+        if (PartioType(attr_types[i]) == Partio::NONE)
+            ok = false;
     }
 
-    mask.foreach([=](ActiveLane lane)->void {
-        // Make a new particle
-        Partio::ParticleIndex p = cloud->addParticle();
+    mask.foreach([&](ActiveLane lane)->void {
+        const int point = int(buf.positions.size());
         const Vec3 pos = wpos[lane];
-        *(Vec3 *)cloud->dataWrite<float>(pc->m_position_attribute, p) = pos;
+        buf.positions.push_back (pos);
         for (int i = 0;  i < nattribs;  ++i) {
-            Partio::ParticleAttribute *a = partattrs[i];
             const void *ptr_to_wide_attr_value = ptrs_to_wide_attr_value[i];
-            if (a  &&  PartioType(attr_types[i]) == a->type) {
-                switch (a->type) {
-                case Partio::FLOAT : {
-                    Wide<const float> wdata(ptr_to_wide_attr_value);
-                    *(float *)cloud->dataWrite<float>(*a, p) = wdata[lane];
-                    }
-                    break;
-                case Partio::VECTOR : {
-                    Wide<const Vec3> wdata(ptr_to_wide_attr_value);
-                    *(Vec3 *)cloud->dataWrite<float>(*a, p) = wdata[lane];
-                    }
-                    break;
-                case Partio::INT : {
-                    Wide<const int> wdata(ptr_to_wide_attr_value);
-                    *(int *)cloud->dataWrite<int>(*a, p) = wdata[lane];
-                    }
-                    break;
-                case Partio::INDEXEDSTR : {
-                    Wide<const ustring> wdata(ptr_to_wide_attr_value);
-                    ustring ustr = wdata[lane];
-                    const char* s = ustr.c_str();
-                    int index = cloud->lookupIndexedStr(*a, s);
-                    if (index == -1)
-                        index = cloud->registerIndexedStr(*a, s);
-                    *(int *)cloud->dataWrite<int>(*a, p) = index;
-                    }
-                    break;
-                case Partio::NONE :
-                    break;
+            PointCloudWriteBuffer::Value v;
+            v.point = point;
+            v.name = attr_names[i];
+            v.type = PartioType(attr_types[i]);
+            switch (v.type) {
+            case Partio::FLOAT : {
+                Wide<const float> wdata(ptr_to_wide_attr_value);
+                v.f[0] = wdata[lane];
+                }
+                break;
+            case Partio::VECTOR : {
+                Wide<const Vec3> wdata(ptr_to_wide_attr_value);
+                const Vec3 value = wdata[lane];
+                v.f[0] = value.x;
+                v.f[1] = value.y;
+                v.f[2] = value.z;
+                }
+                break;
+            case Partio::INT : {
+                Wide<const int> wdata(ptr_to_wide_attr_value);
+                v.i = wdata[lane];
+                }
+                break;
+            case Partio::INDEXEDSTR : {
+                Wide<const ustring> wdata(ptr_to_wide_attr_value);
+                v.s = wdata[lane];
                 }
+                break;
+            case Partio::NONE :
+                continue;
             }
+            buf.values.push_back (v);
         }
     });
 
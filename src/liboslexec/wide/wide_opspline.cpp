@@ -350,42 +350,94 @@ void splineinverse_search(
         return;
     }
 #endif
-    typedef SplineSearchFunctor<K_T,IsBasisUConstantT,BasisStepT,MatrixT,R_T,X_T,KArrayT> Functor;
-    Functor S (M, knots, knot_count);
-
-    // NOTE: OIIO::invert has a loop which was called from inside the search
-    // interval loop, created a nested loop.  Under SIMD/SIMT the nested
-    // loop could execute incoherently.  Instead we choose to use the class
-    // sfm::Inverter to manage state between is_bracketed_by(min,max), meant to
-    // be called from the search interval loop, and bracketed_invert(min,max)
-    // meant to be called after exiting the search interval loop, avoiding
-    // a nested loop that could be executed at different interval's
-    // for each SIMD/SIMT lane/thread.
-    sfm::Inverter<X_T, Functor, /*maxiters=*/32> inverter{/*initial_result=*/0, S, xval, X_T(1.0e-6)};
+    int nsegs = (knot_count - 4) / BasisStepT + 1;
+    float nseginv = 1.0f / nsegs;
+
+    if (IsBasisUConstantT) {
+        // A step function, so no cubic to solve.  Search each interval
+        // with the general inverter.
+        typedef SplineSearchFunctor<K_T,IsBasisUConstantT,BasisStepT,MatrixT,R_T,X_T,KArrayT> Functor;
+        Functor S (M, knots, knot_count);
+
+        // NOTE: OIIO::invert has a loop which was called from inside the search
+        // interval loop, created a nested loop.  Under SIMD/SIMT the nested
+        // loop could execute incoherently.  Instead we choose to use the class
+        // sfm::Inverter to manage state between is_bracketed_by(min,max), meant to
+        // be called from the search interval loop, and bracketed_invert(min,max)
+        // meant to be called after exiting the search interval loop, avoiding
+        // a nested loop that could be executed at different interval's
+        // for each SIMD/SIMT lane/thread.
+        sfm::Inverter<X_T, Functor, /*maxiters=*/32> inverter{/*initial_result=*/0, S, xval, X_T(1.0e-6)};
+
+        X_T r0 = 0.0;
+        X_T r1;
+        bool bracket_found = false;
+        for (int s = 0;  s < nsegs;  ++s)
+        {  // Search each interval
+            r1 = nseginv * (s+1);
+            bracket_found = inverter.is_bracketed_by(r0,r1);
+            if (bracket_found)
+                break;
+            r0 = r1;  // Start of next interval is end of this one
+        }
+
+        if (bracket_found) {
+            // NOTE: do not call bracketed_invert
+            // from inside the search interval loop
+            inverter.bracketed_invert(r0,r1);
+        }
+        result = inverter.result();
+        return;
+    }
 
     // Because of the nature of spline interpolation, monotonic knots
     // can still lead to a non-monotonic curve.  To deal with this,
     // search separately on each spline segment and hope for the best.
-    int nsegs = (knot_count - 4) / BasisStepT + 1;
-    float nseginv = 1.0f / nsegs;
-    X_T r0 = 0.0;
-    X_T r1;
+    // Each segment's cubic is built once to test whether it brackets y;
+    // the solve happens after the search loop, on the bracketing
+    // segment's coefficients, to keep the loops un-nested (see above).
+    float yval = removeDerivatives(xval);
+    float tk[4];
+    float v0, v1;
+    bool seg_increasing;
+    int s = 0;
     bool bracket_found = false;
-    for (int s = 0;  s < nsegs;  ++s)
+    for (;  s < nsegs;  ++s)
     {  // Search each interval
-        r1 = nseginv * (s+1);
-        bracket_found = inverter.is_bracketed_by(r0,r1);
+        int k = s*BasisStepT;
+        K_T P0 = knots[k];
+        K_T P1 = knots[k+1];
+        K_T P2 = knots[k+2];
+        K_T P3 = knots[k+3];
+        tk[0] = M.m00 * P0 + M.m01 * P1 + M.m02 * P2 + M.m03 * P3;
+        tk[1] = M.m10 * P0 + M.m11 * P1 + M.m12 * P2 + M.m13 * P3;
+        tk[2] = M.m20 * P0 + M.m21 * P1 + M.m22 * P2 + M.m23 * P3;
+        tk[3] = M.m30 * P0 + M.m31 * P1 + M.m32 * P2 + M.m33 * P3;
+        v0 = tk[3];
+        v1 = ((tk[0] + tk[1]) + tk[2]) + tk[3];
+        seg_increasing = v0 < v1;
+        float vmin = sfm::select_val(seg_increasing, v0, v1);
+        float vmax = sfm::select_val(seg_increasing, v1, v0);
+        bracket_found = ((yval >= vmin) & (yval <= vmax));
         if (bracket_found)
             break;
-        r0 = r1;  // Start of next interval is end of this one
     }
 
     if (bracket_found) {
-        // NOTE: do not call bracketed_invert
+        // NOTE: do not call solve_segment
         // from inside the search interval loop
-        inverter.bracketed_invert(r0,r1);
+        float slope;
+        float t = Spline::solve_segment(tk, yval, v0, v1, 1.0e-6f,
+                                        1.0e-6f * nsegs, slope);
+        float dxdy = (slope != 0.0f) ? nseginv / slope : 0.0f;
+        Spline::assign_inverse(result, (float(s) + t) * nseginv, xval, dxdy);
+    } else {
+        // Nothing bracketed y, return the appropriate "edge" of the
+        // last interval
+        float vmin = sfm::select_val(seg_increasing, v0, v1);
+        bool low = ((yval < vmin) == seg_increasing);
+        result = R_T(low ? float(nsegs-1) * nseginv : 1.0f);
     }
-    result = inverter.result();
 }
 
 } // namespace sfm
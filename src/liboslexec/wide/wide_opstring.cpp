@@ -276,33 +276,12 @@ OSL_BATCHOP int __OSL_OP(regex_impl)(void* bsg_, const char* subject_,
     auto* bsg           = reinterpret_cast<BatchedShaderGlobals*>(bsg_);
     ShadingContext* ctx = bsg->uniform.context;
 
-    // TODO:  probably could share implementation from here with osl_regex_impl from opstring.cpp
     OSL_ASSERT(ustring::is_unique(subject_));
     OSL_ASSERT(ustring::is_unique(pattern));
 
     const std::string& subject(ustring::from_unique(subject_).string());
-    std::match_results<std::string::const_iterator> mresults;
-    const std::regex& regex(ctx->find_regex(USTR(pattern)));
-    if (nresults > 0) {
-        std::string::const_iterator start = subject.begin();
-        int res = fullmatch ? std::regex_match(subject, mresults, regex)
-                            : std::regex_search(subject, mresults, regex);
-        int* m  = (int*)results;
-        for (int r = 0; r < nresults; ++r) {
-            if (r / 2 < (int)mresults.size()) {
-                if ((r & 1) == 0)
-                    m[r] = mresults[r / 2].first - start;
-                else
-                    m[r] = mresults[r / 2].second - start;
-            } else {
-                m[r] = USTR(pattern).length();
-            }
-        }
-        return res;
-    } else {
-        return fullmatch ? regex_match(subject, regex)
-                         : regex_search(subject, regex);
-    }
+    const CompiledRegex& regex(ctx->find_regex(USTR(pattern)));
+    return regex.match(subject, (int*)results, nresults, fullmatch);
 }
 
 
@@ -322,6 +301,7 @@ OSL_BATCHOP void __OSL_MASKED_OP(regex_impl)(void* bsg_, void* wsuccess_ptr,
     Masked<int[]> wresults(wresults_ptr, nresults, mask);
     Wide<const ustring> wsubject(wsubject_ptr);
     Wide<const ustring> wpattern(wpattern_ptr);
+    int* m = OIIO_ALLOCA(int, std::max(nresults, 1));
 
     mask.foreach ([=](ActiveLane lane) -> void {
         ustring usubject = wsubject[lane];
@@ -332,27 +312,11 @@ OSL_BATCHOP void __OSL_MASKED_OP(regex_impl)(void* bsg_, void* wsuccess_ptr,
         auto results = wresults[lane];
 
         const std::string& subject = usubject.string();
-        std::match_results<std::string::const_iterator> mresults;
-        const std::regex& regex(ctx->find_regex(USTR(pattern)));
-        if (nresults > 0) {
-            std::string::const_iterator start = subject.begin();
-            int res = fullmatch ? std::regex_match(subject, mresults, regex)
-                                : std::regex_search(subject, mresults, regex);
-            for (int r = 0; r < nresults; ++r) {
-                if (r / 2 < (int)mresults.size()) {
-                    if ((r & 1) == 0)
-                        results[r] = mresults[r / 2].first - start;
-                    else
-                        results[r] = mresults[r / 2].second - start;
-                } else {
-                    results[r] = USTR(pattern).length();
-                }
-            }
-            wsuccess[lane] = res;
-        } else {
-            wsuccess[lane] = fullmatch ? regex_match(subject, regex)
-                                       : regex_search(subject, regex);
-        }
+        const CompiledRegex& regex(ctx->find_regex(USTR(pattern)));
+        int res = regex.match(subject, m, nresults, fullmatch);
+        for (int r = 0; r < nresults; ++r)
+            results[r] = m[r];
+        wsuccess[lane] = res;
     });
 }
 
@@ -32,6 +32,261 @@ using WidthTag                = OSL::WidthOf<__OSL_WIDTH>;
 namespace {
 
 
+// The handle to use for a lookup. Ops whose filename is constant were
+// given theirs when the group was JITed; for the rest, the filename is
+// uniform across the batch, so one lookup in the context's cache of
+// runtime filenames (shared with the scalar ops) serves every lane.
+OSL_FORCEINLINE TextureSystem::TextureHandle*
+texture_handle(BatchedShaderGlobals* bsg, void* name, void* handle)
+{
+    if (handle)
+        return (TextureSystem::TextureHandle*)handle;
+    return (TextureSystem::TextureHandle*)bsg->uniform.context
+        ->texture_handle(USTR(name))
+        .handle;
+}
+
+
+
+#if defined(OIIO_TEXTURE_SIMD_BATCH_WIDTH) \
+    && (OIIO_TEXTURE_SIMD_BATCH_WIDTH == __OSL_WIDTH)
+// When our batch width matches the TextureSystem's, BatchedTextureOptions
+// is binary compatible with OIIO::TextureOptBatch (validated in
+// <OSL/batched_texture.h>) and Wide float and Vec3 data are laid out
+// exactly as the batched TextureSystem texture(), texture3d() and
+// environment() calls expect, so the whole batch can be submitted at once
+// instead of one lane at a time.
+// Each batched_* call returns true only if every active lane succeeded;
+// otherwise the caller must redo the lookup lane by lane to find out which
+// lanes failed and why.
+
+// The number of channels to ask the TextureSystem for, or 0 if the result
+// isn't of a type we handle here. The alpha channel, if wanted, is the
+// one after the result's.
+int
+batched_channels(BatchedTextureOutputs& outputs, int& alphaChannelIndex)
+{
+    MaskedData resultRef = outputs.result();
+    if (Masked<Color3>::is(resultRef))
+        alphaChannelIndex = 3;
+    else if (Masked<float>::is(resultRef))
+        alphaChannelIndex = 1;
+    else
+        return 0;
+    return alphaChannelIndex + (outputs.alpha().valid() ? 1 : 0);
+}
+
+
+
+// Copy the channel major results of a batched lookup, one Block per
+// channel, to the outputs. If 'derivs', dx(c, lane) and dy(c, lane) give
+// the x and y derivatives of channel c.
+template<typename DxFunc, typename DyFunc>
+OSL_FORCEINLINE void
+store_batched_results(BatchedTextureOutputs& outputs, int alphaChannelIndex,
+                      const Block<float>* wresult, bool derivs,
+                      const DxFunc& dx, const DyFunc& dy)
+{
+    MaskedData resultRef = outputs.result();
+    MaskedData alphaRef  = outputs.alpha();
+
+    OSL_FORCEINLINE_BLOCK
+    {
+        if (alphaChannelIndex == 3) {
+            Masked<Color3> result(resultRef);
+            OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
+            for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+                result[lane] = Color3(wresult[0].data[lane],
+                                      wresult[1].data[lane],
+                                      wresult[2].data[lane]);
+            }
+            if (derivs && resultRef.has_derivs()) {
+                MaskedDx<Color3> resultDx(resultRef);
+                MaskedDy<Color3> resultDy(resultRef);
+                OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
+                for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+                    resultDx[lane] = Color3(dx(0, lane), dx(1, lane),
+                                            dx(2, lane));
+                    resultDy[lane] = Color3(dy(0, lane), dy(1, lane),
+                                            dy(2, lane));
+                }
+            }
+        } else {
+            Masked<float> result(resultRef);
+            OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
+            for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+                result[lane] = wresult[0].data[lane];
+            }
+            if (derivs && resultRef.has_derivs()) {
+                MaskedDx<float> resultDx(resultRef);
+                MaskedDy<float> resultDy(resultRef);
+                OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
+                for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+                    resultDx[lane] = dx(0, lane);
+                    resultDy[lane] = dy(0, lane);
+                }
+            }
+        }
+
+        if (alphaRef.valid()) {
+            Masked<float> alpha(alphaRef);
+            OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
+            for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+                alpha[lane] = wresult[alphaChannelIndex].data[lane];
+            }
+            if (derivs && alphaRef.has_derivs()) {
+                MaskedDx<float> alphaDx(alphaRef);
+                MaskedDy<float> alphaDy(alphaRef);
+                OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
+                for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+                    alphaDx[lane] = dx(alphaChannelIndex, lane);
+                    alphaDy[lane] = dy(alphaChannelIndex, lane);
+                }
+            }
+        }
+    }
+}
+
+
+
+bool
+batched_texture(BatchedRendererServices* bsr,
+                TextureSystem::TextureHandle* texture_handle,
+                TextureSystem::Perthread* texture_thread_info,
+                const BatchedTextureOptions& options, Wide<const float> ws,
+                Wide<const float> wt, Wide<const float> wdsdx,
+                Wide<const float> wdtdx, Wide<const float> wdsdy,
+                Wide<const float> wdtdy, BatchedTextureOutputs& outputs)
+{
+    int alphaChannelIndex;
+    int nchannels = batched_channels(outputs, alphaChannelIndex);
+    if (!nchannels)
+        return false;
+    bool has_derivs = outputs.result().has_derivs()
+                      || outputs.alpha().has_derivs();
+
+    // Channel major, one Block per channel, which is the
+    // result[channel*BatchWidth + lane] layout the TextureSystem fills in
+    Block<float> wresult[4];
+    Block<float> wdresultds[4];
+    Block<float> wdresultdt[4];
+
+    auto& opt = const_cast<OIIO::TextureOptBatch&>(
+        reinterpret_cast<const OIIO::TextureOptBatch&>(options));
+    bool ok = bsr->texturesys()->texture(
+        texture_handle, texture_thread_info, opt,
+        static_cast<OIIO::Tex::RunMask>(outputs.mask().value()),
+        ws.data().data, wt.data().data, wdsdx.data().data, wdtdx.data().data,
+        wdsdy.data().data, wdtdy.data().data, nchannels, wresult[0].data,
+        has_derivs ? wdresultds[0].data : nullptr,
+        has_derivs ? wdresultdt[0].data : nullptr);
+    if (!ok)
+        return false;
+
+    // Correct our st texture space gradients into xy-space gradients
+    auto dx = [&](int c, int lane) -> float {
+        return wdresultds[c].data[lane] * wdsdx[lane]
+               + wdresultdt[c].data[lane] * wdtdx[lane];
+    };
+    auto dy = [&](int c, int lane) -> float {
+        return wdresultds[c].data[lane] * wdsdy[lane]
+               + wdresultdt[c].data[lane] * wdtdy[lane];
+    };
+    store_batched_results(outputs, alphaChannelIndex, wresult, has_derivs,
+                          dx, dy);
+    return true;
+}
+
+
+
+bool
+batched_texture3d(BatchedRendererServices* bsr,
+                  TextureSystem::TextureHandle* texture_handle,
+                  TextureSystem::Perthread* texture_thread_info,
+                  const BatchedTextureOptions& options, Wide<const Vec3> wP,
+                  Wide<const Vec3> wdPdx, Wide<const Vec3> wdPdy,
+                  Wide<const Vec3> wdPdz, BatchedTextureOutputs& outputs)
+{
+    int alphaChannelIndex;
+    int nchannels = batched_channels(outputs, alphaChannelIndex);
+    if (!nchannels)
+        return false;
+    bool has_derivs = outputs.result().has_derivs()
+                      || outputs.alpha().has_derivs();
+
+    Block<float> wresult[4];
+    Block<float> wdresultds[4];
+    Block<float> wdresultdt[4];
+    Block<float> wdresultdr[4];
+
+    // Block<Vec3> is x, y and z arrays of BatchWidth floats, just as the
+    // TextureSystem takes points.
+    auto& opt = const_cast<OIIO::TextureOptBatch&>(
+        reinterpret_cast<const OIIO::TextureOptBatch&>(options));
+    bool ok = bsr->texturesys()->texture3d(
+        texture_handle, texture_thread_info, opt,
+        static_cast<OIIO::Tex::RunMask>(outputs.mask().value()),
+        wP.data().x, wdPdx.data().x, wdPdy.data().x, wdPdz.data().x,
+        nchannels, wresult[0].data, has_derivs ? wdresultds[0].data : nullptr,
+        has_derivs ? wdresultdt[0].data : nullptr,
+        has_derivs ? wdresultdr[0].data : nullptr);
+    if (!ok)
+        return false;
+
+    // Correct our str texture space gradients into xyz-space gradients
+    auto dx = [&](int c, int lane) -> float {
+        const Vec3 dPdx = wdPdx[lane];
+        return wdresultds[c].data[lane] * dPdx.x
+               + wdresultdt[c].data[lane] * dPdx.y
+               + wdresultdr[c].data[lane] * dPdx.z;
+    };
+    auto dy = [&](int c, int lane) -> float {
+        const Vec3 dPdy = wdPdy[lane];
+        return wdresultds[c].data[lane] * dPdy.x
+               + wdresultdt[c].data[lane] * dPdy.y
+               + wdresultdr[c].data[lane] * dPdy.z;
+    };
+    store_batched_results(outputs, alphaChannelIndex, wresult, has_derivs,
+                          dx, dy);
+    return true;
+}
+
+
+
+bool
+batched_environment(BatchedRendererServices* bsr,
+                    TextureSystem::TextureHandle* texture_handle,
+                    TextureSystem::Perthread* texture_thread_info,
+                    const BatchedTextureOptions& options, Wide<const Vec3> wR,
+                    Wide<const Vec3> wdRdx, Wide<const Vec3> wdRdy,
+                    BatchedTextureOutputs& outputs)
+{
+    int alphaChannelIndex;
+    int nchannels = batched_channels(outputs, alphaChannelIndex);
+    if (!nchannels)
+        return false;
+
+    Block<float> wresult[4];
+
+    // No derivatives: environment() zeroes them (see below).
+    auto& opt = const_cast<OIIO::TextureOptBatch&>(
+        reinterpret_cast<const OIIO::TextureOptBatch&>(options));
+    bool ok = bsr->texturesys()->environment(
+        texture_handle, texture_thread_info, opt,
+        static_cast<OIIO::Tex::RunMask>(outputs.mask().value()),
+        wR.data().x, wdRdx.data().x, wdRdy.data().x, nchannels,
+        wresult[0].data, nullptr, nullptr);
+    if (!ok)
+        return false;
+
+    auto none = [](int, int) -> float { return 0.0f; };
+    store_batched_results(outputs, alphaChannelIndex, wresult, false, none,
+                          none);
+    return true;
+}
+#endif
+
+
 Mask
 default_texture(BatchedRendererServices* bsr, ustring filename,
                 TextureSystem::TextureHandle* texture_handle,
@@ -60,6 +315,16 @@ default_texture(BatchedRendererServices* bsr, ustring filename,
 
     OSL_ASSERT(resultRef.valid());
 
+#if defined(OIIO_TEXTURE_SIMD_BATCH_WIDTH) \
+    && (OIIO_TEXTURE_SIMD_BATCH_WIDTH == __OSL_WIDTH)
+    if (batched_texture(bsr, texture_handle, texture_thread_info, options, ws,
+                        wt, wdsdx, wdtdx, wdsdy, wdtdy, outputs)) {
+        return mask;
+    }
+    // Some lane failed, fall through to the lane by lane lookups which
+    // will report exactly which lanes failed and their error messages.
+#endif
+
     // Convert our BatchedTextureOptions to a single TextureOpt
     // and submit them 1 at a time through existing non-batched interface
     // Renderers could implement their own batched texturing,
@@ -245,6 +510,16 @@ default_texture3d(BatchedRendererServices* bsr, ustring filename,
 
     ASSERT(resultRef.valid());
 
+#if defined(OIIO_TEXTURE_SIMD_BATCH_WIDTH) \
+    && (OIIO_TEXTURE_SIMD_BATCH_WIDTH == __OSL_WIDTH)
+    if (batched_texture3d(bsr, texture_handle, texture_thread_info, options,
+                          wP, wdPdx, wdPdy, wdPdz, outputs)) {
+        return mask;
+    }
+    // Some lane failed, fall through to the lane by lane lookups which
+    // will report exactly which lanes failed and their error messages.
+#endif
+
     // Convert our BatchedTextureOptions to a single TextureOpt
     // and submit them 1 at a time through existing non-batched interface
     // Renderers could implement their own batched texturing,
@@ -437,6 +712,16 @@ default_environment(BatchedRendererServices* bsr, ustring filename,
 
     ASSERT(resultRef.valid());
 
+#if defined(OIIO_TEXTURE_SIMD_BATCH_WIDTH) \
+    && (OIIO_TEXTURE_SIMD_BATCH_WIDTH == __OSL_WIDTH)
+    if (batched_environment(bsr, texture_handle, texture_thread_info, options,
+                            wR, wdRdx, wdRdy, outputs)) {
+        return mask;
+    }
+    // Some lane failed, fall through to the lane by lane lookups which
+    // will report exactly which lanes failed and their error messages.
+#endif
+
     // Convert our BatchedTextureOptions to a single TextureOpt
     // and submit them 1 at a time through existing non-batched interface
     // Renderers could implement their own batched environment,
@@ -546,7 +831,7 @@ dispatch_environment(BatchedRendererServices* bsr, ustring filename,
                    Wide<const Vec3> dRdx, Wide<const Vec3> dRdy,
                    BatchedTextureOutputs& outputs)
 {
-    if (bsr->is_overridden_texture3d()) {
+    if (bsr->is_overridden_environment()) {
         return bsr->environment(filename, texture_handle, texture_thread_info,
                               options, bsg, R, dRdx, dRdy, outputs);
     } else {
@@ -579,7 +864,7 @@ OSL_BATCHOP int __OSL_MASKED_OP(texture)(
 
     Mask retVal
         = dispatch_texture(bsg->uniform.renderer->batched(WidthTag()),
-                           USTR(name), (TextureSystem::TextureHandle*)handle,
+                           USTR(name), texture_handle(bsg, name, handle),
                            bsg->uniform.context->texture_thread_info(), opt,
                            bsg, Wide<const float>(s), Wide<const float>(t),
                            Wide<const float>(dsdx), Wide<const float>(dtdx),
@@ -629,7 +914,7 @@ OSL_BATCHOP int __OSL_MASKED_OP(texture3d)(void* bsg_, void* name, void* handle,
     // for correcting our str texture space gradients into xyz-space gradients
     Mask retVal
         = dispatch_texture3d(bsg->uniform.renderer->batched(WidthTag()),
-                             USTR(name), (TextureSystem::TextureHandle*)handle,
+                             USTR(name), texture_handle(bsg, name, handle),
                              bsg->uniform.context->texture_thread_info(), opt,
                              bsg, Wide<const Vec3>(wP), Wide<const Vec3>(wPdx),
                              Wide<const Vec3>(wPdy), Wide<const Vec3>(wPdz), outputs);
@@ -670,7 +955,7 @@ OSL_BATCHOP int __OSL_MASKED_OP(environment)(void* bsg_, void* name, void* handl
     // for correcting our str texture space gradients into xyz-space gradients
     Mask retVal
         = dispatch_environment(bsg->uniform.renderer->batched(WidthTag()),
-                             USTR(name), (TextureSystem::TextureHandle*)handle,
+                             USTR(name), texture_handle(bsg, name, handle),
                              bsg->uniform.context->texture_thread_info(), opt,
                              bsg, Wide<const Vec3>(wR), Wide<const Vec3>(wRdx),
                              Wide<const Vec3>(wRdy), outputs);
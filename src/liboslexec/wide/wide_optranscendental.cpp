@@ -101,6 +101,76 @@ OSL_USING_DATA_WIDTH(__OSL_WIDTH)
 
 #endif
 
+// "fast_" and "accurate_" variants for the "math_precision" option.
+// pow is masked only, matching its declarations.
+#define __OSL_XMACRO_ARGS (fast_log, OIIO::fast_log, fast_log)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_log2, OIIO::fast_log2, fast_log2)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_log10, OIIO::fast_log10, fast_log10)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_exp, OIIO::fast_exp, fast_exp)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_exp2, OIIO::fast_exp2, fast_exp2)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_expm1, OIIO::fast_expm1, fast_expm1)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_pow, OIIO::fast_safe_pow, fast_safe_pow)
+#define __OSL_XMACRO_MASKED_ONLY
+#include "wide_opbinary_per_component_xmacro.h"
+#define __OSL_XMACRO_ARGS (fast_pow, OIIO::fast_safe_pow, fast_safe_pow)
+#define __OSL_XMACRO_MASKED_ONLY
+#include "wide_opbinary_per_component_mixed_vector_float_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_erf, OIIO::fast_erf, fast_erf)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_erfc, OIIO::fast_erfc, fast_erfc)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_cbrt, OIIO::fast_cbrt, fast_cbrt)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_log, OIIO::safe_log, safe_log)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_log2, OIIO::safe_log2, safe_log2)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_log10, OIIO::safe_log10, safe_log10)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_exp, expf, exp)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_exp2, exp2f, exp2)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_expm1, expm1f, expm1)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_pow, OIIO::safe_pow, safe_pow)
+#define __OSL_XMACRO_MASKED_ONLY
+#include "wide_opbinary_per_component_xmacro.h"
+#define __OSL_XMACRO_ARGS (accurate_pow, OIIO::safe_pow, safe_pow)
+#define __OSL_XMACRO_MASKED_ONLY
+#include "wide_opbinary_per_component_mixed_vector_float_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_erf, erff, erf)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_erfc, erfcf, erfc)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_cbrt, cbrtf, cbrt)
+#include "wide_opunary_per_component_xmacro.h"
+
 #define __OSL_XMACRO_ARGS (logb, OIIO::fast_logb)
 #include "wide_opunary_per_component_float_or_vector_xmacro.h"
 
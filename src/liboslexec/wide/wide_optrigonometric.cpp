@@ -99,6 +99,68 @@ OSL_USING_DATA_WIDTH(__OSL_WIDTH)
 #include "wide_opunary_per_component_xmacro.h"
 #endif
 
+// Explicit "fast_" and "accurate_" variants of the above, bound instead of
+// the build default by the "math_precision" option.
+#define __OSL_XMACRO_ARGS (fast_sin, OIIO::fast_sin, OSL::fast_sin)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_cos, OIIO::fast_cos, OSL::fast_cos)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_tan, OIIO::fast_tan, OSL::fast_tan)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_asin, OIIO::fast_asin, OSL::fast_asin)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_acos, OIIO::fast_acos, OSL::fast_acos)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_atan, OIIO::fast_atan, OSL::fast_atan)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_atan2, OIIO::fast_atan2, OSL::fast_atan2)
+#include "wide_opbinary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_sinh, OIIO::fast_sinh, OSL::fast_sinh)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_cosh, OIIO::fast_cosh, OSL::fast_cosh)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (fast_tanh, OIIO::fast_tanh, OSL::fast_tanh)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_sin, sinf, OSL::sin)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_cos, cosf, OSL::cos)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_tan, tanf, OSL::tan)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_asin, safe_asin, OSL::safe_asin)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_acos, safe_acos, OSL::safe_acos)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_atan, atanf, OSL::atan)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_atan2, atan2f, OSL::atan2)
+#include "wide_opbinary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_sinh, sinhf, OSL::sinh)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_cosh, coshf, OSL::cosh)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (accurate_tanh, tanhf, OSL::tanh)
+#include "wide_opunary_per_component_xmacro.h"
+
 
 
 static OSL_FORCEINLINE void impl_sincos (float theta, float &rsine, float &rcosine) {
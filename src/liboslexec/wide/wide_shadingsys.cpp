@@ -404,7 +404,8 @@ OSL_BATCHOP int __OSL_OP1(get_attribute, s)(void* bsg_, int dest_derivs,
                                             void* obj_name_, void* attr_name_,
                                             int array_lookup, int index,
                                             const void* attr_type,
-                                            void* wide_attr_dest, int mask_)
+                                            void* wide_attr_dest, int mask_,
+                                            void* attr_handle)
 {
     Mask mask(mask_);
     ASSERT(mask.any_on());
@@ -420,7 +421,12 @@ OSL_BATCHOP int __OSL_OP1(get_attribute, s)(void* bsg_, int dest_derivs,
     MaskedData dest(*(const TypeDesc*)attr_type, dest_derivs, mask,
                     wide_attr_dest);
     Mask success;
-    if (array_lookup) {
+    if (attr_handle) {
+        success = renderer->get_attribute_by_handle(bsg, attr_handle, obj_name,
+                                                    attr_name,
+                                                    array_lookup ? index : -1,
+                                                    dest);
+    } else if (array_lookup) {
         success = renderer->get_array_attribute(bsg, obj_name, attr_name, index,
                                                 dest);
     } else {
@@ -485,7 +491,8 @@ OSL_BATCHOP int __OSL_MASKED_OP1(get_attribute,
 
 OSL_BATCHOP bool __OSL_OP(get_attribute_uniform)(
     void* bsg_, int dest_derivs, void* obj_name_, void* attr_name_,
-    int array_lookup, int index, const void* attr_type, void* attr_dest)
+    int array_lookup, int index, const void* attr_type, void* attr_dest,
+    void* attr_handle)
 {
     auto* bsg                = reinterpret_cast<BatchedShaderGlobals*>(bsg_);
     const ustring& obj_name  = USTR(obj_name_);
@@ -495,8 +502,29 @@ OSL_BATCHOP bool __OSL_OP(get_attribute_uniform)(
 
     RefData dest(*(const TypeDesc*)attr_type, dest_derivs, attr_dest);
 
+    // A uniform result is the same for every lane, so it is cached like a
+    // scalar lookup, just under this batch width.
+    ShadingContext* ctx = bsg->uniform.context;
+    bool cache          = ctx->shadingsys().cache_lookups();
+    int cache_index     = array_lookup ? index : -1;
+    size_t size         = dest.type().size() * (dest_derivs ? 3 : 1);
+    if (cache) {
+        if (auto* e = ctx->find_lookup(ShadingContext::LookupAttribute,
+                                       __OSL_WIDTH, obj_name, attr_name,
+                                       dest.type(), cache_index,
+                                       dest_derivs)) {
+            if (e->ok)
+                memcpy(attr_dest, ctx->lookup_data(*e), size);
+            return e->ok;
+        }
+    }
+
     bool success;
-    if (array_lookup) {
+    if (attr_handle) {
+        success = renderer->get_attribute_uniform_by_handle(bsg, attr_handle,
+                                                            obj_name, attr_name,
+                                                            cache_index, dest);
+    } else if (array_lookup) {
         success = renderer->get_array_attribute_uniform(bsg, obj_name,
                                                         attr_name, index, dest);
     } else {
@@ -504,6 +532,17 @@ OSL_BATCHOP bool __OSL_OP(get_attribute_uniform)(
                                                   dest);
     }
 
+    if (cache) {
+        auto& e = ctx->add_lookup(ShadingContext::LookupAttribute, __OSL_WIDTH,
+                                  obj_name, attr_name, dest.type(),
+                                  cache_index, dest_derivs,
+                                  success ? size : 0);
+        e.fetched = 1;
+        e.ok      = success;
+        if (success)
+            memcpy(ctx->lookup_data(e), attr_dest, size);
+    }
+
     return success;
 }
 
@@ -2,6 +2,11 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#ifndef __CUDA_ARCH__
+#    include <atomic>
+#    include <vector>
+#endif
+
 #include <OSL/sfmath.h>
 
 #include "gabornoise.h"
@@ -31,6 +36,12 @@ struct GaborParams {
     float lambda;
     float sqrt_lambda_inv;
     float radius, radius2, radius3, radius_inv;
+    // "fast" variant: impulse patterns come from a precomputed table,
+    // and the envelope is truncated at Gabor_Fast_Truncate.
+    bool fast;
+    int fast_impulses;
+    float fast_dist2;    // squared truncation radius, in grid units
+    float fast_radius2;
 
     OSL_HOSTDEVICE
     GaborParams (const NoiseParams &opt) :
@@ -39,7 +50,8 @@ struct GaborParams {
         do_filter(opt.do_filter),
         weight(Gabor_Impulse_Weight),
         bandwidth(hostdevice::clamp(opt.bandwidth,0.01f,100.0f)),
-        periodic(false)
+        periodic(false),
+        fast(false)
     {
 #if OSL_FAST_MATH
         float TWO_to_bandwidth = OIIO::fast_exp2(bandwidth);
@@ -65,6 +77,14 @@ struct GaborParams {
         float impulses = hostdevice::clamp (opt.impulses, 1.0f, 32.0f);
         lambda = impulses / (float(1.33333 * M_PI) * radius3);
         sqrt_lambda_inv = 1.0f / sqrtf(lambda);
+#ifndef __CUDA_ARCH__
+        // The impulse tables live in host memory; devices always take
+        // the exact path.
+        fast = (opt.fast != 0);
+#endif
+        fast_impulses = int(impulses + 0.5f);
+        fast_dist2 = logf(Gabor_Fast_Truncate) / logf(Gabor_Truncate);
+        fast_radius2 = radius2 * fast_dist2;
     }
 };
 
@@ -107,6 +127,55 @@ gabor_sample (GaborParams &gp, const Vec3 &/*x_c*/, fast_rng &rng,
 }
 
 
+// Evaluate a single gabor impulse with orientation omega_i and phase
+// phi_i, at offset x_k_i from its center.
+static OSL_HOSTDEVICE Dual2<float>
+gabor_impulse (const GaborParams &gp, const Vec3 &omega_i, float phi_i,
+               const Dual2<Vec3> &x_k_i)
+{
+    if (! gp.do_filter) {
+        // N.B. if determinant(gp.filter) is too small, we will
+        // run into numerical problems.  But the filtering isn't
+        // needed in that case anyway, so just don't filter.
+        // This seems to only come up when the filter region is
+        // tiny.
+        return gabor_kernel (gp.weight, omega_i, phi_i, gp.a, x_k_i);  // 3D
+    } else {
+        // Transform the impulse's anisotropy into tangent space
+        Vec3 omega_i_t;
+        multMatrix (gp.local, omega_i, omega_i_t);
+
+        // Slice to get a 2D kernel
+        Dual2<float> d_i = -dot(gp.N, x_k_i);
+        Dual2<float> w_i_t_s;
+        Vec2 omega_i_t_s;
+        Dual2<float> phi_i_t_s;
+        slice_gabor_kernel_3d (d_i, gp.weight, gp.a,
+                               omega_i_t, phi_i,
+                               w_i_t_s, omega_i_t_s, phi_i_t_s);
+
+        // Filter the 2D kernel
+        Dual2<float> w_i_t_s_f;
+        float a_i_t_s_f;
+        Vec2 omega_i_t_s_f;
+        Dual2<float> phi_i_t_s_f;
+        filter_gabor_kernel_2d (gp.filter, w_i_t_s, gp.a, omega_i_t_s, phi_i_t_s, w_i_t_s_f, a_i_t_s_f, omega_i_t_s_f, phi_i_t_s_f);
+
+        // Now evaluate the 2D filtered kernel
+        Dual2<Vec3> xkit;
+        multMatrix (gp.local, x_k_i, xkit);
+        Dual2<Vec2> x_k_i_t = make_Vec2 (comp_x(xkit), comp_y(xkit));
+        Dual2<float> gk = gabor_kernel (w_i_t_s_f, omega_i_t_s_f, phi_i_t_s_f, a_i_t_s_f, x_k_i_t); // 2D
+        if (! OIIO::isfinite(gk.val())) {
+            // Numeric failure of the filtered version.  Fall
+            // back on the unfiltered.
+            gk = gabor_kernel (gp.weight, omega_i, phi_i, gp.a, x_k_i);  // 3D
+        }
+        return gk;
+    }
+}
+
+
 // Evaluate the summed contribution of all gabor impulses within the
 // cell whose corner is c_i.  x_c_i is vector from x (the point
 // we are trying to evaluate noise at) and c_i.
@@ -131,69 +200,153 @@ gabor_cell (GaborParams &gp, const Vec3 &c_i, const Dual2<Vec3> &x_c_i,
         float phi_i;
         Vec3 omega_i;
         gabor_sample (gp, c_i, rng, omega_i, phi_i);
-        if (x_k_i.val().length2() < gp.radius2) {
-            if (! gp.do_filter) {
-                // N.B. if determinant(gp.filter) is too small, we will
-                // run into numerical problems.  But the filtering isn't
-                // needed in that case anyway, so just don't filter.
-                // This seems to only come up when the filter region is
-                // tiny.
-                sum += gabor_kernel (gp.weight, omega_i, phi_i, gp.a, x_k_i);  // 3D
-            } else {
-                // Transform the impulse's anisotropy into tangent space
-                Vec3 omega_i_t;
-                multMatrix (gp.local, omega_i, omega_i_t);
-
-                // Slice to get a 2D kernel
-                Dual2<float> d_i = -dot(gp.N, x_k_i);
-                Dual2<float> w_i_t_s;
-                Vec2 omega_i_t_s;
-                Dual2<float> phi_i_t_s;
-                slice_gabor_kernel_3d (d_i, gp.weight, gp.a,
-                                       omega_i_t, phi_i,
-                                       w_i_t_s, omega_i_t_s, phi_i_t_s);
-
-                // Filter the 2D kernel
-                Dual2<float> w_i_t_s_f;
-                float a_i_t_s_f;
-                Vec2 omega_i_t_s_f;
-                Dual2<float> phi_i_t_s_f;
-                filter_gabor_kernel_2d (gp.filter, w_i_t_s, gp.a, omega_i_t_s, phi_i_t_s, w_i_t_s_f, a_i_t_s_f, omega_i_t_s_f, phi_i_t_s_f);
-
-                // Now evaluate the 2D filtered kernel
-                Dual2<Vec3> xkit;
-                multMatrix (gp.local, x_k_i, xkit);
-                Dual2<Vec2> x_k_i_t = make_Vec2 (comp_x(xkit), comp_y(xkit));
-                Dual2<float> gk = gabor_kernel (w_i_t_s_f, omega_i_t_s_f, phi_i_t_s_f, a_i_t_s_f, x_k_i_t); // 2D
-                if (! OIIO::isfinite(gk.val())) {
-                    // Numeric failure of the filtered version.  Fall
-                    // back on the unfiltered.
-                    gk = gabor_kernel (gp.weight, omega_i, phi_i, gp.a, x_k_i);  // 3D
-                }
-                sum += gk;
-            }
+        if (x_k_i.val().length2() < gp.radius2)
+            sum += gabor_impulse (gp, omega_i, phi_i, x_k_i);
+    }
+
+    return sum;
+}
+
+
+#ifndef __CUDA_ARCH__
+// For the "fast" variant, rather than generating every cell's impulses
+// with the rng, each cell hashes to one of a fixed set of precomputed
+// impulse patterns.  The impulse count and positions only depend on the
+// impulse density (which, in grid units, is independent of bandwidth),
+// the class of anisotropy and the seed, so one table serves every other
+// parameter setting; the direction and bandwidth are applied at
+// evaluation time.
+static constexpr int Gabor_Fast_Patterns = 64;
+
+struct GaborImpulse {
+    Vec3 x;        // impulse position within the cell
+    Vec3 omega;    // isotropic: direction; hybrid: unit xy direction
+    float phi;
+};
+
+struct GaborImpulseTable {
+    int begin[Gabor_Fast_Patterns + 1];  // first impulse of each pattern
+    std::vector<GaborImpulse> impulses;
+};
+
+
+
+static GaborImpulseTable *
+gabor_build_impulse_table (int impulses, int anisotropic, int seed)
+{
+    // Sample with unit direction so hybrid omegas can be rescaled later.
+    NoiseParams unit_opt;
+    unit_opt.anisotropic = anisotropic;
+    unit_opt.impulses = float(impulses);
+    GaborParams unit (unit_opt);
+    float mean = unit.lambda * unit.radius3;
+
+    GaborImpulseTable *table = new GaborImpulseTable;
+    for (int p = 0; p < Gabor_Fast_Patterns; ++p) {
+        table->begin[p] = int(table->impulses.size());
+        fast_rng rng (Vec3 (float(p), float(anisotropic), 0.0f), seed);
+        int n_impulses = rng.poisson (mean);
+        for (int i = 0; i < n_impulses; ++i) {
+            GaborImpulse imp;
+            float z_rng = rng(), y_rng = rng(), x_rng = rng();
+            imp.x = Vec3 (x_rng, y_rng, z_rng);
+            gabor_sample (unit, imp.x, rng, imp.omega, imp.phi);
+            table->impulses.push_back (imp);
         }
     }
+    table->begin[Gabor_Fast_Patterns] = int(table->impulses.size());
+    return table;
+}
 
+
+
+// Retrieve (building on first use) the impulse table for gp's impulse
+// density and anisotropy class.  Tables are shared by all threads and
+// live for the duration of the process; there are at most 32*3*3 of
+// them.
+static const GaborImpulseTable *
+gabor_impulse_table (const GaborParams &gp, int seed)
+{
+    static std::atomic<GaborImpulseTable *> tables[32][3][3];
+    int impulses = OIIO::clamp (gp.fast_impulses, 1, 32);
+    int anisotropic = (gp.anisotropic == 0 || gp.anisotropic == 1)
+                    ? gp.anisotropic : 2;
+    std::atomic<GaborImpulseTable *> &slot (tables[impulses-1][anisotropic][seed]);
+    GaborImpulseTable *table = slot.load (std::memory_order_acquire);
+    if (! table) {
+        GaborImpulseTable *t = gabor_build_impulse_table (impulses, anisotropic, seed);
+        if (slot.compare_exchange_strong (table, t, std::memory_order_acq_rel))
+            table = t;
+        else
+            delete t;   // another thread built it first
+    }
+    return table;
+}
+
+
+
+// The "fast" equivalent of gabor_cell: impulses come from the table
+// pattern selected by hashing the cell, and only those whose envelope is
+// above Gabor_Fast_Truncate are evaluated.
+static Dual2<float>
+gabor_cell_fast (GaborParams &gp, const GaborImpulseTable &table,
+                 const Vec3 &c_i, const Dual2<Vec3> &x_c_i, int seed)
+{
+    Vec3 cell (gp.periodic ? Vec3(wrap(c_i,gp.period)) : c_i);
+    unsigned int pattern = inthash (unsigned(OIIO::ifloor(cell.x)),
+                                    unsigned(OIIO::ifloor(cell.y)),
+                                    unsigned(OIIO::ifloor(cell.z)),
+                                    unsigned(seed)) % Gabor_Fast_Patterns;
+    float omega_r = gp.omega.length();
+    Dual2<float> sum = 0;
+
+    for (int i = table.begin[pattern], e = table.begin[pattern+1]; i < e; ++i) {
+        const GaborImpulse &imp (table.impulses[i]);
+        Dual2<Vec3> x_k_i = gp.radius * (x_c_i - imp.x);
+        if (x_k_i.val().length2() < gp.fast_radius2) {
+            Vec3 omega_i = gp.anisotropic == 1 ? gp.omega
+                         : (gp.anisotropic == 0 ? imp.omega : omega_r * imp.omega);
+            sum += gabor_impulse (gp, omega_i, imp.phi, x_k_i);
+        }
+    }
     return sum;
 }
+#endif
+
 
 
 // Sum the contributions of gabor impulses in all neighboring cells
-// surrounding position x_g.
+// surrounding position x_g.  Neighbors entirely outside the truncation
+// radius are skipped; since each cell seeds its own rng, this doesn't
+// change the result.
 static OSL_HOSTDEVICE Dual2<float>
 gabor_grid (GaborParams &gp, const Dual2<Vec3> &x_g, int seed=0)
 {
     Vec3 floor_x_g (floor (x_g));  // Vec3 because floor has no derivs
     Dual2<Vec3> x_c = x_g - floor_x_g;
     Dual2<float> sum = 0;
-    
+    float cull_dist2 = Gabor_Cull_Dist2;
+#ifndef __CUDA_ARCH__
+    const GaborImpulseTable *table = gp.fast ? gabor_impulse_table (gp, seed)
+                                             : nullptr;
+    if (table)
+        cull_dist2 *= gp.fast_dist2;
+#endif
+
     for (int k = -1; k <= 1; k++) {
         for (int j = -1; j <= 1; j++) {
             for (int i = -1; i <= 1; i++) {
                 Vec3 c (i,j,k);
+                if (gabor_cell_dist2 (x_c.val(), c) > cull_dist2)
+                    continue;
                 Vec3 c_i = floor_x_g + c;
                 Dual2<Vec3> x_c_i = x_c - c;
+#ifndef __CUDA_ARCH__
+                if (table) {
+                    sum += gabor_cell_fast (gp, *table, c_i, x_c_i, seed);
+                    continue;
+                }
+#endif
                 sum += gabor_cell (gp, c_i, x_c_i, seed);
             }
         }
@@ -40,6 +40,17 @@ static OSL_DEVICE constexpr float Gabor_Impulse_Weight = 1.0f;
 // peak value.
 static OSL_DEVICE const float Gabor_Truncate = 0.02f;
 
+// The "fast" Gabor variant trades accuracy for speed by truncating the
+// envelope much more aggressively, so fewer impulses (and often fewer
+// cells) need to be evaluated.
+static OSL_DEVICE const float Gabor_Fast_Truncate = 0.1f;
+
+// Impulses only contribute within a distance of 1 (in grid units) from
+// the point being evaluated.  Cells farther than that can be skipped
+// entirely; the small margin keeps round off from ever culling a cell
+// that the per-impulse test would have accepted.
+static OSL_DEVICE constexpr float Gabor_Cull_Dist2 = 1.001f;
+
 
 
 // Very fast random number generator based on [Borosh & Niederreiter 1983]
@@ -198,6 +209,21 @@ make_orthonormals (Vec3 &v, Vec3 &a, Vec3 &b)
 
 
 
+// Squared distance (in grid units) from the point at x_c, relative to the
+// corner of its own cell, to the nearest point of the neighboring cell
+// at integer offset c.
+OSL_FORCEINLINE OSL_HOSTDEVICE float
+gabor_cell_dist2 (const Vec3 &x_c, const Vec3 &c)
+{
+    // avoid aliasing issues by not using the [] operator
+    float dx = c.x < 0.0f ? x_c.x : (c.x > 0.0f ? 1.0f - x_c.x : 0.0f);
+    float dy = c.y < 0.0f ? x_c.y : (c.y > 0.0f ? 1.0f - x_c.y : 0.0f);
+    float dz = c.z < 0.0f ? x_c.z : (c.z > 0.0f ? 1.0f - x_c.z : 0.0f);
+    return dx * dx + dy * dy + dz * dz;
+}
+
+
+
 // Helper function: per-component 'floor' of a Dual2<Vec3>.
 OSL_FORCEINLINE OSL_HOSTDEVICE Vec3
 floor (const Dual2<Vec3> &vd)
@@ -0,0 +1,530 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+// oslnoise_bench -- time every noise family, in every signature, both as
+// the scalar implementation and as the batched (wide) shade ops, and
+// write the results in machine readable form (JSON and/or CSV) so that
+// they can be compared between builds and releases.
+//
+// The wide shade ops live in the per-target libraries
+// (lib_b8_AVX2_oslexec.so, etc.), which are loaded at runtime with
+// OIIO::Plugin exactly as the batched back end does; targets that were
+// not built, or that the CPU doesn't support, are silently skipped.
+
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <OpenImageIO/argparse.h>
+#include <OpenImageIO/benchmark.h>
+#include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/imageio.h>
+#include <OpenImageIO/plugin.h>
+#include <OpenImageIO/strutil.h>
+#include <OpenImageIO/sysutil.h>
+#include <OpenImageIO/ustring.h>
+
+#include "oslexec_pvt.h"
+#include <OSL/dual_vec.h>
+#include <OSL/oslnoise.h>
+
+using namespace OSL;
+using namespace OSL::pvt;
+using namespace OIIO;
+
+
+static int iterations = 1000000;
+static int ntrials = 5;
+static bool quiet = false;
+static std::string json_filename;
+static std::string csv_filename;
+static std::string filter;
+static std::string libpath;
+
+
+
+// One timed benchmark.
+struct BenchResult {
+    std::string family;   // e.g. "perlin", "pcell", "gabor"
+    std::string result;   // "float" or "vector"
+    std::string args;     // argument types, e.g. "vf" for (point, float)
+    bool derivs;          // Dual2 arguments and result
+    std::string target;   // "scalar", or the batched target, e.g. "b8_AVX2"
+    int width;            // points computed per call
+    double avg, stddev, median;   // seconds per call
+};
+
+static std::vector<BenchResult> results;
+
+
+
+static bool
+selected (const std::string& name)
+{
+    return filter.empty() || Strutil::contains (name, filter);
+}
+
+
+
+static void
+record (Benchmarker& bench, const std::string& name, BenchResult r)
+{
+    r.avg = bench.avg();
+    r.stddev = bench.stddev();
+    r.median = bench.median();
+    results.push_back (r);
+}
+
+
+
+static std::string
+bench_name (const BenchResult& r)
+{
+    return Strutil::fmt::format ("{} {} {}({}){}", r.target, r.family,
+                                 r.result == "float" ? "f" : "v", r.args,
+                                 r.derivs ? " derivs" : "");
+}
+
+
+
+// Arbitrary but non-trivial input values, with derivatives when needed.
+template<typename T> inline T make_input (float base);
+template<> inline float make_input<float> (float base) { return base; }
+template<> inline Vec3 make_input<Vec3> (float base) {
+    return Vec3 (base, base + 0.25f, base + 0.5f);
+}
+template<> inline Dual2<float> make_input<Dual2<float>> (float base) {
+    return Dual2<float> (base, 0.01f, 0.02f);
+}
+template<> inline Dual2<Vec3> make_input<Dual2<Vec3>> (float base) {
+    return Dual2<Vec3> (make_input<Vec3> (base), Vec3 (0.01f, 0.0f, 0.0f),
+                        Vec3 (0.0f, 0.01f, 0.0f));
+}
+
+
+
+template<typename Impl, typename R, typename... A>
+static void
+bench_scalar (Benchmarker& bench, const Impl& impl, const char* family,
+              const char* args, bool derivs, A... a)
+{
+    BenchResult r { family,
+                    std::is_same<R, float>::value
+                            || std::is_same<R, Dual2<float>>::value
+                        ? "float" : "vector",
+                    args, derivs, "scalar", 1, 0.0, 0.0, 0.0 };
+    std::string name = bench_name (r);
+    if (! selected (name))
+        return;
+    R result;
+    bench (name, [&]() {
+        impl (result, a...);
+        DoNotOptimize (result);
+    });
+    record (bench, name, r);
+}
+
+
+
+// All signatures of a non-periodic noise: float and vector results of
+// (float), (float,float), (point) and (point,float).
+template<typename Impl, bool Derivs>
+static void
+bench_scalar_family (Benchmarker& bench, const Impl& impl, const char* family)
+{
+    typedef typename std::conditional<Derivs, Dual2<float>, float>::type F;
+    typedef typename std::conditional<Derivs, Dual2<Vec3>, Vec3>::type V;
+    F f = make_input<F> (0.5f);  clobber (f);
+    F t = make_input<F> (1.25f); clobber (t);
+    V v = make_input<V> (0.75f); clobber (v);
+    bench_scalar<Impl, F> (bench, impl, family, "f", Derivs, f);
+    bench_scalar<Impl, F> (bench, impl, family, "ff", Derivs, f, t);
+    bench_scalar<Impl, F> (bench, impl, family, "v", Derivs, v);
+    bench_scalar<Impl, F> (bench, impl, family, "vf", Derivs, v, t);
+    bench_scalar<Impl, V> (bench, impl, family, "f", Derivs, f);
+    bench_scalar<Impl, V> (bench, impl, family, "ff", Derivs, f, t);
+    bench_scalar<Impl, V> (bench, impl, family, "v", Derivs, v);
+    bench_scalar<Impl, V> (bench, impl, family, "vf", Derivs, v, t);
+}
+
+
+
+// The periodic equivalent; periods never carry derivatives.
+template<typename Impl, bool Derivs>
+static void
+bench_scalar_periodic_family (Benchmarker& bench, const Impl& impl,
+                              const char* family)
+{
+    typedef typename std::conditional<Derivs, Dual2<float>, float>::type F;
+    typedef typename std::conditional<Derivs, Dual2<Vec3>, Vec3>::type V;
+    F f = make_input<F> (0.5f);  clobber (f);
+    F t = make_input<F> (1.25f); clobber (t);
+    V v = make_input<V> (0.75f); clobber (v);
+    float fp = 4.0f;             clobber (fp);
+    Vec3 vp (4.0f, 5.0f, 6.0f);  clobber (vp);
+    bench_scalar<Impl, F> (bench, impl, family, "f", Derivs, f, fp);
+    bench_scalar<Impl, F> (bench, impl, family, "ff", Derivs, f, t, fp, fp);
+    bench_scalar<Impl, F> (bench, impl, family, "v", Derivs, v, vp);
+    bench_scalar<Impl, F> (bench, impl, family, "vf", Derivs, v, t, vp, fp);
+    bench_scalar<Impl, V> (bench, impl, family, "f", Derivs, f, fp);
+    bench_scalar<Impl, V> (bench, impl, family, "ff", Derivs, f, t, fp, fp);
+    bench_scalar<Impl, V> (bench, impl, family, "v", Derivs, v, vp);
+    bench_scalar<Impl, V> (bench, impl, family, "vf", Derivs, v, t, vp, fp);
+}
+
+
+
+// Gabor noise has no functor in oslnoise.h, and always computes
+// derivatives (it needs them to filter).
+struct BenchGabor {
+    NoiseParams opt;
+    void operator() (Dual2<float>& r, const Dual2<float>& x) const { r = gabor (x, &opt); }
+    void operator() (Dual2<float>& r, const Dual2<float>& x, const Dual2<float>& y) const { r = gabor (x, y, &opt); }
+    void operator() (Dual2<float>& r, const Dual2<Vec3>& p) const { r = gabor (p, &opt); }
+    void operator() (Dual2<float>& r, const Dual2<Vec3>& p, const Dual2<float>&) const { r = gabor (p, &opt); }
+    void operator() (Dual2<Vec3>& r, const Dual2<float>& x) const { r = gabor3 (x, &opt); }
+    void operator() (Dual2<Vec3>& r, const Dual2<float>& x, const Dual2<float>& y) const { r = gabor3 (x, y, &opt); }
+    void operator() (Dual2<Vec3>& r, const Dual2<Vec3>& p) const { r = gabor3 (p, &opt); }
+    void operator() (Dual2<Vec3>& r, const Dual2<Vec3>& p, const Dual2<float>&) const { r = gabor3 (p, &opt); }
+};
+
+struct BenchPeriodicGabor {
+    NoiseParams opt;
+    void operator() (Dual2<float>& r, const Dual2<float>& x, float px) const { r = pgabor (x, px, &opt); }
+    void operator() (Dual2<float>& r, const Dual2<float>& x, const Dual2<float>& y, float px, float py) const { r = pgabor (x, y, px, py, &opt); }
+    void operator() (Dual2<float>& r, const Dual2<Vec3>& p, const Vec3& pp) const { r = pgabor (p, pp, &opt); }
+    void operator() (Dual2<float>& r, const Dual2<Vec3>& p, const Dual2<float>&, const Vec3& pp, float) const { r = pgabor (p, pp, &opt); }
+    void operator() (Dual2<Vec3>& r, const Dual2<float>& x, float px) const { r = pgabor3 (x, px, &opt); }
+    void operator() (Dual2<Vec3>& r, const Dual2<float>& x, const Dual2<float>& y, float px, float py) const { r = pgabor3 (x, y, px, py, &opt); }
+    void operator() (Dual2<Vec3>& r, const Dual2<Vec3>& p, const Vec3& pp) const { r = pgabor3 (p, pp, &opt); }
+    void operator() (Dual2<Vec3>& r, const Dual2<Vec3>& p, const Dual2<float>&, const Vec3& pp, float) const { r = pgabor3 (p, pp, &opt); }
+};
+
+
+
+static void
+bench_scalar_all (Benchmarker& bench)
+{
+    bench_scalar_family<SNoise, false> (bench, SNoise(), "perlin");
+    bench_scalar_family<SNoise, true> (bench, SNoise(), "perlin");
+    bench_scalar_family<Noise, false> (bench, Noise(), "uperlin");
+    bench_scalar_family<Noise, true> (bench, Noise(), "uperlin");
+    bench_scalar_family<SimplexNoise, false> (bench, SimplexNoise(), "simplex");
+    bench_scalar_family<SimplexNoise, true> (bench, SimplexNoise(), "simplex");
+    bench_scalar_family<USimplexNoise, false> (bench, USimplexNoise(), "usimplex");
+    bench_scalar_family<USimplexNoise, true> (bench, USimplexNoise(), "usimplex");
+    bench_scalar_family<CellNoise, false> (bench, CellNoise(), "cell");
+    bench_scalar_family<HashNoise, false> (bench, HashNoise(), "hash");
+    bench_scalar_family<BenchGabor, true> (bench, BenchGabor(), "gabor");
+
+    bench_scalar_periodic_family<PeriodicSNoise, false> (bench, PeriodicSNoise(), "pperlin");
+    bench_scalar_periodic_family<PeriodicSNoise, true> (bench, PeriodicSNoise(), "pperlin");
+    bench_scalar_periodic_family<PeriodicNoise, false> (bench, PeriodicNoise(), "puperlin");
+    bench_scalar_periodic_family<PeriodicNoise, true> (bench, PeriodicNoise(), "puperlin");
+    bench_scalar_periodic_family<PeriodicCellNoise, false> (bench, PeriodicCellNoise(), "pcell");
+    bench_scalar_periodic_family<PeriodicHashNoise, false> (bench, PeriodicHashNoise(), "phash");
+    bench_scalar_periodic_family<BenchPeriodicGabor, true> (bench, BenchPeriodicGabor(), "pgabor");
+}
+
+
+
+// A batched target library, and the CPU feature it requires.
+struct WideTarget {
+    int width;
+    const char* isa;
+    const char* cpu_feature;   // as listed by OIIO's "hw:simd" attribute
+};
+
+static const WideTarget wide_targets[] = {
+    { 16, "AVX512", "avx512f" },
+    { 8,  "AVX512", "avx512f" },
+    { 8,  "AVX2",   "avx2" },
+    { 8,  "AVX",    "avx" },
+};
+
+
+
+// Call a batched shade op through a type-erased pointer: every argument
+// is a pointer to a block of wide data, followed by the mask.
+static void
+call_wide_op (void* func, char* const* a, int nargs, unsigned int mask)
+{
+    typedef char* P;
+    switch (nargs) {
+    case 2: ((void (*)(P,P,unsigned int))func) (a[0], a[1], mask); break;
+    case 3: ((void (*)(P,P,P,unsigned int))func) (a[0], a[1], a[2], mask); break;
+    case 5: ((void (*)(P,P,P,P,P,unsigned int))func) (a[0], a[1], a[2], a[3], a[4], mask); break;
+    case 6: ((void (*)(P,P,P,P,P,P,unsigned int))func) (a[0], a[1], a[2], a[3], a[4], a[5], mask); break;
+    case 7: ((void (*)(P,P,P,P,P,P,P,unsigned int))func) (a[0], a[1], a[2], a[3], a[4], a[5], a[6], mask); break;
+    case 9: ((void (*)(P,P,P,P,P,P,P,P,P,unsigned int))func) (a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8], mask); break;
+    default: OSL_ASSERT (0 && "unexpected number of wide noise arguments");
+    }
+}
+
+
+
+class WideBench {
+public:
+    WideBench (Benchmarker& bench, const WideTarget& target,
+               Plugin::Handle lib)
+        : m_bench(bench), m_target(target), m_lib(lib),
+          m_selector(Strutil::fmt::format ("b{}_{}", target.width, target.isa))
+    {
+        // Enough for the largest argument, a Dual2<Vec3> block of 16
+        // lanes, for every argument of the longest signature.
+        m_data.reset (new float[max_args * 9 * 16 + 16]);
+        float* aligned = (float*)(((uintptr_t)m_data.get() + 63) & ~uintptr_t(63));
+        for (int i = 0; i < max_args * 9 * 16; ++i)
+            aligned[i] = 0.125f + 0.0137f * i;
+        for (int i = 0; i < max_args; ++i)
+            m_args[i] = (char*)(aligned + i * 9 * 16);
+    }
+
+    // Time op 'opname' with the given wide argument codes (result first),
+    // e.g. {"Wdf","Wdv","Wdf"}.  Gabor ops take extra name, shader
+    // globals, options and direction arguments.
+    void run (const char* family, const char* opname, const char* args,
+              bool derivs, std::initializer_list<const char*> codes,
+              bool gabor = false)
+    {
+        BenchResult r { family,
+                        Strutil::ends_with (*codes.begin(), "f") ? "float" : "vector",
+                        args, derivs, m_selector, m_target.width,
+                        0.0, 0.0, 0.0 };
+        std::string name = bench_name (r);
+        if (! selected (name))
+            return;
+        std::string symbol = Strutil::fmt::format ("osl_{}_{}_", m_selector, opname);
+        for (const char* c : codes)
+            symbol += c;
+        symbol += "_masked";
+        void* func = Plugin::getsym (m_lib, symbol, /*report_error=*/false);
+        if (! func) {
+            if (! quiet)
+                Strutil::print ("  {} not found, skipping\n", symbol);
+            return;
+        }
+
+        char* a[max_args + 4];
+        int nargs = 0;
+        if (gabor)
+            a[nargs++] = (char*)ustring("gabor").c_str();
+        for (size_t i = 0; i < codes.size(); ++i)
+            a[nargs++] = m_args[i];
+        if (gabor) {
+            a[nargs++] = nullptr;          // shader globals are unused
+            a[nargs++] = (char*)&m_opt;
+            a[nargs++] = nullptr;          // uniform direction
+        }
+        unsigned int mask = (1u << m_target.width) - 1;
+        m_bench (name, [&]() { call_wide_op (func, a, nargs, mask); });
+        record (m_bench, name, r);
+    }
+
+    // All signatures of a non-periodic wide op.
+    void run_family (const char* family, const char* opname, bool derivs,
+                     bool gabor = false)
+    {
+        const char* f = derivs ? "Wdf" : "Wf";
+        const char* v = derivs ? "Wdv" : "Wv";
+        for (const char* result : { f, v }) {
+            run (family, opname, "f", derivs, { result, f }, gabor);
+            run (family, opname, "ff", derivs, { result, f, f }, gabor);
+            run (family, opname, "v", derivs, { result, v }, gabor);
+            run (family, opname, "vf", derivs, { result, v, f }, gabor);
+        }
+    }
+
+    // All signatures of a periodic wide op.
+    void run_periodic_family (const char* family, const char* opname,
+                              bool derivs, bool gabor = false)
+    {
+        const char* f = derivs ? "Wdf" : "Wf";
+        const char* v = derivs ? "Wdv" : "Wv";
+        for (const char* result : { f, v }) {
+            run (family, opname, "f", derivs, { result, f, "Wf" }, gabor);
+            run (family, opname, "ff", derivs, { result, f, f, "Wf", "Wf" }, gabor);
+            run (family, opname, "v", derivs, { result, v, "Wv" }, gabor);
+            run (family, opname, "vf", derivs, { result, v, f, "Wv", "Wf" }, gabor);
+        }
+    }
+
+private:
+    static constexpr int max_args = 5;
+    Benchmarker& m_bench;
+    const WideTarget& m_target;
+    Plugin::Handle m_lib;
+    std::string m_selector;
+    std::unique_ptr<float[]> m_data;
+    char* m_args[max_args];
+    NoiseParams m_opt;
+};
+
+
+
+static void
+bench_wide_all (Benchmarker& bench)
+{
+    std::string simd;
+    OIIO::getattribute ("hw:simd", simd);
+    std::vector<std::string> features = Strutil::splits (simd, ",");
+    std::vector<std::string> dirs;
+    Filesystem::searchpath_split (libpath, dirs);
+
+    for (const WideTarget& target : wide_targets) {
+        if (std::find (features.begin(), features.end(),
+                       target.cpu_feature) == features.end())
+            continue;
+        std::string libname = Strutil::fmt::format ("lib_b{}_{}_oslexec.{}",
+                                                    target.width, target.isa,
+                                                    Plugin::plugin_extension());
+        std::string filename = Filesystem::searchpath_find (libname, dirs);
+        if (filename.empty())
+            continue;
+        Plugin::Handle lib = Plugin::open (filename, /*global=*/false);
+        if (! lib) {
+            std::cerr << "Could not load " << filename << ": "
+                      << Plugin::geterror() << "\n";
+            continue;
+        }
+
+        WideBench wide (bench, target, lib);
+        for (bool derivs : { false, true }) {
+            wide.run_family ("perlin", "snoise", derivs);
+            wide.run_family ("uperlin", "noise", derivs);
+            wide.run_family ("simplex", "simplexnoise", derivs);
+            wide.run_family ("usimplex", "usimplexnoise", derivs);
+            wide.run_periodic_family ("pperlin", "psnoise", derivs);
+            wide.run_periodic_family ("puperlin", "pnoise", derivs);
+        }
+        wide.run_family ("cell", "cellnoise", false);
+        wide.run_family ("hash", "hashnoise", false);
+        wide.run_periodic_family ("pcell", "pcellnoise", false);
+        wide.run_periodic_family ("phash", "phashnoise", false);
+        wide.run_family ("gabor", "gabornoise", true, true);
+        wide.run_periodic_family ("pgabor", "gaborpnoise", true, true);
+        // The library stays loaded; the process is about to exit anyway.
+    }
+}
+
+
+
+static void
+write_json (std::ostream& out)
+{
+    out << "{\n";
+    out << "  \"osl_version\": \"" << OSL_LIBRARY_VERSION_STRING << "\",\n";
+    out << "  \"iterations\": " << iterations << ",\n";
+    out << "  \"trials\": " << ntrials << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r (results[i]);
+        out << Strutil::fmt::format (
+            "    {{ \"family\": \"{}\", \"result\": \"{}\", \"args\": \"{}\", "
+            "\"derivs\": {}, \"target\": \"{}\", \"width\": {}, "
+            "\"ns_per_call\": {:.3f}, \"ns_per_point\": {:.3f}, "
+            "\"stddev_ns\": {:.3f}, \"median_ns\": {:.3f} }}{}\n",
+            r.family, r.result, r.args, r.derivs ? "true" : "false",
+            r.target, r.width, r.avg * 1e9, r.avg * 1e9 / r.width,
+            r.stddev * 1e9, r.median * 1e9,
+            i + 1 < results.size() ? "," : "");
+    }
+    out << "  ]\n}\n";
+}
+
+
+
+static void
+write_csv (std::ostream& out)
+{
+    out << "family,result,args,derivs,target,width,ns_per_call,ns_per_point,stddev_ns,median_ns\n";
+    for (const BenchResult& r : results)
+        out << Strutil::fmt::format ("{},{},{},{},{},{},{:.3f},{:.3f},{:.3f},{:.3f}\n",
+                                     r.family, r.result, r.args,
+                                     r.derivs ? 1 : 0, r.target, r.width,
+                                     r.avg * 1e9, r.avg * 1e9 / r.width,
+                                     r.stddev * 1e9, r.median * 1e9);
+}
+
+
+
+static bool
+write_output (const std::string& filename, void (*writer)(std::ostream&))
+{
+    if (filename.empty())
+        return true;
+    if (filename == "-") {
+        writer (std::cout);
+        return true;
+    }
+    std::ofstream out;
+    Filesystem::open (out, filename);
+    if (! out) {
+        std::cerr << "Could not open " << filename << " for writing\n";
+        return false;
+    }
+    writer (out);
+    return true;
+}
+
+
+
+static void
+getargs (int argc, const char *argv[])
+{
+    bool help = false;
+    OIIO::ArgParse ap;
+    ap.options ("oslnoise_bench  (" OSL_INTRO_STRING ")\n"
+                "Usage:  oslnoise_bench [options]",
+                "--help", &help, "Print help message",
+                "-q", &quiet, "Quiet mode (don't print each timing)",
+                "--iterations %d", &iterations,
+                    ustring::fmtformat("Number of iterations (default: {})", iterations).c_str(),
+                "--trials %d", &ntrials, "Number of trials",
+                "--filter %s", &filter, "Only run benchmarks whose name contains this string",
+                "--libpath %s", &libpath, "Search path for the batched target libraries",
+                "--json %s", &json_filename, "Write results as JSON to this file ('-' for stdout)",
+                "--csv %s", &csv_filename, "Write results as CSV to this file ('-' for stdout)",
+                NULL);
+    if (ap.parse (argc, (const char**)argv) < 0) {
+        std::cerr << ap.geterror() << std::endl;
+        ap.usage ();
+        exit (EXIT_FAILURE);
+    }
+    if (help) {
+        ap.usage ();
+        exit (EXIT_FAILURE);
+    }
+    if (libpath.empty()) {
+        // Look where an install or build tree puts the libraries.
+        std::string bindir = Filesystem::parent_path (Sysutil::this_program_path());
+        libpath = bindir + ":" + bindir + "/../lib";
+    }
+}
+
+
+
+int
+main (int argc, char const *argv[])
+{
+    getargs (argc, argv);
+
+    Benchmarker bench;
+    bench.iterations (iterations);
+    bench.trials (ntrials);
+    bench.verbose (! quiet);
+
+    bench_scalar_all (bench);
+    bench_wide_all (bench);
+
+    bool ok = write_output (json_filename, write_json);
+    ok &= write_output (csv_filename, write_csv);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -418,6 +418,9 @@ gabor_grid(const sfm::GaborUniformParams& gup, const sfm::GaborParams& gp,
             OSL_CLANG_PRAGMA(nounroll)
             for (int i = -1; i <= 1; i++) {
                 Vec3 c(i, j, k);
+                // No impulse of a cell this far away can reach x_g
+                if (pvt::gabor_cell_dist2(x_c.val(), c) > Gabor_Cull_Dist2)
+                    continue;
                 Vec3 c_i          = floor_x_g + c;
                 Dual2<Vec3> x_c_i = x_c - c;
                 sum += sfm::gabor_cell<AnisotropicT, FilterPolicyT, PeriodicT>(
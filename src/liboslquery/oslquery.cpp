@@ -3,8 +3,11 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "../liboslexec/osoreader.h"
@@ -381,9 +384,36 @@ OSLQuery::open(string_view shadername, string_view searchpath)
     }
 
     bool ok = oso.parse_file(filename);
+    if (!ok)
+        errorfmt("File \"{}\" could not be read.", filename);
     return ok;
 }
 
+std::vector<OSLQuery>
+OSLQuery::open_many(cspan<std::string> shadernames, string_view searchpath,
+                    int nthreads)
+{
+    std::vector<OSLQuery> queries(shadernames.size());
+    if (nthreads <= 0)
+        nthreads = int(std::thread::hardware_concurrency());
+    nthreads = std::max(1, std::min(nthreads, int(shadernames.size())));
+
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i; (i = next++) < queries.size();)
+            queries[i].open(shadernames[i], searchpath);
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nthreads; ++t)
+        threads.emplace_back(worker);
+    worker();
+    for (auto&& t : threads)
+        t.join();
+    return queries;
+}
+
+
+
 bool
 OSLQuery::open_bytecode(string_view buffer)
 {
@@ -6,6 +6,9 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <map>
+#include <memory>
+#include <unordered_map>
 
 #include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/imagebufalgo.h>
@@ -17,6 +20,9 @@
 #include <OSL/oslcomp.h>
 #include <OSL/oslexec.h>
 #include <OSL/rendererservices.h>
+#if OSL_USE_BATCHED
+#    include <OSL/batched_rendererservices.h>
+#endif
 
 using namespace OIIO;
 
@@ -24,6 +30,10 @@ using namespace OIIO;
 
 OSL_NAMESPACE_ENTER
 
+namespace pvt {
+struct CachedGroup;
+}
+
 
 /// OSLInput is an ImageInput that behaves as if it's reading an image,
 /// but actually it is executing OSL shaders to generate pixel values.
@@ -46,6 +56,14 @@ OSL_NAMESPACE_ENTER
 ///    MIP=%d           Should it generate all MIP levels (default: 0)
 ///    OUTPUT=%s        Name of output variable to use in the image
 ///                         (default: "result")
+///    PRESHADE=%d      Shade a whole MIP level (of up to 4096x4096
+///                         pixels), in parallel, the first time any of its
+///                         pixels are read, and answer all later reads of
+///                         that level from it (default: 1)
+///
+/// Images opened with the same shader, parameters and outputs share one
+/// shader group, and (for PRESHADE) the MIP levels already shaded, no
+/// matter how many times the TextureSystem opens and closes them.
 ///
 /// All other options are interpreted as setting shader parameters. The
 /// format is "type name=value". If the type is omitted, it will be inferred
@@ -86,8 +104,10 @@ public:
 private:
     std::string m_filename;  ///< Stash the filename
     ShaderGroupRef m_group;
+    std::shared_ptr<pvt::CachedGroup> m_cached;  ///< Shared group & levels
     std::vector<ustring> m_outputs;
     bool m_mip;
+    bool m_preshade;
     int m_subimage, m_miplevel;
     ImageSpec m_topspec;  // spec of highest-res MIPmap
 
@@ -95,10 +115,17 @@ private:
     void init()
     {
         m_group.reset();
+        m_cached.reset();
+        m_outputs.clear();
         m_mip      = false;
+        m_preshade = true;
         m_subimage = -1;
         m_miplevel = -1;
     }
+
+    // Shade the pixels of roi of the current MIP level into data,
+    // contiguous float pixels.
+    bool shade(ROI roi, void* data);
 };
 
 
@@ -181,6 +208,56 @@ public:
     {
         return false;  // FIXME?
     }
+
+#if OSL_USE_BATCHED
+    // Batched execution needs nothing more from us than the scalar
+    // services do: OSL's own defaults for everything.
+    template<int WidthT>
+    class Batched final : public BatchedRendererServices<WidthT> {
+    public:
+        explicit Batched(TextureSystem* texsys)
+            : BatchedRendererServices<WidthT>(texsys)
+        {
+        }
+        bool is_overridden_get_inverse_matrix_WmWxWf() const override
+        {
+            return false;
+        }
+        bool is_overridden_get_matrix_WmWsWf() const override { return false; }
+        bool is_overridden_get_inverse_matrix_WmsWf() const override
+        {
+            return false;
+        }
+        bool is_overridden_get_inverse_matrix_WmWsWf() const override
+        {
+            return false;
+        }
+        bool is_overridden_texture() const override { return false; }
+        bool is_overridden_texture3d() const override { return false; }
+        bool is_overridden_environment() const override { return false; }
+        bool is_overridden_pointcloud_search() const override { return false; }
+        bool is_overridden_pointcloud_get() const override { return false; }
+        bool is_overridden_pointcloud_write() const override { return false; }
+    };
+
+    virtual BatchedRendererServices<16>* batched(WidthOf<16>)
+    {
+        return &m_batched16;
+    }
+    virtual BatchedRendererServices<8>* batched(WidthOf<8>)
+    {
+        return &m_batched8;
+    }
+    virtual BatchedRendererServices<4>* batched(WidthOf<4>)
+    {
+        return &m_batched4;
+    }
+
+private:
+    Batched<16> m_batched16 { texturesys() };
+    Batched<8> m_batched8 { texturesys() };
+    Batched<4> m_batched4 { texturesys() };
+#endif
 };
 
 
@@ -214,10 +291,26 @@ private:
 
 
 
+// A shader group, shared by all the OSLInputs whose URIs ask for the same
+// shader, parameters and outputs, and the MIP levels of it that have been
+// shaded whole, by the resolution and level.
+struct CachedGroup {
+    ShaderGroupRef group;
+    OIIO::mutex levels_mutex;
+    std::map<std::string, std::unique_ptr<ImageBuf>> levels;
+};
+
+
+
 static OIIO::mutex shading_mutex;
 static ShadingSystem* shadingsys       = NULL;
 static OIIO_RendererServices* renderer = NULL;
 static ErrorRecorder errhandler;
+// Guarded by shading_mutex
+static std::unordered_map<std::string, std::shared_ptr<CachedGroup>> group_cache;
+// Levels bigger than this are always shaded a tile at a time, as asked
+// for, rather than kept whole.
+static const imagesize_t max_preshade_pixels = 4096 * 4096;
 
 
 
@@ -461,6 +554,8 @@ OSLInput::open(const std::string& name, ImageSpec& newspec,
             m_outputs.emplace_back(args[i].second);
         } else if (args[i].first == "MIP") {
             m_mip = Strutil::from_string<int>(args[i].second);
+        } else if (args[i].first == "PRESHADE") {
+            m_preshade = Strutil::from_string<int>(args[i].second);
         } else if (args[i].first.size() && args[i].second.size()) {
             parse_param(args[i].first, args[i].second, m_topspec);
         }
@@ -470,6 +565,14 @@ OSLInput::open(const std::string& name, ImageSpec& newspec,
         m_outputs.emplace_back("alpha");
     }
 
+    // Everything but the resolution, tiling, and MIP options decides what
+    // group we'd build, so URIs that agree on the rest can share one.
+    std::string groupkey = shadername;
+    for (const auto& a : args)
+        if (a.first != "RES" && a.first != "TILE" && a.first != "TILES"
+            && a.first != "MIP" && a.first != "PRESHADE")
+            groupkey += Strutil::fmt::format("&{}={}", a.first, a.second);
+
     m_topspec.full_x      = m_topspec.x;
     m_topspec.full_y      = m_topspec.y;
     m_topspec.full_z      = m_topspec.z;
@@ -478,14 +581,29 @@ OSLInput::open(const std::string& name, ImageSpec& newspec,
     m_topspec.full_depth  = m_topspec.depth;
 
     bool ok = true;
-    if (Strutil::ends_with(shadername, ".oslgroup")) {  // Serialized group
-        // No further processing necessary
-        std::string groupspec;
+    std::string groupspec;
+    if (Strutil::ends_with(shadername, ".oslgroup")) {
         if (!OIIO::Filesystem::read_text_file(shadername, groupspec)) {
             // If it didn't name a disk file, assume it's the "inline"
             // serialized group.
             groupspec = groupspec.substr(0, groupspec.size() - 9);
         }
+        // The file's contents, not its name, say what the group is.
+        groupkey += "\n" + groupspec;
+    }
+    {
+        OIIO::lock_guard lock(shading_mutex);
+        auto found = group_cache.find(groupkey);
+        if (found != group_cache.end()) {
+            m_cached = found->second;
+            m_group  = m_cached->group;
+        }
+    }
+
+    if (m_group) {
+        // Already built by an earlier open
+    } else if (Strutil::ends_with(shadername, ".oslgroup")) {  // Serialized group
+        // No further processing necessary
         // std::cout << "Processing group specification:\n---\n"
         //           << groupspec << "\n---\n";
         OIIO::lock_guard lock(shading_mutex);
@@ -493,8 +611,7 @@ OSLInput::open(const std::string& name, ImageSpec& newspec,
         if (!m_group)
             return false;  // Failed
         shadingsys->ShaderGroupEnd();
-    }
-    if (Strutil::ends_with(shadername, ".oso")) {  // Compiled shader
+    } else if (Strutil::ends_with(shadername, ".oso")) {  // Compiled shader
         OIIO::lock_guard lock(shading_mutex);
         shadername.remove_suffix(4);
         m_group = shadingsys->ShaderGroupBegin();
@@ -509,11 +626,8 @@ OSLInput::open(const std::string& name, ImageSpec& newspec,
             ok = false;
         }
         shadingsys->ShaderGroupEnd();
-    }
-
-    if (Strutil::ends_with(shadername, ".osl")) {  // shader source
-    }
-    if (Strutil::ends_with(shadername, ".oslbody")) {  // shader source
+    } else if (Strutil::ends_with(shadername, ".osl")) {  // shader source
+    } else if (Strutil::ends_with(shadername, ".oslbody")) {  // shader source
         OIIO::lock_guard lock(shading_mutex);
         shadername.remove_suffix(8);
         static int exprcount   = 0;
@@ -549,9 +663,21 @@ OSLInput::open(const std::string& name, ImageSpec& newspec,
     if (!ok || m_group.get() == NULL)
         return false;
 
-    shadingsys->attribute(m_group.get(), "renderer_outputs",
-                          TypeDesc(TypeDesc::STRING, m_outputs.size()),
-                          &m_outputs[0]);
+    if (!m_cached) {
+        shadingsys->attribute(m_group.get(), "renderer_outputs",
+                              TypeDesc(TypeDesc::STRING, m_outputs.size()),
+                              &m_outputs[0]);
+        OIIO::lock_guard lock(shading_mutex);
+        // If another thread built the same group meanwhile, use theirs, so
+        // that the MIP levels are shaded once.
+        auto& cached = group_cache[groupkey];
+        if (!cached) {
+            cached.reset(new CachedGroup);
+            cached->group = m_group;
+        }
+        m_cached = cached;
+        m_group  = m_cached->group;
+    }
 
     ok &= seek_subimage(0, 0);
     if (ok)
@@ -601,6 +727,56 @@ OSLInput::seek_subimage(int subimage, int miplevel)
 
 
 
+bool
+OSLInput::shade(ROI roi, void* data)
+{
+    if (!m_preshade || m_spec.image_pixels() > max_preshade_pixels) {
+        // Create an ImageBuf wrapper of the user's data
+        ImageSpec spec = m_spec;  // Make a spec that describes just the roi
+        spec.x         = roi.xbegin;
+        spec.y         = roi.ybegin;
+        spec.z         = roi.zbegin;
+        spec.width     = roi.width();
+        spec.height    = roi.height();
+        spec.depth     = roi.depth();
+        ImageBuf ibwrapper(spec, data);
+
+        // Now run the shader on the ImageBuf pixels, which really point to
+        // the caller's data buffer.
+        return shade_image(*shadingsys, *m_group, NULL, ibwrapper, m_outputs,
+                           ShadePixelCenters, roi, 1);
+    }
+
+    // The first read of any part of a level shades all of it, on as many
+    // threads as shade_image likes (and batched, if the machine can), and
+    // every read of it after that, from this OSLInput or another that
+    // shares the group, is just a copy.  A reader that wants the level
+    // while it's being shaded waits for it rather than shading it again.
+    std::string levelname = Strutil::fmt::format("{}x{}x{}/{}",
+                                                 m_topspec.width,
+                                                 m_topspec.height,
+                                                 m_topspec.depth,
+                                                 m_miplevel);
+    OIIO::lock_guard lock(m_cached->levels_mutex);
+    std::unique_ptr<ImageBuf>& level = m_cached->levels[levelname];
+    if (!level) {
+        ImageSpec spec = m_spec;
+        spec.tile_width = spec.tile_height = spec.tile_depth = 0;
+        std::unique_ptr<ImageBuf> buf(new ImageBuf(spec));
+        if (!shade_image(*shadingsys, *m_group, NULL, *buf, m_outputs,
+                         ShadePixelCenters, buf->roi())) {
+            errorfmt("{}", buf->geterror());
+            return false;
+        }
+        level = std::move(buf);
+    }
+    roi.chbegin = 0;
+    roi.chend   = m_spec.nchannels;
+    return level->get_pixels(roi, TypeDesc::FLOAT, data);
+}
+
+
+
 bool
 OSLInput::read_native_scanlines(int subimage, int miplevel, int ybegin,
                                 int yend, int z, void* data)
@@ -618,20 +794,9 @@ OSLInput::read_native_scanlines(int subimage, int miplevel, int ybegin,
         return false;
     }
 
-    // Create an ImageBuf wrapper of the user's data
-    ImageSpec spec = m_spec;  // Make a spec that describes just this scanline
-    spec.y         = ybegin;
-    spec.z         = z;
-    spec.height    = yend - ybegin;
-    spec.depth     = 1;
-    ImageBuf ibwrapper(spec, data);
-
-    // Now run the shader on the ImageBuf pixels, which really point to
-    // the caller's data buffer.
-    ROI roi(spec.x, spec.x + spec.width, spec.y, spec.y + spec.height, spec.z,
-            spec.z + spec.depth);
-    return shade_image(*shadingsys, *m_group, NULL, ibwrapper, m_outputs,
-                       ShadePixelCenters, roi, 1);
+    return shade(ROI(m_spec.x, m_spec.x + m_spec.width, ybegin, yend, z,
+                     z + 1),
+                 data);
 }
 
 
@@ -662,22 +827,7 @@ OSLInput::read_native_tiles(int subimage, int miplevel, int xbegin, int xend,
         return false;
     }
 
-    // Create an ImageBuf wrapper of the user's data
-    ImageSpec spec = m_spec;  // Make a spec that describes just this scanline
-    spec.x         = xbegin;
-    spec.y         = ybegin;
-    spec.z         = zbegin;
-    spec.width     = xend - xbegin;
-    spec.height    = yend - ybegin;
-    spec.depth     = zend - zbegin;
-    ImageBuf ibwrapper(spec, data);
-
-    // Now run the shader on the ImageBuf pixels, which really point to
-    // the caller's data buffer.
-    ROI roi(spec.x, spec.x + spec.width, spec.y, spec.y + spec.height, spec.z,
-            spec.z + spec.depth);
-    return shade_image(*shadingsys, *m_group, NULL, ibwrapper, m_outputs,
-                       ShadePixelCenters, roi, 1);
+    return shade(ROI(xbegin, xend, ybegin, yend, zbegin, zend), data);
 }
 
 
@@ -3,10 +3,14 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <OpenImageIO/filesystem.h>
@@ -15,6 +19,8 @@
 
 #include <OSL/oslcomp.h>
 #include <OSL/oslexec.h>
+
+#include "shaderbundle.h"
 using namespace OSL;
 
 
@@ -25,25 +31,35 @@ usage()
     std::cout
         << "oslc -- Open Shading Language compiler " OSL_LIBRARY_VERSION_STRING
            "\n" OSL_COPYRIGHT_STRING "\n"
-           "Usage:  oslc [options] file\n"
+           "Usage:  oslc [options] file [file ...]\n"
            "  Options:\n"
            "\t--help         Print this usage message\n"
-           "\t-o filename    Specify output filename\n"
-           "\t-v             Verbose mode\n"
+           "\t-o filename    Specify output filename (one input file only)\n"
+           "\t-j N           Compile the input files on N threads\n"
+           "\t-v             Verbose mode (also times each compile phase)\n"
            "\t-q             Quiet mode\n"
            "\t-Ipath         Add path to the #include search path\n"
            "\t-Dsym[=val]    Define preprocessor symbol\n"
            "\t-Usym          Undefine preprocessor symbol\n"
-           "\t-O0, -O1, -O2  Set optimization level (default=1)\n"
+           "\t-O0, -O1, -O2  Set optimization level (default=1); -O2 also\n"
+           "\t               simplifies the code written to the .oso\n"
            "\t-d             Debug mode\n"
            "\t-E             Only preprocess the input and output to stdout\n"
            "\t-Werror        Treat all warnings as errors\n"
            "\t-embed-source  Embed preprocessed source in the oso file\n"
+           "\t--binary-oso   Write the oso file in the binary form, which\n"
+           "\t               loads faster\n"
+           "\t--bundle filename  Compile the input files into one shader\n"
+           "\t               bundle file instead of separate oso files\n"
            "\t-buffer        (debugging) Force compile from buffer\n"
            "\t-MD, -MMD      Write a depfile containing headers used, to a file\n"
            "\t-M, -MM        Like -MD, but write depfile to stdout\n"
            "\t-MF filename   Specify the name of the depfile to output (for -MD, -MMD)\n"
-           "\t-MT target     Specify a custom dependency target name for -M...\n";
+           "\t-MT target     Specify a custom dependency target name for -M...\n"
+           "\t-MP            Add an empty rule for each header to the depfile\n"
+           "\t--header-cache Preprocess stdosl.h once and reuse it\n"
+           "\t--header-cache-dir dir  Like --header-cache, also keeping it in\n"
+           "\t               dir to reuse across runs\n";
 }
 
 
@@ -83,6 +99,109 @@ public:
 };
 
 static OSLC_ErrorHandler default_oslc_error_handler;
+
+
+
+// Holds on to one file's messages so that, when compiling several files
+// at once, each file's output can be printed together and in the order
+// the files were given, however the threads happened to finish.
+class Deferred_ErrorHandler final : public ErrorHandler {
+public:
+    virtual void operator()(int errcode, const std::string& msg)
+    {
+        m_messages.emplace_back(errcode, msg);
+    }
+    void replay(ErrorHandler& eh) const
+    {
+        for (auto&& m : m_messages)
+            eh(m.first, m.second);
+    }
+
+private:
+    std::vector<std::pair<int, std::string>> m_messages;
+};
+
+
+
+// Compile all the files, up to nthreads at a time, each with its own
+// compiler, and report on them in order. If bundle is not empty, the
+// compiled shaders all go into that one bundle file rather than into
+// their own oso files. Return true if all succeeded.
+static bool
+compile_files(const std::vector<std::string>& shader_paths,
+              std::vector<std::string> args, int nthreads, bool quiet,
+              const std::string& bundle)
+{
+    // All the files can share one preprocessed stdosl.h.
+    if (std::find(args.begin(), args.end(), "--header-cache") == args.end()
+        && std::find(args.begin(), args.end(), "--header-cache-dir")
+               == args.end())
+        args.emplace_back("--header-cache");
+
+    size_t nfiles = shader_paths.size();
+    std::vector<Deferred_ErrorHandler> messages(nfiles);
+    std::vector<std::string> outputs(nfiles);
+    std::vector<std::string> osos(bundle.size() ? nfiles : 0);
+    std::unique_ptr<bool[]> ok(new bool[nfiles]);
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i; (i = next++) < nfiles;) {
+            OSLCompiler compiler(&messages[i]);
+            if (bundle.empty()) {
+                ok[i] = compiler.compile(shader_paths[i], args);
+            } else {
+                std::string source;
+                ok[i] = OIIO::Filesystem::read_text_file(shader_paths[i],
+                                                         source)
+                        && compiler.compile_buffer(source, osos[i], args, "",
+                                                   shader_paths[i]);
+            }
+            outputs[i] = compiler.output_filename();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < std::min(nthreads, int(nfiles)); ++t)
+        threads.emplace_back(worker);
+    worker();
+    for (auto&& t : threads)
+        t.join();
+
+    // Shaders are named in a bundle just as their oso files would be.
+    if (bundle.size()) {
+        for (auto&& output : outputs) {
+            output = OIIO::Filesystem::filename(output);
+            if (OIIO::Strutil::ends_with(output, ".oso"))
+                output.resize(output.size() - 4);
+        }
+    }
+
+    bool all_ok = true;
+    for (size_t i = 0; i < nfiles; ++i) {
+        messages[i].replay(default_oslc_error_handler);
+        if (ok[i]) {
+            if (!quiet)
+                std::cout << "Compiled " << shader_paths[i] << " -> "
+                          << (bundle.size() ? bundle + "(" + outputs[i] + ")"
+                                            : outputs[i])
+                          << "\n";
+        } else {
+            std::cout << "FAILED " << shader_paths[i] << "\n";
+            all_ok = false;
+        }
+    }
+    if (!all_ok || bundle.empty())
+        return all_ok;
+
+    std::vector<std::pair<std::string, std::string>> shaders;
+    for (size_t i = 0; i < nfiles; ++i)
+        shaders.emplace_back(outputs[i], std::move(osos[i]));
+    std::string err;
+    if (!pvt::ShaderBundle::write(bundle, std::move(shaders), err)) {
+        std::cout << "FAILED " << bundle << ": " << err << "\n";
+        return false;
+    }
+    return true;
+}
 }  // anonymous namespace
 
 
@@ -110,7 +229,11 @@ main(int argc, const char* argv[])
     std::vector<std::string> args;
     bool quiet               = false;
     bool compile_from_buffer = false;
-    std::string shader_path;
+    bool has_output_name     = false;
+    bool has_depfile_name    = false;
+    int nthreads             = 1;
+    std::string bundle;
+    std::vector<std::string> shader_paths;
 
     // Parse arguments from command line
     for (int a = 1; a < argc; ++a) {
@@ -120,6 +243,8 @@ main(int argc, const char* argv[])
         } else if (!strcmp(argv[a], "-q") || !strcmp(argv[a], "-v")) {
             args.emplace_back(argv[a]);
             quiet = (strcmp(argv[a], "-q") == 0);
+            if (!quiet)  // -v also reports the time of each compile phase
+                default_oslc_error_handler.verbosity(ErrorHandler::VERBOSE);
         } else if (!strcmp(argv[a], "-E") || !strcmp(argv[a], "-M")
                    || !strcmp(argv[a], "--dependencies")
                    || !strcmp(argv[a], "-MM")
@@ -132,24 +257,41 @@ main(int argc, const char* argv[])
                    || !strcmp(argv[a], "-Werror")
                    || !strcmp(argv[a], "-embed-source")
                    || !strcmp(argv[a], "--embed-source")
+                   || !strcmp(argv[a], "--binary-oso")
                    || !strcmp(argv[a], "-MD")
                    || !strcmp(argv[a], "--write-dependencies")
                    || !strcmp(argv[a], "-MMD")
                    || !strcmp(argv[a], "--write-user-dependencies")
+                   || !strcmp(argv[a], "-MP")
                    || OIIO::Strutil::starts_with(argv[a], "-MF")
                    || OIIO::Strutil::starts_with(argv[a], "-MT")) {
             // Valid command-line argument
             args.emplace_back(argv[a]);
+            if (OIIO::Strutil::starts_with(argv[a], "-MF"))
+                has_depfile_name = true;
             if (a < argc - 1
                 && (!strcmp(argv[a], "-MF") || !strcmp(argv[a], "-MT"))) {
                 ++a;
                 args.emplace_back(argv[a]);
             }
+        } else if (!strcmp(argv[a], "--header-cache")) {
+            args.emplace_back(argv[a]);
+        } else if (!strcmp(argv[a], "--header-cache-dir") && a < argc - 1) {
+            args.emplace_back(argv[a]);
+            ++a;
+            args.emplace_back(argv[a]);
         } else if (!strcmp(argv[a], "-o") && a < argc - 1) {
             // Output filepath
             args.emplace_back(argv[a]);
             ++a;
             args.emplace_back(argv[a]);
+            has_output_name = true;
+        } else if (!strcmp(argv[a], "--bundle") && a < argc - 1) {
+            bundle = argv[++a];
+        } else if (!strcmp(argv[a], "-j") && a < argc - 1) {
+            nthreads = std::max(1, atoi(argv[++a]));
+        } else if (OIIO::Strutil::starts_with(argv[a], "-j")) {
+            nthreads = std::max(1, atoi(argv[a] + 2));
         } else if (argv[a][0] == '-'
                    && (argv[a][1] == 'D' || argv[a][1] == 'U'
                        || argv[a][1] == 'I')) {
@@ -158,16 +300,40 @@ main(int argc, const char* argv[])
             compile_from_buffer = true;
         } else {
             // Shader to compile
-            shader_path = argv[a];
+            shader_paths.emplace_back(argv[a]);
         }
     }
 
-    if (shader_path.empty()) {
+    if (shader_paths.empty()) {
         std::cout << "ERROR: Missing shader path"
                   << "\n\n";
         usage();
         return EXIT_FAILURE;
     }
+    if (bundle.size() && has_output_name) {
+        std::cout << "ERROR: -o and --bundle may not be used together"
+                  << "\n\n";
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (shader_paths.size() > 1 || bundle.size()) {
+        if (bundle.empty() && (has_output_name || compile_from_buffer)) {
+            std::cout << "ERROR: -o and -buffer take only one shader path"
+                      << "\n\n";
+            usage();
+            return EXIT_FAILURE;
+        }
+        if (has_depfile_name && shader_paths.size() > 1) {
+            std::cout << "ERROR: -MF takes only one shader path"
+                      << "\n\n";
+            usage();
+            return EXIT_FAILURE;
+        }
+        return compile_files(shader_paths, args, nthreads, quiet, bundle)
+                   ? EXIT_SUCCESS
+                   : EXIT_FAILURE;
+    }
+    const std::string& shader_path(shader_paths[0]);
 
     OSLCompiler compiler(&default_oslc_error_handler);
     bool ok = true;
@@ -24,9 +24,12 @@ SPDX-License-Identifier: BSD-3-Clause
 ///
 /// ~~~~
 /// <script type="preformatted">
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include <OpenImageIO/argparse.h>
 #include <OpenImageIO/filesystem.h>
@@ -43,6 +46,10 @@ static bool verbose  = false;
 static bool help     = false;
 static bool runstats = false;
 static std::string oneparam;
+static std::vector<std::string> shaderfiles;
+static std::vector<std::string> scandirs;
+static int nthreads  = 0;
+static bool jsonout  = false;
 
 
 
@@ -141,21 +148,13 @@ print_metadata(const OSLQuery::Parameter& m)
 
 
 static void
-oslinfo(const std::string& name)
+oslinfo(const std::string& name, OSLQuery& g)
 {
-    OIIO::Timer t(runstats ? OIIO::Timer::StartNow : OIIO::Timer::DontStartNow);
-    OSLQuery g;
-    g.open(name, searchpath);
     std::string e = g.geterror();
     if (!e.empty()) {
         std::cout << "ERROR opening shader \"" << name << "\" (" << e << ")\n";
         return;
     }
-    if (runstats) {
-        // display timings in an easy to sort form
-        std::cout << t.stop() << " sec for " << name << "\n";
-        return;  // don't show anything else, we are just benchmarking
-    }
 
     if (oneparam.empty()) {
         std::cout << g.shadertype() << " \"" << g.shadername() << "\"\n";
@@ -219,12 +218,148 @@ oslinfo(const std::string& name)
 
 
 
+// Return s as a quoted JSON string.
+static std::string
+json_string(string_view s)
+{
+    std::string r = "\"";
+    for (char c : s) {
+        switch (c) {
+        case '"': r += "\\\""; break;
+        case '\\': r += "\\\\"; break;
+        case '\n': r += "\\n"; break;
+        case '\t': r += "\\t"; break;
+        case '\r': r += "\\r"; break;
+        default:
+            if ((unsigned char)c < 0x20)
+                r += OIIO::Strutil::sprintf("\\u%04x", int(c));
+            else
+                r += c;
+        }
+    }
+    return r + "\"";
+}
+
+
+
+// Return the int, float, or string values of a parameter or metadata item
+// as a JSON array.  Infinities and NaNs, which JSON can't express, become
+// null.
+static std::string
+json_values(const OSLQuery::Parameter& p)
+{
+    std::vector<std::string> vals;
+    for (int i : p.idefault)
+        vals.push_back(OIIO::Strutil::fmt::format("{}", i));
+    for (float f : p.fdefault)
+        vals.push_back(std::isfinite(f) ? OIIO::Strutil::fmt::format("{}", f)
+                                        : std::string("null"));
+    for (ustring s : p.sdefault)
+        vals.push_back(json_string(s));
+    return "[" + OIIO::Strutil::join(vals, ", ") + "]";
+}
+
+
+
+static std::string
+json_metadata(const std::vector<OSLQuery::Parameter>& metadata,
+              const char* indent)
+{
+    std::vector<std::string> items;
+    for (auto&& m : metadata)
+        items.push_back(OIIO::Strutil::fmt::format(
+            "{}  {{ \"name\": {}, \"type\": {}, \"value\": {} }}", indent,
+            json_string(m.name), json_string(m.type.c_str()),
+            json_values(m)));
+    if (items.empty())
+        return "[]";
+    return "[\n" + OIIO::Strutil::join(items, ",\n") + "\n" + indent + "]";
+}
+
+
+
+// Print one shader's entry of the combined JSON document.
+static void
+oslinfo_json(const std::string& name, OSLQuery& g, bool last)
+{
+    std::cout << "    {\n      \"file\": " << json_string(name);
+    std::string e = g.geterror();
+    if (!e.empty()) {
+        std::cout << ",\n      \"error\": " << json_string(e) << "\n    }"
+                  << (last ? "\n" : ",\n");
+        return;
+    }
+    std::cout << ",\n      \"shadertype\": " << json_string(g.shadertype())
+              << ",\n      \"shadername\": " << json_string(g.shadername())
+              << ",\n      \"metadata\": "
+              << json_metadata(g.metadata(), "      ")
+              << ",\n      \"parameters\": [";
+    bool first = true;
+    for (auto&& p : g.parameters()) {
+        if (oneparam.size() && oneparam != p.name)
+            continue;
+        std::cout << (first ? "\n" : ",\n") << "        {\n"
+                  << "          \"name\": " << json_string(p.name) << ",\n"
+                  << "          \"type\": " << json_string(p.type.c_str())
+                  << ",\n"
+                  << "          \"isoutput\": "
+                  << (p.isoutput ? "true" : "false") << ",\n"
+                  << "          \"isclosure\": "
+                  << (p.isclosure ? "true" : "false") << ",\n";
+        if (p.isstruct) {
+            std::vector<std::string> fields;
+            for (ustring f : p.fields)
+                fields.push_back(json_string(f));
+            std::cout << "          \"structname\": "
+                      << json_string(p.structname) << ",\n"
+                      << "          \"fields\": ["
+                      << OIIO::Strutil::join(fields, ", ") << "],\n";
+        }
+        if (p.spacename.size()) {
+            std::vector<std::string> spaces;
+            for (ustring sp : p.spacename)
+                spaces.push_back(json_string(sp));
+            std::cout << "          \"spacename\": ["
+                      << OIIO::Strutil::join(spaces, ", ") << "],\n";
+        }
+        std::cout << "          \"default\": "
+                  << (p.validdefault && !p.isstruct ? json_values(p) : "null")
+                  << ",\n"
+                  << "          \"metadata\": "
+                  << json_metadata(p.metadata, "          ") << "\n"
+                  << "        }";
+        first = false;
+    }
+    std::cout << (first ? "]" : "\n      ]") << "\n    }"
+              << (last ? "\n" : ",\n");
+}
+
+
+
+// Add all the .oso files below dir to shaderfiles, in sorted order so that
+// the output doesn't depend on the order the filesystem lists them in.
+static void
+scan_directory(const std::string& dir)
+{
+    std::vector<std::string> entries;
+    if (!OIIO::Filesystem::get_directory_entries(dir, entries, true)) {
+        std::cerr << "oslinfo: could not read directory \"" << dir << "\"\n";
+        return;
+    }
+    std::sort(entries.begin(), entries.end());
+    for (auto&& f : entries)
+        if (OIIO::Filesystem::extension(f) == ".oso"
+            && OIIO::Filesystem::is_regular(f))
+            shaderfiles.push_back(f);
+}
+
+
+
 static int
 input_file(int argc, const char* argv[])
 {
-    for (int i = 0; i < argc; i++) {
-        oslinfo(argv[i]);
-    }
+    for (int i = 0; i < argc; i++)
+        shaderfiles.emplace_back(argv[i]);
     return 0;
 }
 
@@ -249,18 +384,58 @@ main(int argc, char* argv[])
     ap.options(
         "oslinfo -- list parameters of a compiled OSL shader\n" OSL_INTRO_STRING
         "\n"
-        "Usage:  oslinfo [options] file0 [file1 ...]\n",
+        "Usage:  oslinfo [options] file0 [file1 ...]\n"
+        "        oslinfo [options] -r dir [--json]\n",
         "%*", input_file, "", "-h", &help, "Print help message", "--help",
         &help, "", "-v", &verbose, "Verbose", "--runstats", &runstats,
         "Benchmark shader loading time for queries", "-p %s", &searchpath,
         "Set searchpath for shaders", "--param %s", &oneparam,
-        "Output information in just this parameter", NULL);
+        "Output information in just this parameter", "-r %L", &scandirs,
+        "Query all the .oso files in this directory and below", "-j %d",
+        &nthreads, "Number of threads to read shaders with (default: all)",
+        "--json", &jsonout,
+        "Output one JSON document describing all the shaders", NULL);
 
     if (ap.parse(argc, (const char**)argv) < 0) {
         std::cerr << ap.geterror() << std::endl;
         ap.usage();
+        return EXIT_SUCCESS;
     } else if (help || argc <= 1) {
         ap.usage();
+        return EXIT_SUCCESS;
+    }
+
+    for (auto&& dir : scandirs)
+        scan_directory(dir);
+
+    if (runstats) {
+        // Read the shaders one at a time so each can be timed alone, and
+        // display timings in an easy to sort form.
+        for (auto&& name : shaderfiles) {
+            OIIO::Timer t;
+            OSLQuery g;
+            g.open(name, searchpath);
+            std::string e = g.geterror();
+            if (!e.empty())
+                std::cout << "ERROR opening shader \"" << name << "\" (" << e
+                          << ")\n";
+            else
+                std::cout << t.stop() << " sec for " << name << "\n";
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // Read all the shaders in parallel, then print them in order.
+    std::vector<OSLQuery> queries = OSLQuery::open_many(shaderfiles,
+                                                        searchpath, nthreads);
+    if (jsonout) {
+        std::cout << "{\n  \"shaders\": [" << (queries.empty() ? "" : "\n");
+        for (size_t i = 0; i < queries.size(); ++i)
+            oslinfo_json(shaderfiles[i], queries[i], i + 1 == queries.size());
+        std::cout << (queries.empty() ? "" : "  ") << "]\n}\n";
+    } else {
+        for (size_t i = 0; i < queries.size(); ++i)
+            oslinfo(shaderfiles[i], queries[i]);
     }
     return EXIT_SUCCESS;
 }
@@ -381,6 +381,23 @@ Magnifier::mouseMoveEvent(QMouseEvent* event)
 //
 //
 
+class MyOSLCErrorHandler final : public OIIO::ErrorHandler {
+public:
+    MyOSLCErrorHandler(OSLToyMainWindow* osltoy) : osltoy(osltoy) {}
+    virtual void operator()(int /*errcode*/, const std::string& msg)
+    {
+        errors.emplace_back(msg);
+    }
+    void clear() { errors.clear(); }
+
+    std::vector<std::string> errors;
+
+private:
+    OSLToyMainWindow* osltoy;
+};
+
+
+
 OSLToyMainWindow::OSLToyMainWindow(OSLToyRenderer* rend, int xr, int yr)
     : QMainWindow(nullptr), xres(xr), yres(yr), m_renderer(rend)
 {
@@ -745,14 +762,42 @@ OSLToyMainWindow::action_save()
 
 
 
+struct OSLToyMainWindow::GroupBuild {
+    struct Source {
+        int tab;
+        std::string briefname;
+        std::string source;
+    };
+    int generation = 0;
+    bool compile   = false;  ///< Compile the sources, not just build
+    std::vector<Source> sources;
+    std::string groupname, groupspec, firstshadername;
+    OIIO::ParamValueList instvalues;
+    std::unordered_map<std::string, bool> diddlers;
+
+    // Results
+    bool ok        = true;
+    int failed_tab = -1;
+    std::vector<std::pair<int, std::string>> messages;  ///< Tab, errors
+    ShaderGroupRef group;
+};
+
+
+
 // Separate thread pool just for the async render kickoff triggers, but use
 // the default pool for the workers.
 static OIIO::thread_pool trigger_pool;
 
+// And one thread for compiling and JITing, so that builds are done in the
+// order they were asked for.
+static OIIO::thread_pool compile_pool(1);
+
 
 void
 OSLToyMainWindow::timed_rerender_trigger(void)
 {
+    if (m_shaders_recompiled)
+        finish_group_build();
     if (paused)
         return;
     float now = timer();
@@ -778,16 +823,32 @@ void
 OSLToyMainWindow::osl_do_rerender(float /*frametime*/)
 {
     using namespace OIIO;
-    m_rerender_needed = 0;
+    bool edited = m_rerender_needed.exchange(0);
 
     if (renderer()->shadergroup()) {
         float start = timer();
         renderer()->set_time(start);
-        renderer()->render_image();
+        // After an edit to a shader that is slow to render, show the new
+        // look at once, coarse, and then refine it, rather than nothing
+        // until the whole frame is done.  Animation frames and fast
+        // shaders go straight to the full image.
+        int step = (edited && last_full_render_time > 0.1f) ? 8 : 1;
+        for (;; step /= 2) {
+            float passstart = timer();
+            renderer()->render_image(step);
+            renderView->update(renderer()->framebuffer());
+            if (step == 1) {
+                last_full_render_time = timer() - passstart;
+                break;
+            }
+            if (m_rerender_needed) {
+                // Edited again meanwhile: start over from coarse.
+                m_working = 0;
+                return;
+            }
+        }
         OIIO_UNUSED_OK float rendertime = timer() - start;
 
-        renderView->update(renderer()->framebuffer());
-
         float now = timer();
         // std::cout <<"render only " << (1.0f/rendertime) << "  with coco " << 1.0f/(now-start)
         //     << "   from last frame " << 1.0f / (now - last_finished_frametime) << "\n";
@@ -807,23 +868,6 @@ OSLToyMainWindow::osl_do_rerender(float /*frametime*/)
 
 
 
-class MyOSLCErrorHandler final : public OIIO::ErrorHandler {
-public:
-    MyOSLCErrorHandler(OSLToyMainWindow* osltoy) : osltoy(osltoy) {}
-    virtual void operator()(int /*errcode*/, const std::string& msg)
-    {
-        errors.emplace_back(msg);
-    }
-    void clear() { errors.clear(); }
-
-    std::vector<std::string> errors;
-
-private:
-    OSLToyMainWindow* osltoy;
-};
-
-
-
 void
 OSLToyMainWindow::recompile_shaders()
 {
@@ -831,8 +875,7 @@ OSLToyMainWindow::recompile_shaders()
     m_firstshadername.clear();
     m_groupname.clear();
 
-    QtUtils::clear_layout(paramLayout);
-    bool ok = true;
+    auto build = std::make_shared<GroupBuild>();
     for (int tab = 0; tab < ntabs(); ++tab) {
         auto editor            = editors[tab];
         std::string briefname  = editor->brief_filename();
@@ -847,26 +890,7 @@ OSLToyMainWindow::recompile_shaders()
             // This is the group!
         } else if (OIIO::Strutil::ends_with(briefname, ".osl")) {
             // This is a shader
-            MyOSLCErrorHandler errhandler(this);
-            OSLCompiler oslcomp(&errhandler);
-            std::string osooutput;
-            std::vector<std::string> options;
-            ok = oslcomp.compile_buffer(source, osooutput, options, "",
-                                        briefname);
-            set_error_message(tab,
-                              OIIO::Strutil::join(errhandler.errors, "\n"));
-            if (ok) {
-                // std::cout << osooutput << "\n";
-                ok = shadingsys()->LoadMemoryCompiledShader(briefname,
-                                                            osooutput);
-                if (!ok) {
-                    // FIXME -- handle .oso error. What can happen?
-                }
-            } else {
-                // Force tab display to the error
-                textTabs->setCurrentIndex(tab);
-                break;
-            }
+            build->sources.push_back({ tab, briefname, source });
             if (m_firstshadername.empty())
                 m_firstshadername = shadername;
 
@@ -874,16 +898,8 @@ OSLToyMainWindow::recompile_shaders()
             break;
         }
     }
-
-    if (ok) {
-        // If everything went ok so far, make a shader group
-        build_shader_group();
-        inventory_params();
-        rebuild_param_area();
-        if (paused && fps == 0 /* never started */)
-            toggle_pause();
-        rerender_needed();
-    }
+    m_pending_compile = build;
+    start_group_build(true);
 }
 
 
@@ -923,21 +939,140 @@ OSLToyMainWindow::restart_time()
 void
 OSLToyMainWindow::build_shader_group()
 {
-    // std::cout << "Rebuilding group\n";
+    start_group_build(false);
+}
+
+
+
+void
+OSLToyMainWindow::start_group_build(bool compile)
+{
+    // Everything the build needs from the GUI is copied now; the build
+    // supersedes any still waiting, so if a recompile hasn't finished,
+    // this one must do it too.
+    auto build = std::make_shared<GroupBuild>();
+    if (m_pending_compile) {
+        build->compile = true;
+        build->sources = m_pending_compile->sources;
+    }
+    build->groupname       = m_groupname;
+    build->groupspec       = m_groupspec;
+    build->firstshadername = m_firstshadername;
+    build->instvalues      = m_shaderparam_instvalues;
+    build->diddlers        = m_diddlers;
+    build->generation      = ++m_build_generation;
+    ++m_building;
+    compile_pool.push([=](int) { this->do_group_build(build); });
+}
+
+
+
+void
+OSLToyMainWindow::do_group_build(std::shared_ptr<GroupBuild> build)
+{
+    // Don't bother with a build that a later one has superseded.
+    if (build->generation != m_build_generation) {
+        --m_building;
+        return;
+    }
+
     ShadingSystem* ss = renderer()->shadingsys();
-    ShaderGroupRef group;
-    if (m_groupspec.size()) {
-        group = ss->ShaderGroupBegin(m_groupname, "surface", m_groupspec);
-        ss->ShaderGroupEnd();
-    } else if (m_firstshadername.size()) {
-        group = ss->ShaderGroupBegin();
-        for (auto&& instparam : m_shaderparam_instvalues) {
-            ss->Parameter(instparam.name(), instparam.type(), instparam.data(),
-                          !m_diddlers[instparam.name().string()]);
+    if (build->compile) {
+        for (auto&& src : build->sources) {
+            // Keep one compiler for the session, so that stdosl.h is
+            // only preprocessed once rather than on every edit.
+            if (!m_oslcompiler) {
+                m_oslc_errhandler.reset(new MyOSLCErrorHandler(this));
+                m_oslcompiler.reset(new OSLCompiler(m_oslc_errhandler.get()));
+            }
+            m_oslc_errhandler->clear();
+            std::string osooutput;
+            std::vector<std::string> options;
+            build->ok = m_oslcompiler->compile_buffer(src.source, osooutput,
+                                                      options, "",
+                                                      src.briefname);
+            build->messages.emplace_back(
+                src.tab, OIIO::Strutil::join(m_oslc_errhandler->errors, "\n"));
+            if (build->ok) {
+                // std::cout << osooutput << "\n";
+                build->ok = ss->LoadMemoryCompiledShader(src.briefname,
+                                                         osooutput);
+                if (!build->ok) {
+                    // FIXME -- handle .oso error. What can happen?
+                }
+            } else {
+                // Force tab display to the error
+                build->failed_tab = src.tab;
+                break;
+            }
+        }
+    }
+
+    if (build->ok) {
+        // std::cout << "Rebuilding group\n";
+        ShaderGroupRef group;
+        if (build->groupspec.size()) {
+            group = ss->ShaderGroupBegin(build->groupname, "surface",
+                                         build->groupspec);
+            ss->ShaderGroupEnd();
+        } else if (build->firstshadername.size()) {
+            group = ss->ShaderGroupBegin();
+            for (auto&& instparam : build->instvalues) {
+                ss->Parameter(instparam.name(), instparam.type(),
+                              instparam.data(),
+                              !build->diddlers[instparam.name().string()]);
+            }
+            ss->Shader("surface", build->firstshadername, "layer1");
+            ss->ShaderGroupEnd();
+        }
+        // Optimize and JIT it here, too, rather than in the first frame
+        // rendered with it.
+        if (group) {
+            PerThreadInfo* thread_info = ss->create_thread_info();
+            ShadingContext* ctx        = ss->get_context(thread_info);
+            ss->optimize_group(group.get(), ctx);
+            ss->release_context(ctx);
+            ss->destroy_thread_info(thread_info);
         }
-        ss->Shader("surface", m_firstshadername, "layer1");
-        ss->ShaderGroupEnd();
+        build->group = group;
+    }
+
+    {
+        OIIO::spin_lock lock(m_job_mutex);
+        m_finished_build     = build;
+        m_shaders_recompiled = 1;
+    }
+    --m_building;
+}
+
+
+
+void
+OSLToyMainWindow::finish_group_build()
+{
+    std::shared_ptr<GroupBuild> build;
+    {
+        OIIO::spin_lock lock(m_job_mutex);
+        build.swap(m_finished_build);
+        m_shaders_recompiled = 0;
+    }
+    // A build superseded while it ran will be followed by the later one.
+    if (!build || build->generation != m_build_generation)
+        return;
+    if (build->compile)
+        m_pending_compile.reset();
+
+    for (auto&& msg : build->messages)
+        set_error_message(msg.first, msg.second);
+    if (!build->ok) {
+        // Keep rendering the group we had.
+        if (build->failed_tab >= 0)
+            textTabs->setCurrentIndex(build->failed_tab);
+        return;
     }
+
+    ShadingSystem* ss    = renderer()->shadingsys();
+    ShaderGroupRef group = build->group;
     renderer()->set_shadergroup(group);
 
     m_shader_uses_time            = false;
@@ -950,6 +1085,23 @@ OSLToyMainWindow::build_shader_group()
         if (globals_needed[i] == "time")
             m_shader_uses_time = true;
 
+    if (build->compile) {
+        QtUtils::clear_layout(paramLayout);
+        inventory_params();
+        rebuild_param_area();
+        if (paused && fps == 0 /* never started */)
+            toggle_pause();
+    } else {
+        // Catch up with the parameters adjusted while it was being built.
+        for (auto&& p : m_shaderparams) {
+            if (!m_diddlers[p->name.string()])
+                continue;
+            auto val = m_shaderparam_instvalues.find(p->name);
+            if (val != m_shaderparam_instvalues.end())
+                ss->ReParameter(*group, p->layername, p->name, p->type,
+                                val->data());
+        }
+    }
     rerender_needed();
 }
 
@@ -989,6 +1141,7 @@ OSLToyMainWindow::make_param_adjustment_row(ParamRec* param,
     auto diddleCheckbox = new QCheckBox("  ");
     if (m_diddlers[param->name.string()])
         diddleCheckbox->setCheckState(Qt::Checked);
+    param->diddlebox = diddleCheckbox;
     connect(diddleCheckbox, &QCheckBox::stateChanged, this,
             [=](int state) { set_param_diddle(param, state); });
     layout->addWidget(diddleCheckbox, row, 0);
@@ -1162,6 +1315,12 @@ OSLToyMainWindow::set_param_instance_value(ParamRec* param)
                                       param->layername, param->name,
                                       param->type, val->data());
         rerender_needed();
+    } else if (param->diddlebox) {
+        // A parameter being adjusted is one likely to be adjusted again,
+        // so rebuild the group once with it left unlocked (checking the
+        // box does that), and from then on just ReParameter it.
+        reinterpret_cast<QCheckBox*>(param->diddlebox)
+            ->setCheckState(Qt::Checked);
     } else {
         build_shader_group();
     }
@@ -1222,9 +1381,9 @@ OSLToyMainWindow::finish_and_close()
     // wait for any shading jobs to finish
     for (; true; OIIO::Sysutil::usleep(10000)) {
         OIIO::spin_lock lock(m_job_mutex);
-        if (m_working) {
-            // If shading is still happening, release the lock and sleep
-            // for 1/100 s.
+        if (m_working || m_building) {
+            // If shading or compiling is still happening, release the
+            // lock and sleep for 1/100 s.
             continue;
         }
         close();  // wrap it up for real
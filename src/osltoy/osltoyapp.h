@@ -5,6 +5,7 @@
 #pragma once
 
 #include <atomic>
+#include <memory>
 #include <unordered_map>
 
 #include <OpenImageIO/imagebuf.h>
@@ -35,7 +36,9 @@ OSL_NAMESPACE_ENTER
 
 class ShadingSystem;
 class RendererServices;
+class OSLCompiler;
 class OSLToyRenderer;
+class MyOSLCErrorHandler;
 
 
 
@@ -44,12 +47,19 @@ public:
     using Parameter = OSLQuery::Parameter;
     // Inherits everything from OSLQuery::Parameter, and...
     std::vector<QWidget*> widgets;
+    QWidget* diddlebox = nullptr;
     ustring layername;
 
     ParamRec() {}
     ParamRec(const Parameter& p) : Parameter(p) {}
-    ParamRec(const ParamRec& p) : Parameter(p), widgets(p.widgets) {}
-    ParamRec(ParamRec&& p) : Parameter(p), widgets(p.widgets) {}
+    ParamRec(const ParamRec& p)
+        : Parameter(p), widgets(p.widgets), diddlebox(p.diddlebox)
+    {
+    }
+    ParamRec(ParamRec&& p)
+        : Parameter(p), widgets(p.widgets), diddlebox(p.diddlebox)
+    {
+    }
 };
 
 class OSLToyRenderView;
@@ -172,6 +182,17 @@ private:
 
     void osl_do_rerender(float frametime);
 
+    // Compiling the shaders (if compile is true) and building and JITing
+    // the group happen on a thread of their own, so that the GUI doesn't
+    // stall on a heavy shader, and the group already rendering stays in
+    // use until the new one is ready.  start_group_build() asks for it,
+    // do_group_build() does it on the compile thread, and
+    // finish_group_build() installs the result, back on the GUI thread.
+    struct GroupBuild;
+    void start_group_build(bool compile);
+    void do_group_build(std::shared_ptr<GroupBuild> build);
+    void finish_group_build();
+
     // Clear the param area. After this call, add things to paramLayout.
     // When you are done, call: paramScroll->setWidget (paramWidget)
     void clear_param_area();
@@ -184,6 +205,8 @@ private:
     OIIO::ImageBuf& framebuffer();
 
     std::unique_ptr<OSLToyRenderer> m_renderer;
+    std::unique_ptr<MyOSLCErrorHandler> m_oslc_errhandler;
+    std::unique_ptr<OSLCompiler> m_oslcompiler;
 
     std::vector<std::shared_ptr<ParamRec>> m_shaderparams;
     OIIO::ParamValueList m_shaderparam_instvalues;
@@ -192,6 +215,10 @@ private:
     std::string m_firstshadername;
     std::string m_groupname;
     bool m_shader_uses_time = false;
+    // The last recompile asked for, until it has finished, so that a group
+    // rebuild asked for meanwhile (which supersedes it) compiles too.
+    // GUI thread only.
+    std::shared_ptr<GroupBuild> m_pending_compile;
 
     // Access control mutex for handing things off between the GUI thread
     // and the shading thread.
@@ -200,6 +227,9 @@ private:
     std::atomic<int> m_working { 0 };
     std::atomic<int> m_shaders_recompiled { 0 };
     std::atomic<int> m_rerender_needed { 0 };
+    std::atomic<int> m_building { 0 };       // group builds not yet done
+    std::atomic<int> m_build_generation { 0 };  // the latest build asked for
+    std::shared_ptr<GroupBuild> m_finished_build;
     //vvv--- access by the GUI thread only if m_working == 0, and by the
     //       shading thread only if m_working == 1.
     OIIO::Timer timer { false /*don't start*/ };
@@ -207,6 +237,7 @@ private:
     float last_frame_update_time  = -1;
     float last_fps_update_time    = -1;
     float last_finished_frametime = 0;
+    float last_full_render_time   = 0;
     bool paused                   = true;
 };
 
@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 
 #include <OpenImageIO/imagebuf.h>
 #include <OpenImageIO/imagebufalgo.h>
@@ -106,7 +107,7 @@ OSLToyRenderer::OSLToyRenderer()
 
 
 void
-OSLToyRenderer::render_image()
+OSLToyRenderer::render_image(int step)
 {
     if (!m_framebuffer.initialized())
         m_framebuffer.reset(
@@ -118,8 +119,29 @@ OSLToyRenderer::render_image()
     popt.minitems  = 4096;
     popt.splitdir  = OIIO::Split_Tile;
     popt.recursive = true;
-    shade_image(*shadingsys(), *shadergroup(), &m_shaderglobals_template,
-                m_framebuffer, outputs, ShadePixelCenters, OIIO::ROI(), popt);
+    ShaderGroupRef group = shadergroup();  // the same one for the whole pass
+    if (!group)
+        return;
+    if (step <= 1) {
+        shade_image(*shadingsys(), *group, &m_shaderglobals_template,
+                    m_framebuffer, outputs, ShadePixelCenters, OIIO::ROI(),
+                    popt);
+    } else {
+        // Shade an image step times smaller (whose pixels land on the
+        // centers of the blocks, with derivatives to match), and blow it
+        // up into the framebuffer.
+        int xres = std::max(1, (m_xres + step - 1) / step);
+        int yres = std::max(1, (m_yres + step - 1) / step);
+        OIIO::ImageBuf coarse(OIIO::ImageSpec(xres, yres, 3, TypeDesc::FLOAT));
+        ShaderGlobals sg = m_shaderglobals_template;
+        sg.dudx          = 1.0f / xres;
+        sg.dvdy          = 1.0f / yres;
+        sg.dPdu          = Vec3(xres, 0.0f, 0.0f);
+        sg.dPdv          = Vec3(0.0f, yres, 0.0f);
+        shade_image(*shadingsys(), *group, &sg, coarse, outputs,
+                    ShadePixelCenters, OIIO::ROI(), popt);
+        OIIO::ImageBufAlgo::resample(m_framebuffer, coarse, false);
+    }
     //    std::cout << timer() << "\n";
 }
 
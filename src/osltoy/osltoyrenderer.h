@@ -62,7 +62,10 @@ public:
 
     OIIO::ImageBuf& framebuffer() { return m_framebuffer; }
 
-    void render_image();
+    // Shade the framebuffer.  With step > 1, shade only one point for
+    // each step x step block of pixels and fill the block with it, for a
+    // quick preview.
+    void render_image(int step = 1);
 
     // vvv Methods necessary to be a RendererServices
     virtual int supports(string_view feature) const;
@@ -6,7 +6,9 @@
 
 #include <OSL/dual_vec.h>
 #include <OSL/oslconfig.h>
+#include <OpenImageIO/parallel.h>
 #include <algorithm> // upper_bound
+#include <vector>
 
 OSL_NAMESPACE_ENTER
 
@@ -18,8 +20,12 @@ struct Background {
         delete [] cols;
     }
 
-    template <typename F, typename T>
-    void prepare(int resolution, F cb, T* data) {
+    // Shade the map with cb(dirs, values, n), which is given the n
+    // directions of one row of the map to fill in the values of.  The rows
+    // are shaded in parallel, so cb may be called from several threads at
+    // once.
+    template <typename F>
+    void prepare(int resolution, F cb) {
         res = resolution;
         if (res < 32) res = 32; // validate
         invres = 1.0f / res;
@@ -27,30 +33,39 @@ struct Background {
         values = new Vec3[res * res];
         rows   = new float[res];
         cols   = new float[res * res];
-        for (int y = 0, i = 0; y < res; y++) {
-            for (int x = 0; x < res; x++, i++) {
-                values[i] = cb(map(x + 0.5f, y + 0.5f), data);
-                cols[i] = std::max(std::max(values[i].x, values[i].y), values[i].z) + ((x > 0) ? cols[i - 1] : 0.0f);
-            }
-            rows[y] = cols[i - 1] + ((y > 0) ? rows[y - 1] : 0.0f);
+        // shade each row and build the cdf of picking a column in it
+        OIIO::parallel_for(0, res, [&](int64_t y) {
+            std::vector<Dual2<Vec3>> dirs(res);
+            for (int x = 0; x < res; x++)
+                dirs[x] = map(x + 0.5f, y + 0.5f);
+            Vec3* row_values = values + y * res;
+            float* row_cols = cols + y * res;
+            cb(dirs.data(), row_values, res);
+            for (int x = 0; x < res; x++)
+                row_cols[x] = std::max(std::max(row_values[x].x, row_values[x].y), row_values[x].z) + ((x > 0) ? row_cols[x - 1] : 0.0f);
+            // the row's total, before the pdf is normalized below
+            rows[y] = row_cols[res - 1];
             // normalize the pdf for this scanline (if it was non-zero)
-            if (cols[i - 1] > 0)
+            if (row_cols[res - 1] > 0)
                 for (int x = 0; x < res; x++)
-                    cols[i - res + x] /= cols[i - 1];
-        }
+                    row_cols[x] /= rows[y];
+        });
+        // the cdf across all scanlines
+        for (int y = 1; y < res; y++)
+            rows[y] += rows[y - 1];
         // normalize the pdf across all scanlines
         for (int y = 0; y < res; y++)
             rows[y] /= rows[res - 1];
 
         // both eval and sample below return a "weight" that is
         // value[i] / row*col_pdf, so might as well bake it into the table
-        for (int y = 0, i = 0; y < res; y++) {
+        OIIO::parallel_for(0, res, [&](int64_t y) {
             float row_pdf = rows[y] - (y > 0 ? rows[y - 1] : 0.0f);
-            for (int x = 0; x < res; x++, i++) {
+            for (int x = 0, i = int(y) * res; x < res; x++, i++) {
                 float col_pdf = cols[i] - (x > 0 ? cols[i - 1] : 0.0f);
                 values[i] /= row_pdf * col_pdf * invjacobian;
             }
-        }
+        });
 #if 0  // DEBUG: visualize importance table
         using namespace OIIO;
         ImageOutput* out = ImageOutput::create("bg.exr");
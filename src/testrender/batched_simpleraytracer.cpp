@@ -0,0 +1,269 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <OSL/oslconfig.h>
+
+#if OSL_USE_BATCHED
+
+#include <cstring>
+#include <vector>
+
+#include "batched_simpleraytracer.h"
+#include "simpleraytracer.h"
+
+using namespace OSL;
+
+OSL_NAMESPACE_ENTER
+
+
+namespace {  // anonymous
+
+// The scalar ShaderGlobals a lane was set up from.  A null bsg (the
+// shading system folding a uniform attribute at optimize time) gets a
+// blank one, like the scalar renderer would see before any shading.
+template<int WidthT>
+ShaderGlobals*
+lane_globals(BatchedShaderGlobals<WidthT>* bsg, int lane, ShaderGlobals& blank)
+{
+    if (!bsg || !bsg->uniform.renderstate) {
+        memset((char*)&blank, 0, sizeof(ShaderGlobals));
+        return &blank;
+    }
+    return ((BatchedRenderState*)bsg->uniform.renderstate)->sg[lane];
+}
+
+// Copy the value (and the derivatives, if val has them) that a scalar
+// query wrote to 'src' into one lane of val.  Wide data is laid out as a
+// Block of WidthT for each component, with the x and y derivatives'
+// components following the value's.
+template<typename DataT, int WidthT>
+void
+assign_lane(const MaskedData<WidthT>& val, int lane, const void* src)
+{
+    int ncomps = int(val.type().numelements()) * val.type().aggregate;
+    if (val.has_derivs())
+        ncomps *= 3;
+    DataT* dst = (DataT*)val.ptr();
+    for (int c = 0; c < ncomps; ++c)
+        dst[c * WidthT + lane] = ((const DataT*)src)[c];
+}
+
+template<int WidthT>
+void
+assign_lane(const MaskedData<WidthT>& val, int lane, const void* src)
+{
+    if (val.type().basetype == TypeDesc::STRING)
+        assign_lane<ustring>(val, lane, src);
+    else
+        assign_lane<int>(val, lane, src);
+}
+
+}  // namespace
+
+
+
+template<int WidthT>
+BatchedSimpleRaytracer<WidthT>::BatchedSimpleRaytracer(SimpleRaytracer& sr)
+    : BatchedRendererServices<WidthT>(sr.texturesys()), m_sr(sr)
+{
+}
+
+template<int WidthT> BatchedSimpleRaytracer<WidthT>::~BatchedSimpleRaytracer()
+{
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_matrix(BatchedShaderGlobals* /*bsg*/,
+                                           Masked<Matrix44> result,
+                                           Wide<const TransformationPtr> xform,
+                                           Wide<const float> /*time*/)
+{
+    // SimpleRaytracer doesn't understand motion blur and transformations
+    // are just simple 4x4 matrices.
+    result.mask().foreach([&](ActiveLane lane) -> void {
+        result[lane] = *reinterpret_cast<const Matrix44*>(xform[lane]);
+    });
+    return result.mask();
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_matrix(BatchedShaderGlobals* /*bsg*/,
+                                           Masked<Matrix44> result,
+                                           ustring from,
+                                           Wide<const float> /*time*/)
+{
+    Matrix44 M;
+    if (!m_sr.get_matrix(nullptr, M, from))
+        return Mask(false);
+    result.mask().foreach([&](ActiveLane lane) -> void { result[lane] = M; });
+    return result.mask();
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_matrix(BatchedShaderGlobals* /*bsg*/,
+                                           Masked<Matrix44> result,
+                                           Wide<const ustring> from,
+                                           Wide<const float> /*time*/)
+{
+    Mask succeeded(false);
+    result.mask().foreach([&](ActiveLane lane) -> void {
+        Matrix44 M;
+        if (m_sr.get_matrix(nullptr, M, from[lane])) {
+            result[lane] = M;
+            succeeded.set_on(lane);
+        }
+    });
+    return succeeded;
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_inverse_matrix(BatchedShaderGlobals* /*bsg*/,
+                                                   Masked<Matrix44> result,
+                                                   ustring to,
+                                                   Wide<const float> /*time*/)
+{
+    Matrix44 M;
+    if (!m_sr.get_inverse_matrix(nullptr, M, to, 0.0f))
+        return Mask(false);
+    result.mask().foreach([&](ActiveLane lane) -> void { result[lane] = M; });
+    return result.mask();
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_inverse_matrix(BatchedShaderGlobals* /*bsg*/,
+                                                   Masked<Matrix44> result,
+                                                   Wide<const ustring> to,
+                                                   Wide<const float> time)
+{
+    Mask succeeded(false);
+    result.mask().foreach([&](ActiveLane lane) -> void {
+        Matrix44 M;
+        if (m_sr.get_inverse_matrix(nullptr, M, to[lane], time[lane])) {
+            result[lane] = M;
+            succeeded.set_on(lane);
+        }
+    });
+    return succeeded;
+}
+
+
+
+template<int WidthT>
+bool
+BatchedSimpleRaytracer<WidthT>::is_attribute_uniform(ustring object,
+                                                     ustring name)
+{
+    // The renderer's named attributes (camera and version) are the same
+    // everywhere; anything else falls through to per point userdata.
+    return m_sr.m_attr_getters.find(name) != m_sr.m_attr_getters.end();
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_array_attribute(BatchedShaderGlobals* bsg,
+                                                    ustring object,
+                                                    ustring name, int index,
+                                                    MaskedData val)
+{
+    Mask succeeded(false);
+    std::vector<char> data(3 * val.type().size());
+    val.mask().foreach([&](ActiveLane lane) -> void {
+        ShaderGlobals blank;
+        ShaderGlobals* sg = lane_globals(bsg, lane, blank);
+        if (m_sr.get_array_attribute(sg, val.has_derivs(), object, val.type(),
+                                     name, index, data.data())) {
+            assign_lane(val, lane, data.data());
+            succeeded.set_on(lane);
+        }
+    });
+    return succeeded;
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_attribute(BatchedShaderGlobals* bsg,
+                                              ustring object, ustring name,
+                                              MaskedData val)
+{
+    return get_array_attribute(bsg, object, name, -1, val);
+}
+
+
+
+template<int WidthT>
+bool
+BatchedSimpleRaytracer<WidthT>::get_array_attribute_uniform(
+    BatchedShaderGlobals* bsg, ustring object, ustring name, int index,
+    RefData val)
+{
+    ShaderGlobals blank;
+    return m_sr.get_array_attribute(lane_globals(bsg, 0, blank),
+                                    val.has_derivs(), object, val.type(),
+                                    name, index, val.ptr());
+}
+
+
+
+template<int WidthT>
+bool
+BatchedSimpleRaytracer<WidthT>::get_attribute_uniform(BatchedShaderGlobals* bsg,
+                                                      ustring object,
+                                                      ustring name,
+                                                      RefData val)
+{
+    return get_array_attribute_uniform(bsg, object, name, -1, val);
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_userdata(ustring name,
+                                             BatchedShaderGlobals* bsg,
+                                             MaskedData val)
+{
+    Mask succeeded(false);
+    std::vector<char> data(3 * val.type().size());
+    val.mask().foreach([&](ActiveLane lane) -> void {
+        ShaderGlobals blank;
+        ShaderGlobals* sg = lane_globals(bsg, lane, blank);
+        if (m_sr.get_userdata(val.has_derivs(), name, val.type(), sg,
+                              data.data())) {
+            assign_lane(val, lane, data.data());
+            succeeded.set_on(lane);
+        }
+    });
+    return succeeded;
+}
+
+
+
+// Explicitly instantiate
+template class BatchedSimpleRaytracer<16>;
+template class BatchedSimpleRaytracer<8>;
+template class BatchedSimpleRaytracer<4>;
+
+
+OSL_NAMESPACE_EXIT
+
+#endif
@@ -0,0 +1,91 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <OSL/oslconfig.h>
+#include <OSL/batched_rendererservices.h>
+
+OSL_NAMESPACE_ENTER
+
+class SimpleRaytracer;
+
+/// What the wavefront integrator hands the BatchedSimpleRaytracer as the
+/// renderstate of a batch: the ShaderGlobals each lane was set up from,
+/// so that the batched callbacks can answer lane by lane just as the
+/// scalar SimpleRaytracer ones do.
+struct BatchedRenderState {
+    ShaderGlobals* sg[16];
+};
+
+/// BatchedRendererServices for SimpleRaytracer's --batched mode.  Rather
+/// than keeping a second copy of the renderer's attributes and userdata,
+/// every query is answered by the scalar SimpleRaytracer methods, once for
+/// a uniform query or once per active lane for a varying one.
+template<int WidthT>
+class BatchedSimpleRaytracer : public BatchedRendererServices<WidthT> {
+public:
+    explicit BatchedSimpleRaytracer(SimpleRaytracer& sr);
+    virtual ~BatchedSimpleRaytracer();
+
+    OSL_USING_DATA_WIDTH(WidthT);
+
+    Mask get_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> result,
+                    Wide<const TransformationPtr> xform,
+                    Wide<const float> time) override;
+    bool is_overridden_get_inverse_matrix_WmWxWf() const override
+    {
+        return false;
+    }
+
+    Mask get_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> result,
+                    ustring from, Wide<const float> time) override;
+    Mask get_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> result,
+                    Wide<const ustring> from, Wide<const float> time) override;
+    bool is_overridden_get_matrix_WmWsWf() const override { return true; }
+
+    Mask get_inverse_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> result,
+                            ustring to, Wide<const float> time) override;
+    bool is_overridden_get_inverse_matrix_WmsWf() const override
+    {
+        return true;
+    }
+    Mask get_inverse_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> result,
+                            Wide<const ustring> to,
+                            Wide<const float> time) override;
+    bool is_overridden_get_inverse_matrix_WmWsWf() const override
+    {
+        return true;
+    }
+
+    bool is_attribute_uniform(ustring object, ustring name) override;
+
+    Mask get_array_attribute(BatchedShaderGlobals* bsg, ustring object,
+                             ustring name, int index, MaskedData val) override;
+
+    Mask get_attribute(BatchedShaderGlobals* bsg, ustring object, ustring name,
+                       MaskedData val) override;
+
+    bool get_array_attribute_uniform(BatchedShaderGlobals* bsg, ustring object,
+                                     ustring name, int index,
+                                     RefData val) override;
+
+    bool get_attribute_uniform(BatchedShaderGlobals* bsg, ustring object,
+                               ustring name, RefData val) override;
+
+    Mask get_userdata(ustring name, BatchedShaderGlobals* bsg,
+                      MaskedData val) override;
+
+    bool is_overridden_texture() const override { return false; }
+    bool is_overridden_texture3d() const override { return false; }
+    bool is_overridden_environment() const override { return false; }
+    bool is_overridden_pointcloud_search() const override { return false; }
+    bool is_overridden_pointcloud_get() const override { return false; }
+    bool is_overridden_pointcloud_write() const override { return false; }
+
+private:
+    SimpleRaytracer& m_sr;
+};
+
+OSL_NAMESPACE_EXIT
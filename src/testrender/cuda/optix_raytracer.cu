@@ -107,6 +107,8 @@ extern "C" __global__ void __miss__()
 
     int pixel = launch_index.y * launch_dims.x + launch_index.x;
     output_buffer[pixel] = make_float3(0,0,1);
+    if (render_params.shader_ids)
+        reinterpret_cast<int*>(render_params.shader_ids)[pixel] = -1;
 }
 
 
@@ -121,6 +123,9 @@ extern "C" __global__ void __raygen__setglobals()
     OSL::pvt::s_color_system             = render_params.color_system;
     OSL::pvt::test_str_1                 = render_params.test_str_1;
     OSL::pvt::test_str_2                 = render_params.test_str_2;
+    OSL::pvt::num_pointclouds            = render_params.num_pointclouds;
+    OSL::pvt::pointcloud_name_buffer     = render_params.pointcloud_name_buffer;
+    OSL::pvt::pointcloud_buffer          = render_params.pointcloud_buffer;
 }
 extern "C" __global__ void __miss__setglobals() { }
 
@@ -143,6 +148,36 @@ extern "C" __global__ void __raygen__()
     RayGeometry r;
     r.origin = eye;
     r.direction = normalize (cx * (d.x * invw - 0.5f) + cy * (0.5f - d.y * invh) + dir);
+#if (OPTIX_VERSION >= 80000)
+    if (render_params.shade_mode == SHADE_REORDER) {
+        // Find the hit, then let the hardware regroup the threads by the
+        // shader group it will run (misses as group "0") before invoking
+        // the closest-hit or miss program.
+        optixTraverse (render_params.traversal_handle,
+                       r.origin,
+                       r.direction,
+                       1e-3f,
+                       1e13f,
+                       0,
+                       OptixVisibilityMask(1),
+                       OPTIX_RAY_FLAG_DISABLE_ANYHIT,
+                       0,
+                       1,
+                       0);
+        unsigned int hint = 0;
+        if (optixHitObjectIsHit()) {
+            const GenericData* g_data = reinterpret_cast<const GenericData*>(optixHitObjectGetSbtDataPointer());
+            const unsigned int prim   = optixHitObjectGetPrimitiveIndex();
+            // sbtGeoIndex 0: quads, 1: spheres
+            hint = 1 + (g_data->sbtGeoIndex == 0
+                        ? reinterpret_cast<const QuadParams*>(g_data->data)[prim].shaderID
+                        : reinterpret_cast<const SphereParams*>(g_data->data)[prim].shaderID);
+        }
+        optixReorder (hint, render_params.reorder_hint_bits);
+        optixInvoke ();
+        return;
+    }
+#endif
     optixTrace (render_params.traversal_handle,
                 r.origin,
                 r.direction,
@@ -13,6 +13,7 @@
 #include <cuda_runtime.h>
 #endif
 #include <OSL/oslclosure.h>
+#include <OSL/device_pointcloud.h>
 
 #include "rend_lib.h"
 
@@ -467,6 +468,9 @@ __device__ uint64_t test_str_2                 = 0;
 __device__ uint64_t num_named_xforms           = 0;
 __device__ CUdeviceptr xform_name_buffer       = 0;
 __device__ CUdeviceptr xform_buffer            = 0;
+__device__ uint64_t num_pointclouds            = 0;
+__device__ CUdeviceptr pointcloud_name_buffer  = 0;
+__device__ CUdeviceptr pointcloud_buffer       = 0;
 }
 OSL_NAMESPACE_EXIT
 
@@ -485,104 +489,59 @@ extern "C" {
     // add OptiX entry point to prevent OptiX from discarding the module
    __global__ void __direct_callable__dummy_rend_lib() { }
 
+    // Bump allocate size bytes of the shading point's closure pool, or
+    // return NULL if it's used up.  The pool was sized from the groups'
+    // "closure_pool_size", so that only happens to a group whose closure
+    // use couldn't be bounded.
     __device__
-    void* closure_component_allot (void* pool, int id, size_t prim_size, const OSL::Color3& w)
-    {
-        ((OSL::ClosureComponent*) pool)->id = id;
-        ((OSL::ClosureComponent*) pool)->w  = w;
-
-        size_t needed   = (sizeof(OSL::ClosureComponent) - sizeof(void*) + prim_size + (alignof(OSL::ClosureComponent) - 1)) & ~(alignof(OSL::ClosureComponent) - 1);
-        char*  char_ptr = (char*) pool;
-
-        return (void*) &char_ptr[needed];
-    }
-
-
-    __device__
-    void* closure_mul_allot (void* pool, const OSL::Color3& w, OSL::ClosureColor* c)
-    {
-        ((OSL::ClosureMul*) pool)->id      = OSL::ClosureColor::MUL;
-        ((OSL::ClosureMul*) pool)->weight  = w;
-        ((OSL::ClosureMul*) pool)->closure = c;
-
-        size_t needed   = (sizeof(OSL::ClosureMul) + (alignof(OSL::ClosureComponent) - 1)) & ~(alignof(OSL::ClosureComponent) - 1);
-        char*  char_ptr = (char*) pool;
-
-        return &char_ptr[needed];
-    }
-
-
-    __device__
-    void* closure_mul_float_allot (void* pool, const float& w, OSL::ClosureColor* c)
-    {
-        ((OSL::ClosureMul*) pool)->id       = OSL::ClosureColor::MUL;
-        ((OSL::ClosureMul*) pool)->weight.x = w;
-        ((OSL::ClosureMul*) pool)->weight.y = w;
-        ((OSL::ClosureMul*) pool)->weight.z = w;
-        ((OSL::ClosureMul*) pool)->closure  = c;
-
-        size_t needed   = (sizeof(OSL::ClosureMul) + (alignof(OSL::ClosureComponent) - 1)) & ~(alignof(OSL::ClosureComponent) - 1);
-        char*  char_ptr = (char*) pool;
-
-        return &char_ptr[needed];
-    }
-
-
-    __device__
-    void* closure_add_allot (void* pool, OSL::ClosureColor* a, OSL::ClosureColor* b)
+    static void* closure_pool_allot (void* sg_, size_t size)
     {
-        ((OSL::ClosureAdd*) pool)->id       = OSL::ClosureColor::ADD;
-        ((OSL::ClosureAdd*) pool)->closureA = a;
-        ((OSL::ClosureAdd*) pool)->closureB = b;
-
-        size_t needed   = (sizeof(OSL::ClosureAdd) + (alignof(OSL::ClosureComponent) - 1)) & ~(alignof(OSL::ClosureComponent) - 1);
-        char*  char_ptr = (char*) pool;
-
-        return &char_ptr[needed];
+        ClosurePool* pool = (ClosurePool*) ((ShaderGlobals*) sg_)->renderstate;
+        char* ret = pool->cur + alignment_offset_calc (pool->cur, alignof(OSL::ClosureComponent));
+        if (ret + size > pool->end)
+            return NULL;
+        pool->cur = ret + size;
+        return ret;
     }
 
 
     __device__
     void* osl_allocate_closure_component (void* sg_, int id, int size)
     {
-        ShaderGlobals* sg_ptr = (ShaderGlobals*) sg_;
-
-        OSL::Color3 w   = OSL::Color3 (1, 1, 1);
-        // Fix up the alignment
-        void* ret = ((char*) sg_ptr->renderstate) + alignment_offset_calc (sg_ptr->renderstate, alignof(OSL::ClosureComponent));
-
         size = max (4, size);
 
-        sg_ptr->renderstate = closure_component_allot (ret, id, size, w);
-
-        return ret;
+        size_t needed = sizeof(OSL::ClosureComponent) - sizeof(void*) + size;
+        OSL::ClosureComponent* comp = (OSL::ClosureComponent*) closure_pool_allot (sg_, needed);
+        if (comp) {
+            comp->id = id;
+            comp->w  = OSL::Color3 (1, 1, 1);
+        }
+        return comp;
     }
 
 
     __device__
     void* osl_allocate_weighted_closure_component (void* sg_, int id, int size, const OSL::Color3* w)
     {
-        ShaderGlobals* sg_ptr = (ShaderGlobals*) sg_;
-
         if (w->x == 0.0f && w->y == 0.0f && w->z == 0.0f) {
             return NULL;
         }
 
         size = max (4, size);
 
-        // Fix up the alignment
-        void* ret = ((char*) sg_ptr->renderstate) + alignment_offset_calc (sg_ptr->renderstate, alignof(OSL::ClosureComponent));
-        sg_ptr->renderstate = closure_component_allot (ret, id, size, *w);
-
-        return ret;
+        size_t needed = sizeof(OSL::ClosureComponent) - sizeof(void*) + size;
+        OSL::ClosureComponent* comp = (OSL::ClosureComponent*) closure_pool_allot (sg_, needed);
+        if (comp) {
+            comp->id = id;
+            comp->w  = *w;
+        }
+        return comp;
     }
 
 
     __device__
     void* osl_mul_closure_color (void* sg_, OSL::ClosureColor* a, const OSL::Color3* w)
     {
-        ShaderGlobals* sg_ptr = (ShaderGlobals*) sg_;
-
         if (a == NULL) {
             return NULL;
         }
@@ -595,19 +554,19 @@ extern "C" {
             return a;
         }
 
-        // Fix up the alignment
-        void* ret = ((char*) sg_ptr->renderstate) + alignment_offset_calc (sg_ptr->renderstate, alignof(OSL::ClosureComponent));
-        sg_ptr->renderstate = closure_mul_allot (ret, *w, a);
-
-        return ret;
+        OSL::ClosureMul* mul = (OSL::ClosureMul*) closure_pool_allot (sg_, sizeof(OSL::ClosureMul));
+        if (mul) {
+            mul->id      = OSL::ClosureColor::MUL;
+            mul->weight  = *w;
+            mul->closure = a;
+        }
+        return mul;
     }
 
 
     __device__
     void* osl_mul_closure_float (void* sg_, OSL::ClosureColor* a, float w)
     {
-        ShaderGlobals* sg_ptr = (ShaderGlobals*) sg_;
-
         if (a == NULL || w == 0.0f) {
             return NULL;
         }
@@ -616,19 +575,21 @@ extern "C" {
             return a;
         }
 
-        // Fix up the alignment
-        void* ret = ((char*) sg_ptr->renderstate) + alignment_offset_calc (sg_ptr->renderstate, alignof(OSL::ClosureComponent));
-        sg_ptr->renderstate = closure_mul_float_allot (ret, w, a);
-
-        return ret;
+        OSL::ClosureMul* mul = (OSL::ClosureMul*) closure_pool_allot (sg_, sizeof(OSL::ClosureMul));
+        if (mul) {
+            mul->id       = OSL::ClosureColor::MUL;
+            mul->weight.x = w;
+            mul->weight.y = w;
+            mul->weight.z = w;
+            mul->closure  = a;
+        }
+        return mul;
     }
 
 
     __device__
     void* osl_add_closure_closure (void* sg_, OSL::ClosureColor* a, OSL::ClosureColor* b)
     {
-        ShaderGlobals* sg_ptr = (ShaderGlobals*) sg_;
-
         if (a == NULL) {
             return b;
         }
@@ -637,11 +598,13 @@ extern "C" {
             return a;
         }
 
-        // Fix up the alignment
-        void* ret = ((char*) sg_ptr->renderstate) + alignment_offset_calc (sg_ptr->renderstate, alignof(OSL::ClosureComponent));
-        sg_ptr->renderstate = closure_add_allot (ret, a, b);
-
-        return ret;
+        OSL::ClosureAdd* add = (OSL::ClosureAdd*) closure_pool_allot (sg_, sizeof(OSL::ClosureAdd));
+        if (add) {
+            add->id       = OSL::ClosureColor::ADD;
+            add->closureA = a;
+            add->closureB = b;
+        }
+        return add;
     }
 
 #define IS_STRING(type) (type.basetype == OSL::TypeDesc::STRING)
@@ -917,6 +880,139 @@ extern "C" {
         return ok;
     }
 #undef MAT
+
+    // The point clouds the renderer copied to the device, each a
+    // DevicePointCloud block, found by the hash of the file name
+    __device__
+    static const OSL::DevicePointCloud* find_pointcloud (const char* filename)
+    {
+        for (size_t idx = 0; idx < OSL::pvt::num_pointclouds; ++idx) {
+            if (HDSTR(filename) == HDSTR(((uint64_t*)OSL::pvt::pointcloud_name_buffer)[idx]))
+                return reinterpret_cast<const OSL::DevicePointCloud*>(
+                    ((CUdeviceptr*)OSL::pvt::pointcloud_buffer)[idx]);
+        }
+        return nullptr;
+    }
+
+    // The cloud attribute that a shader wants as 'attr_type', or NULL if
+    // there's none (as for strings, which aren't on the device) or it
+    // isn't of that base type. 'count' is clamped to the number of
+    // points' values that fit.
+    __device__
+    static const OSL::DevicePointCloud::Attribute*
+    pointcloud_attribute (const OSL::DevicePointCloud* cloud,
+                          const char* attr_name, long long attr_type,
+                          int& count)
+    {
+        const OSL::DevicePointCloud::Attribute* attr
+            = cloud->find_attribute (HDSTR(attr_name).hash());
+        const OSL::TypeDesc type = *(OSL::TypeDesc*)&attr_type;
+        if (!attr || type.basetype != attr->basetype)
+            return nullptr;
+        const int nbase = max (int(type.arraylen), 1) * int(type.aggregate);
+        count = min (count, nbase / attr->nvalues);
+        return attr;
+    }
+
+    // Searches with no arrays of the caller's to hold the results use
+    // these many local slots at most.
+    #define POINTCLOUD_LOCAL_RESULTS 128
+
+    // The extra attributes are passed the way NVPTX passes varargs: a
+    // pointer to a packed buffer, here of (name, type, data pointer)
+    // triples of 8 bytes each.
+    __device__
+    int osl_pointcloud_search (void* sg_, const char* filename, void* center,
+                               float radius, int max_points, int sort,
+                               void* out_indices, void* out_distances,
+                               int derivs_offset, int nattrs, void* attr_args)
+    {
+        const OSL::DevicePointCloud* cloud = find_pointcloud (filename);
+        if (!cloud || !cloud->npoints)
+            return 0;
+
+        int   local_slots[POINTCLOUD_LOCAL_RESULTS];
+        float local_dist2[POINTCLOUD_LOCAL_RESULTS];
+        int*   slots = out_indices ? (int*)out_indices : local_slots;
+        float* dist2 = out_distances ? (float*)out_distances : local_dist2;
+        if (!out_indices || !out_distances)
+            max_points = min (max_points, POINTCLOUD_LOCAL_RESULTS);
+
+        const float3 C = *(const float3*)center;
+        int count = cloud->find_nearest ((const float*)center, radius,
+                                         max_points, sort, slots, dist2);
+        if (out_distances) {
+            for (int i = 0; i < count; ++i)
+                dist2[i] = sqrtf (dist2[i]);
+            if (derivs_offset) {
+                const float3 dCdx = ((const float3*)center)[1];
+                const float3 dCdy = ((const float3*)center)[2];
+                float* d_distance_dx = (float*)out_distances + derivs_offset;
+                float* d_distance_dy = (float*)out_distances + derivs_offset * 2;
+                for (int i = 0; i < count; ++i) {
+                    const int p = slots[i];
+                    float3 delta = make_float3 (C.x - cloud->x()[p],
+                                                C.y - cloud->y()[p],
+                                                C.z - cloud->z()[p]);
+                    if (dist2[i] > 0) {
+                        d_distance_dx[i] = 1.0f / dist2[i] * dot (delta, dCdx);
+                        d_distance_dy[i] = 1.0f / dist2[i] * dot (delta, dCdy);
+                    } else {
+                        // distance is 0, derivs would be infinite
+                        d_distance_dx[i] = 0;
+                        d_distance_dy[i] = 0;
+                    }
+                }
+            }
+        }
+
+        // The attributes are stored in tree order, so fetch them by slot
+        // before turning the slots into particle indices.
+        const uint64_t* args = (const uint64_t*)attr_args;
+        for (int a = 0; a < nattrs; ++a, args += 3) {
+            int n = count;
+            const OSL::DevicePointCloud::Attribute* attr
+                = pointcloud_attribute (cloud, (const char*)args[0],
+                                        (long long)args[1], n);
+            if (!attr)
+                continue;
+            const int bytes = attr->nvalues * 4;
+            const char* values = cloud->at<char>(attr->offset);
+            for (int i = 0; i < n; ++i)
+                memcpy ((char*)args[2] + i * bytes,
+                        values + size_t(slots[i]) * bytes, bytes);
+        }
+        if (out_indices)
+            for (int i = 0; i < count; ++i)
+                slots[i] = cloud->index()[slots[i]];
+        return count;
+    }
+
+    __device__
+    int osl_pointcloud_get (void* sg_, const char* filename, void* in_indices,
+                            int count, const char* attr_name,
+                            long long attr_type, void* out_data)
+    {
+        if (!count)
+            return 1;  // always succeed if not asking for any data
+        const OSL::DevicePointCloud* cloud = find_pointcloud (filename);
+        if (!cloud)
+            return 0;
+        const OSL::DevicePointCloud::Attribute* attr
+            = pointcloud_attribute (cloud, attr_name, attr_type, count);
+        if (!attr)
+            return 0;
+        const int bytes = attr->nvalues * 4;
+        const char* values = cloud->at<char>(attr->offset);
+        for (int i = 0; i < count; ++i) {
+            int index = ((const int*)in_indices)[i];
+            if (index >= 0 && index < cloud->npoints)
+                memcpy ((char*)out_data + i * bytes,
+                        values + size_t(cloud->slot()[index]) * bytes, bytes);
+        }
+        return 1;
+    }
+    #undef POINTCLOUD_LOCAL_RESULTS
 }
 
 #endif //#if (OPTIX_VERSION < 70000)
@@ -21,7 +21,7 @@ namespace DeviceStrings {
     rtDeclareVariable(OSL_NAMESPACE::DeviceString, var_name, , );
 #   define STRING_PARAMS(x)  StringParams::x
 #else
-#   define STRING_PARAMS(x)  UStringHash::Hash(__OSL_STRINGIFY(x))
+#   define STRING_PARAMS(x)  OSL_NAMESPACE::Hashes::x
 // Don't declare anything
 #   define STRDECL(str,var_name) 
 
@@ -41,6 +41,9 @@ extern __device__ uint64_t    test_str_2;
 extern __device__ uint64_t    num_named_xforms;
 extern __device__ CUdeviceptr xform_name_buffer;
 extern __device__ CUdeviceptr xform_buffer;
+extern __device__ uint64_t    num_pointclouds;
+extern __device__ CUdeviceptr pointcloud_name_buffer;
+extern __device__ CUdeviceptr pointcloud_buffer;
 }
 #endif
 OSL_NAMESPACE_EXIT
@@ -130,6 +133,24 @@ struct ShaderGlobals {
 };
 
 
+#if (OPTIX_VERSION >= 70000)
+// The closure storage of one shading point, its slice of the launch's
+// closure pool.  ShaderGlobals::renderstate points to it, and the closure
+// allocators bump cur, returning NULL rather than going past end.
+struct ClosurePool {
+    char* cur;
+    char* end;
+
+    // Use the idx'th stride-sized slice of the launch's pool.
+    __device__ void init (CUdeviceptr pool, uint64_t stride, uint64_t idx)
+    {
+        cur = reinterpret_cast<char*>(pool) + idx * stride;
+        end = cur + stride;
+    }
+};
+#endif
+
+
 enum RayType {
     CAMERA       = 1,
     SHADOW       = 2,
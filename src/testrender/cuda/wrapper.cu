@@ -317,7 +317,7 @@ float3 process_closure (const OSL::ClosureColor* closure_tree)
             const char* mem = (const char*)((OSL::ClosureComponent*) cur)->data();
             const char* dist_str = *(const char**) &mem[0];
 
-            if (HDSTR(dist_str) == STRING_PARAMS(default))
+            if (HDSTR(dist_str) == STRING_PARAMS(default_))
                 return make_float3(0.0f, 1.0f, 1.0f);
             else
                 return make_float3(1.0f, 0.0f, 1.0f);
@@ -340,21 +340,20 @@ float3 process_closure (const OSL::ClosureColor* closure_tree)
 }
 
 
-extern "C" __global__  void __closesthit__closest_hit_osl()
+// Run a hit's shader group and write its result to the pixel
+static __device__
+void shade (ShaderGlobals& sg, int pixel)
 {
-    // TODO: Fixed-sized allocations can easily be exceeded by arbitrary shader
-    //       networks, so there should be (at least) some mechanism to issue a
-    //       warning or error if the closure or param storage can possibly be
-    //       exceeded.
-    alignas(8) char closure_pool[256];
-    alignas(8) char params      [256];
-
-    ShaderGlobals sg;
-    globals_from_hit (sg);
+    // The closure and heap storage are this pixel's slices of the pools
+    // the renderer sized for the scene's shader groups.
+    ClosurePool closure_pool;
+    closure_pool.init (render_params.closure_pool,
+                       render_params.closure_pool_stride, pixel);
+    char* params = reinterpret_cast<char*>(render_params.heap_pool)
+                   + pixel * render_params.heap_pool_stride;
 
     // Pack the "closure pool" into one of the ShaderGlobals pointers
-    *(int*) &closure_pool[0] = 0;
-    sg.renderstate = &closure_pool[0];
+    sg.renderstate = &closure_pool;
 
     // Create some run-time options structs. The OSL shader fills in the structs
     // as it executes, based on the options specified in the shader source.
@@ -377,13 +376,70 @@ extern "C" __global__  void __closesthit__closest_hit_osl()
     optixDirectCall<void, ShaderGlobals*, void *, void*, void*, int>(shaderGroupIdx , &sg, params, nullptr, nullptr, 0); // call osl_group_func
 
     float3 result = process_closure ((OSL::ClosureColor*) sg.Ci);
-    uint3 launch_dims  = optixGetLaunchDimensions();
-    uint3 launch_index = optixGetLaunchIndex();
 
     float3* output_buffer = reinterpret_cast<float3 *>(render_params.output_buffer);
-    int pixel = launch_index.y * launch_dims.x + launch_index.x;
     output_buffer[pixel] = make_float3(result.x, result.y, result.z);
+}
+
+
+extern "C" __global__  void __closesthit__closest_hit_osl()
+{
+    uint3 launch_dims  = optixGetLaunchDimensions();
+    uint3 launch_index = optixGetLaunchIndex();
+    int pixel = launch_index.y * launch_dims.x + launch_index.x;
+
+    ShaderGlobals sg;
+    globals_from_hit (sg);
+
+    if (render_params.shader_ids)
+        reinterpret_cast<int*>(render_params.shader_ids)[pixel] = sg.shaderID;
+
+    if (render_params.shade_mode == SHADE_QUEUE) {
+        // Leave the shading to the queue pass
+        ShadingHit& hit = reinterpret_cast<ShadingHit*>(render_params.hits)[pixel];
+        hit.P           = sg.P;
+        hit.N           = sg.N;
+        hit.Ng          = sg.Ng;
+        hit.I           = sg.I;
+        hit.dPdu        = sg.dPdu;
+        hit.dPdv        = sg.dPdv;
+        hit.u           = sg.u;
+        hit.v           = sg.v;
+        hit.surfacearea = sg.surfacearea;
+        hit.backfacing  = sg.backfacing;
+        hit.shaderID    = sg.shaderID;
+        return;
+    }
+
+    shade (sg, pixel);
+}
+
+
+// The second pass of SHADE_QUEUE mode: one thread per hit, in the order
+// the renderer binned them, so that the threads of a warp run the same
+// shader group wherever the image allows.
+extern "C" __global__ void __raygen__shade_queue()
+{
+    const int pixel = reinterpret_cast<const int*>(render_params.shade_order)[optixGetLaunchIndex().x];
+    const ShadingHit& hit = reinterpret_cast<const ShadingHit*>(render_params.hits)[pixel];
+
+    ShaderGlobals sg;
+    sg.I           = hit.I;
+    sg.N           = hit.N;
+    sg.Ng          = hit.Ng;
+    sg.P           = hit.P;
+    sg.dPdu        = hit.dPdu;
+    sg.dPdv        = hit.dPdv;
+    sg.u           = hit.u;
+    sg.v           = hit.v;
+    sg.Ci          = NULL;
+    sg.surfacearea = hit.surfacearea;
+    sg.backfacing  = hit.backfacing;
+    sg.shaderID    = hit.shaderID;
+    sg.raytype = CAMERA;
+    sg.flipHandedness = 0;
 
+    shade (sg, pixel);
 }
 
 #endif //#if (OPTIX_VERSION < 70000)
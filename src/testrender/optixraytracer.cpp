@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <vector>
 
 #include <OpenImageIO/filesystem.h>
@@ -94,11 +95,8 @@ OptixRaytracer::OptixRaytracer ()
     CUDA_CHECK (cudaSetDevice (0));
     CUDA_CHECK (cudaStreamCreate (&m_cuda_stream));
 
-#define STRDECL(str,var_name)                                           \
-    register_string (str, OSL_NAMESPACE_STRING "::DeviceStrings::" #var_name);
-#include <OSL/strdecls.h>
-#undef STRDECL
-
+    // The standard strings are hashed at compile time (see
+    // OSL::Hashes), so only strings made at runtime are registered.
 #endif
 }
 
@@ -110,6 +108,8 @@ OptixRaytracer::~OptixRaytracer ()
     if (m_optix_ctx)
         m_optix_ctx->destroy();
 #else
+    for (CUdeviceptr p : m_pointcloud_ptrs)
+        cudaFree (reinterpret_cast<void *>(p));
     if (m_optix_ctx)
         OPTIX_CHECK (optixDeviceContextDestroy (m_optix_ctx));
 #endif
@@ -407,6 +407,63 @@ OptixRaytracer::create_optix_pg(const OptixProgramGroupDesc* pg_desc,
 
     return true;
 }
+
+void
+OptixRaytracer::register_pointclouds ()
+{
+    // Copy each point cloud that a shader group reads to the device, as
+    // the block that rend_lib's pointcloud_search and pointcloud_get walk,
+    // and list them by the ustring hash of their filenames.
+    std::vector<uint64_t>    name_buffer;
+    std::vector<CUdeviceptr> cloud_buffer;
+    for (const auto& groupref : shaders()) {
+        int unknown = 0, nclouds = 0;
+        ustring* clouds = nullptr;
+        shadingsys->getattribute (groupref.get(), "unknown_pointclouds_needed", unknown);
+        shadingsys->getattribute (groupref.get(), "num_pointclouds_needed", nclouds);
+        shadingsys->getattribute (groupref.get(), "pointclouds_needed",
+                                  TypeDesc::PTR, &clouds);
+        if (unknown)
+            errhandler().warningfmt("A shader group reads point clouds whose "
+                                    "names aren't known until it runs; they "
+                                    "can't be found on the device");
+        for (int i = 0; i < nclouds; ++i) {
+            uint64_t name = clouds[i].hash();
+            if (std::find (name_buffer.begin(), name_buffer.end(), name)
+                    != name_buffer.end())
+                continue;
+            std::vector<char> image;
+            if (! shadingsys->pointcloud_device_image (clouds[i], image)) {
+                errhandler().warningfmt("Could not copy point cloud \"{}\" "
+                                        "to the device", clouds[i]);
+                continue;
+            }
+            CUdeviceptr d_cloud;
+            CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&d_cloud), image.size()));
+            CUDA_CHECK (cudaMemcpy (reinterpret_cast<void *>(d_cloud), image.data(),
+                                    image.size(), cudaMemcpyHostToDevice));
+            m_pointcloud_ptrs.push_back (d_cloud);
+            name_buffer.push_back (name);
+            cloud_buffer.push_back (d_cloud);
+        }
+    }
+
+    m_num_pointclouds = name_buffer.size();
+    if (name_buffer.empty())
+        return;
+
+    size_t sz = sizeof(uint64_t) * name_buffer.size();
+    CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&d_pointcloud_name_buffer), sz));
+    CUDA_CHECK (cudaMemcpy (reinterpret_cast<void *>(d_pointcloud_name_buffer),
+                            name_buffer.data(), sz, cudaMemcpyHostToDevice));
+    m_pointcloud_ptrs.push_back (d_pointcloud_name_buffer);
+
+    sz = sizeof(CUdeviceptr) * cloud_buffer.size();
+    CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&d_pointcloud_buffer), sz));
+    CUDA_CHECK (cudaMemcpy (reinterpret_cast<void *>(d_pointcloud_buffer),
+                            cloud_buffer.data(), sz, cudaMemcpyHostToDevice));
+    m_pointcloud_ptrs.push_back (d_pointcloud_buffer);
+}
 #endif
 
 bool
@@ -504,6 +561,16 @@ OptixRaytracer::make_optix_materials ()
     char msg_log[8192];
     size_t sizeof_msg_log;
 
+    // Keep OptiX's own cache of compiled modules along with the PTX cache
+    // (ptx_cache_dir), so that a second run skips the driver's JIT too.
+    std::string ptx_cache_dir;
+    if (shadingsys->getattribute ("ptx_cache_dir", ptx_cache_dir)
+          && ptx_cache_dir.size()) {
+        OPTIX_CHECK (optixDeviceContextSetCacheLocation (m_optix_ctx,
+                                                         ptx_cache_dir.c_str()));
+        OPTIX_CHECK (optixDeviceContextSetCacheEnabled (m_optix_ctx, 1));
+    }
+
     // Make module that contains programs we'll use in this scene
     OptixModuleCompileOptions module_compile_options = {};
 
@@ -599,6 +666,15 @@ OptixRaytracer::make_optix_materials ()
     OptixProgramGroup  setglobals_miss_group;
     create_optix_pg(&setglobals_miss_desc, 1, &program_options, &setglobals_miss_group);
 
+    // Raygen group of the SHADE_QUEUE pass, which lives with the shading
+    // code in the wrapper
+    OptixProgramGroupDesc shade_queue_raygen_desc = {};
+    shade_queue_raygen_desc.kind = OPTIX_PROGRAM_GROUP_KIND_RAYGEN;
+    shade_queue_raygen_desc.raygen.module            = wrapper_module;
+    shade_queue_raygen_desc.raygen.entryFunctionName = "__raygen__shade_queue";
+    OptixProgramGroup  shade_queue_raygen_group;
+    create_optix_pg(&shade_queue_raygen_desc, 1, &program_options, &shade_queue_raygen_group);
+
     // Hitgroup -- quads
     OptixProgramGroupDesc quad_hitgroup_desc = {};
     quad_hitgroup_desc.kind = OPTIX_PROGRAM_GROUP_KIND_HITGROUP;
@@ -675,6 +751,16 @@ OptixRaytracer::make_optix_materials ()
             }
         }
 
+        // Size the closure and heap pools for the largest group, with a
+        // fixed budget for closures whose use couldn't be bounded.
+        int closure_pool_size = -1, groupdata_size = 0;
+        shadingsys->getattribute (groupref.get(), "closure_pool_size", closure_pool_size);
+        shadingsys->getattribute (groupref.get(), "groupdata_size", groupdata_size);
+        if (closure_pool_size < 0)
+            closure_pool_size = UNBOUNDED_CLOSURE_POOL_SIZE;
+        m_closure_pool_stride = std::max (m_closure_pool_stride, size_t(closure_pool_size));
+        m_heap_pool_stride    = std::max (m_heap_pool_stride, size_t(groupdata_size));
+
         // Retrieve the compiled ShaderGroup PTX
         std::string osl_ptx;
         shadingsys->getattribute (groupref.get(), "ptx_compiled_version",
@@ -733,10 +819,14 @@ OptixRaytracer::make_optix_materials ()
         //    printf ("Creating 'shader' group for group '%s':\n%s\n", group_name.c_str(), msg_log);
     }
 
+    register_pointclouds ();
+
 
     OptixPipelineLinkOptions pipeline_link_options;
     pipeline_link_options.maxTraceDepth          = 1;
-    pipeline_link_options.debugLevel             = OPTIX_COMPILE_DEBUG_LEVEL_FULL;
+    // Link at the same debug level the modules were compiled at: FULL
+    // here would deoptimize the whole pipeline, shaders included.
+    pipeline_link_options.debugLevel             = module_compile_options.debugLevel;
 #if (OPTIX_VERSION < 70100)
     pipeline_link_options.overrideUsesMotionBlur = false;
 #endif
@@ -763,6 +853,9 @@ OptixRaytracer::make_optix_materials ()
     final_groups.push_back(setglobals_raygen_group);
     final_groups.push_back(setglobals_miss_group);
 
+    // append the shade-queue raygen group
+    final_groups.push_back(shade_queue_raygen_group);
+
     sizeof_msg_log = sizeof(msg_log);
     OPTIX_CHECK (optixPipelineCreate (m_optix_ctx,
                                       &pipeline_compile_options,
@@ -810,6 +903,7 @@ OptixRaytracer::make_optix_materials ()
     CUdeviceptr d_callable_records;
     CUdeviceptr d_setglobals_raygen_record;
     CUdeviceptr d_setglobals_miss_record;
+    CUdeviceptr d_shade_queue_raygen_record;
 
     std::vector<CUdeviceptr> d_sbt_records(final_groups.size());
 
@@ -819,7 +913,8 @@ OptixRaytracer::make_optix_materials ()
 
     int       sbtIndex       = 3;
     const int hitRecordStart = sbtIndex;
-    size_t   setglobals_start = final_groups.size() - 2;
+    size_t   setglobals_start  = final_groups.size() - 3;
+    size_t   shade_queue_start = final_groups.size() - 1;
 
     // Copy geometry data to appropriate SBT records
     if (scene.quads.size() > 0 ) {
@@ -849,6 +944,7 @@ OptixRaytracer::make_optix_materials ()
     CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&d_callable_records)          , (2 + nshaders) * sizeof(GenericRecord)));
     CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&d_setglobals_raygen_record)  ,     sizeof(GenericRecord)));
     CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&d_setglobals_miss_record)    ,     sizeof(GenericRecord)));
+    CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&d_shade_queue_raygen_record) ,     sizeof(GenericRecord)));
 
     CUDA_CHECK (cudaMemcpy (reinterpret_cast<void *>(d_raygen_record)   , &sbt_records[1],     sizeof(GenericRecord), cudaMemcpyHostToDevice));
     CUDA_CHECK (cudaMemcpy (reinterpret_cast<void *>(d_miss_record)     , &sbt_records[2],     sizeof(GenericRecord), cudaMemcpyHostToDevice));
@@ -856,6 +952,7 @@ OptixRaytracer::make_optix_materials ()
     CUDA_CHECK (cudaMemcpy (reinterpret_cast<void *>(d_callable_records), &sbt_records[callableRecordStart], (2 + nshaders) * sizeof(GenericRecord), cudaMemcpyHostToDevice));
     CUDA_CHECK (cudaMemcpy (reinterpret_cast<void *>(d_setglobals_raygen_record)   , &sbt_records[setglobals_start + 0],     sizeof(GenericRecord), cudaMemcpyHostToDevice));
     CUDA_CHECK (cudaMemcpy (reinterpret_cast<void *>(d_setglobals_miss_record)     , &sbt_records[setglobals_start + 1],     sizeof(GenericRecord), cudaMemcpyHostToDevice));
+    CUDA_CHECK (cudaMemcpy (reinterpret_cast<void *>(d_shade_queue_raygen_record)  , &sbt_records[shade_queue_start],        sizeof(GenericRecord), cudaMemcpyHostToDevice));
 
     // Looks like OptixShadingTable needs to be filled out completely
     m_optix_sbt.raygenRecord                 = d_raygen_record;
@@ -876,6 +973,11 @@ OptixRaytracer::make_optix_materials ()
     m_setglobals_optix_sbt.missRecordStrideInBytes      = sizeof(GenericRecord);
     m_setglobals_optix_sbt.missRecordCount              = 1;
 
+    // Shader binding table for the SHADE_QUEUE pass, which calls the
+    // shader groups but traces nothing
+    m_shade_queue_optix_sbt              = m_optix_sbt;
+    m_shade_queue_optix_sbt.raygenRecord = d_shade_queue_raygen_record;
+
     // Pipeline has been created so we can clean some things up
     for (auto &&i : final_groups) {
         optixProgramGroupDestroy(i);
@@ -1251,6 +1353,31 @@ void
 OptixRaytracer::prepare_render()
 {
 #ifdef OSL_USE_OPTIX
+    if (scene.triangles.size())
+        errhandler().warningfmt("Meshes are only rendered on the CPU, and will be missing");
+
+#if (OPTIX_VERSION >= 70000)
+    string_view shade_mode = options.get_string ("gpu_shade", "hit");
+    if (shade_mode == "queue")
+        m_shade_mode = SHADE_QUEUE;
+    else if (shade_mode == "reorder") {
+#if (OPTIX_VERSION >= 80000)
+        m_shade_mode = SHADE_REORDER;
+#else
+        errhandler().warningfmt("Shader execution reordering needs OptiX 8, binning hits in a queue instead");
+        m_shade_mode = SHADE_QUEUE;
+#endif
+    } else {
+        if (shade_mode != "hit")
+            errhandler().warningfmt("Unknown GPU shading mode '{}', shading in the hit programs", shade_mode);
+        m_shade_mode = SHADE_IN_HIT;
+    }
+    // Reordering hints are 1 + the shader group, 0 for a miss
+    m_reorder_hint_bits = 1;
+    while ((size_t(1) << m_reorder_hint_bits) < shaders().size() + 1)
+        ++m_reorder_hint_bits;
+#endif
+
     // Set up the OptiX Context
     init_optix_context (camera.xres, camera.yres);
 
@@ -1282,6 +1409,55 @@ OptixRaytracer::warmup()
 
 
 
+#if defined(OSL_USE_OPTIX) && OPTIX_VERSION >= 70000
+// The pixels that hit something, grouped by their shader group (in pixel
+// order within a group, to keep what neighbours share close), by a
+// counting sort.
+static std::vector<int>
+bin_by_shader (const std::vector<int>& shader_ids, size_t ngroups)
+{
+    std::vector<size_t> start (ngroups + 1, 0);
+    for (int id : shader_ids)
+        if (id >= 0)
+            ++start[id + 1];
+    for (size_t g = 1; g <= ngroups; ++g)
+        start[g] += start[g - 1];
+    std::vector<int> order (start[ngroups]);
+    for (size_t pixel = 0; pixel < shader_ids.size(); ++pixel)
+        if (shader_ids[pixel] >= 0)
+            order[start[shader_ids[pixel]]++] = int(pixel);
+    return order;
+}
+
+
+
+// Tally the shader groups each run of 32 consecutive threads -- a warp --
+// ran, where the threads shade the pixels in order (or in launch order,
+// row by row, which is how OptiX maps a 2D launch only approximately).
+template<typename Coherence>
+static void
+tally_warps (const std::vector<int>& shader_ids, const std::vector<int>* order,
+             Coherence& coherence)
+{
+    const size_t nthreads = order ? order->size() : shader_ids.size();
+    for (size_t warp = 0; warp < nthreads; warp += 32) {
+        int groups[32], ngroups = 0;
+        for (size_t t = warp, end = std::min (nthreads, warp + 32); t < end; ++t) {
+            int id = shader_ids[order ? (*order)[t] : t];
+            if (id >= 0 && std::find (groups, groups + ngroups, id) == groups + ngroups)
+                groups[ngroups++] = id;
+        }
+        if (ngroups) {
+            ++coherence.warps;
+            coherence.groups   += ngroups;
+            coherence.coherent += (ngroups == 1);
+        }
+    }
+}
+#endif
+
+
+
 void
 OptixRaytracer::render(int xres OSL_MAYBE_UNUSED, int yres OSL_MAYBE_UNUSED)
 {
@@ -1319,6 +1495,35 @@ OptixRaytracer::render(int xres OSL_MAYBE_UNUSED, int yres OSL_MAYBE_UNUSED)
     params.color_system          = d_color_system;
     params.test_str_1            = test_str_1;
     params.test_str_2            = test_str_2;
+    params.num_pointclouds       = m_num_pointclouds;
+    params.pointcloud_name_buffer = d_pointcloud_name_buffer;
+    params.pointcloud_buffer     = d_pointcloud_buffer;
+
+    // One slice of each pool per pixel, kept 16-byte aligned
+    m_closure_pool_stride = (m_closure_pool_stride + 15) & ~size_t(15);
+    m_heap_pool_stride    = (m_heap_pool_stride + 15) & ~size_t(15);
+    CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&d_closure_pool), std::max (size_t(1), xres * yres * m_closure_pool_stride)));
+    CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&d_heap_pool), std::max (size_t(1), xres * yres * m_heap_pool_stride)));
+    params.closure_pool          = d_closure_pool;
+    params.heap_pool             = d_heap_pool;
+    params.closure_pool_stride   = m_closure_pool_stride;
+    params.heap_pool_stride      = m_heap_pool_stride;
+
+    // The queue pass bins the hits by the shader groups the main launch
+    // found, which the coherence statistics want as well
+    const size_t npixels  = size_t(xres) * size_t(yres);
+    const bool   want_ids = m_shade_mode == SHADE_QUEUE || options.get_int ("gpu_stats");
+    if (want_ids)
+        CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&d_shader_ids), npixels * sizeof(int)));
+    if (m_shade_mode == SHADE_QUEUE) {
+        CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&d_hits), npixels * sizeof(ShadingHit)));
+        CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&d_shade_order), npixels * sizeof(int)));
+    }
+    params.shade_mode            = m_shade_mode;
+    params.reorder_hint_bits     = m_reorder_hint_bits;
+    params.shader_ids            = d_shader_ids;
+    params.hits                  = d_hits;
+    params.shade_order           = d_shade_order;
 
     CUDA_CHECK (cudaMemcpy (reinterpret_cast<void *>(d_launch_params), &params, sizeof(RenderParams), cudaMemcpyHostToDevice));
 
@@ -1340,6 +1545,39 @@ OptixRaytracer::render(int xres OSL_MAYBE_UNUSED, int yres OSL_MAYBE_UNUSED)
                               xres, yres, 1));
     CUDA_SYNC_CHECK();
 
+    if (want_ids) {
+        std::vector<int> shader_ids (npixels);
+        CUDA_CHECK (cudaMemcpy (shader_ids.data(), reinterpret_cast<void *>(d_shader_ids), npixels * sizeof(int), cudaMemcpyDeviceToHost));
+        tally_warps (shader_ids, nullptr, m_launch_coherence);
+
+        if (m_shade_mode == SHADE_QUEUE) {
+            // Shade the hits, a thread each, grouped by shader
+            std::vector<int> order = bin_by_shader (shader_ids, shaders().size());
+            if (order.size()) {
+                CUDA_CHECK (cudaMemcpy (reinterpret_cast<void *>(d_shade_order), order.data(), order.size() * sizeof(int), cudaMemcpyHostToDevice));
+                OPTIX_CHECK (optixLaunch (m_optix_pipeline,
+                                          m_cuda_stream,
+                                          d_launch_params,
+                                          sizeof(RenderParams),
+                                          &m_shade_queue_optix_sbt,
+                                          unsigned(order.size()), 1, 1));
+                CUDA_SYNC_CHECK();
+            }
+            tally_warps (shader_ids, &order, m_shade_coherence);
+        }
+    }
+
+    CUDA_CHECK (cudaFree (reinterpret_cast<void *>(d_closure_pool)));
+    CUDA_CHECK (cudaFree (reinterpret_cast<void *>(d_heap_pool)));
+    d_closure_pool = d_heap_pool = 0;
+    if (d_shader_ids)
+        CUDA_CHECK (cudaFree (reinterpret_cast<void *>(d_shader_ids)));
+    if (d_hits)
+        CUDA_CHECK (cudaFree (reinterpret_cast<void *>(d_hits)));
+    if (d_shade_order)
+        CUDA_CHECK (cudaFree (reinterpret_cast<void *>(d_shade_order)));
+    d_shader_ids = d_hits = d_shade_order = 0;
+
     //
     //  Let's print some basic stuff
     //
@@ -1352,6 +1590,28 @@ OptixRaytracer::render(int xres OSL_MAYBE_UNUSED, int yres OSL_MAYBE_UNUSED)
 }
 
 #if defined(OSL_USE_OPTIX) && OPTIX_VERSION >= 70000
+std::string
+OptixRaytracer::coherence_stats () const
+{
+    static const char* mode_names[] = { "in hit programs", "binned in a queue",
+                                        "reordered by the hardware" };
+    std::string out = fmtformat ("GPU shading: {}\n", mode_names[m_shade_mode]);
+    auto describe = [&](const char* order, const WarpCoherence& c) {
+        out += fmtformat ("  {:<12}: {} warps with hits, {:.2f} shader groups per warp, {:.1f}% single-group\n",
+                          order, c.warps,
+                          c.warps ? double(c.groups) / c.warps : 0.0,
+                          c.warps ? 100.0 * c.coherent / c.warps : 0.0);
+    };
+    describe ("launch order", m_launch_coherence);
+    if (m_shade_mode == SHADE_QUEUE)
+        describe ("shade order", m_shade_coherence);
+    else if (m_shade_mode == SHADE_REORDER)
+        out += "  (the order the hardware shaded in isn't observable)\n";
+    return out;
+}
+
+
+
 void
 OptixRaytracer::processPrintfBuffer(void *buffer_data, size_t buffer_size)
 {
@@ -1376,7 +1636,7 @@ OptixRaytracer::processPrintfBuffer(void *buffer_data, size_t buffer_size)
         // have we reached the end?
         if (fmt_str_hash == 0)
             break;
-        const char *format = m_hash_map[fmt_str_hash];
+        const char *format = hash_to_string (fmt_str_hash);
         OSL_ASSERT(format != nullptr && "The format string should have been registered with the renderer");
         const size_t len = strlen(format);
 
@@ -1412,7 +1672,7 @@ OptixRaytracer::processPrintfBuffer(void *buffer_data, size_t buffer_size)
                         case 's':
                             src = (src + sizeof(double) - 1) & ~(sizeof(double)-1);
                             uint64_t str_hash = *reinterpret_cast<const uint64_t *>(&ptr[src]);
-                            const char *str = m_hash_map[str_hash];
+                            const char *str = hash_to_string (str_hash);
                             OSL_ASSERT(str != nullptr && "The string should have been regisgtered with the renderer");
                             dst += snprintf(&buffer[dst], BufferSize - dst, fmt_string.c_str(), str);
                             src += sizeof(uint64_t);
@@ -40,6 +40,20 @@ public:
 #endif
     }
 
+#if OPTIX_VERSION >= 70000
+    // Map a string hash from the device back to its characters.  Strings
+    // made at runtime are in m_hash_map; anything else (such as the
+    // standard strings and shader constants, which are never registered)
+    // is still a ustring on the host.
+    const char* hash_to_string (uint64_t hash) const
+    {
+        auto found = m_hash_map.find (hash);
+        if (found != m_hash_map.end())
+            return found->second;
+        return ustring::from_hash (hash).c_str();
+    }
+#endif
+
     uint64_t register_global (const std::string& str, uint64_t value);
     bool     fetch_global (const std::string& str, uint64_t *value);
 
@@ -78,6 +92,12 @@ public:
 
 #if (OPTIX_VERSION >= 70000)
     void processPrintfBuffer(void *buffer_data, size_t buffer_size);
+
+    /// Describe how coherently the renders so far ran their shader
+    /// groups: for each warp-sized run of threads that shaded hits, how
+    /// many distinct groups it needed, in launch order and in the order
+    /// the hits were actually shaded.
+    std::string coherence_stats () const;
 #endif
 
 private:
@@ -106,8 +126,38 @@ private:
     uint64_t                test_str_1;
     uint64_t                test_str_2;
     const unsigned long     OSL_PRINTF_BUFFER_SIZE = 8 * 1024 * 1024;
+    CUdeviceptr             d_closure_pool = 0;
+    CUdeviceptr             d_heap_pool    = 0;
+    size_t                  m_closure_pool_stride = 0;  // per launch index
+    size_t                  m_heap_pool_stride    = 0;  // per launch index
+    // Closure bytes per launch index for a group with unbounded closures
+    static constexpr size_t UNBOUNDED_CLOSURE_POOL_SIZE = 1024;
     std::unordered_map<uint64_t, const char *> m_hash_map;
 
+    // Execution ordering of the shading (a GPUShadeMode), and the buffers
+    // and shader binding table of its queue pass
+    int                     m_shade_mode = SHADE_IN_HIT;
+    unsigned int            m_reorder_hint_bits = 1;
+    OptixShaderBindingTable m_shade_queue_optix_sbt = {};
+    CUdeviceptr             d_shader_ids  = 0;
+    CUdeviceptr             d_hits        = 0;
+    CUdeviceptr             d_shade_order = 0;
+
+    // The point clouds the shader groups read, copied to the device, and
+    // everything allocated for them
+    uint64_t                 m_num_pointclouds = 0;
+    CUdeviceptr              d_pointcloud_name_buffer = 0;
+    CUdeviceptr              d_pointcloud_buffer = 0;
+    std::vector<CUdeviceptr> m_pointcloud_ptrs;
+
+    // Warps with hits, the shader groups they ran, and how many of them
+    // ran a single group, accumulated over the renders
+    struct WarpCoherence {
+        uint64_t warps = 0, groups = 0, coherent = 0;
+    };
+    WarpCoherence           m_launch_coherence;
+    WarpCoherence           m_shade_coherence;
+
     bool load_optix_module (const char*                        filename,
                             const OptixModuleCompileOptions*   module_compile_options,
                             const OptixPipelineCompileOptions* pipeline_compile_options,
@@ -116,6 +166,7 @@ private:
                           const int                    num_pg,
                           OptixProgramGroupOptions*    program_options,
                           OptixProgramGroup*           pg);
+    void register_pointclouds ();
 
 #endif
 
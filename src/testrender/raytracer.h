@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <string>
 #include <vector>
 
 #include <OpenImageIO/fmath.h>
@@ -388,6 +389,17 @@ private:
 
 
 
+// A triangle of a mesh, indexing the Scene's vertex arrays.  Meshes are
+// only rendered on the CPU, and can't be lights.
+struct Triangle {
+    int v[3];       // indices into Scene::verts (and Scene::colors)
+    int n[3];       // indices into Scene::normals, or -1
+    int t[3];       // indices into Scene::uvs, or -1
+    int shaderID;
+};
+
+
+
 struct Scene {
     void add_sphere(const Sphere& s) {
         spheres.push_back(s);
@@ -397,33 +409,152 @@ struct Scene {
         quads.push_back(q);
     }
 
+    // Read the triangles of a Wavefront OBJ file, with its normals, uvs,
+    // and per-vertex colors ("v x y z r g b") if it has them.  Return
+    // false and set err if it can't be read.
+    bool add_obj(const std::string& filename, int shaderID, std::string& err);
+
+    // Primitive IDs number the spheres, then the quads, then the triangles.
     int num_prims() const {
-        return spheres.size() + quads.size();
+        return spheres.size() + quads.size() + triangles.size();
     }
 
+    // The index into triangles of primID, or -1 if it's not a triangle.
+    int triangle(int primID) const {
+        primID -= spheres.size() + quads.size();
+        return primID >= 0 ? primID : -1;
+    }
+
+    void getBounds(int primID, Vec3& bmin, Vec3& bmax) const {
+        if (primID < int(spheres.size()))
+            return spheres[primID].getBounds(bmin.x, bmin.y, bmin.z,
+                                             bmax.x, bmax.y, bmax.z);
+        primID -= spheres.size();
+        if (primID < int(quads.size()))
+            return quads[primID].getBounds(bmin.x, bmin.y, bmin.z,
+                                           bmax.x, bmax.y, bmax.z);
+        const Triangle& tri = triangles[primID - quads.size()];
+        bmin = bmax = verts[tri.v[0]];
+        for (int i = 1; i < 3; i++) {
+            const Vec3& p = verts[tri.v[i]];
+            bmin = Vec3(std::min(bmin.x, p.x), std::min(bmin.y, p.y), std::min(bmin.z, p.z));
+            bmax = Vec3(std::max(bmax.x, p.x), std::max(bmax.y, p.y), std::max(bmax.z, p.z));
+        }
+    }
+
+    // returns distance to nearest hit or 0
+    Dual2<float> intersect_triangle(const Ray& r, int tri, bool self) const {
+        if (self) return 0;
+        const Triangle& T = triangles[tri];
+        const Vec3& p0 = verts[T.v[0]];
+        const Vec3 e1 = verts[T.v[1]] - p0, e2 = verts[T.v[2]] - p0;
+        // Moller-Trumbore on the ray's value, to find whether it hits ...
+        const Vec3& d = r.direction.val();
+        Vec3 pvec = d.cross(e2);
+        float det = e1.dot(pvec);
+        if (det == 0)
+            return 0;
+        float invdet = 1 / det;
+        Vec3 tvec = r.origin.val() - p0;
+        float u = tvec.dot(pvec) * invdet;
+        if (u < 0 || u > 1)
+            return 0;
+        Vec3 qvec = tvec.cross(e1);
+        float v = d.dot(qvec) * invdet;
+        if (v < 0 || u + v > 1)
+            return 0;
+        // ... and then the distance, with derivatives, to its plane.
+        Vec3 n = e1.cross(e2);
+        return dot(p0 - r.origin, n) / dot(r.direction, n);
+    }
+
+    // The barycentric coordinates of p (which is on triangle tri) with
+    // respect to its second and third vertices.
+    void barycentric(const Dual2<Vec3>& p, int tri,
+                     Dual2<float>& b1, Dual2<float>& b2) const {
+        const Triangle& T = triangles[tri];
+        const Vec3& p0 = verts[T.v[0]];
+        const Vec3 e1 = verts[T.v[1]] - p0, e2 = verts[T.v[2]] - p0;
+        float d00 = e1.dot(e1), d01 = e1.dot(e2), d11 = e2.dot(e2);
+        float invdenom = 1 / (d00 * d11 - d01 * d01);
+        Dual2<Vec3>  h = p - p0;
+        Dual2<float> d20 = dot(h, e1), d21 = dot(h, e2);
+        b1 = (d11 * d20 - d01 * d21) * invdenom;
+        b2 = (d00 * d21 - d01 * d20) * invdenom;
+    }
+
+    // Interpolate per-vertex values a, b, c at barycentrics (b1, b2)
+    template<typename T>
+    static Dual2<T> lerp_tri(const T& a, const T& b, const T& c,
+                             const Dual2<float>& b1, const Dual2<float>& b2) {
+        const T ba = b - a, ca = c - a;
+        return Dual2<T>(a + ba * b1.val() + ca * b2.val(),
+                        ba * b1.dx() + ca * b2.dx(),
+                        ba * b1.dy() + ca * b2.dy());
+    }
+
+    // Build the BVH that intersect() traverses.  Call it once all the
+    // primitives have been added (see SimpleRaytracer::prepare_render).
+    void build_bvh();
+
     bool intersect(const Ray& r, Dual2<float>& t, int& primID) const {
         const int ns = spheres.size();
-        const int nq = quads.size();
+        const int nsq = ns + quads.size();
         const int self = primID; // remember which object we started from
         t = std::numeric_limits<float>::infinity();
         primID = -1; // reset ID
-        for (int i = 0; i < ns; i++) {
-            Dual2<float> d = spheres[i].intersect(r, self == i);
-            if (d.val() > 0 && d.val() < t.val()) { // found valid hit?
-                t = d;
-                primID = i;
+        if (bvh_nodes.empty())
+            return false;
+        const Vec3 org = r.origin.val();
+        const Vec3 invdir(1.0f / r.direction.val().x,
+                          1.0f / r.direction.val().y,
+                          1.0f / r.direction.val().z);
+        // Walk the tree nearest child first, skipping any node that starts
+        // beyond the closest hit found so far.
+        struct Entry { int node; float tnear; };
+        Entry stack[64];
+        int nstack = 0;
+        float tnear;
+        if (bvh_nodes[0].hit(org, invdir, t.val(), tnear))
+            stack[nstack++] = { 0, tnear };
+        while (nstack) {
+            const Entry e = stack[--nstack];
+            if (e.tnear >= t.val())
+                continue;
+            const BVHNode& node = bvh_nodes[e.node];
+            if (node.count) {
+                for (int i = node.first, end = node.first + node.count; i < end; i++) {
+                    const int id = bvh_prims[i];
+                    Dual2<float> d = id < ns
+                                   ? spheres[id].intersect(r, self == id)
+                                   : id < nsq
+                                   ? quads[id - ns].intersect(r, self == id)
+                                   : intersect_triangle(r, id - nsq, self == id);
+                    if (d.val() > 0 && d.val() < t.val()) { // found valid hit?
+                        t = d;
+                        primID = id;
+                    }
+                }
+                continue;
             }
-        }
-        for (int i = 0; i < nq; i++) {
-            Dual2<float> d = quads[i].intersect(r, self == (i + ns));
-            if (d.val() > 0 && d.val() < t.val()) { // found valid hit?
-                t = d;
-                primID = i + ns;
+            float t0, t1;
+            bool hit0 = bvh_nodes[node.first    ].hit(org, invdir, t.val(), t0);
+            bool hit1 = bvh_nodes[node.first + 1].hit(org, invdir, t.val(), t1);
+            // Push the farther child first, so the nearer one is next.
+            if (hit0 && hit1 && t0 < t1) {
+                stack[nstack++] = { node.first + 1, t1 };
+                stack[nstack++] = { node.first, t0 };
+            } else {
+                if (hit0)
+                    stack[nstack++] = { node.first, t0 };
+                if (hit1)
+                    stack[nstack++] = { node.first + 1, t1 };
             }
         }
         return primID >= 0;
     }
 
+    // Only called for lights, which triangles never are
     Vec3 sample(int primID, const Vec3& x, float xi, float yi, float& pdf) const {
         if (primID < int(spheres.size()))
             return spheres[primID].sample(x, xi, yi, pdf);
@@ -442,39 +573,118 @@ struct Scene {
         if (primID < int(spheres.size()))
             return spheres[primID].surfacearea();
         primID -= spheres.size();
-        return quads[primID].surfacearea();
+        if (primID < int(quads.size()))
+            return quads[primID].surfacearea();
+        const Triangle& T = triangles[primID - quads.size()];
+        const Vec3& p0 = verts[T.v[0]];
+        return 0.5f * (verts[T.v[1]] - p0).cross(verts[T.v[2]] - p0).length();
     }
 
+    // The shading normal, interpolated from a mesh's vertex normals
     Dual2<Vec3> normal(const Dual2<Vec3>& p, int primID) const {
         if (primID < int(spheres.size()))
             return spheres[primID].normal(p);
         primID -= spheres.size();
-        return quads[primID].normal(p);
+        if (primID < int(quads.size()))
+            return quads[primID].normal(p);
+        int tri = primID - quads.size();
+        const Triangle& T = triangles[tri];
+        if (T.n[0] < 0)
+            return Dual2<Vec3>(geometric_normal(tri), Vec3(0, 0, 0), Vec3(0, 0, 0));
+        Dual2<float> b1, b2;
+        barycentric(p, tri, b1, b2);
+        return normalize(lerp_tri(normals[T.n[0]], normals[T.n[1]],
+                                  normals[T.n[2]], b1, b2));
+    }
+
+    // The true normal of a triangle
+    Vec3 geometric_normal(int tri) const {
+        const Triangle& T = triangles[tri];
+        const Vec3& p0 = verts[T.v[0]];
+        return (verts[T.v[1]] - p0).cross(verts[T.v[2]] - p0).normalize();
     }
 
     Dual2<Vec2> uv(const Dual2<Vec3>& p, const Dual2<Vec3>& n, Vec3& dPdu, Vec3& dPdv, int primID) const {
         if (primID < int(spheres.size()))
             return spheres[primID].uv(p, n, dPdu, dPdv);
         primID -= spheres.size();
-        return quads[primID].uv(p, n, dPdu, dPdv);
+        if (primID < int(quads.size()))
+            return quads[primID].uv(p, n, dPdu, dPdv);
+        int tri = primID - quads.size();
+        const Triangle& T = triangles[tri];
+        const Vec3& p0 = verts[T.v[0]];
+        const Vec3 e1 = verts[T.v[1]] - p0, e2 = verts[T.v[2]] - p0;
+        Dual2<float> b1, b2;
+        barycentric(p, tri, b1, b2);
+        if (T.t[0] >= 0) {
+            // Solve for the uv parameterization's tangents
+            const Vec2& t0 = uvs[T.t[0]];
+            const Vec2 d1 = uvs[T.t[1]] - t0, d2 = uvs[T.t[2]] - t0;
+            float det = d1.x * d2.y - d1.y * d2.x;
+            if (det != 0) {
+                float invdet = 1 / det;
+                dPdu = (e1 * d2.y - e2 * d1.y) * invdet;
+                dPdv = (e2 * d1.x - e1 * d2.x) * invdet;
+                return lerp_tri(t0, uvs[T.t[1]], uvs[T.t[2]], b1, b2);
+            }
+        }
+        // No (or degenerate) uvs: use the barycentrics
+        dPdu = e1;
+        dPdv = e2;
+        return make_Vec2(b1, b2);
     }
 
     int shaderid(int primID) const {
         if (primID < int(spheres.size()))
             return spheres[primID].shaderid();
         primID -= spheres.size();
-        return quads[primID].shaderid();
+        if (primID < int(quads.size()))
+            return quads[primID].shaderid();
+        return triangles[primID - quads.size()].shaderID;
     }
 
     bool islight(int primID) const {
         if (primID < int(spheres.size()))
             return spheres[primID].islight();
         primID -= spheres.size();
-        return quads[primID].islight();
-    }
+        if (primID < int(quads.size()))
+            return quads[primID].islight();
+        return false;
+    }
+
+    // A node of the BVH: a leaf holds count primitives, starting at
+    // bvh_prims[first]; an interior node (count == 0) has its two
+    // children at bvh_nodes[first] and bvh_nodes[first + 1].
+    struct BVHNode {
+        Vec3 bmin, bmax;
+        int first;
+        int count;
+
+        // Does the ray enter the box before tmax?  If so, when (clamped
+        // to start at 0).
+        bool hit(const Vec3& org, const Vec3& invdir, float tmax,
+                 float& tnear) const {
+            float tx0 = (bmin.x - org.x) * invdir.x, tx1 = (bmax.x - org.x) * invdir.x;
+            float ty0 = (bmin.y - org.y) * invdir.y, ty1 = (bmax.y - org.y) * invdir.y;
+            float tz0 = (bmin.z - org.z) * invdir.z, tz1 = (bmax.z - org.z) * invdir.z;
+            tnear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)),
+                             std::max(std::min(tz0, tz1), 0.0f));
+            float tfar = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)),
+                                  std::min(std::max(tz0, tz1), tmax));
+            return tnear <= tfar;
+        }
+    };
 
     std::vector<Sphere> spheres;
     std::vector<Quad> quads;
+    std::vector<Triangle> triangles;
+    // Vertex data of all the meshes, as separate arrays
+    std::vector<Vec3> verts;
+    std::vector<Color3> colors;  // empty, or one per vertex
+    std::vector<Vec3> normals;
+    std::vector<Vec2> uvs;
+    std::vector<BVHNode> bvh_nodes;
+    std::vector<int> bvh_prims;  // primitive IDs, grouped by leaf
 #ifdef OSL_USE_OPTIX
 #if (OPTIX_VERSION < 70000)
     std::vector<optix::Material> optix_mtls;
@@ -1,6 +1,33 @@
 #pragma once
 
 #if (OPTIX_VERSION >= 70000)
+
+// How the hits of a launch are handed to their shader groups
+enum GPUShadeMode {
+    SHADE_IN_HIT  = 0,  // in the closest-hit program, in launch order
+    SHADE_QUEUE   = 1,  // record hits, bin them by group, then shade them
+                        // in a second launch that runs each group's hits
+                        // back to back
+    SHADE_REORDER = 2   // shader execution reordering by group (OptiX 8+)
+};
+
+// What the shading of a hit needs, recorded by the closest-hit program in
+// SHADE_QUEUE mode
+struct ShadingHit
+{
+    float3 P;
+    float3 N;
+    float3 Ng;
+    float3 I;
+    float3 dPdu;
+    float3 dPdv;
+    float  u;
+    float  v;
+    float  surfacearea;
+    int    backfacing;
+    int    shaderID;
+};
+
 struct RenderParams
 {
     float3 bad_color;
@@ -26,10 +53,31 @@ struct RenderParams
     uint64_t    num_named_xforms;
     CUdeviceptr xform_name_buffer;
     CUdeviceptr xform_buffer;
+    uint64_t    num_pointclouds;
+    CUdeviceptr pointcloud_name_buffer;
+    CUdeviceptr pointcloud_buffer;
 
     // for used-data tests
     uint64_t test_str_1;
     uint64_t test_str_2;
+
+    // Closure and heap ("groupdata") storage, one stride-sized slice per
+    // launch index, sized to the needs of the largest shader group
+    CUdeviceptr closure_pool;
+    CUdeviceptr heap_pool;
+    uint64_t    closure_pool_stride;
+    uint64_t    heap_pool_stride;
+
+    // Execution ordering of the shading (see GPUShadeMode). When nonzero,
+    // shader_ids gets each pixel's shader group (-1 for a miss) for the
+    // coherence statistics and the queue's binning; hits and shade_order
+    // are the recorded hits and the pixels to shade, grouped by shader,
+    // of the SHADE_QUEUE pass.
+    int          shade_mode;
+    unsigned int reorder_hint_bits;
+    CUdeviceptr  shader_ids;
+    CUdeviceptr  hits;
+    CUdeviceptr  shade_order;
 };
 
 struct PrimitiveParams {
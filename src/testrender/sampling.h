@@ -9,6 +9,7 @@
 #include <OpenImageIO/hash.h>
 #include <algorithm>
 #include <cmath>
+#include <vector>
 
 OSL_NAMESPACE_ENTER
 
@@ -252,4 +253,76 @@ private:
 };
 
 
+// Picks one of n items, each with probability proportional to its weight,
+// in constant time (Walker's alias method, with Vose's construction).
+struct AliasTable {
+    void build(const std::vector<float>& weights) {
+        int n = int(weights.size());
+        prob.assign(n, 0.0f);
+        alias.assign(n, 0);
+        pdfs.assign(n, 0.0f);
+        double total = 0;
+        for (float w : weights) total += w;
+        if (!(total > 0)) {
+            prob.clear();
+            alias.clear();
+            pdfs.clear();
+            return;
+        }
+        // split into items with less than and more than the average weight
+        std::vector<int> small, large;
+        std::vector<double> scaled(n);
+        for (int i = 0; i < n; i++) {
+            pdfs[i] = float(weights[i] / total);
+            scaled[i] = weights[i] * n / total;
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+        // each small item shares its slot with (part of) a large one
+        while (!small.empty() && !large.empty()) {
+            int s = small.back();
+            small.pop_back();
+            int l = large.back();
+            prob[s] = float(scaled[s]);
+            alias[s] = l;
+            scaled[l] -= 1 - scaled[s];
+            if (scaled[l] < 1) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // what's left is 1 up to rounding
+        for (int i : small) { prob[i] = 1; alias[i] = i; }
+        for (int i : large) { prob[i] = 1; alias[i] = i; }
+    }
+
+    bool empty() const { return prob.empty(); }
+
+    // probability of picking item i
+    float pdf(int i) const { return pdfs[i]; }
+
+    // pick an item with xi in [0,1), which is remapped to [0,1) again so
+    // that it can be reused to sample the item itself
+    int sample(float& xi, float& pdf) const {
+        int n = int(prob.size());
+        float x = xi * n;
+        int i = std::min(int(x), n - 1);
+        float u = x - i;
+        if (u < prob[i]) {
+            xi = u / prob[i];
+        } else {
+            xi = (u - prob[i]) / (1 - prob[i]);
+            i = alias[i];
+        }
+        xi = std::min(xi, 0.99999994f); // keep result in [0,1)
+        pdf = pdfs[i];
+        return i;
+    }
+
+private:
+    std::vector<float> prob;  // chance of keeping a slot's own item
+    std::vector<int> alias;   // the item that fills out the rest of it
+    std::vector<float> pdfs;
+};
+
+
 OSL_NAMESPACE_EXIT
@@ -5,6 +5,7 @@
 
 #include "shading.h"
 #include "sampling.h"
+#include <OSL/closure_flatten.h>
 #include <OSL/genclosure.h>
 #include "optics.h"
 
@@ -652,91 +653,91 @@ struct Transparent final : public BSDF {
 };
 
 
-// recursively walk through the closure tree, creating bsdfs as we go
-void process_closure (ShadingResult& result, const ClosureColor* closure, const Color3& w, bool light_only) {
+// Add the bsdf for one closure component to 'bsdfs', which is either a
+// CompositeBSDF or a BSDFSizer
+template <typename BSDFs>
+bool add_bsdf(BSDFs& bsdfs, const ClosureComponent* comp, const Color3& cw) {
    static const ustring u_ggx("ggx");
    static const ustring u_beckmann("beckmann");
    static const ustring u_default("default");
-   if (!closure)
-       return;
-   switch (closure->id) {
-       case ClosureColor::MUL: {
-           Color3 cw = w * closure->as_mul()->weight;
-           process_closure(result, closure->as_mul()->closure, cw, light_only);
-           break;
-       }
-       case ClosureColor::ADD: {
-           process_closure(result, closure->as_add()->closureA, w, light_only);
-           process_closure(result, closure->as_add()->closureB, w, light_only);
-           break;
-       }
-       default: {
-           const ClosureComponent* comp = closure->as_comp();
-           Color3 cw = w * comp->w;
-           if (comp->id == EMISSION_ID)
-               result.Le += cw;
-           else if (!light_only) {
-               bool ok = false;
-               switch (comp->id) {
-                   case DIFFUSE_ID:            ok = result.bsdf.add_bsdf<Diffuse<0>, DiffuseParams   >(cw, *comp->as<DiffuseParams>  ()); break;
-                   case OREN_NAYAR_ID:         ok = result.bsdf.add_bsdf<OrenNayar , OrenNayarParams >(cw, *comp->as<OrenNayarParams>()); break;
-                   case TRANSLUCENT_ID:        ok = result.bsdf.add_bsdf<Diffuse<1>, DiffuseParams   >(cw, *comp->as<DiffuseParams>  ()); break;
-                   case PHONG_ID:              ok = result.bsdf.add_bsdf<Phong     , PhongParams     >(cw, *comp->as<PhongParams>    ()); break;
-                   case WARD_ID:               ok = result.bsdf.add_bsdf<Ward      , WardParams      >(cw, *comp->as<WardParams>     ()); break;
-                   case MICROFACET_ID: {
-                       const MicrofacetParams* mp = comp->as<MicrofacetParams>();
-                       if (mp->dist == u_ggx) {
-                           switch (mp->refract) {
-                               case 0: ok = result.bsdf.add_bsdf<MicrofacetGGXRefl, MicrofacetParams>(cw, *mp); break;
-                               case 1: ok = result.bsdf.add_bsdf<MicrofacetGGXRefr, MicrofacetParams>(cw, *mp); break;
-                               case 2: ok = result.bsdf.add_bsdf<MicrofacetGGXBoth, MicrofacetParams>(cw, *mp); break;
-                           }
-                       } else if (mp->dist == u_beckmann || mp->dist == u_default) {
-                           switch (mp->refract) {
-                               case 0: ok = result.bsdf.add_bsdf<MicrofacetBeckmannRefl, MicrofacetParams>(cw, *mp); break;
-                               case 1: ok = result.bsdf.add_bsdf<MicrofacetBeckmannRefr, MicrofacetParams>(cw, *mp); break;
-                               case 2: ok = result.bsdf.add_bsdf<MicrofacetBeckmannBoth, MicrofacetParams>(cw, *mp); break;
-                           }
-                       }
-                       break;
-                   }
-                   case REFLECTION_ID:
-                   case FRESNEL_REFLECTION_ID: ok = result.bsdf.add_bsdf<Reflection , ReflectionParams>(cw, *comp->as<ReflectionParams>()); break;
-                   case REFRACTION_ID:         ok = result.bsdf.add_bsdf<Refraction , RefractionParams>(cw, *comp->as<RefractionParams>()); break;
-                   case TRANSPARENT_ID:        ok = result.bsdf.add_bsdf<Transparent, int             >(cw, 0); break;
+   switch (comp->id) {
+       case DIFFUSE_ID:            return bsdfs.template add_bsdf<Diffuse<0>, DiffuseParams   >(cw, *comp->as<DiffuseParams>  ());
+       case OREN_NAYAR_ID:         return bsdfs.template add_bsdf<OrenNayar , OrenNayarParams >(cw, *comp->as<OrenNayarParams>());
+       case TRANSLUCENT_ID:        return bsdfs.template add_bsdf<Diffuse<1>, DiffuseParams   >(cw, *comp->as<DiffuseParams>  ());
+       case PHONG_ID:              return bsdfs.template add_bsdf<Phong     , PhongParams     >(cw, *comp->as<PhongParams>    ());
+       case WARD_ID:               return bsdfs.template add_bsdf<Ward      , WardParams      >(cw, *comp->as<WardParams>     ());
+       case MICROFACET_ID: {
+           const MicrofacetParams* mp = comp->as<MicrofacetParams>();
+           if (mp->dist == u_ggx) {
+               switch (mp->refract) {
+                   case 0: return bsdfs.template add_bsdf<MicrofacetGGXRefl, MicrofacetParams>(cw, *mp);
+                   case 1: return bsdfs.template add_bsdf<MicrofacetGGXRefr, MicrofacetParams>(cw, *mp);
+                   case 2: return bsdfs.template add_bsdf<MicrofacetGGXBoth, MicrofacetParams>(cw, *mp);
+               }
+           } else if (mp->dist == u_beckmann || mp->dist == u_default) {
+               switch (mp->refract) {
+                   case 0: return bsdfs.template add_bsdf<MicrofacetBeckmannRefl, MicrofacetParams>(cw, *mp);
+                   case 1: return bsdfs.template add_bsdf<MicrofacetBeckmannRefr, MicrofacetParams>(cw, *mp);
+                   case 2: return bsdfs.template add_bsdf<MicrofacetBeckmannBoth, MicrofacetParams>(cw, *mp);
                }
-               OSL_ASSERT(ok && "Invalid closure invoked in surface shader");
            }
-           break;
+           return false;
        }
+       case REFLECTION_ID:
+       case FRESNEL_REFLECTION_ID: return bsdfs.template add_bsdf<Reflection , ReflectionParams>(cw, *comp->as<ReflectionParams>());
+       case REFRACTION_ID:         return bsdfs.template add_bsdf<Refraction , RefractionParams>(cw, *comp->as<RefractionParams>());
+       case TRANSPARENT_ID:        return bsdfs.template add_bsdf<Transparent, int             >(cw, 0);
    }
+   return false;
 }
 
+// Stands in for a CompositeBSDF to add up how much room the bsdfs of a
+// closure need
+struct BSDFSizer {
+    int num_bsdfs = 0;
+    size_t num_bytes = 0;
+
+    template <typename BSDF_Type, typename BSDF_Params>
+    bool add_bsdf(const Color3& /*w*/, const BSDF_Params& /*params*/) {
+        num_bsdfs++;
+        num_bytes += sizeof(BSDF_Type);
+        return true;
+    }
+};
+
 } // anonymous namespace
 
 OSL_NAMESPACE_ENTER
 
 void process_closure(ShadingResult& result, const ClosureColor* Ci, bool light_only) {
-    ::process_closure(result, Ci, Color3(1, 1, 1), light_only);
+    if (!light_only) {
+        // size the bsdf's storage for all of the closure's components first,
+        // so that none of them have to be left out
+        BSDFSizer sizer;
+        foreach_closure_component(Ci, [&](const ClosureComponent* comp, const Color3& cw) {
+            if (comp->id != EMISSION_ID)
+                add_bsdf(sizer, comp, cw);
+        });
+        result.bsdf.reserve(sizer.num_bsdfs, sizer.num_bytes);
+    }
+    foreach_closure_component(Ci, [&](const ClosureComponent* comp, const Color3& cw) {
+        if (comp->id == EMISSION_ID)
+            result.Le += cw;
+        else if (!light_only) {
+            bool ok = add_bsdf(result.bsdf, comp, cw);
+            OSL_ASSERT(ok && "Invalid closure invoked in surface shader");
+        }
+    });
 }
 
 Vec3 process_background_closure(const ClosureColor* closure) {
-    if (!closure) return Vec3(0, 0, 0);
-    switch (closure->id) {
-           case ClosureColor::MUL: {
-               return closure->as_mul()->weight * process_background_closure(closure->as_mul()->closure);
-           }
-           case ClosureColor::ADD: {
-               return process_background_closure(closure->as_add()->closureA) +
-                      process_background_closure(closure->as_add()->closureB);
-           }
-           case BACKGROUND_ID: {
-               return closure->as_comp()->w;
-           }
-    }
-    // should never happen
-    OSL_ASSERT(false && "Invalid closure invoked in background shader");
-    return Vec3(0, 0, 0);
+    Vec3 result(0, 0, 0);
+    foreach_closure_component(closure, [&](const ClosureComponent* comp, const Color3& cw) {
+        // should never happen
+        OSL_ASSERT(comp->id == BACKGROUND_ID && "Invalid closure invoked in background shader");
+        result += cw;
+    });
+    return result;
 }
 
 
@@ -10,6 +10,7 @@
 #include <OSL/oslexec.h>
 #include <OSL/oslclosure.h>
 #include <OSL/oslconfig.h>
+#include <memory>
 
 
 OSL_NAMESPACE_ENTER
@@ -27,7 +28,30 @@ struct BSDF {
 /// NOTE: no need to inherit from BSDF here because we use a "flattened" representation and therefore never nest these
 ///
 struct CompositeBSDF {
-    CompositeBSDF() : num_bsdfs(0), num_bytes(0) {}
+    CompositeBSDF()
+        : weights(inline_weights), pdfs(inline_pdfs), bsdfs(inline_bsdfs),
+          pool(inline_pool), max_bsdfs(InlineEntries), max_bytes(InlineSize),
+          num_bsdfs(0), num_bytes(0) {}
+
+    /// Make room for n bsdfs of up to size bytes in all.  Only shading
+    /// points with more than fit inline pay for a heap allocation.
+    void reserve(int n, size_t size) {
+        OSL_DASSERT(num_bsdfs == 0);
+        if (n > max_bsdfs) {
+            heap_weights.reset(new Color3[n]);
+            heap_pdfs.reset(new float[n]);
+            heap_bsdfs.reset(new BSDF*[n]);
+            weights = heap_weights.get();
+            pdfs = heap_pdfs.get();
+            bsdfs = heap_bsdfs.get();
+            max_bsdfs = n;
+        }
+        if (size > max_bytes) {
+            heap_pool.reset(new char[size]);
+            pool = heap_pool.get();
+            max_bytes = size;
+        }
+    }
 
     void prepare(const ShaderGlobals& sg, const Color3& path_weight, bool absorb) {
         float w = 1 / (path_weight.x + path_weight.y + path_weight.z);
@@ -77,8 +101,8 @@ struct CompositeBSDF {
     template <typename BSDF_Type, typename BSDF_Params>
     bool add_bsdf(const Color3& w, const BSDF_Params& params) {
         // make sure we have enough space
-        if (num_bsdfs >= MaxEntries) return false;
-        if (num_bytes + sizeof(BSDF_Type) > MaxSize) return false;
+        if (num_bsdfs >= max_bsdfs) return false;
+        if (num_bytes + sizeof(BSDF_Type) > max_bytes) return false;
         weights[num_bsdfs] = w;
         bsdfs  [num_bsdfs] = new (pool + num_bytes) BSDF_Type(params);
         num_bsdfs++;
@@ -91,14 +115,26 @@ private:
     CompositeBSDF(const CompositeBSDF& c);
     CompositeBSDF& operator=(const CompositeBSDF& c);
 
-    enum { MaxEntries = 8 };
-    enum { MaxSize = 256 * sizeof(float) };
-
-    Color3 weights[MaxEntries];
-    float  pdfs[MaxEntries];
-    BSDF*  bsdfs[MaxEntries];
-    char   pool[MaxSize];
-    int    num_bsdfs, num_bytes;
+    enum { InlineEntries = 8 };
+    enum { InlineSize = 256 * sizeof(float) };
+
+    Color3* weights;
+    float*  pdfs;
+    BSDF**  bsdfs;
+    char*   pool;
+    int     max_bsdfs;
+    size_t  max_bytes;
+    int     num_bsdfs;
+    size_t  num_bytes;
+
+    Color3 inline_weights[InlineEntries];
+    float  inline_pdfs[InlineEntries];
+    BSDF*  inline_bsdfs[InlineEntries];
+    alignas(16) char inline_pool[InlineSize];
+    std::unique_ptr<Color3[]> heap_weights;
+    std::unique_ptr<float[]>  heap_pdfs;
+    std::unique_ptr<BSDF*[]>  heap_bsdfs;
+    std::unique_ptr<char[]>   heap_pool;
 };
 
 struct ShadingResult {
@@ -2,8 +2,15 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 #include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/parallel.h>
+#include <OpenImageIO/strutil.h>
+#include <OpenImageIO/thread.h>
+#include <OpenImageIO/timer.h>
 
 #include <pugixml.hpp>
 
@@ -14,6 +21,10 @@ namespace pugi = OIIO::pugi;
 #include "simpleraytracer.h"
 #include "raytracer.h"
 #include "shading.h"
+
+#if OSL_USE_BATCHED
+#   include <OSL/batched_shaderglobals.h>
+#endif
 using namespace OSL;
 
 OSL_NAMESPACE_ENTER
@@ -21,7 +32,7 @@ OSL_NAMESPACE_ENTER
 static ustring u_camera("camera"), u_screen("screen");
 static ustring u_NDC("NDC"), u_raster("raster");
 static ustring u_perspective("perspective");
-static ustring u_s("s"), u_t("t");
+static ustring u_s("s"), u_t("t"), u_Cd("Cd");
 static TypeDesc TypeFloatArray2 (TypeDesc::FLOAT, 2);
 static TypeDesc TypeFloatArray4 (TypeDesc::FLOAT, 4);
 static TypeDesc TypeIntArray2 (TypeDesc::INT, 2);
@@ -50,6 +61,11 @@ private:
 
 
 SimpleRaytracer::SimpleRaytracer ()
+#if OSL_USE_BATCHED
+: m_batch_16_raytracer(*this)
+, m_batch_8_raytracer(*this)
+, m_batch_4_raytracer(*this)
+#endif
 {
     m_errhandler.reset(new SimpleRaytracer::ErrorHandler(*this));
 
@@ -304,6 +320,14 @@ SimpleRaytracer::parse_scene_xml(const std::string& scenefile)
                 Vec3 ey = strtovec(edge_y_attr.value());
                 scene.add_quad(Quad(co, ex, ey, int(shaders().size()) - 1, is_light));
             }
+        } else if (strcmp(node.name(), "Mesh") == 0) {
+            // load triangle mesh from an OBJ file
+            pugi::xml_attribute filename_attr = node.attribute("filename");
+            std::string err;
+            if (filename_attr
+                && !scene.add_obj(filename_attr.value(),
+                                  int(shaders().size()) - 1, err))
+                errhandler().errorfmt("{}", err);
         } else if (strcmp(node.name(), "Background") == 0) {
             pugi::xml_attribute res_attr = node.attribute("resolution");
             if (res_attr)
@@ -568,6 +592,23 @@ SimpleRaytracer::get_userdata (bool derivatives, ustring name, TypeDesc type,
         }
         return true;
     }
+    // Meshes with vertex colors give them, interpolated, as "Cd".
+    if (name == u_Cd && type == TypeDesc::TypeColor && sg->objdata
+        && !scene.colors.empty()) {
+        int tri = int((const Triangle*)sg->objdata - scene.triangles.data());
+        const Triangle& T = scene.triangles[tri];
+        Dual2<float> b1, b2;
+        scene.barycentric(Dual2<Vec3>(sg->P, sg->dPdx, sg->dPdy), tri, b1, b2);
+        Dual2<Color3> Cd = Scene::lerp_tri(scene.colors[T.v[0]],
+                                           scene.colors[T.v[1]],
+                                           scene.colors[T.v[2]], b1, b2);
+        ((Color3 *)val)[0] = Cd.val();
+        if (derivatives) {
+            ((Color3 *)val)[1] = Cd.dx();
+            ((Color3 *)val)[2] = Cd.dy();
+        }
+        return true;
+    }
 
     return false;
 }
@@ -754,6 +795,15 @@ SimpleRaytracer::globals_from_hit(ShaderGlobals& sg, const Ray& r,
     sg.P = P.val(); sg.dPdx = P.dx(); sg.dPdy = P.dy();
     Dual2<Vec3> N = scene.normal(P, id);
     sg.Ng = sg.N = N.val();
+    int tri = scene.triangle(id);
+    if (tri >= 0) {
+        // Meshes have a shading normal apart from the true one, and keep
+        // their triangle where get_userdata can find it.
+        sg.Ng = scene.geometric_normal(tri);
+        if (sg.Ng.dot(sg.N) < 0)
+            sg.Ng = -sg.Ng;
+        sg.objdata = (void*)&scene.triangles[tri];
+    }
     Dual2<Vec2> uv = scene.uv(P, N, sg.dPdu, sg.dPdv, id);
     sg.u = uv.val().x; sg.dudx = uv.dx().x; sg.dudy = uv.dy().x;
     sg.v = uv.val().y; sg.dvdx = uv.dx().y; sg.dvdy = uv.dy().y;
@@ -824,7 +874,7 @@ Color3 SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler, Sh
         float k = 1;
         if (scene.islight(id)) {
             // figure out the probability of reaching this point
-            float light_pdf = scene.shapepdf(id, r.origin.val(), sg.P);
+            float light_pdf = scene.shapepdf(id, r.origin.val(), sg.P) * light_pick_pdf(id);
             k = MIS::power_heuristic<MIS::WEIGHT_EVAL>(bsdf_pdf, light_pdf);
         }
         path_radiance += path_weight * k * result.Le;
@@ -857,15 +907,13 @@ Color3 SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler, Sh
             }
         }
 
-        // trace one ray to each light
-        for (int lid = 0; lid < scene.num_prims(); lid++) {
-            if (lid == id) continue; // skip self
-            if (!scene.islight(lid)) continue; // doesn't want to be sampled as a light
+        // trace one ray to each light (or to one picked at random)
+        foreach_light_sample(id, xi, [&](int lid, float lxi, float pick_pdf) {
             int shaderID = scene.shaderid(lid);
-            if (shaderID < 0 || !m_shaders[shaderID]) continue; // no shader attached to this light
             // sample a random direction towards the object
             float light_pdf;
-            Vec3 ldir = scene.sample(lid, sg.P, xi, yi, light_pdf);
+            Vec3 ldir = scene.sample(lid, sg.P, lxi, yi, light_pdf);
+            light_pdf *= pick_pdf;
             float bsdf_pdf = 0;
             Color3 bsdf_weight = result.bsdf.eval(sg, ldir, bsdf_pdf);
             Color3 contrib = path_weight * bsdf_weight * MIS::power_heuristic<MIS::EVAL_WEIGHT>(light_pdf, bsdf_pdf);
@@ -887,7 +935,7 @@ Color3 SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler, Sh
                     path_radiance += contrib * light_result.Le;
                 }
             }
-        }
+        });
 
         // trace indirect ray and continue
         path_weight *= result.bsdf.sample(sg, xi, yi, zi, r.direction, bsdf_pdf);
@@ -900,18 +948,23 @@ Color3 SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler, Sh
     return path_radiance;
 }
 
+Color3 SimpleRaytracer::pixel_sample(int x, int y, int si, ShadingContext* ctx)
+{
+    Sampler sampler(x, y, si);
+    // jitter pixel coordinate [0,1)^2
+    Vec3 j = sampler.get();
+    // warp distribution to approximate a tent filter [-1,+1)^2
+    j.x *= 2; j.x = j.x < 1 ? sqrtf(j.x) - 1 : 1 - sqrtf(2 - j.x);
+    j.y *= 2; j.y = j.y < 1 ? sqrtf(j.y) - 1 : 1 - sqrtf(2 - j.y);
+    // trace eye ray (apply jitter from center of the pixel)
+    return subpixel_radiance(x + 0.5f + j.x, y + 0.5f + j.y, sampler, ctx);
+}
+
 Color3 SimpleRaytracer::antialias_pixel(int x, int y, ShadingContext* ctx)
 {
     Color3 result(0, 0, 0);
     for (int si = 0, n = aa * aa; si < n; si++) {
-        Sampler sampler(x, y, si);
-        // jitter pixel coordinate [0,1)^2
-        Vec3 j = sampler.get();
-        // warp distribution to approximate a tent filter [-1,+1)^2
-        j.x *= 2; j.x = j.x < 1 ? sqrtf(j.x) - 1 : 1 - sqrtf(2 - j.x);
-        j.y *= 2; j.y = j.y < 1 ? sqrtf(j.y) - 1 : 1 - sqrtf(2 - j.y);
-        // trace eye ray (apply jitter from center of the pixel)
-        Color3 r = subpixel_radiance(x + 0.5f + j.x, y + 0.5f + j.y, sampler, ctx);
+        Color3 r = pixel_sample(x, y, si, ctx);
         // mix in result via lerp for numerical stability
         result = OIIO::lerp(result, r, 1.0f / (si + 1));
     }
@@ -919,6 +972,303 @@ Color3 SimpleRaytracer::antialias_pixel(int x, int y, ShadingContext* ctx)
 }
 
 
+namespace {
+
+// Builds a Scene's BVH top-down, splitting each node where a binned
+// surface area heuristic says it's cheapest.  Each call of build() owns a
+// disjoint range of prims and gets its nodes from an atomic counter, so
+// the big subtrees near the root are built on their own threads.
+struct BVHBuilder {
+    typedef Scene::BVHNode BVHNode;
+    static const int nbins = 16;
+    static const int max_depth = 48;     // well within intersect()'s stack
+    static const int parallel_depth = 4; // up to 16 threads
+
+    std::vector<BVHNode>& nodes;
+    std::vector<int>& prims;
+    std::vector<Vec3> pmin, pmax, centroid;  // per primitive
+    std::atomic<int> nnodes {1};
+
+    BVHBuilder (const Scene& scene, std::vector<BVHNode>& nodes,
+                std::vector<int>& prims)
+        : nodes(nodes), prims(prims)
+    {
+        int n = scene.num_prims();
+        pmin.resize (n);
+        pmax.resize (n);
+        centroid.resize (n);
+        prims.resize (n);
+        // A full binary tree with n leaves has 2n-1 nodes.
+        nodes.resize (std::max (1, 2 * n - 1));
+        OIIO::parallel_for (0, n, [&](int64_t i) {
+            scene.getBounds (int(i), pmin[i], pmax[i]);
+            centroid[i] = 0.5f * (pmin[i] + pmax[i]);
+            prims[i] = int(i);
+        });
+    }
+
+    static float area (const Vec3& bmin, const Vec3& bmax) {
+        Vec3 d = bmax - bmin;
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    void build (int nodeindex, int begin, int end, int depth)
+    {
+        BVHNode& node (nodes[nodeindex]);
+        Vec3 cmin, cmax;
+        node.bmin = cmin = Vec3(std::numeric_limits<float>::max());
+        node.bmax = cmax = Vec3(-std::numeric_limits<float>::max());
+        for (int i = begin; i < end; ++i) {
+            int p = prims[i];
+            node.bmin.x = std::min (node.bmin.x, pmin[p].x);
+            node.bmin.y = std::min (node.bmin.y, pmin[p].y);
+            node.bmin.z = std::min (node.bmin.z, pmin[p].z);
+            node.bmax.x = std::max (node.bmax.x, pmax[p].x);
+            node.bmax.y = std::max (node.bmax.y, pmax[p].y);
+            node.bmax.z = std::max (node.bmax.z, pmax[p].z);
+            cmin.x = std::min (cmin.x, centroid[p].x);
+            cmin.y = std::min (cmin.y, centroid[p].y);
+            cmin.z = std::min (cmin.z, centroid[p].z);
+            cmax.x = std::max (cmax.x, centroid[p].x);
+            cmax.y = std::max (cmax.y, centroid[p].y);
+            cmax.z = std::max (cmax.z, centroid[p].z);
+        }
+        node.first = begin;
+        node.count = end - begin;
+        if (node.count <= 2 || depth >= max_depth)
+            return;
+
+        // Bin the centroids along the axis where they're most spread out.
+        Vec3 extent = cmax - cmin;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                       : (extent.y > extent.z ? 1 : 2);
+        if (extent[axis] <= 0.0f)
+            return;  // all centered at the same point, can't split them
+        float scale = nbins / extent[axis];
+        auto bin = [&](int p) {
+            return std::min (nbins - 1,
+                             int((centroid[p][axis] - cmin[axis]) * scale));
+        };
+        int count[nbins] = {};
+        Vec3 bmin[nbins], bmax[nbins];
+        for (int b = 0; b < nbins; ++b) {
+            bmin[b] = Vec3(std::numeric_limits<float>::max());
+            bmax[b] = Vec3(-std::numeric_limits<float>::max());
+        }
+        for (int i = begin; i < end; ++i) {
+            int p = prims[i], b = bin(p);
+            ++count[b];
+            for (int c = 0; c < 3; ++c) {
+                bmin[b][c] = std::min (bmin[b][c], pmin[p][c]);
+                bmax[b][c] = std::max (bmax[b][c], pmax[p][c]);
+            }
+        }
+
+        // Sweep from the right for the cost of everything past each split,
+        // then from the left for the best split.  Costs are relative to
+        // intersecting one primitive, with a traversal step costing one too.
+        float rightcost[nbins];
+        Vec3 lo(std::numeric_limits<float>::max()), hi(-lo);
+        for (int b = nbins - 1, n = 0; b > 0; --b) {
+            n += count[b];
+            for (int c = 0; c < 3; ++c) {
+                lo[c] = std::min (lo[c], bmin[b][c]);
+                hi[c] = std::max (hi[c], bmax[b][c]);
+            }
+            rightcost[b] = n ? n * area (lo, hi) : 0.0f;
+        }
+        float bestcost = node.count * area (node.bmin, node.bmax);
+        int bestsplit = -1;
+        lo = Vec3(std::numeric_limits<float>::max());
+        hi = -lo;
+        for (int b = 0, n = 0; b < nbins - 1; ++b) {
+            n += count[b];
+            for (int c = 0; c < 3; ++c) {
+                lo[c] = std::min (lo[c], bmin[b][c]);
+                hi[c] = std::max (hi[c], bmax[b][c]);
+            }
+            float cost = area (node.bmin, node.bmax)
+                         + (n ? n * area (lo, hi) : 0.0f) + rightcost[b + 1];
+            if (n && n < node.count && cost < bestcost) {
+                bestcost = cost;
+                bestsplit = b;
+            }
+        }
+        if (bestsplit < 0)
+            return;  // cheaper to just test them all
+
+        int* mid = std::partition (&prims[begin], &prims[0] + end,
+                                   [&](int p) { return bin(p) <= bestsplit; });
+        int split = int(mid - &prims[0]);
+        int children = nnodes.fetch_add (2);
+        node.first = children;
+        node.count = 0;
+        if (depth < parallel_depth && end - begin > 4096) {
+            std::thread left ([=]() { build (children, begin, split, depth + 1); });
+            build (children + 1, split, end, depth + 1);
+            left.join ();
+        } else {
+            build (children, begin, split, depth + 1);
+            build (children + 1, split, end, depth + 1);
+        }
+    }
+};
+
+}  // anonymous namespace
+
+
+
+bool
+Scene::add_obj (const std::string& filename, int shaderID, std::string& err)
+{
+    std::string text;
+    if (! OIIO::Filesystem::read_text_file (filename, text)) {
+        err = fmtformat ("Could not read mesh \"{}\"", filename);
+        return false;
+    }
+    // OBJ indices count from 1 within the file (or back from its last
+    // element if negative); make them index our arrays.
+    const int vbase = verts.size(), nbase = normals.size(), tbase = uvs.size();
+    auto index = [](int i, int base, int count) {
+        return i > 0 ? base + i - 1 : base + count + i;
+    };
+    bool hascolors = !colors.empty();
+    size_t ntris = triangles.size();
+    for (string_view line : OIIO::Strutil::splitsv (text, "\n")) {
+        std::vector<string_view> tok = OIIO::Strutil::splitsv (line);
+        if (tok.empty())
+            continue;
+        if (tok[0] == "v" && tok.size() >= 4) {
+            verts.emplace_back (OIIO::Strutil::stof(tok[1]),
+                                OIIO::Strutil::stof(tok[2]),
+                                OIIO::Strutil::stof(tok[3]));
+            if (tok.size() >= 7) {
+                if (! hascolors)
+                    colors.resize (verts.size() - 1, Color3(1.0f));
+                hascolors = true;
+                colors.emplace_back (OIIO::Strutil::stof(tok[4]),
+                                     OIIO::Strutil::stof(tok[5]),
+                                     OIIO::Strutil::stof(tok[6]));
+            } else if (hascolors) {
+                colors.emplace_back (1.0f);
+            }
+        } else if (tok[0] == "vn" && tok.size() >= 4) {
+            normals.emplace_back (OIIO::Strutil::stof(tok[1]),
+                                  OIIO::Strutil::stof(tok[2]),
+                                  OIIO::Strutil::stof(tok[3]));
+        } else if (tok[0] == "vt" && tok.size() >= 3) {
+            uvs.emplace_back (OIIO::Strutil::stof(tok[1]),
+                              OIIO::Strutil::stof(tok[2]));
+        } else if (tok[0] == "f" && tok.size() >= 4) {
+            // Each corner is v, v/t, v//n, or v/t/n; polygons become fans.
+            int nv = verts.size() - vbase, nn = normals.size() - nbase;
+            int nt = uvs.size() - tbase;
+            std::vector<Triangle> corners (tok.size() - 1);
+            for (size_t c = 1; c < tok.size(); ++c) {
+                auto parts = OIIO::Strutil::splitsv (tok[c], "/");
+                int v = index (OIIO::Strutil::stoi(parts[0]), vbase, nv);
+                int t = parts.size() > 1 && parts[1].size()
+                        ? index (OIIO::Strutil::stoi(parts[1]), tbase, nt) : -1;
+                int n = parts.size() > 2 && parts[2].size()
+                        ? index (OIIO::Strutil::stoi(parts[2]), nbase, nn) : -1;
+                if (v < vbase || v >= int(verts.size())
+                    || t >= int(uvs.size()) || n >= int(normals.size())
+                    || (t >= 0 && t < tbase) || (n >= 0 && n < nbase)) {
+                    err = fmtformat (
+                        "Bad face \"{}\" in mesh \"{}\"", line, filename);
+                    triangles.resize (ntris);
+                    return false;
+                }
+                corners[c - 1].v[0] = v;
+                corners[c - 1].t[0] = t;
+                corners[c - 1].n[0] = n;
+            }
+            for (size_t c = 2; c < corners.size(); ++c) {
+                Triangle tri;
+                const Triangle* fan[3] = { &corners[0], &corners[c - 1], &corners[c] };
+                bool hasuv = true, hasnormal = true;
+                for (int i = 0; i < 3; ++i) {
+                    tri.v[i] = fan[i]->v[0];
+                    tri.t[i] = fan[i]->t[0];
+                    tri.n[i] = fan[i]->n[0];
+                    hasuv &= tri.t[i] >= 0;
+                    hasnormal &= tri.n[i] >= 0;
+                }
+                if (! hasuv)
+                    tri.t[0] = tri.t[1] = tri.t[2] = -1;
+                if (! hasnormal)
+                    tri.n[0] = tri.n[1] = tri.n[2] = -1;
+                tri.shaderID = shaderID;
+                triangles.push_back (tri);
+            }
+        }
+    }
+    return true;
+}
+
+
+
+void
+Scene::build_bvh ()
+{
+    bvh_nodes.clear ();
+    bvh_prims.clear ();
+    if (! num_prims())
+        return;
+    BVHBuilder builder (*this, bvh_nodes, bvh_prims);
+    builder.build (0, 0, num_prims(), 0);
+    bvh_nodes.resize (builder.nnodes);
+}
+
+
+
+namespace {
+
+// Shading contexts that outlive the task that used them, so that the
+// tiles of later passes run in contexts that earlier passes have already
+// warmed up, the way an interactive renderer would keep them, and so that
+// parallel work that doesn't map onto threads one to one (such as the
+// rows of the background's importance map) can share a few of them.
+class ContextPool {
+public:
+    ContextPool (ShadingSystem* shadingsys) : m_shadingsys(shadingsys) { }
+    ~ContextPool () {
+        for (auto& c : m_free) {
+            m_shadingsys->release_context (c.second);
+            m_shadingsys->destroy_thread_info (c.first);
+        }
+    }
+
+    typedef std::pair<PerThreadInfo*, ShadingContext*> Context;
+
+    Context get () {
+        {
+            OIIO::spin_lock lock (m_mutex);
+            if (! m_free.empty()) {
+                Context c = m_free.back();
+                m_free.pop_back();
+                return c;
+            }
+        }
+        PerThreadInfo* thread_info = m_shadingsys->create_thread_info();
+        return Context (thread_info, m_shadingsys->get_context (thread_info));
+    }
+
+    void put (const Context& c) {
+        OIIO::spin_lock lock (m_mutex);
+        m_free.push_back (c);
+    }
+
+private:
+    ShadingSystem* m_shadingsys;
+    OIIO::spin_mutex m_mutex;
+    std::vector<Context> m_free;
+};
+
+}  // anonymous namespace
+
+
+
 void
 SimpleRaytracer::prepare_render ()
 {
@@ -926,26 +1276,518 @@ SimpleRaytracer::prepare_render ()
     aa = std::max (1, options.get_int("aa"));
     max_bounces = options.get_int("max_bounces");
     rr_depth = options.get_int("rr_depth");
+    m_batch_width = options.get_int("batch_width");
+    m_passes = std::max (1, options.get_int("passes"));
+    m_time_budget = options.get_float("time_budget");
+    m_adaptive_threshold = options.get_float("adaptive_threshold");
+    m_tilesize = std::max (1, options.get_int("tilesize", 16));
+    m_sample_one_light = (options.get_string("light_sampler") == "one");
+
+    // Build the acceleration structure for the scene's primitives
+    scene.build_bvh ();
+    prepare_lights ();
 
     // prepare background importance table (if requested)
     if (backgroundResolution > 0 && backgroundShaderID >= 0) {
-        // get a context so we can make several background shader calls
+        // build importance table to optimize background sampling, shading
+        // its rows in parallel (and in batches, if we're batched)
+        ContextPool contexts (shadingsys);
+        background.prepare(backgroundResolution,
+            [&, this](const Dual2<Vec3>* dirs, Vec3* values, int n) {
+                ContextPool::Context c = contexts.get();
+#if OSL_USE_BATCHED
+                if (m_batch_width == 16)
+                    eval_background_batched<16>(dirs, values, n, c.second);
+                else if (m_batch_width == 8)
+                    eval_background_batched<8>(dirs, values, n, c.second);
+                else if (m_batch_width == 4)
+                    eval_background_batched<4>(dirs, values, n, c.second);
+                else
+#endif
+                for (int i = 0; i < n; i++)
+                    values[i] = eval_background(dirs[i], c.second);
+                contexts.put(c);
+            });
+    } else {
+        // we aren't directly evaluating the background
+        backgroundResolution = 0;
+    }
+}
+
+
+
+void
+SimpleRaytracer::prepare_lights ()
+{
+    m_lights.clear ();
+    m_light_index.assign (scene.num_prims(), -1);
+    std::vector<float> weights;
+    for (int lid = 0; lid < scene.num_prims(); lid++) {
+        if (!scene.islight(lid)) continue; // doesn't want to be sampled as a light
+        int shaderID = scene.shaderid(lid);
+        if (shaderID < 0 || !m_shaders[shaderID]) continue; // no shader attached to this light
+        m_light_index[lid] = int(m_lights.size());
+        m_lights.push_back (lid);
+        // How bright a light is isn't known until its shader runs, so pick
+        // lights by how big they are.
+        weights.push_back (scene.surfacearea(lid));
+    }
+    m_light_table.build (weights);
+}
+
+
+
+#if OSL_USE_BATCHED
+
+namespace {
+
+// The state subpixel_radiance keeps on its stack for one path, kept here
+// instead so that the wavefront integrator can advance all the paths of
+// a block of scanlines one bounce at a time.
+struct PathState {
+    PathState (const Ray& ray, const Sampler& sampler)
+        : ray(ray), sampler(sampler) { }
+
+    Ray ray;
+    Sampler sampler;
+    Color3 weight = Color3(1, 1, 1);
+    Color3 radiance = Color3(0, 0, 0);
+    float bsdf_pdf = std::numeric_limits<float>::infinity(); // camera ray has only one possible direction
+    int prev_id = -1;
+    bool flip = false;
+    bool alive = true;
+};
+
+// A point waiting to be shaded: where a path's ray hit a surface, where a
+// shadow ray reached a light, or a path's escape to the background.
+struct ShadeRequest {
+    ShadeRequest (int shaderID, int path, const Ray& ray,
+                  const Dual2<float>& t = Dual2<float>(0.0f), int id = -1,
+                  const Color3& contrib = Color3(0, 0, 0))
+        : shaderID(shaderID), path(path), id(id), ray(ray), t(t),
+          contrib(contrib) { }
+
+    int shaderID;
+    int path;
+    int id;          // primitive that was hit, -1 for the background
+    Ray ray;
+    Dual2<float> t;
+    Color3 contrib;  // for a light, the weight of its emission
+};
+
+
+
+template<int WidthT>
+void
+set_lane (BatchedShaderGlobals<WidthT>& bsg, int lane, const ShaderGlobals& sg)
+{
+    auto& vsg (bsg.varying);
+    vsg.P[lane] = sg.P;
+    vsg.dPdx[lane] = sg.dPdx;
+    vsg.dPdy[lane] = sg.dPdy;
+    vsg.dPdz[lane] = sg.dPdz;
+    vsg.I[lane] = sg.I;
+    vsg.dIdx[lane] = sg.dIdx;
+    vsg.dIdy[lane] = sg.dIdy;
+    vsg.N[lane] = sg.N;
+    vsg.Ng[lane] = sg.Ng;
+    vsg.u[lane] = sg.u;
+    vsg.dudx[lane] = sg.dudx;
+    vsg.dudy[lane] = sg.dudy;
+    vsg.v[lane] = sg.v;
+    vsg.dvdx[lane] = sg.dvdx;
+    vsg.dvdy[lane] = sg.dvdy;
+    vsg.dPdu[lane] = sg.dPdu;
+    vsg.dPdv[lane] = sg.dPdv;
+    vsg.time[lane] = sg.time;
+    vsg.dtime[lane] = sg.dtime;
+    vsg.dPdtime[lane] = sg.dPdtime;
+    vsg.Ps[lane] = sg.Ps;
+    vsg.dPsdx[lane] = sg.dPsdx;
+    vsg.dPsdy[lane] = sg.dPsdy;
+    vsg.object2common[lane] = sg.object2common;
+    vsg.shader2common[lane] = sg.shader2common;
+    vsg.surfacearea[lane] = sg.surfacearea;
+    vsg.flipHandedness[lane] = sg.flipHandedness;
+    vsg.backfacing[lane] = sg.backfacing;
+}
+
+
+
+// Sort the requests by shader and shade them WidthT at a time.  'setup'
+// makes the scalar ShaderGlobals of a request, which are copied into its
+// lane and kept where the BatchedSimpleRaytracer can find them;
+// 'results' is then handed each request with its globals and closures,
+// which are only valid until the next batch is executed.
+template<int WidthT, typename SetupFunc, typename ResultsFunc>
+void
+shade_requests (ShadingSystem* shadingsys, ShadingContext* ctx,
+                const std::vector<ShaderGroupRef>& shaders,
+                std::vector<ShadeRequest>& requests,
+                SetupFunc setup, ResultsFunc results)
+{
+    std::stable_sort (requests.begin(), requests.end(),
+                      [](const ShadeRequest& a, const ShadeRequest& b) {
+                          return a.shaderID < b.shaderID;
+                      });
+    BatchedShaderGlobals<WidthT> bsg;
+    ShaderGlobals sg[WidthT];
+    BatchedRenderState state;
+    Block<int, WidthT> shadeindex;
+    memset ((void *)&bsg.uniform, 0, sizeof(UniformShaderGlobals));
+    bsg.uniform.renderstate = &state;
+    for (size_t begin = 0; begin < requests.size(); ) {
+        int shaderID = requests[begin].shaderID;
+        int n = 0;
+        for ( ; n < WidthT && begin + n < requests.size()
+                && requests[begin + n].shaderID == shaderID; ++n) {
+            setup (requests[begin + n], sg[n]);
+            set_lane (bsg, n, sg[n]);
+            state.sg[n] = &sg[n];
+            shadeindex[n] = int(begin + n);
+        }
+        shadingsys->batched<WidthT>().execute (*ctx, *shaders[shaderID], n,
+                                               shadeindex, bsg,
+                                               nullptr, nullptr);
+        Wide<const ClosureColorPtr, WidthT> Ci (bsg.varying.Ci);
+        for (int lane = 0; lane < n; ++lane)
+            results (requests[begin + lane], sg[lane], Ci[lane]);
+        begin += n;
+    }
+}
+
+}  // anonymous namespace
+
+
+
+// eval_background for n directions at once, WidthT at a time.
+template<int WidthT>
+void
+SimpleRaytracer::eval_background_batched (const Dual2<Vec3>* dirs,
+                                          Vec3* values, int n,
+                                          ShadingContext* ctx)
+{
+    std::vector<ShadeRequest> requests;
+    requests.reserve (n);
+    for (int i = 0; i < n; ++i)
+        requests.emplace_back (backgroundShaderID, i,
+                               Ray(Dual2<Vec3>(Vec3(0, 0, 0)), dirs[i]));
+    shade_requests<WidthT> (shadingsys, ctx, m_shaders, requests,
+        [](const ShadeRequest& req, ShaderGlobals& sg) {
+            memset((char *)&sg, 0, sizeof(ShaderGlobals));
+            sg.I = req.ray.direction.val();
+            sg.dIdx = req.ray.direction.dx();
+            sg.dIdy = req.ray.direction.dy();
+        },
+        [&](const ShadeRequest& req, ShaderGlobals&, const ClosureColor* Ci) {
+            values[req.path] = process_background_closure(Ci);
+        });
+}
+
+
+
+// The same integrator as subpixel_radiance, turned inside out: rather
+// than following one path at a time, each thread starts the paths of all
+// the samples of a few scanlines, and then per bounce traces all their
+// rays, shades the hits in batches of the same shader group, and samples
+// lights and BSDFs for the whole batch.  The lights that are reached are
+// shaded in batches too, once all the hits of the bounce are done.
+template<int WidthT>
+void
+SimpleRaytracer::render_batched (int xres, int yres)
+{
+    ShadingSystem *shadingsys = this->shadingsys;
+    OIIO::parallel_for_chunked (0, yres, 4,
+      [&, this](int64_t ybegin, int64_t yend){
         OSL::PerThreadInfo *thread_info = shadingsys->create_thread_info();
         ShadingContext *ctx = shadingsys->get_context (thread_info);
 
-        // build importance table to optimize background sampling
-        auto evaler = [this](const Dual2<Vec3>& dir, ShadingContext* ctx){
-            return this->eval_background(dir, ctx);
-        };
-        background.prepare(backgroundResolution, evaler, ctx);
+        // Start a path for every sample, a pixel's samples side by side,
+        // jittered as in pixel_sample.
+        const int nsamples = aa * aa;
+        std::vector<PathState> paths;
+        paths.reserve ((yend - ybegin) * xres * nsamples);
+        for (int y = int(ybegin); y < int(yend); ++y) {
+            for (int x = 0; x < xres; ++x) {
+                for (int si = 0; si < nsamples; ++si) {
+                    Sampler sampler(x, y, si);
+                    Vec3 j = sampler.get();
+                    j.x *= 2; j.x = j.x < 1 ? sqrtf(j.x) - 1 : 1 - sqrtf(2 - j.x);
+                    j.y *= 2; j.y = j.y < 1 ? sqrtf(j.y) - 1 : 1 - sqrtf(2 - j.y);
+                    paths.emplace_back (camera.get(x + 0.5f + j.x, y + 0.5f + j.y),
+                                        sampler);
+                }
+            }
+        }
+
+        std::vector<ShadeRequest> hits, lights, misses;
+        for (int b = 0; b <= max_bounces; b++) {
+            // trace the rays of the live paths against the scene
+            hits.clear ();
+            misses.clear ();
+            for (int p = 0, n = int(paths.size()); p < n; ++p) {
+                PathState& path (paths[p]);
+                if (! path.alive)
+                    continue;
+                Dual2<float> t; int id = path.prev_id;
+                if (!scene.intersect(path.ray, t, id)) {
+                    // we hit nothing? check background shader
+                    path.alive = false;
+                    if (backgroundShaderID >= 0) {
+                        if (backgroundResolution > 0) {
+                            float bg_pdf = 0;
+                            Vec3 bg = background.eval(path.ray.direction.val(), bg_pdf);
+                            path.radiance += path.weight * bg * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(path.bsdf_pdf, bg_pdf);
+                        } else {
+                            misses.emplace_back (backgroundShaderID, p, path.ray);
+                        }
+                    }
+                    continue;
+                }
+                int shaderID = scene.shaderid(id);
+                if (shaderID < 0 || !m_shaders[shaderID]) { // no shader attached? done
+                    path.alive = false;
+                    continue;
+                }
+                hits.emplace_back (shaderID, p, path.ray, t, id);
+            }
+            if (hits.empty() && misses.empty())
+                break;
+
+            // run the background shader for the paths that escaped
+            shade_requests<WidthT> (shadingsys, ctx, m_shaders, misses,
+                [](const ShadeRequest& req, ShaderGlobals& sg) {
+                    memset((char *)&sg, 0, sizeof(ShaderGlobals));
+                    sg.I = req.ray.direction.val();
+                    sg.dIdx = req.ray.direction.dx();
+                    sg.dIdy = req.ray.direction.dy();
+                },
+                [&](const ShadeRequest& req, ShaderGlobals&, const ClosureColor* Ci) {
+                    PathState& path (paths[req.path]);
+                    path.radiance += path.weight * process_background_closure(Ci);
+                });
+
+            // shade the hits and process the resulting lists of closures
+            const bool last_bounce = b == max_bounces;
+            lights.clear ();
+            shade_requests<WidthT> (shadingsys, ctx, m_shaders, hits,
+                [&](const ShadeRequest& req, ShaderGlobals& sg) {
+                    globals_from_hit(sg, req.ray, req.t, req.id,
+                                     paths[req.path].flip);
+                },
+                [&](const ShadeRequest& req, ShaderGlobals& sg, const ClosureColor* Ci) {
+                    PathState& path (paths[req.path]);
+                    const int id = req.id;
+                    ShadingResult result;
+                    process_closure(result, Ci, last_bounce);
+
+                    // add self-emission
+                    float k = 1;
+                    if (scene.islight(id)) {
+                        // figure out the probability of reaching this point
+                        float light_pdf = scene.shapepdf(id, path.ray.origin.val(), sg.P) * light_pick_pdf(id);
+                        k = MIS::power_heuristic<MIS::WEIGHT_EVAL>(path.bsdf_pdf, light_pdf);
+                    }
+                    path.radiance += path.weight * k * result.Le;
+
+                    // last bounce? nothing left to do
+                    if (last_bounce) {
+                        path.alive = false;
+                        return;
+                    }
+
+                    // build internal pdf for sampling between bsdf closures
+                    result.bsdf.prepare(sg, path.weight, b >= rr_depth);
+
+                    // get three random numbers
+                    Vec3 s = path.sampler.get();
+                    float xi = s.x;
+                    float yi = s.y;
+                    float zi = s.z;
+
+                    // trace one ray to the background
+                    if (backgroundResolution > 0) {
+                        Dual2<Vec3> bg_dir;
+                        float bg_pdf = 0, bsdf_pdf = 0;
+                        Vec3 bg = background.sample(xi, yi, bg_dir, bg_pdf);
+                        Color3 bsdf_weight = result.bsdf.eval(sg, bg_dir.val(), bsdf_pdf);
+                        Color3 contrib = path.weight * bsdf_weight * bg * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(bg_pdf, bsdf_pdf);
+                        if ((contrib.x + contrib.y + contrib.z) > 0) {
+                            int shadow_id = id;
+                            Ray shadow_ray = Ray(sg.P, bg_dir);
+                            Dual2<float> shadow_dist;
+                            if (!scene.intersect(shadow_ray, shadow_dist, shadow_id)) // ray reached the background?
+                                path.radiance += contrib;
+                        }
+                    }
+
+                    // trace one ray to each light (or to one picked at
+                    // random), queueing the lights that are reached to be
+                    // shaded after this bounce
+                    foreach_light_sample(id, xi, [&](int lid, float lxi, float pick_pdf) {
+                        int shaderID = scene.shaderid(lid);
+                        // sample a random direction towards the object
+                        float light_pdf;
+                        Vec3 ldir = scene.sample(lid, sg.P, lxi, yi, light_pdf);
+                        light_pdf *= pick_pdf;
+                        float bsdf_pdf = 0;
+                        Color3 bsdf_weight = result.bsdf.eval(sg, ldir, bsdf_pdf);
+                        Color3 contrib = path.weight * bsdf_weight * MIS::power_heuristic<MIS::EVAL_WEIGHT>(light_pdf, bsdf_pdf);
+                        if ((contrib.x + contrib.y + contrib.z) > 0) {
+                            Ray shadow_ray = Ray(sg.P, ldir);
+                            int shadow_id = id; // ignore self hit
+                            Dual2<float> shadow_dist;
+                            if (scene.intersect(shadow_ray, shadow_dist, shadow_id) && shadow_id == lid)
+                                lights.emplace_back (shaderID, req.path, shadow_ray,
+                                                     shadow_dist, lid, contrib);
+                        }
+                    });
+
+                    // trace indirect ray and continue
+                    path.weight *= result.bsdf.sample(sg, xi, yi, zi, path.ray.direction, path.bsdf_pdf);
+                    if (!(path.weight.x > 0) && !(path.weight.y > 0) && !(path.weight.z > 0)) {
+                        path.alive = false; // filter out all 0's or NaNs
+                        return;
+                    }
+                    path.prev_id = id;
+                    path.ray.origin = Dual2<Vec3>(sg.P, sg.dPdx, sg.dPdy);
+                    path.flip ^= sg.Ng.dot(path.ray.direction.val()) > 0;
+                });
+
+            // execute the light shaders (for emissive closures only)
+            shade_requests<WidthT> (shadingsys, ctx, m_shaders, lights,
+                [&](const ShadeRequest& req, ShaderGlobals& sg) {
+                    globals_from_hit(sg, req.ray, req.t, req.id, false);
+                },
+                [&](const ShadeRequest& req, ShaderGlobals&, const ClosureColor* Ci) {
+                    ShadingResult light_result;
+                    process_closure(light_result, Ci, true);
+                    paths[req.path].radiance += req.contrib * light_result.Le;
+                });
+        }
+
+        // mix each pixel's samples via lerp for numerical stability
+        OIIO::ImageBuf::Iterator<float> p(pixelbuf, OIIO::ROI(0,xres,ybegin,yend));
+        for (size_t first = 0; !p.done(); ++p, first += nsamples) {
+            Color3 c(0, 0, 0);
+            for (int si = 0; si < nsamples; si++)
+                c = OIIO::lerp(c, paths[first + si].radiance, 1.0f / (si + 1));
+            p[0] = c[0];
+            p[1] = c[1];
+            p[2] = c[2];
+        }
 
-        // release context
         shadingsys->release_context (ctx);
         shadingsys->destroy_thread_info(thread_info);
-    } else {
-        // we aren't directly evaluating the background
-        backgroundResolution = 0;
+    });
+}
+
+#endif
+
+
+
+namespace {
+
+// Running mean of the samples of one pixel, and the variance of their
+// luminance (by Welford's method) to tell when it has converged.
+struct PixelStats {
+    Color3 mean = Color3(0, 0, 0);
+    float m2 = 0;  // sum of squared deviations of the luminance
+    int n = 0;
+    bool converged = false;
+
+    static float luminance (const Color3& c) { return (c.x + c.y + c.z) / 3; }
+
+    void add (const Color3& c) {
+        float delta = luminance(c) - luminance(mean);
+        n++;
+        // mix in result via lerp for numerical stability
+        mean = OIIO::lerp(mean, c, 1.0f / n);
+        m2 += delta * (luminance(c) - luminance(mean));
+    }
+
+    // Is the standard error of the mean within 'threshold' of it
+    // (relative, but with a floor so that black pixels can settle)?
+    bool check (float threshold) {
+        if (n > 1) {
+            float stderror = sqrtf(m2 / (float(n - 1) * n));
+            converged = stderror <= threshold * std::max(luminance(mean), 0.01f);
+        }
+        return converged;
     }
+};
+
+}  // anonymous namespace
+
+
+
+// Render in square tiles and in passes of aa*aa samples per pixel, each
+// pass refining the image left by the last, until there have been
+// "passes" of them or "time_budget" seconds have gone by.  With an
+// "adaptive_threshold", pixels whose noise is below it stop taking
+// samples, and tiles where all have stopped are left out of later passes.
+void
+SimpleRaytracer::render_progressive (int xres, int yres)
+{
+    const int spp = aa * aa;
+    const int ntx = (xres + m_tilesize - 1) / m_tilesize;
+    const int nty = (yres + m_tilesize - 1) / m_tilesize;
+    std::vector<PixelStats> stats (size_t(xres) * yres);
+    std::vector<int> tiles (ntx * nty);
+    for (int t = 0, n = int(tiles.size()); t < n; ++t)
+        tiles[t] = t;
+    ContextPool contexts (shadingsys);
+
+    OIIO::Timer timer;
+    int pass = 0;
+    for ( ; pass < m_passes && ! tiles.empty(); ++pass) {
+        if (pass && m_time_budget > 0 && timer() >= m_time_budget)
+            break;
+        double passstart = timer();
+        std::atomic<int64_t> nsamples (0);
+        OIIO::parallel_for (0, int64_t(tiles.size()), [&, this](int64_t i) {
+            ContextPool::Context c = contexts.get();
+            int tx = tiles[i] % ntx, ty = tiles[i] / ntx;
+            OIIO::ROI roi (tx * m_tilesize, std::min(xres, (tx + 1) * m_tilesize),
+                           ty * m_tilesize, std::min(yres, (ty + 1) * m_tilesize));
+            int64_t n = 0;
+            OIIO::ImageBuf::Iterator<float> p(pixelbuf, roi);
+            for ( ; !p.done(); ++p) {
+                PixelStats& s (stats[size_t(p.y()) * xres + p.x()]);
+                if (s.converged)
+                    continue;
+                for (int si = s.n, e = s.n + spp; si < e; si++)
+                    s.add (pixel_sample(p.x(), p.y(), si, c.second));
+                n += spp;
+                if (m_adaptive_threshold > 0)
+                    s.check (m_adaptive_threshold);
+                p[0] = s.mean[0];
+                p[1] = s.mean[1];
+                p[2] = s.mean[2];
+            }
+            nsamples += n;
+            contexts.put (c);
+        });
+        double passtime = timer() - passstart;
+        errhandler().infofmt("Pass {}: {} tiles, {} samples in {} ({:.3f} us/sample)",
+                             pass, tiles.size(), nsamples.load(),
+                             OIIO::Strutil::timeintervalformat(passtime, 4),
+                             nsamples ? 1.0e6 * passtime / nsamples : 0.0);
+
+        // leave out the tiles that have converged everywhere
+        if (m_adaptive_threshold > 0) {
+            tiles.erase (std::remove_if (tiles.begin(), tiles.end(), [&](int t) {
+                int tx = t % ntx, ty = t / ntx;
+                for (int y = ty * m_tilesize, ye = std::min(yres, y + m_tilesize); y < ye; ++y)
+                    for (int x = tx * m_tilesize, xe = std::min(xres, x + m_tilesize); x < xe; ++x)
+                        if (! stats[size_t(y) * xres + x].converged)
+                            return false;
+                return true;
+            }), tiles.end());
+        }
+    }
+    errhandler().infofmt("Rendered {} passes in {}", pass,
+                         OIIO::Strutil::timeintervalformat(timer(), 4));
 }
 
 
@@ -953,6 +1795,16 @@ SimpleRaytracer::prepare_render ()
 void
 SimpleRaytracer::render (int xres, int yres)
 {
+#if OSL_USE_BATCHED
+    if (m_batch_width == 16)
+        return render_batched<16> (xres, yres);
+    if (m_batch_width == 8)
+        return render_batched<8> (xres, yres);
+    if (m_batch_width == 4)
+        return render_batched<4> (xres, yres);
+#endif
+    if (m_passes > 1 || m_time_budget > 0 || m_adaptive_threshold > 0)
+        return render_progressive (xres, yres);
     ShadingSystem *shadingsys = this->shadingsys;
     OIIO::parallel_for_chunked (0, yres, 0,
       [&, this](int64_t ybegin, int64_t yend){
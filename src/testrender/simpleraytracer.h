@@ -17,12 +17,18 @@
 #include "sampling.h"
 #include "background.h"
 
+#if OSL_USE_BATCHED
+#   include "batched_simpleraytracer.h"
+#endif
+
 
 OSL_NAMESPACE_ENTER
 
 
 class SimpleRaytracer : public RendererServices
 {
+    template<int>
+    friend class BatchedSimpleRaytracer;
 public:
     // Just use 4x4 matrix for transformations
     typedef Matrix44 Transformation;
@@ -50,6 +56,20 @@ public:
     virtual bool get_userdata (bool derivatives, ustring name, TypeDesc type,
                                ShaderGlobals *sg, void *val);
 
+#if OSL_USE_BATCHED
+    // Only offered in --batched mode (the "batch_width" option), so that
+    // the shading system doesn't do batched analysis for nothing.
+    virtual BatchedRendererServices<16> * batched(WidthOf<16>) {
+        return m_batch_width == 16 ? &m_batch_16_raytracer : nullptr;
+    }
+    virtual BatchedRendererServices<8> * batched(WidthOf<8>) {
+        return m_batch_width == 8 ? &m_batch_8_raytracer : nullptr;
+    }
+    virtual BatchedRendererServices<4> * batched(WidthOf<4>) {
+        return m_batch_width == 4 ? &m_batch_4_raytracer : nullptr;
+    }
+#endif
+
     void name_transform (const char *name, const Transformation &xform);
 
     // Set and get renderer attributes/options
@@ -112,8 +132,26 @@ private:
     int aa = 1;
     int max_bounces = 1000000;
     int rr_depth = 5;
+    int m_batch_width = 0;
+    int m_passes = 1;
+    float m_time_budget = 0.0f;
+    float m_adaptive_threshold = 0.0f;
+    int m_tilesize = 16;
     std::vector<ShaderGroupRef> m_shaders;
 
+    // Direct lighting: the primitives that are lights with a shader, and
+    // (if only one of them is to be sampled per shading point) the table
+    // to pick one with and each primitive's index in m_lights.
+    std::vector<int> m_lights;
+    std::vector<int> m_light_index;
+    AliasTable m_light_table;
+    bool m_sample_one_light = false;
+#if OSL_USE_BATCHED
+    BatchedSimpleRaytracer<16> m_batch_16_raytracer;
+    BatchedSimpleRaytracer<8> m_batch_8_raytracer;
+    BatchedSimpleRaytracer<4> m_batch_4_raytracer;
+#endif
+
     class ErrorHandler;  // subclass ErrorHandler for SimpleRaytracer
     std::unique_ptr<OIIO::ErrorHandler> m_errhandler;
     bool m_had_error = false;
@@ -163,9 +201,48 @@ private:
     void globals_from_hit(ShaderGlobals& sg, const Ray& r,
                           const Dual2<float>& t, int id, bool flip);
     Vec3 eval_background(const Dual2<Vec3>& dir, ShadingContext* ctx);
+    void prepare_lights();
+
+    // Call f(lid, xi, pdf) for each light that direct lighting at primitive
+    // id should sample: every light other than id, or one picked at random
+    // with xi.  pdf is the probability of the light having been picked, and
+    // xi is what's left of the random number to sample a point on it with.
+    template<typename F>
+    void foreach_light_sample(int id, float xi, F f) const {
+        if (!m_sample_one_light) {
+            for (int lid : m_lights)
+                if (lid != id) // skip self
+                    f(lid, xi, 1.0f);
+            return;
+        }
+        if (m_light_table.empty())
+            return;
+        float pick_pdf;
+        int lid = m_lights[m_light_table.sample(xi, pick_pdf)];
+        if (lid != id)
+            f(lid, xi, pick_pdf);
+    }
+
+    // The probability of direct lighting having picked light lid
+    float light_pick_pdf(int lid) const {
+        if (!m_sample_one_light)
+            return 1.0f;
+        int i = m_light_index[lid];
+        return i >= 0 ? m_light_table.pdf(i) : 0.0f;
+    }
+
     Color3 subpixel_radiance(float x, float y, Sampler& sampler,
                              ShadingContext* ctx);
+    Color3 pixel_sample(int x, int y, int si, ShadingContext* ctx);
     Color3 antialias_pixel(int x, int y, ShadingContext* ctx);
+    void render_progressive(int xres, int yres);
+#if OSL_USE_BATCHED
+    template<int WidthT>
+    void render_batched(int xres, int yres);
+    template<int WidthT>
+    void eval_background_batched(const Dual2<Vec3>* dirs, Vec3* values,
+                                 int n, ShadingContext* ctx);
+#endif
 
     friend class ErrorHandler;
 };
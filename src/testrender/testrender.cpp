@@ -52,12 +52,18 @@ static std::string extraoptions;
 static std::string texoptions;
 static int xres = 640, yres = 480;
 static int aa = 1, max_bounces = 1000000, rr_depth = 5;
+static int passes = 1, tilesize = 16;
+static float time_budget = 0.0f, adaptive_threshold = 0.0f;
+static std::string light_sampler = "all";
+static std::string gpu_shade = "hit";
 static int num_threads = 0;
 static int iters = 1;
 static std::string scenefile, imagefile;
 static std::string shaderpath;
 static bool shadingsys_options_set = false;
 static bool use_optix = OIIO::Strutil::stoi(OIIO::Sysutil::getenv("TESTSHADE_OPTIX"));
+static bool batched = OIIO::Strutil::stoi(OIIO::Sysutil::getenv("TESTSHADE_BATCHED"));
+static int batch_width = 0;
 
 
 
@@ -89,6 +95,28 @@ set_shadingsys_options ()
     shadingsys->attribute ("llvm_debugging_symbols", 1);
     shadingsys->attribute ("llvm_profiling_events", 1);
 
+    if (batched && !use_optix) {
+#if OSL_USE_BATCHED
+        // For batched allow FMA if build of OSL supports it
+        shadingsys->attribute ("llvm_jit_fma", 1);
+        if (shadingsys->configure_batch_execution_at(16))
+            batch_width = 16;
+        else if (shadingsys->configure_batch_execution_at(8))
+            batch_width = 8;
+        else if (shadingsys->configure_batch_execution_at(4))
+            batch_width = 4;
+#endif
+        if (batch_width) {
+            // The renderer only offers its BatchedRendererServices once
+            // it knows the width, after the ShadingSystem has decided
+            // this option's default.
+            shadingsys->attribute ("opt_batched_analysis", 1);
+        } else {
+            std::cout << "WARNING:  Hardware or library requirements to utilize batched execution"
+                      << " are not met, ignoring --batched\n";
+        }
+    }
+
     shadingsys_options_set = true;
 }
 
@@ -115,6 +143,7 @@ void getargs(int argc, const char *argv[])
                 "-v", &verbose, "Verbose messages",
                 "-t %d", &num_threads, "Render using N threads (default: auto-detect)",
                 "--optix", &use_optix, "Use OptiX if available",
+                "--batched", &batched, "Shade in batches with a wavefront integrator (CPU only)",
                 "--debug", &debug1, "Lots of debugging info",
                 "--debug2", &debug2, "Even more debugging info",
                 "--runstats", &runstats, "Print run statistics",
@@ -122,9 +151,15 @@ void getargs(int argc, const char *argv[])
                 "--profile", &profile, "Print profile information",
                 "--saveptx", &saveptx, "Save the generated PTX (OptiX mode only)",
                 "--warmup", &warmup, "Perform a warmup launch",
+                "--gpushade %s", &gpu_shade, "GPU shading order: in the \"hit\" programs, binned by group in a \"queue\" pass, or \"reorder\"ed by the hardware (OptiX 8+) (default: hit)",
                 "--res %d %d", &xres, &yres, "Make an W x H image",
                 "-r %d %d", &xres, &yres, "", // synonym for -res
                 "-aa %d", &aa, "Trace NxN rays per pixel",
+                "--passes %d", &passes, "Render progressively, NxN rays per pixel per pass (default: 1)",
+                "--timebudget %f", &time_budget, "Start no more passes after this many seconds",
+                "--adaptive %f", &adaptive_threshold, "Stop sampling pixels whose relative noise is below this",
+                "--tilesize %d", &tilesize, "Tile size for progressive rendering (default: 16)",
+                "--lightsampler %s", &light_sampler, "Direct lighting: sample \"all\" lights, or \"one\" picked by power (default: all)",
                 "--iters %d", &iters, "Number of iterations",
                 "-O0", &O0, "Do no runtime shader optimization",
                 "-O1", &O1, "Do a little runtime shader optimization",
@@ -202,6 +237,13 @@ main (int argc, const char *argv[])
         rend->attribute("max_bounces", max_bounces);
         rend->attribute("rr_depth", rr_depth);
         rend->attribute("aa", aa);
+        rend->attribute("passes", passes);
+        rend->attribute("time_budget", time_budget);
+        rend->attribute("adaptive_threshold", adaptive_threshold);
+        rend->attribute("tilesize", tilesize);
+        rend->attribute("light_sampler", light_sampler);
+        rend->attribute("gpu_shade", gpu_shade);
+        rend->attribute("gpu_stats", (int)runstats);
         OIIO::attribute("threads", num_threads);
 
         // Create a new shading system.  We pass it the RendererServices
@@ -219,6 +261,7 @@ main (int argc, const char *argv[])
 
         // Setup common attributes
         set_shadingsys_options();
+        rend->attribute("batch_width", batch_width);
 
 #ifdef OSL_USE_OPTIX
 #if (OPTIX_VERSION >= 70000)
@@ -278,6 +321,12 @@ main (int argc, const char *argv[])
             if (texturesys)
                 std::cout << texturesys->getstats (5) << "\n";
             std::cout << ustring::getstats() << "\n";
+#ifdef OSL_USE_OPTIX
+#if (OPTIX_VERSION >= 70000)
+            if (use_optix)
+                std::cout << reinterpret_cast<OptixRaytracer *> (rend)->coherence_stats() << "\n";
+#endif
+#endif
         }
 
         // We're done with the shading system now, destroy it
@@ -0,0 +1,130 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+
+// The kernels of the plain CUDA compute backend (CudaGridRenderer), which
+// runs a shader group over a grid of points with no OptiX pipeline. This
+// is linked at run time with rend_lib, the group's PTX, and a small
+// module that forwards osl_grid_init and osl_grid_entry to the group's
+// init and entry functions.
+
+#include <optix.h>   // only for OPTIX_VERSION, which rend_lib.h checks
+#include <cuda_runtime.h>
+
+#include "rend_lib.h"
+#include "render_params.h"
+
+
+extern "C" __device__ void osl_grid_init (ShaderGlobals*, void*, void*, void*, int);
+extern "C" __device__ void osl_grid_entry (ShaderGlobals*, void*, void*, void*, int);
+
+
+// Point the renderer support library at the renderer's buffers. One
+// thread is plenty.
+extern "C" __global__ void setglobals (CudaGridParams params)
+{
+    OSL::pvt::osl_printf_buffer_start    = params.osl_printf_buffer_start;
+    OSL::pvt::osl_printf_buffer_end      = params.osl_printf_buffer_end;
+    OSL::pvt::s_color_system             = params.color_system;
+    OSL::pvt::test_str_1                 = params.test_str_1;
+    OSL::pvt::test_str_2                 = params.test_str_2;
+    OSL::pvt::num_named_xforms           = params.num_named_xforms;
+    OSL::pvt::xform_name_buffer          = params.xform_name_buffer;
+    OSL::pvt::xform_buffer               = params.xform_buffer;
+    OSL::pvt::num_pointclouds            = params.num_pointclouds;
+    OSL::pvt::pointcloud_name_buffer     = params.pointcloud_name_buffer;
+    OSL::pvt::pointcloud_buffer          = params.pointcloud_buffer;
+}
+
+
+
+static __device__ float
+input (CUdeviceptr array, int i, float dflt)
+{
+    return array ? reinterpret_cast<const float*>(array)[i] : dflt;
+}
+
+
+
+extern "C" __global__ void shade_grid (CudaGridParams params)
+{
+    int point = blockIdx.x * blockDim.x + threadIdx.x;
+    if (point >= params.npoints)
+        return;
+
+    // Where the point would be on the image lattice, for inputs that
+    // weren't given
+    float2 d = make_float2 (static_cast<float>(point % params.xres) + 0.5f,
+                            static_cast<float>(point / params.xres) + 0.5f);
+    const float invw = params.invw;
+    const float invh = params.invh;
+
+    // The closure and heap storage are this point's slices of the pools
+    // the renderer sized for the shader group.
+    ClosurePool closure_pool;
+    closure_pool.init (params.closure_pool, params.closure_pool_stride, point);
+    char* groupdata = reinterpret_cast<char*>(params.heap_pool)
+                      + point * params.heap_pool_stride;
+
+    ShaderGlobals sg;
+    sg.I           = make_float3(0,0,1);
+    sg.N           = make_float3(input (params.N[0], point, 0.0f),
+                                 input (params.N[1], point, 0.0f),
+                                 input (params.N[2], point, 1.0f));
+    sg.Ng          = sg.N;
+    sg.P           = make_float3(input (params.P[0], point, d.x),
+                                 input (params.P[1], point, d.y),
+                                 input (params.P[2], point, 0.0f));
+    sg.u           = input (params.u, point, d.x * invw);
+    sg.v           = input (params.v, point, params.flipv ? 1.f - d.y * invh
+                                                          : d.y * invh);
+
+    sg.dudx        = input (params.dudx, point, invw);
+    sg.dudy        = input (params.dudy, point, 0.0f);
+    sg.dvdx        = input (params.dvdx, point, 0.0f);
+    sg.dvdy        = input (params.dvdy, point, invh);
+
+    sg.dPdu        = make_float3(1.f / invw, 0.f , 0.f);
+    sg.dPdv        = make_float3(0.0f, 1.f / invh, 0.f);
+
+    sg.dPdx        = make_float3(1.f, 0.f, 0.f);
+    sg.dPdy        = make_float3(0.f, 1.f, 0.f);
+    sg.dPdz        = make_float3(0.f, 0.f, 0.f);
+
+    sg.Ci          = NULL;
+    sg.surfacearea = 0;
+    sg.backfacing  = 0;
+
+    sg.raytype = CAMERA;
+    sg.flipHandedness = 0;
+
+    sg.shader2common = reinterpret_cast<void*>(params.shader2common);
+    sg.object2common = reinterpret_cast<void*>(params.object2common);
+
+    // Pack the "closure pool" into one of the ShaderGlobals pointers
+    sg.renderstate = &closure_pool;
+
+    osl_grid_init (&sg, groupdata, nullptr, nullptr, 0);
+    osl_grid_entry (&sg, groupdata, nullptr, nullptr, 0);
+
+    // Scatter the outputs into their planar arrays
+    const CudaGridOutput* outputs
+        = reinterpret_cast<const CudaGridOutput*>(params.outputs);
+    for (uint64_t o = 0; o < params.noutputs; ++o) {
+        const float* src = reinterpret_cast<const float*>(groupdata + outputs[o].offset);
+        float* dst = reinterpret_cast<float*>(outputs[o].dst);
+        for (uint64_t c = 0; c < outputs[o].nfloats; ++c)
+            dst[c * params.npoints + point] = src[c];
+    }
+}
+
+
+
+// As in optix_grid_renderer.cu, do the texture look-ups in this file.
+extern "C"
+__device__ float4 osl_tex2DLookup(void *handle, float s, float t)
+{
+    cudaTextureObject_t texID = cudaTextureObject_t(handle);
+    return tex2D<float4>(texID, s, t);
+}
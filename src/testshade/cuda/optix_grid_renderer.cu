@@ -126,6 +126,9 @@ extern "C" __global__ void __raygen__setglobals()
     OSL::pvt::num_named_xforms           = render_params.num_named_xforms;
     OSL::pvt::xform_name_buffer          = render_params.xform_name_buffer;
     OSL::pvt::xform_buffer               = render_params.xform_buffer;
+    OSL::pvt::num_pointclouds            = render_params.num_pointclouds;
+    OSL::pvt::pointcloud_name_buffer     = render_params.pointcloud_name_buffer;
+    OSL::pvt::pointcloud_buffer          = render_params.pointcloud_buffer;
 }
 extern "C" __global__ void __miss__setglobals() { }
 
@@ -140,12 +143,15 @@ extern "C" __global__ void __raygen__()
     float2 d = make_float2 (static_cast<float>(launch_index.x) + 0.5f,
                             static_cast<float>(launch_index.y) + 0.5f);
 
-    // TODO: Fixed-sized allocations can easily be exceeded by arbitrary shader
-    //       networks, so there should be (at least) some mechanism to issue a
-    //       warning or error if the closure or param storage can possibly be
-    //       exceeded.
-    alignas(8) char closure_pool[256];
-    alignas(8) char params      [256];
+    int pixel = launch_index.y * launch_dims.x + launch_index.x;
+
+    // The closure and heap storage are this point's slices of the pools
+    // the renderer sized for the shader group.
+    ClosurePool closure_pool;
+    closure_pool.init (render_params.closure_pool,
+                       render_params.closure_pool_stride, pixel);
+    char* params = reinterpret_cast<char*>(render_params.heap_pool)
+                   + pixel * render_params.heap_pool_stride;
 
     const float invw = render_params.invw;
     const float invh = render_params.invh;
@@ -189,15 +195,13 @@ extern "C" __global__ void __raygen__()
     sg.object2common = reinterpret_cast<void*>(render_params.object2common);
 
     // Pack the "closure pool" into one of the ShaderGlobals pointers
-    *(int*) &closure_pool[0] = 0;
-    sg.renderstate = &closure_pool[0];
+    sg.renderstate = &closure_pool;
 
     // Run the OSL group and init functions
     optixDirectCall<void, ShaderGlobals*, void *, void*, void*, int>(0u, &sg, params, nullptr, nullptr, 0); // call osl_init_func
     optixDirectCall<void, ShaderGlobals*, void *, void*, void*, int>(1u, &sg, params, nullptr, nullptr, 0); // call osl_group_func
 
     float* f_output = (float*)params;
-    int pixel = launch_index.y * launch_dims.x + launch_index.x;
     output_buffer[pixel] = {f_output[1], f_output[2], f_output[3]};
 }
 
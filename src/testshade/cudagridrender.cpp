@@ -0,0 +1,390 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <vector>
+
+#include <OpenImageIO/filesystem.h>
+
+#include "cudagridrender.h"
+
+#if defined(OSL_USE_OPTIX) && (OPTIX_VERSION >= 70000)
+#include <cuda_runtime.h>
+#include <nvrtc.h>
+
+
+OSL_NAMESPACE_ENTER
+
+
+#define CU_CHECK(call)                                                    \
+{                                                                         \
+    CUresult res = call;                                                  \
+    if (res != CUDA_SUCCESS)                                              \
+    {                                                                     \
+        const char* name = nullptr;                                       \
+        cuGetErrorName (res, &name);                                      \
+        fprintf (stderr, "[CUDA ERROR]  CUDA call (%s) failed with error: " \
+                 "'%s' (%s:%d)\n", #call, name ? name : "?",              \
+                 __FILE__, __LINE__);                                     \
+        exit(1);                                                          \
+    }                                                                     \
+}
+
+#define CUDA_CHECK(call)                                                  \
+{                                                                         \
+    cudaError_t error = call;                                             \
+    if (error != cudaSuccess)                                             \
+    {                                                                     \
+        fprintf (stderr, "[CUDA ERROR]  CUDA call (%s) failed with error: " \
+                 "'%s' (%s:%d)\n", #call, cudaGetErrorString (error),     \
+                 __FILE__, __LINE__);                                     \
+        exit(1);                                                          \
+    }                                                                     \
+}
+
+// Threads per block of the shading kernel
+static const int block_size = 128;
+
+
+
+CudaGridRenderer::CudaGridRenderer ()
+    : OptixGridRenderer (false /* no OptiX */)
+{
+}
+
+
+
+CudaGridRenderer::~CudaGridRenderer ()
+{
+    for (auto& k : m_kernels)
+        cuModuleUnload (k.second.module);
+}
+
+
+
+bool
+CudaGridRenderer::make_optix_materials ()
+{
+    // Stand-in: names of shader outputs to preserve
+    // FIXME
+    std::vector<const char*> outputs { "Cout" };
+
+    std::string launcher_ptx = load_ptx_file ("cuda_grid_renderer.ptx");
+    std::string rend_lib_ptx = load_ptx_file ("rend_lib.ptx");
+    if (launcher_ptx.empty() || rend_lib_ptx.empty())
+        return false;
+
+    for (const auto& groupref : shaders()) {
+        shadingsys->attribute (groupref.get(), "renderer_outputs",
+                               TypeDesc(TypeDesc::STRING, outputs.size()),
+                               outputs.data());
+
+        shadingsys->optimize_group (groupref.get(), nullptr);
+
+        if (!shadingsys->find_symbol (*groupref.get(), ustring(outputs[0]))) {
+            // FIXME: This is for cases where testshade is run with 1x1 resolution
+            //        Those tests may not have a Cout parameter to write to.
+            if (m_xres > 1 && m_yres > 1) {
+                errhandler().warningfmt("Requested output '{}', which wasn't found",
+                                        outputs[0]);
+            }
+        }
+
+        // Size the closure and heap pools for the largest group, with a
+        // fixed budget for closures whose use couldn't be bounded.
+        int closure_pool_size = -1, groupdata_size = 0;
+        shadingsys->getattribute (groupref.get(), "closure_pool_size", closure_pool_size);
+        shadingsys->getattribute (groupref.get(), "groupdata_size", groupdata_size);
+        if (closure_pool_size < 0)
+            closure_pool_size = UNBOUNDED_CLOSURE_POOL_SIZE;
+        m_closure_pool_stride = std::max (m_closure_pool_stride, size_t(closure_pool_size));
+        m_heap_pool_stride    = std::max (m_heap_pool_stride, size_t(groupdata_size));
+
+        if (! link_group (*groupref, launcher_ptx, rend_lib_ptx))
+            return false;
+    }
+
+    register_pointclouds ();
+
+    // One slice of each pool per point, kept 16-byte aligned
+    m_closure_pool_stride = (m_closure_pool_stride + 15) & ~size_t(15);
+    m_heap_pool_stride    = (m_heap_pool_stride + 15) & ~size_t(15);
+    return true;
+}
+
+
+
+// Link the group's PTX, with the launcher and the renderer support
+// library, into a module whose shade_grid kernel runs the group.
+bool
+CudaGridRenderer::link_group (ShaderGroup &group,
+                              const std::string &launcher_ptx,
+                              const std::string &rend_lib_ptx)
+{
+    std::string group_name, init_name, entry_name;
+    shadingsys->getattribute (&group, "groupname",        group_name);
+    shadingsys->getattribute (&group, "group_init_name",  init_name);
+    shadingsys->getattribute (&group, "group_entry_name", entry_name);
+
+    // Retrieve the compiled ShaderGroup PTX
+    std::string osl_ptx;
+    shadingsys->getattribute (&group, "ptx_compiled_version",
+                              OSL::TypeDesc::PTR, &osl_ptx);
+    if (osl_ptx.empty()) {
+        errhandler().errorfmt("Failed to generate PTX for ShaderGroup {}",
+                              group_name);
+        return false;
+    }
+
+    if (options.get_int("saveptx")) {
+        std::string filename
+            = OIIO::Strutil::fmt::format("{}_{}.ptx", group_name,
+                                         m_kernels.size());
+        OIIO::ofstream out;
+        OIIO::Filesystem::open (out, filename);
+        out << osl_ptx;
+    }
+
+    // The launcher calls osl_grid_init and osl_grid_entry; have NVRTC
+    // make the two forwarders to this group's functions.
+    std::string forward_src = OIIO::Strutil::fmt::format(
+        "extern \"C\" __device__ void {0}(void*, void*, void*, void*, int);\n"
+        "extern \"C\" __device__ void {1}(void*, void*, void*, void*, int);\n"
+        "extern \"C\" __device__ void osl_grid_init(void* sg, void* gd, void* ud, void* out, int i)\n"
+        "{{ {0}(sg, gd, ud, out, i); }}\n"
+        "extern \"C\" __device__ void osl_grid_entry(void* sg, void* gd, void* ud, void* out, int i)\n"
+        "{{ {1}(sg, gd, ud, out, i); }}\n", init_name, entry_name);
+
+    CUdevice device;
+    int major = 0, minor = 0;
+    CU_CHECK (cuCtxGetDevice (&device));
+    CU_CHECK (cuDeviceGetAttribute (&major, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR, device));
+    CU_CHECK (cuDeviceGetAttribute (&minor, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR, device));
+    std::string arch = OIIO::Strutil::fmt::format("--gpu-architecture=compute_{}{}",
+                                                  major, minor);
+    const char* nvrtc_options[] = { arch.c_str(), "-rdc=true" };
+
+    nvrtcProgram prog;
+    std::string forward_ptx;
+    bool compiled = nvrtcCreateProgram (&prog, forward_src.c_str(),
+                                        "osl_grid_forward.cu", 0, nullptr,
+                                        nullptr) == NVRTC_SUCCESS;
+    if (compiled) {
+        compiled = nvrtcCompileProgram (prog, 2, nvrtc_options) == NVRTC_SUCCESS;
+        size_t size = 0;
+        if (compiled && nvrtcGetPTXSize (prog, &size) == NVRTC_SUCCESS) {
+            forward_ptx.resize (size);
+            compiled = nvrtcGetPTX (prog, &forward_ptx[0]) == NVRTC_SUCCESS;
+        }
+        nvrtcDestroyProgram (&prog);
+    }
+    if (! compiled || forward_ptx.empty()) {
+        errhandler().errorfmt("Could not compile the launcher for ShaderGroup {}",
+                              group_name);
+        return false;
+    }
+
+    char error_log[8192] = "";
+    CUjit_option link_options[] = { CU_JIT_ERROR_LOG_BUFFER,
+                                    CU_JIT_ERROR_LOG_BUFFER_SIZE_BYTES };
+    void* link_values[] = { error_log, (void*)(uintptr_t)sizeof(error_log) };
+    CUlinkState link;
+    CU_CHECK (cuLinkCreate (2, link_options, link_values, &link));
+    struct { const std::string* ptx; const char* name; } inputs[] = {
+        { &launcher_ptx, "cuda_grid_renderer.ptx" },
+        { &forward_ptx,  "osl_grid_forward.ptx" },
+        { &rend_lib_ptx, "rend_lib.ptx" },
+        { &osl_ptx,      "group.ptx" },
+    };
+    bool linked = true;
+    for (auto& in : inputs)
+        linked = linked && cuLinkAddData (link, CU_JIT_INPUT_PTX,
+                                          (void*)in.ptx->c_str(),
+                                          in.ptx->size(), in.name, 0,
+                                          nullptr, nullptr) == CUDA_SUCCESS;
+    void* cubin = nullptr;
+    size_t cubin_size = 0;
+    GroupKernel kernel;
+    linked = linked && cuLinkComplete (link, &cubin, &cubin_size) == CUDA_SUCCESS
+             && cuModuleLoadData (&kernel.module, cubin) == CUDA_SUCCESS;
+    cuLinkDestroy (link);
+    if (! linked) {
+        errhandler().errorfmt("Could not link ShaderGroup {}: {}",
+                              group_name, error_log);
+        return false;
+    }
+    CU_CHECK (cuModuleGetFunction (&kernel.setglobals, kernel.module, "setglobals"));
+    CU_CHECK (cuModuleGetFunction (&kernel.shade, kernel.module, "shade_grid"));
+    m_kernels[&group] = kernel;
+    return true;
+}
+
+
+
+CudaGridParams
+CudaGridRenderer::globals_params ()
+{
+    CudaGridParams params = {};
+    params.osl_printf_buffer_start = d_osl_printf_buffer;
+    params.osl_printf_buffer_end   = d_osl_printf_buffer + OSL_PRINTF_BUFFER_SIZE;
+    params.color_system            = d_color_system;
+    params.test_str_1              = test_str_1;
+    params.test_str_2              = test_str_2;
+    params.object2common           = d_object2common;
+    params.shader2common           = d_shader2common;
+    params.num_named_xforms        = m_num_named_xforms;
+    params.xform_name_buffer       = d_xform_name_buffer;
+    params.xform_buffer            = d_xform_buffer;
+    params.num_pointclouds         = m_num_pointclouds;
+    params.pointcloud_name_buffer  = d_pointcloud_name_buffer;
+    params.pointcloud_buffer       = d_pointcloud_buffer;
+    return params;
+}
+
+
+
+bool
+CudaGridRenderer::shade_points (ShaderGroup &group, int npoints, int xres,
+                                const CudaGridParams &inputs,
+                                cspan<ustring> outputs, float *d_results)
+{
+    auto found = m_kernels.find (&group);
+    if (found == m_kernels.end()) {
+        errhandler().errorfmt("No CUDA kernel for the shader group");
+        return false;
+    }
+    if (npoints <= 0)
+        return true;
+    xres = std::max (xres, 1);
+    int yres = (npoints + xres - 1) / xres;
+
+    // Where each output is in the groupdata, and where it goes
+    std::vector<CudaGridOutput> outs;
+    size_t nfloats = 0;
+    for (ustring name : outputs) {
+        const ShaderSymbol* sym = shadingsys->find_symbol (group, name);
+        TypeDesc type = sym ? shadingsys->symbol_typedesc (sym) : TypeDesc();
+        int offset = sym ? shadingsys->symbol_offset (sym) : -1;
+        if (offset < 0 || type.basetype != TypeDesc::FLOAT) {
+            errhandler().errorfmt("Output \"{}\" is not a float-based value computed by the group",
+                                  name);
+            return false;
+        }
+        CudaGridOutput o;
+        o.offset  = offset;
+        o.nfloats = type.basevalues();
+        o.dst     = reinterpret_cast<CUdeviceptr>(d_results) + nfloats * npoints * sizeof(float);
+        outs.push_back (o);
+        nfloats += o.nfloats;
+    }
+
+    CudaGridParams params = globals_params ();
+    params.npoints = npoints;
+    params.xres    = xres;
+    params.invw    = 1.0f / xres;
+    params.invh    = 1.0f / yres;
+    params.flipv   = false;
+    for (int c = 0; c < 3; ++c) {
+        params.P[c] = inputs.P[c];
+        params.N[c] = inputs.N[c];
+    }
+    params.u    = inputs.u;
+    params.v    = inputs.v;
+    params.dudx = inputs.dudx;
+    params.dudy = inputs.dudy;
+    params.dvdx = inputs.dvdx;
+    params.dvdy = inputs.dvdy;
+
+    CUdeviceptr d_outputs = 0;
+    if (outs.size()) {
+        CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&d_outputs), outs.size() * sizeof(CudaGridOutput)));
+        CUDA_CHECK (cudaMemcpy (reinterpret_cast<void *>(d_outputs), outs.data(), outs.size() * sizeof(CudaGridOutput), cudaMemcpyHostToDevice));
+    }
+    params.outputs  = d_outputs;
+    params.noutputs = outs.size();
+
+    CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&params.closure_pool), std::max (size_t(1), npoints * m_closure_pool_stride)));
+    CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&params.heap_pool), std::max (size_t(1), npoints * m_heap_pool_stride)));
+    params.closure_pool_stride = m_closure_pool_stride;
+    params.heap_pool_stride    = m_heap_pool_stride;
+
+    void* args[] = { &params };
+    const GroupKernel& kernel (found->second);
+    CU_CHECK (cuLaunchKernel (kernel.setglobals, 1, 1, 1, 1, 1, 1, 0,
+                              m_cuda_stream, args, nullptr));
+    CU_CHECK (cuLaunchKernel (kernel.shade,
+                              (npoints + block_size - 1) / block_size, 1, 1,
+                              block_size, 1, 1, 0, m_cuda_stream, args,
+                              nullptr));
+    CUDA_CHECK (cudaStreamSynchronize (m_cuda_stream));
+
+    cudaFree (reinterpret_cast<void *>(params.closure_pool));
+    cudaFree (reinterpret_cast<void *>(params.heap_pool));
+    if (d_outputs)
+        cudaFree (reinterpret_cast<void *>(d_outputs));
+
+    // Print what the shaders printed, and start the next launch afresh
+    std::vector<uint8_t> printf_buffer(OSL_PRINTF_BUFFER_SIZE);
+    CUDA_CHECK (cudaMemcpy (printf_buffer.data(), reinterpret_cast<void *>(d_osl_printf_buffer), OSL_PRINTF_BUFFER_SIZE, cudaMemcpyDeviceToHost));
+    processPrintfBuffer (printf_buffer.data(), OSL_PRINTF_BUFFER_SIZE);
+    CUDA_CHECK (cudaMemset (reinterpret_cast<void *>(d_osl_printf_buffer), 0, OSL_PRINTF_BUFFER_SIZE));
+    return true;
+}
+
+
+
+void
+CudaGridRenderer::warmup ()
+{
+    // A one-point launch gets the module onto the device
+    if (shaders().size())
+        shade_points (*shaders().front(), 1, 1, CudaGridParams(), {}, nullptr);
+}
+
+
+
+void
+CudaGridRenderer::render (int xres, int yres)
+{
+    if (shaders().empty())
+        return;
+    m_xres = xres;
+    m_yres = yres;
+    ShaderGroup& group (*shaders().front());
+
+    ustring cout ("Cout");
+    cspan<ustring> outputs;
+    if (shadingsys->find_symbol (group, cout))
+        outputs = cspan<ustring> (&cout, 1);
+    if (! d_cout) {
+        CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&d_cout), xres * yres * 3 * sizeof(float)));
+        CUDA_CHECK (cudaMemset (reinterpret_cast<void *>(d_cout), 0, xres * yres * 3 * sizeof(float)));
+        m_ptrs_to_free.push_back (reinterpret_cast<void*>(d_cout));
+    }
+    shade_points (group, xres * yres, xres, CudaGridParams(), outputs,
+                  reinterpret_cast<float*>(d_cout));
+}
+
+
+
+void
+CudaGridRenderer::finalize_pixel_buffer ()
+{
+    if (! d_cout)
+        return;
+    size_t npoints = size_t(m_xres) * m_yres;
+    std::vector<float> planar (npoints * 3);
+    CUDA_CHECK (cudaMemcpy (planar.data(), reinterpret_cast<void *>(d_cout), npoints * 3 * sizeof(float), cudaMemcpyDeviceToHost));
+    std::vector<float> pixels (npoints * 3);
+    for (size_t i = 0; i < npoints; ++i)
+        for (int c = 0; c < 3; ++c)
+            pixels[i * 3 + c] = planar[c * npoints + i];
+    OIIO::ImageBuf* buf = outputbuf(0);
+    if (buf)
+        buf->set_pixels (OIIO::ROI::All(), OIIO::TypeFloat, pixels.data());
+}
+
+
+OSL_NAMESPACE_EXIT
+
+#endif
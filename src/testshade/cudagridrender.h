@@ -0,0 +1,70 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include "optixgridrender.h"
+
+#if defined(OSL_USE_OPTIX) && (OPTIX_VERSION >= 70000)
+#include <unordered_map>
+#include <cuda.h>
+#include "render_params.h"
+
+OSL_NAMESPACE_ENTER
+
+
+/// A grid renderer that runs the PTX OSL emits for a group as a plain CUDA
+/// compute kernel, with no OptiX context, pipeline or shader binding
+/// table: the group's PTX is linked with the renderer support library
+/// and the launcher kernel (cuda/cuda_grid_renderer.cu) by the CUDA
+/// driver, and each point is a thread. This suits shading a grid of
+/// points, e.g. baking textures, where nothing traces rays.
+///
+/// It shares the device-side setup (strings, color system, transforms,
+/// textures, printf) with OptixGridRenderer, and needs OSL built with
+/// OptiX 7+ so that groups are compiled to PTX at all.
+class CudaGridRenderer final : public OptixGridRenderer
+{
+public:
+    CudaGridRenderer ();
+    virtual ~CudaGridRenderer ();
+
+    virtual bool make_optix_materials ();
+    virtual void warmup ();
+    virtual void render (int xres, int yres);
+    virtual void finalize_pixel_buffer ();
+
+    /// Shade npoints points with a group (one of shaders(), after
+    /// prepare_render()), in the manner of shade_image: the inputs are
+    /// device arrays of npoints floats per component (P[3], N[3], u, v,
+    /// and the u and v derivatives), any of which may be 0 to take its
+    /// value from an xres-wide image lattice instead. Each of the named
+    /// outputs is copied out as one device array of npoints floats per
+    /// float in its type, in order, starting at d_results. Return false
+    /// if the group has no kernel or an output isn't a float-based
+    /// symbol that the group computes.
+    bool shade_points (ShaderGroup &group, int npoints, int xres,
+                       const CudaGridParams &inputs, cspan<ustring> outputs,
+                       float *d_results);
+
+private:
+    // The linked module of each group, and its two kernels
+    struct GroupKernel {
+        CUmodule   module = nullptr;
+        CUfunction setglobals = nullptr;
+        CUfunction shade = nullptr;
+    };
+    std::unordered_map<const ShaderGroup*, GroupKernel> m_kernels;
+
+    bool link_group (ShaderGroup &group, const std::string &launcher_ptx,
+                     const std::string &rend_lib_ptx);
+    CudaGridParams globals_params ();
+
+    CUdeviceptr d_cout = 0;   // render()'s Cout, 3 planar arrays
+};
+
+
+OSL_NAMESPACE_EXIT
+
+#endif
@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <vector>
 
 #include <OpenImageIO/filesystem.h>
@@ -82,7 +83,7 @@ static void context_log_cb (unsigned int level, const char* tag, const char* mes
 #endif
 #endif
 
-OptixGridRenderer::OptixGridRenderer ()
+OptixGridRenderer::OptixGridRenderer (bool with_optix OSL_MAYBE_UNUSED)
 {
 #ifdef OSL_USE_OPTIX
 
@@ -100,22 +101,22 @@ OptixGridRenderer::OptixGridRenderer ()
     // Initialize CUDA
     cudaFree(0);
 
-    CUcontext cuCtx = nullptr;  // zero means take the current context
+    if (with_optix) {
+        CUcontext cuCtx = nullptr;  // zero means take the current context
 
-    OptixDeviceContextOptions ctx_options = {};
-    ctx_options.logCallbackFunction = context_log_cb;
-    ctx_options.logCallbackLevel    = 4;
+        OptixDeviceContextOptions ctx_options = {};
+        ctx_options.logCallbackFunction = context_log_cb;
+        ctx_options.logCallbackLevel    = 4;
 
-    OPTIX_CHECK (optixInit());
-    OPTIX_CHECK (optixDeviceContextCreate (cuCtx, &ctx_options, &m_optix_ctx));
+        OPTIX_CHECK (optixInit());
+        OPTIX_CHECK (optixDeviceContextCreate (cuCtx, &ctx_options, &m_optix_ctx));
+    }
 
     CUDA_CHECK (cudaSetDevice (0));
     CUDA_CHECK (cudaStreamCreate (&m_cuda_stream));
 
-#define STRDECL(str,var_name)                                           \
-    register_string (str, OSL_NAMESPACE_STRING "::DeviceStrings::" #var_name);
-#include <OSL/strdecls.h>
-#undef STRDECL
+    // The standard strings are hashed at compile time (see
+    // OSL::Hashes), so only strings made at runtime are registered.
 #endif //#if (OPTIX_VERSION < 70000)
 
 #endif //#ifdef OSL_USE_OPTIX
@@ -434,6 +435,16 @@ OptixGridRenderer::make_optix_materials ()
     char msg_log[8192];
     size_t sizeof_msg_log;
 
+    // Keep OptiX's own cache of compiled modules along with the PTX cache
+    // (ptx_cache_dir), so that a second run skips the driver's JIT too.
+    std::string ptx_cache_dir;
+    if (shadingsys->getattribute ("ptx_cache_dir", ptx_cache_dir)
+          && ptx_cache_dir.size()) {
+        OPTIX_CHECK (optixDeviceContextSetCacheLocation (m_optix_ctx,
+                                                         ptx_cache_dir.c_str()));
+        OPTIX_CHECK (optixDeviceContextSetCacheEnabled (m_optix_ctx, 1));
+    }
+
     // Make module that contains programs we'll use in this scene
     OptixModuleCompileOptions module_compile_options = {};
 
@@ -625,6 +636,16 @@ OptixGridRenderer::make_optix_materials ()
             }
         }
 
+        // Size the closure and heap pools for the largest group, with a
+        // fixed budget for closures whose use couldn't be bounded.
+        int closure_pool_size = -1, groupdata_size = 0;
+        shadingsys->getattribute (groupref.get(), "closure_pool_size", closure_pool_size);
+        shadingsys->getattribute (groupref.get(), "groupdata_size", groupdata_size);
+        if (closure_pool_size < 0)
+            closure_pool_size = UNBOUNDED_CLOSURE_POOL_SIZE;
+        m_closure_pool_stride = std::max (m_closure_pool_stride, size_t(closure_pool_size));
+        m_heap_pool_stride    = std::max (m_heap_pool_stride, size_t(groupdata_size));
+
         std::string group_name, init_name, entry_name;
         shadingsys->getattribute (groupref.get(), "groupname",        group_name);
         shadingsys->getattribute (groupref.get(), "group_init_name",  init_name);
@@ -694,10 +715,14 @@ OptixGridRenderer::make_optix_materials ()
         //    printf ("Creating 'shader' group for group '%s':\n%s\n", group_name.c_str(), msg_log);
     }
 
+    register_pointclouds();
+
 
     OptixPipelineLinkOptions pipeline_link_options;
     pipeline_link_options.maxTraceDepth          = 1;
-    pipeline_link_options.debugLevel             = OPTIX_COMPILE_DEBUG_LEVEL_FULL;
+    // Link at the same debug level the modules were compiled at: FULL
+    // here would deoptimize the whole pipeline, shaders included.
+    pipeline_link_options.debugLevel             = module_compile_options.debugLevel;
 #if (OPTIX_VERSION < 70100)
     pipeline_link_options.overrideUsesMotionBlur = false;
 #endif
@@ -1070,6 +1095,21 @@ OptixGridRenderer::render(int xres OSL_MAYBE_UNUSED, int yres OSL_MAYBE_UNUSED)
     params.num_named_xforms      = m_num_named_xforms;
     params.xform_name_buffer     = d_xform_name_buffer;
     params.xform_buffer          = d_xform_buffer;
+    params.num_pointclouds       = m_num_pointclouds;
+    params.pointcloud_name_buffer = d_pointcloud_name_buffer;
+    params.pointcloud_buffer     = d_pointcloud_buffer;
+
+    // One slice of each pool per point, kept 16-byte aligned
+    m_closure_pool_stride = (m_closure_pool_stride + 15) & ~size_t(15);
+    m_heap_pool_stride    = (m_heap_pool_stride + 15) & ~size_t(15);
+    CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&d_closure_pool), std::max (size_t(1), xres * yres * m_closure_pool_stride)));
+    CUDA_CHECK (cudaMalloc (reinterpret_cast<void **>(&d_heap_pool), std::max (size_t(1), xres * yres * m_heap_pool_stride)));
+    m_ptrs_to_free.push_back (reinterpret_cast<void*>(d_closure_pool));
+    m_ptrs_to_free.push_back (reinterpret_cast<void*>(d_heap_pool));
+    params.closure_pool          = d_closure_pool;
+    params.heap_pool             = d_heap_pool;
+    params.closure_pool_stride   = m_closure_pool_stride;
+    params.heap_pool_stride      = m_heap_pool_stride;
 
     CUDA_CHECK (cudaMemcpy (reinterpret_cast<void *>(d_launch_params), &params, sizeof(RenderParams), cudaMemcpyHostToDevice));
 
@@ -1128,7 +1168,7 @@ OptixGridRenderer::processPrintfBuffer(void *buffer_data, size_t buffer_size)
         // have we reached the end?
         if (fmt_str_hash == 0)
             break;
-        const char *format = m_hash_map[fmt_str_hash];
+        const char *format = hash_to_string (fmt_str_hash);
         OSL_ASSERT(format != nullptr && "The format string should have been registered with the renderer");
         const size_t len = strlen(format);
 
@@ -1164,7 +1204,7 @@ OptixGridRenderer::processPrintfBuffer(void *buffer_data, size_t buffer_size)
                         case 's':
                             src = (src + sizeof(double) - 1) & ~(sizeof(double)-1);
                             uint64_t str_hash = *reinterpret_cast<const uint64_t *>(&ptr[src]);
-                            const char *str = m_hash_map[str_hash];
+                            const char *str = hash_to_string (str_hash);
                             OSL_ASSERT(str != nullptr && "The string should have been regisgtered with the renderer");
                             dst += snprintf(&buffer[dst], BufferSize - dst, fmt_string.c_str(), str);
                             src += sizeof(uint64_t);
@@ -1301,5 +1341,64 @@ OptixGridRenderer::register_named_transforms()
 #endif // ifdef OSL_USE_OPTIX
 }
 
+#if defined(OSL_USE_OPTIX) && (OPTIX_VERSION >= 70000)
+void
+OptixGridRenderer::register_pointclouds()
+{
+    // Copy each point cloud that a shader group reads to the device, as
+    // the block that rend_lib's pointcloud_search and pointcloud_get walk,
+    // and list them by the ustring hash of their filenames.
+    std::vector<uint64_t>    name_buffer;
+    std::vector<CUdeviceptr> cloud_buffer;
+    for (const auto& groupref : shaders()) {
+        int unknown = 0, nclouds = 0;
+        ustring* clouds = nullptr;
+        shadingsys->getattribute (groupref.get(), "unknown_pointclouds_needed", unknown);
+        shadingsys->getattribute (groupref.get(), "num_pointclouds_needed", nclouds);
+        shadingsys->getattribute (groupref.get(), "pointclouds_needed",
+                                  TypeDesc::PTR, &clouds);
+        if (unknown)
+            errhandler().warningfmt("A shader group reads point clouds whose "
+                                    "names aren't known until it runs; they "
+                                    "can't be found on the device");
+        for (int i = 0; i < nclouds; ++i) {
+            uint64_t name = clouds[i].hash();
+            if (std::find (name_buffer.begin(), name_buffer.end(), name)
+                    != name_buffer.end())
+                continue;
+            std::vector<char> image;
+            if (! shadingsys->pointcloud_device_image (clouds[i], image)) {
+                errhandler().warningfmt("Could not copy point cloud "{}" "
+                                        "to the device", clouds[i]);
+                continue;
+            }
+            CUdeviceptr d_cloud;
+            CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_cloud), image.size()));
+            CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_cloud), image.data(),
+                                  image.size(), cudaMemcpyHostToDevice));
+            m_ptrs_to_free.push_back(reinterpret_cast<void*>(d_cloud));
+            name_buffer.push_back(name);
+            cloud_buffer.push_back(d_cloud);
+        }
+    }
+
+    m_num_pointclouds = name_buffer.size();
+    if (name_buffer.empty())
+        return;
+
+    size_t sz = sizeof(uint64_t) * name_buffer.size();
+    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_pointcloud_name_buffer), sz));
+    CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_pointcloud_name_buffer),
+                          name_buffer.data(), sz, cudaMemcpyHostToDevice));
+    m_ptrs_to_free.push_back(reinterpret_cast<void*>(d_pointcloud_name_buffer));
+
+    sz = sizeof(CUdeviceptr) * cloud_buffer.size();
+    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_pointcloud_buffer), sz));
+    CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_pointcloud_buffer),
+                          cloud_buffer.data(), sz, cudaMemcpyHostToDevice));
+    m_ptrs_to_free.push_back(reinterpret_cast<void*>(d_pointcloud_buffer));
+}
+#endif
+
 OSL_NAMESPACE_EXIT
 
@@ -16,13 +16,13 @@
 OSL_NAMESPACE_ENTER
 
 
-class OptixGridRenderer final : public SimpleRenderer
+class OptixGridRenderer : public SimpleRenderer
 {
 public:
     // Just use 4x4 matrix for transformations
     typedef Matrix44 Transformation;
 
-    OptixGridRenderer ();
+    OptixGridRenderer () : OptixGridRenderer (true) {}
     virtual ~OptixGridRenderer ();
 
     uint64_t register_string (const std::string& str, const std::string& var_name)
@@ -40,6 +40,20 @@ public:
 #endif
     }
 
+#if OPTIX_VERSION >= 70000
+    // Map a string hash from the device back to its characters.  Strings
+    // made at runtime are in m_hash_map; anything else (such as the
+    // standard strings and shader constants, which are never registered)
+    // is still a ustring on the host.
+    const char* hash_to_string (uint64_t hash) const
+    {
+        auto found = m_hash_map.find (hash);
+        if (found != m_hash_map.end())
+            return found->second;
+        return ustring::from_hash (hash).c_str();
+    }
+#endif
+
     uint64_t register_global (const std::string& str, uint64_t value);
     bool     fetch_global (const std::string& str, uint64_t *value);
 
@@ -90,7 +104,16 @@ public:
     void processPrintfBuffer(void *buffer_data, size_t buffer_size);
 #endif
 
-private:
+protected:
+    // Set up CUDA, and OptiX too if with_optix (CudaGridRenderer, which
+    // shares the rest, launches its own kernels and doesn't need it).
+    explicit OptixGridRenderer (bool with_optix);
+
+#if defined(OSL_USE_OPTIX) && (OPTIX_VERSION >= 70000)
+    // Copy the point clouds the shader groups read to the device, once
+    // the groups have been optimized.
+    void register_pointclouds();
+#endif
 
     optix::Context m_optix_ctx = nullptr;
 
@@ -111,9 +134,18 @@ private:
     uint64_t                m_num_named_xforms;
     CUdeviceptr             d_xform_name_buffer;
     CUdeviceptr             d_xform_buffer;
+    uint64_t                m_num_pointclouds = 0;
+    CUdeviceptr             d_pointcloud_name_buffer = 0;
+    CUdeviceptr             d_pointcloud_buffer = 0;
     uint64_t                test_str_1;
     uint64_t                test_str_2;
     const unsigned long     OSL_PRINTF_BUFFER_SIZE = 8 * 1024 * 1024;
+    CUdeviceptr             d_closure_pool = 0;
+    CUdeviceptr             d_heap_pool    = 0;
+    size_t                  m_closure_pool_stride = 0;  // per launch index
+    size_t                  m_heap_pool_stride    = 0;  // per launch index
+    // Closure bytes per launch index for a group with unbounded closures
+    static constexpr size_t UNBOUNDED_CLOSURE_POOL_SIZE = 1024;
 
     std::unordered_map<uint64_t, const char *> m_hash_map;
 #endif
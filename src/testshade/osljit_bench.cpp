@@ -0,0 +1,357 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+// osljit_bench -- time each phase of JITing shader groups: creating the
+// LLVM module from the shadeop library bitcode, generating IR (with
+// BackendLLVM, or BatchedBackendLLVM for a batch width), LLVM's
+// optimization passes, and emitting machine code. Every group is built
+// and JITed afresh, several times, under each combination of width,
+// llvm_opt_preset and llvm_optimize level asked for, and the results are
+// written in machine readable form (JSON and/or CSV), tagged with the
+// LLVM version, so that they can be compared between builds, LLVM
+// versions and settings.
+//
+// The phase times are those of the group's stat:compile_* attributes;
+// "setup" includes creating the module and the JIT itself. Groups are
+// given as shader names (one layer each) or, with --group, as a group
+// specification in the ShaderGroupBegin syntax or a file holding one.
+
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <OpenImageIO/argparse.h>
+#include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/strutil.h>
+#include <OpenImageIO/sysutil.h>
+#include <OpenImageIO/timer.h>
+
+#include <OSL/oslexec.h>
+#include "simplerend.h"
+
+using namespace OSL;
+using namespace OIIO;
+
+
+static int iterations = 10;
+static bool quiet = false;
+static std::string json_filename;
+static std::string csv_filename;
+static std::string shaderpath;
+static std::string widths = "1";
+static std::string presets = "legacy,none,compile-fast,default,aggressive";
+static std::string llvm_optimize_levels = "0,1,2,3";
+static std::vector<std::string> groupspecs;
+static ErrorHandler errhandler;
+
+
+
+// A group to JIT: its name and its ShaderGroupBegin specification.
+struct GroupSource {
+    std::string name;
+    std::string spec;
+};
+
+static std::vector<GroupSource> sources;
+
+
+
+// One group JITed under one configuration.
+struct BenchResult {
+    std::string group;
+    int width;            // 1 for the scalar back end, else the batch width
+    std::string target;   // llvm_jit_target, "" for the host's
+    std::string preset;   // llvm_opt_preset
+    int llvm_optimize;    // only used by the "legacy" preset
+    int ops;              // after runtime optimization
+    // Seconds, averaged over the iterations
+    double specialize, setup, irgen, opt, jit, total;
+    double total_min;     // the fastest iteration
+};
+
+static std::vector<BenchResult> results;
+
+
+
+static int
+add_shader (int argc, const char *argv[])
+{
+    for (int i = 0; i < argc; ++i)
+        sources.push_back ({ argv[i],
+                             Strutil::fmt::format ("shader {} layer1", argv[i]) });
+    return 0;
+}
+
+
+
+static std::vector<int>
+int_list (const std::string& list)
+{
+    std::vector<int> vals;
+    for (auto s : Strutil::splitsv (list, ","))
+        vals.push_back (Strutil::stoi (s));
+    return vals;
+}
+
+
+
+static ShadingSystem*
+make_shadingsys (SimpleRenderer* rend, int width)
+{
+    ShadingSystem* ss = new ShadingSystem (rend, nullptr, &errhandler);
+    rend->init_shadingsys (ss);
+    register_closures (ss);
+    ss->attribute ("lockgeom", 1);
+    if (shaderpath.size())
+        ss->attribute ("searchpath:shader", shaderpath);
+    if (width > 1) {
+#if OSL_USE_BATCHED
+        if (! ss->configure_batch_execution_at (width)) {
+            std::cerr << "Batched execution at width " << width
+                      << " is not supported here, skipping\n";
+            delete ss;
+            return nullptr;
+        }
+#else
+        std::cerr << "Batched execution was not built, skipping width "
+                  << width << "\n";
+        delete ss;
+        return nullptr;
+#endif
+    }
+    return ss;
+}
+
+
+
+// Build the group afresh and JIT it, adding the time of each phase to r.
+static bool
+jit_once (ShadingSystem* ss, PerThreadInfo* thread_info,
+          const GroupSource& src, int width, BenchResult& r, double& total)
+{
+    ShaderGroupRef group = ss->ShaderGroupBegin (src.name, "surface", src.spec);
+    if (! group)
+        return false;
+    ss->ShaderGroupEnd (*group);
+
+    ShadingContext* ctx = ss->get_context (thread_info);
+    Timer timer;
+    if (width == 1)
+        ss->optimize_group (group.get(), ctx);
+#if OSL_USE_BATCHED
+    else if (width == 16)
+        ss->batched<16>().jit_group (group.get(), ctx);
+    else if (width == 8)
+        ss->batched<8>().jit_group (group.get(), ctx);
+    else
+        ss->batched<4>().jit_group (group.get(), ctx);
+#endif
+    total = timer();
+    ss->release_context (ctx);
+
+    float specialize = 0, setup = 0, irgen = 0, opt = 0, jit = 0;
+    int ops = 0;
+    ss->getattribute (group.get(), "stat:compile_specialization_time", specialize);
+    ss->getattribute (group.get(), "stat:compile_llvm_setup_time", setup);
+    ss->getattribute (group.get(), "stat:compile_llvm_irgen_time", irgen);
+    ss->getattribute (group.get(), "stat:compile_llvm_opt_time", opt);
+    ss->getattribute (group.get(), "stat:compile_llvm_jit_time", jit);
+    ss->getattribute (group.get(), "stat:compile_postopt_ops", ops);
+    r.specialize += specialize;
+    r.setup += setup;
+    r.irgen += irgen;
+    r.opt += opt;
+    r.jit += jit;
+    r.total += total;
+    r.ops = ops;
+    return true;
+}
+
+
+
+static void
+bench_config (ShadingSystem* ss, const GroupSource& src, int width,
+              const std::string& preset, int llvm_optimize)
+{
+    ss->attribute ("llvm_opt_preset", preset);
+    ss->attribute ("llvm_optimize", llvm_optimize);
+
+    BenchResult r { src.name, width, "", preset, llvm_optimize, 0,
+                    0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0e30 };
+    ss->getattribute ("llvm_jit_target", r.target);
+
+    PerThreadInfo* thread_info = ss->create_thread_info();
+    // One untimed run first, so that loading the shaders and anything
+    // else done once per ShadingSystem isn't counted.
+    BenchResult warmup (r);
+    double total = 0.0;
+    bool ok = jit_once (ss, thread_info, src, width, warmup, total);
+    for (int i = 0; ok && i < iterations; ++i) {
+        ok = jit_once (ss, thread_info, src, width, r, total);
+        r.total_min = std::min (r.total_min, total);
+    }
+    ss->destroy_thread_info (thread_info);
+    if (! ok) {
+        std::cerr << "Could not build group " << src.name << "\n";
+        return;
+    }
+
+    for (double* t : { &r.specialize, &r.setup, &r.irgen, &r.opt, &r.jit,
+                       &r.total })
+        *t /= iterations;
+    if (! quiet)
+        Strutil::print ("{:<20} w{:<2} {:<12} O{}  ops {:>6}  specialize {:7.2f}ms"
+                        "  setup {:7.2f}ms  irgen {:7.2f}ms  opt {:7.2f}ms"
+                        "  jit {:7.2f}ms  total {:7.2f}ms (min {:.2f}ms)\n",
+                        r.group, r.width, r.preset, r.llvm_optimize, r.ops,
+                        r.specialize * 1e3, r.setup * 1e3, r.irgen * 1e3,
+                        r.opt * 1e3, r.jit * 1e3, r.total * 1e3,
+                        r.total_min * 1e3);
+    results.push_back (r);
+}
+
+
+
+static void
+write_json (std::ostream& out)
+{
+    out << "{\n";
+    out << "  \"osl_version\": \"" << OSL_LIBRARY_VERSION_STRING << "\",\n";
+    out << "  \"llvm_version\": \"" << OSL_LLVM_FULL_VERSION << "\",\n";
+    out << "  \"iterations\": " << iterations << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r (results[i]);
+        out << Strutil::fmt::format (
+            "    {{ \"group\": \"{}\", \"width\": {}, \"target\": \"{}\", "
+            "\"preset\": \"{}\", \"llvm_optimize\": {}, \"ops\": {}, "
+            "\"specialize_ms\": {:.4f}, \"setup_ms\": {:.4f}, "
+            "\"irgen_ms\": {:.4f}, \"opt_ms\": {:.4f}, \"jit_ms\": {:.4f}, "
+            "\"total_ms\": {:.4f}, \"total_min_ms\": {:.4f} }}{}\n",
+            r.group, r.width, r.target, r.preset, r.llvm_optimize, r.ops,
+            r.specialize * 1e3, r.setup * 1e3, r.irgen * 1e3, r.opt * 1e3,
+            r.jit * 1e3, r.total * 1e3, r.total_min * 1e3,
+            i + 1 < results.size() ? "," : "");
+    }
+    out << "  ]\n}\n";
+}
+
+
+
+static void
+write_csv (std::ostream& out)
+{
+    out << "llvm_version,group,width,target,preset,llvm_optimize,ops,"
+           "specialize_ms,setup_ms,irgen_ms,opt_ms,jit_ms,total_ms,total_min_ms\n";
+    for (const BenchResult& r : results)
+        out << Strutil::fmt::format (
+            "{},{},{},{},{},{},{},{:.4f},{:.4f},{:.4f},{:.4f},{:.4f},{:.4f},{:.4f}\n",
+            OSL_LLVM_FULL_VERSION, r.group, r.width, r.target, r.preset,
+            r.llvm_optimize, r.ops, r.specialize * 1e3, r.setup * 1e3,
+            r.irgen * 1e3, r.opt * 1e3, r.jit * 1e3, r.total * 1e3,
+            r.total_min * 1e3);
+}
+
+
+
+static bool
+write_output (const std::string& filename, void (*writer)(std::ostream&))
+{
+    if (filename.empty())
+        return true;
+    if (filename == "-") {
+        writer (std::cout);
+        return true;
+    }
+    std::ofstream out;
+    Filesystem::open (out, filename);
+    if (! out) {
+        std::cerr << "Could not open " << filename << " for writing\n";
+        return false;
+    }
+    writer (out);
+    return true;
+}
+
+
+
+static void
+getargs (int argc, const char *argv[])
+{
+    bool help = false;
+    OIIO::ArgParse ap;
+    ap.options ("osljit_bench  (" OSL_INTRO_STRING ")\n"
+                "Usage:  osljit_bench [options] shader...",
+                "%*", add_shader, "",
+                "--help", &help, "Print help message",
+                "-q", &quiet, "Quiet mode (don't print each timing)",
+                "--iterations %d", &iterations,
+                    ustring::fmtformat("Times to JIT each group in each configuration (default: {})", iterations).c_str(),
+                "--group %L", &groupspecs, "Add a group, given as a specification or a file holding one (may be repeated)",
+                "--path %s", &shaderpath, "Search path for the shaders",
+                "--widths %s", &widths, "Comma-separated widths: 1 for the scalar back end, 4, 8 or 16 to JIT batched (default: 1)",
+                "--presets %s", &presets, "Comma-separated llvm_opt_preset values (default: all)",
+                "--llvm_optimize %s", &llvm_optimize_levels, "Comma-separated llvm_optimize levels for the \"legacy\" preset (default: 0,1,2,3)",
+                "--json %s", &json_filename, "Write results as JSON to this file ('-' for stdout)",
+                "--csv %s", &csv_filename, "Write results as CSV to this file ('-' for stdout)",
+                NULL);
+    if (ap.parse (argc, (const char**)argv) < 0) {
+        std::cerr << ap.geterror() << std::endl;
+        ap.usage ();
+        exit (EXIT_FAILURE);
+    }
+    if (help) {
+        ap.usage ();
+        exit (EXIT_FAILURE);
+    }
+    for (const std::string& g : groupspecs) {
+        GroupSource src { Strutil::fmt::format ("group{}", sources.size()), g };
+        if (Filesystem::exists (g)) {
+            src.name = Filesystem::filename (g);
+            if (! Filesystem::read_text_file (g, src.spec)) {
+                std::cerr << "Could not read " << g << "\n";
+                exit (EXIT_FAILURE);
+            }
+        }
+        sources.push_back (src);
+    }
+    if (sources.empty() || iterations < 1) {
+        ap.usage ();
+        exit (EXIT_FAILURE);
+    }
+}
+
+
+
+int
+main (int argc, char const *argv[])
+{
+    getargs (argc, argv);
+
+    std::unique_ptr<SimpleRenderer> rend (new SimpleRenderer);
+    for (int width : int_list (widths)) {
+        std::unique_ptr<ShadingSystem> ss (make_shadingsys (rend.get(), width));
+        if (! ss)
+            continue;
+        for (const GroupSource& src : sources) {
+            for (auto preset : Strutil::splitsv (presets, ",")) {
+                if (preset == "legacy") {
+                    for (int level : int_list (llvm_optimize_levels))
+                        bench_config (ss.get(), src, width, preset, level);
+                } else {
+                    bench_config (ss.get(), src, width, preset, 0);
+                }
+            }
+        }
+    }
+
+    bool ok = write_output (json_filename, write_json);
+    ok &= write_output (csv_filename, write_csv);
+    return (ok && results.size()) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
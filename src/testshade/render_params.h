@@ -17,10 +17,73 @@ struct RenderParams
     uint64_t    num_named_xforms;
     CUdeviceptr xform_name_buffer;
     CUdeviceptr xform_buffer;
+    uint64_t    num_pointclouds;
+    CUdeviceptr pointcloud_name_buffer;
+    CUdeviceptr pointcloud_buffer;
 
     // for used-data tests
     uint64_t test_str_1;
     uint64_t test_str_2;
+
+    // Closure and heap ("groupdata") storage, one stride-sized slice per
+    // launch index, sized to the needs of the largest shader group
+    CUdeviceptr closure_pool;
+    CUdeviceptr heap_pool;
+    uint64_t    closure_pool_stride;
+    uint64_t    heap_pool_stride;
+};
+
+// Where the CUDA grid kernel copies one output of the group after
+// shading: nfloats floats at offset in the groupdata go to nfloats
+// planar arrays of npoints floats each, starting at dst.
+struct CudaGridOutput
+{
+    uint64_t    offset;
+    uint64_t    nfloats;
+    CUdeviceptr dst;
+};
+
+// What the plain CUDA compute backend (CudaGridRenderer) launches its
+// kernel with. The inputs are planar (SoA) arrays of npoints floats, and
+// any that are 0 take their value from the xres-wide image lattice, as
+// the OptiX grid renderer would set them.
+struct CudaGridParams
+{
+    int      npoints;
+    int      xres;
+    float    invw;
+    float    invh;
+    bool     flipv;
+
+    CUdeviceptr P[3];
+    CUdeviceptr N[3];
+    CUdeviceptr u;
+    CUdeviceptr v;
+    CUdeviceptr dudx, dudy;
+    CUdeviceptr dvdx, dvdy;
+
+    CUdeviceptr outputs;        // array of CudaGridOutput
+    uint64_t    noutputs;
+
+    // Globals the renderer support library reads, as in RenderParams
+    CUdeviceptr osl_printf_buffer_start;
+    CUdeviceptr osl_printf_buffer_end;
+    CUdeviceptr color_system;
+    CUdeviceptr object2common;
+    CUdeviceptr shader2common;
+    uint64_t    num_named_xforms;
+    CUdeviceptr xform_name_buffer;
+    CUdeviceptr xform_buffer;
+    uint64_t    num_pointclouds;
+    CUdeviceptr pointcloud_name_buffer;
+    CUdeviceptr pointcloud_buffer;
+    uint64_t    test_str_1;
+    uint64_t    test_str_2;
+
+    CUdeviceptr closure_pool;
+    CUdeviceptr heap_pool;
+    uint64_t    closure_pool_stride;
+    uint64_t    heap_pool_stride;
 };
 #endif
 
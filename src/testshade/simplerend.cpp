@@ -133,6 +133,7 @@ SimpleRenderer::SimpleRenderer ()
 #if OSL_USE_BATCHED
 : m_batch_16_simple_renderer(*this)
 , m_batch_8_simple_renderer(*this)
+, m_batch_4_simple_renderer(*this)
 #endif
 {
     Matrix44 M;  M.makeIdentity();
@@ -398,6 +399,35 @@ SimpleRenderer::get_attribute (ShaderGlobals *sg, bool derivatives, ustring obje
 
 
 
+RendererServices::AttributeHandle *
+SimpleRenderer::resolve_attribute (ustring object, ustring name,
+                                   TypeDesc type)
+{
+    // The handle is just the getter's entry in the table, which stays
+    // put as long as the renderer does.
+    if (! options.get_int ("attribute_handles", 1))
+        return nullptr;   // look every attribute up by name instead
+    AttrGetterMap::iterator g = m_attr_getters.find (name);
+    if (g != m_attr_getters.end())
+        return &g->second;
+    return nullptr;
+}
+
+
+
+bool
+SimpleRenderer::get_attribute_by_handle (ShaderGlobals *sg,
+                                         AttributeHandle *handle,
+                                         bool derivatives, ustring object,
+                                         TypeDesc type, ustring name,
+                                         int index, void *val)
+{
+    AttrGetter getter = *(const AttrGetter *)handle;
+    return (this->*(getter)) (sg, derivatives, object, type, name, val);
+}
+
+
+
 bool
 SimpleRenderer::get_userdata (bool derivatives, ustring name, TypeDesc type,
                               ShaderGlobals *sg, void *val)
@@ -60,6 +60,13 @@ public:
                                       int index, void *val );
     virtual bool get_attribute (ShaderGlobals *sg, bool derivatives, ustring object,
                                 TypeDesc type, ustring name, void *val);
+    virtual AttributeHandle* resolve_attribute (ustring object, ustring name,
+                                                TypeDesc type);
+    virtual bool get_attribute_by_handle (ShaderGlobals *sg,
+                                          AttributeHandle *handle,
+                                          bool derivatives, ustring object,
+                                          TypeDesc type, ustring name,
+                                          int index, void *val);
     virtual bool get_userdata (bool derivatives, ustring name, TypeDesc type, 
                                ShaderGlobals *sg, void *val);
 
@@ -143,6 +150,7 @@ public:
 #if OSL_USE_BATCHED
     virtual BatchedRendererServices<16> * batched(WidthOf<16>) { return &m_batch_16_simple_renderer; }
     virtual BatchedRendererServices<8> * batched(WidthOf<8>) { return &m_batch_8_simple_renderer; }
+    virtual BatchedRendererServices<4> * batched(WidthOf<4>) { return &m_batch_4_simple_renderer; }
 #endif
 
 protected:
@@ -150,6 +158,7 @@ protected:
 #if OSL_USE_BATCHED
     BatchedSimpleRenderer<16> m_batch_16_simple_renderer;
     BatchedSimpleRenderer<8> m_batch_8_simple_renderer;
+    BatchedSimpleRenderer<4> m_batch_4_simple_renderer;
 #endif
 
     // Camera parameters
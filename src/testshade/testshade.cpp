@@ -3,8 +3,11 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <fstream>
+#include <iterator>
 #include <iostream>
 #include <locale>
 #include <memory>
@@ -19,6 +22,7 @@
 #include <OpenImageIO/imagebufalgo.h>
 #include <OpenImageIO/imagebufalgo_util.h>
 #include <OpenImageIO/imagecache.h>
+#include <OpenImageIO/parallel.h>
 #include <OpenImageIO/argparse.h>
 #include <OpenImageIO/strutil.h>
 #include <OpenImageIO/sysutil.h>
@@ -37,6 +41,7 @@
 #   include <OSL/batched_shaderglobals.h>
 #endif
 #include "optixgridrender.h"
+#include "cudagridrender.h"
 
 #include "render_state.h"
 #include "simplerend.h"
@@ -60,6 +65,8 @@ static std::vector<std::string> entrylayers;
 static std::vector<std::string> entryoutputs;
 static std::vector<int> entrylayer_index;
 static std::vector<const ShaderSymbol *> entrylayer_symbols;
+static std::vector<std::string> execoutputs;
+static std::vector<ustring> execoutput_names;
 static bool debug1 = false;
 static bool debug2 = false;
 static bool llvm_debug = false;
@@ -83,10 +90,18 @@ static bool use_group_outputs = false;
 static bool do_oslquery = false;
 static bool inbuffer = false;
 static bool use_shade_image = false;
+static bool shade_many = false;
+static bool batch_builder = false;
+static bool prefetch_textures = false;
+static bool object_rows = false;
 static bool userdata_isconnected = false;
 static bool print_outputs = false;
+static bool constant_outputs = false;
+static bool connect_by_index = false;
 static bool output_placement = true;
+static bool attribute_handles = true;
 static bool use_optix = OIIO::Strutil::stoi(OIIO::Sysutil::getenv("TESTSHADE_OPTIX"));
+static bool use_cuda = false;   // plain CUDA kernels, not an OptiX pipeline
 static int xres = 1, yres = 1;
 static int num_threads = 0;
 static std::string groupname;
@@ -98,15 +113,20 @@ static ParamValueList reparams;
 static std::string reparam_layer;
 static ErrorHandler errhandler;
 static int iters = 1;
+static std::string benchfile;
 static std::string raytype = "camera";
 static bool raytype_opt = false;
 static std::string extraoptions;
+static std::vector<std::string> shaderbundles;
+static std::vector<std::string> object_attributes;
 static std::string texoptions;
 static std::string colorspace;
 static OSL::Matrix44 Mshad;  // "shader" space to "common" space matrix
 static OSL::Matrix44 Mobj;   // "object" space to "common" space matrix
 static ShaderGroupRef shadergroup;
 static std::string archivegroup;
+static std::string aot_out, aot_in;
+static std::string replayfile;
 static int exprcount = 0;
 static bool shadingsys_options_set = false;
 static float uscale = 1, vscale = 1;
@@ -115,6 +135,10 @@ static std::vector<const char*> shader_setup_args;
 static std::string localename = OIIO::Sysutil::getenv("TESTSHADE_LOCALE");
 static OIIO::ParamValueList userdata;
 static char* userdata_base_ptr = nullptr;
+static OIIO::ParamValueList instancedata;
+static std::vector<uint64_t> instancedata_block;
+static OIIO::ParamValueList constattrs;
+static std::vector<std::string> constattr_objects;
 static char* output_base_ptr = nullptr;
 static bool use_rs_bitcode = false; // use free function bitcode version of renderer services 
 
@@ -204,6 +228,20 @@ set_shadingsys_options ()
 
     if (extraoptions.size())
         shadingsys->attribute ("options", extraoptions);
+    if (object_attributes.size()) {
+        std::vector<ustring> names (object_attributes.begin(),
+                                    object_attributes.end());
+        shadingsys->attribute ("object_attributes",
+                               TypeDesc(TypeDesc::STRING, int(names.size())),
+                               names.data());
+    }
+    for (size_t i = 0;  i < constattrs.size();  ++i)
+        shadingsys->constant_attribute (constattr_objects[i],
+                                        constattrs[i].name(),
+                                        constattrs[i].type(),
+                                        constattrs[i].data());
+    for (auto&& bundle : shaderbundles)
+        shadingsys->add_shader_bundle (bundle);
     if (texoptions.size())
         shadingsys->texturesys()->attribute ("options", texoptions);
 
@@ -226,6 +264,8 @@ set_shadingsys_options ()
     if (const char *opt_env = getenv ("TESTSHADE_LLVM_JIT_FMA"))
         llvm_jit_fma = atoi(opt_env);
     shadingsys->attribute ("llvm_jit_fma", llvm_jit_fma);
+    if (aot_out.size())
+        shadingsys->attribute ("llvm_aot_output", 1);
 
     if (batched) {
 #if OSL_USE_BATCHED
@@ -244,6 +284,12 @@ set_shadingsys_options ()
                     break;
                 }
             }
+            if (!batch_size_requested || batch_size == 4) {
+                if (shadingsys->configure_batch_execution_at(4)) {
+                    batch_size = 4;
+                    break;
+                }
+            }
             std::cout << "WARNING:  Hardware or library requirements to utilize batched execution";
             ustring llvm_jit_target;
             shadingsys->getattribute ("llvm_jit_target", llvm_jit_target);
@@ -292,7 +338,9 @@ compile_buffer (const std::string &sourcecode,
 {
     // std::cout << "source was\n---\n" << sourcecode << "---\n\n";
     std::string osobuffer;
-    OSLCompiler compiler;
+    // One compiler for all of them, as a renderer compiling shaders at
+    // runtime would keep.
+    static OSLCompiler compiler;
     std::vector<std::string> options;
 
     if (! compiler.compile_buffer (sourcecode, osobuffer, options)) {
@@ -591,12 +639,34 @@ stash_userdata(int argc, const char* argv[])
 
 
 
+static void
+stash_instancedata(int argc, const char* argv[])
+{
+    add_param(instancedata, argv[0], argv[1], argv[2]);
+}
+
+
+
+static void
+stash_constattr(int argc, const char* argv[])
+{
+    constattr_objects.emplace_back (argv[1]);
+    add_param(constattrs, argv[0], argv[2], argv[3]);
+}
+
+
+
 void
 print_info()
 {
     ErrorHandler errhandler;
     SimpleRenderer* rend = nullptr;
 #ifdef OSL_USE_OPTIX
+#if OPTIX_VERSION >= 70000
+    if (use_cuda)
+        rend = new CudaGridRenderer;
+    else
+#endif
     if (use_optix)
         rend = new OptixGridRenderer;
     else
@@ -633,6 +703,7 @@ getargs (int argc, const char *argv[])
                 "-v", &verbose, "Verbose messages",
                 "-t %d", &num_threads, "Render using N threads (default: auto-detect)",
                 "--optix", &use_optix, "Use OptiX if available",
+                "--cuda", &use_cuda, "Use plain CUDA kernels (no OptiX pipeline) if available",
                 "--debug", &debug1, "Lots of debugging info",
                 "--debug2", &debug2, "Even more debugging info",
                 "--llvm_debug", &llvm_debug, "Turn on LLVM debugging info",
@@ -648,6 +719,7 @@ getargs (int argc, const char *argv[])
                 "--res %d %d", &xres, &yres, "Make an W x H image",
                 "-g %d %d", &xres, &yres, "", // synonym for -res
                 "--options %s", &extraoptions, "Set extra OSL options",
+                "--bundle %L", &shaderbundles, "Find shaders in this shader bundle file (may be repeated)",
                 "--texoptions %s", &texoptions, "Set extra TextureSystem options",
                 "--colorspace %s", &colorspace, "Set ShadingSysem colorspace",
                 "-o %L %L", &outputvars, &outputfiles,
@@ -656,6 +728,7 @@ getargs (int argc, const char *argv[])
                         "uint8, half, float",
                 "-od %s", &dataformatname, "", // old name
                 "--print", &print_outputs, "Print values of all -o outputs to console instead of saving images",
+                "--constant-outputs", &constant_outputs, "Report which -o outputs the optimized group leaves constant",
                 "--groupname %s", &groupname, "Set shader group name",
                 "--layer %@ %s", stash_shader_arg, NULL, "Set next layer name",
                 "--param %@ %s %s", stash_shader_arg, NULL, NULL,
@@ -665,21 +738,30 @@ getargs (int argc, const char *argv[])
                 "--connect %@ %s %s %s %s",
                     stash_shader_arg, NULL, NULL, NULL, NULL,
                     "Connect fromlayer fromoutput tolayer toinput",
+                "--connect-by-index", &connect_by_index,
+                    "Make all the --connect connections at once, by layer and parameter index",
                 "--reparam %@ %s %s %s", stash_shader_arg, NULL, NULL, NULL,
                         "Change a parameter (args: layername paramname value) (options: type=%s)",
                 "--group %@ %s", stash_shader_arg, NULL,
                         "Specify a full group command",
                 "--archivegroup %s", &archivegroup,
                         "Archive the group to a given filename",
+                "--aot-out %s", &aot_out,
+                        "Also compile the group ahead of time, into the given file",
+                "--aot-in %s", &aot_in,
+                        "Load the group's precompiled code (from --aot-out) instead of JITing it",
                 "--raytype %s", &raytype, "Set the raytype",
                 "--raytype_opt", &raytype_opt, "Specify ray type mask for optimization",
                 "--iters %d", &iters, "Number of iterations",
+                "--replay %s", &replayfile, "Re-execute the points captured in this file (see the \"capture\" option) --iters times, instead of shading",
+                "--bench %s", &benchfile, "Time each iteration and write benchmark results as JSON to this file (\"-\" for stdout)",
                 "-O0", &O0, "Do no runtime shader optimization",
                 "-O1", &O1, "Do a little runtime shader optimization",
                 "-O2", &O2, "Do lots of runtime shader optimization",
                 "--llvm_opt %d", &llvm_opt, "LLVM JIT optimization level",
                 "--entry %L", &entrylayers, "Add layer to the list of entry points",
                 "--entryoutput %L", &entryoutputs, "Add output symbol to the list of entry points",
+                "--execoutput %L", &execoutputs, "Execute computing only this output (add more for a subset; see output_variants)",
                 "--center", &pixelcenters, "Shade at output pixel 'centers' rather than corners",
                 "--debugnan", &debugnan, "Turn on 'debug_nan' mode",
                 "--debuguninit", &debug_uninit, "Turn on 'debug_uninit' mode",
@@ -688,8 +770,15 @@ getargs (int argc, const char *argv[])
                 "--inbuffer", &inbuffer, "Compile osl source from and to buffer",
                 "--no-output-placement %!", &output_placement,
                         "Turn off use of output placement, rely only on get_symbol",
+                "--no-attribute-handles %!", &attribute_handles,
+                        "Don't resolve getattribute names to renderer handles when JITing",
                 "--shadeimage", &use_shade_image, "Use shade_image utility",
                 "--noshadeimage %!", &use_shade_image, "Don't use shade_image utility",
+                "--shademany", &shade_many, "Shade each row of points with one execute_many call",
+                "--prefetch-textures", &prefetch_textures, "Prefetch the group's textures before shading, and report how many files that opened",
+                "--object-rows", &object_rows, "Shade each row of points as a separate object (see ShadingSystem::set_object)",
+                "--object-attribute %L", &object_attributes, "Add an attribute or userdata that is the same over each object (see \"object_attributes\")",
+                "--batchbuilder", &batch_builder, "With --batched, hand the points one at a time to a BatchBuilder to gather into batches",
                 "--expr %@ %s", stash_shader_arg, NULL, "Specify an OSL expression to evaluate",
                 "--offsetuv %f %f", &uoffset, &voffset, "Offset s & t texture coordinates (default: 0 0)",
                 "--offsetst %f %f", &uoffset, &voffset, "", // old name
@@ -698,6 +787,10 @@ getargs (int argc, const char *argv[])
                 "--userdata %@ %s %s", stash_userdata, nullptr, nullptr,
                         "Add userdata (args: name value) (options: type=%s)",
                 "--userdata_isconnected", &userdata_isconnected, "Consider lockgeom=0 to be isconnected()",
+                "--instancedata %@ %s %s", stash_instancedata, nullptr, nullptr,
+                        "Make a param instance data, read from the userdata arena at execution (args: name value) (options: type=%s)",
+                "--constattr %@ %s %s %s", stash_constattr, nullptr, nullptr, nullptr,
+                        "Declare a renderer attribute constant, for the optimizer to fold (args: object name value; \"\" for no object) (options: type=%s)",
                 "--locale %s", &localename, "Set a different locale",
                 "--use_rs_bitcode", &use_rs_bitcode, "Use free function bitcode Renderer services",
                 NULL);
@@ -706,6 +799,9 @@ getargs (int argc, const char *argv[])
         ap.usage ();
         exit (EXIT_FAILURE);
     }
+    // The CUDA renderer runs the same device code as the OptiX one
+    if (use_cuda)
+        use_optix = true;
     if (help) {
         std::cout << "testshade -- Test Open Shading Language\n"
                      OSL_COPYRIGHT_STRING "\n";
@@ -717,6 +813,39 @@ getargs (int argc, const char *argv[])
 
 
 
+// Find the layer and parameter indices, and the element or component of
+// a "param[i]", that --connect-by-index hands to ConnectShaders.
+static bool
+connection_indices (string_view layername, string_view paramname,
+                    int &layer, int &param, int &arrayindex, int &channel)
+{
+    layer = shadingsys->find_layer (*shadergroup, ustring(layername));
+    if (layer < 0)
+        return false;
+    int index = -1;
+    size_t bracket = paramname.find ('[');
+    if (bracket != string_view::npos) {
+        index = OIIO::Strutil::stoi (paramname.substr (bracket+1));
+        paramname = paramname.substr (0, bracket);
+    }
+    ustring name (paramname);
+    OSLQuery oslquery = shadingsys->oslquery (*shadergroup, layer);
+    for (size_t p = 0;  p < oslquery.nparams();  ++p) {
+        const OSLQuery::Parameter *qp = oslquery.getparam (p);
+        if (qp->name == name) {
+            param = int(p);
+            if (index >= 0 && qp->type.arraylen)
+                arrayindex = index;
+            else if (index >= 0)
+                channel = index;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+
 static void
 process_shader_setup_args (int argc, const char *argv[])
 {
@@ -894,6 +1023,11 @@ setup_output_images (SimpleRenderer *rend, ShadingSystem *shadingsys,
         outputfiles.emplace_back("null");
     }
 
+    // Outputs to execute for, if specified
+    execoutput_names.clear ();
+    for (auto&& o : execoutputs)
+        execoutput_names.emplace_back (o);
+
     // Declare entry layers, if specified
     // N.B. Maybe nobody cares about running individual layers manually,
     // and all this entry layer output nonsense can go away.
@@ -1034,9 +1168,11 @@ setup_output_images (SimpleRenderer *rend, ShadingSystem *shadingsys,
             // jit_group will optimize the group if necesssary
             if (batch_size == 16) {
                 shadingsys->batched<16>().jit_group (shadergroup.get(), ctx);
-            } else {
-                ASSERT((batch_size == 8) && "Unsupport batch size");
+            } else if (batch_size == 8) {
                 shadingsys->batched<8>().jit_group (shadergroup.get(), ctx);
+            } else {
+                ASSERT((batch_size == 4) && "Unsupport batch size");
+                shadingsys->batched<4>().jit_group (shadergroup.get(), ctx);
             }
         } else
 #endif
@@ -1283,6 +1419,41 @@ batched_save_outputs (SimpleRenderer *rend, ShadingSystem *shadingsys, ShadingCo
 
 
 
+// Report, for each -o output, whether the optimized group leaves it
+// constant (and if so, its value, which a renderer could use without
+// executing the group), merely uniform, or varying.
+static void
+report_constant_outputs (ShaderGroup *group)
+{
+    for (size_t i = 0;  i < outputvarnames.size();  ++i) {
+        ustring name = outputvarnames[i];
+        TypeDesc t = outputvartypes[i];
+        std::vector<char> value (t.size());
+        std::cout << "Output " << name;
+        if (shadingsys->getattribute (group, "output_is_constant:" + name.string(),
+                                      t, value.data())) {
+            std::cout << " is constant:";
+            for (int c = 0, n = int(t.numelements() * t.aggregate);  c < n;  ++c) {
+                if (t.basetype == TypeDesc::FLOAT)
+                    std::cout << ' ' << ((const float *)value.data())[c];
+                else if (t.basetype == TypeDesc::INT)
+                    std::cout << ' ' << ((const int *)value.data())[c];
+            }
+            std::cout << "\n";
+        } else {
+            int uniform = 0;
+            shadingsys->getattribute (group, "output_is_uniform:" + name.string(),
+                                      uniform);
+            std::cout << (uniform ? " is uniform\n" : " varies\n");
+        }
+    }
+    int empty = 0;
+    shadingsys->getattribute (group, "closure_output_empty", empty);
+    std::cout << "closure_output_empty: " << empty << "\n";
+}
+
+
+
 static void
 test_group_attributes (ShaderGroup *group)
 {
@@ -1385,6 +1556,50 @@ test_group_attributes (ShaderGroup *group)
 
 
 
+// With the "deferred_trace" option, the point just shaded on ctx recorded
+// its trace() calls rather than making them. Trace them all now, the way a
+// renderer that batches its rays would, and shade the point again with the
+// answers, until it asks for no more.
+static void
+answer_deferred_traces (SimpleRenderer *rend, ShaderGroup *shadergroup,
+                        ShadingContext *ctx, int x, int y, int shadeindex)
+{
+    static const std::pair<ustring, TypeDesc> trace_values[] = {
+        { ustring("hitdist"), TypeFloat },
+        { ustring("geom:name"), TypeString },
+        { ustring("N"), TypeNormal }
+    };
+    std::vector<RendererServices::TraceResult> results;
+    ShaderGlobals sg;
+    for (;;) {
+        auto requests = shadingsys->trace_requests (*ctx);
+        if (requests.empty())
+            break;
+        setup_shaderglobals (sg, shadingsys, x, y);
+        for (const auto& r : requests) {
+            RendererServices::TraceOpt opt = r.options;
+            results.emplace_back ();
+            auto& result (results.back());
+            result.hit = rend->trace (opt, &sg, r.P, r.dPdx, r.dPdy,
+                                      r.R, r.dRdx, r.dRdy);
+            for (const auto& v : trace_values) {
+                alignas(ustring) char buf[sizeof(Vec3)];
+                if (rend->getmessage (&sg, ustring("trace"), v.first,
+                                      v.second, buf, false))
+                    result.values.emplace_back (v.first, v.second, 1, buf);
+            }
+        }
+        // Results are for the trace() calls in the order they're made,
+        // so hand over all of them, not just this round's.
+        shadingsys->resume_traces (*ctx, results);
+        setup_shaderglobals (sg, shadingsys, x, y);
+        shadingsys->execute (*ctx, *shadergroup, shadeindex, sg,
+                             userdata_base_ptr, output_base_ptr);
+    }
+}
+
+
+
 void
 shade_region (SimpleRenderer *rend, ShaderGroup *shadergroup,
               OIIO::ROI roi, bool save)
@@ -1401,9 +1616,36 @@ shade_region (SimpleRenderer *rend, ShaderGroup *shadergroup,
     // Set up shader globals and a little test grid of points to shade.
     ShaderGlobals shaderglobals;
 
+    int deferred_trace = 0;
+    shadingsys->getattribute ("deferred_trace", deferred_trace);
+
+    // With --shademany, hand the shading system a row at a time. Without
+    // output placement, the outputs of each point would have to be read
+    // from the context right after it ran, so then shade one by one.
+    if (shade_many && entrylayer_index.empty() && execoutputs.empty()
+        && output_placement && !(save && print_outputs)) {
+        std::vector<ShaderGlobals> row (roi.width());
+        std::vector<int> shadeindices (roi.width());
+        for (int y = roi.ybegin;  y < roi.yend;  ++y) {
+            if (object_rows)
+                shadingsys->set_object (*ctx, y);
+            for (int x = roi.xbegin;  x < roi.xend;  ++x) {
+                setup_shaderglobals (row[x - roi.xbegin], shadingsys, x, y);
+                shadeindices[x - roi.xbegin] = y * xres + x;
+            }
+            shadingsys->execute_many (*ctx, *shadergroup, row, shadeindices,
+                                      userdata_base_ptr, output_base_ptr);
+        }
+        shadingsys->release_context (ctx);
+        shadingsys->destroy_thread_info(thread_info);
+        return;
+    }
+
     // Loop over all pixels in the image (in x and y)...
     for (int y = roi.ybegin;  y < roi.yend;  ++y) {
         int shadeindex = y * xres + roi.xbegin;
+        if (object_rows)
+            shadingsys->set_object (*ctx, y);
         for (int x = roi.xbegin;  x < roi.xend;  ++x, ++shadeindex) {
             // In a real renderer, this is where you would figure
             // out what object point is visible in this pixel (or
@@ -1421,11 +1663,19 @@ shade_region (SimpleRenderer *rend, ShaderGroup *shadergroup,
             setup_shaderglobals (shaderglobals, shadingsys, x, y);
 
             // Actually run the shader for this point
-            if (entrylayer_index.empty()) {
+            if (entrylayer_index.empty() && execoutputs.size()) {
+                // Just the outputs asked for
+                shadingsys->execute (*ctx, *shadergroup, execoutput_names,
+                                     shadeindex, shaderglobals,
+                                     userdata_base_ptr, output_base_ptr);
+            } else if (entrylayer_index.empty()) {
                 // Sole entry point for whole group, default behavior
                 shadingsys->execute (*ctx, *shadergroup, shadeindex,
                                      shaderglobals, userdata_base_ptr,
                                      output_base_ptr);
+                if (deferred_trace)
+                    answer_deferred_traces (rend, shadergroup, ctx, x, y,
+                                            shadeindex);
             } else {
                 // Explicit list of entries to call in order
                 shadingsys->execute_init (*ctx, *shadergroup, shadeindex,
@@ -1563,61 +1813,93 @@ setup_uniform_shaderglobals (BatchedShaderGlobals<WidthT> &bsg, ShadingSystem *s
     assign_all(vsg.backfacing, 0);
 }
 
+// Set up the varying ShaderGlobals of a batch of the points of the grid,
+// numbered in scanline order from 'first', and note their pixel x & y.
 template <int WidthT>
 static inline void
-setup_varying_shaderglobals (int lane, BatchedShaderGlobals<WidthT> & bsg, ShadingSystem *shadingsys,
-                     int x, int y)
+setup_varying_shaderglobals (BatchedShaderGlobals<WidthT> & bsg, int first,
+                             int (&bx)[WidthT], int (&by)[WidthT])
 {
     auto & vsg = bsg.varying;
 
+    // Step through the pixels rather than divide for each lane.  Lanes
+    // past the end of a short last batch get the points that would
+    // follow, which are never used but keep the loops below uniform.
+    int x = first % xres, y = first / xres;
+    for (int lane = 0; lane < WidthT; ++lane) {
+        bx[lane] = x;
+        by[lane] = y;
+        if (++x == xres) {
+            x = 0;
+            ++y;
+        }
+    }
+
     // Set up u,v to vary across the "patch", and also their derivatives.
     // Note that since u & x, and v & y are aligned, we only need to set
     // values for dudx and dvdy, we can use the memset above to have set
     // dvdx and dudy to 0.
-    float u;
-    float v;
-    if (pixelcenters) {
-        // Our patch is like an "image" with shading samples at the
-        // centers of each pixel.
-        u = uscale * (float)(x+0.5f) / xres + uoffset;
-        v = vscale * (float)(y+0.5f) / yres + voffset;
-    } else {
-        // Our patch is like a Reyes grid of points, with the border
-        // samples being exactly on u,v == 0 or 1.
-        u = uscale * ((xres == 1) ? 0.5f : (float) x / (xres - 1)) + uoffset;
-        v = vscale * ((yres == 1) ? 0.5f : (float) y / (yres - 1)) + voffset;
+    OSL_OMP_PRAGMA(omp simd simdlen(WidthT))
+    for (int lane = 0; lane < WidthT; ++lane) {
+        float u, v;
+        if (pixelcenters) {
+            // Our patch is like an "image" with shading samples at the
+            // centers of each pixel.
+            u = uscale * (float)(bx[lane]+0.5f) / xres + uoffset;
+            v = vscale * (float)(by[lane]+0.5f) / yres + voffset;
+        } else {
+            // Our patch is like a Reyes grid of points, with the border
+            // samples being exactly on u,v == 0 or 1.
+            u = uscale * ((xres == 1) ? 0.5f : (float) bx[lane] / (xres - 1)) + uoffset;
+            v = vscale * ((yres == 1) ? 0.5f : (float) by[lane] / (yres - 1)) + voffset;
+        }
+        vsg.u[lane] = u;
+        vsg.v[lane] = v;
+        // Assume that position P is simply (u,v,1), that makes the patch
+        // lie on [0,1] at z=1.
+        vsg.P[lane] = Vec3 (u, v, 1.0f);
     }
-
-    vsg.u[lane] = u;
-    vsg.v[lane] = v;
     if (vary_udxdy) {
-        vsg.dudx[lane] = 1.0f - u;
-        vsg.dudy[lane] = u;
+        OSL_OMP_PRAGMA(omp simd simdlen(WidthT))
+        for (int lane = 0; lane < WidthT; ++lane) {
+            float u = vsg.u[lane];
+            vsg.dudx[lane] = 1.0f - u;
+            vsg.dudy[lane] = u;
+        }
     }
     if (vary_vdxdy) {
-        vsg.dvdx[lane] = 1.0f - v;
-        vsg.dvdy[lane] = v;
+        OSL_OMP_PRAGMA(omp simd simdlen(WidthT))
+        for (int lane = 0; lane < WidthT; ++lane) {
+            float v = vsg.v[lane];
+            vsg.dvdx[lane] = 1.0f - v;
+            vsg.dvdy[lane] = v;
+        }
     }
-
-    // Assume that position P is simply (u,v,1), that makes the patch lie
-    // on [0,1] at z=1.
-    vsg.P[lane] = Vec3 (u, v, 1.0f);
     if (vary_Pdxdy) {
-        vsg.dPdx[lane] = Vec3 (1.0f - u, 1.0f - v, u*0.5);
-        vsg.dPdy[lane] = Vec3 (1.0f - v, 1.0f - u, v*0.5);
+        OSL_OMP_PRAGMA(omp simd simdlen(WidthT))
+        for (int lane = 0; lane < WidthT; ++lane) {
+            float u = vsg.u[lane];
+            float v = vsg.v[lane];
+            vsg.dPdx[lane] = Vec3 (1.0f - u, 1.0f - v, u*0.5);
+            vsg.dPdy[lane] = Vec3 (1.0f - v, 1.0f - u, v*0.5);
+        }
     }
 }
 
 
 
 
+// Shade the points of the grid numbered (in scanline order) from begin
+// to end, WidthT at a time.
 template <int WidthT>
 void OSL_NOINLINE
-batched_shade_region (SimpleRenderer *rend, ShaderGroup *shadergroup, OIIO::ROI roi, bool save);
+batched_shade_points (SimpleRenderer *rend, ShaderGroup *shadergroup,
+                      int begin, int end, bool save);
 
 template <int WidthT>
 void
-batched_shade_region (SimpleRenderer *rend, ShaderGroup *shadergroup, OIIO::ROI roi, bool save)
+batched_shade_points (SimpleRenderer *rend, ShaderGroup *shadergroup,
+                      int begin, int end, bool save)
 {
     // Request an OSL::PerThreadInfo for this thread.
     OSL::PerThreadInfo *thread_info = shadingsys->create_thread_info();
@@ -1628,46 +1910,51 @@ batched_shade_region (SimpleRenderer *rend, ShaderGroup *shadergroup, OIIO::ROI
     // within a thread.
     ShadingContext *ctx = shadingsys->get_context (thread_info);
 
+    if (batch_builder && entrylayer_index.empty()) {
+        // Hand over the points one at a time, as a renderer would its
+        // hits, and let a BatchBuilder gather them into batches.
+        ShadingSystem::BatchBuilder<WidthT> builder (*shadingsys, *ctx,
+            [&](ShadingContext &bctx, ShaderGroup &group, int batchSize,
+                Wide<const int, WidthT> wide_shadeindex,
+                BatchedShaderGlobals<WidthT> &) {
+                if (save && (print_outputs || !output_placement)) {
+                    int bx[WidthT], by[WidthT];
+                    for (int bi = 0; bi < batchSize; ++bi) {
+                        bx[bi] = wide_shadeindex[bi] % xres;
+                        by[bi] = wide_shadeindex[bi] / xres;
+                    }
+                    batched_save_outputs<WidthT>(rend, shadingsys, &bctx,
+                                                 &group, batchSize, bx, by);
+                }
+            }, userdata_base_ptr, output_base_ptr);
+        // Every point's renderstate is then the same, so they all batch.
+        ShaderGlobals sg;
+        for (int i = begin; i < end; ++i) {
+            setup_shaderglobals (sg, shadingsys, i % xres, i / xres);
+            builder.add (*shadergroup, sg, i);
+        }
+        builder.flush ();
+        shadingsys->release_context (ctx);
+        shadingsys->destroy_thread_info(thread_info);
+        return;
+    }
+
     // Set up shader globals and a little test grid of points to shade.
     BatchedShaderGlobals<WidthT> sgBatch;
     setup_uniform_shaderglobals (sgBatch, shadingsys);
 
-    // std::cout << "shading roi y(" << roi.ybegin << ", " << roi.yend << ")";
-    // std::cout << " x(" << roi.xbegin << ", " << roi.xend << ")" << std::endl;
-
-    int rwidth = roi.width();
-    int rheight = roi.height();
-    int nhits = rwidth*rheight;
-
-    int oHitIndex = 0;
-    while (oHitIndex < nhits) {
+    for (int first = begin; first < end; first += WidthT) {
         OSL::Block<int, WidthT> wide_shadeindex_block;
         int bx[WidthT];
         int by[WidthT];
 
-        int batchSize = std::min(WidthT, nhits-oHitIndex);
-
-
-        // TODO: vectorize this loop
-        for(int bi=0; bi < batchSize; ++bi) {
-            int lHitIndex = oHitIndex + bi;
-            // A real renderer would use the hit index to access data to populate shader globals
-            int lx = lHitIndex%rwidth;
-            int ly = lHitIndex/rwidth;
-            int rx = roi.xbegin + lx;
-            int ry = roi.ybegin + ly;
-            setup_varying_shaderglobals (bi, sgBatch, shadingsys, rx, ry);
-
-            int shadeindex = ry * xres + rx;
-            wide_shadeindex_block[bi] = shadeindex;
-
-            if (print_outputs || !output_placement) {
-                // Remember the pixel x & y values to store the outputs after shading
-                bx[bi] = rx;
-                by[bi] = ry;
-            }
-
-        }
+        int batchSize = std::min(WidthT, end - first);
+        // A real renderer would use the hit index to access data to
+        // populate shader globals
+        setup_varying_shaderglobals (sgBatch, first, bx, by);
+        OSL_OMP_PRAGMA(omp simd simdlen(WidthT))
+        for (int bi = 0; bi < WidthT; ++bi)
+            wide_shadeindex_block[bi] = first + bi;
 
         // Actually run the shader for this point
         if (entrylayer_index.empty()) {
@@ -1710,8 +1997,6 @@ batched_shade_region (SimpleRenderer *rend, ShaderGroup *shadergroup, OIIO::ROI
         {
             batched_save_outputs<WidthT>(rend, shadingsys, ctx, shadergroup, batchSize, bx, by);
         }
-
-        oHitIndex += batchSize;
     }
 
     // We're done shading with this context.
@@ -1720,6 +2005,92 @@ batched_shade_region (SimpleRenderer *rend, ShaderGroup *shadergroup, OIIO::ROI
 }
 #endif
 
+// Write the --bench results as JSON: the time of each iteration and
+// statistics of them, how the setup time was split between optimizing the
+// shader group and JITing it, and the shading and texture systems'
+// counters.
+static void
+write_bench_results (ShadingSystem* shadingsys, std::vector<double> itertimes,
+                     double setuptime, double warmuptime)
+{
+    auto stat_float = [&](string_view name) {
+        float val = 0.0f;
+        shadingsys->getattribute (name, TypeDesc::FLOAT, &val);
+        return val;
+    };
+    auto stat_int64 = [&](string_view name) {
+        long long val = 0;
+        shadingsys->getattribute (name, TypeDesc::INT64, &val);
+        return val;
+    };
+
+    const double npoints = double(xres) * double(yres);
+    std::string iterlist;
+    double total = 0.0;
+    for (double t : itertimes) {
+        iterlist += OSL::fmtformat("{}{:.6f}", iterlist.size() ? ", " : "", t);
+        total += t;
+    }
+    std::sort (itertimes.begin(), itertimes.end());
+    // Nearest-rank percentile of the sorted times
+    auto percentile = [&](double p) {
+        size_t rank = size_t(std::ceil(p * itertimes.size()));
+        return itertimes[std::min(std::max(rank, size_t(1)), itertimes.size()) - 1];
+    };
+    double median = percentile(0.5);
+
+    std::string json;
+    json += "{\n";
+    json += OSL::fmtformat("  \"osl_version\": \"{}\",\n", OSL_LIBRARY_VERSION_STRING);
+    json += OSL::fmtformat("  \"resolution\": [{}, {}],\n", xres, yres);
+    json += OSL::fmtformat("  \"batched\": {},\n", batched ? "true" : "false");
+    json += OSL::fmtformat("  \"batch_width\": {},\n", batched ? batch_size : 0);
+    json += OSL::fmtformat("  \"threads\": {},\n", num_threads);
+    json += OSL::fmtformat("  \"iterations\": {},\n", itertimes.size());
+    json += OSL::fmtformat("  \"iteration_seconds\": [{}],\n", iterlist);
+    json += OSL::fmtformat("  \"min_seconds\": {:.6f},\n", itertimes.front());
+    json += OSL::fmtformat("  \"median_seconds\": {:.6f},\n", median);
+    json += OSL::fmtformat("  \"p95_seconds\": {:.6f},\n", percentile(0.95));
+    json += OSL::fmtformat("  \"mean_seconds\": {:.6f},\n", total / itertimes.size());
+    json += OSL::fmtformat("  \"points_per_second\": {:.1f},\n",
+                           median > 0.0 ? npoints / median : 0.0);
+    json += OSL::fmtformat("  \"setup_seconds\": {:.6f},\n", setuptime);
+    json += OSL::fmtformat("  \"warmup_seconds\": {:.6f},\n", warmuptime);
+    json += OSL::fmtformat("  \"optimize_seconds\": {:.6f},\n", stat_float("stat:optimization_time"));
+    json += OSL::fmtformat("  \"jit_seconds\": {:.6f},\n", stat_float("stat:total_llvm_time"));
+    json += OSL::fmtformat("  \"execute_seconds\": {:.6f},\n", total);
+    json += OSL::fmtformat("  \"getattribute_calls\": {},\n", stat_int64("stat:getattribute_calls"));
+    json += OSL::fmtformat("  \"get_userdata_calls\": {},\n", stat_int64("stat:get_userdata_calls"));
+    json += OSL::fmtformat("  \"noise_calls\": {},\n", stat_int64("stat:noise_calls"));
+    // Lookups of each kind, and how many of them OIIO took a batch at a time
+    for (const char* kind : { "texture", "texture3d", "environment" }) {
+        for (const char* stat : { "queries", "batches" }) {
+            long long val = 0;
+            shadingsys->texturesys()->getattribute (
+                OSL::fmtformat("stat:{}_{}", kind, stat), TypeDesc::INT64,
+                &val);
+            json += OSL::fmtformat("  \"{}_{}\": {},\n", kind, stat, val);
+        }
+    }
+    json += OSL::fmtformat("  \"shadingsys_memory_peak\": {},\n", stat_int64("stat:memory_peak"));
+    json += OSL::fmtformat("  \"process_memory_peak\": {}\n", OIIO::Sysutil::memory_used(true));
+    json += "}\n";
+
+    if (benchfile == "-") {
+        std::cout << json;
+        return;
+    }
+    OIIO::ofstream out;
+    OIIO::Filesystem::open (out, benchfile);
+    if (! out) {
+        std::cerr << "ERROR: Could not write benchmark results to " << benchfile << "\n";
+        return;
+    }
+    out << json;
+}
+
+
+
 static void synchio() {
     // Synch all writes to stdout & stderr now (mostly for Windows)
     std::cout.flush();
@@ -1747,6 +2118,11 @@ test_shade (int argc, const char *argv[])
 
     SimpleRenderer *rend = nullptr;
 #ifdef OSL_USE_OPTIX
+#if OPTIX_VERSION >= 70000
+    if (use_cuda)
+        rend = new CudaGridRenderer;
+    else
+#endif
     if (use_optix)
         rend = new OptixGridRenderer;
     else
@@ -1757,6 +2133,7 @@ test_shade (int argc, const char *argv[])
     if (debug1 || verbose)
         rend->errhandler().verbosity (ErrorHandler::VERBOSE);
     rend->attribute("saveptx", (int)saveptx);
+    rend->attribute("attribute_handles", (int)attribute_handles);
 
     // Hand the userdata options from the command line over to the renderer
     rend->userdata.merge(userdata);
@@ -1792,6 +2169,27 @@ test_shade (int argc, const char *argv[])
     // locked (i.e. no per-geometry override):
     shadingsys->attribute("lockgeom", 1);
 
+    // Replaying a capture needs no group or grid of our own
+    if (replayfile.size()) {
+        set_shadingsys_options ();
+        OIIO::Timer replaytimer;
+        int npoints = shadingsys->replay (replayfile, iters);
+        double replaytime = replaytimer();
+        int retcode = EXIT_SUCCESS;
+        if (npoints < 0) {
+            retcode = EXIT_FAILURE;
+        } else {
+            std::cout << "Replayed " << npoints << " points\n";
+            if (runstats || debug1)
+                std::cout << "Run   : " << OIIO::Strutil::timeintervalformat (replaytime,4) << "\n"
+                          << shadingsys->getstats (5) << "\n";
+        }
+        rend->clear();
+        delete shadingsys;
+        delete rend;
+        return retcode;
+    }
+
     // Now we declare our shader.
     // 
     // Each material in the scene is comprised of a "shader group."
@@ -1856,6 +2254,7 @@ test_shade (int argc, const char *argv[])
         shadingsys->attribute (shadergroup.get(), "groupname", groupname);
 
     // Now set up the connections
+    std::vector<ShaderConnection> indexed_connections;
     for (size_t i = 0;  i < connections.size();  i += 4) {
         if (i+3 < connections.size()) {
             std::cout << "Connect " 
@@ -1863,6 +2262,20 @@ test_shade (int argc, const char *argv[])
                       << " to " << connections[i+2] << "." << connections[i+3]
                       << "\n";
             synchio();
+            if (connect_by_index) {
+                ShaderConnection c;
+                if (! connection_indices (connections[i], connections[i+1],
+                                          c.srclayer, c.srcparam,
+                                          c.srcarrayindex, c.srcchannel)
+                    || ! connection_indices (connections[i+2], connections[i+3],
+                                             c.dstlayer, c.dstparam,
+                                             c.dstarrayindex, c.dstchannel)) {
+                    std::cerr << "ERROR: Unknown layer or parameter to connect\n";
+                    return EXIT_FAILURE;
+                }
+                indexed_connections.push_back (c);
+                continue;
+            }
             bool ok = shadingsys->ConnectShaders (*shadergroup,
                                                   connections[i],
                                                   connections[i+1],
@@ -1873,6 +2286,9 @@ test_shade (int argc, const char *argv[])
             }
         }
     }
+    if (indexed_connections.size()
+        && ! shadingsys->ConnectShaders (*shadergroup, indexed_connections))
+        return EXIT_FAILURE;
 
     // End the group
     shadingsys->ShaderGroupEnd (*shadergroup);
@@ -1908,6 +2324,18 @@ test_shade (int argc, const char *argv[])
     }
     if (archivegroup.size())
         shadingsys->archive_shadergroup (shadergroup.get(), archivegroup);
+    if (aot_in.size()) {
+        OIIO::ifstream in;
+        OIIO::Filesystem::open (in, aot_in, std::ios::in | std::ios::binary);
+        if (! in) {
+            std::cerr << "ERROR: Could not read " << aot_in << "\n";
+            return EXIT_FAILURE;
+        }
+        std::string precompiled ((std::istreambuf_iterator<char>(in)),
+                                 std::istreambuf_iterator<char>());
+        shadingsys->attribute (shadergroup.get(), "llvm_aot_object",
+                               TypeDesc::PTR, &precompiled);
+    }
 
     if (outputfiles.size())
         std::cout << "\n";
@@ -1935,6 +2363,65 @@ test_shade (int argc, const char *argv[])
     // Set up the image outputs requested on the command line
     setup_output_images (rend, shadingsys, shadergroup);
 
+    // Params given as instance data come from a block that every execute
+    // is handed as its userdata arena, rather than being compiled in.
+    if (instancedata.size()) {
+        std::vector<const char*> names;
+        for (auto&& pv : instancedata)
+            names.push_back (pv.name().c_str());
+        shadingsys->attribute (shadergroup.get(), "instance_parameters",
+                               TypeDesc(TypeDesc::STRING, names.size()),
+                               names.data());
+        int size = 0;
+        std::vector<int> offsets (instancedata.size());
+        shadingsys->getattribute (shadergroup.get(), "instance_data_size", size);
+        shadingsys->getattribute (shadergroup.get(), "instance_data_offsets",
+                                  TypeDesc(TypeDesc::INT, offsets.size()),
+                                  offsets.data());
+        instancedata_block.resize ((size + 7) / 8);
+        char* block = (char*)instancedata_block.data();
+        for (size_t i = 0;  i < instancedata.size();  ++i) {
+            if (offsets[i] >= 0)
+                memcpy (block + offsets[i], instancedata[i].data(),
+                        instancedata[i].type().size());
+        }
+        userdata_base_ptr = block;
+    }
+
+    // With async_optimize, execute() hands a group that isn't compiled
+    // yet to the background threads and returns false rather than wait.
+    // Check that it does, then wait for the group ourselves, so that the
+    // shading below gives the same results as without async_optimize.
+    int async_optimize = 0;
+    shadingsys->getattribute ("async_optimize", async_optimize);
+    if (async_optimize && !batched && !use_optix && !use_shade_image) {
+        int ready = 1;
+        shadingsys->getattribute (shadergroup.get(), "ready", ready);
+        OSL::PerThreadInfo *thread_info = shadingsys->create_thread_info();
+        ShadingContext *ctx = shadingsys->get_context (thread_info);
+        ShaderGlobals sg;
+        setup_shaderglobals (sg, shadingsys, 0, 0);
+        bool ran = shadingsys->execute (*ctx, *shadergroup, sg, false);
+        shadingsys->release_context (ctx);
+        shadingsys->destroy_thread_info (thread_info);
+        if (ready || ran)
+            std::cout << "ERROR: execute() waited for the group to be compiled\n";
+        if (! shadingsys->optimize_group_async (shadergroup.get()).get())
+            std::cout << "ERROR: the group could not be compiled in the background\n";
+        shadingsys->getattribute (shadergroup.get(), "ready", ready);
+        if (! ready)
+            std::cout << "ERROR: the group is not ready after compiling\n";
+    }
+
+    if (prefetch_textures) {
+        int before = 0, after = 0;
+        shadingsys->texturesys()->getattribute ("stat:unique_files", before);
+        shadingsys->prefetch_textures (shadergroup.get(), 0, true /*wait*/);
+        shadingsys->texturesys()->getattribute ("stat:unique_files", after);
+        std::cout << "Prefetching opened " << (after - before)
+                  << " texture files\n";
+    }
+
     if (debug1)
         test_group_attributes (shadergroup.get());
 
@@ -1965,8 +2452,10 @@ test_shade (int argc, const char *argv[])
     // Allow a settable number of iterations to "render" the whole image,
     // which is useful for time trials of things that would be too quick
     // to accurately time for a single iteration
+    std::vector<double> itertimes;
     for (int iter = 0;  iter < iters;  ++iter) {
         OIIO::ROI roi (0, xres, 0, yres);
+        OIIO::Timer itertimer;
 
         if (use_optix) {
             rend->render (xres, yres);
@@ -1983,16 +2472,28 @@ test_shade (int argc, const char *argv[])
 #else
 #if OSL_USE_BATCHED
             if (batched) {
+                // Split the grid's points (rather than its rows, as
+                // parallel_image would) evenly among the threads, so
+                // that even a single row of points keeps every thread
+                // busy, each shading its share with one context.
+                int npoints = xres * yres;
+                int chunk = std::max (batch_size, (npoints + num_threads - 1) / num_threads);
+                chunk = (chunk + batch_size - 1) / batch_size * batch_size;
                 if (batch_size == 16) {
-                    OIIO::ImageBufAlgo::parallel_image (roi, num_threads,
-                        [&](OIIO::ROI sub_roi)->void {
-                            batched_shade_region<16> (rend, shadergroup.get(), sub_roi, save);
+                    OIIO::parallel_for_chunked (0, npoints, chunk,
+                        [&](int64_t begin, int64_t end)->void {
+                            batched_shade_points<16> (rend, shadergroup.get(), int(begin), int(end), save);
+                        });
+                } else if (batch_size == 8) {
+                    OIIO::parallel_for_chunked (0, npoints, chunk,
+                        [&](int64_t begin, int64_t end)->void {
+                            batched_shade_points<8> (rend, shadergroup.get(), int(begin), int(end), save);
                         });
                 } else {
-                    ASSERT((batch_size == 8) && "Unsupport batch size");
-                    OIIO::ImageBufAlgo::parallel_image (roi, num_threads,
-                        [&](OIIO::ROI sub_roi)->void {
-                            batched_shade_region<8> (rend, shadergroup.get(), sub_roi, save);
+                    ASSERT((batch_size == 4) && "Unsupport batch size");
+                    OIIO::parallel_for_chunked (0, npoints, chunk,
+                        [&](int64_t begin, int64_t end)->void {
+                            batched_shade_points<4> (rend, shadergroup.get(), int(begin), int(end), save);
                         });
                 }
             } else
@@ -2015,9 +2516,16 @@ test_shade (int argc, const char *argv[])
                                          pv.data());
             }
         }
+        itertimes.push_back (itertimer());
     }
     double runtime = timer.lap();
 
+    if (constant_outputs)
+        report_constant_outputs (shadergroup.get());
+
+    if (benchfile.size())
+        write_bench_results (shadingsys, itertimes, setuptime, warmuptime);
+
     // This awkward condition preserves an output oddity from long ago,
     // eliminating the need to update hundreds of ref outputs.
     if (outputfiles.size() == 1 && outputfiles[0] == "null")
@@ -2055,6 +2563,18 @@ test_shade (int argc, const char *argv[])
         }
     }
 
+    if (aot_out.size()) {
+        std::string precompiled;
+        shadingsys->getattribute (shadergroup.get(), "llvm_aot_object",
+                                  TypeDesc::PTR, &precompiled);
+        OIIO::ofstream out;
+        OIIO::Filesystem::open (out, aot_out, std::ios::out | std::ios::binary);
+        if (precompiled.empty() || ! out)
+            std::cerr << "ERROR: Could not write precompiled group to " << aot_out << "\n";
+        else
+            out.write (precompiled.data(), precompiled.size());
+    }
+
     // Print some debugging info
     if (debug1 || runstats || profile) {
         double writetime = timer.lap();
@@ -0,0 +1,14 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Compile the group ahead of time, then shade by loading that code.
+command += testshade("--aot-out test.oslaot test")
+command += testshade("--aot-in test.oslaot test")
+
+# The same, with code for several ISAs, of which the loader picks the best
+# one this CPU runs.
+command += testshade("--options 'llvm_aot_isas=\"x64,SSE4.2\"' --aot-out fat.oslaot test")
+command += testshade("--aot-in fat.oslaot test")
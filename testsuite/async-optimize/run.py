@@ -0,0 +1,11 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# The same group compiled as usual, then in the background. With
+# async_optimize, testshade also checks that execute() doesn't wait for
+# the group to be compiled.
+command += testshade("-g 2 2 test")
+command += testshade("-g 2 2 --options async_optimize=2 test")
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# 13 points make full batches of 4 or 8 plus a partial one that only the
+# final flush runs, and the output must be the same as shading each point.
+command += testshade("-t 1 -g 13 1 --batchbuilder -o fout fout.tif --print test")
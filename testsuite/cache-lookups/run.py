@@ -0,0 +1,7 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+command += testshade("-O0 --options cache_lookups=1 -g 1 1 -layer alayer a -layer blayer b --connect alayer f_out blayer f_in")
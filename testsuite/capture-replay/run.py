@@ -0,0 +1,8 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+command += testshade("-g 1 1 --options capture=capture.bin --userdata:type=float udata 7 test")
+command += testshade("--replay capture.bin")
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Zero weights are always pruned; small ones only under the threshold
+command = testshade("test")
+command += testshade("--options closure_weight_threshold=0.01 test")
@@ -0,0 +1,15 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# testshade compiles every --inbuffer shader and --expr with one
+# OSLCompiler, so the expression and b are compiled by a reused one.
+compile_osl_files = False
+
+command = testshade("-t 1 -g 2 1 --inbuffer -layer alayer a "
+                    "-layer exprlayer --expr 'result = color(u);' "
+                    "-layer blayer b "
+                    "--connect alayer out blayer in "
+                    "--connect exprlayer result blayer c")
@@ -0,0 +1,15 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Connecting by index, all at once, must wire up the group just as
+# connecting by name does: whole values, a color component, and an
+# array element.
+group = ("-g 2 2 -layer alayer up -layer blayer down " +
+         "--connect alayer f blayer f --connect alayer c blayer c " +
+         "--connect alayer c[1] blayer x --connect alayer arr[1] blayer y " +
+         "--connect alayer arr blayer arr")
+command += testshade(group)
+command += testshade("--connect-by-index " + group)
@@ -0,0 +1,10 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# The values reported as constant must be the ones shading produces.
+args = "-g 2 2 -o fdefault fdefault.tif -o idefault idefault.tif -o Cvary Cvary.tif --print test"
+command += testshade(args)
+command += testshade("--constant-outputs " + args)
@@ -0,0 +1,8 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+command += testshade("-g 2 2 -layer alayer a --layer blayer b --connect alayer f_out blayer f_in")
+command += testshade("-g 2 2 --options opt_cross_layer_cse=1 -layer alayer a --layer blayer b --connect alayer f_out blayer f_in")
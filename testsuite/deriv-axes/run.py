@@ -0,0 +1,11 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Both partials, then x only. The last run poisons the unused y partials
+# with NaN (debuguninit), so any read of them would show in Dx.
+command += testshade("-g 2 2 --options opt_deriv_axes=0 test")
+command += testshade("-g 2 2 --options opt_deriv_axes=1 test")
+command += testshade("-g 2 2 --debuguninit --options opt_deriv_axes=1 test")
@@ -0,0 +1,10 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Renderer attributes declared constant for the optimizer to fold
+command = testshade("-t 1 --constattr:type=int studio quality 3 "
+                    "--constattr:type=int[3] \"\" pass:flags 4,5,6 "
+                    "--constattr \"\" pass:name beauty test")
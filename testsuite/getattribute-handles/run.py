@@ -0,0 +1,10 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Attributes looked up through the handles the renderer resolved them to
+# when JITing, then by name.
+command += testshade("-g 2 2 test")
+command += testshade("-g 2 2 --no-attribute-handles test")
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+layers = "-layer alayer a --layer blayer b --connect alayer f_out blayer f_in --connect alayer c_out blayer c_in"
+command += testshade(layers)
+command += testshade("--options opt_groupdata_layout=1 " + layers)
@@ -0,0 +1,13 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Layers a and c both feed d but not each other, so their input params can
+# share group data.
+layers = ("-layer alayer a --layer clayer c --layer dlayer d " +
+          "--connect alayer f_out dlayer f_a --connect alayer c_out dlayer c_a " +
+          "--connect clayer f_out dlayer f_c")
+command += testshade(layers)
+command += testshade("--options opt_groupdata_share=1 " + layers)
@@ -0,0 +1,11 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Kd, Cs and name come from the instance data block, Ks is compiled in
+command += testshade("-g 1 1 --instancedata Kd 0.75 "
+                     + "--instancedata:type=color Cs 0,0.5,1 "
+                     + "--instancedata name fromblock --param Ks 0.2 test")
+command += testshade("-g 1 1 test")
@@ -0,0 +1,12 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Layer b is only run for u > 2, which never happens here, so with
+# llvm_jit_lazy it's never compiled; the output must match compiling the
+# whole group up front. (python-jit-lazy checks that it isn't compiled.)
+layers = "-layer alayer a -layer blayer b --layer clayer c --connect alayer f_out clayer f_in --connect alayer c_out clayer c_in --connect blayer out clayer unused"
+command += testshade("-g 2 2 --options llvm_jit_orc=1 " + layers)
+command += testshade("-g 2 2 --options llvm_jit_orc=1,llvm_jit_lazy=1 " + layers)
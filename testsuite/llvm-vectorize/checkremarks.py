@@ -0,0 +1,16 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+from __future__ import print_function
+import sys
+
+with open(sys.argv[1]) as f:
+    remarks = [line for line in f if line.startswith("LLVM remark [")]
+
+print("loop vectorizer remarks:",
+      any("[loop-vectorize," in r for r in remarks))
+print("a loop was vectorized:",
+      any("[loop-vectorize, done]" in r for r in remarks))
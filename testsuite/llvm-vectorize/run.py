@@ -0,0 +1,16 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# With the aggressive preset, the array loops must still give the right
+# results, and with llvm_debug the loop vectorizer must report that it
+# vectorized them. The debug output is long, so it goes to its own file
+# and only the verdict goes to out.txt.
+command += testshade("--options llvm_opt_preset=aggressive "
+                     "-g 2 2 -o fout fout.tif --print test")
+command += (osl_app("testshade")
+            + "--options llvm_opt_preset=aggressive,llvm_debug=1 "
+            + "-g 2 2 -o fout fout.tif test > remarks.txt 2>&1 ;\n")
+command += pythonbin + " checkremarks.py remarks.txt >> out.txt ;\n"
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+command += testshade("--options math_precision=fast --param mode fast test")
+command += testshade("--options math_precision=accurate --param mode accurate test")
+command += testshade("--options math_precision=default --param mode default test")
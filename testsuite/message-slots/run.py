@@ -0,0 +1,7 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+command += testshade ("--options opt_message_slots=1 -layer alayer a --layer blayer b --connect alayer f_out blayer f_in --connect alayer c_out blayer c_in --connect alayer dummy blayer dummy")
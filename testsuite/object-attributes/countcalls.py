@@ -0,0 +1,14 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+from __future__ import print_function
+import json
+import sys
+
+for filename in sys.argv[1:]:
+    with open(filename) as f:
+        bench = json.load(f)
+    print(filename, "get_userdata calls:", bench["get_userdata_calls"])
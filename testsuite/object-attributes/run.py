@@ -0,0 +1,14 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Shade 4 rows of 4 points, each row a separate object, and count how
+# often the renderer is asked for the userdata: at every point, unless
+# it's named as an object attribute, then once per object.
+command += testshade("-t 1 -g 4 4 --userdata:type=float scale 2 --object-rows --bench every_point.json test")
+command += testshade("-t 1 -g 4 4 --userdata:type=float scale 2 --object-rows --object-attribute scale --bench per_object.json test")
+command += pythonbin + " countcalls.py every_point.json per_object.json >> out.txt ;\n"
+# The remembered value is still the right one
+command += testshade("-t 1 -g 2 2 --userdata:type=float scale 2 --object-rows --object-attribute scale -o fout fout.tif --print test")
@@ -0,0 +1,11 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Stopping the optimizer early, on a pass that changes little or on
+# running out of time, must not change what the shader computes.
+command += testshade("-g 2 2 test")
+command += testshade("--options opt_pass_min_change=0.5 -g 2 2 test")
+command += testshade("--options opt_time_budget_ms=0.000001 -g 2 2 test")
@@ -20,5 +20,8 @@ command += oslc ("-MM test.osl")
 # Test deps with custom target
 command += oslc ("-q -MMD -MF mycustom.d -MT customtarget test.osl")
 
-outputs = [ "test.d", "mydep.d", "mycustom.d", "out.txt" ]
+# Test deps with phony targets for the headers
+command += oslc ("-q -MMD -MP -MF myphony.d test.osl")
+
+outputs = [ "test.d", "mydep.d", "mycustom.d", "myphony.d", "out.txt" ]
 
@@ -0,0 +1,11 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+compile_osl_files = False
+
+# The shader must give the same results after oslc has simplified it.
+command = oslc ("-O2 test.osl")
+command += testshade ("test")
@@ -0,0 +1,13 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+compile_osl_files = False
+
+# The first compile preprocesses stdosl.h and fills the cache, the second
+# one starts from the cached copy. Both should see the same macros.
+command = oslc ("--header-cache-dir hcache -Dfoo=42 test.osl")
+command += oslc ("--header-cache-dir hcache -Dfoo=42 test.osl")
+command += testshade ("test")
@@ -0,0 +1,14 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+compile_osl_files = False
+
+# Compile several shaders in one oslc, two at a time. The messages should
+# come out in the order the files were given.
+command = oslc ("-j 2 first.osl second.osl third.osl")
+command += testshade ("first")
+command += testshade ("second")
+command += testshade ("third")
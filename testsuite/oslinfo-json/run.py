@@ -0,0 +1,6 @@
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+#!/usr/bin/env python 
+
+command = oslinfo("-r . -j 2 --json")
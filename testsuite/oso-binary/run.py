@@ -0,0 +1,12 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+compile_osl_files = False
+
+# Both the query library and the shading system should read binary oso.
+command = oslc ("--binary-oso test.osl")
+command += oslinfo ("-v test")
+command += testshade ("test")
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+group = "-g 1 1 -layer uplayer up -layer surflayer surf --connect uplayer x surflayer x -o a a.tif --print "
+command += testshade("--options output_variants=2 " + group)
+command += testshade("--options output_variants=2 --execoutput a " + group)
@@ -0,0 +1,51 @@
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# The benchmarks run by runperf.py: for each, the shaders it needs
+# compiled and the testshade arguments that set up and shade its group.
+# "{textures}" is replaced by the path of testsuite/common/textures.
+
+def deep_network (depth) :
+    args = ""
+    for i in range(depth) :
+        args += "--param seed {} --shader node n{} ".format(i, i)
+    for i in range(1, depth) :
+        args += "--connect n{} out n{} in ".format(i-1, i)
+    return args + "-o out null"
+
+benchmarks = {
+    # A layered PBR material with procedurally varied parameters
+    "uber" : {
+        "shaders" : [ "uber.osl" ],
+        "args" : "--shader uber uber -o Cout null",
+    },
+    # Many octaves of several kinds of noise, and a cellular pattern
+    "fractal" : {
+        "shaders" : [ "fractal.osl" ],
+        "args" : "--shader fractal fractal -o Cout null",
+    },
+    # Layers of texture lookups with varied options, and an environment
+    "texturing" : {
+        "shaders" : [ "texturing.osl" ],
+        "args" : ("--param colormap {textures}/grid.tx "
+                  "--param envmap {textures}/kitchen_probe.hdr "
+                  "--shader texturing tex -o Cout null"),
+    },
+    # A large closure tree with many kinds of lobes
+    "closures" : {
+        "shaders" : [ "closures.osl" ],
+        "args" : "--shader closures closures -o Cout null",
+    },
+    # Lots of setmessage/getmessage traffic between two layers
+    "messages" : {
+        "shaders" : [ "msgsend.osl", "msgrecv.osl" ],
+        "args" : ("--shader msgsend send --shader msgrecv recv "
+                  "--connect send done recv dummy -o Cout null"),
+    },
+    # A chain of 48 small nodes, as node-based lookdev tools build
+    "deepnetwork" : {
+        "shaders" : [ "node.osl" ],
+        "args" : deep_network(48),
+    },
+}
@@ -0,0 +1,130 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Run the performance testsuite: shade each benchmark of benchmarks.py with
+# "testshade --bench" in each of the requested modes, and compare the
+# median iteration time against the stored baseline for that benchmark and
+# mode.  Exits with status 1 if any benchmark fails to run or is slower
+# than its baseline by more than the tolerance.
+#
+# Timings only mean something on the machine they were taken on, so the
+# baselines are made with --update, on the machine that will check them
+# (see OSL_PERF_BASELINE_DIR in src/cmake/testing.cmake).  A benchmark
+# with no baseline yet is reported but doesn't fail.
+#
+# This is normally run by the "osl_perf" build target.
+
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+perfdir = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, perfdir)
+sys.dont_write_bytecode = True  # keep the source tree clean
+from benchmarks import benchmarks
+
+mode_flags = { "scalar" : "", "batched" : "--batched", "optix" : "--optix" }
+
+parser = argparse.ArgumentParser(description="Run the OSL performance testsuite")
+parser.add_argument("--testshade", default="testshade", help="testshade executable")
+parser.add_argument("--oslc", default="oslc", help="oslc executable")
+parser.add_argument("--workdir", default=".", help="Where to compile shaders and write results")
+parser.add_argument("--baselines", default=os.path.join(perfdir, "baselines"),
+                    help="Directory of baseline results")
+parser.add_argument("--modes", nargs="+", default=["scalar"],
+                    choices=sorted(mode_flags.keys()), help="Shading modes to run")
+parser.add_argument("--only", nargs="+", default=None, help="Run only these benchmarks")
+parser.add_argument("--tolerance", type=float, default=0.15,
+                    help="Allowed slowdown relative to the baseline (default: 0.15)")
+parser.add_argument("--iters", type=int, default=5, help="Iterations per benchmark")
+parser.add_argument("--res", type=int, default=256, help="Shade a res x res grid")
+parser.add_argument("--update", action="store_true",
+                    help="Store these results as the new baselines")
+args = parser.parse_args()
+
+textures = os.path.join(os.path.dirname(perfdir), "common", "textures")
+if not os.path.exists(args.workdir):
+    os.makedirs(args.workdir)
+if args.update and not os.path.exists(args.baselines):
+    os.makedirs(args.baselines)
+
+
+def run (cmd) :
+    # Run a command in the work directory, returning whether it succeeded
+    # and echoing its output if it didn't.
+    proc = subprocess.Popen(cmd, cwd=args.workdir, shell=True,
+                            stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    out = proc.communicate()[0]
+    if proc.returncode != 0 :
+        print("    FAILED: " + cmd)
+        print(out.decode("utf-8", "replace"))
+    return proc.returncode == 0
+
+
+failures = []
+regressions = []
+names = args.only if args.only else sorted(benchmarks.keys())
+for name in names :
+    if name not in benchmarks :
+        print("Unknown benchmark " + name)
+        failures.append(name)
+        continue
+    bench = benchmarks[name]
+    if not all(run('"{}" -q -o {} "{}"'.format(args.oslc,
+                                               os.path.splitext(s)[0] + ".oso",
+                                               os.path.join(perfdir, s)))
+               for s in bench["shaders"]) :
+        failures.append(name)
+        continue
+
+    baselinefile = os.path.join(args.baselines, name + ".json")
+    baseline = {}
+    if os.path.exists(baselinefile) :
+        with open(baselinefile) as f :
+            baseline = json.load(f)
+
+    for mode in args.modes :
+        result = "{}-{}.json".format(name, mode)
+        cmd = '"{}" {} -g {} {} --iters {} --bench {} {}'.format(
+                  args.testshade, mode_flags[mode], args.res, args.res,
+                  args.iters, result, bench["args"].format(textures=textures))
+        if not run(cmd) :
+            failures.append(name + " " + mode)
+            continue
+        with open(os.path.join(args.workdir, result)) as f :
+            stats = json.load(f)
+        median = stats["median_seconds"]
+        line = "{:<12} {:<8} median {:9.4f}s  p95 {:9.4f}s  {:12.0f} points/s".format(
+                   name, mode, median, stats["p95_seconds"],
+                   stats["points_per_second"])
+        if mode in baseline :
+            base = baseline[mode]["median_seconds"]
+            change = (median - base) / base if base > 0 else 0.0
+            line += "  {:+6.1f}% vs baseline".format(100.0 * change)
+            if change > args.tolerance and not args.update :
+                line += "  REGRESSION"
+                regressions.append(name + " " + mode)
+        else :
+            line += "  (no baseline)"
+        print(line)
+        sys.stdout.flush()
+        baseline[mode] = stats
+
+    if args.update :
+        with open(baselinefile, "w") as f :
+            json.dump(baseline, f, indent=2, sort_keys=True)
+            f.write("\n")
+
+if failures :
+    print("\nFailed to run: " + ", ".join(failures))
+if regressions :
+    print("\nSlower than baseline by more than {:.0f}%: {}".format(
+              100.0 * args.tolerance, ", ".join(regressions)))
+sys.exit(1 if (failures or regressions) else 0)
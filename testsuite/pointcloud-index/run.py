@@ -0,0 +1,17 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Bake a cloud along with its search index, then search it through the
+# memory mapped index.
+command += testshade("-g 16 16 --options pointcloud_bake_index=1 -od uint8 -o Cout out0.tif wrcloud")
+command += "test -f cloud.geo.oslpci && echo \"index written\" >> out.txt ;\n"
+command += testshade("-g 256 256 -param radius 0.1 -od uint8 -o Cout out2.tif rdcloud")
+
+outputs = [ "out0.tif", "out2.tif", "out.txt" ]
+
+# expect a few LSB failures
+failthresh = 0.008
+failpercent = 3
@@ -0,0 +1,17 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Bake a cloud along with a paged copy, then search it a page at a time
+# through a page cache too small to hold more than one page.
+command += testshade("-g 16 16 --options pointcloud_bake_pages=1 -od uint8 -o Cout out0.tif wrcloud")
+command += "test -f cloud.geo.oslpcp && echo \"paged copy written\" >> out.txt ;\n"
+command += testshade("-g 256 256 --options pointcloud_max_memory_MB=0 -param radius 0.1 -od uint8 -o Cout out2.tif rdcloud")
+
+outputs = [ "out0.tif", "out2.tif", "out.txt" ]
+
+# expect a few LSB failures
+failthresh = 0.008
+failpercent = 3
@@ -0,0 +1,61 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# These lines make us compatible with both Python 2 and 3
+from __future__ import print_function
+from __future__ import absolute_import
+
+import numpy as np
+import oslexec
+
+
+ss = oslexec.ShadingSystem()
+ss.attribute("searchpath:shader", ".")
+ss.attribute("dedupe_groups", 1)
+
+n = 100
+u = np.linspace(0, 1, n, dtype=np.float32)
+
+def group(scale, outputs=["fout"]):
+    return ss.shader_group("param float scale %d ; shader test layer1 ;" % scale,
+                           outputs=outputs)
+
+# Each group is shaded while the ones before it are still alive, so that
+# any identical one is there to share its code.
+base = group(2)
+same = group(2)
+other_param = group(3)
+more_outputs = group(2, ["fout", "gout"])
+entry = group(2)
+ss.attribute(entry, "entry_layers", ["layer1"])
+placed = group(2)
+ss.place_outputs(placed, {"fout": "float"})
+placed_same = group(2)
+ss.place_outputs(placed_same, {"fout": "float"})
+
+def check(name, g, scale, outputs=["fout"]):
+    ss.jit(g, batched=False)
+    result = {o: np.zeros(n, dtype=np.float32) for o in outputs}
+    ss.shade(g, result)
+    ok = np.allclose(result["fout"], scale * u)
+    if "gout" in result:
+        ok = ok and np.allclose(result["gout"], scale * u + 1)
+    print(name, "correct:", ok)
+
+check("identical to the first", base, 2)
+check("identical", same, 2)
+check("other parameter", other_param, 3)
+check("more renderer outputs", more_outputs, 2, ["fout", "gout"])
+check("entry layers", entry, 2)
+check("placed outputs", placed, 2)
+check("identical placed outputs", placed_same, 2)
+
+# Only the two identical pairs share: the others differ in a parameter
+# or in attributes set after ShaderGroupEnd.
+print("checked:", ss.getattribute("stat:groups_dedupe_checked"))
+print("deduped:", ss.getattribute("stat:groups_deduped"))
+
+print("\nDone.")
@@ -0,0 +1,43 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# These lines make us compatible with both Python 2 and 3
+from __future__ import print_function
+from __future__ import absolute_import
+
+import os
+import shutil
+import tempfile
+import numpy as np
+import oslexec
+
+
+cachedir = tempfile.mkdtemp()
+u = np.linspace(0, 1, 100, dtype=np.float32)
+
+# Each ShadingSystem stands in for a process of its own, sharing only
+# the cache directory.
+def run(name, scale):
+    ss = oslexec.ShadingSystem()
+    ss.attribute("searchpath:shader", ".")
+    ss.attribute("jit_cache_dir", cachedir)
+    group = ss.shader_group("param float scale %g ; shader test layer1 ;" % scale,
+                            outputs=["fout"])
+    ss.jit(group, batched=False)
+    fout = np.zeros(len(u), dtype=np.float32)
+    ss.shade(group, {"fout": fout}, u=u)
+    print(name, "- hits:", ss.getattribute("stat:jit_cache_hits"),
+          "misses:", ss.getattribute("stat:jit_cache_misses"),
+          "correct:", np.allclose(fout, scale * u))
+
+run("first", 2)
+print("code left in the cache:", len(os.listdir(cachedir)) == 1)
+run("second, same group", 2)
+run("third, other parameter", 3)
+
+shutil.rmtree(cachedir)
+
+print("\nDone.")
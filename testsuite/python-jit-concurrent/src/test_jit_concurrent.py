@@ -0,0 +1,55 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# These lines make us compatible with both Python 2 and 3
+from __future__ import print_function
+from __future__ import absolute_import
+
+import threading
+import numpy as np
+import oslexec
+
+
+ss = oslexec.ShadingSystem()
+ss.attribute("searchpath:shader", ".")
+
+n = 1000
+u = np.linspace(0, 1, n, dtype=np.float32)
+v = np.zeros(n, dtype=np.float32)
+expected = sum(np.sin(3 * u * (i + 1)) for i in range(4))
+
+def shade(group):
+    fout = np.zeros(n, dtype=np.float32)
+    ss.shade(group, {"fout": fout}, u=u, v=v)
+    return fout
+
+# JIT the same group one point at a time and in batches, from two
+# threads at once, many times over. The two JITs take separate locks, and
+# with a lock held the wrong way round this would deadlock.
+deadlocked = False
+correct = True
+for i in range(20):
+    scalar = ss.shader_group("param float scale 3 ; shader test layer1 ;",
+                             outputs=["fout"])
+    batched = scalar.copy()
+    threads = [threading.Thread(target=ss.jit, args=(scalar, False)),
+               threading.Thread(target=ss.jit, args=(batched, True))]
+    for t in threads:
+        t.daemon = True
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join(60)
+        deadlocked |= t.is_alive()
+    if deadlocked:
+        break
+    correct &= scalar.jitted and scalar.batch_width == 0 and batched.jitted
+    correct &= np.allclose(shade(scalar), expected, atol=1e-5)
+    correct &= np.allclose(shade(batched), expected, atol=1e-5)
+print("both JITs finished:", not deadlocked)
+print("both versions correct:", correct)
+
+print("\nDone.")
@@ -0,0 +1,44 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# These lines make us compatible with both Python 2 and 3
+from __future__ import print_function
+from __future__ import absolute_import
+
+import numpy as np
+import oslexec
+
+
+ss = oslexec.ShadingSystem()
+ss.attribute("searchpath:shader", ".")
+ss.attribute("max_jit_memory_MB", 1)
+
+n = 100
+u = np.linspace(0, 1, n, dtype=np.float32)
+
+def shade(group):
+    fout = np.zeros(n, dtype=np.float32)
+    ss.shade(group, {"fout": fout}, u=u)
+    return fout
+
+# Keep JITing new groups, all of them kept alive, until the oldest have
+# to be evicted to stay under the budget.
+groups = []
+correct = True
+while ss.getattribute("stat:groups_evicted") == 0 and len(groups) < 2000:
+    scale = len(groups) + 2
+    group = ss.shader_group("param float scale %d ; shader test layer1 ;" % scale,
+                            outputs=["fout"])
+    ss.jit(group, batched=False)
+    correct &= np.allclose(shade(group), scale * u)
+    groups.append(group)
+print("evicted groups:", ss.getattribute("stat:groups_evicted") > 0)
+print("correct before eviction:", correct)
+
+# The first group was the first to go; running it again JITs it again.
+print("correct after re-JIT:", np.allclose(shade(groups[0]), 2 * u))
+
+print("\nDone.")
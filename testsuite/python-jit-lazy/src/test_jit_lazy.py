@@ -0,0 +1,45 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# These lines make us compatible with both Python 2 and 3
+from __future__ import print_function
+from __future__ import absolute_import
+
+import numpy as np
+import oslexec
+
+
+ss = oslexec.ShadingSystem()
+ss.attribute("searchpath:shader", ".")
+ss.attribute("llvm_jit_orc", 1)
+ss.attribute("llvm_jit_lazy", 1)
+
+def compiled():
+    return ss.getattribute("stat:jit_lazy_functions_compiled", "int64")
+
+def shade(group, u):
+    fout = np.zeros(len(u), dtype=np.float32)
+    ss.shade(group, {"fout": fout}, u=u)
+    return fout
+
+# Layer b only runs for u > 2, so it isn't compiled until then.
+group = ss.shader_group("shader a alayer ; shader b blayer ; shader c clayer ; "
+                        "connect alayer.f_out clayer.f_in ; "
+                        "connect blayer.out clayer.unused ;",
+                        outputs=["fout"])
+ss.jit(group, batched=False)
+before = compiled()
+
+u = np.array([0, 0.5, 1], dtype=np.float32)
+print("without b:", np.allclose(shade(group, u), 0.5 * u))
+unreached = compiled()
+print("compiled what ran:", unreached > before)
+
+u = np.array([3], dtype=np.float32)
+print("with b:", np.allclose(shade(group, u), 0.5 * u + 42 + u))
+print("compiled b once reached:", compiled() > unreached)
+
+print("\nDone.")
@@ -0,0 +1,42 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# These lines make us compatible with both Python 2 and 3
+from __future__ import print_function
+from __future__ import absolute_import
+
+import numpy as np
+import oslexec
+
+
+ss = oslexec.ShadingSystem()
+ss.attribute("searchpath:shader", ".")
+
+def live():
+    return ss.getattribute("stat:jit_memory_live", "int64")
+
+n = 100
+u = np.linspace(0, 1, n, dtype=np.float32)
+
+# Build, JIT and shade a group, then drop it. Its JIT code should go
+# with it, so doing that over and over must not add up.
+held = []
+after = []
+for i in range(8):
+    group = ss.shader_group("param float scale %d ; shader test layer1 ;" % (i + 2),
+                            outputs=["fout"])
+    before = live()
+    fout = np.zeros(n, dtype=np.float32)
+    ss.shade(group, {"fout": fout}, u=u)
+    held.append(live() > before)
+    del group
+    after.append(live())
+
+print("held while the group lives:", all(held))
+print("freed when the group goes:", ss.getattribute("stat:jit_memory_freed", "int64") > 0)
+print("no growth over groups:", after[-1] <= after[0])
+
+print("\nDone.")
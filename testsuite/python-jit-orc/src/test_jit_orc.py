@@ -0,0 +1,58 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# These lines make us compatible with both Python 2 and 3
+from __future__ import print_function
+from __future__ import absolute_import
+
+import numpy as np
+import oslexec
+
+
+ss = oslexec.ShadingSystem()
+ss.attribute("searchpath:shader", ".")
+ss.attribute("llvm_jit_orc", 1)
+
+def live():
+    return ss.getattribute("stat:jit_memory_live", "int64")
+
+n = 100
+u = np.linspace(0, 1, n, dtype=np.float32)
+
+def shade(group):
+    fout = np.zeros(n, dtype=np.float32)
+    ss.shade(group, {"fout": fout}, u=u)
+    return fout
+
+# Groups of the same name are linked into the one shared session side by
+# side; each must still run its own code.
+groups = [ss.shader_group("param float scale %d ; shader test layer1 ;" % (i + 2),
+                          outputs=["fout"], name="orc")
+          for i in range(4)]
+print("each group runs its own code:",
+      all(np.allclose(shade(g), (i + 2) * u) for i, g in enumerate(groups)))
+del groups
+
+# A group's code goes with it, so building and dropping groups over and
+# over must not add up.
+held = []
+after = []
+correct = True
+for i in range(8):
+    group = ss.shader_group("param float scale %d ; shader test layer1 ;" % (i + 2),
+                            outputs=["fout"], name="orc")
+    before = live()
+    correct &= np.allclose(shade(group), (i + 2) * u)
+    held.append(live() > before)
+    del group
+    after.append(live())
+
+print("correct output:", correct)
+print("held while the group lives:", all(held))
+print("freed when the group goes:", ss.getattribute("stat:jit_memory_freed", "int64") > 0)
+print("no growth over groups:", after[-1] <= after[0])
+
+print("\nDone.")
@@ -0,0 +1,50 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# These lines make us compatible with both Python 2 and 3
+from __future__ import print_function
+from __future__ import absolute_import
+
+import time
+import numpy as np
+import oslexec
+
+
+ss = oslexec.ShadingSystem()
+ss.attribute("searchpath:shader", ".")
+ss.attribute("llvm_pgo_samples", 5000)
+
+u = np.linspace(0, 1, 1000, dtype=np.float32)
+expected = 4 * np.where(u > 0.9, 3, u)
+
+def shade(group):
+    fout = np.zeros(len(u), dtype=np.float32)
+    ss.shade(group, {"fout": fout}, u=u)
+    return fout
+
+group = ss.shader_group("param float scale 3 ; shader test layer1 ;",
+                        outputs=["fout"])
+ss.jit(group, batched=False)
+
+# Every execution of the group is a sample. Until there have been 5000 of
+# them it runs its instrumented code, and isn't re-JITed.
+correct = True
+for i in range(4):
+    correct &= np.allclose(shade(group), expected)
+print("not re-JITed before enough samples:",
+      ss.getattribute("stat:groups_pgo_rejitted") == 0)
+
+# The 5000th queues it to be re-JITed with its branch profile, and
+# shading goes on, with the new code once it's swapped in.
+deadline = time.time() + 60
+correct &= np.allclose(shade(group), expected)
+while ss.getattribute("stat:groups_pgo_rejitted") == 0 and time.time() < deadline:
+    correct &= np.allclose(shade(group), expected)
+print("re-JITed with its profile:", ss.getattribute("stat:groups_pgo_rejitted") == 1)
+print("correct before and during the swap:", correct)
+print("correct after the swap:", np.allclose(shade(group), expected))
+
+print("\nDone.")
@@ -0,0 +1,43 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# These lines make us compatible with both Python 2 and 3
+from __future__ import print_function
+from __future__ import absolute_import
+
+import time
+import numpy as np
+import oslexec
+
+
+ss = oslexec.ShadingSystem()
+ss.attribute("searchpath:shader", ".")
+ss.attribute("llvm_jit_tiered", 1)
+
+n = 100000
+u = np.linspace(0, 1, n, dtype=np.float32)
+expected = np.where(u > 0.5, 3 * u, 3 + u)
+
+def shade(group):
+    fout = np.zeros(n, dtype=np.float32)
+    ss.shade(group, {"fout": fout}, u=u)
+    return fout
+
+group = ss.shader_group("param float scale 3 ; shader test layer1 ;",
+                        outputs=["fout"])
+ss.jit(group, batched=False)
+
+# Keep shading, on all threads, while the group is re-JITed in the
+# background and its new code swapped in under them.
+correct = True
+deadline = time.time() + 60
+while ss.getattribute("stat:groups_rejitted") == 0 and time.time() < deadline:
+    correct &= np.allclose(shade(group), expected)
+print("re-JITed:", ss.getattribute("stat:groups_rejitted") == 1)
+print("correct before and during the swap:", correct)
+print("correct after the swap:", np.allclose(shade(group), expected))
+
+print("\nDone.")
@@ -0,0 +1,54 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# These lines make us compatible with both Python 2 and 3
+from __future__ import print_function
+from __future__ import absolute_import
+
+import numpy as np
+import oslexec
+
+
+ss = oslexec.ShadingSystem()
+ss.attribute("searchpath:shader", ".")
+group = ss.shader_group("param float scale 2 ; shader test layer1 ;",
+                        outputs=["Cout", "fout", "iout"])
+print("outputs:", group.outputs)
+
+# Shade more points than fit in one batch or one thread's chunk of work,
+# and a count that isn't a multiple of the batch width.
+n = 5003
+P = np.arange(3 * n, dtype=np.float32).reshape(n, 3)
+N = np.zeros((n, 3), dtype=np.float32)
+N[:, 2] = 1
+u = np.linspace(0, 1, n, dtype=np.float32)
+v = np.linspace(1, 0, n, dtype=np.float32)
+Cout = np.zeros((n, 3), dtype=np.float32)
+fout = np.zeros(n, dtype=np.float32)
+iout = np.zeros(n, dtype=np.int32)
+ss.shade(group, {"Cout": Cout, "fout": fout, "iout": iout},
+         P=P, N=N, u=u, v=v)
+print("jitted:", group.jitted)
+print("Cout matches:", np.allclose(Cout, 2 * P))
+print("fout matches:", np.allclose(fout, u + 10 * v + 1, atol=1e-4))
+print("iout matches:", np.array_equal(iout, np.floor(u * 4).astype(np.int32)))
+
+# Outputs are written in place, so arrays of the wrong type or layout are
+# refused rather than silently copied.
+try:
+    ss.shade(group, {"fout": np.zeros(n, dtype=np.float64)}, u=u)
+except TypeError as e:
+    print("TypeError:", e)
+try:
+    ss.shade(group, {"fout": np.zeros((n, 2), dtype=np.float32)[:, 0]}, u=u)
+except ValueError as e:
+    print("ValueError:", e)
+try:
+    ss.shade(group, {"nothere": fout}, u=u)
+except KeyError as e:
+    print("KeyError:", e)
+
+print("\nDone.")
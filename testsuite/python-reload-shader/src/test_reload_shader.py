@@ -0,0 +1,49 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# These lines make us compatible with both Python 2 and 3
+from __future__ import print_function
+from __future__ import absolute_import
+
+import numpy as np
+import oslexec
+
+
+groupspec = "param float scale 2 ; shader test layer1 ;"
+n = 100
+u = np.linspace(0, 1, n, dtype=np.float32)
+
+def shade(ss, group):
+    fout = np.zeros(n, dtype=np.float32)
+    ss.shade(group, {"fout": fout}, u=u)
+    return fout
+
+# The new version of "test", as if it had been edited and recompiled.
+with open("newtest.oso") as f:
+    newtest = f.read().replace("shader newtest", "shader test")
+
+ss = oslexec.ShadingSystem()
+ss.attribute("searchpath:shader", ".")
+ss.attribute("allow_shader_replacement", 1)
+group = ss.shader_group(groupspec, outputs=["fout"])
+ss.jit(group, batched=False)
+print("before reload matches:", np.allclose(shade(ss, group), 2 * u))
+
+# Reloading switches the already compiled group over, keeping its
+# parameter values.
+print("reloaded:", ss.reload_shader("test", newtest))
+reloaded = shade(ss, group)
+print("after reload matches:", np.allclose(reloaded, 2 * u + 10))
+
+# It must shade just like a group built from the new version to begin with.
+fresh_ss = oslexec.ShadingSystem()
+fresh_ss.load_memory_compiled_shader("test", newtest)
+fresh_group = fresh_ss.shader_group(groupspec, outputs=["fout"])
+fresh_ss.jit(fresh_group, batched=False)
+print("same as fresh group:",
+      np.array_equal(reloaded, shade(fresh_ss, fresh_group)))
+
+print("\nDone.")
@@ -0,0 +1,42 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# These lines make us compatible with both Python 2 and 3
+from __future__ import print_function
+from __future__ import absolute_import
+
+import numpy as np
+import oslexec
+
+
+ss = oslexec.ShadingSystem()
+ss.attribute("searchpath:shader", ".")
+group = ss.shader_group("shader test layer1 ;", outputs=["fout"])
+n = 100
+fout = np.zeros(n, dtype=np.float32)
+ss.shade(group, {"fout": fout}, u=np.linspace(0, 1, n, dtype=np.float32))
+
+# Nothing runs between these calls, so every value retrieved at once must
+# equal the same stat retrieved by itself.
+stats = ss.stats()
+print("num_names matches:", len(stats) == ss.getattribute("stat:num_names"))
+mismatched = []
+for name, value in stats.items():
+    single = ss.getattribute(name, "int")
+    if single is None:
+        single = ss.getattribute(name, "int64")
+    if single is None:
+        single = ss.getattribute(name, "float")
+        if single is not None:
+            value = float(np.float32(value))
+    if single != value:
+        mismatched.append(name)
+print("mismatched:", mismatched)
+print("masters:", stats["stat:masters"])
+print("groups_compiled:", stats["stat:groups_compiled"])
+print("unknown:", ss.getattribute("stat:no_such_stat"))
+
+print("\nDone.")
@@ -0,0 +1,45 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# These lines make us compatible with both Python 2 and 3
+from __future__ import print_function
+from __future__ import absolute_import
+
+import numpy as np
+import oslexec
+
+
+ss = oslexec.ShadingSystem()
+ss.attribute("searchpath:shader", ".")
+
+# An odd number of points, so the last batch is a partial one
+n = 1001
+u = np.linspace(0, 1, n, dtype=np.float32)
+scale = np.linspace(1, 2, n, dtype=np.float32)
+tint = np.stack([np.linspace(0, 1, n), np.full(n, 0.5),
+                 np.linspace(1, 0, n)], axis=1).astype(np.float32)
+
+# Batched code loads the userdata from the blocks shade fills in for each
+# batch. Shading one point at a time asks the renderer, which has none,
+# so the parameters keep their defaults.
+group = ss.shader_group("shader test layer1 ;", outputs=["fout", "Cout"])
+ss.place_userdata(group, {"scale": "float", "tint": "color"})
+batched = ss.jit(group) > 0
+fout = np.zeros(n, dtype=np.float32)
+Cout = np.zeros((n, 3), dtype=np.float32)
+ss.shade(group, {"fout": fout, "Cout": Cout}, u=u,
+         userdata={"scale": scale, "tint": tint})
+if batched:
+    correct = (np.allclose(fout, scale * u)
+               and np.allclose(Cout, tint * u[:, np.newaxis]))
+else:
+    correct = (np.allclose(fout, u)
+               and np.allclose(Cout, np.outer(u, [1, 1, 1])))
+print("placed values when batched, defaults otherwise:", correct)
+calls = ss.getattribute("stat:get_userdata_calls", "int64")
+print("asked the renderer only when not batched:", (calls == 0) == batched)
+
+print("\nDone.")
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# scale is not lockgeom=0, so the optimizer folds it into the code, and
+# changing it means optimizing the group again.
+command += testshade ("-g 1 1 --options reparam_reoptimize=1 --layer testlay -param scale 5.0 test -iters 2 -reparam testlay scale 15.0")
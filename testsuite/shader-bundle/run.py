@@ -0,0 +1,15 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+compile_osl_files = False
+
+# No .oso files are written, so every master must come from a bundle,
+# whether it holds text or binary oso.
+command = oslc ("--bundle text.oslb upstream.osl")
+command += oslc ("--binary-oso --bundle binary.oslb downstream.osl")
+command += testshade ("--bundle text.oslb --bundle binary.oslb "
+                      "-layer up upstream --layer down downstream "
+                      "--connect up f_out down f_in")
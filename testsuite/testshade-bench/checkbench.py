@@ -0,0 +1,19 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+from __future__ import print_function
+import json
+import sys
+
+with open(sys.argv[1]) as f:
+    bench = json.load(f)
+
+print("keys:", " ".join(sorted(bench.keys())))
+print("resolution:", bench["resolution"])
+print("iterations:", bench["iterations"], len(bench["iteration_seconds"]))
+print("min <= median <= p95:",
+      bench["min_seconds"] <= bench["median_seconds"] <= bench["p95_seconds"])
+print("points_per_second >= 0:", bench["points_per_second"] >= 0)
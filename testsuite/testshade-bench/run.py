@@ -0,0 +1,10 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# The timings change from run to run, so check only that the benchmark
+# results are well formed and consistent.
+command += testshade("-g 16 16 --iters 3 --bench bench.json test")
+command += pythonbin + " checkbench.py bench.json >> out.txt ;\n"
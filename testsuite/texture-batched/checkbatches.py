@@ -0,0 +1,22 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# A batch as wide as OIIO's texture batches (16) is handed to its batched
+# texture3d() and environment() whole. Any other width, or shading one
+# point at a time, makes one lookup per point.
+
+from __future__ import print_function
+import json
+import sys
+
+with open(sys.argv[1]) as f:
+    bench = json.load(f)
+
+npoints = bench["resolution"][0] * bench["resolution"][1]
+whole_batches = (bench["batch_width"] == 16)
+for kind in ("texture3d", "environment"):
+    expected = npoints // 16 if whole_batches else 0
+    print(kind, "batches as expected:", bench[kind + "_batches"] == expected)
@@ -0,0 +1,12 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+command += oiiotool ("-pattern fill:topleft=0,0,0:topright=1,0,0:bottomleft=0,1,0:bottomright=1,1,1 256x128 3 -d uint8 -oenv ramp.env", silent=True)
+
+# Shade 256 points, and check how the texture3d and environment lookups
+# reached the TextureSystem (see checkbatches.py)
+command += testshade("-g 16 16 -o Cvol vol.tif -o Cenv env.tif --bench bench.json test")
+command += pythonbin + " checkbatches.py bench.json >> out.txt ;\n"
@@ -0,0 +1,14 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+command += oiiotool ("--no-clobber -pattern constant:color=.25,.5,.75,.125 64x64 4 -d float -otex rgba.tx", silent=True)
+
+# Shade 4 points with the two lookups separate, then coalesced, and count
+# the texture queries: 2 per point, then 1, with the same results.
+args = "-t 1 -g 2 2 -o Cout Cout.tif -o aout aout.tif --print test"
+command += testshade("--bench separate.json " + args)
+command += testshade("--options opt_texture_coalesce=1 --bench coalesced.json " + args)
+command += pythonbin + " countqueries.py separate.json coalesced.json >> out.txt ;\n"
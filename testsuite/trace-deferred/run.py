@@ -0,0 +1,10 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Deferred trace() must give the same results as tracing immediately.
+args = "-g 2 2 -o dist dist.tif -o Nhit Nhit.tif -o hits hits.tif --print test"
+command += testshade(args)
+command += testshade("--options deferred_trace=1 " + args)